@@ -16,6 +16,7 @@
 #include "qemu/osdep.h"
 #include "qemu/error-report.h"
 #include "qemu/main-loop.h"
+#include "qemu/timer.h"
 #include "accel/accel-cpu-ops.h"
 #include "system/kvm.h"
 #include "system/kvm_int.h"
@@ -26,21 +27,31 @@
 
 #include <linux/kvm.h>
 #include "kvm-cpus.h"
+#include "trace.h"
 
 static void *kvm_vcpu_thread_fn(void *arg)
 {
     CPUState *cpu = arg;
+    int64_t start, created, locked;
     int r;
 
     rcu_register_thread();
 
-    bql_lock();
     qemu_thread_get_self(cpu->thread);
     cpu->thread_id = qemu_get_thread_id();
     current_cpu = cpu;
 
+    start = get_clock();
+    kvm_create_vcpu_unlocked(cpu, &error_fatal);
+    created = get_clock();
+
+    bql_lock();
+    locked = get_clock();
     r = kvm_init_vcpu(cpu, &error_fatal);
     kvm_init_cpu_signals(cpu);
+    trace_kvm_vcpu_thread_init(cpu->cpu_index, (created - start) / SCALE_US,
+                               (locked - created) / SCALE_US,
+                               (get_clock() - locked) / SCALE_US);
 
     /* signal CPU creation */
     cpu_thread_signal_created(cpu);
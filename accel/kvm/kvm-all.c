@@ -55,6 +55,7 @@
 
 #include "hw/core/boards.h"
 #include "system/stats.h"
+#include "system/system.h"
 
 /* This check must be after config-host.h is included */
 #ifdef CONFIG_EVENTFD
@@ -425,6 +426,7 @@ static void kvm_park_vcpu(CPUState *cpu)
     vcpu = g_malloc0(sizeof(*vcpu));
     vcpu->vcpu_id = kvm_arch_vcpu_id(cpu);
     vcpu->kvm_fd = cpu->kvm_fd;
+    QEMU_LOCK_GUARD(&kvm_state->kvm_parked_vcpus_lock);
     QLIST_INSERT_HEAD(&kvm_state->kvm_parked_vcpus, vcpu, node);
 }
 
@@ -433,12 +435,14 @@ static int kvm_unpark_vcpu(KVMState *s, unsigned long vcpu_id)
     struct KVMParkedVcpu *cpu;
     int kvm_fd = -ENOENT;
 
-    QLIST_FOREACH(cpu, &s->kvm_parked_vcpus, node) {
-        if (cpu->vcpu_id == vcpu_id) {
-            QLIST_REMOVE(cpu, node);
-            kvm_fd = cpu->kvm_fd;
-            g_free(cpu);
-            break;
+    WITH_QEMU_LOCK_GUARD(&s->kvm_parked_vcpus_lock) {
+        QLIST_FOREACH(cpu, &s->kvm_parked_vcpus, node) {
+            if (cpu->vcpu_id == vcpu_id) {
+                QLIST_REMOVE(cpu, node);
+                kvm_fd = cpu->kvm_fd;
+                g_free(cpu);
+                break;
+            }
         }
     }
 
@@ -451,6 +455,7 @@ static void kvm_reset_parked_vcpus(KVMState *s)
 {
     struct KVMParkedVcpu *cpu;
 
+    QEMU_LOCK_GUARD(&s->kvm_parked_vcpus_lock);
     QLIST_FOREACH(cpu, &s->kvm_parked_vcpus, node) {
         kvm_arch_reset_parked_vcpu(cpu->vcpu_id, cpu->kvm_fd);
     }
@@ -557,7 +562,7 @@ void kvm_destroy_vcpu(CPUState *cpu)
     }
 }
 
-int kvm_init_vcpu(CPUState *cpu, Error **errp)
+int kvm_create_vcpu_unlocked(CPUState *cpu, Error **errp)
 {
     KVMState *s = kvm_state;
     int mmap_size;
@@ -596,11 +601,6 @@ int kvm_init_vcpu(CPUState *cpu, Error **errp)
         goto err;
     }
 
-    if (s->coalesced_mmio && !s->coalesced_mmio_ring) {
-        s->coalesced_mmio_ring =
-            (void *)cpu->kvm_run + s->coalesced_mmio * PAGE_SIZE;
-    }
-
     if (s->kvm_dirty_ring_size) {
         /* Use MAP_SHARED to share pages with the kernel */
         cpu->kvm_dirty_gfns = mmap(NULL, s->kvm_dirty_ring_bytes,
@@ -613,6 +613,20 @@ int kvm_init_vcpu(CPUState *cpu, Error **errp)
         }
     }
 
+err:
+    return ret;
+}
+
+int kvm_init_vcpu(CPUState *cpu, Error **errp)
+{
+    KVMState *s = kvm_state;
+    int ret;
+
+    if (s->coalesced_mmio && !s->coalesced_mmio_ring) {
+        s->coalesced_mmio_ring =
+            (void *)cpu->kvm_run + s->coalesced_mmio * PAGE_SIZE;
+    }
+
     ret = kvm_arch_init_vcpu(cpu);
     if (ret < 0) {
         error_setg_errno(errp, -ret,
@@ -621,7 +635,6 @@ int kvm_init_vcpu(CPUState *cpu, Error **errp)
     }
     cpu->kvm_vcpu_stats_fd = kvm_vcpu_ioctl(cpu, KVM_GET_STATS_FD, NULL);
 
-err:
     return ret;
 }
 
@@ -687,6 +700,7 @@ static int kvm_slot_update_flags(KVMMemoryListener *kml, KVMSlot *mem,
     return kvm_set_user_memory_region(kml, mem, false);
 }
 
+/* Called with KVMMemoryListener.slots_lock held */
 static int kvm_section_update_flags(KVMMemoryListener *kml,
                                     MemoryRegionSection *section)
 {
@@ -695,18 +709,13 @@ static int kvm_section_update_flags(KVMMemoryListener *kml,
     int ret = 0;
 
     size = kvm_align_section(section, &start_addr);
-    if (!size) {
-        return 0;
-    }
-
-    kvm_slots_lock();
 
     while (size && !ret) {
         slot_size = MIN(kvm_max_slot_size, size);
         mem = kvm_lookup_matching_slot(kml, start_addr, slot_size);
         if (!mem) {
             /* We don't have a slot if we want to trap every access. */
-            goto out;
+            break;
         }
 
         ret = kvm_slot_update_flags(kml, mem, section->mr);
@@ -714,26 +723,37 @@ static int kvm_section_update_flags(KVMMemoryListener *kml,
         size -= slot_size;
     }
 
-out:
-    kvm_slots_unlock();
     return ret;
 }
 
+/*
+ * Dirty logging is started and stopped from within a memory transaction,
+ * so the new flags are applied by kvm_region_commit(), together with the
+ * other memslot updates of the transaction.
+ */
+static void kvm_log_update(KVMMemoryListener *kml,
+                           MemoryRegionSection *section)
+{
+    KVMMemoryUpdate *update;
+
+    update = g_new0(KVMMemoryUpdate, 1);
+    update->section = *section;
+    memory_region_ref(section->mr);
+
+    QSIMPLEQ_INSERT_TAIL(&kml->transaction_log, update, next);
+}
+
 static void kvm_log_start(MemoryListener *listener,
                           MemoryRegionSection *section,
                           int old, int new)
 {
     KVMMemoryListener *kml = container_of(listener, KVMMemoryListener, listener);
-    int r;
 
     if (old != 0) {
         return;
     }
 
-    r = kvm_section_update_flags(kml, section);
-    if (r < 0) {
-        abort();
-    }
+    kvm_log_update(kml, section);
 }
 
 static void kvm_log_stop(MemoryListener *listener,
@@ -741,16 +761,12 @@ static void kvm_log_stop(MemoryListener *listener,
                           int old, int new)
 {
     KVMMemoryListener *kml = container_of(listener, KVMMemoryListener, listener);
-    int r;
 
     if (new != 0) {
         return;
     }
 
-    r = kvm_section_update_flags(kml, section);
-    if (r < 0) {
-        abort();
-    }
+    kvm_log_update(kml, section);
 }
 
 /* get kvm's dirty pages bitmap and update qemu's */
@@ -843,6 +859,7 @@ static void kvm_dirty_ring_mark_page(KVMState *s, uint32_t as_id,
     }
 
     set_bit(offset, mem->dirty_bmap);
+    mem->ram_block->dirty_ring_pages++;
 }
 
 static bool dirty_gfn_is_dirtied(struct kvm_dirty_gfn *gfn)
@@ -927,9 +944,15 @@ static uint64_t kvm_dirty_ring_reap_locked(KVMState *s, CPUState* cpu)
     if (cpu) {
         total = kvm_dirty_ring_reap_one(s, cpu);
     } else {
+        uint32_t max = 0;
+
         CPU_FOREACH(cpu) {
-            total += kvm_dirty_ring_reap_one(s, cpu);
+            uint32_t count = kvm_dirty_ring_reap_one(s, cpu);
+
+            total += count;
+            max = MAX(max, count);
         }
+        s->reaper.reaped_max = max;
     }
 
     if (total) {
@@ -1574,6 +1597,7 @@ static void kvm_set_phys_mem(KVMMemoryListener *kml,
             mem->dirty_bmap = NULL;
             mem->memory_size = 0;
             mem->flags = 0;
+            mem->ram_block = NULL;
             err = kvm_set_user_memory_region(kml, mem, false);
             if (err) {
                 fprintf(stderr, "%s: error unregistering slot: %s\n",
@@ -1597,6 +1621,7 @@ static void kvm_set_phys_mem(KVMMemoryListener *kml,
         mem->ram_start_offset = ram_start_offset;
         mem->ram = ram;
         mem->flags = kvm_mem_flags(mr);
+        mem->ram_block = mr->ram_block;
         mem->guest_memfd = mr->ram_block->guest_memfd;
         mem->guest_memfd_offset = mem->guest_memfd >= 0 ?
                                   (uint8_t*)ram - mr->ram_block->host : 0;
@@ -1626,10 +1651,226 @@ static void kvm_set_phys_mem(KVMMemoryListener *kml,
     } while (size);
 }
 
+/*
+ * Rolling dirty rates with the "dirty-ring-stats" property.  The reaper
+ * samples the number of pages collected from the dirty rings every
+ * second, per vCPU and per RAM block; dirty tracking stays enabled all
+ * the time, so that the rates are always up to date.
+ */
+
+/* Weight of the past in the rolling rates, about a 4 seconds window */
+#define KVM_DIRTY_RING_STATS_WEIGHT  4
+
+static void kvm_dirty_ring_stats_rate(uint64_t *rate, uint64_t *sampled,
+                                      uint64_t pages, int64_t elapsed)
+{
+    uint64_t bytes = (pages - *sampled) * qemu_real_host_page_size();
+    uint64_t cur = muldiv64(bytes, NANOSECONDS_PER_SECOND, elapsed);
+
+    *rate = (*rate * (KVM_DIRTY_RING_STATS_WEIGHT - 1) + cur) /
+            KVM_DIRTY_RING_STATS_WEIGHT;
+    *sampled = pages;
+}
+
+/* Must be with BQL held */
+static void kvm_dirty_ring_stats_sample(KVMState *s)
+{
+    int64_t now = get_clock();
+    int64_t elapsed = now - s->kvm_dirty_ring_stats_stamp;
+    CPUState *cpu;
+    RAMBlock *rb;
+
+    /* Not started yet, or called again too early to tell anything */
+    if (!s->kvm_dirty_ring_stats_stamp || elapsed < SCALE_MS) {
+        return;
+    }
+
+    kvm_slots_lock();
+    CPU_FOREACH(cpu) {
+        kvm_dirty_ring_stats_rate(&cpu->dirty_rate, &cpu->dirty_pages_sampled,
+                                  cpu->dirty_pages, elapsed);
+    }
+    WITH_RCU_READ_LOCK_GUARD() {
+        RAMBLOCK_FOREACH(rb) {
+            kvm_dirty_ring_stats_rate(&rb->dirty_ring_rate,
+                                      &rb->dirty_ring_sampled,
+                                      rb->dirty_ring_pages, elapsed);
+        }
+    }
+    kvm_slots_unlock();
+
+    s->kvm_dirty_ring_stats_stamp = now;
+}
+
+static StatsList *kvm_dirty_ring_stats_add(StatsList *stats_list,
+                                           strList *names, uint64_t pages,
+                                           uint64_t rate)
+{
+    Stats *stats;
+
+    if (apply_str_list_filter("dirty-rate", names)) {
+        stats = g_new0(Stats, 1);
+        stats->name = g_strdup("dirty-rate");
+        stats->value = g_new0(StatsValue, 1);
+        stats->value->type = QTYPE_QNUM;
+        stats->value->u.scalar = rate;
+        QAPI_LIST_PREPEND(stats_list, stats);
+    }
+
+    if (apply_str_list_filter("dirty-bytes", names)) {
+        stats = g_new0(Stats, 1);
+        stats->name = g_strdup("dirty-bytes");
+        stats->value = g_new0(StatsValue, 1);
+        stats->value->type = QTYPE_QNUM;
+        stats->value->u.scalar = pages * qemu_real_host_page_size();
+        QAPI_LIST_PREPEND(stats_list, stats);
+    }
+
+    return stats_list;
+}
+
+static void kvm_dirty_ring_stats_cb(StatsResultList **result,
+                                    StatsTarget target, strList *names,
+                                    strList *targets, Error **errp)
+{
+    uint64_t total_pages = 0, total_rate = 0;
+    StatsList *stats_list;
+    CPUState *cpu;
+    RAMBlock *rb;
+
+    kvm_slots_lock();
+
+    switch (target) {
+    case STATS_TARGET_VM:
+        CPU_FOREACH(cpu) {
+            total_pages += cpu->dirty_pages;
+            total_rate += cpu->dirty_rate;
+        }
+        stats_list = kvm_dirty_ring_stats_add(NULL, names, total_pages,
+                                              total_rate);
+        if (stats_list) {
+            add_stats_entry(result, STATS_PROVIDER_DIRTY_RING, NULL,
+                            stats_list);
+        }
+        break;
+    case STATS_TARGET_VCPU:
+        CPU_FOREACH(cpu) {
+            if (!apply_str_list_filter(cpu->parent_obj.canonical_path,
+                                       targets)) {
+                continue;
+            }
+            stats_list = kvm_dirty_ring_stats_add(NULL, names,
+                                                  cpu->dirty_pages,
+                                                  cpu->dirty_rate);
+            if (stats_list) {
+                add_stats_entry(result, STATS_PROVIDER_DIRTY_RING,
+                                cpu->parent_obj.canonical_path, stats_list);
+            }
+        }
+        break;
+    case STATS_TARGET_RAMBLOCK:
+        WITH_RCU_READ_LOCK_GUARD() {
+            RAMBLOCK_FOREACH(rb) {
+                g_autofree char *path =
+                    object_get_canonical_path(OBJECT(rb->mr));
+
+                stats_list = kvm_dirty_ring_stats_add(NULL, names,
+                                                      rb->dirty_ring_pages,
+                                                      rb->dirty_ring_rate);
+                if (stats_list) {
+                    add_stats_entry(result, STATS_PROVIDER_DIRTY_RING,
+                                    path ? path : rb->idstr, stats_list);
+                }
+            }
+        }
+        break;
+    default:
+        break;
+    }
+
+    kvm_slots_unlock();
+}
+
+static void kvm_dirty_ring_stats_schemas_cb(StatsSchemaList **result,
+                                            Error **errp)
+{
+    StatsTarget targets[] = {
+        STATS_TARGET_VM, STATS_TARGET_VCPU, STATS_TARGET_RAMBLOCK,
+    };
+
+    for (int i = 0; i < ARRAY_SIZE(targets); i++) {
+        StatsSchemaValueList *list = NULL;
+        StatsSchemaValue *value;
+
+        value = g_new0(StatsSchemaValue, 1);
+        value->name = g_strdup("dirty-rate");
+        value->type = STATS_TYPE_INSTANT;
+        value->has_unit = true;
+        value->unit = STATS_UNIT_BYTES;
+        QAPI_LIST_PREPEND(list, value);
+
+        value = g_new0(StatsSchemaValue, 1);
+        value->name = g_strdup("dirty-bytes");
+        value->type = STATS_TYPE_CUMULATIVE;
+        value->has_unit = true;
+        value->unit = STATS_UNIT_BYTES;
+        QAPI_LIST_PREPEND(list, value);
+
+        add_stats_schema(result, STATS_PROVIDER_DIRTY_RING, targets[i], list);
+    }
+}
+
+static void kvm_dirty_ring_stats_start(Notifier *notifier, void *data)
+{
+    KVMState *s = container_of(notifier, KVMState,
+                               kvm_dirty_ring_stats_notifier);
+    Error *local_err = NULL;
+    CPUState *cpu;
+    RAMBlock *rb;
+
+    if (!memory_global_dirty_log_start(GLOBAL_DIRTY_STATS, &local_err)) {
+        error_report_err(local_err);
+        return;
+    }
+
+    /* Only account for what is dirtied from now on */
+    kvm_slots_lock();
+    CPU_FOREACH(cpu) {
+        cpu->dirty_pages_sampled = cpu->dirty_pages;
+    }
+    WITH_RCU_READ_LOCK_GUARD() {
+        RAMBLOCK_FOREACH(rb) {
+            rb->dirty_ring_sampled = rb->dirty_ring_pages;
+        }
+    }
+    kvm_slots_unlock();
+
+    s->kvm_dirty_ring_stats_stamp = get_clock();
+}
+
+static void kvm_dirty_ring_stats_init(KVMState *s)
+{
+    add_stats_callbacks(STATS_PROVIDER_DIRTY_RING, kvm_dirty_ring_stats_cb,
+                        kvm_dirty_ring_stats_schemas_cb);
+
+    /* Start tracking once all the RAM of the machine is there */
+    s->kvm_dirty_ring_stats_notifier.notify = kvm_dirty_ring_stats_start;
+    qemu_add_machine_init_done_notifier(&s->kvm_dirty_ring_stats_notifier);
+}
+
+/*
+ * The reaper adapts how often it runs to how fast the guest dirties
+ * memory, so that rings are collected well before they get full and
+ * vCPUs rarely have to exit to userspace because of a full ring.
+ */
+#define KVM_DIRTY_RING_REAP_MIN_MS  10
+#define KVM_DIRTY_RING_REAP_MAX_MS  1000
+
 static void *kvm_dirty_ring_reaper_thread(void *data)
 {
     KVMState *s = data;
     struct KVMDirtyRingReaper *r = &s->reaper;
+    int interval = KVM_DIRTY_RING_REAP_MAX_MS;
 
     rcu_register_thread();
 
@@ -1638,13 +1879,19 @@ static void *kvm_dirty_ring_reaper_thread(void *data)
     while (true) {
         r->reaper_state = KVM_DIRTY_RING_REAPER_WAIT;
         trace_kvm_dirty_ring_reaper("wait");
-        /*
-         * TODO: provide a smarter timeout rather than a constant?
-         */
-        sleep(1);
+        if (qemu_sem_timedwait(&r->reaper_sem, interval) == 0) {
+            /* A ring got full, we are not reaping often enough */
+            interval = MAX(interval / 2, KVM_DIRTY_RING_REAP_MIN_MS);
+        }
 
         /* keep sleeping so that dirtylimit not be interfered by reaper */
         if (dirtylimit_in_service()) {
+            /* dirtylimit reaps the rings itself, only sample the counts */
+            if (s->kvm_dirty_ring_stats) {
+                bql_lock();
+                kvm_dirty_ring_stats_sample(s);
+                bql_unlock();
+            }
             continue;
         }
 
@@ -1653,8 +1900,18 @@ static void *kvm_dirty_ring_reaper_thread(void *data)
 
         bql_lock();
         kvm_dirty_ring_reap(s, NULL);
+        if (s->kvm_dirty_ring_stats) {
+            kvm_dirty_ring_stats_sample(s);
+        }
         bql_unlock();
 
+        /* Aim at rings being between 1/8 and 1/2 full when reaped */
+        if (r->reaped_max > s->kvm_dirty_ring_size / 2) {
+            interval = MAX(interval / 2, KVM_DIRTY_RING_REAP_MIN_MS);
+        } else if (r->reaped_max < s->kvm_dirty_ring_size / 8) {
+            interval = MIN(interval * 2, KVM_DIRTY_RING_REAP_MAX_MS);
+        }
+
         r->reaper_iteration++;
     }
 
@@ -1665,6 +1922,7 @@ static void kvm_dirty_ring_reaper_init(KVMState *s)
 {
     struct KVMDirtyRingReaper *r = &s->reaper;
 
+    qemu_sem_init(&r->reaper_sem, 0);
     qemu_thread_create(&r->reaper_thr, "kvm-reaper",
                        kvm_dirty_ring_reaper_thread,
                        s, QEMU_THREAD_JOINABLE);
@@ -1763,12 +2021,17 @@ static void kvm_region_commit(MemoryListener *listener)
                                           listener);
     KVMMemoryUpdate *u1, *u2;
     bool need_inhibit = false;
+    unsigned nr_del = 0, nr_add = 0, nr_log = 0;
+    int64_t start_ns;
 
     if (QSIMPLEQ_EMPTY(&kml->transaction_add) &&
-        QSIMPLEQ_EMPTY(&kml->transaction_del)) {
+        QSIMPLEQ_EMPTY(&kml->transaction_del) &&
+        QSIMPLEQ_EMPTY(&kml->transaction_log)) {
         return;
     }
 
+    start_ns = get_clock();
+
     /*
      * We have to be careful when regions to add overlap with ranges to remove.
      * We have to simulate atomic KVM memslot updates by making sure no ioctl()
@@ -1811,6 +2074,7 @@ static void kvm_region_commit(MemoryListener *listener)
         memory_region_unref(u1->section.mr);
 
         g_free(u1);
+        nr_del++;
     }
     while (!QSIMPLEQ_EMPTY(&kml->transaction_add)) {
         u1 = QSIMPLEQ_FIRST(&kml->transaction_add);
@@ -1820,12 +2084,33 @@ static void kvm_region_commit(MemoryListener *listener)
         kvm_set_phys_mem(kml, &u1->section, true);
 
         g_free(u1);
+        nr_add++;
+    }
+
+    /*
+     * Slots added above already have the right flags, so this only issues
+     * ioctls for the slots whose dirty logging state really changed.
+     */
+    while (!QSIMPLEQ_EMPTY(&kml->transaction_log)) {
+        u1 = QSIMPLEQ_FIRST(&kml->transaction_log);
+        QSIMPLEQ_REMOVE_HEAD(&kml->transaction_log, next);
+
+        if (kvm_section_update_flags(kml, &u1->section) < 0) {
+            abort();
+        }
+        memory_region_unref(u1->section.mr);
+
+        g_free(u1);
+        nr_log++;
     }
 
     if (need_inhibit) {
         accel_ioctl_inhibit_end();
     }
     kvm_slots_unlock();
+
+    trace_kvm_region_commit(kml->as_id, nr_del, nr_add, nr_log, need_inhibit,
+                            get_clock() - start_ns);
 }
 
 static void kvm_log_sync(MemoryListener *listener,
@@ -1970,6 +2255,7 @@ void kvm_memory_listener_register(KVMState *s, KVMMemoryListener *kml,
 
     QSIMPLEQ_INIT(&kml->transaction_add);
     QSIMPLEQ_INIT(&kml->transaction_del);
+    QSIMPLEQ_INIT(&kml->transaction_log);
 
     kml->listener.region_add = kvm_region_add;
     kml->listener.region_del = kvm_region_del;
@@ -2040,6 +2326,31 @@ static void clear_gsi(KVMState *s, unsigned int gsi)
     clear_bit(gsi, s->used_gsi_bitmap);
 }
 
+/*
+ * A vCPU thread that handles an MMIO or PIO exit defers route commits
+ * until the access is complete, so that a guest reprogramming several
+ * MSI-X vectors in one access, or the notifiers of a single vector, cause
+ * a single KVM_SET_GSI_ROUTING.
+ */
+static __thread bool kvm_route_commit_deferred;
+static __thread bool kvm_route_commit_pending;
+
+static void kvm_irqchip_defer_route_commits(void)
+{
+    kvm_route_commit_deferred = true;
+}
+
+static void kvm_irqchip_commit_deferred_routes(void)
+{
+    kvm_route_commit_deferred = false;
+    if (kvm_route_commit_pending) {
+        kvm_route_commit_pending = false;
+        bql_lock();
+        kvm_irqchip_commit_routes(kvm_state);
+        bql_unlock();
+    }
+}
+
 void kvm_init_irq_routing(KVMState *s)
 {
     int gsi_count;
@@ -2049,10 +2360,14 @@ void kvm_init_irq_routing(KVMState *s)
         /* Round up so we can search ints using ffs */
         s->used_gsi_bitmap = bitmap_new(gsi_count);
         s->gsi_count = gsi_count;
+        s->irq_route_index = g_new(int, gsi_count);
+        memset(s->irq_route_index, -1, gsi_count * sizeof(int));
     }
 
     s->irq_routes = g_malloc0(sizeof(*s->irq_routes));
     s->nr_allocated_irq_routes = 0;
+    /* The first commit replaces the default routing of KVM */
+    s->irq_routes_dirty = true;
 
     kvm_arch_init_irq_routing(s);
 }
@@ -2069,10 +2384,19 @@ void kvm_irqchip_commit_routes(KVMState *s)
         return;
     }
 
+    if (!s->irq_routes_dirty) {
+        return;
+    }
+    if (kvm_route_commit_deferred) {
+        kvm_route_commit_pending = true;
+        return;
+    }
+
     s->irq_routes->flags = 0;
     trace_kvm_irqchip_commit_routes();
     ret = kvm_vm_ioctl(s, KVM_SET_GSI_ROUTING, s->irq_routes);
     assert(ret == 0);
+    s->irq_routes_dirty = false;
 }
 
 void kvm_add_routing_entry(KVMState *s,
@@ -2095,6 +2419,10 @@ void kvm_add_routing_entry(KVMState *s,
     new = &s->irq_routes->entries[n];
 
     *new = *entry;
+    if (entry->gsi < s->gsi_count) {
+        s->irq_route_index[entry->gsi] = n;
+    }
+    s->irq_routes_dirty = true;
 
     set_gsi(s, entry->gsi);
 }
@@ -2105,22 +2433,24 @@ static int kvm_update_routing_entry(KVMState *s,
     struct kvm_irq_routing_entry *entry;
     int n;
 
-    for (n = 0; n < s->irq_routes->nr; n++) {
-        entry = &s->irq_routes->entries[n];
-        if (entry->gsi != new_entry->gsi) {
-            continue;
-        }
-
-        if(!memcmp(entry, new_entry, sizeof *entry)) {
-            return 0;
-        }
-
-        *entry = *new_entry;
+    if (new_entry->gsi >= s->gsi_count) {
+        return -ESRCH;
+    }
+    n = s->irq_route_index[new_entry->gsi];
+    if (n < 0) {
+        return -ESRCH;
+    }
 
+    entry = &s->irq_routes->entries[n];
+    assert(entry->gsi == new_entry->gsi);
+    if (!memcmp(entry, new_entry, sizeof(*entry))) {
         return 0;
     }
 
-    return -ESRCH;
+    *entry = *new_entry;
+    s->irq_routes_dirty = true;
+
+    return 0;
 }
 
 void kvm_irqchip_add_irq_route(KVMState *s, int irq, int irqchip, int pin)
@@ -2151,8 +2481,15 @@ void kvm_irqchip_release_virq(KVMState *s, int virq)
         if (e->gsi == virq) {
             s->irq_routes->nr--;
             *e = s->irq_routes->entries[s->irq_routes->nr];
+            if (i < s->irq_routes->nr && e->gsi < s->gsi_count) {
+                s->irq_route_index[e->gsi] = i;
+            }
+            s->irq_routes_dirty = true;
         }
     }
+    if (virq < s->gsi_count) {
+        s->irq_route_index[virq] = -1;
+    }
     clear_gsi(s, virq);
     kvm_arch_release_virq_post(virq);
     trace_kvm_irqchip_release_virq(virq);
@@ -2372,6 +2709,14 @@ int kvm_irqchip_update_msi_route(KVMState *s, int virq, MSIMessage msg)
 {
     return -ENOSYS;
 }
+
+static void kvm_irqchip_defer_route_commits(void)
+{
+}
+
+static void kvm_irqchip_commit_deferred_routes(void)
+{
+}
 #endif /* !KVM_CAP_IRQ_ROUTING */
 
 int kvm_irqchip_add_irqfd_notifier_gsi(KVMState *s, EventNotifier *n,
@@ -2572,6 +2917,12 @@ static int kvm_setup_dirty_ring(KVMState *s)
         return ret;
     }
 
+    if (s->kvm_dirty_ring_stats && !s->kvm_dirty_ring_size) {
+        error_report("KVM dirty-ring-stats requires the dirty ring, "
+                     "see dirty-ring-size");
+        return -EINVAL;
+    }
+
     /*
      * KVM_CAP_MANUAL_DIRTY_LOG_PROTECT2 is not needed when dirty ring is
      * enabled.  More importantly, KVM_DIRTY_LOG_INITIALLY_SET will assume no
@@ -2642,6 +2993,7 @@ static int kvm_init(AccelState *as, MachineState *ms)
 #ifdef TARGET_KVM_HAVE_GUEST_DEBUG
     QTAILQ_INIT(&s->kvm_sw_breakpoints);
 #endif
+    qemu_mutex_init(&s->kvm_parked_vcpus_lock);
     QLIST_INIT(&s->kvm_parked_vcpus);
     s->fd = qemu_open_old(s->device ?: "/dev/kvm", O_RDWR);
     if (s->fd == -1) {
@@ -2815,6 +3167,10 @@ static int kvm_init(AccelState *as, MachineState *ms)
         kvm_dirty_ring_reaper_init(s);
     }
 
+    if (s->kvm_dirty_ring_stats) {
+        kvm_dirty_ring_stats_init(s);
+    }
+
     if (kvm_check_extension(kvm_state, KVM_CAP_BINARY_STATS_FD)) {
         add_stats_callbacks(STATS_PROVIDER_KVM, query_stats_cb,
                             query_stats_schemas_cb);
@@ -3236,20 +3592,24 @@ int kvm_cpu_exec(CPUState *cpu)
         switch (run->exit_reason) {
         case KVM_EXIT_IO:
             /* Called outside BQL */
+            kvm_irqchip_defer_route_commits();
             kvm_handle_io(run->io.port, attrs,
                           (uint8_t *)run + run->io.data_offset,
                           run->io.direction,
                           run->io.size,
                           run->io.count);
+            kvm_irqchip_commit_deferred_routes();
             ret = 0;
             break;
         case KVM_EXIT_MMIO:
             /* Called outside BQL */
+            kvm_irqchip_defer_route_commits();
             address_space_rw(&address_space_memory,
                              run->mmio.phys_addr, attrs,
                              run->mmio.data,
                              run->mmio.len,
                              run->mmio.is_write);
+            kvm_irqchip_commit_deferred_routes();
             ret = 0;
             break;
         case KVM_EXIT_IRQ_WINDOW_OPEN:
@@ -3275,17 +3635,17 @@ int kvm_cpu_exec(CPUState *cpu)
             trace_kvm_dirty_ring_full(cpu->cpu_index);
             bql_lock();
             /*
-             * We throttle vCPU by making it sleep once it exit from kernel
-             * due to dirty ring full. In the dirtylimit scenario, reaping
-             * all vCPUs after a single vCPU dirty ring get full result in
-             * the miss of sleep, so just reap the ring-fulled vCPU.
+             * Only reap the ring of this vCPU so that it can go back to
+             * the guest quickly, and let the reaper thread collect the
+             * other rings.  In the dirtylimit scenario, reaping all vCPUs
+             * after a single vCPU dirty ring get full would also result in
+             * the miss of sleep.
              */
-            if (dirtylimit_in_service()) {
-                kvm_dirty_ring_reap(kvm_state, cpu);
-            } else {
-                kvm_dirty_ring_reap(kvm_state, NULL);
-            }
+            kvm_dirty_ring_reap(kvm_state, cpu);
             bql_unlock();
+            if (!dirtylimit_in_service()) {
+                qemu_sem_post(&kvm_state->reaper.reaper_sem);
+            }
             dirtylimit_vcpu_execute(cpu);
             ret = 0;
             break;
@@ -3943,6 +4303,25 @@ static void kvm_set_dirty_ring_size(Object *obj, Visitor *v,
     s->kvm_dirty_ring_size = value;
 }
 
+static bool kvm_get_dirty_ring_stats(Object *obj, Error **errp)
+{
+    KVMState *s = KVM_STATE(obj);
+
+    return s->kvm_dirty_ring_stats;
+}
+
+static void kvm_set_dirty_ring_stats(Object *obj, bool value, Error **errp)
+{
+    KVMState *s = KVM_STATE(obj);
+
+    if (s->fd != -1) {
+        error_setg(errp, "Cannot set properties after the accelerator has been initialized");
+        return;
+    }
+
+    s->kvm_dirty_ring_stats = value;
+}
+
 static char *kvm_get_device(Object *obj,
                             Error **errp G_GNUC_UNUSED)
 {
@@ -3988,6 +4367,7 @@ static void kvm_accel_instance_init(Object *obj)
     /* KVM dirty ring is by default off */
     s->kvm_dirty_ring_size = 0;
     s->kvm_dirty_ring_with_bitmap = false;
+    s->kvm_dirty_ring_stats = false;
     s->kvm_eager_split_size = 0;
     s->notify_vmexit = NOTIFY_VMEXIT_OPTION_RUN;
     s->notify_window = 0;
@@ -4036,6 +4416,12 @@ static void kvm_accel_class_init(ObjectClass *oc, const void *data)
     object_class_property_set_description(oc, "dirty-ring-size",
         "Size of KVM dirty page ring buffer (default: 0, i.e. use bitmap)");
 
+    object_class_property_add_bool(oc, "dirty-ring-stats",
+        kvm_get_dirty_ring_stats, kvm_set_dirty_ring_stats);
+    object_class_property_set_description(oc, "dirty-ring-stats",
+        "Keep track of dirty page rates through the dirty ring "
+        "(default: off)");
+
     object_class_property_add_str(oc, "device", kvm_get_device, kvm_set_device);
     object_class_property_set_description(oc, "device",
         "Path to the device node to use (default: /dev/kvm)");
@@ -10,6 +10,12 @@
 #ifndef KVM_CPUS_H
 #define KVM_CPUS_H
 
+/*
+ * Create the KVM vCPU of @cpu.  This does not touch machine state and is
+ * called without the BQL, so that vCPUs can be created in parallel.
+ */
+int kvm_create_vcpu_unlocked(CPUState *cpu, Error **errp);
+/* Finish the initialization of @cpu with the BQL held */
 int kvm_init_vcpu(CPUState *cpu, Error **errp);
 int kvm_cpu_exec(CPUState *cpu);
 void kvm_destroy_vcpu(CPUState *cpu);
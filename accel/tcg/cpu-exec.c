@@ -33,6 +33,7 @@
 #include "exec/translation-block.h"
 #include "tcg/tcg.h"
 #include "qemu/atomic.h"
+#include "qemu/host-utils.h"
 #include "qemu/rcu.h"
 #include "exec/log.h"
 #include "qemu/main-loop.h"
@@ -210,6 +211,26 @@ static TranslationBlock *tb_htable_lookup(CPUState *cpu, TCGTBCPUState s)
     return qht_lookup_custom(&tb_ctx.htable, &desc, h, tb_lookup_cmp);
 }
 
+/*
+ * Record @tb as the most recently used entry of its jump cache set.
+ * A concurrent invalidation may be lost while entries are shifted, but a
+ * stale entry never matches: invalidated TBs have CF_INVALID set, and the
+ * caches are cleared wholesale before their code buffer space is reused.
+ */
+static inline void tb_jmp_cache_insert(CPUJumpCache *jc, unsigned int hash,
+                                       unsigned int way, vaddr pc,
+                                       TranslationBlock *tb)
+{
+    CPUJumpCacheEntry *set = tb_jmp_cache_set(jc, hash);
+
+    for (; way > 0; way--) {
+        set[way].pc = set[way - 1].pc;
+        qatomic_set(&set[way].tb, qatomic_read(&set[way - 1].tb));
+    }
+    set[0].pc = pc;
+    qatomic_set(&set[0].tb, tb);
+}
+
 /**
  * tb_lookup:
  * @cpu: CPU that will execute the returned translation block
@@ -228,30 +249,39 @@ static inline TranslationBlock *tb_lookup(CPUState *cpu, TCGTBCPUState s)
 {
     TranslationBlock *tb;
     CPUJumpCache *jc;
+    CPUJumpCacheEntry *set;
     uint32_t hash;
+    unsigned int way;
 
     /* we should never be trying to look up an INVALID tb */
     tcg_debug_assert(!(s.cflags & CF_INVALID));
 
-    hash = tb_jmp_cache_hash_func(s.pc);
     jc = cpu->tb_jmp_cache;
-
-    tb = qatomic_read(&jc->array[hash].tb);
-    if (likely(tb &&
-               jc->array[hash].pc == s.pc &&
-               tb->cs_base == s.cs_base &&
-               tb->flags == s.flags &&
-               tb_cflags(tb) == s.cflags)) {
-        goto hit;
+    hash = tb_jmp_cache_hash_func(jc, s.pc);
+    set = tb_jmp_cache_set(jc, hash);
+
+    for (way = 0; way < jc->ways; way++) {
+        tb = qatomic_read(&set[way].tb);
+        if (likely(tb &&
+                   set[way].pc == s.pc &&
+                   tb->cs_base == s.cs_base &&
+                   tb->flags == s.flags &&
+                   tb_cflags(tb) == s.cflags)) {
+            qatomic_set(&jc->hits, jc->hits + 1);
+            if (way) {
+                tb_jmp_cache_insert(jc, hash, way, s.pc, tb);
+            }
+            goto hit;
+        }
     }
+    qatomic_set(&jc->misses, jc->misses + 1);
 
     tb = tb_htable_lookup(cpu, s);
     if (tb == NULL) {
         return NULL;
     }
 
-    jc->array[hash].pc = s.pc;
-    qatomic_set(&jc->array[hash].tb, tb);
+    tb_jmp_cache_insert(jc, hash, jc->ways - 1, s.pc, tb);
 
 hit:
     /*
@@ -363,15 +393,7 @@ static inline bool check_for_breakpoints(CPUState *cpu, vaddr pc,
         check_for_breakpoints_slow(cpu, pc, cflags);
 }
 
-/**
- * helper_lookup_tb_ptr: quick check for next tb
- * @env: current cpu state
- *
- * Look for an existing TB matching the current cpu state.
- * If found, return the code pointer.  If not found, return
- * the tcg epilogue so that we return into cpu_tb_exec.
- */
-const void *HELPER(lookup_tb_ptr)(CPUArchState *env)
+static const void *lookup_tb_ptr(CPUArchState *env, CPUJumpCacheEntry *ibc)
 {
     CPUState *cpu = env_cpu(env);
     TranslationBlock *tb;
@@ -399,11 +421,41 @@ const void *HELPER(lookup_tb_ptr)(CPUArchState *env)
 
     if (qemu_loglevel_mask(CPU_LOG_TB_CPU | CPU_LOG_EXEC)) {
         log_cpu_exec(s.pc, cpu, tb);
+    } else if (ibc) {
+        /* Hits would bypass the logging above */
+        ibc->pc = s.pc;
+        qatomic_set(&ibc->tb, tb);
     }
 
     return tb->tc.ptr;
 }
 
+/**
+ * helper_lookup_tb_ptr: quick check for next tb
+ * @env: current cpu state
+ *
+ * Look for an existing TB matching the current cpu state.
+ * If found, return the code pointer.  If not found, return
+ * the tcg epilogue so that we return into cpu_tb_exec.
+ */
+const void *HELPER(lookup_tb_ptr)(CPUArchState *env)
+{
+    return lookup_tb_ptr(env, NULL);
+}
+
+/**
+ * helper_lookup_tb_ptr_cached: miss in the indirect branch cache
+ * @env: current cpu state
+ * @slot: indirect branch cache slot of the jump site
+ *
+ * As helper_lookup_tb_ptr, and also store the TB in @slot so that the
+ * next jump from the same site to the same TB is done inline.
+ */
+const void *HELPER(lookup_tb_ptr_cached)(CPUArchState *env, uint32_t slot)
+{
+    return lookup_tb_ptr(env, &env_cpu(env)->tb_jmp_cache->ibc[slot]);
+}
+
 /* Return the current PC from CPU, which may be cached in TB. */
 static vaddr log_pc(CPUState *cpu, const TranslationBlock *tb)
 {
@@ -918,13 +970,19 @@ static inline void cpu_loop_exec_tb(CPUState *cpu, TranslationBlock *tb,
 
     /*
      * If the next tb has more instructions than we have left to
-     * execute we need to ensure we find/generate a TB with exactly
-     * insns_left instructions in it.
+     * execute we need to ensure we find/generate a TB that stops
+     * before the deadline.  Use the largest power of two that fits
+     * rather than exactly insns_left: the remainder is covered by
+     * further, smaller TBs as the decrementer expires again, and
+     * there are only a handful of truncated variants per pc, which
+     * are then found in the TB cache instead of being retranslated
+     * for every distinct distance to the next deadline.
      */
     if (insns_left > 0 && insns_left < tb->icount)  {
         assert(insns_left <= CF_COUNT_MASK);
         assert(cpu->icount_extra == 0);
-        cpu->cflags_next_tb = (tb->cflags & ~CF_COUNT_MASK) | insns_left;
+        cpu->cflags_next_tb = (tb->cflags & ~CF_COUNT_MASK)
+                              | pow2floor(insns_left);
     }
 #endif
 }
@@ -966,7 +1024,6 @@ cpu_exec_loop(CPUState *cpu, SyncClocks *sc)
             tb = tb_lookup(cpu, s);
             if (tb == NULL) {
                 CPUJumpCache *jc;
-                uint32_t h;
 
                 mmap_lock();
                 tb = tb_gen_code(cpu, s);
@@ -976,10 +1033,9 @@ cpu_exec_loop(CPUState *cpu, SyncClocks *sc)
                  * We add the TB in the virtual pc hash table
                  * for the fast lookup
                  */
-                h = tb_jmp_cache_hash_func(s.pc);
                 jc = cpu->tb_jmp_cache;
-                jc->array[h].pc = s.pc;
-                qatomic_set(&jc->array[h].tb, tb);
+                tb_jmp_cache_insert(jc, tb_jmp_cache_hash_func(jc, s.pc),
+                                    jc->ways - 1, s.pc, tb);
             }
 
 #ifndef CONFIG_USER_ONLY
@@ -1067,7 +1123,12 @@ bool tcg_exec_realizefn(CPUState *cpu, Error **errp)
         tcg_target_initialized = true;
     }
 
-    cpu->tb_jmp_cache = g_new0(CPUJumpCache, 1);
+    cpu->tb_jmp_cache = g_malloc0(sizeof(CPUJumpCache) +
+                                  sizeof(CPUJumpCacheEntry) *
+                                  ((size_t)tb_jmp_cache_ways <<
+                                   tb_jmp_cache_bits));
+    cpu->tb_jmp_cache->bits = tb_jmp_cache_bits;
+    cpu->tb_jmp_cache->ways = tb_jmp_cache_ways;
     tlb_init(cpu);
 #ifndef CONFIG_USER_ONLY
     tcg_iommu_init_notifier_list(cpu);
@@ -149,15 +149,23 @@ static void tlb_window_reset(CPUTLBDesc *desc, int64_t ns,
 static void tb_jmp_cache_clear_page(CPUState *cpu, vaddr page_addr)
 {
     CPUJumpCache *jc = cpu->tb_jmp_cache;
-    int i, i0;
+    CPUJumpCacheEntry *set;
+    size_t i, n;
 
     if (unlikely(!jc)) {
         return;
     }
 
-    i0 = tb_jmp_cache_hash_page(page_addr);
-    for (i = 0; i < TB_JMP_PAGE_SIZE; i++) {
-        qatomic_set(&jc->array[i0 + i].tb, NULL);
+    set = tb_jmp_cache_set(jc, tb_jmp_cache_hash_page(jc, page_addr));
+    n = (size_t)jc->ways << tb_jmp_cache_page_bits(jc);
+    for (i = 0; i < n; i++) {
+        qatomic_set(&set[i].tb, NULL);
+    }
+
+    for (i = 0; i < TB_IBC_SIZE; i++) {
+        if (((jc->ibc[i].pc ^ page_addr) & TARGET_PAGE_MASK) == 0) {
+            qatomic_set(&jc->ibc[i].tb, NULL);
+        }
     }
 }
 
@@ -282,8 +290,10 @@ static void tlb_mmu_flush_locked(CPUTLBDesc *desc, CPUTLBDescFast *fast)
     desc->large_page_addr = -1;
     desc->large_page_mask = -1;
     desc->vindex = 0;
+    desc->lindex = 0;
     memset(fast->table, -1, sizeof_tlb(fast));
     memset(desc->vtable, -1, sizeof(desc->vtable));
+    memset(desc->ltable, -1, sizeof(desc->ltable));
 }
 
 static void tlb_flush_one_mmuidx_locked(CPUState *cpu, int mmu_idx,
@@ -318,12 +328,43 @@ static inline void tlb_n_used_entries_dec(CPUState *cpu, uintptr_t mmu_idx)
     cpu->neg.tlb.d[mmu_idx].n_used_entries--;
 }
 
+typedef struct {
+    vaddr addr;
+    vaddr len;
+    MMUIdxMap idxmap;
+    unsigned bits;
+} TLBFlushRangeData;
+
+/*
+ * Flushes requested by other cpus are accumulated per destination cpu
+ * and performed by a single work item, so that a storm of invalidations
+ * costs each vCPU one trip through its work queue rather than one per
+ * page.  Overlapping or adjacent ranges with the same mmu_idx set and
+ * significant bits are merged; once TLB_PENDING_RANGES distinct ranges
+ * are pending, their mmu_idx are flushed entirely instead.
+ */
+#define TLB_PENDING_RANGES 16
+
+struct CPUTLBPending {
+    struct rcu_head rcu;
+    QemuSpin lock;
+    /* A tlb_flush_pending_work item is queued and has not started. */
+    bool queued;
+    /* Set of mmu_idx to flush entirely. */
+    MMUIdxMap full;
+    unsigned n_ranges;
+    TLBFlushRangeData ranges[TLB_PENDING_RANGES];
+};
+typedef struct CPUTLBPending CPUTLBPending;
+
 void tlb_init(CPUState *cpu)
 {
     int64_t now = get_clock_realtime();
     int i;
 
     qemu_spin_init(&cpu->neg.tlb.c.lock);
+    cpu->neg.tlb.c.pending = g_new0(CPUTLBPending, 1);
+    qemu_spin_init(&cpu->neg.tlb.c.pending->lock);
 
     /* All tlbs are initialized flushed. */
     cpu->neg.tlb.c.dirty = 0;
@@ -338,6 +379,8 @@ void tlb_destroy(CPUState *cpu)
     int i;
 
     qemu_spin_destroy(&cpu->neg.tlb.c.lock);
+    /* Other cpus may still be queueing flushes, see cpu_common_unrealize. */
+    g_free_rcu(cpu->neg.tlb.c.pending, rcu);
     for (i = 0; i < NB_MMU_MODES; i++) {
         CPUTLBDesc *desc = &cpu->neg.tlb.d[i];
         CPUTLBDescFast *fast = cpu_tlb_fast(cpu, i);
@@ -347,21 +390,82 @@ void tlb_destroy(CPUState *cpu)
     }
 }
 
-/* flush_all_helper: run fn across all cpus
+static void tlb_flush_pending_work(CPUState *cpu, run_on_cpu_data data);
+
+static bool tlb_flush_range_merge(TLBFlushRangeData *r,
+                                  const TLBFlushRangeData *d)
+{
+    vaddr r_end = r->addr + r->len;
+    vaddr d_end = d->addr + d->len;
+
+    if (r->idxmap != d->idxmap || r->bits != d->bits ||
+        d->addr > r_end || r->addr > d_end) {
+        return false;
+    }
+    r->addr = MIN(r->addr, d->addr);
+    r->len = MAX(r_end, d_end) - r->addr;
+    return true;
+}
+
+/*
+ * Queue a flush of the mmu_idx in @full, and of the range @d if not NULL,
+ * on @cpu.
+ */
+static void tlb_queue_flush(CPUState *cpu, MMUIdxMap full,
+                            const TLBFlushRangeData *d)
+{
+    CPUTLBPending *p = cpu->neg.tlb.c.pending;
+    bool kick;
+
+    qemu_spin_lock(&p->lock);
+    if (d) {
+        unsigned i;
+
+        for (i = 0; i < p->n_ranges; i++) {
+            if (tlb_flush_range_merge(&p->ranges[i], d)) {
+                break;
+            }
+        }
+        if (i == p->n_ranges) {
+            if (p->n_ranges < TLB_PENDING_RANGES) {
+                p->ranges[p->n_ranges++] = *d;
+            } else {
+                full |= d->idxmap;
+                for (i = 0; i < p->n_ranges; i++) {
+                    full |= p->ranges[i].idxmap;
+                }
+                p->n_ranges = 0;
+            }
+        }
+    }
+    p->full |= full;
+    kick = !p->queued;
+    p->queued = true;
+    if (!kick) {
+        qatomic_set(&cpu->neg.tlb.c.coalesced_flush_count,
+                    cpu->neg.tlb.c.coalesced_flush_count + 1);
+    }
+    qemu_spin_unlock(&p->lock);
+
+    if (kick) {
+        async_run_on_cpu(cpu, tlb_flush_pending_work, RUN_ON_CPU_NULL);
+    }
+}
+
+/* flush_all_helper: queue a flush on all cpus but src
  *
- * If the wait flag is set then the src cpu's helper will be queued as
- * "safe" work and the loop exited creating a synchronisation point
- * where all queued work will be finished before execution starts
- * again.
+ * The src cpu's flush is then queued as "safe" work by the caller,
+ * creating a synchronisation point where all queued work will be
+ * finished before execution starts again.
  */
-static void flush_all_helper(CPUState *src, run_on_cpu_func fn,
-                             run_on_cpu_data d)
+static void flush_all_helper(CPUState *src, MMUIdxMap full,
+                             const TLBFlushRangeData *d)
 {
     CPUState *cpu;
 
     CPU_FOREACH(cpu) {
         if (cpu != src) {
-            async_run_on_cpu(cpu, fn, d);
+            tlb_queue_flush(cpu, full, d);
         }
     }
 }
@@ -426,7 +530,7 @@ void tlb_flush_by_mmuidx_all_cpus_synced(CPUState *src_cpu, MMUIdxMap idxmap)
 
     tlb_debug("mmu_idx: 0x%"PRIx16"\n", idxmap);
 
-    flush_all_helper(src_cpu, fn, RUN_ON_CPU_HOST_INT(idxmap));
+    flush_all_helper(src_cpu, idxmap, NULL);
     async_safe_run_on_cpu(src_cpu, fn, RUN_ON_CPU_HOST_INT(idxmap));
 }
 
@@ -618,35 +722,30 @@ void tlb_flush_page_by_mmuidx_all_cpus_synced(CPUState *src_cpu,
                                               vaddr addr,
                                               MMUIdxMap idxmap)
 {
+    TLBFlushRangeData r;
+
     tlb_debug("addr: %016" VADDR_PRIx " mmu_idx:%"PRIx16"\n", addr, idxmap);
 
     /* This should already be page aligned */
     addr &= TARGET_PAGE_MASK;
 
+    /* A page flush is a single page range with all bits significant. */
+    r.addr = addr;
+    r.len = TARGET_PAGE_SIZE;
+    r.idxmap = idxmap;
+    r.bits = target_long_bits();
+    flush_all_helper(src_cpu, 0, &r);
+
     /*
      * Allocate memory to hold addr+idxmap only when needed.
      * See tlb_flush_page_by_mmuidx for details.
      */
     if (idxmap < TARGET_PAGE_SIZE) {
-        flush_all_helper(src_cpu, tlb_flush_page_by_mmuidx_async_1,
-                         RUN_ON_CPU_TARGET_PTR(addr | idxmap));
         async_safe_run_on_cpu(src_cpu, tlb_flush_page_by_mmuidx_async_1,
                               RUN_ON_CPU_TARGET_PTR(addr | idxmap));
     } else {
-        CPUState *dst_cpu;
         TLBFlushPageByMMUIdxData *d;
 
-        /* Allocate a separate data block for each destination cpu.  */
-        CPU_FOREACH(dst_cpu) {
-            if (dst_cpu != src_cpu) {
-                d = g_new(TLBFlushPageByMMUIdxData, 1);
-                d->addr = addr;
-                d->idxmap = idxmap;
-                async_run_on_cpu(dst_cpu, tlb_flush_page_by_mmuidx_async_2,
-                                 RUN_ON_CPU_HOST_PTR(d));
-            }
-        }
-
         d = g_new(TLBFlushPageByMMUIdxData, 1);
         d->addr = addr;
         d->idxmap = idxmap;
@@ -710,13 +809,6 @@ static void tlb_flush_range_locked(CPUState *cpu, int midx,
     }
 }
 
-typedef struct {
-    vaddr addr;
-    vaddr len;
-    MMUIdxMap idxmap;
-    unsigned bits;
-} TLBFlushRangeData;
-
 static void tlb_flush_range_by_mmuidx_async_0(CPUState *cpu,
                                               TLBFlushRangeData d)
 {
@@ -739,7 +831,7 @@ static void tlb_flush_range_by_mmuidx_async_0(CPUState *cpu,
      * If the length is larger than the jump cache size, then it will take
      * longer to clear each entry individually than it will to clear it all.
      */
-    if (d.len >= (TARGET_PAGE_SIZE * TB_JMP_CACHE_SIZE)) {
+    if (d.len >= ((vaddr)TARGET_PAGE_SIZE << tb_jmp_cache_bits)) {
         tcg_flush_jmp_cache(cpu);
         return;
     }
@@ -763,6 +855,34 @@ static void tlb_flush_range_by_mmuidx_async_1(CPUState *cpu,
     g_free(d);
 }
 
+/* Perform all the flushes queued on @cpu by tlb_queue_flush. */
+static void tlb_flush_pending_work(CPUState *cpu, run_on_cpu_data data)
+{
+    CPUTLBPending *p = cpu->neg.tlb.c.pending;
+    TLBFlushRangeData ranges[TLB_PENDING_RANGES];
+    MMUIdxMap full;
+    unsigned i, n;
+
+    qemu_spin_lock(&p->lock);
+    full = p->full;
+    n = p->n_ranges;
+    memcpy(ranges, p->ranges, n * sizeof(ranges[0]));
+    p->full = 0;
+    p->n_ranges = 0;
+    p->queued = false;
+    qemu_spin_unlock(&p->lock);
+
+    if (full) {
+        tlb_flush_by_mmuidx_async_work(cpu, RUN_ON_CPU_HOST_INT(full));
+    }
+    for (i = 0; i < n; i++) {
+        ranges[i].idxmap &= ~full;
+        if (ranges[i].idxmap) {
+            tlb_flush_range_by_mmuidx_async_0(cpu, ranges[i]);
+        }
+    }
+}
+
 void tlb_flush_range_by_mmuidx(CPUState *cpu, vaddr addr,
                                vaddr len, MMUIdxMap idxmap,
                                unsigned bits)
@@ -807,7 +927,6 @@ void tlb_flush_range_by_mmuidx_all_cpus_synced(CPUState *src_cpu,
                                                unsigned bits)
 {
     TLBFlushRangeData d, *p;
-    CPUState *dst_cpu;
 
     /* If no page bits are significant, this devolves to tlb_flush. */
     if (bits < TARGET_PAGE_BITS) {
@@ -829,14 +948,7 @@ void tlb_flush_range_by_mmuidx_all_cpus_synced(CPUState *src_cpu,
     d.idxmap = idxmap;
     d.bits = bits;
 
-    /* Allocate a separate data block for each destination cpu.  */
-    CPU_FOREACH(dst_cpu) {
-        if (dst_cpu != src_cpu) {
-            p = g_memdup(&d, sizeof(d));
-            async_run_on_cpu(dst_cpu, tlb_flush_range_by_mmuidx_async_1,
-                             RUN_ON_CPU_HOST_PTR(p));
-        }
-    }
+    flush_all_helper(src_cpu, 0, &d);
 
     p = g_memdup(&d, sizeof(d));
     async_safe_run_on_cpu(src_cpu, tlb_flush_range_by_mmuidx_async_1,
@@ -972,7 +1084,8 @@ static void tlb_set_dirty(CPUState *cpu, vaddr addr)
 }
 
 /* Our TLB does not support large pages, so remember the area covered by
-   large pages and trigger a full TLB flush if these are invalidated.  */
+   large pages and trigger a full TLB flush if these are invalidated.
+   This also covers every entry of the large page table.  */
 static void tlb_add_large_page(CPUState *cpu, int mmu_idx,
                                vaddr addr, uint64_t size)
 {
@@ -995,6 +1108,39 @@ static void tlb_add_large_page(CPUState *cpu, int mmu_idx,
     cpu->neg.tlb.d[mmu_idx].large_page_mask = lp_mask;
 }
 
+/*
+ * Remember the translation of the large page containing @addr, so that
+ * further misses within it can be refilled without calling tlb_fill.
+ * Pages whose writes must always go back to the target are not cached.
+ */
+static void tlb_add_large_page_entry(CPUState *cpu, int mmu_idx,
+                                     vaddr addr, const CPUTLBEntryFull *full)
+{
+    CPUTLBDesc *desc = &cpu->neg.tlb.d[mmu_idx];
+    vaddr lp_addr = addr & ~(((vaddr)1 << full->lg_page_size) - 1);
+    size_t lidx;
+
+    if (full->lg_page_size >= 64 || (full->prot & PAGE_WRITE_INV)) {
+        return;
+    }
+
+    /* Replace an existing entry for the same page, e.g. with new prot. */
+    for (lidx = 0; lidx < CPU_LTLB_SIZE; ++lidx) {
+        if (desc->ltable[lidx] == lp_addr &&
+            desc->lfulltlb[lidx].lg_page_size == full->lg_page_size) {
+            break;
+        }
+    }
+    if (lidx == CPU_LTLB_SIZE) {
+        lidx = desc->lindex++ % CPU_LTLB_SIZE;
+    }
+
+    desc->ltable[lidx] = lp_addr;
+    desc->lfulltlb[lidx] = *full;
+    desc->lfulltlb[lidx].phys_addr = (full->phys_addr & TARGET_PAGE_MASK) -
+                                     ((addr & TARGET_PAGE_MASK) - lp_addr);
+}
+
 static inline void tlb_set_compare(CPUTLBEntryFull *full, CPUTLBEntry *ent,
                                    vaddr address, int flags,
                                    MMUAccessType access_type, bool enable)
@@ -1042,6 +1188,7 @@ void tlb_set_page_full(CPUState *cpu, int mmu_idx,
     } else {
         sz = (hwaddr)1 << full->lg_page_size;
         tlb_add_large_page(cpu, mmu_idx, addr, sz);
+        tlb_add_large_page_entry(cpu, mmu_idx, addr, full);
     }
     addr_page = addr & TARGET_PAGE_MASK;
     paddr_page = full->phys_addr & TARGET_PAGE_MASK;
@@ -1333,6 +1480,46 @@ static bool victim_tlb_hit(CPUState *cpu, size_t mmu_idx, size_t index,
     return false;
 }
 
+/*
+ * Return true if @addr lies within a large page translated by an earlier
+ * tlb_fill with the permissions required by @access_type, and a tlb entry
+ * for its page has been created from that translation.
+ */
+static bool large_tlb_hit(CPUState *cpu, size_t mmu_idx,
+                          MMUAccessType access_type, vaddr addr)
+{
+    static const uint8_t access_prot[MMU_ACCESS_COUNT] = {
+        [MMU_DATA_LOAD] = PAGE_READ,
+        [MMU_DATA_STORE] = PAGE_WRITE,
+        [MMU_INST_FETCH] = PAGE_EXEC,
+    };
+    CPUTLBDesc *desc = &cpu->neg.tlb.d[mmu_idx];
+    size_t lidx;
+
+    assert_cpu_is_self(cpu);
+    for (lidx = 0; lidx < CPU_LTLB_SIZE; ++lidx) {
+        vaddr lp_addr = desc->ltable[lidx];
+        CPUTLBEntryFull full = desc->lfulltlb[lidx];
+        vaddr lp_mask = ~(((vaddr)1 << full.lg_page_size) - 1);
+
+        if (lp_addr == (vaddr)-1 || (addr & lp_mask) != lp_addr) {
+            continue;
+        }
+        if (!(full.prot & access_prot[access_type])) {
+            return false;
+        }
+
+        full.phys_addr += (addr & TARGET_PAGE_MASK) - lp_addr;
+        tlb_set_page_full(cpu, mmu_idx, addr, &full);
+        qatomic_set(&cpu->neg.tlb.c.large_hit_count,
+                    cpu->neg.tlb.c.large_hit_count + 1);
+
+        return tlb_hit(tlb_read_idx(tlb_entry(cpu, mmu_idx, addr),
+                                    access_type), addr);
+    }
+    return false;
+}
+
 static void notdirty_write(CPUState *cpu, vaddr mem_vaddr, unsigned size,
                            CPUTLBEntryFull *full, uintptr_t retaddr)
 {
@@ -1372,7 +1559,8 @@ static int probe_access_internal(CPUState *cpu, vaddr addr,
     CPUTLBEntryFull *full;
 
     if (!tlb_hit_page(tlb_addr, page_addr)) {
-        if (!victim_tlb_hit(cpu, mmu_idx, index, access_type, page_addr)) {
+        if (!victim_tlb_hit(cpu, mmu_idx, index, access_type, page_addr) &&
+            !large_tlb_hit(cpu, mmu_idx, access_type, addr)) {
             if (!tlb_fill_align(cpu, addr, access_type, mmu_idx,
                                 0, fault_size, nonfault, retaddr)) {
                 /* Non-faulting page table read failed.  */
@@ -1653,7 +1841,8 @@ static bool mmu_lookup1(CPUState *cpu, MMULookupPageData *data, MemOp memop,
     /* If the TLB entry is for a different page, reload and try again.  */
     if (!tlb_hit(tlb_addr, addr)) {
         if (!victim_tlb_hit(cpu, mmu_idx, index, access_type,
-                            addr & TARGET_PAGE_MASK)) {
+                            addr & TARGET_PAGE_MASK) &&
+            !large_tlb_hit(cpu, mmu_idx, access_type, addr)) {
             tlb_fill_align(cpu, addr, access_type, mmu_idx,
                            memop, data->size, false, ra);
             maybe_resized = true;
@@ -1818,11 +2007,26 @@ static void *atomic_mmu_lookup(CPUState *cpu, vaddr addr, MemOpIdx oi,
     index = tlb_index(cpu, mmu_idx, addr);
     tlbe = tlb_entry(cpu, mmu_idx, addr);
 
-    /* Check TLB entry and enforce page permissions.  */
+    /*
+     * Fast path for naturally aligned RMW on plain, dirty RAM:
+     * with no flags set in either comparator there can be no
+     * watchpoint, MMIO or discard in the slow flags, so we need
+     * not touch the CPUTLBEntryFull at all.  An invalid addr_read
+     * (-1) has every flag bit set and so falls through below.
+     */
     tlb_addr = tlb_addr_write(tlbe);
+    if (likely(tlb_hit(tlb_addr, addr)
+               && !((tlb_addr | tlbe->addr_read) & TLB_FLAGS_MASK)
+               && !(addr & (((1 << memop_alignment_bits(mop)) - 1)
+                            | (size - 1))))) {
+        return (void *)((uintptr_t)addr + tlbe->addend);
+    }
+
+    /* Check TLB entry and enforce page permissions.  */
     if (!tlb_hit(tlb_addr, addr)) {
         if (!victim_tlb_hit(cpu, mmu_idx, index, MMU_DATA_STORE,
-                            addr & TARGET_PAGE_MASK)) {
+                            addr & TARGET_PAGE_MASK) &&
+            !large_tlb_hit(cpu, mmu_idx, MMU_DATA_STORE, addr)) {
             tlb_fill_align(cpu, addr, MMU_DATA_STORE, mmu_idx,
                            mop, size, false, retaddr);
             did_tlb_fill = true;
@@ -18,6 +18,7 @@ extern int64_t max_delay;
 extern int64_t max_advance;
 
 extern bool one_insn_per_tb;
+extern bool tb_profile_enabled;
 
 extern bool icount_align_option;
 
@@ -10,6 +10,8 @@
 #include "qapi/error.h"
 #include "qapi/type-helpers.h"
 #include "qapi/qapi-commands-machine.h"
+#include "qobject/qdict.h"
+#include "monitor/hmp.h"
 #include "monitor/monitor.h"
 #include "system/tcg.h"
 #include "tcg/tcg.h"
@@ -29,9 +31,148 @@ HumanReadableText *qmp_x_query_jit(Error **errp)
     return human_readable_text_from_str(buf);
 }
 
+typedef struct JitTbEntry {
+    vaddr pc;
+    tb_page_addr_t phys_pc;
+    bool pcrel;
+    unsigned direct;
+    size_t host_size;
+    TBProfile prof;
+} JitTbEntry;
+
+static gboolean jit_tb_collect(gpointer key, gpointer value, gpointer data)
+{
+    const TranslationBlock *tb = value;
+    GArray *entries = data;
+    JitTbEntry e = {
+        .pc = tb->pc,
+        .phys_pc = tb_page_addr0(tb),
+        .pcrel = tb_cflags(tb) & CF_PCREL,
+        .direct = (tb->jmp_reset_offset[0] != TB_JMP_OFFSET_INVALID) +
+                  (tb->jmp_reset_offset[1] != TB_JMP_OFFSET_INVALID),
+        .host_size = tb->tc.size,
+        .prof = tb->prof,
+    };
+
+    g_array_append_val(entries, e);
+    return false;
+}
+
+static uint64_t jit_tb_key(const JitTbEntry *e, JitTbSortKey sort_by)
+{
+    switch (sort_by) {
+    case JIT_TB_SORT_KEY_EXEC:
+        return e->prof.exec_count;
+    case JIT_TB_SORT_KEY_HOST_SIZE:
+        return e->host_size;
+    case JIT_TB_SORT_KEY_SPILLS:
+        return e->prof.spills;
+    case JIT_TB_SORT_KEY_CALLS:
+        return e->prof.calls;
+    default:
+        g_assert_not_reached();
+    }
+}
+
+static gint jit_tb_cmp(gconstpointer a, gconstpointer b, gpointer opaque)
+{
+    JitTbSortKey sort_by = *(JitTbSortKey *)opaque;
+    uint64_t ka = jit_tb_key(a, sort_by);
+    uint64_t kb = jit_tb_key(b, sort_by);
+
+    /* Descending order. */
+    return ka < kb ? 1 : ka > kb ? -1 : 0;
+}
+
+HumanReadableText *qmp_x_query_jit_tbs(bool has_sort_by,
+                                       JitTbSortKey sort_by,
+                                       bool has_max, uint32_t max,
+                                       Error **errp)
+{
+    g_autoptr(GString) buf = g_string_new("");
+    g_autoptr(GArray) entries = NULL;
+    guint i, n;
+
+    if (!tcg_enabled()) {
+        error_setg(errp, "JIT information is only available with accel=tcg");
+        return NULL;
+    }
+    if (!has_sort_by) {
+        sort_by = JIT_TB_SORT_KEY_EXEC;
+    }
+    if (!has_max) {
+        max = 10;
+    }
+
+    /*
+     * Copy out what we report: the TBs themselves may be discarded
+     * by a concurrent flush once the region trees are unlocked.
+     */
+    entries = g_array_new(false, false, sizeof(JitTbEntry));
+    tcg_tb_foreach(jit_tb_collect, entries);
+    g_array_sort_with_data(entries, jit_tb_cmp, &sort_by);
+
+    n = MIN(entries->len, max);
+    g_string_append_printf(buf, "%u of %u TBs sorted by %s%s\n", n,
+                           entries->len, JitTbSortKey_str(sort_by),
+                           qatomic_read(&tb_profile_enabled) ? "" :
+                           " (tb-profile is off)");
+    g_string_append_printf(buf, "%20s %8s %6s %5s %15s  %s\n",
+                           "exec", "host", "spills", "calls",
+                           "tb/ptr/exit", "pc");
+    for (i = 0; i < n; i++) {
+        const JitTbEntry *e = &g_array_index(entries, JitTbEntry, i);
+
+        g_string_append_printf(buf, "%20" PRIu64 " %8zu %6u %5u %5u/%4u/%4u  ",
+                               e->prof.exec_count, e->host_size,
+                               e->prof.spills, e->prof.calls, e->direct,
+                               e->prof.goto_ptr, e->prof.exit_tb);
+        if (e->pcrel) {
+            g_string_append_printf(buf, "phys 0x" TB_PAGE_ADDR_FMT "\n",
+                                   e->phys_pc);
+        } else {
+            g_string_append_printf(buf, "0x%" VADDR_PRIx
+                                   " (phys 0x" TB_PAGE_ADDR_FMT ")\n",
+                                   e->pc, e->phys_pc);
+        }
+    }
+
+    return human_readable_text_from_str(buf);
+}
+
+static void hmp_info_jit_tbs(Monitor *mon, const QDict *qdict)
+{
+    bool spills = qdict_get_try_bool(qdict, "spills", false);
+    bool calls = qdict_get_try_bool(qdict, "calls", false);
+    bool host = qdict_get_try_bool(qdict, "host", false);
+    int64_t max = qdict_get_try_int(qdict, "max", 10);
+    JitTbSortKey sort_by = JIT_TB_SORT_KEY_EXEC;
+    g_autoptr(HumanReadableText) info = NULL;
+    Error *err = NULL;
+
+    if (spills) {
+        sort_by = JIT_TB_SORT_KEY_SPILLS;
+    } else if (calls) {
+        sort_by = JIT_TB_SORT_KEY_CALLS;
+    } else if (host) {
+        sort_by = JIT_TB_SORT_KEY_HOST_SIZE;
+    }
+    if (max < 0 || max > UINT32_MAX) {
+        monitor_printf(mon, "Invalid maximum number of TBs\n");
+        return;
+    }
+
+    info = qmp_x_query_jit_tbs(true, sort_by, true, max, &err);
+    if (hmp_handle_error(mon, err)) {
+        return;
+    }
+    monitor_puts(mon, info->human_readable_text);
+}
+
 static void hmp_tcg_register(void)
 {
     monitor_register_hmp_info_hrt("jit", qmp_x_query_jit);
+    monitor_register_hmp("jit-tbs", true, hmp_info_jit_tbs);
 }
 
 type_init(hmp_tcg_register);
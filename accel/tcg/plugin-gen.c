@@ -248,6 +248,63 @@ static void gen_mem_cb(struct qemu_plugin_regular_cb *cb,
     tcg_temp_free_i32(clear_flags);
 }
 
+/* Append a record to the vCPU's buffer; no branch, see qemu_plugin_mem_batch */
+static void gen_mem_batch_record(struct qemu_plugin_mem_batch_cb *cb,
+                                 qemu_plugin_meminfo_t meminfo, TCGv_i64 addr)
+{
+    struct qemu_plugin_mem_batch *batch = cb->batch;
+    qemu_plugin_u64 head = { .score = batch->score, .offset = 0 };
+    TCGv_ptr base = gen_plugin_u64_ptr(head);
+    TCGv_ptr rec = tcg_temp_ebb_new_ptr();
+    TCGv_i64 count = tcg_temp_ebb_new_i64();
+    TCGv_i64 idx = tcg_temp_ebb_new_i64();
+    const size_t hdr = QEMU_PLUGIN_MEM_BATCH_HDR;
+
+    tcg_gen_ld_i64(count, base, 0);
+    tcg_gen_umin_i64(idx, count,
+                     tcg_constant_i64(batch->n_records +
+                                      QEMU_PLUGIN_MEM_BATCH_SLACK - 1));
+    tcg_gen_muli_i64(idx, idx, sizeof(qemu_plugin_mem_record));
+    tcg_gen_trunc_i64_ptr(rec, idx);
+    tcg_gen_add_ptr(rec, rec, base);
+
+    tcg_gen_st_i64(addr, rec, hdr + offsetof(qemu_plugin_mem_record, vaddr));
+    tcg_gen_st_i64(tcg_constant_i64(cb->pc), rec,
+                   hdr + offsetof(qemu_plugin_mem_record, pc));
+    tcg_gen_st_i32(tcg_constant_i32(meminfo), rec,
+                   hdr + offsetof(qemu_plugin_mem_record, info));
+
+    tcg_gen_addi_i64(count, count, 1);
+    tcg_gen_st_i64(count, base, 0);
+
+    tcg_temp_free_i64(idx);
+    tcg_temp_free_i64(count);
+    tcg_temp_free_ptr(rec);
+    tcg_temp_free_ptr(base);
+}
+
+/* Hand the buffer to the plugin once it is full */
+static void gen_mem_batch_flush(struct qemu_plugin_mem_batch_cb *cb)
+{
+    struct qemu_plugin_mem_batch *batch = cb->batch;
+    qemu_plugin_u64 head = { .score = batch->score, .offset = 0 };
+    TCGv_ptr base = gen_plugin_u64_ptr(head);
+    TCGv_i64 count = tcg_temp_ebb_new_i64();
+    TCGLabel *after_cb = gen_new_label();
+
+    tcg_gen_ld_i64(count, base, 0);
+    tcg_gen_brcondi_i64(TCG_COND_LTU, count, batch->n_records, after_cb);
+    TCGv_i32 cpu_index = gen_cpu_index();
+    tcg_gen_call2(cb->flush, cb->info, NULL,
+                  tcgv_i32_temp(cpu_index),
+                  tcgv_ptr_temp(tcg_constant_ptr(batch)));
+    tcg_temp_free_i32(cpu_index);
+    gen_set_label(after_cb);
+
+    tcg_temp_free_i64(count);
+    tcg_temp_free_ptr(base);
+}
+
 static void inject_cb(struct qemu_plugin_dyn_cb *cb)
 
 {
@@ -264,11 +321,53 @@ static void inject_cb(struct qemu_plugin_dyn_cb *cb)
     case PLUGIN_CB_INLINE_STORE_U64:
         gen_inline_store_u64_cb(&cb->inline_insn);
         break;
+    case PLUGIN_CB_MEM_BATCH:
+        gen_mem_batch_flush(&cb->mem_batch);
+        break;
     default:
         g_assert_not_reached();
     }
 }
 
+static bool plugin_u64_same_entry(qemu_plugin_u64 a, qemu_plugin_u64 b)
+{
+    return a.score == b.score && a.offset == b.offset;
+}
+
+static void inject_cbs(const GArray *cbs)
+{
+    int i, n;
+
+    for (i = 0, n = (cbs ? cbs->len : 0); i < n; i++) {
+        struct qemu_plugin_dyn_cb *cb =
+            &g_array_index(cbs, struct qemu_plugin_dyn_cb, i);
+
+        /*
+         * Fold a run of additions to the same counter into a single
+         * load/add/store, e.g. a plugin counting both TBs and insns
+         * with the same entry.
+         */
+        if (cb->type == PLUGIN_CB_INLINE_ADD_U64) {
+            struct qemu_plugin_inline_cb add = cb->inline_insn;
+
+            while (i + 1 < n) {
+                struct qemu_plugin_dyn_cb *next =
+                    &g_array_index(cbs, struct qemu_plugin_dyn_cb, i + 1);
+                if (next->type != PLUGIN_CB_INLINE_ADD_U64 ||
+                    !plugin_u64_same_entry(next->inline_insn.entry,
+                                           add.entry)) {
+                    break;
+                }
+                add.imm += next->inline_insn.imm;
+                i++;
+            }
+            gen_inline_add_u64_cb(&add);
+            continue;
+        }
+        inject_cb(cb);
+    }
+}
+
 static void inject_mem_cb(struct qemu_plugin_dyn_cb *cb,
                           enum qemu_plugin_mem_rw rw,
                           qemu_plugin_meminfo_t meminfo, TCGv_i64 addr)
@@ -285,6 +384,11 @@ static void inject_mem_cb(struct qemu_plugin_dyn_cb *cb,
             inject_cb(cb);
         }
         break;
+    case PLUGIN_CB_MEM_BATCH:
+        if (rw & cb->mem_batch.rw) {
+            gen_mem_batch_record(&cb->mem_batch, meminfo, addr);
+        }
+        break;
     default:
         g_assert_not_reached();
     }
@@ -323,8 +427,6 @@ static void plugin_gen_inject(struct qemu_plugin_tb *plugin_tb)
         {
             enum plugin_gen_from from = op->args[0];
             struct qemu_plugin_insn *insn = NULL;
-            const GArray *cbs;
-            int i, n;
 
             if (insn_idx >= 0) {
                 insn = g_ptr_array_index(plugin_tb->insns, insn_idx);
@@ -349,11 +451,7 @@ static void plugin_gen_inject(struct qemu_plugin_tb *plugin_tb)
             case PLUGIN_GEN_FROM_TB:
                 assert(insn == NULL);
 
-                cbs = plugin_tb->cbs;
-                for (i = 0, n = (cbs ? cbs->len : 0); i < n; i++) {
-                    inject_cb(
-                        &g_array_index(cbs, struct qemu_plugin_dyn_cb, i));
-                }
+                inject_cbs(plugin_tb->cbs);
                 break;
 
             case PLUGIN_GEN_FROM_INSN:
@@ -361,11 +459,7 @@ static void plugin_gen_inject(struct qemu_plugin_tb *plugin_tb)
 
                 gen_enable_mem_helper(plugin_tb, insn);
 
-                cbs = insn->insn_cbs;
-                for (i = 0, n = (cbs ? cbs->len : 0); i < n; i++) {
-                    inject_cb(
-                        &g_array_index(cbs, struct qemu_plugin_dyn_cb, i));
-                }
+                inject_cbs(insn->insn_cbs);
                 break;
 
             default:
@@ -12,9 +12,21 @@
 #include "qemu/rcu.h"
 #include "exec/cpu-common.h"
 
+/* Default geometry: 4096 sets of one entry each, i.e. direct mapped. */
 #define TB_JMP_CACHE_BITS 12
 #define TB_JMP_CACHE_SIZE (1 << TB_JMP_CACHE_BITS)
 
+#define TB_JMP_CACHE_MIN_SIZE 256
+#define TB_JMP_CACHE_MAX_SIZE (1 << 20)
+#define TB_JMP_CACHE_MAX_WAYS 4
+
+/* Number of slots of the indirect branch cache, a power of 2. */
+#define TB_IBC_SIZE 256
+
+/* Geometry of the caches of vCPUs created from now on. */
+extern unsigned int tb_jmp_cache_bits;
+extern unsigned int tb_jmp_cache_ways;
+
 /*
  * Invalidated in parallel; all accesses to 'tb' must be atomic.
  * A valid entry is read/written by a single CPU, therefore there is
@@ -22,12 +34,40 @@
  * non-NULL value of 'tb'.  Strictly speaking pc is only needed for
  * CF_PCREL, but it's used always for simplicity.
  */
+typedef struct CPUJumpCacheEntry {
+    TranslationBlock *tb;
+    vaddr pc;
+} CPUJumpCacheEntry;
+
+/*
+ * The cache has 1 << @bits sets of @ways entries each.  The entries of
+ * a set are kept in most recently used first order; only the owning CPU
+ * reorders them.  @hits and @misses are only written by the owning CPU.
+ *
+ * @ibc is the indirect branch cache: every indirect jump site emitted by
+ * translator_lookup_and_goto_ptr_cached() owns a slot, which holds the TB
+ * the site jumped to last.  Generated code reads the slots directly; they
+ * follow the same rules as the entries of @array.
+ */
 typedef struct CPUJumpCache {
     struct rcu_head rcu;
-    struct {
-        TranslationBlock *tb;
-        vaddr pc;
-    } array[TB_JMP_CACHE_SIZE];
+    unsigned int bits;
+    unsigned int ways;
+    size_t hits;
+    size_t misses;
+    CPUJumpCacheEntry ibc[TB_IBC_SIZE];
+    CPUJumpCacheEntry array[];
 } CPUJumpCache;
 
+static inline size_t tb_jmp_cache_entries(const CPUJumpCache *jc)
+{
+    return (size_t)jc->ways << jc->bits;
+}
+
+static inline CPUJumpCacheEntry *tb_jmp_cache_set(CPUJumpCache *jc,
+                                                  unsigned int hash)
+{
+    return &jc->array[hash * jc->ways];
+}
+
 #endif /* ACCEL_TCG_TB_JMP_CACHE_H */
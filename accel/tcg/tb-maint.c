@@ -20,6 +20,7 @@
 #include "qemu/osdep.h"
 #include "qemu/interval-tree.h"
 #include "qemu/qtree.h"
+#include "qemu/plugin.h"
 #include "exec/cputlb.h"
 #include "exec/log.h"
 #include "exec/page-protection.h"
@@ -807,6 +808,68 @@ void queue_tb_flush(CPUState *cs)
     }
 }
 
+static void tb_reclaim_evict(TranslationBlock *tb)
+{
+    tb_phys_invalidate(tb, -1);
+}
+
+/*
+ * Free up code buffer space by invalidating only the TBs of the oldest
+ * regions.  Returns false if the caller must flush everything instead.
+ * Must be called from an exclusive context.
+ */
+static bool tb_reclaim__exclusive(void)
+{
+    size_t n;
+
+#ifdef CONFIG_PLUGIN
+    CPUState *cpu;
+
+    /*
+     * Plugin instrumentation data is only released by a full flush,
+     * and plugins expect to see one when the cache is recycled.
+     */
+    CPU_FOREACH(cpu) {
+        if (cpu->plugin_state &&
+            !bitmap_empty(cpu->plugin_state->event_mask, QEMU_PLUGIN_EV_MAX)) {
+            return false;
+        }
+    }
+#endif
+
+    mmap_lock();
+    qemu_thread_jit_write();
+    n = tcg_region_reclaim(tb_reclaim_evict);
+    qemu_thread_jit_execute();
+    mmap_unlock();
+
+    if (n == 0) {
+        return false;
+    }
+    trace_tb_reclaim(n);
+    qatomic_inc(&tb_ctx.tb_reclaim_count);
+    return true;
+}
+
+static void do_tb_reclaim(CPUState *cpu, run_on_cpu_data tb_gen)
+{
+    unsigned gen = tb_ctx.tb_flush_count + tb_ctx.tb_reclaim_count;
+
+    /* If space was already made on request of another CPU, just retry. */
+    if (gen == tb_gen.host_int && !tb_reclaim__exclusive()) {
+        tb_flush__exclusive_or_serial();
+    }
+}
+
+void queue_tb_reclaim(CPUState *cs)
+{
+    if (tcg_enabled()) {
+        unsigned gen = qatomic_read(&tb_ctx.tb_flush_count) +
+                       qatomic_read(&tb_ctx.tb_reclaim_count);
+        async_safe_run_on_cpu(cs, do_tb_reclaim, RUN_ON_CPU_HOST_INT(gen));
+    }
+}
+
 /* remove @orig from its @n_orig-th jump list */
 static inline void tb_remove_from_jmp_list(TranslationBlock *orig, int n_orig)
 {
@@ -901,13 +964,15 @@ static void tb_jmp_cache_inval_tb(TranslationBlock *tb)
             tcg_flush_jmp_cache(cpu);
         }
     } else {
-        uint32_t h = tb_jmp_cache_hash_func(tb->pc);
-
         CPU_FOREACH(cpu) {
             CPUJumpCache *jc = cpu->tb_jmp_cache;
+            CPUJumpCacheEntry *set;
 
-            if (qatomic_read(&jc->array[h].tb) == tb) {
-                qatomic_set(&jc->array[h].tb, NULL);
+            set = tb_jmp_cache_set(jc, tb_jmp_cache_hash_func(jc, tb->pc));
+            for (unsigned int way = 0; way < jc->ways; way++) {
+                if (qatomic_read(&set[way].tb) == tb) {
+                    qatomic_set(&set[way].tb, NULL);
+                }
             }
         }
     }
@@ -35,6 +35,7 @@
 #include "qapi/qapi-types-common.h"
 #include "qapi/qapi-builtin-visit.h"
 #include "qemu/units.h"
+#include "qemu/host-utils.h"
 #include "qemu/target-info.h"
 #ifndef CONFIG_USER_ONLY
 #include "hw/core/boards.h"
@@ -45,6 +46,7 @@
 #include "accel/accel-cpu-ops.h"
 #include "accel/tcg/cpu-ops.h"
 #include "internal-common.h"
+#include "tb-jmp-cache.h"
 
 
 struct TCGState {
@@ -52,8 +54,11 @@ struct TCGState {
 
     OnOffAuto mttcg_enabled;
     bool one_insn_per_tb;
+    bool tb_profile;
     int splitwx_enabled;
     unsigned long tb_size;
+    uint32_t jmp_cache_size;
+    uint32_t jmp_cache_ways;
 };
 typedef struct TCGState TCGState;
 
@@ -80,9 +85,14 @@ static void tcg_accel_instance_init(Object *obj)
 #else
     s->splitwx_enabled = 0;
 #endif
+    s->jmp_cache_size = TB_JMP_CACHE_SIZE;
+    s->jmp_cache_ways = 1;
 }
 
 bool one_insn_per_tb;
+bool tb_profile_enabled;
+unsigned int tb_jmp_cache_bits = TB_JMP_CACHE_BITS;
+unsigned int tb_jmp_cache_ways = 1;
 
 #ifndef CONFIG_USER_ONLY
 static void tcg_vm_change_state(void *opaque, bool running, RunState state)
@@ -149,6 +159,9 @@ static int tcg_init_machine(AccelState *as, MachineState *ms)
 
     tcg_allowed = true;
 
+    tb_jmp_cache_bits = ctz32(s->jmp_cache_size / s->jmp_cache_ways);
+    tb_jmp_cache_ways = s->jmp_cache_ways;
+
     page_init();
     tb_htable_init();
     tcg_init(s->tb_size * MiB, s->splitwx_enabled, max_threads);
@@ -216,6 +229,65 @@ static void tcg_set_tb_size(Object *obj, Visitor *v,
     s->tb_size = value;
 }
 
+static void tcg_get_jmp_cache_size(Object *obj, Visitor *v,
+                                   const char *name, void *opaque,
+                                   Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value = s->jmp_cache_size;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void tcg_set_jmp_cache_size(Object *obj, Visitor *v,
+                                   const char *name, void *opaque,
+                                   Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+    if (!is_power_of_2(value) ||
+        value < TB_JMP_CACHE_MIN_SIZE || value > TB_JMP_CACHE_MAX_SIZE) {
+        error_setg(errp, "tb-jmp-cache-size must be a power of 2 "
+                   "between %u and %u", TB_JMP_CACHE_MIN_SIZE,
+                   TB_JMP_CACHE_MAX_SIZE);
+        return;
+    }
+
+    s->jmp_cache_size = value;
+}
+
+static void tcg_get_jmp_cache_ways(Object *obj, Visitor *v,
+                                   const char *name, void *opaque,
+                                   Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value = s->jmp_cache_ways;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void tcg_set_jmp_cache_ways(Object *obj, Visitor *v,
+                                   const char *name, void *opaque,
+                                   Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+    if (!is_power_of_2(value) || value > TB_JMP_CACHE_MAX_WAYS) {
+        error_setg(errp, "tb-jmp-cache-ways must be 1, 2 or 4");
+        return;
+    }
+
+    s->jmp_cache_ways = value;
+}
+
 static bool tcg_get_splitwx(Object *obj, Error **errp)
 {
     TCGState *s = TCG_STATE(obj);
@@ -242,6 +314,20 @@ static void tcg_set_one_insn_per_tb(Object *obj, bool value, Error **errp)
     qatomic_set(&one_insn_per_tb, value);
 }
 
+static bool tcg_get_tb_profile(Object *obj, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    return s->tb_profile;
+}
+
+static void tcg_set_tb_profile(Object *obj, bool value, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    s->tb_profile = value;
+    /* Takes effect for blocks translated from now on. */
+    qatomic_set(&tb_profile_enabled, value);
+}
+
 static int tcg_gdbstub_supported_sstep_flags(AccelState *as)
 {
     /*
@@ -278,6 +364,18 @@ static void tcg_accel_class_init(ObjectClass *oc, const void *data)
     object_class_property_set_description(oc, "tb-size",
         "TCG translation block cache size");
 
+    object_class_property_add(oc, "tb-jmp-cache-size", "int",
+        tcg_get_jmp_cache_size, tcg_set_jmp_cache_size,
+        NULL, NULL);
+    object_class_property_set_description(oc, "tb-jmp-cache-size",
+        "Number of entries in each vCPU's TB jump cache");
+
+    object_class_property_add(oc, "tb-jmp-cache-ways", "int",
+        tcg_get_jmp_cache_ways, tcg_set_jmp_cache_ways,
+        NULL, NULL);
+    object_class_property_set_description(oc, "tb-jmp-cache-ways",
+        "Associativity of the TB jump cache (1, 2 or 4)");
+
     object_class_property_add_bool(oc, "split-wx",
         tcg_get_splitwx, tcg_set_splitwx);
     object_class_property_set_description(oc, "split-wx",
@@ -288,6 +386,12 @@ static void tcg_accel_class_init(ObjectClass *oc, const void *data)
                                    tcg_set_one_insn_per_tb);
     object_class_property_set_description(oc, "one-insn-per-tb",
         "Only put one guest insn in each translation block");
+
+    object_class_property_add_bool(oc, "tb-profile",
+                                   tcg_get_tb_profile,
+                                   tcg_set_tb_profile);
+    object_class_property_set_description(oc, "tb-profile",
+        "Count executions of each translation block for info jit-tbs");
 }
 
 static const TypeInfo tcg_accel_type = {
@@ -16,6 +16,7 @@
 #include "tcg/tcg.h"
 #include "internal-common.h"
 #include "tb-context.h"
+#include "tb-jmp-cache.h"
 #include <math.h>
 
 static void dump_drift_info(GString *buf)
@@ -147,12 +148,54 @@ static void tlb_flush_counts(size_t *pfull, size_t *ppart, size_t *pelide)
     *pelide = elide;
 }
 
+static size_t tlb_large_hit_count(void)
+{
+    CPUState *cpu;
+    size_t hits = 0;
+
+    CPU_FOREACH(cpu) {
+        hits += qatomic_read(&cpu->neg.tlb.c.large_hit_count);
+    }
+    return hits;
+}
+
+static size_t tlb_coalesced_flush_count(void)
+{
+    CPUState *cpu;
+    size_t coalesced = 0;
+
+    CPU_FOREACH(cpu) {
+        coalesced += qatomic_read(&cpu->neg.tlb.c.coalesced_flush_count);
+    }
+    return coalesced;
+}
+
+static void tb_jmp_cache_counts(size_t *phits, size_t *pmisses)
+{
+    CPUState *cpu;
+    size_t hits = 0, misses = 0;
+
+    CPU_FOREACH(cpu) {
+        const CPUJumpCache *jc = cpu->tb_jmp_cache;
+
+        if (jc) {
+            hits += qatomic_read(&jc->hits);
+            misses += qatomic_read(&jc->misses);
+        }
+    }
+    *phits = hits;
+    *pmisses = misses;
+}
+
 static void tcg_dump_flush_info(GString *buf)
 {
     size_t flush_full, flush_part, flush_elide;
+    size_t jc_hits, jc_misses;
 
     g_string_append_printf(buf, "TB flush count      %u\n",
                            qatomic_read(&tb_ctx.tb_flush_count));
+    g_string_append_printf(buf, "TB reclaim count    %u\n",
+                           qatomic_read(&tb_ctx.tb_reclaim_count));
     g_string_append_printf(buf, "TB invalidate count %u\n",
                            qatomic_read(&tb_ctx.tb_phys_invalidate_count));
 
@@ -160,6 +203,17 @@ static void tcg_dump_flush_info(GString *buf)
     g_string_append_printf(buf, "TLB full flushes    %zu\n", flush_full);
     g_string_append_printf(buf, "TLB partial flushes %zu\n", flush_part);
     g_string_append_printf(buf, "TLB elided flushes  %zu\n", flush_elide);
+    g_string_append_printf(buf, "TLB large page refills %zu\n",
+                           tlb_large_hit_count());
+    g_string_append_printf(buf, "TLB coalesced remote flushes %zu\n",
+                           tlb_coalesced_flush_count());
+
+    tb_jmp_cache_counts(&jc_hits, &jc_misses);
+    g_string_append_printf(buf, "TB jmp cache hits   %zu\n", jc_hits);
+    g_string_append_printf(buf, "TB jmp cache misses %zu (%zu%%)\n",
+                           jc_misses,
+                           jc_hits + jc_misses ?
+                           (jc_misses * 100) / (jc_hits + jc_misses) : 0);
 }
 
 static void dump_exec_info(GString *buf)
@@ -294,7 +294,7 @@ TranslationBlock *tb_gen_code(CPUState *cpu, TCGTBCPUState s)
             tb_flush__exclusive_or_serial();
             goto buffer_overflow;
         }
-        queue_tb_flush(cpu);
+        queue_tb_reclaim(cpu);
         mmap_unlock();
         /* Make the execution loop process the flush as soon as possible.  */
         cpu->exception_index = EXCP_INTERRUPT;
@@ -634,7 +634,10 @@ void tcg_flush_jmp_cache(CPUState *cpu)
         return;
     }
 
-    for (int i = 0; i < TB_JMP_CACHE_SIZE; i++) {
+    for (size_t i = 0, n = tb_jmp_cache_entries(jc); i < n; i++) {
         qatomic_set(&jc->array[i].tb, NULL);
     }
+    for (size_t i = 0; i < TB_IBC_SIZE; i++) {
+        qatomic_set(&jc->ibc[i].tb, NULL);
+    }
 }
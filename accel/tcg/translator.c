@@ -20,6 +20,7 @@
 #include "internal-common.h"
 #include "disas/disas.h"
 #include "tb-internal.h"
+#include "tb-jmp-cache.h"
 
 static void set_can_do_io(DisasContextBase *db, bool val)
 {
@@ -82,6 +83,15 @@ static TCGOp *gen_tb_start(DisasContextBase *db, uint32_t cflags)
                          sizeof(CPUState));
     }
 
+    if (qatomic_read(&tb_profile_enabled)) {
+        TCGv_ptr ptr = tcg_constant_ptr(&db->tb->prof.exec_count);
+        TCGv_i64 n = tcg_temp_new_i64();
+
+        tcg_gen_ld_i64(n, ptr, 0);
+        tcg_gen_addi_i64(n, n, 1);
+        tcg_gen_st_i64(n, ptr, 0);
+    }
+
     return icount_start_insn;
 }
 
@@ -119,6 +129,73 @@ bool translator_use_goto_tb(DisasContextBase *db, vaddr dest)
     return translator_is_same_page(db, dest);
 }
 
+/* Jump sites take indirect branch cache slots in turn. */
+static unsigned int tb_ibc_next_slot;
+
+void translator_lookup_and_goto_ptr_cached(DisasContextBase *db, TCGv_i64 pc,
+                                           uint64_t cs_base, uint32_t flags)
+{
+    uint32_t cflags = tb_cflags(db->tb);
+    TCGLabel *miss;
+    TCGv_ptr jc, tb, ptr;
+    TCGv_i64 t64;
+    TCGv_i32 t32;
+    intptr_t ofs;
+    uint32_t slot;
+
+    /*
+     * TBs that stop early for breakpoints or single-stepping must go
+     * through the checks in the helper, and so must logged execution.
+     */
+    if ((cflags & (CF_NO_GOTO_PTR | CF_SINGLE_STEP | CF_BP_PAGE |
+                   CF_COUNT_MASK)) ||
+        qemu_loglevel_mask(CPU_LOG_TB_CPU | CPU_LOG_EXEC)) {
+        tcg_gen_lookup_and_goto_ptr();
+        return;
+    }
+
+    slot = qatomic_fetch_inc(&tb_ibc_next_slot) & (TB_IBC_SIZE - 1);
+    ofs = offsetof(CPUJumpCache, ibc) + slot * sizeof(CPUJumpCacheEntry);
+    miss = gen_new_label();
+
+    plugin_gen_disable_mem_helpers();
+
+    /* Breakpoints may be inserted without flushing anything. */
+    ptr = tcg_temp_new_ptr();
+    tcg_gen_ld_ptr(ptr, tcg_env,
+                   offsetof(CPUState, breakpoints.tqh_first) -
+                   sizeof(CPUState));
+    tcg_gen_brcondi_ptr(TCG_COND_NE, ptr, 0, miss);
+
+    jc = tcg_temp_new_ptr();
+    tcg_gen_ld_ptr(jc, tcg_env,
+                   offsetof(CPUState, tb_jmp_cache) - sizeof(CPUState));
+    tb = tcg_temp_new_ptr();
+    tcg_gen_ld_ptr(tb, jc, ofs + offsetof(CPUJumpCacheEntry, tb));
+    tcg_gen_brcondi_ptr(TCG_COND_EQ, tb, 0, miss);
+
+    t64 = tcg_temp_new_i64();
+    tcg_gen_ld_ptr(ptr, jc, ofs + offsetof(CPUJumpCacheEntry, pc));
+    tcg_gen_extu_ptr_i64(t64, ptr);
+    tcg_gen_brcond_i64(TCG_COND_NE, t64, pc, miss);
+    tcg_gen_ld_i64(t64, tb, offsetof(TranslationBlock, cs_base));
+    tcg_gen_brcondi_i64(TCG_COND_NE, t64, cs_base, miss);
+
+    t32 = tcg_temp_new_i32();
+    tcg_gen_ld_i32(t32, tb, offsetof(TranslationBlock, flags));
+    tcg_gen_brcondi_i32(TCG_COND_NE, t32, flags, miss);
+    /* This also fails for TBs that have been invalidated since. */
+    tcg_gen_ld_i32(t32, tb, offsetof(TranslationBlock, cflags));
+    tcg_gen_brcondi_i32(TCG_COND_NE, t32, cflags, miss);
+
+    tcg_gen_ld_ptr(ptr, tb, offsetof(TranslationBlock, tc.ptr));
+    tcg_gen_goto_ptr(ptr);
+
+    gen_set_label(miss);
+    gen_helper_lookup_tb_ptr_cached(ptr, tcg_env, tcg_constant_i32(slot));
+    tcg_gen_goto_ptr(ptr);
+}
+
 void translator_loop(CPUState *cpu, TranslationBlock *tb, int *max_insns,
                      vaddr pc, void *host_pc, const TranslatorOps *ops,
                      DisasContextBase *db)
@@ -24,6 +24,7 @@
 #include "tcg/tcg.h"
 #include "qemu/bitops.h"
 #include "qemu/rcu.h"
+#include "qemu/seqlock.h"
 #include "accel/tcg/cpu-ldst-common.h"
 #include "accel/tcg/helper-retaddr.h"
 #include "accel/tcg/probe.h"
@@ -167,6 +168,24 @@ typedef struct PageFlagsNode {
 
 static IntervalTreeRoot pageflags_root;
 
+/*
+ * Writers of pageflags_root are serialized by mmap_lock.  Readers walk
+ * the tree locklessly under RCU; such walks may miss nodes while a
+ * rotation is in progress, so the sequence count tells a reader whether
+ * a miss can be trusted without falling back to mmap_lock.
+ *
+ * Each thread also caches the last node that satisfied page_check_range,
+ * which lets the repeated checks on the same buffer made by syscall
+ * emulation skip the tree walk until the next mmap, mprotect or munmap.
+ */
+static QemuSeqLock pageflags_seq;
+
+static __thread struct {
+    unsigned int gen;
+    vaddr start, last;
+    int flags;
+} page_check_cache;
+
 static PageFlagsNode *pageflags_find(vaddr start, vaddr last)
 {
     IntervalTreeNode *n;
@@ -238,24 +257,22 @@ void page_dump(FILE *f)
 
 int page_get_flags(vaddr address)
 {
-    PageFlagsNode *p = pageflags_find(address, address);
+    PageFlagsNode *p;
+    unsigned seq;
 
     /*
      * See util/interval-tree.c re lockless lookups: no false positives but
-     * there are false negatives.  If we find nothing, retry with the mmap
-     * lock acquired.
+     * there are false negatives.  A negative is only final if no writer
+     * ran concurrently with the lookup.
      */
-    if (p) {
-        return p->flags;
-    }
-    if (have_mmap_lock()) {
-        return 0;
-    }
-
-    mmap_lock();
-    p = pageflags_find(address, address);
-    mmap_unlock();
-    return p ? p->flags : 0;
+    do {
+        seq = seqlock_read_begin(&pageflags_seq);
+        p = pageflags_find(address, address);
+        if (p) {
+            return p->flags;
+        }
+    } while (seqlock_read_retry(&pageflags_seq, seq));
+    return 0;
 }
 
 /* A subroutine of page_set_flags: insert a new node for [start,last]. */
@@ -323,6 +340,8 @@ static bool pageflags_set_clear(vaddr start, vaddr last,
     int p_flags, merge_flags;
     bool inval_tb = false;
 
+    seqlock_write_begin(&pageflags_seq);
+
  restart:
     p = pageflags_find(start, last);
     if (!p) {
@@ -452,6 +471,7 @@ static bool pageflags_set_clear(vaddr start, vaddr last,
     }
 
  done:
+    seqlock_write_end(&pageflags_seq);
     return inval_tb;
 }
 
@@ -493,6 +513,7 @@ bool page_check_range(vaddr start, vaddr len, int flags)
 {
     vaddr last;
     int locked;  /* tri-state: =0: unlocked, +1: global, -1: local */
+    unsigned int gen;
     bool ret;
 
     if (len == 0) {
@@ -504,16 +525,25 @@ bool page_check_range(vaddr start, vaddr len, int flags)
         return false; /* wrap around */
     }
 
+    /* Every node has PAGE_VALID, which rejects the initial empty cache. */
+    gen = seqlock_read_begin(&pageflags_seq);
+    if (page_check_cache.gen == gen &&
+        start >= page_check_cache.start &&
+        last <= page_check_cache.last &&
+        !((flags | PAGE_VALID) & ~page_check_cache.flags)) {
+        return true;
+    }
+
     locked = have_mmap_lock();
     while (true) {
         PageFlagsNode *p = pageflags_find(start, last);
         int missing;
 
         if (!p) {
-            if (!locked) {
+            if (!locked && seqlock_read_retry(&pageflags_seq, gen)) {
                 /*
-                 * Lockless lookups have false negatives.
-                 * Retry with the lock held.
+                 * Lockless lookups have false negatives while the
+                 * tree is being modified.  Retry with the lock held.
                  */
                 mmap_lock();
                 locked = -1;
@@ -554,6 +584,12 @@ bool page_check_range(vaddr start, vaddr len, int flags)
         }
 
         if (last <= p->itree.last) {
+            if (!seqlock_read_retry(&pageflags_seq, gen)) {
+                page_check_cache.start = p->itree.start;
+                page_check_cache.last = p->itree.last;
+                page_check_cache.flags = p->flags;
+                page_check_cache.gen = gen;
+            }
             ret = true; /* ok */
             break;
         }
@@ -25,6 +25,7 @@
 #include "qemu/osdep.h"
 #include "qemu/bswap.h"
 #include "qemu/audio.h"
+#include "host/cpuinfo.h"
 
 #define AUDIO_CAP "mixeng"
 #include "audio_int.h"
@@ -269,6 +270,48 @@ f_sample *mixeng_clip[2][2][2][3] = {
     }
 };
 
+static void mixeng_mix_int(struct st_sample *dst, const struct st_sample *src,
+                           int samples)
+{
+    while (samples--) {
+        dst->l += src->l;
+        dst->r += src->r;
+        dst++;
+        src++;
+    }
+}
+
+#ifdef FLOAT_MIXENG
+#define mixeng_mix mixeng_mix_int
+#else
+/*
+ * Nearly all guests and backends use signed 16-bit samples in host byte
+ * order; their conversions, and mixing, can use vector instructions.
+ */
+typedef struct MixengAccel {
+    t_sample *conv_s16_to_mono;
+    t_sample *conv_s16_to_stereo;
+    f_sample *clip_s16_from_stereo;
+    void (*mix)(struct st_sample *dst, const struct st_sample *src,
+                int samples);
+} MixengAccel;
+
+#include "host/mixeng.c.inc"
+
+static void (*mixeng_mix)(struct st_sample *dst, const struct st_sample *src,
+                          int samples);
+
+static void __attribute__((constructor)) init_accel(void)
+{
+    const MixengAccel *accel = &accel_table[best_accel()];
+
+    mixeng_conv[0][1][0][1] = accel->conv_s16_to_mono;
+    mixeng_conv[1][1][0][1] = accel->conv_s16_to_stereo;
+    mixeng_clip[1][1][0][1] = accel->clip_s16_from_stereo;
+    mixeng_mix = accel->mix;
+}
+#endif
+
 #ifdef FLOAT_MIXENG
 #define CONV_NATURAL_FLOAT(x) (x)
 #define CLIP_NATURAL_FLOAT(x) (x)
@@ -492,10 +535,12 @@ void *st_rate_start (int inrate, int outrate)
 
 #define NAME st_rate_flow_mix
 #define OP(a, b) a += b
+#define OP_N(dst, src, n) mixeng_mix(dst, src, n)
 #include "rate_template.h"
 
 #define NAME st_rate_flow
 #define OP(a, b) a = b
+#define OP_N(dst, src, n) memcpy(dst, src, (n) * sizeof(struct st_sample))
 #include "rate_template.h"
 
 void st_rate_stop (void *opaque)
@@ -594,6 +639,9 @@ void mixeng_volume (struct st_sample *buf, int len, struct mixeng_volume *vol)
         mixeng_clear (buf, len);
         return;
     }
+    if (vol->l == nominal_volume.l && vol->r == nominal_volume.r) {
+        return;
+    }
 
     while (len--) {
 #ifdef FLOAT_MIXENG
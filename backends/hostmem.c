@@ -229,6 +229,46 @@ static bool host_memory_backend_get_prealloc(Object *obj, Error **errp)
     return backend->prealloc;
 }
 
+/*
+ * Preallocate the memory of @backend.  Without an explicit prealloc-context,
+ * the preallocation threads are placed on the CPUs of the backend's
+ * host-nodes, so that the memory is touched from the nodes it is bound to
+ * and the preallocation of several backends can proceed asynchronously.
+ */
+static bool host_memory_backend_prealloc(HostMemoryBackend *backend,
+                                         bool async, Error **errp)
+{
+    int fd = memory_region_get_fd(&backend->mr);
+    void *ptr = memory_region_get_ram_ptr(&backend->mr);
+    uint64_t sz = memory_region_size(&backend->mr);
+    ThreadContext *tc = backend->prealloc_context;
+    ThreadContext *node_tc = NULL;
+    bool ret;
+
+    if (!tc && backend->policy != HOST_MEM_POLICY_DEFAULT &&
+        !bitmap_empty(backend->host_nodes, MAX_NODES)) {
+        /*
+         * Nodes without CPUs, such as CXL memory, select no CPUs; fall
+         * back to unplaced threads then.
+         */
+        node_tc = thread_context_new_node_affinity(backend->host_nodes,
+                                                   MAX_NODES, NULL);
+        tc = node_tc;
+    }
+
+    ret = qemu_prealloc_mem(fd, ptr, sz, backend->prealloc_threads, tc,
+                            async, errp);
+
+    /*
+     * The preallocation threads have been created at this point, the
+     * context is no longer needed even if they run asynchronously.
+     */
+    if (node_tc) {
+        object_unref(OBJECT(node_tc));
+    }
+    return ret;
+}
+
 static void host_memory_backend_set_prealloc(Object *obj, bool value,
                                              Error **errp)
 {
@@ -245,12 +285,7 @@ static void host_memory_backend_set_prealloc(Object *obj, bool value,
     }
 
     if (value && !backend->prealloc) {
-        int fd = memory_region_get_fd(&backend->mr);
-        void *ptr = memory_region_get_ram_ptr(&backend->mr);
-        uint64_t sz = memory_region_size(&backend->mr);
-
-        if (!qemu_prealloc_mem(fd, ptr, sz, backend->prealloc_threads,
-                               backend->prealloc_context, false, errp)) {
+        if (!host_memory_backend_prealloc(backend, false, errp)) {
             return;
         }
         backend->prealloc = true;
@@ -423,11 +458,8 @@ host_memory_backend_memory_complete(UserCreatable *uc, Error **errp)
      * This is necessary to guarantee memory is allocated with
      * specified NUMA policy in place.
      */
-    if (backend->prealloc && !qemu_prealloc_mem(memory_region_get_fd(&backend->mr),
-                                                ptr, sz,
-                                                backend->prealloc_threads,
-                                                backend->prealloc_context,
-                                                async, errp)) {
+    if (backend->prealloc &&
+        !host_memory_backend_prealloc(backend, async, errp)) {
         return;
     }
 }
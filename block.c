@@ -5666,6 +5666,31 @@ int coroutine_fn bdrv_co_check(BlockDriverState *bs,
     return bs->drv->bdrv_co_check(bs, res, fix);
 }
 
+/*
+ * Deduplicate the data of an image
+ *
+ * Returns 0 on success and -errno on failure.  The number of bytes that were
+ * released is stored in freed_bytes, also when the operation failed partway.
+ */
+int coroutine_fn bdrv_co_dedup(BlockDriverState *bs, int64_t *freed_bytes,
+                               Error **errp)
+{
+    IO_CODE();
+    assert_bdrv_graph_readable();
+    *freed_bytes = 0;
+    if (bs->drv == NULL) {
+        error_setg(errp, "No medium");
+        return -ENOMEDIUM;
+    }
+    if (bs->drv->bdrv_co_dedup == NULL) {
+        error_setg(errp, "Format '%s' does not support deduplication",
+                   bs->drv->format_name);
+        return -ENOTSUP;
+    }
+
+    return bs->drv->bdrv_co_dedup(bs, freed_bytes, errp);
+}
+
 /*
  * Return values:
  * 0        - success
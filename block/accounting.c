@@ -90,6 +90,7 @@ void block_acct_cleanup(BlockAcctStats *stats)
 void block_acct_add_interval(BlockAcctStats *stats, unsigned interval_length)
 {
     BlockAcctTimedStats *s;
+    uint64_t period = (uint64_t) interval_length * NANOSECONDS_PER_SECOND;
     unsigned i;
 
     s = g_new0(BlockAcctTimedStats, 1);
@@ -99,8 +100,8 @@ void block_acct_add_interval(BlockAcctStats *stats, unsigned interval_length)
     QSLIST_INSERT_HEAD(&stats->intervals, s, entries);
 
     for (i = 0; i < BLOCK_MAX_IOTYPE; i++) {
-        timed_average_init(&s->latency[i], clock_type,
-                           (uint64_t) interval_length * NANOSECONDS_PER_SECOND);
+        timed_average_init(&s->latency[i], clock_type, period);
+        timed_histogram_init(&s->latency_hist[i], clock_type, period);
     }
     qemu_mutex_unlock(&stats->lock);
 }
@@ -247,6 +248,8 @@ static void block_account_one_io(BlockAcctStats *stats, BlockAcctCookie *cookie,
 
             QSLIST_FOREACH(s, &stats->intervals, entries) {
                 timed_average_account(&s->latency[cookie->type], latency_ns);
+                timed_histogram_account(&s->latency_hist[cookie->type],
+                                        latency_ns);
             }
         }
     }
@@ -309,3 +312,13 @@ double block_acct_queue_depth(BlockAcctTimedStats *stats,
 
     return (double) sum / elapsed;
 }
+
+uint64_t block_acct_latency_percentile(BlockAcctTimedStats *stats,
+                                       enum BlockAcctType type,
+                                       unsigned permille)
+{
+    assert(type < BLOCK_MAX_IOTYPE);
+
+    QEMU_LOCK_GUARD(&stats->stats->lock);
+    return timed_histogram_percentile(&stats->latency_hist[type], permille);
+}
@@ -119,3 +119,8 @@ int aio_task_pool_status(AioTaskPool *pool)
 
     return pool->status;
 }
+
+int aio_task_pool_busy_tasks(AioTaskPool *pool)
+{
+    return pool->busy_tasks;
+}
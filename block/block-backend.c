@@ -86,6 +86,15 @@ struct BlockBackend {
     VMChangeStateEntry *vmsh;
     bool force_allow_inactivate;
 
+    /*
+     * Merge stage for contiguous requests, see blk_co_merge().  The window is
+     * accessed with atomic ops, the batches are protected by merge_lock.
+     */
+    int64_t merge_window_ns;
+    QemuMutex merge_lock;
+    QLIST_HEAD(, BlkMergeBatch) merge_batches;
+    unsigned int merge_pending; /* atomic: requests held in merge_batches */
+
     /* Number of in-flight aio requests.  BlockDriverState also counts
      * in-flight requests but aio requests can exist even when blk->root is
      * NULL, so we cannot rely on its counter for that case.
@@ -94,6 +103,44 @@ struct BlockBackend {
     unsigned int in_flight;
 };
 
+/* A request waiting in a BlkMergeBatch */
+typedef struct BlkMergeRequest {
+    QEMUIOVector *qiov;
+    size_t qiov_offset;
+    int64_t bytes;
+    Coroutine *co;
+    int ret;
+    bool done;
+    QSIMPLEQ_ENTRY(BlkMergeRequest) next;
+} BlkMergeRequest;
+
+/*
+ * Contiguous requests that are submitted as one by the coroutine of the
+ * request that started the batch
+ */
+typedef struct BlkMergeBatch {
+    BlockBackend *blk;
+    bool is_write;
+    BdrvRequestFlags flags;
+    int64_t offset;
+    int64_t bytes;
+    int64_t max_bytes;
+    int niov;
+    int nreqs;
+    QSIMPLEQ_HEAD(, BlkMergeRequest) reqs;
+
+    /* Submitting coroutine, woken once by whoever sets @released */
+    Coroutine *co;
+    QEMUTimer timer;
+    bool released;
+
+    QLIST_ENTRY(BlkMergeBatch) next;
+    QSIMPLEQ_ENTRY(BlkMergeBatch) wake_next;
+} BlkMergeBatch;
+
+/* Flags that are passed through unchanged for merged requests */
+#define BLK_MERGE_FLAGS (BDRV_REQ_FUA | BDRV_REQ_REGISTERED_BUF)
+
 typedef struct BlockBackendAIOCB {
     BlockAIOCB common;
     BlockBackend *blk;
@@ -372,6 +419,8 @@ BlockBackend *blk_new(AioContext *ctx, uint64_t perm, uint64_t shared_perm)
 
     qemu_mutex_init(&blk->queued_requests_lock);
     qemu_co_queue_init(&blk->queued_requests);
+    qemu_mutex_init(&blk->merge_lock);
+    QLIST_INIT(&blk->merge_batches);
     notifier_list_init(&blk->remove_bs_notifiers);
     notifier_list_init(&blk->insert_bs_notifiers);
     QLIST_INIT(&blk->aio_notifiers);
@@ -495,6 +544,8 @@ static void blk_delete(BlockBackend *blk)
     assert(QLIST_EMPTY(&blk->aio_notifiers));
     assert(qemu_co_queue_empty(&blk->queued_requests));
     qemu_mutex_destroy(&blk->queued_requests_lock);
+    assert(QLIST_EMPTY(&blk->merge_batches));
+    qemu_mutex_destroy(&blk->merge_lock);
     QTAILQ_REMOVE(&block_backends, blk, link);
     drive_info_del(blk->legacy_dinfo);
     block_acct_cleanup(&blk->stats);
@@ -1325,6 +1376,218 @@ static void coroutine_fn blk_wait_while_drained(BlockBackend *blk)
     }
 }
 
+/*
+ * Release @batch so that its coroutine submits it.  Returns true if the caller
+ * must wake batch->co after dropping blk->merge_lock.
+ *
+ * Called with blk->merge_lock.
+ */
+static bool blk_merge_release_locked(BlockBackend *blk, BlkMergeBatch *batch)
+{
+    if (batch->released) {
+        return false;
+    }
+    batch->released = true;
+    QLIST_REMOVE(batch, next);
+    qatomic_sub(&blk->merge_pending, batch->nreqs);
+    return true;
+}
+
+static void blk_merge_timer_cb(void *opaque)
+{
+    BlkMergeBatch *batch = opaque;
+    BlockBackend *blk = batch->blk;
+    bool wake;
+
+    WITH_QEMU_LOCK_GUARD(&blk->merge_lock) {
+        wake = blk_merge_release_locked(blk, batch);
+    }
+    if (wake) {
+        aio_co_wake(batch->co);
+    }
+}
+
+/*
+ * Release held back requests.  Unless @force is true, this only happens once
+ * the backend has nothing else to do, because there is no point in waiting
+ * for more requests to merge then.
+ */
+static void blk_merge_kick(BlockBackend *blk, bool force)
+{
+    QSIMPLEQ_HEAD(, BlkMergeBatch) wake = QSIMPLEQ_HEAD_INITIALIZER(wake);
+    BlkMergeBatch *batch, *next;
+
+    WITH_QEMU_LOCK_GUARD(&blk->merge_lock) {
+        if (!force && qatomic_read(&blk->in_flight) >
+                      qatomic_read(&blk->merge_pending)) {
+            break;
+        }
+        QLIST_FOREACH_SAFE(batch, &blk->merge_batches, next, next) {
+            if (blk_merge_release_locked(blk, batch)) {
+                QSIMPLEQ_INSERT_TAIL(&wake, batch, wake_next);
+            }
+        }
+    }
+
+    /* The batches stay valid until their coroutine is woken */
+    QSIMPLEQ_FOREACH_SAFE(batch, &wake, wake_next, next) {
+        aio_co_wake(batch->co);
+    }
+}
+
+static int coroutine_fn
+blk_co_submit_preadv_part(BlockBackend *blk, int64_t offset, int64_t bytes,
+                          QEMUIOVector *qiov, size_t qiov_offset,
+                          BdrvRequestFlags flags);
+static int coroutine_fn
+blk_co_submit_pwritev_part(BlockBackend *blk, int64_t offset, int64_t bytes,
+                           QEMUIOVector *qiov, size_t qiov_offset,
+                           BdrvRequestFlags flags);
+
+/*
+ * Merge stage for reads and writes, enabled with blk_set_merge_window().
+ *
+ * A request that is contiguous to a request held back here is added to its
+ * batch.  Otherwise, if the backend is busy with other requests, it starts a
+ * new batch and waits for up to the merge window for requests to join.  A
+ * batch is submitted as a single request when the window expires, when it
+ * reaches the maximum transfer size, when the backend has no other requests
+ * in flight any more, or when a drain begins.
+ *
+ * Returns true if the request was completed as part of a batch and sets *ret
+ * to its result.  Returns false if the caller must submit the request itself.
+ *
+ * To be called between exactly one pair of blk_inc/dec_in_flight()
+ */
+static bool coroutine_fn
+blk_co_merge(BlockBackend *blk, bool is_write, int64_t offset, int64_t bytes,
+             QEMUIOVector *qiov, size_t qiov_offset, BdrvRequestFlags flags,
+             int *ret)
+{
+    int64_t window_ns = qatomic_read(&blk->merge_window_ns);
+    BlkMergeRequest req = {
+        .qiov = qiov,
+        .qiov_offset = qiov_offset,
+        .bytes = bytes,
+        .co = qemu_coroutine_self(),
+    };
+    BlkMergeBatch new_batch, *batch;
+    BlkMergeRequest *r, *next;
+    QEMUIOVector merged_qiov;
+    int64_t max_bytes;
+    int niov;
+
+    if (!window_ns || !qiov || bytes <= 0 || (flags & ~BLK_MERGE_FLAGS)) {
+        return false;
+    }
+    niov = qemu_iovec_subvec_niov(qiov, qiov_offset, bytes);
+    max_bytes = MIN(blk_get_max_transfer(blk), BDRV_REQUEST_MAX_BYTES);
+
+    qemu_mutex_lock(&blk->merge_lock);
+    QLIST_FOREACH(batch, &blk->merge_batches, next) {
+        bool full;
+
+        if (batch->is_write != is_write || batch->flags != flags ||
+            batch->bytes + bytes > batch->max_bytes ||
+            batch->niov + niov > IOV_MAX) {
+            continue;
+        }
+        if (offset == batch->offset + batch->bytes) {
+            QSIMPLEQ_INSERT_TAIL(&batch->reqs, &req, next);
+        } else if (offset + bytes == batch->offset) {
+            QSIMPLEQ_INSERT_HEAD(&batch->reqs, &req, next);
+            batch->offset = offset;
+        } else {
+            continue;
+        }
+        batch->bytes += bytes;
+        batch->niov += niov;
+        batch->nreqs++;
+        qatomic_inc(&blk->merge_pending);
+
+        full = batch->bytes == batch->max_bytes || batch->niov == IOV_MAX;
+        if (full) {
+            full = blk_merge_release_locked(blk, batch);
+        }
+        qemu_mutex_unlock(&blk->merge_lock);
+
+        if (full) {
+            aio_co_wake(batch->co);
+        }
+
+        /* Woken exactly once, by the batch's coroutine after completion */
+        qemu_coroutine_yield();
+        assert(qatomic_load_acquire(&req.done));
+        *ret = req.ret;
+        return true;
+    }
+
+    /* Holding the request back only pays off while the backend is busy */
+    if (qatomic_read(&blk->in_flight) <=
+        qatomic_read(&blk->merge_pending) + 1) {
+        qemu_mutex_unlock(&blk->merge_lock);
+        return false;
+    }
+
+    batch = &new_batch;
+    *batch = (BlkMergeBatch) {
+        .blk = blk,
+        .is_write = is_write,
+        .flags = flags,
+        .offset = offset,
+        .bytes = bytes,
+        .max_bytes = max_bytes,
+        .niov = niov,
+        .nreqs = 1,
+        .co = qemu_coroutine_self(),
+    };
+    QSIMPLEQ_INIT(&batch->reqs);
+    QSIMPLEQ_INSERT_TAIL(&batch->reqs, &req, next);
+    QLIST_INSERT_HEAD(&blk->merge_batches, batch, next);
+    qatomic_inc(&blk->merge_pending);
+
+    aio_timer_init(qemu_get_current_aio_context(), &batch->timer,
+                   QEMU_CLOCK_REALTIME, SCALE_NS, blk_merge_timer_cb, batch);
+    timer_mod(&batch->timer,
+              qemu_clock_get_ns(QEMU_CLOCK_REALTIME) + window_ns);
+    qemu_mutex_unlock(&blk->merge_lock);
+
+    /* Woken exactly once, by whoever releases the batch */
+    qemu_coroutine_yield();
+    assert(batch->released);
+    timer_del(&batch->timer);
+
+    if (batch->nreqs == 1) {
+        return false;
+    }
+
+    trace_blk_co_merge(blk, is_write, batch->offset, batch->bytes,
+                       batch->nreqs);
+
+    qemu_iovec_init(&merged_qiov, batch->niov);
+    QSIMPLEQ_FOREACH(r, &batch->reqs, next) {
+        qemu_iovec_concat(&merged_qiov, r->qiov, r->qiov_offset, r->bytes);
+    }
+    if (is_write) {
+        *ret = blk_co_submit_pwritev_part(blk, batch->offset, batch->bytes,
+                                          &merged_qiov, 0, flags);
+    } else {
+        *ret = blk_co_submit_preadv_part(blk, batch->offset, batch->bytes,
+                                         &merged_qiov, 0, flags);
+    }
+    qemu_iovec_destroy(&merged_qiov);
+
+    /* Requests live on their coroutine's stack, don't touch them once woken */
+    QSIMPLEQ_FOREACH_SAFE(r, &batch->reqs, next, next) {
+        if (r != &req) {
+            r->ret = *ret;
+            qatomic_store_release(&r->done, true);
+            aio_co_wake(r->co);
+        }
+    }
+    return true;
+}
+
 /* To be called between exactly one pair of blk_inc/dec_in_flight() */
 static int coroutine_fn
 blk_co_do_preadv_part(BlockBackend *blk, int64_t offset, int64_t bytes,
@@ -1332,10 +1595,27 @@ blk_co_do_preadv_part(BlockBackend *blk, int64_t offset, int64_t bytes,
                       BdrvRequestFlags flags)
 {
     int ret;
-    BlockDriverState *bs;
     IO_CODE();
 
     blk_wait_while_drained(blk);
+
+    if (blk_co_merge(blk, false, offset, bytes, qiov, qiov_offset, flags,
+                     &ret)) {
+        return ret;
+    }
+    return blk_co_submit_preadv_part(blk, offset, bytes, qiov, qiov_offset,
+                                     flags);
+}
+
+/* To be called between exactly one pair of blk_inc/dec_in_flight() */
+static int coroutine_fn
+blk_co_submit_preadv_part(BlockBackend *blk, int64_t offset, int64_t bytes,
+                          QEMUIOVector *qiov, size_t qiov_offset,
+                          BdrvRequestFlags flags)
+{
+    int ret;
+    BlockDriverState *bs;
+
     GRAPH_RDLOCK_GUARD();
 
     /* Call blk_bs() only after waiting, the graph may have changed */
@@ -1407,10 +1687,27 @@ blk_co_do_pwritev_part(BlockBackend *blk, int64_t offset, int64_t bytes,
                        BdrvRequestFlags flags)
 {
     int ret;
-    BlockDriverState *bs;
     IO_CODE();
 
     blk_wait_while_drained(blk);
+
+    if (blk_co_merge(blk, true, offset, bytes, qiov, qiov_offset, flags,
+                     &ret)) {
+        return ret;
+    }
+    return blk_co_submit_pwritev_part(blk, offset, bytes, qiov, qiov_offset,
+                                      flags);
+}
+
+/* To be called between exactly one pair of blk_inc/dec_in_flight() */
+static int coroutine_fn
+blk_co_submit_pwritev_part(BlockBackend *blk, int64_t offset, int64_t bytes,
+                           QEMUIOVector *qiov, size_t qiov_offset,
+                           BdrvRequestFlags flags)
+{
+    int ret;
+    BlockDriverState *bs;
+
     GRAPH_RDLOCK_GUARD();
 
     /* Call blk_bs() only after waiting, the graph may have changed */
@@ -1520,6 +1817,9 @@ void blk_dec_in_flight(BlockBackend *blk)
 {
     IO_CODE();
     qatomic_dec(&blk->in_flight);
+    if (qatomic_read(&blk->merge_pending)) {
+        blk_merge_kick(blk, false);
+    }
     aio_wait_kick();
 }
 
@@ -1597,6 +1897,13 @@ static BlockAIOCB *blk_aio_prwv(BlockBackend *blk, int64_t offset,
     acb->bytes = bytes;
     acb->has_returned = false;
 
+    /*
+     * There is no way to run co_entry on the caller's stack and only switch
+     * to a coroutine on the first yield: the request may block on a CoMutex
+     * or CoQueue anywhere in the graph.  Pooled coroutines make this cheap,
+     * and a request that completes without yielding (cache hit, null-co,
+     * error) is detected below and only costs a bottom half.
+     */
     co = qemu_coroutine_create(co_entry, acb);
     aio_co_enter(qemu_get_current_aio_context(), co);
 
@@ -2234,6 +2541,17 @@ bool blk_enable_write_cache(BlockBackend *blk)
     return blk->enable_write_cache;
 }
 
+/*
+ * Hold back reads and writes for up to @window_ns nanoseconds while the
+ * backend is busy, so that contiguous requests can be merged.  0 disables
+ * merging.
+ */
+void blk_set_merge_window(BlockBackend *blk, int64_t window_ns)
+{
+    GLOBAL_STATE_CODE();
+    qatomic_set(&blk->merge_window_ns, window_ns);
+}
+
 void blk_set_enable_write_cache(BlockBackend *blk, bool wce)
 {
     IO_CODE();
@@ -2751,6 +3069,9 @@ static void blk_root_drained_begin(BdrvChild *child)
     if (qatomic_fetch_inc(&tgm->io_limits_disabled) == 0) {
         throttle_group_restart_tgm(tgm);
     }
+
+    /* Don't make the drain wait for the merge window */
+    blk_merge_kick(blk, true);
 }
 
 static bool blk_root_drained_poll(BdrvChild *child)
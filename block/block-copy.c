@@ -27,7 +27,6 @@
 #include "qemu/ratelimit.h"
 #include "block/aio_task.h"
 #include "qemu/error-report.h"
-#include "qemu/memalign.h"
 
 #define BLOCK_COPY_MAX_COPY_RANGE (16 * MiB)
 #define BLOCK_COPY_MAX_BUFFER (1 * MiB)
@@ -36,6 +35,13 @@
 #define BLOCK_COPY_SLICE_TIME 100000000ULL /* ns */
 #define BLOCK_COPY_CLUSTER_SIZE_DEFAULT (1 << 16)
 
+/* Adaptive scheduling, see block_copy_adapt() */
+#define BLOCK_COPY_ADAPT_WINDOW_NS 250000000LL
+#define BLOCK_COPY_ADAPT_MIN_TASKS 8
+#define BLOCK_COPY_ADAPT_INITIAL_WORKERS 8
+/* Back off when latency per byte exceeds the best seen by this factor */
+#define BLOCK_COPY_ADAPT_LATENCY_FACTOR 2
+
 typedef enum {
     COPY_READ_WRITE_CLUSTER,
     COPY_READ_WRITE,
@@ -112,6 +118,26 @@ static int64_t task_end(BlockCopyTask *task)
     return task->req.offset + task->req.bytes;
 }
 
+/*
+ * Chunk size and number of workers chosen by the adaptive scheduler, and the
+ * statistics of the current measurement window.
+ */
+typedef struct BlockCopyAdapt {
+    bool enabled;
+    int64_t chunk;
+    int workers;
+    /* The knob that was changed last: workers if true, chunk otherwise */
+    bool tune_workers;
+
+    int64_t window_start; /* ns */
+    uint64_t window_bytes;
+    uint64_t window_latency; /* sum of task latencies, ns */
+    uint64_t window_tasks;
+
+    uint64_t last_throughput; /* bytes per second */
+    uint64_t best_ns_per_mib;
+} BlockCopyAdapt;
+
 typedef struct BlockCopyState {
     /*
      * BdrvChild objects are not owned or managed by block-copy. They are
@@ -155,6 +181,7 @@ typedef struct BlockCopyState {
      * block_copy_reset_unallocated() every time it does.
      */
     bool skip_unallocated; /* atomic */
+    BlockCopyAdapt adapt;
     /* State fields that use a thread-safe API */
     BdrvDirtyBitmap *copy_bitmap;
     ProgressMeter *progress;
@@ -169,11 +196,14 @@ static int64_t block_copy_chunk_size(BlockCopyState *s)
     case COPY_READ_WRITE_CLUSTER:
         return s->cluster_size;
     case COPY_READ_WRITE:
-    case COPY_RANGE_SMALL:
-        return MIN(MAX(s->cluster_size, BLOCK_COPY_MAX_BUFFER),
-                   s->max_transfer);
     case COPY_RANGE_FULL:
-        return MIN(MAX(s->cluster_size, BLOCK_COPY_MAX_COPY_RANGE),
+        if (s->adapt.enabled) {
+            return MIN(s->adapt.chunk, s->max_transfer);
+        }
+        /* fall through */
+    case COPY_RANGE_SMALL:
+        return MIN(MAX(s->cluster_size, s->method == COPY_RANGE_FULL ?
+                       BLOCK_COPY_MAX_COPY_RANGE : BLOCK_COPY_MAX_BUFFER),
                    s->max_transfer);
     default:
         /* Cannot have COPY_WRITE_ZEROES here.  */
@@ -181,6 +211,89 @@ static int64_t block_copy_chunk_size(BlockCopyState *s)
     }
 }
 
+/* Called with lock held */
+static void block_copy_adapt_grow(BlockCopyState *s)
+{
+    BlockCopyAdapt *a = &s->adapt;
+
+    if (a->tune_workers) {
+        a->workers = MIN(a->workers * 2, BLOCK_COPY_MAX_WORKERS);
+    } else {
+        a->chunk = MIN(a->chunk * 2,
+                       MAX(s->cluster_size, BLOCK_COPY_MAX_COPY_RANGE));
+    }
+}
+
+/* Called with lock held */
+static void block_copy_adapt_shrink(BlockCopyState *s, bool both)
+{
+    BlockCopyAdapt *a = &s->adapt;
+
+    if (both || a->tune_workers) {
+        a->workers = MAX(a->workers / 2, 1);
+    }
+    if (both || !a->tune_workers) {
+        a->chunk = MAX(a->chunk / 2, s->cluster_size);
+    }
+}
+
+/*
+ * Account a completed task of @bytes that took @latency ns and, at the end of
+ * each measurement window, adjust chunk size and number of workers.
+ *
+ * This is a simple hill climber: it keeps growing the knob it changed last
+ * (doubling the chunk size or the number of workers) as long as throughput
+ * improves, and otherwise undoes the last step and moves on to the other
+ * knob.  If the latency per byte rises well above the best value seen, the
+ * target is congested and both knobs are halved.
+ *
+ * Called with lock held.
+ */
+static void block_copy_adapt(BlockCopyState *s, int64_t bytes,
+                             int64_t latency)
+{
+    BlockCopyAdapt *a = &s->adapt;
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    uint64_t throughput, ns_per_mib;
+
+    a->window_bytes += bytes;
+    a->window_latency += latency;
+    a->window_tasks++;
+
+    if (now - a->window_start < BLOCK_COPY_ADAPT_WINDOW_NS ||
+        a->window_tasks < BLOCK_COPY_ADAPT_MIN_TASKS) {
+        return;
+    }
+
+    throughput = muldiv64(a->window_bytes, NANOSECONDS_PER_SECOND,
+                          now - a->window_start);
+    ns_per_mib = muldiv64(a->window_latency, MiB, a->window_bytes);
+
+    if (!a->best_ns_per_mib || ns_per_mib < a->best_ns_per_mib) {
+        a->best_ns_per_mib = ns_per_mib;
+    }
+
+    if (ns_per_mib > a->best_ns_per_mib * BLOCK_COPY_ADAPT_LATENCY_FACTOR) {
+        block_copy_adapt_shrink(s, true);
+        /* Let the baseline follow a target that got slower for good */
+        a->best_ns_per_mib += (ns_per_mib - a->best_ns_per_mib) / 4;
+    } else if (throughput > a->last_throughput + a->last_throughput / 16) {
+        block_copy_adapt_grow(s);
+    } else {
+        block_copy_adapt_shrink(s, false);
+        a->tune_workers = !a->tune_workers;
+        block_copy_adapt_grow(s);
+    }
+
+    trace_block_copy_adapt(s, throughput, ns_per_mib, a->chunk, a->workers);
+
+    a->last_throughput = throughput;
+    a->window_start = now;
+    a->window_bytes = 0;
+    a->window_latency = 0;
+    a->window_tasks = 0;
+}
+
 /*
  * Search for the first dirty area in offset/bytes range and create task at
  * the beginning of it.
@@ -441,7 +554,7 @@ BlockCopyState *block_copy_state_new(BdrvChild *source, BdrvChild *target,
 
     ratelimit_init(&s->rate_limit);
     qemu_co_mutex_init(&s->lock);
-    QLIST_INIT(&s->reqs);
+    reqlist_init(&s->reqs);
     QLIST_INIT(&s->calls);
 
     return s;
@@ -453,6 +566,29 @@ void block_copy_set_progress_meter(BlockCopyState *s, ProgressMeter *pm)
     s->progress = pm;
 }
 
+/* Only set before running the job, no need for locking. */
+void block_copy_set_adaptive(BlockCopyState *s, bool adaptive)
+{
+    s->adapt = (BlockCopyAdapt) {
+        .enabled = adaptive,
+        .chunk = MAX(s->cluster_size, BLOCK_COPY_MAX_BUFFER),
+        .workers = BLOCK_COPY_ADAPT_INITIAL_WORKERS,
+        .window_start = qemu_clock_get_ns(QEMU_CLOCK_REALTIME),
+    };
+}
+
+/* Number of parallel tasks that @call_state may currently run */
+static int coroutine_fn block_copy_max_workers(BlockCopyCallState *call_state)
+{
+    BlockCopyState *s = call_state->s;
+
+    QEMU_LOCK_GUARD(&s->lock);
+    if (!s->adapt.enabled) {
+        return call_state->max_workers;
+    }
+    return MIN(s->adapt.workers, call_state->max_workers);
+}
+
 /*
  * Takes ownership of @task
  *
@@ -550,7 +686,7 @@ block_copy_do_copy(BlockCopyState *s, int64_t offset, int64_t bytes,
          * copy_range.
          */
 
-        bounce_buffer = qemu_blockalign(s->source->bs, nbytes);
+        bounce_buffer = qemu_blockalign_pooled(s->source->bs, nbytes);
 
         ret = bdrv_co_pread(s->source, offset, nbytes, bounce_buffer, 0);
         if (ret < 0) {
@@ -568,7 +704,7 @@ block_copy_do_copy(BlockCopyState *s, int64_t offset, int64_t bytes,
         }
 
     out:
-        qemu_vfree(bounce_buffer);
+        qemu_blockfree_pooled(bounce_buffer, nbytes);
         break;
 
     default:
@@ -584,6 +720,7 @@ static coroutine_fn int block_copy_task_entry(AioTask *task)
     BlockCopyState *s = t->s;
     bool error_is_read = false;
     BlockCopyMethod method = t->method;
+    int64_t start = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
     int ret = -1;
 
     WITH_GRAPH_RDLOCK_GUARD() {
@@ -596,6 +733,12 @@ static coroutine_fn int block_copy_task_entry(AioTask *task)
             s->method = method;
         }
 
+        /* Zero writes say nothing about the target's data path */
+        if (s->adapt.enabled && ret == 0 && t->method != COPY_WRITE_ZEROES) {
+            block_copy_adapt(s, t->req.bytes,
+                             qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start);
+        }
+
         if (ret < 0) {
             if (!t->call_state->ret) {
                 t->call_state->ret = ret;
@@ -824,6 +967,13 @@ block_copy_dirty_clusters(BlockCopyCallState *call_state)
         if (!aio && bytes) {
             aio = aio_task_pool_new(call_state->max_workers);
         }
+        if (aio) {
+            int max_workers = block_copy_max_workers(call_state);
+
+            while (aio_task_pool_busy_tasks(aio) >= max_workers) {
+                aio_task_pool_wait_one(aio);
+            }
+        }
 
         ret = block_copy_task_run(aio, task);
         if (ret < 0) {
@@ -15,6 +15,7 @@
 #include "qemu/osdep.h"
 #include "qemu/cutils.h"
 #include "trace.h"
+#include "block/aio_task.h"
 #include "block/block-common.h"
 #include "block/coroutines.h"
 #include "block/block_int.h"
@@ -26,13 +27,24 @@
 
 enum {
     /*
-     * Size of data buffer for populating the image file.  This should be large
-     * enough to process multiple clusters in a single call, so that populating
-     * contiguous regions of the image is efficient.
+     * Default size of data buffer for populating the image file.  This should
+     * be large enough to process multiple clusters in a single call, so that
+     * populating contiguous regions of the image is efficient.
      */
     COMMIT_BUFFER_SIZE = 512 * 1024, /* in bytes */
 };
 
+/* An area whose copy failed, or that is to be copied again */
+typedef struct CommitRange {
+    int64_t offset;
+    int64_t bytes;
+    bool zero;
+    bool error_in_source;
+    /* 0 if the area is to be copied again */
+    int ret;
+    QSIMPLEQ_ENTRY(CommitRange) next;
+} CommitRange;
+
 typedef struct CommitBlockJob {
     BlockJob common;
     BlockDriverState *commit_top_bs;
@@ -45,8 +57,20 @@ typedef struct CommitBlockJob {
     bool chain_frozen;
     char *backing_file_str;
     bool backing_mask_protocol;
+    int max_workers;
+    int64_t max_chunk;
+    /* Filled by the copy tasks, handled by commit_run() */
+    QSIMPLEQ_HEAD(, CommitRange) failed;
 } CommitBlockJob;
 
+typedef struct CommitTask {
+    AioTask task;
+    CommitBlockJob *s;
+    int64_t offset;
+    int64_t bytes;
+    bool zero;
+} CommitTask;
+
 static int commit_prepare(Job *job)
 {
     CommitBlockJob *s = container_of(job, CommitBlockJob, common.job);
@@ -128,91 +152,87 @@ static void commit_clean(Job *job)
     blk_unref(s->top);
 }
 
-static int commit_iteration(CommitBlockJob *s, int64_t offset,
-                            int64_t *requested_bytes, void *buf)
+static int coroutine_fn commit_task_entry(AioTask *task)
 {
-    BlockErrorAction action;
-    int64_t bytes = *requested_bytes;
-    int ret = 0;
-    bool error_in_source = true;
-
-    /* Copy if allocated above the base */
-    WITH_GRAPH_RDLOCK_GUARD() {
-        ret = bdrv_co_common_block_status_above(blk_bs(s->top),
-            s->base_overlay, true, true, offset, COMMIT_BUFFER_SIZE,
-            &bytes, NULL, NULL, NULL);
-    }
-
-    trace_commit_one_iteration(s, offset, bytes, ret);
-
-    if (ret < 0) {
-        goto fail;
-    }
-
-    if (ret & BDRV_BLOCK_ALLOCATED) {
-        if (ret & BDRV_BLOCK_ZERO) {
-            /*
-             * If the top (sub)clusters are smaller than the base
-             * (sub)clusters, this will not unmap unless the underlying device
-             * does some tracking of these requests. Ideally, we would find
-             * the maximal extent of the zero clusters.
-             */
-            ret = blk_co_pwrite_zeroes(s->base, offset, bytes,
-                                       BDRV_REQ_MAY_UNMAP);
-            if (ret < 0) {
-                error_in_source = false;
-                goto fail;
-            }
-        } else {
-            assert(bytes < SIZE_MAX);
-
-            ret = blk_co_pread(s->top, offset, bytes, buf, 0);
-            if (ret < 0) {
-                goto fail;
-            }
-
-            ret = blk_co_pwrite(s->base, offset, bytes, buf, 0);
-            if (ret < 0) {
-                error_in_source = false;
-                goto fail;
-            }
-        }
+    CommitTask *t = container_of(task, CommitTask, task);
+    CommitBlockJob *s = t->s;
+    QEMU_AUTO_VFREE void *buf = NULL;
+    bool error_in_source = false;
+    CommitRange *r;
+    int ret;
 
+    if (t->zero) {
         /*
-         * Whether zeroes actually end up on disk depends on the details of
-         * the underlying driver. Therefore, this might rate limit more than
-         * is necessary.
+         * If the top (sub)clusters are smaller than the base (sub)clusters,
+         * this will not unmap unless the underlying device does some
+         * tracking of these requests.  Zero areas are therefore written
+         * as a whole, without splitting them at the maximum chunk size.
          */
-        block_job_ratelimit_processed_bytes(&s->common, bytes);
+        ret = blk_co_pwrite_zeroes(s->base, t->offset, t->bytes,
+                                   BDRV_REQ_MAY_UNMAP);
+    } else {
+        assert(t->bytes < SIZE_MAX);
+
+        buf = blk_blockalign(s->top, t->bytes);
+        ret = blk_co_pread(s->top, t->offset, t->bytes, buf, 0);
+        error_in_source = ret < 0;
+        if (ret >= 0) {
+            ret = blk_co_pwrite(s->base, t->offset, t->bytes, buf, 0);
+        }
     }
 
-    /* Publish progress */
-
-    job_progress_update(&s->common.job, bytes);
-
-    *requested_bytes = bytes;
-
+    if (ret < 0) {
+        r = g_new(CommitRange, 1);
+        *r = (CommitRange) {
+            .offset = t->offset,
+            .bytes = t->bytes,
+            .zero = t->zero,
+            .error_in_source = error_in_source,
+            .ret = ret,
+        };
+        QSIMPLEQ_INSERT_TAIL(&s->failed, r, next);
+    } else {
+        /* Publish progress */
+        job_progress_update(&s->common.job, t->bytes);
+    }
+
+    /* The error action is taken by commit_run(), keep the pool running */
     return 0;
+}
 
-fail:
-    action = block_job_error_action(&s->common, s->on_error,
-                                    error_in_source, -ret);
-    if (action == BLOCK_ERROR_ACTION_REPORT) {
-        return ret;
-    }
+static void coroutine_fn commit_start_task(CommitBlockJob *s,
+                                           AioTaskPool *pool,
+                                           int64_t offset, int64_t bytes,
+                                           bool zero)
+{
+    CommitTask *t = g_new(CommitTask, 1);
 
-    *requested_bytes = 0;
+    *t = (CommitTask) {
+        .task.func = commit_task_entry,
+        .s = s,
+        .offset = offset,
+        .bytes = bytes,
+        .zero = zero,
+    };
 
-    return 0;
+    /*
+     * Whether zeroes actually end up on disk depends on the details of
+     * the underlying driver. Therefore, this might rate limit more than
+     * is necessary.
+     */
+    block_job_ratelimit_processed_bytes(&s->common, bytes);
+    aio_task_pool_start_task(pool, &t->task);
 }
 
 static int coroutine_fn commit_run(Job *job, Error **errp)
 {
     CommitBlockJob *s = container_of(job, CommitBlockJob, common.job);
+    BlockErrorAction action;
+    AioTaskPool *pool;
+    CommitRange *r;
     int64_t offset;
     int ret = 0;
     int64_t n = 0; /* bytes */
-    QEMU_AUTO_VFREE void *buf = NULL;
     int64_t len, base_len;
 
     len = blk_co_getlength(s->top);
@@ -233,25 +253,91 @@ static int coroutine_fn commit_run(Job *job, Error **errp)
         }
     }
 
-    buf = blk_blockalign(s->top, COMMIT_BUFFER_SIZE);
+    pool = aio_task_pool_new(s->max_workers);
+
+    for (offset = 0; ; offset += n) {
+        int status;
+
+        n = 0;
 
-    for (offset = 0; offset < len; offset += n) {
         /* Note that even when no rate limit is applied we need to yield
-         * with no pending I/O here so that bdrv_drain_all() returns.
+         * here so that bdrv_drain_all() returns.
          */
         block_job_ratelimit_sleep(&s->common);
         if (job_is_cancelled(&s->common.job)) {
             break;
         }
 
-        ret = commit_iteration(s, offset, &n, buf);
+        r = QSIMPLEQ_FIRST(&s->failed);
+        if (r) {
+            QSIMPLEQ_REMOVE_HEAD(&s->failed, next);
+            if (r->ret == 0) {
+                commit_start_task(s, pool, r->offset, r->bytes, r->zero);
+                g_free(r);
+                continue;
+            }
 
-        if (ret < 0) {
-            return ret;
+            action = block_job_error_action(&s->common, s->on_error,
+                                            r->error_in_source, -r->ret);
+            if (action == BLOCK_ERROR_ACTION_REPORT) {
+                ret = r->ret;
+                g_free(r);
+                break;
+            }
+            /* Copy again, after the job is resumed if it was stopped */
+            r->ret = 0;
+            QSIMPLEQ_INSERT_HEAD(&s->failed, r, next);
+            continue;
+        }
+
+        if (offset >= len) {
+            if (!aio_task_pool_busy_tasks(pool)) {
+                break;
+            }
+            aio_task_pool_wait_one(pool);
+            continue;
+        }
+
+        /* Copy if allocated above the base, skip the rest at once */
+        WITH_GRAPH_RDLOCK_GUARD() {
+            status = bdrv_co_common_block_status_above(blk_bs(s->top),
+                s->base_overlay, true, true, offset, len - offset,
+                &n, NULL, NULL, NULL);
+        }
+
+        trace_commit_one_iteration(s, offset, n, status);
+
+        if (status < 0) {
+            action = block_job_error_action(&s->common, s->on_error, true,
+                                            -status);
+            if (action == BLOCK_ERROR_ACTION_REPORT) {
+                ret = status;
+                break;
+            }
+            n = 0;
+            continue;
+        }
+
+        if (!(status & BDRV_BLOCK_ALLOCATED)) {
+            /* Publish progress */
+            job_progress_update(&s->common.job, n);
+        } else if (status & BDRV_BLOCK_ZERO) {
+            n = MIN(n, BDRV_REQUEST_MAX_BYTES);
+            commit_start_task(s, pool, offset, n, true);
+        } else {
+            n = MIN(n, s->max_chunk);
+            commit_start_task(s, pool, offset, n, false);
         }
     }
 
-    return 0;
+    aio_task_pool_wait_all(pool);
+    aio_task_pool_free(pool);
+    while ((r = QSIMPLEQ_FIRST(&s->failed))) {
+        QSIMPLEQ_REMOVE_HEAD(&s->failed, next);
+        g_free(r);
+    }
+
+    return ret;
 }
 
 static const BlockJobDriver commit_job_driver = {
@@ -307,7 +393,8 @@ void commit_start(const char *job_id, BlockDriverState *bs,
                   int creation_flags, int64_t speed,
                   BlockdevOnError on_error, const char *backing_file_str,
                   bool backing_mask_protocol,
-                  const char *filter_node_name, Error **errp)
+                  const char *filter_node_name,
+                  const BlockJobCopyPerf *perf, Error **errp)
 {
     CommitBlockJob *s;
     BlockDriverState *iter;
@@ -320,6 +407,19 @@ void commit_start(const char *job_id, BlockDriverState *bs,
     GLOBAL_STATE_CODE();
 
     assert(top != bs);
+
+    if (perf && perf->has_max_workers &&
+        (perf->max_workers < 1 || perf->max_workers > INT_MAX)) {
+        error_setg(errp, "max-workers must be between 1 and %d", INT_MAX);
+        return;
+    }
+    if (perf && perf->has_max_chunk &&
+        (perf->max_chunk < 0 || perf->max_chunk > BDRV_REQUEST_MAX_BYTES)) {
+        error_setg(errp, "max-chunk must be between 0 and %" PRId64,
+                   (int64_t)BDRV_REQUEST_MAX_BYTES);
+        return;
+    }
+
     bdrv_graph_rdlock_main_loop();
     if (bdrv_skip_filters(top) == bdrv_skip_filters(base)) {
         error_setg(errp, "Invalid files for merge: top and base are the same");
@@ -463,6 +563,15 @@ void commit_start(const char *job_id, BlockDriverState *bs,
     s->backing_file_str = g_strdup(backing_file_str);
     s->backing_mask_protocol = backing_mask_protocol;
     s->on_error = on_error;
+    s->max_workers = 1;
+    s->max_chunk = COMMIT_BUFFER_SIZE;
+    if (perf && perf->has_max_workers) {
+        s->max_workers = perf->max_workers;
+    }
+    if (perf && perf->has_max_chunk && perf->max_chunk) {
+        s->max_chunk = perf->max_chunk;
+    }
+    QSIMPLEQ_INIT(&s->failed);
 
     trace_commit_start(bs, base, top, s);
     job_start(&s->common.job);
@@ -47,8 +47,9 @@ typedef struct BDRVCopyBeforeWriteState {
     bool discard_source;
 
     /*
-     * @lock: protects access to @access_bitmap, @done_bitmap and
-     * @frozen_read_reqs
+     * @lock: protects access to @access_bitmap, @done_bitmap,
+     * @settled_bitmap and @frozen_read_reqs.  @settled_bitmap is read
+     * without it.
      */
     CoMutex lock;
 
@@ -64,6 +65,14 @@ typedef struct BDRVCopyBeforeWriteState {
      */
     BdrvDirtyBitmap *done_bitmap;
 
+    /*
+     * @settled_bitmap: represents areas of @done_bitmap where all fleecing
+     * read requests in bs->file node have finished. Guest writes to these
+     * areas need neither a copy nor @lock. As bits are only ever set, it is
+     * checked without @lock.
+     */
+    BdrvDirtyBitmap *settled_bitmap;
+
     /*
      * @frozen_read_reqs: current read requests for fleecing user in bs->file
      * node. These areas must not be rewritten by guest. There can be multiple
@@ -122,6 +131,12 @@ static coroutine_fn int cbw_do_copy_before_write(BlockDriverState *bs,
     off = QEMU_ALIGN_DOWN(offset, cluster_size);
     end = QEMU_ALIGN_UP(offset + bytes, cluster_size);
 
+    /* Fast path for areas that an earlier operation copied already */
+    if (bdrv_dirty_bitmap_next_zero(s->settled_bitmap, off,
+                                    end - off) == -1) {
+        return 0;
+    }
+
     /*
      * Increase in_flight, so that in case of timed-out block-copy, the
      * remaining background block_copy() request (which can't be immediately
@@ -146,6 +161,13 @@ static coroutine_fn int cbw_do_copy_before_write(BlockDriverState *bs,
             bdrv_set_dirty_bitmap(s->done_bitmap, off, end - off);
         }
         reqlist_wait_all(&s->frozen_read_reqs, off, end - off, &s->lock);
+        if (ret >= 0) {
+            /*
+             * No new read requests are frozen in areas of @done_bitmap, see
+             * cbw_snapshot_read_lock()
+             */
+            bdrv_set_dirty_bitmap(s->settled_bitmap, off, end - off);
+        }
     }
 
     return 0;
@@ -495,6 +517,12 @@ static int cbw_open(BlockDriverState *bs, QDict *options, int flags,
     }
     bdrv_disable_dirty_bitmap(s->done_bitmap);
 
+    s->settled_bitmap = bdrv_create_dirty_bitmap(bs, cluster_size, NULL, errp);
+    if (!s->settled_bitmap) {
+        return -EINVAL;
+    }
+    bdrv_disable_dirty_bitmap(s->settled_bitmap);
+
     /* s->access_bitmap starts equal to bcs bitmap */
     s->access_bitmap = bdrv_create_dirty_bitmap(bs, cluster_size, NULL, errp);
     if (!s->access_bitmap) {
@@ -506,7 +534,7 @@ static int cbw_open(BlockDriverState *bs, QDict *options, int flags,
                                      true);
 
     qemu_co_mutex_init(&s->lock);
-    QLIST_INIT(&s->frozen_read_reqs);
+    reqlist_init(&s->frozen_read_reqs);
     return 0;
 }
 
@@ -516,6 +544,7 @@ static void cbw_close(BlockDriverState *bs)
 
     bdrv_release_dirty_bitmap(s->access_bitmap);
     bdrv_release_dirty_bitmap(s->done_bitmap);
+    bdrv_release_dirty_bitmap(s->settled_bitmap);
 
     block_copy_state_free(s->bcs);
     s->bcs = NULL;
@@ -40,6 +40,9 @@
 int coroutine_fn GRAPH_RDLOCK
 bdrv_co_check(BlockDriverState *bs, BdrvCheckResult *res, BdrvCheckMode fix);
 
+int coroutine_fn GRAPH_RDLOCK
+bdrv_co_dedup(BlockDriverState *bs, int64_t *freed_bytes, Error **errp);
+
 int coroutine_fn GRAPH_RDLOCK
 bdrv_co_invalidate_cache(BlockDriverState *bs, Error **errp);
 
@@ -56,14 +59,8 @@ bdrv_co_common_block_status_above(BlockDriverState *bs,
                                   int *depth);
 
 int coroutine_fn GRAPH_RDLOCK
-bdrv_co_readv_vmstate(BlockDriverState *bs, QEMUIOVector *qiov, int64_t pos);
-
-int coroutine_fn GRAPH_RDLOCK
-bdrv_co_writev_vmstate(BlockDriverState *bs, QEMUIOVector *qiov, int64_t pos);
-
-int coroutine_fn GRAPH_RDLOCK
-nbd_co_do_establish_connection(BlockDriverState *bs, bool blocking,
-                               Error **errp);
+nbd_co_do_establish_connection(BlockDriverState *bs, unsigned index,
+                               bool blocking, Error **errp);
 
 
 /*
@@ -87,6 +84,7 @@ bdrv_common_block_status_above(BlockDriverState *bs,
                                int *depth);
 
 int co_wrapper_mixed_bdrv_rdlock
-nbd_do_establish_connection(BlockDriverState *bs, bool blocking, Error **errp);
+nbd_do_establish_connection(BlockDriverState *bs, unsigned index,
+                            bool blocking, Error **errp);
 
 #endif /* BLOCK_COROUTINES_H */
@@ -64,10 +64,22 @@ struct BdrvDirtyBitmapIter {
 static inline void bdrv_dirty_bitmaps_lock(BlockDriverState *bs)
 {
     qemu_mutex_lock(&bs->dirty_bitmap_mutex);
+
+    /* Keep bdrv_set_dirty() away */
+    qatomic_set(&bs->dirty_bitmap_locked, true);
+    /*
+     * Pairs with smp_mb__after_rmw() in bdrv_set_dirty_unlocked(): either
+     * it sees dirty_bitmap_locked, or we see its dirty_bitmap_writers++.
+     */
+    smp_mb();
+    while (qatomic_read(&bs->dirty_bitmap_writers)) {
+        cpu_relax();
+    }
 }
 
 static inline void bdrv_dirty_bitmaps_unlock(BlockDriverState *bs)
 {
+    qatomic_store_release(&bs->dirty_bitmap_locked, false);
     qemu_mutex_unlock(&bs->dirty_bitmap_mutex);
 }
 
@@ -653,6 +665,39 @@ void bdrv_dirty_bitmap_deserialize_finish(BdrvDirtyBitmap *bitmap)
     hbitmap_deserialize_finish(bitmap->bitmap);
 }
 
+/*
+ * Mark the enabled bitmaps dirty without taking dirty_bitmap_mutex, so that
+ * writes from several threads do not serialize on it.  Concurrent callers
+ * only set bits, which hbitmap_set_atomic() allows; everything else that
+ * touches the bitmaps holds the mutex, and bdrv_dirty_bitmaps_lock() waits
+ * for the callers that are already past the check of dirty_bitmap_locked.
+ * Returns false if the mutex is held, in which case nothing was done.
+ */
+static bool bdrv_set_dirty_unlocked(BlockDriverState *bs, int64_t offset,
+                                    int64_t bytes)
+{
+    BdrvDirtyBitmap *bitmap;
+
+    qatomic_inc(&bs->dirty_bitmap_writers);
+    /* Pairs with smp_mb() in bdrv_dirty_bitmaps_lock() */
+    smp_mb__after_rmw();
+    if (qatomic_read(&bs->dirty_bitmap_locked)) {
+        qatomic_dec(&bs->dirty_bitmap_writers);
+        return false;
+    }
+
+    QLIST_FOREACH(bitmap, &bs->dirty_bitmaps, list) {
+        if (!bdrv_dirty_bitmap_enabled(bitmap)) {
+            continue;
+        }
+        assert(!bdrv_dirty_bitmap_readonly(bitmap));
+        hbitmap_set_atomic(bitmap->bitmap, offset, bytes);
+    }
+
+    qatomic_dec(&bs->dirty_bitmap_writers);
+    return true;
+}
+
 void bdrv_set_dirty(BlockDriverState *bs, int64_t offset, int64_t bytes)
 {
     BdrvDirtyBitmap *bitmap;
@@ -662,6 +707,10 @@ void bdrv_set_dirty(BlockDriverState *bs, int64_t offset, int64_t bytes)
         return;
     }
 
+    if (bdrv_set_dirty_unlocked(bs, offset, bytes)) {
+        return;
+    }
+
     bdrv_dirty_bitmaps_lock(bs);
     QLIST_FOREACH(bitmap, &bs->dirty_bitmaps, list) {
         if (!bdrv_dirty_bitmap_enabled(bitmap)) {
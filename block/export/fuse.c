@@ -29,6 +29,7 @@
 #include "qapi/qapi-commands-block.h"
 #include "qemu/main-loop.h"
 #include "system/block-backend.h"
+#include "system/iothread.h"
 
 #include <fuse.h>
 #include <fuse_lowlevel.h>
@@ -44,14 +45,37 @@
 /* Prevent overly long bounce buffer allocations */
 #define FUSE_MAX_BOUNCE_BYTES (MIN(BDRV_REQUEST_MAX_BYTES, 64 * 1024 * 1024))
 
+/* Maximum number of requests fetched from the FUSE device per wakeup */
+#define FUSE_MAX_REQUEST_BATCH 32
 
-typedef struct FuseExport {
+
+typedef struct FuseExport FuseExport;
+
+/*
+ * One reader of the FUSE device.  All queues share the session FD; the
+ * kernel hands each request to exactly one reader, and the reply is
+ * written back by the thread that read the request.
+ */
+typedef struct FuseQueue {
+    FuseExport *exp;
+
+    /* NULL for the first queue, which runs in the export AioContext */
+    IOThread *iothread;
+    AioContext *ctx;
+
+    struct fuse_buf fuse_buf;
+    bool fd_handler_set_up;
+} FuseQueue;
+
+struct FuseExport {
     BlockExport common;
 
     struct fuse_session *fuse_session;
-    struct fuse_buf fuse_buf;
     unsigned int in_flight; /* atomic */
-    bool mounted, fd_handler_set_up;
+    bool mounted;
+
+    FuseQueue *queues;
+    size_t num_queues;
 
     char *mountpoint;
     bool writable;
@@ -62,7 +86,7 @@ typedef struct FuseExport {
     mode_t st_mode;
     uid_t st_uid;
     gid_t st_gid;
-} FuseExport;
+};
 
 static GHashTable *exports;
 static const struct fuse_lowlevel_ops fuse_ops;
@@ -79,27 +103,44 @@ static void read_from_fuse_export(void *opaque);
 static bool is_regular_file(const char *path, Error **errp);
 
 
+static void fuse_queue_attach(FuseQueue *q)
+{
+    aio_set_fd_handler(q->ctx, fuse_session_fd(q->exp->fuse_session),
+                       read_from_fuse_export, NULL, NULL, NULL, q);
+    q->fd_handler_set_up = true;
+}
+
+static void fuse_queue_detach(FuseQueue *q)
+{
+    if (q->fd_handler_set_up) {
+        aio_set_fd_handler(q->ctx, fuse_session_fd(q->exp->fuse_session),
+                           NULL, NULL, NULL, NULL, NULL);
+        q->fd_handler_set_up = false;
+    }
+}
+
 static void fuse_export_drained_begin(void *opaque)
 {
     FuseExport *exp = opaque;
+    size_t i;
 
-    aio_set_fd_handler(exp->common.ctx,
-                       fuse_session_fd(exp->fuse_session),
-                       NULL, NULL, NULL, NULL, NULL);
-    exp->fd_handler_set_up = false;
+    for (i = 0; i < exp->num_queues; i++) {
+        fuse_queue_detach(&exp->queues[i]);
+    }
 }
 
 static void fuse_export_drained_end(void *opaque)
 {
     FuseExport *exp = opaque;
+    size_t i;
 
     /* Refresh AioContext in case it changed */
     exp->common.ctx = blk_get_aio_context(exp->common.blk);
+    exp->queues[0].ctx = exp->common.ctx;
 
-    aio_set_fd_handler(exp->common.ctx,
-                       fuse_session_fd(exp->fuse_session),
-                       read_from_fuse_export, NULL, NULL, NULL, exp);
-    exp->fd_handler_set_up = true;
+    for (i = 0; i < exp->num_queues; i++) {
+        fuse_queue_attach(&exp->queues[i]);
+    }
 }
 
 static bool fuse_export_drained_poll(void *opaque)
@@ -121,10 +162,19 @@ static int fuse_export_create(BlockExport *blk_exp,
 {
     FuseExport *exp = container_of(blk_exp, FuseExport, common);
     BlockExportOptionsFuse *args = &blk_exp_args->u.fuse;
+    strList *iothreads;
+    size_t i;
     int ret;
 
     assert(blk_exp_args->type == BLOCK_EXPORT_TYPE_FUSE);
 
+    for (iothreads = args->iothreads; iothreads; iothreads = iothreads->next) {
+        if (!iothread_by_id(iothreads->value)) {
+            error_setg(errp, "iothread \"%s\" not found", iothreads->value);
+            return -EINVAL;
+        }
+    }
+
     /* For growable and writable exports, take the RESIZE permission */
     if (args->growable || blk_exp_args->writable) {
         uint64_t blk_perm, blk_shared_perm;
@@ -179,6 +229,24 @@ static int fuse_export_create(BlockExport *blk_exp,
     exp->writable = blk_exp_args->writable;
     exp->growable = args->growable;
 
+    /* The first queue is served from the export AioContext */
+    exp->num_queues = 1;
+    for (iothreads = args->iothreads; iothreads; iothreads = iothreads->next) {
+        exp->num_queues++;
+    }
+    exp->queues = g_new0(FuseQueue, exp->num_queues);
+    exp->queues[0].exp = exp;
+    exp->queues[0].ctx = exp->common.ctx;
+    for (i = 1, iothreads = args->iothreads; iothreads;
+         i++, iothreads = iothreads->next) {
+        FuseQueue *q = &exp->queues[i];
+
+        q->exp = exp;
+        q->iothread = iothread_by_id(iothreads->value);
+        object_ref(OBJECT(q->iothread));
+        q->ctx = iothread_get_aio_context(q->iothread);
+    }
+
     /* set default */
     if (!args->has_allow_other) {
         args->allow_other = FUSE_EXPORT_ALLOW_OTHER_AUTO;
@@ -234,6 +302,7 @@ static int setup_fuse_export(FuseExport *exp, const char *mountpoint,
     const char *fuse_argv[4];
     char *mount_opts;
     struct fuse_args fuse_args;
+    size_t i;
     int ret;
 
     /*
@@ -269,10 +338,18 @@ static int setup_fuse_export(FuseExport *exp, const char *mountpoint,
 
     g_hash_table_insert(exports, g_strdup(mountpoint), NULL);
 
-    aio_set_fd_handler(exp->common.ctx,
-                       fuse_session_fd(exp->fuse_session),
-                       read_from_fuse_export, NULL, NULL, NULL, exp);
-    exp->fd_handler_set_up = true;
+    /*
+     * Several queues may wait for the same FD, so reading must not block
+     * when another queue has already taken the request.
+     */
+    if (!qemu_set_blocking(fuse_session_fd(exp->fuse_session), false, errp)) {
+        ret = -EIO;
+        goto fail;
+    }
+
+    for (i = 0; i < exp->num_queues; i++) {
+        fuse_queue_attach(&exp->queues[i]);
+    }
 
     return 0;
 
@@ -284,26 +361,36 @@ fail:
 /**
  * Callback to be invoked when the FUSE session FD can be read from.
  * (This is basically the FUSE event loop.)
+ *
+ * Handles up to FUSE_MAX_REQUEST_BATCH requests per invocation, so that a
+ * busy export does not go back to polling for every single request.
  */
 static void read_from_fuse_export(void *opaque)
 {
-    FuseExport *exp = opaque;
-    int ret;
+    FuseQueue *q = opaque;
+    FuseExport *exp = q->exp;
+    int i, ret;
 
     blk_exp_ref(&exp->common);
 
     qatomic_inc(&exp->in_flight);
 
-    do {
-        ret = fuse_session_receive_buf(exp->fuse_session, &exp->fuse_buf);
-    } while (ret == -EINTR);
-    if (ret < 0) {
-        goto out;
-    }
+    for (i = 0; i < FUSE_MAX_REQUEST_BATCH; i++) {
+        do {
+            ret = fuse_session_receive_buf(exp->fuse_session, &q->fuse_buf);
+        } while (ret == -EINTR);
+        if (ret <= 0) {
+            /* -EAGAIN: no more requests, or another queue took them */
+            break;
+        }
 
-    fuse_session_process_buf(exp->fuse_session, &exp->fuse_buf);
+        fuse_session_process_buf(exp->fuse_session, &q->fuse_buf);
+
+        if (fuse_session_exited(exp->fuse_session)) {
+            break;
+        }
+    }
 
-out:
     if (qatomic_fetch_dec(&exp->in_flight) == 1) {
         aio_wait_kick(); /* wake AIO_WAIT_WHILE() */
     }
@@ -314,15 +401,13 @@ out:
 static void fuse_export_shutdown(BlockExport *blk_exp)
 {
     FuseExport *exp = container_of(blk_exp, FuseExport, common);
+    size_t i;
 
     if (exp->fuse_session) {
         fuse_session_exit(exp->fuse_session);
 
-        if (exp->fd_handler_set_up) {
-            aio_set_fd_handler(exp->common.ctx,
-                               fuse_session_fd(exp->fuse_session),
-                               NULL, NULL, NULL, NULL, NULL);
-            exp->fd_handler_set_up = false;
+        for (i = 0; i < exp->num_queues; i++) {
+            fuse_queue_detach(&exp->queues[i]);
         }
     }
 
@@ -338,6 +423,7 @@ static void fuse_export_shutdown(BlockExport *blk_exp)
 static void fuse_export_delete(BlockExport *blk_exp)
 {
     FuseExport *exp = container_of(blk_exp, FuseExport, common);
+    size_t i;
 
     if (exp->fuse_session) {
         if (exp->mounted) {
@@ -347,7 +433,13 @@ static void fuse_export_delete(BlockExport *blk_exp)
         fuse_session_destroy(exp->fuse_session);
     }
 
-    free(exp->fuse_buf.mem);
+    for (i = 0; i < exp->num_queues; i++) {
+        free(exp->queues[i].fuse_buf.mem);
+        if (exp->queues[i].iothread) {
+            object_unref(OBJECT(exp->queues[i].iothread));
+        }
+    }
+    g_free(exp->queues);
     g_free(exp->mountpoint);
 }
 
@@ -14,7 +14,10 @@
 #include <sys/eventfd.h>
 
 #include "qapi/error.h"
+#include "qapi/clone-visitor.h"
+#include "qapi/qapi-visit-common.h"
 #include "block/export.h"
+#include "hw/virtio/iothread-vq-mapping.h"
 #include "qemu/error-report.h"
 #include "util/block-helpers.h"
 #include "subprojects/libvduse/libvduse.h"
@@ -30,6 +33,10 @@ typedef struct VduseBlkExport {
     VirtioBlkHandler handler;
     VduseDev *dev;
     uint16_t num_queues;
+    /* The AioContext that processes each virtqueue */
+    AioContext **vq_aio_context;
+    /* NULL if all virtqueues are processed in the export AioContext */
+    IOThreadVirtQueueMappingList *iothread_vq_mapping_list;
     char *recon_file;
     unsigned int inflight; /* atomic */
     bool vqs_started;
@@ -128,6 +135,17 @@ static void on_vduse_vq_kick(void *opaque)
     vduse_blk_vq_handler(dev, vq);
 }
 
+static AioContext *vduse_blk_vq_aio_context(VduseBlkExport *vblk_exp,
+                                            VduseVirtq *vq)
+{
+    for (uint16_t i = 0; i < vblk_exp->num_queues; i++) {
+        if (vduse_dev_get_queue(vblk_exp->dev, i) == vq) {
+            return vblk_exp->vq_aio_context[i];
+        }
+    }
+    g_assert_not_reached();
+}
+
 static void vduse_blk_enable_queue(VduseDev *dev, VduseVirtq *vq)
 {
     VduseBlkExport *vblk_exp = vduse_dev_get_priv(dev);
@@ -136,7 +154,8 @@ static void vduse_blk_enable_queue(VduseDev *dev, VduseVirtq *vq)
         return; /* vduse_blk_drained_end() will start vqs later */
     }
 
-    aio_set_fd_handler(vblk_exp->export.ctx, vduse_queue_get_fd(vq),
+    aio_set_fd_handler(vduse_blk_vq_aio_context(vblk_exp, vq),
+                       vduse_queue_get_fd(vq),
                        on_vduse_vq_kick, NULL, NULL, NULL, vq);
     /* Make sure we don't miss any kick after reconnecting */
     eventfd_write(vduse_queue_get_fd(vq), 1);
@@ -151,7 +170,7 @@ static void vduse_blk_disable_queue(VduseDev *dev, VduseVirtq *vq)
         return;
     }
 
-    aio_set_fd_handler(vblk_exp->export.ctx, fd,
+    aio_set_fd_handler(vduse_blk_vq_aio_context(vblk_exp, vq), fd,
                        NULL, NULL, NULL, NULL, NULL);
 }
 
@@ -190,6 +209,11 @@ static void blk_aio_attached(AioContext *ctx, void *opaque)
     VduseBlkExport *vblk_exp = opaque;
 
     vblk_exp->export.ctx = ctx;
+    if (!vblk_exp->iothread_vq_mapping_list) {
+        for (uint16_t i = 0; i < vblk_exp->num_queues; i++) {
+            vblk_exp->vq_aio_context[i] = ctx;
+        }
+    }
     vduse_blk_attach_ctx(vblk_exp, ctx);
 }
 
@@ -258,6 +282,47 @@ static bool vduse_blk_drained_poll(void *opaque)
     return qatomic_read(&vblk_exp->inflight) > 0;
 }
 
+static bool vduse_blk_vq_aio_context_init(VduseBlkExport *vblk_exp,
+                                          BlockExportOptionsVduseBlk *opts,
+                                          Error **errp)
+{
+    uint16_t num_queues = vblk_exp->num_queues;
+
+    vblk_exp->vq_aio_context = g_new(AioContext *, num_queues);
+
+    if (!opts->iothread_vq_mapping) {
+        for (uint16_t i = 0; i < num_queues; i++) {
+            vblk_exp->vq_aio_context[i] = vblk_exp->export.ctx;
+        }
+        return true;
+    }
+
+    if (!iothread_vq_mapping_apply(opts->iothread_vq_mapping,
+                                   vblk_exp->vq_aio_context, num_queues,
+                                   errp)) {
+        g_free(vblk_exp->vq_aio_context);
+        vblk_exp->vq_aio_context = NULL;
+        return false;
+    }
+
+    vblk_exp->iothread_vq_mapping_list =
+        QAPI_CLONE(IOThreadVirtQueueMappingList, opts->iothread_vq_mapping);
+    return true;
+}
+
+static void vduse_blk_vq_aio_context_cleanup(VduseBlkExport *vblk_exp)
+{
+    if (vblk_exp->iothread_vq_mapping_list) {
+        iothread_vq_mapping_cleanup(vblk_exp->iothread_vq_mapping_list);
+        qapi_free_IOThreadVirtQueueMappingList(
+                vblk_exp->iothread_vq_mapping_list);
+        vblk_exp->iothread_vq_mapping_list = NULL;
+    }
+
+    g_free(vblk_exp->vq_aio_context);
+    vblk_exp->vq_aio_context = NULL;
+}
+
 static const BlockDevOps vduse_block_ops = {
     .resize_cb     = vduse_blk_resize,
     .drained_begin = vduse_blk_drained_begin,
@@ -302,6 +367,10 @@ static int vduse_blk_exp_create(BlockExport *exp, BlockExportOptions *opts,
         }
     }
     vblk_exp->num_queues = num_queues;
+    if (!vduse_blk_vq_aio_context_init(vblk_exp, vblk_opts, errp)) {
+        return -EINVAL;
+    }
+
     vblk_exp->handler.blk = exp->blk;
     vblk_exp->handler.serial = g_strdup(vblk_opts->serial ?: "");
     vblk_exp->handler.logical_block_size = logical_block_size;
@@ -381,6 +450,7 @@ err:
     g_free(vblk_exp->recon_file);
 err_dev:
     g_free(vblk_exp->handler.serial);
+    vduse_blk_vq_aio_context_cleanup(vblk_exp);
     return ret;
 }
 
@@ -400,6 +470,7 @@ static void vduse_blk_exp_delete(BlockExport *exp)
     }
     g_free(vblk_exp->recon_file);
     g_free(vblk_exp->handler.serial);
+    vduse_blk_vq_aio_context_cleanup(vblk_exp);
 }
 
 /* Called with exp->ctx acquired */
@@ -10,6 +10,7 @@
  * later.  See the COPYING file in the top-level directory.
  */
 #include "qemu/osdep.h"
+#include "qemu/bitmap.h"
 #include "qemu/error-report.h"
 #include "block/block.h"
 #include "subprojects/libvhost-user/libvhost-user.h" /* only for the type definitions */
@@ -38,16 +39,62 @@ typedef struct {
     VirtioBlkHandler handler;
     QIOChannelSocket *sioc;
     struct virtio_blk_config blkcfg;
+
+    /*
+     * Completion notification is coalesced: virtqueues with completed
+     * requests are marked in notify_pending, and notify_bh signals them
+     * all once the current batch of completions has been processed.
+     */
+    uint16_t num_queues;
+    unsigned long *notify_pending;
+    bool notify_scheduled;
 } VuBlkExport;
 
-static void vu_blk_req_complete(VuBlkReq *req, size_t in_len)
+/*
+ * Takes over the in-flight reference of the request that scheduled it, so
+ * the device cannot be torn down before the guest has been notified.
+ */
+static void vu_blk_notify_bh(void *opaque)
 {
-    VuDev *vu_dev = &req->server->vu_dev;
+    VuBlkExport *vexp = opaque;
+    VuServer *server = &vexp->vu_server;
+    VuDev *vu_dev = &server->vu_dev;
+    unsigned long idx;
+
+    vexp->notify_scheduled = false;
+
+    for (idx = find_first_bit(vexp->notify_pending, vexp->num_queues);
+         idx < vexp->num_queues;
+         idx = find_next_bit(vexp->notify_pending, vexp->num_queues, idx + 1)) {
+        clear_bit(idx, vexp->notify_pending);
+        /* Honours VIRTIO_RING_F_EVENT_IDX if it was negotiated */
+        vu_queue_notify(vu_dev, vu_get_queue(vu_dev, idx));
+    }
+
+    vhost_user_server_dec_in_flight(server);
+}
+
+/*
+ * Returns true if the caller's in-flight reference was handed over to
+ * vu_blk_notify_bh() and must not be dropped.
+ */
+static bool vu_blk_req_complete(VuBlkReq *req, size_t in_len)
+{
+    VuServer *server = req->server;
+    VuBlkExport *vexp = container_of(server, VuBlkExport, vu_server);
+    VuDev *vu_dev = &server->vu_dev;
+    bool schedule = !vexp->notify_scheduled;
 
     vu_queue_push(vu_dev, req->vq, &req->elem, in_len);
-    vu_queue_notify(vu_dev, req->vq);
+    set_bit(req->vq - vu_dev->vq, vexp->notify_pending);
+
+    if (schedule) {
+        vexp->notify_scheduled = true;
+        aio_bh_schedule_oneshot(vexp->export.ctx, vu_blk_notify_bh, vexp);
+    }
 
     free(req);
+    return schedule;
 }
 
 /*
@@ -75,8 +122,9 @@ static void coroutine_fn vu_blk_virtio_process_req(void *opaque)
         return;
     }
 
-    vu_blk_req_complete(req, in_len);
-    vhost_user_server_dec_in_flight(server);
+    if (!vu_blk_req_complete(req, in_len)) {
+        vhost_user_server_dec_in_flight(server);
+    }
 }
 
 static void vu_blk_process_vq(VuDev *vu_dev, int idx)
@@ -340,6 +388,9 @@ static int vu_blk_exp_create(BlockExport *exp, BlockExportOptions *opts,
         error_setg(errp, "num-queues must be greater than 0");
         return -EINVAL;
     }
+    vexp->num_queues = num_queues;
+    vexp->notify_pending = bitmap_new(num_queues);
+
     vexp->handler.blk = exp->blk;
     vexp->handler.serial = g_strdup("vhost_user_blk");
     vexp->handler.logical_block_size = logical_block_size;
@@ -358,6 +409,7 @@ static int vu_blk_exp_create(BlockExport *exp, BlockExportOptions *opts,
         blk_remove_aio_context_notifier(exp->blk, blk_aio_attached,
                                         blk_aio_detach, vexp);
         g_free(vexp->handler.serial);
+        g_free(vexp->notify_pending);
         return -EADDRNOTAVAIL;
     }
 
@@ -371,6 +423,7 @@ static void vu_blk_exp_delete(BlockExport *exp)
     blk_remove_aio_context_notifier(exp->blk, blk_aio_attached, blk_aio_detach,
                                     vexp);
     g_free(vexp->handler.serial);
+    g_free(vexp->notify_pending);
 }
 
 const BlockExportDriver blk_exp_vhost_user_blk = {
@@ -183,7 +183,9 @@ typedef struct BDRVRawState {
     bool use_linux_aio:1;
     bool has_laio_fdsync:1;
     bool use_linux_io_uring:1;
+    bool use_io_uring_fixed:1;
     bool use_mpath:1;
+    bool has_nowait:1;
     int page_cache_inconsistent; /* errno from fdatasync failure */
     bool has_fallocate;
     bool needs_alignment;
@@ -585,6 +587,14 @@ static QemuOptsList raw_runtime_opts = {
             .type = QEMU_OPT_NUMBER,
             .help = "AIO max batch size (0 = auto handled by AIO backend, default: 0)",
         },
+#ifdef CONFIG_LINUX_IO_URING
+        {
+            .name = "io-uring-fixed",
+            .type = QEMU_OPT_BOOL,
+            .help = "register guest RAM and the image file with io_uring "
+                    "(default: off)",
+        },
+#endif
         {
             .name = "locking",
             .type = QEMU_OPT_STRING,
@@ -613,6 +623,29 @@ static QemuOptsList raw_runtime_opts = {
 
 static const char *const mutable_opts[] = { "x-check-cache-dropped", NULL };
 
+/*
+ * With io-uring-fixed=on, s->fd is registered with io_uring as a fixed file
+ * while it is open.  The ring holds a reference to the file, so the fd must
+ * be unregistered before it is closed.
+ */
+static void raw_register_fixed_file(BDRVRawState *s)
+{
+#ifdef CONFIG_LINUX_IO_URING
+    if (s->use_io_uring_fixed) {
+        aio_register_fixed_file(s->fd);
+    }
+#endif
+}
+
+static void raw_unregister_fixed_file(BDRVRawState *s)
+{
+#ifdef CONFIG_LINUX_IO_URING
+    if (s->use_io_uring_fixed) {
+        aio_unregister_fixed_file(s->fd);
+    }
+#endif
+}
+
 static int raw_open_common(BlockDriverState *bs, QDict *options,
                            int bdrv_flags, int open_flags,
                            bool device, Error **errp)
@@ -662,6 +695,12 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
     s->use_linux_aio = (aio == BLOCKDEV_AIO_OPTIONS_NATIVE);
 #ifdef CONFIG_LINUX_IO_URING
     s->use_linux_io_uring = (aio == BLOCKDEV_AIO_OPTIONS_IO_URING);
+    s->use_io_uring_fixed = qemu_opt_get_bool(opts, "io-uring-fixed", false);
+    if (s->use_io_uring_fixed && !s->use_linux_io_uring) {
+        error_setg(errp, "io-uring-fixed=on requires aio=io_uring");
+        ret = -EINVAL;
+        goto fail;
+    }
 #endif
 
     s->aio_max_batch = qemu_opt_get_number(opts, "aio-max-batch", 0);
@@ -775,6 +814,7 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
 
     s->has_discard = true;
     s->has_write_zeroes = true;
+    s->has_nowait = true;
 
     if (fstat(s->fd, &st) < 0) {
         ret = -errno;
@@ -838,6 +878,8 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
         /* When extending regular files, we get zeros from the OS */
         bs->supported_truncate_flags = BDRV_REQ_ZERO_WRITE;
     }
+
+    raw_register_fixed_file(s);
     ret = 0;
 fail:
     if (ret < 0 && s->fd != -1) {
@@ -1794,6 +1836,41 @@ qemu_pwritev(int fd, const struct iovec *iov, int nr_iov, off_t offset)
 
 #endif
 
+#ifdef CONFIG_PREADV2_NOWAIT
+/*
+ * Read from the page cache without blocking, so that cached data does not
+ * need a round trip through the thread pool.  Returns -EAGAIN if the read
+ * could not be completed this way.
+ */
+static int raw_preadv_nowait(BDRVRawState *s, uint64_t offset,
+                             QEMUIOVector *qiov)
+{
+    ssize_t len;
+
+    if (!s->has_nowait || (s->open_flags & O_DIRECT)) {
+        return -EAGAIN;
+    }
+
+    len = RETRY_ON_EINTR(preadv2(s->fd, qiov->iov, qiov->niov, offset,
+                                 RWF_NOWAIT));
+    if (len == qiov->size) {
+        return 0;
+    }
+    if (len < 0 && (errno == EOPNOTSUPP || errno == EINVAL)) {
+        /* Not supported by the kernel or the file system */
+        s->has_nowait = false;
+    }
+    /* Let the thread pool deal with short reads and errors */
+    return -EAGAIN;
+}
+#else
+static int raw_preadv_nowait(BDRVRawState *s, uint64_t offset,
+                             QEMUIOVector *qiov)
+{
+    return -EAGAIN;
+}
+#endif
+
 static ssize_t handle_aiocb_rw_vector(RawPosixAIOData *aiocb)
 {
     ssize_t len;
@@ -2613,6 +2690,13 @@ raw_co_prw(BlockDriverState *bs, int64_t *offset_ptr, uint64_t bytes,
 #endif
     }
 
+    if (type == QEMU_AIO_READ) {
+        ret = raw_preadv_nowait(s, offset, qiov);
+        if (ret != -EAGAIN) {
+            goto out;
+        }
+    }
+
     acb = (RawPosixAIOData) {
         .bs             = bs,
         .aio_fildes     = s->fd,
@@ -2716,11 +2800,41 @@ static void raw_close(BlockDriverState *bs)
 #if defined(CONFIG_BLKZONED)
         g_free(bs->wps);
 #endif
+        raw_unregister_fixed_file(s);
         qemu_close(s->fd);
         s->fd = -1;
     }
 }
 
+/*
+ * With io-uring-fixed=on, buffers registered by the BlockBackend user (usually
+ * guest RAM) become io_uring fixed buffers.  This is only an optimization, so
+ * failure to register them is not an error.
+ */
+static bool raw_register_buf(BlockDriverState *bs, void *host, size_t size,
+                             Error **errp)
+{
+#ifdef CONFIG_LINUX_IO_URING
+    BDRVRawState *s = bs->opaque;
+
+    if (s->use_io_uring_fixed) {
+        aio_register_fixed_buf(host, size);
+    }
+#endif
+    return true;
+}
+
+static void raw_unregister_buf(BlockDriverState *bs, void *host, size_t size)
+{
+#ifdef CONFIG_LINUX_IO_URING
+    BDRVRawState *s = bs->opaque;
+
+    if (s->use_io_uring_fixed) {
+        aio_unregister_fixed_buf(host, size);
+    }
+#endif
+}
+
 /**
  * Truncates the given regular file @fd to @offset and, when growing, fills the
  * new space according to @prealloc.
@@ -3908,9 +4022,11 @@ static void raw_set_perm(BlockDriverState *bs, uint64_t perm, uint64_t shared)
     /* For reopen, we have already switched to the new fd (.bdrv_set_perm is
      * called after .bdrv_reopen_commit) */
     if (s->perm_change_fd && s->fd != s->perm_change_fd) {
+        raw_unregister_fixed_file(s);
         qemu_close(s->fd);
         s->fd = s->perm_change_fd;
         s->open_flags = s->perm_change_flags;
+        raw_register_fixed_file(s);
     }
     s->perm_change_fd = 0;
 
@@ -4005,6 +4121,8 @@ BlockDriver bdrv_file = {
     .bdrv_co_copy_range_from = raw_co_copy_range_from,
     .bdrv_co_copy_range_to  = raw_co_copy_range_to,
     .bdrv_refresh_limits = raw_refresh_limits,
+    .bdrv_register_buf      = raw_register_buf,
+    .bdrv_unregister_buf    = raw_unregister_buf,
 
     .bdrv_co_truncate                   = raw_co_truncate,
     .bdrv_co_getlength                  = raw_co_getlength,
@@ -4475,6 +4593,8 @@ static BlockDriver bdrv_host_device = {
     .bdrv_co_copy_range_from = raw_co_copy_range_from,
     .bdrv_co_copy_range_to  = raw_co_copy_range_to,
     .bdrv_refresh_limits = raw_refresh_limits,
+    .bdrv_register_buf      = raw_register_buf,
+    .bdrv_unregister_buf    = raw_unregister_buf,
 
     .bdrv_co_truncate                   = raw_co_truncate,
     .bdrv_co_getlength                  = raw_co_getlength,
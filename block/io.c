@@ -1173,6 +1173,7 @@ bdrv_co_do_copy_on_readv(BdrvChild *child, int64_t offset, int64_t bytes,
      * where anything might happen inside guest memory.
      */
     void *bounce_buffer = NULL;
+    int64_t bounce_buffer_len = 0;
 
     BlockDriver *drv = bs->drv;
     int64_t align_offset;
@@ -1251,9 +1252,10 @@ bdrv_co_do_copy_on_readv(BdrvChild *child, int64_t offset, int64_t bytes,
             if (!bounce_buffer) {
                 int64_t max_we_need = MAX(pnum, align_bytes - pnum);
                 int64_t max_allowed = MIN(max_transfer, MAX_BOUNCE_BUFFER);
-                int64_t bounce_buffer_len = MIN(max_we_need, max_allowed);
 
-                bounce_buffer = qemu_try_blockalign(bs, bounce_buffer_len);
+                bounce_buffer_len = MIN(max_we_need, max_allowed);
+                bounce_buffer = qemu_try_blockalign_pooled(bs,
+                                                           bounce_buffer_len);
                 if (!bounce_buffer) {
                     ret = -ENOMEM;
                     goto err;
@@ -1316,7 +1318,7 @@ bdrv_co_do_copy_on_readv(BdrvChild *child, int64_t offset, int64_t bytes,
     ret = 0;
 
 err:
-    qemu_vfree(bounce_buffer);
+    qemu_blockfree_pooled(bounce_buffer, bounce_buffer_len);
     return ret;
 }
 
@@ -1500,7 +1502,7 @@ static bool bdrv_init_padding(BlockDriverState *bs,
 
     sum = pad->head + bytes + pad->tail;
     pad->buf_len = (sum > align && pad->head && pad->tail) ? 2 * align : align;
-    pad->buf = qemu_blockalign(bs, pad->buf_len);
+    pad->buf = qemu_blockalign_pooled(bs, pad->buf_len);
     pad->merge_reads = sum == pad->buf_len;
     if (pad->tail) {
         pad->tail_buf = pad->buf + pad->buf_len - align;
@@ -1586,11 +1588,11 @@ static void bdrv_padding_finalize(BdrvRequestPadding *pad)
             qemu_iovec_from_buf(&pad->pre_collapse_qiov, 0,
                                 pad->collapse_bounce_buf, pad->collapse_len);
         }
-        qemu_vfree(pad->collapse_bounce_buf);
+        qemu_blockfree_pooled(pad->collapse_bounce_buf, pad->collapse_len);
         qemu_iovec_destroy(&pad->pre_collapse_qiov);
     }
     if (pad->buf) {
-        qemu_vfree(pad->buf);
+        qemu_blockfree_pooled(pad->buf, pad->buf_len);
         qemu_iovec_destroy(&pad->local_qiov);
     }
     memset(pad, 0, sizeof(*pad));
@@ -1671,7 +1673,8 @@ static int bdrv_create_padded_qiov(BlockDriverState *bs,
          * from those elements.  Then add it to `pad->local_qiov`.
          */
         pad->collapse_len = pad->pre_collapse_qiov.size;
-        pad->collapse_bounce_buf = qemu_blockalign(bs, pad->collapse_len);
+        pad->collapse_bounce_buf = qemu_blockalign_pooled(bs,
+                                                          pad->collapse_len);
         if (pad->write) {
             qemu_iovec_to_buf(&pad->pre_collapse_qiov, 0,
                               pad->collapse_bounce_buf, pad->collapse_len);
@@ -1839,6 +1842,7 @@ bdrv_co_do_pwrite_zeroes(BlockDriverState *bs, int64_t offset, int64_t bytes,
     BlockDriver *drv = bs->drv;
     QEMUIOVector qiov;
     void *buf = NULL;
+    int64_t buf_len = 0;
     int ret = 0;
     bool need_flush = false;
     int head = 0;
@@ -1930,11 +1934,13 @@ bdrv_co_do_pwrite_zeroes(BlockDriverState *bs, int64_t offset, int64_t bytes,
             }
             num = MIN(num, max_transfer);
             if (buf == NULL) {
-                buf = qemu_try_blockalign0(bs, num);
+                buf = qemu_try_blockalign_pooled(bs, num);
                 if (buf == NULL) {
                     ret = -ENOMEM;
                     goto fail;
                 }
+                memset(buf, 0, num);
+                buf_len = num;
             }
             qemu_iovec_init_buf(&qiov, buf, num);
 
@@ -1944,7 +1950,7 @@ bdrv_co_do_pwrite_zeroes(BlockDriverState *bs, int64_t offset, int64_t bytes,
              * all future requests.
              */
             if (num < max_transfer) {
-                qemu_vfree(buf);
+                qemu_blockfree_pooled(buf, buf_len);
                 buf = NULL;
             }
         }
@@ -1957,7 +1963,7 @@ fail:
     if (ret == 0 && need_flush) {
         ret = bdrv_co_flush(bs);
     }
-    qemu_vfree(buf);
+    qemu_blockfree_pooled(buf, buf_len);
     return ret;
 }
 
@@ -2826,13 +2832,13 @@ int coroutine_fn bdrv_co_is_all_zeroes(BlockDriverState *bs)
         return ret;
     }
     /* Only the head of the image is unknown, and it's small.  Read it.  */
-    buf = qemu_blockalign(bs, pnum);
+    buf = qemu_blockalign_pooled(bs, pnum);
     qemu_iovec_init_buf(&local_qiov, buf, pnum);
     ret = bdrv_driver_preadv(bs, 0, pnum, &local_qiov, 0, 0);
     if (ret >= 0) {
         ret = buffer_is_zero(buf, pnum);
     }
-    qemu_vfree(buf);
+    qemu_blockfree_pooled(buf, pnum);
     return ret;
 }
 
@@ -3382,6 +3388,33 @@ void *qemu_try_blockalign0(BlockDriverState *bs, size_t size)
     return mem;
 }
 
+void *qemu_try_blockalign_pooled(BlockDriverState *bs, size_t size)
+{
+    size_t align = bdrv_opt_mem_align(bs);
+    IO_CODE();
+
+    return aio_buf_pool_try_alloc(qemu_get_current_aio_context(), align, size);
+}
+
+void *qemu_blockalign_pooled(BlockDriverState *bs, size_t size)
+{
+    void *mem = qemu_try_blockalign_pooled(bs, size);
+    IO_CODE();
+
+    if (!mem) {
+        fprintf(stderr, "%s: failed to allocate %zu bytes\n", __func__, size);
+        abort();
+    }
+
+    return mem;
+}
+
+void qemu_blockfree_pooled(void *ptr, size_t size)
+{
+    IO_CODE();
+    aio_buf_pool_free(qemu_get_current_aio_context(), ptr, size);
+}
+
 /* Helper that undoes bdrv_register_buf() when it fails partway through */
 static void GRAPH_RDLOCK
 bdrv_register_buf_rollback(BlockDriverState *bs, void *host, size_t size,
@@ -36,19 +36,42 @@ typedef struct {
     CqeHandler cqe_handler;
 } LuringRequest;
 
+/*
+ * Returns the index of the registered buffer that contains @qiov, or -1 if
+ * there is none.  Fixed buffer sqes are not vectored, so this only works for
+ * single element vectors.
+ */
+static int luring_fixed_buf_index(QEMUIOVector *qiov)
+{
+    if (qiov->niov != 1) {
+        return -1;
+    }
+    return aio_get_fixed_buf_index(qiov->iov[0].iov_base,
+                                   qiov->iov[0].iov_len);
+}
+
 static void luring_prep_sqe(struct io_uring_sqe *sqe, void *opaque)
 {
     LuringRequest *req = opaque;
     QEMUIOVector *qiov = req->qiov;
     uint64_t offset = req->offset;
-    int fd = req->fd;
+    int fixed_file = aio_get_fixed_file_index(req->fd);
+    int fd = fixed_file >= 0 ? fixed_file : req->fd;
     BdrvRequestFlags flags = req->flags;
+    int buf_index;
 
     switch (req->type) {
     case QEMU_AIO_WRITE:
     {
         int luring_flags = (flags & BDRV_REQ_FUA) ? RWF_DSYNC : 0;
-        if (luring_flags != 0 || qiov->niov > 1) {
+
+        buf_index = luring_fixed_buf_index(qiov);
+        if (buf_index >= 0) {
+            struct iovec *iov = qiov->iov;
+            io_uring_prep_write_fixed(sqe, fd, iov->iov_base, iov->iov_len,
+                                      offset, buf_index);
+            sqe->rw_flags = luring_flags;
+        } else if (luring_flags != 0 || qiov->niov > 1) {
 #ifdef HAVE_IO_URING_PREP_WRITEV2
             io_uring_prep_writev2(sqe, fd, qiov->iov,
                                   qiov->niov, offset, luring_flags);
@@ -76,7 +99,12 @@ static void luring_prep_sqe(struct io_uring_sqe *sqe, void *opaque)
         if (req->resubmit_qiov.iov != NULL) {
             qiov = &req->resubmit_qiov;
         }
-        if (qiov->niov > 1) {
+        buf_index = luring_fixed_buf_index(qiov);
+        if (buf_index >= 0) {
+            struct iovec *iov = qiov->iov;
+            io_uring_prep_read_fixed(sqe, fd, iov->iov_base, iov->iov_len,
+                                     offset + req->total_read, buf_index);
+        } else if (qiov->niov > 1) {
             io_uring_prep_readv(sqe, fd, qiov->iov, qiov->niov,
                                 offset + req->total_read);
         } else {
@@ -95,6 +123,10 @@ static void luring_prep_sqe(struct io_uring_sqe *sqe, void *opaque)
                         __func__, req->type);
         abort();
     }
+
+    if (fixed_file >= 0) {
+        sqe->flags |= IOSQE_FIXED_FILE;
+    }
 }
 
 /**
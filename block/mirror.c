@@ -87,6 +87,8 @@ typedef struct MirrorBlockJob {
     QTAILQ_HEAD(, MirrorOp) ops_in_flight;
     int ret;
     bool unmap;
+    /* Whether to look for zeroes in the data read from the source */
+    bool detect_zeroes;
     int target_cluster_size;
     int max_iov;
     bool initial_zeroing_ongoing;
@@ -252,6 +254,69 @@ static void coroutine_fn mirror_write_complete(MirrorOp *op, int ret)
     mirror_iteration_done(op, ret);
 }
 
+/*
+ * Write the part of @op that starts at @pos and is @bytes long to the
+ * target, either as data or as zeroes.
+ */
+static int coroutine_fn mirror_write_run(MirrorOp *op, size_t pos,
+                                         size_t bytes, bool zero)
+{
+    MirrorBlockJob *s = op->s;
+    QEMUIOVector qiov;
+    int ret;
+
+    if (zero) {
+        trace_mirror_write_zero_run(s, op->offset + pos, bytes);
+        ret = blk_co_pwrite_zeroes(s->target, op->offset + pos, bytes,
+                                   s->unmap ? BDRV_REQ_MAY_UNMAP : 0);
+        if (ret >= 0 && s->zero_bitmap) {
+            bitmap_set(s->zero_bitmap, (op->offset + pos) / s->granularity,
+                       DIV_ROUND_UP(bytes, s->granularity));
+        }
+        return ret;
+    }
+
+    if (pos == 0 && bytes == op->qiov.size) {
+        return blk_co_pwritev(s->target, op->offset, bytes, &op->qiov, 0);
+    }
+
+    qemu_iovec_init_slice(&qiov, &op->qiov, pos, bytes);
+    ret = blk_co_pwritev(s->target, op->offset + pos, bytes, &qiov, 0);
+    qemu_iovec_destroy(&qiov);
+    return ret;
+}
+
+/*
+ * Write the data read for @op to the target, but turn each run of
+ * granularity-sized chunks that contain only zeroes into a single
+ * write-zeroes request, so that freshly wiped areas that are still
+ * allocated in the source do not have to be transferred.
+ */
+static int coroutine_fn mirror_write_detect_zeroes(MirrorOp *op)
+{
+    struct iovec *iov = op->qiov.iov;
+    size_t run_start = 0, pos = 0;
+    bool run_zero = false;
+    int i, ret;
+
+    /* Every iovec element is one chunk from s->buf_free */
+    for (i = 0; i < op->qiov.niov; i++) {
+        bool zero = buffer_is_zero(iov[i].iov_base, iov[i].iov_len);
+
+        if (i > 0 && zero != run_zero) {
+            ret = mirror_write_run(op, run_start, pos - run_start, run_zero);
+            if (ret < 0) {
+                return ret;
+            }
+            run_start = pos;
+        }
+        run_zero = zero;
+        pos += iov[i].iov_len;
+    }
+
+    return mirror_write_run(op, run_start, pos - run_start, run_zero);
+}
+
 static void coroutine_fn mirror_read_complete(MirrorOp *op, int ret)
 {
     MirrorBlockJob *s = op->s;
@@ -269,7 +334,12 @@ static void coroutine_fn mirror_read_complete(MirrorOp *op, int ret)
         return;
     }
 
-    ret = blk_co_pwritev(s->target, op->offset, op->qiov.size, &op->qiov, 0);
+    if (s->detect_zeroes) {
+        ret = mirror_write_detect_zeroes(op);
+    } else {
+        ret = blk_co_pwritev(s->target, op->offset, op->qiov.size, &op->qiov,
+                             0);
+    }
     mirror_write_complete(op, ret);
 }
 
@@ -1706,7 +1776,7 @@ bdrv_mirror_top_pwritev(BlockDriverState *bs, int64_t offset, int64_t bytes,
          * the data on source and destination must match, so we have
          * to use a bounce buffer if we are going to write to the
          * target now. */
-        bounce_buf = qemu_blockalign(bs, bytes);
+        bounce_buf = qemu_blockalign_pooled(bs, bytes);
         iov_to_buf_full(qiov->iov, qiov->niov, 0, bounce_buf, bytes);
 
         qemu_iovec_init(&bounce_qiov, 1);
@@ -1721,7 +1791,7 @@ bdrv_mirror_top_pwritev(BlockDriverState *bs, int64_t offset, int64_t bytes,
 
     if (copy_to_target) {
         qemu_iovec_destroy(&bounce_qiov);
-        qemu_vfree(bounce_buf);
+        qemu_blockfree_pooled(bounce_buf, bytes);
     }
 
     return ret;
@@ -1831,7 +1901,7 @@ static BlockJob *mirror_start_job(
                              bool target_is_zero,
                              BlockdevOnError on_source_error,
                              BlockdevOnError on_target_error,
-                             bool unmap,
+                             bool unmap, bool detect_zeroes,
                              BlockCompletionFunc *cb,
                              void *opaque,
                              const BlockJobDriver *driver,
@@ -2003,6 +2073,7 @@ static BlockJob *mirror_start_job(
     s->granularity = granularity;
     s->buf_size = ROUND_UP(buf_size, granularity);
     s->unmap = unmap;
+    s->detect_zeroes = detect_zeroes;
     if (auto_complete) {
         s->should_complete = true;
     }
@@ -2128,7 +2199,8 @@ void mirror_start(const char *job_id, BlockDriverState *bs,
                   bool target_is_zero,
                   BlockdevOnError on_source_error,
                   BlockdevOnError on_target_error,
-                  bool unmap, const char *filter_node_name,
+                  bool unmap, bool detect_zeroes,
+                  const char *filter_node_name,
                   MirrorCopyMode copy_mode, Error **errp)
 {
     BlockDriverState *base;
@@ -2149,7 +2221,7 @@ void mirror_start(const char *job_id, BlockDriverState *bs,
     mirror_start_job(job_id, bs, creation_flags, target, replaces,
                      speed, granularity, buf_size, mode, backing_mode,
                      target_is_zero, on_source_error, on_target_error, unmap,
-                     NULL, NULL, &mirror_job_driver, base, false,
+                     detect_zeroes, NULL, NULL, &mirror_job_driver, base, false,
                      filter_node_name, true, copy_mode, false, errp);
 }
 
@@ -2176,7 +2248,7 @@ BlockJob *commit_active_start(const char *job_id, BlockDriverState *bs,
     job = mirror_start_job(
                      job_id, bs, creation_flags, base, NULL, speed, 0, 0,
                      MIRROR_SYNC_MODE_TOP, MIRROR_LEAVE_BACKING_CHAIN, false,
-                     on_error, on_error, true, cb, opaque,
+                     on_error, on_error, true, false, cb, opaque,
                      &commit_active_job_driver, base, auto_complete,
                      filter_node_name, false, MIRROR_COPY_MODE_BACKGROUND,
                      base_read_only, errp);
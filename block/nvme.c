@@ -46,16 +46,26 @@
 
 typedef struct BDRVNVMeState BDRVNVMeState;
 
-/* Same index is used for queues and IRQs */
 #define INDEX_ADMIN     0
 #define INDEX_IO(n)     (1 + n)
 
-/* This driver shares a single MSIX IRQ for the admin and I/O queues */
+/*
+ * The admin queue and the first I/O queue live in the BDS's AioContext and
+ * share a single MSIX IRQ.  Any further I/O queue is bound to one IOThread
+ * that submits requests to it and has an IRQ vector of its own, see
+ * nvme_get_io_queue().
+ */
 enum {
     MSIX_SHARED_IRQ_IDX = 0,
     MSIX_IRQ_COUNT = 1
 };
 
+/* Number of queues that are polled from the BDS's AioContext */
+#define NVME_SHARED_QUEUE_COUNT INDEX_IO(1)
+
+/* Upper bound for the number of I/O queues created on the controller */
+#define NVME_MAX_IO_QUEUES 64
+
 typedef struct {
     int32_t  head, tail;
     uint8_t  *queue;
@@ -65,9 +75,11 @@ typedef struct {
 } NVMeQueue;
 
 typedef struct {
-    /* Called from nvme_process_completion() in the BDS's main AioContext */
+    /* Called from nvme_process_completion() in the queue's AioContext */
     BlockCompletionFunc *cb;
     void *opaque;
+    /* If set, receives the command specific result of the completion */
+    uint32_t *result;
     int cid;
     void *prp_list_page;
     uint64_t prp_list_iova;
@@ -84,6 +96,16 @@ typedef struct {
     /* Fields protected by BQL */
     uint8_t     *prp_list_pages;
 
+    /*
+     * The AioContext that processes completions.  For shared queues this is
+     * the BDS's AioContext, IOThread queues are bound and unbound under
+     * s->queues_lock and are NULL while unused.
+     */
+    AioContext  *aio_context;
+
+    /* Interrupt of IOThread queues, unused for shared queues */
+    EventNotifier irq_notifier;
+
     /* Fields protected by @lock */
     /* Coroutines in this queue are woken in their own context */
     CoQueue     free_req_queue;
@@ -94,8 +116,10 @@ typedef struct {
     int         need_kick;
     int         inflight;
 
-    /* Thread-safe, no lock necessary; runs in the BDS's main context */
+    /* Thread-safe, no lock necessary; runs in the queue's AioContext */
     QEMUBH      *completion_bh;
+    /* Polls the completion queue in poll-completions mode, same context */
+    QEMUBH      *poll_bh;
 } NVMeQueuePair;
 
 struct BDRVNVMeState {
@@ -109,14 +133,24 @@ struct BDRVNVMeState {
     } *doorbells;
     /* The submission/completion queue pairs.
      * [0]: admin queue.
-     * [1..]: io queues.
+     * [1]: io queue shared by all submitters.
+     * [2..]: io queues bound to IOThreads.
+     * Entries are never removed until nvme_close(), @queue_count is updated
+     * with release semantics after a new entry was published.
      */
     NVMeQueuePair **queues;
     unsigned queue_count;
+    /* Number of queues the controller and the IRQ vectors allow for */
+    unsigned max_queue_count;
+    /* Protects binding of IOThread queues and @adding_io_queue */
+    QemuMutex queues_lock;
+    bool adding_io_queue;
     size_t page_size;
     /* How many uint32_t elements does each doorbell entry take. */
     size_t doorbell_scale;
     bool write_cache_supported;
+    /* Completion queues are polled and MSIX interrupts are never enabled */
+    bool poll_completions;
     EventNotifier irq_notifier[MSIX_IRQ_COUNT];
 
     uint64_t nsze; /* Namespace size reported by identify command */
@@ -146,8 +180,10 @@ struct BDRVNVMeState {
 
 #define NVME_BLOCK_OPT_DEVICE "device"
 #define NVME_BLOCK_OPT_NAMESPACE "namespace"
+#define NVME_BLOCK_OPT_POLL_COMPLETIONS "poll-completions"
 
 static void nvme_process_completion_bh(void *opaque);
+static void nvme_poll_bh(void *opaque);
 
 static QemuOptsList runtime_opts = {
     .name = "nvme",
@@ -163,6 +199,11 @@ static QemuOptsList runtime_opts = {
             .type = QEMU_OPT_NUMBER,
             .help = "NVMe namespace",
         },
+        {
+            .name = NVME_BLOCK_OPT_POLL_COMPLETIONS,
+            .type = QEMU_OPT_BOOL,
+            .help = "Poll completion queues instead of using interrupts",
+        },
         { /* end of list */ }
     },
 };
@@ -195,20 +236,40 @@ static void nvme_free_queue(NVMeQueue *q)
     qemu_vfree(q->queue);
 }
 
-static void nvme_free_queue_pair(NVMeQueuePair *q)
+/* Create the BHs of @q in the AioContext that processes its completions */
+static void nvme_queue_attach_bhs(NVMeQueuePair *q, AioContext *aio_context)
+{
+    q->completion_bh = aio_bh_new(aio_context, nvme_process_completion_bh, q);
+    if (q->s->poll_completions) {
+        q->poll_bh = aio_bh_new(aio_context, nvme_poll_bh, q);
+    }
+}
+
+static void nvme_queue_detach_bhs(NVMeQueuePair *q)
 {
-    trace_nvme_free_queue_pair(q->index, q, &q->cq, &q->sq);
     if (q->completion_bh) {
         qemu_bh_delete(q->completion_bh);
+        q->completion_bh = NULL;
+    }
+    if (q->poll_bh) {
+        qemu_bh_delete(q->poll_bh);
+        q->poll_bh = NULL;
     }
+}
+
+static void nvme_free_queue_pair(NVMeQueuePair *q)
+{
+    trace_nvme_free_queue_pair(q->index, q, &q->cq, &q->sq);
+    nvme_queue_detach_bhs(q);
     nvme_free_queue(&q->sq);
     nvme_free_queue(&q->cq);
     qemu_vfree(q->prp_list_pages);
+    event_notifier_cleanup(&q->irq_notifier);
     qemu_mutex_destroy(&q->lock);
     g_free(q);
 }
 
-/* Runs in the BDS's main AioContext */
+/* Runs in the queue's AioContext */
 static void nvme_free_req_queue_cb(void *opaque)
 {
     NVMeQueuePair *q = opaque;
@@ -251,8 +312,11 @@ static NVMeQueuePair *nvme_create_queue_pair(BDRVNVMeState *s,
     qemu_mutex_init(&q->lock);
     q->s = s;
     q->index = idx;
+    q->aio_context = aio_context;
     qemu_co_queue_init(&q->free_req_queue);
-    q->completion_bh = aio_bh_new(aio_context, nvme_process_completion_bh, q);
+    if (aio_context) {
+        nvme_queue_attach_bhs(q, aio_context);
+    }
     r = qemu_vfio_dma_map(s->vfio, q->prp_list_pages, bytes,
                           false, &prp_list_iova, errp);
     if (r) {
@@ -285,7 +349,7 @@ fail:
     return NULL;
 }
 
-/* With q->lock, must be run in the BDS's main AioContext */
+/* With q->lock, must be run in the queue's AioContext */
 static void nvme_kick(NVMeQueuePair *q)
 {
     BDRVNVMeState *s = q->s;
@@ -300,6 +364,11 @@ static void nvme_kick(NVMeQueuePair *q)
     host_pci_stl_le_p(q->sq.doorbell, q->sq.tail);
     q->inflight += q->need_kick;
     q->need_kick = 0;
+
+    if (q->poll_bh) {
+        /* No interrupt will tell us about the completion, go look for it */
+        qemu_bh_schedule(q->poll_bh);
+    }
 }
 
 static NVMeRequest *nvme_get_free_req_nofail_locked(NVMeQueuePair *q)
@@ -354,7 +423,7 @@ static void nvme_put_free_req_locked(NVMeQueuePair *q, NVMeRequest *req)
 static void nvme_wake_free_req_locked(NVMeQueuePair *q)
 {
     if (!qemu_co_queue_empty(&q->free_req_queue)) {
-        replay_bh_schedule_oneshot_event(q->s->aio_context,
+        replay_bh_schedule_oneshot_event(q->aio_context,
                 nvme_free_req_queue_cb, q);
     }
 }
@@ -390,7 +459,7 @@ static inline int nvme_translate_error(const NvmeCqe *c)
     }
 }
 
-/* With q->lock, must be run in the BDS's main AioContext */
+/* With q->lock, must be run in the queue's AioContext */
 static bool nvme_process_completion(NVMeQueuePair *q)
 {
     BDRVNVMeState *s = q->s;
@@ -440,8 +509,12 @@ static bool nvme_process_completion(NVMeQueuePair *q)
         req = *preq;
         assert(req.cid == cid);
         assert(req.cb);
+        if (req.result) {
+            *req.result = le32_to_cpu(c->result);
+        }
         nvme_put_free_req_locked(q, preq);
         preq->cb = preq->opaque = NULL;
+        preq->result = NULL;
         q->inflight--;
         qemu_mutex_unlock(&q->lock);
         req.cb(req.opaque, ret);
@@ -460,7 +533,7 @@ static bool nvme_process_completion(NVMeQueuePair *q)
     return progress;
 }
 
-/* As q->completion_bh, runs in the BDS's main AioContext */
+/* As q->completion_bh, runs in the queue's AioContext */
 static void nvme_process_completion_bh(void *opaque)
 {
     NVMeQueuePair *q = opaque;
@@ -491,7 +564,7 @@ static void nvme_trace_command(const NvmeCmd *cmd)
     }
 }
 
-/* Must be run in the BDS's main AioContext */
+/* Must be run in the queue's AioContext */
 static void nvme_kick_and_check_completions(void *opaque)
 {
     NVMeQueuePair *q = opaque;
@@ -506,10 +579,10 @@ static void nvme_deferred_fn(void *opaque)
 {
     NVMeQueuePair *q = opaque;
 
-    if (qemu_get_current_aio_context() == q->s->aio_context) {
+    if (qemu_get_current_aio_context() == q->aio_context) {
         nvme_kick_and_check_completions(q);
     } else {
-        aio_bh_schedule_oneshot(q->s->aio_context,
+        aio_bh_schedule_oneshot(q->aio_context,
                                 nvme_kick_and_check_completions, q);
     }
 }
@@ -544,8 +617,12 @@ static void nvme_admin_cmd_sync_cb(void *opaque, int ret)
     aio_wait_kick();
 }
 
-/* Must be run in the BDS's or qemu's main AioContext */
-static int nvme_admin_cmd_sync(BlockDriverState *bs, NvmeCmd *cmd)
+/*
+ * Must be run in the BDS's or qemu's main AioContext.  If @result is not
+ * NULL, it receives the command specific result of the completion.
+ */
+static int nvme_admin_cmd_sync_result(BlockDriverState *bs, NvmeCmd *cmd,
+                                      uint32_t *result)
 {
     BDRVNVMeState *s = bs->opaque;
     NVMeQueuePair *q = s->queues[INDEX_ADMIN];
@@ -556,12 +633,19 @@ static int nvme_admin_cmd_sync(BlockDriverState *bs, NvmeCmd *cmd)
     if (!req) {
         return -EBUSY;
     }
+    req->result = result;
     nvme_submit_command(q, req, cmd, nvme_admin_cmd_sync_cb, &ret);
 
     AIO_WAIT_WHILE(aio_context, ret == -EINPROGRESS);
     return ret;
 }
 
+/* Must be run in the BDS's or qemu's main AioContext */
+static int nvme_admin_cmd_sync(BlockDriverState *bs, NvmeCmd *cmd)
+{
+    return nvme_admin_cmd_sync_result(bs, cmd, NULL);
+}
+
 /* Returns true on success, false on failure. */
 static bool nvme_identify(BlockDriverState *bs, int namespace, Error **errp)
 {
@@ -653,19 +737,25 @@ out:
     return ret;
 }
 
-/* Must be run in the BDS's main AioContext */
-static void nvme_poll_queue(NVMeQueuePair *q)
+/* Must be run in the queue's AioContext */
+static bool nvme_queue_has_completions(NVMeQueuePair *q)
 {
     const size_t cqe_offset = q->cq.head * NVME_CQ_ENTRY_BYTES;
     NvmeCqe *cqe = (NvmeCqe *)&q->cq.queue[cqe_offset];
 
+    return (le16_to_cpu(cqe->status) & 0x1) != q->cq_phase;
+}
+
+/* Must be run in the queue's AioContext */
+static void nvme_poll_queue(NVMeQueuePair *q)
+{
     trace_nvme_poll_queue(q->s, q->index);
     /*
      * Do an early check for completions. q->lock isn't needed because
      * nvme_process_completion() only runs in the event loop thread and
      * cannot race with itself.
      */
-    if ((le16_to_cpu(cqe->status) & 0x1) == q->cq_phase) {
+    if (!nvme_queue_has_completions(q)) {
         return;
     }
 
@@ -676,12 +766,39 @@ static void nvme_poll_queue(NVMeQueuePair *q)
     qemu_mutex_unlock(&q->lock);
 }
 
+/*
+ * As q->poll_bh, runs in the queue's AioContext.
+ *
+ * Without interrupts, the event loop must not block while the device still
+ * owes us completions, so keep rescheduling until nothing is in flight.  The
+ * queue's poll handler takes care of completions whenever aio_poll() is in
+ * its polling phase anyway.
+ */
+static void nvme_poll_bh(void *opaque)
+{
+    NVMeQueuePair *q = opaque;
+
+    nvme_poll_queue(q);
+
+    QEMU_LOCK_GUARD(&q->lock);
+    if (q->inflight && q->poll_bh) {
+        qemu_bh_schedule(q->poll_bh);
+    }
+}
+
+/* Number of shared queues that have been created so far */
+static unsigned nvme_shared_queue_count(BDRVNVMeState *s)
+{
+    return MIN(qatomic_load_acquire(&s->queue_count), NVME_SHARED_QUEUE_COUNT);
+}
+
 /* Must be run in the BDS's main AioContext */
 static void nvme_poll_queues(BDRVNVMeState *s)
 {
-    int i;
+    unsigned count = nvme_shared_queue_count(s);
+    unsigned i;
 
-    for (i = 0; i < s->queue_count; i++) {
+    for (i = 0; i < count; i++) {
         nvme_poll_queue(s->queues[i]);
     }
 }
@@ -697,25 +814,106 @@ static void nvme_handle_event(EventNotifier *n)
     nvme_poll_queues(s);
 }
 
+/* Run as an event notifier in the BDS's main AioContext */
+static bool nvme_poll_cb(void *opaque)
+{
+    EventNotifier *e = opaque;
+    BDRVNVMeState *s = container_of(e, BDRVNVMeState,
+                                    irq_notifier[MSIX_SHARED_IRQ_IDX]);
+    unsigned count = nvme_shared_queue_count(s);
+    unsigned i;
+
+    for (i = 0; i < count; i++) {
+        /*
+         * q->lock isn't needed because nvme_process_completion() only runs in
+         * the event loop thread and cannot race with itself.
+         */
+        if (nvme_queue_has_completions(s->queues[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Run as an event notifier in the BDS's main AioContext */
+static void nvme_poll_ready(EventNotifier *e)
+{
+    BDRVNVMeState *s = container_of(e, BDRVNVMeState,
+                                    irq_notifier[MSIX_SHARED_IRQ_IDX]);
+
+    nvme_poll_queues(s);
+}
+
+/* Run as an event notifier in the IOThread queue's AioContext */
+static void nvme_handle_queue_event(EventNotifier *n)
+{
+    NVMeQueuePair *q = container_of(n, NVMeQueuePair, irq_notifier);
+
+    trace_nvme_handle_queue_event(q->s, q->index);
+    event_notifier_test_and_clear(n);
+    nvme_poll_queue(q);
+}
+
+/* Run as an event notifier in the IOThread queue's AioContext */
+static bool nvme_queue_poll_cb(void *opaque)
+{
+    EventNotifier *e = opaque;
+    NVMeQueuePair *q = container_of(e, NVMeQueuePair, irq_notifier);
+
+    return nvme_queue_has_completions(q);
+}
+
+/* Run as an event notifier in the IOThread queue's AioContext */
+static void nvme_queue_poll_ready(EventNotifier *e)
+{
+    NVMeQueuePair *q = container_of(e, NVMeQueuePair, irq_notifier);
+
+    nvme_poll_queue(q);
+}
+
+/* The shared queues use vector 0, every IOThread queue has its own vector */
+static unsigned nvme_queue_irq_vector(unsigned idx)
+{
+    return idx < NVME_SHARED_QUEUE_COUNT ? MSIX_SHARED_IRQ_IDX :
+                                           idx - INDEX_IO(0);
+}
+
+/* Must be run in qemu's main AioContext, or in the BDS's one during open */
 static bool nvme_add_io_queue(BlockDriverState *bs, Error **errp)
 {
     BDRVNVMeState *s = bs->opaque;
     unsigned n = s->queue_count;
+    bool shared = n < NVME_SHARED_QUEUE_COUNT;
+    unsigned vector = nvme_queue_irq_vector(n);
     NVMeQueuePair *q;
     NvmeCmd cmd;
     unsigned queue_size = NVME_QUEUE_SIZE;
 
+    assert(n < s->max_queue_count);
     assert(n <= UINT16_MAX);
-    q = nvme_create_queue_pair(s, bdrv_get_aio_context(bs),
+    q = nvme_create_queue_pair(s, shared ? bdrv_get_aio_context(bs) : NULL,
                                n, queue_size, errp);
     if (!q) {
         return false;
     }
+    if (!shared) {
+        if (event_notifier_init(&q->irq_notifier, 0)) {
+            error_setg(errp, "Failed to init event notifier");
+            goto out_error;
+        }
+        if (!s->poll_completions &&
+            qemu_vfio_pci_set_irq_vector(s->vfio, &q->irq_notifier,
+                                         VFIO_PCI_MSIX_IRQ_INDEX, vector,
+                                         errp)) {
+            goto out_error;
+        }
+    }
     cmd = (NvmeCmd) {
         .opcode = NVME_ADM_CMD_CREATE_CQ,
         .dptr.prp1 = cpu_to_le64(q->cq.iova),
         .cdw10 = cpu_to_le32(((queue_size - 1) << 16) | n),
-        .cdw11 = cpu_to_le32(NVME_CQ_IEN | NVME_CQ_PC),
+        .cdw11 = cpu_to_le32(s->poll_completions ? NVME_CQ_PC :
+                             NVME_CQ_IEN | NVME_CQ_PC | (vector << 16)),
     };
     if (nvme_admin_cmd_sync(bs, &cmd)) {
         error_setg(errp, "Failed to create CQ io queue [%u]", n);
@@ -729,48 +927,179 @@ static bool nvme_add_io_queue(BlockDriverState *bs, Error **errp)
     };
     if (nvme_admin_cmd_sync(bs, &cmd)) {
         error_setg(errp, "Failed to create SQ io queue [%u]", n);
-        goto out_error;
+        goto out_delete_cq;
     }
-    s->queues = g_renew(NVMeQueuePair *, s->queues, n + 1);
     s->queues[n] = q;
-    s->queue_count++;
+    qatomic_store_release(&s->queue_count, n + 1);
     return true;
+out_delete_cq:
+    cmd = (NvmeCmd) {
+        .opcode = NVME_ADM_CMD_DELETE_CQ,
+        .cdw10 = cpu_to_le32(n),
+    };
+    nvme_admin_cmd_sync(bs, &cmd);
 out_error:
+    if (!shared && !s->poll_completions && q->irq_notifier.initialized) {
+        qemu_vfio_pci_set_irq_vector(s->vfio, NULL, VFIO_PCI_MSIX_IRQ_INDEX,
+                                     vector, NULL);
+    }
     nvme_free_queue_pair(q);
     return false;
 }
 
-/* Run as an event notifier in the BDS's main AioContext */
-static bool nvme_poll_cb(void *opaque)
+/* Runs in qemu's main AioContext, scheduled by nvme_get_io_queue() */
+static void nvme_add_io_queue_bh(void *opaque)
 {
-    EventNotifier *e = opaque;
-    BDRVNVMeState *s = container_of(e, BDRVNVMeState,
-                                    irq_notifier[MSIX_SHARED_IRQ_IDX]);
-    int i;
+    BlockDriverState *bs = opaque;
+    BDRVNVMeState *s = bs->opaque;
+    Error *local_err = NULL;
+    bool ok;
+
+    ok = nvme_add_io_queue(bs, &local_err);
+
+    WITH_QEMU_LOCK_GUARD(&s->queues_lock) {
+        if (!ok) {
+            /* Don't retry, the shared queue keeps serving new submitters */
+            s->max_queue_count = s->queue_count;
+        }
+        s->adding_io_queue = false;
+    }
+    if (!ok) {
+        warn_reportf_err(local_err, "NVMe: Cannot create IOThread queue: ");
+    }
+    bdrv_dec_in_flight(bs);
+}
 
-    for (i = 0; i < s->queue_count; i++) {
+/* Called with s->queues_lock, runs in @ctx */
+static void nvme_bind_io_queue_locked(NVMeQueuePair *q, AioContext *ctx)
+{
+    assert(!q->aio_context);
+    trace_nvme_bind_io_queue(q->s, q->index, ctx);
+    nvme_queue_attach_bhs(q, ctx);
+    aio_set_event_notifier(ctx, &q->irq_notifier, nvme_handle_queue_event,
+                           nvme_queue_poll_cb, nvme_queue_poll_ready);
+    qatomic_set(&q->aio_context, ctx);
+}
+
+/*
+ * Release the IOThread queues that have no requests in flight, so that they
+ * can be picked up by other AioContexts and do not refer to IOThreads that
+ * are going away.  May be run in any AioContext.
+ */
+static void nvme_unbind_io_queues(BDRVNVMeState *s)
+{
+    unsigned i;
+
+    QEMU_LOCK_GUARD(&s->queues_lock);
+    for (i = NVME_SHARED_QUEUE_COUNT; i < s->queue_count; i++) {
         NVMeQueuePair *q = s->queues[i];
-        const size_t cqe_offset = q->cq.head * NVME_CQ_ENTRY_BYTES;
-        NvmeCqe *cqe = (NvmeCqe *)&q->cq.queue[cqe_offset];
+        bool idle;
 
-        /*
-         * q->lock isn't needed because nvme_process_completion() only runs in
-         * the event loop thread and cannot race with itself.
-         */
-        if ((le16_to_cpu(cqe->status) & 0x1) != q->cq_phase) {
-            return true;
+        if (!q->aio_context) {
+            continue;
+        }
+        WITH_QEMU_LOCK_GUARD(&q->lock) {
+            idle = !q->inflight && !q->need_kick &&
+                   qemu_co_queue_empty(&q->free_req_queue);
+        }
+        if (!idle) {
+            continue;
         }
+
+        trace_nvme_unbind_io_queue(s, q->index, q->aio_context);
+        aio_set_event_notifier(q->aio_context, &q->irq_notifier,
+                               NULL, NULL, NULL);
+        nvme_queue_detach_bhs(q);
+        qatomic_set(&q->aio_context, NULL);
     }
-    return false;
 }
 
-/* Run as an event notifier in the BDS's main AioContext */
-static void nvme_poll_ready(EventNotifier *e)
+/*
+ * Return the I/O queue for a request submitted from the current AioContext.
+ *
+ * Requests from the BDS's AioContext use the shared I/O queue.  Any other
+ * AioContext, typically an IOThread of a multiqueue device, gets a queue of
+ * its own so that submission and completion stay in the same thread.  These
+ * queues are created in the background on first use, and until one is
+ * available, or if the controller runs out of queues or IRQ vectors, the
+ * shared queue is used instead.
+ *
+ * May be run in any AioContext.
+ */
+static NVMeQueuePair *nvme_get_io_queue(BlockDriverState *bs)
 {
-    BDRVNVMeState *s = container_of(e, BDRVNVMeState,
-                                    irq_notifier[MSIX_SHARED_IRQ_IDX]);
+    BDRVNVMeState *s = bs->opaque;
+    AioContext *ctx = qemu_get_current_aio_context();
+    unsigned count, i;
 
-    nvme_poll_queues(s);
+    if (ctx == bdrv_get_aio_context(bs)) {
+        return s->queues[INDEX_IO(0)];
+    }
+
+    /* Fast path, only this thread can bind a queue to @ctx */
+    count = qatomic_load_acquire(&s->queue_count);
+    for (i = NVME_SHARED_QUEUE_COUNT; i < count; i++) {
+        if (qatomic_read(&s->queues[i]->aio_context) == ctx) {
+            return s->queues[i];
+        }
+    }
+
+    WITH_QEMU_LOCK_GUARD(&s->queues_lock) {
+        count = qatomic_load_acquire(&s->queue_count);
+        for (i = NVME_SHARED_QUEUE_COUNT; i < count; i++) {
+            NVMeQueuePair *q = s->queues[i];
+
+            if (!q->aio_context) {
+                nvme_bind_io_queue_locked(q, ctx);
+                return q;
+            }
+        }
+        if (count < s->max_queue_count && !s->adding_io_queue) {
+            s->adding_io_queue = true;
+            bdrv_inc_in_flight(bs);
+            aio_bh_schedule_oneshot(qemu_get_aio_context(),
+                                    nvme_add_io_queue_bh, bs);
+        }
+    }
+    return s->queues[INDEX_IO(0)];
+}
+
+/*
+ * Negotiate the number of I/O queues with the controller.  Must be called
+ * before the first I/O queue is created.
+ */
+static void nvme_init_queue_count(BlockDriverState *bs, unsigned nvectors)
+{
+    BDRVNVMeState *s = bs->opaque;
+    unsigned max_io_queues, doorbell_queues;
+    uint32_t result = 0;
+    NvmeCmd cmd = {
+        .opcode = NVME_ADM_CMD_SET_FEATURES,
+        .cdw10 = cpu_to_le32(NVME_NUMBER_OF_QUEUES),
+    };
+
+    /* Every I/O queue but the shared one needs an IRQ vector of its own */
+    max_io_queues = MIN(nvectors, NVME_MAX_IO_QUEUES);
+    /* ... and its doorbells must be within the mapped doorbell area */
+    doorbell_queues = NVME_DOORBELL_SIZE /
+                      (sizeof(*s->doorbells) * s->doorbell_scale);
+    max_io_queues = MIN(max_io_queues,
+                        MAX(doorbell_queues, NVME_SHARED_QUEUE_COUNT) -
+                        INDEX_IO(0));
+
+    /* The queue counts are 0's based */
+    cmd.cdw11 = cpu_to_le32(((max_io_queues - 1) << 16) |
+                            (max_io_queues - 1));
+    if (nvme_admin_cmd_sync_result(bs, &cmd, &result)) {
+        /* Stick to the single I/O queue that every controller supports */
+        max_io_queues = 1;
+    } else {
+        max_io_queues = MIN(max_io_queues, extract32(result, 0, 16) + 1);
+        max_io_queues = MIN(max_io_queues, extract32(result, 16, 16) + 1);
+    }
+
+    s->max_queue_count = INDEX_IO(max_io_queues);
+    trace_nvme_init_queue_count(s, max_io_queues);
 }
 
 static int nvme_init(BlockDriverState *bs, const char *device, int namespace,
@@ -785,8 +1114,10 @@ static int nvme_init(BlockDriverState *bs, const char *device, int namespace,
     uint32_t cc;
     uint64_t timeout_ms;
     uint64_t deadline, now;
+    unsigned nvectors;
     NvmeBar *regs = NULL;
 
+    qemu_mutex_init(&s->queues_lock);
     qemu_co_mutex_init(&s->dma_map_lock);
     qemu_co_queue_init(&s->dma_flush_queue);
     s->device = g_strdup(device);
@@ -869,7 +1200,7 @@ static int nvme_init(BlockDriverState *bs, const char *device, int namespace,
     }
 
     /* Set up admin queue. */
-    s->queues = g_new(NVMeQueuePair *, 1);
+    s->queues = g_new0(NVMeQueuePair *, INDEX_IO(NVME_MAX_IO_QUEUES));
     q = nvme_create_queue_pair(s, aio_context, 0, NVME_QUEUE_SIZE, errp);
     if (!q) {
         ret = -EINVAL;
@@ -877,6 +1208,7 @@ static int nvme_init(BlockDriverState *bs, const char *device, int namespace,
     }
     s->queues[INDEX_ADMIN] = q;
     s->queue_count = 1;
+    s->max_queue_count = 1;
     QEMU_BUILD_BUG_ON((NVME_QUEUE_SIZE - 1) & 0xF000);
     host_pci_stl_le_p(&regs->aqa,
                         ((NVME_QUEUE_SIZE - 1) << AQA_ACQS_SHIFT) |
@@ -902,10 +1234,26 @@ static int nvme_init(BlockDriverState *bs, const char *device, int namespace,
         }
     }
 
-    ret = qemu_vfio_pci_init_irq(s->vfio, s->irq_notifier,
-                                 VFIO_PCI_MSIX_IRQ_INDEX, errp);
-    if (ret) {
-        goto out;
+    if (s->poll_completions) {
+        /*
+         * Completion queues are created without interrupts, so there is no
+         * vector limit.  The event notifiers are still registered below for
+         * their poll handlers, the device just never signals them.
+         */
+        nvectors = NVME_MAX_IO_QUEUES;
+    } else {
+        ret = qemu_vfio_pci_get_irq_count(s->vfio, VFIO_PCI_MSIX_IRQ_INDEX,
+                                          errp);
+        if (ret < 0) {
+            goto out;
+        }
+        nvectors = MIN(MAX(ret, 1), NVME_MAX_IO_QUEUES);
+        ret = qemu_vfio_pci_init_irq_vectors(s->vfio, s->irq_notifier,
+                                             VFIO_PCI_MSIX_IRQ_INDEX, nvectors,
+                                             errp);
+        if (ret) {
+            goto out;
+        }
     }
     aio_set_event_notifier(bdrv_get_aio_context(bs),
                            &s->irq_notifier[MSIX_SHARED_IRQ_IDX],
@@ -918,6 +1266,7 @@ static int nvme_init(BlockDriverState *bs, const char *device, int namespace,
     }
 
     /* Set up command queues. */
+    nvme_init_queue_count(bs, nvectors);
     if (!nvme_add_io_queue(bs, errp)) {
         ret = -EIO;
     }
@@ -989,10 +1338,12 @@ static void nvme_close(BlockDriverState *bs)
 {
     BDRVNVMeState *s = bs->opaque;
 
+    nvme_unbind_io_queues(s);
     for (unsigned i = 0; i < s->queue_count; ++i) {
         nvme_free_queue_pair(s->queues[i]);
     }
     g_free(s->queues);
+    qemu_mutex_destroy(&s->queues_lock);
     aio_set_event_notifier(bdrv_get_aio_context(bs),
                            &s->irq_notifier[MSIX_SHARED_IRQ_IDX],
                            NULL, NULL, NULL);
@@ -1025,6 +1376,9 @@ static int nvme_open(BlockDriverState *bs, QDict *options, int flags,
     }
 
     namespace = qemu_opt_get_number(opts, NVME_BLOCK_OPT_NAMESPACE, 1);
+    s->poll_completions = qemu_opt_get_bool(opts,
+                                            NVME_BLOCK_OPT_POLL_COMPLETIONS,
+                                            false);
     ret = nvme_init(bs, device, namespace, errp);
     qemu_opts_del(opts);
     if (ret) {
@@ -1210,7 +1564,7 @@ static void nvme_rw_cb_bh(void *opaque)
     qemu_coroutine_enter(data->co);
 }
 
-/* Put into NVMeRequest.cb, so runs in the BDS's main AioContext */
+/* Put into NVMeRequest.cb, so runs in the queue's AioContext */
 static void nvme_rw_cb(void *opaque, int ret)
 {
     NVMeCoData *data = opaque;
@@ -1230,7 +1584,7 @@ static coroutine_fn int nvme_co_prw_aligned(BlockDriverState *bs,
 {
     int r;
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[INDEX_IO(0)];
+    NVMeQueuePair *ioq = nvme_get_io_queue(bs);
     NVMeRequest *req;
 
     uint32_t cdw12 = (((bytes >> s->blkshift) - 1) & 0xFFFF) |
@@ -1243,7 +1597,7 @@ static coroutine_fn int nvme_co_prw_aligned(BlockDriverState *bs,
         .cdw12 = cpu_to_le32(cdw12),
     };
     NVMeCoData data = {
-        .ctx = bdrv_get_aio_context(bs),
+        .ctx = qemu_get_current_aio_context(),
         .ret = -EINPROGRESS,
     };
 
@@ -1351,14 +1705,14 @@ static coroutine_fn int nvme_co_pwritev(BlockDriverState *bs,
 static coroutine_fn int nvme_co_flush(BlockDriverState *bs)
 {
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[INDEX_IO(0)];
+    NVMeQueuePair *ioq = nvme_get_io_queue(bs);
     NVMeRequest *req;
     NvmeCmd cmd = {
         .opcode = NVME_CMD_FLUSH,
         .nsid = cpu_to_le32(s->nsid),
     };
     NVMeCoData data = {
-        .ctx = bdrv_get_aio_context(bs),
+        .ctx = qemu_get_current_aio_context(),
         .ret = -EINPROGRESS,
     };
 
@@ -1382,7 +1736,7 @@ static coroutine_fn int nvme_co_pwrite_zeroes(BlockDriverState *bs,
                                               BdrvRequestFlags flags)
 {
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[INDEX_IO(0)];
+    NVMeQueuePair *ioq = nvme_get_io_queue(bs);
     NVMeRequest *req;
     uint32_t cdw12;
 
@@ -1409,7 +1763,7 @@ static coroutine_fn int nvme_co_pwrite_zeroes(BlockDriverState *bs,
     };
 
     NVMeCoData data = {
-        .ctx = bdrv_get_aio_context(bs),
+        .ctx = qemu_get_current_aio_context(),
         .ret = -EINPROGRESS,
     };
 
@@ -1445,7 +1799,7 @@ static int coroutine_fn nvme_co_pdiscard(BlockDriverState *bs,
                                          int64_t bytes)
 {
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[INDEX_IO(0)];
+    NVMeQueuePair *ioq = nvme_get_io_queue(bs);
     NVMeRequest *req;
     QEMU_AUTO_VFREE NvmeDsmRange *buf = NULL;
     QEMUIOVector local_qiov;
@@ -1459,7 +1813,7 @@ static int coroutine_fn nvme_co_pdiscard(BlockDriverState *bs,
     };
 
     NVMeCoData data = {
-        .ctx = bdrv_get_aio_context(bs),
+        .ctx = qemu_get_current_aio_context(),
         .ret = -EINPROGRESS,
     };
 
@@ -1589,12 +1943,10 @@ static void nvme_detach_aio_context(BlockDriverState *bs)
 {
     BDRVNVMeState *s = bs->opaque;
 
-    for (unsigned i = 0; i < s->queue_count; i++) {
-        NVMeQueuePair *q = s->queues[i];
-
-        qemu_bh_delete(q->completion_bh);
-        q->completion_bh = NULL;
+    for (unsigned i = 0; i < nvme_shared_queue_count(s); i++) {
+        nvme_queue_detach_bhs(s->queues[i]);
     }
+    nvme_unbind_io_queues(s);
 
     aio_set_event_notifier(bdrv_get_aio_context(bs),
                            &s->irq_notifier[MSIX_SHARED_IRQ_IDX],
@@ -1611,14 +1963,26 @@ static void nvme_attach_aio_context(BlockDriverState *bs,
                            nvme_handle_event, nvme_poll_cb,
                            nvme_poll_ready);
 
-    for (unsigned i = 0; i < s->queue_count; i++) {
+    for (unsigned i = 0; i < nvme_shared_queue_count(s); i++) {
         NVMeQueuePair *q = s->queues[i];
 
-        q->completion_bh =
-            aio_bh_new(new_context, nvme_process_completion_bh, q);
+        q->aio_context = new_context;
+        nvme_queue_attach_bhs(q, new_context);
     }
 }
 
+static void nvme_drain_end(BlockDriverState *bs)
+{
+    BDRVNVMeState *s = bs->opaque;
+
+    /*
+     * Devices drain their block nodes before they are unplugged and their
+     * IOThreads can go away, so give back the queues of idle IOThreads.
+     * They are bound again on the next request.
+     */
+    nvme_unbind_io_queues(s);
+}
+
 static bool nvme_register_buf(BlockDriverState *bs, void *host, size_t size,
                               Error **errp)
 {
@@ -1694,6 +2058,7 @@ static BlockDriver bdrv_nvme = {
 
     .bdrv_detach_aio_context  = nvme_detach_aio_context,
     .bdrv_attach_aio_context  = nvme_attach_aio_context,
+    .bdrv_drain_end           = nvme_drain_end,
 
     .bdrv_register_buf        = nvme_register_buf,
     .bdrv_unregister_buf      = nvme_unregister_buf,
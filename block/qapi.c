@@ -612,6 +612,34 @@ static void bdrv_query_blk_stats(BlockDeviceStats *ds, BlockBackend *blk)
         dev_stats->avg_zone_append_queue_depth =
             block_acct_queue_depth(ts, BLOCK_ACCT_ZONE_APPEND);
 
+        dev_stats->p50_rd_latency_ns =
+            block_acct_latency_percentile(ts, BLOCK_ACCT_READ, 500);
+        dev_stats->p99_rd_latency_ns =
+            block_acct_latency_percentile(ts, BLOCK_ACCT_READ, 990);
+        dev_stats->p999_rd_latency_ns =
+            block_acct_latency_percentile(ts, BLOCK_ACCT_READ, 999);
+
+        dev_stats->p50_wr_latency_ns =
+            block_acct_latency_percentile(ts, BLOCK_ACCT_WRITE, 500);
+        dev_stats->p99_wr_latency_ns =
+            block_acct_latency_percentile(ts, BLOCK_ACCT_WRITE, 990);
+        dev_stats->p999_wr_latency_ns =
+            block_acct_latency_percentile(ts, BLOCK_ACCT_WRITE, 999);
+
+        dev_stats->p50_zone_append_latency_ns =
+            block_acct_latency_percentile(ts, BLOCK_ACCT_ZONE_APPEND, 500);
+        dev_stats->p99_zone_append_latency_ns =
+            block_acct_latency_percentile(ts, BLOCK_ACCT_ZONE_APPEND, 990);
+        dev_stats->p999_zone_append_latency_ns =
+            block_acct_latency_percentile(ts, BLOCK_ACCT_ZONE_APPEND, 999);
+
+        dev_stats->p50_flush_latency_ns =
+            block_acct_latency_percentile(ts, BLOCK_ACCT_FLUSH, 500);
+        dev_stats->p99_flush_latency_ns =
+            block_acct_latency_percentile(ts, BLOCK_ACCT_FLUSH, 990);
+        dev_stats->p999_flush_latency_ns =
+            block_acct_latency_percentile(ts, BLOCK_ACCT_FLUSH, 999);
+
         QAPI_LIST_PREPEND(ds->timed_stats, dev_stats);
     }
 
@@ -0,0 +1,247 @@
+/*
+ * Backing chain lookup cache for qcow2
+ *
+ * A read from an unallocated area of a qcow2 image is passed to the backing
+ * file, and each qcow2 layer of the chain looks the area up in its own L2
+ * tables before passing the read on.  On deep chains these lookups dominate
+ * the cost of reads from old data.  The cache remembers which layer holds
+ * the data of recently read guest ranges, so that the read can be sent to
+ * that layer directly.
+ *
+ * An entry stays valid as long as the layers above the one holding the data
+ * do not change.  The cache records the qcow2 layers below the image and
+ * their write generation; any write to them or any change of the chain
+ * drops all entries.  Graph changes happen in drained sections, so the
+ * cache is dropped on drain, too.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/lockable.h"
+#include "qcow2.h"
+
+/* Maximum number of guest ranges in the cache */
+#define QCOW2_BACKING_CACHE_SIZE 4096
+
+typedef struct Qcow2BackingCacheEntry {
+    IntervalTreeNode node;
+    /* Number of backing links from the image to the layer with the data */
+    int depth;
+} Qcow2BackingCacheEntry;
+
+typedef struct Qcow2BackingLayer {
+    BlockDriverState *bs;
+    unsigned int write_gen;
+} Qcow2BackingLayer;
+
+/* Can reads of @bs be passed directly to its backing file? */
+static bool GRAPH_RDLOCK qcow2_backing_layer_skippable(BlockDriverState *bs)
+{
+    return bs->drv == &bdrv_qcow2 && bs->backing;
+}
+
+/* Called with backing_cache_lock held */
+static void qcow2_backing_cache_clear(BDRVQcow2State *s)
+{
+    IntervalTreeNode *node;
+
+    while ((node = interval_tree_iter_first(&s->backing_cache, 0,
+                                            UINT64_MAX))) {
+        interval_tree_remove(node, &s->backing_cache);
+        g_free(container_of(node, Qcow2BackingCacheEntry, node));
+    }
+    s->nb_backing_cache_entries = 0;
+    g_array_set_size(s->backing_cache_chain, 0);
+    s->backing_cache_gen++;
+}
+
+/*
+ * Check that the layers below @bs are the ones the entries were added for,
+ * or start over with the current chain.  Called with backing_cache_lock
+ * held.
+ */
+static void GRAPH_RDLOCK qcow2_backing_cache_check(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+    GArray *chain = s->backing_cache_chain;
+    BdrvChild *child = bs->backing;
+    unsigned i;
+
+    for (i = 0; i < chain->len; i++) {
+        Qcow2BackingLayer *l = &g_array_index(chain, Qcow2BackingLayer, i);
+
+        if (!child || child->bs != l->bs ||
+            qatomic_read(&l->bs->write_gen) != l->write_gen) {
+            break;
+        }
+        child = child->bs->backing;
+    }
+    if (chain->len && i == chain->len) {
+        return;
+    }
+
+    qcow2_backing_cache_clear(s);
+    for (child = bs->backing;
+         child && qcow2_backing_layer_skippable(child->bs);
+         child = child->bs->backing) {
+        Qcow2BackingLayer l = {
+            .bs = child->bs,
+            .write_gen = qatomic_read(&child->bs->write_gen),
+        };
+
+        g_array_append_val(chain, l);
+    }
+}
+
+/*
+ * Find the layer below @bs that holds the data at @offset by asking each
+ * qcow2 layer in turn, and add it to the cache.  *@bytes is reduced to the
+ * length that is held by the same layer.
+ */
+static int coroutine_fn GRAPH_RDLOCK
+qcow2_backing_cache_resolve(BlockDriverState *bs, uint64_t offset,
+                            int64_t *bytes, int len, uint64_t gen)
+{
+    BDRVQcow2State *s = bs->opaque;
+    BdrvChild *child = bs->backing;
+    Qcow2BackingCacheEntry *e;
+    int64_t pnum;
+    int depth;
+    int ret;
+
+    for (depth = 1; depth <= len; depth++) {
+        ret = bdrv_co_is_allocated(child->bs, offset, *bytes, &pnum);
+        if (ret < 0) {
+            /* Let the layers report the error when reading */
+            return 1;
+        }
+        if (pnum == 0) {
+            /* End of this layer, it reads as zeroes */
+            break;
+        }
+        *bytes = pnum;
+        if (ret) {
+            break;
+        }
+        child = child->bs->backing;
+    }
+
+    if (depth == 1) {
+        return depth;
+    }
+
+    QEMU_LOCK_GUARD(&s->backing_cache_lock);
+    if (s->backing_cache_gen != gen) {
+        /* The chain changed while the layers were being asked */
+        return depth;
+    }
+    if (s->nb_backing_cache_entries >= QCOW2_BACKING_CACHE_SIZE) {
+        IntervalTreeNode *node = interval_tree_iter_first(&s->backing_cache,
+                                                          0, UINT64_MAX);
+
+        interval_tree_remove(node, &s->backing_cache);
+        g_free(container_of(node, Qcow2BackingCacheEntry, node));
+        s->nb_backing_cache_entries--;
+    }
+    e = g_new0(Qcow2BackingCacheEntry, 1);
+    e->node.start = offset;
+    e->node.last = offset + *bytes - 1;
+    e->depth = depth;
+    interval_tree_insert(&e->node, &s->backing_cache);
+    s->nb_backing_cache_entries++;
+    return depth;
+}
+
+/*
+ * Returns the number of backing links to follow from @bs to read the data
+ * at @offset, and reduces *@bytes to the length that can be read from the
+ * same layer.
+ */
+static int coroutine_fn GRAPH_RDLOCK
+qcow2_backing_cache_lookup(BlockDriverState *bs, uint64_t offset,
+                           int64_t *bytes)
+{
+    BDRVQcow2State *s = bs->opaque;
+    IntervalTreeNode *node;
+    uint64_t gen;
+    int len;
+
+    WITH_QEMU_LOCK_GUARD(&s->backing_cache_lock) {
+        qcow2_backing_cache_check(bs);
+
+        node = interval_tree_iter_first(&s->backing_cache, offset, offset);
+        if (node) {
+            *bytes = MIN(*bytes, node->last - offset + 1);
+            return container_of(node, Qcow2BackingCacheEntry, node)->depth;
+        }
+
+        len = s->backing_cache_chain->len;
+        gen = s->backing_cache_gen;
+    }
+
+    if (len == 0) {
+        /* Nothing to skip */
+        return 1;
+    }
+    return qcow2_backing_cache_resolve(bs, offset, bytes, len, gen);
+}
+
+int coroutine_fn GRAPH_RDLOCK
+qcow2_co_preadv_backing(BlockDriverState *bs, uint64_t offset, uint64_t bytes,
+                        QEMUIOVector *qiov, size_t qiov_offset)
+{
+    BdrvChild *child;
+    int64_t cur_bytes;
+    int depth;
+    int ret;
+
+    while (bytes) {
+        cur_bytes = MIN(bytes, BDRV_REQUEST_MAX_BYTES);
+        depth = qcow2_backing_cache_lookup(bs, offset, &cur_bytes);
+
+        for (child = bs->backing; depth > 1; depth--) {
+            child = child->bs->backing;
+        }
+        ret = bdrv_co_preadv_part(child, offset, cur_bytes,
+                                  qiov, qiov_offset, 0);
+        if (ret < 0) {
+            return ret;
+        }
+
+        offset += cur_bytes;
+        bytes -= cur_bytes;
+        qiov_offset += cur_bytes;
+    }
+
+    return 0;
+}
+
+void qcow2_backing_cache_init(BDRVQcow2State *s)
+{
+    qemu_mutex_init(&s->backing_cache_lock);
+    memset(&s->backing_cache, 0, sizeof(s->backing_cache));
+    s->nb_backing_cache_entries = 0;
+    s->backing_cache_chain = g_array_new(false, false,
+                                         sizeof(Qcow2BackingLayer));
+    s->backing_cache_gen = 0;
+}
+
+void qcow2_backing_cache_invalidate(BDRVQcow2State *s)
+{
+    if (!s->backing_cache_chain) {
+        /* Not open */
+        return;
+    }
+
+    QEMU_LOCK_GUARD(&s->backing_cache_lock);
+    qcow2_backing_cache_clear(s);
+}
+
+void qcow2_backing_cache_destroy(BDRVQcow2State *s)
+{
+    qcow2_backing_cache_clear(s);
+    g_array_free(s->backing_cache_chain, true);
+    s->backing_cache_chain = NULL;
+    qemu_mutex_destroy(&s->backing_cache_lock);
+}
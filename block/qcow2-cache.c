@@ -28,13 +28,30 @@
 #include "qcow2.h"
 #include "trace.h"
 
+/*
+ * Entries are split into shards: a table is looked up through the offset hash
+ * index, and on a miss the replacement victim is picked among the entries of
+ * the shard that the offset maps to. This keeps both the lookup and the LRU
+ * scan independent of the total cache size.
+ */
+#define QCOW2_CACHE_MAX_SHARDS      8
+#define QCOW2_CACHE_MIN_SHARD_SIZE  16
+
 typedef struct Qcow2CachedTable {
     int64_t  offset;
     uint64_t lru_counter;
     int      ref;
     bool     dirty;
+    int      hash_next;     /* next entry in the same hash bucket, or -1 */
 } Qcow2CachedTable;
 
+typedef struct Qcow2CacheShard {
+    int      first;         /* index of the first entry of the shard */
+    int      size;          /* number of entries in the shard */
+    uint64_t hits;
+    uint64_t misses;
+} Qcow2CacheShard;
+
 struct Qcow2Cache {
     Qcow2CachedTable       *entries;
     struct Qcow2Cache      *depends;
@@ -44,6 +61,13 @@ struct Qcow2Cache {
     void                   *table_array;
     uint64_t                lru_counter;
     uint64_t                cache_clean_lru_counter;
+
+    /* Hash index: bucket heads, chained through Qcow2CachedTable.hash_next */
+    int                    *buckets;
+    unsigned                bucket_mask;
+
+    Qcow2CacheShard        *shards;
+    int                     nb_shards;
 };
 
 static inline void *qcow2_cache_get_table_addr(Qcow2Cache *c, int table)
@@ -59,6 +83,61 @@ static inline int qcow2_cache_get_table_idx(Qcow2Cache *c, void *table)
     return idx;
 }
 
+static inline uint32_t qcow2_cache_hash(Qcow2Cache *c, uint64_t offset)
+{
+    uint64_t n = offset / c->table_size;
+
+    return (n * 0x9e3779b97f4a7c15ULL) >> 32;
+}
+
+static inline Qcow2CacheShard *qcow2_cache_get_shard(Qcow2Cache *c,
+                                                     uint64_t offset)
+{
+    /* Consecutive tables go to different shards */
+    return &c->shards[(offset / c->table_size) % c->nb_shards];
+}
+
+static int qcow2_cache_hash_lookup(Qcow2Cache *c, uint64_t offset)
+{
+    int i = c->buckets[qcow2_cache_hash(c, offset) & c->bucket_mask];
+
+    while (i >= 0 && c->entries[i].offset != offset) {
+        i = c->entries[i].hash_next;
+    }
+    return i;
+}
+
+static void qcow2_cache_hash_insert(Qcow2Cache *c, int i)
+{
+    int *head = &c->buckets[qcow2_cache_hash(c, c->entries[i].offset) &
+                            c->bucket_mask];
+
+    assert(c->entries[i].offset != 0);
+    c->entries[i].hash_next = *head;
+    *head = i;
+}
+
+/* Removes entry @i from the hash index and marks it as unused */
+static void qcow2_cache_hash_remove(Qcow2Cache *c, int i)
+{
+    int *link;
+
+    if (c->entries[i].offset == 0) {
+        return;
+    }
+
+    link = &c->buckets[qcow2_cache_hash(c, c->entries[i].offset) &
+                       c->bucket_mask];
+    while (*link != i) {
+        assert(*link >= 0);
+        link = &c->entries[*link].hash_next;
+    }
+    *link = c->entries[i].hash_next;
+
+    c->entries[i].hash_next = -1;
+    c->entries[i].offset = 0;
+}
+
 static inline const char *qcow2_cache_get_name(BDRVQcow2State *s, Qcow2Cache *c)
 {
     if (c == s->refcount_block_cache) {
@@ -106,7 +185,7 @@ void qcow2_cache_clean_unused(Qcow2Cache *c)
 
         /* And count how many we can clean in a row */
         while (i < c->size && can_clean_entry(c, i)) {
-            c->entries[i].offset = 0;
+            qcow2_cache_hash_remove(c, i);
             c->entries[i].lru_counter = 0;
             i++;
             to_clean++;
@@ -125,6 +204,8 @@ Qcow2Cache *qcow2_cache_create(BlockDriverState *bs, int num_tables,
 {
     BDRVQcow2State *s = bs->opaque;
     Qcow2Cache *c;
+    unsigned nb_buckets;
+    int i;
 
     assert(num_tables > 0);
     assert(is_power_of_2(table_size));
@@ -138,11 +219,34 @@ Qcow2Cache *qcow2_cache_create(BlockDriverState *bs, int num_tables,
     c->table_array = qemu_try_blockalign(bs->file->bs,
                                          (size_t) num_tables * c->table_size);
 
-    if (!c->entries || !c->table_array) {
+    /* Keep the load factor of the hash index at or below 0.5 */
+    nb_buckets = pow2ceil(num_tables) * 2;
+    c->bucket_mask = nb_buckets - 1;
+    c->buckets = g_try_new(int, nb_buckets);
+
+    c->nb_shards = pow2floor(MAX(num_tables / QCOW2_CACHE_MIN_SHARD_SIZE, 1));
+    c->nb_shards = MIN(c->nb_shards, QCOW2_CACHE_MAX_SHARDS);
+    c->shards = g_new0(Qcow2CacheShard, c->nb_shards);
+
+    if (!c->entries || !c->table_array || !c->buckets) {
         qemu_vfree(c->table_array);
         g_free(c->entries);
+        g_free(c->buckets);
+        g_free(c->shards);
         g_free(c);
-        c = NULL;
+        return NULL;
+    }
+
+    for (i = 0; i < nb_buckets; i++) {
+        c->buckets[i] = -1;
+    }
+    for (i = 0; i < num_tables; i++) {
+        c->entries[i].hash_next = -1;
+    }
+    for (i = 0; i < c->nb_shards; i++) {
+        c->shards[i].first = (int64_t) num_tables * i / c->nb_shards;
+        c->shards[i].size = (int64_t) num_tables * (i + 1) / c->nb_shards -
+                            c->shards[i].first;
     }
 
     return c;
@@ -158,6 +262,8 @@ int qcow2_cache_destroy(Qcow2Cache *c)
 
     qemu_vfree(c->table_array);
     g_free(c->entries);
+    g_free(c->buckets);
+    g_free(c->shards);
     g_free(c);
 
     return 0;
@@ -309,7 +415,7 @@ int qcow2_cache_empty(BlockDriverState *bs, Qcow2Cache *c)
 
     for (i = 0; i < c->size; i++) {
         assert(c->entries[i].ref == 0);
-        c->entries[i].offset = 0;
+        qcow2_cache_hash_remove(c, i);
         c->entries[i].lru_counter = 0;
     }
 
@@ -320,16 +426,32 @@ int qcow2_cache_empty(BlockDriverState *bs, Qcow2Cache *c)
     return 0;
 }
 
+static int qcow2_cache_find_victim(Qcow2Cache *c, int first, int n)
+{
+    uint64_t min_lru_counter = UINT64_MAX;
+    int min_lru_index = -1;
+    int i;
+
+    for (i = first; i < first + n; i++) {
+        const Qcow2CachedTable *t = &c->entries[i];
+        if (t->ref == 0 && t->lru_counter < min_lru_counter) {
+            min_lru_counter = t->lru_counter;
+            min_lru_index = i;
+        }
+    }
+
+    return min_lru_index;
+}
+
 static int GRAPH_RDLOCK
 qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
                    void **table, bool read_from_disk)
 {
     BDRVQcow2State *s = bs->opaque;
+    Qcow2CacheShard *shard;
     int i;
     int ret;
-    int lookup_index;
-    uint64_t min_lru_counter = UINT64_MAX;
-    int min_lru_index = -1;
+    int min_lru_index;
 
     assert(offset != 0);
 
@@ -344,20 +466,22 @@ qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
     }
 
     /* Check if the table is already cached */
-    i = lookup_index = (offset / c->table_size * 4) % c->size;
-    do {
-        const Qcow2CachedTable *t = &c->entries[i];
-        if (t->offset == offset) {
-            goto found;
-        }
-        if (t->ref == 0 && t->lru_counter < min_lru_counter) {
-            min_lru_counter = t->lru_counter;
-            min_lru_index = i;
-        }
-        if (++i == c->size) {
-            i = 0;
-        }
-    } while (i != lookup_index);
+    shard = qcow2_cache_get_shard(c, offset);
+    i = qcow2_cache_hash_lookup(c, offset);
+    if (i >= 0) {
+        shard->hits++;
+        goto found;
+    }
+    shard->misses++;
+
+    /*
+     * Pick the least recently used entry of the shard, and only look at the
+     * whole cache if all entries of the shard are in use.
+     */
+    min_lru_index = qcow2_cache_find_victim(c, shard->first, shard->size);
+    if (min_lru_index == -1) {
+        min_lru_index = qcow2_cache_find_victim(c, 0, c->size);
+    }
 
     if (min_lru_index == -1) {
         /* This can't happen in current synchronous code, but leave the check
@@ -377,7 +501,7 @@ qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
 
     trace_qcow2_cache_get_read(qemu_coroutine_self(),
                                c == s->l2_table_cache, i);
-    c->entries[i].offset = 0;
+    qcow2_cache_hash_remove(c, i);
     if (read_from_disk) {
         if (c == s->l2_table_cache) {
             BLKDBG_EVENT(bs->file, BLKDBG_L2_LOAD);
@@ -391,6 +515,7 @@ qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
     }
 
     c->entries[i].offset = offset;
+    qcow2_cache_hash_insert(c, i);
 
     /* And return the right table */
 found:
@@ -438,14 +563,8 @@ void qcow2_cache_entry_mark_dirty(Qcow2Cache *c, void *table)
 
 void *qcow2_cache_is_table_offset(Qcow2Cache *c, uint64_t offset)
 {
-    int i;
-
-    for (i = 0; i < c->size; i++) {
-        if (c->entries[i].offset == offset) {
-            return qcow2_cache_get_table_addr(c, i);
-        }
-    }
-    return NULL;
+    int i = qcow2_cache_hash_lookup(c, offset);
+    return i >= 0 ? qcow2_cache_get_table_addr(c, i) : NULL;
 }
 
 void qcow2_cache_discard(Qcow2Cache *c, void *table)
@@ -454,9 +573,74 @@ void qcow2_cache_discard(Qcow2Cache *c, void *table)
 
     assert(c->entries[i].ref == 0);
 
-    c->entries[i].offset = 0;
+    qcow2_cache_hash_remove(c, i);
     c->entries[i].lru_counter = 0;
     c->entries[i].dirty = false;
 
     qcow2_cache_table_release(c, i, 1);
 }
+
+Qcow2CacheShardStatsList *qcow2_cache_get_shard_stats(Qcow2Cache *c)
+{
+    Qcow2CacheShardStatsList *list = NULL;
+    int i;
+
+    for (i = c->nb_shards - 1; i >= 0; i--) {
+        Qcow2CacheShardStats *stats = g_new(Qcow2CacheShardStats, 1);
+
+        *stats = (Qcow2CacheShardStats) {
+            .entries = c->shards[i].size,
+            .hits = c->shards[i].hits,
+            .misses = c->shards[i].misses,
+        };
+        QAPI_LIST_PREPEND(list, stats);
+    }
+
+    return list;
+}
+
+int qcow2_cache_get_size(Qcow2Cache *c)
+{
+    return c->size;
+}
+
+static int compare_lru_desc(const void *a, const void *b)
+{
+    const Qcow2CachedTable *x = a, *y = b;
+
+    return x->lru_counter < y->lru_counter ? 1 :
+           x->lru_counter > y->lru_counter ? -1 : 0;
+}
+
+static int compare_uint64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * Stores the offsets of up to @max of the most recently used tables in
+ * @offsets, sorted by offset, and returns their number.
+ */
+int qcow2_cache_get_hot_offsets(Qcow2Cache *c, uint64_t *offsets, int max)
+{
+    g_autofree Qcow2CachedTable *used = g_new(Qcow2CachedTable, c->size);
+    int i, n = 0;
+
+    for (i = 0; i < c->size; i++) {
+        if (c->entries[i].offset != 0) {
+            used[n++] = c->entries[i];
+        }
+    }
+
+    qsort(used, n, sizeof(*used), compare_lru_desc);
+    n = MIN(n, max);
+
+    for (i = 0; i < n; i++) {
+        offsets[i] = used[i].offset;
+    }
+    qsort(offsets, n, sizeof(*offsets), compare_uint64);
+
+    return n;
+}
@@ -1619,6 +1619,17 @@ do_alloc_cluster_offset(BlockDriverState *bs, uint64_t guest_offset,
 
     /* Allocate new clusters */
     trace_qcow2_cluster_alloc_phys(qemu_coroutine_self());
+    if (s->alloc_arena_size) {
+        int64_t ret = qcow2_alloc_clusters_arena(bs, host_offset,
+                                                 *nb_clusters);
+        if (ret < 0) {
+            return ret;
+        } else if (ret > 0) {
+            *nb_clusters = ret;
+            return 0;
+        }
+    }
+
     if (*host_offset == INV_OFFSET) {
         int64_t cluster_offset =
             qcow2_alloc_clusters(bs, *nb_clusters * s->cluster_size);
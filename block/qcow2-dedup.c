@@ -0,0 +1,293 @@
+/*
+ * Offline deduplication of qcow2 data clusters
+ *
+ * Data clusters with identical contents are made to share a single host
+ * cluster.  Sharing uses the regular refcounting that internal snapshots
+ * rely on: a shared cluster has a refcount above one and its L2 entries
+ * lack QCOW_OFLAG_COPIED, so the next guest write to any of them triggers
+ * copy-on-write.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "crypto/hash.h"
+#include "qemu/memalign.h"
+#include "qcow2.h"
+
+/* The first cluster seen with a given fingerprint */
+typedef struct Qcow2DedupCluster {
+    uint64_t host_offset;
+    /* Location of the L2 entry that maps it */
+    uint64_t slice_offset;
+    int slice_index;
+    /* QCOW_OFLAG_COPIED has been cleared in that L2 entry */
+    bool shared;
+} Qcow2DedupCluster;
+
+typedef struct Qcow2DedupState {
+    BlockDriverState *bs;
+    /* Fingerprint (a SHA-256 prefix) -> Qcow2DedupCluster */
+    GHashTable *clusters;
+    uint8_t *buf;
+    uint8_t *cmp_buf;
+    /* Duplicates to free once the L2 tables that dropped them are written */
+    GArray *to_free;
+    int64_t freed;
+} Qcow2DedupState;
+
+static int coroutine_fn GRAPH_RDLOCK
+qcow2_dedup_fingerprint(Qcow2DedupState *d, uint64_t host_offset,
+                        uint64_t *fingerprint, Error **errp)
+{
+    BDRVQcow2State *s = d->bs->opaque;
+    g_autofree uint8_t *digest = NULL;
+    size_t digest_len = 0;
+    int ret;
+
+    ret = bdrv_co_pread(s->data_file, host_offset, s->cluster_size, d->buf, 0);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Failed to read cluster at offset 0x%"
+                         PRIx64, host_offset);
+        return ret;
+    }
+    if (qcrypto_hash_bytes(QCRYPTO_HASH_ALGO_SHA256, d->buf, s->cluster_size,
+                           &digest, &digest_len, errp) < 0) {
+        return -EIO;
+    }
+    assert(digest_len >= sizeof(*fingerprint));
+    memcpy(fingerprint, digest, sizeof(*fingerprint));
+    return 0;
+}
+
+/*
+ * Make the L2 entry at @index of @l2_slice point to @c instead of its own
+ * cluster, which must hold the same data as @c (now in d->buf).
+ * Returns 1 if the entry was changed, 0 if it has to stay as it is.
+ */
+static int coroutine_fn GRAPH_RDLOCK
+qcow2_dedup_share(Qcow2DedupState *d, Qcow2DedupCluster *c,
+                  uint64_t *l2_slice, int index, Error **errp)
+{
+    BlockDriverState *bs = d->bs;
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t host_offset = get_l2_entry(s, l2_slice, index) & L2E_OFFSET_MASK;
+    uint64_t *first_slice;
+    int ret;
+
+    /* Do not trust the fingerprint alone */
+    ret = bdrv_co_pread(s->data_file, c->host_offset, s->cluster_size,
+                        d->cmp_buf, 0);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Failed to read cluster at offset 0x%"
+                         PRIx64, c->host_offset);
+        return ret;
+    }
+    if (memcmp(d->buf, d->cmp_buf, s->cluster_size)) {
+        return 0;
+    }
+
+    ret = qcow2_update_cluster_refcount(bs, c->host_offset >> s->cluster_bits,
+                                        1, false, QCOW2_DISCARD_NEVER);
+    if (ret == -ERANGE) {
+        /* Refcount is at its maximum, keep this copy */
+        return 0;
+    } else if (ret < 0) {
+        error_setg_errno(errp, -ret, "Failed to update refcount");
+        return ret;
+    }
+
+    /* The new references must be on disk before the L2 entries using them */
+    ret = qcow2_cache_set_dependency(bs, s->l2_table_cache,
+                                     s->refcount_block_cache);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Failed to flush refcounts");
+        return ret;
+    }
+
+    if (!c->shared) {
+        ret = qcow2_cache_get(bs, s->l2_table_cache, c->slice_offset,
+                              (void **)&first_slice);
+        if (ret < 0) {
+            error_setg_errno(errp, -ret, "Failed to read L2 table");
+            return ret;
+        }
+        set_l2_entry(s, first_slice, c->slice_index, c->host_offset);
+        qcow2_cache_entry_mark_dirty(s->l2_table_cache, first_slice);
+        qcow2_cache_put(s->l2_table_cache, (void **)&first_slice);
+        c->shared = true;
+    }
+
+    set_l2_entry(s, l2_slice, index, c->host_offset);
+    g_array_append_val(d->to_free, host_offset);
+    return 1;
+}
+
+static int coroutine_fn GRAPH_RDLOCK
+qcow2_dedup_slice(Qcow2DedupState *d, uint64_t slice_offset, Error **errp)
+{
+    BDRVQcow2State *s = d->bs->opaque;
+    uint64_t *l2_slice;
+    bool dirty = false;
+    int ret = 0;
+    int i;
+
+    ret = qcow2_cache_get(d->bs, s->l2_table_cache, slice_offset,
+                          (void **)&l2_slice);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Failed to read L2 table");
+        return ret;
+    }
+
+    for (i = 0; i < s->l2_slice_size; i++) {
+        uint64_t l2_entry = get_l2_entry(s, l2_slice, i);
+        uint64_t host_offset = l2_entry & L2E_OFFSET_MASK;
+        Qcow2DedupCluster *c;
+        uint64_t fingerprint;
+
+        /* Only clusters that are not shared yet are considered */
+        if (qcow2_get_cluster_type(d->bs, l2_entry) != QCOW2_CLUSTER_NORMAL ||
+            !(l2_entry & QCOW_OFLAG_COPIED)) {
+            continue;
+        }
+
+        ret = qcow2_dedup_fingerprint(d, host_offset, &fingerprint, errp);
+        if (ret < 0) {
+            break;
+        }
+
+        c = g_hash_table_lookup(d->clusters, &fingerprint);
+        if (!c) {
+            uint64_t *key = g_new(uint64_t, 1);
+
+            *key = fingerprint;
+            c = g_new0(Qcow2DedupCluster, 1);
+            c->host_offset = host_offset;
+            c->slice_offset = slice_offset;
+            c->slice_index = i;
+            g_hash_table_insert(d->clusters, key, c);
+            continue;
+        }
+
+        ret = qcow2_dedup_share(d, c, l2_slice, i, errp);
+        if (ret < 0) {
+            break;
+        }
+        dirty |= ret;
+        ret = 0;
+    }
+
+    if (dirty) {
+        qcow2_cache_entry_mark_dirty(s->l2_table_cache, l2_slice);
+    }
+    qcow2_cache_put(s->l2_table_cache, (void **)&l2_slice);
+    return ret;
+}
+
+/* Free the duplicates once no L2 entry on disk refers to them any more */
+static int coroutine_fn GRAPH_RDLOCK
+qcow2_dedup_free(Qcow2DedupState *d, Error **errp)
+{
+    BDRVQcow2State *s = d->bs->opaque;
+    int ret;
+    int i;
+
+    if (!d->to_free->len) {
+        return 0;
+    }
+
+    ret = qcow2_cache_flush(d->bs, s->l2_table_cache);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Failed to write L2 tables");
+        return ret;
+    }
+    for (i = 0; i < d->to_free->len; i++) {
+        qcow2_free_clusters(d->bs, g_array_index(d->to_free, uint64_t, i),
+                            s->cluster_size, QCOW2_DISCARD_ALWAYS);
+    }
+    d->freed += d->to_free->len * s->cluster_size;
+    g_array_set_size(d->to_free, 0);
+    return 0;
+}
+
+int coroutine_fn GRAPH_RDLOCK
+qcow2_co_dedup(BlockDriverState *bs, int64_t *freed_bytes, Error **errp)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2DedupState d = { .bs = bs };
+    unsigned slice_size2 = s->l2_slice_size * l2_entry_size(s);
+    unsigned n_slices = s->cluster_size / slice_size2;
+    int ret = 0, free_ret;
+    int i, j;
+
+    *freed_bytes = 0;
+
+    if (has_data_file(bs)) {
+        error_setg(errp, "Deduplication is not supported with an external "
+                   "data file");
+        return -ENOTSUP;
+    }
+    if (s->crypt_method_header) {
+        /* The IV depends on the guest offset, equal data is not shareable */
+        error_setg(errp, "Deduplication is not supported for encrypted "
+                   "images");
+        return -ENOTSUP;
+    }
+    if (has_subclusters(s)) {
+        error_setg(errp, "Deduplication is not supported with subclusters");
+        return -ENOTSUP;
+    }
+
+    d.clusters = g_hash_table_new_full(g_int64_hash, g_int64_equal,
+                                       g_free, g_free);
+    d.to_free = g_array_new(false, false, sizeof(uint64_t));
+    d.buf = qemu_try_blockalign(s->data_file->bs, s->cluster_size);
+    d.cmp_buf = qemu_try_blockalign(s->data_file->bs, s->cluster_size);
+    if (!d.buf || !d.cmp_buf) {
+        error_setg(errp, "Failed to allocate buffers");
+        ret = -ENOMEM;
+        goto out;
+    }
+
+    qemu_co_mutex_lock(&s->lock);
+    for (i = 0; i < s->l1_size; i++) {
+        uint64_t l2_offset = s->l1_table[i] & L1E_OFFSET_MASK;
+
+        /* L2 tables shared with snapshots must not change */
+        if (!l2_offset || !(s->l1_table[i] & QCOW_OFLAG_COPIED)) {
+            continue;
+        }
+        for (j = 0; j < n_slices; j++) {
+            ret = qcow2_dedup_slice(&d, l2_offset + j * slice_size2, errp);
+            if (ret < 0) {
+                break;
+            }
+        }
+        /* Free what was found so far even if this table failed */
+        free_ret = qcow2_dedup_free(&d, ret < 0 ? NULL : errp);
+        if (ret == 0) {
+            ret = free_ret;
+        }
+        if (ret < 0) {
+            break;
+        }
+    }
+    if (ret == 0) {
+        qcow2_process_refcount_deltas(bs);
+        ret = qcow2_cache_flush(bs, s->refcount_block_cache);
+        if (ret < 0) {
+            error_setg_errno(errp, -ret, "Failed to write refcounts");
+        }
+    }
+    qemu_co_mutex_unlock(&s->lock);
+
+    *freed_bytes = d.freed;
+
+out:
+    qemu_vfree(d.buf);
+    qemu_vfree(d.cmp_buf);
+    g_array_free(d.to_free, true);
+    g_hash_table_destroy(d.clusters);
+    return ret;
+}
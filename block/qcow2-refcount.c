@@ -901,6 +901,9 @@ update_refcount(BlockDriverState *bs, int64_t offset, int64_t length,
                 qcow2_cache_discard(s->l2_table_cache, table);
             }
 
+            qcow2_decompressed_cache_invalidate(s, cluster_offset,
+                                                s->cluster_size);
+
             if (s->discard_passthrough[type]) {
                 queue_discard(bs, cluster_offset, s->cluster_size);
             }
@@ -972,6 +975,9 @@ alloc_clusters_noref(BlockDriverState *bs, uint64_t size, uint64_t max)
     uint64_t i, nb_clusters, refcount;
     int ret;
 
+    /* Clusters may only become free once their deferred decrement is done */
+    qcow2_process_refcount_deltas(bs);
+
     /* We can't allocate clusters if they may still be queued for discard. */
     if (s->cache_discards) {
         qcow2_process_discards(bs, 0);
@@ -1041,6 +1047,8 @@ int64_t coroutine_fn qcow2_alloc_clusters_at(BlockDriverState *bs, uint64_t offs
         return 0;
     }
 
+    qcow2_process_refcount_deltas(bs);
+
     do {
         /* Check how many clusters there are free */
         cluster_index = offset >> s->cluster_bits;
@@ -1065,6 +1073,95 @@ int64_t coroutine_fn qcow2_alloc_clusters_at(BlockDriverState *bs, uint64_t offs
     return i;
 }
 
+static Qcow2AllocArena *qcow2_get_alloc_arena(BDRVQcow2State *s)
+{
+    AioContext *ctx = qemu_get_current_aio_context();
+    Qcow2AllocArena *arena;
+
+    QLIST_FOREACH(arena, &s->alloc_arenas, next_arena) {
+        if (arena->ctx == ctx) {
+            return arena;
+        }
+    }
+
+    arena = g_new0(Qcow2AllocArena, 1);
+    arena->ctx = ctx;
+    QLIST_INSERT_HEAD(&s->alloc_arenas, arena, next_arena);
+    return arena;
+}
+
+/*
+ * Allocates up to @nb_clusters data clusters from the arena of the current
+ * AioContext. Arenas are reserved with a single refcount update of
+ * alloc_arena_size bytes, so that allocating writes from different IOThreads
+ * get disjoint, contiguous host ranges and don't pay for a refcount update
+ * each.
+ *
+ * If *host_offset is INV_OFFSET, the clusters can come from anywhere in the
+ * arena, and an empty arena is refilled first. Otherwise the allocation must
+ * start at *host_offset, which only succeeds if that is where the unused part
+ * of the arena starts.
+ *
+ * Returns the number of allocated clusters (starting at *host_offset) on
+ * success, 0 if the arena cannot serve the request and the caller should
+ * allocate the clusters in the normal way, or -errno.
+ */
+int64_t coroutine_fn GRAPH_RDLOCK
+qcow2_alloc_clusters_arena(BlockDriverState *bs, uint64_t *host_offset,
+                           uint64_t nb_clusters)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2AllocArena *arena;
+    uint64_t avail;
+
+    assert(s->alloc_arena_size > 0);
+    if (nb_clusters << s->cluster_bits > s->alloc_arena_size) {
+        return 0;
+    }
+
+    arena = qcow2_get_alloc_arena(s);
+    if (*host_offset != INV_OFFSET) {
+        if (*host_offset != arena->next || arena->next == arena->end) {
+            return 0;
+        }
+    } else if (arena->next == arena->end) {
+        int64_t offset = qcow2_alloc_clusters(bs, s->alloc_arena_size);
+        if (offset < 0) {
+            return offset;
+        }
+        arena->next = offset;
+        arena->end = offset + s->alloc_arena_size;
+    }
+
+    avail = (arena->end - arena->next) >> s->cluster_bits;
+    nb_clusters = MIN(nb_clusters, avail);
+
+    *host_offset = arena->next;
+    arena->next += nb_clusters << s->cluster_bits;
+
+    return nb_clusters;
+}
+
+/*
+ * Gives the unused part of all allocation arenas back. Must be called before
+ * anything that assumes that every cluster with a non-zero refcount is
+ * referenced, such as closing the image or repairing leaks.
+ */
+void GRAPH_RDLOCK qcow2_release_alloc_arenas(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2AllocArena *arena, *tmp;
+
+    QLIST_FOREACH_SAFE(arena, &s->alloc_arenas, next_arena, tmp) {
+        if (arena->next < arena->end) {
+            qcow2_free_clusters(bs, arena->next, arena->end - arena->next,
+                                QCOW2_DISCARD_NEVER);
+        }
+        QLIST_REMOVE(arena, next_arena);
+        g_free(arena);
+    }
+}
+
 /* only used to allocate compressed sectors. We try to allocate
    contiguous sectors. size must be <= cluster_size */
 int64_t coroutine_fn GRAPH_RDLOCK qcow2_alloc_bytes(BlockDriverState *bs, int size)
@@ -1141,13 +1238,124 @@ int64_t coroutine_fn GRAPH_RDLOCK qcow2_alloc_bytes(BlockDriverState *bs, int si
     return offset;
 }
 
+static int compare_refcount_deltas(const void *a, const void *b)
+{
+    const Qcow2RefcountDelta *da = a;
+    const Qcow2RefcountDelta *db = b;
+
+    if (da->cluster_index != db->cluster_index) {
+        return da->cluster_index < db->cluster_index ? -1 : 1;
+    }
+    return 0;
+}
+
+/*
+ * Applies all deferred refcount decrements. They are sorted by offset first
+ * and ranges that directly follow each other are merged, so that every
+ * refcount block is loaded and dirtied only once per batch instead of once
+ * per freed range.
+ */
+void qcow2_process_refcount_deltas(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2RefcountDelta *d = s->refcount_deltas;
+    int n = s->nb_refcount_deltas;
+    int i;
+
+    if (n == 0) {
+        return;
+    }
+
+    /*
+     * Detach the batch first, so that allocations done by update_refcount()
+     * (which process pending deltas themselves) find it empty
+     */
+    s->nb_refcount_deltas = 0;
+    s->refcount_deltas = NULL;
+
+    qsort(d, n, sizeof(*d), compare_refcount_deltas);
+
+    trace_qcow2_process_refcount_deltas(bs, n);
+
+    for (i = 0; i < n; i++) {
+        uint64_t start = d[i].cluster_index;
+        uint64_t end = start + d[i].nb_clusters;
+        int ret;
+
+        /*
+         * Ranges of the same cluster (e.g. compressed clusters sharing a host
+         * cluster) must stay separate so that each gets decremented.
+         */
+        while (i + 1 < n && d[i + 1].cluster_index == end &&
+               d[i + 1].type == d[i].type)
+        {
+            end += d[++i].nb_clusters;
+        }
+
+        ret = update_refcount(bs, start << s->cluster_bits,
+                              (end - start) << s->cluster_bits, 1, true,
+                              d[i].type);
+        if (ret < 0) {
+            fprintf(stderr, "qcow2_free_clusters failed: %s\n",
+                    strerror(-ret));
+        }
+    }
+
+    g_free(d);
+}
+
+static void queue_refcount_delta(BlockDriverState *bs, int64_t offset,
+                                 int64_t size, enum qcow2_discard_type type)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t start = offset >> s->cluster_bits;
+    uint64_t nb_clusters = ((offset + size - 1) >> s->cluster_bits) - start + 1;
+    Qcow2RefcountDelta *last;
+
+    if (!s->refcount_deltas) {
+        s->refcount_deltas = g_new(Qcow2RefcountDelta,
+                                   QCOW2_MAX_REFCOUNT_DELTAS);
+    }
+
+    /* Sequential frees (e.g. from a guest fstrim) extend the last range */
+    last = s->nb_refcount_deltas ?
+           &s->refcount_deltas[s->nb_refcount_deltas - 1] : NULL;
+    if (last && last->type == type &&
+        last->cluster_index + last->nb_clusters == start)
+    {
+        last->nb_clusters += nb_clusters;
+    } else {
+        s->refcount_deltas[s->nb_refcount_deltas++] = (Qcow2RefcountDelta) {
+            .cluster_index  = start,
+            .nb_clusters    = nb_clusters,
+            .type           = type,
+        };
+    }
+
+    if (s->nb_refcount_deltas == QCOW2_MAX_REFCOUNT_DELTAS) {
+        qcow2_process_refcount_deltas(bs);
+    }
+}
+
 void qcow2_free_clusters(BlockDriverState *bs,
                           int64_t offset, int64_t size,
                           enum qcow2_discard_type type)
 {
+    BDRVQcow2State *s = bs->opaque;
     int ret;
 
     BLKDBG_EVENT(bs->file, BLKDBG_CLUSTER_FREE);
+
+    /*
+     * Deferring a decrement is safe: until it is applied, the clusters are
+     * merely leaked, and they are not reused because the allocation functions
+     * process all pending decrements first.
+     */
+    if (s->batch_refcount_updates && size > 0) {
+        queue_refcount_delta(bs, offset, size, type);
+        return;
+    }
+
     ret = update_refcount(bs, offset, size, 1, true, type);
     if (ret < 0) {
         fprintf(stderr, "qcow2_free_clusters failed: %s\n", strerror(-ret));
@@ -1227,6 +1435,8 @@ int qcow2_write_caches(BlockDriverState *bs)
     BDRVQcow2State *s = bs->opaque;
     int ret;
 
+    qcow2_process_refcount_deltas(bs);
+
     ret = qcow2_cache_write(bs, s->l2_table_cache);
     if (ret < 0) {
         return ret;
@@ -1271,6 +1481,9 @@ int qcow2_update_snapshot_refcount(BlockDriverState *bs,
 
     assert(addend >= -1 && addend <= 1);
 
+    /* The COPIED flags below are derived from the current refcounts */
+    qcow2_process_refcount_deltas(bs);
+
     l2_slice = NULL;
     l1_table = NULL;
     l1_size2 = l1_size * L1E_SIZE;
@@ -36,6 +36,7 @@
 #include "qcow2.h"
 #include "block/block-io.h"
 #include "block/thread-pool.h"
+#include "qemu/memalign.h"
 #include "crypto.h"
 
 static int coroutine_fn
@@ -45,7 +46,7 @@ qcow2_co_process(BlockDriverState *bs, ThreadPoolFunc *func, void *arg)
     BDRVQcow2State *s = bs->opaque;
 
     qemu_co_mutex_lock(&s->lock);
-    while (s->nb_threads >= QCOW2_MAX_THREADS) {
+    while (s->nb_threads >= s->max_threads) {
         qemu_co_queue_wait(&s->thread_task_queue, &s->lock);
     }
     s->nb_threads++;
@@ -426,6 +427,375 @@ qcow2_co_decompress(BlockDriverState *bs, void *dest, size_t dest_size,
 }
 
 
+/*
+ * Reads the compressed cluster described by @l2_entry and decompresses it
+ * into @out_buf, which must be cluster_size bytes large.
+ */
+int coroutine_fn GRAPH_RDLOCK
+qcow2_co_read_compressed_cluster(BlockDriverState *bs, uint64_t l2_entry,
+                                 void *out_buf)
+{
+    BDRVQcow2State *s = bs->opaque;
+    int ret, csize;
+    uint64_t coffset;
+    uint8_t *buf;
+
+    qcow2_parse_compressed_l2_entry(bs, l2_entry, &coffset, &csize);
+
+    buf = g_try_malloc(csize);
+    if (!buf) {
+        return -ENOMEM;
+    }
+
+    BLKDBG_CO_EVENT(bs->file, BLKDBG_READ_COMPRESSED);
+    ret = bdrv_co_pread(bs->file, coffset, csize, buf, 0);
+    if (ret < 0) {
+        goto fail;
+    }
+
+    if (qcow2_co_decompress(bs, out_buf, s->cluster_size, buf, csize) < 0) {
+        ret = -EIO;
+        goto fail;
+    }
+
+    ret = 0;
+fail:
+    g_free(buf);
+    return ret;
+}
+
+
+/*
+ * Decompressed cluster cache
+ *
+ * Entries are looked up by their L2 entry, so an entry can only be found
+ * again while an L2 table references the same compressed data. Because the
+ * data at a given host offset can only change after its cluster has been
+ * freed, update_refcount() invalidates all entries in a cluster whose
+ * refcount drops to zero.
+ *
+ * Protected by decompressed_lock, which is never held across a yield.
+ */
+
+void qcow2_decompressed_cache_init(BDRVQcow2State *s)
+{
+    qemu_mutex_init(&s->decompressed_lock);
+    QTAILQ_INIT(&s->decompressed_clusters);
+    s->nb_decompressed_clusters = 0;
+    s->readahead_next = 0;
+    s->readahead_end = 0;
+}
+
+static void decompressed_cluster_unref(Qcow2DecompressedCluster *dc)
+{
+    if (--dc->ref == 0 && !dc->in_cache) {
+        qemu_vfree(dc->data);
+        g_free(dc);
+    }
+}
+
+static void decompressed_cluster_remove(BDRVQcow2State *s,
+                                        Qcow2DecompressedCluster *dc)
+{
+    assert(dc->in_cache);
+    QTAILQ_REMOVE(&s->decompressed_clusters, dc, next);
+    s->nb_decompressed_clusters--;
+    dc->in_cache = false;
+
+    if (dc->ref == 0) {
+        dc->ref++;
+        decompressed_cluster_unref(dc);
+    }
+}
+
+/* Returns a new reference to the cached entry for @l2_entry, if any */
+static Qcow2DecompressedCluster *
+decompressed_cluster_lookup(BDRVQcow2State *s, uint64_t l2_entry)
+{
+    Qcow2DecompressedCluster *dc;
+
+    QTAILQ_FOREACH(dc, &s->decompressed_clusters, next) {
+        if (dc->l2_entry == l2_entry) {
+            QTAILQ_REMOVE(&s->decompressed_clusters, dc, next);
+            QTAILQ_INSERT_HEAD(&s->decompressed_clusters, dc, next);
+            dc->ref++;
+            return dc;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Creates a new entry in loading state and returns a reference to it, or NULL
+ * if the cache is full of entries that are in use.
+ */
+static Qcow2DecompressedCluster *
+decompressed_cluster_insert(BlockDriverState *bs, uint64_t l2_entry,
+                            uint64_t guest_offset)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2DecompressedCluster *dc;
+    void *data;
+
+    if (s->nb_decompressed_clusters >= 2 * s->compressed_readahead) {
+        QTAILQ_FOREACH_REVERSE(dc, &s->decompressed_clusters, next) {
+            if (dc->ref == 0) {
+                break;
+            }
+        }
+        if (!dc) {
+            return NULL;
+        }
+        decompressed_cluster_remove(s, dc);
+    }
+
+    data = qemu_try_blockalign(bs->file->bs, s->cluster_size);
+    if (!data) {
+        return NULL;
+    }
+
+    dc = g_new0(Qcow2DecompressedCluster, 1);
+    dc->l2_entry = l2_entry;
+    qcow2_parse_compressed_l2_entry(bs, l2_entry, &dc->coffset, &dc->csize);
+    dc->guest_offset = guest_offset;
+    dc->data = data;
+    dc->ref = 1;
+    dc->in_cache = true;
+    dc->loading = true;
+    qemu_co_queue_init(&dc->loading_queue);
+
+    QTAILQ_INSERT_HEAD(&s->decompressed_clusters, dc, next);
+    s->nb_decompressed_clusters++;
+
+    return dc;
+}
+
+static void coroutine_fn GRAPH_RDLOCK
+decompressed_cluster_load(BlockDriverState *bs, Qcow2DecompressedCluster *dc)
+{
+    BDRVQcow2State *s = bs->opaque;
+    unsigned int bytes = s->cluster_size;
+    uint64_t l2_entry = 0;
+    QCow2SubclusterType type = QCOW2_SUBCLUSTER_INVALID;
+    bool keep = false;
+    int ret;
+
+    ret = qcow2_co_read_compressed_cluster(bs, dc->l2_entry, dc->data);
+
+    /*
+     * Only keep the entry if the guest cluster still references the same
+     * compressed data. Checking this under s->lock makes sure that the
+     * cluster can't be freed between here and making the entry visible;
+     * any later free is caught by qcow2_decompressed_cache_invalidate().
+     */
+    qemu_co_mutex_lock(&s->lock);
+    if (ret == 0) {
+        keep = qcow2_get_host_offset(bs, dc->guest_offset, &bytes, &l2_entry,
+                                     &type) == 0 &&
+               type == QCOW2_SUBCLUSTER_COMPRESSED &&
+               l2_entry == dc->l2_entry;
+    }
+
+    qemu_mutex_lock(&s->decompressed_lock);
+    dc->loading = false;
+    dc->ret = ret;
+    if (dc->in_cache && !keep) {
+        decompressed_cluster_remove(s, dc);
+    }
+    qemu_co_queue_restart_all(&dc->loading_queue);
+    qemu_mutex_unlock(&s->decompressed_lock);
+    qemu_co_mutex_unlock(&s->lock);
+}
+
+typedef struct Qcow2ReadaheadTask {
+    BlockDriverState *bs;
+    uint64_t offset;
+} Qcow2ReadaheadTask;
+
+static void coroutine_fn qcow2_readahead_entry(void *opaque)
+{
+    Qcow2ReadaheadTask *task = opaque;
+    BlockDriverState *bs = task->bs;
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2DecompressedCluster *dc = NULL;
+    unsigned int bytes = s->cluster_size;
+    uint64_t l2_entry = 0;
+    QCow2SubclusterType type = QCOW2_SUBCLUSTER_INVALID;
+    int ret;
+
+    bdrv_graph_co_rdlock();
+
+    qemu_co_mutex_lock(&s->lock);
+    ret = qcow2_get_host_offset(bs, task->offset, &bytes, &l2_entry, &type);
+    qemu_co_mutex_unlock(&s->lock);
+
+    if (ret == 0 && type == QCOW2_SUBCLUSTER_COMPRESSED) {
+        WITH_QEMU_LOCK_GUARD(&s->decompressed_lock) {
+            dc = decompressed_cluster_lookup(s, l2_entry);
+            if (dc) {
+                /* Already cached or being loaded */
+                decompressed_cluster_unref(dc);
+                dc = NULL;
+            } else {
+                dc = decompressed_cluster_insert(bs, l2_entry, task->offset);
+            }
+        }
+    }
+
+    if (dc) {
+        decompressed_cluster_load(bs, dc);
+        WITH_QEMU_LOCK_GUARD(&s->decompressed_lock) {
+            decompressed_cluster_unref(dc);
+        }
+    }
+
+    bdrv_graph_co_rdunlock();
+    bdrv_dec_in_flight(bs);
+    g_free(task);
+}
+
+static void qcow2_start_readahead(BlockDriverState *bs, uint64_t offset)
+{
+    Qcow2ReadaheadTask *task = g_new(Qcow2ReadaheadTask, 1);
+    Coroutine *co;
+
+    *task = (Qcow2ReadaheadTask) {
+        .bs     = bs,
+        .offset = offset,
+    };
+
+    /* Drained sections wait for the read-ahead to complete */
+    bdrv_inc_in_flight(bs);
+    co = qemu_coroutine_create(qcow2_readahead_entry, task);
+    aio_co_enter(qemu_get_current_aio_context(), co);
+}
+
+/*
+ * Starts read-ahead of the next compressed_readahead clusters if the guest
+ * is reading (compressed) clusters sequentially.
+ */
+static void qcow2_update_readahead(BlockDriverState *bs, uint64_t offset)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t cluster = offset >> s->cluster_bits;
+    uint64_t nb_clusters = size_to_clusters(s, bs->total_sectors *
+                                               BDRV_SECTOR_SIZE);
+    uint64_t start, end, i;
+    bool sequential;
+
+    qemu_mutex_lock(&s->decompressed_lock);
+    sequential = cluster == s->readahead_next ||
+                 cluster + 1 == s->readahead_next;
+    s->readahead_next = cluster + 1;
+
+    start = MAX(cluster + 1, s->readahead_end);
+    end = MIN(cluster + 1 + s->compressed_readahead, nb_clusters);
+    if (!sequential) {
+        s->readahead_end = cluster + 1;
+        end = start;
+    } else if (start < end) {
+        s->readahead_end = end;
+    }
+    qemu_mutex_unlock(&s->decompressed_lock);
+
+    for (i = start; i < end; i++) {
+        qcow2_start_readahead(bs, i << s->cluster_bits);
+    }
+}
+
+int coroutine_fn GRAPH_RDLOCK
+qcow2_co_preadv_decompressed_cached(BlockDriverState *bs, uint64_t l2_entry,
+                                    uint64_t offset, uint64_t bytes,
+                                    QEMUIOVector *qiov, size_t qiov_offset)
+{
+    BDRVQcow2State *s = bs->opaque;
+    int offset_in_cluster = offset_into_cluster(s, offset);
+    Qcow2DecompressedCluster *dc;
+    bool load = false;
+    int ret;
+
+    qemu_mutex_lock(&s->decompressed_lock);
+    dc = decompressed_cluster_lookup(s, l2_entry);
+    if (dc) {
+        while (dc->loading) {
+            qemu_co_queue_wait(&dc->loading_queue, &s->decompressed_lock);
+        }
+    } else {
+        dc = decompressed_cluster_insert(bs, l2_entry,
+                                         start_of_cluster(s, offset));
+        load = true;
+    }
+    qemu_mutex_unlock(&s->decompressed_lock);
+
+    if (!dc) {
+        /* Every cached cluster is in use, bypass the cache */
+        void *out_buf = qemu_blockalign(bs, s->cluster_size);
+
+        ret = qcow2_co_read_compressed_cluster(bs, l2_entry, out_buf);
+        if (ret == 0) {
+            qemu_iovec_from_buf(qiov, qiov_offset,
+                                (uint8_t *) out_buf + offset_in_cluster,
+                                bytes);
+        }
+        qemu_vfree(out_buf);
+        return ret;
+    }
+
+    if (load) {
+        decompressed_cluster_load(bs, dc);
+    }
+
+    ret = dc->ret;
+    if (ret == 0) {
+        qemu_iovec_from_buf(qiov, qiov_offset,
+                            (uint8_t *) dc->data + offset_in_cluster, bytes);
+    }
+
+    WITH_QEMU_LOCK_GUARD(&s->decompressed_lock) {
+        decompressed_cluster_unref(dc);
+    }
+
+    if (ret == 0) {
+        qcow2_update_readahead(bs, offset);
+    }
+
+    return ret;
+}
+
+/*
+ * Drops all entries with compressed data in the host range at @offset.
+ * Entries that are still in use are freed once their last user is done.
+ */
+void qcow2_decompressed_cache_invalidate(BDRVQcow2State *s, uint64_t offset,
+                                         uint64_t bytes)
+{
+    Qcow2DecompressedCluster *dc, *next;
+
+    if (!s->compressed_readahead) {
+        return;
+    }
+
+    QEMU_LOCK_GUARD(&s->decompressed_lock);
+    QTAILQ_FOREACH_SAFE(dc, &s->decompressed_clusters, next, next) {
+        if (dc->coffset < offset + bytes && offset < dc->coffset + dc->csize) {
+            decompressed_cluster_remove(s, dc);
+        }
+    }
+}
+
+void qcow2_decompressed_cache_destroy(BDRVQcow2State *s)
+{
+    Qcow2DecompressedCluster *dc, *next;
+
+    QTAILQ_FOREACH_SAFE(dc, &s->decompressed_clusters, next, next) {
+        assert(dc->ref == 0);
+        decompressed_cluster_remove(s, dc);
+    }
+    qemu_mutex_destroy(&s->decompressed_lock);
+}
+
+
 /*
  * Cryptography
  */
@@ -437,6 +807,9 @@ qcow2_co_decompress(BlockDriverState *bs, void *dest, size_t dest_size,
 typedef int (*Qcow2EncDecFunc)(QCryptoBlock *block, uint64_t offset,
                                uint8_t *buf, size_t len, Error **errp);
 
+/* Requests up to this size are encrypted in the calling coroutine */
+#define QCOW2_CRYPTO_INLINE_MAX (16 * KiB)
+
 typedef struct Qcow2EncDecData {
     QCryptoBlock *block;
     uint64_t offset;
@@ -475,7 +848,19 @@ qcow2_co_encdec(BlockDriverState *bs, uint64_t host_offset,
     assert(QEMU_IS_ALIGNED(host_offset, sector_size));
     assert(QEMU_IS_ALIGNED(len, sector_size));
 
-    return len == 0 ? 0 : qcow2_co_process(bs, qcow2_encdec_pool_func, &arg);
+    if (len == 0) {
+        return 0;
+    }
+
+    /*
+     * Hardware accelerated AES gets through a small request faster than it
+     * takes to hand it to a worker thread and wake the coroutine up again.
+     */
+    if (len <= QCOW2_CRYPTO_INLINE_MAX) {
+        return qcow2_encdec_pool_func(&arg);
+    }
+
+    return qcow2_co_process(bs, qcow2_encdec_pool_func, &arg);
 }
 
 /*
@@ -73,6 +73,7 @@ typedef struct {
 #define  QCOW2_EXT_MAGIC_CRYPTO_HEADER 0x0537be77
 #define  QCOW2_EXT_MAGIC_BITMAPS 0x23852875
 #define  QCOW2_EXT_MAGIC_DATA_FILE 0x44415441
+#define  QCOW2_EXT_MAGIC_L2_HOT_SET 0x4c32484f
 
 static int coroutine_fn
 qcow2_co_preadv_compressed(BlockDriverState *bs,
@@ -432,6 +433,39 @@ qcow2_read_extensions(BlockDriverState *bs, uint64_t start_offset,
             break;
         }
 
+        case QCOW2_EXT_MAGIC_L2_HOT_SET:
+        {
+            int i;
+
+            if (ext.len % sizeof(uint64_t) != 0 ||
+                ext.len / sizeof(uint64_t) > QCOW2_MAX_L2_HOT_SET) {
+                /* Only a hint, so just drop it if it is invalid */
+                break;
+            }
+
+            g_free(s->l2_hot_set_offsets);
+            s->l2_hot_set_size = ext.len / sizeof(uint64_t);
+            s->l2_hot_set_offsets = g_new(uint64_t, s->l2_hot_set_size);
+            ret = bdrv_co_pread(bs->file, offset, ext.len,
+                                s->l2_hot_set_offsets, 0);
+            if (ret < 0) {
+                error_setg_errno(errp, -ret, "ERROR: l2_hot_set_ext: "
+                                 "Could not read ext header");
+                return ret;
+            }
+
+            for (i = 0; i < s->l2_hot_set_size; i++) {
+                s->l2_hot_set_offsets[i] =
+                    be64_to_cpu(s->l2_hot_set_offsets[i]);
+            }
+
+#ifdef DEBUG_EXT
+            printf("Qcow2: Got L2 hot set with %d entries\n",
+                   s->l2_hot_set_size);
+#endif
+            break;
+        }
+
         default:
             /* unknown magic - save it in case we need to rewrite the header */
             /* If you add a new feature, make sure to also update the fast
@@ -614,6 +648,13 @@ qcow2_co_check_locked(BlockDriverState *bs, BdrvCheckResult *result,
 
     memset(result, 0, sizeof(*result));
 
+    /*
+     * Reserved but unused arena clusters and deferred refcount decrements
+     * would be reported as leaks
+     */
+    qcow2_release_alloc_arenas(bs);
+    qcow2_process_refcount_deltas(bs);
+
     ret = qcow2_check_read_snapshot_table(bs, &snapshot_res, fix);
     if (ret < 0) {
         qcow2_add_check_result(result, &snapshot_res, false);
@@ -817,6 +858,35 @@ static QemuOptsList qcow2_runtime_opts = {
             .type = QEMU_OPT_NUMBER,
             .help = "Clean unused cache entries after this time (in seconds)",
         },
+        {
+            .name = QCOW2_OPT_ALLOC_ARENA_SIZE,
+            .type = QEMU_OPT_SIZE,
+            .help = "Reserve data clusters in ranges of this size for each "
+                    "AioContext (0 to disable)",
+        },
+        {
+            .name = QCOW2_OPT_BATCH_REFCOUNT_UPDATES,
+            .type = QEMU_OPT_BOOL,
+            .help = "Defer refcount decrements and apply them in batches",
+        },
+        {
+            .name = QCOW2_OPT_COALESCE_COW,
+            .type = QEMU_OPT_BOOL,
+            .help = "Merge adjacent writes into pending copy-on-write "
+                    "allocations",
+        },
+        {
+            .name = QCOW2_OPT_L2_HOT_SET,
+            .type = QEMU_OPT_BOOL,
+            .help = "Record the cached L2 slices on close and prefetch them "
+                    "on open",
+        },
+        {
+            .name = QCOW2_OPT_COMPRESSED_READAHEAD,
+            .type = QEMU_OPT_NUMBER,
+            .help = "Number of compressed clusters to decompress ahead of "
+                    "sequential reads (0 to disable)",
+        },
         BLOCK_CRYPTO_OPT_DEF_KEY_SECRET("encrypt.",
             "ID of secret providing qcow2 AES key or LUKS passphrase"),
         { /* end of list */ }
@@ -1051,6 +1121,11 @@ typedef struct Qcow2ReopenState {
     bool discard_passthrough[QCOW2_DISCARD_MAX];
     bool discard_no_unref;
     uint64_t cache_clean_interval;
+    uint64_t alloc_arena_size;
+    bool batch_refcount_updates;
+    uint64_t compressed_readahead;
+    bool coalesce_cow;
+    bool l2_hot_set;
     QCryptoBlockOpenOptions *crypto_opts; /* Disk encryption runtime options */
 } Qcow2ReopenState;
 
@@ -1229,6 +1304,37 @@ qcow2_update_options_prepare(BlockDriverState *bs, Qcow2ReopenState *r,
         goto fail;
     }
 
+    r->alloc_arena_size = qemu_opt_get_size(opts, QCOW2_OPT_ALLOC_ARENA_SIZE,
+                                            0);
+    if (!QEMU_IS_ALIGNED(r->alloc_arena_size, s->cluster_size)) {
+        error_setg(errp, QCOW2_OPT_ALLOC_ARENA_SIZE " must be a multiple of "
+                   "the cluster size");
+        ret = -EINVAL;
+        goto fail;
+    }
+    if (r->alloc_arena_size > QCOW2_MAX_ALLOC_ARENA_SIZE) {
+        error_setg(errp, QCOW2_OPT_ALLOC_ARENA_SIZE " must not exceed %"
+                   PRIu64 " bytes", (uint64_t) QCOW2_MAX_ALLOC_ARENA_SIZE);
+        ret = -EINVAL;
+        goto fail;
+    }
+
+    r->batch_refcount_updates =
+        qemu_opt_get_bool(opts, QCOW2_OPT_BATCH_REFCOUNT_UPDATES, false);
+
+    r->coalesce_cow = qemu_opt_get_bool(opts, QCOW2_OPT_COALESCE_COW, false);
+
+    r->l2_hot_set = qemu_opt_get_bool(opts, QCOW2_OPT_L2_HOT_SET, false);
+
+    r->compressed_readahead =
+        qemu_opt_get_number(opts, QCOW2_OPT_COMPRESSED_READAHEAD, 0);
+    if (r->compressed_readahead > QCOW2_MAX_COMPRESSED_READAHEAD) {
+        error_setg(errp, QCOW2_OPT_COMPRESSED_READAHEAD " must not exceed %d",
+                   QCOW2_MAX_COMPRESSED_READAHEAD);
+        ret = -EINVAL;
+        goto fail;
+    }
+
     switch (s->crypt_method_header) {
     case QCOW_CRYPT_NONE:
         if (encryptfmt) {
@@ -1327,6 +1433,13 @@ static void qcow2_update_options_commit(BlockDriverState *bs,
     s->cache_clean_interval = r->cache_clean_interval;
     cache_clean_timer_init(bs, bdrv_get_aio_context(bs));
 
+    /* Not in mutable_opts, so these can only be set when opening the image */
+    s->alloc_arena_size = r->alloc_arena_size;
+    s->batch_refcount_updates = r->batch_refcount_updates;
+    s->compressed_readahead = r->compressed_readahead;
+    s->coalesce_cow = r->coalesce_cow;
+    s->l2_hot_set = r->l2_hot_set;
+
     qapi_free_QCryptoBlockOpenOptions(s->crypto_opts);
     s->crypto_opts = r->crypto_opts;
 }
@@ -1397,6 +1510,141 @@ static int validate_compression_type(BDRVQcow2State *s, Error **errp)
     return 0;
 }
 
+/* Largest read issued to prefetch adjacent L2 slices of the hot set */
+#define QCOW2_L2_HOT_SET_MAX_READ (1 * MiB)
+
+/* Called with s->lock held */
+static bool qcow2_is_active_l2_table(BDRVQcow2State *s, uint64_t l2_offset)
+{
+    int i;
+
+    for (i = 0; i < s->l1_size; i++) {
+        if ((s->l1_table[i] & L1E_OFFSET_MASK) == l2_offset) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Reads the L2 slices recorded in the L2 hot set into the L2 cache.  Slices
+ * that are adjacent in the image file are read with a single request.  Only
+ * slices of L2 tables that are referenced by the active L1 table are loaded,
+ * so a stale hot set cannot bring anything else into the cache.
+ */
+static void coroutine_fn GRAPH_RDLOCK
+qcow2_co_prefetch_l2_hot_set(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+    size_t slice_size = s->l2_slice_size * l2_entry_size(s);
+    g_autofree uint64_t *offsets = NULL;
+    uint8_t *buf;
+    int i, j, k, n = 0;
+    int ret;
+
+    buf = qemu_try_blockalign(bs->file->bs, QCOW2_L2_HOT_SET_MAX_READ);
+    if (buf == NULL) {
+        return;
+    }
+    offsets = g_memdup2(s->l2_hot_set_offsets,
+                        s->l2_hot_set_size * sizeof(uint64_t));
+
+    /*
+     * The hot set is stored sorted by offset, but the slice size may have
+     * changed since it was written: align the offsets to the current slice
+     * size and drop duplicates.  The prefetched entries must all fit into
+     * the cache at the same time.
+     */
+    for (i = 0; i < s->l2_hot_set_size; i++) {
+        uint64_t offset = QEMU_ALIGN_DOWN(offsets[i], slice_size);
+
+        if (offset != 0 && (n == 0 || offsets[n - 1] != offset)) {
+            offsets[n++] = offset;
+        }
+    }
+    n = MIN(n, qcow2_cache_get_size(s->l2_table_cache));
+
+    trace_qcow2_prefetch_l2_hot_set(bs, n);
+
+    for (i = 0; i < n; i = j) {
+        j = i + 1;
+        while (j < n && offsets[j] == offsets[j - 1] + slice_size &&
+               (j - i + 1) * slice_size <= QCOW2_L2_HOT_SET_MAX_READ) {
+            j++;
+        }
+
+        qemu_co_mutex_lock(&s->lock);
+        ret = bdrv_co_pread(bs->file, offsets[i], (j - i) * slice_size, buf, 0);
+        for (k = i; ret >= 0 && k < j; k++) {
+            void *table;
+
+            if (qcow2_cache_is_table_offset(s->l2_table_cache, offsets[k]) ||
+                !qcow2_is_active_l2_table(s, start_of_cluster(s, offsets[k]))) {
+                continue;
+            }
+
+            ret = qcow2_cache_get_empty(bs, s->l2_table_cache, offsets[k],
+                                        &table);
+            if (ret >= 0) {
+                memcpy(table, buf + (k - i) * slice_size, slice_size);
+                qcow2_cache_put(s->l2_table_cache, &table);
+            }
+        }
+        qemu_co_mutex_unlock(&s->lock);
+
+        if (ret < 0) {
+            break;
+        }
+    }
+
+    qemu_vfree(buf);
+}
+
+static void coroutine_fn qcow2_prefetch_l2_hot_set_entry(void *opaque)
+{
+    BlockDriverState *bs = opaque;
+
+    bdrv_graph_co_rdlock();
+    qcow2_co_prefetch_l2_hot_set(bs);
+    bdrv_graph_co_rdunlock();
+    bdrv_dec_in_flight(bs);
+}
+
+/*
+ * Stores the most recently used L2 slices in the L2 hot set header extension.
+ * Errors are not fatal because the hot set is only a hint.
+ */
+static void GRAPH_RDLOCK qcow2_store_l2_hot_set(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t *offsets;
+    int n, ret;
+
+    if (!s->l2_hot_set || bdrv_is_read_only(bs)) {
+        return;
+    }
+
+    offsets = g_new(uint64_t, QCOW2_MAX_L2_HOT_SET);
+    n = qcow2_cache_get_hot_offsets(s->l2_table_cache, offsets,
+                                    QCOW2_MAX_L2_HOT_SET);
+    if (n == s->l2_hot_set_size &&
+        (n == 0 || !memcmp(offsets, s->l2_hot_set_offsets,
+                           n * sizeof(*offsets)))) {
+        g_free(offsets);
+        return;
+    }
+
+    g_free(s->l2_hot_set_offsets);
+    s->l2_hot_set_offsets = offsets;
+    s->l2_hot_set_size = n;
+
+    ret = qcow2_update_header(bs);
+    if (ret < 0) {
+        warn_report("Failed to store the L2 hot set of node '%s': %s",
+                    bdrv_get_device_or_node_name(bs), strerror(-ret));
+    }
+}
+
 /* Called with s->lock held.  */
 static int coroutine_fn GRAPH_RDLOCK
 qcow2_do_open(BlockDriverState *bs, QDict *options, int flags,
@@ -1971,10 +2219,24 @@ qcow2_do_open(BlockDriverState *bs, QDict *options, int flags,
 #endif
 
     qemu_co_queue_init(&s->thread_task_queue);
+    s->max_threads = MAX(QCOW2_MAX_THREADS, g_get_num_processors());
+    qemu_co_queue_init(&s->compressed_alloc_queue);
+
+    if (s->l2_hot_set && s->l2_hot_set_size > 0 &&
+        !(flags & (BDRV_O_INACTIVE | BDRV_O_CHECK))) {
+        /* Drained sections wait for the prefetch to complete */
+        bdrv_inc_in_flight(bs);
+        aio_co_enter(bdrv_get_aio_context(bs),
+                     qemu_coroutine_create(qcow2_prefetch_l2_hot_set_entry,
+                                           bs));
+    }
 
     return ret;
 
  fail:
+    g_free(s->l2_hot_set_offsets);
+    s->l2_hot_set_offsets = NULL;
+    s->l2_hot_set_size = 0;
     g_free(s->image_data_file);
     if (open_data_file && has_data_file(bs)) {
         bdrv_graph_co_rdunlock();
@@ -2047,6 +2309,8 @@ static int qcow2_open(BlockDriverState *bs, QDict *options, int flags,
     /* Initialise locks */
     qemu_co_mutex_init(&s->lock);
     qemu_co_queue_init(&s->cache_clean_timer_exit);
+    qcow2_decompressed_cache_init(s);
+    qcow2_backing_cache_init(s);
 
     assert(!qemu_in_coroutine());
     assert(qemu_get_current_aio_context() == qemu_get_aio_context());
@@ -2287,6 +2551,7 @@ qcow2_handle_l2meta(BlockDriverState *bs, QCowL2Meta **pl2meta, bool link_l2)
 
     while (l2meta != NULL) {
         QCowL2Meta *next;
+        Qcow2MergedWrite *mw;
 
         if (link_l2) {
             ret = qcow2_alloc_cluster_link_l2(bs, l2meta);
@@ -2300,6 +2565,13 @@ qcow2_handle_l2meta(BlockDriverState *bs, QCowL2Meta **pl2meta, bool link_l2)
         /* Take the request off the list of running requests */
         QLIST_REMOVE(l2meta, next_in_flight);
 
+        QLIST_FOREACH(mw, &l2meta->merged_writes, next) {
+            mw->ret = link_l2 ? 0 : -EIO;
+        }
+        if (l2meta->data_qiov == &l2meta->merged_qiov) {
+            qemu_iovec_destroy(&l2meta->merged_qiov);
+        }
+
         qemu_co_queue_restart_all(&l2meta->dependent_requests);
 
         next = l2meta->next;
@@ -2430,8 +2702,7 @@ qcow2_co_preadv_task(BlockDriverState *bs, QCow2SubclusterType subc_type,
         assert(bs->backing); /* otherwise handled in qcow2_co_preadv_part */
 
         BLKDBG_CO_EVENT(bs->file, BLKDBG_READ_BACKING_AIO);
-        return bdrv_co_preadv_part(bs->backing, offset, bytes,
-                                   qiov, qiov_offset, 0);
+        return qcow2_co_preadv_backing(bs, offset, bytes, qiov, qiov_offset);
 
     case QCOW2_SUBCLUSTER_COMPRESSED:
         return qcow2_co_preadv_compressed(bs, host_offset,
@@ -2611,6 +2882,125 @@ is_zero_cow(BlockDriverState *bs, QCowL2Meta *m)
                                 m->cow_end.nb_bytes);
 }
 
+/*
+ * Lets writes that directly follow the guest data of @l2meta be merged into
+ * the allocation before its COW is performed.
+ *
+ * Called with s->lock held. The lock is dropped while the coroutine yields
+ * once, so that other requests that are ready to run (e.g. the rest of a
+ * batch of adjacent writes submitted together by the guest) can get to
+ * qcow2_merge_into_pending_cow().
+ */
+static void coroutine_fn
+wait_for_cow_merges(BlockDriverState *bs, QCowL2Meta *l2meta)
+{
+    BDRVQcow2State *s = bs->opaque;
+    QCowL2Meta *m;
+
+    for (m = l2meta; m != NULL; m = m->next) {
+        if (m->data_qiov && m->cow_end.nb_bytes) {
+            break;
+        }
+    }
+    if (!m) {
+        return;
+    }
+
+    m->accept_merges = true;
+    qemu_co_mutex_unlock(&s->lock);
+
+    aio_co_schedule(qemu_get_current_aio_context(), qemu_coroutine_self());
+    qemu_coroutine_yield();
+
+    qemu_co_mutex_lock(&s->lock);
+    m->accept_merges = false;
+}
+
+/*
+ * Tries to merge a write of @bytes at @offset into an in-flight allocation
+ * that accepts merges (see wait_for_cow_merges()). This works if the write
+ * starts exactly where the guest data of the allocation ends and fits into
+ * its tail COW region: the COW region shrinks accordingly and the data of
+ * both requests is written together with the remaining COW data.
+ *
+ * On success, waits for the allocation to complete and returns true with
+ * the result of the write in @mw->ret.
+ *
+ * Called with s->lock held.
+ */
+static bool coroutine_fn
+qcow2_merge_into_pending_cow(BlockDriverState *bs, uint64_t offset,
+                             uint64_t bytes, QEMUIOVector *qiov,
+                             size_t qiov_offset, Qcow2MergedWrite *mw)
+{
+    BDRVQcow2State *s = bs->opaque;
+    QCowL2Meta *m, *target = NULL;
+    Qcow2COWRegion *end;
+    unsigned data_bytes;
+
+    QLIST_FOREACH(m, &s->cluster_allocs, next_in_flight) {
+        if (offset + bytes <= l2meta_cow_start(m) ||
+            offset >= l2meta_cow_end(m))
+        {
+            continue;
+        }
+        if (target || !m->accept_merges) {
+            return false;
+        }
+        target = m;
+    }
+
+    if (!target) {
+        return false;
+    }
+
+    /*
+     * perform_cow() only writes the guest data if there is COW to do, so
+     * don't let the COW regions become empty
+     */
+    end = &target->cow_end;
+    if (offset != target->offset + end->offset || bytes > end->nb_bytes ||
+        (bytes == end->nb_bytes && target->cow_start.nb_bytes == 0))
+    {
+        return false;
+    }
+
+    data_bytes = end->offset -
+                 (target->cow_start.offset + target->cow_start.nb_bytes);
+    if (qemu_iovec_subvec_niov(target->data_qiov, target->data_qiov_offset,
+                               data_bytes) +
+        qemu_iovec_subvec_niov(qiov, qiov_offset, bytes) > IOV_MAX - 2)
+    {
+        return false;
+    }
+
+    if (target->data_qiov != &target->merged_qiov) {
+        QEMUIOVector *data_qiov = target->data_qiov;
+
+        qemu_iovec_init(&target->merged_qiov, data_qiov->niov + qiov->niov);
+        qemu_iovec_concat(&target->merged_qiov, data_qiov,
+                          target->data_qiov_offset, data_bytes);
+        target->data_qiov = &target->merged_qiov;
+        target->data_qiov_offset = 0;
+    }
+    qemu_iovec_concat(&target->merged_qiov, qiov, qiov_offset, bytes);
+
+    end->offset += bytes;
+    end->nb_bytes -= bytes;
+
+    trace_qcow2_merge_into_pending_cow(qemu_coroutine_self(), offset, bytes,
+                                       target->offset);
+
+    mw->ret = -EINPROGRESS;
+    QLIST_INSERT_HEAD(&target->merged_writes, mw, next);
+
+    /* @target is freed once this returns, don't touch it afterwards */
+    qemu_co_queue_wait(&target->dependent_requests, &s->lock);
+    assert(mw->ret != -EINPROGRESS);
+
+    return true;
+}
+
 static int coroutine_fn GRAPH_RDLOCK
 handle_alloc_space(BlockDriverState *bs, QCowL2Meta *l2meta)
 {
@@ -2729,6 +3119,10 @@ int qcow2_co_pwritev_task(BlockDriverState *bs, uint64_t host_offset,
 
     qemu_co_mutex_lock(&s->lock);
 
+    if (s->coalesce_cow && !bs->encrypted) {
+        wait_for_cow_merges(bs, l2meta);
+    }
+
     ret = qcow2_handle_l2meta(bs, &l2meta, true);
     goto out_locked;
 
@@ -2774,6 +3168,21 @@ qcow2_co_pwritev_part(BlockDriverState *bs, int64_t offset, int64_t bytes,
 
     trace_qcow2_writev_start_req(qemu_coroutine_self(), offset, bytes);
 
+    if (s->coalesce_cow && !bs->encrypted) {
+        Qcow2MergedWrite mw;
+        bool merged;
+
+        qemu_co_mutex_lock(&s->lock);
+        merged = qcow2_merge_into_pending_cow(bs, offset, bytes, qiov,
+                                              qiov_offset, &mw);
+        qemu_co_mutex_unlock(&s->lock);
+
+        if (merged) {
+            trace_qcow2_writev_done_req(qemu_coroutine_self(), mw.ret);
+            return mw.ret;
+        }
+    }
+
     while (bytes != 0 && aio_task_pool_status(aio) == 0) {
 
         l2meta = NULL;
@@ -2848,6 +3257,9 @@ static int GRAPH_RDLOCK qcow2_inactivate(BlockDriverState *bs)
     int ret, result = 0;
     Error *local_err = NULL;
 
+    qcow2_release_alloc_arenas(bs);
+    qcow2_process_refcount_deltas(bs);
+
     qcow2_store_persistent_dirty_bitmaps(bs, true, &local_err);
     if (local_err != NULL) {
         result = -EINVAL;
@@ -2871,6 +3283,7 @@ static int GRAPH_RDLOCK qcow2_inactivate(BlockDriverState *bs)
     }
 
     if (result == 0) {
+        qcow2_store_l2_hot_set(bs);
         qcow2_mark_clean(bs);
     }
 
@@ -2900,6 +3313,17 @@ qcow2_do_close(BlockDriverState *bs, bool close_data_file)
     g_free(s->unknown_header_fields);
     cleanup_unknown_header_ext(bs);
 
+    assert(s->nb_refcount_deltas == 0);
+    g_free(s->refcount_deltas);
+    s->refcount_deltas = NULL;
+
+    qcow2_decompressed_cache_destroy(s);
+    qcow2_backing_cache_destroy(s);
+
+    g_free(s->l2_hot_set_offsets);
+    s->l2_hot_set_offsets = NULL;
+    s->l2_hot_set_size = 0;
+
     g_free(s->image_data_file);
     g_free(s->image_backing_file);
     g_free(s->image_backing_format);
@@ -2918,6 +3342,14 @@ qcow2_do_close(BlockDriverState *bs, bool close_data_file)
     qcow2_free_snapshots(bs);
 }
 
+static void qcow2_drain_begin(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+
+    /* The backing chain can only change while drained */
+    qcow2_backing_cache_invalidate(s);
+}
+
 static void GRAPH_UNLOCKED qcow2_close(BlockDriverState *bs)
 {
     GLOBAL_STATE_CODE();
@@ -2960,6 +3392,8 @@ qcow2_co_invalidate_cache(BlockDriverState *bs, Error **errp)
     /* Re-initialize objects initialized in qcow2_open() */
     qemu_co_mutex_init(&s->lock);
     qemu_co_queue_init(&s->cache_clean_timer_exit);
+    qcow2_decompressed_cache_init(s);
+    qcow2_backing_cache_init(s);
 
     options = qdict_clone_shallow(bs->options);
 
@@ -3226,6 +3660,35 @@ int qcow2_update_header(BlockDriverState *bs)
         buflen -= ret;
     }
 
+    /*
+     * L2 hot set extension.  This is only a hint, so leave it out rather than
+     * fail if it does not fit next to the end marker and backing file name.
+     */
+    if (s->l2_hot_set_size > 0) {
+        size_t hot_set_len = s->l2_hot_set_size * sizeof(uint64_t);
+        size_t needed = sizeof(QCowExtension) + hot_set_len +
+                        sizeof(QCowExtension) +
+                        (s->image_backing_file ?
+                         strlen(s->image_backing_file) : 0);
+
+        if (buflen >= needed) {
+            g_autofree uint64_t *hot_set = g_new(uint64_t, s->l2_hot_set_size);
+            int i;
+
+            for (i = 0; i < s->l2_hot_set_size; i++) {
+                hot_set[i] = cpu_to_be64(s->l2_hot_set_offsets[i]);
+            }
+            ret = header_ext_add(buf, QCOW2_EXT_MAGIC_L2_HOT_SET,
+                                 hot_set, hot_set_len, buflen);
+            if (ret < 0) {
+                goto fail;
+            }
+
+            buf += ret;
+            buflen -= ret;
+        }
+    }
+
     /* End of header extensions */
     ret = header_ext_add(buf, QCOW2_EXT_MAGIC_END, NULL, 0, buflen);
     if (ret < 0) {
@@ -4410,6 +4873,9 @@ qcow2_co_truncate(BlockDriverState *bs, int64_t offset, bool exact,
 
     qemu_co_mutex_lock(&s->lock);
 
+    qcow2_release_alloc_arenas(bs);
+    qcow2_process_refcount_deltas(bs);
+
     /*
      * Even though we store snapshot size for all images, it was not
      * required until v3, so it is not safe to proceed for v2.
@@ -4766,14 +5232,18 @@ qcow2_co_pwritev_compressed_task(BlockDriverState *bs,
                                  QEMUIOVector *qiov, size_t qiov_offset)
 {
     BDRVQcow2State *s = bs->opaque;
-    int ret;
+    int ret = 0;
     ssize_t out_len;
     uint8_t *buf, *out_buf;
     uint64_t cluster_offset;
+    uint64_t seq;
 
     assert(bytes == s->cluster_size || (bytes < s->cluster_size &&
            (offset + bytes == bs->total_sectors << BDRV_SECTOR_BITS)));
 
+    /* Must be taken before the first yield to preserve the issue order */
+    seq = qatomic_fetch_inc(&s->compressed_seq);
+
     buf = qemu_blockalign(bs, s->cluster_size);
     if (bytes < s->cluster_size) {
         /* Zero-pad last write if image size is not cluster aligned */
@@ -4785,6 +5255,24 @@ qcow2_co_pwritev_compressed_task(BlockDriverState *bs,
 
     out_len = qcow2_co_compress(bs, out_buf, s->cluster_size - 1,
                                 buf, s->cluster_size);
+
+    qemu_co_mutex_lock(&s->lock);
+    while (s->compressed_alloc_seq != seq) {
+        qemu_co_queue_wait(&s->compressed_alloc_queue, &s->lock);
+    }
+    if (out_len >= 0) {
+        ret = qcow2_alloc_compressed_cluster_offset(bs, offset, out_len,
+                                                    &cluster_offset);
+        if (ret == 0) {
+            ret = qcow2_pre_write_overlap_check(bs, 0, cluster_offset,
+                                                out_len, true);
+        }
+    }
+    /* Let the next write allocate, even if this one failed */
+    s->compressed_alloc_seq++;
+    qemu_co_queue_restart_all(&s->compressed_alloc_queue);
+    qemu_co_mutex_unlock(&s->lock);
+
     if (out_len == -ENOMEM) {
         /* could not compress: write normal cluster */
         ret = qcow2_co_pwritev_part(bs, offset, bytes, qiov, qiov_offset, 0);
@@ -4796,17 +5284,6 @@ qcow2_co_pwritev_compressed_task(BlockDriverState *bs,
         ret = -EINVAL;
         goto fail;
     }
-
-    qemu_co_mutex_lock(&s->lock);
-    ret = qcow2_alloc_compressed_cluster_offset(bs, offset, out_len,
-                                                &cluster_offset);
-    if (ret < 0) {
-        qemu_co_mutex_unlock(&s->lock);
-        goto fail;
-    }
-
-    ret = qcow2_pre_write_overlap_check(bs, 0, cluster_offset, out_len, true);
-    qemu_co_mutex_unlock(&s->lock);
     if (ret < 0) {
         goto fail;
     }
@@ -4916,36 +5393,24 @@ qcow2_co_preadv_compressed(BlockDriverState *bs,
                            size_t qiov_offset)
 {
     BDRVQcow2State *s = bs->opaque;
-    int ret = 0, csize;
-    uint64_t coffset;
-    uint8_t *buf, *out_buf;
+    int ret;
+    uint8_t *out_buf;
     int offset_in_cluster = offset_into_cluster(s, offset);
 
-    qcow2_parse_compressed_l2_entry(bs, l2_entry, &coffset, &csize);
-
-    buf = g_try_malloc(csize);
-    if (!buf) {
-        return -ENOMEM;
+    if (s->compressed_readahead) {
+        return qcow2_co_preadv_decompressed_cached(bs, l2_entry, offset, bytes,
+                                                   qiov, qiov_offset);
     }
 
     out_buf = qemu_blockalign(bs, s->cluster_size);
 
-    BLKDBG_CO_EVENT(bs->file, BLKDBG_READ_COMPRESSED);
-    ret = bdrv_co_pread(bs->file, coffset, csize, buf, 0);
-    if (ret < 0) {
-        goto fail;
-    }
-
-    if (qcow2_co_decompress(bs, out_buf, s->cluster_size, buf, csize) < 0) {
-        ret = -EIO;
-        goto fail;
+    ret = qcow2_co_read_compressed_cluster(bs, l2_entry, out_buf);
+    if (ret == 0) {
+        qemu_iovec_from_buf(qiov, qiov_offset, out_buf + offset_in_cluster,
+                            bytes);
     }
 
-    qemu_iovec_from_buf(qiov, qiov_offset, out_buf + offset_in_cluster, bytes);
-
-fail:
     qemu_vfree(out_buf);
-    g_free(buf);
 
     return ret;
 }
@@ -5108,6 +5573,9 @@ static int GRAPH_RDLOCK qcow2_make_empty(BlockDriverState *bs)
     int step = QEMU_ALIGN_DOWN(INT_MAX, s->cluster_size);
     int l1_clusters, ret = 0;
 
+    qcow2_release_alloc_arenas(bs);
+    qcow2_process_refcount_deltas(bs);
+
     l1_clusters = DIV_ROUND_UP(s->l1_size, s->cluster_size / L1E_SIZE);
 
     if (s->qcow_version >= 3 && !s->snapshots && !s->nb_bitmaps &&
@@ -5123,6 +5591,9 @@ static int GRAPH_RDLOCK qcow2_make_empty(BlockDriverState *bs)
          * refcount block) have to fit inside one refcount block. It
          * only resets the image file, i.e. does not work with an
          * external data file. */
+        g_free(s->l2_hot_set_offsets);
+        s->l2_hot_set_offsets = NULL;
+        s->l2_hot_set_size = 0;
         return make_completely_empty(bs);
     }
 
@@ -5416,6 +5887,25 @@ qcow2_get_specific_info(BlockDriverState *bs, Error **errp)
     return spec_info;
 }
 
+static BlockStatsSpecific *qcow2_get_specific_stats(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+    BlockStatsSpecific *stats;
+
+    if (!s->l2_table_cache || !s->refcount_block_cache) {
+        return NULL;
+    }
+
+    stats = g_new(BlockStatsSpecific, 1);
+    stats->driver = BLOCKDEV_DRIVER_QCOW2;
+    stats->u.qcow2 = (BlockStatsSpecificQcow2) {
+        .l2_cache = qcow2_cache_get_shard_stats(s->l2_table_cache),
+        .refcount_cache = qcow2_cache_get_shard_stats(s->refcount_block_cache),
+    };
+
+    return stats;
+}
+
 static int coroutine_mixed_fn GRAPH_RDLOCK
 qcow2_has_zero_init(BlockDriverState *bs)
 {
@@ -6234,6 +6724,7 @@ BlockDriver bdrv_qcow2 = {
     .bdrv_probe                         = qcow2_probe,
     .bdrv_open                          = qcow2_open,
     .bdrv_close                         = qcow2_close,
+    .bdrv_drain_begin                   = qcow2_drain_begin,
     .bdrv_reopen_prepare                = qcow2_reopen_prepare,
     .bdrv_reopen_commit                 = qcow2_reopen_commit,
     .bdrv_reopen_commit_post            = qcow2_reopen_commit_post,
@@ -6265,6 +6756,7 @@ BlockDriver bdrv_qcow2 = {
     .bdrv_measure                       = qcow2_measure,
     .bdrv_co_get_info                   = qcow2_co_get_info,
     .bdrv_get_specific_info             = qcow2_get_specific_info,
+    .bdrv_get_specific_stats            = qcow2_get_specific_stats,
 
     .bdrv_co_save_vmstate               = qcow2_co_save_vmstate,
     .bdrv_co_load_vmstate               = qcow2_co_load_vmstate,
@@ -6282,6 +6774,7 @@ BlockDriver bdrv_qcow2 = {
     .strong_runtime_opts                = qcow2_strong_runtime_opts,
     .mutable_opts                       = mutable_opts,
     .bdrv_co_check                      = qcow2_co_check,
+    .bdrv_co_dedup                      = qcow2_co_dedup,
     .bdrv_amend_options                 = qcow2_amend_options,
     .bdrv_co_amend                      = qcow2_co_amend,
 
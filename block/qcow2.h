@@ -27,6 +27,7 @@
 
 #include "crypto/block.h"
 #include "qemu/coroutine.h"
+#include "qemu/interval-tree.h"
 #include "qemu/units.h"
 #include "block/block_int.h"
 
@@ -150,6 +151,22 @@
 #define QCOW2_OPT_L2_CACHE_ENTRY_SIZE "l2-cache-entry-size"
 #define QCOW2_OPT_REFCOUNT_CACHE_SIZE "refcount-cache-size"
 #define QCOW2_OPT_CACHE_CLEAN_INTERVAL "cache-clean-interval"
+#define QCOW2_OPT_ALLOC_ARENA_SIZE "alloc-arena-size"
+#define QCOW2_OPT_BATCH_REFCOUNT_UPDATES "batch-refcount-updates"
+#define QCOW2_OPT_COMPRESSED_READAHEAD "compressed-readahead"
+#define QCOW2_OPT_COALESCE_COW "coalesce-cow"
+#define QCOW2_OPT_L2_HOT_SET "l2-hot-set"
+
+#define QCOW2_MAX_ALLOC_ARENA_SIZE (1 * GiB)
+
+/* Number of pending refcount decrements after which they are applied */
+#define QCOW2_MAX_REFCOUNT_DELTAS 4096
+
+/* Maximum number of compressed clusters decompressed ahead of the guest */
+#define QCOW2_MAX_COMPRESSED_READAHEAD 64
+
+/* Maximum number of L2 slices recorded in the L2 hot set header extension */
+#define QCOW2_MAX_L2_HOT_SET 512
 
 typedef struct QCowHeader {
     uint32_t magic;
@@ -303,6 +320,24 @@ typedef struct Qcow2Feature {
     char    name[46];
 } QEMU_PACKED Qcow2Feature;
 
+/*
+ * Range of clusters that has been reserved (its refcount has already been
+ * incremented) for the allocating writes issued from one AioContext.
+ */
+typedef struct Qcow2AllocArena {
+    AioContext *ctx;
+    uint64_t next;  /* host offset of the first unused cluster */
+    uint64_t end;   /* end of the reserved range */
+    QLIST_ENTRY(Qcow2AllocArena) next_arena;
+} Qcow2AllocArena;
+
+/* A pending decrement by one of the refcounts of a range of clusters */
+typedef struct Qcow2RefcountDelta {
+    uint64_t cluster_index;
+    uint64_t nb_clusters;
+    enum qcow2_discard_type type;
+} Qcow2RefcountDelta;
+
 typedef struct Qcow2DiscardRegion {
     BlockDriverState *bs;
     uint64_t offset;
@@ -322,8 +357,26 @@ typedef struct Qcow2BitmapHeaderExt {
     uint64_t bitmap_directory_offset;
 } QEMU_PACKED Qcow2BitmapHeaderExt;
 
+/* Lower bound for BDRVQcow2State.max_threads on hosts with few CPUs */
 #define QCOW2_MAX_THREADS 4
 
+/* A cluster in the decompressed cluster cache, keyed by its L2 entry */
+typedef struct Qcow2DecompressedCluster {
+    uint64_t l2_entry;
+    uint64_t coffset;
+    int csize;
+    uint64_t guest_offset;  /* guest cluster that the entry was loaded for */
+    void *data;
+
+    int ref;
+    bool in_cache;          /* false once evicted or invalidated */
+    bool loading;           /* data is being read and decompressed */
+    int ret;                /* result of loading */
+    CoQueue loading_queue;  /* coroutines waiting for loading to finish */
+
+    QTAILQ_ENTRY(Qcow2DecompressedCluster) next;
+} Qcow2DecompressedCluster;
+
 typedef struct BDRVQcow2State {
     int cluster_bits;
     int cluster_size;
@@ -404,6 +457,52 @@ typedef struct BDRVQcow2State {
     QTAILQ_HEAD (, Qcow2DiscardRegion) discards;
     bool cache_discards;
 
+    /* Per-AioContext data cluster arenas, only used if alloc_arena_size > 0 */
+    uint64_t alloc_arena_size;
+    QLIST_HEAD(, Qcow2AllocArena) alloc_arenas;
+
+    /*
+     * Refcount decrements that have been deferred so that they can be applied
+     * in one pass sorted by offset, only used if batch_refcount_updates is set
+     */
+    bool batch_refcount_updates;
+    Qcow2RefcountDelta *refcount_deltas;
+    int nb_refcount_deltas;
+
+    /*
+     * LRU cache of decompressed clusters (most recently used first), filled
+     * by guest reads and by read-ahead of the next compressed_readahead
+     * clusters when the guest reads compressed clusters sequentially
+     */
+    int compressed_readahead;
+    QemuMutex decompressed_lock;
+    QTAILQ_HEAD(, Qcow2DecompressedCluster) decompressed_clusters;
+    int nb_decompressed_clusters;
+    uint64_t readahead_next;    /* guest cluster expected to be read next */
+    uint64_t readahead_end;     /* read-ahead is started up to this cluster */
+
+    /*
+     * Layer of the backing chain that holds the data of recently read guest
+     * ranges, see qcow2-backing.c.  Protected by backing_cache_lock, which
+     * is never held across a yield.
+     */
+    QemuMutex backing_cache_lock;
+    IntervalTreeRoot backing_cache;
+    int nb_backing_cache_entries;
+    GArray *backing_cache_chain;    /* layers the entries were added for */
+    uint64_t backing_cache_gen;     /* incremented when entries are dropped */
+
+    bool coalesce_cow;
+
+    /*
+     * Host offsets of the L2 slices that were cached when the image was last
+     * closed, as stored in the L2 hot set header extension.  If l2_hot_set
+     * is set, they are prefetched on open and updated on inactivation.
+     */
+    bool l2_hot_set;
+    uint64_t *l2_hot_set_offsets;
+    int l2_hot_set_size;
+
     /* Backing file path and format as stored in the image (this is not the
      * effective path/format, which may be the result of a runtime option
      * override) */
@@ -413,6 +512,18 @@ typedef struct BDRVQcow2State {
 
     CoQueue thread_task_queue;
     int nb_threads;
+    int max_threads;
+
+    /*
+     * Compressed clusters are allocated in the order in which the writes
+     * were issued, even though they are compressed in parallel and may
+     * finish compressing in any order.  compressed_seq is the ticket of the
+     * next compressed write, compressed_alloc_seq the ticket that may
+     * allocate next; both are protected by lock.
+     */
+    uint64_t compressed_seq;
+    uint64_t compressed_alloc_seq;
+    CoQueue compressed_alloc_queue;
 
     BdrvChild *data_file;
 
@@ -438,6 +549,16 @@ typedef struct Qcow2COWRegion {
     unsigned    nb_bytes;
 } Qcow2COWRegion;
 
+/**
+ * A guest write whose data has been merged into the data write of another
+ * request's allocation (see QCowL2Meta.merged_writes)
+ */
+typedef struct Qcow2MergedWrite {
+    /** -EINPROGRESS until the allocation it was merged into is done */
+    int ret;
+    QLIST_ENTRY(Qcow2MergedWrite) next;
+} Qcow2MergedWrite;
+
 /**
  * Describes an in-flight (part of a) write request that writes to clusters
  * that need to have their L2 table entries updated (because they are
@@ -499,6 +620,18 @@ typedef struct QCowL2Meta
     QEMUIOVector *data_qiov;
     size_t data_qiov_offset;
 
+    /**
+     * Set while the allocation waits for adjacent writes to be merged into
+     * it. Such writes are appended to the guest data, shrinking @cow_end.
+     */
+    bool accept_merges;
+
+    /** Combined guest data once other writes have been merged */
+    QEMUIOVector merged_qiov;
+
+    /** Writes that complete together with this allocation */
+    QLIST_HEAD(, Qcow2MergedWrite) merged_writes;
+
     /** Pointer to next L2Meta of the same write request */
     struct QCowL2Meta *next;
 
@@ -877,6 +1010,11 @@ qcow2_alloc_clusters_at(BlockDriverState *bs, uint64_t offset,
                         int64_t nb_clusters);
 
 int64_t coroutine_fn GRAPH_RDLOCK qcow2_alloc_bytes(BlockDriverState *bs, int size);
+int64_t coroutine_fn GRAPH_RDLOCK
+qcow2_alloc_clusters_arena(BlockDriverState *bs, uint64_t *host_offset,
+                           uint64_t nb_clusters);
+void GRAPH_RDLOCK qcow2_release_alloc_arenas(BlockDriverState *bs);
+void GRAPH_RDLOCK qcow2_process_refcount_deltas(BlockDriverState *bs);
 void GRAPH_RDLOCK qcow2_free_clusters(BlockDriverState *bs,
                                       int64_t offset, int64_t size,
                                       enum qcow2_discard_type type);
@@ -1028,6 +1166,21 @@ qcow2_cache_get_empty(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
 void qcow2_cache_put(Qcow2Cache *c, void **table);
 void *qcow2_cache_is_table_offset(Qcow2Cache *c, uint64_t offset);
 void qcow2_cache_discard(Qcow2Cache *c, void *table);
+Qcow2CacheShardStatsList *qcow2_cache_get_shard_stats(Qcow2Cache *c);
+int qcow2_cache_get_size(Qcow2Cache *c);
+int qcow2_cache_get_hot_offsets(Qcow2Cache *c, uint64_t *offsets, int max);
+
+/* qcow2-dedup.c functions */
+int coroutine_fn GRAPH_RDLOCK
+qcow2_co_dedup(BlockDriverState *bs, int64_t *freed_bytes, Error **errp);
+
+/* qcow2-backing.c functions */
+int coroutine_fn GRAPH_RDLOCK
+qcow2_co_preadv_backing(BlockDriverState *bs, uint64_t offset, uint64_t bytes,
+                        QEMUIOVector *qiov, size_t qiov_offset);
+void qcow2_backing_cache_init(BDRVQcow2State *s);
+void qcow2_backing_cache_invalidate(BDRVQcow2State *s);
+void qcow2_backing_cache_destroy(BDRVQcow2State *s);
 
 /* qcow2-bitmap.c functions */
 int coroutine_fn GRAPH_RDLOCK
@@ -1071,6 +1224,17 @@ qcow2_co_compress(BlockDriverState *bs, void *dest, size_t dest_size,
 ssize_t coroutine_fn
 qcow2_co_decompress(BlockDriverState *bs, void *dest, size_t dest_size,
                     const void *src, size_t src_size);
+int coroutine_fn GRAPH_RDLOCK
+qcow2_co_read_compressed_cluster(BlockDriverState *bs, uint64_t l2_entry,
+                                 void *out_buf);
+int coroutine_fn GRAPH_RDLOCK
+qcow2_co_preadv_decompressed_cached(BlockDriverState *bs, uint64_t l2_entry,
+                                    uint64_t offset, uint64_t bytes,
+                                    QEMUIOVector *qiov, size_t qiov_offset);
+void qcow2_decompressed_cache_init(BDRVQcow2State *s);
+void qcow2_decompressed_cache_invalidate(BDRVQcow2State *s, uint64_t offset,
+                                         uint64_t bytes);
+void qcow2_decompressed_cache_destroy(BDRVQcow2State *s);
 int coroutine_fn
 qcow2_co_encrypt(BlockDriverState *bs, uint64_t host_offset,
                  uint64_t guest_offset, void *buf, size_t len);
@@ -18,6 +18,8 @@
 #include "qemu/module.h"
 #include "qemu/option.h"
 #include "qemu/memalign.h"
+#include "qemu/range.h"
+#include "qemu/timer.h"
 #include "block/block_int.h"
 #include "block/coroutines.h"
 #include "block/qdict.h"
@@ -29,7 +31,12 @@
 #include "qobject/qstring.h"
 #include "crypto/hash.h"
 
-#define HASH_LENGTH 32
+/*
+ * Votes only need to tell apart differing versions of the data read from
+ * the children, not to withstand attacks, so a fast hash is enough.
+ */
+#define HASH_ALGO   QCRYPTO_HASH_ALGO_XXH64
+#define HASH_LENGTH QCRYPTO_HASH_DIGEST_LEN_XXH64
 
 #define INDEXSTR_LEN 32
 
@@ -38,9 +45,12 @@
 #define QUORUM_OPT_REWRITE        "rewrite-corrupted"
 #define QUORUM_OPT_READ_PATTERN   "read-pattern"
 
+/* With read-pattern=lazy-verify, how many reads may await verification */
+#define QUORUM_VERIFY_MAX_IN_FLIGHT 16
+
 /* This union holds a vote hash value */
 typedef union QuorumVoteValue {
-    uint8_t h[HASH_LENGTH];    /* SHA-256 hash */
+    uint8_t h[HASH_LENGTH];    /* data hash */
     int64_t l;                 /* simpler 64 bits hash */
 } QuorumVoteValue;
 
@@ -69,6 +79,18 @@ typedef struct QuorumVotes {
     bool (*compare)(QuorumVoteValue *a, QuorumVoteValue *b);
 } QuorumVotes;
 
+/* A read served by a single child that still has to be verified */
+typedef struct QuorumVerify {
+    BlockDriverState *bs;
+    uint64_t offset;
+    uint64_t bytes;
+    int child;             /* index of the child that served the read */
+    uint8_t *buf;          /* data returned to the guest */
+    /* An overlapping write was issued, the children may now differ */
+    bool stale;
+    QLIST_ENTRY(QuorumVerify) next;
+} QuorumVerify;
+
 /* the following structure holds the state of one quorum instance */
 typedef struct BDRVQuorumState {
     BdrvChild **children;  /* children BlockDriverStates */
@@ -92,6 +114,13 @@ typedef struct BDRVQuorumState {
                             */
 
     QuorumReadPattern read_pattern;
+
+    /* State of read-pattern=lazy-verify, protected by verify_lock */
+    QemuMutex verify_lock;
+    int64_t *latency_ns;   /* average read latency of each child */
+    int verify_in_flight;
+    CoQueue verify_queue;  /* reads waiting for verify_in_flight to drop */
+    QLIST_HEAD(, QuorumVerify) verify_list;
 } BDRVQuorumState;
 
 typedef struct QuorumAIOCB QuorumAIOCB;
@@ -151,7 +180,37 @@ static void quorum_aio_finalize(QuorumAIOCB *acb)
     g_free(acb);
 }
 
-static bool quorum_sha256_compare(QuorumVoteValue *a, QuorumVoteValue *b)
+static void quorum_account_latency(BDRVQuorumState *s, int i, int64_t start)
+{
+    int64_t ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start;
+
+    if (s->read_pattern != QUORUM_READ_PATTERN_LAZY_VERIFY) {
+        return;
+    }
+    qemu_mutex_lock(&s->verify_lock);
+    s->latency_ns[i] = s->latency_ns[i] ? (s->latency_ns[i] * 7 + ns) / 8 : ns;
+    qemu_mutex_unlock(&s->verify_lock);
+}
+
+/* Called before and after writing [offset, offset + bytes) */
+static void quorum_verify_invalidate(BDRVQuorumState *s, uint64_t offset,
+                                     uint64_t bytes)
+{
+    QuorumVerify *v;
+
+    if (s->read_pattern != QUORUM_READ_PATTERN_LAZY_VERIFY) {
+        return;
+    }
+    qemu_mutex_lock(&s->verify_lock);
+    QLIST_FOREACH(v, &s->verify_list, next) {
+        if (ranges_overlap(v->offset, v->bytes, offset, bytes)) {
+            v->stale = true;
+        }
+    }
+    qemu_mutex_unlock(&s->verify_lock);
+}
+
+static bool quorum_hash_compare(QuorumVoteValue *a, QuorumVoteValue *b)
 {
     return !memcmp(a->h, b->h, HASH_LENGTH);
 }
@@ -177,7 +236,7 @@ static QuorumAIOCB *coroutine_fn quorum_aio_get(BlockDriverState *bs,
         .bytes              = bytes,
         .flags              = flags,
         .qiov               = qiov,
-        .votes.compare      = quorum_sha256_compare,
+        .votes.compare      = quorum_hash_compare,
         .votes.vote_list    = QLIST_HEAD_INITIALIZER(acb.votes.vote_list),
     };
 
@@ -393,7 +452,7 @@ static int quorum_compute_hash(QuorumAIOCB *acb, int i, QuorumVoteValue *hash)
     /* XXX - would be nice if we could pass in the Error **
      * and propagate that back, but this quorum code is
      * restricted to just errno values currently */
-    if (qcrypto_hash_bytesv(QCRYPTO_HASH_ALGO_SHA256,
+    if (qcrypto_hash_bytesv(HASH_ALGO,
                             qiov->iov, qiov->niov,
                             &data, &len,
                             NULL) < 0) {
@@ -586,10 +645,12 @@ static void coroutine_fn GRAPH_RDLOCK read_quorum_children_entry(void *opaque)
     BDRVQuorumState *s = acb->bs->opaque;
     int i = co->idx;
     QuorumChildRequest *sacb = &acb->qcrs[i];
+    int64_t start = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
 
     sacb->bs = s->children[i]->bs;
     sacb->ret = bdrv_co_preadv(s->children[i], acb->offset, acb->bytes,
                                &acb->qcrs[i].qiov, 0);
+    quorum_account_latency(s, i, start);
 
     if (sacb->ret == 0) {
         acb->success_count++;
@@ -607,13 +668,21 @@ static void coroutine_fn GRAPH_RDLOCK read_quorum_children_entry(void *opaque)
     }
 }
 
-static int coroutine_fn GRAPH_RDLOCK read_quorum_children(QuorumAIOCB *acb)
+/*
+ * Read from all children except @skip, whose request must already be
+ * accounted for in @acb, into buffers of their own.
+ */
+static void coroutine_fn GRAPH_RDLOCK
+quorum_read_children(QuorumAIOCB *acb, int skip)
 {
     BDRVQuorumState *s = acb->bs->opaque;
     int i;
 
     acb->children_read = s->num_children;
     for (i = 0; i < s->num_children; i++) {
+        if (i == skip) {
+            continue;
+        }
         acb->qcrs[i].buf = qemu_blockalign(s->children[i]->bs, acb->qiov->size);
         qemu_iovec_init(&acb->qcrs[i].qiov, acb->qiov->niov);
         qemu_iovec_clone(&acb->qcrs[i].qiov, acb->qiov, acb->qcrs[i].buf);
@@ -626,6 +695,9 @@ static int coroutine_fn GRAPH_RDLOCK read_quorum_children(QuorumAIOCB *acb)
             .idx = i,
         };
 
+        if (i == skip) {
+            continue;
+        }
         co = qemu_coroutine_create(read_quorum_children_entry, &data);
         qemu_coroutine_enter(co);
     }
@@ -633,13 +705,26 @@ static int coroutine_fn GRAPH_RDLOCK read_quorum_children(QuorumAIOCB *acb)
     while (acb->count < s->num_children) {
         qemu_coroutine_yield();
     }
+}
+
+static void quorum_free_children_bufs(QuorumAIOCB *acb)
+{
+    BDRVQuorumState *s = acb->bs->opaque;
+    int i;
 
-    /* Do the vote on read */
-    quorum_vote(acb);
     for (i = 0; i < s->num_children; i++) {
         qemu_vfree(acb->qcrs[i].buf);
         qemu_iovec_destroy(&acb->qcrs[i].qiov);
     }
+}
+
+static int coroutine_fn GRAPH_RDLOCK read_quorum_children(QuorumAIOCB *acb)
+{
+    quorum_read_children(acb, -1);
+
+    /* Do the vote on read */
+    quorum_vote(acb);
+    quorum_free_children_bufs(acb);
 
     while (acb->rewrite_count) {
         qemu_coroutine_yield();
@@ -669,6 +754,113 @@ static int coroutine_fn GRAPH_RDLOCK read_fifo_child(QuorumAIOCB *acb)
     return ret;
 }
 
+static void quorum_verify_done(BDRVQuorumState *s, QuorumVerify *v)
+{
+    qemu_mutex_lock(&s->verify_lock);
+    QLIST_REMOVE(v, next);
+    s->verify_in_flight--;
+    qemu_co_enter_next(&s->verify_queue, &s->verify_lock);
+    qemu_mutex_unlock(&s->verify_lock);
+
+    qemu_vfree(v->buf);
+    g_free(v);
+}
+
+/* Vote on a read that was served by v->child alone */
+static void coroutine_fn quorum_verify_entry(void *opaque)
+{
+    QuorumVerify *v = opaque;
+    BlockDriverState *bs = v->bs;
+    BDRVQuorumState *s = bs->opaque;
+    QEMUIOVector qiov;
+    QuorumAIOCB *acb;
+    bool stale;
+
+    GRAPH_RDLOCK_GUARD();
+
+    qemu_iovec_init_buf(&qiov, v->buf, v->bytes);
+    acb = quorum_aio_get(bs, &qiov, v->offset, v->bytes, 0);
+    acb->is_read = true;
+
+    /* What the guest got stands for the vote of the child it came from */
+    acb->qcrs[v->child].bs = s->children[v->child]->bs;
+    qemu_iovec_init_buf(&acb->qcrs[v->child].qiov, v->buf, v->bytes);
+    acb->count = 1;
+    acb->success_count = 1;
+
+    quorum_read_children(acb, v->child);
+
+    qemu_mutex_lock(&s->verify_lock);
+    stale = v->stale;
+    qemu_mutex_unlock(&s->verify_lock);
+
+    if (!stale) {
+        quorum_vote(acb);
+    }
+    quorum_free_children_bufs(acb);
+    quorum_aio_finalize(acb);
+
+    quorum_verify_done(s, v);
+    bdrv_dec_in_flight(bs);
+}
+
+/*
+ * Serve the read from the child with the lowest latency and check the
+ * result against the other children in the background.  Mismatches are
+ * reported with QUORUM_REPORT_BAD events after the guest got the data.
+ */
+static int coroutine_fn GRAPH_RDLOCK read_lazy_verify(QuorumAIOCB *acb)
+{
+    BDRVQuorumState *s = acb->bs->opaque;
+    QuorumVerify *v = g_new0(QuorumVerify, 1);
+    int64_t start;
+    int i, ret;
+
+    v->bs = acb->bs;
+    v->offset = acb->offset;
+    v->bytes = acb->bytes;
+
+    qemu_mutex_lock(&s->verify_lock);
+    /* Bound how far verification can lag behind the guest */
+    while (s->verify_in_flight >= QUORUM_VERIFY_MAX_IN_FLIGHT) {
+        qemu_co_queue_wait(&s->verify_queue, &s->verify_lock);
+    }
+    s->verify_in_flight++;
+    for (i = 1; i < s->num_children; i++) {
+        if (s->latency_ns[i] < s->latency_ns[v->child]) {
+            v->child = i;
+        }
+    }
+    /* From now on, overlapping writes mark the verification stale */
+    QLIST_INSERT_HEAD(&s->verify_list, v, next);
+    qemu_mutex_unlock(&s->verify_lock);
+
+    acb->qcrs[v->child].bs = s->children[v->child]->bs;
+    start = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    ret = bdrv_co_preadv(s->children[v->child], acb->offset, acb->bytes,
+                         acb->qiov, 0);
+    quorum_account_latency(s, v->child, start);
+
+    if (ret < 0) {
+        quorum_report_bad_acb(&acb->qcrs[v->child], ret);
+        quorum_verify_done(s, v);
+        return read_quorum_children(acb);
+    }
+    if (s->num_children == 1) {
+        quorum_verify_done(s, v);
+        return 0;
+    }
+
+    v->buf = qemu_blockalign(acb->bs, acb->bytes);
+    qemu_iovec_to_buf(acb->qiov, 0, v->buf, acb->bytes);
+
+    /* Runs once this request has completed */
+    bdrv_inc_in_flight(acb->bs);
+    aio_co_enter(qemu_get_current_aio_context(),
+                 qemu_coroutine_create(quorum_verify_entry, v));
+    return 0;
+}
+
 static int coroutine_fn GRAPH_RDLOCK
 quorum_co_preadv(BlockDriverState *bs, int64_t offset, int64_t bytes,
                  QEMUIOVector *qiov, BdrvRequestFlags flags)
@@ -680,10 +872,16 @@ quorum_co_preadv(BlockDriverState *bs, int64_t offset, int64_t bytes,
     acb->is_read = true;
     acb->children_read = 0;
 
-    if (s->read_pattern == QUORUM_READ_PATTERN_QUORUM) {
+    switch (s->read_pattern) {
+    case QUORUM_READ_PATTERN_QUORUM:
         ret = read_quorum_children(acb);
-    } else {
+        break;
+    case QUORUM_READ_PATTERN_LAZY_VERIFY:
+        ret = read_lazy_verify(acb);
+        break;
+    default:
         ret = read_fifo_child(acb);
+        break;
     }
     quorum_aio_finalize(acb);
 
@@ -733,6 +931,7 @@ quorum_co_pwritev(BlockDriverState *bs, int64_t offset, int64_t bytes,
     QuorumAIOCB *acb = quorum_aio_get(bs, qiov, offset, bytes, flags);
     int i, ret;
 
+    quorum_verify_invalidate(s, offset, bytes);
     for (i = 0; i < s->num_children; i++) {
         Coroutine *co;
         QuorumCo data = {
@@ -747,6 +946,7 @@ quorum_co_pwritev(BlockDriverState *bs, int64_t offset, int64_t bytes,
     while (acb->count < s->num_children) {
         qemu_coroutine_yield();
     }
+    quorum_verify_invalidate(s, offset, bytes);
 
     quorum_has_too_much_io_failed(acb);
 
@@ -917,7 +1117,8 @@ static QemuOptsList quorum_runtime_opts = {
         {
             .name = QUORUM_OPT_READ_PATTERN,
             .type = QEMU_OPT_STRING,
-            .help = "Allowed pattern: quorum, fifo. Quorum is default",
+            .help = "Allowed pattern: quorum, fifo, lazy-verify. "
+                    "Quorum is default",
         },
         { /* end of list */ }
     },
@@ -984,7 +1185,8 @@ static int quorum_open(BlockDriverState *bs, QDict *options, int flags,
                               -EINVAL, NULL);
     }
     if (ret < 0) {
-        error_setg(errp, "Please set read-pattern as fifo or quorum");
+        error_setg(errp,
+                   "Please set read-pattern as fifo, quorum or lazy-verify");
         goto exit;
     }
     s->read_pattern = ret;
@@ -1029,6 +1231,10 @@ static int quorum_open(BlockDriverState *bs, QDict *options, int flags,
     }
     s->next_child_index = s->num_children;
 
+    qemu_mutex_init(&s->verify_lock);
+    qemu_co_queue_init(&s->verify_queue);
+    s->latency_ns = g_new0(int64_t, s->num_children);
+
     bs->supported_write_flags = BDRV_REQ_WRITE_UNCHANGED;
     quorum_refresh_flags(bs);
 
@@ -1064,6 +1270,8 @@ static void quorum_close(BlockDriverState *bs)
     bdrv_graph_wrunlock();
 
     g_free(s->children);
+    g_free(s->latency_ns);
+    qemu_mutex_destroy(&s->verify_lock);
 }
 
 static void GRAPH_WRLOCK
@@ -1103,6 +1311,8 @@ quorum_add_child(BlockDriverState *bs, BlockDriverState *child_bs, Error **errp)
         return;
     }
     s->children = g_renew(BdrvChild *, s->children, s->num_children + 1);
+    s->latency_ns = g_renew(int64_t, s->latency_ns, s->num_children + 1);
+    s->latency_ns[s->num_children] = 0;
     s->children[s->num_children++] = child;
     quorum_refresh_flags(bs);
 }
@@ -1141,7 +1351,10 @@ quorum_del_child(BlockDriverState *bs, BdrvChild *child, Error **errp)
     /* We can safely remove this child now */
     memmove(&s->children[i], &s->children[i + 1],
             (s->num_children - i - 1) * sizeof(BdrvChild *));
+    memmove(&s->latency_ns[i], &s->latency_ns[i + 1],
+            (s->num_children - i - 1) * sizeof(int64_t));
     s->children = g_renew(BdrvChild *, s->children, --s->num_children);
+    s->latency_ns = g_renew(int64_t, s->latency_ns, s->num_children);
 
     bdrv_unref_child(bs, child);
 
@@ -1308,8 +1521,7 @@ static BlockDriver bdrv_quorum = {
 
 static void bdrv_quorum_init(void)
 {
-    if (!qcrypto_hash_supports(QCRYPTO_HASH_ALGO_SHA256)) {
-        /* SHA256 hash support is required for quorum device */
+    if (!qcrypto_hash_supports(HASH_ALGO)) {
         return;
     }
     bdrv_register(&bdrv_quorum);
@@ -23,6 +23,8 @@
 #include "block/qdict.h"
 #include "crypto/secret.h"
 #include "qemu/cutils.h"
+#include "qemu/coroutine-tls.h"
+#include "qemu/notify.h"
 #include "system/replay.h"
 #include "qobject/qstring.h"
 #include "qobject/qdict.h"
@@ -109,11 +111,29 @@ typedef struct BDRVRBDState {
     RbdImageEncryptionFormat encryption_format;
 } BDRVRBDState;
 
+/*
+ * librbd threads queue completed requests here, and a single BH of the
+ * AioContext that submitted them wakes up the coroutines.  This way a
+ * burst of completions costs one wakeup of the event loop, rather than one
+ * BH per request.  There is one queue per thread that submits requests.
+ */
+typedef struct RBDCompletionQueue {
+    AioContext *ctx;
+    QEMUBH *bh;
+    QSLIST_HEAD(, RBDTask) tasks;
+    Notifier exit_notifier;
+} RBDCompletionQueue;
+
 typedef struct RBDTask {
     Coroutine *co;
     int64_t ret;
+    /* NULL if the completion is delivered with a oneshot BH */
+    RBDCompletionQueue *queue;
+    QSLIST_ENTRY(RBDTask) next;
 } RBDTask;
 
+QEMU_DEFINE_STATIC_CO_TLS(RBDCompletionQueue *, rbd_completion_queue);
+
 typedef struct RBDDiffIterateReq {
     uint64_t offs;
     uint64_t bytes;
@@ -1310,6 +1330,49 @@ static void qemu_rbd_finish_bh(void *opaque)
     aio_co_wake(task->co);
 }
 
+static void qemu_rbd_completion_queue_bh(void *opaque)
+{
+    RBDCompletionQueue *queue = opaque;
+    QSLIST_HEAD(, RBDTask) tasks;
+    RBDTask *task, *next;
+
+    QSLIST_MOVE_ATOMIC(&tasks, &queue->tasks);
+
+    /* The task lives on the coroutine's stack, do not touch it after waking */
+    QSLIST_FOREACH_SAFE(task, &tasks, next, next) {
+        aio_co_wake(task->co);
+    }
+}
+
+static void qemu_rbd_completion_queue_free(Notifier *n, void *unused)
+{
+    RBDCompletionQueue *queue = container_of(n, RBDCompletionQueue,
+                                             exit_notifier);
+
+    assert(QSLIST_EMPTY(&queue->tasks));
+    qemu_bh_delete(queue->bh);
+    g_free(queue);
+    set_rbd_completion_queue(NULL);
+}
+
+/* Return the completion queue of the current thread if it serves @ctx */
+static RBDCompletionQueue *qemu_rbd_get_completion_queue(AioContext *ctx)
+{
+    RBDCompletionQueue *queue = get_rbd_completion_queue();
+
+    if (!queue) {
+        queue = g_new0(RBDCompletionQueue, 1);
+        queue->ctx = qemu_get_current_aio_context();
+        queue->bh = aio_bh_new(queue->ctx, qemu_rbd_completion_queue_bh,
+                               queue);
+        queue->exit_notifier.notify = qemu_rbd_completion_queue_free;
+        qemu_thread_atexit_add(&queue->exit_notifier);
+        set_rbd_completion_queue(queue);
+    }
+
+    return queue->ctx == ctx ? queue : NULL;
+}
+
 /*
  * This is the completion callback function for all rbd aio calls
  * started from qemu_rbd_start_co().
@@ -1321,10 +1384,19 @@ static void qemu_rbd_finish_bh(void *opaque)
  */
 static void qemu_rbd_completion_cb(rbd_completion_t c, RBDTask *task)
 {
+    RBDCompletionQueue *queue = task->queue;
+
     task->ret = rbd_aio_get_return_value(c);
     rbd_aio_release(c);
-    aio_bh_schedule_oneshot(qemu_coroutine_get_aio_context(task->co),
-                            qemu_rbd_finish_bh, task);
+
+    if (queue) {
+        /* Scheduling an already pending BH does not notify the loop again */
+        QSLIST_INSERT_HEAD_ATOMIC(&queue->tasks, task, next);
+        qemu_bh_schedule(queue->bh);
+    } else {
+        aio_bh_schedule_oneshot(qemu_coroutine_get_aio_context(task->co),
+                                qemu_rbd_finish_bh, task);
+    }
 }
 
 static int coroutine_fn qemu_rbd_start_co(BlockDriverState *bs,
@@ -1340,6 +1412,8 @@ static int coroutine_fn qemu_rbd_start_co(BlockDriverState *bs,
     int r;
 
     assert(!qiov || qiov->size == bytes);
+    task.queue =
+        qemu_rbd_get_completion_queue(qemu_coroutine_get_aio_context(task.co));
 
     if (cmd == RBD_AIO_WRITE || cmd == RBD_AIO_WRITE_ZEROES) {
         /*
@@ -1398,7 +1472,7 @@ static int coroutine_fn qemu_rbd_start_co(BlockDriverState *bs,
         return r;
     }
 
-    /* Expect exactly a single wake from qemu_rbd_finish_bh() */
+    /* Expect exactly a single wake from the completion BH */
     qemu_coroutine_yield();
 
     if (task.ret < 0) {
@@ -13,6 +13,7 @@
 
 #include "qemu/osdep.h"
 #include "trace.h"
+#include "block/aio_task.h"
 #include "block/block_int.h"
 #include "block/blockjob_int.h"
 #include "qapi/error.h"
@@ -23,13 +24,22 @@
 
 enum {
     /*
-     * Maximum chunk size to feed to copy-on-read.  This should be
-     * large enough to process multiple clusters in a single call, so
+     * Default maximum chunk size to feed to copy-on-read.  This should
+     * be large enough to process multiple clusters in a single call, so
      * that populating contiguous regions of the image is efficient.
      */
     STREAM_CHUNK = 512 * 1024, /* in bytes */
 };
 
+/* An area whose copy failed, or that is to be copied again */
+typedef struct StreamRange {
+    int64_t offset;
+    int64_t bytes;
+    /* 0 if the area is to be copied again */
+    int ret;
+    QSIMPLEQ_ENTRY(StreamRange) next;
+} StreamRange;
+
 typedef struct StreamBlockJob {
     BlockJob common;
     BlockBackend *blk;
@@ -41,8 +51,19 @@ typedef struct StreamBlockJob {
     char *backing_file_str;
     bool backing_mask_protocol;
     bool bs_read_only;
+    int max_workers;
+    int64_t max_chunk;
+    /* Filled by the copy tasks, handled by stream_run() */
+    QSIMPLEQ_HEAD(, StreamRange) failed;
 } StreamBlockJob;
 
+typedef struct StreamTask {
+    AioTask task;
+    StreamBlockJob *s;
+    int64_t offset;
+    int64_t bytes;
+} StreamTask;
+
 static int coroutine_fn stream_populate(BlockBackend *blk,
                                         int64_t offset, uint64_t bytes)
 {
@@ -51,6 +72,47 @@ static int coroutine_fn stream_populate(BlockBackend *blk,
     return blk_co_preadv(blk, offset, bytes, NULL, BDRV_REQ_PREFETCH);
 }
 
+static int coroutine_fn stream_task_entry(AioTask *task)
+{
+    StreamTask *t = container_of(task, StreamTask, task);
+    StreamBlockJob *s = t->s;
+    StreamRange *r;
+    int ret;
+
+    ret = stream_populate(s->blk, t->offset, t->bytes);
+    if (ret < 0) {
+        r = g_new(StreamRange, 1);
+        *r = (StreamRange) {
+            .offset = t->offset,
+            .bytes = t->bytes,
+            .ret = ret,
+        };
+        QSIMPLEQ_INSERT_TAIL(&s->failed, r, next);
+    } else {
+        job_progress_update(&s->common.job, t->bytes);
+    }
+
+    /* The error action is taken by stream_run(), keep the pool running */
+    return 0;
+}
+
+static void coroutine_fn stream_start_task(StreamBlockJob *s,
+                                           AioTaskPool *pool,
+                                           int64_t offset, int64_t bytes)
+{
+    StreamTask *t = g_new(StreamTask, 1);
+
+    *t = (StreamTask) {
+        .task.func = stream_task_entry,
+        .s = s,
+        .offset = offset,
+        .bytes = bytes,
+    };
+
+    block_job_ratelimit_processed_bytes(&s->common, bytes);
+    aio_task_pool_start_task(pool, &t->task);
+}
+
 static int GRAPH_UNLOCKED stream_prepare(Job *job)
 {
     StreamBlockJob *s = container_of(job, StreamBlockJob, common.job);
@@ -153,6 +215,9 @@ static int coroutine_fn stream_run(Job *job, Error **errp)
 {
     StreamBlockJob *s = container_of(job, StreamBlockJob, common.job);
     BlockDriverState *unfiltered_bs = NULL;
+    BlockErrorAction action;
+    AioTaskPool *pool;
+    StreamRange *r;
     int64_t len = -1;
     int64_t offset = 0;
     int error = 0;
@@ -172,22 +237,65 @@ static int coroutine_fn stream_run(Job *job, Error **errp)
     }
     job_progress_set_remaining(&s->common.job, len);
 
-    for ( ; offset < len; offset += n) {
+    pool = aio_task_pool_new(s->max_workers);
+
+    for ( ; ; offset += n) {
         bool copy;
         int ret = -1;
 
+        n = 0;
+
         /* Note that even when no rate limit is applied we need to yield
-         * with no pending I/O here so that bdrv_drain_all() returns.
+         * here so that bdrv_drain_all() returns.
          */
         block_job_ratelimit_sleep(&s->common);
         if (job_is_cancelled(&s->common.job)) {
             break;
         }
 
+        r = QSIMPLEQ_FIRST(&s->failed);
+        if (r) {
+            QSIMPLEQ_REMOVE_HEAD(&s->failed, next);
+            if (r->ret == 0) {
+                stream_start_task(s, pool, r->offset, r->bytes);
+                g_free(r);
+                continue;
+            }
+
+            action = block_job_error_action(&s->common, s->on_error, true,
+                                            -r->ret);
+            if (action == BLOCK_ERROR_ACTION_STOP) {
+                /* Copy again once the job is resumed */
+                r->ret = 0;
+                QSIMPLEQ_INSERT_HEAD(&s->failed, r, next);
+                continue;
+            }
+            if (error == 0) {
+                error = r->ret;
+            }
+            if (action == BLOCK_ERROR_ACTION_REPORT) {
+                g_free(r);
+                break;
+            }
+            job_progress_update(&s->common.job, r->bytes);
+            g_free(r);
+            continue;
+        }
+
+        if (offset >= len) {
+            if (!aio_task_pool_busy_tasks(pool)) {
+                break;
+            }
+            aio_task_pool_wait_one(pool);
+            continue;
+        }
+
         copy = false;
 
         WITH_GRAPH_RDLOCK_GUARD() {
-            ret = bdrv_co_is_allocated(unfiltered_bs, offset, STREAM_CHUNK, &n);
+            /* Ask for the whole rest, to skip unallocated areas at once */
+            ret = bdrv_co_is_allocated(unfiltered_bs, offset, len - offset,
+                                       &n);
             if (ret == 1) {
                 /* Allocated in the top, no need to copy.  */
             } else if (ret >= 0) {
@@ -206,13 +314,13 @@ static int coroutine_fn stream_run(Job *job, Error **errp)
                 copy = (ret > 0);
             }
         }
-        trace_stream_one_iteration(s, offset, n, ret);
         if (copy) {
-            ret = stream_populate(s->blk, offset, n);
+            n = MIN(n, s->max_chunk);
         }
+        trace_stream_one_iteration(s, offset, n, ret);
         if (ret < 0) {
-            BlockErrorAction action =
-                block_job_error_action(&s->common, s->on_error, true, -ret);
+            action = block_job_error_action(&s->common, s->on_error, true,
+                                            -ret);
             if (action == BLOCK_ERROR_ACTION_STOP) {
                 n = 0;
                 continue;
@@ -225,13 +333,21 @@ static int coroutine_fn stream_run(Job *job, Error **errp)
             }
         }
 
-        /* Publish progress */
-        job_progress_update(&s->common.job, n);
         if (copy) {
-            block_job_ratelimit_processed_bytes(&s->common, n);
+            stream_start_task(s, pool, offset, n);
+        } else {
+            /* Publish progress */
+            job_progress_update(&s->common.job, n);
         }
     }
 
+    aio_task_pool_wait_all(pool);
+    aio_task_pool_free(pool);
+    while ((r = QSIMPLEQ_FIRST(&s->failed))) {
+        QSIMPLEQ_REMOVE_HEAD(&s->failed, next);
+        g_free(r);
+    }
+
     /* Do not remove the backing file if an error was there but ignored. */
     return error;
 }
@@ -255,6 +371,7 @@ void stream_start(const char *job_id, BlockDriverState *bs,
                   int creation_flags, int64_t speed,
                   BlockdevOnError on_error,
                   const char *filter_node_name,
+                  const BlockJobCopyPerf *perf,
                   Error **errp)
 {
     StreamBlockJob *s = NULL;
@@ -272,6 +389,18 @@ void stream_start(const char *job_id, BlockDriverState *bs,
     assert(!(base && bottom));
     assert(!(backing_file_str && bottom));
 
+    if (perf && perf->has_max_workers &&
+        (perf->max_workers < 1 || perf->max_workers > INT_MAX)) {
+        error_setg(errp, "max-workers must be between 1 and %d", INT_MAX);
+        return;
+    }
+    if (perf && perf->has_max_chunk &&
+        (perf->max_chunk < 0 || perf->max_chunk > BDRV_REQUEST_MAX_BYTES)) {
+        error_setg(errp, "max-chunk must be between 0 and %" PRId64,
+                   (int64_t)BDRV_REQUEST_MAX_BYTES);
+        return;
+    }
+
     bdrv_graph_rdlock_main_loop();
 
     if (bottom) {
@@ -408,6 +537,15 @@ void stream_start(const char *job_id, BlockDriverState *bs,
     s->bs_read_only = bs_read_only;
 
     s->on_error = on_error;
+    s->max_workers = 1;
+    s->max_chunk = STREAM_CHUNK;
+    if (perf && perf->has_max_workers) {
+        s->max_workers = perf->max_workers;
+    }
+    if (perf && perf->has_max_chunk && perf->max_chunk) {
+        s->max_chunk = perf->max_chunk;
+    }
+    QSIMPLEQ_INIT(&s->failed);
     trace_stream_start(bs, base, s);
     job_start(&s->common.job);
     return;
@@ -74,6 +74,7 @@ struct ThrottleGroup {
     ThrottleState ts;
     QLIST_HEAD(, ThrottleGroupMember) head;
     ThrottleGroupMember *tokens[THROTTLE_MAX];
+    /* Also read without the lock, with atomic operations */
     bool any_timer_armed[THROTTLE_MAX];
     QEMUClockType clock_type;
 
@@ -85,6 +86,10 @@ struct ThrottleGroup {
 static QTAILQ_HEAD(, ThrottleGroup) throttle_groups =
     QTAILQ_HEAD_INITIALIZER(throttle_groups);
 
+/* Members borrow the I/O that the limits of their group allow in this time */
+#define THROTTLE_CREDIT_NS (10 * SCALE_MS)
+#define THROTTLE_CREDIT_MAX (INT_MAX / 4)
+
 
 /* This function reads throttle_groups and must be called under the global
  * mutex.
@@ -286,7 +291,7 @@ static bool throttle_group_schedule_timer(ThrottleGroupMember *tgm,
     /* If a timer just got armed, set tgm as the current token */
     if (must_wait) {
         tg->tokens[direction] = tgm;
-        tg->any_timer_armed[direction] = true;
+        qatomic_set(&tg->any_timer_armed[direction], true);
     }
 
     return must_wait;
@@ -344,12 +349,126 @@ static void coroutine_mixed_fn schedule_next_request(ThrottleGroupMember *tgm,
             ThrottleTimers *tt = &token->throttle_timers;
             int64_t now = qemu_clock_get_ns(tg->clock_type);
             timer_mod(tt->timers[direction], now);
-            tg->any_timer_armed[direction] = true;
+            qatomic_set(&tg->any_timer_armed[direction], true);
         }
         tg->tokens[direction] = token;
     }
 }
 
+/* Take @n from a credit of a ThrottleGroupMember. Return false, leaving the
+ * credit untouched, if it is not enough.
+ */
+static bool throttle_group_take_credit(int *credit, int n)
+{
+    int old = qatomic_read(credit);
+    int prev;
+
+    while (old >= n) {
+        prev = qatomic_cmpxchg(credit, old, old - n);
+        if (prev == old) {
+            return true;
+        }
+        old = prev;
+    }
+    return false;
+}
+
+/* Admit an I/O request using the credit of a ThrottleGroupMember, without
+ * taking the group lock. This is only done while no request of the group is
+ * throttled, so that those keep their round robin order. Return whether the
+ * request was admitted.
+ *
+ * @tgm:       the current ThrottleGroupMember
+ * @bytes:     the number of bytes for this I/O
+ * @direction: the ThrottleDirection
+ */
+static bool throttle_group_use_credit(ThrottleGroupMember *tgm, int64_t bytes,
+                                      ThrottleDirection direction)
+{
+    ThrottleGroup *tg = container_of(tgm->throttle_state, ThrottleGroup, ts);
+
+    if (bytes > INT_MAX ||
+        qatomic_read(&tg->any_timer_armed[direction]) ||
+        qatomic_read(&tgm->pending_reqs[direction])) {
+        return false;
+    }
+    if (!throttle_group_take_credit(&tgm->credit_ops[direction], 1)) {
+        return false;
+    }
+    if (!throttle_group_take_credit(&tgm->credit_bytes[direction], bytes)) {
+        qatomic_add(&tgm->credit_ops[direction], 1);
+        return false;
+    }
+    return true;
+}
+
+/* Account in advance the I/O that the group limits allow in
+ * THROTTLE_CREDIT_NS and give it to a ThrottleGroupMember as credit, unless
+ * that would make requests wait. Unlimited dimensions are not accounted.
+ *
+ * This assumes that tg->lock is held.
+ *
+ * @tgm:       the current ThrottleGroupMember
+ * @direction: the ThrottleDirection
+ */
+static void throttle_group_borrow_credit(ThrottleGroupMember *tgm,
+                                         ThrottleDirection direction)
+{
+    ThrottleState *ts = tgm->throttle_state;
+    ThrottleGroup *tg = container_of(ts, ThrottleGroup, ts);
+    uint64_t bytes, ops, new_bytes, new_ops;
+
+    /* Operations larger than iops-size count as several, not supported */
+    if (ts->cfg.op_size || tg->any_timer_armed[direction] ||
+        tgm->pending_reqs[direction] ||
+        qatomic_read(&tgm->io_limits_disabled)) {
+        return;
+    }
+
+    throttle_get_allowance(ts, direction, THROTTLE_CREDIT_NS, &bytes, &ops);
+    bytes = MIN(bytes, THROTTLE_CREDIT_MAX);
+    ops = MIN(ops, THROTTLE_CREDIT_MAX);
+
+    /* Top up a credit only when it runs low, so that it stays bounded */
+    new_bytes = qatomic_read(&tgm->credit_bytes[direction]) < bytes ? bytes : 0;
+    new_ops = qatomic_read(&tgm->credit_ops[direction]) < ops ? ops : 0;
+    if ((new_bytes || new_ops) &&
+        !throttle_account_batch(ts, qemu_clock_get_ns(tg->clock_type),
+                                direction, new_bytes, new_ops)) {
+        return;
+    }
+
+    if (!bytes) {
+        qatomic_set(&tgm->credit_bytes[direction], INT_MAX);
+    } else if (new_bytes) {
+        qatomic_add(&tgm->credit_bytes[direction], new_bytes);
+    }
+    if (!ops) {
+        qatomic_set(&tgm->credit_ops[direction], INT_MAX);
+    } else if (new_ops) {
+        qatomic_add(&tgm->credit_ops[direction], new_ops);
+    }
+}
+
+/* Drop the credit of all members of a group, e.g. when its limits change.
+ * Credit that was already accounted is lost, which only makes the group
+ * slightly stricter for a moment.
+ *
+ * This assumes that tg->lock is held.
+ */
+static void throttle_group_clear_credit(ThrottleGroup *tg)
+{
+    ThrottleGroupMember *tgm;
+    ThrottleDirection dir;
+
+    QLIST_FOREACH(tgm, &tg->head, round_robin) {
+        for (dir = THROTTLE_READ; dir < THROTTLE_MAX; dir++) {
+            qatomic_set(&tgm->credit_bytes[dir], 0);
+            qatomic_set(&tgm->credit_ops[dir], 0);
+        }
+    }
+}
+
 /* Check if an I/O request needs to be throttled, wait and set a timer
  * if necessary, and schedule the next request using a round robin
  * algorithm.
@@ -369,6 +488,10 @@ void coroutine_fn throttle_group_co_io_limits_intercept(ThrottleGroupMember *tgm
     assert(bytes >= 0);
     assert(direction < THROTTLE_MAX);
 
+    if (throttle_group_use_credit(tgm, bytes, direction)) {
+        return;
+    }
+
     qemu_mutex_lock(&tg->lock);
 
     /* First we check if this I/O has to be throttled. */
@@ -377,19 +500,22 @@ void coroutine_fn throttle_group_co_io_limits_intercept(ThrottleGroupMember *tgm
 
     /* Wait if there's a timer set or queued requests of this type */
     if (must_wait || tgm->pending_reqs[direction]) {
-        tgm->pending_reqs[direction]++;
+        qatomic_inc(&tgm->pending_reqs[direction]);
         qemu_mutex_unlock(&tg->lock);
         qemu_co_mutex_lock(&tgm->throttled_reqs_lock);
         qemu_co_queue_wait(&tgm->throttled_reqs[direction],
                            &tgm->throttled_reqs_lock);
         qemu_co_mutex_unlock(&tgm->throttled_reqs_lock);
         qemu_mutex_lock(&tg->lock);
-        tgm->pending_reqs[direction]--;
+        qatomic_dec(&tgm->pending_reqs[direction]);
     }
 
     /* The I/O will be executed, so do the accounting */
     throttle_account(tgm->throttle_state, direction, bytes);
 
+    /* Let the next requests of this tgm skip the lock if possible */
+    throttle_group_borrow_credit(tgm, direction);
+
     /* Schedule the next request */
     schedule_next_request(tgm, direction);
 
@@ -478,6 +604,7 @@ void throttle_group_config(ThrottleGroupMember *tgm, ThrottleConfig *cfg)
     ThrottleGroup *tg = container_of(ts, ThrottleGroup, ts);
     qemu_mutex_lock(&tg->lock);
     throttle_config(ts, tg->clock_type, cfg);
+    throttle_group_clear_credit(tg);
     qemu_mutex_unlock(&tg->lock);
 
     throttle_group_restart_tgm(tgm);
@@ -512,7 +639,7 @@ static void timer_cb(ThrottleGroupMember *tgm, ThrottleDirection direction)
 
     /* The timer has just been fired, so we can update the flag */
     qemu_mutex_lock(&tg->lock);
-    tg->any_timer_armed[direction] = false;
+    qatomic_set(&tg->any_timer_armed[direction], false);
     qemu_mutex_unlock(&tg->lock);
 
     /* Run the request that was waiting for this timer */
@@ -559,6 +686,8 @@ void throttle_group_register_tgm(ThrottleGroupMember *tgm,
             tg->tokens[dir] = tgm;
         }
         qemu_co_queue_init(&tgm->throttled_reqs[dir]);
+        qatomic_set(&tgm->credit_bytes[dir], 0);
+        qatomic_set(&tgm->credit_ops[dir], 0);
     }
 
     QLIST_INSERT_HEAD(&tg->head, tgm, round_robin);
@@ -645,7 +774,7 @@ void throttle_group_detach_aio_context(ThrottleGroupMember *tgm)
     WITH_QEMU_LOCK_GUARD(&tg->lock) {
         for (dir = THROTTLE_READ; dir < THROTTLE_MAX; dir++) {
             if (timer_pending(tt->timers[dir])) {
-                tg->any_timer_armed[dir] = false;
+                qatomic_set(&tg->any_timer_armed[dir], false);
                 schedule_next_request(tgm, dir);
             }
         }
@@ -2360,6 +2360,7 @@ void qmp_block_stream(const char *job_id, const char *device,
                       const char *filter_node_name,
                       bool has_auto_finalize, bool auto_finalize,
                       bool has_auto_dismiss, bool auto_dismiss,
+                      BlockJobCopyPerf *x_perf,
                       Error **errp)
 {
     BlockDriverState *bs, *iter, *iter_end;
@@ -2482,7 +2483,7 @@ void qmp_block_stream(const char *job_id, const char *device,
     stream_start(job_id, bs, base_bs, backing_file,
                  backing_mask_protocol,
                  bottom_bs, job_flags, has_speed ? speed : 0, on_error,
-                 filter_node_name, &local_err);
+                 filter_node_name, x_perf, &local_err);
     if (local_err) {
         error_propagate(errp, local_err);
         return;
@@ -2508,6 +2509,7 @@ void qmp_block_commit(const char *job_id, const char *device,
                       const char *filter_node_name,
                       bool has_auto_finalize, bool auto_finalize,
                       bool has_auto_dismiss, bool auto_dismiss,
+                      BlockJobCopyPerf *x_perf,
                       Error **errp)
 {
     BlockDriverState *bs;
@@ -2678,7 +2680,7 @@ void qmp_block_commit(const char *job_id, const char *device,
         commit_start(job_id, bs, base_bs, top_bs, job_flags,
                      speed, on_error, backing_file,
                      backing_mask_protocol,
-                     filter_node_name, &local_err);
+                     filter_node_name, x_perf, &local_err);
     }
     if (local_err != NULL) {
         error_propagate(errp, local_err);
@@ -2731,6 +2733,9 @@ static BlockJob *do_backup_common(BackupCommon *backup,
         if (backup->x_perf->has_min_cluster_size) {
             perf.min_cluster_size = backup->x_perf->min_cluster_size;
         }
+        if (backup->x_perf->has_adaptive) {
+            perf.adaptive = backup->x_perf->adaptive;
+        }
     }
 
     if ((backup->sync == MIRROR_SYNC_MODE_BITMAP) ||
@@ -2869,6 +2874,7 @@ static void blockdev_mirror_common(const char *job_id, BlockDriverState *bs,
                                    bool has_on_target_error,
                                    BlockdevOnError on_target_error,
                                    bool has_unmap, bool unmap,
+                                   bool has_detect_zeroes, bool detect_zeroes,
                                    const char *filter_node_name,
                                    bool has_copy_mode, MirrorCopyMode copy_mode,
                                    bool has_auto_finalize, bool auto_finalize,
@@ -2899,6 +2905,9 @@ static void blockdev_mirror_common(const char *job_id, BlockDriverState *bs,
     if (!has_unmap) {
         unmap = true;
     }
+    if (!has_detect_zeroes) {
+        detect_zeroes = false;
+    }
     if (!has_copy_mode) {
         copy_mode = MIRROR_COPY_MODE_BACKGROUND;
     }
@@ -2970,7 +2979,7 @@ static void blockdev_mirror_common(const char *job_id, BlockDriverState *bs,
     mirror_start(job_id, bs, target, replaces, job_flags,
                  speed, granularity, buf_size, sync, backing_mode,
                  target_is_zero, on_source_error, on_target_error, unmap,
-                 filter_node_name, copy_mode, errp);
+                 detect_zeroes, filter_node_name, copy_mode, errp);
 }
 
 void qmp_drive_mirror(DriveMirror *arg, Error **errp)
@@ -3118,6 +3127,7 @@ void qmp_drive_mirror(DriveMirror *arg, Error **errp)
                            arg->has_on_source_error, arg->on_source_error,
                            arg->has_on_target_error, arg->on_target_error,
                            arg->has_unmap, arg->unmap,
+                           arg->has_detect_zeroes, arg->detect_zeroes,
                            NULL,
                            arg->has_copy_mode, arg->copy_mode,
                            arg->has_auto_finalize, arg->auto_finalize,
@@ -3142,6 +3152,7 @@ void qmp_blockdev_mirror(const char *job_id,
                          bool has_auto_finalize, bool auto_finalize,
                          bool has_auto_dismiss, bool auto_dismiss,
                          bool has_target_is_zero, bool target_is_zero,
+                         bool has_detect_zeroes, bool detect_zeroes,
                          Error **errp)
 {
     BlockDriverState *bs;
@@ -3175,7 +3186,9 @@ void qmp_blockdev_mirror(const char *job_id,
                            has_buf_size, buf_size,
                            has_on_source_error, on_source_error,
                            has_on_target_error, on_target_error,
-                           true, true, filter_node_name,
+                           true, true,
+                           has_detect_zeroes, detect_zeroes,
+                           filter_node_name,
                            has_copy_mode, copy_mode,
                            has_auto_finalize, auto_finalize,
                            has_auto_dismiss, auto_dismiss,
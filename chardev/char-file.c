@@ -133,6 +133,8 @@ static void char_file_class_init(ObjectClass *oc, const void *data)
 {
     ChardevClass *cc = CHARDEV_CLASS(oc);
 
+    cc->supports_write_buffer = true;
+
     cc->parse = qemu_chr_parse_file_out;
     cc->open = qmp_chardev_open_file;
 }
@@ -1575,6 +1575,7 @@ static void char_socket_class_init(ObjectClass *oc, const void *data)
     ChardevClass *cc = CHARDEV_CLASS(oc);
 
     cc->supports_yank = true;
+    cc->supports_write_buffer = true;
 
     cc->parse = qemu_chr_parse_socket;
     cc->open = qmp_chardev_open_socket;
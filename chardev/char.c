@@ -24,6 +24,8 @@
 
 #include "qemu/osdep.h"
 #include "qemu/cutils.h"
+#include "qemu/lockable.h"
+#include "qemu/units.h"
 #include "monitor/monitor.h"
 #include "monitor/qmp-helpers.h"
 #include "qemu/config-file.h"
@@ -159,11 +161,173 @@ static int qemu_chr_write_buffer(Chardev *s,
     return res;
 }
 
+/*
+ * With the write-buffer option, output is collected in a buffer and passed
+ * to the backend by a separate thread, so that a frontend writing a byte
+ * at a time does not make a system call per byte.  The thread swaps the
+ * buffer with a spare one and writes the spare one while the frontend
+ * fills the other.
+ */
+struct ChardevWriteBuffer {
+    QemuThread thread;
+    /* Protects the fields below */
+    QemuMutex lock;
+    QemuCond cond;
+    uint8_t *buf;
+    size_t len;
+    size_t size;
+    uint32_t interval_ms;
+    bool stop;
+    /* Serializes the writes of the spare buffer */
+    QemuMutex flush_lock;
+    uint8_t *spare;
+};
+
+#define CHARDEV_WRITE_BUFFER_MAX (64 * MiB)
+#define CHARDEV_WRITE_BUFFER_INTERVAL_DEFAULT 100
+
+static void qemu_chr_wbuf_flush(Chardev *s)
+{
+    ChardevWriteBuffer *b = s->wbuf;
+    uint8_t *data;
+    size_t len;
+    int offset;
+
+    QEMU_LOCK_GUARD(&b->flush_lock);
+    WITH_QEMU_LOCK_GUARD(&b->lock) {
+        data = b->buf;
+        len = b->len;
+        b->buf = b->spare;
+        b->len = 0;
+        b->spare = data;
+    }
+    if (len) {
+        qemu_chr_write_buffer(s, data, len, &offset, true);
+    }
+}
+
+static void *qemu_chr_wbuf_thread(void *opaque)
+{
+    Chardev *s = opaque;
+    ChardevWriteBuffer *b = s->wbuf;
+
+    qemu_mutex_lock(&b->lock);
+    while (!b->stop) {
+        if (!b->len) {
+            qemu_cond_wait(&b->cond, &b->lock);
+            continue;
+        }
+        if (b->len < b->size / 2) {
+            /* Give the frontend some time to add more */
+            qemu_cond_timedwait(&b->cond, &b->lock, b->interval_ms);
+        }
+        qemu_mutex_unlock(&b->lock);
+        qemu_chr_wbuf_flush(s);
+        qemu_mutex_lock(&b->lock);
+    }
+    qemu_mutex_unlock(&b->lock);
+    return NULL;
+}
+
+static void qemu_chr_wbuf_write(Chardev *s, const uint8_t *buf, int len)
+{
+    ChardevWriteBuffer *b = s->wbuf;
+    size_t half = b->size / 2;
+    size_t n;
+
+    while (len > 0) {
+        WITH_QEMU_LOCK_GUARD(&b->lock) {
+            n = MIN(len, b->size - b->len);
+            /* Wake up the thread to start the timer or to write it out */
+            if (n && (!b->len || (b->len < half && b->len + n >= half))) {
+                qemu_cond_signal(&b->cond);
+            }
+            memcpy(b->buf + b->len, buf, n);
+            b->len += n;
+        }
+        buf += n;
+        len -= n;
+        if (len) {
+            /* The buffer is full, write it out here */
+            qemu_chr_wbuf_flush(s);
+        }
+    }
+}
+
+static bool qemu_chr_wbuf_init(Chardev *chr, ChardevCommon *common,
+                               Error **errp)
+{
+    ChardevWriteBuffer *b;
+
+    if (!CHARDEV_GET_CLASS(chr)->supports_write_buffer) {
+        error_setg(errp, "write-buffer is not supported by chardev '%s'",
+                   object_get_typename(OBJECT(chr)));
+        return false;
+    }
+    if (common->write_buffer > CHARDEV_WRITE_BUFFER_MAX) {
+        error_setg(errp, "write-buffer must not exceed %" PRId64 " bytes",
+                   CHARDEV_WRITE_BUFFER_MAX);
+        return false;
+    }
+    if (common->has_write_buffer_interval &&
+        !common->write_buffer_interval) {
+        error_setg(errp, "write-buffer-interval must not be 0");
+        return false;
+    }
+
+    b = g_new0(ChardevWriteBuffer, 1);
+    qemu_mutex_init(&b->lock);
+    qemu_mutex_init(&b->flush_lock);
+    qemu_cond_init(&b->cond);
+    b->size = common->write_buffer;
+    b->buf = g_malloc(b->size);
+    b->spare = g_malloc(b->size);
+    b->interval_ms = common->has_write_buffer_interval ?
+                     common->write_buffer_interval :
+                     CHARDEV_WRITE_BUFFER_INTERVAL_DEFAULT;
+    chr->wbuf = b;
+    qemu_thread_create(&b->thread, "chardev-wbuf", qemu_chr_wbuf_thread,
+                       chr, QEMU_THREAD_JOINABLE);
+    return true;
+}
+
+/* Stop the thread, and write out what is left if @flush */
+static void qemu_chr_wbuf_cleanup(Chardev *chr, bool flush)
+{
+    ChardevWriteBuffer *b = chr->wbuf;
+
+    if (!b) {
+        return;
+    }
+
+    WITH_QEMU_LOCK_GUARD(&b->lock) {
+        b->stop = true;
+        qemu_cond_signal(&b->cond);
+    }
+    qemu_thread_join(&b->thread);
+    if (flush) {
+        qemu_chr_wbuf_flush(chr);
+    }
+
+    chr->wbuf = NULL;
+    qemu_cond_destroy(&b->cond);
+    qemu_mutex_destroy(&b->flush_lock);
+    qemu_mutex_destroy(&b->lock);
+    g_free(b->buf);
+    g_free(b->spare);
+    g_free(b);
+}
+
 int qemu_chr_write(Chardev *s, const uint8_t *buf, int len, bool write_all)
 {
     int offset = 0;
     int res;
 
+    if (s->wbuf && !qemu_chr_replay(s)) {
+        qemu_chr_wbuf_write(s, buf, len);
+        return len;
+    }
+
     if (qemu_chr_replay(s) && replay_mode == REPLAY_MODE_PLAY) {
         replay_char_write_event_load(&res, &offset);
         assert(offset <= len);
@@ -253,6 +417,11 @@ static void qemu_char_open(Chardev *chr, ChardevBackend *backend,
     /* Any ChardevCommon member would work */
     ChardevCommon *common = backend ? backend->u.null.data : NULL;
 
+    if (common && common->write_buffer &&
+        !qemu_chr_wbuf_init(chr, common, errp)) {
+        return;
+    }
+
     if (common && common->logfile) {
         int flags = O_WRONLY;
         if (common->has_logappend &&
@@ -295,10 +464,17 @@ static int null_chr_write(Chardev *chr, const uint8_t *buf, int len)
     return len;
 }
 
+static void char_unparent(Object *obj)
+{
+    /* The backend is still open here, unlike in char_finalize */
+    qemu_chr_wbuf_cleanup(CHARDEV(obj), true);
+}
+
 static void char_class_init(ObjectClass *oc, const void *data)
 {
     ChardevClass *cc = CHARDEV_CLASS(oc);
 
+    oc->unparent = char_unparent;
     cc->chr_write = null_chr_write;
     cc->chr_be_event = chr_be_event;
 }
@@ -312,6 +488,7 @@ static void char_finalize(Object *obj)
     }
     g_free(chr->filename);
     g_free(chr->label);
+    qemu_chr_wbuf_cleanup(chr, false);
     if (chr->logfd != -1) {
         close(chr->logfd);
     }
@@ -517,6 +694,15 @@ void qemu_chr_parse_common(QemuOpts *opts, ChardevCommon *backend)
     backend->logfile = g_strdup(logfile);
     backend->has_logappend = true;
     backend->logappend = qemu_opt_get_bool(opts, "logappend", false);
+    if (qemu_opt_get(opts, "write-buffer")) {
+        backend->has_write_buffer = true;
+        backend->write_buffer = qemu_opt_get_size(opts, "write-buffer", 0);
+    }
+    if (qemu_opt_get(opts, "write-buffer-interval")) {
+        backend->has_write_buffer_interval = true;
+        backend->write_buffer_interval =
+            qemu_opt_get_number(opts, "write-buffer-interval", 0);
+    }
 }
 
 static const ChardevClass *char_get_class(const char *driver, Error **errp)
@@ -968,6 +1154,12 @@ QemuOptsList qemu_chardev_opts = {
         },{
             .name = "logappend",
             .type = QEMU_OPT_BOOL,
+        },{
+            .name = "write-buffer",
+            .type = QEMU_OPT_SIZE,
+        },{
+            .name = "write-buffer-interval",
+            .type = QEMU_OPT_NUMBER,
         },{
             .name = "mouse",
             .type = QEMU_OPT_BOOL,
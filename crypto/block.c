@@ -365,7 +365,13 @@ void qcrypto_block_free(QCryptoBlock *block)
 }
 
 
+/* Maximum number of sectors whose IVs are computed in one go */
+#define QCRYPTO_BLOCK_IV_BATCH 256
+
 typedef int (*QCryptoCipherEncDecFunc)(QCryptoCipher *cipher,
+                                        const uint8_t *ivs,
+                                        size_t niv,
+                                        size_t sectorsize,
                                         const void *in,
                                         void *out,
                                         size_t len,
@@ -382,20 +388,31 @@ static int do_qcrypto_block_cipher_encdec(QCryptoCipher *cipher,
                                           QCryptoCipherEncDecFunc func,
                                           Error **errp)
 {
-    g_autofree uint8_t *iv = niv ? g_new0(uint8_t, niv) : NULL;
-    int ret = -1;
+    size_t max_sectors = MIN(len / sectorsize, QCRYPTO_BLOCK_IV_BATCH);
+    g_autofree uint8_t *ivs = niv ? g_new0(uint8_t, niv * max_sectors) : NULL;
+    int ret = 0;
     uint64_t startsector = offset / sectorsize;
 
     assert(QEMU_IS_ALIGNED(offset, sectorsize));
     assert(QEMU_IS_ALIGNED(len, sectorsize));
 
+    /*
+     * Compute the IVs of a batch of sectors up front, so that the cipher
+     * can process the whole batch in a single call.
+     */
     while (len > 0) {
-        size_t nbytes;
+        size_t nsectors = MIN(len / sectorsize, max_sectors);
+        size_t nbytes = nsectors * sectorsize;
+        size_t i;
+
         if (niv) {
             if (ivgen_mutex) {
                 qemu_mutex_lock(ivgen_mutex);
             }
-            ret = qcrypto_ivgen_calculate(ivgen, startsector, iv, niv, errp);
+            for (i = 0; i < nsectors && ret == 0; i++) {
+                ret = qcrypto_ivgen_calculate(ivgen, startsector + i,
+                                              ivs + i * niv, niv, errp);
+            }
             if (ivgen_mutex) {
                 qemu_mutex_unlock(ivgen_mutex);
             }
@@ -403,20 +420,13 @@ static int do_qcrypto_block_cipher_encdec(QCryptoCipher *cipher,
             if (ret < 0) {
                 return -1;
             }
-
-            if (qcrypto_cipher_setiv(cipher,
-                                     iv, niv,
-                                     errp) < 0) {
-                return -1;
-            }
         }
 
-        nbytes = len > sectorsize ? sectorsize : len;
-        if (func(cipher, buf, buf, nbytes, errp) < 0) {
+        if (func(cipher, ivs, niv, sectorsize, buf, buf, nbytes, errp) < 0) {
             return -1;
         }
 
-        startsector++;
+        startsector += nsectors;
         buf += nbytes;
         len -= nbytes;
     }
@@ -436,7 +446,7 @@ int qcrypto_block_cipher_decrypt_helper(QCryptoCipher *cipher,
 {
     return do_qcrypto_block_cipher_encdec(cipher, niv, ivgen, NULL, sectorsize,
                                           offset, buf, len,
-                                          qcrypto_cipher_decrypt, errp);
+                                          qcrypto_cipher_decrypt_sectors, errp);
 }
 
 
@@ -451,7 +461,7 @@ int qcrypto_block_cipher_encrypt_helper(QCryptoCipher *cipher,
 {
     return do_qcrypto_block_cipher_encdec(cipher, niv, ivgen, NULL, sectorsize,
                                           offset, buf, len,
-                                          qcrypto_cipher_encrypt, errp);
+                                          qcrypto_cipher_encrypt_sectors, errp);
 }
 
 int qcrypto_block_decrypt_helper(QCryptoBlock *block,
@@ -469,7 +479,8 @@ int qcrypto_block_decrypt_helper(QCryptoBlock *block,
 
     ret = do_qcrypto_block_cipher_encdec(cipher, block->niv, block->ivgen,
                                          &block->mutex, sectorsize, offset, buf,
-                                         len, qcrypto_cipher_decrypt, errp);
+                                         len, qcrypto_cipher_decrypt_sectors,
+                                         errp);
 
     qcrypto_block_push_cipher(block, cipher);
 
@@ -491,7 +502,8 @@ int qcrypto_block_encrypt_helper(QCryptoBlock *block,
 
     ret = do_qcrypto_block_cipher_encdec(cipher, block->niv, block->ivgen,
                                          &block->mutex, sectorsize, offset, buf,
-                                         len, qcrypto_cipher_encrypt, errp);
+                                         len, qcrypto_cipher_encrypt_sectors,
+                                         errp);
 
     qcrypto_block_push_cipher(block, cipher);
 
@@ -204,6 +204,80 @@ int qcrypto_cipher_setiv(QCryptoCipher *cipher,
 }
 
 
+static int qcrypto_cipher_encdec_sectors(QCryptoCipher *cipher,
+                                         const uint8_t *ivs, size_t niv,
+                                         size_t sectorsize,
+                                         const uint8_t *in,
+                                         uint8_t *out,
+                                         size_t len,
+                                         bool encrypt,
+                                         Error **errp)
+{
+    const QCryptoCipherDriver *drv = cipher->driver;
+    int ret;
+
+    assert(QEMU_IS_ALIGNED(len, sectorsize));
+
+    if (encrypt && drv->cipher_encrypt_sectors) {
+        return drv->cipher_encrypt_sectors(cipher, ivs, niv, sectorsize,
+                                           in, out, len, errp);
+    }
+    if (!encrypt && drv->cipher_decrypt_sectors) {
+        return drv->cipher_decrypt_sectors(cipher, ivs, niv, sectorsize,
+                                           in, out, len, errp);
+    }
+
+    /* Without IVs the sectors do not need to be processed one by one */
+    if (!niv) {
+        sectorsize = len;
+    }
+    while (len > 0) {
+        if (niv && drv->cipher_setiv(cipher, ivs, niv, errp) < 0) {
+            return -1;
+        }
+        if (encrypt) {
+            ret = drv->cipher_encrypt(cipher, in, out, sectorsize, errp);
+        } else {
+            ret = drv->cipher_decrypt(cipher, in, out, sectorsize, errp);
+        }
+        if (ret < 0) {
+            return -1;
+        }
+        ivs += niv;
+        in += sectorsize;
+        out += sectorsize;
+        len -= sectorsize;
+    }
+    return 0;
+}
+
+
+int qcrypto_cipher_encrypt_sectors(QCryptoCipher *cipher,
+                                   const uint8_t *ivs, size_t niv,
+                                   size_t sectorsize,
+                                   const void *in,
+                                   void *out,
+                                   size_t len,
+                                   Error **errp)
+{
+    return qcrypto_cipher_encdec_sectors(cipher, ivs, niv, sectorsize,
+                                         in, out, len, true, errp);
+}
+
+
+int qcrypto_cipher_decrypt_sectors(QCryptoCipher *cipher,
+                                   const uint8_t *ivs, size_t niv,
+                                   size_t sectorsize,
+                                   const void *in,
+                                   void *out,
+                                   size_t len,
+                                   Error **errp)
+{
+    return qcrypto_cipher_encdec_sectors(cipher, ivs, niv, sectorsize,
+                                         in, out, len, false, errp);
+}
+
+
 void qcrypto_cipher_free(QCryptoCipher *cipher)
 {
     if (cipher) {
@@ -34,6 +34,23 @@ struct QCryptoCipherDriver {
                         const uint8_t *iv, size_t niv,
                         Error **errp);
 
+    /* Optional, a loop over setiv and encrypt/decrypt is used otherwise */
+    int (*cipher_encrypt_sectors)(QCryptoCipher *cipher,
+                                  const uint8_t *ivs, size_t niv,
+                                  size_t sectorsize,
+                                  const void *in,
+                                  void *out,
+                                  size_t len,
+                                  Error **errp);
+
+    int (*cipher_decrypt_sectors)(QCryptoCipher *cipher,
+                                  const uint8_t *ivs, size_t niv,
+                                  size_t sectorsize,
+                                  const void *in,
+                                  void *out,
+                                  size_t len,
+                                  Error **errp);
+
     void (*cipher_free)(QCryptoCipher *cipher);
 };
 
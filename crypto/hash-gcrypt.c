@@ -39,7 +39,7 @@ static int qcrypto_hash_alg_map[QCRYPTO_HASH_ALGO__MAX] = {
 #endif
 };
 
-gboolean qcrypto_hash_supports(QCryptoHashAlgo alg)
+gboolean qcrypto_hash_lib_supports(QCryptoHashAlgo alg)
 {
     if (alg < G_N_ELEMENTS(qcrypto_hash_alg_map) &&
         qcrypto_hash_alg_map[alg] != GCRY_MD_NONE) {
@@ -109,7 +109,7 @@ struct qcrypto_hash_alg {
 #endif
 };
 
-gboolean qcrypto_hash_supports(QCryptoHashAlgo alg)
+gboolean qcrypto_hash_lib_supports(QCryptoHashAlgo alg)
 {
     if (alg < G_N_ELEMENTS(qcrypto_hash_alg_map) &&
         qcrypto_hash_alg_map[alg].init != NULL) {
@@ -0,0 +1,72 @@
+/*
+ * QEMU Crypto xxHash64 hash driver
+ *
+ * xxHash64 is not a cryptographic hash and is always provided by QEMU
+ * itself, independent of the crypto library in use.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "qemu/bswap.h"
+#include "qemu/xxh64.h"
+#include "hashpriv.h"
+
+static QCryptoHash *qcrypto_xxh64_hash_new(QCryptoHashAlgo alg, Error **errp)
+{
+    QCryptoHash *hash = g_new(QCryptoHash, 1);
+    QemuXXH64State *state = g_new(QemuXXH64State, 1);
+
+    assert(alg == QCRYPTO_HASH_ALGO_XXH64);
+    qemu_xxh64_init(state, 0);
+    hash->alg = alg;
+    hash->opaque = state;
+    return hash;
+}
+
+static void qcrypto_xxh64_hash_free(QCryptoHash *hash)
+{
+    g_free(hash->opaque);
+    g_free(hash);
+}
+
+static int qcrypto_xxh64_hash_update(QCryptoHash *hash,
+                                     const struct iovec *iov,
+                                     size_t niov,
+                                     Error **errp)
+{
+    size_t i;
+
+    for (i = 0; i < niov; i++) {
+        qemu_xxh64_update(hash->opaque, iov[i].iov_base, iov[i].iov_len);
+    }
+    return 0;
+}
+
+static int qcrypto_xxh64_hash_finalize(QCryptoHash *hash,
+                                       uint8_t **result,
+                                       size_t *result_len,
+                                       Error **errp)
+{
+    if (*result_len == 0) {
+        *result_len = QCRYPTO_HASH_DIGEST_LEN_XXH64;
+        *result = g_new(uint8_t, *result_len);
+    } else if (*result_len != QCRYPTO_HASH_DIGEST_LEN_XXH64) {
+        error_setg(errp,
+                   "Result buffer size %zu does not match hash %d",
+                   *result_len, QCRYPTO_HASH_DIGEST_LEN_XXH64);
+        return -1;
+    }
+
+    /* The canonical representation is big endian */
+    stq_be_p(*result, qemu_xxh64_digest(hash->opaque));
+    return 0;
+}
+
+QCryptoHashDriver qcrypto_hash_xxh64_driver = {
+    .hash_new      = qcrypto_xxh64_hash_new,
+    .hash_update   = qcrypto_xxh64_hash_update,
+    .hash_finalize = qcrypto_xxh64_hash_finalize,
+    .hash_free     = qcrypto_xxh64_hash_free,
+};
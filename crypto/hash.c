@@ -36,8 +36,17 @@ static size_t qcrypto_hash_alg_size[QCRYPTO_HASH_ALGO__MAX] = {
 #ifdef CONFIG_CRYPTO_SM3
     [QCRYPTO_HASH_ALGO_SM3] = QCRYPTO_HASH_DIGEST_LEN_SM3,
 #endif
+    [QCRYPTO_HASH_ALGO_XXH64] = QCRYPTO_HASH_DIGEST_LEN_XXH64,
 };
 
+gboolean qcrypto_hash_supports(QCryptoHashAlgo alg)
+{
+    if (alg == QCRYPTO_HASH_ALGO_XXH64) {
+        return true;
+    }
+    return qcrypto_hash_lib_supports(alg);
+}
+
 size_t qcrypto_hash_digest_len(QCryptoHashAlgo alg)
 {
     assert(alg < G_N_ELEMENTS(qcrypto_hash_alg_size));
@@ -108,6 +117,12 @@ QCryptoHash *qcrypto_hash_new(QCryptoHashAlgo alg, Error **errp)
         return NULL;
    }
 
+    if (alg == QCRYPTO_HASH_ALGO_XXH64) {
+        hash = qcrypto_hash_xxh64_driver.hash_new(alg, errp);
+        hash->driver = &qcrypto_hash_xxh64_driver;
+        return hash;
+    }
+
 #ifdef CONFIG_AF_ALG
     hash = qcrypto_hash_afalg_driver.hash_new(alg, NULL);
     if (hash) {
@@ -34,6 +34,10 @@ struct QCryptoHashDriver {
 };
 
 extern QCryptoHashDriver qcrypto_hash_lib_driver;
+extern QCryptoHashDriver qcrypto_hash_xxh64_driver;
+
+/* Whether qcrypto_hash_lib_driver implements @alg */
+gboolean qcrypto_hash_lib_supports(QCryptoHashAlgo alg);
 
 #ifdef CONFIG_AF_ALG
 
@@ -170,6 +170,27 @@ qcrypto_tls_creds_prop_get_dir(Object *obj,
 }
 
 
+static void
+qcrypto_tls_creds_prop_set_kernel_offload(Object *obj,
+                                          bool value,
+                                          Error **errp G_GNUC_UNUSED)
+{
+    QCryptoTLSCreds *creds = QCRYPTO_TLS_CREDS(obj);
+
+    creds->kernelOffload = value;
+}
+
+
+static bool
+qcrypto_tls_creds_prop_get_kernel_offload(Object *obj,
+                                          Error **errp G_GNUC_UNUSED)
+{
+    QCryptoTLSCreds *creds = QCRYPTO_TLS_CREDS(obj);
+
+    return creds->kernelOffload;
+}
+
+
 static void
 qcrypto_tls_creds_prop_set_priority(Object *obj,
                                     const char *value,
@@ -229,6 +250,9 @@ qcrypto_tls_creds_class_init(ObjectClass *oc, const void *data)
     object_class_property_add_str(oc, "priority",
                                   qcrypto_tls_creds_prop_get_priority,
                                   qcrypto_tls_creds_prop_set_priority);
+    object_class_property_add_bool(oc, "kernel-offload",
+                                   qcrypto_tls_creds_prop_get_kernel_offload,
+                                   qcrypto_tls_creds_prop_set_kernel_offload);
 }
 
 
@@ -33,6 +33,7 @@ struct QCryptoTLSCreds {
     char *dir;
     QCryptoTLSCredsEndpoint endpoint;
     bool verifyPeer;
+    bool kernelOffload;
     char *priority;
     QCryptoTLSCredsBox *box;
 };
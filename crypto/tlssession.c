@@ -35,6 +35,18 @@
 
 #include <gnutls/x509.h>
 
+#ifdef CONFIG_LINUX
+#include <netinet/tcp.h>
+#include <linux/tls.h>
+
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+#ifndef TCP_ULP
+#define TCP_ULP 31
+#endif
+#endif
+
 
 struct QCryptoTLSSession {
     QCryptoTLSCreds *creds;
@@ -62,6 +74,9 @@ struct QCryptoTLSSession {
     bool requireThreadSafety;
     bool lockEnabled;
     QemuMutex lock;
+
+    /* Socket whose sending side is handled by kernel TLS, or -1 */
+    int ktlsFd;
 };
 
 
@@ -183,6 +198,7 @@ qcrypto_tls_session_new(QCryptoTLSCreds *creds,
     object_ref(OBJECT(creds));
 
     qemu_mutex_init(&session->lock);
+    session->ktlsFd = -1;
 
     if (creds->endpoint != endpoint) {
         error_setg(errp, "Credentials endpoint doesn't match session");
@@ -441,6 +457,19 @@ qcrypto_tls_session_write(QCryptoTLSSession *session,
 {
     ssize_t ret;
 
+    if (session->ktlsFd >= 0) {
+        /* The kernel builds and encrypts the records */
+        ret = send(session->ktlsFd, buf, len, 0);
+        if (ret < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return QCRYPTO_TLS_SESSION_ERR_BLOCK;
+            }
+            error_setg_errno(errp, errno, "Cannot write to TLS channel");
+            return -1;
+        }
+        return ret;
+    }
+
     if (session->lockEnabled) {
         qemu_mutex_lock(&session->lock);
     }
@@ -585,6 +614,159 @@ qcrypto_tls_session_handshake(QCryptoTLSSession *session,
 }
 
 
+#ifdef CONFIG_LINUX
+/*
+ * Fill in the kernel's crypto info for an AES-GCM cipher, @info being
+ * one of the struct tls12_crypto_info_aes_gcm_* types and @PREFIX the
+ * matching TLS_CIPHER_AES_GCM_* prefix.
+ */
+#define QCRYPTO_TLS_KTLS_AES_GCM(info, PREFIX, version, iv, key, seq)   \
+    ({                                                                  \
+        size_t iv_size = (version) == GNUTLS_TLS1_2 ?                   \
+            PREFIX##_SALT_SIZE : PREFIX##_SALT_SIZE + PREFIX##_IV_SIZE; \
+        bool ok = (key).size == PREFIX##_KEY_SIZE &&                    \
+            (iv).size == iv_size;                                       \
+        if (ok) {                                                       \
+            (info).info.version = (version) == GNUTLS_TLS1_2 ?          \
+                TLS_1_2_VERSION : TLS_1_3_VERSION;                      \
+            (info).info.cipher_type = PREFIX;                           \
+            memcpy((info).salt, (iv).data, PREFIX##_SALT_SIZE);         \
+            /* TLS 1.2 uses the sequence number as explicit nonce */    \
+            memcpy((info).iv, (version) == GNUTLS_TLS1_2 ? (seq) :      \
+                   (iv).data + PREFIX##_SALT_SIZE, PREFIX##_IV_SIZE);   \
+            memcpy((info).rec_seq, (seq), PREFIX##_REC_SEQ_SIZE);       \
+            memcpy((info).key, (key).data, PREFIX##_KEY_SIZE);          \
+        }                                                               \
+        ok;                                                             \
+    })
+
+static int
+qcrypto_tls_session_ktls_set_tx(QCryptoTLSSession *session, int fd,
+                                Error **errp)
+{
+    gnutls_protocol_t version = gnutls_protocol_get_version(session->handle);
+    gnutls_cipher_algorithm_t cipher = gnutls_cipher_get(session->handle);
+    union {
+        struct tls12_crypto_info_aes_gcm_128 aes128;
+        struct tls12_crypto_info_aes_gcm_256 aes256;
+    } info;
+    gnutls_datum_t iv, key;
+    unsigned char seq[8];
+    socklen_t len;
+    bool ok;
+    int ret;
+
+    if (version != GNUTLS_TLS1_2 && version != GNUTLS_TLS1_3) {
+        error_setg(errp, "Kernel TLS does not support %s",
+                   gnutls_protocol_get_name(version));
+        return -1;
+    }
+
+    ret = gnutls_record_get_state(session->handle, 0, NULL, &iv, &key, seq);
+    if (ret < 0) {
+        error_setg(errp, "Cannot get TLS session keys: %s",
+                   gnutls_strerror(ret));
+        return -1;
+    }
+
+    memset(&info, 0, sizeof(info));
+    switch (cipher) {
+    case GNUTLS_CIPHER_AES_128_GCM:
+        ok = QCRYPTO_TLS_KTLS_AES_GCM(info.aes128, TLS_CIPHER_AES_GCM_128,
+                                      version, iv, key, seq);
+        len = sizeof(info.aes128);
+        break;
+    case GNUTLS_CIPHER_AES_256_GCM:
+        ok = QCRYPTO_TLS_KTLS_AES_GCM(info.aes256, TLS_CIPHER_AES_GCM_256,
+                                      version, iv, key, seq);
+        len = sizeof(info.aes256);
+        break;
+    default:
+        ok = false;
+        break;
+    }
+    if (!ok) {
+        error_setg(errp, "Kernel TLS does not support cipher %s",
+                   gnutls_cipher_get_name(cipher));
+        return -1;
+    }
+
+    if (setsockopt(fd, SOL_TCP, TCP_ULP, "tls", sizeof("tls")) < 0) {
+        error_setg_errno(errp, errno, "Cannot enable kernel TLS");
+        ret = -1;
+    } else if (setsockopt(fd, SOL_TLS, TLS_TX, &info, len) < 0) {
+        error_setg_errno(errp, errno, "Cannot set kernel TLS keys");
+        ret = -1;
+    } else {
+        ret = 0;
+    }
+    qemu_explicit_bzero(&info, sizeof(info));
+    return ret;
+}
+
+
+/* Send close_notify through the kernel, which owns the sending keys */
+static int
+qcrypto_tls_session_ktls_bye(QCryptoTLSSession *session, Error **errp)
+{
+    char alert[2] = { 1 /* warning */, 0 /* close_notify */ };
+    char control[CMSG_SPACE(sizeof(unsigned char))] = { 0 };
+    struct iovec iov = { .iov_base = alert, .iov_len = sizeof(alert) };
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control,
+        .msg_controllen = sizeof(control),
+    };
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+
+    cmsg->cmsg_level = SOL_TLS;
+    cmsg->cmsg_type = TLS_SET_RECORD_TYPE;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(unsigned char));
+    *CMSG_DATA(cmsg) = 21; /* alert */
+
+    if (sendmsg(session->ktlsFd, &msg, 0) < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return QCRYPTO_TLS_BYE_SENDING;
+        }
+        error_setg_errno(errp, errno, "TLS termination failed");
+        return -1;
+    }
+    return QCRYPTO_TLS_BYE_COMPLETE;
+}
+#endif
+
+
+int
+qcrypto_tls_session_enable_ktls(QCryptoTLSSession *session, int fd,
+                                Error **errp)
+{
+    assert(session->handshakeComplete);
+
+    if (!session->creds->kernelOffload) {
+        return -1;
+    }
+
+#ifdef CONFIG_LINUX
+    if (qcrypto_tls_session_ktls_set_tx(session, fd, errp) < 0) {
+        return -1;
+    }
+    session->ktlsFd = fd;
+    return 0;
+#else
+    error_setg(errp, "Kernel TLS is not supported on this platform");
+    return -1;
+#endif
+}
+
+
+bool
+qcrypto_tls_session_has_ktls(QCryptoTLSSession *session)
+{
+    return session->ktlsFd >= 0;
+}
+
+
 int
 qcrypto_tls_session_bye(QCryptoTLSSession *session, Error **errp)
 {
@@ -594,6 +776,12 @@ qcrypto_tls_session_bye(QCryptoTLSSession *session, Error **errp)
         return 0;
     }
 
+#ifdef CONFIG_LINUX
+    if (session->ktlsFd >= 0) {
+        return qcrypto_tls_session_ktls_bye(session, errp);
+    }
+#endif
+
     if (session->lockEnabled) {
         qemu_mutex_lock(&session->lock);
     }
@@ -735,6 +923,23 @@ qcrypto_tls_session_handshake(QCryptoTLSSession *sess,
 }
 
 
+int
+qcrypto_tls_session_enable_ktls(QCryptoTLSSession *sess G_GNUC_UNUSED,
+                                int fd G_GNUC_UNUSED,
+                                Error **errp)
+{
+    error_setg(errp, "TLS requires GNUTLS support");
+    return -1;
+}
+
+
+bool
+qcrypto_tls_session_has_ktls(QCryptoTLSSession *sess G_GNUC_UNUSED)
+{
+    return false;
+}
+
+
 int
 qcrypto_tls_session_bye(QCryptoTLSSession *session, Error **errp)
 {
@@ -32,6 +32,7 @@
 #include "hw/core/cpu.h"
 #include "win_dump.h"
 #include "qemu/range.h"
+#include "block/thread-pool.h"
 
 #include <zlib.h>
 #ifdef CONFIG_LZO
@@ -40,6 +41,9 @@
 #ifdef CONFIG_SNAPPY
 #include <snappy-c.h>
 #endif
+#ifdef CONFIG_ZSTD
+#include <zstd.h>
+#endif
 #ifndef ELF_MACHINE_UNAME
 #define ELF_MACHINE_UNAME "Unknown"
 #endif
@@ -1004,6 +1008,11 @@ static void create_header32(DumpState *s, Error **errp)
     if (s->flag_compress & DUMP_DH_COMPRESSED_SNAPPY) {
         status |= DUMP_DH_COMPRESSED_SNAPPY;
     }
+#endif
+#ifdef CONFIG_ZSTD
+    if (s->flag_compress & DUMP_DH_COMPRESSED_ZSTD) {
+        status |= DUMP_DH_COMPRESSED_ZSTD;
+    }
 #endif
     dh->status = cpu_to_dump32(s, status);
 
@@ -1115,6 +1124,11 @@ static void create_header64(DumpState *s, Error **errp)
     if (s->flag_compress & DUMP_DH_COMPRESSED_SNAPPY) {
         status |= DUMP_DH_COMPRESSED_SNAPPY;
     }
+#endif
+#ifdef CONFIG_ZSTD
+    if (s->flag_compress & DUMP_DH_COMPRESSED_ZSTD) {
+        status |= DUMP_DH_COMPRESSED_ZSTD;
+    }
 #endif
     dh->status = cpu_to_dump32(s, status);
 
@@ -1467,6 +1481,217 @@ static size_t get_len_buf_out(size_t page_size, uint32_t flag_compress)
     case DUMP_DH_COMPRESSED_SNAPPY:
         return snappy_max_compressed_length(page_size);
 #endif
+
+#ifdef CONFIG_ZSTD
+    case DUMP_DH_COMPRESSED_ZSTD:
+        return ZSTD_compressBound(page_size);
+#endif
+    }
+    return 0;
+}
+
+/* Number of pages handed to a compression thread at a time */
+#define DUMP_BATCH_PAGES            512
+
+/* Maximum number of compression threads */
+#define DUMP_MAX_THREADS            64
+
+/*
+ * A batch of consecutive dumpable pages.  The batches are compressed in
+ * parallel and then written out in order by the dump thread.
+ */
+typedef struct DumpPageBatch {
+    DumpState *state;
+    size_t len_buf_out;
+    size_t nr_pages;
+    /* the page data, either guest memory or a copy in @copy */
+    uint8_t *pages[DUMP_BATCH_PAGES];
+    uint8_t *copy;
+    /* compressed data of page i is at buf_out + i * len_buf_out */
+    uint8_t *buf_out;
+    /* size and flags of the data to write, size 0 for a zero page */
+    uint32_t size[DUMP_BATCH_PAGES];
+    uint32_t flags[DUMP_BATCH_PAGES];
+#ifdef CONFIG_LZO
+    lzo_bytep wrkmem;
+#endif
+#ifdef CONFIG_ZSTD
+    ZSTD_CCtx *zstd;
+#endif
+} DumpPageBatch;
+
+static DumpPageBatch *dump_page_batch_new(DumpState *s, size_t len_buf_out)
+{
+    DumpPageBatch *b = g_new0(DumpPageBatch, 1);
+
+    b->state = s;
+    b->len_buf_out = len_buf_out;
+    b->copy = g_malloc(DUMP_BATCH_PAGES * s->dump_info.page_size);
+    b->buf_out = g_malloc(DUMP_BATCH_PAGES * len_buf_out);
+#ifdef CONFIG_LZO
+    b->wrkmem = g_malloc(LZO1X_1_MEM_COMPRESS);
+#endif
+#ifdef CONFIG_ZSTD
+    if (s->flag_compress & DUMP_DH_COMPRESSED_ZSTD) {
+        b->zstd = ZSTD_createCCtx();
+    }
+#endif
+    return b;
+}
+
+static void dump_page_batch_free(DumpPageBatch *b)
+{
+    if (!b) {
+        return;
+    }
+    g_free(b->copy);
+    g_free(b->buf_out);
+#ifdef CONFIG_LZO
+    g_free(b->wrkmem);
+#endif
+#ifdef CONFIG_ZSTD
+    ZSTD_freeCCtx(b->zstd);
+#endif
+    g_free(b);
+}
+
+/*
+ * Compress page @i of @b into its slot of b->buf_out.
+ *
+ * only one compression format will be used here, for s->flag_compress is
+ * set. But when compression fails to work, we fall back to save in plaintext.
+ */
+static void dump_compress_page(DumpPageBatch *b, size_t i)
+{
+    DumpState *s = b->state;
+    uint32_t page_size = s->dump_info.page_size;
+    uint8_t *buf = b->pages[i];
+    uint8_t *buf_out = b->buf_out + i * b->len_buf_out;
+    uLongf zlib_size_out = b->len_buf_out;
+#ifdef CONFIG_LZO
+    lzo_uint lzo_size_out = b->len_buf_out;
+#endif
+#if defined(CONFIG_SNAPPY) || defined(CONFIG_ZSTD)
+    size_t size_out;
+#endif
+
+    /* check zero page */
+    if (buffer_is_zero(buf, page_size)) {
+        b->size[i] = 0;
+        b->flags[i] = 0;
+        return;
+    }
+
+    if ((s->flag_compress & DUMP_DH_COMPRESSED_ZLIB) &&
+        compress2(buf_out, &zlib_size_out, buf, page_size,
+                  Z_BEST_SPEED) == Z_OK &&
+        zlib_size_out < page_size) {
+        b->flags[i] = DUMP_DH_COMPRESSED_ZLIB;
+        b->size[i] = zlib_size_out;
+        return;
+    }
+#ifdef CONFIG_LZO
+    if ((s->flag_compress & DUMP_DH_COMPRESSED_LZO) &&
+        lzo1x_1_compress(buf, page_size, buf_out, &lzo_size_out,
+                         b->wrkmem) == LZO_E_OK &&
+        lzo_size_out < page_size) {
+        b->flags[i] = DUMP_DH_COMPRESSED_LZO;
+        b->size[i] = lzo_size_out;
+        return;
+    }
+#endif
+#ifdef CONFIG_SNAPPY
+    size_out = b->len_buf_out;
+    if ((s->flag_compress & DUMP_DH_COMPRESSED_SNAPPY) &&
+        snappy_compress((char *)buf, page_size, (char *)buf_out,
+                        &size_out) == SNAPPY_OK &&
+        size_out < page_size) {
+        b->flags[i] = DUMP_DH_COMPRESSED_SNAPPY;
+        b->size[i] = size_out;
+        return;
+    }
+#endif
+#ifdef CONFIG_ZSTD
+    if (b->zstd) {
+        size_out = ZSTD_compressCCtx(b->zstd, buf_out, b->len_buf_out,
+                                     buf, page_size, 1);
+        if (!ZSTD_isError(size_out) && size_out < page_size) {
+            b->flags[i] = DUMP_DH_COMPRESSED_ZSTD;
+            b->size[i] = size_out;
+            return;
+        }
+    }
+#endif
+
+    /* fall back to save in plaintext, a whole target page */
+    b->flags[i] = 0;
+    b->size[i] = page_size;
+}
+
+static int dump_compress_batch(void *opaque)
+{
+    DumpPageBatch *b = opaque;
+    size_t i;
+
+    for (i = 0; i < b->nr_pages; i++) {
+        dump_compress_page(b, i);
+    }
+    return 0;
+}
+
+/*
+ * Fill @b with the next pages of the guest, return false once the end of
+ * guest memory is reached.
+ */
+static bool dump_fill_batch(DumpPageBatch *b, GuestPhysBlock **block_iter,
+                            uint64_t *pfn_iter)
+{
+    uint32_t page_size = b->state->dump_info.page_size;
+    uint8_t *buf;
+
+    for (b->nr_pages = 0; b->nr_pages < DUMP_BATCH_PAGES; b->nr_pages++) {
+        buf = b->copy + b->nr_pages * page_size;
+        if (!get_next_page(block_iter, pfn_iter, &buf, b->state)) {
+            return false;
+        }
+        b->pages[b->nr_pages] = buf;
+    }
+    return true;
+}
+
+static int dump_write_batch(DumpPageBatch *b, DataCache *page_desc,
+                            DataCache *page_data, PageDescriptor *pd_zero,
+                            off_t *offset_data, Error **errp)
+{
+    DumpState *s = b->state;
+    PageDescriptor pd;
+    size_t i;
+
+    for (i = 0; i < b->nr_pages; i++) {
+        if (!b->size[i]) {
+            /* zero pages all share the first page of the page section */
+            pd = *pd_zero;
+        } else {
+            const uint8_t *buf = b->flags[i] ? b->buf_out + i * b->len_buf_out
+                                             : b->pages[i];
+
+            if (write_cache(page_data, buf, b->size[i], false) < 0) {
+                error_setg(errp, "dump: failed to write page data");
+                return -1;
+            }
+
+            pd.flags = cpu_to_dump32(s, b->flags[i]);
+            pd.size = cpu_to_dump32(s, b->size[i]);
+            pd.page_flags = cpu_to_dump64(s, 0);
+            pd.offset = cpu_to_dump64(s, *offset_data);
+            *offset_data += b->size[i];
+        }
+
+        if (write_cache(page_desc, &pd, sizeof(PageDescriptor), false) < 0) {
+            error_setg(errp, "dump: failed to write page desc");
+            return -1;
+        }
+        s->written_size += s->dump_info.page_size;
     }
     return 0;
 }
@@ -1475,17 +1700,16 @@ static void write_dump_pages(DumpState *s, Error **errp)
 {
     int ret = 0;
     DataCache page_desc, page_data;
-    size_t len_buf_out, size_out;
-#ifdef CONFIG_LZO
-    lzo_bytep wrkmem = NULL;
-#endif
-    uint8_t *buf_out = NULL;
+    size_t len_buf_out;
     off_t offset_desc, offset_data;
-    PageDescriptor pd, pd_zero;
+    PageDescriptor pd_zero;
     uint8_t *buf;
     GuestPhysBlock *block_iter = NULL;
     uint64_t pfn_iter;
-    g_autofree uint8_t *page = NULL;
+    ThreadPool *pool = NULL;
+    DumpPageBatch **batches;
+    int nr_threads, nr_batches, i;
+    bool done = false;
 
     /* get offset of page_desc and page_data in dump file */
     offset_desc = s->offset_page;
@@ -1498,11 +1722,15 @@ static void write_dump_pages(DumpState *s, Error **errp)
     len_buf_out = get_len_buf_out(s->dump_info.page_size, s->flag_compress);
     assert(len_buf_out != 0);
 
-#ifdef CONFIG_LZO
-    wrkmem = g_malloc(LZO1X_1_MEM_COMPRESS);
-#endif
-
-    buf_out = g_malloc(len_buf_out);
+    nr_threads = MIN(g_get_num_processors(), DUMP_MAX_THREADS);
+    batches = g_new0(DumpPageBatch *, nr_threads);
+    for (i = 0; i < nr_threads; i++) {
+        batches[i] = dump_page_batch_new(s, len_buf_out);
+    }
+    if (nr_threads > 1) {
+        pool = thread_pool_new();
+        thread_pool_set_max_threads(pool, nr_threads);
+    }
 
     /*
      * init zero page's page_desc and page_data, because every zero page
@@ -1521,103 +1749,34 @@ static void write_dump_pages(DumpState *s, Error **errp)
     }
 
     offset_data += s->dump_info.page_size;
-    page = g_malloc(s->dump_info.page_size);
 
     /*
-     * dump memory to vmcore page by page. zero page will all be resided in the
-     * first page of page section
+     * dump memory to vmcore one round of batches at a time: the batches are
+     * compressed in parallel, then written in the order of the pages. zero
+     * page will all be resided in the first page of page section
      */
-    for (buf = page; get_next_page(&block_iter, &pfn_iter, &buf, s); buf = page) {
-        /* check zero page */
-        if (buffer_is_zero(buf, s->dump_info.page_size)) {
-            ret = write_cache(&page_desc, &pd_zero, sizeof(PageDescriptor),
-                              false);
-            if (ret < 0) {
-                error_setg(errp, "dump: failed to write page desc");
-                goto out;
-            }
-        } else {
-            /*
-             * not zero page, then:
-             * 1. compress the page
-             * 2. write the compressed page into the cache of page_data
-             * 3. get page desc of the compressed page and write it into the
-             *    cache of page_desc
-             *
-             * only one compression format will be used here, for
-             * s->flag_compress is set. But when compression fails to work,
-             * we fall back to save in plaintext.
-             */
-             size_out = len_buf_out;
-             if ((s->flag_compress & DUMP_DH_COMPRESSED_ZLIB) &&
-                    (compress2(buf_out, (uLongf *)&size_out, buf,
-                               s->dump_info.page_size, Z_BEST_SPEED) == Z_OK) &&
-                    (size_out < s->dump_info.page_size)) {
-                pd.flags = cpu_to_dump32(s, DUMP_DH_COMPRESSED_ZLIB);
-                pd.size  = cpu_to_dump32(s, size_out);
-
-                ret = write_cache(&page_data, buf_out, size_out, false);
-                if (ret < 0) {
-                    error_setg(errp, "dump: failed to write page data");
-                    goto out;
-                }
-#ifdef CONFIG_LZO
-            } else if ((s->flag_compress & DUMP_DH_COMPRESSED_LZO) &&
-                    (lzo1x_1_compress(buf, s->dump_info.page_size, buf_out,
-                    (lzo_uint *)&size_out, wrkmem) == LZO_E_OK) &&
-                    (size_out < s->dump_info.page_size)) {
-                pd.flags = cpu_to_dump32(s, DUMP_DH_COMPRESSED_LZO);
-                pd.size  = cpu_to_dump32(s, size_out);
-
-                ret = write_cache(&page_data, buf_out, size_out, false);
-                if (ret < 0) {
-                    error_setg(errp, "dump: failed to write page data");
-                    goto out;
-                }
-#endif
-#ifdef CONFIG_SNAPPY
-            } else if ((s->flag_compress & DUMP_DH_COMPRESSED_SNAPPY) &&
-                    (snappy_compress((char *)buf, s->dump_info.page_size,
-                    (char *)buf_out, &size_out) == SNAPPY_OK) &&
-                    (size_out < s->dump_info.page_size)) {
-                pd.flags = cpu_to_dump32(s, DUMP_DH_COMPRESSED_SNAPPY);
-                pd.size  = cpu_to_dump32(s, size_out);
-
-                ret = write_cache(&page_data, buf_out, size_out, false);
-                if (ret < 0) {
-                    error_setg(errp, "dump: failed to write page data");
-                    goto out;
-                }
-#endif
+    while (!done) {
+        for (nr_batches = 0; nr_batches < nr_threads && !done; nr_batches++) {
+            DumpPageBatch *b = batches[nr_batches];
+
+            done = !dump_fill_batch(b, &block_iter, &pfn_iter);
+            if (pool) {
+                thread_pool_submit(pool, dump_compress_batch, b, NULL);
             } else {
-                /*
-                 * fall back to save in plaintext, size_out should be
-                 * assigned the target's page size
-                 */
-                pd.flags = cpu_to_dump32(s, 0);
-                size_out = s->dump_info.page_size;
-                pd.size = cpu_to_dump32(s, size_out);
-
-                ret = write_cache(&page_data, buf,
-                                  s->dump_info.page_size, false);
-                if (ret < 0) {
-                    error_setg(errp, "dump: failed to write page data");
-                    goto out;
-                }
+                dump_compress_batch(b);
             }
+        }
+        if (pool) {
+            thread_pool_wait(pool);
+        }
 
-            /* get and write page desc here */
-            pd.page_flags = cpu_to_dump64(s, 0);
-            pd.offset = cpu_to_dump64(s, offset_data);
-            offset_data += size_out;
-
-            ret = write_cache(&page_desc, &pd, sizeof(PageDescriptor), false);
+        for (i = 0; i < nr_batches; i++) {
+            ret = dump_write_batch(batches[i], &page_desc, &page_data,
+                                   &pd_zero, &offset_data, errp);
             if (ret < 0) {
-                error_setg(errp, "dump: failed to write page desc");
                 goto out;
             }
         }
-        s->written_size += s->dump_info.page_size;
     }
 
     ret = write_cache(&page_desc, NULL, 0, true);
@@ -1635,11 +1794,13 @@ out:
     free_data_cache(&page_desc);
     free_data_cache(&page_data);
 
-#ifdef CONFIG_LZO
-    g_free(wrkmem);
-#endif
-
-    g_free(buf_out);
+    if (pool) {
+        thread_pool_free(pool);
+    }
+    for (i = 0; i < nr_threads; i++) {
+        dump_page_batch_free(batches[i]);
+    }
+    g_free(batches);
 }
 
 static void create_kdump_vmcore(DumpState *s, Error **errp)
@@ -1947,6 +2108,10 @@ static void dump_init(DumpState *s, int fd, bool has_format,
             s->flag_compress = DUMP_DH_COMPRESSED_SNAPPY;
             break;
 
+        case DUMP_GUEST_MEMORY_FORMAT_KDUMP_ZSTD:
+            s->flag_compress = DUMP_DH_COMPRESSED_ZSTD;
+            break;
+
         default:
             s->flag_compress = 0;
         }
@@ -2106,6 +2271,10 @@ void qmp_dump_guest_memory(bool paging, const char *protocol,
             format = DUMP_GUEST_MEMORY_FORMAT_KDUMP_SNAPPY;
             kdump_raw = true;
             break;
+        case DUMP_GUEST_MEMORY_FORMAT_KDUMP_RAW_ZSTD:
+            format = DUMP_GUEST_MEMORY_FORMAT_KDUMP_ZSTD;
+            kdump_raw = true;
+            break;
         default:
             break;
         }
@@ -2133,7 +2302,7 @@ void qmp_dump_guest_memory(bool paging, const char *protocol,
         detach_p = detach;
     }
 
-    /* check whether lzo/snappy is supported */
+    /* check whether lzo/snappy/zstd is supported */
 #ifndef CONFIG_LZO
     if (has_format && format == DUMP_GUEST_MEMORY_FORMAT_KDUMP_LZO) {
         error_setg(errp, "kdump-lzo is not available now");
@@ -2148,6 +2317,13 @@ void qmp_dump_guest_memory(bool paging, const char *protocol,
     }
 #endif
 
+#ifndef CONFIG_ZSTD
+    if (has_format && format == DUMP_GUEST_MEMORY_FORMAT_KDUMP_ZSTD) {
+        error_setg(errp, "kdump-zstd is not available now");
+        return;
+    }
+#endif
+
     if (has_format && format == DUMP_GUEST_MEMORY_FORMAT_WIN_DMP
         && !win_dump_available(errp)) {
         return;
@@ -2235,6 +2411,12 @@ DumpGuestMemoryCapability *qmp_query_dump_guest_memory_capability(Error **errp)
     QAPI_LIST_APPEND(tail, DUMP_GUEST_MEMORY_FORMAT_KDUMP_RAW_SNAPPY);
 #endif
 
+    /* add new item if kdump-zstd is available */
+#ifdef CONFIG_ZSTD
+    QAPI_LIST_APPEND(tail, DUMP_GUEST_MEMORY_FORMAT_KDUMP_ZSTD);
+    QAPI_LIST_APPEND(tail, DUMP_GUEST_MEMORY_FORMAT_KDUMP_RAW_ZSTD);
+#endif
+
     if (win_dump_available(NULL)) {
         QAPI_LIST_APPEND(tail, DUMP_GUEST_MEMORY_FORMAT_WIN_DMP);
     }
@@ -2901,7 +2901,8 @@ float16 float64_to_float16(float64 a, bool ieee, float_status *s)
     return float16a_round_pack_canonical(&p, s, fmt);
 }
 
-float32 float64_to_float32(float64 a, float_status *s)
+static float32 QEMU_SOFTFLOAT_ATTR
+soft_float64_to_float32(float64 a, float_status *s)
 {
     FloatParts64 p;
 
@@ -2910,6 +2911,26 @@ float32 float64_to_float32(float64 a, float_status *s)
     return float32_round_pack_canonical(&p, s);
 }
 
+float32 float64_to_float32(float64 a, float_status *s)
+{
+    if (can_use_fpu(s) && likely(float64_is_normal(a))) {
+        /*
+         * Narrowing may be inexact, which is already flagged, or may
+         * overflow or underflow, which we leave to softfloat.  As for
+         * the arithmetic ops, a result of FLT_MIN may have been tiny
+         * before rounding.
+         */
+        union_float64 ud;
+        union_float32 uf;
+        ud.s = a;
+        uf.h = ud.h;
+        if (likely(float32_is_normal(uf.s) && fabsf(uf.h) > FLT_MIN)) {
+            return uf.s;
+        }
+    }
+    return soft_float64_to_float32(a, s);
+}
+
 float32 bfloat16_to_float32(bfloat16 a, float_status *s)
 {
     FloatParts64 p;
@@ -4357,10 +4378,48 @@ static bfloat16 bfloat16_minmax(bfloat16 a, bfloat16 b,
     return bfloat16_round_pack_canonical(pr, s);
 }
 
+/*
+ * With neither NaN nor denormal inputs, min/max cannot raise any
+ * exception and return one of the operands unchanged, so the choice
+ * can be made with integer compares on the encodings.  Return true
+ * if A is the result.  This mirrors the ordering in parts_minmax.
+ */
+static inline bool minmax_pick_a(uint64_t a, uint64_t b,
+                                 uint64_t sign, int flags)
+{
+    uint64_t ma = a & (sign - 1);
+    uint64_t mb = b & (sign - 1);
+    int cmp = 0;
+
+    if (flags & minmax_ismag) {
+        cmp = ma < mb ? -1 : ma > mb;
+    }
+    if (cmp == 0) {
+        if ((a ^ b) & sign) {
+            cmp = a & sign ? -1 : 1;
+        } else {
+            cmp = ma < mb ? -1 : ma > mb;
+            if (a & sign) {
+                cmp = -cmp;
+            }
+        }
+    }
+    if (flags & minmax_ismin) {
+        cmp = -cmp;
+    }
+    return cmp >= 0;
+}
+
 static float32 float32_minmax(float32 a, float32 b, float_status *s, int flags)
 {
     FloatParts64 pa, pb, *pr;
 
+    if (likely(!float32_is_any_nan(a) && !float32_is_denormal(a) &&
+               !float32_is_any_nan(b) && !float32_is_denormal(b))) {
+        return minmax_pick_a(float32_val(a), float32_val(b),
+                             1ull << 31, flags) ? a : b;
+    }
+
     float32_unpack_canonical(&pa, a, s);
     float32_unpack_canonical(&pb, b, s);
     pr = parts_minmax(&pa, &pb, s, flags);
@@ -4372,6 +4431,12 @@ static float64 float64_minmax(float64 a, float64 b, float_status *s, int flags)
 {
     FloatParts64 pa, pb, *pr;
 
+    if (likely(!float64_is_any_nan(a) && !float64_is_denormal(a) &&
+               !float64_is_any_nan(b) && !float64_is_denormal(b))) {
+        return minmax_pick_a(float64_val(a), float64_val(b),
+                             1ull << 63, flags) ? a : b;
+    }
+
     float64_unpack_canonical(&pa, a, s);
     float64_unpack_canonical(&pb, b, s);
     pr = parts_minmax(&pa, &pb, s, flags);
@@ -242,6 +242,21 @@ SRST
     Show memory tree.
 ERST
 
+    {
+        .name       = "mmio-bql",
+        .args_type  = "",
+        .params     = "",
+        .help       = "show the time MMIO accesses waited for the BQL, "
+                      "by memory region",
+        .cmd        = hmp_info_mmio_bql,
+    },
+
+SRST
+  ``info mmio-bql``
+    Show, for each memory region, how many MMIO and PIO accesses had to
+    take the BQL and how long they waited for it.
+ERST
+
 #if defined(CONFIG_TCG)
     {
         .name       = "jit",
@@ -256,6 +271,27 @@ SRST
     Show dynamic compiler info.
 ERST
 
+#if defined(CONFIG_TCG)
+    {
+        .name       = "jit-tbs",
+        .args_type  = "spills:-s,calls:-c,host:-b,max:i?",
+        .params     = "[-s] [-c] [-b] [max]",
+        .help       = "show code quality metrics of up to max translated "
+                      "blocks (default: 10), sorted by execution count "
+                      "(-s: sort by register spills; -c: sort by helper "
+                      "calls; -b: sort by host code size)",
+    },
+#endif
+
+SRST
+  ``info jit-tbs`` [-s] [-c] [-b] [*max*]
+    Show the generated host code size, register spills, helper calls
+    and kinds of exit (chained ``goto_tb``, ``goto_ptr`` lookups and
+    returns to the main loop) of the hottest translated blocks.  Execution
+    counts are only maintained for blocks translated while the
+    ``tb-profile`` property of the tcg accelerator is on.
+ERST
+
     {
         .name       = "sync-profile",
         .args_type  = "mean:-m,no_coalesce:-n,max:i?",
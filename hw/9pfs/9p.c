@@ -1616,6 +1616,8 @@ static void coroutine_fn v9fs_getattr(void *opaque)
     V9fsFidState *fidp;
     uint64_t request_mask;
     V9fsStatDotl v9stat_dotl;
+    uint64_t st_gen;
+    int st_gen_err = -EOPNOTSUPP;
     V9fsPDU *pdu = opaque;
 
     retval = pdu_unmarshal(pdu, offset, "dq", &fid, &request_mask);
@@ -1629,11 +1631,11 @@ static void coroutine_fn v9fs_getattr(void *opaque)
         retval = -ENOENT;
         goto out_nofid;
     }
-    if (fid_has_valid_file_handle(pdu->s, fidp)) {
-        retval = v9fs_co_fstat(pdu, fidp, &stbuf);
-    } else {
-        retval = v9fs_co_lstat(pdu, &fidp->path, &stbuf);
-    }
+    /* fetch st_gen along with the attributes, if requested */
+    retval = v9fs_co_getattr(pdu, fidp, fid_has_valid_file_handle(pdu->s, fidp),
+                             &stbuf,
+                             request_mask & P9_STATS_GEN ? &st_gen : NULL,
+                             &st_gen_err);
     if (retval < 0) {
         goto out;
     }
@@ -1642,21 +1644,10 @@ static void coroutine_fn v9fs_getattr(void *opaque)
         goto out;
     }
 
-    /*  fill st_gen if requested and supported by underlying fs */
-    if (request_mask & P9_STATS_GEN) {
-        retval = v9fs_co_st_gen(pdu, &fidp->path, stbuf.st_mode, &v9stat_dotl);
-        switch (retval) {
-        case 0:
-            /* we have valid st_gen: update result mask */
-            v9stat_dotl.st_result_mask |= P9_STATS_GEN;
-            break;
-        case -EINTR:
-            /* request cancelled, e.g. by Tflush */
-            goto out;
-        default:
-            /* failed to get st_gen: not fatal, ignore */
-            break;
-        }
+    /* failing to get st_gen (e.g. unsupported by the fs) is not fatal */
+    if (request_mask & P9_STATS_GEN && !st_gen_err) {
+        v9stat_dotl.st_gen = st_gen;
+        v9stat_dotl.st_result_mask |= P9_STATS_GEN;
     }
     retval = pdu_marshal(pdu, offset, "A", &v9stat_dotl);
     if (retval < 0) {
@@ -2460,38 +2451,32 @@ static void coroutine_fn v9fs_read(void *opaque)
         err += offset + count;
     } else if (fidp->fid_type == P9_FID_FILE) {
         QEMUIOVector qiov_full;
-        QEMUIOVector qiov;
         int32_t len;
 
         v9fs_init_qiov_from_pdu(&qiov_full, pdu, offset + 4, max_count, false);
-        qemu_iovec_init(&qiov, qiov_full.niov);
+        if (0) {
+            print_sg(qiov_full.iov, qiov_full.niov);
+        }
+        /*
+         * Loop in case of EINTR, short reads are already continued by
+         * v9fs_co_preadv() until EOF.
+         */
         do {
-            qemu_iovec_reset(&qiov);
-            qemu_iovec_concat(&qiov, &qiov_full, count, qiov_full.size - count);
-            if (0) {
-                print_sg(qiov.iov, qiov.niov);
-            }
-            /* Loop in case of EINTR */
-            do {
-                len = v9fs_co_preadv(pdu, fidp, qiov.iov, qiov.niov, off);
-                if (len >= 0) {
-                    off   += len;
-                    count += len;
-                }
-            } while (len == -EINTR && !pdu->cancelled);
-            if (len < 0) {
-                /* IO error return the error */
-                err = len;
-                goto out_free_iovec;
-            }
-        } while (count < max_count && len > 0);
+            len = v9fs_co_preadv(pdu, fidp, qiov_full.iov, qiov_full.niov,
+                                 off);
+        } while (len == -EINTR && !pdu->cancelled);
+        if (len < 0) {
+            /* IO error return the error */
+            err = len;
+            goto out_free_iovec;
+        }
+        count = len;
         err = pdu_marshal(pdu, offset, "d", count);
         if (err < 0) {
             goto out_free_iovec;
         }
         err += offset + count;
 out_free_iovec:
-        qemu_iovec_destroy(&qiov);
         qemu_iovec_destroy(&qiov_full);
     } else if (fidp->fid_type == P9_FID_XATTR) {
         err = v9fs_xattr_read(s, pdu, fidp, off, max_count);
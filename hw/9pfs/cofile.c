@@ -18,35 +18,12 @@
 
 #include "qemu/osdep.h"
 #include "fsdev/qemu-fsdev.h"
+#include "qemu/iov.h"
 #include "qemu/thread.h"
 #include "qemu/main-loop.h"
 #include "qemu/error-report.h"
 #include "coth.h"
 
-int coroutine_fn v9fs_co_st_gen(V9fsPDU *pdu, V9fsPath *path, mode_t st_mode,
-                                V9fsStatDotl *v9stat)
-{
-    int err = 0;
-    V9fsState *s = pdu->s;
-
-    if (v9fs_request_cancelled(pdu)) {
-        return -EINTR;
-    }
-    if (s->ctx.exops.get_st_gen) {
-        v9fs_path_read_lock(s);
-        v9fs_co_run_in_worker(
-            {
-                err = s->ctx.exops.get_st_gen(&s->ctx, path, st_mode,
-                                              &v9stat->st_gen);
-                if (err < 0) {
-                    err = -errno;
-                }
-            });
-        v9fs_path_unlock(s);
-    }
-    return err;
-}
-
 int coroutine_fn v9fs_co_lstat(V9fsPDU *pdu, V9fsPath *path, struct stat *stbuf)
 {
     int err;
@@ -100,6 +77,60 @@ int coroutine_fn v9fs_co_fstat(V9fsPDU *pdu, V9fsFidState *fidp,
     return err;
 }
 
+/*
+ * Fetches the attributes of @fidp like v9fs_co_fstat() (or v9fs_co_lstat() if
+ * @use_fd is false) and, if @st_gen is not NULL, its inode generation number,
+ * all in a single hop to the worker thread.  The result of fetching the
+ * generation number is stored in @st_gen_err; failing to fetch it does not
+ * fail the call.
+ */
+int coroutine_fn v9fs_co_getattr(V9fsPDU *pdu, V9fsFidState *fidp,
+                                 bool use_fd, struct stat *stbuf,
+                                 uint64_t *st_gen, int *st_gen_err)
+{
+    int err = -EOPNOTSUPP;
+    V9fsState *s = pdu->s;
+
+    if (v9fs_request_cancelled(pdu)) {
+        return -EINTR;
+    }
+    v9fs_path_read_lock(s);
+    v9fs_co_run_in_worker(
+        {
+            if (use_fd) {
+                err = s->ops->fstat(&s->ctx, fidp->fid_type, &fidp->fs,
+                                    stbuf);
+                if (err < 0) {
+                    err = -errno;
+                }
+            }
+            /* see v9fs_co_fstat() */
+            if (err == -EOPNOTSUPP) {
+                err = s->ops->lstat(&s->ctx, &fidp->path, stbuf);
+                if (err < 0) {
+                    err = -errno;
+                    if (use_fd && err == -ENOENT) {
+                        err = 0;
+                    }
+                }
+            }
+            if (!err && st_gen) {
+                *st_gen_err = -EOPNOTSUPP;
+                if (s->ctx.exops.get_st_gen) {
+                    *st_gen_err = s->ctx.exops.get_st_gen(&s->ctx,
+                                                          &fidp->path,
+                                                          stbuf->st_mode,
+                                                          st_gen);
+                    if (*st_gen_err < 0) {
+                        *st_gen_err = -errno;
+                    }
+                }
+            }
+        });
+    v9fs_path_unlock(s);
+    return err;
+}
+
 int coroutine_fn v9fs_co_open(V9fsPDU *pdu, V9fsFidState *fidp, int flags)
 {
     int err;
@@ -268,6 +299,43 @@ int coroutine_fn v9fs_co_pwritev(V9fsPDU *pdu, V9fsFidState *fidp,
     return err;
 }
 
+/*
+ * Runs on the worker thread.  Continues short reads until @iov is full or
+ * EOF is reached, so that a read ending at EOF does not need another hop to
+ * the worker thread just to read 0 bytes.
+ */
+static ssize_t v9fs_preadv_full(V9fsState *s, V9fsFidOpenState *fs,
+                                struct iovec *iov, int iovcnt, int64_t offset)
+{
+    g_autofree struct iovec *rest = NULL;
+    struct iovec *rest_iov;
+    unsigned int rest_cnt = iovcnt;
+    ssize_t done, len;
+
+    done = s->ops->preadv(&s->ctx, fs, iov, iovcnt, offset);
+    if (done < 0) {
+        return -errno;
+    }
+    if (done == 0 || done == iov_size(iov, iovcnt)) {
+        return done;
+    }
+
+    /* iov_discard_front() modifies the iovec array, work on a copy */
+    rest = g_memdup2(iov, iovcnt * sizeof(*iov));
+    rest_iov = rest;
+    iov_discard_front(&rest_iov, &rest_cnt, done);
+    while (rest_cnt) {
+        len = s->ops->preadv(&s->ctx, fs, rest_iov, rest_cnt, offset + done);
+        if (len <= 0) {
+            /* EOF, or leave the error to the next request */
+            break;
+        }
+        done += len;
+        iov_discard_front(&rest_iov, &rest_cnt, len);
+    }
+    return done;
+}
+
 int coroutine_fn v9fs_co_preadv(V9fsPDU *pdu, V9fsFidState *fidp,
                                 struct iovec *iov, int iovcnt, int64_t offset)
 {
@@ -280,10 +348,7 @@ int coroutine_fn v9fs_co_preadv(V9fsPDU *pdu, V9fsFidState *fidp,
     fsdev_co_throttle_request(s->ctx.fst, THROTTLE_READ, iov, iovcnt);
     v9fs_co_run_in_worker(
         {
-            err = s->ops->preadv(&s->ctx, &fidp->fs, iov, iovcnt, offset);
-            if (err < 0) {
-                err = -errno;
-            }
+            err = v9fs_preadv_full(s, &fidp->fs, iov, iovcnt, offset);
         });
     return err;
 }
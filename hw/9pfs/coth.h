@@ -111,7 +111,8 @@ int coroutine_fn v9fs_co_preadv(V9fsPDU *, V9fsFidState *,
                                 struct iovec *, int, int64_t);
 int coroutine_fn v9fs_co_name_to_path(V9fsPDU *, V9fsPath *,
                                       const char *, V9fsPath *);
-int coroutine_fn v9fs_co_st_gen(V9fsPDU *pdu, V9fsPath *path, mode_t,
-                                V9fsStatDotl *v9stat);
+int coroutine_fn v9fs_co_getattr(V9fsPDU *pdu, V9fsFidState *fidp,
+                                 bool use_fd, struct stat *stbuf,
+                                 uint64_t *st_gen, int *st_gen_err);
 
 #endif
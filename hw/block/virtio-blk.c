@@ -85,7 +85,7 @@ static int virtio_blk_handle_rw_error(VirtIOBlockReq *req, int error,
         if (acct_failed) {
             block_acct_failed(blk_get_stats(s->blk), &req->acct);
         }
-        g_free(req);
+        virtqueue_element_release(req);
     }
 
     blk_error_action(s->blk, action, is_read, error);
@@ -128,7 +128,7 @@ static void virtio_blk_rw_complete(void *opaque, int ret)
 
         virtio_blk_req_complete(req, VIRTIO_BLK_S_OK);
         block_acct_done(blk_get_stats(s->blk), &req->acct);
-        g_free(req);
+        virtqueue_element_release(req);
     }
 }
 
@@ -143,7 +143,7 @@ static void virtio_blk_flush_complete(void *opaque, int ret)
 
     virtio_blk_req_complete(req, VIRTIO_BLK_S_OK);
     block_acct_done(blk_get_stats(s->blk), &req->acct);
-    g_free(req);
+    virtqueue_element_release(req);
 }
 
 static void virtio_blk_discard_write_zeroes_complete(void *opaque, int ret)
@@ -161,17 +161,22 @@ static void virtio_blk_discard_write_zeroes_complete(void *opaque, int ret)
     if (is_write_zeroes) {
         block_acct_done(blk_get_stats(s->blk), &req->acct);
     }
-    g_free(req);
+    virtqueue_element_release(req);
 }
 
-static VirtIOBlockReq *virtio_blk_get_request(VirtIOBlock *s, VirtQueue *vq)
+static unsigned int virtio_blk_get_requests(VirtIOBlock *s, VirtQueue *vq,
+                                            VirtIOBlockReq **reqs,
+                                            unsigned int max)
 {
-    VirtIOBlockReq *req = virtqueue_pop(vq, sizeof(VirtIOBlockReq));
+    unsigned int i, n;
 
-    if (req) {
-        virtio_blk_init_request(s, vq, req);
+    /* Requests are parsed without regard to the framing of the buffers */
+    n = virtqueue_pop_batch(vq, sizeof(VirtIOBlockReq), (void **)reqs, max,
+                            true);
+    for (i = 0; i < n; i++) {
+        virtio_blk_init_request(s, vq, reqs[i]);
     }
-    return req;
+    return n;
 }
 
 static void virtio_blk_handle_scsi(VirtIOBlockReq *req)
@@ -206,7 +211,7 @@ static void virtio_blk_handle_scsi(VirtIOBlockReq *req)
 
 fail:
     virtio_blk_req_complete(req, status);
-    g_free(req);
+    virtqueue_element_release(req);
 }
 
 static inline void submit_requests(VirtIOBlock *s, MultiReqBuffer *mrb,
@@ -331,6 +336,115 @@ static void virtio_blk_submit_multireq(VirtIOBlock *s, MultiReqBuffer *mrb)
     mrb->num_reqs = 0;
 }
 
+/*
+ * Requests left over by the queues that an AioContext processed in one
+ * event loop iteration, so that they can be sorted and merged together.
+ * Guests with one queue per vCPU often spread a sequential stream over
+ * several queues.
+ */
+typedef struct VirtIOBlockElevator {
+    VirtIOBlock *s;
+    AioContext *ctx;
+    QEMUBH *bh;
+    bool bh_scheduled;
+    MultiReqBuffer mrb;
+} VirtIOBlockElevator;
+
+static void virtio_blk_elevator_bh(void *opaque)
+{
+    VirtIOBlockElevator *e = opaque;
+
+    e->bh_scheduled = false;
+    defer_call_begin();
+    if (e->mrb.num_reqs) {
+        virtio_blk_submit_multireq(e->s, &e->mrb);
+    }
+    defer_call_end();
+
+    /* Incremented in virtio_blk_elevator_add() */
+    blk_dec_in_flight(e->s->blk);
+}
+
+static VirtIOBlockElevator *virtio_blk_elevator_get(VirtIOBlock *s)
+{
+    AioContext *ctx = qemu_get_current_aio_context();
+    unsigned int i;
+
+    for (i = 0; i < s->num_elevators; i++) {
+        if (s->elevators[i].ctx == ctx) {
+            return &s->elevators[i];
+        }
+    }
+    return NULL;
+}
+
+/* Takes over the requests in @mrb, submitting them from a BH */
+static void virtio_blk_elevator_add(VirtIOBlockElevator *e,
+                                    MultiReqBuffer *mrb)
+{
+    unsigned int i;
+
+    if (e->mrb.num_reqs &&
+        (e->mrb.is_write != mrb->is_write ||
+         e->mrb.num_reqs + mrb->num_reqs > VIRTIO_BLK_MAX_MERGE_REQS)) {
+        virtio_blk_submit_multireq(e->s, &e->mrb);
+    }
+
+    if (!e->bh_scheduled) {
+        /* Let drain wait for the requests until they are submitted */
+        blk_inc_in_flight(e->s->blk);
+        qemu_bh_schedule(e->bh);
+        e->bh_scheduled = true;
+    }
+
+    for (i = 0; i < mrb->num_reqs; i++) {
+        e->mrb.reqs[e->mrb.num_reqs++] = mrb->reqs[i];
+    }
+    e->mrb.is_write = mrb->is_write;
+    mrb->num_reqs = 0;
+}
+
+static void virtio_blk_elevator_init(VirtIOBlock *s)
+{
+    unsigned int i, j;
+
+    if (!s->conf.request_merging || !s->conf.request_merging_across_queues ||
+        s->conf.num_queues < 2) {
+        return;
+    }
+
+    s->elevators = g_new0(VirtIOBlockElevator, s->conf.num_queues);
+    for (i = 0; i < s->conf.num_queues; i++) {
+        AioContext *ctx = s->vq_aio_context[i];
+
+        for (j = 0; j < s->num_elevators; j++) {
+            if (s->elevators[j].ctx == ctx) {
+                break;
+            }
+        }
+        if (j == s->num_elevators) {
+            VirtIOBlockElevator *e = &s->elevators[s->num_elevators++];
+
+            e->s = s;
+            e->ctx = ctx;
+            e->bh = aio_bh_new(ctx, virtio_blk_elevator_bh, e);
+        }
+    }
+}
+
+static void virtio_blk_elevator_cleanup(VirtIOBlock *s)
+{
+    unsigned int i;
+
+    for (i = 0; i < s->num_elevators; i++) {
+        assert(!s->elevators[i].mrb.num_reqs);
+        qemu_bh_delete(s->elevators[i].bh);
+    }
+    g_free(s->elevators);
+    s->elevators = NULL;
+    s->num_elevators = 0;
+}
+
 static void virtio_blk_handle_flush(VirtIOBlockReq *req, MultiReqBuffer *mrb)
 {
     VirtIOBlock *s = req->dev;
@@ -604,7 +718,7 @@ static void virtio_blk_zone_report_complete(void *opaque, int ret)
 
 out:
     virtio_blk_req_complete(req, err_status);
-    g_free(req);
+    virtqueue_element_release(req);
     g_free(data->zone_report_data.zones);
     g_free(data);
 }
@@ -653,7 +767,7 @@ static void virtio_blk_handle_zone_report(VirtIOBlockReq *req,
     return;
 out:
     virtio_blk_req_complete(req, err_status);
-    g_free(req);
+    virtqueue_element_release(req);
 }
 
 static void virtio_blk_zone_mgmt_complete(void *opaque, int ret)
@@ -669,7 +783,7 @@ static void virtio_blk_zone_mgmt_complete(void *opaque, int ret)
     }
 
     virtio_blk_req_complete(req, err_status);
-    g_free(req);
+    virtqueue_element_release(req);
 }
 
 static int virtio_blk_handle_zone_mgmt(VirtIOBlockReq *req, BlockZoneOp op)
@@ -711,7 +825,7 @@ static int virtio_blk_handle_zone_mgmt(VirtIOBlockReq *req, BlockZoneOp op)
     return 0;
 out:
     virtio_blk_req_complete(req, err_status);
-    g_free(req);
+    virtqueue_element_release(req);
     return err_status;
 }
 
@@ -742,7 +856,7 @@ static void virtio_blk_zone_append_complete(void *opaque, int ret)
 
 out:
     virtio_blk_req_complete(req, err_status);
-    g_free(req);
+    virtqueue_element_release(req);
     g_free(data);
 }
 
@@ -780,7 +894,7 @@ static int virtio_blk_handle_zone_append(VirtIOBlockReq *req,
 
 out:
     virtio_blk_req_complete(req, err_status);
-    g_free(req);
+    virtqueue_element_release(req);
     return err_status;
 }
 
@@ -847,7 +961,7 @@ static int virtio_blk_handle_request(VirtIOBlockReq *req, MultiReqBuffer *mrb)
             virtio_blk_req_complete(req, VIRTIO_BLK_S_IOERR);
             block_acct_invalid(blk_get_stats(s->blk),
                                is_write ? BLOCK_ACCT_WRITE : BLOCK_ACCT_READ);
-            g_free(req);
+            virtqueue_element_release(req);
             return 0;
         }
 
@@ -903,7 +1017,7 @@ static int virtio_blk_handle_request(VirtIOBlockReq *req, MultiReqBuffer *mrb)
                               VIRTIO_BLK_ID_BYTES));
         iov_from_buf(in_iov, in_num, 0, serial, size);
         virtio_blk_req_complete(req, VIRTIO_BLK_S_OK);
-        g_free(req);
+        virtqueue_element_release(req);
         break;
     }
     case VIRTIO_BLK_T_ZONE_APPEND & ~VIRTIO_BLK_T_OUT:
@@ -935,7 +1049,7 @@ static int virtio_blk_handle_request(VirtIOBlockReq *req, MultiReqBuffer *mrb)
         if (unlikely(!(type & VIRTIO_BLK_T_OUT) ||
                      out_len > sizeof(dwz_hdr))) {
             virtio_blk_req_complete(req, VIRTIO_BLK_S_UNSUPP);
-            g_free(req);
+            virtqueue_element_release(req);
             return 0;
         }
 
@@ -952,7 +1066,7 @@ static int virtio_blk_handle_request(VirtIOBlockReq *req, MultiReqBuffer *mrb)
                                                             is_write_zeroes);
         if (err_status != VIRTIO_BLK_S_OK) {
             virtio_blk_req_complete(req, err_status);
-            g_free(req);
+            virtqueue_element_release(req);
         }
 
         break;
@@ -967,7 +1081,7 @@ static int virtio_blk_handle_request(VirtIOBlockReq *req, MultiReqBuffer *mrb)
         if (!vbk->handle_unknown_request ||
             !vbk->handle_unknown_request(req, mrb, type)) {
             virtio_blk_req_complete(req, VIRTIO_BLK_S_UNSUPP);
-            g_free(req);
+            virtqueue_element_release(req);
         }
     }
     }
@@ -976,7 +1090,9 @@ static int virtio_blk_handle_request(VirtIOBlockReq *req, MultiReqBuffer *mrb)
 
 void virtio_blk_handle_vq(VirtIOBlock *s, VirtQueue *vq)
 {
-    VirtIOBlockReq *req;
+    VirtIOBlockReq *reqs[VIRTQUEUE_POP_BATCH];
+    unsigned int i, n;
+    bool failed = false;
     MultiReqBuffer mrb = {};
     bool suppress_notifications = virtio_queue_get_notification(vq);
 
@@ -987,13 +1103,17 @@ void virtio_blk_handle_vq(VirtIOBlock *s, VirtQueue *vq)
             virtio_queue_set_notification(vq, 0);
         }
 
-        while ((req = virtio_blk_get_request(s, vq))) {
-            if (virtio_blk_handle_request(req, &mrb)) {
-                virtqueue_detach_element(req->vq, &req->elem, 0);
-                g_free(req);
-                break;
+        do {
+            n = virtio_blk_get_requests(s, vq, reqs, ARRAY_SIZE(reqs));
+            for (i = 0; i < n; i++) {
+                /* Once the device is broken, drop the rest of the batch */
+                if (failed || virtio_blk_handle_request(reqs[i], &mrb)) {
+                    virtqueue_detach_element(vq, &reqs[i]->elem, 0);
+                    virtqueue_element_release(reqs[i]);
+                    failed = true;
+                }
             }
-        }
+        } while (!failed && n == ARRAY_SIZE(reqs));
 
         if (suppress_notifications) {
             virtio_queue_set_notification(vq, 1);
@@ -1001,7 +1121,13 @@ void virtio_blk_handle_vq(VirtIOBlock *s, VirtQueue *vq)
     } while (!virtio_queue_empty(vq));
 
     if (mrb.num_reqs) {
-        virtio_blk_submit_multireq(s, &mrb);
+        VirtIOBlockElevator *e = virtio_blk_elevator_get(s);
+
+        if (e) {
+            virtio_blk_elevator_add(e, &mrb);
+        } else {
+            virtio_blk_submit_multireq(s, &mrb);
+        }
     }
 
     defer_call_end();
@@ -1040,7 +1166,7 @@ static void virtio_blk_dma_restart_bh(void *opaque)
             while (req) {
                 next = req->next;
                 virtqueue_detach_element(req->vq, &req->elem, 0);
-                g_free(req);
+                virtqueue_element_release(req);
                 req = next;
             }
             break;
@@ -1123,7 +1249,7 @@ static void virtio_blk_reset(VirtIODevice *vdev)
             /* No other threads can access req->vq here */
             virtqueue_detach_element(req->vq, &req->elem, 0);
 
-            g_free(req);
+            virtqueue_element_release(req);
         }
     }
 
@@ -1775,7 +1901,11 @@ static void virtio_blk_device_realize(DeviceState *dev, Error **errp)
     s->sector_mask = (s->conf.conf.logical_block_size / BDRV_SECTOR_SIZE) - 1;
 
     for (i = 0; i < conf->num_queues; i++) {
-        virtio_add_queue(vdev, conf->queue_size, virtio_blk_handle_output);
+        VirtQueue *vq = virtio_add_queue(vdev, conf->queue_size,
+                                         virtio_blk_handle_output);
+
+        /* Requests complete with the length of all their in buffers */
+        virtio_queue_set_in_order_batch(vq, true);
     }
     qemu_coroutine_inc_pool_size(conf->num_queues * conf->queue_size / 2);
 
@@ -1793,6 +1923,7 @@ static void virtio_blk_device_realize(DeviceState *dev, Error **errp)
         virtio_cleanup(vdev);
         return;
     }
+    virtio_blk_elevator_init(s);
 
     /*
      * This must be after virtio_init() so virtio_blk_dma_restart_cb() gets
@@ -1821,6 +1952,7 @@ static void virtio_blk_device_unrealize(DeviceState *dev)
 
     blk_drain(s->blk);
     del_boot_device_lchs(dev, "/disk@0,0");
+    virtio_blk_elevator_cleanup(s);
     virtio_blk_vq_aio_context_cleanup(s);
     for (i = 0; i < conf->num_queues; i++) {
         virtio_del_queue(vdev, i);
@@ -1861,6 +1993,8 @@ static const Property virtio_blk_properties[] = {
                       VIRTIO_BLK_F_CONFIG_WCE, true),
     DEFINE_PROP_BIT("request-merging", VirtIOBlock, conf.request_merging, 0,
                     true),
+    DEFINE_PROP_BOOL("x-request-merging-across-queues", VirtIOBlock,
+                     conf.request_merging_across_queues, false),
     DEFINE_PROP_UINT16("num-queues", VirtIOBlock, conf.num_queues,
                        VIRTIO_BLK_AUTO_NUM_QUEUES),
     DEFINE_PROP_UINT16("queue-size", VirtIOBlock, conf.queue_size, 256),
@@ -1779,6 +1779,7 @@ static void handle_machine_dumpdtb(MachineState *ms)
 
 void qdev_machine_creation_done(void)
 {
+    qemu_wait_vcpus_created();
     cpu_synchronize_all_post_init();
 
     if (current_machine->boot_config.once) {
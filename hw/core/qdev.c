@@ -32,6 +32,8 @@
 #include "qapi/visitor.h"
 #include "qemu/error-report.h"
 #include "qemu/option.h"
+#include "qemu/log.h"
+#include "qemu/timer.h"
 #include "hw/core/irq.h"
 #include "hw/core/qdev-properties.h"
 #include "hw/core/boards.h"
@@ -877,6 +879,23 @@ char *qdev_get_human_name(DeviceState *dev)
 
 static MachineInitPhase machine_phase;
 
+/* When the process started and each phase was reached, for -d startup */
+static int64_t startup_time_ns;
+static int64_t phase_time_ns[PHASE_MACHINE_READY + 1];
+
+static const char *const phase_names[PHASE_MACHINE_READY + 1] = {
+    [PHASE_MACHINE_CREATED] = "machine created",
+    [PHASE_ACCEL_CREATED] = "accelerator created",
+    [PHASE_LATE_BACKENDS_CREATED] = "backends created",
+    [PHASE_MACHINE_INITIALIZED] = "machine initialized",
+    [PHASE_MACHINE_READY] = "machine ready",
+};
+
+static void __attribute__((constructor)) phase_init_startup_time(void)
+{
+    startup_time_ns = get_clock();
+}
+
 bool phase_check(MachineInitPhase phase)
 {
     return machine_phase >= phase;
@@ -886,6 +905,35 @@ void phase_advance(MachineInitPhase phase)
 {
     assert(machine_phase == phase - 1);
     machine_phase = phase;
+    phase_time_ns[phase] = get_clock();
+}
+
+void phase_log_startup_time(void)
+{
+    static bool logged;
+    int64_t prev = startup_time_ns;
+    int64_t now = get_clock();
+    int phase;
+
+    if (logged || !qemu_loglevel_mask(LOG_STARTUP)) {
+        return;
+    }
+    logged = true;
+
+    for (phase = PHASE_MACHINE_CREATED; phase <= PHASE_MACHINE_READY;
+         phase++) {
+        if (!phase_time_ns[phase]) {
+            continue;
+        }
+        qemu_log("startup: %-20s at %8.3f ms (+%.3f ms)\n",
+                 phase_names[phase],
+                 (phase_time_ns[phase] - startup_time_ns) / (double)SCALE_MS,
+                 (phase_time_ns[phase] - prev) / (double)SCALE_MS);
+        prev = phase_time_ns[phase];
+    }
+    qemu_log("startup: %-20s at %8.3f ms (+%.3f ms)\n", "guest running",
+             (now - startup_time_ns) / (double)SCALE_MS,
+             (now - prev) / (double)SCALE_MS);
 }
 
 static const TypeInfo device_type_info = {
@@ -19,6 +19,7 @@
 #include "ui/console.h"
 #include "ui/qemu-pixman.h"
 #include "qom/object.h"
+#include "framebuffer.h"
 
 typedef struct BochsDisplayMode {
     pixman_format_code_t format;
@@ -201,13 +202,11 @@ static int bochs_display_get_mode(BochsDisplayState *s,
 static void bochs_display_update(void *opaque)
 {
     BochsDisplayState *s = opaque;
-    DirtyBitmapSnapshot *snap = NULL;
     bool full_update = false;
     BochsDisplayMode mode;
     DisplaySurface *ds;
     uint8_t *ptr;
-    bool dirty;
-    int y, ys, ret;
+    int ret;
 
     ret = bochs_display_get_mode(s, &mode);
     if (ret < 0) {
@@ -231,29 +230,9 @@ static void bochs_display_update(void *opaque)
     if (full_update) {
         dpy_gfx_update_full(s->con);
     } else {
-        snap = memory_region_snapshot_and_clear_dirty(&s->vram,
-                                                      mode.offset, mode.size,
-                                                      DIRTY_MEMORY_VGA);
-        ys = -1;
-        for (y = 0; y < mode.height; y++) {
-            dirty = memory_region_snapshot_get_dirty(&s->vram, snap,
-                                                     mode.offset + mode.stride * y,
-                                                     mode.stride);
-            if (dirty && ys < 0) {
-                ys = y;
-            }
-            if (!dirty && ys >= 0) {
-                dpy_gfx_update(s->con, 0, ys,
-                               mode.width, y - ys);
-                ys = -1;
-            }
-        }
-        if (ys >= 0) {
-            dpy_gfx_update(s->con, 0, ys,
-                           mode.width, y - ys);
-        }
-
-        g_free(snap);
+        framebuffer_update_dirty_rects(s->con, &s->vram, mode.offset,
+                                       mode.stride, mode.bytepp,
+                                       mode.width, mode.height);
     }
 }
 
@@ -18,6 +18,7 @@
  */
 
 #include "qemu/osdep.h"
+#include "exec/target_page.h"
 #include "ui/console.h"
 #include "framebuffer.h"
 
@@ -120,3 +121,89 @@ void framebuffer_update_display(
     *first_row = first;
     *last_row = last;
 }
+
+/* Find the dirty columns of one row, returns false if the row is clean */
+static bool framebuffer_dirty_columns(MemoryRegion *mr,
+                                      DirtyBitmapSnapshot *snap,
+                                      hwaddr row, unsigned len,
+                                      unsigned bytes_pp, int *x0, int *x1)
+{
+    hwaddr page_size = qemu_target_page_size();
+    hwaddr start = row, end = row + len;
+    hwaddr page;
+
+    if (!memory_region_snapshot_get_dirty(mr, snap, row, len)) {
+        return false;
+    }
+
+    /* Narrow the range down to the first and the last dirty page */
+    for (;;) {
+        page = MIN(QEMU_ALIGN_DOWN(start, page_size) + page_size, end);
+        if (page == end ||
+            memory_region_snapshot_get_dirty(mr, snap, start, page - start)) {
+            break;
+        }
+        start = page;
+    }
+    for (;;) {
+        page = MAX(QEMU_ALIGN_DOWN(end - 1, page_size), start);
+        if (page == start ||
+            memory_region_snapshot_get_dirty(mr, snap, page, end - page)) {
+            break;
+        }
+        end = page;
+    }
+
+    *x0 = (start - row) / bytes_pp;
+    *x1 = DIV_ROUND_UP(end - row, bytes_pp);
+    return true;
+}
+
+void framebuffer_update_dirty_rects(
+    QemuConsole *con,
+    MemoryRegion *mr,
+    hwaddr offset,
+    unsigned stride,
+    unsigned bytes_pp,
+    int width,
+    int height)
+{
+    DirtyBitmapSnapshot *snap;
+    unsigned len = width * bytes_pp;
+    int y, ys = -1, rx0 = 0, rx1 = 0;
+
+    if (!width || !height) {
+        return;
+    }
+
+    snap = memory_region_snapshot_and_clear_dirty(mr, offset,
+                                                  (hwaddr)stride * height,
+                                                  DIRTY_MEMORY_VGA);
+    if (!memory_region_snapshot_get_dirty(mr, snap, offset,
+                                          (hwaddr)stride * (height - 1) +
+                                          len)) {
+        g_free(snap);
+        return;
+    }
+
+    for (y = 0; y < height; y++) {
+        int x0, x1;
+        bool dirty = framebuffer_dirty_columns(mr, snap,
+                                               offset + (hwaddr)stride * y,
+                                               len, bytes_pp, &x0, &x1);
+
+        if (ys >= 0 && (!dirty || x0 != rx0 || x1 != rx1)) {
+            dpy_gfx_update(con, rx0, ys, rx1 - rx0, y - ys);
+            ys = -1;
+        }
+        if (dirty && ys < 0) {
+            ys = y;
+            rx0 = x0;
+            rx1 = x1;
+        }
+    }
+    if (ys >= 0) {
+        dpy_gfx_update(con, rx0, ys, rx1 - rx0, y - ys);
+    }
+    g_free(snap);
+}
@@ -62,4 +62,31 @@ void framebuffer_update_display(
     int *first_row,
     int *last_row);
 
+/* framebuffer_update_dirty_rects: Report the changed parts of a linear
+ * framebuffer to the display.
+ *
+ * Takes a snapshot of the DIRTY_MEMORY_VGA bitmap covering the framebuffer,
+ * clears it, and calls dpy_gfx_update() for rectangles that cover all the
+ * dirty pages.  Within a row only the columns in dirty pages are updated,
+ * and consecutive rows that are dirty in the same columns are merged into a
+ * single rectangle.  When nothing changed, this costs a single bitmap scan.
+ *
+ * @con: #QemuConsole to update.
+ * @mr: #MemoryRegion that holds the framebuffer, with DIRTY_MEMORY_VGA
+ * logging enabled.
+ * @offset: Offset of the first pixel within @mr.
+ * @stride: Number of bytes in framebuffer memory between two rows.
+ * @bytes_pp: Number of bytes per pixel.
+ * @width: Width of the screen.
+ * @height: Height of the screen.
+ */
+void framebuffer_update_dirty_rects(
+    QemuConsole *con,
+    MemoryRegion *mr,
+    hwaddr offset,
+    unsigned stride,
+    unsigned bytes_pp,
+    int width,
+    int height);
+
 #endif
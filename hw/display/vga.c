@@ -24,6 +24,7 @@
 
 #include "qemu/osdep.h"
 #include "qemu/units.h"
+#include "qemu/cutils.h"
 #include "system/reset.h"
 #include "system/ramblock.h"
 #include "qapi/error.h"
@@ -1675,6 +1676,14 @@ static void vga_draw_graphic(VGACommonState *s, int full_update)
         snap = memory_region_snapshot_and_clear_dirty(&s->vram, region_start,
                                                       region_end - region_start,
                                                       DIRTY_MEMORY_VGA);
+        /* Idle screen, skip checking every scanline */
+        if (!memory_region_snapshot_get_dirty(&s->vram, snap, region_start,
+                                              region_end - region_start) &&
+            buffer_is_zero(s->invalidated_y_table,
+                           sizeof(s->invalidated_y_table))) {
+            g_free(snap);
+            return;
+        }
     }
 
     for(y = 0; y < height; y++) {
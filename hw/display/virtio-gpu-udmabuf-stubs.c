@@ -12,6 +12,11 @@ void virtio_gpu_init_udmabuf(struct virtio_gpu_simple_resource *res)
     /* nothing (stub) */
 }
 
+void virtio_gpu_init_udmabuf_2d(struct virtio_gpu_simple_resource *res)
+{
+    res->dmabuf_fd = -1;
+}
+
 void virtio_gpu_fini_udmabuf(struct virtio_gpu_simple_resource *res)
 {
     /* nothing (stub) */
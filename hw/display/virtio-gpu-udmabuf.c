@@ -68,9 +68,15 @@ static void virtio_gpu_create_udmabuf(struct virtio_gpu_simple_resource *res)
     g_free(list);
 }
 
+/* 2D resources are mapped with the layout of their host image */
+static uint64_t virtio_gpu_udmabuf_size(struct virtio_gpu_simple_resource *res)
+{
+    return res->blob_size ? res->blob_size : res->hostmem;
+}
+
 static void virtio_gpu_remap_udmabuf(struct virtio_gpu_simple_resource *res)
 {
-    res->remapped = mmap(NULL, res->blob_size, PROT_READ,
+    res->remapped = mmap(NULL, virtio_gpu_udmabuf_size(res), PROT_READ,
                          MAP_SHARED, res->dmabuf_fd, 0);
     if (res->remapped == MAP_FAILED) {
         warn_report("%s: dmabuf mmap failed: %s", __func__,
@@ -82,7 +88,7 @@ static void virtio_gpu_remap_udmabuf(struct virtio_gpu_simple_resource *res)
 static void virtio_gpu_destroy_udmabuf(struct virtio_gpu_simple_resource *res)
 {
     if (res->remapped) {
-        munmap(res->remapped, res->blob_size);
+        munmap(res->remapped, virtio_gpu_udmabuf_size(res));
         res->remapped = NULL;
     }
     if (res->dmabuf_fd >= 0) {
@@ -151,6 +157,23 @@ void virtio_gpu_init_udmabuf(struct virtio_gpu_simple_resource *res)
     res->blob = pdata;
 }
 
+void virtio_gpu_init_udmabuf_2d(struct virtio_gpu_simple_resource *res)
+{
+    res->dmabuf_fd = -1;
+    if (iov_size(res->iov, res->iov_cnt) < res->hostmem) {
+        return;
+    }
+
+    virtio_gpu_create_udmabuf(res);
+    if (res->dmabuf_fd < 0) {
+        return;
+    }
+    virtio_gpu_remap_udmabuf(res);
+    if (!res->remapped) {
+        virtio_gpu_destroy_udmabuf(res);
+    }
+}
+
 void virtio_gpu_fini_udmabuf(struct virtio_gpu_simple_resource *res)
 {
     if (res->remapped) {
@@ -42,6 +42,19 @@ virtio_gpu_find_check_resource(VirtIOGPU *g, uint32_t resource_id,
 
 static void virtio_gpu_reset_bh(void *opaque);
 
+/*
+ * Transfers to a 2D resource that is scanned out from its udmabuf are
+ * skipped, bring the host image up to date before using it.
+ */
+static void virtio_gpu_sync_image(struct virtio_gpu_simple_resource *res)
+{
+    if (res->image_stale) {
+        memcpy(pixman_image_get_data(res->image), res->remapped,
+               res->hostmem);
+        res->image_stale = false;
+    }
+}
+
 void virtio_gpu_update_cursor_data(VirtIOGPU *g,
                                    struct virtio_gpu_scanout *s,
                                    uint32_t resource_id)
@@ -67,6 +80,7 @@ void virtio_gpu_update_cursor_data(VirtIOGPU *g,
             pixman_image_get_height(res->image) != s->current_cursor->height) {
             return;
         }
+        virtio_gpu_sync_image(res);
         data = pixman_image_get_data(res->image);
     }
 
@@ -273,6 +287,7 @@ static void virtio_gpu_resource_create_2d(VirtIOGPU *g,
     res->height = c2d.height;
     res->format = c2d.format;
     res->resource_id = c2d.resource_id;
+    res->dmabuf_fd = -1;
 
     pformat = virtio_gpu_get_pixman_format(c2d.format);
     if (!pformat) {
@@ -464,6 +479,12 @@ static void virtio_gpu_transfer_to_host_2d(VirtIOGPU *g,
         return;
     }
 
+    if (res->remapped) {
+        /* The scanouts read the guest pages directly */
+        res->image_stale = true;
+        return;
+    }
+
     format = pixman_image_get_format(res->image);
     bpp = DIV_ROUND_UP(PIXMAN_FORMAT_BPP(format), 8);
     stride = pixman_image_get_stride(res->image);
@@ -570,8 +591,14 @@ static void virtio_gpu_resource_flush(VirtIOGPU *g,
         /* work out the area we need to update for each console */
         if (qemu_rect_intersect(&flush_rect, &rect, &rect)) {
             qemu_rect_translate(&rect, -scanout->x, -scanout->y);
-            dpy_gfx_update(g->parent_obj.scanout[i].con,
-                           rect.x, rect.y, rect.width, rect.height);
+            if (res->remapped && console_has_gl(scanout->con)) {
+                /* zero-copy 2D resource, scanned out as dmabuf */
+                dpy_gl_update(scanout->con,
+                              rect.x, rect.y, rect.width, rect.height);
+            } else {
+                dpy_gfx_update(g->parent_obj.scanout[i].con,
+                               rect.x, rect.y, rect.width, rect.height);
+            }
         }
     }
 }
@@ -613,6 +640,7 @@ static bool virtio_gpu_do_set_scanout(VirtIOGPU *g,
                                       uint32_t *error)
 {
     struct virtio_gpu_scanout *scanout;
+    bool zero_copy = !res->blob && res->remapped;
     uint8_t *data;
 
     scanout = &g->parent_obj.scanout[scanout_id];
@@ -636,18 +664,20 @@ static bool virtio_gpu_do_set_scanout(VirtIOGPU *g,
 
     g->parent_obj.enable = 1;
 
-    if (res->blob) {
-        if (console_has_gl(scanout->con)) {
-            if (!virtio_gpu_update_dmabuf(g, scanout_id, res, fb, r)) {
-                virtio_gpu_update_scanout(g, scanout_id, res, fb, r);
-            } else {
-                *error = VIRTIO_GPU_RESP_ERR_OUT_OF_MEMORY;
-                return false;
-            }
-            return true;
+    if ((res->blob || zero_copy) && console_has_gl(scanout->con)) {
+        if (!virtio_gpu_update_dmabuf(g, scanout_id, res, fb, r)) {
+            virtio_gpu_update_scanout(g, scanout_id, res, fb, r);
+        } else {
+            *error = VIRTIO_GPU_RESP_ERR_OUT_OF_MEMORY;
+            return false;
         }
+        return true;
+    }
 
+    if (res->blob) {
         data = res->blob;
+    } else if (zero_copy) {
+        data = res->remapped;
     } else {
         data = (uint8_t *)pixman_image_get_data(res->image);
     }
@@ -663,7 +693,7 @@ static bool virtio_gpu_do_set_scanout(VirtIOGPU *g,
         rect = pixman_image_create_bits(fb->format, r->width, r->height,
                                         ptr, fb->stride);
 
-        if (res->image) {
+        if (res->image && !zero_copy) {
             pixman_image_ref(res->image);
             pixman_image_set_destroy_function(rect, virtio_unref_resource,
                                               res->image);
@@ -671,7 +701,10 @@ static bool virtio_gpu_do_set_scanout(VirtIOGPU *g,
 
         /* realloc the surface ptr */
         scanout->ds = qemu_create_displaysurface_pixman(rect);
-        qemu_displaysurface_set_share_handle(scanout->ds, res->share_handle, fb->offset);
+        if (!zero_copy) {
+            qemu_displaysurface_set_share_handle(scanout->ds, res->share_handle,
+                                                 fb->offset);
+        }
 
         pixman_image_unref(rect);
         dpy_gfx_replace_surface(g->parent_obj.scanout[scanout_id].con,
@@ -903,6 +936,9 @@ void virtio_gpu_cleanup_mapping(VirtIOGPU *g,
 
     if (res->blob) {
         virtio_gpu_fini_udmabuf(res);
+    } else if (res->remapped) {
+        virtio_gpu_sync_image(res);
+        virtio_gpu_fini_udmabuf(res);
     }
 }
 
@@ -937,6 +973,10 @@ virtio_gpu_resource_attach_backing(VirtIOGPU *g,
         cmd->error = VIRTIO_GPU_RESP_ERR_UNSPEC;
         return;
     }
+
+    if (res->image && virtio_gpu_udmabuf_2d_enabled(g->parent_obj.conf)) {
+        virtio_gpu_init_udmabuf_2d(res);
+    }
 }
 
 static void
@@ -945,6 +985,8 @@ virtio_gpu_resource_detach_backing(VirtIOGPU *g,
 {
     struct virtio_gpu_simple_resource *res;
     struct virtio_gpu_resource_detach_backing detach;
+    bool zero_copy;
+    int i;
 
     VIRTIO_GPU_FILL_CMD(detach);
     virtio_gpu_bswap_32(&detach, sizeof(detach));
@@ -955,7 +997,24 @@ virtio_gpu_resource_detach_backing(VirtIOGPU *g,
     if (!res) {
         return;
     }
+    zero_copy = !res->blob && res->remapped;
     virtio_gpu_cleanup_mapping(g, res);
+
+    /* Scanouts of a zero-copy resource must not keep using the guest pages */
+    for (i = 0; zero_copy && i < g->parent_obj.conf.max_outputs; i++) {
+        struct virtio_gpu_scanout *scanout = &g->parent_obj.scanout[i];
+        struct virtio_gpu_rect r = {
+            .x = scanout->x,
+            .y = scanout->y,
+            .width = scanout->width,
+            .height = scanout->height
+        };
+
+        if (res->scanout_bitmask & (1 << i)) {
+            virtio_gpu_do_set_scanout(g, i, &scanout->fb, res, &r,
+                                      &cmd->error);
+        }
+    }
 }
 
 void virtio_gpu_simple_process_cmd(VirtIOGPU *g,
@@ -1244,6 +1303,7 @@ static int virtio_gpu_save(QEMUFile *f, void *opaque, size_t size,
             qemu_put_be64(f, res->addrs[i]);
             qemu_put_be32(f, res->iov[i].iov_len);
         }
+        virtio_gpu_sync_image(res);
         qemu_put_buffer(f, (void *)pixman_image_get_data(res->image),
                         pixman_image_get_stride(res->image) * res->height);
     }
@@ -1349,6 +1409,11 @@ static int virtio_gpu_load(QEMUFile *f, void *opaque, size_t size,
             return -EINVAL;
         }
 
+        res->dmabuf_fd = -1;
+        if (virtio_gpu_udmabuf_2d_enabled(g->parent_obj.conf)) {
+            virtio_gpu_init_udmabuf_2d(res);
+        }
+
         resource_id = qemu_get_be32(f);
     }
 
@@ -1502,6 +1567,12 @@ void virtio_gpu_device_realize(DeviceState *qdev, Error **errp)
 #endif
     }
 
+    if (virtio_gpu_udmabuf_2d_enabled(g->parent_obj.conf) &&
+        !virtio_gpu_have_udmabuf()) {
+        error_setg(errp, "need udmabuf for x-udmabuf-2d");
+        return;
+    }
+
     if (virtio_gpu_venus_enabled(g->parent_obj.conf)) {
 #ifdef VIRGL_VERSION_MAJOR
     #if VIRGL_VERSION_MAJOR >= 1
@@ -1693,6 +1764,8 @@ static const Property virtio_gpu_properties[] = {
     DEFINE_PROP_BIT("blob", VirtIOGPU, parent_obj.conf.flags,
                     VIRTIO_GPU_FLAG_BLOB_ENABLED, false),
     DEFINE_PROP_SIZE("hostmem", VirtIOGPU, parent_obj.conf.hostmem, 0),
+    DEFINE_PROP_BIT("x-udmabuf-2d", VirtIOGPU, parent_obj.conf.flags,
+                    VIRTIO_GPU_FLAG_UDMABUF_2D_ENABLED, false),
     DEFINE_PROP_UINT8("x-scanout-vmstate-version", VirtIOGPU, scanout_vmstate_version, 2),
 };
 
@@ -77,16 +77,19 @@ struct vtd_as_raw_key {
     uint32_t pasid;
 };
 
-struct vtd_iotlb_key {
-    uint64_t gfn;
-    uint32_t pasid;
-    uint16_t sid;
-    uint8_t level;
-};
-
 static void vtd_address_space_refresh_all(IntelIOMMUState *s);
 static void vtd_address_space_unmap(VTDAddressSpace *as, IOMMUNotifier *n);
 
+/*
+ * Any change to the IOTLB or to the cached context and PASID entries makes
+ * the translations remembered by the address spaces stale.  Must be called
+ * with IOMMU lock held.
+ */
+static void vtd_iotlb_gen_bump(IntelIOMMUState *s)
+{
+    qatomic_set(&s->iotlb_gen, iommu_tlb_gen_next(s->iotlb_gen));
+}
+
 static void vtd_pasid_cache_reset_locked(IntelIOMMUState *s)
 {
     VTDAddressSpace *vtd_as;
@@ -99,6 +102,7 @@ static void vtd_pasid_cache_reset_locked(IntelIOMMUState *s)
         VTDPASIDCacheEntry *pc_entry = &vtd_as->pasid_cache_entry;
         pc_entry->valid = false;
     }
+    vtd_iotlb_gen_bump(s);
 }
 
 static void vtd_define_quad(IntelIOMMUState *s, hwaddr addr, uint64_t val,
@@ -230,27 +234,6 @@ static inline gboolean vtd_as_has_map_notifier(VTDAddressSpace *as)
 }
 
 /* GHashTable functions */
-static gboolean vtd_iotlb_equal(gconstpointer v1, gconstpointer v2)
-{
-    const struct vtd_iotlb_key *key1 = v1;
-    const struct vtd_iotlb_key *key2 = v2;
-
-    return key1->sid == key2->sid &&
-           key1->pasid == key2->pasid &&
-           key1->level == key2->level &&
-           key1->gfn == key2->gfn;
-}
-
-static guint vtd_iotlb_hash(gconstpointer v)
-{
-    const struct vtd_iotlb_key *key = v;
-    uint64_t hash64 = key->gfn | ((uint64_t)(key->sid) << VTD_IOTLB_SID_SHIFT) |
-        (uint64_t)(key->level - 1) << VTD_IOTLB_LVL_SHIFT |
-        (uint64_t)(key->pasid) << VTD_IOTLB_PASID_SHIFT;
-
-    return (guint)((hash64 >> 32) ^ (hash64 & 0xffffffffU));
-}
-
 static gboolean vtd_as_equal(gconstpointer v1, gconstpointer v2)
 {
     const struct vtd_as_key *key1 = v1;
@@ -292,11 +275,16 @@ static void vtd_hiod_destroy(gpointer v)
     object_unref(v);
 }
 
-static gboolean vtd_hash_remove_by_domain(gpointer key, gpointer value,
-                                          gpointer user_data)
+static uint64_t vtd_iotlb_tag(uint16_t source_id, uint32_t pasid)
+{
+    return (uint64_t)pasid << 16 | source_id;
+}
+
+static bool vtd_iotlb_remove_by_domain(IOMMURangeTLBEntry *tlb_entry,
+                                       void *opaque)
 {
-    VTDIOTLBEntry *entry = (VTDIOTLBEntry *)value;
-    uint16_t domain_id = *(uint16_t *)user_data;
+    VTDIOTLBEntry *entry = container_of(tlb_entry, VTDIOTLBEntry, tlb);
+    uint16_t domain_id = *(uint16_t *)opaque;
     return entry->domain_id == domain_id;
 }
 
@@ -312,11 +300,11 @@ static inline uint64_t vtd_pt_level_page_mask(uint32_t level)
     return ~((1ULL << vtd_pt_level_shift(level)) - 1);
 }
 
-static gboolean vtd_hash_remove_by_page(gpointer key, gpointer value,
-                                        gpointer user_data)
+static bool vtd_iotlb_remove_by_page(IOMMURangeTLBEntry *tlb_entry,
+                                     void *opaque)
 {
-    VTDIOTLBEntry *entry = (VTDIOTLBEntry *)value;
-    VTDIOTLBPageInvInfo *info = (VTDIOTLBPageInvInfo *)user_data;
+    VTDIOTLBEntry *entry = container_of(tlb_entry, VTDIOTLBEntry, tlb);
+    VTDIOTLBPageInvInfo *info = (VTDIOTLBPageInvInfo *)opaque;
     uint64_t gfn = (info->addr >> VTD_PAGE_SHIFT_4K) & info->mask;
     uint64_t gfn_tlb = (info->addr & entry->mask) >> VTD_PAGE_SHIFT_4K;
 
@@ -336,11 +324,11 @@ static gboolean vtd_hash_remove_by_page(gpointer key, gpointer value,
     return (entry->gfn & info->mask) == gfn || entry->gfn == gfn_tlb;
 }
 
-static gboolean vtd_hash_remove_by_page_piotlb(gpointer key, gpointer value,
-                                               gpointer user_data)
+static bool vtd_iotlb_remove_by_page_piotlb(IOMMURangeTLBEntry *tlb_entry,
+                                            void *opaque)
 {
-    VTDIOTLBEntry *entry = (VTDIOTLBEntry *)value;
-    VTDIOTLBPageInvInfo *info = (VTDIOTLBPageInvInfo *)user_data;
+    VTDIOTLBEntry *entry = container_of(tlb_entry, VTDIOTLBEntry, tlb);
+    VTDIOTLBPageInvInfo *info = (VTDIOTLBPageInvInfo *)opaque;
     uint64_t gfn = (info->addr >> VTD_PAGE_SHIFT_4K) & info->mask;
     uint64_t gfn_tlb = (info->addr & entry->mask) >> VTD_PAGE_SHIFT_4K;
 
@@ -374,13 +362,14 @@ static void vtd_reset_context_cache_locked(IntelIOMMUState *s)
         vtd_as->context_cache_entry.context_cache_gen = 0;
     }
     s->context_cache_gen = 1;
+    vtd_iotlb_gen_bump(s);
 }
 
 /* Must be called with IOMMU lock held. */
 static void vtd_reset_iotlb_locked(IntelIOMMUState *s)
 {
-    assert(s->iotlb);
-    g_hash_table_remove_all(s->iotlb);
+    iommu_range_tlb_reset(&s->iotlb);
+    vtd_iotlb_gen_bump(s);
 }
 
 static void vtd_reset_iotlb(IntelIOMMUState *s)
@@ -408,23 +397,12 @@ static uint64_t vtd_get_iotlb_gfn(hwaddr addr, uint32_t level)
 static VTDIOTLBEntry *vtd_lookup_iotlb(IntelIOMMUState *s, uint16_t source_id,
                                        uint32_t pasid, hwaddr addr)
 {
-    struct vtd_iotlb_key key;
-    VTDIOTLBEntry *entry;
-    unsigned level;
-
-    for (level = VTD_PT_LEVEL; level < VTD_PML4_LEVEL; level++) {
-        key.gfn = vtd_get_iotlb_gfn(addr, level);
-        key.level = level;
-        key.sid = source_id;
-        key.pasid = pasid;
-        entry = g_hash_table_lookup(s->iotlb, &key);
-        if (entry) {
-            goto out;
-        }
-    }
+    IOMMURangeTLBEntry *tlb_entry;
 
-out:
-    return entry;
+    /* One lookup finds 4K pages as well as 2M and 1G large pages */
+    tlb_entry = iommu_range_tlb_lookup(&s->iotlb,
+                                       vtd_iotlb_tag(source_id, pasid), addr);
+    return tlb_entry ? container_of(tlb_entry, VTDIOTLBEntry, tlb) : NULL;
 }
 
 /* Must be with IOMMU lock held */
@@ -434,11 +412,10 @@ static void vtd_update_iotlb(IntelIOMMUState *s, uint16_t source_id,
                              uint32_t pasid, uint8_t pgtt)
 {
     VTDIOTLBEntry *entry = g_malloc(sizeof(*entry));
-    struct vtd_iotlb_key *key = g_malloc(sizeof(*key));
     uint64_t gfn = vtd_get_iotlb_gfn(addr, level);
 
     trace_vtd_iotlb_page_update(source_id, addr, pte, domain_id);
-    if (g_hash_table_size(s->iotlb) >= VTD_IOTLB_MAX_SIZE) {
+    if (s->iotlb.nb_entries >= VTD_IOTLB_MAX_SIZE) {
         trace_vtd_iotlb_reset("iotlb exceeds size limit");
         vtd_reset_iotlb_locked(s);
     }
@@ -451,12 +428,9 @@ static void vtd_update_iotlb(IntelIOMMUState *s, uint16_t source_id,
     entry->pasid = pasid;
     entry->pgtt = pgtt;
 
-    key->gfn = gfn;
-    key->sid = source_id;
-    key->level = level;
-    key->pasid = pasid;
-
-    g_hash_table_replace(s->iotlb, key, entry);
+    iommu_range_tlb_insert(&s->iotlb, &entry->tlb,
+                           vtd_iotlb_tag(source_id, pasid), addr,
+                           ~entry->mask);
 }
 
 /* Given the reg addr of both the message data and address, generate an
@@ -2258,11 +2232,14 @@ static bool vtd_do_iommu_translate(VTDAddressSpace *vtd_as, PCIBus *bus,
     vtd_update_iotlb(s, source_id, vtd_get_domain_id(s, &ce, pasid),
                      addr, pte, access_flags, level, pasid, pgtt);
 out:
-    vtd_iommu_unlock(s);
     entry->iova = addr & page_mask;
     entry->translated_addr = vtd_get_pte_addr(pte, s->aw_bits) & page_mask;
     entry->addr_mask = ~page_mask;
     entry->perm = (is_write ? access_flags : (access_flags & (~IOMMU_WO)));
+    iommu_tlb_mru_update(&vtd_as->iotlb_mru, s->iotlb_gen, entry->iova,
+                         entry->translated_addr, entry->addr_mask,
+                         access_flags);
+    vtd_iommu_unlock(s);
     return true;
 
 error:
@@ -2382,6 +2359,7 @@ static void vtd_context_device_invalidate(IntelIOMMUState *s,
                                          VTD_PCI_FUNC(vtd_as->devfn));
             vtd_iommu_lock(s);
             vtd_as->context_cache_entry.context_cache_gen = 0;
+            vtd_iotlb_gen_bump(s);
             vtd_iommu_unlock(s);
             /*
              * Do switch address space when needed, in case if the
@@ -2446,8 +2424,9 @@ static void vtd_iotlb_domain_invalidate(IntelIOMMUState *s, uint16_t domain_id)
     trace_vtd_inv_desc_iotlb_domain(domain_id);
 
     vtd_iommu_lock(s);
-    g_hash_table_foreach_remove(s->iotlb, vtd_hash_remove_by_domain,
-                                &domain_id);
+    iommu_range_tlb_remove(&s->iotlb, 0, HWADDR_MAX,
+                           vtd_iotlb_remove_by_domain, &domain_id);
+    vtd_iotlb_gen_bump(s);
     vtd_iommu_unlock(s);
 
     QLIST_FOREACH(vtd_as, &s->vtd_as_with_notifiers, next) {
@@ -2459,6 +2438,16 @@ static void vtd_iotlb_domain_invalidate(IntelIOMMUState *s, uint16_t domain_id)
     }
 }
 
+/* The IOVA range of a page-selective invalidation of 2^@am pages */
+static void vtd_iotlb_inv_range(hwaddr addr, uint8_t am, hwaddr *start,
+                                hwaddr *last)
+{
+    hwaddr size = (hwaddr)1 << (am + VTD_PAGE_SHIFT_4K);
+
+    *start = addr & ~(size - 1);
+    *last = *start + size - 1;
+}
+
 /*
  * There is no pasid field in iotlb invalidation descriptor, so PCI_NO_PASID
  * is passed as parameter. Piotlb invalidation supports pasid, pasid in its
@@ -2532,6 +2521,7 @@ static void vtd_iotlb_page_invalidate(IntelIOMMUState *s, uint16_t domain_id,
                                       hwaddr addr, uint8_t am)
 {
     VTDIOTLBPageInvInfo info;
+    hwaddr start, last;
 
     trace_vtd_inv_desc_iotlb_pages(domain_id, addr, am);
 
@@ -2539,8 +2529,16 @@ static void vtd_iotlb_page_invalidate(IntelIOMMUState *s, uint16_t domain_id,
     info.domain_id = domain_id;
     info.addr = addr;
     info.mask = ~((1 << am) - 1);
+    vtd_iotlb_inv_range(addr, am, &start, &last);
+    if (s->flts && s->root_scalable) {
+        /* First-stage entries of the domain go regardless of the address */
+        start = 0;
+        last = HWADDR_MAX;
+    }
     vtd_iommu_lock(s);
-    g_hash_table_foreach_remove(s->iotlb, vtd_hash_remove_by_page, &info);
+    iommu_range_tlb_remove(&s->iotlb, start, last, vtd_iotlb_remove_by_page,
+                           &info);
+    vtd_iotlb_gen_bump(s);
     vtd_iommu_unlock(s);
     vtd_iotlb_page_invalidate_notify(s, domain_id, addr, am, PCI_NO_PASID);
 }
@@ -2966,11 +2964,11 @@ static bool vtd_process_iotlb_desc(IntelIOMMUState *s, VTDInvDesc *inv_desc)
     return true;
 }
 
-static gboolean vtd_hash_remove_by_pasid(gpointer key, gpointer value,
-                                         gpointer user_data)
+static bool vtd_iotlb_remove_by_pasid(IOMMURangeTLBEntry *tlb_entry,
+                                      void *opaque)
 {
-    VTDIOTLBEntry *entry = (VTDIOTLBEntry *)value;
-    VTDIOTLBPageInvInfo *info = (VTDIOTLBPageInvInfo *)user_data;
+    VTDIOTLBEntry *entry = container_of(tlb_entry, VTDIOTLBEntry, tlb);
+    VTDIOTLBPageInvInfo *info = (VTDIOTLBPageInvInfo *)opaque;
 
     return ((entry->domain_id == info->domain_id) &&
             (entry->pasid == info->pasid));
@@ -2987,8 +2985,9 @@ static void vtd_piotlb_pasid_invalidate(IntelIOMMUState *s,
     info.pasid = pasid;
 
     vtd_iommu_lock(s);
-    g_hash_table_foreach_remove(s->iotlb, vtd_hash_remove_by_pasid,
-                                &info);
+    iommu_range_tlb_remove(&s->iotlb, 0, HWADDR_MAX,
+                           vtd_iotlb_remove_by_pasid, &info);
+    vtd_iotlb_gen_bump(s);
     vtd_iommu_unlock(s);
 
     QLIST_FOREACH(vtd_as, &s->vtd_as_with_notifiers, next) {
@@ -3013,15 +3012,18 @@ static void vtd_piotlb_page_invalidate(IntelIOMMUState *s, uint16_t domain_id,
                                        uint32_t pasid, hwaddr addr, uint8_t am)
 {
     VTDIOTLBPageInvInfo info;
+    hwaddr start, last;
 
     info.domain_id = domain_id;
     info.pasid = pasid;
     info.addr = addr;
     info.mask = ~((1 << am) - 1);
+    vtd_iotlb_inv_range(addr, am, &start, &last);
 
     vtd_iommu_lock(s);
-    g_hash_table_foreach_remove(s->iotlb,
-                                vtd_hash_remove_by_page_piotlb, &info);
+    iommu_range_tlb_remove(&s->iotlb, start, last,
+                           vtd_iotlb_remove_by_page_piotlb, &info);
+    vtd_iotlb_gen_bump(s);
     vtd_iommu_unlock(s);
 
     vtd_iotlb_page_invalidate_notify(s, domain_id, addr, am, pasid);
@@ -3166,6 +3168,7 @@ static void vtd_pasid_cache_sync(IntelIOMMUState *s, VTDPASIDCacheInfo *pc_info)
     vtd_iommu_lock(s);
     g_hash_table_foreach(s->vtd_address_spaces, vtd_pasid_cache_sync_locked,
                          pc_info);
+    vtd_iotlb_gen_bump(s);
     vtd_iommu_unlock(s);
 }
 
@@ -3953,6 +3956,12 @@ static IOMMUTLBEntry vtd_iommu_translate(IOMMUMemoryRegion *iommu, hwaddr addr,
     bool success;
 
     if (likely(s->dmar_enabled)) {
+        /* Repeated DMA to the same page skips the IOMMU lock */
+        if (iommu_tlb_mru_lookup(&vtd_as->iotlb_mru,
+                                 qatomic_read(&s->iotlb_gen), addr,
+                                 flag & IOMMU_RW, &iotlb)) {
+            return iotlb;
+        }
         success = vtd_do_iommu_translate(vtd_as, vtd_as->bus, vtd_as->devfn,
                                          addr, flag & IOMMU_WO, &iotlb);
     } else {
@@ -4525,6 +4534,7 @@ VTDAddressSpace *vtd_find_add_as(IntelIOMMUState *s, PCIBus *bus,
         vtd_dev_as->pasid = pasid;
         vtd_dev_as->iommu_state = s;
         vtd_dev_as->context_cache_entry.context_cache_gen = 0;
+        iommu_tlb_mru_init(&vtd_dev_as->iotlb_mru);
         vtd_dev_as->iova_tree = iova_tree_new();
 
         memory_region_init(&vtd_dev_as->root, OBJECT(s), name, UINT64_MAX);
@@ -5447,9 +5457,8 @@ static void vtd_realize(DeviceState *dev, Error **errp)
     memory_region_add_subregion_overlap(&s->mr_nodmar,
                                         VTD_INTERRUPT_ADDR_FIRST,
                                         &s->mr_ir, 1);
-    /* No corresponding destroy */
-    s->iotlb = g_hash_table_new_full(vtd_iotlb_hash, vtd_iotlb_equal,
-                                     g_free, g_free);
+    iommu_range_tlb_init(&s->iotlb, VTD_IOTLB_MAX_SIZE);
+    s->iotlb_gen = 1;
     s->vtd_address_spaces = g_hash_table_new_full(vtd_as_hash, vtd_as_equal,
                                       g_free, g_free);
     s->vtd_host_iommu_dev = g_hash_table_new_full(vtd_hiod_hash, vtd_hiod_equal,
@@ -82,6 +82,7 @@ struct E1000EState {
     E1000ECore core;
     bool init_vet;
     bool timadj;
+    bool ebpf_rss;
 };
 
 #define E1000E_MMIO_IDX     0
@@ -223,6 +224,14 @@ e1000e_nc_receive(NetClientState *nc, const uint8_t *buf, size_t size)
     return e1000e_receive(&s->core, buf, size);
 }
 
+static int
+e1000e_nc_receive_batch(NetClientState *nc, const NetBatchPacket *pkts,
+                        int count)
+{
+    E1000EState *s = qemu_get_nic_opaque(nc);
+    return e1000e_receive_batch(&s->core, pkts, count);
+}
+
 static void
 e1000e_set_link_status(NetClientState *nc)
 {
@@ -236,6 +245,7 @@ static NetClientInfo net_e1000e_info = {
     .can_receive = e1000e_nc_can_receive,
     .receive = e1000e_nc_receive,
     .receive_iov = e1000e_nc_receive_iov,
+    .receive_batch = e1000e_nc_receive_batch,
     .link_status_changed = e1000e_set_link_status,
 };
 
@@ -433,6 +443,14 @@ static void e1000e_pci_realize(PCIDevice *pci_dev, Error **errp)
     /* Define IO/MMIO regions */
     memory_region_init_io(&s->mmio, OBJECT(s), &mmio_ops, s,
                           "e1000e-mmio", E1000E_MMIO_SIZE);
+    /*
+     * Adaptive interrupt moderation rewrites the throttling registers from
+     * the interrupt path of the guest.  Writing them has no side effect, so
+     * let KVM batch these writes instead of exiting for each of them.  Any
+     * other access to the device flushes the batched writes first.
+     */
+    memory_region_add_coalescing(&s->mmio, E1000_ITR, 4);
+    memory_region_add_coalescing(&s->mmio, E1000_EITR, E1000E_MSIX_VEC_NUM * 4);
     pci_register_bar(pci_dev, E1000E_MMIO_IDX,
                      PCI_BASE_ADDRESS_SPACE_MEMORY, &s->mmio);
 
@@ -447,6 +465,8 @@ static void e1000e_pci_realize(PCIDevice *pci_dev, Error **errp)
 
     memory_region_init_io(&s->io, OBJECT(s), &io_ops, s,
                           "e1000e-io", E1000E_IO_SIZE);
+    /* The I/O BAR accesses the same registers */
+    memory_region_set_flush_coalesced(&s->io);
     pci_register_bar(pci_dev, E1000E_IO_IDX,
                      PCI_BASE_ADDRESS_SPACE_IO, &s->io);
 
@@ -492,6 +512,10 @@ static void e1000e_pci_realize(PCIDevice *pci_dev, Error **errp)
                             e1000e_eeprom_template,
                             sizeof(e1000e_eeprom_template),
                             macaddr);
+
+    if (s->ebpf_rss) {
+        e1000e_core_load_ebpf_rss(&s->core);
+    }
 }
 
 static void e1000e_pci_uninit(PCIDevice *pci_dev)
@@ -530,6 +554,8 @@ static int e1000e_pre_save(void *opaque)
 
     trace_e1000e_cb_pre_save();
 
+    /* Don't leave coalesced register writes behind */
+    qemu_flush_coalesced_mmio_buffer();
     e1000e_core_pre_save(&s->core);
 
     return 0;
@@ -671,6 +697,7 @@ static const Property e1000e_properties[] = {
                         e1000e_prop_subsys, uint16_t),
     DEFINE_PROP_BOOL("init-vet", E1000EState, init_vet, true),
     DEFINE_PROP_BOOL("migrate-timadj", E1000EState, timadj, true),
+    DEFINE_PROP_BOOL("x-ebpf-rss", E1000EState, ebpf_rss, false),
 };
 
 static void e1000e_class_init(ObjectClass *class, const void *data)
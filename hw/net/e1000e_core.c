@@ -35,12 +35,14 @@
 
 #include "qemu/osdep.h"
 #include "qemu/log.h"
+#include "qemu/error-report.h"
 #include "net/net.h"
 #include "net/tap.h"
 #include "hw/net/mii.h"
 #include "hw/pci/msi.h"
 #include "hw/pci/msix.h"
 #include "system/runstate.h"
+#include "ebpf/ebpf_rss.h"
 
 #include "net_tx_pkt.h"
 #include "net_rx_pkt.h"
@@ -594,6 +596,100 @@ e1000e_rss_parse_packet(E1000ECore *core,
     info->queue = E1000_RSS_QUEUE(&core->mac[RETA], info->hash);
 }
 
+static bool
+e1000e_attach_ebpf_rss(E1000ECore *core, int prog_fd)
+{
+    NetClientState *nc = qemu_get_peer(qemu_get_queue(core->owner_nic), 0);
+
+    if (!nc || !nc->info->set_steering_ebpf) {
+        return false;
+    }
+
+    trace_e1000e_rx_rss_ebpf_attach(prog_fd);
+    return nc->info->set_steering_ebpf(nc, prog_fd);
+}
+
+/*
+ * Mirror the RSS configuration of the guest into the steering program of
+ * the backend, so that the packets of each RSS queue come in through the
+ * backend queue with the same index.  This is only a hint: the RSS queue
+ * of every packet is still computed here.
+ */
+static void
+e1000e_update_ebpf_rss(E1000ECore *core)
+{
+    uint32_t mrqc = core->mac[MRQC];
+    struct EBPFRSSConfig config = {
+        .redirect = true,
+        .indirections_len = E1000_RETA_LEN,
+    };
+    uint16_t table[E1000_RETA_LEN];
+    uint8_t key[E1000_RSSRK_LEN];
+    int i;
+
+    if (!core->ebpf_rss) {
+        return;
+    }
+
+    if (!E1000_MRQC_ENABLED(mrqc)) {
+        e1000e_attach_ebpf_rss(core, -1);
+        return;
+    }
+
+    if (E1000_MRQC_EN_IPV4(mrqc)) {
+        config.hash_types |= VIRTIO_NET_RSS_HASH_TYPE_IPv4;
+    }
+    if (E1000_MRQC_EN_TCPIPV4(mrqc)) {
+        config.hash_types |= VIRTIO_NET_RSS_HASH_TYPE_TCPv4;
+    }
+    if (E1000_MRQC_EN_IPV6(mrqc)) {
+        config.hash_types |= VIRTIO_NET_RSS_HASH_TYPE_IPv6;
+    }
+    if (E1000_MRQC_EN_IPV6EX(mrqc)) {
+        config.hash_types |= VIRTIO_NET_RSS_HASH_TYPE_IPv6 |
+                             VIRTIO_NET_RSS_HASH_TYPE_IP_EX;
+    }
+    if (E1000_MRQC_EN_TCPIPV6EX(mrqc)) {
+        config.hash_types |= VIRTIO_NET_RSS_HASH_TYPE_TCPv6 |
+                             VIRTIO_NET_RSS_HASH_TYPE_TCP_EX;
+    }
+
+    /* Queues the backend does not have are folded onto the ones it has */
+    for (i = 0; i < ARRAY_SIZE(table); i++) {
+        table[i] = E1000_RSS_QUEUE(&core->mac[RETA], i) %
+                   (core->max_queue_num + 1);
+    }
+    memcpy(key, &core->mac[RSSRK], sizeof(key));
+
+    if (!ebpf_rss_set_all(core->ebpf_rss, &config, table, key, NULL) ||
+        !e1000e_attach_ebpf_rss(core, core->ebpf_rss->program_fd)) {
+        e1000e_attach_ebpf_rss(core, -1);
+    }
+}
+
+void
+e1000e_core_load_ebpf_rss(E1000ECore *core)
+{
+    Error *err = NULL;
+
+    /* Steering only makes sense with a multiqueue backend that supports it */
+    if (!core->max_queue_num || !e1000e_attach_ebpf_rss(core, -1)) {
+        warn_report("e1000e: the backend cannot steer packets with eBPF");
+        return;
+    }
+
+    core->ebpf_rss = g_new(struct EBPFRSSContext, 1);
+    ebpf_rss_init(core->ebpf_rss);
+    if (!ebpf_rss_load(core->ebpf_rss, &err)) {
+        warn_report_err(err);
+        g_free(core->ebpf_rss);
+        core->ebpf_rss = NULL;
+        return;
+    }
+
+    e1000e_update_ebpf_rss(core);
+}
+
 static bool
 e1000e_setup_tx_offloads(E1000ECore *core, struct e1000e_tx *tx)
 {
@@ -1645,6 +1741,17 @@ e1000e_rx_fix_l4_csum(E1000ECore *core, struct NetRxPkt *pkt)
     }
 }
 
+static void
+e1000e_rx_interrupt(E1000ECore *core, uint32_t causes)
+{
+    if (!e1000e_intrmgr_delay_rx_causes(core, &causes)) {
+        trace_e1000e_rx_interrupt_set(causes);
+        e1000e_set_interrupt_cause(core, causes);
+    } else {
+        trace_e1000e_rx_interrupt_delayed(causes);
+    }
+}
+
 ssize_t
 e1000e_receive_iov(E1000ECore *core, const struct iovec *iov, int iovcnt)
 {
@@ -1750,16 +1857,37 @@ e1000e_receive_internal(E1000ECore *core, const struct iovec *iov, int iovcnt,
         trace_e1000e_rx_not_written_to_guest(rxr.i->idx);
     }
 
-    if (!e1000e_intrmgr_delay_rx_causes(core, &causes)) {
-        trace_e1000e_rx_interrupt_set(causes);
-        e1000e_set_interrupt_cause(core, causes);
+    if (core->rx_batching) {
+        core->rx_batch_causes |= causes;
     } else {
-        trace_e1000e_rx_interrupt_delayed(causes);
+        e1000e_rx_interrupt(core, causes);
     }
 
     return retval;
 }
 
+int
+e1000e_receive_batch(E1000ECore *core, const NetBatchPacket *pkts, int count)
+{
+    int i;
+
+    /* Raise the interrupts of the whole burst at once */
+    core->rx_batching = true;
+    core->rx_batch_causes = 0;
+    for (i = 0; i < count; i++) {
+        if (e1000e_receive_iov(core, pkts[i].iov, pkts[i].iovcnt) == 0) {
+            break;
+        }
+    }
+    core->rx_batching = false;
+
+    if (core->rx_batch_causes) {
+        e1000e_rx_interrupt(core, core->rx_batch_causes);
+    }
+
+    return i;
+}
+
 static inline bool
 e1000e_have_autoneg(E1000ECore *core)
 {
@@ -2868,6 +2996,13 @@ e1000e_set_rxcsum(E1000ECore *core, int index, uint32_t val)
     e1000e_update_rx_offloads(core);
 }
 
+static void
+e1000e_set_rss(E1000ECore *core, int index, uint32_t val)
+{
+    core->mac[index] = val;
+    e1000e_update_ebpf_rss(core);
+}
+
 static void
 e1000e_set_gcr(E1000ECore *core, int index, uint32_t val)
 {
@@ -3151,7 +3286,6 @@ static const writeops e1000e_macreg_writeops[] = {
     e1000e_putreg(GSCN_2),
     e1000e_putreg(GSCN_3),
     e1000e_putreg(GCR2),
-    e1000e_putreg(MRQC),
     e1000e_putreg(FLOP),
     e1000e_putreg(FLOL),
     e1000e_putreg(FLSWCTL),
@@ -3256,8 +3390,9 @@ static const writeops e1000e_macreg_writeops[] = {
     [MDEF ... MDEF + 7]      = e1000e_mac_writereg,
     [FFLT ... FFLT + 10]     = e1000e_set_11bit,
     [FTFT ... FTFT + 254]    = e1000e_mac_writereg,
-    [RETA ... RETA + 31]     = e1000e_mac_writereg,
-    [RSSRK ... RSSRK + 31]   = e1000e_mac_writereg,
+    [MRQC]                   = e1000e_set_rss,
+    [RETA ... RETA + 31]     = e1000e_set_rss,
+    [RSSRK ... RSSRK + 31]   = e1000e_set_rss,
     [MAVTV0 ... MAVTV3]      = e1000e_mac_writereg,
     [EITR...EITR + E1000E_MSIX_VEC_NUM - 1] = e1000e_set_eitr
 };
@@ -3386,6 +3521,12 @@ e1000e_core_pci_uninit(E1000ECore *core)
     }
 
     net_rx_pkt_uninit(core->rx_pkt);
+
+    if (core->ebpf_rss) {
+        e1000e_attach_ebpf_rss(core, -1);
+        ebpf_rss_unload(core->ebpf_rss);
+        g_free(core->ebpf_rss);
+    }
 }
 
 static const uint16_t
@@ -3504,6 +3645,7 @@ static void e1000e_reset(E1000ECore *core, bool sw)
     }
 
     e1000x_reset_mac_addr(core->owner_nic, core->mac, core->permanent_mac);
+    e1000e_update_ebpf_rss(core);
 
     for (i = 0; i < ARRAY_SIZE(core->tx); i++) {
         memset(&core->tx[i].props, 0, sizeof(core->tx[i].props));
@@ -3556,6 +3698,7 @@ e1000e_core_post_load(E1000ECore *core)
      */
     e1000e_intrmgr_resume(core);
     e1000e_autoneg_resume(core);
+    e1000e_update_ebpf_rss(core);
 
     return 0;
 }
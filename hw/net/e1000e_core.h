@@ -84,9 +84,16 @@ struct E1000Core {
     bool has_vnet;
     int max_queue_num;
 
+    /* Steers packets to the backend queue of their RSS queue, if loaded */
+    struct EBPFRSSContext *ebpf_rss;
+
     /* Interrupt moderation management */
     uint32_t delayed_causes;
 
+    /* Causes of the packets received so far in a burst */
+    bool rx_batching;
+    uint32_t rx_batch_causes;
+
     E1000IntrDelayTimer radv;
     E1000IntrDelayTimer rdtr;
     E1000IntrDelayTimer raid;
@@ -139,6 +146,9 @@ e1000e_core_set_link_status(E1000ECore *core);
 void
 e1000e_core_pci_uninit(E1000ECore *core);
 
+void
+e1000e_core_load_ebpf_rss(E1000ECore *core);
+
 bool
 e1000e_can_receive(E1000ECore *core);
 
@@ -148,6 +158,9 @@ e1000e_receive(E1000ECore *core, const uint8_t *buf, size_t size);
 ssize_t
 e1000e_receive_iov(E1000ECore *core, const struct iovec *iov, int iovcnt);
 
+int
+e1000e_receive_batch(E1000ECore *core, const NetBatchPacket *pkts, int count);
+
 void
 e1000e_start_recv(E1000ECore *core);
 
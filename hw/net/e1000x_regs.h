@@ -287,7 +287,10 @@
 #define E1000_RETA      0x05C00 /* Redirection Table - RW Array */
 #define E1000_RSSRK     0x05C80 /* RSS Random Key - RW Array */
 
-#define E1000_RETA_IDX(hash)        ((hash) & (BIT(7) - 1))
+#define E1000_RETA_LEN              BIT(7) /* Entries of the RETA */
+#define E1000_RSSRK_LEN             40     /* Bytes of the key in use */
+
+#define E1000_RETA_IDX(hash)        ((hash) & (E1000_RETA_LEN - 1))
 #define E1000_RETA_VAL(reta, hash)  (((uint8_t *)(reta))[E1000_RETA_IDX(hash)])
 
 #define E1000_MRQC_EN_TCPIPV4(mrqc)   ((mrqc) & BIT(16))
@@ -79,6 +79,7 @@ struct IGBState {
 
     IGBCore core;
     bool has_flr;
+    bool ebpf_rss;
 };
 
 #define IGB_CAP_SRIOV_OFFSET    (0x160)
@@ -242,6 +243,13 @@ igb_nc_receive(NetClientState *nc, const uint8_t *buf, size_t size)
     return igb_receive(&s->core, buf, size);
 }
 
+static int
+igb_nc_receive_batch(NetClientState *nc, const NetBatchPacket *pkts, int count)
+{
+    IGBState *s = qemu_get_nic_opaque(nc);
+    return igb_receive_batch(&s->core, pkts, count);
+}
+
 static void
 igb_set_link_status(NetClientState *nc)
 {
@@ -255,6 +263,7 @@ static NetClientInfo net_igb_info = {
     .can_receive = igb_nc_can_receive,
     .receive = igb_nc_receive,
     .receive_iov = igb_nc_receive_iov,
+    .receive_batch = igb_nc_receive_batch,
     .link_status_changed = igb_set_link_status,
 };
 
@@ -394,6 +403,13 @@ static void igb_pci_realize(PCIDevice *pci_dev, Error **errp)
     /* Define IO/MMIO regions */
     memory_region_init_io(&s->mmio, OBJECT(s), &mmio_ops, s,
                           "igb-mmio", E1000E_MMIO_SIZE);
+    /*
+     * Adaptive interrupt moderation rewrites the throttling registers from
+     * the interrupt path of the guest.  Writing them has no side effect, so
+     * let KVM batch these writes instead of exiting for each of them.  Any
+     * other access to the device flushes the batched writes first.
+     */
+    memory_region_add_coalescing(&s->mmio, E1000_EITR(0), IGB_INTR_NUM * 4);
     pci_register_bar(pci_dev, E1000E_MMIO_IDX,
                      PCI_BASE_ADDRESS_SPACE_MEMORY, &s->mmio);
 
@@ -408,6 +424,8 @@ static void igb_pci_realize(PCIDevice *pci_dev, Error **errp)
 
     memory_region_init_io(&s->io, OBJECT(s), &io_ops, s,
                           "igb-io", E1000E_IO_SIZE);
+    /* The I/O BAR accesses the same registers */
+    memory_region_set_flush_coalesced(&s->io);
     pci_register_bar(pci_dev, E1000E_IO_IDX,
                      PCI_BASE_ADDRESS_SPACE_IO, &s->io);
 
@@ -469,6 +487,10 @@ static void igb_pci_realize(PCIDevice *pci_dev, Error **errp)
                          igb_eeprom_template,
                          sizeof(igb_eeprom_template),
                          macaddr);
+
+    if (s->ebpf_rss) {
+        igb_core_load_ebpf_rss(&s->core);
+    }
 }
 
 static void igb_pci_uninit(PCIDevice *pci_dev)
@@ -503,6 +525,8 @@ static int igb_pre_save(void *opaque)
 
     trace_e1000e_cb_pre_save();
 
+    /* Don't leave coalesced register writes behind */
+    qemu_flush_coalesced_mmio_buffer();
     igb_core_pre_save(&s->core);
 
     return 0;
@@ -597,6 +621,7 @@ static const VMStateDescription igb_vmstate = {
 static const Property igb_properties[] = {
     DEFINE_NIC_PROPERTIES(IGBState, conf),
     DEFINE_PROP_BOOL("x-pcie-flr-init", IGBState, has_flr, true),
+    DEFINE_PROP_BOOL("x-ebpf-rss", IGBState, ebpf_rss, false),
 };
 
 static void igb_class_init(ObjectClass *class, const void *data)
@@ -39,12 +39,14 @@
 
 #include "qemu/osdep.h"
 #include "qemu/log.h"
+#include "qemu/error-report.h"
 #include "net/net.h"
 #include "net/tap.h"
 #include "hw/net/mii.h"
 #include "hw/pci/msi.h"
 #include "hw/pci/msix.h"
 #include "system/runstate.h"
+#include "ebpf/ebpf_rss.h"
 
 #include "net_tx_pkt.h"
 #include "net_rx_pkt.h"
@@ -434,6 +436,107 @@ igb_rss_parse_packet(IGBCore *core, struct NetRxPkt *pkt, bool tx,
     info->queue = E1000_RSS_QUEUE(&core->mac[RETA], info->hash);
 }
 
+static bool
+igb_attach_ebpf_rss(IGBCore *core, int prog_fd)
+{
+    NetClientState *nc = qemu_get_peer(qemu_get_queue(core->owner_nic), 0);
+
+    if (!nc || !nc->info->set_steering_ebpf) {
+        return false;
+    }
+
+    trace_e1000e_rx_rss_ebpf_attach(prog_fd);
+    return nc->info->set_steering_ebpf(nc, prog_fd);
+}
+
+/*
+ * Mirror the RSS configuration of the guest into the steering program of
+ * the backend, so that the packets of each RSS queue come in through the
+ * backend queue with the same index and a full ring only holds back its
+ * own flows.  This is only a hint: the RSS queue of every packet is still
+ * computed here, whichever backend queue it came in through.
+ */
+static void
+igb_update_ebpf_rss(IGBCore *core)
+{
+    uint32_t mrqc = core->mac[MRQC];
+    struct EBPFRSSConfig config = {
+        .redirect = true,
+        .indirections_len = E1000_RETA_LEN,
+    };
+    uint16_t table[E1000_RETA_LEN];
+    uint8_t key[E1000_RSSRK_LEN];
+    int i;
+
+    if (!core->ebpf_rss) {
+        return;
+    }
+
+    if ((mrqc & 3) != E1000_MRQC_ENABLE_RSS_MQ) {
+        igb_attach_ebpf_rss(core, -1);
+        return;
+    }
+
+    if (E1000_MRQC_EN_IPV4(mrqc)) {
+        config.hash_types |= VIRTIO_NET_RSS_HASH_TYPE_IPv4;
+    }
+    if (E1000_MRQC_EN_TCPIPV4(mrqc)) {
+        config.hash_types |= VIRTIO_NET_RSS_HASH_TYPE_TCPv4;
+    }
+    if (mrqc & E1000_MRQC_RSS_FIELD_IPV4_UDP) {
+        config.hash_types |= VIRTIO_NET_RSS_HASH_TYPE_UDPv4;
+    }
+    if (E1000_MRQC_EN_IPV6(mrqc)) {
+        config.hash_types |= VIRTIO_NET_RSS_HASH_TYPE_IPv6;
+    }
+    if (E1000_MRQC_EN_IPV6EX(mrqc)) {
+        config.hash_types |= VIRTIO_NET_RSS_HASH_TYPE_IPv6 |
+                             VIRTIO_NET_RSS_HASH_TYPE_IP_EX;
+    }
+    if (E1000_MRQC_EN_TCPIPV6EX(mrqc)) {
+        config.hash_types |= VIRTIO_NET_RSS_HASH_TYPE_TCPv6 |
+                             VIRTIO_NET_RSS_HASH_TYPE_TCP_EX;
+    }
+    if (mrqc & E1000_MRQC_RSS_FIELD_IPV6_UDP) {
+        config.hash_types |= VIRTIO_NET_RSS_HASH_TYPE_UDPv6;
+    }
+
+    /* Queues the backend does not have are folded onto the ones it has */
+    for (i = 0; i < ARRAY_SIZE(table); i++) {
+        table[i] = E1000_RSS_QUEUE(&core->mac[RETA], i) %
+                   (core->max_queue_num + 1);
+    }
+    memcpy(key, &core->mac[RSSRK], sizeof(key));
+
+    if (!ebpf_rss_set_all(core->ebpf_rss, &config, table, key, NULL) ||
+        !igb_attach_ebpf_rss(core, core->ebpf_rss->program_fd)) {
+        igb_attach_ebpf_rss(core, -1);
+    }
+}
+
+void
+igb_core_load_ebpf_rss(IGBCore *core)
+{
+    Error *err = NULL;
+
+    /* Steering only makes sense with a multiqueue backend that supports it */
+    if (!core->max_queue_num || !igb_attach_ebpf_rss(core, -1)) {
+        warn_report("igb: the backend cannot steer packets with eBPF");
+        return;
+    }
+
+    core->ebpf_rss = g_new(struct EBPFRSSContext, 1);
+    ebpf_rss_init(core->ebpf_rss);
+    if (!ebpf_rss_load(core->ebpf_rss, &err)) {
+        warn_report_err(err);
+        g_free(core->ebpf_rss);
+        core->ebpf_rss = NULL;
+        return;
+    }
+
+    igb_update_ebpf_rss(core);
+}
+
 static void
 igb_tx_insert_vlan(IGBCore *core, uint16_t qn, struct igb_tx *tx,
     uint16_t vlan, bool insert_vlan)
@@ -2095,6 +2198,12 @@ igb_receive_internal(IGBCore *core, const struct iovec *iov, int iovcnt,
         trace_e1000e_rx_written_to_guest(rxr.i->idx);
     }
 
+    if (core->rx_batching) {
+        core->rx_batch_causes |= causes;
+        core->rx_batch_ecauses |= ecauses;
+        return orig_size;
+    }
+
     trace_e1000e_rx_interrupt_set(causes);
     igb_raise_interrupts(core, EICR, ecauses);
     igb_raise_interrupts(core, ICR, causes);
@@ -2102,6 +2211,31 @@ igb_receive_internal(IGBCore *core, const struct iovec *iov, int iovcnt,
     return orig_size;
 }
 
+int
+igb_receive_batch(IGBCore *core, const NetBatchPacket *pkts, int count)
+{
+    int i;
+
+    /* Raise the interrupts of the whole burst at once */
+    core->rx_batching = true;
+    core->rx_batch_causes = 0;
+    core->rx_batch_ecauses = 0;
+    for (i = 0; i < count; i++) {
+        if (igb_receive_iov(core, pkts[i].iov, pkts[i].iovcnt) == 0) {
+            break;
+        }
+    }
+    core->rx_batching = false;
+
+    if (core->rx_batch_causes || core->rx_batch_ecauses) {
+        trace_e1000e_rx_interrupt_set(core->rx_batch_causes);
+        igb_raise_interrupts(core, EICR, core->rx_batch_ecauses);
+        igb_raise_interrupts(core, ICR, core->rx_batch_causes);
+    }
+
+    return i;
+}
+
 static inline bool
 igb_have_autoneg(IGBCore *core)
 {
@@ -3071,6 +3205,13 @@ igb_set_rxcsum(IGBCore *core, int index, uint32_t val)
     igb_update_rx_offloads(core);
 }
 
+static void
+igb_set_rss(IGBCore *core, int index, uint32_t val)
+{
+    core->mac[index] = val;
+    igb_update_ebpf_rss(core);
+}
+
 static void
 igb_set_gcr(IGBCore *core, int index, uint32_t val)
 {
@@ -3775,7 +3916,6 @@ static const writeops igb_macreg_writeops[] = {
     igb_putreg(GSCN_1),
     igb_putreg(GSCN_2),
     igb_putreg(GSCN_3),
-    igb_putreg(MRQC),
     igb_putreg(FLOP),
     igb_putreg(FLA),
     igb_putreg(TXDCTL0),
@@ -4035,8 +4175,9 @@ static const writeops igb_macreg_writeops[] = {
     [FFMT ... FFMT + 254]    = igb_set_4bit,
     [MDEF ... MDEF + 7]      = igb_mac_writereg,
     [FTFT ... FTFT + 254]    = igb_mac_writereg,
-    [RETA ... RETA + 31]     = igb_mac_writereg,
-    [RSSRK ... RSSRK + 9]    = igb_mac_writereg,
+    [MRQC]                   = igb_set_rss,
+    [RETA ... RETA + 31]     = igb_set_rss,
+    [RSSRK ... RSSRK + 9]    = igb_set_rss,
     [MAVTV0 ... MAVTV3]      = igb_mac_writereg,
     [EITR0 ... EITR0 + IGB_INTR_NUM - 1] = igb_set_eitr,
 
@@ -4322,6 +4463,12 @@ igb_core_pci_uninit(IGBCore *core)
     }
 
     net_rx_pkt_uninit(core->rx_pkt);
+
+    if (core->ebpf_rss) {
+        igb_attach_ebpf_rss(core, -1);
+        ebpf_rss_unload(core->ebpf_rss);
+        g_free(core->ebpf_rss);
+    }
 }
 
 static const uint16_t
@@ -4488,6 +4635,7 @@ static void igb_reset(IGBCore *core, bool sw)
     }
 
     e1000x_reset_mac_addr(core->owner_nic, core->mac, core->permanent_mac);
+    igb_update_ebpf_rss(core);
 
     for (int vfn = 0; vfn < IGB_MAX_VF_FUNCTIONS; vfn++) {
         /* Set RSTI, so VF can identify a PF reset is in progress */
@@ -4547,6 +4695,7 @@ igb_core_post_load(IGBCore *core)
      */
     igb_intrmgr_resume(core);
     igb_autoneg_resume(core);
+    igb_update_ebpf_rss(core);
 
     return 0;
 }
@@ -88,8 +88,16 @@ struct IGBCore {
     bool has_vnet;
     int max_queue_num;
 
+    /* Steers packets to the backend queue of their RSS queue, if loaded */
+    struct EBPFRSSContext *ebpf_rss;
+
     IGBIntrDelayTimer eitr[IGB_INTR_NUM];
 
+    /* Causes of the packets received so far in a burst */
+    bool rx_batching;
+    uint32_t rx_batch_causes;
+    uint32_t rx_batch_ecauses;
+
     uint32_t eitr_guest_value[IGB_INTR_NUM];
 
     uint8_t permanent_mac[ETH_ALEN];
@@ -128,6 +136,9 @@ igb_core_set_link_status(IGBCore *core);
 void
 igb_core_pci_uninit(IGBCore *core);
 
+void
+igb_core_load_ebpf_rss(IGBCore *core);
+
 void
 igb_core_vf_reset(IGBCore *core, uint16_t vfn);
 
@@ -140,6 +151,9 @@ igb_receive(IGBCore *core, const uint8_t *buf, size_t size);
 ssize_t
 igb_receive_iov(IGBCore *core, const struct iovec *iov, int iovcnt);
 
+int
+igb_receive_batch(IGBCore *core, const NetBatchPacket *pkts, int count);
+
 void
 igb_start_recv(IGBCore *core);
 
@@ -47,6 +47,23 @@ struct NetRxPkt {
     eth_ip6_hdr_info ip6hdr_info;
     eth_ip4_hdr_info ip4hdr_info;
     eth_l4_hdr_info  l4hdr_info;
+
+    /*
+     * The analysis results describe the packet at parsed_off in
+     * parsed_iov, with offsets counted from parsed_base.  Only set by
+     * net_rx_pkt_set_protocols(), so that attaching the same packet
+     * afterwards does not parse it again.
+     */
+    const struct iovec *parsed_iov;
+    int parsed_iovcnt;
+    size_t parsed_off;
+    size_t parsed_base;
+
+    /*
+     * RSS key of the last net_rx_pkt_calc_rss_hash() call.  All zeroes
+     * is a valid table for the all-zeroes key.
+     */
+    NetToeplitzTable rss_table;
 };
 
 void net_rx_pkt_init(struct NetRxPkt **pkt)
@@ -107,6 +124,17 @@ net_rx_pkt_pull_data(struct NetRxPkt *pkt,
                                 iov, iovcnt, ploff, pkt->tot_len);
     }
 
+    if (!pkt->ehdr_buf_len && pkt->parsed_iov == iov &&
+        pkt->parsed_iovcnt == iovcnt && pkt->parsed_off == ploff) {
+        /* Nothing was stripped, only make the offsets relative to ploff */
+        pkt->l3hdr_off -= ploff - pkt->parsed_base;
+        pkt->l4hdr_off -= ploff - pkt->parsed_base;
+        pkt->l5hdr_off -= ploff - pkt->parsed_base;
+        pkt->parsed_base = ploff;
+        return;
+    }
+
+    pkt->parsed_iov = NULL;
     eth_get_protocols(pkt->vec, pkt->vec_len, 0, &pkt->hasip4, &pkt->hasip6,
                       &pkt->l3hdr_off, &pkt->l4hdr_off, &pkt->l5hdr_off,
                       &pkt->ip6hdr_info, &pkt->ip4hdr_info, &pkt->l4hdr_info);
@@ -196,6 +224,11 @@ void net_rx_pkt_set_protocols(struct NetRxPkt *pkt,
     eth_get_protocols(iov, iovcnt, iovoff, &pkt->hasip4, &pkt->hasip6,
                       &pkt->l3hdr_off, &pkt->l4hdr_off, &pkt->l5hdr_off,
                       &pkt->ip6hdr_info, &pkt->ip4hdr_info, &pkt->l4hdr_info);
+
+    pkt->parsed_iov = iov;
+    pkt->parsed_iovcnt = iovcnt;
+    pkt->parsed_off = iovoff;
+    pkt->parsed_base = 0;
 }
 
 void net_rx_pkt_get_protocols(struct NetRxPkt *pkt,
@@ -307,8 +340,7 @@ net_rx_pkt_calc_rss_hash(struct NetRxPkt *pkt,
 {
     uint8_t rss_input[36];
     size_t rss_length = 0;
-    uint32_t rss_hash = 0;
-    net_toeplitz_key key_data;
+    uint32_t rss_hash;
 
     switch (type) {
     case NetPktRssIpV4:
@@ -372,8 +404,10 @@ net_rx_pkt_calc_rss_hash(struct NetRxPkt *pkt,
         g_assert_not_reached();
     }
 
-    net_toeplitz_key_init(&key_data, key);
-    net_toeplitz_add(&rss_hash, rss_input, rss_length, &key_data);
+    if (memcmp(pkt->rss_table.key, key, NET_TOEPLITZ_KEY_SIZE)) {
+        net_toeplitz_table_init(&pkt->rss_table, key);
+    }
+    rss_hash = net_toeplitz_hash(&pkt->rss_table, rss_input, rss_length);
 
     trace_net_rx_pkt_rss_hash(rss_length, rss_hash);
 
@@ -54,6 +54,10 @@ size_t net_rx_pkt_get_total_len(struct NetRxPkt *pkt);
 /**
  * parse and set packet analysis results
  *
+ * The results are reused if the same packet is attached next with
+ * net_rx_pkt_attach_iovec() or net_rx_pkt_attach_iovec_ex() and no VLAN
+ * tag is stripped, so @iov must not change in between.
+ *
  * @pkt:            packet
  * @iov:            received data scatter-gather list
  * @iovcnt:         number of elements in iov
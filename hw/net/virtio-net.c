@@ -31,6 +31,8 @@
 #include "net/vhost_net.h"
 #include "net/announce.h"
 #include "hw/virtio/virtio-bus.h"
+#include "hw/virtio/iothread-vq-mapping.h"
+#include "qemu/aio-wait.h"
 #include "qapi/error.h"
 #include "qapi/qapi-events-net.h"
 #include "hw/core/qdev-properties.h"
@@ -401,12 +403,21 @@ static void virtio_net_drop_tx_queue_data(VirtIODevice *vdev, VirtQueue *vq)
     }
 }
 
+static void virtio_net_dataplane_attach(VirtIONet *n);
+static void virtio_net_dataplane_detach(VirtIONet *n);
+
 static int virtio_net_set_status(struct VirtIODevice *vdev, uint8_t status)
 {
     VirtIONet *n = VIRTIO_NET(vdev);
     VirtIONetQueue *q;
     int i;
     uint8_t queue_status;
+    bool dataplane_attached = n->dataplane_attached;
+
+    /* The queue pairs are only ever reconfigured from the main loop */
+    if (dataplane_attached) {
+        virtio_net_dataplane_detach(n);
+    }
 
     virtio_net_vnet_endian_status(n, status);
     virtio_net_vhost_status(n, status);
@@ -456,6 +467,10 @@ static int virtio_net_set_status(struct VirtIODevice *vdev, uint8_t status)
             }
         }
     }
+
+    if (dataplane_attached) {
+        virtio_net_dataplane_attach(n);
+    }
     return 0;
 }
 
@@ -580,6 +595,12 @@ static void virtio_net_queue_reset(VirtIODevice *vdev, uint32_t queue_index)
         return;
     }
 
+    /*
+     * The ring is reset by our caller once we return, so the queue pairs
+     * stay in the main loop until the driver enables it again.
+     */
+    virtio_net_dataplane_detach(n);
+
     nc = qemu_get_subqueue(n->nic, vq2q(queue_index));
 
     if (!nc->peer) {
@@ -605,6 +626,10 @@ static void virtio_net_queue_enable(VirtIODevice *vdev, uint32_t queue_index)
         return;
     }
 
+    if (n->dataplane_started) {
+        virtio_net_dataplane_attach(n);
+    }
+
     nc = qemu_get_subqueue(n->nic, vq2q(queue_index));
 
     if (!nc->peer || !vdev->vhost_started) {
@@ -636,6 +661,12 @@ static int peer_has_vnet_hdr(VirtIONet *n)
     return n->has_vnet_hdr;
 }
 
+/* Offloads the peer cannot take are done in software, see net/gso.c */
+static bool virtio_net_sw_offload(VirtIONet *n)
+{
+    return n->sw_offload && !n->has_vnet_hdr;
+}
+
 static int peer_has_ufo(VirtIONet *n)
 {
     if (!peer_has_vnet_hdr(n))
@@ -926,6 +957,9 @@ static void failover_add_primary(VirtIONet *n, Error **errp)
     error_propagate(errp, err);
 }
 
+static void virtio_net_gro_flush(void *opaque, const struct virtio_net_hdr *hdr,
+                                 const uint8_t *pkt, size_t size);
+
 static void virtio_net_set_features(VirtIODevice *vdev,
                                     const uint64_t *in_features)
 {
@@ -967,6 +1001,23 @@ static void virtio_net_set_features(VirtIODevice *vdev,
         virtio_net_apply_guest_offloads(n);
     }
 
+    if (virtio_net_sw_offload(n)) {
+        bool csum = virtio_has_feature_ex(features, VIRTIO_NET_F_GUEST_CSUM);
+
+        for (i = 0; i < n->max_queue_pairs; i++) {
+            VirtIONetQueue *q = &n->vqs[i];
+
+            if (!q->gro) {
+                q->gro = net_gro_new(virtio_net_gro_flush, q);
+            }
+            net_gro_set_offloads(q->gro,
+                csum && virtio_has_feature_ex(features,
+                                              VIRTIO_NET_F_GUEST_TSO4),
+                csum && virtio_has_feature_ex(features,
+                                              VIRTIO_NET_F_GUEST_TSO6));
+        }
+    }
+
     for (i = 0;  i < n->max_queue_pairs; i++) {
         NetClientState *nc = qemu_get_subqueue(n->nic, i);
 
@@ -1593,7 +1644,14 @@ size_t virtio_net_handle_ctrl_iov(VirtIODevice *vdev,
 
 static void virtio_net_handle_ctrl(VirtIODevice *vdev, VirtQueue *vq)
 {
+    VirtIONet *n = VIRTIO_NET(vdev);
     VirtQueueElement *elem;
+    bool dataplane_attached = n->dataplane_attached;
+
+    /* Commands change state that the rx and tx paths rely on */
+    if (dataplane_attached) {
+        virtio_net_dataplane_detach(n);
+    }
 
     for (;;) {
         size_t written;
@@ -1614,6 +1672,10 @@ static void virtio_net_handle_ctrl(VirtIODevice *vdev, VirtQueue *vq)
             break;
         }
     }
+
+    if (dataplane_attached) {
+        virtio_net_dataplane_attach(n);
+    }
 }
 
 /* RX */
@@ -1714,7 +1776,8 @@ static void work_around_broken_dhclient(struct virtio_net_hdr *hdr,
 }
 
 static void receive_header(VirtIONet *n, const struct iovec *iov, int iov_cnt,
-                           const void *buf, size_t size)
+                           const void *buf, size_t size,
+                           const struct virtio_net_hdr *sw_hdr)
 {
     if (n->has_vnet_hdr) {
         /* FIXME this cast is evil */
@@ -1726,6 +1789,8 @@ static void receive_header(VirtIONet *n, const struct iovec *iov, int iov_cnt,
             virtio_net_hdr_swap(VIRTIO_DEVICE(n), wbuf);
         }
         iov_from_buf(iov, iov_cnt, 0, buf, sizeof(struct virtio_net_hdr));
+    } else if (sw_hdr) {
+        iov_from_buf(iov, iov_cnt, 0, sw_hdr, sizeof(*sw_hdr));
     } else {
         struct virtio_net_hdr hdr = {
             .flags = 0,
@@ -1900,8 +1965,13 @@ static int virtio_net_process_rss(NetClientState *nc, const uint8_t *buf,
     return (index == new_index) ? -1 : new_index;
 }
 
+/*
+ * @sw_hdr is the header to hand the guest along with the packet, in guest
+ * byte order, for offloads done in software.
+ */
 static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
-                                      size_t size)
+                                      size_t size,
+                                      const struct virtio_net_hdr *sw_hdr)
 {
     VirtIONet *n = qemu_get_nic_opaque(nc);
     VirtIONetQueue *q;
@@ -1919,7 +1989,13 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
     if (n->rss_data.enabled && n->rss_data.enabled_software_rss) {
         int index = virtio_net_process_rss(nc, buf, size, &extra_hdr);
         if (index >= 0) {
-            nc = qemu_get_subqueue(n->nic, index % n->curr_queue_pairs);
+            index %= n->curr_queue_pairs;
+            /* Queue pairs run by other IOThreads cannot be filled from here */
+            if (!n->dataplane_attached ||
+                n->vq_aio_context[index] ==
+                n->vq_aio_context[nc->queue_index]) {
+                nc = qemu_get_subqueue(n->nic, index);
+            }
         }
     }
 
@@ -1952,7 +2028,7 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
             goto err;
         }
 
-        elem = virtqueue_pop(q->rx_vq, sizeof(VirtQueueElement));
+        elem = virtqueue_pop_pooled(q->rx_vq, sizeof(VirtQueueElement));
         if (!elem) {
             if (i) {
                 virtio_error(vdev, "virtio-net unexpected empty queue: "
@@ -1971,7 +2047,7 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
             virtio_error(vdev,
                          "virtio-net receive queue contains no in buffers");
             virtqueue_detach_element(q->rx_vq, elem, 0);
-            g_free(elem);
+            virtqueue_element_release(elem);
             err = -1;
             goto err;
         }
@@ -1988,7 +2064,7 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
                 extra_hdr.hdr.num_buffers = cpu_to_le16(1);
             }
 
-            receive_header(n, sg, elem->in_num, buf, size);
+            receive_header(n, sg, elem->in_num, buf, size, sw_hdr);
             if (n->rss_data.populate_hash) {
                 offset = offsetof(typeof(extra_hdr), hash_value);
                 iov_from_buf(sg, elem->in_num, offset,
@@ -2013,7 +2089,7 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
          * Otherwise, drop it. */
         if (!n->mergeable_rx_bufs && offset < size) {
             virtqueue_unpop(q->rx_vq, elem, total);
-            g_free(elem);
+            virtqueue_element_release(elem);
             err = size;
             goto err;
         }
@@ -2034,18 +2110,22 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
     for (j = 0; j < i; j++) {
         /* signal other side */
         virtqueue_fill(q->rx_vq, elems[j], lens[j], j);
-        g_free(elems[j]);
+        virtqueue_element_release(elems[j]);
     }
 
     virtqueue_flush(q->rx_vq, i);
-    virtio_notify(vdev, q->rx_vq);
+    if (q->rx_batching) {
+        q->rx_notify_pending = true;
+    } else {
+        virtio_notify(vdev, q->rx_vq);
+    }
 
     return size;
 
 err:
     for (j = 0; j < i; j++) {
         virtqueue_detach_element(q->rx_vq, elems[j], lens[j]);
-        g_free(elems[j]);
+        virtqueue_element_release(elems[j]);
     }
 
     return err;
@@ -2056,7 +2136,23 @@ static ssize_t virtio_net_do_receive(NetClientState *nc, const uint8_t *buf,
 {
     RCU_READ_LOCK_GUARD();
 
-    return virtio_net_receive_rcu(nc, buf, size);
+    return virtio_net_receive_rcu(nc, buf, size, NULL);
+}
+
+static void virtio_net_gro_flush(void *opaque, const struct virtio_net_hdr *hdr,
+                                 const uint8_t *pkt, size_t size)
+{
+    VirtIONetQueue *q = opaque;
+    VirtIONet *n = q->n;
+    struct virtio_net_hdr sw_hdr = *hdr;
+
+    virtio_net_hdr_swap(VIRTIO_DEVICE(n), &sw_hdr);
+
+    RCU_READ_LOCK_GUARD();
+
+    /* There was room in the ring, so this cannot fail but for link loss */
+    virtio_net_receive_rcu(qemu_get_subqueue(n->nic, q - n->vqs), pkt, size,
+                           &sw_hdr);
 }
 
 /*
@@ -2690,7 +2786,7 @@ static void virtio_net_tx_complete(NetClientState *nc, ssize_t len)
     virtqueue_push(q->tx_vq, q->async_tx.elem, 0);
     virtio_notify(vdev, q->tx_vq);
 
-    g_free(q->async_tx.elem);
+    virtqueue_element_release(q->async_tx.elem);
     q->async_tx.elem = NULL;
 
     virtio_queue_set_notification(q->tx_vq, 1);
@@ -2713,11 +2809,65 @@ static void virtio_net_tx_complete(NetClientState *nc, ssize_t len)
 }
 
 /* TX */
+/*
+ * Do the checksum and segmentation offloads the guest asked for in @vhdr,
+ * for a peer that cannot take a virtio-net header.  Returns 0 if part of
+ * the packet had to be queued, like qemu_sendv_packet_async().
+ */
+static ssize_t virtio_net_tx_sw_offload(VirtIONetQueue *q,
+                                        struct virtio_net_hdr *vhdr,
+                                        const struct iovec *sg,
+                                        unsigned int sg_num)
+{
+    VirtIONet *n = q->n;
+    NetClientState *nc = qemu_get_subqueue(n->nic, q - n->vqs);
+    g_autofree uint8_t *pkt = NULL;
+    NetGSOSegments segs;
+    size_t size;
+    int sent, count;
+
+    size = iov_size(sg, sg_num) - n->guest_hdr_len;
+    if (size > NET_BUFSIZE) {
+        return size;
+    }
+    pkt = g_malloc(size);
+    iov_to_buf(sg, sg_num, n->guest_hdr_len, pkt, size);
+
+    virtio_net_hdr_swap(VIRTIO_DEVICE(n), vhdr);
+    if (!net_gso_segment(vhdr, pkt, size, &segs)) {
+        /* Malformed offload request, drop the packet */
+        return size;
+    }
+
+    sent = qemu_sendv_batch_async(nc, segs.pkts, segs.count,
+                                  virtio_net_tx_complete);
+    count = segs.count;
+    net_gso_segments_free(&segs);
+
+    return sent < count ? 0 : size;
+}
+
+/*
+ * Make the transmitted buffers filled so far used at once, so that with
+ * VIRTIO_F_IN_ORDER they take a single used descriptor
+ */
+static void virtio_net_tx_flush_filled(VirtIONetQueue *q,
+                                       unsigned int num_filled)
+{
+    if (num_filled) {
+        WITH_RCU_READ_LOCK_GUARD() {
+            virtqueue_flush(q->tx_vq, num_filled);
+        }
+        virtio_notify(VIRTIO_DEVICE(q->n), q->tx_vq);
+    }
+}
+
 static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
 {
     VirtIONet *n = q->n;
     VirtIODevice *vdev = VIRTIO_DEVICE(n);
     VirtQueueElement *elem;
+    unsigned int num_filled = 0;
     int32_t num_packets = 0;
     int queue_index = vq2q(virtio_get_queue_index(q->tx_vq));
     if (!(vdev->status & VIRTIO_CONFIG_S_DRIVER_OK)) {
@@ -2735,7 +2885,7 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
         struct iovec sg[VIRTQUEUE_MAX_SIZE], sg2[VIRTQUEUE_MAX_SIZE + 1], *out_sg;
         struct virtio_net_hdr vhdr;
 
-        elem = virtqueue_pop(q->tx_vq, sizeof(VirtQueueElement));
+        elem = virtqueue_pop_pooled(q->tx_vq, sizeof(VirtQueueElement));
         if (!elem) {
             break;
         }
@@ -2775,6 +2925,14 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
                 virtio_error(vdev, "virtio-net header is invalid");
                 goto detach;
             }
+            if (virtio_net_sw_offload(n)) {
+                iov_to_buf(out_sg, out_num, 0, &vhdr, sizeof(vhdr));
+                if ((vhdr.flags & VIRTIO_NET_HDR_F_NEEDS_CSUM) ||
+                    vhdr.gso_type != VIRTIO_NET_HDR_GSO_NONE) {
+                    ret = virtio_net_tx_sw_offload(q, &vhdr, out_sg, out_num);
+                    goto sent;
+                }
+            }
             unsigned sg_num = iov_copy(sg, ARRAY_SIZE(sg),
                                        out_sg, out_num,
                                        0, n->host_hdr_len);
@@ -2792,26 +2950,31 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
 
         ret = qemu_sendv_packet_async(qemu_get_subqueue(n->nic, queue_index),
                                       out_sg, out_num, virtio_net_tx_complete);
+sent:
         if (ret == 0) {
+            virtio_net_tx_flush_filled(q, num_filled);
             virtio_queue_set_notification(q->tx_vq, 0);
             q->async_tx.elem = elem;
             return -EBUSY;
         }
 
 drop:
-        virtqueue_push(q->tx_vq, elem, 0);
-        virtio_notify(vdev, q->tx_vq);
-        g_free(elem);
+        WITH_RCU_READ_LOCK_GUARD() {
+            virtqueue_fill(q->tx_vq, elem, 0, num_filled++);
+        }
+        virtqueue_element_release(elem);
 
         if (++num_packets >= n->tx_burst) {
             break;
         }
     }
+    virtio_net_tx_flush_filled(q, num_filled);
     return num_packets;
 
 detach:
+    virtio_net_tx_flush_filled(q, num_filled);
     virtqueue_detach_element(q->tx_vq, elem, 0);
-    g_free(elem);
+    virtqueue_element_release(elem);
     return -EINVAL;
 }
 
@@ -2971,6 +3134,62 @@ static void virtio_net_tx_bh(void *opaque)
     }
 }
 
+static bool virtio_net_tx_timer_enabled(VirtIONet *n)
+{
+    return n->net_conf.tx && !strcmp(n->net_conf.tx, "timer");
+}
+
+/*
+ * Create the tx timer or bottom half of @q in @ctx, or in the main loop if
+ * @ctx is NULL, and restart transmission if it was pending.
+ */
+static void virtio_net_tx_attach(VirtIONetQueue *q, AioContext *ctx)
+{
+    VirtIONet *n = q->n;
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+
+    if (virtio_net_tx_timer_enabled(n)) {
+        if (ctx) {
+            q->tx_timer = aio_timer_new(ctx, QEMU_CLOCK_VIRTUAL, SCALE_NS,
+                                        virtio_net_tx_timer, q);
+        } else {
+            q->tx_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL,
+                                       virtio_net_tx_timer, q);
+        }
+    } else {
+        if (ctx) {
+            q->tx_bh = aio_bh_new_guarded(ctx, virtio_net_tx_bh, q,
+                                          &DEVICE(vdev)->mem_reentrancy_guard);
+        } else {
+            q->tx_bh = qemu_bh_new_guarded(virtio_net_tx_bh, q,
+                                           &DEVICE(vdev)->mem_reentrancy_guard);
+        }
+    }
+
+    if (!q->tx_waiting || !virtio_net_started(n, vdev->status)) {
+        return;
+    }
+
+    if (q->tx_timer) {
+        timer_mod(q->tx_timer,
+                  qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + n->tx_timeout);
+    } else {
+        replay_bh_schedule_event(q->tx_bh);
+    }
+}
+
+/* Free the tx timer or bottom half of @q, q->tx_waiting is left as is */
+static void virtio_net_tx_detach(VirtIONetQueue *q)
+{
+    if (q->tx_timer) {
+        timer_free(q->tx_timer);
+        q->tx_timer = NULL;
+    } else {
+        qemu_bh_delete(q->tx_bh);
+        q->tx_bh = NULL;
+    }
+}
+
 static void virtio_net_add_queue(VirtIONet *n, int index)
 {
     VirtIODevice *vdev = VIRTIO_DEVICE(n);
@@ -2978,23 +3197,25 @@ static void virtio_net_add_queue(VirtIONet *n, int index)
     n->vqs[index].rx_vq = virtio_add_queue(vdev, n->net_conf.rx_queue_size,
                                            virtio_net_handle_rx);
 
-    if (n->net_conf.tx && !strcmp(n->net_conf.tx, "timer")) {
+    if (virtio_net_tx_timer_enabled(n)) {
         n->vqs[index].tx_vq =
             virtio_add_queue(vdev, n->net_conf.tx_queue_size,
                              virtio_net_handle_tx_timer);
-        n->vqs[index].tx_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL,
-                                              virtio_net_tx_timer,
-                                              &n->vqs[index]);
     } else {
         n->vqs[index].tx_vq =
             virtio_add_queue(vdev, n->net_conf.tx_queue_size,
                              virtio_net_handle_tx_bh);
-        n->vqs[index].tx_bh = qemu_bh_new_guarded(virtio_net_tx_bh, &n->vqs[index],
-                                                  &DEVICE(vdev)->mem_reentrancy_guard);
     }
 
+    /*
+     * Transmitted buffers are used with a length of 0, while received
+     * packets need not fill their buffers
+     */
+    virtio_queue_set_in_order_batch(n->vqs[index].tx_vq, true);
+
     n->vqs[index].tx_waiting = 0;
     n->vqs[index].n = n;
+    virtio_net_tx_attach(&n->vqs[index], NULL);
 }
 
 static void virtio_net_del_queue(VirtIONet *n, int index)
@@ -3006,13 +3227,7 @@ static void virtio_net_del_queue(VirtIONet *n, int index)
     qemu_purge_queued_packets(nc);
 
     virtio_del_queue(vdev, index * 2);
-    if (q->tx_timer) {
-        timer_free(q->tx_timer);
-        q->tx_timer = NULL;
-    } else {
-        qemu_bh_delete(q->tx_bh);
-        q->tx_bh = NULL;
-    }
+    virtio_net_tx_detach(q);
     q->tx_waiting = 0;
     virtio_del_queue(vdev, index * 2 + 1);
 }
@@ -3068,6 +3283,232 @@ static int virtio_net_pre_load_queues(VirtIODevice *vdev, uint32_t n)
     return 0;
 }
 
+/*
+ * With iothread-vq-mapping, each queue pair runs in the AioContext of the
+ * IOThread it is mapped to, together with the backend queue it is connected
+ * to, while the control virtqueue stays in the main loop.  The queue pairs
+ * are brought back to the main loop whenever the state they depend on is
+ * changed, so that neither the rx nor the tx path needs any locking.
+ */
+
+static int virtio_net_dataplane_queue_pairs(VirtIONet *n)
+{
+    return n->multiqueue ? n->max_queue_pairs : 1;
+}
+
+/* Context: BQL held */
+static bool virtio_net_dataplane_setup(VirtIONet *n, Error **errp)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    BusState *qbus = qdev_get_parent_bus(DEVICE(vdev));
+    VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    int i;
+
+    if (!k->set_guest_notifiers || !k->ioeventfd_assign) {
+        error_setg(errp,
+                   "device is incompatible with iothread-vq-mapping "
+                   "(transport does not support notifiers)");
+        return false;
+    }
+    if (!virtio_device_ioeventfd_enabled(vdev)) {
+        error_setg(errp, "ioeventfd is required for iothread-vq-mapping");
+        return false;
+    }
+    if (virtio_has_feature(n->host_features, VIRTIO_NET_F_RSC_EXT)) {
+        error_setg(errp, "guest_rsc_ext is not supported with "
+                   "iothread-vq-mapping");
+        return false;
+    }
+
+    for (i = 0; i < n->nic_conf.peers.queues; i++) {
+        NetClientState *peer = n->nic_conf.peers.ncs[i];
+
+        if (get_vhost_net(peer)) {
+            error_setg(errp, "iothread-vq-mapping is not supported with "
+                       "vhost netdev '%s'", peer->name);
+            return false;
+        }
+        if (!peer->info->set_aio_context) {
+            error_setg(errp, "netdev '%s' does not support "
+                       "iothread-vq-mapping", peer->name);
+            return false;
+        }
+        if (!QTAILQ_EMPTY(&peer->filters)) {
+            error_setg(errp, "iothread-vq-mapping is not supported with "
+                       "filters on netdev '%s'", peer->name);
+            return false;
+        }
+    }
+
+    n->vq_aio_context = g_new(AioContext *, n->max_queue_pairs);
+    if (!iothread_vq_mapping_apply(n->iothread_vq_mapping_list,
+                                   n->vq_aio_context, n->max_queue_pairs,
+                                   errp)) {
+        g_free(n->vq_aio_context);
+        n->vq_aio_context = NULL;
+        return false;
+    }
+
+    /* Masking is left to the transport, there is no vhost to do it */
+    vdev->use_guest_notifier_mask = false;
+    return true;
+}
+
+/* Context: BQL held */
+static void virtio_net_dataplane_cleanup(VirtIONet *n)
+{
+    if (!n->vq_aio_context) {
+        return;
+    }
+
+    assert(!n->dataplane_started);
+    iothread_vq_mapping_cleanup(n->iothread_vq_mapping_list);
+    g_free(n->vq_aio_context);
+    n->vq_aio_context = NULL;
+}
+
+/* Context: BH in IOThread */
+static void virtio_net_dataplane_attach_bh(void *opaque)
+{
+    VirtIONetQueue *q = opaque;
+    VirtIONet *n = q->n;
+    AioContext *ctx = qemu_get_current_aio_context();
+
+    qemu_set_aio_context(qemu_get_subqueue(n->nic, q - n->vqs)->peer, ctx);
+    virtio_net_tx_attach(q, ctx);
+
+    /* The rx and tx handlers do not pop everything, don't poll them */
+    virtio_queue_aio_attach_host_notifier_no_poll(q->rx_vq, ctx);
+    virtio_queue_aio_attach_host_notifier_no_poll(q->tx_vq, ctx);
+}
+
+/* Context: BQL held */
+static void virtio_net_dataplane_attach(VirtIONet *n)
+{
+    int i;
+
+    if (n->dataplane_attached) {
+        return;
+    }
+
+    /* Set first, see the software RSS steering in virtio_net_receive_rcu() */
+    n->dataplane_attached = true;
+
+    for (i = 0; i < virtio_net_dataplane_queue_pairs(n); i++) {
+        VirtIONetQueue *q = &n->vqs[i];
+
+        event_notifier_set_handler(virtio_queue_get_host_notifier(q->rx_vq),
+                                   NULL);
+        event_notifier_set_handler(virtio_queue_get_host_notifier(q->tx_vq),
+                                   NULL);
+        virtio_net_tx_detach(q);
+
+        aio_wait_bh_oneshot(n->vq_aio_context[i],
+                            virtio_net_dataplane_attach_bh, q);
+    }
+}
+
+/* Context: BH in IOThread */
+static void virtio_net_dataplane_detach_bh(void *opaque)
+{
+    VirtIONetQueue *q = opaque;
+    VirtIONet *n = q->n;
+    AioContext *ctx = qemu_get_current_aio_context();
+
+    virtio_queue_aio_detach_host_notifier(q->rx_vq, ctx);
+    virtio_queue_aio_detach_host_notifier(q->tx_vq, ctx);
+
+    virtio_net_tx_detach(q);
+    qemu_set_aio_context(qemu_get_subqueue(n->nic, q - n->vqs)->peer, NULL);
+}
+
+/* Context: BQL held */
+static void virtio_net_dataplane_detach(VirtIONet *n)
+{
+    int i;
+
+    if (!n->dataplane_attached) {
+        return;
+    }
+
+    for (i = 0; i < virtio_net_dataplane_queue_pairs(n); i++) {
+        VirtIONetQueue *q = &n->vqs[i];
+
+        aio_wait_bh_oneshot(n->vq_aio_context[i],
+                            virtio_net_dataplane_detach_bh, q);
+
+        virtio_net_tx_attach(q, NULL);
+        event_notifier_set_handler(virtio_queue_get_host_notifier(q->rx_vq),
+                                   virtio_queue_host_notifier_read);
+        event_notifier_set_handler(virtio_queue_get_host_notifier(q->tx_vq),
+                                   virtio_queue_host_notifier_read);
+    }
+
+    n->dataplane_attached = false;
+}
+
+/* Context: BQL held */
+static int virtio_net_start_ioeventfd(VirtIODevice *vdev)
+{
+    VirtIONet *n = VIRTIO_NET(vdev);
+    VirtioDeviceClass *vdc =
+        VIRTIO_DEVICE_CLASS(object_class_by_name(TYPE_VIRTIO_DEVICE));
+    BusState *qbus = qdev_get_parent_bus(DEVICE(vdev));
+    VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    int nvqs = virtio_get_num_queues(vdev);
+    int r;
+
+    if (!n->vq_aio_context) {
+        return vdc->start_ioeventfd(vdev);
+    }
+
+    if (n->dataplane_started) {
+        return 0;
+    }
+
+    /* Set up guest notifier (irq) */
+    r = k->set_guest_notifiers(qbus->parent, nvqs, true);
+    if (r != 0) {
+        error_report("virtio-net failed to set guest notifier (%d), "
+                     "ensure -accel kvm is set.", r);
+        return -ENOSYS;
+    }
+
+    r = vdc->start_ioeventfd(vdev);
+    if (r < 0) {
+        k->set_guest_notifiers(qbus->parent, nvqs, false);
+        return r;
+    }
+
+    n->dataplane_started = true;
+    virtio_net_dataplane_attach(n);
+    return 0;
+}
+
+/* Context: BQL held */
+static void virtio_net_stop_ioeventfd(VirtIODevice *vdev)
+{
+    VirtIONet *n = VIRTIO_NET(vdev);
+    VirtioDeviceClass *vdc =
+        VIRTIO_DEVICE_CLASS(object_class_by_name(TYPE_VIRTIO_DEVICE));
+    BusState *qbus = qdev_get_parent_bus(DEVICE(vdev));
+    VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+
+    if (!n->vq_aio_context) {
+        vdc->stop_ioeventfd(vdev);
+        return;
+    }
+
+    if (!n->dataplane_started) {
+        return;
+    }
+
+    virtio_net_dataplane_detach(n);
+    vdc->stop_ioeventfd(vdev);
+    k->set_guest_notifiers(qbus->parent, virtio_get_num_queues(vdev), false);
+    n->dataplane_started = false;
+}
+
 static void virtio_net_get_features(VirtIODevice *vdev, uint64_t *features,
                                     Error **errp)
 {
@@ -3087,7 +3528,7 @@ static void virtio_net_get_features(VirtIODevice *vdev, uint64_t *features,
 
     virtio_add_feature_ex(features, VIRTIO_NET_F_MAC);
 
-    if (!peer_has_vnet_hdr(n)) {
+    if (!peer_has_vnet_hdr(n) && !virtio_net_sw_offload(n)) {
         virtio_clear_feature_ex(features, VIRTIO_NET_F_CSUM);
         virtio_clear_feature_ex(features, VIRTIO_NET_F_HOST_TSO4);
         virtio_clear_feature_ex(features, VIRTIO_NET_F_HOST_TSO6);
@@ -3096,6 +3537,9 @@ static void virtio_net_get_features(VirtIODevice *vdev, uint64_t *features,
         virtio_clear_feature_ex(features, VIRTIO_NET_F_GUEST_CSUM);
         virtio_clear_feature_ex(features, VIRTIO_NET_F_GUEST_TSO4);
         virtio_clear_feature_ex(features, VIRTIO_NET_F_GUEST_TSO6);
+    }
+
+    if (!peer_has_vnet_hdr(n)) {
         virtio_clear_feature_ex(features, VIRTIO_NET_F_GUEST_ECN);
 
         virtio_clear_feature_ex(features, VIRTIO_NET_F_HOST_USO);
@@ -3625,6 +4069,68 @@ static const VMStateDescription vmstate_virtio_net_device = {
     }
 };
 
+static int virtio_net_receive_batch(NetClientState *nc,
+                                    const NetBatchPacket *pkts, int count)
+{
+    VirtIONet *n = qemu_get_nic_opaque(nc);
+    VirtIONetQueue *q = virtio_net_get_subqueue(nc);
+    NetGRO *gro = NULL;
+    int i;
+
+    /*
+     * Coalesce TCP segments for a guest that can take them, when the peer
+     * cannot do it.  RSS might spread the packets across queues, and RSC
+     * does its own coalescing.
+     */
+    if (virtio_net_sw_offload(n) && q->gro &&
+        !n->rss_data.enabled_software_rss &&
+        !n->rsc4_enabled && !n->rsc6_enabled) {
+        gro = q->gro;
+    }
+
+    /* Flush each packet to the ring, but notify once for the burst */
+    q->rx_batching = true;
+    for (i = 0; i < count; i++) {
+        g_autofree uint8_t *copy = NULL;
+        const uint8_t *buf = pkts[i].iov[0].iov_base;
+        size_t size = pkts[i].iov[0].iov_len;
+
+        if (pkts[i].iovcnt != 1) {
+            size = iov_size(pkts[i].iov, pkts[i].iovcnt);
+            copy = g_malloc(size);
+            iov_to_buf(pkts[i].iov, pkts[i].iovcnt, 0, copy, size);
+            buf = copy;
+        }
+
+        if (gro) {
+            /* Only coalesce what the ring can take in one go */
+            if (!virtio_net_has_buffers(q, net_gro_pending(gro) + size +
+                                           n->guest_hdr_len)) {
+                net_gro_flush(gro);
+            }
+            if (virtio_net_has_buffers(q, size + n->guest_hdr_len) &&
+                net_gro_receive(gro, buf, size)) {
+                continue;
+            }
+        }
+
+        if (virtio_net_receive(nc, buf, size) == 0) {
+            break;
+        }
+    }
+    if (gro) {
+        net_gro_flush(gro);
+    }
+    q->rx_batching = false;
+
+    if (q->rx_notify_pending) {
+        q->rx_notify_pending = false;
+        virtio_notify(VIRTIO_DEVICE(n), q->rx_vq);
+    }
+
+    return i;
+}
+
 static NetClientInfo net_virtio_info = {
     .type = NET_CLIENT_DRIVER_NIC,
     .size = sizeof(NICState),
@@ -3633,6 +4139,7 @@ static NetClientInfo net_virtio_info = {
     .link_status_changed = virtio_net_set_link_status,
     .query_rx_filter = virtio_net_query_rxfilter,
     .announce = virtio_net_announce,
+    .receive_batch = virtio_net_receive_batch,
 };
 
 static bool virtio_net_guest_notifier_pending(VirtIODevice *vdev, int idx)
@@ -3957,6 +4464,13 @@ static void virtio_net_device_realize(DeviceState *dev, Error **errp)
         virtio_cleanup(vdev);
         return;
     }
+
+    if (n->iothread_vq_mapping_list &&
+        !virtio_net_dataplane_setup(n, errp)) {
+        virtio_cleanup(vdev);
+        return;
+    }
+
     n->vqs = g_new0(VirtIONetQueue, n->max_queue_pairs);
     n->curr_queue_pairs = 1;
     n->tx_timeout = n->net_conf.txtimer;
@@ -4059,6 +4573,7 @@ static void virtio_net_device_unrealize(DeviceState *dev)
 
     /* This will stop vhost backend if appropriate. */
     virtio_net_set_status(vdev, 0);
+    virtio_net_dataplane_cleanup(n);
 
     g_free(n->netclient_name);
     n->netclient_name = NULL;
@@ -4083,6 +4598,9 @@ static void virtio_net_device_unrealize(DeviceState *dev)
     /* delete also control vq */
     virtio_del_queue(vdev, max_queue_pairs * 2);
     qemu_announce_timer_del(&n->announce_timer, false);
+    for (i = 0; i < n->max_queue_pairs; i++) {
+        g_clear_pointer(&n->vqs[i].gro, net_gro_free);
+    }
     g_free(n->vqs);
     qemu_del_nic(n->nic);
     virtio_net_rsc_cleanup(n);
@@ -4248,11 +4766,14 @@ static const Property virtio_net_properties[] = {
     DEFINE_PROP_UINT16("tx_queue_size", VirtIONet, net_conf.tx_queue_size,
                        VIRTIO_NET_TX_QUEUE_DEFAULT_SIZE),
     DEFINE_PROP_UINT16("host_mtu", VirtIONet, net_conf.mtu, 0),
+    DEFINE_PROP_BOOL("x-sw-offload", VirtIONet, sw_offload, false),
     DEFINE_PROP_BOOL("x-mtu-bypass-backend", VirtIONet, mtu_bypass_backend,
                      true),
     DEFINE_PROP_INT32("speed", VirtIONet, net_conf.speed, SPEED_UNKNOWN),
     DEFINE_PROP_STRING("duplex", VirtIONet, net_conf.duplex_str),
     DEFINE_PROP_BOOL("failover", VirtIONet, failover, false),
+    DEFINE_PROP_IOTHREAD_VQ_MAPPING_LIST("iothread-vq-mapping", VirtIONet,
+                                         iothread_vq_mapping_list),
     DEFINE_PROP_BIT64("guest_uso4", VirtIONet, host_features,
                       VIRTIO_NET_F_GUEST_USO4, true),
     DEFINE_PROP_BIT64("guest_uso6", VirtIONet, host_features,
@@ -4332,6 +4853,8 @@ static void virtio_net_class_init(ObjectClass *klass, const void *data)
     vdc->queue_reset = virtio_net_queue_reset;
     vdc->queue_enable = virtio_net_queue_enable;
     vdc->set_status = virtio_net_set_status;
+    vdc->start_ioeventfd = virtio_net_start_ioeventfd;
+    vdc->stop_ioeventfd = virtio_net_stop_ioeventfd;
     vdc->guest_notifier_mask = virtio_net_guest_notifier_mask;
     vdc->guest_notifier_pending = virtio_net_guest_notifier_pending;
     vdc->legacy_features |= (0x1 << VIRTIO_NET_F_GSO);
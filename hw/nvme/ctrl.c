@@ -199,6 +199,7 @@
 #include "qemu/log.h"
 #include "qemu/units.h"
 #include "qemu/range.h"
+#include "qemu/timer.h"
 #include "qapi/error.h"
 #include "qapi/visitor.h"
 #include "system/system.h"
@@ -257,6 +258,8 @@ static const uint32_t nvme_feature_cap[NVME_FID_MAX] = {
     [NVME_ERROR_RECOVERY]           = NVME_FEAT_CAP_CHANGE | NVME_FEAT_CAP_NS,
     [NVME_VOLATILE_WRITE_CACHE]     = NVME_FEAT_CAP_CHANGE,
     [NVME_NUMBER_OF_QUEUES]         = NVME_FEAT_CAP_CHANGE,
+    [NVME_INTERRUPT_COALESCING]     = NVME_FEAT_CAP_CHANGE,
+    [NVME_INTERRUPT_VECTOR_CONF]    = NVME_FEAT_CAP_CHANGE,
     [NVME_WRITE_ATOMICITY]          = NVME_FEAT_CAP_CHANGE,
     [NVME_ASYNCHRONOUS_EVENT_CONF]  = NVME_FEAT_CAP_CHANGE,
     [NVME_TIMESTAMP]                = NVME_FEAT_CAP_CHANGE,
@@ -705,6 +708,120 @@ static void nvme_irq_deassert(NvmeCtrl *n, NvmeCQueue *cq)
     }
 }
 
+/*
+ * Used for interrupt coalescing when the host has not configured the feature
+ * and the intc-adaptive parameter is set: aggregate up to 8 completions for at
+ * most 100 microseconds.
+ */
+#define NVME_INTC_ADAPTIVE_THR  7
+#define NVME_INTC_ADAPTIVE_TIME 1
+
+/* Aggregation Time is specified in 100 microsecond increments */
+#define NVME_INTC_TIME_NS       (100 * SCALE_US)
+
+static void nvme_intv_timer(void *opaque)
+{
+    NvmeIntVec *iv = opaque;
+    PCIDevice *pci = PCI_DEVICE(iv->ctrl);
+
+    trace_pci_nvme_irq_coalesced(iv->vector, iv->aggr);
+
+    iv->aggr = 0;
+    if (msix_enabled(pci)) {
+        msix_notify(pci, iv->vector);
+    }
+}
+
+static bool nvme_cq_busy(NvmeCQueue *cq)
+{
+    NvmeSQueue *sq;
+
+    QTAILQ_FOREACH(sq, &cq->sq_list, entry) {
+        if (!QTAILQ_EMPTY(&sq->out_req_list)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * Raise the interrupt of @cq after @posted completion queue entries were
+ * posted, unless interrupt coalescing allows it to be delayed.  Coalescing
+ * only applies to MSI-X vectors of I/O completion queues.  The interrupt is
+ * never delayed while no commands are outstanding on the queue, since no
+ * further completions would arrive to aggregate with.
+ */
+static void nvme_irq_post(NvmeCtrl *n, NvmeCQueue *cq, unsigned posted)
+{
+    uint32_t intc = n->features.int_coalescing;
+    NvmeIntVec *iv;
+    uint8_t thr, time;
+
+    if (!cq->cqid || !cq->irq_enabled || !msix_enabled(PCI_DEVICE(n)) ||
+        cq->vector >= n->nr_intv) {
+        goto out;
+    }
+
+    iv = &n->intv[cq->vector];
+    if (iv->cd) {
+        goto out;
+    }
+
+    thr = NVME_INTC_THR(intc);
+    time = NVME_INTC_TIME(intc);
+    if (!intc && n->params.intc_adaptive) {
+        thr = NVME_INTC_ADAPTIVE_THR;
+        time = NVME_INTC_ADAPTIVE_TIME;
+    }
+
+    /* an Aggregation Time of zero means no delay */
+    if (!time) {
+        goto out;
+    }
+
+    if (!posted) {
+        /* the vector is either idle or an interrupt is already scheduled */
+        if (!iv->aggr) {
+            goto out;
+        }
+
+        return;
+    }
+
+    /* the Aggregation Threshold is a 0's based value */
+    iv->aggr += posted;
+    if (iv->aggr <= thr && nvme_cq_busy(cq)) {
+        if (!timer_pending(iv->timer)) {
+            timer_mod(iv->timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) +
+                      time * NVME_INTC_TIME_NS);
+        }
+
+        return;
+    }
+
+    timer_del(iv->timer);
+    iv->aggr = 0;
+
+out:
+    nvme_irq_assert(n, cq);
+}
+
+static void nvme_intv_reset(NvmeCtrl *n)
+{
+    int i;
+
+    n->features.int_coalescing = 0;
+
+    for (i = 0; i < n->nr_intv; i++) {
+        NvmeIntVec *iv = &n->intv[i];
+
+        timer_del(iv->timer);
+        iv->aggr = 0;
+        iv->cd = false;
+    }
+}
+
 static void nvme_req_clear(NvmeRequest *req)
 {
     req->ns = NULL;
@@ -866,6 +983,20 @@ static uint16_t nvme_map_addr(NvmeCtrl *n, NvmeSg *sg, hwaddr addr, size_t len)
         return NVME_INVALID_USE_OF_CMB | NVME_DNR;
     }
 
+    /*
+     * PRPs of large transfers are often physically contiguous; extend the
+     * previous entry instead of mapping every page on its own.
+     */
+    if (sg->qsg.nsg) {
+        ScatterGatherEntry *last = &sg->qsg.sg[sg->qsg.nsg - 1];
+
+        if (last->base + last->len == addr) {
+            last->len += len;
+            sg->qsg.size += len;
+            return NVME_SUCCESS;
+        }
+    }
+
     if (sg->qsg.nsg + 1 > IOV_MAX) {
         goto max_mappings_exceeded;
     }
@@ -906,7 +1037,7 @@ static uint16_t nvme_map_prp(NvmeCtrl *n, NvmeSg *sg, uint64_t prp1,
     len -= trans_len;
     if (len) {
         if (len > n->page_size) {
-            g_autofree uint64_t *prp_list = g_new(uint64_t, n->max_prp_ents);
+            uint64_t *prp_list = n->prp_list;
             uint32_t nents, prp_trans;
             int i = 0;
 
@@ -1501,6 +1632,7 @@ static void nvme_post_cqes(void *opaque)
     NvmeCtrl *n = cq->ctrl;
     NvmeRequest *req, *next;
     bool pending = cq->head != cq->tail;
+    unsigned posted = 0;
     int ret;
 
     QTAILQ_FOREACH_SAFE(req, &cq->req_list, entry, next) {
@@ -1534,6 +1666,7 @@ static void nvme_post_cqes(void *opaque)
 
         nvme_inc_cq_tail(cq);
         nvme_sg_unmap(&req->sg);
+        posted++;
 
         if (QTAILQ_EMPTY(&sq->req_list) && !nvme_sq_empty(sq)) {
             qemu_bh_schedule(sq->bh);
@@ -1546,7 +1679,7 @@ static void nvme_post_cqes(void *opaque)
             n->cq_pending++;
         }
 
-        nvme_irq_assert(n, cq);
+        nvme_irq_post(n, cq, posted);
     }
 }
 
@@ -6373,6 +6506,20 @@ static uint16_t nvme_get_feature(NvmeCtrl *n, NvmeRequest *req)
     case NVME_ASYNCHRONOUS_EVENT_CONF:
         result = n->features.async_config;
         goto out;
+    case NVME_INTERRUPT_COALESCING:
+        result = n->features.int_coalescing;
+        goto out;
+    case NVME_INTERRUPT_VECTOR_CONF:
+        iv = dw11 & 0xffff;
+        if (iv >= n->conf_ioqpairs + 1) {
+            return NVME_INVALID_FIELD | NVME_DNR;
+        }
+
+        result = iv;
+        if (iv == n->admin_cq.vector || (iv < n->nr_intv && n->intv[iv].cd)) {
+            result |= NVME_INTVC_NOCOALESCING;
+        }
+        goto out;
     case NVME_TIMESTAMP:
         return nvme_get_feature_timestamp(n, req);
     case NVME_HOST_BEHAVIOR_SUPPORT:
@@ -6582,6 +6729,7 @@ static uint16_t nvme_set_feature(NvmeCtrl *n, NvmeRequest *req)
     uint8_t fid = NVME_GETSETFEAT_FID(dw10);
     uint8_t save = NVME_SETFEAT_SAVE(dw10);
     uint16_t status;
+    uint16_t iv;
     int i;
 
     trace_pci_nvme_setfeat(nvme_cid(req), nsid, fid, save, dw11);
@@ -6701,6 +6849,27 @@ static uint16_t nvme_set_feature(NvmeCtrl *n, NvmeRequest *req)
     case NVME_ASYNCHRONOUS_EVENT_CONF:
         n->features.async_config = dw11;
         break;
+    case NVME_INTERRUPT_COALESCING:
+        n->features.int_coalescing = dw11 & 0xffff;
+        break;
+    case NVME_INTERRUPT_VECTOR_CONF:
+        iv = dw11 & 0xffff;
+        if (iv >= n->conf_ioqpairs + 1) {
+            return NVME_INVALID_FIELD | NVME_DNR;
+        }
+
+        /* the admin vector is never coalesced */
+        if (iv == n->admin_cq.vector) {
+            if (!(dw11 & NVME_INTVC_NOCOALESCING)) {
+                return NVME_INVALID_FIELD | NVME_DNR;
+            }
+            break;
+        }
+
+        if (iv < n->nr_intv) {
+            n->intv[iv].cd = !!(dw11 & NVME_INTVC_NOCOALESCING);
+        }
+        break;
     case NVME_TIMESTAMP:
         return nvme_set_feature_timestamp(n, req);
     case NVME_HOST_BEHAVIOR_SUPPORT:
@@ -7931,6 +8100,8 @@ static void nvme_ctrl_reset(NvmeCtrl *n, NvmeResetType rst)
         }
     }
 
+    nvme_intv_reset(n);
+
     n->aer_queued = 0;
     n->aer_mask = 0;
     n->outstanding_aers = 0;
@@ -8037,6 +8208,7 @@ static int nvme_start_ctrl(NvmeCtrl *n)
     n->page_bits = page_bits;
     n->page_size = page_size;
     n->max_prp_ents = n->page_size / sizeof(uint64_t);
+    n->prp_list = g_renew(uint64_t, n->prp_list, n->max_prp_ents);
     nvme_init_cq(&n->admin_cq, n, acq, 0, 0, NVME_AQA_ACQS(aqa) + 1, 1);
     nvme_init_sq(&n->admin_sq, n, asq, 0, 0, NVME_AQA_ASQS(aqa) + 1);
 
@@ -8944,7 +9116,7 @@ static bool nvme_init_pci(NvmeCtrl *n, PCIDevice *pci_dev, Error **errp)
     uint64_t bar_size;
     unsigned msix_table_offset = 0, msix_pba_offset = 0;
     unsigned nr_vectors;
-    int ret;
+    int i, ret;
 
     pci_conf[PCI_INTERRUPT_PIN] = pci_is_vf(pci_dev) ? 0 : 1;
     pci_config_set_prog_interface(pci_conf, 0x2);
@@ -9012,6 +9184,17 @@ static bool nvme_init_pci(NvmeCtrl *n, PCIDevice *pci_dev, Error **errp)
         return false;
     }
 
+    if (msix_present(pci_dev)) {
+        n->nr_intv = pci_dev->msix_entries_nr;
+        n->intv = g_new0(NvmeIntVec, n->nr_intv);
+        for (i = 0; i < n->nr_intv; i++) {
+            n->intv[i].ctrl = n;
+            n->intv[i].vector = i;
+            n->intv[i].timer = timer_new_ns(QEMU_CLOCK_VIRTUAL,
+                                            nvme_intv_timer, &n->intv[i]);
+        }
+    }
+
     if (!pci_is_vf(pci_dev) && n->params.sriov_max_vfs &&
         !nvme_init_sriov(n, pci_dev, 0x120, errp)) {
         return false;
@@ -9335,6 +9518,12 @@ static void nvme_exit(PCIDevice *pci_dev)
     g_free(n->cq);
     g_free(n->sq);
     g_free(n->aer_reqs);
+    g_free(n->prp_list);
+
+    for (i = 0; i < n->nr_intv; i++) {
+        timer_free(n->intv[i].timer);
+    }
+    g_free(n->intv);
 
     if (n->params.cmb_size_mb) {
         g_free(n->cmb.buf);
@@ -9386,6 +9575,7 @@ static const Property nvme_props[] = {
     DEFINE_PROP_BOOL("legacy-cmb", NvmeCtrl, params.legacy_cmb, false),
     DEFINE_PROP_BOOL("ioeventfd", NvmeCtrl, params.ioeventfd, false),
     DEFINE_PROP_BOOL("dbcs", NvmeCtrl, params.dbcs, true),
+    DEFINE_PROP_BOOL("intc-adaptive", NvmeCtrl, params.intc_adaptive, false),
     DEFINE_PROP_UINT8("zoned.zasl", NvmeCtrl, params.zasl, 0),
     DEFINE_PROP_BOOL("zoned.auto_transition", NvmeCtrl,
                      params.auto_transition_zones, true),
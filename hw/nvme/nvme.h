@@ -535,6 +535,15 @@ typedef struct NvmeCQueue {
     QTAILQ_HEAD(, NvmeRequest) req_list;
 } NvmeCQueue;
 
+/* Interrupt coalescing state of an MSI-X vector */
+typedef struct NvmeIntVec {
+    struct NvmeCtrl *ctrl;
+    uint16_t    vector;
+    bool        cd;         /* Coalescing Disable */
+    uint32_t    aggr;       /* completions posted since the last interrupt */
+    QEMUTimer   *timer;
+} NvmeIntVec;
+
 #define TYPE_NVME "nvme"
 #define NVME(obj) \
         OBJECT_CHECK(NvmeCtrl, (obj), TYPE_NVME)
@@ -571,6 +580,7 @@ typedef struct NvmeParams {
     uint16_t atomic_awun;
     uint16_t atomic_awupf;
     bool     atomic_dn;
+    bool     intc_adaptive;
 } NvmeParams;
 
 typedef struct NvmeCtrl {
@@ -586,10 +596,14 @@ typedef struct NvmeCtrl {
     uint32_t    page_size;
     uint16_t    page_bits;
     uint16_t    max_prp_ents;
+    /* PRP list buffer of max_prp_ents, reused by every command */
+    uint64_t    *prp_list;
     uint32_t    max_q_ents;
     uint8_t     outstanding_aers;
     uint32_t    irq_status;
     int         cq_pending;
+    NvmeIntVec  *intv;      /* one per MSI-X vector */
+    uint16_t    nr_intv;
     uint64_t    host_timestamp;                 /* Timestamp sent by the host */
     uint64_t    timestamp_set_qemu_clock_ms;    /* QEMU clock time */
     uint64_t    starttime_ms;
@@ -650,6 +664,7 @@ typedef struct NvmeCtrl {
         };
 
         uint32_t                async_config;
+        uint32_t                int_coalescing;
         NvmeHostBehaviorSupport hbs;
     } features;
 
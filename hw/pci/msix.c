@@ -16,6 +16,7 @@
 
 #include "qemu/osdep.h"
 #include "qemu/log.h"
+#include "qemu/main-loop.h"
 #include "hw/pci/msi.h"
 #include "hw/pci/msix.h"
 #include "hw/pci/pci.h"
@@ -227,6 +228,8 @@ static void msix_table_mmio_write(void *opaque, hwaddr addr,
 
     assert(addr + size <= dev->msix_entries_nr * PCI_MSIX_ENTRY_SIZE);
 
+    /* The region may be lockless, see msix_enable_lockless_io() */
+    BQL_LOCK_GUARD();
     was_masked = msix_is_masked(dev, vector);
     pci_set_long(dev->msix_table + addr, val);
     msix_handle_mask_update(dev, vector, was_masked);
@@ -252,6 +255,8 @@ static uint64_t msix_pba_mmio_read(void *opaque, hwaddr addr,
     if (dev->msix_vector_poll_notifier) {
         unsigned vector_start = addr * 8;
         unsigned vector_end = MIN((addr + size) * 8, dev->msix_entries_nr);
+        BQL_LOCK_GUARD();
+
         dev->msix_vector_poll_notifier(dev, vector_start, vector_end);
     }
 
@@ -490,6 +495,16 @@ void msix_uninit_exclusive_bar(PCIDevice *dev)
     }
 }
 
+/*
+ * Table reads and PBA reads without a poll notifier only load from memory
+ * that is written under the BQL.  Everything else takes the BQL itself.
+ */
+void msix_enable_lockless_io(PCIDevice *dev)
+{
+    memory_region_enable_lockless_io(&dev->msix_table_mmio);
+    memory_region_enable_lockless_io(&dev->msix_pba_mmio);
+}
+
 void msix_save(PCIDevice *dev, QEMUFile *f)
 {
     unsigned n = dev->msix_entries_nr;
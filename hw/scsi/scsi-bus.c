@@ -998,7 +998,8 @@ void scsi_req_build_sense(SCSIRequest *req, SCSISense sense)
     req->sense_len = scsi_build_sense(req->sense, sense);
 }
 
-static void scsi_req_enqueue_internal(SCSIRequest *req)
+/* Everything but adding the request to dev->requests */
+static void scsi_req_enqueue_prepare(SCSIRequest *req)
 {
     assert(!req->enqueued);
     scsi_req_ref(req);
@@ -1008,24 +1009,61 @@ static void scsi_req_enqueue_internal(SCSIRequest *req)
         req->sg = NULL;
     }
     req->enqueued = true;
+}
+
+static void scsi_req_enqueue_internal(SCSIRequest *req)
+{
+    scsi_req_enqueue_prepare(req);
 
     WITH_QEMU_LOCK_GUARD(&req->dev->requests_lock) {
         QTAILQ_INSERT_TAIL(&req->dev->requests, req, next);
     }
 }
 
-int32_t scsi_req_enqueue(SCSIRequest *req)
+static int32_t scsi_req_send_command(SCSIRequest *req)
 {
     int32_t rc;
 
-    assert(!req->retry);
-    scsi_req_enqueue_internal(req);
     scsi_req_ref(req);
     rc = req->ops->send_command(req, req->cmd.buf);
     scsi_req_unref(req);
     return rc;
 }
 
+int32_t scsi_req_enqueue(SCSIRequest *req)
+{
+    assert(!req->retry);
+    scsi_req_enqueue_internal(req);
+    return scsi_req_send_command(req);
+}
+
+void scsi_req_enqueue_batch(SCSIRequest **reqs, unsigned int n)
+{
+    unsigned int i, j, k;
+
+    for (i = 0; i < n; i = j) {
+        SCSIDevice *dev = reqs[i]->dev;
+
+        for (j = i; j < n && reqs[j]->dev == dev; j++) {
+            assert(!reqs[j]->retry);
+            scsi_req_enqueue_prepare(reqs[j]);
+        }
+
+        /* One lock round trip for all consecutive requests to a device */
+        WITH_QEMU_LOCK_GUARD(&dev->requests_lock) {
+            for (k = i; k < j; k++) {
+                QTAILQ_INSERT_TAIL(&dev->requests, reqs[k], next);
+            }
+        }
+
+        for (k = i; k < j; k++) {
+            if (scsi_req_send_command(reqs[k])) {
+                scsi_req_continue(reqs[k]);
+            }
+        }
+    }
+}
+
 static void scsi_req_dequeue(SCSIRequest *req)
 {
     trace_scsi_req_dequeue(req->dev->id, req->lun, req->tag);
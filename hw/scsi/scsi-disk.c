@@ -40,6 +40,7 @@
 #include "hw/core/qdev-properties-system.h"
 #include "system/dma.h"
 #include "system/system.h"
+#include "exec/icount.h"
 #include "qemu/cutils.h"
 #include "trace.h"
 #include "qom/object.h"
@@ -88,6 +89,8 @@ typedef struct SCSIDiskReq {
     bool need_fua;
     struct iovec iov;
     QEMUIOVector qiov;
+    /* req.sg mapped as a whole, see scsi_disk_map_sg() */
+    QEMUIOVector sg_qiov;
     BlockAcctCookie acct;
 } SCSIDiskReq;
 
@@ -421,6 +424,74 @@ static void scsi_dma_complete(void *opaque, int ret)
     scsi_dma_complete_noio(r, ret);
 }
 
+static DMADirection scsi_disk_sg_dir(SCSIDiskReq *r)
+{
+    return r->req.cmd.mode == SCSI_XFER_TO_DEV ? DMA_DIRECTION_TO_DEVICE :
+                                                 DMA_DIRECTION_FROM_DEVICE;
+}
+
+static void scsi_disk_unmap_sg(SCSIDiskReq *r)
+{
+    DMADirection dir = scsi_disk_sg_dir(r);
+    int i;
+
+    for (i = 0; i < r->sg_qiov.niov; i++) {
+        dma_memory_unmap(r->req.sg->as, r->sg_qiov.iov[i].iov_base,
+                         r->sg_qiov.iov[i].iov_len, dir,
+                         r->sg_qiov.iov[i].iov_len);
+    }
+    qemu_iovec_destroy(&r->sg_qiov);
+}
+
+/*
+ * Map all of req.sg into sg_qiov, so that the whole transfer can be
+ * submitted as a single vectored request instead of going through
+ * dma_blk_io().  Fails if any entry can't be mapped in one piece, e.g.
+ * because it isn't RAM or the bounce buffer is in use; dma_blk_io()
+ * then deals with it.
+ */
+static bool scsi_disk_map_sg(SCSIDiskReq *r)
+{
+    QEMUSGList *sg = r->req.sg;
+    DMADirection dir = scsi_disk_sg_dir(r);
+    int i;
+
+    /*
+     * dma_blk_io() keeps reads with overlapping entries deterministic
+     * with icount
+     */
+    if ((icount_enabled() && dir == DMA_DIRECTION_FROM_DEVICE) ||
+        !QEMU_IS_ALIGNED(sg->size, BDRV_SECTOR_SIZE)) {
+        return false;
+    }
+
+    qemu_iovec_init(&r->sg_qiov, sg->nsg);
+    for (i = 0; i < sg->nsg; i++) {
+        dma_addr_t len = sg->sg[i].len;
+        void *mem = dma_memory_map(sg->as, sg->sg[i].base, &len, dir,
+                                   MEMTXATTRS_UNSPECIFIED);
+
+        if (mem && len != sg->sg[i].len) {
+            dma_memory_unmap(sg->as, mem, len, dir, 0);
+            mem = NULL;
+        }
+        if (!mem) {
+            scsi_disk_unmap_sg(r);
+            return false;
+        }
+        qemu_iovec_add(&r->sg_qiov, mem, len);
+    }
+    return true;
+}
+
+static void scsi_dma_complete_mapped(void *opaque, int ret)
+{
+    SCSIDiskReq *r = (SCSIDiskReq *)opaque;
+
+    scsi_disk_unmap_sg(r);
+    scsi_dma_complete(opaque, ret);
+}
+
 static void scsi_read_complete_noio(SCSIDiskReq *r, int ret)
 {
     uint32_t n;
@@ -477,10 +548,17 @@ static void scsi_do_read(SCSIDiskReq *r, int ret)
     if (r->req.sg) {
         dma_acct_start(s->qdev.conf.blk, &r->acct, r->req.sg, BLOCK_ACCT_READ);
         r->req.residual -= r->req.sg->size;
-        r->req.aiocb = dma_blk_io(r->req.sg, r->sector << BDRV_SECTOR_BITS,
-                                  BDRV_SECTOR_SIZE,
-                                  sdc->dma_readv, r, scsi_dma_complete, r,
-                                  DMA_DIRECTION_FROM_DEVICE);
+        if (scsi_disk_map_sg(r)) {
+            r->req.aiocb = sdc->dma_readv(r->sector << BDRV_SECTOR_BITS,
+                                          &r->sg_qiov,
+                                          scsi_dma_complete_mapped, r, r);
+        } else {
+            r->req.aiocb = dma_blk_io(r->req.sg,
+                                      r->sector << BDRV_SECTOR_BITS,
+                                      BDRV_SECTOR_SIZE,
+                                      sdc->dma_readv, r, scsi_dma_complete, r,
+                                      DMA_DIRECTION_FROM_DEVICE);
+        }
     } else {
         scsi_init_iovec(r, SCSI_DMA_BUF_SIZE);
         block_acct_start(blk_get_stats(s->qdev.conf.blk), &r->acct,
@@ -635,10 +713,17 @@ static void scsi_write_data(SCSIRequest *req)
     if (r->req.sg) {
         dma_acct_start(s->qdev.conf.blk, &r->acct, r->req.sg, BLOCK_ACCT_WRITE);
         r->req.residual -= r->req.sg->size;
-        r->req.aiocb = dma_blk_io(r->req.sg, r->sector << BDRV_SECTOR_BITS,
-                                  BDRV_SECTOR_SIZE,
-                                  sdc->dma_writev, r, scsi_dma_complete, r,
-                                  DMA_DIRECTION_TO_DEVICE);
+        if (scsi_disk_map_sg(r)) {
+            r->req.aiocb = sdc->dma_writev(r->sector << BDRV_SECTOR_BITS,
+                                           &r->sg_qiov,
+                                           scsi_dma_complete_mapped, r, r);
+        } else {
+            r->req.aiocb = dma_blk_io(r->req.sg,
+                                      r->sector << BDRV_SECTOR_BITS,
+                                      BDRV_SECTOR_SIZE,
+                                      sdc->dma_writev, r, scsi_dma_complete, r,
+                                      DMA_DIRECTION_TO_DEVICE);
+        }
     } else {
         block_acct_start(blk_get_stats(s->qdev.conf.blk), &r->acct,
                          r->qiov.size, BLOCK_ACCT_WRITE);
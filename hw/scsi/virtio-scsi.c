@@ -100,7 +100,7 @@ static void virtio_scsi_free_req(VirtIOSCSIReq *req)
 {
     qemu_iovec_destroy(&req->resp_iov);
     qemu_sglist_destroy(&req->qsgl);
-    g_free(req);
+    virtqueue_element_release(req);
 }
 
 static void virtio_scsi_complete_req(VirtIOSCSIReq *req, QemuMutex *vq_lock)
@@ -236,7 +236,7 @@ static VirtIOSCSIReq *virtio_scsi_pop_req(VirtIOSCSI *s, VirtQueue *vq, QemuMute
         qemu_mutex_lock(vq_lock);
     }
 
-    req = virtqueue_pop(vq, sizeof(VirtIOSCSIReq) + vs->cdb_size);
+    req = virtqueue_pop_pooled(vq, sizeof(VirtIOSCSIReq) + vs->cdb_size);
 
     if (vq_lock) {
         qemu_mutex_unlock(vq_lock);
@@ -249,6 +249,28 @@ static VirtIOSCSIReq *virtio_scsi_pop_req(VirtIOSCSI *s, VirtQueue *vq, QemuMute
     return req;
 }
 
+/* Only for queues that don't need a lock to be popped from */
+static unsigned int virtio_scsi_pop_reqs(VirtIOSCSI *s, VirtQueue *vq,
+                                         VirtIOSCSIReq **reqs,
+                                         unsigned int max)
+{
+    VirtIOSCSICommon *vs = (VirtIOSCSICommon *)s;
+    unsigned int i, n;
+
+    /*
+     * Without VIRTIO_F_ANY_LAYOUT the first buffers hold the headers, see
+     * virtio_scsi_parse_req()
+     */
+    n = virtqueue_pop_batch(vq, sizeof(VirtIOSCSIReq) + vs->cdb_size,
+                            (void **)reqs, max,
+                            virtio_vdev_has_feature(VIRTIO_DEVICE(s),
+                                                    VIRTIO_F_ANY_LAYOUT));
+    for (i = 0; i < n; i++) {
+        virtio_scsi_init_req(s, vq, reqs[i]);
+    }
+    return n;
+}
+
 static void virtio_scsi_save_request(QEMUFile *f, SCSIRequest *sreq)
 {
     VirtIOSCSIReq *req = sreq->hba_private;
@@ -894,19 +916,25 @@ static int virtio_scsi_handle_cmd_req_prepare(VirtIOSCSI *s, VirtIOSCSIReq *req)
     return 0;
 }
 
-static void virtio_scsi_handle_cmd_req_submit(VirtIOSCSI *s, VirtIOSCSIReq *req)
+static void virtio_scsi_handle_cmd_reqs_submit(VirtIOSCSI *s,
+                                               SCSIRequest **sreqs,
+                                               unsigned int n)
 {
-    SCSIRequest *sreq = req->sreq;
-    if (scsi_req_enqueue(sreq)) {
-        scsi_req_continue(sreq);
+    unsigned int i;
+
+    scsi_req_enqueue_batch(sreqs, n);
+    for (i = 0; i < n; i++) {
+        defer_call_end();
+        scsi_req_unref(sreqs[i]);
     }
-    defer_call_end();
-    scsi_req_unref(sreq);
 }
 
 static void virtio_scsi_handle_cmd_vq(VirtIOSCSI *s, VirtQueue *vq)
 {
+    VirtIOSCSIReq *batch[VIRTQUEUE_POP_BATCH];
+    SCSIRequest *sreqs[VIRTQUEUE_POP_BATCH];
     VirtIOSCSIReq *req, *next;
+    unsigned int i, n;
     int ret = 0;
     bool suppress_notifications = virtio_queue_get_notification(vq);
 
@@ -917,30 +945,49 @@ static void virtio_scsi_handle_cmd_vq(VirtIOSCSI *s, VirtQueue *vq)
             virtio_queue_set_notification(vq, 0);
         }
 
-        while ((req = virtio_scsi_pop_req(s, vq, NULL))) {
-            ret = virtio_scsi_handle_cmd_req_prepare(s, req);
-            if (!ret) {
-                QTAILQ_INSERT_TAIL(&reqs, req, next);
-            } else if (ret == -EINVAL) {
-                /* The device is broken and shouldn't process any request */
-                while (!QTAILQ_EMPTY(&reqs)) {
-                    req = QTAILQ_FIRST(&reqs);
-                    QTAILQ_REMOVE(&reqs, req, next);
-                    defer_call_end();
-                    scsi_req_unref(req->sreq);
+        do {
+            n = virtio_scsi_pop_reqs(s, vq, batch, ARRAY_SIZE(batch));
+            for (i = 0; i < n; i++) {
+                req = batch[i];
+                if (ret == -EINVAL) {
+                    /* Drop the rest of the batch as well */
                     virtqueue_detach_element(req->vq, &req->elem, 0);
                     virtio_scsi_free_req(req);
+                    continue;
+                }
+                ret = virtio_scsi_handle_cmd_req_prepare(s, req);
+                if (!ret) {
+                    QTAILQ_INSERT_TAIL(&reqs, req, next);
+                } else if (ret == -EINVAL) {
+                    /* The device is broken and shouldn't process any request */
+                    while (!QTAILQ_EMPTY(&reqs)) {
+                        req = QTAILQ_FIRST(&reqs);
+                        QTAILQ_REMOVE(&reqs, req, next);
+                        defer_call_end();
+                        scsi_req_unref(req->sreq);
+                        virtqueue_detach_element(req->vq, &req->elem, 0);
+                        virtio_scsi_free_req(req);
+                    }
                 }
             }
-        }
+        } while (ret != -EINVAL && n == ARRAY_SIZE(batch));
 
         if (suppress_notifications) {
             virtio_queue_set_notification(vq, 1);
         }
     } while (ret != -EINVAL && !virtio_queue_empty(vq));
 
+    /* The requests may complete, and be freed, once submitted */
+    n = 0;
     QTAILQ_FOREACH_SAFE(req, &reqs, next, next) {
-        virtio_scsi_handle_cmd_req_submit(s, req);
+        sreqs[n++] = req->sreq;
+        if (n == ARRAY_SIZE(sreqs)) {
+            virtio_scsi_handle_cmd_reqs_submit(s, sreqs, n);
+            n = 0;
+        }
+    }
+    if (n) {
+        virtio_scsi_handle_cmd_reqs_submit(s, sreqs, n);
     }
 }
 
@@ -34,11 +34,14 @@
 #include "qemu/error-report.h"
 #include "qemu/main-loop.h"
 #include "qemu/range.h"
+#include "qemu/thread.h"
+#include "qemu/units.h"
 #include "system/kvm.h"
 #include "system/reset.h"
 #include "system/runstate.h"
 #include "trace.h"
 #include "qapi/error.h"
+#include "migration/cpr.h"
 #include "migration/misc.h"
 #include "migration/qemu-file.h"
 #include "system/tcg.h"
@@ -479,6 +482,115 @@ VFIORamDiscardListener *vfio_find_ram_discard_listener(
     return vrdl;
 }
 
+/*
+ * While the listener is first registered, RAM sections are queued and mapped
+ * in pieces of at most VFIO_DMA_MAP_CHUNK by up to VFIO_DMA_MAP_MAX_THREADS
+ * threads.  Mapping pins the guest RAM, which takes minutes for very large
+ * guests when done one section at a time.
+ */
+#define VFIO_DMA_MAP_CHUNK       (1 * GiB)
+#define VFIO_DMA_MAP_MAX_THREADS 16
+
+typedef struct VFIODMAMapChunk {
+    hwaddr iova;
+    uint64_t size;
+    void *vaddr;
+    bool readonly;
+    MemoryRegion *mr;
+    int ret;
+} VFIODMAMapChunk;
+
+typedef struct VFIODMAMapWork {
+    VFIOContainer *bcontainer;
+    GArray *chunks;
+    unsigned next;
+} VFIODMAMapWork;
+
+static void vfio_dma_map_batch_add(VFIOContainer *bcontainer, hwaddr iova,
+                                   uint64_t size, void *vaddr, bool readonly,
+                                   MemoryRegion *mr)
+{
+    while (size) {
+        VFIODMAMapChunk chunk = {
+            .iova = iova,
+            .size = MIN(size, VFIO_DMA_MAP_CHUNK),
+            .vaddr = vaddr,
+            .readonly = readonly,
+            .mr = mr,
+        };
+
+        g_array_append_val(bcontainer->dma_map_batch, chunk);
+        iova += chunk.size;
+        vaddr += chunk.size;
+        size -= chunk.size;
+    }
+}
+
+static void *vfio_dma_map_thread(void *opaque)
+{
+    VFIODMAMapWork *work = opaque;
+    unsigned i;
+
+    while ((i = qatomic_fetch_inc(&work->next)) < work->chunks->len) {
+        VFIODMAMapChunk *chunk = &g_array_index(work->chunks,
+                                                VFIODMAMapChunk, i);
+
+        chunk->ret = vfio_container_dma_map(work->bcontainer, chunk->iova,
+                                            chunk->size, chunk->vaddr,
+                                            chunk->readonly, chunk->mr);
+    }
+    return NULL;
+}
+
+static void vfio_dma_map_batch_flush(VFIOContainer *bcontainer)
+{
+    VFIODMAMapWork work = {
+        .bcontainer = bcontainer,
+        .chunks = bcontainer->dma_map_batch,
+    };
+    long host_procs = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned nr_threads, i;
+
+    bcontainer->dma_map_batch = NULL;
+
+    nr_threads = MIN(work.chunks->len, VFIO_DMA_MAP_MAX_THREADS);
+    if (host_procs > 0) {
+        nr_threads = MIN(nr_threads, host_procs);
+    }
+
+    trace_vfio_dma_map_batch(work.chunks->len, nr_threads);
+    if (nr_threads <= 1) {
+        vfio_dma_map_thread(&work);
+    } else {
+        g_autofree QemuThread *threads = g_new(QemuThread, nr_threads);
+
+        for (i = 0; i < nr_threads; i++) {
+            qemu_thread_create(&threads[i], "vfio-dma-map",
+                               vfio_dma_map_thread, &work,
+                               QEMU_THREAD_JOINABLE);
+        }
+        for (i = 0; i < nr_threads; i++) {
+            qemu_thread_join(&threads[i]);
+        }
+    }
+
+    for (i = 0; i < work.chunks->len; i++) {
+        VFIODMAMapChunk *chunk = &g_array_index(work.chunks,
+                                                VFIODMAMapChunk, i);
+
+        /* Report the first failure, like vfio_container_region_add() */
+        if (chunk->ret && !bcontainer->error) {
+            error_setg(&bcontainer->error, "Region %s: "
+                       "vfio_container_dma_map(%p, 0x%"HWADDR_PRIx", "
+                       "0x%"PRIx64", %p) = %d (%s)",
+                       memory_region_name(chunk->mr), bcontainer,
+                       chunk->iova, chunk->size, chunk->vaddr, chunk->ret,
+                       strerror(-chunk->ret));
+        }
+    }
+    g_array_free(work.chunks, true);
+}
+
 static void vfio_listener_region_add(MemoryListener *listener,
                                      MemoryRegionSection *section)
 {
@@ -608,6 +720,13 @@ void vfio_container_region_add(VFIOContainer *bcontainer,
         }
     }
 
+    if (bcontainer->dma_map_batch && !cpr_remap &&
+        !memory_region_is_ram_device(section->mr)) {
+        vfio_dma_map_batch_add(bcontainer, iova, int128_get64(llsize),
+                               vaddr, section->readonly, section->mr);
+        return;
+    }
+
     ret = vfio_container_dma_map(bcontainer, iova, int128_get64(llsize),
                                  vaddr, section->readonly, section->mr);
     if (ret) {
@@ -1184,11 +1303,22 @@ static int vfio_sync_iommu_dirty_bitmap(VFIOContainer *bcontainer,
 static int vfio_sync_dirty_bitmap(VFIOContainer *bcontainer,
                                   MemoryRegionSection *section, Error **errp)
 {
-    hwaddr translated_addr;
+    hwaddr translated_addr, iova, end;
 
     if (memory_region_is_iommu(section->mr)) {
         return vfio_sync_iommu_dirty_bitmap(bcontainer, section);
-    } else if (memory_region_has_ram_discard_manager(section->mr)) {
+    }
+
+    /*
+     * Device memory is not migrated as RAM, and sections that are too small
+     * to be mapped cannot be dirtied by DMA.  Don't fetch bitmaps for them.
+     */
+    if (memory_region_is_ram_device(section->mr) ||
+        !vfio_get_section_iova_range(bcontainer, section, &iova, &end, NULL)) {
+        return 0;
+    }
+
+    if (memory_region_has_ram_discard_manager(section->mr)) {
         int ret;
 
         ret = vfio_sync_ram_discard_listener_dirty_bitmap(bcontainer, section);
@@ -1245,7 +1375,16 @@ static const MemoryListener vfio_memory_listener = {
 bool vfio_listener_register(VFIOContainer *bcontainer, Error **errp)
 {
     bcontainer->listener = vfio_memory_listener;
+
+    /* Incoming CPR diverts or skips the mappings, keep that sequential */
+    if (!cpr_is_incoming()) {
+        bcontainer->dma_map_batch = g_array_new(false, false,
+                                                sizeof(VFIODMAMapChunk));
+    }
     memory_listener_register(&bcontainer->listener, bcontainer->space->as);
+    if (bcontainer->dma_map_batch) {
+        vfio_dma_map_batch_flush(bcontainer);
+    }
 
     if (bcontainer->error) {
         error_propagate_prepend(errp, bcontainer->error,
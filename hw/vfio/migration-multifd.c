@@ -54,7 +54,8 @@ typedef struct VFIOStateBuffers {
 
 typedef struct VFIOStateBuffer {
     bool is_present;
-    char *data;
+    char *packet;   /* the received packet, owned by the buffer */
+    char *data;     /* points into packet */
     size_t len;
 } VFIOStateBuffer;
 
@@ -82,7 +83,8 @@ static void vfio_state_buffer_clear(gpointer data)
         return;
     }
 
-    g_clear_pointer(&lb->data, g_free);
+    g_clear_pointer(&lb->packet, g_free);
+    lb->data = NULL;
     lb->is_present = false;
 }
 
@@ -121,12 +123,13 @@ static VFIOStateBuffer *vfio_state_buffers_at(VFIOStateBuffers *bufs,
 
 /* called with load_bufs_mutex locked */
 static bool vfio_load_state_buffer_insert(VFIODevice *vbasedev,
-                                          VFIODeviceStatePacket *packet,
+                                          char **data,
                                           size_t packet_total_size,
                                           Error **errp)
 {
     VFIOMigration *migration = vbasedev->migration;
     VFIOMultifd *multifd = migration->multifd;
+    VFIODeviceStatePacket *packet = (VFIODeviceStatePacket *)*data;
     VFIOStateBuffer *lb;
     size_t data_size = packet_total_size - sizeof(*packet);
 
@@ -155,20 +158,22 @@ static bool vfio_load_state_buffer_insert(VFIODevice *vbasedev,
         return false;
     }
 
-    lb->data = g_memdup2(&packet->data, data_size);
+    /* Keep the received packet rather than copying its payload */
+    lb->packet = g_steal_pointer(data);
+    lb->data = (char *)packet->data;
     lb->len = data_size;
     lb->is_present = true;
 
     return true;
 }
 
-bool vfio_multifd_load_state_buffer(void *opaque, char *data, size_t data_size,
+bool vfio_multifd_load_state_buffer(void *opaque, char **data, size_t data_size,
                                     Error **errp)
 {
     VFIODevice *vbasedev = opaque;
     VFIOMigration *migration = vbasedev->migration;
     VFIOMultifd *multifd = migration->multifd;
-    VFIODeviceStatePacket *packet = (VFIODeviceStatePacket *)data;
+    VFIODeviceStatePacket *packet = (VFIODeviceStatePacket *)*data;
 
     if (!vfio_multifd_transfer_enabled(vbasedev)) {
         error_setg(errp,
@@ -214,7 +219,7 @@ bool vfio_multifd_load_state_buffer(void *opaque, char *data, size_t data_size,
             multifd->load_buf_idx_last = packet->idx;
         }
 
-        if (!vfio_load_state_buffer_insert(vbasedev, packet, data_size,
+        if (!vfio_load_state_buffer_insert(vbasedev, data, data_size,
                                            errp)) {
             return false;
         }
@@ -302,7 +307,7 @@ static bool vfio_load_state_buffer_write(VFIODevice *vbasedev,
 {
     VFIOMigration *migration = vbasedev->migration;
     VFIOMultifd *multifd = migration->multifd;
-    g_autofree char *buf = NULL;
+    g_autofree char *packet = NULL;
     char *buf_cur;
     size_t buf_len;
 
@@ -314,8 +319,8 @@ static bool vfio_load_state_buffer_write(VFIODevice *vbasedev,
                                                    multifd->load_buf_idx);
 
     /* lb might become re-allocated when we drop the lock */
-    buf = g_steal_pointer(&lb->data);
-    buf_cur = buf;
+    packet = g_steal_pointer(&lb->packet);
+    buf_cur = g_steal_pointer(&lb->data);
     buf_len = lb->len;
     while (buf_len > 0) {
         ssize_t wr_ret;
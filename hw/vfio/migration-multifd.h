@@ -21,7 +21,7 @@ bool vfio_multifd_transfer_supported(void);
 bool vfio_multifd_transfer_enabled(VFIODevice *vbasedev);
 
 bool vfio_load_config_after_iter(VFIODevice *vbasedev);
-bool vfio_multifd_load_state_buffer(void *opaque, char *data, size_t data_size,
+bool vfio_multifd_load_state_buffer(void *opaque, char **data, size_t data_size,
                                     Error **errp);
 
 int vfio_load_state_config_load_ready(VFIODevice *vbasedev);
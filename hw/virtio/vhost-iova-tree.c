@@ -9,6 +9,8 @@
 
 #include "qemu/osdep.h"
 #include "qemu/iova-tree.h"
+#include "qemu/thread.h"
+#include "qemu/lockable.h"
 #include "vhost-iova-tree.h"
 
 #define iova_min_addr qemu_real_host_page_size()
@@ -34,6 +36,13 @@ struct VhostIOVATree {
 
     /* GPA->IOVA address memory maps */
     IOVATree *gpa_iova_map;
+
+    /*
+     * Serializes map changes against lookups done by shadow virtqueues
+     * running in an IOThread.  Changes always happen with the BQL held, so
+     * lookups done with the BQL do not need it.
+     */
+    QemuMutex lock;
 };
 
 /**
@@ -52,6 +61,7 @@ VhostIOVATree *vhost_iova_tree_new(hwaddr iova_first, hwaddr iova_last)
     tree->iova_taddr_map = iova_tree_new();
     tree->iova_map = iova_tree_new();
     tree->gpa_iova_map = gpa_tree_new();
+    qemu_mutex_init(&tree->lock);
     return tree;
 }
 
@@ -63,9 +73,26 @@ void vhost_iova_tree_delete(VhostIOVATree *iova_tree)
     iova_tree_destroy(iova_tree->iova_taddr_map);
     iova_tree_destroy(iova_tree->iova_map);
     iova_tree_destroy(iova_tree->gpa_iova_map);
+    qemu_mutex_destroy(&iova_tree->lock);
     g_free(iova_tree);
 }
 
+/**
+ * Lock the tree so the maps returned by the find functions stay valid
+ * outside of the BQL
+ *
+ * @tree: The VhostIOVATree
+ */
+void vhost_iova_tree_lock(VhostIOVATree *tree)
+{
+    qemu_mutex_lock(&tree->lock);
+}
+
+void vhost_iova_tree_unlock(VhostIOVATree *tree)
+{
+    qemu_mutex_unlock(&tree->lock);
+}
+
 /**
  * Find the IOVA address stored from a memory address
  *
@@ -105,6 +132,8 @@ int vhost_iova_tree_map_alloc(VhostIOVATree *tree, DMAMap *map, hwaddr taddr)
         return IOVA_ERR_INVALID;
     }
 
+    QEMU_LOCK_GUARD(&tree->lock);
+
     /* Allocate a node in the IOVA-only tree */
     ret = iova_tree_alloc_map(tree->iova_map, map, iova_first, tree->iova_last);
     if (unlikely(ret != IOVA_OK)) {
@@ -124,6 +153,7 @@ int vhost_iova_tree_map_alloc(VhostIOVATree *tree, DMAMap *map, hwaddr taddr)
  */
 void vhost_iova_tree_remove(VhostIOVATree *iova_tree, DMAMap map)
 {
+    QEMU_LOCK_GUARD(&iova_tree->lock);
     iova_tree_remove(iova_tree->iova_taddr_map, map);
     iova_tree_remove(iova_tree->iova_map, map);
 }
@@ -167,6 +197,8 @@ int vhost_iova_tree_map_alloc_gpa(VhostIOVATree *tree, DMAMap *map, hwaddr taddr
         return IOVA_ERR_INVALID;
     }
 
+    QEMU_LOCK_GUARD(&tree->lock);
+
     /* Allocate a node in the IOVA-only tree */
     ret = iova_tree_alloc_map(tree->iova_map, map, iova_first, tree->iova_last);
     if (unlikely(ret != IOVA_OK)) {
@@ -186,6 +218,7 @@ int vhost_iova_tree_map_alloc_gpa(VhostIOVATree *tree, DMAMap *map, hwaddr taddr
  */
 void vhost_iova_tree_remove_gpa(VhostIOVATree *iova_tree, DMAMap map)
 {
+    QEMU_LOCK_GUARD(&iova_tree->lock);
     iova_tree_remove(iova_tree->gpa_iova_map, map);
     iova_tree_remove(iova_tree->iova_map, map);
 }
@@ -18,6 +18,8 @@ typedef struct VhostIOVATree VhostIOVATree;
 VhostIOVATree *vhost_iova_tree_new(uint64_t iova_first, uint64_t iova_last);
 void vhost_iova_tree_delete(VhostIOVATree *iova_tree);
 G_DEFINE_AUTOPTR_CLEANUP_FUNC(VhostIOVATree, vhost_iova_tree_delete);
+void vhost_iova_tree_lock(VhostIOVATree *iova_tree);
+void vhost_iova_tree_unlock(VhostIOVATree *iova_tree);
 
 const DMAMap *vhost_iova_tree_find_iova(const VhostIOVATree *iova_tree,
                                         const DMAMap *map);
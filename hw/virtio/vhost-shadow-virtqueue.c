@@ -14,6 +14,7 @@
 #include "qapi/error.h"
 #include "qemu/main-loop.h"
 #include "qemu/log.h"
+#include "qemu/aio-wait.h"
 #include "qemu/memalign.h"
 #include "linux-headers/linux/vhost.h"
 
@@ -84,10 +85,14 @@ static bool vhost_svq_translate_addr(const VhostShadowVirtqueue *svq,
                                      hwaddr *addrs, const struct iovec *iovec,
                                      size_t num, const hwaddr *gpas)
 {
+    bool ok = true;
+
     if (num == 0) {
         return true;
     }
 
+    /* The memory listener may change the tree if SVQ runs in an IOThread */
+    vhost_iova_tree_lock(svq->iova_tree);
     for (size_t i = 0; i < num; ++i) {
         Int128 needle_last, map_last;
         size_t off;
@@ -119,7 +124,8 @@ static bool vhost_svq_translate_addr(const VhostShadowVirtqueue *svq,
             qemu_log_mask(LOG_GUEST_ERROR,
                           "Invalid address 0x%"HWADDR_PRIx" given by guest",
                           needle.translated_addr);
-            return false;
+            ok = false;
+            break;
         }
 
         off = needle.translated_addr - map->translated_addr;
@@ -131,11 +137,13 @@ static bool vhost_svq_translate_addr(const VhostShadowVirtqueue *svq,
         if (unlikely(int128_gt(needle_last, map_last))) {
             qemu_log_mask(LOG_GUEST_ERROR,
                           "Guest buffer expands over iova range");
-            return false;
+            ok = false;
+            break;
         }
     }
+    vhost_iova_tree_unlock(svq->iova_tree);
 
-    return true;
+    return ok;
 }
 
 /**
@@ -229,17 +237,30 @@ static bool vhost_svq_add_split(VhostShadowVirtqueue *svq,
     avail->ring[avail_idx] = cpu_to_le16(*head);
     svq->shadow_avail_idx++;
 
-    /* Update the avail index after write the descriptor */
-    smp_wmb();
-    avail->idx = cpu_to_le16(svq->shadow_avail_idx);
-
+    /* avail->idx is updated by vhost_svq_kick, once per batch */
     return true;
 }
 
+/**
+ * Expose the descriptors added since the last kick to the device and notify
+ * it if needed.
+ *
+ * @svq: Shadow VirtQueue
+ */
 static void vhost_svq_kick(VhostShadowVirtqueue *svq)
 {
+    uint16_t old_avail_idx = svq->published_avail_idx;
     bool needs_kick;
 
+    if (old_avail_idx == svq->shadow_avail_idx) {
+        return;
+    }
+
+    /* Update the avail index after write the descriptors */
+    smp_wmb();
+    svq->vring.avail->idx = cpu_to_le16(svq->shadow_avail_idx);
+    svq->published_avail_idx = svq->shadow_avail_idx;
+
     /*
      * We need to expose the available array entries before checking the used
      * flags
@@ -249,7 +270,8 @@ static void vhost_svq_kick(VhostShadowVirtqueue *svq)
     if (virtio_vdev_has_feature(svq->vdev, VIRTIO_RING_F_EVENT_IDX)) {
         uint16_t avail_event = le16_to_cpu(
                 *(uint16_t *)(&svq->vring.used->ring[svq->vring.num]));
-        needs_kick = vring_need_event(avail_event, svq->shadow_avail_idx, svq->shadow_avail_idx - 1);
+        needs_kick = vring_need_event(avail_event, svq->shadow_avail_idx,
+                                      old_avail_idx);
     } else {
         needs_kick =
                 !(svq->vring.used->flags & cpu_to_le16(VRING_USED_F_NO_NOTIFY));
@@ -262,15 +284,15 @@ static void vhost_svq_kick(VhostShadowVirtqueue *svq)
     event_notifier_set(&svq->hdev_kick);
 }
 
-/**
- * Add an element to a SVQ.
- *
- * Return -EINVAL if element is invalid, -ENOSPC if dev queue is full
+/*
+ * Add an element to a SVQ without exposing it to the device.  The caller must
+ * call vhost_svq_kick once the batch is complete.
  */
-int vhost_svq_add(VhostShadowVirtqueue *svq, const struct iovec *out_sg,
-                  size_t out_num, const hwaddr *out_addr,
-                  const struct iovec *in_sg, size_t in_num,
-                  const hwaddr *in_addr, VirtQueueElement *elem)
+static int vhost_svq_add_nokick(VhostShadowVirtqueue *svq,
+                                const struct iovec *out_sg, size_t out_num,
+                                const hwaddr *out_addr,
+                                const struct iovec *in_sg, size_t in_num,
+                                const hwaddr *in_addr, VirtQueueElement *elem)
 {
     unsigned qemu_head;
     unsigned ndescs = in_num + out_num;
@@ -289,16 +311,38 @@ int vhost_svq_add(VhostShadowVirtqueue *svq, const struct iovec *out_sg,
     svq->num_free -= ndescs;
     svq->desc_state[qemu_head].elem = elem;
     svq->desc_state[qemu_head].ndescs = ndescs;
-    vhost_svq_kick(svq);
     return 0;
 }
 
-/* Convenience wrapper to add a guest's element to SVQ */
+/**
+ * Add an element to a SVQ.
+ *
+ * Return -EINVAL if element is invalid, -ENOSPC if dev queue is full
+ */
+int vhost_svq_add(VhostShadowVirtqueue *svq, const struct iovec *out_sg,
+                  size_t out_num, const hwaddr *out_addr,
+                  const struct iovec *in_sg, size_t in_num,
+                  const hwaddr *in_addr, VirtQueueElement *elem)
+{
+    int r = vhost_svq_add_nokick(svq, out_sg, out_num, out_addr, in_sg, in_num,
+                                 in_addr, elem);
+
+    if (likely(r == 0)) {
+        vhost_svq_kick(svq);
+    }
+    return r;
+}
+
+/*
+ * Convenience wrapper to add a guest's element to SVQ.  The device is kicked
+ * by vhost_handle_guest_kick once per batch.
+ */
 static int vhost_svq_add_element(VhostShadowVirtqueue *svq,
                                  VirtQueueElement *elem)
 {
-    return vhost_svq_add(svq, elem->out_sg, elem->out_num, elem->out_addr,
-                         elem->in_sg, elem->in_num, elem->in_addr, elem);
+    return vhost_svq_add_nokick(svq, elem->out_sg, elem->out_num,
+                                elem->out_addr, elem->in_sg, elem->in_num,
+                                elem->in_addr, elem);
 }
 
 /**
@@ -313,6 +357,9 @@ static int vhost_svq_add_element(VhostShadowVirtqueue *svq,
  *
  * If that happens, guest's kick notifications will be disabled until the
  * device uses some buffers.
+ *
+ * The device is kicked once for all the buffers forwarded in a pass, not once
+ * per buffer.
  */
 static void vhost_handle_guest_kick(VhostShadowVirtqueue *svq)
 {
@@ -359,12 +406,14 @@ static void vhost_handle_guest_kick(VhostShadowVirtqueue *svq)
                 }
 
                 /* VQ is full or broken, just return and ignore kicks */
+                vhost_svq_kick(svq);
                 return;
             }
             /* elem belongs to SVQ or external caller now */
             elem = NULL;
         }
 
+        vhost_svq_kick(svq);
         virtio_queue_set_notification(svq->vq, true);
     } while (!virtio_queue_empty(svq->vq));
 }
@@ -524,8 +573,11 @@ static void vhost_svq_flush(VhostShadowVirtqueue *svq,
             virtqueue_fill(vq, elem, len, i++);
         }
 
-        virtqueue_flush(vq, i);
-        event_notifier_set(&svq->svq_call);
+        if (i) {
+            /* One guest notification per batch of used buffers */
+            virtqueue_flush(vq, i);
+            event_notifier_set(&svq->svq_call);
+        }
 
         if (check_for_avail_queue && svq->next_guest_avail_elem) {
             /*
@@ -641,6 +693,50 @@ size_t vhost_svq_device_area_size(const VhostShadowVirtqueue *svq)
     return ROUND_UP(used_size, qemu_real_host_page_size());
 }
 
+/* Run the kick and call handlers in the main loop again */
+static void vhost_svq_detach_bh(void *opaque)
+{
+    VhostShadowVirtqueue *svq = opaque;
+
+    aio_set_event_notifier(svq->ctx, &svq->svq_kick, NULL, NULL, NULL);
+    aio_set_event_notifier(svq->ctx, &svq->hdev_call, NULL, NULL, NULL);
+}
+
+static void vhost_svq_detach_aio_context(VhostShadowVirtqueue *svq)
+{
+    if (!svq->ctx_attached) {
+        return;
+    }
+
+    /* The handlers may be running right now, remove them from the IOThread */
+    aio_wait_bh_oneshot(svq->ctx, vhost_svq_detach_bh, svq);
+    svq->ctx_attached = false;
+    event_notifier_set_handler(&svq->hdev_call, vhost_svq_handle_call);
+}
+
+/**
+ * Move the SVQ handlers to its IOThread on the first guest kick.
+ *
+ * @n: guest kick event notifier
+ *
+ * The main loop does not dispatch handlers until the whole vhost-vdpa device
+ * is started and its memory is mapped, so this is the first point where the
+ * IOThread can safely forward buffers.  The kick is left pending for the
+ * IOThread to process.
+ */
+static void vhost_svq_attach_aio_context(EventNotifier *n)
+{
+    VhostShadowVirtqueue *svq = container_of(n, VhostShadowVirtqueue, svq_kick);
+
+    event_notifier_set_handler(&svq->svq_kick, NULL);
+    event_notifier_set_handler(&svq->hdev_call, NULL);
+    svq->ctx_attached = true;
+    aio_set_event_notifier(svq->ctx, &svq->hdev_call, vhost_svq_handle_call,
+                           NULL, NULL);
+    aio_set_event_notifier(svq->ctx, &svq->svq_kick,
+                           vhost_handle_guest_kick_notifier, NULL, NULL);
+}
+
 /**
  * Set a new file descriptor for the guest to kick the SVQ and notify for avail
  *
@@ -656,6 +752,7 @@ void vhost_svq_set_svq_kick_fd(VhostShadowVirtqueue *svq, int svq_kick_fd)
     bool poll_start = svq_kick_fd != VHOST_FILE_UNBIND;
 
     if (poll_stop) {
+        vhost_svq_detach_aio_context(svq);
         event_notifier_set_handler(svq_kick, NULL);
     }
 
@@ -667,7 +764,9 @@ void vhost_svq_set_svq_kick_fd(VhostShadowVirtqueue *svq, int svq_kick_fd)
      */
     if (poll_start) {
         event_notifier_set(svq_kick);
-        event_notifier_set_handler(svq_kick, vhost_handle_guest_kick_notifier);
+        event_notifier_set_handler(svq_kick, svq->ctx ?
+                                   vhost_svq_attach_aio_context :
+                                   vhost_handle_guest_kick_notifier);
     }
 }
 
@@ -687,6 +786,7 @@ void vhost_svq_start(VhostShadowVirtqueue *svq, VirtIODevice *vdev,
     event_notifier_set_handler(&svq->hdev_call, vhost_svq_handle_call);
     svq->next_guest_avail_elem = NULL;
     svq->shadow_avail_idx = 0;
+    svq->published_avail_idx = 0;
     svq->shadow_used_idx = 0;
     svq->last_used_idx = 0;
     svq->vdev = vdev;
@@ -756,15 +856,17 @@ void vhost_svq_stop(VhostShadowVirtqueue *svq)
  *
  * @ops: SVQ owner callbacks
  * @ops_opaque: ops opaque pointer
+ * @ctx: AioContext to forward buffers in, or NULL to use the main loop
  */
 VhostShadowVirtqueue *vhost_svq_new(const VhostShadowVirtqueueOps *ops,
-                                    void *ops_opaque)
+                                    void *ops_opaque, AioContext *ctx)
 {
     VhostShadowVirtqueue *svq = g_new0(VhostShadowVirtqueue, 1);
 
     event_notifier_init_fd(&svq->svq_kick, VHOST_FILE_UNBIND);
     svq->ops = ops;
     svq->ops_opaque = ops_opaque;
+    svq->ctx = ctx;
     return svq;
 }
 
@@ -96,9 +96,18 @@ typedef struct VhostShadowVirtqueue {
     /* Caller callbacks opaque */
     void *ops_opaque;
 
+    /* AioContext that forwards buffers, NULL for the main loop */
+    AioContext *ctx;
+
+    /* The kick and call handlers have been moved to ctx */
+    bool ctx_attached;
+
     /* Next head to expose to the device */
     uint16_t shadow_avail_idx;
 
+    /* avail->idx value the device was last kicked with */
+    uint16_t published_avail_idx;
+
     /* Next free descriptor */
     uint16_t free_head;
 
@@ -135,7 +144,7 @@ void vhost_svq_start(VhostShadowVirtqueue *svq, VirtIODevice *vdev,
 void vhost_svq_stop(VhostShadowVirtqueue *svq);
 
 VhostShadowVirtqueue *vhost_svq_new(const VhostShadowVirtqueueOps *ops,
-                                    void *ops_opaque);
+                                    void *ops_opaque, AioContext *ctx);
 
 void vhost_svq_free(gpointer vq);
 G_DEFINE_AUTOPTR_CLEANUP_FUNC(VhostShadowVirtqueue, vhost_svq_free);
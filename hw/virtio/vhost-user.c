@@ -57,6 +57,13 @@
  */
 #define VHOST_USER_MAX_CONFIG_SIZE 256
 
+/*
+ * Maximum number of replies left unread in a batch.  The replies must fit
+ * in the socket buffer, or the back-end could block sending them while
+ * the front-end is blocked sending more requests.
+ */
+#define VHOST_USER_MAX_PENDING_REPLIES 256
+
 #define VHOST_USER_PROTOCOL_FEATURE_MASK ((1 << VHOST_USER_PROTOCOL_F_MAX) - 1)
 
 typedef enum VhostUserRequest {
@@ -300,7 +307,7 @@ static int vhost_user_read_header(struct vhost_dev *dev, VhostUserMsg *msg)
     return 0;
 }
 
-static int vhost_user_read(struct vhost_dev *dev, VhostUserMsg *msg)
+static int do_vhost_user_read(struct vhost_dev *dev, VhostUserMsg *msg)
 {
     struct vhost_user *u = dev->opaque;
     CharFrontend *chr = u->user->chr;
@@ -335,9 +342,66 @@ static int vhost_user_read(struct vhost_dev *dev, VhostUserMsg *msg)
     return 0;
 }
 
+/*
+ * Read the replies that were left pending in the current batch.  A
+ * failure reported by the back-end is recorded for vhost_user_batch_end(),
+ * only errors on the connection itself are returned.
+ */
+static int vhost_user_read_pending_replies(struct vhost_dev *dev)
+{
+    struct vhost_user *u = dev->opaque;
+    VhostUserState *user = u->user;
+    GArray *pending = user->pending_replies;
+    int ret = 0;
+    guint i;
+
+    for (i = 0; i < pending->len && !ret; i++) {
+        VhostUserRequest request = g_array_index(pending, VhostUserRequest, i);
+        VhostUserMsg msg_reply;
+
+        ret = do_vhost_user_read(dev, &msg_reply);
+        if (ret < 0) {
+            break;
+        }
+        if (msg_reply.hdr.request != request) {
+            error_report("Received unexpected msg type. "
+                         "Expected %d received %d",
+                         request, msg_reply.hdr.request);
+            ret = -EPROTO;
+        } else if (msg_reply.payload.u64 && !user->batch_ret) {
+            user->batch_ret = -EIO;
+        }
+    }
+
+    trace_vhost_user_read_pending_replies(pending->len, ret);
+    g_array_set_size(pending, 0);
+    if (ret < 0 && !user->batch_ret) {
+        user->batch_ret = ret;
+    }
+    return ret;
+}
+
+static int vhost_user_read(struct vhost_dev *dev, VhostUserMsg *msg)
+{
+    struct vhost_user *u = dev->opaque;
+    int r;
+
+    /* The replies of the batch come first */
+    if (u->user->pending_replies->len) {
+        r = vhost_user_read_pending_replies(dev);
+        if (r < 0) {
+            return r;
+        }
+    }
+
+    return do_vhost_user_read(dev, msg);
+}
+
 static int process_message_reply(struct vhost_dev *dev,
                                  const VhostUserMsg *msg)
 {
+    struct vhost_user *u = dev->opaque;
+    VhostUserState *user = u->user;
     int ret;
     VhostUserMsg msg_reply;
 
@@ -345,6 +409,16 @@ static int process_message_reply(struct vhost_dev *dev,
         return 0;
     }
 
+    if (user->batch_depth &&
+        virtio_has_feature(dev->protocol_features,
+                           VHOST_USER_PROTOCOL_F_PIPELINED_REPLY)) {
+        g_array_append_val(user->pending_replies, msg->hdr.request);
+        if (user->pending_replies->len < VHOST_USER_MAX_PENDING_REPLIES) {
+            return 0;
+        }
+        return vhost_user_read_pending_replies(dev);
+    }
+
     ret = vhost_user_read(dev, &msg_reply);
     if (ret < 0) {
         return ret;
@@ -360,6 +434,37 @@ static int process_message_reply(struct vhost_dev *dev,
     return msg_reply.payload.u64 ? -EIO : 0;
 }
 
+/*
+ * With VHOST_USER_PROTOCOL_F_PIPELINED_REPLY, the acknowledgements of the
+ * requests sent until vhost_user_batch_end() are read there, instead of
+ * waiting for each of them in turn.  Batches can nest; the replies are
+ * read when the outermost one ends.
+ */
+static void vhost_user_batch_begin(struct vhost_dev *dev)
+{
+    struct vhost_user *u = dev->opaque;
+
+    if (!u->user->batch_depth++) {
+        u->user->batch_ret = 0;
+    }
+}
+
+static int vhost_user_batch_end(struct vhost_dev *dev)
+{
+    struct vhost_user *u = dev->opaque;
+    VhostUserState *user = u->user;
+
+    assert(user->batch_depth);
+    if (--user->batch_depth) {
+        return 0;
+    }
+
+    if (user->pending_replies->len) {
+        vhost_user_read_pending_replies(dev);
+    }
+    return user->batch_ret;
+}
+
 static bool vhost_user_per_device_request(VhostUserRequest request)
 {
     switch (request) {
@@ -575,12 +680,25 @@ static void scrub_shadow_regions(struct vhost_dev *dev,
 {
     struct vhost_user *u = dev->opaque;
     bool found[VHOST_USER_MAX_RAM_SLOTS] = {};
+    g_autoptr(GHashTable) regs_by_gpa = NULL;
     struct vhost_memory_region *reg, *shadow_reg;
     int i, j, fd, add_idx = 0, rm_idx = 0, fd_num = 0;
     ram_addr_t offset;
     MemoryRegion *mr;
     bool matching;
 
+    /*
+     * Regions never overlap, so the guest physical address identifies the
+     * device region a shadow region could match.  Index them to avoid a
+     * quadratic search when many regions are plugged one by one.
+     */
+    regs_by_gpa = g_hash_table_new(g_int64_hash, g_int64_equal);
+    for (j = 0; j < dev->mem->nregions; j++) {
+        g_hash_table_insert(regs_by_gpa,
+                            &dev->mem->regions[j].guest_phys_addr,
+                            GINT_TO_POINTER(j + 1));
+    }
+
     /*
      * Find memory regions present in our shadow state which are not in
      * the device's current memory state.
@@ -591,15 +709,17 @@ static void scrub_shadow_regions(struct vhost_dev *dev,
         shadow_reg = &u->shadow_regions[i];
         matching = false;
 
-        for (j = 0; j < dev->mem->nregions; j++) {
+        j = GPOINTER_TO_INT(g_hash_table_lookup(regs_by_gpa,
+                                    &shadow_reg->guest_phys_addr)) - 1;
+        if (j >= 0) {
             reg = &dev->mem->regions[j];
 
-            mr = vhost_user_get_mr_data(reg->userspace_addr, &offset, &fd);
-
             if (reg_equal(shadow_reg, reg)) {
                 matching = true;
                 found[j] = true;
                 if (track_ramblocks) {
+                    mr = vhost_user_get_mr_data(reg->userspace_addr, &offset,
+                                                &fd);
                     /*
                      * Reset postcopy client bases, region_rb, and
                      * region_rb_offset in case regions are removed.
@@ -613,7 +733,6 @@ static void scrub_shadow_regions(struct vhost_dev *dev,
                         u->region_rb[j] = NULL;
                     }
                 }
-                break;
             }
         }
 
@@ -1238,6 +1357,7 @@ static int vhost_user_set_vring_enable(struct vhost_dev *dev, int enable)
         return -EINVAL;
     }
 
+    vhost_user_batch_begin(dev);
     for (i = 0; i < dev->nvqs; ++i) {
         int ret;
         struct vhost_vring_state state = {
@@ -1257,7 +1377,8 @@ static int vhost_user_set_vring_enable(struct vhost_dev *dev, int enable)
          * seemingly disabled queue). To prevent this out-of-order delivery,
          * don't let the guest proceed to pushing the virtio request until the
          * backend control plane acknowledges enabling the queue -- IOW, pass
-         * wait_for_reply=true below.
+         * wait_for_reply=true below.  With a batch, the replies are all
+         * read before returning.
          */
         ret = vhost_set_vring(dev, VHOST_USER_SET_VRING_ENABLE, &state, true);
         if (ret < 0) {
@@ -1266,11 +1387,12 @@ static int vhost_user_set_vring_enable(struct vhost_dev *dev, int enable)
              * proceeding regardless the error, so just bail out and hope for
              * the device-level recovery.
              */
+            vhost_user_batch_end(dev);
             return ret;
         }
     }
 
-    return 0;
+    return vhost_user_batch_end(dev);
 }
 
 static VhostUserHostNotifier *fetch_notifier(VhostUserState *u,
@@ -2779,6 +2901,9 @@ bool vhost_user_init(VhostUserState *user, CharFrontend *chr, Error **errp)
     user->memory_slots = 0;
     user->notifiers = g_ptr_array_new_full(VIRTIO_QUEUE_MAX / 4,
                                            &vhost_user_state_destroy);
+    user->pending_replies = g_array_new(false, false,
+                                        sizeof(VhostUserRequest));
+    user->batch_depth = 0;
     return true;
 }
 
@@ -2788,6 +2913,8 @@ void vhost_user_cleanup(VhostUserState *user)
         return;
     }
     user->notifiers = (GPtrArray *) g_ptr_array_free(user->notifiers, true);
+    g_array_free(user->pending_replies, true);
+    user->pending_replies = NULL;
     user->chr = NULL;
 }
 
@@ -3059,4 +3186,6 @@ const VhostOps user_ops = {
         .vhost_supports_device_state = vhost_user_supports_device_state,
         .vhost_set_device_state_fd = vhost_user_set_device_state_fd,
         .vhost_check_device_state = vhost_user_check_device_state,
+        .vhost_batch_begin = vhost_user_batch_begin,
+        .vhost_batch_end = vhost_user_batch_end,
 };
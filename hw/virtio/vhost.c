@@ -615,7 +615,12 @@ static void vhost_begin(MemoryListener *listener)
 {
     struct vhost_dev *dev = container_of(listener, struct vhost_dev,
                                          memory_listener);
-    dev->tmp_sections = NULL;
+    /*
+     * The new layout is usually close to the current one, size the list for
+     * it up front instead of growing it one section at a time.
+     */
+    dev->tmp_sections_alloc = MAX(dev->n_mem_sections, 16);
+    dev->tmp_sections = g_new(MemoryRegionSection, dev->tmp_sections_alloc);
     dev->n_tmp_sections = 0;
 }
 
@@ -824,9 +829,13 @@ static void vhost_region_add_section(struct vhost_dev *dev,
     }
 
     if (need_add) {
+        if (dev->n_tmp_sections == dev->tmp_sections_alloc) {
+            dev->tmp_sections_alloc *= 2;
+            dev->tmp_sections = g_renew(MemoryRegionSection,
+                                        dev->tmp_sections,
+                                        dev->tmp_sections_alloc);
+        }
         ++dev->n_tmp_sections;
-        dev->tmp_sections = g_renew(MemoryRegionSection, dev->tmp_sections,
-                                    dev->n_tmp_sections);
         dev->tmp_sections[dev->n_tmp_sections - 1] = *section;
         /* The flatview isn't stable and we don't use it, making it NULL
          * means we can memcmp the list.
@@ -2052,7 +2061,8 @@ static int vhost_dev_set_vring_enable(struct vhost_dev *hdev, int enable)
  */
 int vhost_dev_start(struct vhost_dev *hdev, VirtIODevice *vdev, bool vrings)
 {
-    int i, r;
+    int64_t start_time = g_get_monotonic_time();
+    int i, r, e;
 
     /* should only be called after backend is connected */
     assert(hdev->vhost_ops);
@@ -2077,15 +2087,30 @@ int vhost_dev_start(struct vhost_dev *hdev, VirtIODevice *vdev, bool vrings)
         VHOST_OPS_DEBUG(r, "vhost_set_mem_table failed");
         goto fail_mem;
     }
+
+    /* Do not wait for the back-end to acknowledge each virtqueue in turn */
+    if (hdev->vhost_ops->vhost_batch_begin) {
+        hdev->vhost_ops->vhost_batch_begin(hdev);
+    }
     for (i = 0; i < hdev->nvqs; ++i) {
         r = vhost_virtqueue_start(hdev,
                                   vdev,
                                   hdev->vqs + i,
                                   hdev->vq_index + i);
         if (r < 0) {
-            goto fail_vq;
+            break;
+        }
+    }
+    if (hdev->vhost_ops->vhost_batch_end) {
+        e = hdev->vhost_ops->vhost_batch_end(hdev);
+        if (r == 0 && e < 0) {
+            VHOST_OPS_DEBUG(e, "vhost_virtqueue_start failed");
+            r = e;
         }
     }
+    if (r < 0) {
+        goto fail_vq;
+    }
 
     r = event_notifier_init(
         &hdev->vqs[VHOST_QUEUE_NUM_CONFIG_INR].masked_config_notifier, 0);
@@ -2142,6 +2167,8 @@ int vhost_dev_start(struct vhost_dev *hdev, VirtIODevice *vdev, bool vrings)
         }
     }
     vhost_start_config_intr(hdev);
+    trace_vhost_dev_start_finish(hdev, vdev->name, hdev->nvqs,
+                                 g_get_monotonic_time() - start_time);
     return 0;
 fail_iotlb:
     if (vhost_dev_has_iommu(hdev) &&
@@ -18,6 +18,8 @@
 #include "qemu/module.h"
 #include "qemu/timer.h"
 #include "qemu/madvise.h"
+#include "qemu/aio-wait.h"
+#include "block/thread-pool.h"
 #include "hw/virtio/virtio.h"
 #include "hw/mem/pc-dimm.h"
 #include "hw/core/qdev-properties.h"
@@ -338,14 +340,143 @@ static void balloon_stats_set_poll_interval(Object *obj, Visitor *v,
     balloon_stats_change_timer(s, 0);
 }
 
+/*
+ * Free page reports are discarded by a worker thread, so that the main loop
+ * keeps running while large amounts of memory are returned to the host.
+ * One batch is in flight at a time; it holds all elements that were queued
+ * when it was started, and their ranges sorted and merged so that adjacent
+ * free pages are discarded with a single call.
+ */
+typedef struct BalloonReportRange {
+    RAMBlock *rb;
+    ram_addr_t offset;
+    size_t size;
+} BalloonReportRange;
+
+typedef struct BalloonReport {
+    VirtIOBalloon *dev;
+    GPtrArray *elems;
+    GArray *ranges;
+    /* Filled in by the worker */
+    uint64_t bytes;
+    int64_t ns;
+} BalloonReport;
+
+static gint balloon_report_range_compare(gconstpointer a, gconstpointer b)
+{
+    const BalloonReportRange *ra = a, *rb = b;
+
+    if (ra->rb != rb->rb) {
+        return (uintptr_t)ra->rb < (uintptr_t)rb->rb ? -1 : 1;
+    }
+    return ra->offset < rb->offset ? -1 : ra->offset > rb->offset;
+}
+
+static void balloon_report_coalesce(GArray *ranges)
+{
+    unsigned i, n = 0;
+
+    g_array_sort(ranges, balloon_report_range_compare);
+    for (i = 0; i < ranges->len; i++) {
+        BalloonReportRange *r = &g_array_index(ranges, BalloonReportRange, i);
+        BalloonReportRange *last;
+
+        if (n) {
+            last = &g_array_index(ranges, BalloonReportRange, n - 1);
+            if (last->rb == r->rb && last->offset + last->size >= r->offset) {
+                last->size = MAX(last->size,
+                                 r->offset + r->size - last->offset);
+                continue;
+            }
+        }
+        g_array_index(ranges, BalloonReportRange, n++) = *r;
+    }
+    g_array_set_size(ranges, n);
+}
+
+static int virtio_balloon_report_worker(void *opaque)
+{
+    BalloonReport *report = opaque;
+    int64_t start = get_clock();
+    unsigned i;
+
+    /* Discards might have been disabled since the elements were popped */
+    if (!ram_block_discard_begin()) {
+        return 0;
+    }
+    for (i = 0; i < report->ranges->len; i++) {
+        BalloonReportRange *r = &g_array_index(report->ranges,
+                                               BalloonReportRange, i);
+
+        if (!ram_block_discard_range(r->rb, r->offset, r->size)) {
+            report->bytes += r->size;
+        }
+    }
+    ram_block_discard_end();
+    report->ns = get_clock() - start;
+    return 0;
+}
+
+static void virtio_balloon_handle_report(VirtIODevice *vdev, VirtQueue *vq);
+
+static void virtio_balloon_report_done(void *opaque, int ret)
+{
+    BalloonReport *report = opaque;
+    VirtIOBalloon *dev = report->dev;
+    VirtIODevice *vdev = VIRTIO_DEVICE(dev);
+    unsigned i;
+
+    trace_virtio_balloon_report(report->elems->len, report->ranges->len,
+                                report->bytes, report->ns);
+    dev->free_page_report_bytes += report->bytes;
+    dev->free_page_report_ns += report->ns;
+
+    for (i = 0; i < report->elems->len; i++) {
+        VirtQueueElement *elem = g_ptr_array_index(report->elems, i);
+
+        virtqueue_push(dev->reporting_vq, elem, 0);
+        g_free(elem);
+    }
+    virtio_notify(vdev, dev->reporting_vq);
+
+    g_ptr_array_free(report->elems, true);
+    g_array_free(report->ranges, true);
+    g_free(report);
+    dev->free_page_report_inflight = false;
+
+    /* Pick up the reports that were queued in the meantime */
+    if (vdev->vm_running) {
+        virtio_balloon_handle_report(vdev, dev->reporting_vq);
+    }
+}
+
+/* Wait for the discards of the batch in flight, if any. */
+static void virtio_balloon_report_drain(VirtIOBalloon *dev)
+{
+    AIO_WAIT_WHILE(NULL, dev->free_page_report_inflight);
+}
+
 static void virtio_balloon_handle_report(VirtIODevice *vdev, VirtQueue *vq)
 {
     VirtIOBalloon *dev = VIRTIO_BALLOON(vdev);
     VirtQueueElement *elem;
+    BalloonReport *report;
+
+    /* virtio_balloon_report_done() looks at the queue again */
+    if (dev->free_page_report_inflight) {
+        return;
+    }
+
+    report = g_new0(BalloonReport, 1);
+    report->dev = dev;
+    report->elems = g_ptr_array_new();
+    report->ranges = g_array_new(false, false, sizeof(BalloonReportRange));
 
     while ((elem = virtqueue_pop(vq, sizeof(VirtQueueElement)))) {
         unsigned int i;
 
+        g_ptr_array_add(report->elems, elem);
+
         /*
          * When we discard the page it has the effect of removing the page
          * from the hypervisor itself and causing it to be zeroed when it
@@ -354,12 +485,13 @@ static void virtio_balloon_handle_report(VirtIODevice *vdev, VirtQueue *vq)
          * expecting it to retain a non-zero value.
          */
         if (virtio_balloon_inhibited() || dev->poison_val) {
-            goto skip_element;
+            continue;
         }
 
         for (i = 0; i < elem->in_num; i++) {
             void *addr = elem->in_sg[i].iov_base;
             size_t size = elem->in_sg[i].iov_len;
+            BalloonReportRange range;
             ram_addr_t ram_offset;
             RAMBlock *rb;
 
@@ -389,14 +521,33 @@ static void virtio_balloon_handle_report(VirtIODevice *vdev, VirtQueue *vq)
                 continue;
             }
 
-            ram_block_discard_range(rb, ram_offset, size);
+            /*
+             * The RAMBlock stays alive until the element is pushed, as
+             * mapping the element took a reference to its memory region.
+             */
+            range.rb = rb;
+            range.offset = ram_offset;
+            range.size = size;
+            g_array_append_val(report->ranges, range);
         }
+    }
 
-skip_element:
-        virtqueue_push(vq, elem, 0);
-        virtio_notify(vdev, vq);
-        g_free(elem);
+    if (!report->elems->len) {
+        g_ptr_array_free(report->elems, true);
+        g_array_free(report->ranges, true);
+        g_free(report);
+        return;
     }
+
+    dev->free_page_report_inflight = true;
+    if (!report->ranges->len) {
+        virtio_balloon_report_done(report, 0);
+        return;
+    }
+    balloon_report_coalesce(report->ranges);
+    thread_pool_submit_aio(virtio_balloon_report_worker, report,
+                           virtio_balloon_report_done, report);
+}
 }
 
 static void virtio_balloon_handle_output(VirtIODevice *vdev, VirtQueue *vq)
@@ -921,6 +1072,7 @@ static void virtio_balloon_device_unrealize(DeviceState *dev)
     VirtIOBalloon *s = VIRTIO_BALLOON(dev);
 
     qemu_unregister_resettable(OBJECT(dev));
+    virtio_balloon_report_drain(s);
     if (s->free_page_bh) {
         qemu_bh_delete(s->free_page_bh);
         object_unref(OBJECT(s->iothread));
@@ -946,6 +1098,7 @@ static void virtio_balloon_device_reset(VirtIODevice *vdev)
 {
     VirtIOBalloon *s = VIRTIO_BALLOON(vdev);
 
+    virtio_balloon_report_drain(s);
     if (virtio_balloon_free_page_support(s)) {
         virtio_balloon_free_page_stop(s);
     }
@@ -970,6 +1123,11 @@ static int virtio_balloon_set_status(VirtIODevice *vdev, uint8_t status)
         virtio_balloon_receive_stats(vdev, s->svq);
     }
 
+    /* Reports must not be in flight while the VM is stopped, e.g. migrated */
+    if (!vdev->vm_running) {
+        virtio_balloon_report_drain(s);
+    }
+
     if (virtio_balloon_free_page_support(s)) {
         /*
          * The VM is woken up and the iothread was blocked, so signal it to
@@ -1029,6 +1187,13 @@ static void virtio_balloon_instance_init(Object *obj)
                         balloon_stats_get_poll_interval,
                         balloon_stats_set_poll_interval,
                         NULL, NULL);
+
+    object_property_add_uint64_ptr(obj, "free-page-reporting-bytes",
+                                   &s->free_page_report_bytes,
+                                   OBJ_PROP_FLAG_READ);
+    object_property_add_uint64_ptr(obj, "free-page-reporting-ns",
+                                   &s->free_page_report_ns,
+                                   OBJ_PROP_FLAG_READ);
 }
 
 static const VMStateDescription vmstate_virtio_balloon = {
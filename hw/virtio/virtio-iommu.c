@@ -20,6 +20,7 @@
 #include "qemu/osdep.h"
 #include "qemu/log.h"
 #include "qemu/iov.h"
+#include "qemu/lockable.h"
 #include "qemu/range.h"
 #include "qemu/reserved-region.h"
 #include "exec/target_page.h"
@@ -401,6 +402,16 @@ static void add_prop_resv_regions(IOMMUDevice *sdev)
     }
 }
 
+/* Largest block a translation is extended to */
+#define VIRTIO_IOMMU_TLB_MAX_MASK (1 * GiB - 1)
+
+/* Drop the translations cached by the endpoints */
+static void virtio_iommu_tlb_gen_bump(VirtIOIOMMU *s)
+{
+    QEMU_LOCK_GUARD(&s->mutex);
+    qatomic_set(&s->tlb_gen, iommu_tlb_gen_next(s->tlb_gen));
+}
+
 static AddressSpace *virtio_iommu_find_add_as(PCIBus *bus, void *opaque,
                                               int devfn)
 {
@@ -426,6 +437,7 @@ static AddressSpace *virtio_iommu_find_add_as(PCIBus *bus, void *opaque,
         sdev->viommu = s;
         sdev->bus = bus;
         sdev->devfn = devfn;
+        iommu_tlb_mru_init(&sdev->iotlb_mru);
 
         trace_virtio_iommu_init_iommu_mr(name);
 
@@ -562,6 +574,7 @@ static int virtio_iommu_set_host_iova_ranges(VirtIOIOMMU *s, PCIBus *bus,
                         &sdev->host_resv_ranges,
                         0, UINT64_MAX);
     rebuild_resv_regions(sdev);
+    virtio_iommu_tlb_gen_bump(s);
 
     return 0;
 }
@@ -586,6 +599,7 @@ static void virtio_iommu_unset_host_iova_ranges(VirtIOIOMMU *s, PCIBus *bus,
     sdev->host_resv_ranges = NULL;
     sdev->resv_regions = NULL;
     add_prop_resv_regions(sdev);
+    virtio_iommu_tlb_gen_bump(s);
 }
 
 
@@ -1035,15 +1049,18 @@ static void virtio_iommu_handle_command(VirtIODevice *vdev, VirtQueue *vq)
         switch (head.type) {
         case VIRTIO_IOMMU_T_ATTACH:
             tail.status = virtio_iommu_handle_attach(s, iov, iov_cnt);
+            virtio_iommu_tlb_gen_bump(s);
             break;
         case VIRTIO_IOMMU_T_DETACH:
             tail.status = virtio_iommu_handle_detach(s, iov, iov_cnt);
+            virtio_iommu_tlb_gen_bump(s);
             break;
         case VIRTIO_IOMMU_T_MAP:
             tail.status = virtio_iommu_handle_map(s, iov, iov_cnt);
             break;
         case VIRTIO_IOMMU_T_UNMAP:
             tail.status = virtio_iommu_handle_unmap(s, iov, iov_cnt);
+            virtio_iommu_tlb_gen_bump(s);
             break;
         case VIRTIO_IOMMU_T_PROBE:
         {
@@ -1135,6 +1152,40 @@ static void virtio_iommu_report_fault(VirtIOIOMMU *viommu, uint8_t reason,
 
 }
 
+/*
+ * Returns the mask of the largest naturally aligned block around @addr,
+ * starting from @mask, that @mapping translates linearly and that does not
+ * overlap reserved regions of @sdev.  A single cached translation then
+ * covers a whole large mapping.
+ */
+static hwaddr virtio_iommu_block_mask(IOMMUDevice *sdev,
+                                      VirtIOIOMMUInterval *interval,
+                                      VirtIOIOMMUMapping *mapping,
+                                      hwaddr addr, hwaddr mask)
+{
+    while (mask < VIRTIO_IOMMU_TLB_MAX_MASK) {
+        hwaddr next = (mask << 1) | 1;
+        hwaddr start = addr & ~next;
+        Range block;
+        GList *l;
+
+        if (start < interval->low || (start | next) > interval->high ||
+            ((mapping->phys_addr - interval->low) & next)) {
+            break;
+        }
+        range_set_bounds(&block, start, start | next);
+        for (l = sdev->resv_regions; l; l = l->next) {
+            ReservedRegion *reg = l->data;
+
+            if (range_overlaps_range(&reg->range, &block)) {
+                return mask;
+            }
+        }
+        mask = next;
+    }
+    return mask;
+}
+
 static IOMMUTLBEntry virtio_iommu_translate(IOMMUMemoryRegion *mr, hwaddr addr,
                                             IOMMUAccessFlags flag,
                                             int iommu_idx)
@@ -1145,6 +1196,7 @@ static IOMMUTLBEntry virtio_iommu_translate(IOMMUMemoryRegion *mr, hwaddr addr,
     VirtIOIOMMU *s = sdev->viommu;
     bool read_fault, write_fault;
     VirtIOIOMMUEndpoint *ep;
+    IOMMUAccessFlags perm;
     uint32_t sid, flags;
     bool bypass_allowed;
     int granule;
@@ -1163,6 +1215,11 @@ static IOMMUTLBEntry virtio_iommu_translate(IOMMUMemoryRegion *mr, hwaddr addr,
         .perm = IOMMU_NONE,
     };
 
+    if (iommu_tlb_mru_lookup(&sdev->iotlb_mru, qatomic_read(&s->tlb_gen),
+                             addr, flag & IOMMU_RW, &entry)) {
+        return entry;
+    }
+
     bypass_allowed = s->config.bypass;
 
     sid = virtio_iommu_get_bdf(sdev);
@@ -1255,6 +1312,16 @@ static IOMMUTLBEntry virtio_iommu_translate(IOMMUMemoryRegion *mr, hwaddr addr,
     entry.perm = flag;
     trace_virtio_iommu_translate_out(addr, entry.translated_addr, sid);
 
+    entry.addr_mask = virtio_iommu_block_mask(sdev, mapping_key, mapping_value,
+                                              addr, entry.addr_mask);
+    entry.iova = addr & ~entry.addr_mask;
+    entry.translated_addr &= ~entry.addr_mask;
+
+    perm = mapping_value->flags & VIRTIO_IOMMU_MAP_F_READ ? IOMMU_RO : 0;
+    perm |= mapping_value->flags & VIRTIO_IOMMU_MAP_F_WRITE ? IOMMU_WO : 0;
+    iommu_tlb_mru_update(&sdev->iotlb_mru, s->tlb_gen, entry.iova,
+                         entry.translated_addr, entry.addr_mask, perm);
+
 unlock:
     qemu_rec_mutex_unlock(&s->mutex);
     return entry;
@@ -1300,6 +1367,7 @@ static void virtio_iommu_set_config(VirtIODevice *vdev,
             return;
         }
         dev_config->bypass = in_config->bypass;
+        virtio_iommu_tlb_gen_bump(dev);
         virtio_iommu_switch_address_space_all(dev);
     }
 
@@ -1393,6 +1461,7 @@ static void virtio_iommu_system_reset(void *opaque)
      * system reset
      */
     s->config.bypass = s->boot_bypass;
+    virtio_iommu_tlb_gen_bump(s);
     virtio_iommu_switch_address_space_all(s);
 
 }
@@ -1463,6 +1532,7 @@ static void virtio_iommu_device_realize(DeviceState *dev, Error **errp)
     virtio_add_feature(&s->features, VIRTIO_IOMMU_F_BYPASS_CONFIG);
 
     qemu_rec_mutex_init(&s->mutex);
+    s->tlb_gen = 1;
 
     s->as_by_busptr = g_hash_table_new_full(NULL, NULL, NULL, g_free);
 
@@ -1520,6 +1590,7 @@ static void virtio_iommu_device_reset_exit(Object *obj, ResetType type)
                                  NULL, NULL, virtio_iommu_put_domain);
     s->endpoints = g_tree_new_full((GCompareDataFunc)int_cmp,
                                    NULL, NULL, virtio_iommu_put_endpoint);
+    virtio_iommu_tlb_gen_bump(s);
 }
 
 static int virtio_iommu_set_status(VirtIODevice *vdev, uint8_t status)
@@ -1621,6 +1692,7 @@ static int iommu_post_load(void *opaque, int version_id)
     VirtIOIOMMU *s = opaque;
 
     g_tree_foreach(s->domains, reconstruct_endpoints, s);
+    virtio_iommu_tlb_gen_bump(s);
 
     /*
      * Memory regions are dynamically turned on/off depending on
@@ -606,7 +606,9 @@ static int virtio_mem_set_block_state(VirtIOMEM *vmem, uint64_t start_gpa,
         int fd = memory_region_get_fd(&vmem->memdev->mr);
         Error *local_err = NULL;
 
-        if (!qemu_prealloc_mem(fd, area, size, 1, NULL, false, &local_err)) {
+        if (!qemu_prealloc_mem(fd, area, size, vmem->memdev->prealloc_threads,
+                               vmem->memdev->prealloc_context, false,
+                               &local_err)) {
             static bool warned;
 
             /*
@@ -651,17 +653,15 @@ static int virtio_mem_set_block_state(VirtIOMEM *vmem, uint64_t start_gpa,
     return 0;
 }
 
-static int virtio_mem_state_change_request(VirtIOMEM *vmem, uint64_t gpa,
-                                           uint16_t nb_blocks, bool plug)
+static uint16_t virtio_mem_state_change_check(VirtIOMEM *vmem, uint64_t gpa,
+                                              uint64_t size, bool plug,
+                                              uint64_t pending_size)
 {
-    const uint64_t size = nb_blocks * vmem->block_size;
-    int ret;
-
     if (!virtio_mem_valid_range(vmem, gpa, size)) {
         return VIRTIO_MEM_RESP_ERROR;
     }
 
-    if (plug && (vmem->size + size > vmem->requested_size)) {
+    if (plug && (vmem->size + pending_size + size > vmem->requested_size)) {
         return VIRTIO_MEM_RESP_NACK;
     }
 
@@ -670,6 +670,13 @@ static int virtio_mem_state_change_request(VirtIOMEM *vmem, uint64_t gpa,
         (!plug && !virtio_mem_is_range_plugged(vmem, gpa, size))) {
         return VIRTIO_MEM_RESP_ERROR;
     }
+    return VIRTIO_MEM_RESP_ACK;
+}
+
+static uint16_t virtio_mem_state_change(VirtIOMEM *vmem, uint64_t gpa,
+                                        uint64_t size, bool plug)
+{
+    int ret;
 
     ret = virtio_mem_set_block_state(vmem, gpa, size, plug);
     if (ret) {
@@ -684,28 +691,92 @@ static int virtio_mem_state_change_request(VirtIOMEM *vmem, uint64_t gpa,
     return VIRTIO_MEM_RESP_ACK;
 }
 
-static void virtio_mem_plug_request(VirtIOMEM *vmem, VirtQueueElement *elem,
+/*
+ * Consecutive plug or unplug requests for adjacent ranges are merged, so
+ * that discarding, preallocation, listener notifications and memslot
+ * updates happen once for the whole range.  All requests of a batch get
+ * the same response.
+ */
+#define VIRTIO_MEM_BATCH_MAX 32
+
+typedef struct VirtIOMEMBatch {
+    bool plug;
+    uint64_t gpa;
+    uint64_t size;
+    unsigned int nb_elems;
+    VirtQueueElement *elems[VIRTIO_MEM_BATCH_MAX];
+} VirtIOMEMBatch;
+
+static void virtio_mem_batch_flush(VirtIOMEM *vmem, VirtIOMEMBatch *batch)
+{
+    unsigned int i;
+    uint16_t type;
+
+    if (!batch->nb_elems) {
+        return;
+    }
+
+    trace_virtio_mem_batch(batch->plug, batch->gpa, batch->size,
+                           batch->nb_elems);
+    type = virtio_mem_state_change(vmem, batch->gpa, batch->size, batch->plug);
+    for (i = 0; i < batch->nb_elems; i++) {
+        virtio_mem_send_response_simple(vmem, batch->elems[i], type);
+        g_free(batch->elems[i]);
+    }
+    batch->nb_elems = 0;
+    batch->size = 0;
+}
+
+static void virtio_mem_state_change_request(VirtIOMEM *vmem,
+                                            VirtIOMEMBatch *batch,
+                                            VirtQueueElement *elem,
+                                            uint64_t gpa, uint16_t nb_blocks,
+                                            bool plug)
+{
+    const uint64_t size = nb_blocks * vmem->block_size;
+    uint16_t type;
+
+    if (batch->nb_elems && (batch->plug != plug ||
+                            batch->gpa + batch->size != gpa ||
+                            batch->nb_elems == VIRTIO_MEM_BATCH_MAX)) {
+        virtio_mem_batch_flush(vmem, batch);
+    }
+
+    type = virtio_mem_state_change_check(vmem, gpa, size, plug, batch->size);
+    if (type != VIRTIO_MEM_RESP_ACK) {
+        virtio_mem_send_response_simple(vmem, elem, type);
+        g_free(elem);
+        return;
+    }
+
+    if (!batch->nb_elems) {
+        batch->plug = plug;
+        batch->gpa = gpa;
+    }
+    batch->elems[batch->nb_elems++] = elem;
+    batch->size += size;
+}
+
+static void virtio_mem_plug_request(VirtIOMEM *vmem, VirtIOMEMBatch *batch,
+                                    VirtQueueElement *elem,
                                     struct virtio_mem_req *req)
 {
     const uint64_t gpa = le64_to_cpu(req->u.plug.addr);
     const uint16_t nb_blocks = le16_to_cpu(req->u.plug.nb_blocks);
-    uint16_t type;
 
     trace_virtio_mem_plug_request(gpa, nb_blocks);
-    type = virtio_mem_state_change_request(vmem, gpa, nb_blocks, true);
-    virtio_mem_send_response_simple(vmem, elem, type);
+    virtio_mem_state_change_request(vmem, batch, elem, gpa, nb_blocks, true);
 }
 
-static void virtio_mem_unplug_request(VirtIOMEM *vmem, VirtQueueElement *elem,
+static void virtio_mem_unplug_request(VirtIOMEM *vmem, VirtIOMEMBatch *batch,
+                                      VirtQueueElement *elem,
                                       struct virtio_mem_req *req)
 {
     const uint64_t gpa = le64_to_cpu(req->u.unplug.addr);
     const uint16_t nb_blocks = le16_to_cpu(req->u.unplug.nb_blocks);
-    uint16_t type;
 
     trace_virtio_mem_unplug_request(gpa, nb_blocks);
-    type = virtio_mem_state_change_request(vmem, gpa, nb_blocks, false);
-    virtio_mem_send_response_simple(vmem, elem, type);
+    virtio_mem_state_change_request(vmem, batch, elem, gpa, nb_blocks, false);
 }
 
 static void virtio_mem_resize_usable_region(VirtIOMEM *vmem,
@@ -801,6 +872,7 @@ static void virtio_mem_handle_request(VirtIODevice *vdev, VirtQueue *vq)
 {
     const int len = sizeof(struct virtio_mem_req);
     VirtIOMEM *vmem = VIRTIO_MEM(vdev);
+    VirtIOMEMBatch batch = { 0 };
     VirtQueueElement *elem;
     struct virtio_mem_req req;
     uint16_t type;
@@ -808,10 +880,11 @@ static void virtio_mem_handle_request(VirtIODevice *vdev, VirtQueue *vq)
     while (true) {
         elem = virtqueue_pop(vq, sizeof(VirtQueueElement));
         if (!elem) {
-            return;
+            break;
         }
 
         if (iov_to_buf(elem->out_sg, elem->out_num, 0, &req, len) < len) {
+            virtio_mem_batch_flush(vmem, &batch);
             virtio_error(vdev, "virtio-mem protocol violation: invalid request"
                          " size: %d", len);
             virtqueue_detach_element(vq, elem, 0);
@@ -821,6 +894,7 @@ static void virtio_mem_handle_request(VirtIODevice *vdev, VirtQueue *vq)
 
         if (iov_size(elem->in_sg, elem->in_num) <
             sizeof(struct virtio_mem_resp)) {
+            virtio_mem_batch_flush(vmem, &batch);
             virtio_error(vdev, "virtio-mem protocol violation: not enough space"
                          " for response: %zu",
                          iov_size(elem->in_sg, elem->in_num));
@@ -832,11 +906,17 @@ static void virtio_mem_handle_request(VirtIODevice *vdev, VirtQueue *vq)
         type = le16_to_cpu(req.type);
         switch (type) {
         case VIRTIO_MEM_REQ_PLUG:
-            virtio_mem_plug_request(vmem, elem, &req);
-            break;
+            virtio_mem_plug_request(vmem, &batch, elem, &req);
+            continue;
         case VIRTIO_MEM_REQ_UNPLUG:
-            virtio_mem_unplug_request(vmem, elem, &req);
-            break;
+            virtio_mem_unplug_request(vmem, &batch, elem, &req);
+            continue;
+        }
+
+        /* Other requests observe the state, apply what is batched first */
+        virtio_mem_batch_flush(vmem, &batch);
+
+        switch (type) {
         case VIRTIO_MEM_REQ_UNPLUG_ALL:
             virtio_mem_unplug_all_request(vmem, elem);
             break;
@@ -853,6 +933,8 @@ static void virtio_mem_handle_request(VirtIODevice *vdev, VirtQueue *vq)
 
         g_free(elem);
     }
+
+    virtio_mem_batch_flush(vmem, &batch);
 }
 
 static void virtio_mem_get_config(VirtIODevice *vdev, uint8_t *config_data)
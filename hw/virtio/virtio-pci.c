@@ -29,6 +29,7 @@
 #include "qapi/error.h"
 #include "qemu/error-report.h"
 #include "qemu/log.h"
+#include "qemu/main-loop.h"
 #include "qemu/module.h"
 #include "qemu/bswap.h"
 #include "hw/pci/msi.h"
@@ -1779,6 +1780,20 @@ static uint64_t virtio_pci_notify_read(void *opaque, hwaddr addr,
     return 0;
 }
 
+/*
+ * The notify regions are accessed without the BQL.  When the queue has a
+ * host notifier the notification is passed on the same way an ioeventfd
+ * would; only queues that are processed in the main loop need the BQL.
+ */
+static void virtio_pci_queue_notify(VirtIODevice *vdev, unsigned queue)
+{
+    if (!virtio_queue_notify_host(vdev, queue)) {
+        BQL_LOCK_GUARD();
+
+        virtio_queue_notify(vdev, queue);
+    }
+}
+
 static void virtio_pci_notify_write(void *opaque, hwaddr addr,
                                     uint64_t val, unsigned size)
 {
@@ -1789,7 +1804,7 @@ static void virtio_pci_notify_write(void *opaque, hwaddr addr,
 
     if (vdev != NULL && queue < VIRTIO_QUEUE_MAX) {
         trace_virtio_pci_notify_write(addr, val, size);
-        virtio_queue_notify(vdev, queue);
+        virtio_pci_queue_notify(vdev, queue);
     }
 }
 
@@ -1803,7 +1818,7 @@ static void virtio_pci_notify_write_pio(void *opaque, hwaddr addr,
 
     if (vdev != NULL && queue < VIRTIO_QUEUE_MAX) {
         trace_virtio_pci_notify_write_pio(addr, val, size);
-        virtio_queue_notify(vdev, queue);
+        virtio_pci_queue_notify(vdev, queue);
     }
 }
 
@@ -1818,8 +1833,18 @@ static uint64_t virtio_pci_isr_read(void *opaque, hwaddr addr,
         return UINT64_MAX;
     }
 
+    /*
+     * The ISR region is accessed without the BQL.  Reading it while no
+     * interrupt is pending, as shared INTx handlers do, does not need the
+     * BQL.  Otherwise recompute the level under the BQL, in case
+     * virtio_notify() raised the ISR again since the exchange.
+     */
     val = qatomic_xchg(&vdev->isr, 0);
-    pci_irq_deassert(&proxy->pci_dev);
+    if (val) {
+        BQL_LOCK_GUARD();
+
+        pci_set_irq(&proxy->pci_dev, qatomic_read(&vdev->isr) & 1);
+    }
     return val;
 }
 
@@ -1963,6 +1988,10 @@ static void virtio_pci_modern_regions_init(VirtIOPCIProxy *proxy,
                           proxy,
                           name->str,
                           proxy->notify_pio.size);
+
+    memory_region_enable_lockless_io(&proxy->isr.mr);
+    memory_region_enable_lockless_io(&proxy->notify.mr);
+    memory_region_enable_lockless_io(&proxy->notify_pio.mr);
 }
 
 static void virtio_pci_modern_region_map(VirtIOPCIProxy *proxy,
@@ -2164,6 +2193,8 @@ static void virtio_pci_device_plugged(DeviceState *d, Error **errp)
                             proxy->nvectors);
             }
             proxy->nvectors = 0;
+        } else {
+            msix_enable_lockless_io(&proxy->pci_dev);
         }
     }
 
@@ -21,6 +21,7 @@
 #include "qemu/main-loop.h"
 #include "qemu/module.h"
 #include "qemu/target-info.h"
+#include "qemu/thread.h"
 #include "qom/object_interfaces.h"
 #include "hw/core/cpu.h"
 #include "hw/virtio/virtio.h"
@@ -76,6 +77,15 @@ typedef struct VRingPackedDesc {
     uint16_t flags;
 } VRingPackedDesc;
 
+/* Packed descriptors read at once when walking a chain, a cache line */
+#define VRING_PACKED_DESC_CHUNK 4
+
+typedef struct VRingPackedDescChunk {
+    VRingPackedDesc desc[VRING_PACKED_DESC_CHUNK];
+    unsigned int start;
+    unsigned int num;
+} VRingPackedDescChunk;
+
 typedef struct VRingAvail
 {
     uint16_t flags;
@@ -119,10 +129,34 @@ typedef struct VRingPackedDescEvent {
     uint16_t flags;
 } VRingPackedDescEvent ;
 
+/*
+ * Longest descriptor chain that still gets an element from the pool of
+ * its queue
+ */
+#define VIRTQUEUE_POOL_MAX_SG 32
+
+/*
+ * Preallocated elements of one queue, enough for all the requests it
+ * can have in flight.  Elements may be released from another thread
+ * than the one popping them, e.g. on completion or cancellation.  The
+ * pool outlives its queue until the last of its elements is released.
+ */
+typedef struct VirtQueueElementPool {
+    QemuSpin lock;
+    /* free slots, linked through their first word */
+    void *free;
+    unsigned int in_use;
+    bool orphaned;
+    size_t elem_sz;
+    size_t slot_size;
+    void *slab;
+} VirtQueueElementPool;
+
 struct VirtQueue
 {
     VRing vring;
     VirtQueueElement *used_elems;
+    VirtQueueElementPool *elem_pool;
 
     /* Next head to pop */
     uint16_t last_avail_idx;
@@ -154,6 +188,14 @@ struct VirtQueue
     EventNotifier guest_notifier;
     EventNotifier host_notifier;
     bool host_notifier_enabled;
+
+    /* Write one used descriptor per in-order batch (packed ring only) */
+    bool in_order_batch;
+
+    /* Interrupt moderation, see virtio_irq_moderate() */
+    QEMUTimer *irq_mod_timer;
+    AioContext *irq_mod_ctx;
+    unsigned int irq_mod_pending;
     QLIST_ENTRY(VirtQueue) node;
 };
 
@@ -602,6 +644,11 @@ bool virtio_queue_get_notification(VirtQueue *vq)
     return vq->notification;
 }
 
+void virtio_queue_set_in_order_batch(VirtQueue *vq, bool enable)
+{
+    vq->in_order_batch = enable;
+}
+
 void virtio_queue_set_notification(VirtQueue *vq, int enable)
 {
     vq->notification = enable;
@@ -657,6 +704,35 @@ static void vring_packed_desc_read(VirtIODevice *vdev,
     virtio_tswap32s(vdev, &desc->len);
 }
 
+/*
+ * Same as vring_packed_desc_read() without strict ordering, but reads the
+ * descriptors following @i in the table of @max entries as well, so that
+ * walking a chain goes back to guest memory once per chunk.
+ */
+static void vring_packed_desc_read_chunked(VirtIODevice *vdev,
+                                           VRingPackedDesc *desc,
+                                           MemoryRegionCache *cache,
+                                           unsigned int i, unsigned int max,
+                                           VRingPackedDescChunk *chunk)
+{
+    unsigned int j;
+
+    if (i < chunk->start || i >= chunk->start + chunk->num) {
+        chunk->start = i;
+        chunk->num = MIN(VRING_PACKED_DESC_CHUNK, max - i);
+        address_space_read_cached(cache, i * sizeof(VRingPackedDesc),
+                                  chunk->desc,
+                                  chunk->num * sizeof(VRingPackedDesc));
+        for (j = 0; j < chunk->num; j++) {
+            virtio_tswap64s(vdev, &chunk->desc[j].addr);
+            virtio_tswap32s(vdev, &chunk->desc[j].len);
+            virtio_tswap16s(vdev, &chunk->desc[j].id);
+            virtio_tswap16s(vdev, &chunk->desc[j].flags);
+        }
+    }
+    *desc = chunk->desc[i - chunk->start];
+}
+
 static void vring_packed_desc_write_data(VirtIODevice *vdev,
                                          VRingPackedDesc *desc,
                                          MemoryRegionCache *cache,
@@ -1131,6 +1207,7 @@ static void virtqueue_packed_flush(VirtQueue *vq, unsigned int count)
 static void virtqueue_ordered_flush(VirtQueue *vq)
 {
     unsigned int i = vq->used_idx % vq->vring.num;
+    unsigned int last = i;
     unsigned int ndescs = 0;
     uint16_t old = vq->used_idx;
     uint16_t new;
@@ -1158,7 +1235,7 @@ static void virtqueue_ordered_flush(VirtQueue *vq)
          * First entry for packed VQs is written last so the guest
          * doesn't see invalid descriptors.
          */
-        if (packed && i != vq->used_idx) {
+        if (packed && i != vq->used_idx && !vq->in_order_batch) {
             virtqueue_packed_fill_desc(vq, &vq->used_elems[i], ndescs, false);
         } else if (!packed) {
             uelem.id = vq->used_elems[i].index;
@@ -1167,6 +1244,7 @@ static void virtqueue_ordered_flush(VirtQueue *vq)
         }
 
         vq->used_elems[i].in_order_filled = false;
+        last = i;
         ndescs += vq->used_elems[i].ndescs;
         i += vq->used_elems[i].ndescs;
         if (i >= vq->vring.num) {
@@ -1174,8 +1252,17 @@ static void virtqueue_ordered_flush(VirtQueue *vq)
         }
     }
 
-    if (packed) {
+    if (packed && vq->in_order_batch) {
+        /*
+         * A single used descriptor with the id of the last buffer tells
+         * the driver that the whole batch has been used.
+         */
+        virtqueue_packed_fill_desc(vq, &vq->used_elems[last], 0, true);
+    } else if (packed) {
         virtqueue_packed_fill_desc(vq, &vq->used_elems[vq->used_idx], 0, true);
+    }
+
+    if (packed) {
         vq->used_idx += ndescs;
         if (vq->used_idx >= vq->vring.num) {
             vq->used_idx -= vq->vring.num;
@@ -1410,7 +1497,8 @@ static int virtqueue_packed_read_next_desc(VirtQueue *vq,
                                            *desc_cache,
                                            unsigned int max,
                                            unsigned int *next,
-                                           bool indirect)
+                                           bool indirect,
+                                           VRingPackedDescChunk *chunk)
 {
     /* If this descriptor says it doesn't chain, we're done. */
     if (!indirect && !(desc->flags & VRING_DESC_F_NEXT)) {
@@ -1426,7 +1514,12 @@ static int virtqueue_packed_read_next_desc(VirtQueue *vq,
         }
     }
 
-    vring_packed_desc_read(vq->vdev, desc, desc_cache, *next, false);
+    if (chunk) {
+        vring_packed_desc_read_chunked(vq->vdev, desc, desc_cache, *next,
+                                       indirect ? max : vq->vring.num, chunk);
+    } else {
+        vring_packed_desc_read(vq->vdev, desc, desc_cache, *next, false);
+    }
     return VIRTQUEUE_READ_DESC_MORE;
 }
 
@@ -1511,7 +1604,7 @@ static void virtqueue_packed_get_avail_bytes(VirtQueue *vq,
 
             rc = virtqueue_packed_read_next_desc(vq, &desc, desc_cache, max,
                                                  &i, desc_cache ==
-                                                 &indirect_desc_cache);
+                                                 &indirect_desc_cache, NULL);
         } while (rc == VIRTQUEUE_READ_DESC_MORE);
 
         if (desc_cache == &indirect_desc_cache) {
@@ -1700,7 +1793,8 @@ void virtqueue_map(VirtIODevice *vdev, VirtQueueElement *elem)
                                                                         false);
 }
 
-static void *virtqueue_alloc_element(size_t sz, unsigned out_num, unsigned in_num)
+static size_t virtqueue_element_size(size_t sz, unsigned out_num,
+                                     unsigned in_num)
 {
     VirtQueueElement *elem;
     size_t in_addr_ofs = QEMU_ALIGN_UP(sz, __alignof__(elem->in_addr[0]));
@@ -1708,11 +1802,115 @@ static void *virtqueue_alloc_element(size_t sz, unsigned out_num, unsigned in_nu
     size_t out_addr_end = out_addr_ofs + out_num * sizeof(elem->out_addr[0]);
     size_t in_sg_ofs = QEMU_ALIGN_UP(out_addr_end, __alignof__(elem->in_sg[0]));
     size_t out_sg_ofs = in_sg_ofs + in_num * sizeof(elem->in_sg[0]);
+
+    return out_sg_ofs + out_num * sizeof(elem->out_sg[0]);
+}
+
+static VirtQueueElementPool *virtqueue_pool_new(unsigned int num, size_t sz)
+{
+    VirtQueueElementPool *pool = g_new0(VirtQueueElementPool, 1);
+    unsigned int i;
+
+    qemu_spin_init(&pool->lock);
+    pool->elem_sz = sz;
+    /* Keep the slots as aligned as g_malloc() would */
+    pool->slot_size = QEMU_ALIGN_UP(
+        virtqueue_element_size(sz, VIRTQUEUE_POOL_MAX_SG, 0), 16);
+    pool->slab = g_malloc(num * pool->slot_size);
+    for (i = 0; i < num; i++) {
+        void **slot = pool->slab + i * pool->slot_size;
+
+        *slot = pool->free;
+        pool->free = slot;
+    }
+    return pool;
+}
+
+static void virtqueue_pool_free(VirtQueueElementPool *pool)
+{
+    g_free(pool->slab);
+    g_free(pool);
+}
+
+/* Called when the queue goes away */
+static void virtqueue_pool_orphan(VirtQueueElementPool *pool)
+{
+    bool unused;
+
+    qemu_spin_lock(&pool->lock);
+    pool->orphaned = true;
+    unused = !pool->in_use;
+    qemu_spin_unlock(&pool->lock);
+
+    if (unused) {
+        virtqueue_pool_free(pool);
+    }
+}
+
+static void *virtqueue_pool_get(VirtQueueElementPool *pool, size_t sz,
+                                size_t elem_size)
+{
+    void **slot;
+
+    if (sz != pool->elem_sz || elem_size > pool->slot_size) {
+        return NULL;
+    }
+
+    qemu_spin_lock(&pool->lock);
+    slot = pool->free;
+    if (slot) {
+        pool->free = *slot;
+        pool->in_use++;
+    }
+    qemu_spin_unlock(&pool->lock);
+    return slot;
+}
+
+void virtqueue_element_release(void *opaque)
+{
+    VirtQueueElement *elem = opaque;
+    VirtQueueElementPool *pool;
+    void **slot = opaque;
+    bool last;
+
+    if (!elem || !elem->pool) {
+        g_free(elem);
+        return;
+    }
+
+    pool = elem->pool;
+    qemu_spin_lock(&pool->lock);
+    *slot = pool->free;
+    pool->free = slot;
+    last = !--pool->in_use && pool->orphaned;
+    qemu_spin_unlock(&pool->lock);
+
+    if (last) {
+        virtqueue_pool_free(pool);
+    }
+}
+
+static void *virtqueue_alloc_element(VirtQueueElementPool *pool, size_t sz,
+                                     unsigned out_num, unsigned in_num)
+{
+    VirtQueueElement *elem = NULL;
+    size_t in_addr_ofs = QEMU_ALIGN_UP(sz, __alignof__(elem->in_addr[0]));
+    size_t out_addr_ofs = in_addr_ofs + in_num * sizeof(elem->in_addr[0]);
+    size_t out_addr_end = out_addr_ofs + out_num * sizeof(elem->out_addr[0]);
+    size_t in_sg_ofs = QEMU_ALIGN_UP(out_addr_end, __alignof__(elem->in_sg[0]));
+    size_t out_sg_ofs = in_sg_ofs + in_num * sizeof(elem->in_sg[0]);
     size_t out_sg_end = out_sg_ofs + out_num * sizeof(elem->out_sg[0]);
 
     assert(sz >= sizeof(VirtQueueElement));
-    elem = g_malloc(out_sg_end);
+    if (pool) {
+        elem = virtqueue_pool_get(pool, sz, out_sg_end);
+    }
+    if (!elem) {
+        elem = g_malloc(out_sg_end);
+        pool = NULL;
+    }
     trace_virtqueue_alloc_element(elem, sz, in_num, out_num);
+    elem->pool = pool;
     elem->out_num = out_num;
     elem->in_num = in_num;
     elem->in_addr = (void *)elem + in_addr_ofs;
@@ -1722,10 +1920,52 @@ static void *virtqueue_alloc_element(size_t sz, unsigned out_num, unsigned in_nu
     return elem;
 }
 
-static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
+static VirtQueueElementPool *virtqueue_get_pool(VirtQueue *vq, size_t sz,
+                                                bool pooled)
+{
+    if (!pooled) {
+        return NULL;
+    }
+    if (!vq->elem_pool) {
+        vq->elem_pool = virtqueue_pool_new(vq->vring.num, sz);
+    }
+    return vq->elem_pool;
+}
+
+/*
+ * Map one run of descriptors pointing to adjacent guest-physical memory
+ * after the @out_num device-readable and @in_num device-writable buffers
+ * mapped so far.
+ */
+static bool virtqueue_map_desc_run(VirtIODevice *vdev, unsigned int *out_num,
+                                   unsigned int *in_num, hwaddr *addr,
+                                   struct iovec *iov, bool is_write,
+                                   hwaddr pa, size_t sz)
+{
+    if (is_write) {
+        return virtqueue_map_desc(vdev, in_num, addr + *out_num,
+                                  iov + *out_num,
+                                  VIRTQUEUE_MAX_SIZE - *out_num, true,
+                                  pa, sz);
+    } else {
+        return virtqueue_map_desc(vdev, out_num, addr, iov,
+                                  VIRTQUEUE_MAX_SIZE, false, pa, sz);
+    }
+}
+
+/*
+ * Called within rcu_read_lock() with at least one head available.
+ *
+ * If @coalesce is true, descriptors of the same direction that are
+ * contiguous in guest-physical memory are mapped with a single
+ * dma_memory_map() call, and end up in the same iovec unless the
+ * mapping has to be split.
+ */
+static void *virtqueue_split_pop_head(VirtQueue *vq,
+                                      VRingMemoryRegionCaches *caches,
+                                      size_t sz, bool pooled, bool coalesce)
 {
     unsigned int i, head, max, idx;
-    VRingMemoryRegionCaches *caches;
     MemoryRegionCache indirect_desc_cache;
     MemoryRegionCache *desc_cache;
     int64_t len;
@@ -1735,18 +1975,13 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
     hwaddr QEMU_UNINITIALIZED addr[VIRTQUEUE_MAX_SIZE];
     struct iovec QEMU_UNINITIALIZED iov[VIRTQUEUE_MAX_SIZE];
     VRingDesc desc;
+    hwaddr run_pa = 0;
+    size_t run_len = 0;
+    bool run_write = false, have_run = false, seen_write = false;
     int rc;
 
     address_space_cache_init_empty(&indirect_desc_cache);
 
-    RCU_READ_LOCK_GUARD();
-    if (virtio_queue_empty_rcu(vq)) {
-        goto done;
-    }
-    /* Needed after virtio_queue_empty(), see comment in
-     * virtqueue_num_heads(). */
-    smp_rmb();
-
     /* When we start there are none of either input nor output. */
     out_num = in_num = elem_entries = 0;
 
@@ -1761,18 +1996,8 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
         goto done;
     }
 
-    if (virtio_vdev_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX)) {
-        vring_set_avail_event(vq, vq->last_avail_idx);
-    }
-
     i = head;
 
-    caches = vring_get_region_caches(vq);
-    if (!caches) {
-        virtio_error(vdev, "Region caches not initialized");
-        goto done;
-    }
-
     if (caches->desc.len < max * sizeof(VRingDesc)) {
         virtio_error(vdev, "Cannot map descriptor ring");
         goto done;
@@ -1803,24 +2028,27 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
 
     /* Collect all the descriptors */
     do {
-        bool map_ok;
+        bool is_write = desc.flags & VRING_DESC_F_WRITE;
 
-        if (desc.flags & VRING_DESC_F_WRITE) {
-            map_ok = virtqueue_map_desc(vdev, &in_num, addr + out_num,
-                                        iov + out_num,
-                                        VIRTQUEUE_MAX_SIZE - out_num, true,
-                                        desc.addr, desc.len);
+        if (!is_write && seen_write) {
+            virtio_error(vdev, "Incorrect order for descriptors");
+            goto err_undo_map;
+        }
+        seen_write |= is_write;
+
+        if (coalesce && have_run && desc.len && is_write == run_write &&
+            run_pa + run_len == desc.addr && desc.len <= SIZE_MAX - run_len) {
+            run_len += desc.len;
         } else {
-            if (in_num) {
-                virtio_error(vdev, "Incorrect order for descriptors");
+            if (have_run &&
+                !virtqueue_map_desc_run(vdev, &out_num, &in_num, addr, iov,
+                                        run_write, run_pa, run_len)) {
                 goto err_undo_map;
             }
-            map_ok = virtqueue_map_desc(vdev, &out_num, addr, iov,
-                                        VIRTQUEUE_MAX_SIZE, false,
-                                        desc.addr, desc.len);
-        }
-        if (!map_ok) {
-            goto err_undo_map;
+            run_pa = desc.addr;
+            run_len = desc.len;
+            run_write = is_write;
+            have_run = true;
         }
 
         /* If we've got too many, that implies a descriptor loop. */
@@ -1836,8 +2064,14 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
         goto err_undo_map;
     }
 
+    if (!virtqueue_map_desc_run(vdev, &out_num, &in_num, addr, iov,
+                                run_write, run_pa, run_len)) {
+        goto err_undo_map;
+    }
+
     /* Now copy what we have collected and mapped */
-    elem = virtqueue_alloc_element(sz, out_num, in_num);
+    elem = virtqueue_alloc_element(virtqueue_get_pool(vq, sz, pooled),
+                                   sz, out_num, in_num);
     elem->index = head;
     elem->ndescs = 1;
     for (i = 0; i < out_num; i++) {
@@ -1869,7 +2103,73 @@ err_undo_map:
     goto done;
 }
 
-static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
+static void *virtqueue_split_pop(VirtQueue *vq, size_t sz, bool pooled)
+{
+    VRingMemoryRegionCaches *caches;
+    VirtQueueElement *elem;
+
+    RCU_READ_LOCK_GUARD();
+    if (virtio_queue_empty_rcu(vq)) {
+        return NULL;
+    }
+    /* Needed after virtio_queue_empty(), see comment in
+     * virtqueue_num_heads(). */
+    smp_rmb();
+
+    caches = vring_get_region_caches(vq);
+    if (!caches) {
+        virtio_error(vq->vdev, "Region caches not initialized");
+        return NULL;
+    }
+
+    elem = virtqueue_split_pop_head(vq, caches, sz, pooled, false);
+
+    if (virtio_vdev_has_feature(vq->vdev, VIRTIO_RING_F_EVENT_IDX)) {
+        vring_set_avail_event(vq, vq->last_avail_idx);
+    }
+    return elem;
+}
+
+/*
+ * Pop up to @max elements with a single read of the avail index, and
+ * publish the avail event only once for all of them.
+ */
+static unsigned int virtqueue_split_pop_batch(VirtQueue *vq, size_t sz,
+                                              void **elems, unsigned int max,
+                                              bool coalesce)
+{
+    VRingMemoryRegionCaches *caches;
+    unsigned int n = 0;
+    int num_heads;
+
+    RCU_READ_LOCK_GUARD();
+    num_heads = virtqueue_num_heads(vq, vq->last_avail_idx);
+    if (num_heads <= 0) {
+        return 0;
+    }
+
+    caches = vring_get_region_caches(vq);
+    if (!caches) {
+        virtio_error(vq->vdev, "Region caches not initialized");
+        return 0;
+    }
+
+    max = MIN(max, num_heads);
+    while (n < max) {
+        elems[n] = virtqueue_split_pop_head(vq, caches, sz, true, coalesce);
+        if (!elems[n]) {
+            break;
+        }
+        n++;
+    }
+
+    if (virtio_vdev_has_feature(vq->vdev, VIRTIO_RING_F_EVENT_IDX)) {
+        vring_set_avail_event(vq, vq->last_avail_idx);
+    }
+    return n;
+}
+
+static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz, bool pooled)
 {
     unsigned int i, max;
     VRingMemoryRegionCaches *caches;
@@ -1882,6 +2182,7 @@ static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
     hwaddr QEMU_UNINITIALIZED addr[VIRTQUEUE_MAX_SIZE];
     struct iovec QEMU_UNINITIALIZED iov[VIRTQUEUE_MAX_SIZE];
     VRingPackedDesc desc;
+    VRingPackedDescChunk chunk = {};
     uint16_t id;
     int rc;
 
@@ -1969,7 +2270,7 @@ static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
 
         rc = virtqueue_packed_read_next_desc(vq, &desc, desc_cache, max, &i,
                                              desc_cache ==
-                                             &indirect_desc_cache);
+                                             &indirect_desc_cache, &chunk);
     } while (rc == VIRTQUEUE_READ_DESC_MORE);
 
     if (desc_cache != &indirect_desc_cache) {
@@ -1978,7 +2279,8 @@ static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
     }
 
     /* Now copy what we have collected and mapped */
-    elem = virtqueue_alloc_element(sz, out_num, in_num);
+    elem = virtqueue_alloc_element(virtqueue_get_pool(vq, sz, pooled),
+                                   sz, out_num, in_num);
     for (i = 0; i < out_num; i++) {
         elem->out_addr[i] = addr[i];
         elem->out_sg[i] = iov[i];
@@ -2019,17 +2321,46 @@ err_undo_map:
     goto done;
 }
 
-void *virtqueue_pop(VirtQueue *vq, size_t sz)
+static void *virtqueue_pop_common(VirtQueue *vq, size_t sz, bool pooled)
 {
     if (virtio_device_disabled(vq->vdev)) {
         return NULL;
     }
 
     if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
-        return virtqueue_packed_pop(vq, sz);
+        return virtqueue_packed_pop(vq, sz, pooled);
     } else {
-        return virtqueue_split_pop(vq, sz);
+        return virtqueue_split_pop(vq, sz, pooled);
+    }
+}
+
+void *virtqueue_pop(VirtQueue *vq, size_t sz)
+{
+    return virtqueue_pop_common(vq, sz, false);
+}
+
+void *virtqueue_pop_pooled(VirtQueue *vq, size_t sz)
+{
+    return virtqueue_pop_common(vq, sz, true);
+}
+
+unsigned int virtqueue_pop_batch(VirtQueue *vq, size_t sz, void **elems,
+                                 unsigned int max, bool coalesce)
+{
+    unsigned int n = 0;
+
+    if (virtio_device_disabled(vq->vdev)) {
+        return 0;
+    }
+
+    if (!virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
+        return virtqueue_split_pop_batch(vq, sz, elems, max, coalesce);
     }
+
+    while (n < max && (elems[n] = virtqueue_packed_pop(vq, sz, true))) {
+        n++;
+    }
+    return n;
 }
 
 static unsigned int virtqueue_packed_drop_all(VirtQueue *vq)
@@ -2066,7 +2397,8 @@ static unsigned int virtqueue_packed_drop_all(VirtQueue *vq)
         elem.index = desc.id;
         elem.ndescs = 1;
         while (virtqueue_packed_read_next_desc(vq, &desc, desc_cache,
-                                               vq->vring.num, &idx, false)) {
+                                               vq->vring.num, &idx, false,
+                                               NULL)) {
             ++elem.ndescs;
         }
         /*
@@ -2167,7 +2499,7 @@ void *qemu_get_virtqueue_element(VirtIODevice *vdev, QEMUFile *f, size_t sz)
     assert(ARRAY_SIZE(data.in_addr) >= data.in_num);
     assert(ARRAY_SIZE(data.out_addr) >= data.out_num);
 
-    elem = virtqueue_alloc_element(sz, data.out_num, data.in_num);
+    elem = virtqueue_alloc_element(NULL, sz, data.out_num, data.in_num);
     elem->index = data.index;
 
     for (i = 0; i < elem->in_num; i++) {
@@ -2322,6 +2654,13 @@ static enum virtio_device_endian virtio_current_cpu_endian(void)
     }
 }
 
+static void virtio_irq_moderation_cancel(VirtQueue *vq)
+{
+    if (vq->irq_mod_timer) {
+        timer_del(vq->irq_mod_timer);
+    }
+}
+
 static void __virtio_queue_reset(VirtIODevice *vdev, uint32_t i)
 {
     vdev->vq[i].vring.desc = 0;
@@ -2339,6 +2678,8 @@ static void __virtio_queue_reset(VirtIODevice *vdev, uint32_t i)
     vdev->vq[i].notification = true;
     vdev->vq[i].vring.num = vdev->vq[i].vring.num_default;
     vdev->vq[i].inuse = 0;
+    virtio_irq_moderation_cancel(&vdev->vq[i]);
+    qatomic_set(&vdev->vq[i].irq_mod_pending, 0);
     virtio_virtqueue_reset_region_cache(&vdev->vq[i]);
 }
 
@@ -2524,6 +2865,19 @@ void virtio_queue_notify(VirtIODevice *vdev, int n)
     }
 }
 
+bool virtio_queue_notify_host(VirtIODevice *vdev, int n)
+{
+    VirtQueue *vq = &vdev->vq[n];
+
+    if (!qatomic_read(&vq->host_notifier_enabled)) {
+        return false;
+    }
+
+    trace_virtio_queue_notify(vdev, n, vq);
+    event_notifier_set(&vq->host_notifier);
+    return true;
+}
+
 uint16_t virtio_queue_vector(VirtIODevice *vdev, int n)
 {
     return n < VIRTIO_QUEUE_MAX ? vdev->vq[n].vector :
@@ -2576,6 +2930,17 @@ void virtio_delete_queue(VirtQueue *vq)
     vq->handle_output = NULL;
     g_free(vq->used_elems);
     vq->used_elems = NULL;
+    vq->in_order_batch = false;
+    if (vq->irq_mod_timer) {
+        timer_free(vq->irq_mod_timer);
+        vq->irq_mod_timer = NULL;
+        vq->irq_mod_ctx = NULL;
+    }
+    qatomic_set(&vq->irq_mod_pending, 0);
+    if (vq->elem_pool) {
+        virtqueue_pool_orphan(vq->elem_pool);
+        vq->elem_pool = NULL;
+    }
     virtio_virtqueue_reset_region_cache(vq);
 }
 
@@ -2719,16 +3084,85 @@ static void virtio_irq(VirtQueue *vq)
     }
 }
 
+/* Send the interrupt held back by moderation, if any */
+static void virtio_irq_moderation_fire(VirtQueue *vq)
+{
+    unsigned int pending = qatomic_xchg(&vq->irq_mod_pending, 0);
+
+    if (pending) {
+        trace_virtio_irq_moderation_fire(vq->vdev, vq, pending);
+        virtio_irq(vq);
+    }
+}
+
+static void virtio_irq_moderation_timer_cb(void *opaque)
+{
+    virtio_irq_moderation_fire(opaque);
+}
+
+/*
+ * Interrupts of queues served by an IOThread are delayed by up to
+ * irq_coalesce_usecs so that one of them covers several completions.
+ * The interrupt is sent right away once irq_coalesce_max completions are
+ * pending, or when the queue has no more requests in flight: nothing
+ * else would come to share it, so light loads keep their latency.
+ *
+ * Returns false if moderation does not apply and the caller must send
+ * the interrupt itself.
+ */
+static bool virtio_irq_moderate(VirtIODevice *vdev, VirtQueue *vq)
+{
+    AioContext *ctx;
+    unsigned int pending;
+
+    if (!vdev->irq_coalesce_usecs || !qemu_in_iothread()) {
+        if (qatomic_read(&vq->irq_mod_pending)) {
+            virtio_irq_moderation_cancel(vq);
+            qatomic_set(&vq->irq_mod_pending, 0);
+        }
+        return false;
+    }
+
+    ctx = qemu_get_current_aio_context();
+    if (vq->irq_mod_ctx != ctx) {
+        /* The queue moved to another IOThread */
+        if (vq->irq_mod_timer) {
+            timer_free(vq->irq_mod_timer);
+        }
+        vq->irq_mod_timer = aio_timer_new(ctx, QEMU_CLOCK_REALTIME, SCALE_US,
+                                          virtio_irq_moderation_timer_cb, vq);
+        vq->irq_mod_ctx = ctx;
+    }
+
+    pending = qatomic_inc_fetch(&vq->irq_mod_pending);
+    if (!vq->inuse || pending >= vdev->irq_coalesce_max) {
+        virtio_irq_moderation_cancel(vq);
+        virtio_irq_moderation_fire(vq);
+    } else if (pending == 1) {
+        timer_mod(vq->irq_mod_timer,
+                  qemu_clock_get_us(QEMU_CLOCK_REALTIME) +
+                  vdev->irq_coalesce_usecs);
+    }
+    return true;
+}
+
 void virtio_notify(VirtIODevice *vdev, VirtQueue *vq)
 {
     WITH_RCU_READ_LOCK_GUARD() {
-        if (!virtio_should_notify(vdev, vq)) {
+        /*
+         * Completions after a held back interrupt still count towards
+         * sending it, even though the guest would not need another one.
+         */
+        if (!virtio_should_notify(vdev, vq) &&
+            !qatomic_read(&vq->irq_mod_pending)) {
             return;
         }
     }
 
     trace_virtio_notify(vdev, vq);
-    virtio_irq(vq);
+    if (!virtio_irq_moderate(vdev, vq)) {
+        virtio_irq(vq);
+    }
 }
 
 void virtio_notify_config(VirtIODevice *vdev)
@@ -3838,6 +4272,10 @@ void virtio_queue_set_guest_notifier_fd_handler(VirtQueue *vq, bool assign,
         event_notifier_set_handler(&vq->guest_notifier, NULL);
     }
     if (!assign) {
+        /* Don't lose an interrupt held back by moderation */
+        virtio_irq_moderation_cancel(vq);
+        virtio_irq_moderation_fire(vq);
+
         /* Test and clear notifier before closing it,
          * in case poll callback didn't have time to run. */
         virtio_queue_guest_notifier_read(&vq->guest_notifier);
@@ -3987,7 +4425,7 @@ EventNotifier *virtio_config_get_guest_notifier(VirtIODevice *vdev)
 
 void virtio_queue_set_host_notifier_enabled(VirtQueue *vq, bool enabled)
 {
-    vq->host_notifier_enabled = enabled;
+    qatomic_set(&vq->host_notifier_enabled, enabled);
 }
 
 int virtio_queue_set_host_notifier_mr(VirtIODevice *vdev, int n,
@@ -4123,6 +4561,10 @@ static const Property virtio_properties[] = {
     DEFINE_PROP_BOOL("use-disabled-flag", VirtIODevice, use_disabled_flag, true),
     DEFINE_PROP_BOOL("x-disable-legacy-check", VirtIODevice,
                      disable_legacy_check, false),
+    DEFINE_PROP_UINT32("x-irq-coalesce-usecs", VirtIODevice,
+                       irq_coalesce_usecs, 0),
+    DEFINE_PROP_UINT32("x-irq-coalesce-max", VirtIODevice,
+                       irq_coalesce_max, 32),
 };
 
 static int virtio_device_start_ioeventfd_impl(VirtIODevice *vdev)
@@ -18,6 +18,12 @@ typedef struct AccelCPUClass {
     void (*cpu_class_init)(CPUClass *cc);
     void (*cpu_instance_init)(CPUState *cpu);
     bool (*cpu_target_realize)(CPUState *cpu, Error **errp);
+    /*
+     * The CPU does not use the accelerator state of the vCPU before
+     * the machine is ready, so cold-plugged vCPUs can finish their
+     * initialization in parallel.  See qemu_wait_vcpus_created().
+     */
+    bool parallel_vcpu_init;
 } AccelCPUClass;
 
 #endif /* ACCEL_CPU_H */
@@ -26,6 +26,7 @@
 #define BLOCK_ACCOUNTING_H
 
 #include "qemu/timed-average.h"
+#include "qemu/timed-histogram.h"
 #include "qemu/thread.h"
 #include "qapi/qapi-types-common.h"
 
@@ -45,6 +46,7 @@ enum BlockAcctType {
 struct BlockAcctTimedStats {
     BlockAcctStats *stats;
     TimedAverage latency[BLOCK_MAX_IOTYPE];
+    TimedHistogram latency_hist[BLOCK_MAX_IOTYPE];
     unsigned interval_length; /* in seconds */
     QSLIST_ENTRY(BlockAcctTimedStats) entries;
 };
@@ -118,6 +120,9 @@ void block_acct_merge_done(BlockAcctStats *stats, enum BlockAcctType type,
 int64_t block_acct_idle_time_ns(BlockAcctStats *stats);
 double block_acct_queue_depth(BlockAcctTimedStats *stats,
                               enum BlockAcctType type);
+uint64_t block_acct_latency_percentile(BlockAcctTimedStats *stats,
+                                       enum BlockAcctType type,
+                                       unsigned permille);
 int block_latency_histogram_set(BlockAcctStats *stats, enum BlockAcctType type,
                                 uint64List *boundaries);
 void block_latency_histograms_clear(BlockAcctStats *stats);
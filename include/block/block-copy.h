@@ -37,6 +37,14 @@ void block_copy_set_copy_opts(BlockCopyState *s, bool use_copy_range,
                               bool compress);
 void block_copy_set_progress_meter(BlockCopyState *s, ProgressMeter *pm);
 
+/*
+ * Let block-copy adjust chunk size and number of parallel requests to the
+ * throughput and latency of the target.  The max_workers and max_chunk
+ * limits of each call still apply.  Should be called prior any actual copy
+ * request.
+ */
+void block_copy_set_adaptive(BlockCopyState *s, bool adaptive);
+
 void block_copy_state_free(BlockCopyState *s);
 
 void block_copy_reset(BlockCopyState *s, int64_t offset, int64_t bytes);
@@ -239,6 +239,15 @@ void *qemu_blockalign0(BlockDriverState *bs, size_t size);
 void *qemu_try_blockalign(BlockDriverState *bs, size_t size);
 void *qemu_try_blockalign0(BlockDriverState *bs, size_t size);
 
+/*
+ * Like qemu_blockalign() and qemu_try_blockalign(), but reuse buffers kept
+ * by the current AioContext.  Meant for short-lived bounce buffers; free
+ * them with qemu_blockfree_pooled() and the size they were allocated with.
+ */
+void *qemu_blockalign_pooled(BlockDriverState *bs, size_t size);
+void *qemu_try_blockalign_pooled(BlockDriverState *bs, size_t size);
+void qemu_blockfree_pooled(void *ptr, size_t size);
+
 void bdrv_enable_copy_on_read(BlockDriverState *bs);
 void bdrv_disable_copy_on_read(BlockDriverState *bs);
 
@@ -367,6 +376,9 @@ bdrv_truncate(BdrvChild *child, int64_t offset, bool exact,
 int co_wrapper_mixed_bdrv_rdlock
 bdrv_check(BlockDriverState *bs, BdrvCheckResult *res, BdrvCheckMode fix);
 
+int co_wrapper_mixed_bdrv_rdlock
+bdrv_dedup(BlockDriverState *bs, int64_t *freed_bytes, Error **errp);
+
 /* Invalidate any cached metadata used by image formats */
 int co_wrapper_mixed_bdrv_rdlock
 bdrv_invalidate_cache(BlockDriverState *bs, Error **errp);
@@ -376,9 +388,13 @@ int co_wrapper_mixed_bdrv_rdlock bdrv_flush(BlockDriverState *bs);
 int co_wrapper_mixed_bdrv_rdlock
 bdrv_pdiscard(BdrvChild *child, int64_t offset, int64_t bytes);
 
+int coroutine_fn GRAPH_RDLOCK
+bdrv_co_readv_vmstate(BlockDriverState *bs, QEMUIOVector *qiov, int64_t pos);
 int co_wrapper_mixed_bdrv_rdlock
 bdrv_readv_vmstate(BlockDriverState *bs, QEMUIOVector *qiov, int64_t pos);
 
+int coroutine_fn GRAPH_RDLOCK
+bdrv_co_writev_vmstate(BlockDriverState *bs, QEMUIOVector *qiov, int64_t pos);
 int co_wrapper_mixed_bdrv_rdlock
 bdrv_writev_vmstate(BlockDriverState *bs, QEMUIOVector *qiov, int64_t pos);
 
@@ -786,6 +786,13 @@ struct BlockDriver {
     int coroutine_fn GRAPH_RDLOCK_PTR (*bdrv_co_check)(
         BlockDriverState *bs, BdrvCheckResult *result, BdrvCheckMode fix);
 
+    /*
+     * Makes clusters with identical contents share storage.  Returns 0 on
+     * success and the number of bytes released in freed_bytes.
+     */
+    int coroutine_fn GRAPH_RDLOCK_PTR (*bdrv_co_dedup)(
+        BlockDriverState *bs, int64_t *freed_bytes, Error **errp);
+
     void coroutine_fn GRAPH_RDLOCK_PTR (*bdrv_co_debug_event)(
         BlockDriverState *bs, BlkdebugEvent event);
 
@@ -1245,6 +1252,16 @@ struct BlockDriverState {
     QemuMutex dirty_bitmap_mutex;
     QLIST_HEAD(, BdrvDirtyBitmap) dirty_bitmaps;
 
+    /*
+     * bdrv_set_dirty() marks bitmaps dirty without dirty_bitmap_mutex
+     * unless dirty_bitmap_locked is set.  Whoever takes the mutex sets
+     * dirty_bitmap_locked and then waits for dirty_bitmap_writers, the
+     * number of bdrv_set_dirty() calls not using the mutex, to drop to
+     * zero.  Both are accessed with atomic operations.
+     */
+    bool dirty_bitmap_locked;
+    unsigned dirty_bitmap_writers;
+
     /* Offset after the highest byte written to */
     Stat64 wr_highest_offset;
 
@@ -55,6 +55,8 @@
  * @filter_node_name: The node name that should be assigned to the filter
  *                    driver that the stream job inserts into the graph above
  *                    @bs. NULL means that a node name should be autogenerated.
+ * @perf: Number of parallel requests and their maximum length, or %NULL
+ *        for the defaults.
  * @errp: Error object.
  *
  * Start a streaming operation on @bs.  Clusters that are unallocated
@@ -71,6 +73,7 @@ void stream_start(const char *job_id, BlockDriverState *bs,
                   int creation_flags, int64_t speed,
                   BlockdevOnError on_error,
                   const char *filter_node_name,
+                  const BlockJobCopyPerf *perf,
                   Error **errp);
 
 /**
@@ -90,6 +93,8 @@ void stream_start(const char *job_id, BlockDriverState *bs,
  * @filter_node_name: The node name that should be assigned to the filter
  * driver that the commit job inserts into the graph above @top. NULL means
  * that a node name should be autogenerated.
+ * @perf: Number of parallel requests and their maximum length, or %NULL
+ * for the defaults.
  * @errp: Error object.
  *
  */
@@ -98,7 +103,8 @@ void commit_start(const char *job_id, BlockDriverState *bs,
                   int creation_flags, int64_t speed,
                   BlockdevOnError on_error, const char *backing_file_str,
                   bool backing_mask_protocol,
-                  const char *filter_node_name, Error **errp);
+                  const char *filter_node_name,
+                  const BlockJobCopyPerf *perf, Error **errp);
 /**
  * commit_active_start:
  * @job_id: The id of the newly-created job, or %NULL to use the
@@ -162,7 +168,8 @@ void mirror_start(const char *job_id, BlockDriverState *bs,
                   bool target_is_zero,
                   BlockdevOnError on_source_error,
                   BlockdevOnError on_target_error,
-                  bool unmap, const char *filter_node_name,
+                  bool unmap, bool detect_zeroes,
+                  const char *filter_node_name,
                   MirrorCopyMode copy_mode, Error **errp);
 
 /*
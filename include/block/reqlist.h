@@ -16,22 +16,30 @@
 #define REQLIST_H
 
 #include "qemu/coroutine.h"
+#include "qemu/interval-tree.h"
 
 /*
  * The API is not thread-safe and shouldn't be. The struct is public to be part
  * of other structures and protected by third-party locks, see
  * block/block-copy.c for example.
+ *
+ * Requests are kept in an interval tree, so that looking for a conflict
+ * does not depend on the number of requests in flight.
  */
 
+typedef IntervalTreeRoot BlockReqList;
+
 typedef struct BlockReq {
     int64_t offset;
     int64_t bytes;
 
     CoQueue wait_queue; /* coroutines blocked on this req */
-    QLIST_ENTRY(BlockReq) list;
+    BlockReqList *reqs;
+    IntervalTreeNode node;
 } BlockReq;
 
-typedef QLIST_HEAD(, BlockReq) BlockReqList;
+/* Initialize an empty list. */
+void reqlist_init(BlockReqList *reqs);
 
 /*
  * Initialize new request and add it to the list. Caller must be sure that
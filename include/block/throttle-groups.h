@@ -49,6 +49,13 @@ typedef struct ThrottleGroupMember {
      */
     unsigned int restart_pending;
 
+    /* Bytes and operations already accounted in the group, which requests
+     * can use without taking the group lock while none of the requests of
+     * the group are throttled.  Accessed with atomic operations.
+     */
+    int credit_bytes[THROTTLE_MAX];
+    int credit_ops[THROTTLE_MAX];
+
     /* The following fields are protected by the ThrottleGroup lock.
      * See the ThrottleGroup documentation for details.
      * throttle_state tells us if I/O limits are configured. */
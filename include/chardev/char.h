@@ -16,6 +16,7 @@
 
 /* character device */
 typedef struct CharFrontend CharFrontend;
+typedef struct ChardevWriteBuffer ChardevWriteBuffer;
 
 typedef enum {
     CHR_EVENT_BREAK, /* serial break char */
@@ -64,6 +65,8 @@ struct Chardev {
     char *label;
     char *filename;
     int logfd;
+    /* Output buffered by the write-buffer option, NULL if unbuffered */
+    ChardevWriteBuffer *wbuf;
     int be_open;
     /* used to coordinate the chardev-change special-case: */
     bool handover_yank_instance;
@@ -255,6 +258,8 @@ struct ChardevClass {
 
     bool internal; /* TODO: eventually use TYPE_USER_CREATABLE */
     bool supports_yank;
+    /* the write-buffer option may be used */
+    bool supports_write_buffer;
 
     /* parse command line options and populate QAPI @backend */
     void (*parse)(QemuOpts *opts, ChardevBackend *backend, Error **errp);
@@ -235,4 +235,55 @@ int qcrypto_cipher_setiv(QCryptoCipher *cipher,
                          const uint8_t *iv, size_t niv,
                          Error **errp);
 
+/**
+ * qcrypto_cipher_encrypt_sectors:
+ * @cipher: the cipher object
+ * @ivs: the initialization vectors, @niv bytes for each sector
+ * @niv: the length of each initialization vector, or 0
+ * @sectorsize: the size of a sector
+ * @in: buffer holding the plain text input data
+ * @out: buffer to fill with the cipher text output data
+ * @len: the length of @in and @out buffers, a multiple of @sectorsize
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Encrypts @len bytes as consecutive sectors, each of which is
+ * encrypted on its own with the next initialization vector from
+ * @ivs.  This is equivalent to calling qcrypto_cipher_setiv()
+ * and qcrypto_cipher_encrypt() for each sector, but lets the
+ * backend process the whole request at once.  The initialization
+ * vector of @cipher is undefined afterwards.
+ *
+ * Returns: 0 on success, or -1 on error
+ */
+int qcrypto_cipher_encrypt_sectors(QCryptoCipher *cipher,
+                                   const uint8_t *ivs, size_t niv,
+                                   size_t sectorsize,
+                                   const void *in,
+                                   void *out,
+                                   size_t len,
+                                   Error **errp);
+
+/**
+ * qcrypto_cipher_decrypt_sectors:
+ * @cipher: the cipher object
+ * @ivs: the initialization vectors, @niv bytes for each sector
+ * @niv: the length of each initialization vector, or 0
+ * @sectorsize: the size of a sector
+ * @in: buffer holding the cipher text input data
+ * @out: buffer to fill with the plain text output data
+ * @len: the length of @in and @out buffers, a multiple of @sectorsize
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * The counterpart of qcrypto_cipher_encrypt_sectors().
+ *
+ * Returns: 0 on success, or -1 on error
+ */
+int qcrypto_cipher_decrypt_sectors(QCryptoCipher *cipher,
+                                   const uint8_t *ivs, size_t niv,
+                                   size_t sectorsize,
+                                   const void *in,
+                                   void *out,
+                                   size_t len,
+                                   Error **errp);
+
 #endif /* QCRYPTO_CIPHER_H */
@@ -32,6 +32,7 @@
 #define QCRYPTO_HASH_DIGEST_LEN_SHA512    64
 #define QCRYPTO_HASH_DIGEST_LEN_RIPEMD160 20
 #define QCRYPTO_HASH_DIGEST_LEN_SM3       32
+#define QCRYPTO_HASH_DIGEST_LEN_XXH64     8
 
 /* See also "QCryptoHashAlgo" defined in qapi/crypto.json */
 
@@ -339,6 +339,37 @@ typedef enum {
 int
 qcrypto_tls_session_bye(QCryptoTLSSession *session, Error **errp);
 
+/**
+ * qcrypto_tls_session_enable_ktls:
+ * @sess: the TLS session object
+ * @fd: the socket the session runs over
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Once the handshake is complete, hand the sending side of
+ * the session over to the kernel TLS implementation of @fd,
+ * if the credentials have the "kernel-offload" property set.
+ * Afterwards data written with qcrypto_tls_session_write(),
+ * or directly to @fd, is encrypted by the kernel or the NIC.
+ * Received data is still decrypted by GNUTLS.
+ *
+ * @errp is only set if offload was requested but could not
+ * be enabled, in which case the session keeps working as
+ * before.
+ *
+ * Returns: 0 if offload was enabled, -1 otherwise
+ */
+int qcrypto_tls_session_enable_ktls(QCryptoTLSSession *sess,
+                                    int fd,
+                                    Error **errp);
+
+/**
+ * qcrypto_tls_session_has_ktls:
+ * @sess: the TLS session object
+ *
+ * Returns: true if qcrypto_tls_session_enable_ktls() succeeded
+ */
+bool qcrypto_tls_session_has_ktls(QCryptoTLSSession *sess);
+
 /**
  * qcrypto_tls_session_get_key_size:
  * @sess: the TLS session object
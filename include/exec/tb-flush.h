@@ -33,6 +33,16 @@ void tb_flush__exclusive_or_serial(void);
  */
 void queue_tb_flush(CPUState *cs);
 
+/**
+ * queue_tb_reclaim() - add code buffer reclaim to the cpu work queue
+ * @cs: CPUState
+ *
+ * Like queue_tb_flush(), but only invalidate the translation blocks held
+ * in the oldest regions of the code generation buffer, falling back to a
+ * full flush when that is not possible.  Used when the buffer is full.
+ */
+void queue_tb_reclaim(CPUState *cs);
+
 void tcg_flush_jmp_cache(CPUState *cs);
 
 #endif /* _TB_FLUSH_H_ */
@@ -43,6 +43,21 @@ struct tb_tc {
     size_t size;
 };
 
+/*
+ * Per-TB code quality metrics, reported by "info jit-tbs".  The code
+ * generation counts are filled in by tcg_gen_code; exec_count is only
+ * maintained for TBs translated while the "tb-profile" accelerator
+ * property is on, and is updated without atomics, so under MTTCG it is
+ * a close approximation rather than an exact count.
+ */
+typedef struct TBProfile {
+    uint64_t exec_count;
+    uint32_t spills;    /* registers evicted by the register allocator */
+    uint16_t calls;     /* helper calls */
+    uint16_t exit_tb;   /* exits back to the main loop */
+    uint16_t goto_ptr;  /* indirect exits through lookup_and_goto_ptr */
+} TBProfile;
+
 struct TranslationBlock {
     /*
      * Guest PC corresponding to this block.  This must be the true
@@ -146,6 +161,8 @@ struct TranslationBlock {
     uintptr_t jmp_list_head;
     uintptr_t jmp_list_next[2];
     uintptr_t jmp_dest[2];
+
+    TBProfile prof;
 };
 
 /* The alignment given to TranslationBlock during allocation. */
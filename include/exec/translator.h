@@ -159,6 +159,22 @@ void translator_loop(CPUState *cpu, TranslationBlock *tb, int *max_insns,
  */
 bool translator_use_goto_tb(DisasContextBase *db, vaddr dest);
 
+/**
+ * translator_lookup_and_goto_ptr_cached
+ * @db: Disassembly context
+ * @pc: target pc of the jump, as returned by get_tb_cpu_state
+ * @cs_base: cs_base of the CPU state after the jump
+ * @flags: flags of the CPU state after the jump
+ *
+ * Like tcg_gen_lookup_and_goto_ptr(), for an indirect jump after which
+ * only the pc can differ from the state described by @cs_base and @flags.
+ * The jump site gets an inline cache of its last target TB, so that
+ * jumping to it again does not need to call out to the lookup helper.
+ */
+void translator_lookup_and_goto_ptr_cached(DisasContextBase *db,
+                                           struct TCGv_i64_d *pc,
+                                           uint64_t cs_base, uint32_t flags);
+
 /**
  * translator_io_start
  * @db: Disassembly context
@@ -207,6 +207,9 @@ typedef uint32_t MMUIdxMap;
 /* Use a fully associative victim tlb of 8 entries. */
 #define CPU_VTLB_SIZE 8
 
+/* Remember up to 8 large page translations per mmu mode. */
+#define CPU_LTLB_SIZE 8
+
 /*
  * The full TLB entry, which is not accessed by generated TCG code,
  * so the layout is not as critical as that of CPUTLBEntry. This is
@@ -293,6 +296,16 @@ typedef struct CPUTLBDesc {
     /* The tlb victim table, in two parts.  */
     CPUTLBEntry vtable[CPU_VTLB_SIZE];
     CPUTLBEntryFull vfulltlb[CPU_VTLB_SIZE];
+    /* The next index to use in the large page table.  */
+    size_t lindex;
+    /*
+     * The large page table, in two parts: the base virtual address of
+     * each large page (-1 if unused) and its translation as returned by
+     * tlb_fill, with @phys_addr adjusted to the base of the page.  Every
+     * entry lies within the large_page_addr/mask region above.
+     */
+    vaddr ltable[CPU_LTLB_SIZE];
+    CPUTLBEntryFull lfulltlb[CPU_LTLB_SIZE];
     CPUTLBEntryFull *fulltlb;
 } CPUTLBDesc;
 
@@ -316,6 +329,10 @@ typedef struct CPUTLBCommon {
     size_t full_flush_count;
     size_t part_flush_count;
     size_t elide_flush_count;
+    size_t large_hit_count;
+    size_t coalesced_flush_count;
+    /* Flushes queued by other cpus, see tlb_queue_flush. */
+    struct CPUTLBPending *pending;
 } CPUTLBCommon;
 
 /*
@@ -547,6 +564,9 @@ struct CPUState {
     struct kvm_dirty_gfn *kvm_dirty_gfns;
     uint32_t kvm_fetch_index;
     uint64_t dirty_pages;
+    /* dirty_pages at the last sample, and rolling rate in bytes/s */
+    uint64_t dirty_pages_sampled;
+    uint64_t dirty_rate;
     int kvm_vcpu_stats_fd;
 
     /* Use by accel-block: CPU is executing an ioctl() */
@@ -1157,4 +1157,14 @@ typedef enum MachineInitPhase {
 bool phase_check(MachineInitPhase phase);
 void phase_advance(MachineInitPhase phase);
 
+/**
+ * phase_log_startup_time:
+ *
+ * With "-d startup", log when each machine init phase was reached,
+ * relative to the start of the process, and the time spent until now.
+ * Only the first call does anything; it is made when the guest first
+ * starts running.
+ */
+void phase_log_startup_time(void);
+
 #endif
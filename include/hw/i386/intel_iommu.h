@@ -24,6 +24,7 @@
 
 #include "hw/i386/x86-iommu.h"
 #include "qemu/iova-tree.h"
+#include "system/iommu-tlb.h"
 #include "qom/object.h"
 
 #define TYPE_INTEL_IOMMU_DEVICE "intel-iommu"
@@ -113,6 +114,7 @@ struct VTDAddressSpace {
     IntelIOMMUState *iommu_state;
     VTDContextCacheEntry context_cache_entry;
     VTDPASIDCacheEntry pasid_cache_entry;
+    IOMMUTLBMRU iotlb_mru;      /* Last translation, see vtd_iotlb_gen_bump */
     QLIST_ENTRY(VTDAddressSpace) next;
     /* Superset of notifier flags that this address space has */
     IOMMUNotifierFlag notifier_flags;
@@ -157,6 +159,7 @@ struct VTDAddressSpace {
 };
 
 struct VTDIOTLBEntry {
+    IOMMURangeTLBEntry tlb;
     uint64_t gfn;
     uint16_t domain_id;
     uint32_t pasid;
@@ -295,7 +298,8 @@ struct IntelIOMMUState {
     uint64_t ecap;                  /* The value of extended capability reg */
 
     uint32_t context_cache_gen;     /* Should be in [1,MAX] */
-    GHashTable *iotlb;              /* IOTLB */
+    IOMMURangeTLB iotlb;            /* IOTLB */
+    unsigned iotlb_gen;             /* Generation of VTDAddressSpace MRUs */
 
     GHashTable *vtd_address_spaces;             /* VTD address spaces */
     VTDAddressSpace *vtd_as_cache[VTD_PCI_BUS_MAX]; /* VTD address space cache */
@@ -21,6 +21,9 @@ void msix_uninit(PCIDevice *dev, MemoryRegion *table_bar,
                  MemoryRegion *pba_bar);
 void msix_uninit_exclusive_bar(PCIDevice *dev);
 
+/* Access the MSI-X table and PBA without taking the BQL for reads */
+void msix_enable_lockless_io(PCIDevice *dev);
+
 unsigned int msix_nr_vectors_allocated(const PCIDevice *dev);
 
 void msix_save(PCIDevice *dev, QEMUFile *f);
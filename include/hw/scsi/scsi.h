@@ -209,6 +209,13 @@ SCSIRequest *scsi_req_alloc(const SCSIReqOps *reqops, SCSIDevice *d,
 SCSIRequest *scsi_req_new(SCSIDevice *d, uint32_t tag, uint32_t lun,
                           uint8_t *buf, size_t buf_len, void *hba_private);
 int32_t scsi_req_enqueue(SCSIRequest *req);
+/*
+ * Enqueue @n requests and start those that transfer data, i.e. call
+ * scsi_req_continue() if scsi_req_enqueue() would have returned nonzero.
+ * Consecutive requests for the same device are added to its list of
+ * requests at once.
+ */
+void scsi_req_enqueue_batch(SCSIRequest **reqs, unsigned int n);
 SCSIRequest *scsi_req_ref(SCSIRequest *req);
 void scsi_req_unref(SCSIRequest *req);
 
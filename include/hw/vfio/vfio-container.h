@@ -40,6 +40,8 @@ struct VFIOContainer {
     MemoryListener listener;
     Error *error;
     bool initialized;
+    /* RAM mappings queued while the listener is registered */
+    GArray *dma_map_batch;
     uint64_t dirty_pgsizes;
     uint64_t max_dirty_bitmap_size;
     unsigned long pgsizes;
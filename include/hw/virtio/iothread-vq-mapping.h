@@ -10,7 +10,7 @@
 #define HW_VIRTIO_IOTHREAD_VQ_MAPPING_H
 
 #include "qapi/error.h"
-#include "qapi/qapi-types-virtio.h"
+#include "qapi/qapi-types-common.h"
 
 /**
  * iothread_vq_mapping_apply:
@@ -164,6 +164,9 @@ typedef int (*vhost_set_device_state_fd_op)(struct vhost_dev *dev,
                                             Error **errp);
 typedef int (*vhost_check_device_state_op)(struct vhost_dev *dev, Error **errp);
 
+typedef void (*vhost_batch_begin_op)(struct vhost_dev *dev);
+typedef int (*vhost_batch_end_op)(struct vhost_dev *dev);
+
 typedef struct VhostOps {
     VhostBackendType backend_type;
     vhost_backend_init vhost_backend_init;
@@ -220,6 +223,8 @@ typedef struct VhostOps {
     vhost_supports_device_state_op vhost_supports_device_state;
     vhost_set_device_state_fd_op vhost_set_device_state_fd;
     vhost_check_device_state_op vhost_check_device_state;
+    vhost_batch_begin_op vhost_batch_begin;
+    vhost_batch_end_op vhost_batch_end;
 } VhostOps;
 
 int vhost_backend_update_device_iotlb(struct vhost_dev *dev,
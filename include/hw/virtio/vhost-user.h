@@ -32,6 +32,7 @@ enum VhostUserProtocolFeature {
     /* Feature 17 reserved for VHOST_USER_PROTOCOL_F_XEN_MMAP. */
     VHOST_USER_PROTOCOL_F_SHARED_OBJECT = 18,
     VHOST_USER_PROTOCOL_F_DEVICE_STATE = 19,
+    VHOST_USER_PROTOCOL_F_PIPELINED_REPLY = 20,
     VHOST_USER_PROTOCOL_F_MAX
 };
 
@@ -62,12 +63,19 @@ typedef struct VhostUserHostNotifier {
  * @chr: the character backend for the socket
  * @notifiers: GPtrArray of @VhostUserHostnotifier
  * @memory_slots:
+ * @pending_replies: GArray of the requests whose reply has not been read
+ *   yet, see vhost_user_batch_begin()
+ * @batch_depth: nesting depth of the current batch
+ * @batch_ret: first error reported by a reply read during the batch
  */
 typedef struct VhostUserState {
     CharFrontend *chr;
     GPtrArray *notifiers;
     int memory_slots;
     bool supports_config;
+    GArray *pending_replies;
+    unsigned int batch_depth;
+    int batch_ret;
 } VhostUserState;
 
 /**
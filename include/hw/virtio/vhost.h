@@ -84,6 +84,7 @@ struct vhost_dev {
     int n_mem_sections;
     MemoryRegionSection *mem_sections;
     int n_tmp_sections;
+    int tmp_sections_alloc;
     MemoryRegionSection *tmp_sections;
     struct vhost_virtqueue *vqs;
     unsigned int nvqs;
@@ -73,6 +73,11 @@ struct VirtIOBalloon {
     bool qemu_4_0_config_size;
     uint32_t poison_val;
 
+    /* Free page reporting, only accessed with the BQL held */
+    bool free_page_report_inflight;
+    uint64_t free_page_report_bytes;
+    uint64_t free_page_report_ns;
+
     /* State of the resettable container */
     ResettableState reset_state;
 };
@@ -41,6 +41,7 @@ struct VirtIOBlkConf
     IOThreadVirtQueueMappingList *iothread_vq_mapping_list;
     char *serial;
     uint32_t request_merging;
+    bool request_merging_across_queues;
     uint16_t num_queues;
     uint16_t queue_size;
     bool seg_max_adjust;
@@ -51,6 +52,7 @@ struct VirtIOBlkConf
 };
 
 struct VirtIOBlockReq;
+struct VirtIOBlockElevator;
 struct VirtIOBlock {
     VirtIODevice parent_obj;
     BlockBackend *blk;
@@ -71,6 +73,13 @@ struct VirtIOBlock {
      */
     AioContext **vq_aio_context;
 
+    /*
+     * With request_merging_across_queues, one per distinct AioContext in
+     * vq_aio_context
+     */
+    struct VirtIOBlockElevator *elevators;
+    unsigned int num_elevators;
+
     uint64_t host_features;
     size_t config_size;
     BlockRAMRegistrar blk_ram_registrar;
@@ -26,6 +26,7 @@
 #include "qom/object.h"
 #include "qapi/qapi-types-virtio.h"
 #include "system/host_iommu_device.h"
+#include "system/iommu-tlb.h"
 
 #define TYPE_VIRTIO_IOMMU "virtio-iommu-device"
 #define TYPE_VIRTIO_IOMMU_PCI "virtio-iommu-pci"
@@ -43,6 +44,7 @@ typedef struct IOMMUDevice {
     MemoryRegion bypass_mr;     /* The alias of shared memory MR */
     GList *resv_regions;
     GList *host_resv_ranges;
+    IOMMUTLBMRU iotlb_mru;
 } IOMMUDevice;
 
 typedef struct IOMMUPciBus {
@@ -65,6 +67,8 @@ struct VirtIOIOMMU {
     GTree *domains;
     QemuRecMutex mutex;
     GTree *endpoints;
+    /* Generation of the translations cached in IOMMUDevice.iotlb_mru */
+    unsigned tlb_gen;
     bool boot_bypass;
     Notifier machine_done;
     bool granule_frozen;
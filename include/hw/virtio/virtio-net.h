@@ -18,8 +18,10 @@
 #include "standard-headers/linux/virtio_net.h"
 #include "hw/virtio/virtio.h"
 #include "net/announce.h"
+#include "net/gso.h"
 #include "qemu/option_int.h"
 #include "qom/object.h"
+#include "qapi/qapi-types-common.h"
 
 #include "ebpf/ebpf_rss.h"
 
@@ -165,6 +167,11 @@ typedef struct VirtIONetQueue {
         VirtQueueElement *elem;
     } async_tx;
     struct VirtIONet *n;
+    /* the backend is delivering a burst, notify once at its end */
+    bool rx_batching;
+    bool rx_notify_pending;
+    /* coalescing of received TCP segments, with x-sw-offload */
+    NetGRO *gro;
 } VirtIONetQueue;
 
 struct VirtIONet {
@@ -219,6 +226,8 @@ struct VirtIONet {
     AnnounceTimer announce_timer;
     bool needs_vnet_hdr_swap;
     bool mtu_bypass_backend;
+    /* offer offloads the peer lacks, and do them in software */
+    bool sw_offload;
     /* primary failover device is hidden*/
     bool failover_primary_hidden;
     bool failover;
@@ -231,6 +240,12 @@ struct VirtIONet {
     struct EBPFRSSContext ebpf_rss;
     uint32_t nr_ebpf_rss_fds;
     char **ebpf_rss_fds;
+    IOThreadVirtQueueMappingList *iothread_vq_mapping_list;
+    /* AioContext of each queue pair, only set with iothread-vq-mapping */
+    AioContext **vq_aio_context;
+    bool dataplane_started;
+    /* queue pairs and their backends are running in vq_aio_context */
+    bool dataplane_attached;
 };
 
 size_t virtio_net_handle_ctrl_iov(VirtIODevice *vdev,
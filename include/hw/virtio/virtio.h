@@ -63,6 +63,9 @@ typedef struct VirtQueue VirtQueue;
 
 #define VIRTQUEUE_MAX_SIZE 1024
 
+/* Elements devices pop at once with virtqueue_pop_batch() */
+#define VIRTQUEUE_POP_BATCH 32
+
 typedef struct VirtQueueElement
 {
     unsigned int index;
@@ -72,6 +75,8 @@ typedef struct VirtQueueElement
     unsigned int in_num;
     /* Element has been processed (VIRTIO_F_IN_ORDER) */
     bool in_order_filled;
+    /* Pool the element was taken from, NULL if it was g_malloc()ed */
+    struct VirtQueueElementPool *pool;
     hwaddr *in_addr;
     hwaddr *out_addr;
     struct iovec *in_sg;
@@ -151,6 +156,13 @@ struct VirtIODevice
     bool start_on_kick; /* when virtio 1.0 feature has not been negotiated */
     bool disable_legacy_check;
     bool vhost_started;
+    /*
+     * Interrupt moderation for queues served by IOThreads: longest delay
+     * of an interrupt in microseconds (0 disables moderation), and number
+     * of coalesced completions after which it is sent anyway
+     */
+    uint32_t irq_coalesce_usecs;
+    uint32_t irq_coalesce_max;
     VMChangeStateEntry *vmstate;
     char *bus_name;
     uint8_t device_endian;
@@ -280,6 +292,24 @@ void virtqueue_fill(VirtQueue *vq, const VirtQueueElement *elem,
 
 void virtqueue_map(VirtIODevice *vdev, VirtQueueElement *elem);
 void *virtqueue_pop(VirtQueue *vq, size_t sz);
+/*
+ * Like virtqueue_pop(), but the element is taken from a pool the queue
+ * keeps for elements of size @sz, unless its descriptor chain is too
+ * long.  Such elements must be released with virtqueue_element_release()
+ * rather than g_free().
+ */
+void *virtqueue_pop_pooled(VirtQueue *vq, size_t sz);
+/* Free an element, whether it was taken from a pool or not */
+void virtqueue_element_release(void *elem);
+/*
+ * Pop up to @max elements into @elems, reading the avail index only once.
+ * If @coalesce is true, descriptors that are contiguous in guest memory
+ * are mapped together, so the device must not depend on the framing of
+ * the buffers.  The elements are pooled as with virtqueue_pop_pooled().
+ * Returns the number of elements popped.
+ */
+unsigned int virtqueue_pop_batch(VirtQueue *vq, size_t sz, void **elems,
+                                 unsigned int max, bool coalesce);
 unsigned int virtqueue_drop_all(VirtQueue *vq);
 void *qemu_get_virtqueue_element(VirtIODevice *vdev, QEMUFile *f, size_t sz);
 void qemu_put_virtqueue_element(VirtIODevice *vdev, QEMUFile *f,
@@ -320,6 +350,13 @@ void virtio_notify_config(VirtIODevice *vdev);
 
 bool virtio_queue_get_notification(VirtQueue *vq);
 void virtio_queue_set_notification(VirtQueue *vq, int enable);
+/*
+ * With VIRTIO_F_IN_ORDER and a packed ring, flush each batch of in-order
+ * elements as a single used descriptor.  The driver then cannot know the
+ * length of all but the last buffer, so only enable this for queues whose
+ * elements are always completed with the full length of their in buffers.
+ */
+void virtio_queue_set_in_order_batch(VirtQueue *vq, bool enable);
 
 int virtio_queue_ready(VirtQueue *vq);
 
@@ -365,6 +402,12 @@ void virtio_queue_update_rings(VirtIODevice *vdev, int n);
 void virtio_init_region_cache(VirtIODevice *vdev, int n);
 void virtio_queue_set_align(VirtIODevice *vdev, int n, int align);
 void virtio_queue_notify(VirtIODevice *vdev, int n);
+/*
+ * Notify queue @n through its host notifier, without the BQL.  Returns
+ * false if the queue has no host notifier and virtio_queue_notify() must
+ * be called with the BQL held instead.
+ */
+bool virtio_queue_notify_host(VirtIODevice *vdev, int n);
 uint16_t virtio_queue_vector(VirtIODevice *vdev, int n);
 void virtio_queue_set_vector(VirtIODevice *vdev, int n, uint16_t vector);
 int virtio_queue_set_host_notifier_mr(VirtIODevice *vdev, int n,
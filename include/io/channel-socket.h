@@ -29,6 +29,7 @@
 #define TYPE_QIO_CHANNEL_SOCKET "qio-channel-socket"
 OBJECT_DECLARE_SIMPLE_TYPE(QIOChannelSocket, QIO_CHANNEL_SOCKET)
 
+typedef struct QIOChannelSocketSendQueue QIOChannelSocketSendQueue;
 
 /**
  * QIOChannelSocket:
@@ -55,6 +56,8 @@ struct QIOChannelSocket {
      * zerocopy since the last qio_channel_socket_flush() call.
      */
     bool new_zero_copy_sent_success;
+    /* See qio_channel_socket_enable_send_queue() */
+    QIOChannelSocketSendQueue *send_queue;
 };
 
 
@@ -281,4 +284,81 @@ int qio_channel_socket_set_send_buffer(QIOChannelSocket *ioc,
                                        size_t size,
                                        Error **errp);
 
+/**
+ * qio_channel_socket_enable_zero_copy:
+ * @ioc: the socket channel object
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Enable MSG_ZEROCOPY on a connected socket, e.g. one returned by
+ * qio_channel_socket_accept(), so that QIO_CHANNEL_WRITE_FLAG_ZERO_COPY
+ * can be used for writes.
+ *
+ * Returns: 0 on success, or -1 if zero copy is not supported by the host
+ */
+int qio_channel_socket_enable_zero_copy(QIOChannelSocket *ioc,
+                                        Error **errp);
+
+/**
+ * qio_channel_socket_reap_zero_copy:
+ * @ioc: the socket channel object
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Process the zero copy completion notifications that are already
+ * queued on the socket, without blocking.  Afterwards, the buffers of
+ * the first @ioc->zero_copy_sent zero copy writes may be reused.
+ *
+ * This is a non-blocking alternative to qio_channel_flush() for
+ * callers that keep track of their own buffers.
+ *
+ * Returns: 0 on success, or -1 on error
+ */
+int qio_channel_socket_reap_zero_copy(QIOChannelSocket *ioc,
+                                      Error **errp);
+
+/**
+ * qio_channel_socket_enable_send_queue:
+ * @ioc: the socket channel object
+ * @depth: maximum number of writes on the queue
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Send the writes to a connected socket through an io_uring, so that
+ * a write returns once it is queued and the caller can prepare the
+ * next one while the data is being sent.  Up to @depth writes are
+ * kept on the queue; a write blocks while the queue is full.
+ *
+ * Writes with QIO_CHANNEL_WRITE_FLAG_ZERO_COPY are sent from the
+ * caller's buffers, and their zero copy notifications are read from
+ * the ring instead of the socket error queue.  The data of other
+ * writes is copied when they are queued.  Writing file descriptors is
+ * not supported.
+ *
+ * Writes queued while earlier ones are being sent are only submitted
+ * once these complete, by a later write or by
+ * qio_channel_socket_submit_send_queue() or qio_channel_flush().
+ * Errors of queued writes are reported by a later call of any of
+ * these functions.
+ *
+ * Returns: 0 on success, or -1 if send queues are not supported by
+ * the host
+ */
+int qio_channel_socket_enable_send_queue(QIOChannelSocket *ioc,
+                                         unsigned int depth,
+                                         Error **errp);
+
+/**
+ * qio_channel_socket_submit_send_queue:
+ * @ioc: the socket channel object
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Start sending all the writes that are on the send queue of @ioc,
+ * waiting for the ones that are being sent first if needed.  This must
+ * be called before the caller stops writing for a while, e.g. before
+ * it waits for more data to send.
+ *
+ * Returns: 0 on success (also if @ioc has no send queue), or -1 if a
+ * queued write failed
+ */
+int qio_channel_socket_submit_send_queue(QIOChannelSocket *ioc,
+                                         Error **errp);
+
 #endif /* QIO_CHANNEL_SOCKET_H */
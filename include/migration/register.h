@@ -261,13 +261,15 @@ typedef struct SaveVMHandlers {
      * Load device state buffer provided to qemu_loadvm_load_state_buffer().
      *
      * @opaque: data pointer passed to register_savevm_live()
-     * @buf: the data buffer to load
+     * @buf: pointer to the data buffer to load, allocated with g_malloc().
+     *       The handler may keep the buffer instead of copying it by setting
+     *       *@buf to NULL, it is then responsible for freeing it.
      * @len: the data length in buffer
      * @errp: pointer to Error*, to store an error if it happens.
      *
      * Returns true to indicate success and false for errors.
      */
-    bool (*load_state_buffer)(void *opaque, char *buf, size_t len,
+    bool (*load_state_buffer)(void *opaque, char **buf, size_t len,
                               Error **errp);
 
     /**
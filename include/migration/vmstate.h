@@ -221,6 +221,14 @@ struct VMStateDescription {
     bool (*pre_load_errp)(void *opaque, Error **errp);
     int (*post_load)(void *opaque, int version_id);
     bool (*post_load_errp)(void *opaque, int version_id, Error **errp);
+    /*
+     * Post-load work that only touches the device itself, called after
+     * post_load/post_load_errp.  When loading an incoming migration, it
+     * runs on a worker thread without the BQL, concurrently with the load
+     * of the rest of the state, and the VM does not start before all of
+     * them are done.  Otherwise it is called right away.
+     */
+    bool (*post_load_async)(void *opaque, int version_id, Error **errp);
     int (*pre_save)(void *opaque);
     bool (*pre_save_errp)(void *opaque, Error **errp);
     int (*post_save)(void *opaque);
@@ -27,6 +27,12 @@ struct iovec;
 #define CSUM_ALL    (CSUM_IP | CSUM_TCP | CSUM_UDP)
 
 uint32_t net_checksum_add_cont(int len, uint8_t *buf, int seq);
+/*
+ * Switch net_checksum_add_cont() to the next less optimized version,
+ * returning false if the generic version is already in use.  For
+ * tests and benchmarks only.
+ */
+bool test_net_checksum_next_accel(void);
 uint16_t net_checksum_finish(uint32_t sum);
 uint16_t net_checksum_tcpudp(uint16_t length, uint16_t proto,
                              uint8_t *addrs, uint8_t *buf);
@@ -108,4 +114,30 @@ void net_toeplitz_add(uint32_t *result,
     *result = accumulator;
 }
 
+/* Size of the RSS hash key of the emulated NICs */
+#define NET_TOEPLITZ_KEY_SIZE   40
+/* Longest RSS hash input: two IPv6 addresses and two ports */
+#define NET_TOEPLITZ_MAX_INPUT  36
+
+/*
+ * A Toeplitz hash key, prepared for net_toeplitz_hash().  The key bits
+ * that apply to each 8 bytes of input are kept in reverse bit order, so
+ * that the hash of 8 bytes is the middle of their carry-less product.
+ */
+typedef struct NetToeplitzTable {
+    uint8_t key[NET_TOEPLITZ_KEY_SIZE];
+    uint64_t lo[DIV_ROUND_UP(NET_TOEPLITZ_MAX_INPUT, 8)];
+    uint64_t hi[DIV_ROUND_UP(NET_TOEPLITZ_MAX_INPUT, 8)];
+} NetToeplitzTable;
+
+void net_toeplitz_table_init(NetToeplitzTable *table, const uint8_t *key);
+/* Same as net_toeplitz_add() from 0 for up to NET_TOEPLITZ_MAX_INPUT bytes */
+uint32_t net_toeplitz_hash(const NetToeplitzTable *table,
+                           const uint8_t *input, size_t len);
+/*
+ * Switch net_toeplitz_hash() to the bit by bit version, returning false
+ * if it is already in use.  For tests and benchmarks only.
+ */
+bool test_net_toeplitz_next_accel(void);
+
 #endif /* QEMU_NET_CHECKSUM_H */
@@ -56,6 +56,9 @@ struct NetFilterState {
     char *netdev_id;
     NetClientState *netdev;
     NetFilterDirection direction;
+    /* queue of a multiqueue netdev the filter is attached to */
+    bool has_queue_index;
+    uint32_t queue_index;
     bool on;
     char *position;
     bool insert_before_flag;
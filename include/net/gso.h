@@ -0,0 +1,90 @@
+/*
+ * Software TCP segmentation and receive coalescing
+ *
+ * Copyright (c) 2026 The QEMU Project Developers
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef QEMU_NET_GSO_H
+#define QEMU_NET_GSO_H
+
+#include "net/queue.h"
+#include "standard-headers/linux/virtio_net.h"
+
+/*
+ * These let a NIC model offer checksum and TCP segmentation offloads to
+ * the guest even though its peer cannot take a virtio-net header: the
+ * offloads are described with a virtio-net header, whose fields are in
+ * host byte order here, and performed in software at the boundary.
+ */
+
+/* Most segments a single packet may be split into */
+#define NET_GSO_MAX_SEGS 1024
+
+typedef struct NetGSOSegments {
+    NetBatchPacket *pkts;
+    int count;
+
+    /* private */
+    struct iovec *iov;
+    uint8_t *hdrs;
+} NetGSOSegments;
+
+/**
+ * net_gso_segment:
+ * @hdr: offloads requested for the packet
+ * @pkt: Ethernet frame
+ * @size: size of @pkt
+ * @segs: filled in with the resulting frames
+ *
+ * Split a TCP packet into segments of at most @hdr->gso_size bytes of
+ * payload, and fill in the checksums requested by @hdr.  The segments
+ * point into @pkt, which must outlive them; release them with
+ * net_gso_segments_free().
+ *
+ * Returns: false if @hdr does not describe @pkt, or asks for offloads
+ * that are not supported.
+ */
+bool net_gso_segment(const struct virtio_net_hdr *hdr, uint8_t *pkt,
+                     size_t size, NetGSOSegments *segs);
+void net_gso_segments_free(NetGSOSegments *segs);
+
+/*
+ * Called with the frame resulting from coalescing, and the offloads the
+ * receiver has to be told about.
+ */
+typedef void (NetGROFlush)(void *opaque, const struct virtio_net_hdr *hdr,
+                           const uint8_t *pkt, size_t size);
+
+typedef struct NetGRO NetGRO;
+
+NetGRO *net_gro_new(NetGROFlush *flush, void *opaque);
+void net_gro_free(NetGRO *gro);
+
+/* Which of IPv4 and IPv6 TCP segments to coalesce, none by default */
+void net_gro_set_offloads(NetGRO *gro, bool tcp4, bool tcp6);
+
+/**
+ * net_gro_receive:
+ * @gro: coalescing context
+ * @pkt: Ethernet frame
+ * @size: size of @pkt
+ *
+ * Coalesce @pkt with the segments received before it, if it belongs to
+ * the same TCP flow and directly follows them.
+ *
+ * Returns: true if @pkt was taken, false if it has to be delivered as
+ * is.  In that case the packet being coalesced was flushed first, so
+ * that ordering is preserved.
+ */
+bool net_gro_receive(NetGRO *gro, const uint8_t *pkt, size_t size);
+
+/* Size of the frame being coalesced, 0 if none */
+size_t net_gro_pending(NetGRO *gro);
+
+/* Hand the frame being coalesced, if any, to the flush callback */
+void net_gro_flush(NetGRO *gro);
+
+#endif /* QEMU_NET_GSO_H */
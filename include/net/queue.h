@@ -44,7 +44,30 @@ typedef ssize_t (NetQueueDeliverFunc)(NetClientState *sender,
                                       int iovcnt,
                                       void *opaque);
 
-NetQueue *qemu_new_net_queue(NetQueueDeliverFunc *deliver, void *opaque);
+/* One packet of a burst */
+typedef struct NetBatchPacket {
+    const struct iovec *iov;
+    int iovcnt;
+} NetBatchPacket;
+
+/*
+ * Returns the number of packets consumed, i.e. delivered or discarded.
+ * Delivery stopped at the first packet that has to be queued for future
+ * redelivery, if that is less than @count.
+ */
+typedef int (NetQueueDeliverBatchFunc)(NetClientState *sender,
+                                       unsigned flags,
+                                       const NetBatchPacket *pkts,
+                                       int count,
+                                       void *opaque);
+
+/*
+ * @deliver_batch is optional, bursts are delivered one packet at a time
+ * through @deliver without it.
+ */
+NetQueue *qemu_new_net_queue(NetQueueDeliverFunc *deliver,
+                             NetQueueDeliverBatchFunc *deliver_batch,
+                             void *opaque);
 
 void qemu_net_queue_append_iov(NetQueue *queue,
                                NetClientState *sender,
@@ -73,6 +96,13 @@ ssize_t qemu_net_queue_send_iov(NetQueue *queue,
                                 int iovcnt,
                                 NetPacketSent *sent_cb);
 
+int qemu_net_queue_send_batch(NetQueue *queue,
+                              NetClientState *sender,
+                              unsigned flags,
+                              const NetBatchPacket *pkts,
+                              int count,
+                              NetPacketSent *sent_cb);
+
 void qemu_net_queue_purge(NetQueue *queue, NetClientState *from);
 bool qemu_net_queue_flush(NetQueue *queue);
 
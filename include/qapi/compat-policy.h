@@ -42,4 +42,14 @@ Visitor *qobject_input_visitor_new_qmp(QObject *obj);
  */
 Visitor *qobject_output_visitor_new_qmp(QObject **result);
 
+/*
+ * Create an output visitor for the return value of a command with
+ * QCO_STREAM_OUTPUT
+ *
+ * This is like qobject_output_visitor_new_qmp(), except that when the
+ * dispatcher streams the reply, it writes the JSON text directly and
+ * leaves @result null.
+ */
+Visitor *qmp_output_visitor_new_stream(QObject **result);
+
 #endif
@@ -0,0 +1,35 @@
+/*
+ * JSON Output Visitor
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#ifndef JSON_OUTPUT_VISITOR_H
+#define JSON_OUTPUT_VISITOR_H
+
+#include "qapi/visitor.h"
+
+typedef struct JSONOutputVisitor JSONOutputVisitor;
+
+/**
+ * Create a JSON output visitor writing to @writer
+ *
+ * A JSON output visitor visit writes the JSON text for a QAPI object
+ * to @writer as it goes, without building a QObject first.  Output is
+ * the same as with qobject_output_visitor_new() and qobject_to_json(),
+ * except that the members of an object appear in the order they are
+ * visited.
+ *
+ * The visit adds a single value to @writer, named @name if @writer is
+ * in an object.  The name passed to the visit of the root is ignored,
+ * as it usually is meaningless.
+ *
+ * visit_complete() checks that the visit is finished; its @opaque
+ * argument is ignored.  Errors are not expected to happen.
+ *
+ * The caller is responsible for freeing the visitor with
+ * visit_free().
+ */
+Visitor *json_output_visitor_new(JSONWriter *writer, const char *name);
+
+#endif
@@ -25,6 +25,7 @@ typedef enum QmpCommandOptions
     QCO_ALLOW_OOB             =  (1U << 1),
     QCO_ALLOW_PRECONFIG       =  (1U << 2),
     QCO_COROUTINE             =  (1U << 3),
+    QCO_STREAM_OUTPUT         =  (1U << 4),
 } QmpCommandOptions;
 
 typedef struct QmpCommand
@@ -57,6 +58,26 @@ bool qmp_has_success_response(const QmpCommand *cmd);
 QDict *qmp_error_response(Error *err);
 QDict *coroutine_mixed_fn qmp_dispatch(const QmpCommandList *cmds, QObject *request,
                                        bool allow_oob, Monitor *cur_mon);
+
+/*
+ * The successful reply of a command with QCO_STREAM_OUTPUT is written
+ * to @writer while its return value is visited, instead of being built
+ * as a QObject first.  @done is called once the reply is complete.
+ */
+typedef struct QmpReplyStream QmpReplyStream;
+struct QmpReplyStream {
+    JSONWriter *writer;
+    void (*done)(QmpReplyStream *stream);
+    /* Private to the dispatcher */
+    QObject *id;
+    bool started;
+};
+
+QDict *coroutine_mixed_fn qmp_dispatch_stream(const QmpCommandList *cmds,
+                                              QObject *request,
+                                              bool allow_oob,
+                                              Monitor *cur_mon,
+                                              QmpReplyStream *stream);
 bool qmp_is_oob(const QDict *dict);
 
 typedef void (*qmp_cmd_callback_fn)(const QmpCommand *cmd, void *opaque);
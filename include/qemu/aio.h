@@ -21,8 +21,10 @@
 #include "qemu/queue.h"
 #include "qemu/event_notifier.h"
 #include "qemu/lockcnt.h"
+#include "qemu/stats64.h"
 #include "qemu/thread.h"
 #include "qemu/timer.h"
+#include "qemu/units.h"
 
 struct MemReentrancyGuard;
 
@@ -194,10 +196,29 @@ struct BHListSlice {
 
 typedef QSLIST_HEAD(, AioHandler) AioHandlerSList;
 
+/* See aio_context_set_poll_group() */
+typedef struct AioPollGroup AioPollGroup;
+
 typedef struct AioPolledEvent {
     int64_t ns;        /* current polling time in nanoseconds */
 } AioPolledEvent;
 
+/* Buffer sizes kept by AioBufPool: 4 KiB, 8 KiB, ..., 1 MiB */
+#define AIO_BUF_POOL_MIN_SHIFT 12
+#define AIO_BUF_POOL_CLASSES 9
+/* Maximum number of free buffers per size */
+#define AIO_BUF_POOL_DEPTH 8
+/* Maximum number of bytes kept in free buffers */
+#define AIO_BUF_POOL_MAX_CACHED (4 * MiB)
+
+/* See aio_buf_pool_try_alloc() */
+typedef struct AioBufPool {
+    QemuMutex lock;
+    void *bufs[AIO_BUF_POOL_CLASSES][AIO_BUF_POOL_DEPTH];
+    unsigned nb_bufs[AIO_BUF_POOL_CLASSES];
+    size_t cached;
+} AioBufPool;
+
 struct AioContext {
     GSource source;
 
@@ -273,6 +294,8 @@ struct AioContext {
      */
     bool notified;
     EventNotifier notifier;
+    /* Number of times aio_notify() had to kick the event loop awake */
+    Stat64 wakeups;
 
     QSLIST_HEAD(, Coroutine) scheduled_coroutines;
     QEMUBH *co_schedule_bh;
@@ -284,6 +307,9 @@ struct AioContext {
      */
     struct ThreadPoolAio *thread_pool;
 
+    /* Free aligned buffers for I/O.  Has its own locking. */
+    AioBufPool buf_pool;
+
 #ifdef CONFIG_LINUX_AIO
     struct LinuxAioState *linux_aio;
 #endif
@@ -309,6 +335,7 @@ struct AioContext {
     int64_t poll_max_ns;    /* maximum polling time in nanoseconds */
     int64_t poll_grow;      /* polling time growth factor */
     int64_t poll_shrink;    /* polling time shrink factor */
+    AioPollGroup *poll_group; /* shares busy polling with other contexts */
 
     /* AIO engine parameters */
     int64_t aio_max_batch;  /* maximum number of requests in a batch */
@@ -585,6 +612,33 @@ GSource *aio_get_g_source(AioContext *ctx);
 /* Return the ThreadPoolAio bound to this AioContext */
 struct ThreadPoolAio *aio_get_thread_pool(AioContext *ctx);
 
+/**
+ * aio_buf_pool_try_alloc:
+ * @ctx: the AioContext whose free buffers to use, or NULL
+ * @alignment: required alignment, in bytes
+ * @size: size of allocation, in bytes
+ *
+ * Allocate memory like qemu_try_memalign(), but reuse a buffer freed by
+ * aio_buf_pool_free() if possible.  Sizes up to 1 MiB are rounded up to a
+ * power of two, so that buffers can be reused for requests of a similar
+ * size.  This avoids calling into the allocator for each request on paths
+ * that need a bounce buffer.
+ *
+ * The memory must be freed with aio_buf_pool_free() and the same @size.
+ */
+void *aio_buf_pool_try_alloc(AioContext *ctx, size_t alignment, size_t size);
+
+/**
+ * aio_buf_pool_free:
+ * @ctx: the AioContext to keep the buffer in, or NULL
+ * @ptr: memory to free, may be NULL
+ * @size: size that was passed to aio_buf_pool_try_alloc()
+ *
+ * Keep @ptr for reuse in @ctx if there is room, or free it.  @ctx does not
+ * need to be the one that allocated @ptr.
+ */
+void aio_buf_pool_free(AioContext *ctx, void *ptr, size_t size);
+
 /* Setup the LinuxAioState bound to this AioContext */
 struct LinuxAioState *aio_setup_linux_aio(AioContext *ctx, Error **errp);
 
@@ -797,6 +851,21 @@ void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
                                  int64_t grow, int64_t shrink,
                                  Error **errp);
 
+/**
+ * aio_context_set_poll_group:
+ * @ctx: the aio context
+ * @name: the name of the poll group, or NULL to leave the current one
+ *
+ * AioContexts in the same poll group take turns at busy polling: while one
+ * of them is polling, the others skip polling and block in the file
+ * descriptor monitor right away.  Event loop threads that share a host CPU
+ * can thus use adaptive polling without spinning against each other.
+ *
+ * Must be called with the BQL held, while no thread is running aio_poll()
+ * on @ctx.
+ */
+void aio_context_set_poll_group(AioContext *ctx, const char *name);
+
 /**
  * aio_context_set_aio_params:
  * @ctx: the aio context
@@ -805,6 +874,21 @@ void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
  */
 void aio_context_set_aio_params(AioContext *ctx, int64_t max_batch);
 
+/**
+ * aio_context_set_io_uring_sqpoll:
+ * @ctx: the aio context
+ * @cpu: the CPU to pin the kernel poller thread to, or -1 to not pin it
+ * @errp: pointer to Error*, to store an error if it happens
+ *
+ * Recreate the io_uring of @ctx with a kernel thread that polls the
+ * submission queue, so that neither file descriptor monitoring nor I/O
+ * requests need a syscall for submission while the poller is active.  This
+ * must be called before @ctx is used.
+ *
+ * Returns true on success, false with @errp set on failure.
+ */
+bool aio_context_set_io_uring_sqpoll(AioContext *ctx, int cpu, Error **errp);
+
 /**
  * aio_context_set_thread_pool_params:
  * @ctx: the aio context
@@ -847,6 +931,55 @@ static inline bool aio_has_io_uring(void)
  */
 void aio_add_sqe(void (*prep_sqe)(struct io_uring_sqe *sqe, void *opaque),
                  void *opaque, CqeHandler *cqe_handler);
+
+/**
+ * aio_register_fixed_buf: Register a buffer with the io_uring of all
+ * AioContexts.
+ * @host: start of the buffer
+ * @size: size of the buffer in bytes
+ *
+ * Afterwards aio_get_fixed_buf_index() returns an index for ranges within the
+ * buffer that can be used with IORING_OP_READ_FIXED and IORING_OP_WRITE_FIXED
+ * sqes.  The buffer stays pinned until aio_unregister_fixed_buf() is called
+ * with the same @host and @size as many times as it was registered.
+ *
+ * This is only an optimization: if the buffer cannot be registered (e.g.
+ * because the memlock limit is reached), lookups simply fail.
+ */
+void aio_register_fixed_buf(void *host, size_t size);
+void aio_unregister_fixed_buf(void *host, size_t size);
+
+/**
+ * aio_register_fixed_file: Register a file with the io_uring of all
+ * AioContexts.
+ * @fd: the file descriptor
+ *
+ * Afterwards aio_get_fixed_file_index() returns an index that can be used
+ * instead of @fd in sqes with the IOSQE_FIXED_FILE flag.  The ring holds a
+ * reference to the file, so aio_unregister_fixed_file() must be called before
+ * @fd is closed.
+ */
+void aio_register_fixed_file(int fd);
+void aio_unregister_fixed_file(int fd);
+
+/**
+ * aio_get_fixed_buf_index: Look up a registered buffer.
+ * @addr: start of the range
+ * @len: length of the range in bytes
+ *
+ * Returns the index of a registered buffer that contains the whole range, or
+ * -1 if there is none.  The index is the same in all AioContexts.
+ */
+int aio_get_fixed_buf_index(const void *addr, size_t len);
+
+/**
+ * aio_get_fixed_file_index: Look up a registered file.
+ * @fd: the file descriptor
+ *
+ * Returns the index of @fd in the registered files, or -1 if it is not
+ * registered.  The index is the same in all AioContexts.
+ */
+int aio_get_fixed_file_index(int fd);
 #endif /* CONFIG_LINUX_IO_URING */
 
 #endif
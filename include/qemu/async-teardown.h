@@ -15,6 +15,12 @@
 
 #ifdef CONFIG_LINUX
 void init_async_teardown(void);
+bool async_teardown_enabled(void);
+#else
+static inline bool async_teardown_enabled(void)
+{
+    return false;
+}
 #endif
 
 #endif
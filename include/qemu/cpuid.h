@@ -65,12 +65,21 @@
 #endif
 
 /* Leaf 7, %ecx */
+#ifndef bit_WAITPKG
+#define bit_WAITPKG     (1 << 5)
+#endif
 #ifndef bit_AVX512VBMI2
 #define bit_AVX512VBMI2 (1 << 6)
 #endif
 #ifndef bit_GFNI
 #define bit_GFNI        (1 << 8)
 #endif
+#ifndef bit_MOVDIR64B
+#define bit_MOVDIR64B   (1 << 28)
+#endif
+#ifndef bit_ENQCMD
+#define bit_ENQCMD      (1 << 29)
+#endif
 
 /* Leaf 0x80000001, %ecx */
 #ifndef bit_LZCNT
@@ -114,6 +114,19 @@ uint64_t hbitmap_count(const HBitmap *hb);
  */
 void hbitmap_set(HBitmap *hb, uint64_t start, uint64_t count);
 
+/**
+ * hbitmap_set_atomic:
+ * @hb: HBitmap to operate on.
+ * @start: First bit to set (0-based).
+ * @count: Number of bits to set.
+ *
+ * Set a consecutive range of bits in an HBitmap.  Unlike hbitmap_set(),
+ * this can run concurrently with other calls to hbitmap_set_atomic() on
+ * the same bitmap, but not with any other function that modifies it or
+ * iterates over it.
+ */
+void hbitmap_set_atomic(HBitmap *hb, uint64_t start, uint64_t count);
+
 /**
  * hbitmap_reset:
  * @hb: HBitmap to operate on.
@@ -350,4 +363,13 @@ bool hbitmap_status(const HBitmap *hb, int64_t start, int64_t count,
  */
 int64_t hbitmap_iter_next(HBitmapIter *hbi);
 
+/*
+ * test_hbitmap_next_accel:
+ *
+ * Switch the scanning and merging of HBitmap words to the next less
+ * optimized version, returning false if the generic version is already
+ * in use.  For tests and benchmarks only.
+ */
+bool test_hbitmap_next_accel(void);
+
 #endif
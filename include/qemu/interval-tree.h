@@ -96,4 +96,56 @@ IntervalTreeNode *interval_tree_iter_first(IntervalTreeRoot *root,
 IntervalTreeNode *interval_tree_iter_next(IntervalTreeNode *node,
                                           uint64_t start, uint64_t last);
 
+/*
+ * Gap trees keep non-overlapping intervals, and track the largest free
+ * gap between them so that free ranges can be allocated in O(log n).
+ */
+typedef struct IntervalGapTreeNode
+{
+    RBNode rb;
+
+    uint64_t start;    /* Start of interval */
+    uint64_t last;     /* Last location _in_ interval */
+    uint64_t gap;      /* Free locations between the previous node and start */
+    uint64_t subtree_gap;
+} IntervalGapTreeNode;
+
+typedef RBRoot IntervalGapTreeRoot;
+
+/**
+ * interval_gap_tree_insert
+ * @node: node to insert,
+ * @root: root of the tree.
+ *
+ * Insert @node into @root, and rebalance.  @node must not overlap any
+ * interval already in the tree.
+ */
+void interval_gap_tree_insert(IntervalGapTreeNode *node,
+                              IntervalGapTreeRoot *root);
+
+/**
+ * interval_gap_tree_remove
+ * @node: node to remove,
+ * @root: root of the tree.
+ *
+ * Remove @node from @root, and rebalance.
+ */
+void interval_gap_tree_remove(IntervalGapTreeNode *node,
+                              IntervalGapTreeRoot *root);
+
+/**
+ * interval_gap_tree_find_free
+ * @root: root of the tree,
+ * @begin, @end: the inclusive range to allocate from,
+ * @size: the size of the wanted range, minus one,
+ * @start: where to store the start of the free range.
+ *
+ * Find the lowest range [@start, @start + @size] inside [@begin, @end]
+ * that does not overlap any node of the tree.  Returns false if there
+ * is no such range.
+ */
+bool interval_gap_tree_find_free(const IntervalGapTreeRoot *root,
+                                 uint64_t begin, uint64_t end, uint64_t size,
+                                 uint64_t *start);
+
 #endif /* QEMU_INTERVAL_TREE_H */
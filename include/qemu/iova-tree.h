@@ -142,6 +142,9 @@ const DMAMap *iova_tree_find_iova(const IOVATree *tree, const DMAMap *map);
  * @iova_end: the maximum addressable direction of the allocation
  *
  * Allocates a new region of a given size, between iova_min and iova_max.
+ * The lowest free range that fits is used.  Free ranges are tracked by the
+ * tree, so the search is O(log n) in the number of mappings.  Only trees
+ * created with iova_tree_new() can allocate.
  *
  * Return: Same as iova_tree_insert, but cannot overlap and can return error if
  * iova tree is out of free contiguous range. The caller gets the assigned iova
@@ -283,10 +283,12 @@ bool mutex_is_bql(QemuMutex *mutex);
  * bql_update_status:
  *
  * @locked: update status on whether the BQL is locked
+ * @file: source file of the call site that locks or unlocks the BQL
+ * @line: line of the call site
  *
  * NOTE: this should normally only be invoked when the status changed.
  */
-void bql_update_status(bool locked);
+void bql_update_status(bool locked, const char *file, int line);
 
 /**
  * bql_block: Allow/deny releasing the BQL
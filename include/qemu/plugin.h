@@ -73,6 +73,7 @@ enum plugin_dyn_cb_type {
     PLUGIN_CB_MEM_REGULAR,
     PLUGIN_CB_INLINE_ADD_U64,
     PLUGIN_CB_INLINE_STORE_U64,
+    PLUGIN_CB_MEM_BATCH,
 };
 
 struct qemu_plugin_regular_cb {
@@ -97,6 +98,15 @@ struct qemu_plugin_conditional_cb {
     uint64_t imm;
 };
 
+struct qemu_plugin_mem_batch_cb {
+    struct qemu_plugin_mem_batch *batch;
+    /* called at insn start when the vCPU's buffer is full */
+    qemu_plugin_vcpu_udata_cb_t flush;
+    TCGHelperInfo *info;
+    uint64_t pc;
+    enum qemu_plugin_mem_rw rw;
+};
+
 /*
  * A dynamic callback has an insertion point that is determined at run-time.
  * Usually the insertion point is somewhere in the code cache; think for
@@ -108,6 +118,7 @@ struct qemu_plugin_dyn_cb {
         struct qemu_plugin_regular_cb regular;
         struct qemu_plugin_conditional_cb cond;
         struct qemu_plugin_inline_cb inline_insn;
+        struct qemu_plugin_mem_batch_cb mem_batch;
     };
 };
 
@@ -129,6 +140,25 @@ struct qemu_plugin_scoreboard {
     QLIST_ENTRY(qemu_plugin_scoreboard) entry;
 };
 
+/*
+ * Each scoreboard entry of a batch holds a uint64_t record count followed
+ * by @n_records + QEMU_PLUGIN_MEM_BATCH_SLACK struct qemu_plugin_mem_record.
+ * Translated code only checks for a full buffer at the start of each
+ * instrumented instruction, so that no branch is inserted between a guest
+ * access and the ops that follow it; the slack absorbs the accesses of
+ * that one instruction.
+ */
+struct qemu_plugin_mem_batch {
+    struct qemu_plugin_scoreboard *score;
+    size_t n_records;
+    qemu_plugin_vcpu_mem_batch_cb_t cb;
+    void *userdata;
+    QLIST_ENTRY(qemu_plugin_mem_batch) entry;
+};
+
+#define QEMU_PLUGIN_MEM_BATCH_HDR sizeof(uint64_t)
+#define QEMU_PLUGIN_MEM_BATCH_SLACK 256
+
 /* Internal context for this TranslationBlock */
 struct qemu_plugin_tb {
     GPtrArray *insns;
@@ -72,11 +72,15 @@ typedef uint64_t qemu_plugin_id_t;
  * - added qemu_plugin_write_memory_hwaddr
  * - added qemu_plugin_write_register
  * - added qemu_plugin_translate_vaddr
+ *
+ * version 6:
+ * - added qemu_plugin_mem_batch_new, qemu_plugin_mem_batch_free,
+ *   qemu_plugin_mem_batch_flush and qemu_plugin_register_vcpu_mem_batch_cb
  */
 
 extern QEMU_PLUGIN_EXPORT int qemu_plugin_version;
 
-#define QEMU_PLUGIN_VERSION 5
+#define QEMU_PLUGIN_VERSION 6
 
 /**
  * struct qemu_info_t - system information for plugins
@@ -303,6 +307,8 @@ struct qemu_plugin_tb;
 struct qemu_plugin_insn;
 /** struct qemu_plugin_scoreboard - Opaque handle for a scoreboard */
 struct qemu_plugin_scoreboard;
+/** struct qemu_plugin_mem_batch - Opaque handle for batched mem records */
+struct qemu_plugin_mem_batch;
 
 /**
  * typedef qemu_plugin_u64 - uint64_t member of an entry in a scoreboard
@@ -765,6 +771,98 @@ void qemu_plugin_register_vcpu_mem_inline_per_vcpu(
     qemu_plugin_u64 entry,
     uint64_t imm);
 
+/**
+ * typedef qemu_plugin_mem_record - a batched memory access
+ * @vaddr: the virtual address of the transaction
+ * @pc: the virtual address of the instruction doing the access
+ * @info: an opaque handle for further queries about the memory
+ *
+ * Only queries working on the value of @info (e.g.
+ * qemu_plugin_mem_size_shift()) are valid on batched records;
+ * qemu_plugin_get_hwaddr() and qemu_plugin_mem_get_value() are not.
+ */
+typedef struct qemu_plugin_mem_record {
+    uint64_t vaddr;
+    uint64_t pc;
+    qemu_plugin_meminfo_t info;
+} qemu_plugin_mem_record;
+
+/**
+ * typedef qemu_plugin_vcpu_mem_batch_cb_t - batched memory callback type
+ * @vcpu_index: the executing vCPU
+ * @records: the accesses recorded since the previous flush, oldest first
+ * @n: number of entries in @records
+ * @userdata: any user data attached to the batch
+ *
+ * @records is only valid for the duration of the callback.
+ */
+typedef void (*qemu_plugin_vcpu_mem_batch_cb_t) (
+    unsigned int vcpu_index,
+    const qemu_plugin_mem_record *records,
+    size_t n,
+    void *userdata);
+
+/**
+ * qemu_plugin_mem_batch_new() - allocate a batch of per-vCPU ring buffers
+ * @n_records: capacity of each vCPU's buffer, in records
+ * @cb: callback invoked when a vCPU's buffer is flushed
+ * @userdata: opaque pointer passed to @cb
+ *
+ * A batch holds one buffer of @n_records entries per vCPU. The
+ * translated code appends to the buffer of the executing vCPU without
+ * leaving the TB, and @cb is only called once that buffer is full,
+ * when the vCPU exits, on qemu_plugin_mem_batch_flush() and before
+ * the plugin's atexit callbacks run. Fullness is checked at instruction
+ * boundaries, so @cb may see slightly more than @n_records records.
+ *
+ * Returns a handle that must be freed with qemu_plugin_mem_batch_free().
+ */
+QEMU_PLUGIN_API
+struct qemu_plugin_mem_batch *
+qemu_plugin_mem_batch_new(size_t n_records,
+                          qemu_plugin_vcpu_mem_batch_cb_t cb,
+                          void *userdata);
+
+/**
+ * qemu_plugin_mem_batch_free() - flush and free a batch
+ * @batch: batch to free
+ *
+ * Pending records of every vCPU are delivered before @batch is freed.
+ * Code instrumented with @batch must no longer run, so this should
+ * only be called once all vCPUs have stopped (e.g. from atexit).
+ */
+QEMU_PLUGIN_API
+void qemu_plugin_mem_batch_free(struct qemu_plugin_mem_batch *batch);
+
+/**
+ * qemu_plugin_mem_batch_flush() - deliver a vCPU's pending records
+ * @batch: batch to flush
+ * @vcpu_index: vCPU whose buffer is flushed
+ *
+ * This must be called from a callback running on @vcpu_index (e.g. a
+ * tb exec or syscall callback), or while all vCPUs are stopped.
+ */
+QEMU_PLUGIN_API
+void qemu_plugin_mem_batch_flush(struct qemu_plugin_mem_batch *batch,
+                                 unsigned int vcpu_index);
+
+/**
+ * qemu_plugin_register_vcpu_mem_batch_cb() - record mem accesses in a batch
+ * @insn: handle for instruction to instrument
+ * @rw: monitor reads, writes or both
+ * @batch: batch the accesses are recorded into
+ *
+ * This is a cheaper alternative to qemu_plugin_register_vcpu_mem_cb()
+ * for plugins that trace every access: rather than calling out of the
+ * translated code for each access, a &qemu_plugin_mem_record is stored
+ * inline and the batch callback only runs when the buffer fills up.
+ */
+QEMU_PLUGIN_API
+void qemu_plugin_register_vcpu_mem_batch_cb(
+    struct qemu_plugin_insn *insn,
+    enum qemu_plugin_mem_rw rw,
+    struct qemu_plugin_mem_batch *batch);
+
 /**
  * qemu_plugin_request_time_control() - request the ability to control time
  *
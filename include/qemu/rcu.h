@@ -143,6 +143,15 @@ struct rcu_head {
 void call_rcu1(struct rcu_head *head, RCUCBFunc *func);
 void drain_call_rcu(void);
 
+typedef struct RCUStats {
+    uint64_t grace_periods;         /* completed synchronize_rcu() calls */
+    uint64_t forced_grace_periods;  /* of which had to force readers out */
+    uint64_t callbacks;             /* call_rcu() calls */
+    uint64_t callbacks_pending;     /* callbacks not invoked yet */
+} RCUStats;
+
+void rcu_get_stats(RCUStats *stats);
+
 /* The operands of the minus operator must have the same type,
  * which must be the one that we specify in the cast.
  */
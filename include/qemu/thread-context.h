@@ -54,4 +54,20 @@ void thread_context_create_thread(ThreadContext *tc, QemuThread *thread,
                                   void *(*start_routine)(void *), void *arg,
                                   int mode);
 
+/**
+ * thread_context_new_node_affinity:
+ * @host_nodes: bitmap of host NUMA nodes
+ * @nnodes: number of bits in @host_nodes
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Create a thread context that is not visible in the QOM tree and whose
+ * threads run on the CPUs of @host_nodes, like setting the "node-affinity"
+ * property.  The caller owns the returned reference.
+ *
+ * Returns: the new thread context, or NULL on failure.
+ */
+ThreadContext *thread_context_new_node_affinity(const unsigned long *host_nodes,
+                                                unsigned long nnodes,
+                                                Error **errp);
+
 #endif /* SYSEMU_THREAD_CONTEXT_H */
@@ -159,6 +159,11 @@ bool throttle_schedule_timer(ThrottleState *ts,
 
 void throttle_account(ThrottleState *ts, ThrottleDirection direction,
                       uint64_t size);
+void throttle_get_allowance(ThrottleState *ts, ThrottleDirection direction,
+                            int64_t ns, uint64_t *size, uint64_t *units);
+bool throttle_account_batch(ThrottleState *ts, int64_t now,
+                            ThrottleDirection direction,
+                            uint64_t size, uint64_t units);
 void throttle_limits_to_config(ThrottleLimits *arg, ThrottleConfig *cfg,
                                Error **errp);
 void throttle_config_to_limits(ThrottleConfig *cfg, ThrottleLimits *var);
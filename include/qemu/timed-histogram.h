@@ -0,0 +1,64 @@
+/*
+ * QEMU timed latency histogram
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TIMED_HISTOGRAM_H
+#define TIMED_HISTOGRAM_H
+
+#include "qemu/timer.h"
+
+/*
+ * Values below 2^TIMED_HISTOGRAM_SUB_BITS are counted exactly, every larger
+ * power of two is split into 2^TIMED_HISTOGRAM_SUB_BITS buckets, so the
+ * relative error is below 1/16.  Values of 2^TIMED_HISTOGRAM_MAX_BITS and
+ * more are counted in the last bucket.
+ */
+#define TIMED_HISTOGRAM_SUB_BITS    4
+#define TIMED_HISTOGRAM_MAX_BITS    40
+#define TIMED_HISTOGRAM_BUCKETS \
+    ((TIMED_HISTOGRAM_MAX_BITS - TIMED_HISTOGRAM_SUB_BITS + 1) << \
+     TIMED_HISTOGRAM_SUB_BITS)
+
+typedef struct TimedHistogramWindow TimedHistogramWindow;
+typedef struct TimedHistogram TimedHistogram;
+
+/* All fields of both structures are private */
+
+struct TimedHistogramWindow {
+    uint64_t      buckets[TIMED_HISTOGRAM_BUCKETS];
+    uint64_t      count;           /* number of values */
+    int64_t       expiration;      /* the end of the current window in ns */
+};
+
+struct TimedHistogram {
+    uint64_t             period;     /* period in nanoseconds */
+    TimedHistogramWindow windows[2]; /* two overlapping windows with an
+                                      * offset of period / 2 between them */
+    unsigned             current;    /* the current window index: it's also
+                                      * the oldest window index */
+    QEMUClockType        clock_type; /* the clock used */
+};
+
+void timed_histogram_init(TimedHistogram *th, QEMUClockType clock_type,
+                          uint64_t period);
+
+void timed_histogram_account(TimedHistogram *th, uint64_t value);
+
+uint64_t timed_histogram_percentile(TimedHistogram *th, unsigned permille);
+
+#endif
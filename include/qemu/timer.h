@@ -86,7 +86,8 @@ struct QEMUTimer {
     QEMUTimerList *timer_list;
     QEMUTimerCB *cb;
     void *opaque;
-    QEMUTimer *next;
+    uint64_t seq;               /* orders timers with the same expire_time */
+    unsigned heap_index;        /* position in timer_list, if pending */
     int attributes;
     int scale;
 };
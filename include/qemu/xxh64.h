@@ -0,0 +1,71 @@
+/*
+ * xxHash64 - Fast non-cryptographic hash
+ *
+ * The algorithm is by Yann Collet, see https://github.com/Cyan4973/xxHash
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#ifndef QEMU_XXH64_H
+#define QEMU_XXH64_H
+
+#define QEMU_XXH64_DIGEST_LEN 8
+
+typedef struct QemuXXH64State {
+    uint64_t v[4];
+    uint64_t seed;
+    uint64_t total_len;
+    uint8_t buf[32];
+    size_t buf_len;
+} QemuXXH64State;
+
+/**
+ * qemu_xxh64_init:
+ * @state: the hash state
+ * @seed: the seed, 0 for the standard hash
+ *
+ * Start computing a hash incrementally.
+ */
+void qemu_xxh64_init(QemuXXH64State *state, uint64_t seed);
+
+/**
+ * qemu_xxh64_update:
+ * @state: the hash state
+ * @data: the data to add
+ * @len: the length of @data
+ *
+ * Add @data to the hash.  The result does not depend on how the input
+ * is split across calls.
+ */
+void qemu_xxh64_update(QemuXXH64State *state, const void *data, size_t len);
+
+/**
+ * qemu_xxh64_digest:
+ * @state: the hash state
+ *
+ * Returns: the hash of all the data passed to qemu_xxh64_update().
+ * @state is not modified and more data can still be added.
+ */
+uint64_t qemu_xxh64_digest(const QemuXXH64State *state);
+
+/**
+ * qemu_xxh64:
+ * @seed: the seed, 0 for the standard hash
+ * @data: the data to hash
+ * @len: the length of @data
+ *
+ * Returns: the hash of @data
+ */
+uint64_t qemu_xxh64(uint64_t seed, const void *data, size_t len);
+
+/**
+ * iov_xxh64:
+ * @seed: the seed, 0 for the standard hash
+ * @iov: the data to hash
+ * @iov_cnt: the number of elements in @iov
+ *
+ * Returns: the hash of the concatenated contents of @iov
+ */
+uint64_t iov_xxh64(uint64_t seed, const struct iovec *iov, size_t iov_cnt);
+
+#endif
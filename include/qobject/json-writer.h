@@ -21,6 +21,12 @@ void json_writer_free(JSONWriter *);
 
 G_DEFINE_AUTOPTR_CLEANUP_FUNC(JSONWriter, json_writer_free)
 
+typedef void JSONWriterFlushFunc(const char *buf, size_t len, void *opaque);
+
+void json_writer_set_flush(JSONWriter *, size_t threshold,
+                           JSONWriterFlushFunc *fn, void *opaque);
+void json_writer_flush(JSONWriter *);
+
 void json_writer_start_object(JSONWriter *, const char *name);
 void json_writer_end_object(JSONWriter *);
 void json_writer_start_array(JSONWriter *, const char *name);
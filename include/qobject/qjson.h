@@ -27,5 +27,7 @@ QDict *qdict_from_jsonf_nofail(const char *string, ...)
 
 GString *qobject_to_json(const QObject *obj);
 GString *qobject_to_json_pretty(const QObject *obj, bool pretty);
+void qobject_to_json_writer(JSONWriter *writer, const char *name,
+                            const QObject *obj);
 
 #endif /* QJSON_H */
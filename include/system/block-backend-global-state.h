@@ -85,6 +85,7 @@ void blk_set_on_error(BlockBackend *blk, BlockdevOnError on_read_error,
 bool blk_supports_write_perm(BlockBackend *blk);
 bool blk_is_sg(BlockBackend *blk);
 void blk_set_enable_write_cache(BlockBackend *blk, bool wce);
+void blk_set_merge_window(BlockBackend *blk, int64_t window_ns);
 int blk_get_flags(BlockBackend *blk);
 int blk_set_aio_context(BlockBackend *blk, AioContext *new_context,
                         Error **errp);
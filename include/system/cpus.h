@@ -26,6 +26,12 @@ void cpu_handle_guest_debug(CPUState *cpu);
 
 bool qemu_in_vcpu_thread(void);
 void qemu_init_cpu_loop(void);
+/*
+ * Wait until all vCPUs are created.  Cold-plugged vCPUs finish their
+ * initialization in parallel if the accelerator allows it, see
+ * AccelCPUClass.parallel_vcpu_init.
+ */
+void qemu_wait_vcpus_created(void);
 void resume_all_vcpus(void);
 void pause_all_vcpus(void);
 void cpu_stop_current(void);
@@ -40,4 +46,39 @@ void cpu_synchronize_all_post_reset(void);
 void cpu_synchronize_all_post_init(void);
 void cpu_synchronize_all_pre_loadvm(void);
 
+/* BQL hold time statistics, see bql_get_stats() */
+#define BQL_HOLD_HIST_BUCKETS 32
+
+typedef struct BQLStats {
+    uint64_t acquisitions;
+    uint64_t hold_ns;
+    uint64_t max_hold_ns;
+    /*
+     * log2 histogram of hold times in microseconds: bucket 0 counts holds
+     * shorter than 1 us, bucket i > 0 those in [2^(i-1), 2^i) us.
+     */
+    uint64_t hold_us_hist[BQL_HOLD_HIST_BUCKETS];
+} BQLStats;
+
+typedef struct BQLSiteStats {
+    const char *file;
+    int line;
+    uint64_t acquisitions;
+    uint64_t hold_ns;
+    uint64_t max_hold_ns;
+} BQLSiteStats;
+
+/**
+ * bql_get_stats:
+ * @stats: filled with the BQL hold time statistics
+ * @sites: filled with the call sites that held the BQL longest in total
+ * @nr_sites: number of elements in @sites
+ *
+ * Must be called with the BQL held.  A call site is where the BQL was
+ * taken, either by bql_lock() or by waking up from a condition variable
+ * wait.  Returns the number of elements of @sites that were filled.
+ */
+unsigned bql_get_stats(BQLStats *stats, BQLSiteStats *sites,
+                       unsigned nr_sites);
+
 #endif
@@ -0,0 +1,134 @@
+/*
+ * Translation caches for emulated IOMMUs
+ *
+ * IOMMURangeTLB caches translations by IOVA range, so that a single entry
+ * covers a large page and an invalidation only visits the entries in the
+ * invalidated range.  IOMMUTLBMRU remembers the last translation of an
+ * address space and can be checked without taking the IOMMU lock.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#ifndef SYSTEM_IOMMU_TLB_H
+#define SYSTEM_IOMMU_TLB_H
+
+#include "qemu/interval-tree.h"
+#include "qemu/seqlock.h"
+#include "system/memory.h"
+
+/*
+ * An entry of an IOMMURangeTLB, embedded as the first member of the entry
+ * type of the IOMMU.  Entries are freed with g_free() when they are removed.
+ */
+typedef struct IOMMURangeTLBEntry {
+    IntervalTreeNode node;
+    /* Which translations the entry belongs to, e.g. requester and PASID */
+    uint64_t tag;
+} IOMMURangeTLBEntry;
+
+typedef struct IOMMURangeTLB {
+    IntervalTreeRoot root;
+    unsigned nb_entries;
+    unsigned max_entries;
+} IOMMURangeTLB;
+
+/* Returns true if @entry is to be removed */
+typedef bool IOMMURangeTLBMatch(IOMMURangeTLBEntry *entry, void *opaque);
+
+void iommu_range_tlb_init(IOMMURangeTLB *tlb, unsigned max_entries);
+
+/* Remove all entries */
+void iommu_range_tlb_reset(IOMMURangeTLB *tlb);
+
+/* Returns the entry for @tag that translates @addr, or NULL */
+IOMMURangeTLBEntry *iommu_range_tlb_lookup(IOMMURangeTLB *tlb, uint64_t tag,
+                                           hwaddr addr);
+
+/*
+ * Add @entry for @tag, translating the naturally aligned block of
+ * @addr_mask + 1 bytes at @iova.  All entries are dropped first if the
+ * TLB is full.
+ */
+void iommu_range_tlb_insert(IOMMURangeTLB *tlb, IOMMURangeTLBEntry *entry,
+                            uint64_t tag, hwaddr iova, hwaddr addr_mask);
+
+/*
+ * Remove the entries that overlap [@start, @last] and for which @match
+ * returns true; a NULL @match removes all of them.
+ */
+void iommu_range_tlb_remove(IOMMURangeTLB *tlb, hwaddr start, hwaddr last,
+                            IOMMURangeTLBMatch *match, void *opaque);
+
+/*
+ * The last translation of an address space.  It is valid as long as the
+ * generation number of the IOMMU is the one it was stored with; the IOMMU
+ * increments its generation number whenever a translation may change.
+ * Updates must be serialized by the IOMMU, lookups need no lock.
+ */
+typedef struct IOMMUTLBMRU {
+    QemuSeqLock seq;
+    /* 0 is never a valid generation */
+    unsigned gen;
+    hwaddr iova;
+    hwaddr translated_addr;
+    hwaddr addr_mask;
+    IOMMUAccessFlags perm;
+} IOMMUTLBMRU;
+
+static inline void iommu_tlb_mru_init(IOMMUTLBMRU *mru)
+{
+    seqlock_init(&mru->seq);
+    mru->gen = 0;
+}
+
+/* Returns the next generation number after @gen */
+static inline unsigned iommu_tlb_gen_next(unsigned gen)
+{
+    return gen + 1 ?: 1;
+}
+
+/*
+ * Fill in @entry from @mru if it translates @addr for @flag in generation
+ * @gen.  The permissions of @entry are @flag.
+ */
+static inline bool iommu_tlb_mru_lookup(IOMMUTLBMRU *mru, unsigned gen,
+                                        hwaddr addr, IOMMUAccessFlags flag,
+                                        IOMMUTLBEntry *entry)
+{
+    unsigned start;
+    bool hit;
+
+    do {
+        start = seqlock_read_begin(&mru->seq);
+        hit = mru->gen == gen && (addr & ~mru->addr_mask) == mru->iova &&
+              !(flag & ~mru->perm);
+        if (hit) {
+            entry->iova = mru->iova;
+            entry->translated_addr = mru->translated_addr;
+            entry->addr_mask = mru->addr_mask;
+        }
+    } while (seqlock_read_retry(&mru->seq, start));
+
+    if (hit) {
+        entry->target_as = &address_space_memory;
+        entry->perm = flag;
+    }
+    return hit;
+}
+
+/* Remember a translation with permissions @perm made in generation @gen */
+static inline void iommu_tlb_mru_update(IOMMUTLBMRU *mru, unsigned gen,
+                                        hwaddr iova, hwaddr translated_addr,
+                                        hwaddr addr_mask,
+                                        IOMMUAccessFlags perm)
+{
+    seqlock_write_begin(&mru->seq);
+    mru->gen = gen;
+    mru->iova = iova & ~addr_mask;
+    mru->translated_addr = translated_addr & ~addr_mask;
+    mru->addr_mask = addr_mask;
+    mru->perm = perm & IOMMU_RW;
+    seqlock_write_end(&mru->seq);
+}
+
+#endif
@@ -38,6 +38,14 @@ struct IOThread {
     int64_t poll_max_ns;
     int64_t poll_grow;
     int64_t poll_shrink;
+    char *poll_group;           /* can only be set before creation */
+
+    /* io_uring submission queue polling, can only be set before creation */
+    bool io_uring_sqpoll;
+    int64_t io_uring_sqpoll_cpu; /* -1 if the poller is not pinned */
+
+    /* Host NUMA node, -1 if not bound; can only be set before creation */
+    int64_t numa_node;
 };
 typedef struct IOThread IOThread;
 
@@ -36,6 +36,8 @@ typedef struct KVMSlot
     ram_addr_t ram_start_offset;
     int guest_memfd;
     hwaddr guest_memfd_offset;
+    /* RAM block backing the slot */
+    RAMBlock *ram_block;
 } KVMSlot;
 
 typedef struct KVMMemoryUpdate {
@@ -51,6 +53,8 @@ typedef struct KVMMemoryListener {
     int as_id;
     QSIMPLEQ_HEAD(, KVMMemoryUpdate) transaction_add;
     QSIMPLEQ_HEAD(, KVMMemoryUpdate) transaction_del;
+    /* Sections whose dirty logging was started or stopped */
+    QSIMPLEQ_HEAD(, KVMMemoryUpdate) transaction_log;
 } KVMMemoryListener;
 
 #define KVM_MSI_HASHTAB_SIZE    256
@@ -100,6 +104,10 @@ struct KVMDirtyRingReaper {
     QemuThread reaper_thr;
     volatile uint64_t reaper_iteration; /* iteration number of reaper thr */
     volatile enum KVMDirtyRingReaperState reaper_state; /* reap thr state */
+    /* Posted by vCPUs whose ring got full, to wake up the reaper early */
+    QemuSemaphore reaper_sem;
+    /* Most entries collected from a single ring by the last full reap */
+    uint32_t reaped_max;
 };
 struct KVMState
 {
@@ -142,10 +150,16 @@ struct KVMState
 #ifdef KVM_CAP_IRQ_ROUTING
     struct kvm_irq_routing *irq_routes;
     int nr_allocated_irq_routes;
+    /* Index in irq_routes of the last entry added for each GSI */
+    int *irq_route_index;
+    /* irq_routes differs from the table that KVM has */
+    bool irq_routes_dirty;
     unsigned long *used_gsi_bitmap;
     unsigned int gsi_count;
 #endif
     KVMMemoryListener memory_listener;
+    /* vCPUs are created without the BQL */
+    QemuMutex kvm_parked_vcpus_lock;
     QLIST_HEAD(, KVMParkedVcpu) kvm_parked_vcpus;
 
     /* For "info mtree -f" to tell if an MR is registered in KVM */
@@ -157,6 +171,10 @@ struct KVMState
     uint64_t kvm_dirty_ring_bytes;  /* Size of the per-vcpu dirty ring */
     uint32_t kvm_dirty_ring_size;   /* Number of dirty GFNs per ring */
     bool kvm_dirty_ring_with_bitmap;
+    /* Keep track of dirty rates through the dirty ring */
+    bool kvm_dirty_ring_stats;
+    int64_t kvm_dirty_ring_stats_stamp;
+    Notifier kvm_dirty_ring_stats_notifier;
     uint64_t kvm_eager_split_size;  /* Eager Page Splitting chunk size */
     struct KVMDirtyRingReaper reaper;
     struct KVMMsrEnergy msr_energy;
@@ -76,7 +76,10 @@ static inline void fuzz_dma_read_cb(size_t addr,
 /* Dirty tracking enabled because dirty limit */
 #define GLOBAL_DIRTY_LIMIT      (1U << 2)
 
-#define GLOBAL_DIRTY_MASK  (0x7)
+/* Dirty tracking enabled because of continuous dirty rate statistics */
+#define GLOBAL_DIRTY_STATS      (1U << 3)
+
+#define GLOBAL_DIRTY_MASK  (0xf)
 
 extern unsigned int global_dirty_tracking;
 
@@ -869,6 +872,11 @@ struct MemoryRegion {
     unsigned ioeventfd_nb;
     MemoryRegionIoeventfd *ioeventfds;
     RamDiscardManager *rdm; /* Only for RAM */
+    /* Transaction that last changed this region or its subtree */
+    unsigned changed_gen;
+    /* Accesses that had to take the BQL and time spent waiting for it */
+    uint64_t bql_accesses;
+    uint64_t bql_wait_ns;
 
     /* For devices designed to perform re-entrant IO into their own IO MRs */
     bool disable_reentrancy_guard;
@@ -2684,6 +2692,15 @@ void memory_global_dirty_log_stop(unsigned int flags);
 
 void mtree_info(bool flatview, bool dispatch_tree, bool owner, bool disabled);
 
+/**
+ * mmio_bql_info: print the regions whose accesses had to take the BQL
+ *
+ * Regions are sorted by the total time spent waiting for the BQL, which
+ * makes the regions at the top the best candidates for
+ * memory_region_enable_lockless_io().
+ */
+void mmio_bql_info(void);
+
 bool memory_region_access_valid(MemoryRegion *mr, hwaddr addr,
                                 unsigned size, bool is_write,
                                 MemTxAttrs attrs);
@@ -3324,6 +3341,21 @@ int ram_block_coordinated_discard_require(bool state);
  */
 bool ram_block_discard_is_disabled(void);
 
+/*
+ * Mark the start of uncoordinated discards done outside the BQL, e.g. from
+ * a worker thread.  ram_block_discard_disable() and
+ * ram_block_uncoordinated_discard_disable() wait for them to end, so that
+ * no discard can happen after they returned.
+ *
+ * Returns false, without starting anything, if discards are disabled.
+ */
+bool ram_block_discard_begin(void);
+
+/*
+ * Mark the end of discards started with ram_block_discard_begin().
+ */
+void ram_block_discard_end(void);
+
 /*
  * Test if any discarding of memory in ram blocks is required to work reliably.
  */
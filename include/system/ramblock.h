@@ -57,6 +57,18 @@ struct RAMBlock {
      */
     off_t bitmap_offset;
     uint64_t pages_offset;
+    /* some pages are mapped privately from the migration file */
+    bool file_mapped;
+
+    /*
+     * Below fields are only used with the x-defer-hot-pages capability
+     */
+    /* pages held back from bmap until the final stage as being hot */
+    unsigned long *hot_bmap;
+    /* pages newly dirtied in the last dirty bitmap sync */
+    unsigned long *hot_recent_bmap;
+    /* bmap before the current dirty bitmap sync */
+    unsigned long *hot_prev_bmap;
 
     /* Bitmap of already received pages.  Only used on destination side. */
     unsigned long *receivedmap;
@@ -89,6 +101,17 @@ struct RAMBlock {
      * could not have been valid on the source.
      */
     ram_addr_t postcopy_length;
+
+    /*
+     * Below fields are only used with the KVM "dirty-ring-stats"
+     * accelerator property, all protected by the KVM slots lock
+     */
+    /* pages collected from the dirty rings for this block */
+    uint64_t dirty_ring_pages;
+    /* dirty_ring_pages at the last sample */
+    uint64_t dirty_ring_sampled;
+    /* rolling dirty rate, in bytes per second */
+    uint64_t dirty_ring_rate;
 };
 
 struct RamBlockAttributes {
@@ -133,6 +156,25 @@ static inline void *ramblock_ptr(RAMBlock *block, ram_addr_t offset)
 /* memory API */
 
 void qemu_ram_remap(ram_addr_t addr);
+
+/**
+ * qemu_ram_map_file: map part of a file into anonymous guest RAM
+ *
+ * @block: the RAMBlock, which must be private anonymous memory
+ * @offset: offset in @block, aligned to the host page size
+ * @length: length of the range, aligned to the host page size
+ * @fd: the file to map
+ * @file_offset: offset in @fd, aligned to the host page size
+ *
+ * Replace the range with a private mapping of @fd, so that its pages are
+ * read from the file when first accessed and copied when first written.
+ * Discarding such pages later makes them read as zeroes, as for the rest
+ * of the anonymous memory.
+ *
+ * Returns: 0 on success, a negative errno value otherwise.
+ */
+int qemu_ram_map_file(RAMBlock *block, uint64_t offset, size_t length,
+                      int fd, off_t file_offset);
 /* This should not be used by devices.  */
 ram_addr_t qemu_ram_addr_from_host(void *ptr);
 ram_addr_t qemu_ram_addr_from_host_nofail(void *ptr);
@@ -195,7 +237,9 @@ static inline long clear_bmap_size(uint64_t pages, uint8_t shift)
 
 /**
  * clear_bmap_set: set clear bitmap for the page range.  Must be with
- * bitmap_mutex held.
+ * bitmap_mutex held.  The bits are set atomically, so that callers
+ * working on different page ranges of the same ramblock can run
+ * concurrently even if their ranges share a clear bitmap chunk.
  *
  * @rb: the ramblock to operate on
  * @start: the start page number
@@ -207,8 +251,10 @@ static inline void clear_bmap_set(RAMBlock *rb, uint64_t start,
                                   uint64_t npages)
 {
     uint8_t shift = rb->clear_bmap_shift;
+    uint64_t first = start >> shift;
+    uint64_t last = (start + npages - 1) >> shift;
 
-    bitmap_set(rb->clear_bmap, start >> shift, clear_bmap_size(npages, shift));
+    bitmap_set_atomic(rb->clear_bmap, first, last - first + 1);
 }
 
 /**
@@ -277,6 +323,17 @@ RAMBlock *qemu_ram_alloc_resizeable(ram_addr_t size, ram_addr_t max_size,
                                     MemoryRegion *mr, Error **errp);
 void qemu_ram_free(RAMBlock *block);
 
+/**
+ * qemu_ram_release_all:
+ *
+ * Drop the contents of all guest RAM from the page tables of QEMU, using
+ * several threads in parallel.  Unmapping huge amounts of memory is slow
+ * and exit() does it from a single thread, so this shortens shutdown when
+ * nothing will access guest RAM anymore.  Contents of shared mappings stay
+ * in their backing file or memfd.
+ */
+void qemu_ram_release_all(void);
+
 int qemu_ram_resize(RAMBlock *block, ram_addr_t newsize, Error **errp);
 
 void qemu_ram_msync(RAMBlock *block, ram_addr_t start, ram_addr_t length);
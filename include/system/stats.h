@@ -25,6 +25,19 @@ void add_stats_callbacks(StatsProvider provider,
                          StatRetrieveFunc *stats_fn,
                          SchemaRetrieveFunc *schemas_fn);
 
+/*
+ * Same as add_stats_callbacks(), for providers whose @stats_fn is
+ * thread-safe and does not need the BQL.
+ */
+void add_stats_callbacks_unlocked(StatsProvider provider,
+                                  StatRetrieveFunc *stats_fn,
+                                  SchemaRetrieveFunc *schemas_fn);
+
+/*
+ * True if querying @filter involves a provider that needs the BQL.
+ */
+bool stats_filter_needs_bql(StatsFilter *filter);
+
 /*
  * Helper routines for adding stats entries to the results lists.
  */
@@ -42,4 +55,10 @@ void add_stats_schema(StatsSchemaList **, StatsProvider, StatsTarget,
  */
 bool apply_str_list_filter(const char *string, strList *list);
 
+/* Register the "rcu" statistics provider */
+void rcu_stats_init(void);
+
+/* Register the "bql" statistics provider */
+void bql_stats_init(void);
+
 #endif /* STATS_H */
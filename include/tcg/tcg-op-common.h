@@ -75,6 +75,16 @@ void tcg_gen_goto_tb(unsigned idx);
  */
 void tcg_gen_lookup_and_goto_ptr(void);
 
+/**
+ * tcg_gen_goto_ptr() - output goto_ptr TCG operation
+ * @dest: Host code address of a TB, or tcg_code_gen_epilogue
+ *
+ * Jump to @dest, which must have been obtained in the same way as by
+ * tcg_gen_lookup_and_goto_ptr().  The caller is responsible for disabling
+ * plugin memory helpers first.
+ */
+void tcg_gen_goto_ptr(TCGv_ptr dest);
+
 void tcg_gen_plugin_cb(unsigned from);
 void tcg_gen_plugin_mem_cb(TCGv_i64 addr, unsigned meminfo);
 
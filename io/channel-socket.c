@@ -35,6 +35,14 @@
 #endif
 #endif
 
+#if defined(QEMU_MSG_ZEROCOPY) && defined(CONFIG_LINUX_IO_URING) && \
+    defined(HAVE_IO_URING_PREP_SENDMSG_ZC)
+#define QEMU_SOCKET_SEND_QUEUE
+#include "qemu/iov.h"
+#include "qemu/lockable.h"
+#include <liburing.h>
+#endif
+
 #define SOCKET_MAX_FDS 16
 
 #ifdef QEMU_MSG_ZEROCOPY
@@ -98,6 +106,371 @@ int qio_channel_socket_set_send_buffer(QIOChannelSocket *ioc,
     return 0;
 }
 
+int qio_channel_socket_enable_zero_copy(QIOChannelSocket *ioc,
+                                        Error **errp)
+{
+#ifdef QEMU_MSG_ZEROCOPY
+    int v = 1;
+
+    if (setsockopt(ioc->fd, SOL_SOCKET, SO_ZEROCOPY, &v, sizeof(v)) < 0) {
+        error_setg_errno(errp, errno, "Unable to enable zero copy");
+        return -1;
+    }
+    qio_channel_set_feature(QIO_CHANNEL(ioc),
+                            QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY);
+    return 0;
+#else
+    error_setg(errp, "Zero copy not supported on this host");
+    return -1;
+#endif
+}
+
+#ifdef QEMU_SOCKET_SEND_QUEUE
+/* A write on the send queue */
+typedef struct QIOChannelSocketSend {
+    QLIST_ENTRY(QIOChannelSocketSend) next;
+    size_t len;
+    bool zero_copy;
+    /* Copy of the data of writes without QIO_CHANNEL_WRITE_FLAG_ZERO_COPY */
+    void *bounce;
+    struct msghdr msg;
+    struct iovec iov[];
+} QIOChannelSocketSend;
+
+struct QIOChannelSocketSendQueue {
+    QemuMutex lock;
+    struct io_uring ring;
+    unsigned int depth;
+    /*
+     * Writes on the queue.  Zero copy writes stay until their
+     * notification arrives, because their buffers are in use until then.
+     */
+    QLIST_HEAD(, QIOChannelSocketSend) sends;
+    unsigned int nr_sends;
+    /* Writes prepared on the ring but not submitted */
+    unsigned int nr_pending;
+    struct io_uring_sqe *last_sqe;
+    /* Submitted writes whose send has not completed */
+    unsigned int nr_inflight;
+    /* errno of the first write that failed */
+    int error;
+};
+
+/* Called with the queue lock held */
+static void qio_channel_socket_send_complete(QIOChannelSocket *sioc,
+                                             struct io_uring_cqe *cqe)
+{
+    QIOChannelSocketSendQueue *q = sioc->send_queue;
+    QIOChannelSocketSend *send = io_uring_cqe_get_data(cqe);
+
+    if (!send) {
+        /* Cancellation request of qio_channel_socket_send_queue_free() */
+        return;
+    }
+
+    if (cqe->flags & IORING_CQE_F_NOTIF) {
+        sioc->zero_copy_sent++;
+#ifdef IORING_NOTIF_USAGE_ZC_COPIED
+        if (!(cqe->res & IORING_NOTIF_USAGE_ZC_COPIED)) {
+            sioc->new_zero_copy_sent_success = true;
+        }
+#else
+        sioc->new_zero_copy_sent_success = true;
+#endif
+    } else {
+        q->nr_inflight--;
+        if ((cqe->res < 0 || cqe->res != send->len) && !q->error) {
+            /* A short write means the socket failed while sending */
+            q->error = cqe->res < 0 ? -cqe->res : EPIPE;
+        }
+        if (cqe->flags & IORING_CQE_F_MORE) {
+            /* The notification follows */
+            return;
+        }
+        if (send->zero_copy) {
+            /* The buffers were never used */
+            sioc->zero_copy_sent++;
+        }
+    }
+
+    QLIST_REMOVE(send, next);
+    q->nr_sends--;
+    g_free(send->bounce);
+    g_free(send);
+}
+
+/*
+ * Process the completions on the ring, waiting for one first if @wait.
+ * Called with the queue lock held.
+ */
+static int qio_channel_socket_send_queue_reap(QIOChannelSocket *sioc,
+                                              bool wait, Error **errp)
+{
+    QIOChannelSocketSendQueue *q = sioc->send_queue;
+    struct io_uring_cqe *cqe;
+    unsigned int head, n = 0;
+    int ret;
+
+    if (wait) {
+        do {
+            ret = io_uring_wait_cqe(&q->ring, &cqe);
+        } while (ret == -EINTR);
+        if (ret < 0) {
+            error_setg_errno(errp, -ret, "Unable to wait for socket writes");
+            return -1;
+        }
+    }
+
+    io_uring_for_each_cqe(&q->ring, head, cqe) {
+        qio_channel_socket_send_complete(sioc, cqe);
+        n++;
+    }
+    io_uring_cq_advance(&q->ring, n);
+    return 0;
+}
+
+/*
+ * Submit the pending writes as one linked chain.  The sends of separate
+ * chains are not ordered against each other, so wait for the previous
+ * chain to complete first.  Called with the queue lock held.
+ */
+static int qio_channel_socket_send_queue_submit(QIOChannelSocket *sioc,
+                                                Error **errp)
+{
+    QIOChannelSocketSendQueue *q = sioc->send_queue;
+    int ret;
+
+    while (q->nr_inflight) {
+        if (qio_channel_socket_send_queue_reap(sioc, true, errp) < 0) {
+            return -1;
+        }
+    }
+    if (q->error) {
+        error_setg_errno(errp, q->error, "Unable to write to socket");
+        return -1;
+    }
+    if (!q->nr_pending) {
+        return 0;
+    }
+
+    trace_qio_channel_socket_send_queue_submit(sioc, q->nr_pending);
+    ret = io_uring_submit(&q->ring);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Unable to submit socket writes");
+        return -1;
+    }
+    /* With IORING_SETUP_SUBMIT_ALL, failures are reported as completions */
+    q->nr_inflight = q->nr_pending;
+    q->nr_pending = 0;
+    q->last_sqe = NULL;
+    return 0;
+}
+
+static ssize_t qio_channel_socket_send_queue_writev(QIOChannelSocket *sioc,
+                                                    const struct iovec *iov,
+                                                    size_t niov,
+                                                    int flags,
+                                                    Error **errp)
+{
+    QIOChannelSocketSendQueue *q = sioc->send_queue;
+    size_t len = iov_size(iov, niov);
+    QIOChannelSocketSend *send;
+    struct io_uring_sqe *sqe;
+
+    QEMU_LOCK_GUARD(&q->lock);
+
+    qio_channel_socket_send_queue_reap(sioc, false, NULL);
+    if (q->error) {
+        error_setg_errno(errp, q->error, "Unable to write to socket");
+        return -1;
+    }
+
+    /* Start sending what was queued behind a chain that has completed */
+    if (!q->nr_inflight && q->nr_pending &&
+        qio_channel_socket_send_queue_submit(sioc, errp) < 0) {
+        return -1;
+    }
+
+    while (q->nr_sends == q->depth) {
+        if (q->nr_pending) {
+            if (qio_channel_socket_send_queue_submit(sioc, errp) < 0) {
+                return -1;
+            }
+        } else if (qio_channel_socket_send_queue_reap(sioc, true,
+                                                      errp) < 0) {
+            return -1;
+        }
+    }
+
+    if (flags & QIO_CHANNEL_WRITE_FLAG_ZERO_COPY) {
+        send = g_malloc0(sizeof(*send) + niov * sizeof(*iov));
+        memcpy(send->iov, iov, niov * sizeof(*iov));
+        send->msg.msg_iov = send->iov;
+        send->msg.msg_iovlen = niov;
+        send->zero_copy = true;
+    } else {
+        send = g_malloc0(sizeof(*send) + sizeof(*iov));
+        send->bounce = g_malloc(len);
+        iov_to_buf(iov, niov, 0, send->bounce, len);
+        send->iov[0].iov_base = send->bounce;
+        send->iov[0].iov_len = len;
+        send->msg.msg_iov = send->iov;
+        send->msg.msg_iovlen = 1;
+    }
+    send->len = len;
+
+    /* The ring has one entry more than the queue, see below */
+    sqe = io_uring_get_sqe(&q->ring);
+    assert(sqe);
+    if (send->zero_copy) {
+        /* MSG_WAITALL makes the ring retry short sends */
+        io_uring_prep_sendmsg_zc(sqe, sioc->fd, &send->msg, MSG_WAITALL);
+#ifdef IORING_SEND_ZC_REPORT_USAGE
+        sqe->ioprio |= IORING_SEND_ZC_REPORT_USAGE;
+#endif
+        sioc->zero_copy_queued++;
+    } else {
+        io_uring_prep_sendmsg(sqe, sioc->fd, &send->msg, MSG_WAITALL);
+    }
+    io_uring_sqe_set_data(sqe, send);
+    if (q->last_sqe) {
+        q->last_sqe->flags |= IOSQE_IO_LINK;
+    }
+    q->last_sqe = sqe;
+    q->nr_pending++;
+    QLIST_INSERT_HEAD(&q->sends, send, next);
+    q->nr_sends++;
+
+    /* Nothing is being sent, start right away */
+    if (!q->nr_inflight &&
+        qio_channel_socket_send_queue_submit(sioc, errp) < 0) {
+        return -1;
+    }
+    return len;
+}
+
+/* Wait until the data and buffers of all writes are released */
+static int qio_channel_socket_send_queue_flush(QIOChannelSocket *sioc,
+                                               Error **errp)
+{
+    QIOChannelSocketSendQueue *q = sioc->send_queue;
+
+    QEMU_LOCK_GUARD(&q->lock);
+
+    if (qio_channel_socket_send_queue_submit(sioc, errp) < 0) {
+        return -1;
+    }
+    while (q->nr_sends) {
+        if (qio_channel_socket_send_queue_reap(sioc, true, errp) < 0) {
+            return -1;
+        }
+    }
+    if (q->error) {
+        error_setg_errno(errp, q->error, "Unable to write to socket");
+        return -1;
+    }
+    return 0;
+}
+
+static void qio_channel_socket_send_queue_free(QIOChannelSocket *sioc)
+{
+    QIOChannelSocketSendQueue *q = sioc->send_queue;
+    QIOChannelSocketSend *send, *next;
+    struct io_uring_sqe *sqe;
+
+    if (!q) {
+        return;
+    }
+
+    if (q->nr_pending || q->nr_inflight) {
+        /*
+         * Nobody waits for the data any more.  Cancel the writes that are
+         * still waiting for the socket, using the spare ring entry.
+         */
+        sqe = io_uring_get_sqe(&q->ring);
+        io_uring_prep_cancel(sqe, NULL, IORING_ASYNC_CANCEL_ANY);
+        io_uring_sqe_set_data(sqe, NULL);
+        if (io_uring_submit(&q->ring) >= 0) {
+            q->nr_inflight += q->nr_pending;
+            while (q->nr_inflight) {
+                if (qio_channel_socket_send_queue_reap(sioc, true,
+                                                       NULL) < 0) {
+                    break;
+                }
+            }
+        }
+    }
+
+    /* Zero copy buffers belong to the caller, do not wait for them */
+    QLIST_FOREACH_SAFE(send, &q->sends, next, next) {
+        g_free(send->bounce);
+        g_free(send);
+    }
+    io_uring_queue_exit(&q->ring);
+    qemu_mutex_destroy(&q->lock);
+    g_free(q);
+    sioc->send_queue = NULL;
+}
+#endif /* QEMU_SOCKET_SEND_QUEUE */
+
+int qio_channel_socket_enable_send_queue(QIOChannelSocket *ioc,
+                                         unsigned int depth,
+                                         Error **errp)
+{
+#ifdef QEMU_SOCKET_SEND_QUEUE
+    QIOChannelSocketSendQueue *q;
+    struct io_uring_probe *probe;
+    bool supported;
+    int ret;
+
+    assert(!ioc->send_queue && depth);
+
+    q = g_new0(QIOChannelSocketSendQueue, 1);
+    /* One spare entry to cancel the queue in case it is closed early */
+    ret = io_uring_queue_init(depth + 1, &q->ring, IORING_SETUP_SUBMIT_ALL);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Unable to create socket send queue");
+        g_free(q);
+        return -1;
+    }
+
+    probe = io_uring_get_probe_ring(&q->ring);
+    supported = probe &&
+                io_uring_opcode_supported(probe, IORING_OP_SENDMSG_ZC);
+    io_uring_free_probe(probe);
+    if (!supported) {
+        error_setg(errp, "Socket send queues not supported by host kernel");
+        io_uring_queue_exit(&q->ring);
+        g_free(q);
+        return -1;
+    }
+
+    qemu_mutex_init(&q->lock);
+    q->depth = depth;
+    QLIST_INIT(&q->sends);
+    ioc->send_queue = q;
+    qio_channel_set_feature(QIO_CHANNEL(ioc),
+                            QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY);
+    trace_qio_channel_socket_send_queue(ioc, depth);
+    return 0;
+#else
+    error_setg(errp, "Socket send queues not supported on this host");
+    return -1;
+#endif
+}
+
+int qio_channel_socket_submit_send_queue(QIOChannelSocket *ioc,
+                                         Error **errp)
+{
+#ifdef QEMU_SOCKET_SEND_QUEUE
+    if (ioc->send_queue) {
+        QEMU_LOCK_GUARD(&ioc->send_queue->lock);
+        return qio_channel_socket_send_queue_submit(ioc, errp);
+    }
+#endif
+    return 0;
+}
+
 static int
 qio_channel_socket_set_fd(QIOChannelSocket *sioc,
                           int fd,
@@ -450,6 +823,9 @@ static void qio_channel_socket_finalize(Object *obj)
 {
     QIOChannelSocket *ioc = QIO_CHANNEL_SOCKET(obj);
 
+#ifdef QEMU_SOCKET_SEND_QUEUE
+    qio_channel_socket_send_queue_free(ioc);
+#endif
     if (ioc->fd != -1) {
         QIOChannel *ioc_local = QIO_CHANNEL(ioc);
         if (qio_channel_has_feature(ioc_local, QIO_CHANNEL_FEATURE_LISTEN)) {
@@ -630,6 +1006,18 @@ static ssize_t qio_channel_socket_writev(QIOChannel *ioc,
     bool zerocopy_flushed_once = false;
 #endif
 
+#ifdef QEMU_SOCKET_SEND_QUEUE
+    if (sioc->send_queue) {
+        if (nfds) {
+            error_setg(errp, "Cannot send file descriptors through a "
+                       "socket send queue");
+            return -1;
+        }
+        return qio_channel_socket_send_queue_writev(sioc, iov, niov, flags,
+                                                    errp);
+    }
+#endif
+
     memset(control, 0, CMSG_SPACE(sizeof(int) * SOCKET_MAX_FDS));
 
     msg.msg_iov = (struct iovec *)iov;
@@ -816,6 +1204,16 @@ static int qio_channel_socket_flush_internal(QIOChannel *ioc,
     char control[CMSG_SPACE(sizeof(*serr))];
     int received;
 
+#ifdef QEMU_SOCKET_SEND_QUEUE
+    if (sioc->send_queue) {
+        if (block) {
+            return qio_channel_socket_send_queue_flush(sioc, errp);
+        }
+        QEMU_LOCK_GUARD(&sioc->send_queue->lock);
+        return qio_channel_socket_send_queue_reap(sioc, false, errp);
+    }
+#endif
+
     if (sioc->zero_copy_queued == sioc->zero_copy_sent) {
         return 0;
     }
@@ -910,6 +1308,16 @@ static int qio_channel_socket_flush(QIOChannel *ioc,
 
 #endif /* QEMU_MSG_ZEROCOPY */
 
+int qio_channel_socket_reap_zero_copy(QIOChannelSocket *ioc,
+                                      Error **errp)
+{
+#ifdef QEMU_MSG_ZEROCOPY
+    return qio_channel_socket_flush_internal(QIO_CHANNEL(ioc), false, errp);
+#else
+    return 0;
+#endif
+}
+
 static int
 qio_channel_socket_set_blocking(QIOChannel *ioc,
                                 bool enabled,
@@ -985,6 +1393,9 @@ qio_channel_socket_close(QIOChannel *ioc,
     int rc = 0;
     Error *err = NULL;
 
+#ifdef QEMU_SOCKET_SEND_QUEUE
+    qio_channel_socket_send_queue_free(sioc);
+#endif
     if (sioc->fd != -1) {
 #ifdef WIN32
         qemu_socket_unselect_nofail(sioc->fd);
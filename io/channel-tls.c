@@ -22,6 +22,7 @@
 #include "qapi/error.h"
 #include "qemu/module.h"
 #include "io/channel-tls.h"
+#include "io/channel-socket.h"
 #include "trace.h"
 #include "qemu/atomic.h"
 
@@ -157,6 +158,27 @@ static gboolean qio_channel_tls_handshake_io(QIOChannel *ioc,
                                              GIOCondition condition,
                                              gpointer user_data);
 
+/*
+ * Let the kernel encrypt the data we send, if the credentials ask for it.
+ * Failing to do so is not fatal, the session goes on in userspace.
+ */
+static void qio_channel_tls_enable_ktls(QIOChannelTLS *ioc)
+{
+    QIOChannelSocket *sioc = (QIOChannelSocket *)
+        object_dynamic_cast(OBJECT(ioc->master), TYPE_QIO_CHANNEL_SOCKET);
+    Error *err = NULL;
+
+    if (!sioc) {
+        return;
+    }
+    if (qcrypto_tls_session_enable_ktls(ioc->session, sioc->fd, &err) == 0) {
+        trace_qio_channel_tls_ktls_enabled(ioc);
+    } else if (err) {
+        trace_qio_channel_tls_ktls_fail(ioc, error_get_pretty(err));
+        error_free(err);
+    }
+}
+
 static void qio_channel_tls_handshake_task(QIOChannelTLS *ioc,
                                            QIOTask *task,
                                            GMainContext *context)
@@ -181,6 +203,7 @@ static void qio_channel_tls_handshake_task(QIOChannelTLS *ioc,
             qio_task_set_error(task, err);
         } else {
             trace_qio_channel_tls_credentials_allow(ioc);
+            qio_channel_tls_enable_ktls(ioc);
         }
         qio_task_complete(task);
     } else {
@@ -425,6 +448,12 @@ static ssize_t qio_channel_tls_writev(QIOChannel *ioc,
     size_t i;
     ssize_t done = 0;
 
+    if (qcrypto_tls_session_has_ktls(tioc->session)) {
+        /* Records are built by the kernel, no need to split the iovec */
+        return qio_channel_writev_full(tioc->master, iov, niov,
+                                       NULL, 0, 0, errp);
+    }
+
     for (i = 0 ; i < niov ; i++) {
         ssize_t ret = qcrypto_tls_session_write(tioc->session,
                                                 iov[i].iov_base,
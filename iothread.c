@@ -25,6 +25,9 @@
 #include "qemu/rcu.h"
 #include "qemu/main-loop.h"
 
+#ifdef CONFIG_NUMA
+#include <numa.h>
+#endif
 
 #ifdef CONFIG_POSIX
 /* Benchmark results from 2016 on NVMe SSD drives show max polling times around
@@ -36,10 +39,35 @@
 #define IOTHREAD_POLL_MAX_NS_DEFAULT 0ULL
 #endif
 
+#ifdef CONFIG_NUMA
+/* Runs in iothread_run() thread */
+static void iothread_bind_numa_node(IOThread *iothread)
+{
+    if (iothread->numa_node < 0) {
+        return;
+    }
+
+    if (numa_run_on_node(iothread->numa_node) < 0) {
+        warn_report("iothread: cannot run on NUMA node %" PRId64 ": %s",
+                    iothread->numa_node, strerror(errno));
+        return;
+    }
+
+    /*
+     * glibc gives each thread its own malloc arena, so buffers allocated
+     * by this thread end up on the node's memory.
+     */
+    numa_set_preferred(iothread->numa_node);
+}
+#endif
+
 static void *iothread_run(void *opaque)
 {
     IOThread *iothread = opaque;
 
+#ifdef CONFIG_NUMA
+    iothread_bind_numa_node(iothread);
+#endif
     rcu_register_thread();
     /*
      * g_main_context_push_thread_default() must be called before anything
@@ -103,6 +131,8 @@ static void iothread_instance_init(Object *obj)
     IOThread *iothread = IOTHREAD(obj);
 
     iothread->poll_max_ns = IOTHREAD_POLL_MAX_NS_DEFAULT;
+    iothread->io_uring_sqpoll_cpu = -1;
+    iothread->numa_node = -1;
     iothread->thread_id = -1;
     qemu_sem_init(&iothread->init_done_sem, 0);
     /* By default, we don't run gcontext */
@@ -136,6 +166,7 @@ static void iothread_instance_finalize(Object *obj)
         iothread->main_loop = NULL;
     }
     qemu_sem_destroy(&iothread->init_done_sem);
+    g_free(iothread->poll_group);
 }
 
 static void iothread_init_gcontext(IOThread *iothread, const char *thread_name)
@@ -185,11 +216,25 @@ static void iothread_init(EventLoopBase *base, Error **errp)
 
     iothread->stopping = false;
     iothread->running = true;
+    if (iothread->io_uring_sqpoll_cpu >= 0 && !iothread->io_uring_sqpoll) {
+        error_setg(errp, "io-uring-sqpoll-cpu requires io-uring-sqpoll=on");
+        return;
+    }
+
     iothread->ctx = aio_context_new(errp);
     if (!iothread->ctx) {
         return;
     }
 
+    if (iothread->io_uring_sqpoll &&
+        !aio_context_set_io_uring_sqpoll(iothread->ctx,
+                                         iothread->io_uring_sqpoll_cpu,
+                                         errp)) {
+        aio_context_unref(iothread->ctx);
+        iothread->ctx = NULL;
+        return;
+    }
+
     thread_name = g_strdup_printf("IO %s",
                         object_get_canonical_path_component(OBJECT(base)));
 
@@ -199,6 +244,10 @@ static void iothread_init(EventLoopBase *base, Error **errp)
      */
     iothread_init_gcontext(iothread, thread_name);
 
+    if (iothread->poll_group) {
+        aio_context_set_poll_group(iothread->ctx, iothread->poll_group);
+    }
+
     iothread_set_aio_context_params(base, &local_error);
     if (local_error) {
         error_propagate(errp, local_error);
@@ -292,6 +341,119 @@ static void iothread_set_poll_param(Object *obj, Visitor *v,
     }
 }
 
+static char *iothread_get_poll_group(Object *obj, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+
+    return g_strdup(iothread->poll_group);
+}
+
+static void iothread_set_poll_group(Object *obj, const char *value,
+                                    Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+
+    if (iothread->ctx) {
+        error_setg(errp, "poll-group cannot be changed after the "
+                   "iothread has been created");
+        return;
+    }
+    g_free(iothread->poll_group);
+    iothread->poll_group = g_strdup(value);
+}
+
+static bool iothread_get_io_uring_sqpoll(Object *obj, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+
+    return iothread->io_uring_sqpoll;
+}
+
+static void iothread_set_io_uring_sqpoll(Object *obj, bool value,
+                                         Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+
+    if (iothread->ctx) {
+        error_setg(errp, "io-uring-sqpoll cannot be changed after the "
+                   "iothread has been created");
+        return;
+    }
+    iothread->io_uring_sqpoll = value;
+}
+
+static void iothread_get_io_uring_sqpoll_cpu(Object *obj, Visitor *v,
+        const char *name, void *opaque, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+
+    visit_type_int64(v, name, &iothread->io_uring_sqpoll_cpu, errp);
+}
+
+static void iothread_set_io_uring_sqpoll_cpu(Object *obj, Visitor *v,
+        const char *name, void *opaque, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+    int64_t value;
+
+    if (iothread->ctx) {
+        error_setg(errp, "%s cannot be changed after the iothread has been "
+                   "created", name);
+        return;
+    }
+
+    if (!visit_type_int64(v, name, &value, errp)) {
+        return;
+    }
+
+    if (value < 0 || value > INT_MAX) {
+        error_setg(errp, "%s value must be in range [0, %d]", name, INT_MAX);
+        return;
+    }
+
+    iothread->io_uring_sqpoll_cpu = value;
+}
+
+#ifdef CONFIG_NUMA
+static void iothread_get_numa_node(Object *obj, Visitor *v,
+        const char *name, void *opaque, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+
+    visit_type_int64(v, name, &iothread->numa_node, errp);
+}
+
+static void iothread_set_numa_node(Object *obj, Visitor *v,
+        const char *name, void *opaque, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+    int64_t value;
+
+    if (iothread->ctx) {
+        error_setg(errp, "%s cannot be changed after the iothread has been "
+                   "created", name);
+        return;
+    }
+
+    if (!visit_type_int64(v, name, &value, errp)) {
+        return;
+    }
+
+    if (numa_available() < 0) {
+        error_setg(errp, "NUMA is not available on this host");
+        return;
+    }
+    if (value < 0 || value > numa_max_node() ||
+        !numa_bitmask_isbitset(numa_all_nodes_ptr, value)) {
+        error_setg(errp, "%s value %" PRId64 " is not an available host "
+                   "NUMA node", name, value);
+        return;
+    }
+
+    iothread->numa_node = value;
+}
+#endif
+
 static void iothread_class_init(ObjectClass *klass, const void *class_data)
 {
     EventLoopBaseClass *bc = EVENT_LOOP_BASE_CLASS(klass);
@@ -311,6 +473,24 @@ static void iothread_class_init(ObjectClass *klass, const void *class_data)
                               iothread_get_poll_param,
                               iothread_set_poll_param,
                               NULL, &poll_shrink_info);
+    object_class_property_add_str(klass, "poll-group",
+                                  iothread_get_poll_group,
+                                  iothread_set_poll_group);
+#ifdef CONFIG_LINUX_IO_URING
+    object_class_property_add_bool(klass, "io-uring-sqpoll",
+                                   iothread_get_io_uring_sqpoll,
+                                   iothread_set_io_uring_sqpoll);
+    object_class_property_add(klass, "io-uring-sqpoll-cpu", "int",
+                              iothread_get_io_uring_sqpoll_cpu,
+                              iothread_set_io_uring_sqpoll_cpu,
+                              NULL, NULL);
+#endif
+#ifdef CONFIG_NUMA
+    object_class_property_add(klass, "numa-node", "int",
+                              iothread_get_numa_node,
+                              iothread_set_numa_node,
+                              NULL, NULL);
+#endif
 }
 
 static const TypeInfo iothread_info = {
@@ -357,6 +537,7 @@ static int query_one_iothread(Object *object, void *opaque)
     info->poll_grow = iothread->poll_grow;
     info->poll_shrink = iothread->poll_shrink;
     info->aio_max_batch = iothread->parent_obj.aio_max_batch;
+    info->wakeups = stat64_get(&iothread->ctx->wakeups);
 
     QAPI_LIST_APPEND(*tail, info);
     return 0;
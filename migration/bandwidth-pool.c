@@ -0,0 +1,469 @@
+/*
+ * Host-wide migration bandwidth pool
+ *
+ * Several QEMU processes migrating at the same time, for example while
+ * evacuating a host, can share one bandwidth budget by creating a pool
+ * object on the same file.  The file is mapped in every process and holds
+ * one slot per outgoing migration, where each of them regularly publishes
+ * how much data it still has to send before it converges.
+ *
+ * Every active migration is guaranteed a small share of the budget, so
+ * that none of them starves; the rest goes to the migrations closest to
+ * convergence first, so that they finish and free their share early
+ * instead of all of them finishing late.
+ *
+ * Copyright (c) 2026 The QEMU Project Developers
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include <sys/mman.h>
+#include "qapi/error.h"
+#include "qapi/visitor.h"
+#include "qemu/atomic.h"
+#include "qemu/module.h"
+#include "qemu/timer.h"
+#include "qemu/units.h"
+#include "qom/object_interfaces.h"
+#include "bandwidth-pool.h"
+#include "trace.h"
+
+#define BANDWIDTH_POOL_MAGIC    0x514d4257 /* "QMBW" */
+#define BANDWIDTH_POOL_VERSION  1
+#define BANDWIDTH_POOL_SLOTS    64
+
+/* Attempts at taking the file lock, 1ms apart */
+#define BANDWIDTH_POOL_LOCK_RETRIES  1000
+
+/* A slot takes part in the allocation if updated within this interval */
+#define BANDWIDTH_POOL_ACTIVE_MS  1000
+/* A slot not updated within this interval can be taken by someone else */
+#define BANDWIDTH_POOL_EXPIRE_MS  10000
+
+/* Each active migration is guaranteed a 1/BANDWIDTH_POOL_FLOOR_DIV share */
+#define BANDWIDTH_POOL_FLOOR_DIV  4
+
+/*
+ * All the fields are only accessed atomically, as they are shared with
+ * the other processes.  Sizes are in KiB, rates in KiB per second, and
+ * times in milliseconds of the host monotonic clock, truncated.
+ */
+typedef struct {
+    uint32_t owner;
+    uint32_t heartbeat;
+    uint32_t remaining;
+    uint32_t max_bandwidth;
+} BandwidthPoolSlot;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t max_bandwidth;
+    uint32_t reserved;
+    BandwidthPoolSlot slots[BANDWIDTH_POOL_SLOTS];
+} BandwidthPoolShared;
+
+struct MigrationBandwidthPool {
+    Object parent_obj;
+
+    char *mem_path;
+    uint64_t max_bandwidth;
+
+    BandwidthPoolShared *shared;
+    /* Slot taken by the current migration, or -1 */
+    int slot;
+};
+
+static uint32_t bandwidth_pool_now(void)
+{
+    return get_clock() / SCALE_MS;
+}
+
+static uint32_t bandwidth_pool_to_kib(uint64_t value)
+{
+    return MIN(value / KiB, UINT32_MAX);
+}
+
+static bool bandwidth_pool_slot_idle(BandwidthPoolSlot *slot, uint32_t now,
+                                     uint32_t interval)
+{
+    int32_t elapsed = now - qatomic_read(&slot->heartbeat);
+
+    return elapsed >= (int32_t)interval;
+}
+
+static int bandwidth_pool_claim(MigrationBandwidthPool *pool)
+{
+    uint32_t self = getpid();
+    uint32_t now = bandwidth_pool_now();
+    int i;
+
+    for (i = 0; i < BANDWIDTH_POOL_SLOTS; i++) {
+        BandwidthPoolSlot *slot = &pool->shared->slots[i];
+        uint32_t owner = qatomic_read(&slot->owner);
+
+        if (owner &&
+            !bandwidth_pool_slot_idle(slot, now, BANDWIDTH_POOL_EXPIRE_MS)) {
+            continue;
+        }
+        if (qatomic_cmpxchg(&slot->owner, owner, self) != owner) {
+            continue;
+        }
+        qatomic_set(&slot->remaining, UINT32_MAX);
+        qatomic_set(&slot->max_bandwidth, UINT32_MAX);
+        qatomic_set(&slot->heartbeat, now);
+        return i;
+    }
+
+    return -1;
+}
+
+MigrationBandwidthPool *migration_bandwidth_pool_join(const char *id,
+                                                      Error **errp)
+{
+    Object *obj = object_resolve_path_component(object_get_objects_root(), id);
+    MigrationBandwidthPool *pool;
+
+    if (!obj) {
+        error_setg(errp, "No migration bandwidth pool with id '%s'", id);
+        return NULL;
+    }
+    pool = (MigrationBandwidthPool *)
+        object_dynamic_cast(obj, TYPE_MIGRATION_BANDWIDTH_POOL);
+    if (!pool) {
+        error_setg(errp, "Object with id '%s' is not a migration "
+                   "bandwidth pool", id);
+        return NULL;
+    }
+
+    pool->slot = bandwidth_pool_claim(pool);
+    if (pool->slot < 0) {
+        error_setg(errp, "Migration bandwidth pool '%s' is full", id);
+        return NULL;
+    }
+
+    object_ref(OBJECT(pool));
+    return pool;
+}
+
+void migration_bandwidth_pool_leave(MigrationBandwidthPool *pool)
+{
+    if (pool->slot >= 0) {
+        qatomic_cmpxchg(&pool->shared->slots[pool->slot].owner,
+                        (uint32_t)getpid(), 0);
+        pool->slot = -1;
+    }
+    object_unref(OBJECT(pool));
+}
+
+typedef struct {
+    int slot;
+    uint32_t remaining;
+    uint32_t max_bandwidth;
+    uint32_t alloc;
+} BandwidthPoolEntry;
+
+static gint bandwidth_pool_entry_cmp(gconstpointer a, gconstpointer b)
+{
+    const BandwidthPoolEntry *ea = a, *eb = b;
+
+    if (ea->remaining != eb->remaining) {
+        return ea->remaining < eb->remaining ? -1 : 1;
+    }
+    return ea->slot - eb->slot;
+}
+
+uint64_t migration_bandwidth_pool_update(MigrationBandwidthPool *pool,
+                                         uint64_t remaining,
+                                         uint64_t max_bandwidth)
+{
+    BandwidthPoolEntry entries[BANDWIDTH_POOL_SLOTS];
+    uint32_t now = bandwidth_pool_now();
+    uint32_t total = qatomic_read(&pool->shared->max_bandwidth);
+    uint32_t want = max_bandwidth ? bandwidth_pool_to_kib(max_bandwidth)
+                                  : UINT32_MAX;
+    uint32_t left, min_share, share = 0;
+    int n = 0, i;
+
+    /* Someone took over our slot after we failed to update it for long */
+    if (pool->slot >= 0 &&
+        qatomic_read(&pool->shared->slots[pool->slot].owner) !=
+        (uint32_t)getpid()) {
+        pool->slot = -1;
+    }
+    if (pool->slot < 0) {
+        pool->slot = bandwidth_pool_claim(pool);
+    }
+
+    if (pool->slot >= 0) {
+        BandwidthPoolSlot *slot = &pool->shared->slots[pool->slot];
+
+        qatomic_set(&slot->remaining, bandwidth_pool_to_kib(remaining));
+        qatomic_set(&slot->max_bandwidth, want);
+        qatomic_set(&slot->heartbeat, now);
+    }
+
+    for (i = 0; i < BANDWIDTH_POOL_SLOTS; i++) {
+        BandwidthPoolSlot *slot = &pool->shared->slots[i];
+
+        if (!qatomic_read(&slot->owner) ||
+            bandwidth_pool_slot_idle(slot, now, BANDWIDTH_POOL_ACTIVE_MS)) {
+            continue;
+        }
+        entries[n].slot = i;
+        entries[n].remaining = qatomic_read(&slot->remaining);
+        entries[n].max_bandwidth = qatomic_read(&slot->max_bandwidth);
+        n++;
+    }
+
+    if (pool->slot < 0) {
+        /* No slot left for us, make do with the guaranteed share */
+        share = MIN(total / (BANDWIDTH_POOL_FLOOR_DIV * (n + 1)), want);
+        goto out;
+    }
+
+    /* Guaranteed share first, so that nobody starves... */
+    min_share = total / (BANDWIDTH_POOL_FLOOR_DIV * n);
+    left = total;
+    for (i = 0; i < n; i++) {
+        entries[i].alloc = MIN(min_share, entries[i].max_bandwidth);
+        left -= entries[i].alloc;
+    }
+
+    /* ...then the rest to the migrations closest to completion */
+    qsort(entries, n, sizeof(entries[0]), bandwidth_pool_entry_cmp);
+    for (i = 0; i < n; i++) {
+        uint32_t extra = MIN(entries[i].max_bandwidth - entries[i].alloc,
+                             left);
+
+        entries[i].alloc += extra;
+        left -= extra;
+        if (entries[i].slot == pool->slot) {
+            share = entries[i].alloc;
+        }
+    }
+
+out:
+    trace_migration_bandwidth_pool_update(pool->slot, n, remaining, share);
+    /* Never return 0, which would disable rate limiting altogether */
+    return (uint64_t)MAX(share, 1) * KiB;
+}
+
+static bool bandwidth_pool_map(MigrationBandwidthPool *pool, Error **errp)
+{
+    BandwidthPoolShared *shared;
+    struct stat st;
+    bool ok = false;
+    int fd, ret, i;
+
+    fd = qemu_create(pool->mem_path, O_RDWR, 0600, errp);
+    if (fd < 0) {
+        return false;
+    }
+
+    /*
+     * Serialize the initialization of the file with the other processes.
+     * They only hold the lock for a very short time, so just retry.
+     */
+    for (i = 0; (ret = qemu_lock_fd(fd, 0, 0, true)) == -EAGAIN &&
+                i < BANDWIDTH_POOL_LOCK_RETRIES; i++) {
+        g_usleep(1000);
+    }
+    if (ret) {
+        error_setg_errno(errp, -ret, "Failed to lock '%s'", pool->mem_path);
+        goto out;
+    }
+
+    if (fstat(fd, &st)) {
+        error_setg_errno(errp, errno, "Failed to stat '%s'", pool->mem_path);
+        goto out_unlock;
+    }
+    if (st.st_size && st.st_size != sizeof(*shared)) {
+        error_setg(errp, "'%s' is not a migration bandwidth pool",
+                   pool->mem_path);
+        goto out_unlock;
+    }
+    if (!st.st_size && ftruncate(fd, sizeof(*shared))) {
+        error_setg_errno(errp, errno, "Failed to resize '%s'",
+                         pool->mem_path);
+        goto out_unlock;
+    }
+
+    shared = mmap(NULL, sizeof(*shared), PROT_READ | PROT_WRITE, MAP_SHARED,
+                  fd, 0);
+    if (shared == MAP_FAILED) {
+        error_setg_errno(errp, errno, "Failed to map '%s'", pool->mem_path);
+        goto out_unlock;
+    }
+
+    if (!st.st_size) {
+        shared->version = BANDWIDTH_POOL_VERSION;
+        qatomic_store_release(&shared->magic, BANDWIDTH_POOL_MAGIC);
+    } else if (qatomic_load_acquire(&shared->magic) != BANDWIDTH_POOL_MAGIC ||
+               shared->version != BANDWIDTH_POOL_VERSION) {
+        error_setg(errp, "'%s' is not a migration bandwidth pool",
+                   pool->mem_path);
+        munmap(shared, sizeof(*shared));
+        goto out_unlock;
+    }
+
+    pool->shared = shared;
+    ok = true;
+
+out_unlock:
+    qemu_unlock_fd(fd, 0, 0);
+out:
+    /* The mapping stays valid after the file is closed */
+    qemu_close(fd);
+    return ok;
+}
+
+static void bandwidth_pool_complete(UserCreatable *uc, Error **errp)
+{
+    MigrationBandwidthPool *pool = MIGRATION_BANDWIDTH_POOL(uc);
+
+    if (!pool->mem_path) {
+        error_setg(errp, "'mem-path' property is not set");
+        return;
+    }
+
+    if (!bandwidth_pool_map(pool, errp)) {
+        return;
+    }
+
+    /* Without a value of our own, keep using the one already shared */
+    if (pool->max_bandwidth) {
+        qatomic_set(&pool->shared->max_bandwidth,
+                    bandwidth_pool_to_kib(pool->max_bandwidth));
+    } else if (!qatomic_read(&pool->shared->max_bandwidth)) {
+        error_setg(errp, "'max-bandwidth' property is not set");
+        munmap(pool->shared, sizeof(*pool->shared));
+        pool->shared = NULL;
+    }
+}
+
+static bool bandwidth_pool_can_be_deleted(UserCreatable *uc)
+{
+    MigrationBandwidthPool *pool = MIGRATION_BANDWIDTH_POOL(uc);
+
+    return pool->slot < 0;
+}
+
+static char *bandwidth_pool_get_mem_path(Object *obj, Error **errp)
+{
+    MigrationBandwidthPool *pool = MIGRATION_BANDWIDTH_POOL(obj);
+
+    return g_strdup(pool->mem_path);
+}
+
+static void bandwidth_pool_set_mem_path(Object *obj, const char *value,
+                                        Error **errp)
+{
+    MigrationBandwidthPool *pool = MIGRATION_BANDWIDTH_POOL(obj);
+
+    if (pool->shared) {
+        error_setg(errp, "cannot change property 'mem-path' of %s",
+                   object_get_typename(obj));
+        return;
+    }
+
+    g_free(pool->mem_path);
+    pool->mem_path = g_strdup(value);
+}
+
+static void bandwidth_pool_get_max_bandwidth(Object *obj, Visitor *v,
+                                             const char *name, void *opaque,
+                                             Error **errp)
+{
+    MigrationBandwidthPool *pool = MIGRATION_BANDWIDTH_POOL(obj);
+    uint64_t value = pool->max_bandwidth;
+
+    if (pool->shared) {
+        value = (uint64_t)qatomic_read(&pool->shared->max_bandwidth) * KiB;
+    }
+
+    visit_type_size(v, name, &value, errp);
+}
+
+static void bandwidth_pool_set_max_bandwidth(Object *obj, Visitor *v,
+                                             const char *name, void *opaque,
+                                             Error **errp)
+{
+    MigrationBandwidthPool *pool = MIGRATION_BANDWIDTH_POOL(obj);
+    uint64_t value;
+
+    if (!visit_type_size(v, name, &value, errp)) {
+        return;
+    }
+    if (value < MiB) {
+        error_setg(errp, "property '%s' of %s must be at least 1M",
+                   name, object_get_typename(obj));
+        return;
+    }
+
+    pool->max_bandwidth = value;
+    /* Changing it on a live pool changes it for every process */
+    if (pool->shared) {
+        qatomic_set(&pool->shared->max_bandwidth,
+                    bandwidth_pool_to_kib(value));
+    }
+}
+
+static void bandwidth_pool_init(Object *obj)
+{
+    MigrationBandwidthPool *pool = MIGRATION_BANDWIDTH_POOL(obj);
+
+    pool->slot = -1;
+}
+
+static void bandwidth_pool_finalize(Object *obj)
+{
+    MigrationBandwidthPool *pool = MIGRATION_BANDWIDTH_POOL(obj);
+
+    if (pool->shared) {
+        munmap(pool->shared, sizeof(*pool->shared));
+    }
+    g_free(pool->mem_path);
+}
+
+static void bandwidth_pool_class_init(ObjectClass *oc, const void *data)
+{
+    UserCreatableClass *ucc = USER_CREATABLE_CLASS(oc);
+
+    ucc->complete = bandwidth_pool_complete;
+    ucc->can_be_deleted = bandwidth_pool_can_be_deleted;
+
+    object_class_property_add_str(oc, "mem-path",
+                                  bandwidth_pool_get_mem_path,
+                                  bandwidth_pool_set_mem_path);
+    object_class_property_set_description(oc, "mem-path",
+        "File shared by the processes using the pool");
+    object_class_property_add(oc, "max-bandwidth", "size",
+                              bandwidth_pool_get_max_bandwidth,
+                              bandwidth_pool_set_max_bandwidth,
+                              NULL, NULL);
+    object_class_property_set_description(oc, "max-bandwidth",
+        "Bandwidth shared by all the migrations, in bytes per second");
+}
+
+static const TypeInfo bandwidth_pool_info = {
+    .name = TYPE_MIGRATION_BANDWIDTH_POOL,
+    .parent = TYPE_OBJECT,
+    .instance_size = sizeof(MigrationBandwidthPool),
+    .instance_init = bandwidth_pool_init,
+    .instance_finalize = bandwidth_pool_finalize,
+    .class_init = bandwidth_pool_class_init,
+    .interfaces = (const InterfaceInfo[]) {
+        { TYPE_USER_CREATABLE },
+        { }
+    }
+};
+
+static void bandwidth_pool_register_types(void)
+{
+    type_register_static(&bandwidth_pool_info);
+}
+
+type_init(bandwidth_pool_register_types);
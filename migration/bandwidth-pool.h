@@ -0,0 +1,60 @@
+/*
+ * Host-wide migration bandwidth pool
+ *
+ * Copyright (c) 2026 The QEMU Project Developers
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef QEMU_MIGRATION_BANDWIDTH_POOL_H
+#define QEMU_MIGRATION_BANDWIDTH_POOL_H
+
+#include "qom/object.h"
+
+#define TYPE_MIGRATION_BANDWIDTH_POOL "x-migration-bandwidth-pool"
+
+OBJECT_DECLARE_SIMPLE_TYPE(MigrationBandwidthPool, MIGRATION_BANDWIDTH_POOL)
+
+#ifdef CONFIG_POSIX
+/*
+ * Look up the pool object named @id, and take a slot in it.  Returns
+ * a new reference to the pool, or NULL with @errp set.
+ */
+MigrationBandwidthPool *migration_bandwidth_pool_join(const char *id,
+                                                      Error **errp);
+/* Give up the slot taken by migration_bandwidth_pool_join() */
+void migration_bandwidth_pool_leave(MigrationBandwidthPool *pool);
+/*
+ * Publish the number of bytes this migration still has to send before it
+ * converges, and the most it is allowed to use (0 for no limit).  Returns
+ * the share of the pool bandwidth, in bytes per second, this migration
+ * should use until the next update.
+ */
+uint64_t migration_bandwidth_pool_update(MigrationBandwidthPool *pool,
+                                         uint64_t remaining,
+                                         uint64_t max_bandwidth);
+#else
+#include "qapi/error.h"
+
+static inline MigrationBandwidthPool *
+migration_bandwidth_pool_join(const char *id, Error **errp)
+{
+    error_setg(errp, "Migration bandwidth pools are not supported on "
+               "this host");
+    return NULL;
+}
+
+static inline void migration_bandwidth_pool_leave(MigrationBandwidthPool *pool)
+{
+}
+
+static inline uint64_t
+migration_bandwidth_pool_update(MigrationBandwidthPool *pool,
+                                uint64_t remaining, uint64_t max_bandwidth)
+{
+    return max_bandwidth;
+}
+#endif
+
+#endif
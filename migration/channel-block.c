@@ -22,8 +22,29 @@
 #include "migration/channel-block.h"
 #include "qapi/error.h"
 #include "block/block.h"
+#include "qemu/iov.h"
+#include "qemu/memalign.h"
+#include "qemu/units.h"
 #include "trace.h"
 
+/* Size of the requests used for sequential I/O */
+#define QIO_CHANNEL_BLOCK_CHUNK_SIZE (1 * MiB)
+
+/* Maximum number of background requests */
+#define QIO_CHANNEL_BLOCK_MAX_IN_FLIGHT 8
+
+struct QIOChannelBlockChunk {
+    QIOChannelBlock *ioc;
+    uint8_t *buf;
+    off_t offset;
+    size_t len;
+    /* Bytes filled in by writes, or consumed by reads */
+    size_t pos;
+    /* Result of a read, valid once @done is set */
+    int ret;
+    bool done;
+};
+
 QIOChannelBlock *
 qio_channel_block_new(BlockDriverState *bs)
 {
@@ -39,11 +60,146 @@ qio_channel_block_new(BlockDriverState *bs)
 }
 
 
+static QIOChannelBlockChunk *
+qio_channel_block_chunk_new(QIOChannelBlock *bioc, off_t offset)
+{
+    QIOChannelBlockChunk *c = g_new0(QIOChannelBlockChunk, 1);
+
+    c->ioc = bioc;
+    c->buf = qemu_blockalign(bioc->bs, QIO_CHANNEL_BLOCK_CHUNK_SIZE);
+    c->offset = offset;
+    c->len = QIO_CHANNEL_BLOCK_CHUNK_SIZE;
+    return c;
+}
+
+
+static void
+qio_channel_block_chunk_free(QIOChannelBlockChunk *c)
+{
+    qemu_vfree(c->buf);
+    g_free(c);
+}
+
+
+static void coroutine_fn
+qio_channel_block_co_write(void *opaque)
+{
+    QIOChannelBlockChunk *c = opaque;
+    QIOChannelBlock *bioc = c->ioc;
+    QEMUIOVector qiov;
+    int ret;
+
+    qemu_iovec_init_buf(&qiov, c->buf, c->pos);
+    WITH_GRAPH_RDLOCK_GUARD() {
+        ret = bdrv_co_writev_vmstate(bioc->bs, &qiov, c->offset);
+    }
+    if (ret < 0) {
+        qatomic_cmpxchg(&bioc->ret, 0, ret);
+    }
+    qio_channel_block_chunk_free(c);
+
+    qatomic_dec(&bioc->in_flight);
+    aio_wait_kick();
+}
+
+
+static void coroutine_fn
+qio_channel_block_co_read(void *opaque)
+{
+    QIOChannelBlockChunk *c = opaque;
+    QIOChannelBlock *bioc = c->ioc;
+    QEMUIOVector qiov;
+
+    qemu_iovec_init_buf(&qiov, c->buf, c->len);
+    WITH_GRAPH_RDLOCK_GUARD() {
+        c->ret = bdrv_co_readv_vmstate(bioc->bs, &qiov, c->offset);
+    }
+    qatomic_store_release(&c->done, true);
+
+    qatomic_dec(&bioc->in_flight);
+    aio_wait_kick();
+}
+
+
+/* Wait until at most @max background requests are in flight */
+static void
+qio_channel_block_wait(QIOChannelBlock *bioc, int max)
+{
+    BDRV_POLL_WHILE(bioc->bs, qatomic_read(&bioc->in_flight) > max);
+}
+
+
+static void
+qio_channel_block_submit(QIOChannelBlock *bioc, CoroutineEntry *entry,
+                         QIOChannelBlockChunk *c)
+{
+    Coroutine *co = qemu_coroutine_create(entry, c);
+
+    qio_channel_block_wait(bioc, QIO_CHANNEL_BLOCK_MAX_IN_FLIGHT - 1);
+    qatomic_inc(&bioc->in_flight);
+    aio_co_enter(bdrv_get_aio_context(bioc->bs), co);
+}
+
+
+static void
+qio_channel_block_submit_write(QIOChannelBlock *bioc)
+{
+    QIOChannelBlockChunk *c = g_steal_pointer(&bioc->wchunk);
+
+    if (c) {
+        qio_channel_block_submit(bioc, qio_channel_block_co_write, c);
+    }
+}
+
+
+/* Submit read-ahead requests until the maximum is reached */
+static void
+qio_channel_block_fill_readahead(QIOChannelBlock *bioc)
+{
+    while (bioc->readahead.length < QIO_CHANNEL_BLOCK_MAX_IN_FLIGHT) {
+        QIOChannelBlockChunk *tail = g_queue_peek_tail(&bioc->readahead);
+        off_t offset = tail ? tail->offset + tail->len : bioc->offset;
+        QIOChannelBlockChunk *c = qio_channel_block_chunk_new(bioc, offset);
+
+        g_queue_push_tail(&bioc->readahead, c);
+        qio_channel_block_submit(bioc, qio_channel_block_co_read, c);
+    }
+}
+
+
+/*
+ * Complete all background requests and drop the read-ahead data.
+ * Returns the error of a failed background write, if any.
+ */
+static int
+qio_channel_block_drain(QIOChannelBlock *bioc, Error **errp)
+{
+    QIOChannelBlockChunk *c;
+    int ret;
+
+    qio_channel_block_submit_write(bioc);
+    qio_channel_block_wait(bioc, 0);
+    while ((c = g_queue_pop_head(&bioc->readahead))) {
+        qio_channel_block_chunk_free(c);
+    }
+
+    ret = qatomic_read(&bioc->ret);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "bdrv_writev_vmstate failed");
+        return -1;
+    }
+    return 0;
+}
+
+
 static void
 qio_channel_block_finalize(Object *obj)
 {
     QIOChannelBlock *ioc = QIO_CHANNEL_BLOCK(obj);
 
+    if (ioc->bs) {
+        qio_channel_block_drain(ioc, NULL);
+    }
     g_clear_pointer(&ioc->bs, bdrv_unref);
 }
 
@@ -58,18 +214,54 @@ qio_channel_block_readv(QIOChannel *ioc,
                         Error **errp)
 {
     QIOChannelBlock *bioc = QIO_CHANNEL_BLOCK(ioc);
+    QIOChannelBlockChunk *c;
     QEMUIOVector qiov;
+    size_t len;
     int ret;
 
-    qemu_iovec_init_external(&qiov, (struct iovec *)iov, niov);
-    ret = bdrv_readv_vmstate(bioc->bs, &qiov, bioc->offset);
-    if (ret < 0) {
-        error_setg_errno(errp, -ret, "bdrv_readv_vmstate failed");
+    if (qemu_in_coroutine()) {
+        /* Cannot poll for background requests, read synchronously */
+        qemu_iovec_init_external(&qiov, (struct iovec *)iov, niov);
+        ret = bdrv_readv_vmstate(bioc->bs, &qiov, bioc->offset);
+        if (ret < 0) {
+            error_setg_errno(errp, -ret, "bdrv_readv_vmstate failed");
+            return -1;
+        }
+
+        bioc->offset += qiov.size;
+        return qiov.size;
+    }
+
+    if (bioc->wchunk && qio_channel_block_drain(bioc, errp) < 0) {
         return -1;
     }
 
-    bioc->offset += qiov.size;
-    return qiov.size;
+    /* Drop read-ahead data that does not cover the current offset */
+    while ((c = g_queue_peek_head(&bioc->readahead)) &&
+           (bioc->offset < c->offset ||
+            bioc->offset >= c->offset + c->len)) {
+        BDRV_POLL_WHILE(bioc->bs, !qatomic_load_acquire(&c->done));
+        qio_channel_block_chunk_free(g_queue_pop_head(&bioc->readahead));
+    }
+    qio_channel_block_fill_readahead(bioc);
+
+    c = g_queue_peek_head(&bioc->readahead);
+    BDRV_POLL_WHILE(bioc->bs, !qatomic_load_acquire(&c->done));
+    if (c->ret < 0) {
+        error_setg_errno(errp, -c->ret, "bdrv_readv_vmstate failed");
+        qio_channel_block_chunk_free(g_queue_pop_head(&bioc->readahead));
+        return -1;
+    }
+
+    /* Short reads are fine, QEMUFile comes back for the rest */
+    c->pos = bioc->offset - c->offset;
+    len = iov_from_buf(iov, niov, 0, c->buf + c->pos, c->len - c->pos);
+    bioc->offset += len;
+    if (c->pos + len == c->len) {
+        qio_channel_block_chunk_free(g_queue_pop_head(&bioc->readahead));
+        qio_channel_block_fill_readahead(bioc);
+    }
+    return len;
 }
 
 
@@ -84,17 +276,61 @@ qio_channel_block_writev(QIOChannel *ioc,
 {
     QIOChannelBlock *bioc = QIO_CHANNEL_BLOCK(ioc);
     QEMUIOVector qiov;
+    size_t done = 0;
+    size_t i;
     int ret;
 
-    qemu_iovec_init_external(&qiov, (struct iovec *)iov, niov);
-    ret = bdrv_writev_vmstate(bioc->bs, &qiov, bioc->offset);
+    if (qemu_in_coroutine()) {
+        /* Cannot poll for background requests, write synchronously */
+        qemu_iovec_init_external(&qiov, (struct iovec *)iov, niov);
+        ret = bdrv_writev_vmstate(bioc->bs, &qiov, bioc->offset);
+        if (ret < 0) {
+            error_setg_errno(errp, -ret, "bdrv_writev_vmstate failed");
+            return -1;
+        }
+
+        bioc->offset += qiov.size;
+        return qiov.size;
+    }
+
+    ret = qatomic_read(&bioc->ret);
     if (ret < 0) {
         error_setg_errno(errp, -ret, "bdrv_writev_vmstate failed");
         return -1;
     }
+    if (!g_queue_is_empty(&bioc->readahead)) {
+        qio_channel_block_drain(bioc, NULL);
+    }
+    if (bioc->wchunk &&
+        bioc->wchunk->offset + bioc->wchunk->pos != bioc->offset) {
+        qio_channel_block_submit_write(bioc);
+    }
 
-    bioc->offset += qiov.size;
-    return qiov.size;
+    /* Gather the data into chunks that are written in the background */
+    for (i = 0; i < niov; i++) {
+        size_t pos = 0;
+
+        while (pos < iov[i].iov_len) {
+            QIOChannelBlockChunk *c = bioc->wchunk;
+            size_t len;
+
+            if (!c) {
+                c = bioc->wchunk = qio_channel_block_chunk_new(bioc,
+                                                               bioc->offset);
+            }
+            len = MIN(iov[i].iov_len - pos, c->len - c->pos);
+            memcpy(c->buf + c->pos, iov[i].iov_base + pos, len);
+            c->pos += len;
+            pos += len;
+            bioc->offset += len;
+            if (c->pos == c->len) {
+                qio_channel_block_submit_write(bioc);
+            }
+        }
+        done += pos;
+    }
+
+    return done;
 }
 
 static ssize_t
@@ -108,6 +344,10 @@ qio_channel_block_preadv(QIOChannel *ioc,
     QEMUIOVector qiov;
     int ret;
 
+    if (!qemu_in_coroutine() && qio_channel_block_drain(bioc, errp) < 0) {
+        return -1;
+    }
+
     qemu_iovec_init_external(&qiov, (struct iovec *)iov, niov);
     ret = bdrv_readv_vmstate(bioc->bs, &qiov, offset);
     if (ret < 0) {
@@ -129,6 +369,10 @@ qio_channel_block_pwritev(QIOChannel *ioc,
     QEMUIOVector qiov;
     int ret;
 
+    if (!qemu_in_coroutine() && qio_channel_block_drain(bioc, errp) < 0) {
+        return -1;
+    }
+
     qemu_iovec_init_external(&qiov, (struct iovec *)iov, niov);
     ret = bdrv_writev_vmstate(bioc->bs, &qiov, offset);
     if (ret < 0) {
@@ -183,8 +427,13 @@ qio_channel_block_close(QIOChannel *ioc,
                         Error **errp)
 {
     QIOChannelBlock *bioc = QIO_CHANNEL_BLOCK(ioc);
-    int rv = bdrv_flush(bioc->bs);
+    int rv;
+
+    if (!qemu_in_coroutine() && qio_channel_block_drain(bioc, errp) < 0) {
+        return -1;
+    }
 
+    rv = bdrv_flush(bioc->bs);
     if (rv < 0) {
         error_setg_errno(errp, -rv,
                          "Unable to flush VMState");
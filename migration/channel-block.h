@@ -34,12 +34,28 @@ OBJECT_DECLARE_SIMPLE_TYPE(QIOChannelBlock, QIO_CHANNEL_BLOCK)
  * The QIOChannelBlock object provides a channel implementation
  * that is able to perform I/O on the BlockDriverState objects
  * to the VMState region.
+ *
+ * Sequential reads and writes, which is how QEMUFile accesses the
+ * VMState, are done in large chunks with several requests in flight
+ * when the channel is used outside of coroutine context.  Errors of
+ * background writes are reported by a later write, or by close.
  */
 
+typedef struct QIOChannelBlockChunk QIOChannelBlockChunk;
+
 struct QIOChannelBlock {
     QIOChannel parent;
     BlockDriverState *bs;
     off_t offset;
+
+    /* Sequential writes not submitted yet, they end at @offset */
+    QIOChannelBlockChunk *wchunk;
+    /* Sequential reads submitted ahead of time, in order of offset */
+    GQueue readahead;
+    /* Background requests that have not completed yet */
+    int in_flight;
+    /* First error of a background write */
+    int ret;
 };
 
 
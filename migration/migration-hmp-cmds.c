@@ -243,6 +243,10 @@ void hmp_info_migrate(Monitor *mon, const QDict *qdict)
             monitor_printf(mon, ", zerocopy_fallbacks=%" PRIu64,
                            info->ram->dirty_sync_missed_zero_copy);
         }
+        if (info->ram->hot_pages) {
+            monitor_printf(mon, ", hot_pages=%" PRIu64,
+                           info->ram->hot_pages);
+        }
         monitor_printf(mon, "\n");
     }
 
@@ -453,6 +457,28 @@ void hmp_info_migrate_parameters(Monitor *mon, const QDict *qdict)
 
         assert(params->has_cpr_exec_command);
         monitor_print_cpr_exec_command(mon, params->cpr_exec_command);
+
+        assert(params->x_bandwidth_pool);
+        monitor_printf(mon, "%s: '%s'\n",
+            MigrationParameter_str(MIGRATION_PARAMETER_X_BANDWIDTH_POOL),
+                       params->x_bandwidth_pool->u.s);
+
+        assert(params->has_x_postcopy_preempt_channels);
+        monitor_printf(mon, "%s: %u\n",
+            MigrationParameter_str(
+                MIGRATION_PARAMETER_X_POSTCOPY_PREEMPT_CHANNELS),
+            params->x_postcopy_preempt_channels);
+
+        assert(params->x_dsa_work_queues);
+        monitor_printf(mon, "%s: '%s'\n",
+            MigrationParameter_str(MIGRATION_PARAMETER_X_DSA_WORK_QUEUES),
+                       params->x_dsa_work_queues->u.s);
+
+        assert(params->has_x_multifd_send_queue_depth);
+        monitor_printf(mon, "%s: %u\n",
+            MigrationParameter_str(
+                MIGRATION_PARAMETER_X_MULTIFD_SEND_QUEUE_DEPTH),
+            params->x_multifd_send_queue_depth);
     }
 
     qapi_free_MigrationParameters(params);
@@ -755,6 +781,24 @@ void hmp_migrate_set_parameter(Monitor *mon, const QDict *qdict)
         p->has_cpr_exec_command = true;
         break;
     }
+    case MIGRATION_PARAMETER_X_BANDWIDTH_POOL:
+        p->x_bandwidth_pool = g_new0(StrOrNull, 1);
+        p->x_bandwidth_pool->type = QTYPE_QSTRING;
+        visit_type_str(v, param, &p->x_bandwidth_pool->u.s, &err);
+        break;
+    case MIGRATION_PARAMETER_X_POSTCOPY_PREEMPT_CHANNELS:
+        p->has_x_postcopy_preempt_channels = true;
+        visit_type_uint8(v, param, &p->x_postcopy_preempt_channels, &err);
+        break;
+    case MIGRATION_PARAMETER_X_DSA_WORK_QUEUES:
+        p->x_dsa_work_queues = g_new0(StrOrNull, 1);
+        p->x_dsa_work_queues->type = QTYPE_QSTRING;
+        visit_type_str(v, param, &p->x_dsa_work_queues->u.s, &err);
+        break;
+    case MIGRATION_PARAMETER_X_MULTIFD_SEND_QUEUE_DEPTH:
+        p->has_x_multifd_send_queue_depth = true;
+        visit_type_uint32(v, param, &p->x_multifd_send_queue_depth, &err);
+        break;
     default:
         g_assert_not_reached();
     }
@@ -60,6 +60,10 @@ typedef struct {
      * guest is stopped.
      */
     Stat64 downtime_bytes;
+    /*
+     * Number of pages held back until the final stage as being hot.
+     */
+    Stat64 hot_pages;
     /*
      * Number of bytes sent through multifd channels.
      */
@@ -33,6 +33,7 @@
 #include "migration/misc.h"
 #include "migration.h"
 #include "migration-stats.h"
+#include "bandwidth-pool.h"
 #include "savevm.h"
 #include "qemu-file.h"
 #include "channel.h"
@@ -109,9 +110,87 @@ static bool close_return_path_on_source(MigrationState *s);
 static void migration_completion_end(MigrationState *s);
 static void migrate_hup_delete(MigrationState *s);
 
+static void migration_device_time_free(gpointer data)
+{
+    MigrationDeviceTime *dev = data;
+
+    g_free(dev->idstr);
+    g_free(dev);
+}
+
+void migration_downtime_profile_init(MigrationDowntimeProfile *p)
+{
+    qemu_mutex_init(&p->lock);
+    p->checkpoints = g_array_new(false, false, sizeof(DowntimeCheckpoint));
+    p->devices = g_ptr_array_new_with_free_func(migration_device_time_free);
+}
+
+void migration_downtime_profile_destroy(MigrationDowntimeProfile *p)
+{
+    g_array_free(p->checkpoints, true);
+    g_ptr_array_free(p->devices, true);
+    qemu_mutex_destroy(&p->lock);
+}
+
+void migration_downtime_profile_reset(MigrationDowntimeProfile *p)
+{
+    QEMU_LOCK_GUARD(&p->lock);
+    g_array_set_size(p->checkpoints, 0);
+    g_ptr_array_set_size(p->devices, 0);
+}
+
+void migration_downtime_checkpoint(MigrationDowntimeProfile *p,
+                                   const char *checkpoint)
+{
+    DowntimeCheckpoint c = {
+        .name = checkpoint,
+        .time = qemu_clock_get_us(QEMU_CLOCK_REALTIME),
+    };
+
+    trace_vmstate_downtime_checkpoint(checkpoint);
+    QEMU_LOCK_GUARD(&p->lock);
+    g_array_append_val(p->checkpoints, c);
+}
+
+/* @p takes ownership of @dev */
+void migration_downtime_add_device(MigrationDowntimeProfile *p,
+                                   MigrationDeviceTime *dev)
+{
+    QEMU_LOCK_GUARD(&p->lock);
+    g_ptr_array_add(p->devices, dev);
+}
+
+static MigrationDowntimeCheckpointList *
+migration_downtime_checkpoints_info(MigrationDowntimeProfile *p)
+{
+    MigrationDowntimeCheckpointList *list = NULL;
+    MigrationDowntimeCheckpointList **tail = &list;
+    DowntimeCheckpoint *first;
+    int i;
+
+    QEMU_LOCK_GUARD(&p->lock);
+    if (!p->checkpoints->len) {
+        return NULL;
+    }
+
+    first = &g_array_index(p->checkpoints, DowntimeCheckpoint, 0);
+    for (i = 0; i < p->checkpoints->len; i++) {
+        DowntimeCheckpoint *c = &g_array_index(p->checkpoints,
+                                               DowntimeCheckpoint, i);
+        MigrationDowntimeCheckpoint *info =
+            g_new0(MigrationDowntimeCheckpoint, 1);
+
+        info->name = g_strdup(c->name);
+        info->time = c->time - first->time;
+        QAPI_LIST_APPEND(tail, info);
+    }
+    return list;
+}
+
 static void migration_downtime_start(MigrationState *s)
 {
-    trace_vmstate_downtime_checkpoint("src-downtime-start");
+    migration_downtime_profile_reset(&s->downtime_profile);
+    migration_downtime_checkpoint(&s->downtime_profile, "src-downtime-start");
     s->downtime_start = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
 }
 
@@ -146,7 +225,7 @@ static void migration_downtime_end(MigrationState *s)
      */
     if (!s->downtime) {
         s->downtime = now - s->downtime_start;
-        trace_vmstate_downtime_checkpoint("src-downtime-end");
+        migration_downtime_checkpoint(&s->downtime_profile, "src-downtime-end");
     }
 }
 
@@ -294,7 +373,7 @@ static int migration_stop_vm(MigrationState *s, RunState state)
 
     ret = vm_stop_force_state(state);
 
-    trace_vmstate_downtime_checkpoint("src-vm-stopped");
+    migration_downtime_checkpoint(&s->downtime_profile, "src-vm-stopped");
     trace_migration_completion_vm_stop(ret);
 
     return ret;
@@ -302,6 +381,8 @@ static int migration_stop_vm(MigrationState *s, RunState state)
 
 void migration_object_init(void)
 {
+    int i;
+
     /* This can only be called once. */
     assert(!current_migration);
     current_migration = MIGRATION_OBJ(object_new(TYPE_MIGRATION));
@@ -316,14 +397,17 @@ void migration_object_init(void)
     current_incoming->postcopy_remote_fds =
         g_array_new(FALSE, TRUE, sizeof(struct PostCopyFD));
     qemu_mutex_init(&current_incoming->rp_mutex);
-    qemu_mutex_init(&current_incoming->postcopy_prio_thread_mutex);
+    for (i = 0; i < POSTCOPY_PREEMPT_CHANNELS_MAX; i++) {
+        qemu_mutex_init(&current_incoming->postcopy_prio_thread_mutex[i]);
+        qemu_sem_init(&current_incoming->postcopy_qemufile_dst_done[i], 0);
+    }
     qemu_event_init(&current_incoming->main_thread_load_event, false);
     qemu_sem_init(&current_incoming->postcopy_pause_sem_dst, 0);
     qemu_sem_init(&current_incoming->postcopy_pause_sem_fault, 0);
     qemu_sem_init(&current_incoming->postcopy_pause_sem_fast_load, 0);
-    qemu_sem_init(&current_incoming->postcopy_qemufile_dst_done, 0);
 
     qemu_mutex_init(&current_incoming->page_request_mutex);
+    migration_downtime_profile_init(&current_incoming->downtime_profile);
     qemu_cond_init(&current_incoming->page_request_cond);
     current_incoming->page_requested = g_tree_new(page_request_addr_cmp);
 
@@ -440,6 +524,7 @@ void migration_incoming_state_destroy(void)
 {
     MigrationIncomingState *mis = migration_incoming_get_current();
     PostcopyState ps = postcopy_state_get();
+    int i;
 
     multifd_recv_cleanup();
 
@@ -490,10 +575,13 @@ void migration_incoming_state_destroy(void)
         mis->page_requested = NULL;
     }
 
-    if (mis->postcopy_qemufile_dst) {
-        migration_ioc_unregister_yank_from_file(mis->postcopy_qemufile_dst);
-        qemu_fclose(mis->postcopy_qemufile_dst);
-        mis->postcopy_qemufile_dst = NULL;
+    for (i = 0; i < POSTCOPY_PREEMPT_CHANNELS_MAX; i++) {
+        if (mis->postcopy_qemufile_dst[i]) {
+            migration_ioc_unregister_yank_from_file(
+                mis->postcopy_qemufile_dst[i]);
+            qemu_fclose(mis->postcopy_qemufile_dst[i]);
+            mis->postcopy_qemufile_dst[i] = NULL;
+        }
     }
 
     cpr_set_incoming_mode(MIG_MODE_NONE);
@@ -541,11 +629,11 @@ static int migrate_send_rp_message(MigrationIncomingState *mis,
  *   Len: Length in bytes required - must be a multiple of pagesize
  */
 int migrate_send_rp_message_req_pages(MigrationIncomingState *mis,
-                                      RAMBlock *rb, ram_addr_t start)
+                                      RAMBlock *rb, ram_addr_t start,
+                                      size_t len)
 {
     uint8_t bufc[12 + 1 + 255]; /* start (8), len (4), rbname up to 256 */
     size_t msglen = 12; /* start + len */
-    size_t len = qemu_ram_pagesize(rb);
     enum mig_rp_message_type msg_type;
     const char *rbname;
     int rbname_len;
@@ -610,7 +698,8 @@ int migrate_send_rp_req_pages(MigrationIncomingState *mis,
         return 0;
     }
 
-    return migrate_send_rp_message_req_pages(mis, rb, start);
+    return migrate_send_rp_message_req_pages(mis, rb, start,
+                                             qemu_ram_pagesize(rb));
 }
 
 static bool migration_colo_enabled;
@@ -815,7 +904,8 @@ static void process_incoming_migration_bh(void *opaque)
 {
     MigrationIncomingState *mis = opaque;
 
-    trace_vmstate_downtime_checkpoint("dst-precopy-bh-enter");
+    migration_downtime_checkpoint(&mis->downtime_profile,
+                                  "dst-precopy-bh-enter");
 
     /*
      * This must happen after all error conditions are dealt with and
@@ -823,7 +913,8 @@ static void process_incoming_migration_bh(void *opaque)
      */
     qemu_announce_self(&mis->announce_timer, migrate_announce_params());
 
-    trace_vmstate_downtime_checkpoint("dst-precopy-bh-announced");
+    migration_downtime_checkpoint(&mis->downtime_profile,
+                                  "dst-precopy-bh-announced");
 
     multifd_recv_shutdown();
 
@@ -855,7 +946,8 @@ static void process_incoming_migration_bh(void *opaque)
     } else {
         runstate_set(global_state_get_runstate());
     }
-    trace_vmstate_downtime_checkpoint("dst-precopy-bh-vm-started");
+    migration_downtime_checkpoint(&mis->downtime_profile,
+                                  "dst-precopy-bh-vm-started");
     /*
      * This must happen after any state changes since as soon as an external
      * observer sees this event they might start to prod at the VM assuming
@@ -885,7 +977,8 @@ process_incoming_migration_co(void *opaque)
     ret = qemu_loadvm_state(mis->from_src_file, &local_err);
     mis->loadvm_co = NULL;
 
-    trace_vmstate_downtime_checkpoint("dst-precopy-loadvm-completed");
+    migration_downtime_checkpoint(&mis->downtime_profile,
+                                  "dst-precopy-loadvm-completed");
 
     trace_process_incoming_migration_co_end(ret);
     if (mis->have_listen_thread) {
@@ -1080,7 +1173,10 @@ void migration_ioc_process_incoming(QIOChannel *ioc, Error **errp)
             return;
         }
     } else if (channel == CH_POSTCOPY) {
-        assert(!mis->postcopy_qemufile_dst);
+        if (postcopy_preempt_channels_ready(mis)) {
+            error_setg(errp, "unexpected postcopy preempt channel");
+            return;
+        }
         f = qemu_file_new_input(ioc);
         postcopy_preempt_new_channel(mis, f);
         return;
@@ -1108,7 +1204,7 @@ bool migration_has_all_channels(void)
     }
 
     MigrationIncomingState *mis = migration_incoming_get_current();
-    if (migrate_postcopy_preempt() && !mis->postcopy_qemufile_dst) {
+    if (migrate_postcopy_preempt() && !postcopy_preempt_channels_ready(mis)) {
         return false;
     }
 
@@ -1282,6 +1378,7 @@ static void populate_ram_info(MigrationInfo *info, MigrationState *s)
     info->ram->precopy_bytes = stat64_get(&mig_stats.precopy_bytes);
     info->ram->downtime_bytes = stat64_get(&mig_stats.downtime_bytes);
     info->ram->postcopy_bytes = stat64_get(&mig_stats.postcopy_bytes);
+    info->ram->hot_pages = stat64_get(&mig_stats.hot_pages);
 
     if (migrate_xbzrle()) {
         info->xbzrle_cache = g_malloc0(sizeof(*info->xbzrle_cache));
@@ -1315,6 +1412,30 @@ static void populate_ram_info(MigrationInfo *info, MigrationState *s)
     }
 }
 
+static void fill_source_downtime_info(MigrationInfo *info,
+                                      MigrationState *s)
+{
+    MigrationDowntimeProfile *p = &s->downtime_profile;
+    MigrationDeviceSaveTimeList **tail = &info->device_save_times;
+    int i;
+
+    info->downtime_checkpoints = migration_downtime_checkpoints_info(p);
+    info->has_downtime_checkpoints = !!info->downtime_checkpoints;
+
+    QEMU_LOCK_GUARD(&p->lock);
+    for (i = 0; i < p->devices->len; i++) {
+        MigrationDeviceTime *dev = g_ptr_array_index(p->devices, i);
+        MigrationDeviceSaveTime *t = g_new0(MigrationDeviceSaveTime, 1);
+
+        t->id = g_strdup(dev->idstr);
+        t->instance_id = dev->instance_id;
+        t->iterable = dev->iterable;
+        t->save_time = dev->time;
+        QAPI_LIST_APPEND(tail, t);
+    }
+    info->has_device_save_times = !!info->device_save_times;
+}
+
 static void fill_source_migration_info(MigrationInfo *info)
 {
     MigrationState *s = migrate_get_current();
@@ -1369,6 +1490,7 @@ static void fill_source_migration_info(MigrationInfo *info)
         populate_time_info(info, s);
         populate_ram_info(info, s);
         migration_populate_vfio_info(info);
+        fill_source_downtime_info(info, s);
         break;
     case MIGRATION_STATUS_FAILED:
         info->has_status = true;
@@ -1388,6 +1510,33 @@ static void fill_source_migration_info(MigrationInfo *info)
     }
 }
 
+static void fill_destination_downtime_info(MigrationInfo *info)
+{
+    MigrationIncomingState *mis = migration_incoming_get_current();
+    MigrationDowntimeProfile *p = &mis->downtime_profile;
+    MigrationDeviceLoadTimeList **tail = &info->device_load_times;
+    int i;
+
+    info->downtime_checkpoints = migration_downtime_checkpoints_info(p);
+    info->has_downtime_checkpoints = !!info->downtime_checkpoints;
+
+    QEMU_LOCK_GUARD(&p->lock);
+    for (i = 0; i < p->devices->len; i++) {
+        MigrationDeviceTime *dev = g_ptr_array_index(p->devices, i);
+        MigrationDeviceLoadTime *t = g_new0(MigrationDeviceLoadTime, 1);
+
+        t->id = g_strdup(dev->idstr);
+        t->instance_id = dev->instance_id;
+        t->load_time = dev->time;
+        if (dev->async_post_load) {
+            t->has_async_post_load_time = true;
+            t->async_post_load_time = stat64_get(&dev->async_post_load_time);
+        }
+        QAPI_LIST_APPEND(tail, t);
+    }
+    info->has_device_load_times = true;
+}
+
 static void fill_destination_migration_info(MigrationInfo *info)
 {
     MigrationIncomingState *mis = migration_incoming_get_current();
@@ -1414,6 +1563,7 @@ static void fill_destination_migration_info(MigrationInfo *info)
     case MIGRATION_STATUS_COMPLETED:
         info->has_status = true;
         fill_destination_postcopy_migration_info(info);
+        fill_destination_downtime_info(info);
         break;
     default:
         return;
@@ -1504,6 +1654,8 @@ static void migration_cleanup(MigrationState *s)
         bql_lock();
     }
 
+    g_clear_pointer(&s->bandwidth_pool, migration_bandwidth_pool_leave);
+
     WITH_QEMU_LOCK_GUARD(&s->qemu_file_lock) {
         /*
          * Close the file handle without the lock to make sure the critical
@@ -2473,6 +2625,7 @@ static bool migrate_handle_rp_resume_ack(MigrationState *s,
 static void migration_release_dst_files(MigrationState *ms)
 {
     QEMUFile *file = NULL;
+    int i;
 
     WITH_QEMU_LOCK_GUARD(&ms->qemu_file_lock) {
         /*
@@ -2484,15 +2637,19 @@ static void migration_release_dst_files(MigrationState *ms)
     }
 
     /*
-     * Do the same to postcopy fast path socket too if there is.  No
-     * locking needed because this qemufile should only be managed by
-     * return path thread.
+     * Do the same to postcopy fast path sockets too if there are.  No
+     * locking needed because these qemufiles should only be managed by
+     * return path thread, once the threads sending on them are gone.
      */
-    if (ms->postcopy_qemufile_src) {
-        migration_ioc_unregister_yank_from_file(ms->postcopy_qemufile_src);
-        qemu_file_shutdown(ms->postcopy_qemufile_src);
-        qemu_fclose(ms->postcopy_qemufile_src);
-        ms->postcopy_qemufile_src = NULL;
+    postcopy_preempt_senders_stop(ms, true);
+    for (i = 0; i < POSTCOPY_PREEMPT_CHANNELS_MAX; i++) {
+        if (ms->postcopy_qemufile_src[i]) {
+            migration_ioc_unregister_yank_from_file(
+                ms->postcopy_qemufile_src[i]);
+            qemu_file_shutdown(ms->postcopy_qemufile_src[i]);
+            qemu_fclose(ms->postcopy_qemufile_src[i]);
+            ms->postcopy_qemufile_src[i] = NULL;
+        }
     }
 
     qemu_fclose(file);
@@ -3307,11 +3464,13 @@ static MigThrError migration_detect_error(MigrationState *s)
 
     /*
      * Try to detect any file errors.  Note that postcopy_qemufile_src will
-     * be NULL when postcopy preempt is not enabled.
+     * be empty when postcopy preempt is not enabled.
      */
-    ret = qemu_file_get_error_obj_any(s->to_dst_file,
-                                      s->postcopy_qemufile_src,
-                                      &local_error);
+    ret = qemu_file_get_error_obj_any(s->to_dst_file, NULL, &local_error);
+    if (!ret) {
+        ret = postcopy_preempt_get_error(s->postcopy_qemufile_src,
+                                         &local_error);
+    }
     if (!ret) {
         /* Everything is fine */
         assert(!local_error);
@@ -3430,6 +3589,19 @@ static void migration_update_counters(MigrationState *s,
 
     migration_rate_reset();
 
+    /*
+     * Our share of a bandwidth pool depends on how far we are from
+     * convergence, compared to the other migrations in the pool.
+     */
+    if (s->bandwidth_pool && !migration_in_postcopy()) {
+        uint64_t remaining = s->pending_size > s->threshold_size ?
+                             s->pending_size - s->threshold_size : 0;
+
+        migration_rate_set(migration_bandwidth_pool_update(
+                               s->bandwidth_pool, remaining,
+                               migrate_max_bandwidth()));
+    }
+
     update_iteration_initial_status(s);
 
     trace_migrate_transferred(transferred, time_spent,
@@ -3510,6 +3682,8 @@ static MigIterateState migration_iteration_run(MigrationState *s)
                                         can_postcopy);
         }
 
+        s->pending_size = pending_size;
+
         /* Should we switch to postcopy now? */
         if (must_precopy <= s->threshold_size &&
             can_switchover && qatomic_read(&s->start_postcopy)) {
@@ -4053,6 +4227,20 @@ void migration_connect(MigrationState *s, Error *error_in)
         /* This is a fresh new migration */
         rate_limit = migrate_max_bandwidth();
 
+        if (migrate_bandwidth_pool()) {
+            s->bandwidth_pool =
+                migration_bandwidth_pool_join(migrate_bandwidth_pool(),
+                                              &local_err);
+            if (!s->bandwidth_pool) {
+                goto fail;
+            }
+            /* Nothing is known about our progress yet */
+            s->pending_size = UINT64_MAX;
+            rate_limit = migration_bandwidth_pool_update(s->bandwidth_pool,
+                                                         UINT64_MAX,
+                                                         rate_limit);
+        }
+
         /* Notify before starting migration thread */
         if (migration_call_notifiers(s, MIG_EVENT_PRECOPY_SETUP, &local_err)) {
             goto fail;
@@ -4151,6 +4339,7 @@ static void migration_instance_finalize(Object *obj)
     qemu_sem_destroy(&ms->postcopy_qemufile_src_sem);
     error_free(ms->error);
     qemu_event_destroy(&ms->postcopy_package_loaded_event);
+    migration_downtime_profile_destroy(&ms->downtime_profile);
 }
 
 static void migration_instance_init(Object *obj)
@@ -4173,6 +4362,7 @@ static void migration_instance_init(Object *obj)
     qemu_sem_init(&ms->postcopy_qemufile_src_sem, 0);
     qemu_mutex_init(&ms->qemu_file_lock);
     qemu_event_init(&ms->postcopy_package_loaded_event, 0);
+    migration_downtime_profile_init(&ms->downtime_profile);
 }
 
 /*
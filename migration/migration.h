@@ -21,6 +21,7 @@
 #include "qobject/json-writer.h"
 #include "qemu/thread.h"
 #include "qemu/coroutine.h"
+#include "qemu/stats64.h"
 #include "io/channel.h"
 #include "io/channel-buffer.h"
 #include "net/announce.h"
@@ -83,6 +84,44 @@ typedef struct {
     bool all_zero;
 } PostcopyTmpPage;
 
+/* Time spent saving or loading the state of one device at switchover */
+typedef struct {
+    char *idstr;
+    uint32_t instance_id;
+    /* Iterable section (save_live_complete_*), or vmstate section */
+    bool iterable;
+    /* Time spent in the migration or loading thread, in microseconds */
+    int64_t time;
+    /* Whether post_load_async hooks were run on worker threads */
+    bool async_post_load;
+    /* Time spent in those hooks, in microseconds */
+    Stat64 async_post_load_time;
+} MigrationDeviceTime;
+
+typedef struct {
+    /* One of the names traced by vmstate_downtime_checkpoint */
+    const char *name;
+    /* QEMU_CLOCK_REALTIME, in microseconds */
+    int64_t time;
+} DowntimeCheckpoint;
+
+/* Where the time of the last switchover went, reported by query-migrate */
+typedef struct {
+    QemuMutex lock;
+    /* DowntimeCheckpoint, in the order they were passed */
+    GArray *checkpoints;
+    /* MigrationDeviceTime of each device saved or loaded */
+    GPtrArray *devices;
+} MigrationDowntimeProfile;
+
+void migration_downtime_profile_init(MigrationDowntimeProfile *p);
+void migration_downtime_profile_destroy(MigrationDowntimeProfile *p);
+void migration_downtime_profile_reset(MigrationDowntimeProfile *p);
+void migration_downtime_checkpoint(MigrationDowntimeProfile *p,
+                                   const char *checkpoint);
+void migration_downtime_add_device(MigrationDowntimeProfile *p,
+                                   MigrationDeviceTime *dev);
+
 typedef enum {
     PREEMPT_THREAD_NONE = 0,
     PREEMPT_THREAD_CREATED,
@@ -128,6 +167,19 @@ struct MigrationIncomingState {
     QemuMutex rp_mutex;    /* We send replies from multiple threads */
     /* RAMBlock of last request sent to source */
     RAMBlock *last_rb;
+    /*
+     * Fault locality tracking for x-postcopy-prefetch, only used by the
+     * fault thread.
+     */
+    RAMBlock *prefetch_rb;
+    /* Offset of the last fault in prefetch_rb */
+    ram_addr_t prefetch_last;
+    /* Distance between the last two faults */
+    int64_t prefetch_stride;
+    /* Offset of the furthest page requested ahead along prefetch_stride */
+    ram_addr_t prefetch_end;
+    /* Number of pages to request ahead of the next fault */
+    unsigned int prefetch_window;
     /*
      * Number of postcopy channels including the default precopy channel, so
      * vanilla postcopy will only contain one channel which contain both
@@ -138,16 +190,21 @@ struct MigrationIncomingState {
      * enabled.
      */
     unsigned int postcopy_channels;
-    /* QEMUFile for postcopy only; it'll be handled by a separate thread */
-    QEMUFile *postcopy_qemufile_dst;
     /*
-     * When postcopy_qemufile_dst is properly setup, this sem is posted.
-     * One can wait on this semaphore to wait until the preempt channel is
-     * properly setup.
+     * QEMUFiles for postcopy only, one for each preempt channel; each is
+     * handled by a separate thread
      */
-    QemuSemaphore postcopy_qemufile_dst_done;
-    /* Postcopy priority thread is used to receive postcopy requested pages */
-    QemuThread postcopy_prio_thread;
+    QEMUFile *postcopy_qemufile_dst[POSTCOPY_PREEMPT_CHANNELS_MAX];
+    /*
+     * When postcopy_qemufile_dst[i] is properly setup, the i-th sem is
+     * posted.  One can wait on this semaphore to wait until the preempt
+     * channel is properly setup.
+     */
+    QemuSemaphore postcopy_qemufile_dst_done[POSTCOPY_PREEMPT_CHANNELS_MAX];
+    /* Postcopy priority threads receive postcopy requested pages */
+    QemuThread postcopy_prio_thread[POSTCOPY_PREEMPT_CHANNELS_MAX];
+    /* Number of postcopy priority threads started */
+    unsigned int postcopy_prio_threads;
     /*
      * Always set by the main vm load thread only, but can be read by the
      * postcopy preempt thread.  "volatile" makes sure all reads will be
@@ -156,8 +213,8 @@ struct MigrationIncomingState {
     volatile PreemptThreadStatus preempt_thread_status;
     /*
      * Used to sync between the ram load main thread and the fast ram load
-     * thread.  It protects postcopy_qemufile_dst, which is the postcopy
-     * fast channel.
+     * thread.  The i-th mutex protects postcopy_qemufile_dst[i], which is a
+     * postcopy fast channel.
      *
      * The ram fast load thread will take it mostly for the whole lifecycle
      * because it needs to continuously read data from the channel, and
@@ -165,7 +222,7 @@ struct MigrationIncomingState {
      * the ram load main thread will take this mutex over and properly
      * release the broken channel.
      */
-    QemuMutex postcopy_prio_thread_mutex;
+    QemuMutex postcopy_prio_thread_mutex[POSTCOPY_PREEMPT_CHANNELS_MAX];
     /*
      * An array of temp host huge pages to be used, one for each postcopy
      * channel.
@@ -193,6 +250,9 @@ struct MigrationIncomingState {
     ThreadPool *load_threads;
     bool load_threads_abort;
 
+    /* Devices loaded and checkpoints passed by the last loadvm */
+    MigrationDowntimeProfile downtime_profile;
+
     /*
      * PostcopyBlocktimeContext to keep information for postcopy
      * live migration, to calculate vCPU block time
@@ -280,10 +340,10 @@ struct MigrationState {
     QemuThread thread;
     /* Protected by qemu_file_lock */
     QEMUFile *to_dst_file;
-    /* Postcopy specific transfer channel */
-    QEMUFile *postcopy_qemufile_src;
+    /* Postcopy specific transfer channels */
+    QEMUFile *postcopy_qemufile_src[POSTCOPY_PREEMPT_CHANNELS_MAX];
     /*
-     * It is posted when the preempt channel is established.  Note: this is
+     * It is posted when a preempt channel is established.  Note: this is
      * used for both the start or recover of a postcopy migration.  We'll
      * post to this sem every time a new preempt channel is created in the
      * main thread, and we keep post() and wait() in pair.
@@ -318,6 +378,10 @@ struct MigrationState {
      * measured bandwidth, or avail-switchover-bandwidth if specified.
      */
     uint64_t threshold_size;
+    /* Estimate of the data left to send, as of the last iteration */
+    uint64_t pending_size;
+    /* Pool arbitrating our bandwidth, see the x-bandwidth-pool parameter */
+    struct MigrationBandwidthPool *bandwidth_pool;
 
     /* params from 'migrate-set-parameters' */
     MigrationParameters parameters;
@@ -359,6 +423,8 @@ struct MigrationState {
     /* Timestamp when VM is down (ms) to migrate the last stuff */
     int64_t downtime_start;
     int64_t downtime;
+    /* Devices saved and checkpoints passed during the downtime */
+    MigrationDowntimeProfile downtime_profile;
     int64_t expected_downtime;
     bool capabilities[MIGRATION_CAPABILITY__MAX];
     int64_t setup_time;
@@ -560,7 +626,8 @@ void migrate_send_rp_pong(MigrationIncomingState *mis,
 int migrate_send_rp_req_pages(MigrationIncomingState *mis, RAMBlock *rb,
                               ram_addr_t start, uint64_t haddr, uint32_t tid);
 int migrate_send_rp_message_req_pages(MigrationIncomingState *mis,
-                                      RAMBlock *rb, ram_addr_t start);
+                                      RAMBlock *rb, ram_addr_t start,
+                                      size_t len);
 void migrate_send_rp_recv_bitmap(MigrationIncomingState *mis,
                                  char *block_name);
 void migrate_send_rp_resume_ack(MigrationIncomingState *mis, uint32_t value);
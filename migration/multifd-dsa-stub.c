@@ -0,0 +1,44 @@
+/*
+ * Multifd zero page offload to Intel DSA - stubs
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "multifd.h"
+
+bool multifd_dsa_setup(const char *work_queues, Error **errp)
+{
+    error_setg(errp, "DSA support is not compiled in");
+    return false;
+}
+
+void multifd_dsa_cleanup(void)
+{
+    g_assert_not_reached();
+}
+
+MultiFDDsaTask *multifd_dsa_task_new(uint32_t max_pages)
+{
+    g_assert_not_reached();
+}
+
+void multifd_dsa_task_free(MultiFDDsaTask *task)
+{
+    g_assert_not_reached();
+}
+
+bool *multifd_dsa_zero_detect(MultiFDDsaTask *task, uint8_t *host,
+                              const ram_addr_t *offsets, uint32_t num,
+                              size_t page_size)
+{
+    g_assert_not_reached();
+}
+
+void multifd_dsa_zero_fill(MultiFDDsaTask *task, uint8_t *host,
+                           const ram_addr_t *offsets, uint32_t num,
+                           size_t page_size)
+{
+    g_assert_not_reached();
+}
@@ -0,0 +1,418 @@
+/*
+ * Multifd zero page offload to Intel Data Streaming Accelerator (DSA)
+ *
+ * The zero page checks of a multifd packet on the source, and the zero
+ * fill of received zero pages on the destination, are submitted as one
+ * batch descriptor to a DSA work queue, so that the channel threads do
+ * not have to read or write the pages themselves.  The work queues are
+ * used from user space through the idxd driver's character devices, with
+ * shared virtual addressing.  Pages the device cannot handle, e.g.
+ * because they are not mapped yet, are handled by the CPU.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/cutils.h"
+#include "qemu/cpuid.h"
+#include "qemu/memalign.h"
+#include "qapi/error.h"
+#include "multifd.h"
+#include "trace.h"
+
+#include <linux/idxd.h>
+#include <immintrin.h>
+#include <x86intrin.h>
+
+#define DSA_WQ_PORTAL_SIZE      4096
+
+/* Number of times to retry ENQCMD when a shared work queue is full */
+#define DSA_ENQCMD_RETRIES      1000
+
+/* How long to wait in UMWAIT for a completion, in TSC cycles */
+#define DSA_UMWAIT_CYCLES       10000
+
+typedef struct {
+    char *path;
+    void *portal;
+    /* Shared work queues take ENQCMD, dedicated ones MOVDIR64B */
+    bool shared;
+    /* Number of descriptors a dedicated work queue can hold */
+    uint32_t size;
+    uint32_t max_batch_size;
+    /* Tasks using this work queue, protected by dsa_lock */
+    uint32_t nr_tasks;
+} DsaWorkQueue;
+
+struct MultiFDDsaTask {
+    DsaWorkQueue *wq;
+    uint32_t max_descs;
+    struct dsa_hw_desc *descs;
+    struct dsa_completion_record *comps;
+    struct dsa_hw_desc *batch_desc;
+    struct dsa_completion_record *batch_comp;
+    /* Results of multifd_dsa_zero_detect() */
+    bool *zero;
+};
+
+static QemuMutex dsa_lock;
+static int dsa_users;
+static DsaWorkQueue *dsa_wqs;
+static unsigned int dsa_nr_wqs;
+static bool dsa_waitpkg;
+
+static void __attribute__((constructor)) multifd_dsa_init(void)
+{
+    qemu_mutex_init(&dsa_lock);
+}
+
+/* Read an attribute of the work queue from sysfs */
+static bool dsa_wq_read_attr(const char *path, const char *attr,
+                             char **value, Error **errp)
+{
+    g_autofree char *name = g_path_get_basename(path);
+    g_autofree char *file = g_strdup_printf("/sys/bus/dsa/devices/%s/%s",
+                                            name, attr);
+    g_autoptr(GError) err = NULL;
+
+    if (!g_file_get_contents(file, value, NULL, &err)) {
+        error_setg(errp, "DSA work queue %s: %s", path, err->message);
+        return false;
+    }
+    g_strstrip(*value);
+    return true;
+}
+
+static bool dsa_wq_read_u32(const char *path, const char *attr,
+                            uint32_t *value, Error **errp)
+{
+    g_autofree char *str = NULL;
+    unsigned int v;
+
+    if (!dsa_wq_read_attr(path, attr, &str, errp)) {
+        return false;
+    }
+    if (qemu_strtoui(str, NULL, 10, &v) < 0) {
+        error_setg(errp, "DSA work queue %s: invalid %s '%s'", path, attr,
+                   str);
+        return false;
+    }
+    *value = v;
+    return true;
+}
+
+static bool dsa_wq_open(DsaWorkQueue *wq, const char *path, Error **errp)
+{
+    g_autofree char *mode = NULL;
+    int fd;
+
+    if (!dsa_wq_read_attr(path, "mode", &mode, errp) ||
+        !dsa_wq_read_u32(path, "size", &wq->size, errp) ||
+        !dsa_wq_read_u32(path, "max_batch_size", &wq->max_batch_size,
+                         errp)) {
+        return false;
+    }
+    wq->shared = !strcmp(mode, "shared");
+
+    fd = open(path, O_RDWR);
+    if (fd < 0) {
+        error_setg_errno(errp, errno, "Failed to open DSA work queue %s",
+                         path);
+        return false;
+    }
+    wq->portal = mmap(NULL, DSA_WQ_PORTAL_SIZE, PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (wq->portal == MAP_FAILED) {
+        wq->portal = NULL;
+        error_setg_errno(errp, errno, "Failed to map DSA work queue %s",
+                         path);
+        return false;
+    }
+    wq->path = g_strdup(path);
+
+    trace_multifd_dsa_wq_open(path, wq->shared, wq->size,
+                              wq->max_batch_size);
+    return true;
+}
+
+static void dsa_wqs_close(void)
+{
+    unsigned int i;
+
+    for (i = 0; i < dsa_nr_wqs; i++) {
+        if (dsa_wqs[i].portal) {
+            munmap(dsa_wqs[i].portal, DSA_WQ_PORTAL_SIZE);
+        }
+        g_free(dsa_wqs[i].path);
+    }
+    g_clear_pointer(&dsa_wqs, g_free);
+    dsa_nr_wqs = 0;
+}
+
+bool multifd_dsa_setup(const char *work_queues, Error **errp)
+{
+    g_auto(GStrv) paths = g_strsplit_set(work_queues, " ,", -1);
+    unsigned int a, b, c, d;
+    unsigned int i;
+
+    QEMU_LOCK_GUARD(&dsa_lock);
+    if (dsa_users++) {
+        /* Incoming and outgoing migration share the work queues */
+        return true;
+    }
+
+    if (!__get_cpuid_count(7, 0, &a, &b, &c, &d) ||
+        !(c & bit_MOVDIR64B) || !(c & bit_ENQCMD)) {
+        error_setg(errp, "DSA needs MOVDIR64B and ENQCMD support");
+        goto fail;
+    }
+    dsa_waitpkg = c & bit_WAITPKG;
+
+    dsa_wqs = g_new0(DsaWorkQueue, g_strv_length(paths));
+    for (i = 0; paths[i]; i++) {
+        if (!*paths[i]) {
+            continue;
+        }
+        if (!dsa_wq_open(&dsa_wqs[dsa_nr_wqs++], paths[i], errp)) {
+            goto fail;
+        }
+    }
+    if (!dsa_nr_wqs) {
+        error_setg(errp, "No DSA work queue given");
+        goto fail;
+    }
+    return true;
+
+fail:
+    dsa_wqs_close();
+    dsa_users--;
+    return false;
+}
+
+void multifd_dsa_cleanup(void)
+{
+    QEMU_LOCK_GUARD(&dsa_lock);
+    assert(dsa_users > 0);
+    if (!--dsa_users) {
+        dsa_wqs_close();
+    }
+}
+
+MultiFDDsaTask *multifd_dsa_task_new(uint32_t max_pages)
+{
+    DsaWorkQueue *wq = NULL;
+    MultiFDDsaTask *task;
+    unsigned int i;
+
+    /*
+     * Every task has at most one batch descriptor in flight.  Dedicated
+     * work queues silently drop descriptors when full, so they cannot
+     * serve more tasks than they have entries.
+     */
+    WITH_QEMU_LOCK_GUARD(&dsa_lock) {
+        for (i = 0; i < dsa_nr_wqs; i++) {
+            DsaWorkQueue *cur = &dsa_wqs[i];
+
+            if (!cur->shared && cur->nr_tasks >= cur->size) {
+                continue;
+            }
+            if (!wq || cur->nr_tasks < wq->nr_tasks) {
+                wq = cur;
+            }
+        }
+        if (!wq) {
+            return NULL;
+        }
+        wq->nr_tasks++;
+    }
+
+    task = g_new0(MultiFDDsaTask, 1);
+    task->wq = wq;
+    task->max_descs = MIN(max_pages, wq->max_batch_size);
+    task->descs = qemu_memalign(64, task->max_descs * sizeof(*task->descs));
+    task->comps = qemu_memalign(32, task->max_descs * sizeof(*task->comps));
+    task->batch_desc = qemu_memalign(64, sizeof(*task->batch_desc));
+    task->batch_comp = qemu_memalign(32, sizeof(*task->batch_comp));
+    task->zero = g_new0(bool, max_pages);
+    return task;
+}
+
+void multifd_dsa_task_free(MultiFDDsaTask *task)
+{
+    WITH_QEMU_LOCK_GUARD(&dsa_lock) {
+        task->wq->nr_tasks--;
+    }
+    qemu_vfree(task->descs);
+    qemu_vfree(task->comps);
+    qemu_vfree(task->batch_desc);
+    qemu_vfree(task->batch_comp);
+    g_free(task->zero);
+    g_free(task);
+}
+
+static bool __attribute__((target("enqcmd,movdir64b")))
+dsa_submit(DsaWorkQueue *wq, struct dsa_hw_desc *desc)
+{
+    int i;
+
+    /* The descriptors must be visible to the device before the doorbell */
+    _mm_sfence();
+
+    if (!wq->shared) {
+        _movdir64b(wq->portal, desc);
+        return true;
+    }
+    for (i = 0; i < DSA_ENQCMD_RETRIES; i++) {
+        if (!_enqcmd(wq->portal, desc)) {
+            return true;
+        }
+        _mm_pause();
+    }
+    return false;
+}
+
+static void __attribute__((target("waitpkg")))
+dsa_wait(struct dsa_completion_record *comp)
+{
+    while (!comp->status) {
+        if (dsa_waitpkg) {
+            /* Doze until the device writes the completion record */
+            _umonitor((void *)&comp->status);
+            if (!comp->status) {
+                _umwait(0, __rdtsc() + DSA_UMWAIT_CYCLES);
+            }
+        } else {
+            _mm_pause();
+        }
+    }
+    /* Read the rest of the completion record after its status */
+    smp_rmb();
+}
+
+static void dsa_desc_init(MultiFDDsaTask *task, uint32_t i, uint8_t opcode,
+                          uint8_t *addr, size_t len)
+{
+    struct dsa_hw_desc *desc = &task->descs[i];
+
+    memset(desc, 0, sizeof(*desc));
+    desc->opcode = opcode;
+    desc->flags = IDXD_OP_FLAG_RCR | IDXD_OP_FLAG_CRAV;
+    desc->completion_addr = (uintptr_t)&task->comps[i];
+    desc->xfer_size = len;
+    if (opcode == DSA_OPCODE_COMPVAL) {
+        desc->src_addr = (uintptr_t)addr;
+        desc->comp_pattern = 0;
+    } else {
+        desc->dst_addr = (uintptr_t)addr;
+        desc->pattern = 0;
+    }
+    task->comps[i].status = DSA_COMP_NONE;
+}
+
+/*
+ * Run the @num descriptors in task->descs.  Returns false if none of
+ * them could be submitted.
+ */
+static bool dsa_run(MultiFDDsaTask *task, uint32_t num)
+{
+    struct dsa_hw_desc *batch = task->batch_desc;
+
+    if (num == 1) {
+        /* A batch needs at least two descriptors */
+        if (!dsa_submit(task->wq, &task->descs[0])) {
+            return false;
+        }
+        dsa_wait(&task->comps[0]);
+        return true;
+    }
+
+    memset(batch, 0, sizeof(*batch));
+    batch->opcode = DSA_OPCODE_BATCH;
+    batch->flags = IDXD_OP_FLAG_RCR | IDXD_OP_FLAG_CRAV;
+    batch->desc_list_addr = (uintptr_t)task->descs;
+    batch->desc_count = num;
+    batch->completion_addr = (uintptr_t)task->batch_comp;
+    task->batch_comp->status = DSA_COMP_NONE;
+
+    if (!dsa_submit(task->wq, batch)) {
+        return false;
+    }
+    dsa_wait(task->batch_comp);
+    if ((task->batch_comp->status & DSA_COMP_STATUS_MASK) !=
+        DSA_COMP_SUCCESS &&
+        (task->batch_comp->status & DSA_COMP_STATUS_MASK) !=
+        DSA_COMP_BATCH_FAIL) {
+        /* The descriptors were not processed, e.g. fault on the list */
+        return false;
+    }
+    return true;
+}
+
+static bool dsa_desc_done(MultiFDDsaTask *task, uint32_t i)
+{
+    return (task->comps[i].status & DSA_COMP_STATUS_MASK) == DSA_COMP_SUCCESS;
+}
+
+bool *multifd_dsa_zero_detect(MultiFDDsaTask *task, uint8_t *host,
+                              const ram_addr_t *offsets, uint32_t num,
+                              size_t page_size)
+{
+    uint32_t done, n, i, fallback = 0;
+
+    for (done = 0; done < num; done += n) {
+        bool ran;
+
+        n = MIN(num - done, task->max_descs);
+        for (i = 0; i < n; i++) {
+            dsa_desc_init(task, i, DSA_OPCODE_COMPVAL,
+                          host + offsets[done + i], page_size);
+        }
+
+        ran = dsa_run(task, n);
+        for (i = 0; i < n; i++) {
+            if (ran && dsa_desc_done(task, i)) {
+                /* 0 means the page matched the pattern */
+                task->zero[done + i] = !task->comps[i].result;
+            } else {
+                task->zero[done + i] =
+                    buffer_is_zero(host + offsets[done + i], page_size);
+                fallback++;
+            }
+        }
+    }
+
+    if (fallback) {
+        trace_multifd_dsa_fallback("zero-detect", fallback, num);
+    }
+    return task->zero;
+}
+
+void multifd_dsa_zero_fill(MultiFDDsaTask *task, uint8_t *host,
+                           const ram_addr_t *offsets, uint32_t num,
+                           size_t page_size)
+{
+    uint32_t done, n, i, fallback = 0;
+
+    for (done = 0; done < num; done += n) {
+        bool ran;
+
+        n = MIN(num - done, task->max_descs);
+        for (i = 0; i < n; i++) {
+            dsa_desc_init(task, i, DSA_OPCODE_MEMFILL,
+                          host + offsets[done + i], page_size);
+        }
+
+        ran = dsa_run(task, n);
+        for (i = 0; i < n; i++) {
+            if (!ran || !dsa_desc_done(task, i)) {
+                memset(host + offsets[done + i], 0, page_size);
+                fallback++;
+            }
+        }
+    }
+
+    if (fallback) {
+        trace_multifd_dsa_fallback("zero-fill", fallback, num);
+    }
+}
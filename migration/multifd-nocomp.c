@@ -161,7 +161,9 @@ static void multifd_nocomp_recv_cleanup(MultiFDRecvParams *p)
 
 static int multifd_nocomp_recv(MultiFDRecvParams *p, Error **errp)
 {
+    size_t page_size = multifd_ram_page_size();
     uint32_t flags;
+    int niov = 0;
 
     if (migrate_mapped_ram()) {
         return multifd_file_recv_data(p, errp);
@@ -182,11 +184,20 @@ static int multifd_nocomp_recv(MultiFDRecvParams *p, Error **errp)
     }
 
     for (int i = 0; i < p->normal_num; i++) {
-        p->iov[i].iov_base = p->host + p->normal[i];
-        p->iov[i].iov_len = multifd_ram_page_size();
+        uint8_t *host = p->host + p->normal[i];
+
         ramblock_recv_bitmap_set_offset(p->block, p->normal[i]);
+        /* Read contiguous pages with a single iovec */
+        if (niov && p->iov[niov - 1].iov_base +
+                    p->iov[niov - 1].iov_len == host) {
+            p->iov[niov - 1].iov_len += page_size;
+            continue;
+        }
+        p->iov[niov].iov_base = host;
+        p->iov[niov].iov_len = page_size;
+        niov++;
     }
-    return qio_channel_readv_all(p->c, p->iov, p->normal_num, errp);
+    return qio_channel_readv_all(p->c, p->iov, niov, errp);
 }
 
 static void multifd_pages_reset(MultiFDPages_t *pages)
@@ -352,6 +363,50 @@ retry:
     return true;
 }
 
+/*
+ * Queue a page on the channel's own payload, from the sender thread of
+ * @p itself.  Used by the partitioned dirty page scan, where there is no
+ * need to hand the payload over to another thread: when the queue needs
+ * a flush it is written out directly on @p.
+ *
+ * Returns 0 if succeed, non-zero otherwise with @errp set.
+ */
+int multifd_ram_queue_page_local(MultiFDSendParams *p, RAMBlock *block,
+                                 ram_addr_t offset, Error **errp)
+{
+    MultiFDPages_t *pages = &p->data->u.ram;
+    int ret;
+
+    if (multifd_payload_empty(p->data)) {
+        multifd_pages_reset(pages);
+        multifd_set_payload_type(p->data, MULTIFD_PAYLOAD_RAM);
+    }
+
+    if (!multifd_queue_empty(pages) &&
+        (pages->block != block || multifd_queue_full(pages))) {
+        ret = multifd_send_payload(p, errp);
+        if (ret != 0) {
+            return ret;
+        }
+        multifd_pages_reset(pages);
+        multifd_set_payload_type(p->data, MULTIFD_PAYLOAD_RAM);
+    }
+
+    pages->block = block;
+    multifd_enqueue(pages, offset);
+    return 0;
+}
+
+/* Send out whatever multifd_ram_queue_page_local() left queued on @p */
+int multifd_ram_flush_local(MultiFDSendParams *p, Error **errp)
+{
+    if (multifd_payload_empty(p->data)) {
+        return 0;
+    }
+
+    return multifd_send_payload(p, errp);
+}
+
 /*
  * We have two modes for multifd flushes:
  *
@@ -0,0 +1,308 @@
+/*
+ * Multifd XBZRLE delta compression implementation
+ *
+ * Each channel keeps a cache of the last version of the pages it sent,
+ * and sends XBZRLE deltas against it for the pages that are found in the
+ * cache.  The destination applies the deltas on top of the guest page,
+ * which holds that same version.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "system/ramblock.h"
+#include "exec/target_page.h"
+#include "qapi/error.h"
+#include "migration.h"
+#include "migration-stats.h"
+#include "trace.h"
+#include "options.h"
+#include "multifd.h"
+#include "page_cache.h"
+#include "xbzrle.h"
+
+/*
+ * Each normal page in the packet starts with one of these, followed by
+ * either the whole page (FULL), or a be16 length and the XBZRLE encoded
+ * delta against the previous version of the page (DELTA).
+ */
+#define MULTIFD_XBZRLE_PAGE_FULL  0
+#define MULTIFD_XBZRLE_PAGE_DELTA 1
+
+/* Kind byte plus the be16 length of a delta */
+#define MULTIFD_XBZRLE_DELTA_HDR  3
+
+struct xbzrle_data {
+    /* cache of the last version of the pages sent on this channel */
+    PageCache *cache;
+    /* copy of the page being encoded, of size qemu_target_page_size() */
+    uint8_t *buf;
+    /* encoded packet */
+    uint8_t *out;
+    /* size of encoded packet buffer */
+    uint32_t out_len;
+};
+
+static uint32_t multifd_xbzrle_packet_len(void)
+{
+    /* Worst case, all the pages are sent in full */
+    return multifd_ram_page_count() * (multifd_ram_page_size() + 1);
+}
+
+/* Multifd XBZRLE compression */
+
+static int multifd_xbzrle_send_setup(MultiFDSendParams *p, Error **errp)
+{
+    struct xbzrle_data *x;
+    uint64_t cache_size;
+
+    /*
+     * The deltas are only valid if the destination page was last written
+     * by this very channel, which is only guaranteed when every page is
+     * always sent through the same channel.
+     */
+    if (!migrate_multifd_partitioned_scan()) {
+        error_setg(errp, "multifd %u: xbzrle compression requires "
+                   "capability 'x-multifd-partitioned-scan'", p->id);
+        return -1;
+    }
+
+    x = g_new0(struct xbzrle_data, 1);
+    cache_size = migrate_xbzrle_cache_size() / migrate_multifd_channels();
+    x->cache = cache_init(cache_size, multifd_ram_page_size(), errp);
+    if (!x->cache) {
+        error_prepend(errp, "multifd %u: ", p->id);
+        g_free(x);
+        return -1;
+    }
+    x->buf = g_malloc(multifd_ram_page_size());
+    x->out_len = multifd_xbzrle_packet_len();
+    x->out = g_malloc(x->out_len);
+    p->compress_data = x;
+
+    /* Needs 2 IOVs, one for packet header and one for encoded data */
+    p->iov = g_new0(struct iovec, 2);
+
+    return 0;
+}
+
+static void multifd_xbzrle_send_cleanup(MultiFDSendParams *p, Error **errp)
+{
+    struct xbzrle_data *x = p->compress_data;
+
+    cache_fini(x->cache);
+    g_free(x->buf);
+    g_free(x->out);
+    g_free(p->compress_data);
+    p->compress_data = NULL;
+
+    g_free(p->iov);
+    p->iov = NULL;
+}
+
+static int multifd_xbzrle_send_prepare(MultiFDSendParams *p, Error **errp)
+{
+    MultiFDPages_t *pages = &p->data->u.ram;
+    struct xbzrle_data *x = p->compress_data;
+    uint64_t age = stat64_get(&mig_stats.dirty_sync_count);
+    uint32_t page_size = multifd_ram_page_size();
+    uint32_t out_size = 0, deltas = 0;
+    bool has_normal;
+    uint32_t i;
+
+    has_normal = multifd_send_prepare_common(p);
+
+    /*
+     * Zero pages are cleared on the destination, make sure the next
+     * delta for them is computed against a zero page too.
+     */
+    for (i = pages->normal_num; i < pages->num; i++) {
+        ram_addr_t addr = pages->block->offset + pages->offset[i];
+
+        if (cache_is_cached(x->cache, addr, age)) {
+            memset(get_cached_data(x->cache, addr), 0, page_size);
+        }
+    }
+
+    if (!has_normal) {
+        goto out;
+    }
+
+    for (i = 0; i < pages->normal_num; i++) {
+        ram_addr_t addr = pages->block->offset + pages->offset[i];
+        uint8_t *rec = x->out + out_size;
+
+        /*
+         * Since the VM might be running, the page may be changing
+         * concurrently.  Work on a copy, so that what we send and what
+         * we keep in the cache are the same.
+         */
+        memcpy(x->buf, pages->block->host + pages->offset[i], page_size);
+
+        if (cache_is_cached(x->cache, addr, age)) {
+            uint8_t *old = get_cached_data(x->cache, addr);
+            int len;
+
+            len = xbzrle_encode_buffer(old, x->buf, page_size,
+                                       rec + MULTIFD_XBZRLE_DELTA_HDR,
+                                       page_size - MULTIFD_XBZRLE_DELTA_HDR);
+            memcpy(old, x->buf, page_size);
+            if (len >= 0) {
+                rec[0] = MULTIFD_XBZRLE_PAGE_DELTA;
+                stw_be_p(rec + 1, len);
+                out_size += MULTIFD_XBZRLE_DELTA_HDR + len;
+                deltas++;
+                continue;
+            }
+            /* Delta is bigger than the page itself, send it in full */
+        } else {
+            /* Failing to insert only means we send a full page next time */
+            cache_insert(x->cache, addr, x->buf, age);
+        }
+
+        rec[0] = MULTIFD_XBZRLE_PAGE_FULL;
+        memcpy(rec + 1, x->buf, page_size);
+        out_size += 1 + page_size;
+    }
+
+    trace_multifd_xbzrle_send(p->id, pages->normal_num, deltas, out_size);
+
+    p->iov[p->iovs_num].iov_base = x->out;
+    p->iov[p->iovs_num].iov_len = out_size;
+    p->iovs_num++;
+    p->next_packet_size = out_size;
+
+out:
+    p->flags |= MULTIFD_FLAG_XBZRLE;
+    multifd_send_fill_packet(p);
+    return 0;
+}
+
+static int multifd_xbzrle_recv_setup(MultiFDRecvParams *p, Error **errp)
+{
+    struct xbzrle_data *x = g_new0(struct xbzrle_data, 1);
+
+    x->out_len = multifd_xbzrle_packet_len();
+    x->out = g_malloc(x->out_len);
+    p->compress_data = x;
+
+    return 0;
+}
+
+static void multifd_xbzrle_recv_cleanup(MultiFDRecvParams *p)
+{
+    struct xbzrle_data *x = p->compress_data;
+
+    g_free(x->out);
+    g_free(p->compress_data);
+    p->compress_data = NULL;
+}
+
+static int multifd_xbzrle_recv(MultiFDRecvParams *p, Error **errp)
+{
+    struct xbzrle_data *x = p->compress_data;
+    uint32_t in_size = p->next_packet_size;
+    uint32_t page_size = multifd_ram_page_size();
+    uint32_t flags = p->flags & MULTIFD_FLAG_COMPRESSION_MASK;
+    uint32_t pos = 0;
+    int ret;
+    int i;
+
+    if (flags != MULTIFD_FLAG_XBZRLE) {
+        error_setg(errp, "multifd %u: flags received %x flags expected %x",
+                   p->id, flags, MULTIFD_FLAG_XBZRLE);
+        return -1;
+    }
+
+    multifd_recv_zero_page_process(p);
+
+    if (!p->normal_num) {
+        assert(in_size == 0);
+        return 0;
+    }
+
+    if (in_size > x->out_len) {
+        error_setg(errp, "multifd %u: packet size %u exceeds maximum %u",
+                   p->id, in_size, x->out_len);
+        return -1;
+    }
+
+    ret = qio_channel_read_all(p->c, (void *)x->out, in_size, errp);
+    if (ret != 0) {
+        return ret;
+    }
+
+    for (i = 0; i < p->normal_num; i++) {
+        uint8_t *host = p->host + p->normal[i];
+        uint32_t len;
+
+        ramblock_recv_bitmap_set_offset(p->block, p->normal[i]);
+
+        if (pos >= in_size) {
+            goto truncated;
+        }
+
+        switch (x->out[pos]) {
+        case MULTIFD_XBZRLE_PAGE_FULL:
+            pos++;
+            if (in_size - pos < page_size) {
+                goto truncated;
+            }
+            memcpy(host, x->out + pos, page_size);
+            pos += page_size;
+            break;
+        case MULTIFD_XBZRLE_PAGE_DELTA:
+            if (in_size - pos < MULTIFD_XBZRLE_DELTA_HDR) {
+                goto truncated;
+            }
+            len = lduw_be_p(x->out + pos + 1);
+            pos += MULTIFD_XBZRLE_DELTA_HDR;
+            if (in_size - pos < len) {
+                goto truncated;
+            }
+            if (xbzrle_decode_buffer(x->out + pos, len, host, page_size) < 0) {
+                error_setg(errp, "multifd %u: failed to decode xbzrle delta "
+                           "for page at offset 0x%" PRIx64, p->id,
+                           (uint64_t)p->normal[i]);
+                return -1;
+            }
+            pos += len;
+            break;
+        default:
+            error_setg(errp, "multifd %u: unknown xbzrle page kind %u",
+                       p->id, x->out[pos]);
+            return -1;
+        }
+    }
+
+    if (pos != in_size) {
+        error_setg(errp, "multifd %u: packet size received %u size expected %u",
+                   p->id, in_size, pos);
+        return -1;
+    }
+
+    return 0;
+
+truncated:
+    error_setg(errp, "multifd %u: truncated xbzrle packet of size %u",
+               p->id, in_size);
+    return -1;
+}
+
+static const MultiFDMethods multifd_xbzrle_ops = {
+    .send_setup = multifd_xbzrle_send_setup,
+    .send_cleanup = multifd_xbzrle_send_cleanup,
+    .send_prepare = multifd_xbzrle_send_prepare,
+    .recv_setup = multifd_xbzrle_recv_setup,
+    .recv_cleanup = multifd_xbzrle_recv_cleanup,
+    .recv = multifd_xbzrle_recv
+};
+
+static void multifd_xbzrle_register(void)
+{
+    multifd_register_ops(MULTIFD_COMPRESSION_XBZRLE, &multifd_xbzrle_ops);
+}
+
+migration_init(multifd_xbzrle_register);
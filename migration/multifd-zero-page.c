@@ -12,6 +12,7 @@
 
 #include "qemu/osdep.h"
 #include "qemu/cutils.h"
+#include "qemu/units.h"
 #include "system/ramblock.h"
 #include "migration.h"
 #include "migration-stats.h"
@@ -19,12 +20,23 @@
 #include "options.h"
 #include "ram.h"
 
+/*
+ * Runs of zero pages over already received memory are discarded instead
+ * of cleared where they cover whole aligned chunks of this size, or of the
+ * host page size if bigger.
+ */
+#define MULTIFD_ZERO_DISCARD_MIN (256 * KiB)
+
+/* Set once discarding failed, to fall back to clearing from then on */
+static bool multifd_zero_discard_failed;
+
 static bool multifd_zero_page_enabled(void)
 {
     return migrate_zero_page_detection() == ZERO_PAGE_DETECTION_MULTIFD;
 }
 
-static void swap_page_offset(ram_addr_t *pages_offset, int a, int b)
+static void swap_page_offset(ram_addr_t *pages_offset, bool *zero,
+                             int a, int b)
 {
     ram_addr_t temp;
 
@@ -35,6 +47,9 @@ static void swap_page_offset(ram_addr_t *pages_offset, int a, int b)
     temp = pages_offset[a];
     pages_offset[a] = pages_offset[b];
     pages_offset[b] = temp;
+    if (zero) {
+        zero[a] = zero[b];
+    }
 }
 
 /**
@@ -49,6 +64,7 @@ void multifd_send_zero_page_detect(MultiFDSendParams *p)
 {
     MultiFDPages_t *pages = &p->data->u.ram;
     RAMBlock *rb = pages->block;
+    bool *zero = NULL;
     int i = 0;
     int j = pages->num - 1;
 
@@ -57,6 +73,11 @@ void multifd_send_zero_page_detect(MultiFDSendParams *p)
         goto out;
     }
 
+    if (p->dsa_task) {
+        zero = multifd_dsa_zero_detect(p->dsa_task, rb->host, pages->offset,
+                                       pages->num, multifd_ram_page_size());
+    }
+
     /*
      * Sort the page offset array by moving all normal pages to
      * the left and all zero pages to the right of the array.
@@ -64,12 +85,14 @@ void multifd_send_zero_page_detect(MultiFDSendParams *p)
     while (i <= j) {
         uint64_t offset = pages->offset[i];
 
-        if (!buffer_is_zero(rb->host + offset, multifd_ram_page_size())) {
+        if (zero ? !zero[i] :
+            !buffer_is_zero(rb->host + offset, multifd_ram_page_size())) {
             i++;
             continue;
         }
 
-        swap_page_offset(pages->offset, i, j);
+        /* zero[j] is not looked at again, it only needs to move to i */
+        swap_page_offset(pages->offset, zero, i, j);
         ram_release_page(rb->idstr, offset);
         j--;
     }
@@ -81,12 +104,85 @@ out:
     stat64_add(&mig_stats.zero_pages, pages->num - pages->normal_num);
 }
 
+static int multifd_zero_page_cmp(const void *a, const void *b)
+{
+    ram_addr_t x = *(const ram_addr_t *)a, y = *(const ram_addr_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static bool multifd_recv_zero_page_can_discard(RAMBlock *rb)
+{
+    /*
+     * Only discarding anonymous private memory reliably reads back as
+     * zeroes later.  Not with postcopy either, as the discarded pages
+     * would then fault into userfaultfd, nor when some device relies on
+     * guest memory staying populated.
+     */
+    return qemu_ram_get_fd(rb) < 0 && !qemu_ram_is_shared(rb) &&
+           !migrate_postcopy_ram() && !ram_block_discard_is_disabled() &&
+           !qatomic_read(&multifd_zero_discard_failed);
+}
+
+/*
+ * Clear the first @num pages of p->zero, discarding the aligned chunks of
+ * the contiguous runs rather than clearing them page by page.
+ */
+static void multifd_recv_zero_page_clear(MultiFDRecvParams *p, uint32_t num)
+{
+    RAMBlock *rb = p->block;
+    ram_addr_t page_size = multifd_ram_page_size();
+    ram_addr_t chunk = MAX(MULTIFD_ZERO_DISCARD_MIN, qemu_ram_pagesize(rb));
+    uint32_t i, j;
+
+    if (num * page_size < chunk || !multifd_recv_zero_page_can_discard(rb)) {
+        if (p->dsa_task) {
+            multifd_dsa_zero_fill(p->dsa_task, p->host, p->zero, num,
+                                  page_size);
+            return;
+        }
+        for (i = 0; i < num; i++) {
+            memset(p->host + p->zero[i], 0, page_size);
+        }
+        return;
+    }
+
+    /* The sender's zero page detection does not keep the pages in order */
+    qsort(p->zero, num, sizeof(p->zero[0]), multifd_zero_page_cmp);
+
+    for (i = 0; i < num; i = j) {
+        ram_addr_t start = p->zero[i], end, discard_start, discard_end;
+
+        for (j = i + 1; j < num; j++) {
+            if (p->zero[j] != start + (j - i) * page_size) {
+                break;
+            }
+        }
+        end = start + (j - i) * page_size;
+        discard_start = QEMU_ALIGN_UP(start, chunk);
+        discard_end = QEMU_ALIGN_DOWN(end, chunk);
+
+        if (discard_start < discard_end) {
+            if (!ram_block_discard_range(rb, discard_start,
+                                         discard_end - discard_start)) {
+                memset(p->host + start, 0, discard_start - start);
+                memset(p->host + discard_end, 0, end - discard_end);
+                continue;
+            }
+            qatomic_set(&multifd_zero_discard_failed, true);
+        }
+        memset(p->host + start, 0, end - start);
+    }
+}
+
 void multifd_recv_zero_page_process(MultiFDRecvParams *p)
 {
+    uint32_t nr_clear = 0;
+
     for (int i = 0; i < p->zero_num; i++) {
-        void *page = p->host + p->zero[i];
+        ram_addr_t offset = p->zero[i];
         bool received =
-                ramblock_recv_bitmap_test_byte_offset(p->block, p->zero[i]);
+                ramblock_recv_bitmap_test_byte_offset(p->block, offset);
 
         /*
          * During multifd migration zero page is written to the memory
@@ -103,10 +199,13 @@ void multifd_recv_zero_page_process(MultiFDRecvParams *p)
          * it is migrated.
          */
         if (migrate_postcopy_ram() || received) {
-            memset(page, 0, multifd_ram_page_size());
+            /* Gather the pages to clear at the start of p->zero */
+            p->zero[nr_clear++] = offset;
         }
         if (!received) {
-            ramblock_recv_bitmap_set_offset(p->block, p->zero[i]);
+            ramblock_recv_bitmap_set_offset(p->block, offset);
         }
     }
+
+    multifd_recv_zero_page_clear(p, nr_clear);
 }
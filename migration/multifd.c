@@ -79,6 +79,8 @@ struct {
     int exiting;
     /* multifd ops */
     const MultiFDMethods *ops;
+    /* DSA work queues are set up */
+    bool dsa;
 } *multifd_send_state;
 
 struct {
@@ -96,6 +98,8 @@ struct {
     int exiting;
     /* multifd ops */
     const MultiFDMethods *ops;
+    /* DSA work queues are set up */
+    bool dsa;
 } *multifd_recv_state;
 
 MultiFDSendData *multifd_send_data_alloc(void)
@@ -554,6 +558,7 @@ static bool multifd_send_cleanup_channel(MultiFDSendParams *p, Error **errp)
     g_clear_pointer(&p->packet_device_state, g_free);
     g_free(p->packet);
     p->packet = NULL;
+    g_clear_pointer(&p->dsa_task, multifd_dsa_task_free);
     multifd_send_state->ops->send_cleanup(p, errp);
     assert(!p->iov);
 
@@ -565,6 +570,9 @@ static void multifd_send_cleanup_state(void)
     file_cleanup_outgoing_migration();
     socket_cleanup_outgoing_migration();
     multifd_device_state_send_cleanup();
+    if (multifd_send_state->dsa) {
+        multifd_dsa_cleanup();
+    }
     qemu_sem_destroy(&multifd_send_state->channels_created);
     qemu_sem_destroy(&multifd_send_state->channels_ready);
     qemu_mutex_destroy(&multifd_send_state->multifd_send_mutex);
@@ -659,6 +667,130 @@ int multifd_send_sync_main(MultiFDSyncReq req)
     return 0;
 }
 
+/*
+ * multifd_send_scan_main: run one round of partitioned dirty page scan
+ *
+ * Every sender thread scans its own partition of the RAM dirty bitmap
+ * and sends the dirty pages it finds (see ram_multifd_scan_partition());
+ * the caller only waits for all of them to finish.
+ *
+ * multifd_send_mutex is held for the whole round, so that nobody else
+ * can hand a job to a channel while it is busy scanning.
+ *
+ * Returns 0 if succeed, -1 otherwise.
+ */
+int multifd_send_scan_main(void)
+{
+    int i;
+
+    QEMU_LOCK_GUARD(&multifd_send_state->multifd_send_mutex);
+
+    for (i = 0; i < migrate_multifd_channels(); i++) {
+        MultiFDSendParams *p = &multifd_send_state->params[i];
+
+        if (multifd_send_should_exit()) {
+            return -1;
+        }
+
+        assert(!qatomic_read(&p->pending_scan));
+        qatomic_set(&p->pending_scan, true);
+        qemu_sem_post(&p->sem);
+    }
+    for (i = 0; i < migrate_multifd_channels(); i++) {
+        MultiFDSendParams *p = &multifd_send_state->params[i];
+
+        if (multifd_send_should_exit()) {
+            return -1;
+        }
+
+        qemu_sem_wait(&multifd_send_state->channels_ready);
+        qemu_sem_wait(&p->sem_sync);
+    }
+    trace_multifd_send_scan_main(multifd_send_state->packet_num);
+
+    return 0;
+}
+
+/*
+ * multifd_send_payload: transmit the payload currently in p->data
+ *
+ * Must only be called from the sender thread of @p.  On success the
+ * payload has been written to the channel and p->data is empty again.
+ *
+ * Returns 0 if succeed, non-zero otherwise with @errp set.
+ */
+int multifd_send_payload(MultiFDSendParams *p, Error **errp)
+{
+    bool is_device_state = multifd_payload_device_state(p->data);
+    size_t total_size;
+    int write_flags_masked = 0;
+    int ret;
+
+    p->flags = 0;
+    p->iovs_num = 0;
+    assert(!multifd_payload_empty(p->data));
+
+    if (is_device_state) {
+        multifd_device_state_send_prepare(p);
+
+        /* Device state packets cannot be sent via zerocopy */
+        write_flags_masked |= QIO_CHANNEL_WRITE_FLAG_ZERO_COPY;
+    } else {
+        ret = multifd_send_state->ops->send_prepare(p, errp);
+        if (ret != 0) {
+            return ret;
+        }
+    }
+
+    /*
+     * The packet header in the zerocopy RAM case is accounted for
+     * in multifd_nocomp_send_prepare() - where it is actually
+     * being sent.
+     */
+    total_size = iov_size(p->iov, p->iovs_num);
+
+    if (migrate_mapped_ram()) {
+        assert(!is_device_state);
+
+        ret = file_write_ramblock_iov(p->c, p->iov, p->iovs_num,
+                                      &p->data->u.ram, errp);
+    } else {
+        ret = qio_channel_writev_full_all(p->c, p->iov, p->iovs_num,
+                                          NULL, 0,
+                                          p->write_flags & ~write_flags_masked,
+                                          errp);
+    }
+
+    if (ret != 0) {
+        return ret;
+    }
+
+    stat64_add(&mig_stats.multifd_bytes, total_size);
+
+    p->next_packet_size = 0;
+    multifd_send_data_clear(p->data);
+
+    return 0;
+}
+
+/*
+ * Wait for work on a channel with a send queue.  Writes that were queued
+ * while earlier ones were being sent are only submitted by later writes,
+ * so push them out before the thread goes to sleep.
+ */
+static int multifd_send_queue_wait(MultiFDSendParams *p, Error **errp)
+{
+    if (qemu_sem_timedwait(&p->sem, 0) == 0) {
+        return 0;
+    }
+    if (qio_channel_socket_submit_send_queue(QIO_CHANNEL_SOCKET(p->c),
+                                             errp) < 0) {
+        return -1;
+    }
+    qemu_sem_wait(&p->sem);
+    return 0;
+}
+
 static void *multifd_send_thread(void *opaque)
 {
     MultiFDSendParams *p = opaque;
@@ -681,7 +813,14 @@ static void *multifd_send_thread(void *opaque)
 
     while (true) {
         qemu_sem_post(&multifd_send_state->channels_ready);
-        qemu_sem_wait(&p->sem);
+        if (p->send_queue) {
+            ret = multifd_send_queue_wait(p, &local_err);
+            if (ret != 0) {
+                break;
+            }
+        } else {
+            qemu_sem_wait(&p->sem);
+        }
 
         if (multifd_send_should_exit()) {
             break;
@@ -692,60 +831,31 @@ static void *multifd_send_thread(void *opaque)
          * qatomic_store_release() in multifd_send().
          */
         if (qatomic_load_acquire(&p->pending_job)) {
-            bool is_device_state = multifd_payload_device_state(p->data);
-            size_t total_size;
-            int write_flags_masked = 0;
-
-            p->flags = 0;
-            p->iovs_num = 0;
-            assert(!multifd_payload_empty(p->data));
-
-            if (is_device_state) {
-                multifd_device_state_send_prepare(p);
-
-                /* Device state packets cannot be sent via zerocopy */
-                write_flags_masked |= QIO_CHANNEL_WRITE_FLAG_ZERO_COPY;
-            } else {
-                ret = multifd_send_state->ops->send_prepare(p, &local_err);
-                if (ret != 0) {
-                    break;
-                }
-            }
-
-            /*
-             * The packet header in the zerocopy RAM case is accounted for
-             * in multifd_nocomp_send_prepare() - where it is actually
-             * being sent.
-             */
-            total_size = iov_size(p->iov, p->iovs_num);
-
-            if (migrate_mapped_ram()) {
-                assert(!is_device_state);
-
-                ret = file_write_ramblock_iov(p->c, p->iov, p->iovs_num,
-                                              &p->data->u.ram, &local_err);
-            } else {
-                ret = qio_channel_writev_full_all(p->c, p->iov, p->iovs_num,
-                                                  NULL, 0,
-                                                  p->write_flags & ~write_flags_masked,
-                                                  &local_err);
-            }
-
+            ret = multifd_send_payload(p, &local_err);
             if (ret != 0) {
                 break;
             }
 
-            stat64_add(&mig_stats.multifd_bytes, total_size);
-
-            p->next_packet_size = 0;
-            multifd_send_data_clear(p->data);
-
             /*
              * Making sure p->data is published before saying "we're
              * free".  Pairs with the smp_mb_acquire() in
              * multifd_send().
              */
             qatomic_store_release(&p->pending_job, false);
+        } else if (qatomic_read(&p->pending_scan)) {
+            /*
+             * Scan our own partition of the dirty bitmap and send
+             * whatever we find directly from this thread.  Like
+             * pending_sync, this is a standalone flag and the migration
+             * thread waits on sem_sync for the scan to finish.
+             */
+            ret = ram_multifd_scan_partition(p, &local_err);
+            if (ret != 0) {
+                break;
+            }
+
+            qatomic_set(&p->pending_scan, false);
+            qemu_sem_post(&p->sem_sync);
         } else {
             MultiFDSyncReq req = qatomic_read(&p->pending_sync);
 
@@ -885,6 +995,16 @@ static void multifd_new_send_channel_async(QIOTask *task, gpointer opaque)
             return;
         }
     } else {
+        unsigned int depth = migrate_multifd_send_queue_depth();
+
+        if (depth) {
+            if (qio_channel_socket_enable_send_queue(QIO_CHANNEL_SOCKET(ioc),
+                                                     depth, &local_err)) {
+                ret = false;
+                goto out;
+            }
+            p->send_queue = true;
+        }
         multifd_channel_connect(p, ioc);
         ret = true;
     }
@@ -992,6 +1112,20 @@ bool multifd_send_setup(void)
         assert(p->iov);
     }
 
+    if (migrate_dsa_work_queues()) {
+        Error *local_err = NULL;
+
+        if (!multifd_dsa_setup(migrate_dsa_work_queues(), &local_err)) {
+            migrate_error_propagate(s, local_err);
+            goto err;
+        }
+        multifd_send_state->dsa = true;
+        for (i = 0; i < thread_count; i++) {
+            multifd_send_state->params[i].dsa_task =
+                multifd_dsa_task_new(page_count);
+        }
+    }
+
     multifd_device_state_send_setup();
 
     return true;
@@ -1140,11 +1274,15 @@ static void multifd_recv_cleanup_channel(MultiFDRecvParams *p)
     p->normal = NULL;
     g_free(p->zero);
     p->zero = NULL;
+    g_clear_pointer(&p->dsa_task, multifd_dsa_task_free);
     multifd_recv_state->ops->recv_cleanup(p);
 }
 
 static void multifd_recv_cleanup_state(void)
 {
+    if (multifd_recv_state->dsa) {
+        multifd_dsa_cleanup();
+    }
     qemu_sem_destroy(&multifd_recv_state->sem_sync);
     g_free(multifd_recv_state->params);
     multifd_recv_state->params = NULL;
@@ -1257,7 +1395,7 @@ static int multifd_device_state_recv(MultiFDRecvParams *p, Error **errp)
 
     if (!qemu_loadvm_load_state_buffer(p->packet_dev_state->idstr,
                                        p->packet_dev_state->instance_id,
-                                       dev_state_buf, p->next_packet_size,
+                                       &dev_state_buf, p->next_packet_size,
                                        errp)) {
         ret = -1;
     }
@@ -1501,6 +1639,17 @@ int multifd_recv_setup(Error **errp)
             return ret;
         }
     }
+
+    if (migrate_dsa_work_queues()) {
+        if (!multifd_dsa_setup(migrate_dsa_work_queues(), errp)) {
+            return -1;
+        }
+        multifd_recv_state->dsa = true;
+        for (i = 0; i < thread_count; i++) {
+            multifd_recv_state->params[i].dsa_task =
+                multifd_dsa_task_new(page_count);
+        }
+    }
     return 0;
 }
 
@@ -18,6 +18,7 @@
 
 typedef struct MultiFDRecvData MultiFDRecvData;
 typedef struct MultiFDSendData MultiFDSendData;
+typedef struct MultiFDDsaTask MultiFDDsaTask;
 
 typedef enum {
     /* No sync request */
@@ -45,6 +46,7 @@ bool multifd_recv_all_channels_created(void);
 void multifd_recv_new_channel(QIOChannel *ioc, Error **errp);
 void multifd_recv_sync_main(void);
 int multifd_send_sync_main(MultiFDSyncReq req);
+int multifd_send_scan_main(void);
 bool multifd_queue_page(RAMBlock *block, ram_addr_t offset);
 bool multifd_recv(void);
 MultiFDRecvData *multifd_get_recv_data(void);
@@ -63,6 +65,7 @@ MultiFDRecvData *multifd_get_recv_data(void);
 #define MULTIFD_FLAG_NOCOMP (0 << 1)
 #define MULTIFD_FLAG_ZLIB (1 << 1)
 #define MULTIFD_FLAG_ZSTD (2 << 1)
+#define MULTIFD_FLAG_XBZRLE (3 << 1)
 #define MULTIFD_FLAG_QPL (4 << 1)
 #define MULTIFD_FLAG_UADK (8 << 1)
 #define MULTIFD_FLAG_QATZIP (16 << 1)
@@ -193,6 +196,8 @@ typedef struct {
     bool tls_thread_created;
     /* communication channel */
     QIOChannel *c;
+    /* c is a socket with a send queue */
+    bool send_queue;
     /* packet allocated len */
     uint32_t packet_len;
     /* multifd flags for sending ram */
@@ -210,12 +215,15 @@ typedef struct {
      *
      * @pending_job:  a job is pending
      * @pending_sync: a sync request is pending
+     * @pending_scan: a dirty page scan of the channel's own RAM
+     *                partition is pending (x-multifd-partitioned-scan)
      *
-     * For both of these fields, they're only set by the requesters, and
+     * For all of these fields, they're only set by the requesters, and
      * cleared by the multifd sender threads.
      */
     bool pending_job;
     MultiFDSyncReq pending_sync;
+    bool pending_scan;
 
     MultiFDSendData *data;
 
@@ -234,6 +242,8 @@ typedef struct {
     uint32_t iovs_num;
     /* used for compression methods */
     void *compress_data;
+    /* zero page detection offload, see x-dsa-work-queues */
+    MultiFDDsaTask *dsa_task;
 }  MultiFDSendParams;
 
 typedef struct {
@@ -295,6 +305,8 @@ typedef struct {
     void *compress_data;
     /* Flags for the QIOChannel */
     int read_flags;
+    /* zero page fill offload, see x-dsa-work-queues */
+    MultiFDDsaTask *dsa_task;
 } MultiFDRecvParams;
 
 typedef struct {
@@ -382,8 +394,23 @@ bool multifd_send_prepare_common(MultiFDSendParams *p);
 void multifd_send_zero_page_detect(MultiFDSendParams *p);
 void multifd_recv_zero_page_process(MultiFDRecvParams *p);
 
+/* Zero page offload to Intel DSA, see multifd-dsa.c */
+bool multifd_dsa_setup(const char *work_queues, Error **errp);
+void multifd_dsa_cleanup(void);
+/* Returns NULL if no work queue can take one more task */
+MultiFDDsaTask *multifd_dsa_task_new(uint32_t max_pages);
+void multifd_dsa_task_free(MultiFDDsaTask *task);
+/* Returns whether each of the @num pages is zero, in an array of @task */
+bool *multifd_dsa_zero_detect(MultiFDDsaTask *task, uint8_t *host,
+                              const ram_addr_t *offsets, uint32_t num,
+                              size_t page_size);
+void multifd_dsa_zero_fill(MultiFDDsaTask *task, uint8_t *host,
+                           const ram_addr_t *offsets, uint32_t num,
+                           size_t page_size);
+
 void multifd_channel_connect(MultiFDSendParams *p, QIOChannel *ioc);
 bool multifd_send(MultiFDSendData **send_data);
+int multifd_send_payload(MultiFDSendParams *p, Error **errp);
 MultiFDSendData *multifd_send_data_alloc(void);
 void multifd_send_data_clear(MultiFDSendData *data);
 void multifd_send_data_free(MultiFDSendData *data);
@@ -407,6 +434,10 @@ void multifd_ram_payload_alloc(MultiFDPages_t *pages);
 void multifd_ram_payload_free(MultiFDPages_t *pages);
 void multifd_ram_fill_packet(MultiFDSendParams *p);
 int multifd_ram_unfill_packet(MultiFDRecvParams *p, Error **errp);
+int multifd_ram_queue_page_local(MultiFDSendParams *p, RAMBlock *block,
+                                 ram_addr_t offset, Error **errp);
+int multifd_ram_flush_local(MultiFDSendParams *p, Error **errp);
+int ram_multifd_scan_partition(MultiFDSendParams *p, Error **errp);
 
 void multifd_send_data_clear_device_state(MultiFDDeviceState_t *device_state);
 
@@ -70,6 +70,7 @@
  * that page requests can still exceed this limit.
  */
 #define DEFAULT_MIGRATE_MAX_POSTCOPY_BANDWIDTH 0
+#define MAX_MULTIFD_SEND_QUEUE_DEPTH 4096
 
 /*
  * Parameters for self_announce_delay giving a stream of RARP/ARP
@@ -134,6 +135,10 @@ const Property migration_properties[] = {
     DEFINE_PROP_UINT8("multifd-channels", MigrationState,
                       parameters.multifd_channels,
                       DEFAULT_MIGRATE_MULTIFD_CHANNELS),
+    DEFINE_PROP_UINT8("x-postcopy-preempt-channels", MigrationState,
+                      parameters.x_postcopy_preempt_channels, 1),
+    DEFINE_PROP_UINT32("x-multifd-send-queue-depth", MigrationState,
+                       parameters.x_multifd_send_queue_depth, 0),
     DEFINE_PROP_MULTIFD_COMPRESSION("multifd-compression", MigrationState,
                       parameters.multifd_compression,
                       DEFAULT_MIGRATE_MULTIFD_COMPRESSION),
@@ -171,6 +176,10 @@ const Property migration_properties[] = {
     DEFINE_PROP_STR_OR_NULL("tls-hostname", MigrationState,
                             parameters.tls_hostname),
     DEFINE_PROP_STR_OR_NULL("tls-authz", MigrationState, parameters.tls_authz),
+    DEFINE_PROP_STR_OR_NULL("x-bandwidth-pool", MigrationState,
+                            parameters.x_bandwidth_pool),
+    DEFINE_PROP_STR_OR_NULL("x-dsa-work-queues", MigrationState,
+                            parameters.x_dsa_work_queues),
     DEFINE_PROP_UINT64("x-vcpu-dirty-limit-period", MigrationState,
                        parameters.x_vcpu_dirty_limit_period,
                        DEFAULT_MIGRATE_VCPU_DIRTY_LIMIT_PERIOD),
@@ -211,6 +220,16 @@ const Property migration_properties[] = {
     DEFINE_PROP_MIG_CAP("mapped-ram", MIGRATION_CAPABILITY_MAPPED_RAM),
     DEFINE_PROP_MIG_CAP("x-ignore-shared",
                         MIGRATION_CAPABILITY_X_IGNORE_SHARED),
+    DEFINE_PROP_MIG_CAP("x-multifd-partitioned-scan",
+                        MIGRATION_CAPABILITY_X_MULTIFD_PARTITIONED_SCAN),
+    DEFINE_PROP_MIG_CAP("x-defer-hot-pages",
+                        MIGRATION_CAPABILITY_X_DEFER_HOT_PAGES),
+    DEFINE_PROP_MIG_CAP("x-postcopy-prefetch",
+                        MIGRATION_CAPABILITY_X_POSTCOPY_PREFETCH),
+    DEFINE_PROP_MIG_CAP("x-mapped-ram-map",
+                        MIGRATION_CAPABILITY_X_MAPPED_RAM_MAP),
+    DEFINE_PROP_MIG_CAP("x-mapped-ram-lazy",
+                        MIGRATION_CAPABILITY_X_MAPPED_RAM_LAZY),
 };
 const size_t migration_properties_count = ARRAY_SIZE(migration_properties);
 
@@ -309,6 +328,13 @@ bool migrate_colo(void)
     return s->capabilities[MIGRATION_CAPABILITY_X_COLO];
 }
 
+bool migrate_defer_hot_pages(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->capabilities[MIGRATION_CAPABILITY_X_DEFER_HOT_PAGES];
+}
+
 bool migrate_dirty_bitmaps(void)
 {
     MigrationState *s = migrate_get_current();
@@ -337,6 +363,20 @@ bool migrate_mapped_ram(void)
     return s->capabilities[MIGRATION_CAPABILITY_MAPPED_RAM];
 }
 
+bool migrate_mapped_ram_lazy(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->capabilities[MIGRATION_CAPABILITY_X_MAPPED_RAM_LAZY];
+}
+
+bool migrate_mapped_ram_map(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->capabilities[MIGRATION_CAPABILITY_X_MAPPED_RAM_MAP];
+}
+
 bool migrate_ignore_shared(void)
 {
     MigrationState *s = migrate_get_current();
@@ -358,6 +398,13 @@ bool migrate_multifd(void)
     return s->capabilities[MIGRATION_CAPABILITY_MULTIFD];
 }
 
+bool migrate_multifd_partitioned_scan(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->capabilities[MIGRATION_CAPABILITY_X_MULTIFD_PARTITIONED_SCAN];
+}
+
 bool migrate_pause_before_switchover(void)
 {
     MigrationState *s = migrate_get_current();
@@ -379,6 +426,13 @@ bool migrate_postcopy_preempt(void)
     return s->capabilities[MIGRATION_CAPABILITY_POSTCOPY_PREEMPT];
 }
 
+bool migrate_postcopy_prefetch(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->capabilities[MIGRATION_CAPABILITY_X_POSTCOPY_PREFETCH];
+}
+
 bool migrate_postcopy_ram(void)
 {
     MigrationState *s = migrate_get_current();
@@ -658,6 +712,33 @@ bool migrate_caps_check(bool *old_caps, bool *new_caps, Error **errp)
     }
 #endif
 
+    if (new_caps[MIGRATION_CAPABILITY_X_POSTCOPY_PREFETCH] &&
+        !new_caps[MIGRATION_CAPABILITY_POSTCOPY_RAM]) {
+        error_setg(errp, "Capability 'x-postcopy-prefetch' "
+                   "requires postcopy-ram");
+        return false;
+    }
+
+    if (new_caps[MIGRATION_CAPABILITY_X_MAPPED_RAM_MAP] &&
+        !new_caps[MIGRATION_CAPABILITY_MAPPED_RAM]) {
+        error_setg(errp, "Capability 'x-mapped-ram-map' "
+                   "requires mapped-ram");
+        return false;
+    }
+
+    if (new_caps[MIGRATION_CAPABILITY_X_MAPPED_RAM_LAZY]) {
+#ifndef CONFIG_LINUX
+        error_setg(errp, "Capability 'x-mapped-ram-lazy' is not supported "
+                   "on this host");
+        return false;
+#endif
+        if (!new_caps[MIGRATION_CAPABILITY_MAPPED_RAM]) {
+            error_setg(errp, "Capability 'x-mapped-ram-lazy' "
+                       "requires mapped-ram");
+            return false;
+        }
+    }
+
     if (new_caps[MIGRATION_CAPABILITY_POSTCOPY_PREEMPT]) {
         if (!new_caps[MIGRATION_CAPABILITY_POSTCOPY_RAM]) {
             error_setg(errp, "Postcopy preempt requires postcopy-ram");
@@ -706,6 +787,27 @@ bool migrate_caps_check(bool *old_caps, bool *new_caps, Error **errp)
         }
     }
 
+    if (new_caps[MIGRATION_CAPABILITY_X_MULTIFD_PARTITIONED_SCAN]) {
+        if (!new_caps[MIGRATION_CAPABILITY_MULTIFD]) {
+            error_setg(errp, "Capability 'x-multifd-partitioned-scan' "
+                       "requires capability 'multifd'");
+            return false;
+        }
+
+        if (new_caps[MIGRATION_CAPABILITY_POSTCOPY_RAM]) {
+            error_setg(errp, "Capability 'x-multifd-partitioned-scan' "
+                       "is incompatible with postcopy");
+            return false;
+        }
+    }
+
+    if (new_caps[MIGRATION_CAPABILITY_X_DEFER_HOT_PAGES] &&
+        new_caps[MIGRATION_CAPABILITY_POSTCOPY_RAM]) {
+        error_setg(errp, "Capability 'x-defer-hot-pages' "
+                   "is incompatible with postcopy");
+        return false;
+    }
+
     if (new_caps[MIGRATION_CAPABILITY_MAPPED_RAM]) {
         if (new_caps[MIGRATION_CAPABILITY_XBZRLE]) {
             error_setg(errp,
@@ -890,6 +992,20 @@ int migrate_multifd_channels(void)
     return s->parameters.multifd_channels;
 }
 
+int migrate_postcopy_preempt_channels(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->parameters.x_postcopy_preempt_channels;
+}
+
+unsigned int migrate_multifd_send_queue_depth(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->parameters.x_multifd_send_queue_depth;
+}
+
 MultiFDCompression migrate_multifd_compression(void)
 {
     MigrationState *s = migrate_get_current();
@@ -926,6 +1042,28 @@ uint8_t migrate_throttle_trigger_threshold(void)
     return s->parameters.throttle_trigger_threshold;
 }
 
+const char *migrate_bandwidth_pool(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    if (*s->parameters.x_bandwidth_pool->u.s) {
+        return s->parameters.x_bandwidth_pool->u.s;
+    }
+
+    return NULL;
+}
+
+const char *migrate_dsa_work_queues(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    if (*s->parameters.x_dsa_work_queues->u.s) {
+        return s->parameters.x_dsa_work_queues->u.s;
+    }
+
+    return NULL;
+}
+
 const char *migrate_tls_authz(void)
 {
     MigrationState *s = migrate_get_current();
@@ -1006,6 +1144,8 @@ void migrate_tls_opts_free(MigrationParameters *params)
     qapi_free_StrOrNull(params->tls_creds);
     qapi_free_StrOrNull(params->tls_hostname);
     qapi_free_StrOrNull(params->tls_authz);
+    qapi_free_StrOrNull(params->x_bandwidth_pool);
+    qapi_free_StrOrNull(params->x_dsa_work_queues);
 }
 
 /* normalize QTYPE_QNULL to QTYPE_QSTRING "" */
@@ -1033,7 +1173,11 @@ static void tls_opt_to_str(StrOrNull *opt)
  */
 static void migrate_mark_all_params_present(MigrationParameters *p)
 {
-    int len, n_str_args = 3; /* tls-creds, tls-hostname, tls-authz */
+    /*
+     * tls-creds, tls-hostname, tls-authz, x-bandwidth-pool,
+     * x-dsa-work-queues
+     */
+    int len, n_str_args = 5;
     bool *has_fields[] = {
         &p->has_throttle_trigger_threshold, &p->has_cpu_throttle_initial,
         &p->has_cpu_throttle_increment, &p->has_cpu_throttle_tailslow,
@@ -1047,7 +1191,8 @@ static void migrate_mark_all_params_present(MigrationParameters *p)
         &p->has_announce_step, &p->has_block_bitmap_mapping,
         &p->has_x_vcpu_dirty_limit_period, &p->has_vcpu_dirty_limit,
         &p->has_mode, &p->has_zero_page_detection, &p->has_direct_io,
-        &p->has_cpr_exec_command,
+        &p->has_cpr_exec_command, &p->has_x_postcopy_preempt_channels,
+        &p->has_x_multifd_send_queue_depth,
     };
 
     len = ARRAY_SIZE(has_fields);
@@ -1164,6 +1309,29 @@ bool migrate_params_check(MigrationParameters *params, Error **errp)
         return false;
     }
 
+    if (params->x_postcopy_preempt_channels < 1 ||
+        params->x_postcopy_preempt_channels > POSTCOPY_PREEMPT_CHANNELS_MAX) {
+        error_setg(errp, "Option x-postcopy-preempt-channels expects "
+                   "a value between 1 and "
+                   stringify(POSTCOPY_PREEMPT_CHANNELS_MAX));
+        return false;
+    }
+
+    if (params->x_multifd_send_queue_depth > MAX_MULTIFD_SEND_QUEUE_DEPTH) {
+        error_setg(errp, "Option x-multifd-send-queue-depth expects "
+                   "a value between 0 and "
+                   stringify(MAX_MULTIFD_SEND_QUEUE_DEPTH));
+        return false;
+    }
+
+#ifndef CONFIG_DSA_OPT
+    if (params->x_dsa_work_queues && *params->x_dsa_work_queues->u.s) {
+        error_setg(errp, "QEMU compiled without DSA support can't use "
+                   "x-dsa-work-queues");
+        return false;
+    }
+#endif
+
     if (params->multifd_zlib_level > 9) {
         error_setg(errp, "Option multifd_zlib_level expects "
                    "a value between 0 and 9");
@@ -1233,6 +1401,12 @@ bool migrate_params_check(MigrationParameters *params, Error **errp)
     }
 #endif
 
+    if (params->x_multifd_send_queue_depth && *params->tls_creds->u.s) {
+        error_setg(errp, "x-multifd-send-queue-depth is not available with "
+                   "TLS");
+        return false;
+    }
+
     if (migrate_mapped_ram() &&
         (migrate_multifd_compression() || migrate_tls())) {
         error_setg(errp,
@@ -1305,6 +1479,22 @@ static void migrate_params_test_apply(MigrationParameters *params,
         dest->tls_authz = NULL;
     }
 
+    if (params->x_bandwidth_pool) {
+        dest->x_bandwidth_pool = QAPI_CLONE(StrOrNull,
+                                            params->x_bandwidth_pool);
+    } else {
+        /* clear the reference, it's owned by s->parameters */
+        dest->x_bandwidth_pool = NULL;
+    }
+
+    if (params->x_dsa_work_queues) {
+        dest->x_dsa_work_queues = QAPI_CLONE(StrOrNull,
+                                             params->x_dsa_work_queues);
+    } else {
+        /* clear the reference, it's owned by s->parameters */
+        dest->x_dsa_work_queues = NULL;
+    }
+
     if (params->has_max_bandwidth) {
         dest->max_bandwidth = params->max_bandwidth;
     }
@@ -1324,6 +1514,13 @@ static void migrate_params_test_apply(MigrationParameters *params,
     if (params->has_multifd_channels) {
         dest->multifd_channels = params->multifd_channels;
     }
+    if (params->has_x_postcopy_preempt_channels) {
+        dest->x_postcopy_preempt_channels =
+            params->x_postcopy_preempt_channels;
+    }
+    if (params->has_x_multifd_send_queue_depth) {
+        dest->x_multifd_send_queue_depth = params->x_multifd_send_queue_depth;
+    }
     if (params->has_multifd_compression) {
         dest->multifd_compression = params->multifd_compression;
     }
@@ -1426,6 +1623,18 @@ static void migrate_params_apply(MigrationParameters *params)
         s->parameters.tls_authz = QAPI_CLONE(StrOrNull, params->tls_authz);
     }
 
+    if (params->x_bandwidth_pool) {
+        qapi_free_StrOrNull(s->parameters.x_bandwidth_pool);
+        s->parameters.x_bandwidth_pool = QAPI_CLONE(StrOrNull,
+                                                    params->x_bandwidth_pool);
+    }
+
+    if (params->x_dsa_work_queues) {
+        qapi_free_StrOrNull(s->parameters.x_dsa_work_queues);
+        s->parameters.x_dsa_work_queues =
+            QAPI_CLONE(StrOrNull, params->x_dsa_work_queues);
+    }
+
     if (params->has_max_bandwidth) {
         s->parameters.max_bandwidth = params->max_bandwidth;
     }
@@ -1445,6 +1654,14 @@ static void migrate_params_apply(MigrationParameters *params)
     if (params->has_multifd_channels) {
         s->parameters.multifd_channels = params->multifd_channels;
     }
+    if (params->has_x_postcopy_preempt_channels) {
+        s->parameters.x_postcopy_preempt_channels =
+            params->x_postcopy_preempt_channels;
+    }
+    if (params->has_x_multifd_send_queue_depth) {
+        s->parameters.x_multifd_send_queue_depth =
+            params->x_multifd_send_queue_depth;
+    }
     if (params->has_multifd_compression) {
         s->parameters.multifd_compression = params->multifd_compression;
     }
@@ -1531,6 +1748,8 @@ void qmp_migrate_set_parameters(MigrationParameters *params, Error **errp)
     tls_opt_to_str(params->tls_creds);
     tls_opt_to_str(params->tls_hostname);
     tls_opt_to_str(params->tls_authz);
+    tls_opt_to_str(params->x_bandwidth_pool);
+    tls_opt_to_str(params->x_dsa_work_queues);
 
     migrate_params_test_apply(params, &tmp);
 
@@ -18,6 +18,7 @@
 
 #include "qemu/osdep.h"
 #include "qemu/madvise.h"
+#include "qemu/units.h"
 #include "exec/target_page.h"
 #include "migration.h"
 #include "qemu-file.h"
@@ -788,6 +789,8 @@ static void postcopy_temp_pages_cleanup(MigrationIncomingState *mis)
  */
 int postcopy_ram_incoming_cleanup(MigrationIncomingState *mis)
 {
+    unsigned int i;
+
     trace_postcopy_ram_incoming_cleanup_entry();
 
     if (mis->preempt_thread_status == PREEMPT_THREAD_CREATED) {
@@ -816,11 +819,16 @@ int postcopy_ram_incoming_cleanup(MigrationIncomingState *mis)
                                &mis->page_request_mutex);
             }
         }
-        /* Notify the fast load thread to quit */
-        if (mis->postcopy_qemufile_dst) {
-            qemu_file_shutdown(mis->postcopy_qemufile_dst);
+        /* Notify the fast load threads to quit */
+        for (i = 0; i < POSTCOPY_PREEMPT_CHANNELS_MAX; i++) {
+            if (mis->postcopy_qemufile_dst[i]) {
+                qemu_file_shutdown(mis->postcopy_qemufile_dst[i]);
+            }
         }
-        qemu_thread_join(&mis->postcopy_prio_thread);
+        for (i = 0; i < mis->postcopy_prio_threads; i++) {
+            qemu_thread_join(&mis->postcopy_prio_thread[i]);
+        }
+        mis->postcopy_prio_threads = 0;
         mis->preempt_thread_status = PREEMPT_THREAD_NONE;
     }
 
@@ -1272,6 +1280,103 @@ static void postcopy_pause_fault_thread(MigrationIncomingState *mis)
 /*
  * Handle faults detected by the USERFAULT markings
  */
+/* Pages requested ahead once a fault pattern is found */
+#define POSTCOPY_PREFETCH_WINDOW_MIN    4
+/* Largest window requested ahead, in bytes */
+#define POSTCOPY_PREFETCH_WINDOW_BYTES  (512 * KiB)
+/* Largest distance between two faults still taken as a pattern, in pages */
+#define POSTCOPY_PREFETCH_STRIDE_MAX    16
+
+static void postcopy_prefetch_send(MigrationIncomingState *mis, RAMBlock *rb,
+                                   ram_addr_t start, ram_addr_t len)
+{
+    if (!len) {
+        return;
+    }
+
+    trace_postcopy_prefetch(qemu_ram_get_idstr(rb), start, len,
+                            mis->prefetch_stride);
+    /*
+     * A failure here means the return path is broken, which the next
+     * request for a faulting page will find out and handle.
+     */
+    migrate_send_rp_message_req_pages(mis, rb, start, len);
+}
+
+/*
+ * Called by the fault thread once the page at @offset of @rb is requested.
+ * When the fault follows the same stride as the previous one, also request
+ * the next pages along that stride that did not arrive yet, so the guest
+ * hopefully finds them there instead of faulting on each.  The window of
+ * pages requested ahead doubles for each fault following the pattern, and
+ * is dropped as soon as the pattern breaks.
+ */
+static void postcopy_prefetch(MigrationIncomingState *mis, RAMBlock *rb,
+                              ram_addr_t offset)
+{
+    int64_t page_size = qemu_ram_pagesize(rb);
+    unsigned int window_max = POSTCOPY_PREFETCH_WINDOW_BYTES / page_size;
+    int64_t delta = (int64_t)offset - (int64_t)mis->prefetch_last;
+    ram_addr_t run_start = 0, run_len = 0;
+    unsigned int i;
+
+    if (rb == mis->prefetch_rb && delta == 0) {
+        /* Another vCPU faulting on the same page */
+        return;
+    }
+
+    if (rb != mis->prefetch_rb || delta != mis->prefetch_stride ||
+        ABS(delta) > POSTCOPY_PREFETCH_STRIDE_MAX * page_size ||
+        !window_max) {
+        /* Not a pattern, but this may be the stride of the next one */
+        mis->prefetch_rb = rb;
+        mis->prefetch_last = offset;
+        mis->prefetch_stride = delta;
+        mis->prefetch_end = offset;
+        mis->prefetch_window = 0;
+        return;
+    }
+
+    mis->prefetch_last = offset;
+    if (mis->prefetch_window) {
+        mis->prefetch_window = MIN(mis->prefetch_window * 2, window_max);
+    } else {
+        mis->prefetch_window = MIN(POSTCOPY_PREFETCH_WINDOW_MIN, window_max);
+    }
+
+    /* Skip the pages already requested ahead of the previous faults */
+    i = 1;
+    if ((delta > 0 && mis->prefetch_end > offset) ||
+        (delta < 0 && mis->prefetch_end < offset)) {
+        i += ((int64_t)mis->prefetch_end - (int64_t)offset) / delta;
+    }
+
+    for (; i <= mis->prefetch_window; i++) {
+        int64_t next = (int64_t)offset + i * delta;
+
+        if (next < 0 || next >= rb->used_length) {
+            break;
+        }
+        mis->prefetch_end = next;
+
+        if (ramblock_recv_bitmap_test_byte_offset(rb, next) ||
+            ramblock_page_is_discarded(rb, next)) {
+            postcopy_prefetch_send(mis, rb, run_start, run_len);
+            run_len = 0;
+        } else if (run_len && next == run_start + run_len) {
+            run_len += page_size;
+        } else if (run_len && next + page_size == run_start) {
+            run_start = next;
+            run_len += page_size;
+        } else {
+            postcopy_prefetch_send(mis, rb, run_start, run_len);
+            run_start = next;
+            run_len = page_size;
+        }
+    }
+    postcopy_prefetch_send(mis, rb, run_start, run_len);
+}
+
 static void *postcopy_ram_fault_thread(void *opaque)
 {
     MigrationIncomingState *mis = opaque;
@@ -1400,6 +1505,10 @@ retry:
                 postcopy_pause_fault_thread(mis);
                 goto retry;
             }
+
+            if (migrate_postcopy_prefetch()) {
+                postcopy_prefetch(mis, rb, rb_offset);
+            }
         }
 
         /* Now handle any requests from external processes on shared memory */
@@ -1472,8 +1581,9 @@ static int postcopy_temp_pages_setup(MigrationIncomingState *mis)
     void *temp_page;
 
     if (migrate_postcopy_preempt()) {
-        /* If preemption enabled, need extra channel for urgent requests */
-        mis->postcopy_channels = RAM_CHANNEL_MAX;
+        /* If preemption enabled, need extra channels for urgent requests */
+        mis->postcopy_channels = RAM_CHANNEL_POSTCOPY +
+                                 migrate_postcopy_preempt_channels();
     } else {
         /* Both precopy/postcopy on the same channel */
         mis->postcopy_channels = 1;
@@ -1520,6 +1630,7 @@ static int postcopy_temp_pages_setup(MigrationIncomingState *mis)
 int postcopy_ram_incoming_setup(MigrationIncomingState *mis)
 {
     Error *local_err = NULL;
+    unsigned int i;
 
     /* Open the fd for the kernel to give us userfaults */
     mis->userfault_fd = uffd_open(O_CLOEXEC | O_NONBLOCK);
@@ -1570,12 +1681,15 @@ int postcopy_ram_incoming_setup(MigrationIncomingState *mis)
 
     if (migrate_postcopy_preempt()) {
         /*
-         * This thread needs to be created after the temp pages because
-         * it'll fetch RAM_CHANNEL_POSTCOPY PostcopyTmpPage immediately.
+         * These threads need to be created after the temp pages because
+         * they'll fetch their PostcopyTmpPage immediately.
          */
-        postcopy_thread_create(mis, &mis->postcopy_prio_thread,
-                               MIGRATION_THREAD_DST_PREEMPT,
-                               postcopy_preempt_thread, QEMU_THREAD_JOINABLE);
+        for (i = 0; i < migrate_postcopy_preempt_channels(); i++) {
+            postcopy_thread_create(mis, &mis->postcopy_prio_thread[i],
+                                   MIGRATION_THREAD_DST_PREEMPT,
+                                   postcopy_preempt_thread,
+                                   QEMU_THREAD_JOINABLE);
+        }
         mis->preempt_thread_status = PREEMPT_THREAD_CREATED;
     }
 
@@ -1913,10 +2027,46 @@ void postcopy_preempt_new_channel(MigrationIncomingState *mis, QEMUFile *file)
      * The new loading channel has its own threads, so it needs to be
      * blocked too.  It's by default true, just be explicit.
      */
+    unsigned int i;
+
     qemu_file_set_blocking(file, true, &error_abort);
-    mis->postcopy_qemufile_dst = file;
-    qemu_sem_post(&mis->postcopy_qemufile_dst_done);
-    trace_postcopy_preempt_new_channel();
+    for (i = 0; i < migrate_postcopy_preempt_channels(); i++) {
+        if (!mis->postcopy_qemufile_dst[i]) {
+            break;
+        }
+    }
+    /* Callers make sure that a channel is still missing */
+    assert(i < migrate_postcopy_preempt_channels());
+    mis->postcopy_qemufile_dst[i] = file;
+    qemu_sem_post(&mis->postcopy_qemufile_dst_done[i]);
+    trace_postcopy_preempt_new_channel(i);
+}
+
+bool postcopy_preempt_channels_ready(MigrationIncomingState *mis)
+{
+    unsigned int i;
+
+    for (i = 0; i < migrate_postcopy_preempt_channels(); i++) {
+        if (!mis->postcopy_qemufile_dst[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int postcopy_preempt_get_error(QEMUFile **files, Error **errp)
+{
+    int i, ret;
+
+    for (i = 0; i < POSTCOPY_PREEMPT_CHANNELS_MAX; i++) {
+        if (files[i]) {
+            ret = qemu_file_get_error_obj(files[i], errp);
+            if (ret) {
+                return ret;
+            }
+        }
+    }
+    return 0;
 }
 
 /*
@@ -1927,12 +2077,20 @@ static void
 postcopy_preempt_send_channel_done(MigrationState *s,
                                    QIOChannel *ioc, Error *local_err)
 {
+    unsigned int i;
+
     if (local_err) {
         migrate_error_propagate(s, local_err);
     } else {
+        for (i = 0; i < POSTCOPY_PREEMPT_CHANNELS_MAX; i++) {
+            if (!s->postcopy_qemufile_src[i]) {
+                break;
+            }
+        }
+        assert(i < POSTCOPY_PREEMPT_CHANNELS_MAX);
         migration_ioc_register_yank(ioc);
-        s->postcopy_qemufile_src = qemu_file_new_output(ioc);
-        trace_postcopy_preempt_new_channel();
+        s->postcopy_qemufile_src[i] = qemu_file_new_output(ioc);
+        trace_postcopy_preempt_new_channel(i);
     }
 
     /*
@@ -1984,12 +2142,15 @@ out:
 }
 
 /*
- * This function will kick off an async task to establish the preempt
- * channel, and wait until the connection setup completed.  Returns 0 if
- * channel established, -1 for error.
+ * This function will kick off async tasks to establish the preempt
+ * channels, and wait until the connections setup completed.  Returns 0 if
+ * all channels established, -1 for error.
  */
 int postcopy_preempt_establish_channel(MigrationState *s)
 {
+    unsigned int i, channels = migrate_postcopy_preempt_channels();
+    int ret = 0;
+
     /* If preempt not enabled, no need to wait */
     if (!migrate_postcopy_preempt()) {
         return 0;
@@ -2005,26 +2166,41 @@ int postcopy_preempt_establish_channel(MigrationState *s)
     }
 
     /*
-     * We need the postcopy preempt channel to be established before
+     * We need the postcopy preempt channels to be established before
      * starting doing anything.
      */
-    qemu_sem_wait(&s->postcopy_qemufile_src_sem);
+    for (i = 0; i < channels; i++) {
+        qemu_sem_wait(&s->postcopy_qemufile_src_sem);
+    }
+    for (i = 0; i < channels; i++) {
+        if (!s->postcopy_qemufile_src[i]) {
+            ret = -1;
+        }
+    }
 
-    return s->postcopy_qemufile_src ? 0 : -1;
+    if (!ret) {
+        postcopy_preempt_senders_start(s);
+    }
+    return ret;
 }
 
 void postcopy_preempt_setup(MigrationState *s)
 {
-    /* Kick an async task to connect */
-    socket_send_channel_create(postcopy_preempt_send_channel_new, s);
+    unsigned int i;
+
+    /* Kick an async task to connect each channel */
+    for (i = 0; i < migrate_postcopy_preempt_channels(); i++) {
+        socket_send_channel_create(postcopy_preempt_send_channel_new, s);
+    }
 }
 
-static void postcopy_pause_ram_fast_load(MigrationIncomingState *mis)
+static void postcopy_pause_ram_fast_load(MigrationIncomingState *mis,
+                                         unsigned int channel)
 {
     trace_postcopy_pause_fast_load();
-    qemu_mutex_unlock(&mis->postcopy_prio_thread_mutex);
+    qemu_mutex_unlock(&mis->postcopy_prio_thread_mutex[channel]);
     qemu_sem_wait(&mis->postcopy_pause_sem_fast_load);
-    qemu_mutex_lock(&mis->postcopy_prio_thread_mutex);
+    qemu_mutex_lock(&mis->postcopy_prio_thread_mutex[channel]);
     trace_postcopy_pause_fast_load_continued();
 }
 
@@ -2036,9 +2212,11 @@ static bool preempt_thread_should_run(MigrationIncomingState *mis)
 void *postcopy_preempt_thread(void *opaque)
 {
     MigrationIncomingState *mis = opaque;
+    /* Threads are created one at a time, see postcopy_thread_create() */
+    unsigned int channel = mis->postcopy_prio_threads++;
     int ret;
 
-    trace_postcopy_preempt_thread_entry();
+    trace_postcopy_preempt_thread_entry(channel);
 
     rcu_register_thread();
 
@@ -2048,26 +2226,26 @@ void *postcopy_preempt_thread(void *opaque)
      * The preempt channel is established in asynchronous way.  Wait
      * for its completion.
      */
-    qemu_sem_wait(&mis->postcopy_qemufile_dst_done);
+    qemu_sem_wait(&mis->postcopy_qemufile_dst_done[channel]);
 
     /* Sending RAM_SAVE_FLAG_EOS to terminate this thread */
-    qemu_mutex_lock(&mis->postcopy_prio_thread_mutex);
+    qemu_mutex_lock(&mis->postcopy_prio_thread_mutex[channel]);
     while (preempt_thread_should_run(mis)) {
-        ret = ram_load_postcopy(mis->postcopy_qemufile_dst,
-                                RAM_CHANNEL_POSTCOPY);
+        ret = ram_load_postcopy(mis->postcopy_qemufile_dst[channel],
+                                RAM_CHANNEL_POSTCOPY + channel);
         /* If error happened, go into recovery routine */
         if (ret && preempt_thread_should_run(mis)) {
-            postcopy_pause_ram_fast_load(mis);
+            postcopy_pause_ram_fast_load(mis, channel);
         } else {
             /* We're done */
             break;
         }
     }
-    qemu_mutex_unlock(&mis->postcopy_prio_thread_mutex);
+    qemu_mutex_unlock(&mis->postcopy_prio_thread_mutex[channel]);
 
     rcu_unregister_thread();
 
-    trace_postcopy_preempt_thread_exit();
+    trace_postcopy_preempt_thread_exit(channel);
 
     return NULL;
 }
@@ -185,14 +185,24 @@ int postcopy_wake_shared(struct PostCopyFD *pcfd, uint64_t client_addr,
 int postcopy_request_shared_page(struct PostCopyFD *pcfd, RAMBlock *rb,
                                  uint64_t client_addr, uint64_t offset);
 
-/* Hard-code channels for now for postcopy preemption */
+/* Maximum number of postcopy preempt channels */
+#define POSTCOPY_PREEMPT_CHANNELS_MAX 8
+
+/*
+ * Channels for postcopy preemption.  Preempt channel i uses
+ * RAM_CHANNEL_POSTCOPY + i.
+ */
 enum PostcopyChannels {
     RAM_CHANNEL_PRECOPY = 0,
     RAM_CHANNEL_POSTCOPY = 1,
-    RAM_CHANNEL_MAX,
+    RAM_CHANNEL_MAX = RAM_CHANNEL_POSTCOPY + POSTCOPY_PREEMPT_CHANNELS_MAX,
 };
 
 void postcopy_preempt_new_channel(MigrationIncomingState *mis, QEMUFile *file);
+/* Have all the preempt channels of the destination been set up? */
+bool postcopy_preempt_channels_ready(MigrationIncomingState *mis);
+/* Returns the first error found on the preempt channels in @files */
+int postcopy_preempt_get_error(QEMUFile **files, Error **errp);
 void postcopy_preempt_setup(MigrationState *s);
 int postcopy_preempt_establish_channel(MigrationState *s);
 bool postcopy_is_paused(MigrationStatus status);
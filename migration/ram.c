@@ -31,6 +31,7 @@
 #include "qemu/bitops.h"
 #include "qemu/bitmap.h"
 #include "qemu/madvise.h"
+#include "qemu/units.h"
 #include "qemu/main-loop.h"
 #include "xbzrle.h"
 #include "ram.h"
@@ -58,7 +59,10 @@
 #include "savevm.h"
 #include "qemu/iov.h"
 #include "multifd.h"
+#include "block/thread-pool.h"
 #include "system/runstate.h"
+#include "system/xen.h"
+#include "io/channel-file.h"
 #include "rdma.h"
 #include "options.h"
 #include "system/dirtylimit.h"
@@ -67,7 +71,10 @@
 #include "hw/core/boards.h" /* for machine_dump_guest_core() */
 
 #if defined(__linux__)
+#include <poll.h>
+#include "qemu/event_notifier.h"
 #include "qemu/userfaultfd.h"
+#include "system/system.h"
 #endif /* defined(__linux__) */
 
 /***********************************************************/
@@ -91,6 +98,22 @@
  */
 #define MAPPED_RAM_LOAD_BUF_SIZE 0x100000
 
+/*
+ * Without multifd, the pages region of each ramblock is instead read in
+ * jobs of up to this size, spread over a thread pool.
+ */
+#define MAPPED_RAM_LOAD_JOB_SIZE (64 * MiB)
+#define MAPPED_RAM_LOAD_MAX_THREADS 16
+
+/*
+ * With x-mapped-ram-map, the number of separate file mappings created in
+ * a ramblock, each of which takes a VMA in the kernel.  Once exceeded the
+ * remaining pages are read instead.
+ */
+#define MAPPED_RAM_MAP_MAX_REGIONS 8192
+
+static ThreadPool *mapped_ram_load_threads;
+
 XBZRLECacheStats xbzrle_counters;
 
 /*
@@ -364,6 +387,38 @@ struct RAMSrcPageRequest {
     QSIMPLEQ_ENTRY(RAMSrcPageRequest) next_req;
 };
 
+/*
+ * A thread sending the urgent pages queued for one postcopy preempt
+ * channel, used when there is more than one preempt channel.
+ */
+typedef struct PostcopyPreemptSender {
+    QemuThread thread;
+    /* Index of the preempt channel, starting from 0 */
+    unsigned int channel;
+    /* Protects @requests and @quit */
+    QemuMutex lock;
+    /* Posted for each queued request, and to quit */
+    QemuSemaphore sem;
+    QSIMPLEQ_HEAD(, RAMSrcPageRequest) requests;
+    /* Requests queued and not sent yet */
+    unsigned int pending;
+    bool quit;
+} PostcopyPreemptSender;
+
+/*
+ * Per multifd channel dirty page search state, used when
+ * x-multifd-partitioned-scan is enabled.
+ */
+typedef struct RAMPartitionScan {
+    /* Current block and page of the search within our partition */
+    RAMBlock *block;
+    unsigned long page;
+    /* Pages sent during the last scan round */
+    uint64_t pages;
+    /* Whether the last scan round found the whole partition clean */
+    bool clean;
+} RAMPartitionScan;
+
 /* State of RAM for migration */
 struct RAMState {
     /*
@@ -434,6 +489,23 @@ struct RAMState {
      * Protected by @bitmap_mutex.
      */
     PageLocationHint page_hint;
+    /*
+     * Partitioned dirty page scan state, one entry per multifd channel.
+     * The migration thread only accesses the entries in between scan
+     * rounds, during a round each entry is owned by its channel thread.
+     */
+    RAMPartitionScan *partition_scan;
+    unsigned int nr_partitions;
+    /* Thread pool for syncing the dirty bitmap of large ramblocks */
+    ThreadPool *sync_threads;
+    /*
+     * Senders of the postcopy preempt channels, NULL when the urgent pages
+     * are sent directly by the return path thread.  Protected by
+     * @preempt_senders_lock.
+     */
+    QemuMutex preempt_senders_lock;
+    PostcopyPreemptSender *preempt_senders;
+    unsigned int nr_preempt_senders;
 };
 typedef struct RAMState RAMState;
 
@@ -504,9 +576,26 @@ static void pss_init(PageSearchStatus *pss, RAMBlock *rb, ram_addr_t page)
 static bool pss_overlap(PageSearchStatus *pss1, PageSearchStatus *pss2)
 {
     return pss1->host_page_sending && pss2->host_page_sending &&
+        pss1->block == pss2->block &&
         (pss1->host_page_start == pss2->host_page_start);
 }
 
+/*
+ * Check whether any other channel is actively sending the host page of
+ * @pss.  Called with bitmap_mutex held.
+ */
+static bool pss_overlap_any(RAMState *rs, PageSearchStatus *pss)
+{
+    int i;
+
+    for (i = 0; i < RAM_CHANNEL_MAX; i++) {
+        if (&rs->pss[i] != pss && pss_overlap(pss, &rs->pss[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
 /**
  * save_page_header: write page header to wire
  *
@@ -746,17 +835,12 @@ static void pss_find_next_dirty(PageSearchStatus *pss)
     pss->page = find_next_bit(bitmap, size, pss->page);
 }
 
-static void migration_clear_memory_region_dirty_bitmap(RAMBlock *rb,
-                                                       unsigned long page)
+static void migration_clear_memory_region_dirty_chunk(RAMBlock *rb,
+                                                      unsigned long page)
 {
-    uint8_t shift;
+    uint8_t shift = rb->clear_bmap_shift;
     hwaddr size, start;
 
-    if (!rb->clear_bmap || !clear_bmap_test_and_clear(rb, page)) {
-        return;
-    }
-
-    shift = rb->clear_bmap_shift;
     /*
      * CLEAR_BITMAP_SHIFT_MIN should always guarantee this... this
      * can make things easier sometimes since then start address
@@ -773,6 +857,16 @@ static void migration_clear_memory_region_dirty_bitmap(RAMBlock *rb,
     memory_region_clear_dirty_bitmap(rb->mr, start, size);
 }
 
+static void migration_clear_memory_region_dirty_bitmap(RAMBlock *rb,
+                                                       unsigned long page)
+{
+    if (!rb->clear_bmap || !clear_bmap_test_and_clear(rb, page)) {
+        return;
+    }
+
+    migration_clear_memory_region_dirty_chunk(rb, page);
+}
+
 static void
 migration_clear_memory_region_dirty_bitmap_range(RAMBlock *rb,
                                                  unsigned long start,
@@ -936,7 +1030,20 @@ bool ramblock_page_is_discarded(RAMBlock *rb, ram_addr_t start)
     return false;
 }
 
-/* Called with RCU critical section */
+/*
+ * Dirty pages are tracked at target page granularity all the way from
+ * the accelerator (KVM_GET_DIRTY_LOG, the dirty ring) through
+ * ram_list.dirty_memory to rb->bmap, even for RAMBlocks backed by huge
+ * pages.  Coarser tracking in rb->bmap alone would not make this sync
+ * any cheaper: every word of the DIRTY_MEMORY_MIGRATION bitmap still
+ * has to be read and cleared.  It would also change the meaning of
+ * rb->bmap for postcopy discard, COLO, free page hinting and the
+ * recovery bitmap exchange.  The cost per round is instead bounded by
+ * syncing large RAMBlocks in parallel (see ram_sync_dirty_bitmap_all())
+ * and by clearing the dirty log lazily in clear_bmap chunks.
+ *
+ * Called with RCU critical section
+ */
 static uint64_t physical_memory_sync_dirty_bitmap(RAMBlock *rb,
                                                   ram_addr_t start,
                                                   ram_addr_t length)
@@ -1012,6 +1119,225 @@ static void ramblock_sync_dirty_bitmap(RAMState *rs, RAMBlock *rb)
     rs->num_dirty_pages_period += new_dirty_pages;
 }
 
+/*
+ * The dirty bitmap of ramblocks larger than this is synced in jobs of
+ * this size, spread over a thread pool.  Smaller ramblocks are synced
+ * by the migration thread while the pool is busy.
+ */
+#define BITMAP_SYNC_JOB_SIZE (1ULL << 30)
+#define BITMAP_SYNC_MAX_THREADS 16
+
+typedef struct BitmapSyncJob {
+    RAMBlock *rb;
+    ram_addr_t start;
+    ram_addr_t length;
+    uint64_t num_dirty;
+} BitmapSyncJob;
+
+static int ramblock_sync_dirty_bitmap_job(void *opaque)
+{
+    BitmapSyncJob *job = opaque;
+
+    job->num_dirty = physical_memory_sync_dirty_bitmap(job->rb, job->start,
+                                                       job->length);
+    return 0;
+}
+
+/*
+ * Size of the jobs the dirty bitmap sync of @rb is split into, or zero if
+ * it should be synced in one go.  Jobs only share ram_list.dirty_memory
+ * words or rb->bmap words if @rb is not aligned to a word in the bitmap,
+ * so such ramblocks are not split.
+ */
+static ram_addr_t ramblock_sync_job_size(RAMBlock *rb)
+{
+    ram_addr_t word_size = (ram_addr_t)BITS_PER_LONG << TARGET_PAGE_BITS;
+
+    if (rb->used_length <= BITMAP_SYNC_JOB_SIZE ||
+        !QEMU_IS_ALIGNED(rb->offset, word_size)) {
+        return 0;
+    }
+
+    return QEMU_ALIGN_UP(BITMAP_SYNC_JOB_SIZE, word_size);
+}
+
+/*
+ * Sync the dirty bitmap of all ramblocks, splitting the large ones over
+ * rs->sync_threads.
+ *
+ * Called with RCU critical section and bitmap_mutex held.  The RCU
+ * critical section keeps all ramblocks and the dirty memory blocks alive
+ * until the pool jobs, which only ever touch their own page range of the
+ * bitmaps, are finished.
+ */
+static void ram_sync_dirty_bitmap_all(RAMState *rs)
+{
+    g_autofree BitmapSyncJob *jobs = NULL;
+    unsigned int nr_jobs = 0, i = 0;
+    ram_addr_t job_size;
+    RAMBlock *block;
+
+    if (rs->sync_threads) {
+        RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+            job_size = ramblock_sync_job_size(block);
+            if (job_size) {
+                nr_jobs += DIV_ROUND_UP(block->used_length, job_size);
+            }
+        }
+    }
+
+    if (!nr_jobs) {
+        RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+            ramblock_sync_dirty_bitmap(rs, block);
+        }
+        return;
+    }
+
+    jobs = g_new0(BitmapSyncJob, nr_jobs);
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        ram_addr_t start;
+
+        job_size = ramblock_sync_job_size(block);
+        if (!job_size) {
+            continue;
+        }
+
+        for (start = 0; start < block->used_length; start += job_size) {
+            BitmapSyncJob *job = &jobs[i++];
+
+            job->rb = block;
+            job->start = start;
+            job->length = MIN(job_size, block->used_length - start);
+            thread_pool_submit(rs->sync_threads,
+                               ramblock_sync_dirty_bitmap_job, job, NULL);
+        }
+    }
+    assert(i == nr_jobs);
+
+    /* Deal with the small ramblocks meanwhile */
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        if (!ramblock_sync_job_size(block)) {
+            ramblock_sync_dirty_bitmap(rs, block);
+        }
+    }
+
+    thread_pool_wait(rs->sync_threads);
+
+    for (i = 0; i < nr_jobs; i++) {
+        rs->migration_dirty_pages += jobs[i].num_dirty;
+        rs->num_dirty_pages_period += jobs[i].num_dirty;
+    }
+    trace_ram_sync_dirty_bitmap_all(nr_jobs);
+}
+
+/*
+ * Pages that the guest dirtied again in two dirty bitmap syncs in a row
+ * are likely to be dirty again at switchover, so sending them during
+ * precopy mostly wastes bandwidth.  With x-defer-hot-pages they are moved
+ * from rb->bmap to rb->hot_bmap after each sync, and only go back to
+ * rb->bmap once a sync finds them clean, or at the final stage.  They stay
+ * accounted in migration_dirty_pages, as they still have to be sent.
+ */
+
+/* Called with RCU critical section and bitmap_mutex held */
+static void ram_hot_pages_snapshot(void)
+{
+    RAMBlock *block;
+
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        if (block->hot_bmap) {
+            bitmap_copy(block->hot_prev_bmap, block->bmap,
+                        block->used_length >> TARGET_PAGE_BITS);
+        }
+    }
+}
+
+/*
+ * Called right after the sync, with RCU critical section and bitmap_mutex
+ * held.  Returns the number of hot pages of @rb.
+ */
+static uint64_t ramblock_update_hot_pages(RAMState *rs, RAMBlock *rb)
+{
+    unsigned long pages = rb->used_length >> TARGET_PAGE_BITS;
+    unsigned long nr = BITS_TO_LONGS(pages), i;
+    unsigned long *bmap = rb->bmap, *hot = rb->hot_bmap;
+    unsigned long *prev = rb->hot_prev_bmap, *recent = rb->hot_recent_bmap;
+    uint64_t nr_hot = 0;
+
+    for (i = 0; i < nr; i++) {
+        unsigned long mask = i == nr - 1 ? BITMAP_LAST_WORD_MASK(pages) : ~0UL;
+        unsigned long dirty = bmap[i] & mask;
+        /* Hot pages are not in bmap before the sync, so they show up here */
+        unsigned long fresh = dirty & ~prev[i];
+        unsigned long still_hot = hot[i] & dirty;
+        unsigned long cooled = hot[i] & ~dirty;
+
+        /* The sync accounted the hot pages dirtied again a second time */
+        rs->migration_dirty_pages -= ctpopl(still_hot);
+
+        hot[i] = still_hot | (fresh & recent[i]);
+        bmap[i] = (bmap[i] & ~hot[i]) | cooled;
+        prev[i] = fresh;
+        if (hot[i]) {
+            /*
+             * The hot pages are not sent, clear their dirty log anyway to
+             * find out whether they get dirtied again.  A word of the
+             * bitmap never spans more than one clear_bmap chunk.
+             */
+            migration_clear_memory_region_dirty_bitmap(rb, i * BITS_PER_LONG);
+            nr_hot += ctpopl(hot[i]);
+        }
+    }
+
+    /* The pages dirtied in this sync are the recent ones for the next */
+    rb->hot_recent_bmap = prev;
+    rb->hot_prev_bmap = recent;
+
+    return nr_hot;
+}
+
+/* Called with RCU critical section and bitmap_mutex held */
+static void ramblock_release_hot_pages(RAMState *rs, RAMBlock *rb)
+{
+    unsigned long nr = BITS_TO_LONGS(rb->used_length >> TARGET_PAGE_BITS);
+    unsigned long i;
+
+    for (i = 0; i < nr; i++) {
+        rs->migration_dirty_pages -= ctpopl(rb->hot_bmap[i] & rb->bmap[i]);
+        rb->bmap[i] |= rb->hot_bmap[i];
+        rb->hot_bmap[i] = 0;
+    }
+}
+
+/*
+ * Update the hot pages after a dirty bitmap sync, or give them all back
+ * to the migration at the final stage.
+ *
+ * Called with RCU critical section and bitmap_mutex held.
+ */
+static void ram_update_hot_pages(RAMState *rs, bool last_stage)
+{
+    uint64_t nr_hot = 0;
+    RAMBlock *block;
+
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        if (!block->hot_bmap) {
+            continue;
+        }
+        if (last_stage) {
+            ramblock_release_hot_pages(rs, block);
+        } else {
+            nr_hot += ramblock_update_hot_pages(rs, block);
+        }
+    }
+
+    /* Keep reporting the size of the hot set found during precopy */
+    if (!last_stage) {
+        stat64_set(&mig_stats.hot_pages, nr_hot);
+    }
+    trace_ram_update_hot_pages(nr_hot, last_stage);
+}
+
 /**
  * ram_pagesize_summary: calculate all the pagesizes of a VM
  *
@@ -1133,7 +1459,6 @@ static void migration_trigger_throttle(RAMState *rs)
 
 static void migration_bitmap_sync(RAMState *rs, bool last_stage)
 {
-    RAMBlock *block;
     int64_t end_time;
 
     stat64_add(&mig_stats.dirty_sync_count, 1);
@@ -1147,8 +1472,12 @@ static void migration_bitmap_sync(RAMState *rs, bool last_stage)
 
     WITH_QEMU_LOCK_GUARD(&rs->bitmap_mutex) {
         WITH_RCU_READ_LOCK_GUARD() {
-            RAMBLOCK_FOREACH_NOT_IGNORED(block) {
-                ramblock_sync_dirty_bitmap(rs, block);
+            if (migrate_defer_hot_pages()) {
+                ram_hot_pages_snapshot();
+            }
+            ram_sync_dirty_bitmap_all(rs);
+            if (migrate_defer_hot_pages()) {
+                ram_update_hot_pages(rs, last_stage);
             }
             stat64_set(&mig_stats.dirty_bytes_last_sync, ram_bytes_remaining());
         }
@@ -1925,6 +2254,215 @@ static void migration_page_queue_free(RAMState *rs)
     }
 }
 
+/*
+ * Send the host pages of @rb in [@start, @start + @len) on the preempt
+ * channel of @pss.
+ */
+static int ram_save_urgent_pages(RAMState *rs, PageSearchStatus *pss,
+                                 RAMBlock *rb, ram_addr_t start,
+                                 ram_addr_t len, Error **errp)
+{
+    size_t page_size = qemu_ram_pagesize(rb);
+
+    /*
+     * It must be either one or multiple of host page size.  Just
+     * assert; if something wrong we're mostly split brain anyway.
+     */
+    assert(len % page_size == 0);
+
+    QEMU_LOCK_GUARD(&rs->bitmap_mutex);
+    pss_init(pss, rb, start >> TARGET_PAGE_BITS);
+    while (len) {
+        if (ram_save_host_page_urgent(pss)) {
+            error_setg(errp, "ram_save_host_page_urgent() failed: "
+                       "ramblock=%s, start_addr=0x"RAM_ADDR_FMT,
+                       rb->idstr, start);
+            return -1;
+        }
+        /*
+         * NOTE: after ram_save_host_page_urgent() succeeded, pss->page
+         * will automatically be moved and point to the next host page
+         * we're going to send, so no need to update here.
+         *
+         * Normally QEMU never sends >1 host page in requests, so
+         * logically we don't even need that as the loop should only
+         * run once, but just to be consistent.
+         */
+        len -= page_size;
+    }
+    return 0;
+}
+
+static void *postcopy_preempt_sender_thread(void *opaque)
+{
+    PostcopyPreemptSender *sender = opaque;
+    RAMState *rs = ram_state;
+    PageSearchStatus *pss = &rs->pss[RAM_CHANNEL_POSTCOPY + sender->channel];
+    struct RAMSrcPageRequest *req;
+    Error *local_err = NULL;
+    int ret;
+
+    rcu_register_thread();
+    pss->pss_channel = migrate_get_current()->postcopy_qemufile_src[
+        sender->channel];
+
+    while (true) {
+        qemu_sem_wait(&sender->sem);
+        WITH_QEMU_LOCK_GUARD(&sender->lock) {
+            req = sender->quit ? NULL : QSIMPLEQ_FIRST(&sender->requests);
+            if (req) {
+                QSIMPLEQ_REMOVE_HEAD(&sender->requests, next_req);
+            }
+        }
+        if (!req) {
+            break;
+        }
+
+        WITH_RCU_READ_LOCK_GUARD() {
+            ret = ram_save_urgent_pages(rs, pss, req->rb, req->offset,
+                                        req->len, &local_err);
+        }
+        memory_region_unref(req->rb->mr);
+        g_free(req);
+        qatomic_dec(&sender->pending);
+        if (ret) {
+            /* The migration thread finds it and pauses postcopy */
+            qemu_file_set_error_obj(pss->pss_channel, -EIO, local_err);
+            break;
+        }
+    }
+
+    rcu_unregister_thread();
+    return NULL;
+}
+
+/*
+ * Queue an urgent request for the sender of the preempt channel with the
+ * fewest pending requests.  Returns false if there are no senders, in
+ * which case the caller sends the pages itself.
+ */
+static bool postcopy_preempt_queue(RAMState *rs, RAMBlock *rb,
+                                   ram_addr_t start, ram_addr_t len)
+{
+    PostcopyPreemptSender *sender = NULL;
+    struct RAMSrcPageRequest *req;
+    unsigned int i, n, first;
+
+    QEMU_LOCK_GUARD(&rs->preempt_senders_lock);
+    if (!rs->preempt_senders) {
+        return false;
+    }
+
+    /*
+     * Requests do not say which vCPU faulted, so ties are broken by the
+     * page: repeated requests for one page go to the same channel, while
+     * faults on different pages are served in parallel.
+     */
+    n = rs->nr_preempt_senders;
+    first = (start / qemu_ram_pagesize(rb)) % n;
+    for (i = 0; i < n; i++) {
+        PostcopyPreemptSender *p = &rs->preempt_senders[(first + i) % n];
+
+        if (!sender ||
+            qatomic_read(&p->pending) < qatomic_read(&sender->pending)) {
+            sender = p;
+        }
+    }
+
+    req = g_new0(struct RAMSrcPageRequest, 1);
+    req->rb = rb;
+    req->offset = start;
+    req->len = len;
+    memory_region_ref(rb->mr);
+
+    trace_postcopy_preempt_queue(sender->channel, rb->idstr, start, len);
+    qatomic_inc(&sender->pending);
+    WITH_QEMU_LOCK_GUARD(&sender->lock) {
+        QSIMPLEQ_INSERT_TAIL(&sender->requests, req, next_req);
+    }
+    qemu_sem_post(&sender->sem);
+    return true;
+}
+
+void postcopy_preempt_senders_start(MigrationState *s)
+{
+    RAMState *rs = ram_state;
+    unsigned int i, n = migrate_postcopy_preempt_channels();
+
+    /* A single channel is served by the return path thread directly */
+    if (n == 1) {
+        return;
+    }
+
+    QEMU_LOCK_GUARD(&rs->preempt_senders_lock);
+    assert(!rs->preempt_senders);
+    rs->preempt_senders = g_new0(PostcopyPreemptSender, n);
+    rs->nr_preempt_senders = n;
+    for (i = 0; i < n; i++) {
+        PostcopyPreemptSender *sender = &rs->preempt_senders[i];
+        g_autofree char *name = g_strdup_printf("mig/src/prio/%u", i);
+
+        assert(s->postcopy_qemufile_src[i]);
+        sender->channel = i;
+        qemu_mutex_init(&sender->lock);
+        qemu_sem_init(&sender->sem, 0);
+        QSIMPLEQ_INIT(&sender->requests);
+        qemu_thread_create(&sender->thread, name,
+                           postcopy_preempt_sender_thread, sender,
+                           QEMU_THREAD_JOINABLE);
+    }
+}
+
+void postcopy_preempt_senders_stop(MigrationState *s, bool shutdown)
+{
+    RAMState *rs = ram_state;
+    struct RAMSrcPageRequest *req;
+    unsigned int i;
+
+    if (!rs) {
+        return;
+    }
+
+    QEMU_LOCK_GUARD(&rs->preempt_senders_lock);
+    if (!rs->preempt_senders) {
+        return;
+    }
+
+    for (i = 0; i < rs->nr_preempt_senders; i++) {
+        PostcopyPreemptSender *sender = &rs->preempt_senders[i];
+
+        /* Do not wait for a sender blocked on a broken channel */
+        if (shutdown && s->postcopy_qemufile_src[i]) {
+            qemu_file_shutdown(s->postcopy_qemufile_src[i]);
+        }
+        WITH_QEMU_LOCK_GUARD(&sender->lock) {
+            sender->quit = true;
+        }
+        qemu_sem_post(&sender->sem);
+    }
+
+    /*
+     * Requests still queued are dropped.  After a recovery, the
+     * destination asks again for the pages it is still waiting for.
+     */
+    for (i = 0; i < rs->nr_preempt_senders; i++) {
+        PostcopyPreemptSender *sender = &rs->preempt_senders[i];
+
+        qemu_thread_join(&sender->thread);
+        while ((req = QSIMPLEQ_FIRST(&sender->requests))) {
+            QSIMPLEQ_REMOVE_HEAD(&sender->requests, next_req);
+            memory_region_unref(req->rb->mr);
+            g_free(req);
+        }
+        qemu_sem_destroy(&sender->sem);
+        qemu_mutex_destroy(&sender->lock);
+    }
+
+    g_free(rs->preempt_senders);
+    rs->preempt_senders = NULL;
+    rs->nr_preempt_senders = 0;
+}
+
 /**
  * ram_save_queue_pages: queue the page for transmission
  *
@@ -1979,52 +2517,24 @@ int ram_save_queue_pages(const char *rbname, ram_addr_t start, ram_addr_t len,
 
     /*
      * When with postcopy preempt, we send back the page directly in the
-     * rp-return thread.
+     * rp-return thread, or hand it to the sender of a preempt channel if
+     * there are more than one.
      */
     if (postcopy_preempt_active()) {
-        ram_addr_t page_start = start >> TARGET_PAGE_BITS;
-        size_t page_size = qemu_ram_pagesize(ramblock);
-        PageSearchStatus *pss = &ram_state->pss[RAM_CHANNEL_POSTCOPY];
-        int ret = 0;
+        PageSearchStatus *pss = &rs->pss[RAM_CHANNEL_POSTCOPY];
 
-        qemu_mutex_lock(&rs->bitmap_mutex);
+        if (postcopy_preempt_queue(rs, ramblock, start, len)) {
+            return 0;
+        }
 
-        pss_init(pss, ramblock, page_start);
         /*
-         * Always use the preempt channel, and make sure it's there.  It's
+         * Use the first preempt channel, and make sure it's there.  It's
          * safe to access without lock, because when rp-thread is running
          * we should be the only one who operates on the qemufile
          */
-        pss->pss_channel = migrate_get_current()->postcopy_qemufile_src;
+        pss->pss_channel = migrate_get_current()->postcopy_qemufile_src[0];
         assert(pss->pss_channel);
-
-        /*
-         * It must be either one or multiple of host page size.  Just
-         * assert; if something wrong we're mostly split brain anyway.
-         */
-        assert(len % page_size == 0);
-        while (len) {
-            if (ram_save_host_page_urgent(pss)) {
-                error_setg(errp, "ram_save_host_page_urgent() failed: "
-                           "ramblock=%s, start_addr=0x"RAM_ADDR_FMT,
-                           ramblock->idstr, start);
-                ret = -1;
-                break;
-            }
-            /*
-             * NOTE: after ram_save_host_page_urgent() succeeded, pss->page
-             * will automatically be moved and point to the next host page
-             * we're going to send, so no need to update here.
-             *
-             * Normally QEMU never sends >1 host page in requests, so
-             * logically we don't even need that as the loop should only
-             * run once, but just to be consistent.
-             */
-            len -= page_size;
-        };
-        qemu_mutex_unlock(&rs->bitmap_mutex);
-
-        return ret;
+        return ram_save_urgent_pages(rs, pss, ramblock, start, len, errp);
     }
 
     struct RAMSrcPageRequest *new_entry =
@@ -2151,7 +2661,8 @@ static void ram_page_hint_update(RAMState *rs, PageSearchStatus *pss)
 
 /*
  * Send an urgent host page specified by `pss'.  Need to be called with
- * bitmap_mutex held.
+ * bitmap_mutex held.  The mutex is released while the pages are sent, so
+ * that precopy and the other preempt channels can make progress.
  *
  * Returns 0 if save host page succeeded, false otherwise.
  */
@@ -2165,13 +2676,14 @@ static int ram_save_host_page_urgent(PageSearchStatus *pss)
     pss_host_page_prepare(pss);
 
     /*
-     * If precopy is sending the same page, let it be done in precopy, or
-     * we could send the same page in two channels and none of them will
-     * receive the whole page.
+     * If precopy or another preempt channel is sending the same page, let
+     * it be done there, or we could send the same page in two channels and
+     * none of them will receive the whole page.
      */
-    if (pss_overlap(pss, &ram_state->pss[RAM_CHANNEL_PRECOPY])) {
+    if (pss_overlap_any(rs, pss)) {
         trace_postcopy_preempt_hit(pss->block->idstr,
                                    pss->page << TARGET_PAGE_BITS);
+        pss_host_page_finish(pss);
         return 0;
     }
 
@@ -2179,8 +2691,14 @@ static int ram_save_host_page_urgent(PageSearchStatus *pss)
         page_dirty = migration_bitmap_clear_dirty(rs, pss->block, pss->page);
 
         if (page_dirty) {
+            int res;
+
+            qemu_mutex_unlock(&rs->bitmap_mutex);
+            res = ram_save_target_page(rs, pss);
+            qemu_mutex_lock(&rs->bitmap_mutex);
+
             /* Be strict to return code; it must be 1, or what else? */
-            if (ram_save_target_page(rs, pss) != 1) {
+            if (res != 1) {
                 error_report_once("%s: ram_save_target_page failed", __func__);
                 ret = -1;
                 goto out;
@@ -2237,6 +2755,13 @@ static int ram_save_host_page(RAMState *rs, PageSearchStatus *pss)
     /* Update host page boundary information */
     pss_host_page_prepare(pss);
 
+    /* Leave the host page to the preempt channel that is sending it */
+    if (preempt_active && pss_overlap_any(rs, pss)) {
+        pss->page = pss->host_page_end;
+        pss_host_page_finish(pss);
+        return 0;
+    }
+
     do {
         page_dirty = migration_bitmap_clear_dirty(rs, pss->block, pss->page);
 
@@ -2381,10 +2906,188 @@ static int ram_find_and_save_block(RAMState *rs)
     return pages;
 }
 
-static uint64_t ram_bytes_total_with_ignored(void)
-{
-    RAMBlock *block;
-    uint64_t total = 0;
+/*
+ * Number of multifd packets worth of pages each channel sends at most
+ * in one round of partitioned scan.  Bounds how far we can overshoot
+ * the rate limit and MAX_WAIT.
+ */
+#define PARTITION_SCAN_PACKETS 16
+
+/*
+ * ram_partition_range: get the range of pages of @rb owned by channel @idx
+ *
+ * Each ramblock is split in @nr contiguous slices, one per channel.  The
+ * slices are aligned so that no two channels ever share a word of the
+ * dirty bitmap, a clear_bmap chunk or a host page.
+ */
+static void ram_partition_range(RAMBlock *rb, unsigned int idx,
+                                unsigned int nr, unsigned long *start,
+                                unsigned long *end)
+{
+    unsigned long size = rb->used_length >> TARGET_PAGE_BITS;
+    unsigned long align = MAX(BITS_PER_LONG,
+                              qemu_ram_pagesize(rb) >> TARGET_PAGE_BITS);
+    unsigned long slice;
+
+    if (rb->clear_bmap) {
+        align = MAX(align, 1UL << rb->clear_bmap_shift);
+    }
+
+    slice = QEMU_ALIGN_UP(DIV_ROUND_UP(size, nr), align);
+    *start = MIN(size, slice * idx);
+    *end = MIN(size, *start + slice);
+}
+
+/*
+ * Same as migration_bitmap_clear_dirty(), but for a page owned by the
+ * calling multifd channel.  The clear_bmap words can still be shared
+ * with other channels, so it needs to be updated atomically; the
+ * dirty page counter is updated by the migration thread after the
+ * round.
+ */
+static bool ram_partition_clear_dirty(RAMState *rs, RAMBlock *rb,
+                                      unsigned long page)
+{
+    if (!rs->last_stage && rb->clear_bmap &&
+        bitmap_test_and_clear_atomic(rb->clear_bmap,
+                                     page >> rb->clear_bmap_shift, 1)) {
+        migration_clear_memory_region_dirty_chunk(rb, page);
+    }
+
+    return test_and_clear_bit(page, rb->bmap);
+}
+
+/**
+ * ram_multifd_scan_partition: find and send the dirty pages of the
+ * partition of guest RAM owned by multifd channel @p
+ *
+ * Called from the multifd sender thread, while the migration thread
+ * holds bitmap_mutex and waits for all channels to finish.  Stops after
+ * PARTITION_SCAN_PACKETS packets worth of pages, or once the whole
+ * partition has been scanned without finding anything dirty.
+ *
+ * Returns 0 if succeed, non-zero otherwise with @errp set.
+ *
+ * @p: the multifd channel doing the scan
+ * @errp: pointer to error object
+ */
+int ram_multifd_scan_partition(MultiFDSendParams *p, Error **errp)
+{
+    RAMState *rs = ram_state;
+    RAMPartitionScan *scan = &rs->partition_scan[p->id];
+    uint64_t budget = PARTITION_SCAN_PACKETS * multifd_ram_page_count();
+    RAMBlock *start_block;
+    unsigned long start_page;
+    bool wrapped = false;
+    int ret;
+
+    RCU_READ_LOCK_GUARD();
+
+    scan->pages = 0;
+    scan->clean = false;
+
+    if (!scan->block) {
+        scan->block = QLIST_FIRST_RCU(&ram_list.blocks);
+        scan->page = 0;
+    }
+    start_block = scan->block;
+    start_page = scan->page;
+
+    while (scan->pages < budget) {
+        RAMBlock *rb = scan->block;
+        unsigned long start, end;
+
+        ram_partition_range(rb, p->id, rs->nr_partitions, &start, &end);
+        scan->page = MAX(scan->page, start);
+        if (migrate_ram_is_ignored(rb)) {
+            scan->page = end;
+        } else {
+            scan->page = find_next_bit(rb->bmap, end, scan->page);
+        }
+
+        if (wrapped && rb == start_block && scan->page >= start_page) {
+            /* We've been once around our partition and found nothing */
+            scan->clean = true;
+            break;
+        }
+
+        if (scan->page >= end) {
+            scan->page = 0;
+            scan->block = QLIST_NEXT_RCU(rb, next);
+            if (!scan->block) {
+                scan->block = QLIST_FIRST_RCU(&ram_list.blocks);
+                wrapped = true;
+            }
+            continue;
+        }
+
+        if (ram_partition_clear_dirty(rs, rb, scan->page)) {
+            ret = multifd_ram_queue_page_local(p, rb,
+                ((ram_addr_t)scan->page) << TARGET_PAGE_BITS, errp);
+            if (ret != 0) {
+                return ret;
+            }
+            scan->pages++;
+        }
+        scan->page++;
+    }
+
+    trace_ram_multifd_scan_partition(p->id, scan->pages, scan->clean);
+
+    return multifd_ram_flush_local(p, errp);
+}
+
+/**
+ * ram_save_partitioned_round: let every multifd channel scan and send
+ * the dirty pages of its own partition of guest RAM
+ *
+ * Called within an RCU critical section, with bitmap_mutex held.  This
+ * keeps the dirty bitmap stable (no sync nor free page hinting) for the
+ * whole round.
+ *
+ * Returns the number of pages written where zero means no dirty pages,
+ * or negative on error
+ *
+ * @rs: current RAM state
+ */
+static int ram_save_partitioned_round(RAMState *rs)
+{
+    uint64_t pages = 0;
+    bool clean = true;
+    unsigned int i;
+    int ret;
+
+    if (!rs->ram_bytes_total) {
+        return 0;
+    }
+
+    ret = multifd_send_scan_main();
+    if (ret < 0) {
+        return ret;
+    }
+
+    for (i = 0; i < rs->nr_partitions; i++) {
+        pages += rs->partition_scan[i].pages;
+        clean &= rs->partition_scan[i].clean;
+    }
+    rs->migration_dirty_pages -= pages;
+
+    if (clean && !pages && multifd_ram_sync_per_round()) {
+        QEMUFile *f = rs->pss[RAM_CHANNEL_PRECOPY].pss_channel;
+
+        ret = multifd_ram_flush_and_sync(f);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+
+    return pages;
+}
+
+static uint64_t ram_bytes_total_with_ignored(void)
+{
+    RAMBlock *block;
+    uint64_t total = 0;
 
     RCU_READ_LOCK_GUARD();
 
@@ -2424,6 +3127,9 @@ static void ram_state_cleanup(RAMState **rsp)
         migration_page_queue_free(*rsp);
         qemu_mutex_destroy(&(*rsp)->bitmap_mutex);
         qemu_mutex_destroy(&(*rsp)->src_page_req_mutex);
+        qemu_mutex_destroy(&(*rsp)->preempt_senders_lock);
+        g_free((*rsp)->partition_scan);
+        g_clear_pointer(&(*rsp)->sync_threads, thread_pool_free);
         g_free(*rsp);
         *rsp = NULL;
     }
@@ -2456,6 +3162,12 @@ static void ram_bitmaps_destroy(void)
         block->bmap = NULL;
         g_free(block->file_bmap);
         block->file_bmap = NULL;
+        g_free(block->hot_bmap);
+        block->hot_bmap = NULL;
+        g_free(block->hot_recent_bmap);
+        block->hot_recent_bmap = NULL;
+        g_free(block->hot_prev_bmap);
+        block->hot_prev_bmap = NULL;
     }
 }
 
@@ -2463,6 +3175,8 @@ static void ram_save_cleanup(void *opaque)
 {
     RAMState **rsp = opaque;
 
+    postcopy_preempt_senders_stop(migrate_get_current(), true);
+
     /* We don't use dirty log with background snapshots */
     if (!migrate_background_snapshot()) {
         /* caller have hold BQL or is in a bh, so there is
@@ -2505,6 +3219,11 @@ static void ram_state_reset(RAMState *rs)
     rs->last_version = ram_list.version;
     rs->xbzrle_started = false;
 
+    for (i = 0; i < rs->nr_partitions; i++) {
+        rs->partition_scan[i].block = NULL;
+        rs->partition_scan[i].page = 0;
+    }
+
     ram_page_hint_reset(&rs->page_hint);
 }
 
@@ -2802,6 +3521,7 @@ static bool ram_state_init(RAMState **rsp, Error **errp)
 
     qemu_mutex_init(&(*rsp)->bitmap_mutex);
     qemu_mutex_init(&(*rsp)->src_page_req_mutex);
+    qemu_mutex_init(&(*rsp)->preempt_senders_lock);
     QSIMPLEQ_INIT(&(*rsp)->src_page_requests);
     (*rsp)->ram_bytes_total = ram_bytes_total();
 
@@ -2811,6 +3531,19 @@ static bool ram_state_init(RAMState **rsp, Error **errp)
      * This must match with the initial values of dirty bitmap.
      */
     (*rsp)->migration_dirty_pages = (*rsp)->ram_bytes_total >> TARGET_PAGE_BITS;
+
+    if (migrate_multifd_partitioned_scan()) {
+        (*rsp)->nr_partitions = migrate_multifd_channels();
+        (*rsp)->partition_scan = g_new0(RAMPartitionScan,
+                                        (*rsp)->nr_partitions);
+    }
+
+    if (g_get_num_processors() > 1) {
+        (*rsp)->sync_threads = thread_pool_new();
+        thread_pool_set_max_threads((*rsp)->sync_threads,
+                                    MIN(g_get_num_processors(),
+                                        BITMAP_SYNC_MAX_THREADS));
+    }
     ram_state_reset(*rsp);
 
     return true;
@@ -2852,6 +3585,11 @@ static void ram_list_init_bitmaps(void)
             if (migrate_mapped_ram()) {
                 block->file_bmap = bitmap_new(pages);
             }
+            if (migrate_defer_hot_pages()) {
+                block->hot_bmap = bitmap_new(pages);
+                block->hot_recent_bmap = bitmap_new(pages);
+                block->hot_prev_bmap = bitmap_new(pages);
+            }
             block->clear_bmap_shift = shift;
             block->clear_bmap = bitmap_new(clear_bmap_size(pages, shift));
         }
@@ -3294,7 +4032,11 @@ static int ram_save_iterate(QEMUFile *f, void *opaque)
                     break;
                 }
 
-                pages = ram_find_and_save_block(rs);
+                if (rs->partition_scan) {
+                    pages = ram_save_partitioned_round(rs);
+                } else {
+                    pages = ram_find_and_save_block(rs);
+                }
                 /* no more pages to sent */
                 if (pages == 0) {
                     done = 1;
@@ -3394,7 +4136,11 @@ static int ram_save_complete(QEMUFile *f, void *opaque)
         while (true) {
             int pages;
 
-            pages = ram_find_and_save_block(rs);
+            if (rs->partition_scan) {
+                pages = ram_save_partitioned_round(rs);
+            } else {
+                pages = ram_find_and_save_block(rs);
+            }
             /* no more blocks to sent */
             if (pages == 0) {
                 break;
@@ -3760,9 +4506,20 @@ void colo_release_ram_cache(void)
  */
 static int ram_load_setup(QEMUFile *f, void *opaque, Error **errp)
 {
+    /* Pages of a previous lazy load must not land on top of this one */
+    ram_lazy_load_finish();
+
     xbzrle_load_setup();
     ramblock_recv_map_init();
 
+    if (migrate_mapped_ram() && !migrate_multifd() &&
+        g_get_num_processors() > 1) {
+        mapped_ram_load_threads = thread_pool_new();
+        thread_pool_set_max_threads(mapped_ram_load_threads,
+                                    MIN(g_get_num_processors(),
+                                        MAPPED_RAM_LOAD_MAX_THREADS));
+    }
+
     return 0;
 }
 
@@ -3777,6 +4534,8 @@ static int ram_load_cleanup(void *opaque)
     }
 
     xbzrle_load_cleanup();
+    g_clear_pointer(&mapped_ram_load_threads, thread_pool_free);
+    ram_lazy_load_start();
 
     RAMBLOCK_FOREACH_NOT_IGNORED(rb) {
         g_free(rb->receivedmap);
@@ -4086,15 +4845,209 @@ static bool handle_zero_mapped_ram(RAMBlock *block, unsigned long from_bit_idx,
     return true;
 }
 
+typedef struct MappedRamLoadJob {
+    QIOChannel *ioc;
+    void *host;
+    size_t size;
+    off_t pos;
+    Error *err;
+} MappedRamLoadJob;
+
+static int mapped_ram_load_job(void *opaque)
+{
+    MappedRamLoadJob *job = opaque;
+    ssize_t ret;
+
+    ret = qio_channel_pread(job->ioc, job->host, job->size, job->pos,
+                            &job->err);
+    if (ret < 0) {
+        if (!job->err) {
+            error_setg(&job->err, "Failed to read %zu bytes", job->size);
+        }
+        return -1;
+    }
+    if (ret != job->size) {
+        error_setg(&job->err, "Partial read of size %zd, expected %zu",
+                   ret, job->size);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void mapped_ram_load_job_free(gpointer opaque)
+{
+    MappedRamLoadJob *job = opaque;
+
+    error_free(job->err);
+    g_free(job);
+}
+
+/*
+ * Wait for the read jobs of a ramblock, and report the first one that
+ * failed, unless @errp is already set.
+ */
+static bool mapped_ram_load_wait(RAMBlock *block, GPtrArray *jobs,
+                                 Error **errp)
+{
+    thread_pool_wait(mapped_ram_load_threads);
+
+    if (*errp) {
+        return false;
+    }
+    for (guint i = 0; i < jobs->len; i++) {
+        MappedRamLoadJob *job = g_ptr_array_index(jobs, i);
+
+        if (job->err) {
+            error_propagate_prepend(errp, g_steal_pointer(&job->err),
+                                    "(%s) failed to read pages from file "
+                                    "offset %" PRIx64 ": ", block->idstr,
+                                    (uint64_t)job->pos);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Whether @block is private anonymous memory with host-sized pages, the
+ * only kind whose pages can be populated other than by writing them.
+ */
+static bool mapped_ram_block_is_anon(RAMBlock *block)
+{
+    return block->fd < 0 && !qemu_ram_is_shared(block) &&
+           block->page_size == qemu_real_host_page_size() &&
+           !memory_region_has_ram_discard_manager(block->mr) &&
+           !xen_enabled();
+}
+
+/* Return the file descriptor of the migration file, or -1 */
+static int mapped_ram_file_fd(QEMUFile *f)
+{
+    QIOChannel *ioc = qemu_file_get_ioc(f);
+
+    if (!object_dynamic_cast(OBJECT(ioc), TYPE_QIO_CHANNEL_FILE)) {
+        return -1;
+    }
+    return QIO_CHANNEL_FILE(ioc)->fd;
+}
+
+/*
+ * Return the file descriptor that pages of @block can be mapped from with
+ * x-mapped-ram-map, or -1 if they have to be read.
+ */
+static int mapped_ram_map_fd(QEMUFile *f, RAMBlock *block)
+{
+    if (!migrate_mapped_ram_map() || !mapped_ram_block_is_anon(block)) {
+        return -1;
+    }
+    return mapped_ram_file_fd(f);
+}
+
+/*
+ * Map as much as possible of the @size bytes at @offset in @block from
+ * @fd.  Returns the mapped range in @map_start and @map_end, which are
+ * equal if nothing was mapped.
+ */
+static void mapped_ram_map_pages(RAMBlock *block, int fd, ram_addr_t offset,
+                                 size_t size, ram_addr_t *map_start,
+                                 ram_addr_t *map_end)
+{
+#ifndef _WIN32
+    size_t host_page_size = qemu_real_host_page_size();
+    ram_addr_t start = ROUND_UP(offset, host_page_size);
+    ram_addr_t end = ROUND_DOWN(offset + size, host_page_size);
+    int ret;
+
+    *map_start = *map_end = offset;
+    if (start >= end ||
+        !QEMU_IS_ALIGNED(block->pages_offset, host_page_size)) {
+        return;
+    }
+
+    ret = qemu_ram_map_file(block, start, end - start, fd,
+                            block->pages_offset + start);
+    trace_ram_load_map_pages(block->idstr, start, end - start, ret);
+    if (ret == 0) {
+        *map_start = start;
+        *map_end = end;
+    }
+#else
+    *map_start = *map_end = offset;
+#endif
+}
+
+static bool mapped_ram_read_pages(QEMUFile *f, RAMBlock *block,
+                                  GPtrArray *jobs, ram_addr_t offset,
+                                  size_t unread, Error **errp)
+{
+    ERRP_GUARD();
+    void *host;
+    size_t read, size;
+
+    while (unread > 0) {
+        host = host_from_ram_block_offset(block, offset);
+        if (!host) {
+            error_setg(errp, "page outside of ramblock %s range",
+                       block->idstr);
+            return false;
+        }
+
+        if (jobs) {
+            MappedRamLoadJob *job = g_new0(MappedRamLoadJob, 1);
+
+            job->ioc = qemu_file_get_ioc(f);
+            job->host = host;
+            job->size = MIN(unread, MAPPED_RAM_LOAD_JOB_SIZE);
+            job->pos = block->pages_offset + offset;
+            g_ptr_array_add(jobs, job);
+            thread_pool_submit(mapped_ram_load_threads,
+                               mapped_ram_load_job, job, NULL);
+            offset += job->size;
+            unread -= job->size;
+            continue;
+        }
+
+        size = MIN(unread, MAPPED_RAM_LOAD_BUF_SIZE);
+
+        if (migrate_multifd()) {
+            read = ram_load_multifd_pages(host, size,
+                                          block->pages_offset + offset);
+        } else {
+            read = qemu_get_buffer_at(f, host, size,
+                                      block->pages_offset + offset);
+        }
+
+        if (!read) {
+            qemu_file_get_error_obj(f, errp);
+            error_prepend(errp, "(%s) failed to read page " RAM_ADDR_FMT
+                          "from file offset %" PRIx64 ": ", block->idstr,
+                          offset, block->pages_offset + offset);
+            return false;
+        }
+        offset += read;
+        unread -= read;
+    }
+
+    return true;
+}
+
 static bool read_ramblock_mapped_ram(QEMUFile *f, RAMBlock *block,
                                      long num_pages, unsigned long *bitmap,
                                      Error **errp)
 {
     ERRP_GUARD();
     unsigned long set_bit_idx, clear_bit_idx = 0;
-    ram_addr_t offset;
-    void *host;
-    size_t read, unread, size;
+    g_autoptr(GPtrArray) jobs = NULL;
+    ram_addr_t offset, map_start, map_end;
+    size_t unread;
+    int map_fd = mapped_ram_map_fd(f, block);
+    unsigned map_regions = 0;
+
+    if (!migrate_multifd() && mapped_ram_load_threads) {
+        jobs = g_ptr_array_new_with_free_func(mapped_ram_load_job_free);
+    }
 
     for (set_bit_idx = find_first_bit(bitmap, num_pages);
          set_bit_idx < num_pages;
@@ -4102,7 +5055,7 @@ static bool read_ramblock_mapped_ram(QEMUFile *f, RAMBlock *block,
 
         /* Zero pages */
         if (!handle_zero_mapped_ram(block, clear_bit_idx, set_bit_idx, errp)) {
-            return false;
+            goto out;
         }
 
         /* Non-zero pages */
@@ -4110,48 +5063,439 @@ static bool read_ramblock_mapped_ram(QEMUFile *f, RAMBlock *block,
 
         unread = TARGET_PAGE_SIZE * (clear_bit_idx - set_bit_idx);
         offset = set_bit_idx << TARGET_PAGE_BITS;
+        map_start = map_end = offset;
 
-        while (unread > 0) {
-            host = host_from_ram_block_offset(block, offset);
-            if (!host) {
-                error_setg(errp, "page outside of ramblock %s range",
-                           block->idstr);
-                return false;
+        /*
+         * Only ranges that are present in the file can be mapped, the
+         * file may hold stale data where the bitmap is clear.
+         */
+        if (map_fd >= 0 && map_regions < MAPPED_RAM_MAP_MAX_REGIONS) {
+            mapped_ram_map_pages(block, map_fd, offset, unread,
+                                 &map_start, &map_end);
+            map_regions += map_start != map_end;
+        }
+
+        if (map_start == map_end) {
+            if (!mapped_ram_read_pages(f, block, jobs, offset, unread,
+                                       errp)) {
+                goto out;
             }
+            continue;
+        }
 
-            size = MIN(unread, MAPPED_RAM_LOAD_BUF_SIZE);
+        /* Partial host pages at either end of the mapping */
+        if (!mapped_ram_read_pages(f, block, jobs, offset,
+                                   map_start - offset, errp) ||
+            !mapped_ram_read_pages(f, block, jobs, map_end,
+                                   offset + unread - map_end, errp)) {
+            goto out;
+        }
+    }
 
-            if (migrate_multifd()) {
-                read = ram_load_multifd_pages(host, size,
-                                              block->pages_offset + offset);
-            } else {
-                read = qemu_get_buffer_at(f, host, size,
-                                          block->pages_offset + offset);
+    /* Handle trailing 0 pages */
+    handle_zero_mapped_ram(block, clear_bit_idx, num_pages, errp);
+
+out:
+    if (jobs) {
+        return mapped_ram_load_wait(block, jobs, errp);
+    }
+    return !*errp;
+}
+
+#if defined(__linux__)
+/*
+ * With x-mapped-ram-lazy, the amount read at a time by the thread loading
+ * the pages that the guest did not access yet.
+ */
+#define MAPPED_RAM_LAZY_CHUNK_SIZE (1 * MiB)
+
+/* A ramblock whose pages are read from the migration file on demand */
+typedef struct RamLazyBlock {
+    RAMBlock *block;
+    ram_addr_t length;
+    /* Target pages present in the file, the others are zero */
+    unsigned long *file_bmap;
+    /* Host pages that are placed, or being placed by one of the threads */
+    unsigned long *claimed;
+} RamLazyBlock;
+
+typedef struct RamLazyLoad {
+    int uffd;
+    /* Copy of the migration file descriptor, open until all is loaded */
+    int fd;
+    QemuMutex lock;
+    /* RamLazyBlock array, protected by lock */
+    GPtrArray *blocks;
+    EventNotifier quit;
+    QemuThread fault_thread;
+    QemuThread load_thread;
+    bool load_thread_started;
+    /* Releases everything once the load thread is done */
+    QEMUBH *bh;
+} RamLazyLoad;
+
+/* Protected by the BQL */
+static RamLazyLoad *ram_lazy_load;
+
+/* Returns true if the caller is the one that must place @page */
+static bool ram_lazy_claim(RamLazyBlock *lb, unsigned long page)
+{
+    unsigned long mask = BIT_MASK(page);
+
+    return !(qatomic_fetch_or(&lb->claimed[BIT_WORD(page)], mask) & mask);
+}
+
+static int ram_lazy_read(int fd, uint8_t *buf, size_t len, off_t pos)
+{
+    ssize_t ret;
+
+    while (len) {
+        ret = pread(fd, buf, len, pos);
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret < 0) {
+            return -errno;
+        }
+        if (ret == 0) {
+            return -EIO;
+        }
+        buf += ret;
+        len -= ret;
+        pos += ret;
+    }
+    return 0;
+}
+
+/*
+ * Place the @len bytes at @offset of @lb, whose host pages the caller
+ * claimed, using @buf as a bounce buffer of at least @len bytes.
+ * Returns 0 on success, a negative errno value otherwise.
+ */
+static int ram_lazy_place(RamLazyLoad *lazy, RamLazyBlock *lb,
+                          ram_addr_t offset, size_t len, uint8_t *buf)
+{
+    unsigned long first = offset >> TARGET_PAGE_BITS;
+    unsigned long last = (offset + len) >> TARGET_PAGE_BITS;
+    unsigned long page = first, set, clear;
+    uint8_t *host = lb->block->host + offset;
+    int ret;
+
+    if (find_next_bit(lb->file_bmap, last, first) == last) {
+        return uffd_zero_page(lazy->uffd, host, len, false);
+    }
+
+    while (page < last) {
+        set = find_next_bit(lb->file_bmap, last, page);
+        memset(buf + ((page - first) << TARGET_PAGE_BITS), 0,
+               (set - page) << TARGET_PAGE_BITS);
+        if (set == last) {
+            break;
+        }
+        clear = find_next_zero_bit(lb->file_bmap, last, set + 1);
+        ret = ram_lazy_read(lazy->fd, buf + ((set - first) << TARGET_PAGE_BITS),
+                            (clear - set) << TARGET_PAGE_BITS,
+                            lb->block->pages_offset +
+                            (set << TARGET_PAGE_BITS));
+        if (ret) {
+            return ret;
+        }
+        page = clear;
+    }
+    return uffd_copy_page(lazy->uffd, host, buf, len, false);
+}
+
+/* The guest cannot continue without the page, so give up */
+static void G_NORETURN ram_lazy_place_failed(RamLazyBlock *lb,
+                                             ram_addr_t offset, int ret)
+{
+    error_report("Failed to load RAM block %s at offset 0x" RAM_ADDR_FMT
+                 " from the migration file: %s", lb->block->idstr, offset,
+                 strerror(-ret));
+    exit(EXIT_FAILURE);
+}
+
+static RamLazyBlock *ram_lazy_find(RamLazyLoad *lazy, uintptr_t addr,
+                                   ram_addr_t *offset)
+{
+    QEMU_LOCK_GUARD(&lazy->lock);
+
+    for (guint i = 0; i < lazy->blocks->len; i++) {
+        RamLazyBlock *lb = g_ptr_array_index(lazy->blocks, i);
+        uintptr_t host = (uintptr_t)lb->block->host;
+
+        if (addr >= host && addr - host < lb->length) {
+            *offset = addr - host;
+            return lb;
+        }
+    }
+    return NULL;
+}
+
+static void ram_lazy_handle_fault(RamLazyLoad *lazy, uint8_t *buf,
+                                  struct uffd_msg *msg)
+{
+    size_t page_size = qemu_real_host_page_size();
+    RamLazyBlock *lb;
+    ram_addr_t offset;
+    int ret;
+
+    if (msg->event != UFFD_EVENT_PAGEFAULT) {
+        return;
+    }
+
+    lb = ram_lazy_find(lazy, msg->arg.pagefault.address, &offset);
+    if (!lb) {
+        error_report("%s: fault outside of lazily loaded RAM: 0x%" PRIx64,
+                     __func__, (uint64_t)msg->arg.pagefault.address);
+        return;
+    }
+
+    offset = ROUND_DOWN(offset, page_size);
+    trace_ram_lazy_load_fault(lb->block->idstr, offset);
+
+    /* Otherwise the load thread is placing it and will wake the guest */
+    if (ram_lazy_claim(lb, offset / page_size)) {
+        ret = ram_lazy_place(lazy, lb, offset, page_size, buf);
+        if (ret) {
+            ram_lazy_place_failed(lb, offset, ret);
+        }
+    }
+}
+
+/* Place the pages that the guest accesses */
+static void *ram_lazy_fault_thread(void *opaque)
+{
+    RamLazyLoad *lazy = opaque;
+    g_autofree uint8_t *buf = g_malloc(qemu_real_host_page_size());
+    struct pollfd pfd[2] = {
+        { .fd = lazy->uffd, .events = POLLIN },
+        { .fd = event_notifier_get_fd(&lazy->quit), .events = POLLIN },
+    };
+    struct uffd_msg msg;
+
+    while (true) {
+        if (poll(pfd, ARRAY_SIZE(pfd), -1) < 0) {
+            if (errno == EINTR) {
+                continue;
             }
+            error_report("%s: poll failed: %s", __func__, strerror(errno));
+            break;
+        }
+        if (pfd[1].revents) {
+            break;
+        }
+        while (uffd_read_events(lazy->uffd, &msg, 1) == 1) {
+            ram_lazy_handle_fault(lazy, buf, &msg);
+        }
+    }
+    return NULL;
+}
+
+/* Place the pages that the guest did not access yet */
+static void *ram_lazy_load_thread(void *opaque)
+{
+    RamLazyLoad *lazy = opaque;
+    size_t page_size = qemu_real_host_page_size();
+    unsigned long chunk = MAX(MAPPED_RAM_LAZY_CHUNK_SIZE / page_size, 1);
+    g_autofree uint8_t *buf = g_malloc(chunk * page_size);
+    unsigned long npages, start, end;
+    RamLazyBlock *lb;
+    int ret;
 
-            if (!read) {
-                goto err;
+    for (guint i = 0; i < lazy->blocks->len; i++) {
+        WITH_QEMU_LOCK_GUARD(&lazy->lock) {
+            lb = g_ptr_array_index(lazy->blocks, i);
+        }
+        npages = lb->length / page_size;
+
+        for (start = find_first_zero_bit(lb->claimed, npages); start < npages;
+             start = find_next_zero_bit(lb->claimed, npages, end)) {
+            /* Stop at the first page claimed by the fault thread */
+            for (end = start; end < npages && end - start < chunk; end++) {
+                if (!ram_lazy_claim(lb, end)) {
+                    break;
+                }
+            }
+            if (end == start) {
+                continue;
+            }
+            ret = ram_lazy_place(lazy, lb, start * page_size,
+                                 (end - start) * page_size, buf);
+            if (ret) {
+                ram_lazy_place_failed(lb, start * page_size, ret);
             }
-            offset += read;
-            unread -= read;
         }
     }
 
-    /* Handle trailing 0 pages */
-    if (!handle_zero_mapped_ram(block, clear_bit_idx, num_pages, errp)) {
+    trace_ram_lazy_load_done();
+    qemu_bh_schedule(lazy->bh);
+    return NULL;
+}
+
+/*
+ * Wait until all the pages of the last lazy load are placed, then release
+ * its resources.
+ */
+static void ram_lazy_load_finish(void)
+{
+    RamLazyLoad *lazy = ram_lazy_load;
+
+    if (!lazy) {
+        return;
+    }
+
+    if (lazy->load_thread_started) {
+        qemu_thread_join(&lazy->load_thread);
+    }
+    event_notifier_set(&lazy->quit);
+    qemu_thread_join(&lazy->fault_thread);
+
+    for (guint i = 0; i < lazy->blocks->len; i++) {
+        RamLazyBlock *lb = g_ptr_array_index(lazy->blocks, i);
+
+        uffd_unregister_memory(lazy->uffd, lb->block->host, lb->length);
+        qemu_madvise(lb->block->host, lb->length, QEMU_MADV_HUGEPAGE);
+        memory_region_unref(lb->block->mr);
+        g_free(lb->file_bmap);
+        g_free(lb->claimed);
+        g_free(lb);
+    }
+    g_ptr_array_free(lazy->blocks, true);
+
+    qemu_bh_delete(lazy->bh);
+    event_notifier_cleanup(&lazy->quit);
+    uffd_close_fd(lazy->uffd);
+    close(lazy->fd);
+    qemu_mutex_destroy(&lazy->lock);
+    g_free(lazy);
+    ram_lazy_load = NULL;
+}
+
+static void ram_lazy_load_bh(void *opaque)
+{
+    ram_lazy_load_finish();
+}
+
+static RamLazyLoad *ram_lazy_load_new(int fd)
+{
+    RamLazyLoad *lazy = g_new0(RamLazyLoad, 1);
+
+    lazy->uffd = uffd_create_fd(0, true);
+    if (lazy->uffd < 0) {
+        g_free(lazy);
+        return NULL;
+    }
+    if (event_notifier_init(&lazy->quit, false) < 0) {
+        uffd_close_fd(lazy->uffd);
+        g_free(lazy);
+        return NULL;
+    }
+    lazy->fd = qemu_dup(fd);
+    if (lazy->fd < 0) {
+        event_notifier_cleanup(&lazy->quit);
+        uffd_close_fd(lazy->uffd);
+        g_free(lazy);
+        return NULL;
+    }
+
+    qemu_mutex_init(&lazy->lock);
+    lazy->blocks = g_ptr_array_new();
+    lazy->bh = qemu_bh_new(ram_lazy_load_bh, NULL);
+    qemu_thread_create(&lazy->fault_thread, "mig/dst/lazyflt",
+                       ram_lazy_fault_thread, lazy, QEMU_THREAD_JOINABLE);
+    return lazy;
+}
+
+/*
+ * With x-mapped-ram-lazy, make the pages of @block be read from the file
+ * when first accessed, instead of now.  Returns false if they have to be
+ * read now, otherwise takes ownership of @bitmap.
+ */
+static bool ram_lazy_load_block(QEMUFile *f, RAMBlock *block, long num_pages,
+                                unsigned long **bitmap)
+{
+    const uint64_t mask = BIT(_UFFDIO_COPY) | BIT(_UFFDIO_ZEROPAGE);
+    size_t page_size = qemu_real_host_page_size();
+    ram_addr_t length = (ram_addr_t)num_pages << TARGET_PAGE_BITS;
+    int fd = mapped_ram_file_fd(f);
+    RamLazyBlock *lb;
+    uint64_t ioctls;
+
+    /* userfaultfd and mlock do not go together */
+    if (!migrate_mapped_ram_lazy() || mapped_ram_map_fd(f, block) >= 0 ||
+        !mapped_ram_block_is_anon(block) || fd < 0 ||
+        !QEMU_IS_ALIGNED(length, page_size) || should_mlock(mlock_state)) {
         return false;
     }
 
+    if (!ram_lazy_load) {
+        ram_lazy_load = ram_lazy_load_new(fd);
+        if (!ram_lazy_load) {
+            warn_report_once("x-mapped-ram-lazy: userfaultfd is not "
+                             "available, loading RAM before starting");
+            return false;
+        }
+    }
+
+    /*
+     * The block must be empty for accesses to fault, and stay so: THP
+     * could otherwise fill the gaps around the pages already placed.
+     */
+    qemu_madvise(block->host, length, QEMU_MADV_NOHUGEPAGE);
+    if (ram_block_discard_range(block, 0, length)) {
+        return false;
+    }
+    if (uffd_register_memory(ram_lazy_load->uffd, block->host, length,
+                             UFFDIO_REGISTER_MODE_MISSING, &ioctls)) {
+        return false;
+    }
+    if ((ioctls & mask) != mask) {
+        uffd_unregister_memory(ram_lazy_load->uffd, block->host, length);
+        return false;
+    }
+
+    lb = g_new0(RamLazyBlock, 1);
+    lb->block = block;
+    lb->length = length;
+    lb->file_bmap = g_steal_pointer(bitmap);
+    lb->claimed = bitmap_new(length / page_size);
+    memory_region_ref(block->mr);
+    WITH_QEMU_LOCK_GUARD(&ram_lazy_load->lock) {
+        g_ptr_array_add(ram_lazy_load->blocks, lb);
+    }
+
+    trace_ram_lazy_load_block(block->idstr, length);
     return true;
+}
 
-err:
-    qemu_file_get_error_obj(f, errp);
-    error_prepend(errp, "(%s) failed to read page " RAM_ADDR_FMT
-                  "from file offset %" PRIx64 ": ", block->idstr, offset,
-                  block->pages_offset + offset);
+/* Start loading the pages that the guest has not accessed */
+static void ram_lazy_load_start(void)
+{
+    RamLazyLoad *lazy = ram_lazy_load;
+
+    if (lazy && !lazy->load_thread_started) {
+        qemu_thread_create(&lazy->load_thread, "mig/dst/lazyld",
+                           ram_lazy_load_thread, lazy, QEMU_THREAD_JOINABLE);
+        lazy->load_thread_started = true;
+    }
+}
+#else
+static bool ram_lazy_load_block(QEMUFile *f, RAMBlock *block, long num_pages,
+                                unsigned long **bitmap)
+{
     return false;
 }
 
+static void ram_lazy_load_start(void)
+{
+}
+
+static void ram_lazy_load_finish(void)
+{
+}
+#endif /* defined(__linux__) */
+
 static void parse_ramblock_mapped_ram(QEMUFile *f, RAMBlock *block,
                                       ram_addr_t length, Error **errp)
 {
@@ -4194,7 +5538,8 @@ static void parse_ramblock_mapped_ram(QEMUFile *f, RAMBlock *block,
         return;
     }
 
-    if (!read_ramblock_mapped_ram(f, block, num_pages, bitmap, errp)) {
+    if (!ram_lazy_load_block(f, block, num_pages, &bitmap) &&
+        !read_ramblock_mapped_ram(f, block, num_pages, bitmap, errp)) {
         return;
     }
 
@@ -4694,8 +6039,13 @@ static bool ram_save_postcopy_prepare(QEMUFile *f, void *opaque, Error **errp)
 
 void postcopy_preempt_shutdown_file(MigrationState *s)
 {
-    qemu_put_be64(s->postcopy_qemufile_src, RAM_SAVE_FLAG_EOS);
-    qemu_fflush(s->postcopy_qemufile_src);
+    int i;
+
+    postcopy_preempt_senders_stop(s, false);
+    for (i = 0; i < migrate_postcopy_preempt_channels(); i++) {
+        qemu_put_be64(s->postcopy_qemufile_src[i], RAM_SAVE_FLAG_EOS);
+        qemu_fflush(s->postcopy_qemufile_src[i]);
+    }
 }
 
 static SaveVMHandlers savevm_ram_handlers = {
@@ -105,6 +105,8 @@ int64_t ramblock_recv_bitmap_send(QEMUFile *file,
 bool ram_dirty_bitmap_reload(MigrationState *s, RAMBlock *rb, Error **errp);
 bool ramblock_page_is_discarded(RAMBlock *rb, ram_addr_t start);
 void postcopy_preempt_shutdown_file(MigrationState *s);
+void postcopy_preempt_senders_start(MigrationState *s);
+void postcopy_preempt_senders_stop(MigrationState *s, bool shutdown);
 void *postcopy_preempt_thread(void *opaque);
 void ramblock_set_file_bmap_atomic(RAMBlock *block, ram_addr_t offset,
                                    bool set);
@@ -66,6 +66,8 @@
 #include "system/xen.h"
 #include "migration/colo.h"
 #include "qemu/bitmap.h"
+#include "qemu/coroutine-tls.h"
+#include "qemu/lockable.h"
 #include "net/announce.h"
 #include "qemu/yank.h"
 #include "yank_functions.h"
@@ -163,6 +165,80 @@ static bool qemu_loadvm_thread_pool_wait(MigrationState *s,
     return !migrate_has_error(s);
 }
 
+/***********************************************************/
+/* Per-device load times and asynchronous post-load */
+
+/* The device whose state is being loaded by this thread, if any */
+QEMU_DEFINE_STATIC_CO_TLS(MigrationDeviceTime *, loadvm_device)
+
+typedef struct LoadvmPostLoadAsync {
+    const VMStateDescription *vmsd;
+    void *opaque;
+    int version_id;
+    MigrationDeviceTime *dev;
+} LoadvmPostLoadAsync;
+
+static bool qemu_loadvm_post_load_async_thread(void *opaque,
+                                               bool *should_quit,
+                                               Error **errp)
+{
+    g_autofree LoadvmPostLoadAsync *data = opaque;
+    const VMStateDescription *vmsd = data->vmsd;
+    int64_t start_ts;
+
+    if (qatomic_read(should_quit)) {
+        /* The load failed, nobody is going to use this state */
+        return true;
+    }
+
+    start_ts = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
+    if (!vmsd->post_load_async(data->opaque, data->version_id, errp)) {
+        error_prepend(errp, "async post load hook failed for: %s, "
+                      "version_id: %d: ", vmsd->name, data->version_id);
+        return false;
+    }
+    stat64_add(&data->dev->async_post_load_time,
+               qemu_clock_get_us(QEMU_CLOCK_REALTIME) - start_ts);
+    return true;
+}
+
+int qemu_loadvm_post_load_async(const VMStateDescription *vmsd, void *opaque,
+                                int version_id, Error **errp)
+{
+    MigrationDeviceTime *dev = get_loadvm_device();
+    MigrationIncomingState *mis;
+    LoadvmPostLoadAsync *data;
+
+    /*
+     * Only the load of a precopy stream waits for the load threads before
+     * the VM starts.  Anything else runs the hook right away.
+     */
+    if (dev) {
+        mis = migration_incoming_get_current();
+        if (mis->load_threads && !qatomic_read(&mis->load_threads_abort) &&
+            postcopy_state_get() == POSTCOPY_INCOMING_NONE) {
+            data = g_new(LoadvmPostLoadAsync, 1);
+            data->vmsd = vmsd;
+            data->opaque = opaque;
+            data->version_id = version_id;
+            data->dev = dev;
+            dev->async_post_load = true;
+            trace_loadvm_post_load_async(vmsd->name);
+            qemu_loadvm_start_load_thread(qemu_loadvm_post_load_async_thread,
+                                          data);
+            return 0;
+        }
+    }
+
+    if (!vmsd->post_load_async(opaque, version_id, errp)) {
+        error_prepend(errp, "post load hook failed for: %s, version_id: %d, "
+                      "minimum_version: %d: ", vmsd->name, vmsd->version_id,
+                      vmsd->minimum_version_id);
+        return -EINVAL;
+    }
+    return 0;
+}
+
 /***********************************************************/
 /* savevm/loadvm support */
 
@@ -979,6 +1055,71 @@ static int vmstate_load(QEMUFile *f, SaveStateEntry *se, Error **errp)
                               errp);
 }
 
+/*
+ * Load the state of @se while the VM is stopped, and record how long it
+ * takes.  @type is used for tracing.
+ */
+static int vmstate_load_timed(QEMUFile *f, SaveStateEntry *se,
+                              const char *type, Error **errp)
+{
+    MigrationIncomingState *mis = migration_incoming_get_current();
+    MigrationDeviceTime *dev = g_new0(MigrationDeviceTime, 1);
+    int64_t start_ts = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
+    int ret;
+
+    dev->idstr = g_strdup(se->idstr);
+    dev->instance_id = se->instance_id;
+    dev->iterable = !strcmp(type, "iterable");
+
+    set_loadvm_device(dev);
+    ret = vmstate_load(f, se, errp);
+    set_loadvm_device(NULL);
+
+    dev->time = qemu_clock_get_us(QEMU_CLOCK_REALTIME) - start_ts;
+    if (ret >= 0) {
+        trace_vmstate_downtime_load(type, se->idstr, se->instance_id,
+                                    dev->time);
+    }
+
+    /* The load threads still using @dev are done before it is freed */
+    migration_downtime_add_device(&mis->downtime_profile, dev);
+    return ret;
+}
+
+/*
+ * Record the time @se took to save during the downtime of a migration.
+ * @type is used for tracing.
+ */
+static void vmstate_save_timed(SaveStateEntry *se, const char *type,
+                               int64_t time)
+{
+    MigrationDeviceTime *dev;
+
+    trace_vmstate_downtime_save(type, se->idstr, se->instance_id, time);
+    if (!migration_is_running()) {
+        /* Saving a snapshot */
+        return;
+    }
+
+    dev = g_new0(MigrationDeviceTime, 1);
+    dev->idstr = g_strdup(se->idstr);
+    dev->instance_id = se->instance_id;
+    dev->iterable = !strcmp(type, "iterable");
+    dev->time = time;
+    migration_downtime_add_device(&migrate_get_current()->downtime_profile,
+                                  dev);
+}
+
+static void qemu_savevm_downtime_checkpoint(const char *checkpoint)
+{
+    if (migration_is_running()) {
+        migration_downtime_checkpoint(
+            &migrate_get_current()->downtime_profile, checkpoint);
+    } else {
+        trace_vmstate_downtime_checkpoint(checkpoint);
+    }
+}
+
 static void vmstate_save_old_style(QEMUFile *f, SaveStateEntry *se,
                                    JSONWriter *vmdesc)
 {
@@ -1629,8 +1770,7 @@ int qemu_savevm_state_complete_precopy_iterable(QEMUFile *f, bool in_postcopy)
         }
         end_ts_each = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
 
-        trace_vmstate_downtime_save("iterable", se->idstr, se->instance_id,
-                                    end_ts_each - start_ts_each);
+        vmstate_save_timed(se, "iterable", end_ts_each - start_ts_each);
     }
 
     if (multifd_device_state) {
@@ -1644,7 +1784,7 @@ int qemu_savevm_state_complete_precopy_iterable(QEMUFile *f, bool in_postcopy)
         }
     }
 
-    trace_vmstate_downtime_checkpoint("src-iterable-saved");
+    qemu_savevm_downtime_checkpoint("src-iterable-saved");
 
     return 0;
 
@@ -1688,8 +1828,7 @@ int qemu_savevm_state_complete_precopy_non_iterable(QEMUFile *f,
         }
 
         end_ts_each = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
-        trace_vmstate_downtime_save("non-iterable", se->idstr, se->instance_id,
-                                    end_ts_each - start_ts_each);
+        vmstate_save_timed(se, "non-iterable", end_ts_each - start_ts_each);
     }
 
     if (!in_postcopy) {
@@ -1707,7 +1846,7 @@ int qemu_savevm_state_complete_precopy_non_iterable(QEMUFile *f,
         }
     }
 
-    trace_vmstate_downtime_checkpoint("src-non-iterable-saved");
+    qemu_savevm_downtime_checkpoint("src-non-iterable-saved");
 
     return 0;
 }
@@ -2124,18 +2263,21 @@ static void loadvm_postcopy_handle_run_bh(void *opaque)
 {
     MigrationIncomingState *mis = opaque;
 
-    trace_vmstate_downtime_checkpoint("dst-postcopy-bh-enter");
+    migration_downtime_checkpoint(&mis->downtime_profile,
+                                  "dst-postcopy-bh-enter");
 
     /* TODO we should move all of this lot into postcopy_ram.c or a shared code
      * in migration.c
      */
     cpu_synchronize_all_post_init();
 
-    trace_vmstate_downtime_checkpoint("dst-postcopy-bh-cpu-synced");
+    migration_downtime_checkpoint(&mis->downtime_profile,
+                                  "dst-postcopy-bh-cpu-synced");
 
     qemu_announce_self(&mis->announce_timer, migrate_announce_params());
 
-    trace_vmstate_downtime_checkpoint("dst-postcopy-bh-announced");
+    migration_downtime_checkpoint(&mis->downtime_profile,
+                                  "dst-postcopy-bh-announced");
 
     dirty_bitmap_mig_before_vm_start();
 
@@ -2146,7 +2288,8 @@ static void loadvm_postcopy_handle_run_bh(void *opaque)
          */
         bool success = migration_block_activate(NULL);
 
-        trace_vmstate_downtime_checkpoint("dst-postcopy-bh-cache-invalidated");
+        migration_downtime_checkpoint(&mis->downtime_profile,
+                                      "dst-postcopy-bh-cache-invalidated");
 
         if (success) {
             vm_start();
@@ -2156,7 +2299,8 @@ static void loadvm_postcopy_handle_run_bh(void *opaque)
         runstate_set(RUN_STATE_PAUSED);
     }
 
-    trace_vmstate_downtime_checkpoint("dst-postcopy-bh-vm-started");
+    migration_downtime_checkpoint(&mis->downtime_profile,
+                                  "dst-postcopy-bh-vm-started");
 }
 
 /* After all discards we can start running and asking for pages */
@@ -2209,7 +2353,8 @@ static gboolean postcopy_sync_page_req(gpointer key, gpointer value,
         return FALSE;
     }
 
-    ret = migrate_send_rp_message_req_pages(mis, rb, rb_offset);
+    ret = migrate_send_rp_message_req_pages(mis, rb, rb_offset,
+                                            qemu_ram_pagesize(rb));
     if (ret) {
         /* Please refer to above comment. */
         error_report("%s: send rp message failed for addr %p",
@@ -2231,6 +2376,8 @@ static void migrate_send_rp_req_pages_pending(MigrationIncomingState *mis)
 
 static void loadvm_postcopy_handle_resume(MigrationIncomingState *mis)
 {
+    unsigned int i;
+
     if (mis->state != MIGRATION_STATUS_POSTCOPY_RECOVER) {
         warn_report("%s: illegal resume received", __func__);
         /* Don't fail the load, only for this. */
@@ -2278,13 +2425,17 @@ static void loadvm_postcopy_handle_resume(MigrationIncomingState *mis)
 
     if (migrate_postcopy_preempt()) {
         /*
-         * The preempt channel will be created in async manner, now let's
-         * wait for it and make sure it's created.
+         * The preempt channels will be created in async manner, now let's
+         * wait for them and make sure they're created.
          */
-        qemu_sem_wait(&mis->postcopy_qemufile_dst_done);
-        assert(mis->postcopy_qemufile_dst);
-        /* Kick the fast ram load thread too */
-        qemu_sem_post(&mis->postcopy_pause_sem_fast_load);
+        for (i = 0; i < migrate_postcopy_preempt_channels(); i++) {
+            qemu_sem_wait(&mis->postcopy_qemufile_dst_done[i]);
+            assert(mis->postcopy_qemufile_dst[i]);
+        }
+        /* Kick the fast ram load threads too */
+        for (i = 0; i < migrate_postcopy_preempt_channels(); i++) {
+            qemu_sem_post(&mis->postcopy_pause_sem_fast_load);
+        }
     }
 }
 
@@ -2341,7 +2492,7 @@ static int loadvm_handle_cmd_packaged(MigrationIncomingState *mis, Error **errp)
      */
     do {
         if (!migrate_postcopy_preempt() || !qemu_in_coroutine() ||
-            mis->postcopy_qemufile_dst) {
+            postcopy_preempt_channels_ready(mis)) {
             break;
         }
 
@@ -2599,7 +2750,6 @@ qemu_loadvm_section_start_full(QEMUFile *f, uint8_t type, Error **errp)
     ERRP_GUARD();
     bool trace_downtime = (type == QEMU_VM_SECTION_FULL);
     uint32_t instance_id, version_id, section_id;
-    int64_t start_ts, end_ts;
     SaveStateEntry *se;
     char idstr[256];
     int ret;
@@ -2648,10 +2798,10 @@ qemu_loadvm_section_start_full(QEMUFile *f, uint8_t type, Error **errp)
     }
 
     if (trace_downtime) {
-        start_ts = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
+        ret = vmstate_load_timed(f, se, "non-iterable", errp);
+    } else {
+        ret = vmstate_load(f, se, errp);
     }
-
-    ret = vmstate_load(f, se, errp);
     if (ret < 0) {
         error_prepend(errp,
                       "error while loading state for instance 0x%"PRIx32" of"
@@ -2659,12 +2809,6 @@ qemu_loadvm_section_start_full(QEMUFile *f, uint8_t type, Error **errp)
         return ret;
     }
 
-    if (trace_downtime) {
-        end_ts = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
-        trace_vmstate_downtime_load("non-iterable", se->idstr,
-                                    se->instance_id, end_ts - start_ts);
-    }
-
     if (!check_section_footer(f, se)) {
         error_setg(errp, "Section footer error, section_id: %d",
                    section_id);
@@ -2678,7 +2822,6 @@ static int
 qemu_loadvm_section_part_end(QEMUFile *f, uint8_t type, Error **errp)
 {
     bool trace_downtime = (type == QEMU_VM_SECTION_END);
-    int64_t start_ts, end_ts;
     uint32_t section_id;
     SaveStateEntry *se;
     int ret;
@@ -2703,20 +2846,14 @@ qemu_loadvm_section_part_end(QEMUFile *f, uint8_t type, Error **errp)
     }
 
     if (trace_downtime) {
-        start_ts = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
+        ret = vmstate_load_timed(f, se, "iterable", errp);
+    } else {
+        ret = vmstate_load(f, se, errp);
     }
-
-    ret = vmstate_load(f, se, errp);
     if (ret < 0) {
         return ret;
     }
 
-    if (trace_downtime) {
-        end_ts = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
-        trace_vmstate_downtime_load("iterable", se->idstr,
-                                    se->instance_id, end_ts - start_ts);
-    }
-
     if (!check_section_footer(f, se)) {
         error_setg(errp, "Section footer error, section_id: %d",
                    section_id);
@@ -2908,14 +3045,19 @@ static bool postcopy_pause_incoming(MigrationIncomingState *mis)
      * otherwise it's racy to reset those fields when the fast load thread
      * can be accessing it in parallel.
      */
-    if (mis->postcopy_qemufile_dst) {
-        qemu_file_shutdown(mis->postcopy_qemufile_dst);
+    for (i = 0; i < POSTCOPY_PREEMPT_CHANNELS_MAX; i++) {
+        QEMUFile *file = mis->postcopy_qemufile_dst[i];
+
+        if (!file) {
+            continue;
+        }
+        qemu_file_shutdown(file);
         /* Take the mutex to make sure the fast ram load thread halted */
-        qemu_mutex_lock(&mis->postcopy_prio_thread_mutex);
-        migration_ioc_unregister_yank_from_file(mis->postcopy_qemufile_dst);
-        qemu_fclose(mis->postcopy_qemufile_dst);
-        mis->postcopy_qemufile_dst = NULL;
-        qemu_mutex_unlock(&mis->postcopy_prio_thread_mutex);
+        qemu_mutex_lock(&mis->postcopy_prio_thread_mutex[i]);
+        migration_ioc_unregister_yank_from_file(file);
+        qemu_fclose(file);
+        mis->postcopy_qemufile_dst[i] = NULL;
+        qemu_mutex_unlock(&mis->postcopy_prio_thread_mutex[i]);
     }
 
     /* Current state can be either ACTIVE or RECOVER */
@@ -2958,7 +3100,10 @@ retry:
     while (true) {
         section_type = qemu_get_byte(f);
 
-        ret = qemu_file_get_error_obj_any(f, mis->postcopy_qemufile_dst, errp);
+        ret = qemu_file_get_error_obj_any(f, NULL, errp);
+        if (!ret) {
+            ret = postcopy_preempt_get_error(mis->postcopy_qemufile_dst, errp);
+        }
         if (ret) {
             error_prepend(errp,
                           "Failed to load section ID: stream error: %d: ",
@@ -3039,6 +3184,7 @@ int qemu_loadvm_state(QEMUFile *f, Error **errp)
     }
 
     qemu_loadvm_thread_pool_create(mis);
+    migration_downtime_profile_reset(&mis->downtime_profile);
 
     ret = qemu_loadvm_state_header(f, errp);
     if (ret) {
@@ -3135,6 +3281,8 @@ int qemu_load_device_state(QEMUFile *f, Error **errp)
     MigrationIncomingState *mis = migration_incoming_get_current();
     int ret;
 
+    migration_downtime_profile_reset(&mis->downtime_profile);
+
     /* Load QEMU_VM_SECTION_FULL section */
     ret = qemu_loadvm_state_main(f, mis, errp);
     if (ret < 0) {
@@ -3164,7 +3312,7 @@ int qemu_loadvm_approve_switchover(void)
 }
 
 bool qemu_loadvm_load_state_buffer(const char *idstr, uint32_t instance_id,
-                                   char *buf, size_t len, Error **errp)
+                                   char **buf, size_t len, Error **errp)
 {
     SaveStateEntry *se;
 
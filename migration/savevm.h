@@ -76,6 +76,8 @@ int qemu_savevm_state_complete_precopy_non_iterable(QEMUFile *f,
         bool in_postcopy);
 
 bool qemu_loadvm_load_state_buffer(const char *idstr, uint32_t instance_id,
-                                   char *buf, size_t len, Error **errp);
+                                   char **buf, size_t len, Error **errp);
+int qemu_loadvm_post_load_async(const VMStateDescription *vmsd, void *opaque,
+                                int version_id, Error **errp);
 
 #endif
@@ -271,6 +271,9 @@ int vmstate_load_state(QEMUFile *f, const VMStateDescription *vmsd,
                        ret);
         }
     }
+    if (ret >= 0 && vmsd->post_load_async) {
+        ret = qemu_loadvm_post_load_async(vmsd, opaque, version_id, errp);
+    }
     trace_vmstate_load_state_end(vmsd->name, "end", ret);
     return ret;
 }
@@ -19,4 +19,11 @@ int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
 
 int xbzrle_decode_buffer(uint8_t *src, int slen, uint8_t *dst, int dlen);
 
+/*
+ * Switch xbzrle_encode_buffer() to the next less optimized version,
+ * for testing and benchmarking.  Returns false if already using the
+ * generic version.
+ */
+bool test_xbzrle_encode_next_accel(void);
+
 #endif
@@ -207,6 +207,7 @@ void hmp_info_iothreads(Monitor *mon, const QDict *qdict)
         monitor_printf(mon, "  poll-shrink=%" PRId64 "\n", value->poll_shrink);
         monitor_printf(mon, "  aio-max-batch=%" PRId64 "\n",
                        value->aio_max_batch);
+        monitor_printf(mon, "  wakeups=%" PRIu64 "\n", value->wakeups);
     }
 
     qapi_free_IOThreadInfoList(info_list);
@@ -425,6 +426,11 @@ void hmp_info_mtree(Monitor *mon, const QDict *qdict)
     mtree_info(flatview, dispatch_tree, owner, disabled);
 }
 
+void hmp_info_mmio_bql(Monitor *mon, const QDict *qdict)
+{
+    mmio_bql_info();
+}
+
 #if defined(CONFIG_FDT)
 void hmp_dumpdtb(Monitor *mon, const QDict *qdict)
 {
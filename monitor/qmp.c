@@ -28,6 +28,8 @@
 #include "monitor-internal.h"
 #include "qapi/error.h"
 #include "qapi/qapi-commands-control.h"
+#include "qemu/units.h"
+#include "qobject/json-writer.h"
 #include "qobject/qdict.h"
 #include "qobject/qjson.h"
 #include "qobject/qlist.h"
@@ -156,17 +158,64 @@ static void monitor_qmp_respond(MonitorQMP *mon, QDict *rsp)
     }
 }
 
+/* Size of the chunks in which streamed replies are sent */
+#define QMP_REPLY_STREAM_CHUNK (64 * KiB)
+
+typedef struct MonitorQMPReplyStream {
+    QmpReplyStream stream;
+    MonitorQMP *mon;
+    size_t len;
+    bool locked;
+} MonitorQMPReplyStream;
+
+static void monitor_qmp_stream_write(const char *buf, size_t len,
+                                     void *opaque)
+{
+    MonitorQMPReplyStream *s = opaque;
+
+    /* Keep events and out-of-band replies from getting in between */
+    if (!s->locked) {
+        qemu_mutex_lock(&s->mon->common.mon_lock);
+        s->locked = true;
+    }
+    monitor_puts_locked(&s->mon->common, buf);
+    monitor_flush_locked(&s->mon->common);
+    s->len += len;
+}
+
+static void monitor_qmp_stream_done(QmpReplyStream *stream)
+{
+    MonitorQMPReplyStream *s = container_of(stream, MonitorQMPReplyStream,
+                                            stream);
+
+    /* The reply ends with "}", so there is something left to write */
+    json_writer_flush(stream->writer);
+    assert(s->locked);
+    trace_monitor_qmp_respond_stream(s->mon, s->len);
+    monitor_puts_locked(&s->mon->common, "\n");
+    qemu_mutex_unlock(&s->mon->common.mon_lock);
+    s->locked = false;
+}
+
 /*
  * Runs outside of coroutine context for OOB commands, but in
  * coroutine context for everything else.
  */
 static void monitor_qmp_dispatch(MonitorQMP *mon, QObject *req)
 {
+    g_autoptr(JSONWriter) writer = json_writer_new(mon->pretty);
+    MonitorQMPReplyStream stream = {
+        .stream.writer = writer,
+        .stream.done = monitor_qmp_stream_done,
+        .mon = mon,
+    };
     QDict *rsp;
     QDict *error;
 
-    rsp = qmp_dispatch(mon->commands, req, qmp_oob_enabled(mon),
-                       &mon->common);
+    json_writer_set_flush(writer, QMP_REPLY_STREAM_CHUNK,
+                          monitor_qmp_stream_write, &stream);
+    rsp = qmp_dispatch_stream(mon->commands, req, qmp_oob_enabled(mon),
+                              &mon->common, &stream.stream);
 
     if (mon->commands == &qmp_cap_negotiation_commands) {
         error = qdict_get_qdict(rsp, "error");
@@ -0,0 +1,137 @@
+/*
+ * Periodic statistics events
+ *
+ * A subscription runs query-stats at a fixed interval and sends the
+ * result as a STATS event.  Subscriptions whose providers do not need
+ * the BQL are served from the monitor I/O thread, so that polling them
+ * neither takes the lock nor delays the main loop.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "block/aio-wait.h"
+#include "monitor-internal.h"
+#include "qapi/clone-visitor.h"
+#include "qapi/error.h"
+#include "qapi/qapi-commands-stats.h"
+#include "qapi/qapi-events-stats.h"
+#include "qapi/qapi-visit-stats.h"
+#include "qemu/error-report.h"
+#include "qemu/main-loop.h"
+#include "qemu/timer.h"
+#include "system/stats.h"
+
+typedef struct StatsSubscription {
+    char *id;
+    StatsFilter *filter;
+    uint32_t interval;
+    /* Where the timer runs, the main loop or the monitor I/O thread */
+    AioContext *ctx;
+    QEMUTimer *timer;
+    QTAILQ_ENTRY(StatsSubscription) next;
+} StatsSubscription;
+
+/* Protected by the BQL */
+static QTAILQ_HEAD(, StatsSubscription) stats_subscriptions =
+    QTAILQ_HEAD_INITIALIZER(stats_subscriptions);
+
+static StatsSubscription *stats_subscription_find(const char *id)
+{
+    StatsSubscription *sub;
+
+    QTAILQ_FOREACH(sub, &stats_subscriptions, next) {
+        if (g_str_equal(sub->id, id)) {
+            return sub;
+        }
+    }
+    return NULL;
+}
+
+static void stats_subscription_cb(void *opaque)
+{
+    StatsSubscription *sub = opaque;
+    StatsResultList *results;
+    Error *err = NULL;
+
+    results = qmp_query_stats(sub->filter, &err);
+    if (err) {
+        error_prepend(&err, "Stopping stats subscription '%s': ", sub->id);
+        error_report_err(err);
+        return;
+    }
+
+    qapi_event_send_stats(sub->id, results);
+    qapi_free_StatsResultList(results);
+    timer_mod(sub->timer,
+              qemu_clock_get_ms(QEMU_CLOCK_REALTIME) + sub->interval);
+}
+
+static void stats_subscription_stop_bh(void *opaque)
+{
+    StatsSubscription *sub = opaque;
+
+    timer_free(sub->timer);
+}
+
+static void stats_subscription_free(StatsSubscription *sub)
+{
+    if (sub->ctx == qemu_get_aio_context()) {
+        timer_free(sub->timer);
+    } else {
+        /* The callback may be running in the I/O thread */
+        aio_wait_bh_oneshot(sub->ctx, stats_subscription_stop_bh, sub);
+    }
+
+    QTAILQ_REMOVE(&stats_subscriptions, sub, next);
+    qapi_free_StatsFilter(sub->filter);
+    g_free(sub->id);
+    g_free(sub);
+}
+
+void qmp_stats_subscribe(const char *id, uint32_t interval,
+                         StatsFilter *filter, Error **errp)
+{
+    StatsSubscription *sub;
+
+    if (!interval) {
+        error_setg(errp, "Parameter 'interval' must be positive");
+        return;
+    }
+    if (stats_subscription_find(id)) {
+        error_setg(errp, "Stats subscription '%s' already exists", id);
+        return;
+    }
+
+    sub = g_new0(StatsSubscription, 1);
+    sub->id = g_strdup(id);
+    sub->filter = QAPI_CLONE(StatsFilter, filter);
+    sub->interval = interval;
+    sub->ctx = qemu_get_aio_context();
+    if (mon_iothread && !stats_filter_needs_bql(filter)) {
+        sub->ctx = iothread_get_aio_context(mon_iothread);
+    }
+    sub->timer = aio_timer_new(sub->ctx, QEMU_CLOCK_REALTIME, SCALE_MS,
+                               stats_subscription_cb, sub);
+    QTAILQ_INSERT_TAIL(&stats_subscriptions, sub, next);
+
+    timer_mod(sub->timer, qemu_clock_get_ms(QEMU_CLOCK_REALTIME) + interval);
+}
+
+void qmp_stats_unsubscribe(const char *id, Error **errp)
+{
+    StatsSubscription *sub = stats_subscription_find(id);
+
+    if (!sub) {
+        error_setg(errp, "Stats subscription '%s' not found", id);
+        return;
+    }
+    stats_subscription_free(sub);
+}
+
+void monitor_stats_cleanup(void)
+{
+    while (!QTAILQ_EMPTY(&stats_subscriptions)) {
+        stats_subscription_free(QTAILQ_FIRST(&stats_subscriptions));
+    }
+}
@@ -27,7 +27,7 @@
 #include "trace.h"
 #include "nbd-internal.h"
 #include "qemu/units.h"
-#include "qemu/memalign.h"
+#include "system/iothread.h"
 
 #define NBD_META_ID_BASE_ALLOCATION 0
 #define NBD_META_ID_ALLOCATION_DEPTH 1
@@ -42,6 +42,25 @@
  */
 #define NBD_MAX_BLOCK_STATUS_EXTENTS (1 * MiB / 8)
 
+/*
+ * NBD_MAX_BITMAP_EXTENTS_EXT: 16 MiB of extents data.  Dirty bitmaps of
+ * large disks are fragmented and clients read them from start to end, so
+ * with extended headers they get more extents per reply.  The array only
+ * grows as far as the bitmap needs.
+ */
+#define NBD_MAX_BITMAP_EXTENTS_EXT (16 * MiB / sizeof(NBDExtent64))
+#define NBD_EXTENT_ARRAY_MIN_ALLOC 1024
+
+/*
+ * Read payloads smaller than NBD_ZERO_COPY_MIN_SIZE are always copied,
+ * because pinning the pages and processing the completion costs more than
+ * the copy.  At most NBD_ZERO_COPY_MAX_PENDING bytes of read buffers may be
+ * waiting for the kernel to complete a zero copy send; beyond that, replies
+ * are copied until completions catch up.
+ */
+#define NBD_ZERO_COPY_MIN_SIZE (16 * KiB)
+#define NBD_ZERO_COPY_MAX_PENDING (64 * MiB)
+
 static int system_errno_to_nbd_errno(int err)
 {
     switch (err) {
@@ -82,9 +101,19 @@ typedef struct NBDRequestData NBDRequestData;
 struct NBDRequestData {
     NBDClient *client;
     uint8_t *data;
+    uint64_t data_size;
+    bool zero_copy; /* @data may be sent with MSG_ZEROCOPY */
     bool complete;
 };
 
+/* A read buffer that the kernel may still be sending with MSG_ZEROCOPY */
+typedef struct NBDZeroCopyBuffer {
+    void *data;
+    uint64_t size;
+    ssize_t seq; /* Free once sioc->zero_copy_sent reaches this */
+    QSIMPLEQ_ENTRY(NBDZeroCopyBuffer) next;
+} NBDZeroCopyBuffer;
+
 struct NBDExport {
     BlockExport common;
 
@@ -101,6 +130,13 @@ struct NBDExport {
     bool allocation_depth;
     BdrvDirtyBitmap **export_bitmaps;
     size_t nr_export_bitmaps;
+
+    bool zero_copy;
+
+    /* IOThreads that client connections are distributed across */
+    IOThread **iothreads;
+    size_t nr_iothreads;
+    size_t next_iothread;
 };
 
 static QTAILQ_HEAD(, NBDExport) exports = QTAILQ_HEAD_INITIALIZER(exports);
@@ -129,6 +165,7 @@ struct NBDClient {
     QemuMutex lock;
 
     NBDExport *exp;
+    AioContext *ctx; /* If non-NULL, overrides the export AioContext */
     QCryptoTLSCreds *tlscreds;
     char *tlsauthz;
     uint32_t handshake_max_secs;
@@ -149,6 +186,11 @@ struct NBDClient {
 
     uint32_t check_align; /* If non-zero, check for aligned client requests */
 
+    bool zero_copy; /* Send read payloads with MSG_ZEROCOPY */
+    /* Buffers waiting for zero copy completion, protected by lock */
+    QSIMPLEQ_HEAD(, NBDZeroCopyBuffer) zero_copy_bufs;
+    uint64_t zero_copy_pending; /* protected by lock */
+
     NBDMode mode;
     NBDMetaContexts contexts; /* Negotiated meta contexts */
 
@@ -1556,6 +1598,52 @@ static int coroutine_fn nbd_receive_request(NBDClient *client, NBDRequest *reque
 
 #define MAX_NBD_REQUESTS 16
 
+/* The AioContext where the requests of @client are processed */
+static AioContext *nbd_client_aio_context(NBDClient *client)
+{
+    return client->ctx ?: client->exp->common.ctx;
+}
+
+/*
+ * Free the zero copy buffers that the kernel has finished sending.
+ * Runs in export AioContext with client->lock held.
+ */
+static void nbd_zero_copy_reap(NBDClient *client)
+{
+    NBDZeroCopyBuffer *buf;
+
+    if (QSIMPLEQ_EMPTY(&client->zero_copy_bufs)) {
+        return;
+    }
+
+    /* Errors are reported by the next write to the socket */
+    qio_channel_socket_reap_zero_copy(client->sioc, NULL);
+
+    while ((buf = QSIMPLEQ_FIRST(&client->zero_copy_bufs)) &&
+           client->sioc->zero_copy_sent >= buf->seq) {
+        QSIMPLEQ_REMOVE_HEAD(&client->zero_copy_bufs, next);
+        client->zero_copy_pending -= buf->size;
+        qemu_blockfree_pooled(buf->data, buf->size);
+        g_free(buf);
+    }
+}
+
+/*
+ * Once the client is gone, the socket is closed and nothing can be sent
+ * from the remaining buffers anymore.
+ */
+static void nbd_zero_copy_free_all(NBDClient *client)
+{
+    NBDZeroCopyBuffer *buf;
+
+    while ((buf = QSIMPLEQ_FIRST(&client->zero_copy_bufs))) {
+        QSIMPLEQ_REMOVE_HEAD(&client->zero_copy_bufs, next);
+        qemu_blockfree_pooled(buf->data, buf->size);
+        g_free(buf);
+    }
+    client->zero_copy_pending = 0;
+}
+
 /* Runs in export AioContext and main loop thread */
 void nbd_client_get(NBDClient *client)
 {
@@ -1583,6 +1671,7 @@ void nbd_client_put(NBDClient *client)
             blk_exp_unref(&client->exp->common);
         }
         g_free(client->contexts.bitmaps);
+        nbd_zero_copy_free_all(client);
         qemu_mutex_destroy(&client->lock);
         g_free(client);
     }
@@ -1655,8 +1744,27 @@ static void nbd_request_put(NBDRequestData *req)
 {
     NBDClient *client = req->client;
 
-    if (req->data) {
-        qemu_vfree(req->data);
+    if (client->zero_copy) {
+        nbd_zero_copy_reap(client);
+    }
+
+    if (req->zero_copy &&
+        client->sioc->zero_copy_sent < client->sioc->zero_copy_queued) {
+        NBDZeroCopyBuffer *buf = g_new(NBDZeroCopyBuffer, 1);
+
+        /*
+         * Any zero copy send of this buffer was queued before now, so it is
+         * safe to free once everything queued so far has completed.
+         */
+        *buf = (NBDZeroCopyBuffer) {
+            .data = req->data,
+            .size = req->data_size,
+            .seq = client->sioc->zero_copy_queued,
+        };
+        QSIMPLEQ_INSERT_TAIL(&client->zero_copy_bufs, buf, next);
+        client->zero_copy_pending += buf->size;
+    } else if (req->data) {
+        qemu_blockfree_pooled(req->data, req->data_size);
     }
     g_free(req);
 
@@ -1755,7 +1863,7 @@ static bool nbd_drained_poll(void *opaque)
                  * qio_channel_yield().
                  */
                 if (client->recv_coroutine != NULL && client->read_yielding) {
-                    aio_bh_schedule_oneshot(nbd_export_aio_context(client->exp),
+                    aio_bh_schedule_oneshot(nbd_client_aio_context(client),
                                             nbd_wake_read_bh, client);
                 }
 
@@ -1805,6 +1913,7 @@ static int nbd_export_create(BlockExport *blk_exp, BlockExportOptions *exp_args,
     uint64_t perm, shared_perm;
     bool readonly = !exp_args->writable;
     BlockDirtyBitmapOrStrList *bitmaps;
+    strList *iothreads;
     size_t i;
     int ret;
 
@@ -1831,6 +1940,13 @@ static int nbd_export_create(BlockExport *blk_exp, BlockExportOptions *exp_args,
         return -EEXIST;
     }
 
+    for (iothreads = arg->iothreads; iothreads; iothreads = iothreads->next) {
+        if (!iothread_by_id(iothreads->value)) {
+            error_setg(errp, "iothread \"%s\" not found", iothreads->value);
+            return -EINVAL;
+        }
+    }
+
     size = blk_getlength(blk);
     if (size < 0) {
         error_setg_errno(errp, -size,
@@ -1933,6 +2049,17 @@ static int nbd_export_create(BlockExport *blk_exp, BlockExportOptions *exp_args,
     }
 
     exp->allocation_depth = arg->allocation_depth;
+    exp->zero_copy = arg->zero_copy;
+
+    for (iothreads = arg->iothreads; iothreads; iothreads = iothreads->next) {
+        exp->nr_iothreads++;
+    }
+    exp->iothreads = g_new0(IOThread *, exp->nr_iothreads);
+    for (i = 0, iothreads = arg->iothreads; iothreads;
+         i++, iothreads = iothreads->next) {
+        exp->iothreads[i] = iothread_by_id(iothreads->value);
+        object_ref(OBJECT(exp->iothreads[i]));
+    }
 
     /*
      * We need to inhibit request queuing in the block layer to ensure we can
@@ -2023,6 +2150,13 @@ static void nbd_export_delete(BlockExport *blk_exp)
     for (i = 0; i < exp->nr_export_bitmaps; i++) {
         bdrv_dirty_bitmap_set_busy(exp->export_bitmaps[i], false);
     }
+
+    for (i = 0; i < exp->nr_iothreads; i++) {
+        object_unref(OBJECT(exp->iothreads[i]));
+    }
+    g_free(exp->iothreads);
+    exp->iothreads = NULL;
+    exp->nr_iothreads = 0;
 }
 
 const BlockExportDriver blk_exp_nbd = {
@@ -2051,6 +2185,50 @@ static int coroutine_fn nbd_co_send_iov(NBDClient *client, struct iovec *iov,
     return ret;
 }
 
+/*
+ * Like nbd_co_send_iov(), but the last element of @iov is the payload of a
+ * read reply.  It lives in the request buffer, which nbd_request_put() keeps
+ * around until the kernel is done with it, so it may be sent with zero copy.
+ */
+static int coroutine_fn nbd_co_send_read_iov(NBDClient *client,
+                                             struct iovec *iov, unsigned niov,
+                                             Error **errp)
+{
+    struct iovec *payload = &iov[niov - 1];
+    bool zero_copy = false;
+    int ret;
+
+    if (client->zero_copy && payload->iov_len >= NBD_ZERO_COPY_MIN_SIZE) {
+        WITH_QEMU_LOCK_GUARD(&client->lock) {
+            zero_copy = client->zero_copy_pending < NBD_ZERO_COPY_MAX_PENDING;
+        }
+    }
+    if (!zero_copy) {
+        return nbd_co_send_iov(client, iov, niov, errp);
+    }
+
+    g_assert(qemu_in_coroutine());
+    qemu_co_mutex_lock(&client->send_lock);
+    client->send_coroutine = qemu_coroutine_self();
+
+    /*
+     * The reply headers are on the stack and must be copied.  The channel is
+     * corked while the request is handled, so no extra segment is sent.
+     */
+    ret = qio_channel_writev_all(client->ioc, iov, niov - 1, errp);
+    if (ret == 0) {
+        ret = qio_channel_writev_full_all(client->ioc, payload, 1, NULL, 0,
+                                          QIO_CHANNEL_WRITE_FLAG_ZERO_COPY,
+                                          errp);
+    }
+    ret = ret < 0 ? -EIO : 0;
+
+    client->send_coroutine = NULL;
+    qemu_co_mutex_unlock(&client->send_lock);
+
+    return ret;
+}
+
 static inline void set_be_simple_reply(NBDSimpleReply *reply, uint64_t error,
                                        uint64_t cookie)
 {
@@ -2082,6 +2260,9 @@ static int coroutine_fn nbd_co_send_simple_reply(NBDClient *client,
                                    nbd_err_lookup(nbd_err), len);
     set_be_simple_reply(&reply, nbd_err, request->cookie);
 
+    if (len) {
+        return nbd_co_send_read_iov(client, iov, 2, errp);
+    }
     return nbd_co_send_iov(client, iov, 2, errp);
 }
 
@@ -2163,7 +2344,7 @@ static int coroutine_fn nbd_co_send_chunk_read(NBDClient *client,
                  NBD_REPLY_TYPE_OFFSET_DATA, request);
     stq_be_p(&chunk.offset, offset);
 
-    return nbd_co_send_iov(client, iov, 3, errp);
+    return nbd_co_send_read_iov(client, iov, 3, errp);
 }
 
 static int coroutine_fn nbd_co_send_chunk_error(NBDClient *client,
@@ -2264,6 +2445,7 @@ static int coroutine_fn nbd_co_send_sparse_read(NBDClient *client,
 typedef struct NBDExtentArray {
     NBDExtent64 *extents;
     unsigned int nb_alloc;
+    unsigned int nb_max;
     unsigned int count;
     uint64_t total_length;
     bool extended;
@@ -2271,14 +2453,16 @@ typedef struct NBDExtentArray {
     bool converted_to_be;
 } NBDExtentArray;
 
-static NBDExtentArray *nbd_extent_array_new(unsigned int nb_alloc,
+/* The array starts small and grows up to @nb_max extents */
+static NBDExtentArray *nbd_extent_array_new(unsigned int nb_max,
                                             NBDMode mode)
 {
     NBDExtentArray *ea = g_new0(NBDExtentArray, 1);
 
     assert(mode >= NBD_MODE_STRUCTURED);
-    ea->nb_alloc = nb_alloc;
-    ea->extents = g_new(NBDExtent64, nb_alloc);
+    ea->nb_max = nb_max;
+    ea->nb_alloc = MIN(nb_max, NBD_EXTENT_ARRAY_MIN_ALLOC);
+    ea->extents = g_new(NBDExtent64, ea->nb_alloc);
     ea->extended = mode >= NBD_MODE_EXTENDED;
     ea->can_add = true;
 
@@ -2366,8 +2550,12 @@ static int nbd_extent_array_add(NBDExtentArray *ea,
     }
 
     if (ea->count >= ea->nb_alloc) {
-        ea->can_add = false;
-        return -1;
+        if (ea->nb_alloc == ea->nb_max) {
+            ea->can_add = false;
+            return -1;
+        }
+        ea->nb_alloc = MIN((uint64_t)ea->nb_alloc * 2, ea->nb_max);
+        ea->extents = g_renew(NBDExtent64, ea->extents, ea->nb_alloc);
     }
 
     ea->total_length += length;
@@ -2544,9 +2732,15 @@ static int coroutine_fn nbd_co_send_bitmap(NBDClient *client,
                                            bool last, uint32_t context_id,
                                            Error **errp)
 {
-    unsigned int nb_extents = dont_fragment ? 1 : NBD_MAX_BLOCK_STATUS_EXTENTS;
-    g_autoptr(NBDExtentArray) ea =
-        nbd_extent_array_new(nb_extents, client->mode);
+    unsigned int nb_extents = NBD_MAX_BLOCK_STATUS_EXTENTS;
+    g_autoptr(NBDExtentArray) ea = NULL;
+
+    if (dont_fragment) {
+        nb_extents = 1;
+    } else if (client->mode >= NBD_MODE_EXTENDED) {
+        nb_extents = NBD_MAX_BITMAP_EXTENTS_EXT;
+    }
+    ea = nbd_extent_array_new(nb_extents, client->mode);
 
     bitmap_to_extents(bitmap, offset, length, ea);
 
@@ -2763,12 +2957,14 @@ static int coroutine_fn nbd_co_receive_request(NBDRequestData *req,
     }
     if (allocate_buffer) {
         /* READ, WRITE */
-        req->data = blk_try_blockalign(client->exp->common.blk,
-                                       request->len);
+        req->data = qemu_try_blockalign_pooled(
+            blk_bs(client->exp->common.blk), request->len);
         if (req->data == NULL) {
             error_setg(errp, "No memory");
             return -ENOMEM;
         }
+        req->data_size = request->len;
+        req->zero_copy = client->zero_copy && request->type == NBD_CMD_READ;
     }
     if (payload_len) {
         if (payload_okay) {
@@ -3209,7 +3405,7 @@ static void nbd_client_receive_next_request(NBDClient *client)
         nbd_client_get(client);
         req = nbd_request_get(client);
         client->recv_coroutine = qemu_coroutine_create(nbd_trip, req);
-        aio_co_schedule(client->exp->common.ctx, client->recv_coroutine);
+        aio_co_schedule(nbd_client_aio_context(client), client->recv_coroutine);
     }
 }
 
@@ -3221,6 +3417,49 @@ static void nbd_handshake_timer_cb(void *opaque)
     qio_channel_shutdown(ioc, QIO_CHANNEL_SHUTDOWN_BOTH, NULL);
 }
 
+/*
+ * Assign @client to the next IOThread of its export, if the export is
+ * served from several IOThreads.  Runs in the main loop thread before the
+ * first request is received.
+ */
+static void nbd_client_assign_iothread(NBDClient *client)
+{
+    NBDExport *exp = client->exp;
+
+    if (!exp->nr_iothreads) {
+        return;
+    }
+
+    client->ctx = iothread_get_aio_context(exp->iothreads[exp->next_iothread]);
+    exp->next_iothread = (exp->next_iothread + 1) % exp->nr_iothreads;
+    trace_nbd_client_assign_iothread(exp->name, client->ctx);
+}
+
+static void nbd_client_setup_zero_copy(NBDClient *client)
+{
+    Error *local_err = NULL;
+
+    if (!client->exp->zero_copy) {
+        return;
+    }
+
+    /* TLS encrypts into its own buffers, so there is nothing to gain */
+    if (client->ioc != QIO_CHANNEL(client->sioc)) {
+        trace_nbd_client_zero_copy(client->exp->name, "TLS connection");
+        return;
+    }
+
+    if (qio_channel_socket_enable_zero_copy(client->sioc, &local_err) < 0) {
+        trace_nbd_client_zero_copy(client->exp->name,
+                                   error_get_pretty(local_err));
+        error_free(local_err);
+        return;
+    }
+
+    trace_nbd_client_zero_copy(client->exp->name, "enabled");
+    client->zero_copy = true;
+}
+
 static coroutine_fn void nbd_co_client_start(void *opaque)
 {
     NBDClient *client = opaque;
@@ -3255,6 +3494,8 @@ static coroutine_fn void nbd_co_client_start(void *opaque)
     }
 
     timer_free(handshake_timer);
+    nbd_client_assign_iothread(client);
+    nbd_client_setup_zero_copy(client);
     WITH_QEMU_LOCK_GUARD(&client->lock) {
         nbd_client_receive_next_request(client);
     }
@@ -3292,6 +3533,7 @@ void nbd_client_new(QIOChannelSocket *sioc,
     object_ref(OBJECT(client->ioc));
     client->close_fn = close_fn;
     client->owner = owner;
+    QSIMPLEQ_INIT(&client->zero_copy_bufs);
 
     nbd_set_socket_send_buffer(sioc);
 
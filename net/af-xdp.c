@@ -16,6 +16,7 @@
 #include <linux/if_link.h>
 #include <linux/if_xdp.h>
 #include <net/if.h>
+#include <sys/mman.h>
 #include <xdp/xsk.h>
 
 #include "clients.h"
@@ -47,6 +48,8 @@ typedef struct AFXDPState {
     uint64_t             *pool;
     uint32_t             n_pool;
     char                 *buffer;
+    uint64_t             buffer_size;
+    bool                 hugepages;
     struct xsk_umem      *umem;
 
     uint32_t             xdp_flags;
@@ -55,6 +58,8 @@ typedef struct AFXDPState {
     char                 *map_path;
     int                  map_fd;
     uint32_t             map_start_index;
+
+    AioContext           *ctx;
 } AFXDPState;
 
 #define AF_XDP_BATCH_SIZE 64
@@ -62,13 +67,30 @@ typedef struct AFXDPState {
 static void af_xdp_send(void *opaque);
 static void af_xdp_writable(void *opaque);
 
+/* Event loop of the af-xdp backend, the main loop unless moved. */
+static AioContext *af_xdp_get_aio_context(AFXDPState *s)
+{
+    return s->ctx ? s->ctx : iohandler_get_aio_context();
+}
+
 /* Set the event-loop handlers for the af-xdp backend. */
 static void af_xdp_update_fd_handler(AFXDPState *s)
 {
-    qemu_set_fd_handler(xsk_socket__fd(s->xsk),
-                        s->read_poll ? af_xdp_send : NULL,
-                        s->write_poll ? af_xdp_writable : NULL,
-                        s);
+    aio_set_fd_handler(af_xdp_get_aio_context(s), xsk_socket__fd(s->xsk),
+                       s->read_poll ? af_xdp_send : NULL,
+                       s->write_poll ? af_xdp_writable : NULL,
+                       NULL, NULL, s);
+}
+
+/* Move the event-loop handlers to @ctx, NULL for the main loop. */
+static void af_xdp_set_aio_context(NetClientState *nc, AioContext *ctx)
+{
+    AFXDPState *s = DO_UPCAST(AFXDPState, nc, nc);
+
+    aio_set_fd_handler(af_xdp_get_aio_context(s), xsk_socket__fd(s->xsk),
+                       NULL, NULL, NULL, NULL, NULL);
+    s->ctx = ctx;
+    af_xdp_update_fd_handler(s);
 }
 
 /* Update the read handler. */
@@ -142,10 +164,11 @@ static void af_xdp_writable(void *opaque)
     qemu_flush_queued_packets(&s->nc);
 }
 
-static ssize_t af_xdp_receive(NetClientState *nc,
-                              const uint8_t *buf, size_t size)
+static ssize_t af_xdp_receive_iov(NetClientState *nc,
+                                  const struct iovec *iov, int iovcnt)
 {
     AFXDPState *s = DO_UPCAST(AFXDPState, nc, nc);
+    size_t size = iov_size(iov, iovcnt);
     struct xdp_desc *desc;
     uint32_t idx;
     void *data;
@@ -171,8 +194,9 @@ static ssize_t af_xdp_receive(NetClientState *nc,
     desc->addr = s->pool[--s->n_pool];
     desc->len = size;
 
+    /* Gather the packet straight into the frame, without a bounce buffer. */
     data = xsk_umem__get_data(s->buffer, desc->addr);
-    memcpy(data, buf, size);
+    iov_to_buf(iov, iovcnt, 0, data, size);
 
     xsk_ring_prod__submit(&s->tx, 1);
     s->outstanding_tx++;
@@ -184,6 +208,31 @@ static ssize_t af_xdp_receive(NetClientState *nc,
     return size;
 }
 
+static ssize_t af_xdp_receive(NetClientState *nc,
+                              const uint8_t *buf, size_t size)
+{
+    struct iovec iov = {
+        .iov_base = (void *)buf,
+        .iov_len = size,
+    };
+
+    return af_xdp_receive_iov(nc, &iov, 1);
+}
+
+static void af_xdp_umem_free(AFXDPState *s)
+{
+    if (!s->buffer) {
+        return;
+    }
+
+    if (s->hugepages) {
+        munmap(s->buffer, s->buffer_size);
+    } else {
+        qemu_vfree(s->buffer);
+    }
+    s->buffer = NULL;
+}
+
 /*
  * Complete a previous send (backend --> guest) and enable the
  * fd_read callback.
@@ -222,7 +271,10 @@ static void af_xdp_fq_refill(AFXDPState *s, uint32_t n)
 static void af_xdp_send(void *opaque)
 {
     uint32_t i, n_rx, idx = 0;
+    NetBatchPacket pkts[AF_XDP_BATCH_SIZE];
+    struct iovec iov[AF_XDP_BATCH_SIZE];
     AFXDPState *s = opaque;
+    int sent;
 
     n_rx = xsk_ring_cons__peek(&s->rx, AF_XDP_BATCH_SIZE, &idx);
     if (!n_rx) {
@@ -231,31 +283,31 @@ static void af_xdp_send(void *opaque)
 
     for (i = 0; i < n_rx; i++) {
         const struct xdp_desc *desc;
-        struct iovec iov;
 
         desc = xsk_ring_cons__rx_desc(&s->rx, idx++);
 
-        iov.iov_base = xsk_umem__get_data(s->buffer, desc->addr);
-        iov.iov_len = desc->len;
+        iov[i].iov_base = xsk_umem__get_data(s->buffer, desc->addr);
+        iov[i].iov_len = desc->len;
+        pkts[i].iov = &iov[i];
+        pkts[i].iovcnt = 1;
 
         s->pool[s->n_pool++] = desc->addr;
+    }
 
-        if (!qemu_sendv_packet_async(&s->nc, &iov, 1,
-                                     af_xdp_send_completed)) {
-            /*
-             * The peer does not receive anymore.  Packet is queued, stop
-             * reading from the backend until af_xdp_send_completed().
-             */
-            af_xdp_read_poll(s, false);
-
-            /* Return unused descriptors to not break the ring cache. */
-            xsk_ring_cons__cancel(&s->rx, n_rx - i - 1);
-            n_rx = i + 1;
-            break;
-        }
+    /*
+     * The packets the peer does not take are copied into its queue, so
+     * that all the descriptors can be given back right away.
+     */
+    sent = qemu_sendv_batch_async(&s->nc, pkts, n_rx, af_xdp_send_completed);
+    if (sent < n_rx) {
+        /*
+         * The peer does not receive anymore.  Stop reading from the
+         * backend until af_xdp_send_completed().
+         */
+        af_xdp_read_poll(s, false);
     }
 
-    /* Release actually sent descriptors and try to re-fill. */
+    /* Release sent descriptors and try to re-fill. */
     xsk_ring_cons__release(&s->rx, n_rx);
     af_xdp_fq_refill(s, AF_XDP_BATCH_SIZE);
 }
@@ -276,8 +328,7 @@ static void af_xdp_cleanup(NetClientState *nc)
     s->pool = NULL;
     xsk_umem__delete(s->umem);
     s->umem = NULL;
-    qemu_vfree(s->buffer);
-    s->buffer = NULL;
+    af_xdp_umem_free(s);
 
     if (s->map_fd >= 0) {
         idx = nc->queue_index + s->map_start_index;
@@ -310,8 +361,22 @@ static int af_xdp_umem_create(AFXDPState *s, int sock_fd, Error **errp)
                + XSK_RING_CONS__DEFAULT_NUM_DESCS) * 2;
     size = n_descs * XSK_UMEM__DEFAULT_FRAME_SIZE;
 
-    s->buffer = qemu_memalign(qemu_real_host_page_size(), size);
-    memset(s->buffer, 0, size);
+    if (s->hugepages) {
+        /* Fewer IOTLB and TLB misses for the device and for us. */
+        s->buffer = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (s->buffer == MAP_FAILED) {
+            s->buffer = NULL;
+            error_setg_errno(errp, errno,
+                             "failed to allocate huge pages for umem of %s "
+                             "queue_index: %d", s->ifname, s->nc.queue_index);
+            return -1;
+        }
+    } else {
+        s->buffer = qemu_memalign(qemu_real_host_page_size(), size);
+        memset(s->buffer, 0, size);
+    }
+    s->buffer_size = size;
 
     if (sock_fd < 0) {
         ret = xsk_umem__create(&s->umem, s->buffer, size,
@@ -322,7 +387,7 @@ static int af_xdp_umem_create(AFXDPState *s, int sock_fd, Error **errp)
     }
 
     if (ret) {
-        qemu_vfree(s->buffer);
+        af_xdp_umem_free(s);
         error_setg_errno(errp, errno,
                          "failed to create umem for %s queue_index: %d",
                          s->ifname, s->nc.queue_index);
@@ -361,6 +426,10 @@ static int af_xdp_socket_create(AFXDPState *s,
         cfg.bind_flags |= XDP_COPY;
     }
 
+    if (opts->has_zero_copy && opts->zero_copy) {
+        cfg.bind_flags |= XDP_ZEROCOPY;
+    }
+
     queue_id = s->nc.queue_index;
     if (opts->has_start_queue && opts->start_queue > 0) {
         queue_id += opts->start_queue;
@@ -437,8 +506,10 @@ static NetClientInfo net_af_xdp_info = {
     .type = NET_CLIENT_DRIVER_AF_XDP,
     .size = sizeof(AFXDPState),
     .receive = af_xdp_receive,
+    .receive_iov = af_xdp_receive_iov,
     .poll = af_xdp_poll,
     .cleanup = af_xdp_cleanup,
+    .set_aio_context = af_xdp_set_aio_context,
 };
 
 static int *parse_socket_fds(const char *sock_fds_str,
@@ -516,6 +587,11 @@ int net_init_af_xdp(const Netdev *netdev,
         error_setg(errp, "'sock-fds' and 'map-path' are mutually exclusive");
         return -1;
     }
+    if (opts->has_force_copy && opts->force_copy &&
+        opts->has_zero_copy && opts->zero_copy) {
+        error_setg(errp, "'force-copy' and 'zero-copy' are mutually exclusive");
+        return -1;
+    }
     if (!opts->map_path && opts->has_map_start_index) {
         error_setg(errp, "'map-start-index' requires 'map-path'");
         return -1;
@@ -549,6 +625,7 @@ int net_init_af_xdp(const Netdev *netdev,
         pstrcpy(s->ifname, sizeof(s->ifname), opts->ifname);
         s->ifindex = ifindex;
         s->inhibit = inhibit;
+        s->hugepages = opts->has_umem_hugepages && opts->umem_hugepages;
 
         s->map_path = g_strdup(opts->map_path);
         s->map_start_index = map_start_index;
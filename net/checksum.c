@@ -18,25 +18,144 @@
 #include "qemu/osdep.h"
 #include "net/checksum.h"
 #include "net/eth.h"
+#include "host/cpuinfo.h"
+#include "crypto/clmul.h"
+
+/*
+ * Sum of the big-endian 16-bit words of @buf, before folding; @buf[0]
+ * is the most significant byte of the first word.
+ */
+typedef uint64_t (*net_checksum_add_fn)(const uint8_t *buf, int len);
+
+static uint64_t net_checksum_add_int(const uint8_t *buf, int len)
+{
+    uint64_t sum = 0;
+
+    /*
+     * Add big-endian 32-bit words, eight bytes at a time: since 2^16 is 1
+     * modulo 0xffff, the carries of a 64-bit accumulator fold back into
+     * the same ones' complement sum as adding 16-bit words one by one.
+     */
+    while (len >= 8) {
+        uint64_t v = ldq_be_p(buf);
+
+        sum += (v >> 32) + (uint32_t)v;
+        buf += 8;
+        len -= 8;
+    }
+    if (len >= 4) {
+        sum += ldl_be_p(buf);
+        buf += 4;
+        len -= 4;
+    }
+    if (len >= 2) {
+        sum += lduw_be_p(buf);
+        buf += 2;
+        len -= 2;
+    }
+    if (len) {
+        sum += (uint32_t)buf[0] << 8;
+    }
+    return sum;
+}
+
+static inline uint32_t net_checksum_fold(uint64_t sum)
+{
+    sum = (sum & 0xffffffff) + (sum >> 32);
+    sum = (sum & 0xffffffff) + (sum >> 32);
+    return net_checksum_finish(sum) ^ 0xffff;
+}
+
+#include "host/checksum.c.inc"
+
+static net_checksum_add_fn net_checksum_add_accel;
+static unsigned accel_index;
 
 uint32_t net_checksum_add_cont(int len, uint8_t *buf, int seq)
 {
-    uint32_t sum1 = 0, sum2 = 0;
+    uint32_t sum16 = net_checksum_fold(net_checksum_add_accel(buf, len));
+
+    /* Odd offsets in the packet swap the bytes of each 16-bit word */
+    return seq & 1 ? bswap16(sum16) : sum16;
+}
+
+bool test_net_checksum_next_accel(void)
+{
+    if (accel_index != 0) {
+        net_checksum_add_accel = accel_table[--accel_index];
+        return true;
+    }
+    return false;
+}
+
+static void __attribute__((constructor)) init_accel(void)
+{
+    accel_index = best_accel();
+    net_checksum_add_accel = accel_table[accel_index];
+}
+
+static bool net_toeplitz_generic;
+
+void net_toeplitz_table_init(NetToeplitzTable *table, const uint8_t *key)
+{
+    /* Input bits past the key are zero, so are the key bits past its end */
+    uint8_t padded[NET_TOEPLITZ_KEY_SIZE + 16] = { 0 };
+    int i;
+
+    memcpy(table->key, key, NET_TOEPLITZ_KEY_SIZE);
+    memcpy(padded, key, NET_TOEPLITZ_KEY_SIZE);
+    for (i = 0; i < ARRAY_SIZE(table->lo); i++) {
+        /*
+         * Input bit j of these 8 bytes selects key bits 64 * i + j up to
+         * 64 * i + j + 31; bit m of lo:hi is key bit 64 * i + m.
+         */
+        table->lo[i] = revbit64(ldq_be_p(padded + i * 8));
+        table->hi[i] = revbit64(ldq_be_p(padded + i * 8 + 8)) & 0x7fffffff;
+    }
+}
+
+uint32_t net_toeplitz_hash(const NetToeplitzTable *table,
+                           const uint8_t *input, size_t len)
+{
+    uint8_t padded[ARRAY_SIZE(table->lo) * 8] = { 0 };
+    uint64_t acc = 0;
     int i;
 
-    for (i = 0; i < len - 1; i += 2) {
-        sum1 += (uint32_t)buf[i];
-        sum2 += (uint32_t)buf[i + 1];
+    assert(len <= NET_TOEPLITZ_MAX_INPUT);
+
+    if (!HAVE_CLMUL_ACCEL || net_toeplitz_generic) {
+        net_toeplitz_key key;
+        uint32_t result = 0;
+
+        net_toeplitz_key_init(&key, (uint8_t *)table->key);
+        net_toeplitz_add(&result, (uint8_t *)input, len, &key);
+        return result;
     }
-    if (i < len) {
-        sum1 += (uint32_t)buf[i];
+
+    /*
+     * With the input bits in big-endian order and the key bits reversed,
+     * bit 63 + r of their product is bit r of the hash, counting from the
+     * most significant one.
+     */
+    memcpy(padded, input, len);
+    for (i = 0; i < DIV_ROUND_UP(len, 8); i++) {
+        uint64_t x = ldq_be_p(padded + i * 8);
+        Int128 lo = clmul_64(x, table->lo[i]);
+        Int128 hi = clmul_64(x, table->hi[i]);
+
+        acc ^= int128_getlo(int128_urshift(lo, 63)) ^
+               (int128_getlo(hi) << 1);
     }
+    return revbit32(acc);
+}
 
-    if (seq & 1) {
-        return sum1 + (sum2 << 8);
-    } else {
-        return sum2 + (sum1 << 8);
+bool test_net_toeplitz_next_accel(void)
+{
+    if (HAVE_CLMUL_ACCEL && !net_toeplitz_generic) {
+        net_toeplitz_generic = true;
+        return true;
     }
+    return false;
 }
 
 uint16_t net_checksum_finish(uint32_t sum)
@@ -32,6 +32,7 @@
 
 #include "qemu/aio-wait.h"
 #include "qemu/coroutine.h"
+#include "qemu/thread.h"
 
 #define TYPE_COLO_COMPARE "colo-compare"
 typedef struct CompareState CompareState;
@@ -52,6 +53,7 @@ static NotifierList colo_compare_notifiers =
 
 #define REGULAR_PACKET_CHECK_MS 1000
 #define DEFAULT_TIME_OUT_MS 3000
+#define MAX_WORKER_THREADS 64
 
 /* #define DEBUG_COLO_PACKETS */
 
@@ -83,6 +85,12 @@ static uint32_t max_queue_size;
  *                    |primary |  |secondary    |primary | |secondary
  *                    |packet  |  |packet  +    |packet  | |packet  +
  *                    +--------+  +--------+    +--------+ +--------+
+ *
+ * The connections are spread over shards by the hash of their key, each
+ * with its own conn list and connection table.  With worker_threads set,
+ * each shard is compared by a thread of its own and the iothread only
+ * dispatches the packets and sends the ones released by the comparison;
+ * otherwise there is a single shard, compared in the iothread.
  */
 
 typedef struct SendCo {
@@ -101,6 +109,37 @@ typedef struct SendEntry {
     uint8_t *buf;
 } SendEntry;
 
+typedef struct CompareInput {
+    Packet *pkt;
+    int mode;
+} CompareInput;
+
+typedef struct CompareShard {
+    struct CompareState *s;
+    QemuThread thread;
+
+    /* Protects the input queue and quit, signalled through cond */
+    QemuMutex input_lock;
+    QemuCond cond;
+    /* Packets dispatched to the shard, element type: CompareInput */
+    GQueue input;
+    bool quit;
+
+    /* Protects everything below, held while comparing */
+    QemuMutex lock;
+    /*
+     * Record the connection that through the NIC
+     * Element type: Connection
+     */
+    GQueue conn_list;
+    /* Record the connection without repetition */
+    GHashTable *connection_track_table;
+    /* Primary packets released by the comparison, element type: Packet */
+    GQueue output;
+    /* The comparison found a difference, a checkpoint is needed */
+    bool inconsistent;
+} CompareShard;
+
 struct CompareState {
     Object parent;
 
@@ -120,14 +159,13 @@ struct CompareState {
     bool vnet_hdr;
     uint64_t compare_timeout;
     uint32_t expired_scan_cycle;
+    uint32_t worker_threads;
 
-    /*
-     * Record the connection that through the NIC
-     * Element type: Connection
-     */
-    GQueue conn_list;
-    /* Record the connection without repetition */
-    GHashTable *connection_track_table;
+    /* worker_threads shards, or a single one compared in the iothread */
+    CompareShard *shards;
+    uint32_t nr_shards;
+    /* Sends the packets released by the workers */
+    QEMUBH *output_bh;
 
     IOThread *iothread;
     GMainContext *worker_context;
@@ -238,15 +276,12 @@ static int colo_insert_packet(GQueue *queue, Packet *pkt, uint32_t *max_ack)
 }
 
 /*
- * Return 0 on success, if return -1 means the pkt
- * is unsupported(arp and ipv6) and will be sent later
+ * Return the packet, or NULL if it is unsupported (arp and ipv6) and
+ * has to be sent as is.
  */
-static int packet_enqueue(CompareState *s, int mode, Connection **con)
+static Packet *packet_parse(CompareState *s, int mode)
 {
-    ConnectionKey key;
-    Packet *pkt = NULL;
-    Connection *conn;
-    int ret;
+    Packet *pkt;
 
     if (mode == PRIMARY_IN) {
         pkt = packet_new(s->pri_rs.buf,
@@ -260,17 +295,34 @@ static int packet_enqueue(CompareState *s, int mode, Connection **con)
 
     if (parse_packet_early(pkt)) {
         packet_destroy(pkt, NULL);
-        pkt = NULL;
-        return -1;
+        return NULL;
     }
+    return pkt;
+}
+
+static CompareShard *packet_shard(CompareState *s, Packet *pkt)
+{
+    ConnectionKey key;
+
+    fill_connection_key(pkt, &key, false);
+    return &s->shards[connection_key_hash(&key) % s->nr_shards];
+}
+
+/* Called with shard->lock held */
+static Connection *packet_enqueue(CompareShard *shard, Packet *pkt, int mode)
+{
+    ConnectionKey key;
+    Connection *conn;
+    int ret;
+
     fill_connection_key(pkt, &key, false);
 
-    conn = connection_get(s->connection_track_table,
+    conn = connection_get(shard->connection_track_table,
                           &key,
-                          &s->conn_list);
+                          &shard->conn_list);
 
     if (!conn->processing) {
-        g_queue_push_tail(&s->conn_list, conn);
+        g_queue_push_tail(&shard->conn_list, conn);
         conn->processing = true;
     }
 
@@ -287,9 +339,7 @@ static int packet_enqueue(CompareState *s, int mode, Connection **con)
         pkt = NULL;
     }
 
-    *con = conn;
-
-    return 0;
+    return conn;
 }
 
 static inline bool after(uint32_t seq1, uint32_t seq2)
@@ -297,20 +347,11 @@ static inline bool after(uint32_t seq1, uint32_t seq2)
         return (int32_t)(seq1 - seq2) > 0;
 }
 
-static void colo_release_primary_pkt(CompareState *s, Packet *pkt)
+/* Called with shard->lock held, the packet is sent by the iothread */
+static void colo_release_primary_pkt(CompareShard *shard, Packet *pkt)
 {
-    int ret;
-    ret = compare_chr_send(s,
-                           pkt->data,
-                           pkt->size,
-                           pkt->vnet_hdr_len,
-                           false,
-                           true);
-    if (ret < 0) {
-        error_report("colo send primary packet failed");
-    }
     trace_colo_compare_main("packet same and release packet");
-    packet_destroy_partial(pkt, NULL);
+    g_queue_push_tail(&shard->output, pkt);
 }
 
 /*
@@ -396,7 +437,7 @@ static bool colo_mark_tcp_pkt(Packet *ppkt, Packet *spkt,
     return false;
 }
 
-static void colo_compare_tcp(CompareState *s, Connection *conn)
+static void colo_compare_tcp(CompareShard *shard, Connection *conn)
 {
     Packet *ppkt = NULL, *spkt = NULL;
     int8_t mark;
@@ -427,13 +468,13 @@ sec:
     spkt = g_queue_pop_tail(&conn->secondary_list);
 
     if (ppkt->tcp_seq == ppkt->seq_end) {
-        colo_release_primary_pkt(s, ppkt);
+        colo_release_primary_pkt(shard, ppkt);
         ppkt = NULL;
     }
 
     if (ppkt && conn->compare_seq && !after(ppkt->seq_end, conn->compare_seq)) {
         trace_colo_compare_main("pri: this packet has compared");
-        colo_release_primary_pkt(s, ppkt);
+        colo_release_primary_pkt(shard, ppkt);
         ppkt = NULL;
     }
 
@@ -473,7 +514,7 @@ sec:
 
         if (mark == COLO_COMPARE_FREE_PRIMARY) {
             conn->compare_seq = ppkt->seq_end;
-            colo_release_primary_pkt(s, ppkt);
+            colo_release_primary_pkt(shard, ppkt);
             g_queue_push_tail(&conn->secondary_list, spkt);
             goto pri;
         } else if (mark == COLO_COMPARE_FREE_SECONDARY) {
@@ -482,7 +523,7 @@ sec:
             goto sec;
         } else if (mark == (COLO_COMPARE_FREE_PRIMARY | COLO_COMPARE_FREE_SECONDARY)) {
             conn->compare_seq = ppkt->seq_end;
-            colo_release_primary_pkt(s, ppkt);
+            colo_release_primary_pkt(shard, ppkt);
             packet_destroy(spkt, NULL);
             goto pri;
         }
@@ -495,7 +536,7 @@ sec:
         qemu_hexdump(stderr, "colo-compare spkt", spkt->data, spkt->size);
 #endif
 
-        colo_compare_inconsistency_notify(s);
+        shard->inconsistent = true;
     }
 }
 
@@ -625,23 +666,20 @@ static int colo_old_packet_check_one_conn(Connection *conn,
     if (!g_queue_is_empty(&conn->primary_list)) {
         if (g_queue_find_custom(&conn->primary_list,
                                 &s->compare_timeout,
-                                (GCompareFunc)colo_old_packet_check_one))
-            goto out;
+                                (GCompareFunc)colo_old_packet_check_one)) {
+            return 0;
+        }
     }
 
     if (!g_queue_is_empty(&conn->secondary_list)) {
         if (g_queue_find_custom(&conn->secondary_list,
                                 &s->compare_timeout,
-                                (GCompareFunc)colo_old_packet_check_one))
-            goto out;
+                                (GCompareFunc)colo_old_packet_check_one)) {
+            return 0;
+        }
     }
 
     return 1;
-
-out:
-    /* Do checkpoint will flush old packet */
-    colo_compare_inconsistency_notify(s);
-    return 0;
 }
 
 /*
@@ -652,16 +690,29 @@ out:
 static void colo_old_packet_check(void *opaque)
 {
     CompareState *s = opaque;
+    GCompareFunc check = (GCompareFunc)colo_old_packet_check_one_conn;
+    bool found = false;
+    uint32_t i;
 
     /*
      * If we find one old packet, stop finding job and notify
      * COLO frame do checkpoint.
      */
-    g_queue_find_custom(&s->conn_list, s,
-                        (GCompareFunc)colo_old_packet_check_one_conn);
+    for (i = 0; i < s->nr_shards && !found; i++) {
+        CompareShard *shard = &s->shards[i];
+
+        qemu_mutex_lock(&shard->lock);
+        found = g_queue_find_custom(&shard->conn_list, s, check) != NULL;
+        qemu_mutex_unlock(&shard->lock);
+    }
+
+    if (found) {
+        /* Do checkpoint will flush old packet */
+        colo_compare_inconsistency_notify(s);
+    }
 }
 
-static void colo_compare_packet(CompareState *s, Connection *conn,
+static void colo_compare_packet(CompareShard *shard, Connection *conn,
                                 int (*HandlePacket)(Packet *spkt,
                                 Packet *ppkt))
 {
@@ -675,7 +726,7 @@ static void colo_compare_packet(CompareState *s, Connection *conn,
                  pkt, (GCompareFunc)HandlePacket);
 
         if (result) {
-            colo_release_primary_pkt(s, pkt);
+            colo_release_primary_pkt(shard, pkt);
             packet_destroy(result->data, NULL);
             g_queue_delete_link(&conn->secondary_list, result);
         } else {
@@ -688,39 +739,84 @@ static void colo_compare_packet(CompareState *s, Connection *conn,
             trace_colo_compare_main("packet different");
             g_queue_push_tail(&conn->primary_list, pkt);
 
-            colo_compare_inconsistency_notify(s);
+            shard->inconsistent = true;
             break;
         }
     }
 }
 
 /*
- * Called from the compare thread on the primary
- * for compare packet with secondary list of the
- * specified connection when a new packet was
- * queued to it.
+ * Called from the compare thread or worker of the shard on the primary
+ * for compare packet with secondary list of the specified connection
+ * when a new packet was queued to it, with shard->lock held.
  */
-static void colo_compare_connection(void *opaque, void *user_data)
+static void colo_compare_connection(CompareShard *shard, Connection *conn)
 {
-    CompareState *s = user_data;
-    Connection *conn = opaque;
-
     switch (conn->ip_proto) {
     case IPPROTO_TCP:
-        colo_compare_tcp(s, conn);
+        colo_compare_tcp(shard, conn);
         break;
     case IPPROTO_UDP:
-        colo_compare_packet(s, conn, colo_packet_compare_udp);
+        colo_compare_packet(shard, conn, colo_packet_compare_udp);
         break;
     case IPPROTO_ICMP:
-        colo_compare_packet(s, conn, colo_packet_compare_icmp);
+        colo_compare_packet(shard, conn, colo_packet_compare_icmp);
         break;
     default:
-        colo_compare_packet(s, conn, colo_packet_compare_other);
+        colo_compare_packet(shard, conn, colo_packet_compare_other);
         break;
     }
 }
 
+/* Queue and compare the packets dispatched to the shard, with its lock held */
+static void colo_compare_shard_input(CompareShard *shard)
+{
+    CompareInput *in;
+    GQueue input;
+
+    qemu_mutex_lock(&shard->input_lock);
+    input = shard->input;
+    g_queue_init(&shard->input);
+    qemu_mutex_unlock(&shard->input_lock);
+
+    while ((in = g_queue_pop_head(&input))) {
+        colo_compare_connection(shard,
+                                packet_enqueue(shard, in->pkt, in->mode));
+        g_slice_free(CompareInput, in);
+    }
+}
+
+static void *colo_compare_worker(void *opaque)
+{
+    CompareShard *shard = opaque;
+
+    qemu_mutex_lock(&shard->input_lock);
+    while (!shard->quit) {
+        if (g_queue_is_empty(&shard->input)) {
+            qemu_cond_wait(&shard->cond, &shard->input_lock);
+            continue;
+        }
+        qemu_mutex_unlock(&shard->input_lock);
+
+        /*
+         * The input is only taken with shard->lock held, so that a
+         * checkpoint flushing the shard sees each packet either still in
+         * the input or already in its connection.
+         */
+        qemu_mutex_lock(&shard->lock);
+        colo_compare_shard_input(shard);
+        if (!g_queue_is_empty(&shard->output) || shard->inconsistent) {
+            qemu_bh_schedule(shard->s->output_bh);
+        }
+        qemu_mutex_unlock(&shard->lock);
+
+        qemu_mutex_lock(&shard->input_lock);
+    }
+    qemu_mutex_unlock(&shard->input_lock);
+
+    return NULL;
+}
+
 static void coroutine_fn _compare_chr_send(void *opaque)
 {
     SendCo *sendco = opaque;
@@ -832,6 +928,99 @@ static int compare_chr_send(CompareState *s,
     return 0;
 }
 
+/*
+ * Called from the compare thread on the primary to send the packets
+ * released in the shard, and to ask for a checkpoint if the comparison
+ * found a difference.
+ */
+static void colo_compare_shard_output(CompareShard *shard)
+{
+    CompareState *s = shard->s;
+    bool inconsistent;
+    GQueue output;
+    Packet *pkt;
+
+    qemu_mutex_lock(&shard->lock);
+    output = shard->output;
+    g_queue_init(&shard->output);
+    inconsistent = shard->inconsistent;
+    shard->inconsistent = false;
+    qemu_mutex_unlock(&shard->lock);
+
+    while ((pkt = g_queue_pop_head(&output))) {
+        if (compare_chr_send(s, pkt->data, pkt->size, pkt->vnet_hdr_len,
+                             false, true) < 0) {
+            error_report("colo send primary packet failed");
+        }
+        packet_destroy_partial(pkt, NULL);
+    }
+
+    if (inconsistent) {
+        colo_compare_inconsistency_notify(s);
+    }
+}
+
+static void colo_compare_output_bh(void *opaque)
+{
+    CompareState *s = opaque;
+    uint32_t i;
+
+    for (i = 0; i < s->nr_shards; i++) {
+        colo_compare_shard_output(&s->shards[i]);
+    }
+}
+
+/*
+ * Called from the compare thread on the primary to hand a packet to the
+ * shard of its connection.
+ */
+static void colo_compare_dispatch(CompareState *s, Packet *pkt, int mode)
+{
+    CompareShard *shard = s->nr_shards == 1 ? s->shards : packet_shard(s, pkt);
+    CompareInput *in;
+
+    if (!s->worker_threads) {
+        qemu_mutex_lock(&shard->lock);
+        colo_compare_connection(shard, packet_enqueue(shard, pkt, mode));
+        qemu_mutex_unlock(&shard->lock);
+        colo_compare_shard_output(shard);
+        return;
+    }
+
+    in = g_slice_new(CompareInput);
+    in->pkt = pkt;
+    in->mode = mode;
+
+    qemu_mutex_lock(&shard->input_lock);
+    g_queue_push_tail(&shard->input, in);
+    qemu_cond_signal(&shard->cond);
+    qemu_mutex_unlock(&shard->input_lock);
+}
+
+static void colo_flush_packets(void *opaque, void *user_data);
+
+/*
+ * Release all the primary packets and drop all the secondary ones,
+ * including those still waiting for a worker, as a checkpoint makes
+ * the secondary catch up with the primary.
+ */
+static void colo_compare_flush(CompareState *s)
+{
+    uint32_t i;
+
+    for (i = 0; i < s->nr_shards; i++) {
+        CompareShard *shard = &s->shards[i];
+
+        qemu_mutex_lock(&shard->lock);
+        colo_compare_shard_input(shard);
+        g_queue_foreach(&shard->conn_list, colo_flush_packets, shard);
+        shard->inconsistent = false;
+        qemu_mutex_unlock(&shard->lock);
+
+        colo_compare_shard_output(shard);
+    }
+}
+
 static int compare_chr_can_read(void *opaque)
 {
     return COMPARE_READ_LEN_MAX;
@@ -943,15 +1132,13 @@ static void colo_compare_timer_del(CompareState *s)
     }
  }
 
-static void colo_flush_packets(void *opaque, void *user_data);
-
 static void colo_compare_handle_event(void *opaque)
 {
     CompareState *s = opaque;
 
     switch (s->event) {
     case COLO_EVENT_CHECKPOINT:
-        g_queue_foreach(&s->conn_list, colo_flush_packets, s);
+        colo_compare_flush(s);
         break;
     case COLO_EVENT_FAILOVER:
         break;
@@ -986,6 +1173,7 @@ static void colo_compare_iothread(CompareState *s)
 
     colo_compare_timer_init(s);
     s->event_bh = aio_bh_new(ctx, colo_compare_handle_event, s);
+    s->output_bh = aio_bh_new(ctx, colo_compare_output_bh, s);
 }
 
 static char *compare_get_pri_indev(Object *obj, Error **errp)
@@ -1120,6 +1308,34 @@ static void compare_set_expired_scan_cycle(Object *obj, Visitor *v,
     s->expired_scan_cycle = value;
 }
 
+static void compare_get_worker_threads(Object *obj, Visitor *v,
+                                       const char *name, void *opaque,
+                                       Error **errp)
+{
+    CompareState *s = COLO_COMPARE(obj);
+    uint32_t value = s->worker_threads;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void compare_set_worker_threads(Object *obj, Visitor *v,
+                                       const char *name, void *opaque,
+                                       Error **errp)
+{
+    CompareState *s = COLO_COMPARE(obj);
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+    if (value > MAX_WORKER_THREADS) {
+        error_setg(errp, "Property '%s.%s' must be at most %d",
+                   object_get_typename(obj), name, MAX_WORKER_THREADS);
+        return;
+    }
+    s->worker_threads = value;
+}
+
 static void get_max_queue_size(Object *obj, Visitor *v,
                                const char *name, void *opaque,
                                Error **errp)
@@ -1149,9 +1365,9 @@ static void set_max_queue_size(Object *obj, Visitor *v,
 static void compare_pri_rs_finalize(SocketReadState *pri_rs)
 {
     CompareState *s = container_of(pri_rs, CompareState, pri_rs);
-    Connection *conn = NULL;
+    Packet *pkt = packet_parse(s, PRIMARY_IN);
 
-    if (packet_enqueue(s, PRIMARY_IN, &conn)) {
+    if (!pkt) {
         trace_colo_compare_main("primary: unsupported packet in");
         compare_chr_send(s,
                          pri_rs->buf,
@@ -1161,20 +1377,20 @@ static void compare_pri_rs_finalize(SocketReadState *pri_rs)
                          false);
     } else {
         /* compare packet in the specified connection */
-        colo_compare_connection(conn, s);
+        colo_compare_dispatch(s, pkt, PRIMARY_IN);
     }
 }
 
 static void compare_sec_rs_finalize(SocketReadState *sec_rs)
 {
     CompareState *s = container_of(sec_rs, CompareState, sec_rs);
-    Connection *conn = NULL;
+    Packet *pkt = packet_parse(s, SECONDARY_IN);
 
-    if (packet_enqueue(s, SECONDARY_IN, &conn)) {
+    if (!pkt) {
         trace_colo_compare_main("secondary: unsupported packet in");
     } else {
         /* compare packet in the specified connection */
-        colo_compare_connection(conn, s);
+        colo_compare_dispatch(s, pkt, SECONDARY_IN);
     }
 }
 
@@ -1196,7 +1412,7 @@ static void compare_notify_rs_finalize(SocketReadState *notify_rs)
                                   notify_rs->buf,
                                   notify_rs->packet_len)) {
         /* colo-compare do checkpoint, flush pri packet and remove sec packet */
-        g_queue_foreach(&s->conn_list, colo_flush_packets, s);
+        colo_compare_flush(s);
     } else {
         error_report("COLO compare got unsupported instruction");
     }
@@ -1240,6 +1456,7 @@ static void colo_compare_complete(UserCreatable *uc, Error **errp)
 {
     CompareState *s = COLO_COMPARE(uc);
     Chardev *chr;
+    uint32_t i;
 
     if (!s->pri_indev || !s->sec_indev || !s->outdev || !s->iothread) {
         error_setg(errp, "colo compare needs 'primary_in' ,"
@@ -1311,15 +1528,31 @@ static void colo_compare_complete(UserCreatable *uc, Error **errp)
         g_queue_init(&s->notify_sendco.send_list);
     }
 
-    g_queue_init(&s->conn_list);
+    s->nr_shards = s->worker_threads ?: 1;
+    s->shards = g_new0(CompareShard, s->nr_shards);
+    for (i = 0; i < s->nr_shards; i++) {
+        CompareShard *shard = &s->shards[i];
 
-    s->connection_track_table = g_hash_table_new_full(connection_key_hash,
-                                                      connection_key_equal,
-                                                      g_free,
-                                                      NULL);
+        shard->s = s;
+        qemu_mutex_init(&shard->input_lock);
+        qemu_cond_init(&shard->cond);
+        g_queue_init(&shard->input);
+        qemu_mutex_init(&shard->lock);
+        g_queue_init(&shard->conn_list);
+        shard->connection_track_table =
+            g_hash_table_new_full(connection_key_hash, connection_key_equal,
+                                  g_free, NULL);
+        g_queue_init(&shard->output);
+    }
 
     colo_compare_iothread(s);
 
+    for (i = 0; i < s->worker_threads; i++) {
+        qemu_thread_create(&s->shards[i].thread, "colo-compare",
+                           colo_compare_worker, &s->shards[i],
+                           QEMU_THREAD_JOINABLE);
+    }
+
     qemu_mutex_lock(&colo_compare_mutex);
     if (!colo_compare_active) {
         qemu_mutex_init(&event_mtx);
@@ -1330,21 +1563,16 @@ static void colo_compare_complete(UserCreatable *uc, Error **errp)
     qemu_mutex_unlock(&colo_compare_mutex);
 }
 
+/* Called with shard->lock held */
 static void colo_flush_packets(void *opaque, void *user_data)
 {
-    CompareState *s = user_data;
+    CompareShard *shard = user_data;
     Connection *conn = opaque;
     Packet *pkt = NULL;
 
     while (!g_queue_is_empty(&conn->primary_list)) {
         pkt = g_queue_pop_tail(&conn->primary_list);
-        compare_chr_send(s,
-                         pkt->data,
-                         pkt->size,
-                         pkt->vnet_hdr_len,
-                         false,
-                         true);
-        packet_destroy_partial(pkt, NULL);
+        g_queue_push_tail(&shard->output, pkt);
     }
     while (!g_queue_is_empty(&conn->secondary_list)) {
         pkt = g_queue_pop_tail(&conn->secondary_list);
@@ -1389,6 +1617,10 @@ static void colo_compare_init(Object *obj)
                         get_max_queue_size,
                         set_max_queue_size, NULL, NULL);
 
+    object_property_add(obj, "worker_threads", "uint32",
+                        compare_get_worker_threads,
+                        compare_set_worker_threads, NULL, NULL);
+
     s->vnet_hdr = false;
     object_property_add_bool(obj, "vnet_hdr_support", compare_get_vnet_hdr,
                              compare_set_vnet_hdr);
@@ -1408,6 +1640,7 @@ static void colo_compare_finalize(Object *obj)
 {
     CompareState *s = COLO_COMPARE(obj);
     CompareState *tmp = NULL;
+    uint32_t i;
 
     qemu_mutex_lock(&colo_compare_mutex);
     QTAILQ_FOREACH(tmp, &net_compares, next) {
@@ -1434,6 +1667,19 @@ static void colo_compare_finalize(Object *obj)
 
     qemu_bh_delete(s->event_bh);
 
+    for (i = 0; i < s->worker_threads && s->shards; i++) {
+        CompareShard *shard = &s->shards[i];
+
+        qemu_mutex_lock(&shard->input_lock);
+        shard->quit = true;
+        qemu_cond_signal(&shard->cond);
+        qemu_mutex_unlock(&shard->input_lock);
+        qemu_thread_join(&shard->thread);
+    }
+    if (s->output_bh) {
+        qemu_bh_delete(s->output_bh);
+    }
+
     AioContext *ctx = iothread_get_aio_context(s->iothread);
     AIO_WAIT_WHILE(ctx, !s->out_sendco.done);
     if (s->notify_dev) {
@@ -1441,18 +1687,24 @@ static void colo_compare_finalize(Object *obj)
     }
 
     /* Release all unhandled packets after compare thead exited */
-    g_queue_foreach(&s->conn_list, colo_flush_packets, s);
+    colo_compare_flush(s);
     AIO_WAIT_WHILE(NULL, !s->out_sendco.done);
 
-    g_queue_clear(&s->conn_list);
     g_queue_clear(&s->out_sendco.send_list);
     if (s->notify_dev) {
         g_queue_clear(&s->notify_sendco.send_list);
     }
 
-    if (s->connection_track_table) {
-        g_hash_table_destroy(s->connection_track_table);
+    for (i = 0; i < s->nr_shards; i++) {
+        CompareShard *shard = &s->shards[i];
+
+        g_queue_clear(&shard->conn_list);
+        g_hash_table_destroy(shard->connection_track_table);
+        qemu_mutex_destroy(&shard->lock);
+        qemu_cond_destroy(&shard->cond);
+        qemu_mutex_destroy(&shard->input_lock);
     }
+    g_free(s->shards);
 
     object_unref(OBJECT(s->iothread));
 
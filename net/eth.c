@@ -126,14 +126,15 @@ _eth_tcp_has_data(bool is_ip4,
     return l4len > TCP_HEADER_DATA_OFFSET(tcp);
 }
 
-void eth_get_protocols(const struct iovec *iov, size_t iovcnt, size_t iovoff,
-                       bool *hasip4, bool *hasip6,
-                       size_t *l3hdr_off,
-                       size_t *l4hdr_off,
-                       size_t *l5hdr_off,
-                       eth_ip6_hdr_info *ip6hdr_info,
-                       eth_ip4_hdr_info *ip4hdr_info,
-                       eth_l4_hdr_info  *l4hdr_info)
+static void
+_eth_get_protocols(const struct iovec *iov, size_t iovcnt, size_t iovoff,
+                   bool *hasip4, bool *hasip6,
+                   size_t *l3hdr_off,
+                   size_t *l4hdr_off,
+                   size_t *l5hdr_off,
+                   eth_ip6_hdr_info *ip6hdr_info,
+                   eth_ip4_hdr_info *ip4hdr_info,
+                   eth_l4_hdr_info  *l4hdr_info)
 {
     int proto;
     bool fragment = false;
@@ -218,6 +219,76 @@ void eth_get_protocols(const struct iovec *iov, size_t iovcnt, size_t iovoff,
     }
 }
 
+/*
+ * Enough for an Ethernet header with two VLAN tags, followed by IPv6 and
+ * TCP headers with options, and for a virtio-net header in front.
+ */
+#define ETH_PARSE_PREFIX_LEN 192
+
+/*
+ * Whether parsing @prefix_len bytes of the packet was enough, that is
+ * whether every header the parser looked at lies within them.
+ */
+static bool
+_eth_prefix_parsed(size_t prefix_len, size_t l4hdr_off, size_t l5hdr_off,
+                   const eth_l4_hdr_info *l4hdr_info)
+{
+    switch (l4hdr_info->proto) {
+    case ETH_L4_HDR_PROTO_TCP:
+        return l4hdr_off + sizeof(struct tcp_header) <= prefix_len &&
+               l5hdr_off <= prefix_len;
+    case ETH_L4_HDR_PROTO_UDP:
+        return l5hdr_off <= prefix_len;
+    case ETH_L4_HDR_PROTO_SCTP:
+        return l4hdr_off <= prefix_len;
+    default:
+        /* Not worth telling truncated headers apart from the others */
+        return false;
+    }
+}
+
+void eth_get_protocols(const struct iovec *iov, size_t iovcnt, size_t iovoff,
+                       bool *hasip4, bool *hasip6,
+                       size_t *l3hdr_off,
+                       size_t *l4hdr_off,
+                       size_t *l5hdr_off,
+                       eth_ip6_hdr_info *ip6hdr_info,
+                       eth_ip4_hdr_info *ip4hdr_info,
+                       eth_l4_hdr_info  *l4hdr_info)
+{
+    uint8_t buf[ETH_PARSE_PREFIX_LEN];
+    struct iovec prefix;
+
+    /*
+     * The headers are parsed with many small reads, each of which walks
+     * the scatter list.  Parse a contiguous copy of the start of the
+     * packet instead, or the first fragment if it is large enough, and
+     * only go through the whole packet if the headers do not fit there.
+     */
+    if (iovcnt && iov[0].iov_len >= sizeof(buf)) {
+        prefix = iov[0];
+    } else {
+        prefix.iov_base = buf;
+        prefix.iov_len = iov_to_buf(iov, iovcnt, 0, buf, sizeof(buf));
+    }
+
+    if (prefix.iov_len > iovoff) {
+        _eth_get_protocols(&prefix, 1, iovoff, hasip4, hasip6,
+                           l3hdr_off, l4hdr_off, l5hdr_off,
+                           ip6hdr_info, ip4hdr_info, l4hdr_info);
+        if (prefix.iov_len < sizeof(buf) ||
+            _eth_prefix_parsed(prefix.iov_len, *l4hdr_off, *l5hdr_off,
+                               l4hdr_info)) {
+            /* A short copy holds the whole packet */
+            return;
+        }
+    }
+
+    _eth_get_protocols(iov, iovcnt, iovoff, hasip4, hasip6,
+                       l3hdr_off, l4hdr_off, l5hdr_off,
+                       ip6hdr_info, ip4hdr_info, l4hdr_info);
+}
+
 size_t
 eth_strip_vlan(const struct iovec *iov, int iovcnt, size_t iovoff,
                void *new_ehdr_buf,
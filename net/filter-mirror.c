@@ -21,6 +21,9 @@
 #include "qemu/iov.h"
 #include "qemu/sockets.h"
 #include "qemu/aio-wait.h"
+#include "qemu/bswap.h"
+#include "qemu/coroutine.h"
+#include "qemu/units.h"
 
 #define TYPE_FILTER_MIRROR "filter-mirror"
 typedef struct MirrorState MirrorState;
@@ -33,6 +36,22 @@ DECLARE_INSTANCE_CHECKER(MirrorState, FILTER_REDIRECTOR,
 
 #define REDIRECTOR_MAX_LEN NET_BUFSIZE
 
+/*
+ * Most bytes a filter may have waiting to be written to its outdev before
+ * the sender is made to wait for them
+ */
+#define MIRROR_MAX_QUEUED_BYTES (4 * MiB)
+
+/*
+ * A packet waiting to be sent, prefixed with its be32 length and, if
+ * vnet_hdr is set, the be32 length of its vnet header
+ */
+typedef struct MirrorPacket {
+    QSIMPLEQ_ENTRY(MirrorPacket) next;
+    size_t size;
+    uint8_t data[];
+} MirrorPacket;
+
 struct MirrorState {
     NetFilterState parent_obj;
     char *indev;
@@ -41,97 +60,97 @@ struct MirrorState {
     CharFrontend chr_out;
     SocketReadState rs;
     bool vnet_hdr;
+    /* packets not yet written by send_co, oldest first */
+    QSIMPLEQ_HEAD(, MirrorPacket) send_queue;
+    size_t send_queue_bytes;
+    Coroutine *send_co;
 };
 
-typedef struct FilterSendCo {
-    MirrorState *s;
-    char *buf;
-    ssize_t size;
-    bool done;
+static void coroutine_fn filter_send_co(void *opaque)
+{
+    MirrorState *s = opaque;
+    MirrorPacket *pkt;
     int ret;
-} FilterSendCo;
 
-static int _filter_send(MirrorState *s,
-                       char *buf,
-                       ssize_t size)
+    while ((pkt = QSIMPLEQ_FIRST(&s->send_queue))) {
+        QSIMPLEQ_REMOVE_HEAD(&s->send_queue, next);
+
+        ret = qemu_chr_fe_write_all(&s->chr_out, pkt->data, pkt->size);
+        if (ret != pkt->size) {
+            error_report("%s send failed(%s)", object_get_typename(OBJECT(s)),
+                         strerror(ret < 0 ? -ret : EIO));
+        }
+
+        s->send_queue_bytes -= pkt->size;
+        g_free(pkt);
+    }
+
+    s->send_co = NULL;
+    aio_wait_kick();
+}
+
+/*
+ * Queue the packet to be written by send_co, so that the sender does not
+ * have to wait for the outdev.  Packets that arrive before send_co runs
+ * are written in one go.  The packet has to be copied, as @iov is only
+ * valid until we return.
+ */
+static int filter_send(MirrorState *s,
+                       const struct iovec *iov,
+                       int iovcnt)
 {
     NetFilterState *nf = NETFILTER(s);
-    int ret = 0;
-    uint32_t len = 0;
+    ssize_t size = iov_size(iov, iovcnt);
+    size_t hdr_len = s->vnet_hdr ? 2 * sizeof(uint32_t) : sizeof(uint32_t);
+    MirrorPacket *pkt;
 
-    len = htonl(size);
-    ret = qemu_chr_fe_write_all(&s->chr_out, (uint8_t *)&len, sizeof(len));
-    if (ret != sizeof(len)) {
-        goto err;
+    if (!size) {
+        return 0;
     }
 
+    pkt = g_malloc(sizeof(*pkt) + hdr_len + size);
+    pkt->size = hdr_len + size;
+    stl_be_p(pkt->data, size);
     if (s->vnet_hdr) {
         /*
          * If vnet_hdr = on, we send vnet header len to make other
          * module(like colo-compare) know how to parse net
          * packet correctly.
          */
-        ssize_t vnet_hdr_len;
+        stl_be_p(pkt->data + sizeof(uint32_t), nf->netdev->vnet_hdr_len);
+    }
+    iov_to_buf(iov, iovcnt, 0, pkt->data + hdr_len, size);
 
-        vnet_hdr_len = nf->netdev->vnet_hdr_len;
+    QSIMPLEQ_INSERT_TAIL(&s->send_queue, pkt, next);
+    s->send_queue_bytes += pkt->size;
 
-        len = htonl(vnet_hdr_len);
-        ret = qemu_chr_fe_write_all(&s->chr_out, (uint8_t *)&len, sizeof(len));
-        if (ret != sizeof(len)) {
-            goto err;
-        }
+    if (!s->send_co) {
+        s->send_co = qemu_coroutine_create(filter_send_co, s);
+        aio_co_schedule(qemu_get_aio_context(), s->send_co);
     }
 
-    ret = qemu_chr_fe_write_all(&s->chr_out, (uint8_t *)buf, size);
-    if (ret != size) {
-        goto err;
+    /* Push back on the sender if the outdev cannot keep up */
+    while (s->send_queue_bytes > MIRROR_MAX_QUEUED_BYTES) {
+        aio_poll(qemu_get_aio_context(), true);
     }
 
     return size;
-
-err:
-    return ret < 0 ? ret : -EIO;
-}
-
-static void coroutine_fn filter_send_co(void *opaque)
-{
-    FilterSendCo *data = opaque;
-
-    data->ret = _filter_send(data->s, data->buf, data->size);
-    data->done = true;
-    g_free(data->buf);
-    aio_wait_kick();
 }
 
-static int filter_send(MirrorState *s,
-                       const struct iovec *iov,
-                       int iovcnt)
+/* Drop the packets that were not sent yet, and wait for send_co to stop */
+static void filter_send_cleanup(MirrorState *s)
 {
-    ssize_t size = iov_size(iov, iovcnt);
-    char *buf = NULL;
+    MirrorPacket *pkt, *next;
 
-    if (!size) {
-        return 0;
+    QSIMPLEQ_FOREACH_SAFE(pkt, &s->send_queue, next, next) {
+        s->send_queue_bytes -= pkt->size;
+        g_free(pkt);
     }
+    QSIMPLEQ_INIT(&s->send_queue);
 
-    buf = g_malloc(size);
-    iov_to_buf(iov, iovcnt, 0, buf, size);
-
-    FilterSendCo data = {
-        .s = s,
-        .size = size,
-        .buf = buf,
-        .ret = 0,
-    };
-
-    Coroutine *co = qemu_coroutine_create(filter_send_co, &data);
-    qemu_coroutine_enter(co);
-
-    while (!data.done) {
+    while (s->send_co) {
         aio_poll(qemu_get_aio_context(), true);
     }
-
-    return data.ret;
 }
 
 static void redirector_to_filter(NetFilterState *nf,
@@ -196,17 +215,10 @@ static ssize_t filter_mirror_receive_iov(NetFilterState *nf,
                                          NetPacketSent *sent_cb)
 {
     MirrorState *s = FILTER_MIRROR(nf);
-    int ret;
 
-    ret = filter_send(s, iov, iovcnt);
-    if (ret < 0) {
-        error_report("filter mirror send failed(%s)", strerror(-ret));
-    }
+    filter_send(s, iov, iovcnt);
 
-    /*
-     * we don't hope this error interrupt the normal
-     * path of net packet, so we always return zero.
-     */
+    /* the packet always carries on down the normal path */
     return 0;
 }
 
@@ -218,14 +230,9 @@ static ssize_t filter_redirector_receive_iov(NetFilterState *nf,
                                              NetPacketSent *sent_cb)
 {
     MirrorState *s = FILTER_REDIRECTOR(nf);
-    int ret;
 
     if (qemu_chr_fe_backend_connected(&s->chr_out)) {
-        ret = filter_send(s, iov, iovcnt);
-        if (ret < 0) {
-            error_report("filter redirector send failed(%s)", strerror(-ret));
-        }
-        return ret;
+        return filter_send(s, iov, iovcnt);
     } else {
         return 0;
     }
@@ -235,6 +242,7 @@ static void filter_mirror_cleanup(NetFilterState *nf)
 {
     MirrorState *s = FILTER_MIRROR(nf);
 
+    filter_send_cleanup(s);
     qemu_chr_fe_deinit(&s->chr_out, false);
 }
 
@@ -242,6 +250,7 @@ static void filter_redirector_cleanup(NetFilterState *nf)
 {
     MirrorState *s = FILTER_REDIRECTOR(nf);
 
+    filter_send_cleanup(s);
     qemu_chr_fe_deinit(&s->chr_in, false);
     qemu_chr_fe_deinit(&s->chr_out, false);
 }
@@ -447,6 +456,7 @@ static void filter_mirror_init(Object *obj)
     MirrorState *s = FILTER_MIRROR(obj);
 
     s->vnet_hdr = false;
+    QSIMPLEQ_INIT(&s->send_queue);
 }
 
 static void filter_redirector_init(Object *obj)
@@ -454,6 +464,7 @@ static void filter_redirector_init(Object *obj)
     MirrorState *s = FILTER_REDIRECTOR(obj);
 
     s->vnet_hdr = false;
+    QSIMPLEQ_INIT(&s->send_queue);
 }
 
 static void filter_mirror_fini(Object *obj)
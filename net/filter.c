@@ -9,6 +9,7 @@
 #include "qemu/osdep.h"
 #include "qapi/error.h"
 #include "qapi/qmp/qerror.h"
+#include "qapi/visitor.h"
 #include "qemu/error-report.h"
 
 #include "net/filter.h"
@@ -205,6 +206,30 @@ static void netfilter_set_insert(Object *obj, const char *str, Error **errp)
     nf->insert_before_flag = !strcmp(str, "before");
 }
 
+static void netfilter_get_queue_index(Object *obj, Visitor *v,
+                                      const char *name, void *opaque,
+                                      Error **errp)
+{
+    NetFilterState *nf = NETFILTER(obj);
+    uint32_t value = nf->queue_index;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void netfilter_set_queue_index(Object *obj, Visitor *v,
+                                      const char *name, void *opaque,
+                                      Error **errp)
+{
+    NetFilterState *nf = NETFILTER(obj);
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+    nf->queue_index = value;
+    nf->has_queue_index = true;
+}
+
 static void netfilter_init(Object *obj)
 {
     NetFilterState *nf = NETFILTER(obj);
@@ -219,6 +244,7 @@ static void netfilter_complete(UserCreatable *uc, Error **errp)
     NetFilterState *nf = NETFILTER(uc);
     NetFilterState *position = NULL;
     NetClientState *ncs[MAX_QUEUE_NUM];
+    NetClientState *nc;
     NetFilterClass *nfc = NETFILTER_GET_CLASS(uc);
     int queues;
     Error *local_err = NULL;
@@ -235,12 +261,29 @@ static void netfilter_complete(UserCreatable *uc, Error **errp)
         error_setg(errp, QERR_INVALID_PARAMETER_VALUE, "netdev",
                    "a network backend id");
         return;
+    }
+
+    /*
+     * Each queue of a multiqueue backend has its own filter chain, so
+     * the queue has to be named.  Filters on different queues share no
+     * state, and can be given one instance per queue.
+     */
+    if (nf->has_queue_index) {
+        if (nf->queue_index >= queues) {
+            error_setg(errp, "netdev '%s' has no queue %u",
+                       nf->netdev_id, nf->queue_index);
+            return;
+        }
+        nc = ncs[nf->queue_index];
     } else if (queues > 1) {
-        error_setg(errp, "multiqueue is not supported");
+        error_setg(errp, "netdev '%s' has %d queues, 'queue-index' is "
+                   "required", nf->netdev_id, queues);
         return;
+    } else {
+        nc = ncs[0];
     }
 
-    if (get_vhost_net(ncs[0])) {
+    if (get_vhost_net(nc)) {
         error_setg(errp, "Vhost is not supported");
         return;
     }
@@ -270,7 +313,7 @@ static void netfilter_complete(UserCreatable *uc, Error **errp)
 
         position = NETFILTER(obj);
 
-        if (position->netdev != ncs[0]) {
+        if (position->netdev != nc) {
             error_setg(errp, "filter '%s' belongs to a different netdev",
                         position_id);
             g_free(position_id);
@@ -280,7 +323,7 @@ static void netfilter_complete(UserCreatable *uc, Error **errp)
         g_free(position_id);
     }
 
-    nf->netdev = ncs[0];
+    nf->netdev = nc;
 
     if (nfc->setup) {
         nfc->setup(nf, &local_err);
@@ -343,6 +386,9 @@ static void netfilter_class_init(ObjectClass *oc, const void *data)
     object_class_property_add_enum(oc, "queue", "NetFilterDirection",
                                    &NetFilterDirection_lookup,
                                    netfilter_get_direction, netfilter_set_direction);
+    object_class_property_add(oc, "queue-index", "uint32",
+                              netfilter_get_queue_index,
+                              netfilter_set_queue_index, NULL, NULL);
     object_class_property_add_str(oc, "status",
                                   netfilter_get_status, netfilter_set_status);
     object_class_property_add_str(oc, "position",
@@ -0,0 +1,442 @@
+/*
+ * Software TCP segmentation and receive coalescing
+ *
+ * Copyright (c) 2026 The QEMU Project Developers
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "net/gso.h"
+#include "net/checksum.h"
+#include "net/eth.h"
+#include "net/net.h"
+
+#define TCP_FLAGS_OFFSET 13
+#define IP6_HDR_LEN      sizeof(struct ip6_header)
+
+/* Sum of the TCP pseudo header, for a TCP segment of @tcp_len bytes */
+static uint32_t net_gso_pseudo_sum(const uint8_t *l3, bool ipv6,
+                                   size_t tcp_len)
+{
+    if (ipv6) {
+        return net_checksum_add(2 * sizeof(struct in6_address),
+                                (uint8_t *)l3 +
+                                offsetof(struct ip6_header, ip6_src)) +
+               IP_PROTO_TCP + tcp_len;
+    }
+    return net_checksum_add(2 * sizeof(uint32_t),
+                            (uint8_t *)l3 +
+                            offsetof(struct ip_header, ip_src)) +
+           IP_PROTO_TCP + tcp_len;
+}
+
+static void net_gso_alloc(NetGSOSegments *segs, int count, size_t hdr_len)
+{
+    segs->count = count;
+    segs->pkts = g_new(NetBatchPacket, count);
+    segs->iov = g_new(struct iovec, 2 * count);
+    segs->hdrs = hdr_len ? g_malloc(count * hdr_len) : NULL;
+}
+
+void net_gso_segments_free(NetGSOSegments *segs)
+{
+    g_free(segs->pkts);
+    g_free(segs->iov);
+    g_free(segs->hdrs);
+    memset(segs, 0, sizeof(*segs));
+}
+
+bool net_gso_segment(const struct virtio_net_hdr *hdr, uint8_t *pkt,
+                     size_t size, NetGSOSegments *segs)
+{
+    uint8_t gso_type = hdr->gso_type & ~VIRTIO_NET_HDR_GSO_ECN;
+    size_t l3_off, l4_off, tcp_hlen, hdr_len, payload, off;
+    uint32_t seq;
+    uint16_t id;
+    bool ipv6;
+    int count, i;
+
+    memset(segs, 0, sizeof(*segs));
+
+    if ((hdr->flags & VIRTIO_NET_HDR_F_NEEDS_CSUM) &&
+        (hdr->csum_start > size ||
+         size - hdr->csum_start < hdr->csum_offset + sizeof(uint16_t))) {
+        return false;
+    }
+
+    if (gso_type == VIRTIO_NET_HDR_GSO_NONE) {
+        if (hdr->flags & VIRTIO_NET_HDR_F_NEEDS_CSUM) {
+            /* The checksum field holds the sum of the pseudo header */
+            uint32_t sum = net_checksum_add(size - hdr->csum_start,
+                                            pkt + hdr->csum_start);
+
+            stw_be_p(pkt + hdr->csum_start + hdr->csum_offset,
+                     net_checksum_finish_nozero(sum));
+        }
+        net_gso_alloc(segs, 1, 0);
+        segs->iov[0].iov_base = pkt;
+        segs->iov[0].iov_len = size;
+        segs->pkts[0].iov = segs->iov;
+        segs->pkts[0].iovcnt = 1;
+        return true;
+    }
+
+    if ((gso_type != VIRTIO_NET_HDR_GSO_TCPV4 &&
+         gso_type != VIRTIO_NET_HDR_GSO_TCPV6) ||
+        !(hdr->flags & VIRTIO_NET_HDR_F_NEEDS_CSUM) ||
+        hdr->csum_offset != offsetof(struct tcp_header, th_sum) ||
+        !hdr->gso_size) {
+        return false;
+    }
+
+    if (size < sizeof(struct eth_header) + 2 * sizeof(struct vlan_header)) {
+        return false;
+    }
+    ipv6 = gso_type == VIRTIO_NET_HDR_GSO_TCPV6;
+    l3_off = eth_get_l2_hdr_length(pkt);
+    l4_off = hdr->csum_start;
+
+    if (ipv6) {
+        if (l4_off < l3_off + IP6_HDR_LEN || (pkt[l3_off] >> 4) != 6) {
+            return false;
+        }
+    } else {
+        if (l4_off < l3_off + sizeof(struct ip_header) ||
+            pkt[l3_off] >> 4 != 4 ||
+            IP_HDR_GET_LEN(pkt + l3_off) != l4_off - l3_off ||
+            IP_HDR_GET_P(pkt + l3_off) != IP_PROTO_TCP) {
+            return false;
+        }
+    }
+
+    if (size - l4_off < sizeof(struct tcp_header)) {
+        return false;
+    }
+    tcp_hlen = TCP_HEADER_DATA_OFFSET((struct tcp_header *)(pkt + l4_off));
+    if (tcp_hlen < sizeof(struct tcp_header) || size - l4_off < tcp_hlen) {
+        return false;
+    }
+
+    hdr_len = l4_off + tcp_hlen;
+    payload = size - hdr_len;
+    count = MAX(DIV_ROUND_UP(payload, hdr->gso_size), 1);
+    if (count > NET_GSO_MAX_SEGS) {
+        return false;
+    }
+
+    seq = ldl_be_p(pkt + l4_off + offsetof(struct tcp_header, th_seq));
+    id = ipv6 ? 0 : lduw_be_p(pkt + l3_off +
+                              offsetof(struct ip_header, ip_id));
+
+    net_gso_alloc(segs, count, hdr_len);
+
+    for (i = 0, off = 0; i < count; i++) {
+        uint8_t *h = segs->hdrs + i * hdr_len;
+        uint8_t *tcp = h + l4_off;
+        size_t len = MIN(hdr->gso_size, payload - off);
+        uint32_t sum;
+
+        memcpy(h, pkt, hdr_len);
+
+        if (ipv6) {
+            stw_be_p(h + l3_off + offsetof(struct ip6_header, ip6_plen),
+                     hdr_len - l3_off - IP6_HDR_LEN + len);
+        } else {
+            stw_be_p(h + l3_off + offsetof(struct ip_header, ip_len),
+                     hdr_len - l3_off + len);
+            stw_be_p(h + l3_off + offsetof(struct ip_header, ip_id), id + i);
+            eth_fix_ip4_checksum(h + l3_off, l4_off - l3_off);
+        }
+
+        stl_be_p(tcp + offsetof(struct tcp_header, th_seq), seq + off);
+        if (i) {
+            tcp[TCP_FLAGS_OFFSET] &= ~TH_CWR;
+        }
+        if (i < count - 1) {
+            tcp[TCP_FLAGS_OFFSET] &= ~(TH_FIN | TH_PUSH);
+        }
+
+        stw_be_p(tcp + offsetof(struct tcp_header, th_sum), 0);
+        sum = net_gso_pseudo_sum(h + l3_off, ipv6, tcp_hlen + len);
+        sum += net_checksum_add(tcp_hlen, tcp);
+        sum += net_checksum_add_cont(len, pkt + hdr_len + off, tcp_hlen);
+        stw_be_p(tcp + offsetof(struct tcp_header, th_sum),
+                 net_checksum_finish(sum));
+
+        segs->iov[2 * i].iov_base = h;
+        segs->iov[2 * i].iov_len = hdr_len;
+        segs->iov[2 * i + 1].iov_base = pkt + hdr_len + off;
+        segs->iov[2 * i + 1].iov_len = len;
+        segs->pkts[i].iov = &segs->iov[2 * i];
+        segs->pkts[i].iovcnt = len ? 2 : 1;
+
+        off += len;
+    }
+
+    return true;
+}
+
+struct NetGRO {
+    NetGROFlush *flush;
+    void *opaque;
+    bool tcp4;
+    bool tcp6;
+
+    /* The frame being coalesced, if size is not 0 */
+    size_t size;
+    size_t l3_off;
+    size_t l4_off;
+    size_t hdr_len;
+    bool ipv6;
+    /* payload of the first segment, that all but the last one must have */
+    size_t mss;
+    uint32_t next_seq;
+    int segs;
+    uint8_t buf[NET_BUFSIZE];
+};
+
+/* Layout of a TCP segment that can be coalesced */
+typedef struct NetGROSegment {
+    size_t l3_off;
+    size_t l4_off;
+    size_t hdr_len;
+    size_t end;
+    bool ipv6;
+} NetGROSegment;
+
+NetGRO *net_gro_new(NetGROFlush *flush, void *opaque)
+{
+    NetGRO *gro = g_new0(NetGRO, 1);
+
+    gro->flush = flush;
+    gro->opaque = opaque;
+
+    return gro;
+}
+
+void net_gro_free(NetGRO *gro)
+{
+    g_free(gro);
+}
+
+void net_gro_set_offloads(NetGRO *gro, bool tcp4, bool tcp6)
+{
+    net_gro_flush(gro);
+    gro->tcp4 = tcp4;
+    gro->tcp6 = tcp6;
+}
+
+size_t net_gro_pending(NetGRO *gro)
+{
+    return gro->size;
+}
+
+/*
+ * Only plain data segments with valid checksums are coalesced: the frame
+ * that results is handed on with a checksum to complete, so a corrupted
+ * segment would otherwise go unnoticed.
+ */
+static bool net_gro_parse(NetGRO *gro, const uint8_t *pkt, size_t size,
+                          NetGROSegment *seg)
+{
+    const uint8_t *l3, *tcp;
+    size_t l3_len;
+    uint32_t sum;
+
+    if (size < sizeof(struct eth_header) + 2 * sizeof(struct vlan_header)) {
+        return false;
+    }
+    seg->l3_off = eth_get_l2_hdr_length(pkt);
+    l3 = pkt + seg->l3_off;
+
+    switch (lduw_be_p(pkt + seg->l3_off - sizeof(uint16_t))) {
+    case ETH_P_IP:
+        if (!gro->tcp4 || size - seg->l3_off < sizeof(struct ip_header) ||
+            l3[0] != 0x45 ||
+            IP_HDR_GET_P(l3) != IP_PROTO_TCP ||
+            (lduw_be_p(l3 + offsetof(struct ip_header, ip_off)) &
+             (IP_MF | IP_OFFMASK)) ||
+            net_raw_checksum((uint8_t *)l3, sizeof(struct ip_header))) {
+            return false;
+        }
+        seg->ipv6 = false;
+        seg->l4_off = seg->l3_off + sizeof(struct ip_header);
+        l3_len = lduw_be_p(l3 + offsetof(struct ip_header, ip_len));
+        break;
+    case ETH_P_IPV6:
+        if (!gro->tcp6 || size - seg->l3_off < IP6_HDR_LEN ||
+            (l3[0] >> 4) != 6 ||
+            l3[offsetof(struct ip6_header, ip6_nxt)] != IP_PROTO_TCP) {
+            return false;
+        }
+        seg->ipv6 = true;
+        seg->l4_off = seg->l3_off + IP6_HDR_LEN;
+        l3_len = IP6_HDR_LEN +
+                 lduw_be_p(l3 + offsetof(struct ip6_header, ip6_plen));
+        break;
+    default:
+        return false;
+    }
+
+    /* Drop what follows the IP packet, such as Ethernet padding */
+    seg->end = seg->l3_off + l3_len;
+    if (seg->end > size ||
+        seg->end < seg->l4_off + sizeof(struct tcp_header)) {
+        return false;
+    }
+    tcp = pkt + seg->l4_off;
+    seg->hdr_len = seg->l4_off +
+                   TCP_HEADER_DATA_OFFSET((struct tcp_header *)tcp);
+    if (seg->hdr_len < seg->l4_off + sizeof(struct tcp_header) ||
+        seg->hdr_len >= seg->end ||
+        (tcp[TCP_FLAGS_OFFSET] & ~TH_PUSH) != TH_ACK) {
+        return false;
+    }
+
+    sum = net_gso_pseudo_sum(l3, seg->ipv6, seg->end - seg->l4_off);
+    sum += net_checksum_add(seg->end - seg->l4_off, (uint8_t *)tcp);
+    return net_checksum_finish(sum) == 0;
+}
+
+/* Whether @seg of @pkt directly follows the frame being coalesced */
+static bool net_gro_can_merge(NetGRO *gro, const uint8_t *pkt,
+                              const NetGROSegment *seg)
+{
+    const uint8_t *l3 = pkt + seg->l3_off, *tcp = pkt + seg->l4_off;
+    const uint8_t *gl3 = gro->buf + gro->l3_off;
+    const uint8_t *gtcp = gro->buf + gro->l4_off;
+    size_t payload = seg->end - seg->hdr_len;
+    size_t max_size = gro->l3_off + (gro->ipv6 ? IP6_HDR_LEN : 0) + 0xffff;
+
+    if (seg->ipv6 != gro->ipv6 || seg->l3_off != gro->l3_off ||
+        seg->hdr_len != gro->hdr_len ||
+        payload > gro->mss || gro->size + payload > max_size ||
+        memcmp(pkt, gro->buf, seg->l3_off)) {
+        return false;
+    }
+
+    if (seg->ipv6) {
+        /* Everything but the payload length */
+        if (memcmp(l3, gl3, offsetof(struct ip6_header, ip6_plen)) ||
+            memcmp(l3 + offsetof(struct ip6_header, ip6_nxt),
+                   gl3 + offsetof(struct ip6_header, ip6_nxt),
+                   IP6_HDR_LEN - offsetof(struct ip6_header, ip6_nxt))) {
+            return false;
+        }
+    } else {
+        /* Everything but the total length, the ID and the checksum */
+        if (l3[1] != gl3[1] ||
+            memcmp(l3 + offsetof(struct ip_header, ip_off),
+                   gl3 + offsetof(struct ip_header, ip_off),
+                   offsetof(struct ip_header, ip_sum) -
+                   offsetof(struct ip_header, ip_off)) ||
+            memcmp(l3 + offsetof(struct ip_header, ip_src),
+                   gl3 + offsetof(struct ip_header, ip_src),
+                   2 * sizeof(uint32_t))) {
+            return false;
+        }
+    }
+
+    /* Same ports, acknowledgment, window and options */
+    return ldl_be_p(tcp + offsetof(struct tcp_header, th_seq)) ==
+           gro->next_seq &&
+           !memcmp(tcp, gtcp, offsetof(struct tcp_header, th_seq)) &&
+           !memcmp(tcp + offsetof(struct tcp_header, th_ack),
+                   gtcp + offsetof(struct tcp_header, th_ack),
+                   TCP_FLAGS_OFFSET - offsetof(struct tcp_header, th_ack)) &&
+           !memcmp(tcp + offsetof(struct tcp_header, th_win),
+                   gtcp + offsetof(struct tcp_header, th_win),
+                   sizeof(uint16_t)) &&
+           !memcmp(tcp + sizeof(struct tcp_header),
+                   gtcp + sizeof(struct tcp_header),
+                   seg->hdr_len - seg->l4_off - sizeof(struct tcp_header));
+}
+
+void net_gro_flush(NetGRO *gro)
+{
+    struct virtio_net_hdr hdr = {
+        /* Checksums have been verified in net_gro_parse() */
+        .flags = VIRTIO_NET_HDR_F_DATA_VALID,
+        .gso_type = VIRTIO_NET_HDR_GSO_NONE,
+    };
+    uint8_t *l3 = gro->buf + gro->l3_off;
+    size_t size = gro->size;
+
+    if (!size) {
+        return;
+    }
+
+    if (gro->segs > 1) {
+        uint32_t sum;
+
+        if (gro->ipv6) {
+            stw_be_p(l3 + offsetof(struct ip6_header, ip6_plen),
+                     size - gro->l3_off - IP6_HDR_LEN);
+        } else {
+            stw_be_p(l3 + offsetof(struct ip_header, ip_len),
+                     size - gro->l3_off);
+            eth_fix_ip4_checksum(l3, sizeof(struct ip_header));
+        }
+
+        /* Leave the sum of the pseudo header for the receiver to complete */
+        sum = net_gso_pseudo_sum(l3, gro->ipv6, size - gro->l4_off);
+        stw_be_p(gro->buf + gro->l4_off + offsetof(struct tcp_header, th_sum),
+                 (uint16_t)~net_checksum_finish(sum));
+
+        hdr.flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+        hdr.gso_type = gro->ipv6 ? VIRTIO_NET_HDR_GSO_TCPV6 :
+                                   VIRTIO_NET_HDR_GSO_TCPV4;
+        hdr.hdr_len = gro->hdr_len;
+        hdr.gso_size = gro->mss;
+        hdr.csum_start = gro->l4_off;
+        hdr.csum_offset = offsetof(struct tcp_header, th_sum);
+    }
+
+    gro->size = 0;
+    gro->flush(gro->opaque, &hdr, gro->buf, size);
+}
+
+bool net_gro_receive(NetGRO *gro, const uint8_t *pkt, size_t size)
+{
+    NetGROSegment seg;
+    size_t payload;
+    bool push;
+
+    if (!net_gro_parse(gro, pkt, size, &seg)) {
+        net_gro_flush(gro);
+        return false;
+    }
+
+    payload = seg.end - seg.hdr_len;
+    push = pkt[seg.l4_off + TCP_FLAGS_OFFSET] & TH_PUSH;
+
+    if (gro->size && net_gro_can_merge(gro, pkt, &seg)) {
+        memcpy(gro->buf + gro->size, pkt + seg.hdr_len, payload);
+        gro->size += payload;
+        gro->segs++;
+        if (push) {
+            gro->buf[seg.l4_off + TCP_FLAGS_OFFSET] |= TH_PUSH;
+        }
+    } else {
+        net_gro_flush(gro);
+        memcpy(gro->buf, pkt, seg.end);
+        gro->size = seg.end;
+        gro->l3_off = seg.l3_off;
+        gro->l4_off = seg.l4_off;
+        gro->hdr_len = seg.hdr_len;
+        gro->ipv6 = seg.ipv6;
+        gro->mss = payload;
+        gro->segs = 1;
+    }
+    gro->next_seq = ldl_be_p(pkt + seg.l4_off +
+                             offsetof(struct tcp_header, th_seq)) + payload;
+
+    /* Only the last segment may be short, or ask to be pushed */
+    if (push || payload < gro->mss) {
+        net_gro_flush(gro);
+    }
+
+    return true;
+}
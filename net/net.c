@@ -260,6 +260,11 @@ static ssize_t qemu_deliver_packet_iov(NetClientState *sender,
                                        const struct iovec *iov,
                                        int iovcnt,
                                        void *opaque);
+static int qemu_deliver_packet_batch(NetClientState *sender,
+                                     unsigned flags,
+                                     const NetBatchPacket *pkts,
+                                     int count,
+                                     void *opaque);
 
 static void qemu_net_client_setup(NetClientState *nc,
                                   NetClientInfo *info,
@@ -284,7 +289,8 @@ static void qemu_net_client_setup(NetClientState *nc,
     }
     QTAILQ_INSERT_TAIL(&net_clients, nc, next);
 
-    nc->incoming_queue = qemu_new_net_queue(qemu_deliver_packet_iov, nc);
+    nc->incoming_queue = qemu_new_net_queue(qemu_deliver_packet_iov,
+                                            qemu_deliver_packet_batch, nc);
     nc->destructor = destructor;
     nc->is_datapath = is_datapath;
     QTAILQ_INIT(&nc->filters);
@@ -559,6 +565,19 @@ void qemu_set_offload(NetClientState *nc, const NetOffloads *ol)
     nc->info->set_offload(nc, ol);
 }
 
+/*
+ * Move the event handlers of @nc to @ctx, or back to the main loop if @ctx
+ * is NULL.  Only clients that implement ->set_aio_context() can be moved.
+ */
+void qemu_set_aio_context(NetClientState *nc, AioContext *ctx)
+{
+    if (!nc || !nc->info->set_aio_context) {
+        return;
+    }
+
+    nc->info->set_aio_context(nc, ctx);
+}
+
 int qemu_get_vnet_hdr_len(NetClientState *nc)
 {
     if (!nc) {
@@ -826,6 +845,27 @@ static ssize_t nc_sendv_compat(NetClientState *nc, const struct iovec *iov,
     return ret;
 }
 
+/*
+ * Returns the reentrancy guard of NIC @nc, engaged, if it was not already;
+ * the caller disengages it once the NIC is done receiving.
+ */
+static MemReentrancyGuard *qemu_net_reentrancy_guard_enter(NetClientState *nc)
+{
+    MemReentrancyGuard *guard;
+
+    if (nc->info->type != NET_CLIENT_DRIVER_NIC) {
+        return NULL;
+    }
+
+    guard = qemu_get_nic(nc)->reentrancy_guard;
+    if (guard->engaged_in_io) {
+        return NULL;
+    }
+    guard->engaged_in_io = true;
+
+    return guard;
+}
+
 static ssize_t qemu_deliver_packet_iov(NetClientState *sender,
                                        unsigned flags,
                                        const struct iovec *iov,
@@ -847,13 +887,7 @@ static ssize_t qemu_deliver_packet_iov(NetClientState *sender,
         return 0;
     }
 
-    if (nc->info->type != NET_CLIENT_DRIVER_NIC ||
-        qemu_get_nic(nc)->reentrancy_guard->engaged_in_io) {
-        owned_reentrancy_guard = NULL;
-    } else {
-        owned_reentrancy_guard = qemu_get_nic(nc)->reentrancy_guard;
-        owned_reentrancy_guard->engaged_in_io = true;
-    }
+    owned_reentrancy_guard = qemu_net_reentrancy_guard_enter(nc);
 
     if ((flags & QEMU_NET_PACKET_FLAG_RAW) && nc->vnet_hdr_len) {
         iov_copy = g_new(struct iovec, iovcnt + 1);
@@ -881,6 +915,50 @@ static ssize_t qemu_deliver_packet_iov(NetClientState *sender,
     return ret;
 }
 
+static int qemu_deliver_packet_batch(NetClientState *sender,
+                                     unsigned flags,
+                                     const NetBatchPacket *pkts,
+                                     int count,
+                                     void *opaque)
+{
+    MemReentrancyGuard *owned_reentrancy_guard;
+    NetClientState *nc = opaque;
+    int i;
+
+    if (nc->link_down) {
+        return count;
+    }
+
+    if (!nc->info->receive_batch ||
+        ((flags & QEMU_NET_PACKET_FLAG_RAW) && nc->vnet_hdr_len)) {
+        for (i = 0; i < count; i++) {
+            if (qemu_deliver_packet_iov(sender, flags, pkts[i].iov,
+                                        pkts[i].iovcnt, opaque) == 0) {
+                break;
+            }
+        }
+        return i;
+    }
+
+    if (nc->receive_disabled) {
+        return 0;
+    }
+
+    owned_reentrancy_guard = qemu_net_reentrancy_guard_enter(nc);
+
+    i = nc->info->receive_batch(nc, pkts, count);
+
+    if (owned_reentrancy_guard) {
+        owned_reentrancy_guard->engaged_in_io = false;
+    }
+
+    if (i < count) {
+        nc->receive_disabled = 1;
+    }
+
+    return i;
+}
+
 ssize_t qemu_sendv_packet_async(NetClientState *sender,
                                 const struct iovec *iov, int iovcnt,
                                 NetPacketSent *sent_cb)
@@ -917,6 +995,50 @@ ssize_t qemu_sendv_packet_async(NetClientState *sender,
                                    iov, iovcnt, sent_cb);
 }
 
+/*
+ * Send the @count packets of @pkts as one burst, that the peer can receive
+ * in a single go.  Returns the number of packets that were delivered or
+ * dropped.  If that is less than @count, the remaining packets have been
+ * queued: the caller must not send any more until @sent_cb is called.
+ */
+int qemu_sendv_batch_async(NetClientState *sender,
+                           const NetBatchPacket *pkts, int count,
+                           NetPacketSent *sent_cb)
+{
+    int i, queued = -1;
+
+    if (sender->link_down || !sender->peer) {
+        return count;
+    }
+
+    for (i = 0; i < count; i++) {
+        if (iov_size(pkts[i].iov, pkts[i].iovcnt) > NET_BUFSIZE) {
+            break;
+        }
+    }
+
+    if (i < count || !QTAILQ_EMPTY(&sender->filters) ||
+        !QTAILQ_EMPTY(&sender->peer->filters)) {
+        /*
+         * Filters work on one packet at a time.  Only the first packet
+         * that gets queued carries @sent_cb: the ones after it are queued
+         * behind it anyway.
+         */
+        for (i = 0; i < count; i++) {
+            if (!qemu_sendv_packet_async(sender, pkts[i].iov, pkts[i].iovcnt,
+                                         queued < 0 ? sent_cb : NULL) &&
+                queued < 0) {
+                queued = i;
+            }
+        }
+        return queued < 0 ? count : queued;
+    }
+
+    return qemu_net_queue_send_batch(sender->peer->incoming_queue, sender,
+                                     QEMU_NET_PACKET_FLAG_NONE,
+                                     pkts, count, sent_cb);
+}
+
 ssize_t
 qemu_sendv_packet(NetClientState *nc, const struct iovec *iov, int iovcnt)
 {
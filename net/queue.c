@@ -38,6 +38,10 @@
  *
  * If a sent callback isn't provided, we just drop the packet to avoid
  * unbounded queueing.
+ *
+ * A burst sent with qemu_net_queue_send_batch() is queued from the first
+ * packet that could not be delivered on, and only the last packet of the
+ * burst carries the sent callback, so it is invoked once for the burst.
  */
 
 struct NetPacket {
@@ -54,13 +58,16 @@ struct NetQueue {
     uint32_t nq_maxlen;
     uint32_t nq_count;
     NetQueueDeliverFunc *deliver;
+    NetQueueDeliverBatchFunc *deliver_batch;
 
     QTAILQ_HEAD(, NetPacket) packets;
 
     unsigned delivering : 1;
 };
 
-NetQueue *qemu_new_net_queue(NetQueueDeliverFunc *deliver, void *opaque)
+NetQueue *qemu_new_net_queue(NetQueueDeliverFunc *deliver,
+                             NetQueueDeliverBatchFunc *deliver_batch,
+                             void *opaque)
 {
     NetQueue *queue;
 
@@ -70,6 +77,7 @@ NetQueue *qemu_new_net_queue(NetQueueDeliverFunc *deliver, void *opaque)
     queue->nq_maxlen = 10000;
     queue->nq_count = 0;
     queue->deliver = deliver;
+    queue->deliver_batch = deliver_batch;
 
     QTAILQ_INIT(&queue->packets);
 
@@ -113,20 +121,17 @@ static void qemu_net_queue_append(NetQueue *queue,
     QTAILQ_INSERT_TAIL(&queue->packets, packet, entry);
 }
 
-void qemu_net_queue_append_iov(NetQueue *queue,
-                               NetClientState *sender,
-                               unsigned flags,
-                               const struct iovec *iov,
-                               int iovcnt,
-                               NetPacketSent *sent_cb)
+static void qemu_net_queue_insert_iov(NetQueue *queue,
+                                      NetClientState *sender,
+                                      unsigned flags,
+                                      const struct iovec *iov,
+                                      int iovcnt,
+                                      NetPacketSent *sent_cb)
 {
     NetPacket *packet;
     size_t max_len = 0;
     int i;
 
-    if (queue->nq_count >= queue->nq_maxlen && !sent_cb) {
-        return; /* drop if queue full and no callback */
-    }
     for (i = 0; i < iovcnt; i++) {
         max_len += iov[i].iov_len;
     }
@@ -148,6 +153,38 @@ void qemu_net_queue_append_iov(NetQueue *queue,
     QTAILQ_INSERT_TAIL(&queue->packets, packet, entry);
 }
 
+void qemu_net_queue_append_iov(NetQueue *queue,
+                               NetClientState *sender,
+                               unsigned flags,
+                               const struct iovec *iov,
+                               int iovcnt,
+                               NetPacketSent *sent_cb)
+{
+    if (queue->nq_count >= queue->nq_maxlen && !sent_cb) {
+        return; /* drop if queue full and no callback */
+    }
+    qemu_net_queue_insert_iov(queue, sender, flags, iov, iovcnt, sent_cb);
+}
+
+static void qemu_net_queue_append_batch(NetQueue *queue,
+                                        NetClientState *sender,
+                                        unsigned flags,
+                                        const NetBatchPacket *pkts,
+                                        int count,
+                                        NetPacketSent *sent_cb)
+{
+    int i;
+
+    if (queue->nq_count >= queue->nq_maxlen && !sent_cb) {
+        return; /* drop if queue full and no callback */
+    }
+    for (i = 0; i < count; i++) {
+        qemu_net_queue_insert_iov(queue, sender, flags,
+                                  pkts[i].iov, pkts[i].iovcnt,
+                                  i == count - 1 ? sent_cb : NULL);
+    }
+}
+
 static ssize_t qemu_net_queue_deliver(NetQueue *queue,
                                       NetClientState *sender,
                                       unsigned flags,
@@ -182,6 +219,30 @@ static ssize_t qemu_net_queue_deliver_iov(NetQueue *queue,
     return ret;
 }
 
+static int qemu_net_queue_deliver_batch(NetQueue *queue,
+                                        NetClientState *sender,
+                                        unsigned flags,
+                                        const NetBatchPacket *pkts,
+                                        int count)
+{
+    int i;
+
+    queue->delivering = 1;
+    if (queue->deliver_batch) {
+        i = queue->deliver_batch(sender, flags, pkts, count, queue->opaque);
+    } else {
+        for (i = 0; i < count; i++) {
+            if (queue->deliver(sender, flags, pkts[i].iov, pkts[i].iovcnt,
+                               queue->opaque) == 0) {
+                break;
+            }
+        }
+    }
+    queue->delivering = 0;
+
+    return i;
+}
+
 ssize_t qemu_net_queue_receive(NetQueue *queue,
                                const uint8_t *data,
                                size_t size)
@@ -243,6 +304,37 @@ ssize_t qemu_net_queue_send_iov(NetQueue *queue,
     return ret;
 }
 
+/*
+ * Returns the number of packets of the burst that were delivered or
+ * discarded.  If that is less than @count, the remaining packets have
+ * been queued and @sent_cb will be called once they are delivered.
+ */
+int qemu_net_queue_send_batch(NetQueue *queue,
+                              NetClientState *sender,
+                              unsigned flags,
+                              const NetBatchPacket *pkts,
+                              int count,
+                              NetPacketSent *sent_cb)
+{
+    int done;
+
+    if (queue->delivering || !qemu_can_send_packet(sender)) {
+        qemu_net_queue_append_batch(queue, sender, flags, pkts, count, sent_cb);
+        return 0;
+    }
+
+    done = qemu_net_queue_deliver_batch(queue, sender, flags, pkts, count);
+    if (done < count) {
+        qemu_net_queue_append_batch(queue, sender, flags, pkts + done,
+                                    count - done, sent_cb);
+        return done;
+    }
+
+    qemu_net_queue_flush(queue);
+
+    return count;
+}
+
 void qemu_net_queue_purge(NetQueue *queue, NetClientState *from)
 {
     NetPacket *packet, *next;
@@ -67,12 +67,21 @@ static const int kernel_feature_bits[] = {
     VHOST_INVALID_FEATURE_BIT
 };
 
+/*
+ * When the host keeps receiving more packets while tap_send() is running we
+ * can hog the BQL.  Limit the number of packets that are processed per
+ * tap_send() callback to prevent stalling the guest.
+ */
+#define TAP_BATCH_MAX 50
+#define TAP_BATCH_BUFSIZE (2 * NET_BUFSIZE)
+
 typedef struct TAPState {
     NetClientState nc;
     int fd;
     char down_script[1024];
     char down_script_arg[128];
-    uint8_t buf[NET_BUFSIZE];
+    /* room for a burst of packets, read back to back */
+    uint8_t buf[TAP_BATCH_BUFSIZE];
     bool read_poll;
     bool write_poll;
     bool using_vnet_hdr;
@@ -83,6 +92,7 @@ typedef struct TAPState {
     VHostNetState *vhost_net;
     unsigned host_vnet_hdr_len;
     Notifier exit;
+    AioContext *ctx; /* NULL for the main loop */
 } TAPState;
 
 static void launch_script(const char *setup_script, const char *ifname,
@@ -91,12 +101,17 @@ static void launch_script(const char *setup_script, const char *ifname,
 static void tap_send(void *opaque);
 static void tap_writable(void *opaque);
 
+static AioContext *tap_get_aio_context(TAPState *s)
+{
+    return s->ctx ? s->ctx : iohandler_get_aio_context();
+}
+
 static void tap_update_fd_handler(TAPState *s)
 {
-    qemu_set_fd_handler(s->fd,
-                        s->read_poll && s->enabled ? tap_send : NULL,
-                        s->write_poll && s->enabled ? tap_writable : NULL,
-                        s);
+    aio_set_fd_handler(tap_get_aio_context(s), s->fd,
+                       s->read_poll && s->enabled ? tap_send : NULL,
+                       s->write_poll && s->enabled ? tap_writable : NULL,
+                       NULL, NULL, s);
 }
 
 static void tap_read_poll(TAPState *s, bool enable)
@@ -180,15 +195,20 @@ static void tap_send_completed(NetClientState *nc, ssize_t len)
 static void tap_send(void *opaque)
 {
     TAPState *s = opaque;
+    NetBatchPacket pkts[TAP_BATCH_MAX];
+    struct iovec iov[TAP_BATCH_MAX];
+    size_t offset = 0;
+    int count = 0;
     int size;
-    int packets = 0;
 
-    while (true) {
-        uint8_t *buf = s->buf;
-        uint8_t min_pkt[ETH_ZLEN];
-        size_t min_pktsz = sizeof(min_pkt);
+    /*
+     * Read as many packets as fit in s->buf, so that they reach the peer
+     * as a single burst.  Each read must be able to take a whole packet.
+     */
+    while (count < TAP_BATCH_MAX && sizeof(s->buf) - offset >= NET_BUFSIZE) {
+        uint8_t *buf = s->buf + offset;
 
-        size = tap_read_packet(s->fd, s->buf, sizeof(s->buf));
+        size = tap_read_packet(s->fd, buf, NET_BUFSIZE);
         if (size <= 0) {
             break;
         }
@@ -197,37 +217,31 @@ static void tap_send(void *opaque)
             /* Invalid packet */
             break;
         }
+        offset += size;
 
         if (s->host_vnet_hdr_len && !s->using_vnet_hdr) {
             buf  += s->host_vnet_hdr_len;
             size -= s->host_vnet_hdr_len;
         }
 
-        if (net_peer_needs_padding(&s->nc)) {
-            if (eth_pad_short_frame(min_pkt, &min_pktsz, buf, size)) {
-                buf = min_pkt;
-                size = min_pktsz;
-            }
+        /* Pad in place, a short frame leaves plenty of room behind it */
+        if (net_peer_needs_padding(&s->nc) && size < ETH_ZLEN) {
+            memset(buf + size, 0, ETH_ZLEN - size);
+            offset += ETH_ZLEN - size;
+            size = ETH_ZLEN;
         }
 
-        size = qemu_send_packet_async(&s->nc, buf, size, tap_send_completed);
-        if (size == 0) {
-            tap_read_poll(s, false);
-            break;
-        } else if (size < 0) {
-            break;
-        }
+        iov[count].iov_base = buf;
+        iov[count].iov_len = size;
+        pkts[count].iov = &iov[count];
+        pkts[count].iovcnt = 1;
+        count++;
+    }
 
-        /*
-         * When the host keeps receiving more packets while tap_send() is
-         * running we can hog the BQL.  Limit the number of
-         * packets that are processed per tap_send() callback to prevent
-         * stalling the guest.
-         */
-        packets++;
-        if (packets >= 50) {
-            break;
-        }
+    if (count &&
+        qemu_sendv_batch_async(&s->nc, pkts, count,
+                               tap_send_completed) < count) {
+        tap_read_poll(s, false);
     }
 }
 
@@ -347,6 +361,16 @@ static void tap_poll(NetClientState *nc, bool enable)
     tap_write_poll(s, enable);
 }
 
+static void tap_set_aio_context(NetClientState *nc, AioContext *ctx)
+{
+    TAPState *s = DO_UPCAST(TAPState, nc, nc);
+
+    aio_set_fd_handler(tap_get_aio_context(s), s->fd, NULL, NULL, NULL, NULL,
+                       NULL);
+    s->ctx = ctx;
+    tap_update_fd_handler(s);
+}
+
 static bool tap_set_steering_ebpf(NetClientState *nc, int prog_fd)
 {
     TAPState *s = DO_UPCAST(TAPState, nc, nc);
@@ -394,6 +418,7 @@ static NetClientInfo net_tap_info = {
     .set_vnet_be = tap_set_vnet_be,
     .set_steering_ebpf = tap_set_steering_ebpf,
     .get_vhost_net = tap_get_vhost_net,
+    .set_aio_context = tap_set_aio_context,
 };
 
 static TAPState *net_tap_fd_init(NetClientState *peer,
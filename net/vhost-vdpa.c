@@ -21,6 +21,7 @@
 #include "qemu/memalign.h"
 #include "qemu/option.h"
 #include "qapi/error.h"
+#include "system/iothread.h"
 #include <linux/vhost.h>
 #include <sys/ioctl.h>
 #include <err.h>
@@ -47,6 +48,9 @@ typedef struct VhostVDPAState {
     /* The device can isolate CVQ in its own ASID */
     bool cvq_isolated;
 
+    /* IOThread running the data queues SVQs, if any */
+    IOThread *svq_iothread;
+
     bool started;
 } VhostVDPAState;
 
@@ -236,6 +240,10 @@ static void vhost_vdpa_cleanup(NetClientState *nc)
         g_free(s->vhost_net);
         s->vhost_net = NULL;
     }
+    if (s->svq_iothread) {
+        object_unref(OBJECT(s->svq_iothread));
+        s->svq_iothread = NULL;
+    }
     if (s->vhost_vdpa.index != 0) {
         return;
     }
@@ -1684,6 +1692,7 @@ static NetClientState *net_vhost_vdpa_init(NetClientState *peer,
                                        int nvqs,
                                        bool is_datapath,
                                        bool svq,
+                                       IOThread *svq_iothread,
                                        struct vhost_vdpa_iova_range iova_range,
                                        uint64_t features,
                                        VhostVDPAShared *shared,
@@ -1740,6 +1749,11 @@ static NetClientState *net_vhost_vdpa_init(NetClientState *peer,
     if (queue_pair_index != 0) {
         s->vhost_vdpa.shared = shared;
     }
+    if (svq_iothread) {
+        s->svq_iothread = svq_iothread;
+        object_ref(OBJECT(svq_iothread));
+        s->vhost_vdpa.shadow_vq_ctx = iothread_get_aio_context(svq_iothread);
+    }
 
     ret = vhost_vdpa_add(nc, (void *)&s->vhost_vdpa, queue_pair_index, nvqs);
     if (ret) {
@@ -1801,6 +1815,7 @@ int net_init_vhost_vdpa(const Netdev *netdev, const char *name,
     uint64_t features;
     int vdpa_device_fd;
     g_autofree NetClientState **ncs = NULL;
+    g_autoptr(GPtrArray) svq_iothreads = g_ptr_array_new();
     struct vhost_vdpa_iova_range iova_range;
     NetClientState *nc;
     int queue_pairs, r, i = 0, has_cvq = 0;
@@ -1855,17 +1870,34 @@ int net_init_vhost_vdpa(const Netdev *netdev, const char *name,
         goto err;
     }
 
+    for (strList *l = opts->x_svq_iothreads; l; l = l->next) {
+        IOThread *iothread = iothread_by_id(l->value);
+
+        if (!iothread) {
+            error_setg(errp, "vhost-vdpa: IOThread '%s' not found", l->value);
+            goto err;
+        }
+        g_ptr_array_add(svq_iothreads, iothread);
+    }
+
     ncs = g_malloc0(sizeof(*ncs) * queue_pairs);
 
     for (i = 0; i < queue_pairs; i++) {
         VhostVDPAShared *shared = NULL;
+        IOThread *svq_iothread = NULL;
 
         if (i) {
             shared = DO_UPCAST(VhostVDPAState, nc, ncs[0])->vhost_vdpa.shared;
         }
+        if (svq_iothreads->len) {
+            /* Spread the queue pairs among the IOThreads */
+            svq_iothread = g_ptr_array_index(svq_iothreads,
+                                             i % svq_iothreads->len);
+        }
         ncs[i] = net_vhost_vdpa_init(peer, TYPE_VHOST_VDPA, name,
                                      vdpa_device_fd, i, 2, true, opts->x_svq,
-                                     iova_range, features, shared, errp);
+                                     svq_iothread, iova_range, features,
+                                     shared, errp);
         if (!ncs[i])
             goto err;
     }
@@ -1876,8 +1908,8 @@ int net_init_vhost_vdpa(const Netdev *netdev, const char *name,
 
         nc = net_vhost_vdpa_init(peer, TYPE_VHOST_VDPA, name,
                                  vdpa_device_fd, i, 1, false,
-                                 opts->x_svq, iova_range, features, shared,
-                                 errp);
+                                 opts->x_svq, NULL, iova_range, features,
+                                 shared, errp);
         if (!nc)
             goto err;
     }
@@ -189,6 +189,15 @@ void qemu_plugin_register_vcpu_mem_inline_per_vcpu(
     plugin_register_inline_op_on_entry(&insn->mem_cbs, rw, op, entry, imm);
 }
 
+void qemu_plugin_register_vcpu_mem_batch_cb(
+    struct qemu_plugin_insn *insn,
+    enum qemu_plugin_mem_rw rw,
+    struct qemu_plugin_mem_batch *batch)
+{
+    plugin_register_vcpu_mem_batch_cb(&insn->insn_cbs, &insn->mem_cbs, rw,
+                                      insn->vaddr, batch);
+}
+
 void qemu_plugin_register_vcpu_tb_trans_cb(qemu_plugin_id_t id,
                                            qemu_plugin_vcpu_tb_trans_cb_t cb)
 {
@@ -601,6 +610,26 @@ void qemu_plugin_scoreboard_free(struct qemu_plugin_scoreboard *score)
     plugin_scoreboard_free(score);
 }
 
+struct qemu_plugin_mem_batch *
+qemu_plugin_mem_batch_new(size_t n_records,
+                          qemu_plugin_vcpu_mem_batch_cb_t cb,
+                          void *userdata)
+{
+    return plugin_mem_batch_new(n_records, cb, userdata);
+}
+
+void qemu_plugin_mem_batch_free(struct qemu_plugin_mem_batch *batch)
+{
+    plugin_mem_batch_free(batch);
+}
+
+void qemu_plugin_mem_batch_flush(struct qemu_plugin_mem_batch *batch,
+                                 unsigned int vcpu_index)
+{
+    g_assert(vcpu_index < qemu_plugin_num_vcpus());
+    plugin_mem_batch_flush(batch, vcpu_index);
+}
+
 void *qemu_plugin_scoreboard_find(struct qemu_plugin_scoreboard *score,
                                   unsigned int vcpu_index)
 {
@@ -637,9 +666,26 @@ void qemu_plugin_u64_set(qemu_plugin_u64 entry, unsigned int vcpu_index,
 
 uint64_t qemu_plugin_u64_sum(qemu_plugin_u64 entry)
 {
+    GArray *arr = entry.score->data;
+    size_t stride = g_array_get_element_size(arr);
+    const char *base = arr->data + entry.offset;
+    int n = qemu_plugin_num_vcpus();
     uint64_t total = 0;
-    for (int i = 0, n = qemu_plugin_num_vcpus(); i < n; ++i) {
-        total += qemu_plugin_u64_get(entry, i);
+
+    /*
+     * Walk the scoreboard directly rather than through
+     * qemu_plugin_u64_get(); a plain uint64_t scoreboard is a
+     * contiguous array the compiler can vectorize.
+     */
+    if (stride == sizeof(uint64_t)) {
+        const uint64_t *p = (const uint64_t *)base;
+        for (int i = 0; i < n; ++i) {
+            total += p[i];
+        }
+    } else {
+        for (int i = 0; i < n; ++i) {
+            total += *(const uint64_t *)(base + i * stride);
+        }
     }
     return total;
 }
@@ -306,8 +306,15 @@ void qemu_plugin_vcpu_init_hook(CPUState *cpu)
 
 void qemu_plugin_vcpu_exit_hook(CPUState *cpu)
 {
+    struct qemu_plugin_mem_batch *batch;
     bool success;
 
+    qemu_rec_mutex_lock(&plugin.lock);
+    QLIST_FOREACH(batch, &plugin.mem_batches, entry) {
+        plugin_mem_batch_flush(batch, cpu->cpu_index);
+    }
+    qemu_rec_mutex_unlock(&plugin.lock);
+
     qemu_plugin_set_cb_flags(cpu, QEMU_PLUGIN_CB_RW_REGS);
     plugin_vcpu_cb__simple(cpu, QEMU_PLUGIN_EV_VCPU_EXIT);
     qemu_plugin_set_cb_flags(cpu, QEMU_PLUGIN_CB_NO_REGS);
@@ -491,6 +498,98 @@ void plugin_register_vcpu_mem_cb(GArray **arr,
     dyn_cb->regular = regular_cb;
 }
 
+static uint64_t *plugin_mem_batch_buf(struct qemu_plugin_mem_batch *batch,
+                                      unsigned int vcpu_index)
+{
+    GArray *arr = batch->score->data;
+    size_t entry_size = g_array_get_element_size(arr);
+
+    return (uint64_t *)(arr->data + vcpu_index * entry_size);
+}
+
+/*
+ * Disable CFI checks.
+ * The callback function has been loaded from an external library so we do not
+ * have type information
+ */
+QEMU_DISABLE_CFI
+void plugin_mem_batch_flush(struct qemu_plugin_mem_batch *batch,
+                            unsigned int vcpu_index)
+{
+    uint64_t *count = plugin_mem_batch_buf(batch, vcpu_index);
+    char *records = (char *)count + QEMU_PLUGIN_MEM_BATCH_HDR;
+    size_t n = MIN(*count, batch->n_records + QEMU_PLUGIN_MEM_BATCH_SLACK);
+
+    if (n) {
+        batch->cb(vcpu_index, (qemu_plugin_mem_record *)records, n,
+                  batch->userdata);
+        *count = 0;
+    }
+}
+
+static void plugin_mem_batch_flush_cb(unsigned int vcpu_index, void *udata)
+{
+    plugin_mem_batch_flush(udata, vcpu_index);
+}
+
+static void plugin_mem_batch_record(struct qemu_plugin_mem_batch_cb *cb,
+                                    unsigned int vcpu_index,
+                                    qemu_plugin_meminfo_t info,
+                                    uint64_t vaddr)
+{
+    struct qemu_plugin_mem_batch *batch = cb->batch;
+    uint64_t *count = plugin_mem_batch_buf(batch, vcpu_index);
+    qemu_plugin_mem_record *rec = (qemu_plugin_mem_record *)
+        ((char *)count + QEMU_PLUGIN_MEM_BATCH_HDR);
+
+    rec += MIN(*count, batch->n_records + QEMU_PLUGIN_MEM_BATCH_SLACK - 1);
+    rec->vaddr = vaddr;
+    rec->pc = cb->pc;
+    rec->info = info;
+    if (++*count >= batch->n_records) {
+        plugin_mem_batch_flush(batch, vcpu_index);
+    }
+}
+
+void plugin_register_vcpu_mem_batch_cb(GArray **insn_arr, GArray **mem_arr,
+                                       enum qemu_plugin_mem_rw rw,
+                                       uint64_t pc,
+                                       struct qemu_plugin_mem_batch *batch)
+{
+    /*
+     * The flush runs the plugin's batch callback, which has no access
+     * to guest registers.
+     */
+    static TCGHelperInfo info = {
+        .flags = TCG_CALL_NO_RWG,
+        /*
+         * Match qemu_plugin_vcpu_udata_cb_t:
+         *   void (*)(uint32_t, void *)
+         */
+        .typemask = (dh_typemask(void, 0) |
+                     dh_typemask(i32, 1) |
+                     dh_typemask(ptr, 2))
+    };
+    struct qemu_plugin_mem_batch_cb batch_cb = {
+        .batch = batch,
+        .flush = plugin_mem_batch_flush_cb,
+        .info = &info,
+        .pc = pc,
+        .rw = rw,
+    };
+    struct qemu_plugin_dyn_cb *dyn_cb;
+
+    /* flush check at insn start */
+    dyn_cb = plugin_get_dyn_cb(insn_arr);
+    dyn_cb->type = PLUGIN_CB_MEM_BATCH;
+    dyn_cb->mem_batch = batch_cb;
+
+    /* record store on every access */
+    dyn_cb = plugin_get_dyn_cb(mem_arr);
+    dyn_cb->type = PLUGIN_CB_MEM_BATCH;
+    dyn_cb->mem_batch = batch_cb;
+}
+
 /*
  * Disable CFI checks.
  * The callback function has been loaded from an external library so we do not
@@ -708,6 +807,12 @@ void qemu_plugin_vcpu_mem_cb(CPUState *cpu, uint64_t vaddr,
                 exec_inline_op(cb->type, &cb->inline_insn, cpu->cpu_index);
             }
             break;
+        case PLUGIN_CB_MEM_BATCH:
+            if (rw & cb->mem_batch.rw) {
+                plugin_mem_batch_record(&cb->mem_batch, cpu->cpu_index,
+                                        make_plugin_meminfo(oi, rw), vaddr);
+            }
+            break;
         default:
             g_assert_not_reached();
         }
@@ -716,6 +821,18 @@ void qemu_plugin_vcpu_mem_cb(CPUState *cpu, uint64_t vaddr,
 
 void qemu_plugin_atexit_cb(void)
 {
+    struct qemu_plugin_mem_batch *batch;
+    int i;
+
+    /* deliver whatever is still buffered before the plugins wrap up */
+    qemu_rec_mutex_lock(&plugin.lock);
+    QLIST_FOREACH(batch, &plugin.mem_batches, entry) {
+        for (i = 0; i < plugin.num_vcpus; i++) {
+            plugin_mem_batch_flush(batch, i);
+        }
+    }
+    qemu_rec_mutex_unlock(&plugin.lock);
+
     plugin_cb__udata(QEMU_PLUGIN_EV_ATEXIT);
 }
 
@@ -805,6 +922,7 @@ static void __attribute__((__constructor__)) plugin_init(void)
     plugin.id_ht = g_hash_table_new(g_int64_hash, g_int64_equal);
     plugin.cpu_ht = g_hash_table_new(g_int_hash, g_int_equal);
     QLIST_INIT(&plugin.scoreboards);
+    QLIST_INIT(&plugin.mem_batches);
     plugin.scoreboard_alloc_size = 16; /* avoid frequent reallocation */
     QTAILQ_INIT(&plugin.ctxs);
     qht_init(&plugin.dyn_cb_arr_ht, plugin_dyn_cb_arr_cmp, 16,
@@ -841,6 +959,44 @@ void plugin_scoreboard_free(struct qemu_plugin_scoreboard *score)
     g_free(score);
 }
 
+struct qemu_plugin_mem_batch *
+plugin_mem_batch_new(size_t n_records, qemu_plugin_vcpu_mem_batch_cb_t cb,
+                     void *userdata)
+{
+    struct qemu_plugin_mem_batch *batch;
+
+    g_assert(n_records > 0);
+    batch = g_new0(struct qemu_plugin_mem_batch, 1);
+    batch->score = plugin_scoreboard_new(QEMU_PLUGIN_MEM_BATCH_HDR +
+                                         (n_records +
+                                          QEMU_PLUGIN_MEM_BATCH_SLACK) *
+                                         sizeof(qemu_plugin_mem_record));
+    batch->n_records = n_records;
+    batch->cb = cb;
+    batch->userdata = userdata;
+
+    qemu_rec_mutex_lock(&plugin.lock);
+    QLIST_INSERT_HEAD(&plugin.mem_batches, batch, entry);
+    qemu_rec_mutex_unlock(&plugin.lock);
+
+    return batch;
+}
+
+void plugin_mem_batch_free(struct qemu_plugin_mem_batch *batch)
+{
+    int i;
+
+    qemu_rec_mutex_lock(&plugin.lock);
+    for (i = 0; i < plugin.num_vcpus; i++) {
+        plugin_mem_batch_flush(batch, i);
+    }
+    QLIST_REMOVE(batch, entry);
+    qemu_rec_mutex_unlock(&plugin.lock);
+
+    plugin_scoreboard_free(batch->score);
+    g_free(batch);
+}
+
 enum qemu_plugin_cb_flags tcg_call_to_qemu_plugin_cb_flags(int flags)
 {
     if (flags & TCG_CALL_NO_RWG) {
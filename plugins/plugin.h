@@ -34,6 +34,7 @@ struct qemu_plugin_state {
     GHashTable *cpu_ht;
     QLIST_HEAD(, qemu_plugin_scoreboard) scoreboards;
     size_t scoreboard_alloc_size;
+    QLIST_HEAD(, qemu_plugin_mem_batch) mem_batches;
     DECLARE_BITMAP(mask, QEMU_PLUGIN_EV_MAX);
     /*
      * @lock protects the struct as well as ctx->uninstalling.
@@ -109,6 +110,11 @@ void plugin_register_vcpu_mem_cb(GArray **arr,
                                  enum qemu_plugin_mem_rw rw,
                                  void *udata);
 
+void plugin_register_vcpu_mem_batch_cb(GArray **insn_arr, GArray **mem_arr,
+                                       enum qemu_plugin_mem_rw rw,
+                                       uint64_t pc,
+                                       struct qemu_plugin_mem_batch *batch);
+
 void exec_inline_op(enum plugin_dyn_cb_type type,
                     struct qemu_plugin_inline_cb *cb,
                     int cpu_index);
@@ -119,6 +125,15 @@ struct qemu_plugin_scoreboard *plugin_scoreboard_new(size_t element_size);
 
 void plugin_scoreboard_free(struct qemu_plugin_scoreboard *score);
 
+struct qemu_plugin_mem_batch *
+plugin_mem_batch_new(size_t n_records, qemu_plugin_vcpu_mem_batch_cb_t cb,
+                     void *userdata);
+
+void plugin_mem_batch_free(struct qemu_plugin_mem_batch *batch);
+
+void plugin_mem_batch_flush(struct qemu_plugin_mem_batch *batch,
+                            unsigned int vcpu_index);
+
 /**
  * qemu_plugin_fillin_mode_info() - populate mode specific info
  * info: pointer to qemu_info_t structure
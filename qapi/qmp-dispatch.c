@@ -16,7 +16,9 @@
 #include "qemu/aio.h"
 #include "qapi/compat-policy.h"
 #include "qapi/error.h"
+#include "qapi/json-output-visitor.h"
 #include "qapi/qmp-registry.h"
+#include "qobject/json-writer.h"
 #include "qobject/qdict.h"
 #include "qobject/qjson.h"
 #include "qapi/qobject-input-visitor.h"
@@ -41,6 +43,58 @@ Visitor *qobject_output_visitor_new_qmp(QObject **result)
     return v;
 }
 
+/*
+ * Where the reply of the command being run goes, if it streams it.
+ * Only one command that is not run out-of-band runs at a time.
+ */
+static QmpReplyStream *qmp_cur_stream;
+
+Visitor *qmp_output_visitor_new_stream(QObject **result)
+{
+    QmpReplyStream *stream = qmp_cur_stream;
+    Visitor *v;
+
+    if (!stream) {
+        return qobject_output_visitor_new_qmp(result);
+    }
+
+    *result = NULL;
+    assert(!stream->started);
+    stream->started = true;
+    json_writer_start_object(stream->writer, NULL);
+    v = json_output_visitor_new(stream->writer, "return");
+    visit_set_policy(v, &compat_policy);
+    return v;
+}
+
+static void qmp_run_command(const QmpCommand *cmd, QDict *args,
+                            QObject **ret, Error **errp, Monitor *cur_mon,
+                            QmpReplyStream *stream)
+{
+    monitor_set_cur(qemu_coroutine_self(), cur_mon);
+    if (cmd->options & QCO_STREAM_OUTPUT) {
+        assert(!qmp_cur_stream);
+        qmp_cur_stream = stream;
+    }
+    cmd->fn(args, ret, errp);
+    qmp_cur_stream = NULL;
+    monitor_set_cur(qemu_coroutine_self(), NULL);
+
+    if (stream && stream->started) {
+        /*
+         * Output visitors don't fail, so the return value was written
+         * completely.  Finish the reply right away, the writer may hold
+         * a lock until it's done.
+         */
+        assert(!*errp);
+        if (stream->id) {
+            qobject_to_json_writer(stream->writer, "id", stream->id);
+        }
+        json_writer_end_object(stream->writer);
+        stream->done(stream);
+    }
+}
+
 static QDict *qmp_dispatch_check_obj(QDict *dict, bool allow_oob,
                                      Error **errp)
 {
@@ -113,6 +167,7 @@ bool qmp_is_oob(const QDict *dict)
 typedef struct QmpDispatchBH {
     const QmpCommand *cmd;
     Monitor *cur_mon;
+    QmpReplyStream *stream;
     QDict *args;
     QObject **ret;
     Error **errp;
@@ -124,18 +179,23 @@ static void do_qmp_dispatch_bh(void *opaque)
     QmpDispatchBH *data = opaque;
 
     assert(monitor_cur() == NULL);
-    monitor_set_cur(qemu_coroutine_self(), data->cur_mon);
-    data->cmd->fn(data->args, data->ret, data->errp);
-    monitor_set_cur(qemu_coroutine_self(), NULL);
+    qmp_run_command(data->cmd, data->args, data->ret, data->errp,
+                    data->cur_mon, data->stream);
     aio_co_wake(data->co);
 }
 
 /*
  * Runs outside of coroutine context for OOB commands, but in coroutine
  * context for everything else.
+ *
+ * If @stream is not null and the command has QCO_STREAM_OUTPUT, a
+ * successful reply is written to @stream and null is returned.
  */
-QDict *coroutine_mixed_fn qmp_dispatch(const QmpCommandList *cmds, QObject *request,
-                                       bool allow_oob, Monitor *cur_mon)
+QDict *coroutine_mixed_fn qmp_dispatch_stream(const QmpCommandList *cmds,
+                                              QObject *request,
+                                              bool allow_oob,
+                                              Monitor *cur_mon,
+                                              QmpReplyStream *stream)
 {
     Error *err = NULL;
     bool oob;
@@ -203,6 +263,11 @@ QDict *coroutine_mixed_fn qmp_dispatch(const QmpCommandList *cmds, QObject *requ
         qobject_ref(args);
     }
 
+    if (stream) {
+        stream->id = id;
+        stream->started = false;
+    }
+
     assert(!(oob && qemu_in_coroutine()));
     assert(monitor_cur() == NULL);
     if (!!(cmd->options & QCO_COROUTINE) == qemu_in_coroutine()) {
@@ -216,9 +281,7 @@ QDict *coroutine_mixed_fn qmp_dispatch(const QmpCommandList *cmds, QObject *requ
             qemu_coroutine_yield();
         }
 
-        monitor_set_cur(qemu_coroutine_self(), cur_mon);
-        cmd->fn(args, &ret, &err);
-        monitor_set_cur(qemu_coroutine_self(), NULL);
+        qmp_run_command(cmd, args, &ret, &err, cur_mon, stream);
 
         if (qemu_in_coroutine()) {
             /*
@@ -248,6 +311,7 @@ QDict *coroutine_mixed_fn qmp_dispatch(const QmpCommandList *cmds, QObject *requ
 
         QmpDispatchBH data = {
             .cur_mon    = cur_mon,
+            .stream     = stream,
             .cmd        = cmd,
             .args       = args,
             .ret        = &ret,
@@ -259,6 +323,10 @@ QDict *coroutine_mixed_fn qmp_dispatch(const QmpCommandList *cmds, QObject *requ
         qemu_coroutine_yield();
     }
     qobject_unref(args);
+    if (stream && stream->started) {
+        /* The reply has been sent already */
+        return NULL;
+    }
     if (err) {
         /* or assert(!ret) after reviewing all handlers: */
         qobject_unref(ret);
@@ -294,3 +362,10 @@ out:
 
     return rsp;
 }
+
+QDict *coroutine_mixed_fn qmp_dispatch(const QmpCommandList *cmds,
+                                       QObject *request, bool allow_oob,
+                                       Monitor *cur_mon)
+{
+    return qmp_dispatch_stream(cmds, request, allow_oob, cur_mon, NULL);
+}
@@ -24,6 +24,7 @@
 
 #include "qemu/osdep.h"
 #include <getopt.h>
+#include <math.h>
 
 #include "qemu/help-texts.h"
 #include "qemu/qemu-progress.h"
@@ -34,6 +35,7 @@
 #include "qapi/qobject-output-visitor.h"
 #include "qobject/qjson.h"
 #include "qobject/qdict.h"
+#include "qobject/qnum.h"
 #include "qemu/cutils.h"
 #include "qemu/config-file.h"
 #include "qemu/option.h"
@@ -87,6 +89,9 @@ enum {
     OPTION_FORCE = 276,
     OPTION_SKIP_BROKEN = 277,
     OPTION_LIMITS = 278,
+    OPTION_RANDOM = 279,
+    OPTION_ZIPF = 280,
+    OPTION_READ_PERCENT = 281,
 };
 
 typedef enum OutputFormat {
@@ -849,6 +854,101 @@ fail:
     return ret;
 }
 
+static int img_dedup(const img_cmd_t *ccmd, int argc, char **argv)
+{
+    Error *local_err = NULL;
+    const char *filename, *fmt = NULL, *cache = BDRV_DEFAULT_CACHE;
+    BlockBackend *blk;
+    int flags = BDRV_O_RDWR;
+    bool writethrough;
+    bool quiet = false;
+    bool image_opts = false;
+    int64_t freed;
+    int c, ret;
+
+    for (;;) {
+        static const struct option long_options[] = {
+            {"help", no_argument, 0, 'h'},
+            {"format", required_argument, 0, 'f'},
+            {"image-opts", no_argument, 0, OPTION_IMAGE_OPTS},
+            {"cache", required_argument, 0, 'T'},
+            {"quiet", no_argument, 0, 'q'},
+            {"object", required_argument, 0, OPTION_OBJECT},
+            {0, 0, 0, 0}
+        };
+        c = getopt_long(argc, argv, "hf:T:q", long_options, NULL);
+        if (c == -1) {
+            break;
+        }
+        switch (c) {
+        case 'h':
+            cmd_help(ccmd, "[-f FMT | --image-opts] [-T CACHE_MODE] [-q]\n"
+"        [--object OBJDEF] FILE\n"
+,
+"  -f, --format FMT\n"
+"     specifies the format of the image explicitly (default: probing is used)\n"
+"  --image-opts\n"
+"     treat FILE as an option string (key=value,..), not a file name\n"
+"     (incompatible with -f|--format)\n"
+"  -T, --cache CACHE_MODE\n"
+"     cache mode (default: " BDRV_DEFAULT_CACHE ")\n"
+"  -q, --quiet\n"
+"     quiet mode (produce only error messages if any)\n"
+"  --object OBJDEF\n"
+"     defines QEMU user-creatable object\n"
+"  FILE\n"
+"     name of the image file, or an option string (key=value,..)\n"
+"     with --image-opts, to operate on\n"
+);
+            break;
+        case 'f':
+            fmt = optarg;
+            break;
+        case OPTION_IMAGE_OPTS:
+            image_opts = true;
+            break;
+        case 'T':
+            cache = optarg;
+            break;
+        case 'q':
+            quiet = true;
+            break;
+        case OPTION_OBJECT:
+            user_creatable_process_cmdline(optarg);
+            break;
+        default:
+            tryhelp(argv[0]);
+        }
+    }
+    if (optind != argc - 1) {
+        error_exit(argv[0], "Expecting one image file name");
+    }
+    filename = argv[optind++];
+
+    ret = bdrv_parse_cache_mode(cache, &flags, &writethrough);
+    if (ret < 0) {
+        error_report("Invalid cache option: %s", cache);
+        return 1;
+    }
+
+    blk = img_open(image_opts, filename, fmt, flags, writethrough, quiet,
+                   false);
+    if (!blk) {
+        return 1;
+    }
+
+    ret = bdrv_dedup(blk_bs(blk), &freed, &local_err);
+    if (freed) {
+        qprintf(quiet, "Freed %" PRId64 " bytes\n", freed);
+    }
+    blk_unref(blk);
+    if (ret < 0) {
+        error_report_err(local_err);
+        return 1;
+    }
+    return 0;
+}
+
 typedef struct CommonBlockJobCBInfo {
     BlockDriverState *bs;
     Error **errp;
@@ -1290,42 +1390,232 @@ static int compare_buffers(const uint8_t *buf1, const uint8_t *buf2,
 
 #define IO_BUF_SIZE (2 * MiB)
 
+/* Number of coroutines that compare ranges of the images in parallel */
+#define COMPARE_COROUTINES 8
+
+typedef struct ImgCompareState {
+    BlockBackend *blk1, *blk2;
+    const char *filename1, *filename2;
+    int64_t total_size1, total_size2;
+    int64_t total_size;         /* size of the smaller image */
+    int64_t progress_base;      /* size of the larger image */
+    bool strict;
+    CoMutex lock;
+    int64_t offset;             /* start of the next range to compare */
+    int running_coroutines;
+    /*
+     * The first difference or error, reported once all coroutines are done
+     * so that it is the one with the lowest offset.  ret is the exit code.
+     */
+    int64_t fail_offset;
+    int ret;
+    char *fail_msg;
+} ImgCompareState;
+
+enum ImgCompareAction {
+    COMPARE_SKIP,               /* identical according to the block status */
+    COMPARE_DATA,               /* read and compare both images */
+    COMPARE_EMPTY1,             /* check that FILE1 reads as zeroes */
+    COMPARE_EMPTY2,             /* check that FILE2 reads as zeroes */
+};
+
+static void G_GNUC_PRINTF(4, 5)
+compare_fail(ImgCompareState *s, int64_t offset, int ret, const char *fmt, ...)
+{
+    va_list ap;
+
+    if (offset >= s->fail_offset) {
+        return;
+    }
+    va_start(ap, fmt);
+    g_free(s->fail_msg);
+    s->fail_msg = g_strdup_vprintf(fmt, ap);
+    va_end(ap);
+    s->fail_offset = offset;
+    s->ret = ret;
+}
+
 /*
- * Check if passed sectors are empty (not allocated or contain only 0 bytes)
- *
- * Intended for use by 'qemu-img compare': Returns 0 in case sectors are
- * filled with 0, 1 if sectors contain non-zero data (this is a comparison
- * failure), and 4 on error (the exit status for read errors), after emitting
- * an error message.
- *
- * @param blk:  BlockBackend for the image
- * @param offset: Starting offset to check
- * @param bytes: Number of bytes to check
- * @param filename: Name of disk file we are checking (logging purpose)
- * @param buffer: Allocated buffer for storing read data
- * @param quiet: Flag for quiet mode
+ * Pick the range starting at s->offset and decide what to do with it.
+ * Returns an ImgCompareAction, or -1 after recording a failure.
  */
-static int check_empty_sectors(BlockBackend *blk, int64_t offset,
-                               int64_t bytes, const char *filename,
-                               uint8_t *buffer, bool quiet)
+static int coroutine_mixed_fn GRAPH_RDLOCK
+compare_next_range(ImgCompareState *s, int64_t *offset, int64_t *bytes)
 {
-    int ret = 0;
-    int64_t idx;
+    int64_t pnum1, pnum2, map1, map2;
+    BlockDriverState *file1, *file2;
+    int status1, status2;
+
+    *offset = s->offset;
+
+    if (*offset >= s->total_size) {
+        /* Past the end of the smaller image, only check the larger one */
+        bool over1 = s->total_size1 > s->total_size2;
+
+        status1 = bdrv_block_status_above(blk_bs(over1 ? s->blk1 : s->blk2),
+                                          NULL, *offset,
+                                          s->progress_base - *offset, bytes,
+                                          NULL, NULL);
+        if (status1 < 0) {
+            compare_fail(s, *offset, 3, "Sector allocation test failed for %s",
+                         over1 ? s->filename1 : s->filename2);
+            return -1;
+        }
+        if (status1 & BDRV_BLOCK_ALLOCATED && !(status1 & BDRV_BLOCK_ZERO)) {
+            *bytes = MIN(*bytes, IO_BUF_SIZE);
+            s->offset += *bytes;
+            return over1 ? COMPARE_EMPTY1 : COMPARE_EMPTY2;
+        }
+        s->offset += *bytes;
+        return COMPARE_SKIP;
+    }
+
+    status1 = bdrv_block_status_above(blk_bs(s->blk1), NULL, *offset,
+                                      s->total_size1 - *offset, &pnum1,
+                                      &map1, &file1);
+    if (status1 < 0) {
+        compare_fail(s, *offset, 3, "Sector allocation test failed for %s",
+                     s->filename1);
+        return -1;
+    }
+
+    status2 = bdrv_block_status_above(blk_bs(s->blk2), NULL, *offset,
+                                      s->total_size2 - *offset, &pnum2,
+                                      &map2, &file2);
+    if (status2 < 0) {
+        compare_fail(s, *offset, 3, "Sector allocation test failed for %s",
+                     s->filename2);
+        return -1;
+    }
+
+    assert(pnum1 && pnum2);
+    *bytes = MIN(pnum1, pnum2);
+
+    if (s->strict && status1 != status2) {
+        compare_fail(s, *offset, 1, "Strict mode: Offset %" PRId64
+                     " block status mismatch!\n", *offset);
+        return -1;
+    }
+
+    if ((status1 & BDRV_BLOCK_ZERO) && (status2 & BDRV_BLOCK_ZERO)) {
+        s->offset += *bytes;
+        return COMPARE_SKIP;
+    }
+    if ((status1 & BDRV_BLOCK_ALLOCATED) == (status2 & BDRV_BLOCK_ALLOCATED)) {
+        /* Both unallocated, or both mapped to the same host data */
+        if (!(status1 & BDRV_BLOCK_ALLOCATED) ||
+            ((status1 & status2 & BDRV_BLOCK_OFFSET_VALID) &&
+             file1 == file2 && map1 == map2)) {
+            s->offset += *bytes;
+            return COMPARE_SKIP;
+        }
+        *bytes = MIN(*bytes, IO_BUF_SIZE);
+        s->offset += *bytes;
+        return COMPARE_DATA;
+    }
+
+    *bytes = MIN(*bytes, IO_BUF_SIZE);
+    s->offset += *bytes;
+    return (status1 & BDRV_BLOCK_ALLOCATED) ? COMPARE_EMPTY1 : COMPARE_EMPTY2;
+}
+
+static bool coroutine_fn compare_co_read(ImgCompareState *s, BlockBackend *blk,
+                                         const char *filename, int64_t offset,
+                                         int64_t bytes, uint8_t *buf)
+{
+    int ret = blk_co_pread(blk, offset, bytes, buf, 0);
 
-    ret = blk_pread(blk, offset, bytes, buffer, 0);
     if (ret < 0) {
-        error_report("Error while reading offset %" PRId64 " of %s: %s",
-                     offset, filename, strerror(-ret));
-        return 4;
+        compare_fail(s, offset, 4, "Error while reading offset %" PRId64
+                     " of %s: %s", offset, filename, strerror(-ret));
+        return false;
+    }
+    return true;
+}
+
+/* Check that a range reads as zeroes, it is allocated only in one image */
+static void coroutine_fn compare_co_empty(ImgCompareState *s,
+                                          BlockBackend *blk,
+                                          const char *filename,
+                                          int64_t offset, int64_t bytes,
+                                          uint8_t *buf)
+{
+    int64_t idx;
+
+    if (!compare_co_read(s, blk, filename, offset, bytes, buf)) {
+        return;
     }
-    idx = find_nonzero(buffer, bytes);
+    idx = find_nonzero(buf, bytes);
     if (idx >= 0) {
-        qprintf(quiet, "Content mismatch at offset %" PRId64 "!\n",
-                offset + idx);
-        return 1;
+        compare_fail(s, offset + idx, 1, "Content mismatch at offset %"
+                     PRId64 "!\n", offset + idx);
     }
+}
 
-    return 0;
+static void coroutine_fn compare_co_data(ImgCompareState *s,
+                                         int64_t offset, int64_t bytes,
+                                         uint8_t *buf1, uint8_t *buf2)
+{
+    int64_t pnum;
+    int ret;
+
+    if (!compare_co_read(s, s->blk1, s->filename1, offset, bytes, buf1) ||
+        !compare_co_read(s, s->blk2, s->filename2, offset, bytes, buf2)) {
+        return;
+    }
+    ret = compare_buffers(buf1, buf2, bytes, 0, &pnum);
+    if (ret || pnum != bytes) {
+        offset += ret ? 0 : pnum;
+        compare_fail(s, offset, 1, "Content mismatch at offset %" PRId64
+                     "!\n", offset);
+    }
+}
+
+static void coroutine_fn compare_co_do_compare(void *opaque)
+{
+    ImgCompareState *s = opaque;
+    uint8_t *buf1 = blk_blockalign(s->blk1, IO_BUF_SIZE);
+    uint8_t *buf2 = blk_blockalign(s->blk2, IO_BUF_SIZE);
+    int64_t offset, bytes;
+    int action;
+
+    for (;;) {
+        /*
+         * Ranges are handed out in order, so once a difference is found
+         * everything below it has been handed out already.
+         */
+        qemu_co_mutex_lock(&s->lock);
+        if (s->ret || s->offset >= s->progress_base) {
+            qemu_co_mutex_unlock(&s->lock);
+            break;
+        }
+        WITH_GRAPH_RDLOCK_GUARD() {
+            action = compare_next_range(s, &offset, &bytes);
+        }
+        qemu_co_mutex_unlock(&s->lock);
+
+        switch (action) {
+        case COMPARE_SKIP:
+            break;
+        case COMPARE_DATA:
+            compare_co_data(s, offset, bytes, buf1, buf2);
+            break;
+        case COMPARE_EMPTY1:
+            compare_co_empty(s, s->blk1, s->filename1, offset, bytes, buf1);
+            break;
+        case COMPARE_EMPTY2:
+            compare_co_empty(s, s->blk2, s->filename2, offset, bytes, buf1);
+            break;
+        default:
+            goto out;
+        }
+        qemu_progress_print(((float) bytes / s->progress_base) * 100, 100);
+    }
+
+out:
+    qemu_vfree(buf1);
+    qemu_vfree(buf2);
+    s->running_coroutines--;
 }
 
 /*
@@ -1339,20 +1629,13 @@ static int img_compare(const img_cmd_t *ccmd, int argc, char **argv)
 {
     const char *fmt1 = NULL, *fmt2 = NULL, *cache, *filename1, *filename2;
     BlockBackend *blk1, *blk2;
-    BlockDriverState *bs1, *bs2;
+    ImgCompareState s;
     int64_t total_size1, total_size2;
-    uint8_t *buf1 = NULL, *buf2 = NULL;
-    int64_t pnum1, pnum2;
-    int allocated1, allocated2;
     int ret = 0; /* return value - 0 Ident, 1 Different, >1 Error */
     bool progress = false, quiet = false, strict = false;
     int flags;
     bool writethrough;
-    int64_t total_size;
-    int64_t offset = 0;
-    int64_t chunk;
-    int c;
-    uint64_t progress_base;
+    int c, i;
     bool image_opts = false;
     bool force_share = false;
 
@@ -1474,11 +1757,6 @@ static int img_compare(const img_cmd_t *ccmd, int argc, char **argv)
         ret = 2;
         goto out2;
     }
-    bs1 = blk_bs(blk1);
-    bs2 = blk_bs(blk2);
-
-    buf1 = blk_blockalign(blk1, IO_BUF_SIZE);
-    buf2 = blk_blockalign(blk2, IO_BUF_SIZE);
     total_size1 = blk_getlength(blk1);
     if (total_size1 < 0) {
         error_report("Can't get size of %s: %s",
@@ -1493,8 +1771,6 @@ static int img_compare(const img_cmd_t *ccmd, int argc, char **argv)
         ret = 4;
         goto out;
     }
-    total_size = MIN(total_size1, total_size2);
-    progress_base = MAX(total_size1, total_size2);
 
     qemu_progress_print(0, 100);
 
@@ -1504,131 +1780,47 @@ static int img_compare(const img_cmd_t *ccmd, int argc, char **argv)
         goto out;
     }
 
-    while (offset < total_size) {
-        int status1, status2;
-
-        status1 = bdrv_block_status_above(bs1, NULL, offset,
-                                          total_size1 - offset, &pnum1, NULL,
-                                          NULL);
-        if (status1 < 0) {
-            ret = 3;
-            error_report("Sector allocation test failed for %s", filename1);
-            goto out;
-        }
-        allocated1 = status1 & BDRV_BLOCK_ALLOCATED;
-
-        status2 = bdrv_block_status_above(bs2, NULL, offset,
-                                          total_size2 - offset, &pnum2, NULL,
-                                          NULL);
-        if (status2 < 0) {
-            ret = 3;
-            error_report("Sector allocation test failed for %s", filename2);
-            goto out;
-        }
-        allocated2 = status2 & BDRV_BLOCK_ALLOCATED;
-
-        assert(pnum1 && pnum2);
-        chunk = MIN(pnum1, pnum2);
-
-        if (strict) {
-            if (status1 != status2) {
-                ret = 1;
-                qprintf(quiet, "Strict mode: Offset %" PRId64
-                        " block status mismatch!\n", offset);
-                goto out;
-            }
-        }
-        if ((status1 & BDRV_BLOCK_ZERO) && (status2 & BDRV_BLOCK_ZERO)) {
-            /* nothing to do */
-        } else if (allocated1 == allocated2) {
-            if (allocated1) {
-                int64_t pnum;
+    s = (ImgCompareState) {
+        .blk1 = blk1,
+        .blk2 = blk2,
+        .filename1 = filename1,
+        .filename2 = filename2,
+        .total_size1 = total_size1,
+        .total_size2 = total_size2,
+        .total_size = MIN(total_size1, total_size2),
+        .progress_base = MAX(total_size1, total_size2),
+        .strict = strict,
+        .fail_offset = INT64_MAX,
+    };
+    qemu_co_mutex_init(&s.lock);
+    for (i = 0; i < COMPARE_COROUTINES; i++) {
+        Coroutine *co = qemu_coroutine_create(compare_co_do_compare, &s);
 
-                chunk = MIN(chunk, IO_BUF_SIZE);
-                ret = blk_pread(blk1, offset, chunk, buf1, 0);
-                if (ret < 0) {
-                    error_report("Error while reading offset %" PRId64
-                                 " of %s: %s",
-                                 offset, filename1, strerror(-ret));
-                    ret = 4;
-                    goto out;
-                }
-                ret = blk_pread(blk2, offset, chunk, buf2, 0);
-                if (ret < 0) {
-                    error_report("Error while reading offset %" PRId64
-                                 " of %s: %s",
-                                 offset, filename2, strerror(-ret));
-                    ret = 4;
-                    goto out;
-                }
-                ret = compare_buffers(buf1, buf2, chunk, 0, &pnum);
-                if (ret || pnum != chunk) {
-                    qprintf(quiet, "Content mismatch at offset %" PRId64 "!\n",
-                            offset + (ret ? 0 : pnum));
-                    ret = 1;
-                    goto out;
-                }
-            }
-        } else {
-            chunk = MIN(chunk, IO_BUF_SIZE);
-            if (allocated1) {
-                ret = check_empty_sectors(blk1, offset, chunk,
-                                          filename1, buf1, quiet);
-            } else {
-                ret = check_empty_sectors(blk2, offset, chunk,
-                                          filename2, buf1, quiet);
-            }
-            if (ret) {
-                goto out;
-            }
-        }
-        offset += chunk;
-        qemu_progress_print(((float) chunk / progress_base) * 100, 100);
+        s.running_coroutines++;
+        qemu_coroutine_enter(co);
+    }
+    while (s.running_coroutines) {
+        main_loop_wait(false);
     }
 
-    if (total_size1 != total_size2) {
-        BlockBackend *blk_over;
-        const char *filename_over;
-
+    if (total_size1 != total_size2 && s.fail_offset >= s.total_size) {
         qprintf(quiet, "Warning: Image size mismatch!\n");
-        if (total_size1 > total_size2) {
-            blk_over = blk1;
-            filename_over = filename1;
+    }
+    if (s.ret) {
+        if (s.ret == 1) {
+            qprintf(quiet, "%s", s.fail_msg);
         } else {
-            blk_over = blk2;
-            filename_over = filename2;
-        }
-
-        while (offset < progress_base) {
-            ret = bdrv_block_status_above(blk_bs(blk_over), NULL, offset,
-                                          progress_base - offset, &chunk,
-                                          NULL, NULL);
-            if (ret < 0) {
-                ret = 3;
-                error_report("Sector allocation test failed for %s",
-                             filename_over);
-                goto out;
-
-            }
-            if (ret & BDRV_BLOCK_ALLOCATED && !(ret & BDRV_BLOCK_ZERO)) {
-                chunk = MIN(chunk, IO_BUF_SIZE);
-                ret = check_empty_sectors(blk_over, offset, chunk,
-                                          filename_over, buf1, quiet);
-                if (ret) {
-                    goto out;
-                }
-            }
-            offset += chunk;
-            qemu_progress_print(((float) chunk / progress_base) * 100, 100);
+            error_report("%s", s.fail_msg);
         }
+        g_free(s.fail_msg);
+        ret = s.ret;
+        goto out;
     }
 
     qprintf(quiet, "Images are identical.\n");
     ret = 0;
 
 out:
-    qemu_vfree(buf1);
-    qemu_vfree(buf2);
     blk_unref(blk2);
 out2:
     blk_unref(blk1);
@@ -1663,6 +1855,12 @@ enum ImgConvertBlockStatus {
 #define MAX_COROUTINES 16
 #define CONVERT_THROTTLE_GROUP "img_convert"
 
+/* A run of sectors with the same status, ending at @end */
+typedef struct ImgConvertExtent {
+    int64_t end;
+    enum ImgConvertBlockStatus status;
+} ImgConvertExtent;
+
 typedef struct ImgConvertState {
     BlockBackend **src;
     int64_t *src_sectors;
@@ -1675,6 +1873,13 @@ typedef struct ImgConvertState {
     int64_t wr_offs;
     enum ImgConvertBlockStatus status;
     int64_t sector_next_status;
+    /*
+     * Extent map of the sources, built by the first pass over the block
+     * status so that the copy does not have to query it again.
+     */
+    GArray *extents;
+    bool extents_ready;
+    unsigned extent_index;
     BlockBackend *target;
     bool has_zero_init;
     bool compressed;
@@ -1709,6 +1914,40 @@ static void convert_select_part(ImgConvertState *s, int64_t sector_num,
     }
 }
 
+/* Append an extent to the map, merging it with the previous one if possible */
+static void convert_add_extent(ImgConvertState *s, int64_t end,
+                               enum ImgConvertBlockStatus status)
+{
+    ImgConvertExtent e = { .end = end, .status = status };
+
+    if (s->extents->len) {
+        ImgConvertExtent *last = &g_array_index(s->extents, ImgConvertExtent,
+                                                s->extents->len - 1);
+        if (last->status == status) {
+            last->end = end;
+            return;
+        }
+    }
+    g_array_append_val(s->extents, e);
+}
+
+/* Look up the status of @sector_num, which only ever moves forward */
+static void convert_next_extent(ImgConvertState *s, int64_t sector_num)
+{
+    ImgConvertExtent *e;
+
+    for (;;) {
+        assert(s->extent_index < s->extents->len);
+        e = &g_array_index(s->extents, ImgConvertExtent, s->extent_index);
+        if (e->end > sector_num) {
+            break;
+        }
+        s->extent_index++;
+    }
+    s->status = e->status;
+    s->sector_next_status = e->end;
+}
+
 static int coroutine_mixed_fn GRAPH_RDLOCK
 convert_iteration_sectors(ImgConvertState *s, int64_t sector_num)
 {
@@ -1731,6 +1970,10 @@ convert_iteration_sectors(ImgConvertState *s, int64_t sector_num)
         }
     }
 
+    if (s->sector_next_status <= sector_num && s->extents_ready) {
+        convert_next_extent(s, sector_num);
+    }
+
     if (s->sector_next_status <= sector_num) {
         uint64_t offset = (sector_num - src_cur_offset) * BDRV_SECTOR_SIZE;
         int64_t count;
@@ -1794,6 +2037,7 @@ convert_iteration_sectors(ImgConvertState *s, int64_t sector_num)
         }
 
         s->sector_next_status = sector_num + n;
+        convert_add_extent(s, s->sector_next_status, s->status);
     }
 
     n = MIN(n, s->sector_next_status - sector_num);
@@ -1965,6 +2209,33 @@ static int coroutine_fn convert_co_copy_range(ImgConvertState *s, int64_t sector
     return 0;
 }
 
+/*
+ * Allow writes at @wr_offs and wake the coroutine that waits for it.  With
+ * @defer the coroutine only runs once the caller yields.
+ */
+static void coroutine_fn convert_co_wake_next(ImgConvertState *s,
+                                              int64_t wr_offs, bool defer)
+{
+    int i;
+
+    s->wr_offs = wr_offs;
+    for (i = 0; i < s->num_coroutines; i++) {
+        if (s->co[i] && s->wait_sector_num[i] == wr_offs) {
+            /*
+             * A -> B -> A cannot occur because A has
+             * s->wait_sector_num[i] == -1 during A -> B.  Therefore
+             * B will never enter A during this time window.
+             */
+            if (defer) {
+                aio_co_wake(s->co[i]);
+            } else {
+                qemu_coroutine_enter(s->co[i]);
+            }
+            break;
+        }
+    }
+}
+
 static void coroutine_fn convert_co_do_copy(void *opaque)
 {
     ImgConvertState *s = opaque;
@@ -2020,7 +2291,7 @@ static void coroutine_fn convert_co_do_copy(void *opaque)
         }
 
 retry:
-        copy_range = s->copy_range && s->status == BLK_DATA;
+        copy_range = s->copy_range && status == BLK_DATA;
         if (status == BLK_DATA && !copy_range) {
             ret = convert_co_read(s, sector_num, n, buf);
             if (ret < 0) {
@@ -2042,6 +2313,16 @@ retry:
             s->wait_sector_num[index] = -1;
         }
 
+        /*
+         * The target allocates compressed clusters in the order in which the
+         * writes are issued, before the data is compressed.  So the next
+         * write can be issued as soon as this one yields, and the clusters
+         * are compressed in parallel but still laid out in order.
+         */
+        if (s->wr_in_order && s->compressed) {
+            convert_co_wake_next(s, sector_num + n, true);
+        }
+
         if (s->ret == -EINPROGRESS) {
             if (copy_range) {
                 WITH_GRAPH_RDLOCK_GUARD() {
@@ -2061,21 +2342,10 @@ retry:
             }
         }
 
-        if (s->wr_in_order) {
+        if (s->wr_in_order && !s->compressed) {
             /* reenter the coroutine that might have waited
              * for this write to complete */
-            s->wr_offs = sector_num + n;
-            for (i = 0; i < s->num_coroutines; i++) {
-                if (s->co[i] && s->wait_sector_num[i] == s->wr_offs) {
-                    /*
-                     * A -> B -> A cannot occur because A has
-                     * s->wait_sector_num[i] == -1 during A -> B.  Therefore
-                     * B will never enter A during this time window.
-                     */
-                    qemu_coroutine_enter(s->co[i]);
-                    break;
-                }
-            }
+            convert_co_wake_next(s, sector_num + n, false);
         }
     }
 
@@ -2088,6 +2358,18 @@ retry:
     }
 }
 
+static bool convert_srcs_are_raw(ImgConvertState *s)
+{
+    int i;
+
+    for (i = 0; i < s->src_num; i++) {
+        if (g_strcmp0(bdrv_get_format_name(blk_bs(s->src[i])), "raw")) {
+            return false;
+        }
+    }
+    return true;
+}
+
 static int convert_do_copy(ImgConvertState *s)
 {
     int ret, i, n;
@@ -2111,6 +2393,7 @@ static int convert_do_copy(ImgConvertState *s)
         s->buf_sectors = s->cluster_sectors;
     }
 
+    s->extents = g_array_new(false, false, sizeof(ImgConvertExtent));
     while (sector_num < s->total_sectors) {
         bdrv_graph_rdlock_main_loop();
         n = convert_iteration_sectors(s, sector_num);
@@ -2127,6 +2410,8 @@ static int convert_do_copy(ImgConvertState *s)
 
     /* Do the copy */
     s->sector_next_status = 0;
+    s->extents_ready = true;
+    s->extent_index = 0;
     s->ret = -EINPROGRESS;
 
     qemu_co_mutex_init(&s->lock);
@@ -2860,6 +3145,18 @@ static int img_convert(const img_cmd_t *ccmd, int argc, char **argv)
         s.cluster_sectors = bdi.cluster_size / BDRV_SECTOR_SIZE;
     }
 
+    /*
+     * Data extents of raw images can be copied with copy offloading
+     * (copy_file_range, possibly a reflink) even without -C.  If the
+     * target does not support it, the first attempt falls back to
+     * reading and writing.  Copy offloading does not detect zeroes
+     * within data extents, so -S keeps the old behaviour.
+     */
+    if (!s.copy_range && !explict_min_sparse && !s.compressed &&
+        !s.salvage && !rate_limit && convert_srcs_are_raw(&s)) {
+        s.copy_range = true;
+    }
+
     if (rate_limit) {
         set_rate_limit(s.target, rate_limit);
     }
@@ -2888,6 +3185,9 @@ out:
     }
     g_free(s.src_sectors);
     g_free(s.src_alignment);
+    if (s.extents) {
+        g_array_free(s.extents, true);
+    }
 fail_getopt:
     qemu_opts_del(sn_opts);
     g_free(options);
@@ -4638,10 +4938,20 @@ out_no_progress:
     return 0;
 }
 
-typedef struct BenchData {
+typedef struct BenchData BenchData;
+
+typedef struct BenchReq {
+    BenchData *b;
+    QEMUIOVector qiov;
+    int64_t start;
+    bool write;
+} BenchReq;
+
+struct BenchData {
     BlockBackend *blk;
     uint64_t image_size;
     bool write;
+    int read_percent;
     int bufsize;
     int step;
     int nrreq;
@@ -4649,12 +4959,106 @@ typedef struct BenchData {
     int flush_interval;
     bool drain_on_flush;
     uint8_t *buf;
-    QEMUIOVector *qiov;
+    BenchReq *reqs;
+    BenchReq **free_reqs;
+    int nr_free_reqs;
+
+    /* Random offsets, in units of bufsize */
+    bool random;
+    GRand *rand;
+    uint64_t nr_blocks;
+    double zipf_theta;
+    double zipf_zetan;
+    double zipf_eta;
+
+    /* Completion latency of each request, in nanoseconds */
+    int64_t *latency;
+    int nr_latency;
+    int nr_writes;
 
     int in_flight;
     bool in_flush;
     uint64_t offset;
-} BenchData;
+};
+
+/* Number of terms of the zeta function that are summed up exactly */
+#define BENCH_ZETA_TERMS 1000000
+
+/* sum(1 / i^theta) for i = 1..n, with an integral for the tail */
+static double bench_zeta(uint64_t n, double theta)
+{
+    uint64_t terms = MIN(n, BENCH_ZETA_TERMS);
+    double sum = 0;
+    uint64_t i;
+
+    for (i = 1; i <= terms; i++) {
+        sum += pow(i, -theta);
+    }
+    if (n > terms) {
+        sum += (pow(n + 0.5, 1 - theta) - pow(terms + 0.5, 1 - theta)) /
+               (1 - theta);
+    }
+    return sum;
+}
+
+/*
+ * Zipfian block numbers, following Gray et al., "Quickly Generating
+ * Billion-Record Synthetic Databases".  Block 0 is the most popular one.
+ */
+static void bench_zipf_init(BenchData *b, double theta)
+{
+    double zeta2 = 1 + pow(0.5, theta);
+
+    b->zipf_theta = theta;
+    b->zipf_zetan = bench_zeta(b->nr_blocks, theta);
+    b->zipf_eta = (1 - pow(2.0 / b->nr_blocks, 1 - theta)) /
+                  (1 - zeta2 / b->zipf_zetan);
+}
+
+static uint64_t bench_zipf_next(BenchData *b)
+{
+    double u = g_rand_double(b->rand);
+    double uz = u * b->zipf_zetan;
+    uint64_t block;
+
+    if (uz < 1) {
+        return 0;
+    }
+    if (uz < 1 + pow(0.5, b->zipf_theta)) {
+        return 1;
+    }
+    block = b->nr_blocks * pow(b->zipf_eta * u - b->zipf_eta + 1,
+                               1 / (1 - b->zipf_theta));
+    return MIN(block, b->nr_blocks - 1);
+}
+
+static uint64_t bench_next_offset(BenchData *b)
+{
+    uint64_t offset = b->offset;
+
+    if (b->random) {
+        uint64_t block;
+
+        if (b->nr_blocks <= 1) {
+            return 0;
+        } else if (b->zipf_theta) {
+            block = bench_zipf_next(b);
+        } else if (b->nr_blocks <= G_MAXINT32) {
+            block = g_rand_int_range(b->rand, 0, b->nr_blocks);
+        } else {
+            block = g_rand_double(b->rand) * b->nr_blocks;
+        }
+        return block * b->bufsize;
+    }
+
+    b->offset += b->step;
+    if (b->image_size <= b->bufsize) {
+        b->offset = 0;
+    } else {
+        b->offset %= b->image_size - b->bufsize;
+    }
+    return offset;
+}
 
 static void bench_undrained_flush_cb(void *opaque, int ret)
 {
@@ -4664,6 +5068,18 @@ static void bench_undrained_flush_cb(void *opaque, int ret)
     }
 }
 
+static void bench_cb(void *opaque, int ret);
+
+static void bench_req_cb(void *opaque, int ret)
+{
+    BenchReq *req = opaque;
+    BenchData *b = req->b;
+
+    b->latency[b->nr_latency++] = get_clock() - req->start;
+    b->free_reqs[b->nr_free_reqs++] = req;
+    bench_cb(b, ret);
+}
+
 static void bench_cb(void *opaque, int ret)
 {
     BenchData *b = opaque;
@@ -4709,22 +5125,24 @@ static void bench_cb(void *opaque, int ret)
     }
 
     while (b->n > b->in_flight && b->in_flight < b->nrreq) {
-        int64_t offset = b->offset;
+        BenchReq *req = b->free_reqs[--b->nr_free_reqs];
+        int64_t offset = bench_next_offset(b);
         /* blk_aio_* might look for completed I/Os and kick bench_cb
          * again, so make sure this operation is counted by in_flight
          * and b->offset is ready for the next submission.
          */
         b->in_flight++;
-        b->offset += b->step;
-        if (b->image_size <= b->bufsize) {
-            b->offset = 0;
-        } else {
-            b->offset %= b->image_size - b->bufsize;
-        }
-        if (b->write) {
-            acb = blk_aio_pwritev(b->blk, offset, b->qiov, 0, bench_cb, b);
+        req->write = b->write &&
+                     (b->read_percent == 0 ||
+                      g_rand_int_range(b->rand, 0, 100) >= b->read_percent);
+        req->start = get_clock();
+        if (req->write) {
+            b->nr_writes++;
+            acb = blk_aio_pwritev(b->blk, offset, &req->qiov, 0,
+                                  bench_req_cb, req);
         } else {
-            acb = blk_aio_preadv(b->blk, offset, b->qiov, 0, bench_cb, b);
+            acb = blk_aio_preadv(b->blk, offset, &req->qiov, 0,
+                                 bench_req_cb, req);
         }
         if (!acb) {
             error_report("Failed to issue request");
@@ -4733,6 +5151,72 @@ static void bench_cb(void *opaque, int ret)
     }
 }
 
+static int bench_compare_latency(const void *a, const void *b)
+{
+    int64_t la = *(const int64_t *)a, lb = *(const int64_t *)b;
+
+    return la < lb ? -1 : la > lb;
+}
+
+/* Nearest-rank percentile of the sorted latencies */
+static int64_t bench_percentile(BenchData *b, double percent)
+{
+    int64_t rank = ceil(percent / 100 * b->nr_latency);
+
+    return b->latency[MAX(rank, 1) - 1];
+}
+
+static void bench_dump_results(BenchData *b, double seconds,
+                               OutputFormat output_format)
+{
+    int64_t total = 0;
+    double avg;
+    int i;
+
+    qsort(b->latency, b->nr_latency, sizeof(*b->latency),
+          bench_compare_latency);
+    for (i = 0; i < b->nr_latency; i++) {
+        total += b->latency[i];
+    }
+    avg = (double)total / b->nr_latency;
+
+    if (output_format == OFORMAT_JSON) {
+        QDict *dict = qdict_new();
+        QDict *lat = qdict_new();
+        GString *str;
+
+        qdict_put_int(dict, "requests", b->nr_latency);
+        qdict_put_int(dict, "reads", b->nr_latency - b->nr_writes);
+        qdict_put_int(dict, "writes", b->nr_writes);
+        qdict_put_int(dict, "request-size", b->bufsize);
+        qdict_put_int(dict, "depth", b->nrreq);
+        qdict_put(dict, "seconds", qnum_from_double(seconds));
+        qdict_put(dict, "iops", qnum_from_double(b->nr_latency / seconds));
+        qdict_put_int(lat, "min", b->latency[0]);
+        qdict_put(lat, "avg", qnum_from_double(avg));
+        qdict_put_int(lat, "p50", bench_percentile(b, 50));
+        qdict_put_int(lat, "p99", bench_percentile(b, 99));
+        qdict_put_int(lat, "p999", bench_percentile(b, 99.9));
+        qdict_put_int(lat, "max", b->latency[b->nr_latency - 1]);
+        qdict_put(dict, "latency-ns", lat);
+
+        str = qobject_to_json_pretty(QOBJECT(dict), true);
+        printf("%s\n", str->str);
+        g_string_free(str, true);
+        qobject_unref(dict);
+        return;
+    }
+
+    printf("Run completed in %3.3f seconds.\n", seconds);
+    printf("Latency (us): min %.1f, avg %.1f, p50 %.1f, p99 %.1f, "
+           "p99.9 %.1f, max %.1f\n",
+           b->latency[0] / 1000.0, avg / 1000,
+           bench_percentile(b, 50) / 1000.0,
+           bench_percentile(b, 99) / 1000.0,
+           bench_percentile(b, 99.9) / 1000.0,
+           b->latency[b->nr_latency - 1] / 1000.0);
+}
+
 static int img_bench(const img_cmd_t *ccmd, int argc, char **argv)
 {
     int c, ret = 0;
@@ -4748,12 +5232,17 @@ static int img_bench(const img_cmd_t *ccmd, int argc, char **argv)
     ssize_t step = 0;
     int flush_interval = 0;
     bool drain_on_flush = true;
+    bool random = false;
+    double zipf_theta = 0;
+    int read_percent = 0;
+    OutputFormat output_format = OFORMAT_HUMAN;
     int64_t image_size;
     BlockBackend *blk = NULL;
     BenchData data = {};
     int flags = 0;
     bool writethrough = false;
     struct timeval t1, t2;
+    double seconds;
     int i;
     bool force_share = false;
     size_t buf_size = 0;
@@ -4773,6 +5262,10 @@ static int img_bench(const img_cmd_t *ccmd, int argc, char **argv)
             {"pattern", required_argument, 0, OPTION_PATTERN},
             {"flush-interval", required_argument, 0, OPTION_FLUSH_INTERVAL},
             {"no-drain", no_argument, 0, OPTION_NO_DRAIN},
+            {"random", no_argument, 0, OPTION_RANDOM},
+            {"zipf", required_argument, 0, OPTION_ZIPF},
+            {"read-percent", required_argument, 0, OPTION_READ_PERCENT},
+            {"output", required_argument, 0, OPTION_OUTPUT},
             {"aio", required_argument, 0, 'i'},
             {"native", no_argument, 0, 'n'},
             {"force-share", no_argument, 0, 'U'},
@@ -4790,8 +5283,9 @@ static int img_bench(const img_cmd_t *ccmd, int argc, char **argv)
         case 'h':
             cmd_help(ccmd, "[-f FMT | --image-opts] [-t CACHE]\n"
 "        [-c COUNT] [-d DEPTH] [-o OFFSET] [-s BUFFER_SIZE] [-S STEP_SIZE]\n"
-"        [-w [--pattern PATTERN] [--flush-interval INTERVAL [--no-drain]]]\n"
-"        [-i AIO] [-n] [-U] [-q] FILE\n"
+"        [-w [--pattern PATTERN] [--flush-interval INTERVAL [--no-drain]]\n"
+"            [--read-percent PERCENT]] [--random | --zipf THETA]\n"
+"        [--output human|json] [-i AIO] [-n] [-U] [-q] FILE\n"
 ,
 "  -f, --format FMT\n"
 "     specify FILE format explicitly\n"
@@ -4820,6 +5314,14 @@ static int img_bench(const img_cmd_t *ccmd, int argc, char **argv)
 "     issue flush after this number of requests\n"
 "  --no-drain\n"
 "     do not wait when flushing pending requests\n"
+"  --read-percent PERCENT\n"
+"     make PERCENT of the requests of a write test reads\n"
+"  --random\n"
+"     use uniformly distributed random offsets, aligned to BUFFER_SIZE\n"
+"  --zipf THETA\n"
+"     use random offsets with a zipfian distribution, 0 < THETA < 1\n"
+"  --output human|json\n"
+"     output format for the results (default: human)\n"
 "  -i, --aio AIO\n"
 "     async-io backend (threads, native, io_uring)\n"
 "  -n, --native\n"
@@ -4910,6 +5412,28 @@ static int img_bench(const img_cmd_t *ccmd, int argc, char **argv)
         case OPTION_NO_DRAIN:
             drain_on_flush = false;
             break;
+        case OPTION_RANDOM:
+            random = true;
+            break;
+        case OPTION_ZIPF:
+            if (qemu_strtod(optarg, NULL, &zipf_theta) < 0 ||
+                !(zipf_theta > 0 && zipf_theta < 1)) {
+                error_report("Invalid zipf theta '%s', must be between "
+                             "0 and 1 (exclusive)", optarg);
+                return 1;
+            }
+            random = true;
+            break;
+        case OPTION_READ_PERCENT:
+            read_percent = cvtnum_full("read percentage", optarg,
+                                       false, 0, 100);
+            if (read_percent < 0) {
+                return 1;
+            }
+            break;
+        case OPTION_OUTPUT:
+            output_format = parse_output_format(argv[0], optarg);
+            break;
         case 'U':
             force_share = true;
             break;
@@ -4929,6 +5453,18 @@ static int img_bench(const img_cmd_t *ccmd, int argc, char **argv)
     }
     filename = argv[argc - 1];
 
+    if (!is_write && read_percent) {
+        error_report("--read-percent is only available in write tests");
+        ret = -1;
+        goto out;
+    }
+    if (random && (step || offset)) {
+        error_report("--step-size and --offset cannot be used with random "
+                     "offsets");
+        ret = -1;
+        goto out;
+    }
+
     if (!is_write && flush_interval) {
         error_report("--flush-interval is only available in write tests");
         ret = -1;
@@ -4962,15 +5498,35 @@ static int img_bench(const img_cmd_t *ccmd, int argc, char **argv)
         .n              = count,
         .offset         = offset,
         .write          = is_write,
+        .read_percent   = read_percent,
         .flush_interval = flush_interval,
         .drain_on_flush = drain_on_flush,
+        .random         = random,
+        .rand           = g_rand_new_with_seed(0),
+        .nr_blocks      = image_size / bufsize,
+        .latency        = g_new(int64_t, count),
     };
-    printf("Sending %d %s requests, %d bytes each, %d in parallel "
-           "(starting at offset %" PRId64 ", step size %d)\n",
-           data.n, data.write ? "write" : "read", data.bufsize, data.nrreq,
-           data.offset, data.step);
-    if (flush_interval) {
-        printf("Sending flush every %d requests\n", flush_interval);
+    if (zipf_theta && data.nr_blocks > 1) {
+        bench_zipf_init(&data, zipf_theta);
+    }
+    if (output_format == OFORMAT_HUMAN) {
+        if (random) {
+            printf("Sending %d %s requests, %d bytes each, %d in parallel "
+                   "(%s offsets)\n",
+                   data.n, data.write ? "write" : "read", data.bufsize,
+                   data.nrreq, zipf_theta ? "zipfian" : "random");
+        } else {
+            printf("Sending %d %s requests, %d bytes each, %d in parallel "
+                   "(starting at offset %" PRId64 ", step size %d)\n",
+                   data.n, data.write ? "write" : "read", data.bufsize,
+                   data.nrreq, data.offset, data.step);
+        }
+        if (read_percent) {
+            printf("Making %d%% of the requests reads\n", read_percent);
+        }
+        if (flush_interval) {
+            printf("Sending flush every %d requests\n", flush_interval);
+        }
     }
 
     buf_size = data.nrreq * data.bufsize;
@@ -4979,11 +5535,14 @@ static int img_bench(const img_cmd_t *ccmd, int argc, char **argv)
 
     blk_register_buf(blk, data.buf, buf_size, &error_fatal);
 
-    data.qiov = g_new(QEMUIOVector, data.nrreq);
+    data.reqs = g_new0(BenchReq, data.nrreq);
+    data.free_reqs = g_new(BenchReq *, data.nrreq);
     for (i = 0; i < data.nrreq; i++) {
-        qemu_iovec_init(&data.qiov[i], 1);
-        qemu_iovec_add(&data.qiov[i],
+        data.reqs[i].b = &data;
+        qemu_iovec_init(&data.reqs[i].qiov, 1);
+        qemu_iovec_add(&data.reqs[i].qiov,
                        data.buf + i * data.bufsize, data.bufsize);
+        data.free_reqs[data.nr_free_reqs++] = &data.reqs[i];
     }
 
     gettimeofday(&t1, NULL);
@@ -4994,11 +5553,22 @@ static int img_bench(const img_cmd_t *ccmd, int argc, char **argv)
     }
     gettimeofday(&t2, NULL);
 
-    printf("Run completed in %3.3f seconds.\n",
-           (t2.tv_sec - t1.tv_sec)
-           + ((double)(t2.tv_usec - t1.tv_usec) / 1000000));
+    seconds = (t2.tv_sec - t1.tv_sec)
+              + ((double)(t2.tv_usec - t1.tv_usec) / 1000000);
+    bench_dump_results(&data, seconds, output_format);
 
 out:
+    if (data.reqs) {
+        for (i = 0; i < data.nrreq; i++) {
+            qemu_iovec_destroy(&data.reqs[i].qiov);
+        }
+        g_free(data.reqs);
+        g_free(data.free_reqs);
+    }
+    if (data.rand) {
+        g_rand_free(data.rand);
+    }
+    g_free(data.latency);
     if (data.buf) {
         blk_unregister_buf(blk, data.buf, buf_size);
     }
@@ -5879,6 +6449,8 @@ static const img_cmd_t img_cmds[] = {
       "Copy one or more images to another with optional format conversion" },
     { "create", img_create,
       "Create and format a new image file" },
+    { "dedup", img_dedup,
+      "Make clusters with identical contents share storage" },
     { "dd", img_dd,
       "Copy input to output with optional format conversion" },
     { "info", img_info,
@@ -235,7 +235,11 @@ DEF("accel", HAS_ARG, QEMU_OPTION_accel,
     "                one-insn-per-tb=on|off (one guest instruction per TCG translation block)\n"
     "                split-wx=on|off (enable TCG split w^x mapping)\n"
     "                tb-size=n (TCG translation block cache size)\n"
+    "                tb-jmp-cache-size=n (entries in each vCPU's TCG jump cache, default 4096)\n"
+    "                tb-jmp-cache-ways=1|2|4 (TCG jump cache associativity, default 1)\n"
+    "                tb-profile=on|off (count TCG translation block executions, default off)\n"
     "                dirty-ring-size=n (KVM dirty ring GFN count, default 0)\n"
+    "                dirty-ring-stats=on|off (keep track of dirty rates through the KVM dirty ring, default off)\n"
     "                eager-split-size=n (KVM Eager Page Split chunk size, default 0, disabled. ARM only)\n"
     "                notify-vmexit=run|internal-error|disable,notify-window=n (enable notify VM exit and set notify window, x86 only)\n"
     "                thread=single|multi (enable multi-threaded TCG)\n"
@@ -278,6 +282,23 @@ SRST
     ``tb-size=n``
         Controls the size (in MiB) of the TCG translation block cache.
 
+    ``tb-jmp-cache-size=n``
+        Sets the number of entries, a power of 2 between 256 and 1048576,
+        in the per-vCPU cache that maps guest PCs to translation blocks.
+        Guests with large code working sets may benefit from a larger
+        cache; its hit rate is reported by ``info jit``.
+
+    ``tb-jmp-cache-ways=1|2|4``
+        Sets the associativity of the per-vCPU jump cache. The default
+        of 1 is a direct-mapped cache; 2 or 4 reduce conflict misses at
+        the cost of a few more comparisons on each lookup.
+
+    ``tb-profile=on|off``
+        Makes translation blocks count how often they are executed, so
+        that ``info jit-tbs`` can rank them together with code quality
+        metrics such as register spills and helper calls. Only blocks
+        translated while the option is on are counted.
+
     ``thread=single|multi``
         Controls number of TCG threads. When the TCG is multi-threaded
         there will be one thread per vCPU therefore taking advantage of
@@ -296,6 +317,14 @@ SRST
         is disabled (dirty-ring-size=0).  When enabled, KVM will instead
         record dirty pages in a bitmap.
 
+    ``dirty-ring-stats=on|off``
+        When the KVM dirty ring is enabled with ``dirty-ring-size``, keep
+        dirty page tracking enabled for the whole life of the VM, and
+        maintain rolling dirty rates per vCPU and per RAM block.  They
+        are reported by the ``query-stats`` QMP command, with the
+        ``dirty-ring`` provider.  This makes the guest pay the cost of
+        dirty tracking all the time.  By default, this is disabled.
+
     ``eager-split-size=n``
         KVM implements dirty page logging at the PAGE_SIZE granularity and
         enabling dirty-logging on a huge-page requires breaking it into
@@ -2636,7 +2665,7 @@ SRST
         ``sasl-authz`` and ``tls-authz`` options are a replacement.
 
     ``lossy=on|off``
-        Enable lossy compression methods (gradient, JPEG, ...). If this
+        Enable lossy compression methods (gradient, JPEG, H.264, ...). If this
         option is set, VNC client may receive lossy framebuffer updates
         depending on its encoding settings. Enabling this option can
         save a lot of bandwidth at the expense of quality.
@@ -2980,9 +3009,12 @@ DEF("netdev", HAS_ARG, QEMU_OPTION_netdev,
     "-netdev af-xdp,id=str,ifname=name[,mode=native|skb][,force-copy=on|off]\n"
     "         [,queues=n][,start-queue=m][,inhibit=on|off][,sock-fds=x:y:...:z]\n"
     "         [,map-path=/path/to/socket/map][,map-start-index=i]\n"
+    "         [,zero-copy=on|off][,umem-hugepages=on|off]\n"
     "                attach to the existing network interface 'name' with AF_XDP socket\n"
     "                use 'mode=MODE' to specify an XDP program attach mode\n"
     "                use 'force-copy=on|off' to force XDP copy mode even if device supports zero-copy (default: off)\n"
+    "                use 'zero-copy=on|off' to require XDP zero-copy mode (default: off)\n"
+    "                use 'umem-hugepages=on|off' to allocate packet buffers from huge pages (default: off)\n"
     "                use 'inhibit=on|off' to inhibit loading of a default XDP program (default: off)\n"
     "                with inhibit=on,\n"
     "                  use 'sock-fds' to provide file descriptors for already open AF_XDP sockets\n"
@@ -3819,7 +3851,7 @@ SRST
         # launch QEMU instance
         |qemu_system| linux.img -nic vde,sock=/tmp/myswitch
 
-``-netdev af-xdp,id=str,ifname=name[,mode=native|skb][,force-copy=on|off][,queues=n][,start-queue=m][,inhibit=on|off][,sock-fds=x:y:...:z][,map-path=/path/to/socket/map][,map-start-index=i]``
+``-netdev af-xdp,id=str,ifname=name[,mode=native|skb][,force-copy=on|off][,queues=n][,start-queue=m][,inhibit=on|off][,sock-fds=x:y:...:z][,map-path=/path/to/socket/map][,map-start-index=i][,zero-copy=on|off][,umem-hugepages=on|off]``
     Configure AF_XDP backend to connect to a network interface 'name'
     using AF_XDP socket.  A specific program attach mode for a default
     XDP program can be forced with 'mode', defaults to best-effort,
@@ -3884,6 +3916,19 @@ SRST
     for insertion into the socket map.  The combination of 'map-path' and
     'sock-fds' together is not supported.
 
+    By default the kernel picks XDP zero-copy mode when the driver supports
+    it, and silently falls back to copy mode otherwise.  'zero-copy=on'
+    makes that fallback an error instead.  With 'umem-hugepages=on', the
+    UMEM of each queue, 32 MiB of packet buffers shared with the device,
+    is allocated from the default huge page size, which must be reserved
+    in advance.
+
+    .. parsed-literal::
+
+        echo 64 > /proc/sys/vm/nr_hugepages
+        |qemu_system| linux.img -device virtio-net-pci,netdev=n1 \\
+            -netdev af-xdp,id=n1,ifname=eth0,queues=4,zero-copy=on,umem-hugepages=on
+
 ``-netdev vhost-user,chardev=id[,vhostforce=on|off][,queues=n]``
     Establish a vhost-user netdev, backed by a chardev id. The chardev
     should be a unix domain socket backed one. The vhost-user uses a
@@ -3962,6 +4007,7 @@ DEF("chardev", HAS_ARG, QEMU_OPTION_chardev,
     "         [,mux=on|off][,logfile=PATH][,logappend=on|off]\n"
     "-chardev ringbuf,id=id[,size=size][,logfile=PATH][,logappend=on|off]\n"
     "-chardev file,id=id,path=path[,input-path=input-file][,mux=on|off][,logfile=PATH][,logappend=on|off]\n"
+    "         [,write-buffer=size][,write-buffer-interval=milliseconds]\n"
     "-chardev pipe,id=id,path=path[,mux=on|off][,logfile=PATH][,logappend=on|off]\n"
 #ifdef _WIN32
     "-chardev console,id=id[,mux=on|off][,logfile=PATH][,logappend=on|off]\n"
@@ -4058,6 +4104,14 @@ The general form of a character device option is:
     ``logappend`` option controls whether the log file will be truncated
     or appended to when opened.
 
+    The file and socket backends support the ``write-buffer=size``
+    option, which collects the output in a buffer of the given size and
+    writes it from a separate thread once the buffer is half full or
+    ``write-buffer-interval`` milliseconds (default 100) after output was
+    added.  This saves a system call per byte for guests that log to a
+    serial port, at the cost of losing the output that was not written
+    yet if QEMU terminates abnormally.
+
 The available backends are:
 
 ``-chardev null,id=id``
@@ -5142,13 +5196,13 @@ SRST
 ERST
 
 DEF("icount", HAS_ARG, QEMU_OPTION_icount, \
-    "-icount [shift=N|auto][,align=on|off][,sleep=on|off][,rr=record|replay,rrfile=<filename>[,rrsnapshot=<snapshot>]]\n" \
+    "-icount [shift=N|auto][,align=on|off][,sleep=on|off][,rr=record|replay,rrfile=<filename>[,rrsnapshot=<snapshot>][,rrcompress=on|off]]\n" \
     "                enable virtual instruction counter with 2^N clock ticks per\n" \
     "                instruction, enable aligning the host and virtual clocks\n" \
     "                or disable real time cpu sleeping, and optionally enable\n" \
     "                record-and-replay mode\n", QEMU_ARCH_ALL)
 SRST
-``-icount [shift=N|auto][,align=on|off][,sleep=on|off][,rr=record|replay,rrfile=filename[,rrsnapshot=snapshot]]``
+``-icount [shift=N|auto][,align=on|off][,sleep=on|off][,rr=record|replay,rrfile=filename[,rrsnapshot=snapshot][,rrcompress=on|off]]``
     Enable virtual instruction counter. The virtual cpu will execute one
     instruction every 2^N ns of virtual time. If ``auto`` is specified
     then the virtual cpu speed will be automatically adjusted to keep
@@ -5190,6 +5244,10 @@ SRST
     name. In record mode, a new VM snapshot with the given name is created
     at the start of execution recording. In replay mode this option
     specifies the snapshot name used to load the initial VM state.
+    With ``rrcompress=on`` the log is recorded as a sequence of
+    zstd-compressed chunks. Replay detects the format by itself, and
+    loading a snapshot only decompresses the chunk holding its position
+    in the log.
 ERST
 
 DEF("watchdog-action", HAS_ARG, QEMU_OPTION_watchdog_action, \
@@ -5919,6 +5977,11 @@ SRST
         ``tx``: the filter is attached to the transmit queue of the
         netdev, where it will receive packets sent by the netdev.
 
+        queue-index=n is an option that can be applied to any netfilter,
+        and is required when netdevid has several queues. It attaches
+        the filter to queue n of the netdev only, so that each queue is
+        filtered by its own instance.
+
         position head\|tail\|id=<id> is an option to specify where the
         filter should be inserted in the filter list. It can be applied
         to any netfilter.
@@ -5972,7 +6035,7 @@ SRST
         stored. The file format is libpcap, so it can be analyzed with
         tools such as tcpdump or Wireshark.
 
-    ``-object colo-compare,id=id,primary_in=chardevid,secondary_in=chardevid,outdev=chardevid,iothread=id[,vnet_hdr_support][,notify_dev=id][,compare_timeout=@var{ms}][,expired_scan_cycle=@var{ms}][,max_queue_size=@var{size}]``
+    ``-object colo-compare,id=id,primary_in=chardevid,secondary_in=chardevid,outdev=chardevid,iothread=id[,vnet_hdr_support][,notify_dev=id][,compare_timeout=@var{ms}][,expired_scan_cycle=@var{ms}][,max_queue_size=@var{size}][,worker_threads=@var{n}]``
         Colo-compare gets packet from primary\_in chardevid and
         secondary\_in, then compare whether the payload of primary packet
         and secondary packet are the same. If same, it will output
@@ -5986,6 +6049,9 @@ SRST
         is to set the period of scanning expired primary node network packets.
         The max\_queue\_size=@var{size} is to set the max compare queue
         size depend on user environment.
+        The worker\_threads=@var{n} spreads the connections over @var{n}
+        threads doing the comparison, leaving only the dispatch of
+        the packets to the iothread.
         If user want to use Xen COLO, need to add the notify\_dev to
         notify Xen colo-frame to do checkpoint.
 
@@ -22,6 +22,11 @@ struct JSONWriter {
     bool need_comma;
     GString *contents;
     GByteArray *container_is_array;
+    /* Output already passed to @flush */
+    size_t flushed;
+    size_t flush_threshold;
+    JSONWriterFlushFunc *flush;
+    void *flush_opaque;
 };
 
 JSONWriter *json_writer_new(bool pretty)
@@ -32,9 +37,34 @@ JSONWriter *json_writer_new(bool pretty)
     writer->need_comma = false;
     writer->contents = g_string_new(NULL);
     writer->container_is_array = g_byte_array_new();
+    writer->flushed = 0;
+    writer->flush = NULL;
     return writer;
 }
 
+/*
+ * Pass the output to @fn whenever more than @threshold bytes of it are
+ * buffered, so that long output can be sent while it is being written.
+ * json_writer_flush() passes what is left.
+ */
+void json_writer_set_flush(JSONWriter *writer, size_t threshold,
+                           JSONWriterFlushFunc *fn, void *opaque)
+{
+    writer->flush_threshold = threshold;
+    writer->flush = fn;
+    writer->flush_opaque = opaque;
+}
+
+void json_writer_flush(JSONWriter *writer)
+{
+    if (writer->flush && writer->contents->len) {
+        writer->flush(writer->contents->str, writer->contents->len,
+                      writer->flush_opaque);
+        writer->flushed += writer->contents->len;
+        g_string_truncate(writer->contents, 0);
+    }
+}
+
 const char *json_writer_get(JSONWriter *writer)
 {
     g_assert(!writer->container_is_array->len);
@@ -156,11 +186,15 @@ static void quoted_str(JSONWriter *writer, const char *str)
 
 static void maybe_comma_name(JSONWriter *writer, const char *name)
 {
+    if (writer->flush && writer->contents->len >= writer->flush_threshold) {
+        json_writer_flush(writer);
+    }
+
     if (writer->need_comma) {
         g_string_append_c(writer->contents, ',');
         pretty_newline_or_space(writer);
     } else {
-        if (writer->contents->len) {
+        if (writer->contents->len || writer->flushed) {
             pretty_newline(writer);
         }
         writer->need_comma = true;
@@ -218,6 +218,12 @@ static void to_json(JSONWriter *writer, const char *name,
     }
 }
 
+void qobject_to_json_writer(JSONWriter *writer, const char *name,
+                            const QObject *obj)
+{
+    to_json(writer, name, obj);
+}
+
 GString *qobject_to_json_pretty(const QObject *obj, bool pretty)
 {
     JSONWriter *writer = json_writer_new(pretty);
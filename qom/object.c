@@ -1100,6 +1100,31 @@ typedef struct OCFData
     void *opaque;
 } OCFData;
 
+/*
+ * Whether @type may be a subtype of @target, looking only at the TypeInfo.
+ * This avoids running class_init for every registered type when looking
+ * for the implementations of an interface or the subclasses of a type.
+ */
+static bool type_may_implement(TypeImpl *type, TypeImpl *target)
+{
+    int i;
+
+    for (; type; type = type_get_parent(type)) {
+        if (type == target) {
+            return true;
+        }
+        for (i = 0; i < type->num_interfaces; i++) {
+            TypeImpl *iface =
+                type_get_by_name_noload(type->interfaces[i].typename);
+
+            if (iface && type_is_ancestor(iface, target)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
 static void object_class_foreach_tramp(gpointer key, gpointer value,
                                        gpointer opaque)
 {
@@ -1107,14 +1132,22 @@ static void object_class_foreach_tramp(gpointer key, gpointer value,
     TypeImpl *type = value;
     ObjectClass *k;
 
-    type_initialize(type);
-    k = type->class;
-
     if (!data->include_abstract && type->abstract) {
         return;
     }
 
-    if (data->implements_type && 
+    if (data->implements_type) {
+        TypeImpl *target = type_get_by_name_noload(data->implements_type);
+
+        if (!target || !type_may_implement(type, target)) {
+            return;
+        }
+    }
+
+    type_initialize(type);
+    k = type->class;
+
+    if (data->implements_type &&
         !object_class_dynamic_cast(k, data->implements_type)) {
         return;
     }
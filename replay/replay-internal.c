@@ -48,7 +48,7 @@ static void replay_read_error(void)
 static void replay_putc(uint8_t byte)
 {
     if (replay_file) {
-        if (putc(byte, replay_file) == EOF) {
+        if (!replay_log_putc(byte)) {
             replay_write_error();
         }
     }
@@ -99,7 +99,7 @@ void replay_put_array(const uint8_t *buf, size_t size)
 {
     if (replay_file) {
         replay_put_dword(size);
-        if (fwrite(buf, 1, size, replay_file) != size) {
+        if (!replay_log_write(buf, size)) {
             replay_write_error();
         }
     }
@@ -109,7 +109,7 @@ static uint8_t replay_getc(void)
 {
     uint8_t byte = 0;
     if (replay_file) {
-        int r = getc(replay_file);
+        int r = replay_log_getc();
         if (r == EOF) {
             replay_read_error();
         }
@@ -171,7 +171,7 @@ void replay_get_array(uint8_t *buf, size_t *size)
 {
     if (replay_file) {
         *size = replay_get_dword();
-        if (fread(buf, 1, *size, replay_file) != *size) {
+        if (!replay_log_read(buf, *size)) {
             replay_read_error();
         }
     }
@@ -182,7 +182,7 @@ void replay_get_array_alloc(uint8_t **buf, size_t *size)
     if (replay_file) {
         *size = replay_get_dword();
         *buf = g_malloc(*size);
-        if (fread(*buf, 1, *size, replay_file) != *size) {
+        if (!replay_log_read(*buf, *size)) {
             replay_read_error();
         }
     }
@@ -191,11 +191,11 @@ void replay_get_array_alloc(uint8_t **buf, size_t *size)
 void replay_check_error(void)
 {
     if (replay_file) {
-        if (feof(replay_file)) {
+        if (replay_log_eof()) {
             error_report("replay file is over");
             qemu_system_vmstop_request_prepare();
             qemu_system_vmstop_request(RUN_STATE_PAUSED);
-        } else if (ferror(replay_file)) {
+        } else if (replay_log_error()) {
             error_report("replay file is over or something goes wrong");
             qemu_system_vmstop_request_prepare();
             qemu_system_vmstop_request(RUN_STATE_INTERNAL_ERROR);
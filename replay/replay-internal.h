@@ -106,6 +106,22 @@ extern uint64_t replay_break_icount;
 /* Timer for the replay breakpoint callback */
 extern QEMUTimer *replay_break_timer;
 
+/* Log storage, plain or in zstd-compressed chunks */
+
+/*! Starts reading or writing events after the file header. */
+void replay_log_start(bool compressed);
+/*! Writes out buffered data, the file header can be written afterwards. */
+bool replay_log_finish(void);
+bool replay_log_putc(uint8_t byte);
+bool replay_log_write(const void *buf, size_t size);
+int replay_log_getc(void);
+bool replay_log_read(void *buf, size_t size);
+/*! Position in the event stream, as saved in snapshots. */
+uint64_t replay_log_tell(void);
+void replay_log_seek(uint64_t offset);
+bool replay_log_eof(void);
+bool replay_log_error(void);
+
 void replay_put_byte(uint8_t byte);
 void replay_put_event(uint8_t event);
 void replay_put_word(uint16_t word);
@@ -0,0 +1,369 @@
+/*
+ * replay-log.c
+ *
+ * Storage of the replay log, either as a plain byte stream or as a
+ * sequence of zstd-compressed chunks.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "qemu/units.h"
+#include "system/replay.h"
+#include "replay-internal.h"
+#ifdef CONFIG_ZSTD
+#include <zstd.h>
+#endif
+
+/*
+ * A compressed log is a sequence of chunks following the file header.
+ * Each chunk is a ReplayChunkHeader followed by a single zstd frame that
+ * holds raw_size bytes of the event stream.  Offsets returned by
+ * replay_log_tell() (and saved in snapshots) are positions in the
+ * uncompressed stream.  The chunk headers can be walked without
+ * decompressing anything, so seeking only has to decompress the one
+ * chunk that holds the target offset.
+ */
+#define REPLAY_CHUNK_SIZE   (1 * MiB)
+/* Favour speed, the log is compressed from the vCPU thread */
+#define REPLAY_ZSTD_LEVEL   1
+
+typedef struct QEMU_PACKED ReplayChunkHeader {
+    uint32_t raw_size;      /* all fields big endian */
+    uint32_t comp_size;
+    uint64_t icount;        /* replay_state.current_icount at chunk start */
+} ReplayChunkHeader;
+
+typedef struct ReplayChunkIndex {
+    uint64_t file_pos;      /* of the chunk header */
+    uint64_t offset;        /* in the uncompressed stream */
+    uint32_t raw_size;
+    uint32_t comp_size;
+    uint64_t icount;
+} ReplayChunkIndex;
+
+static bool log_compressed;
+static bool log_eof;
+static bool log_error;
+
+/* Current uncompressed chunk */
+static uint8_t *chunk;
+static size_t chunk_len;
+static size_t chunk_pos;
+static uint64_t chunk_offset;
+/* Compressed data of the current chunk */
+static uint8_t *comp;
+static size_t comp_alloc;
+/* Chunks seen so far while replaying, sorted by offset */
+static GArray *chunk_index;
+
+#ifdef CONFIG_ZSTD
+static uint64_t chunk_icount;
+/* Index of the chunk to load when the current one is exhausted */
+static unsigned chunk_next;
+/* File position and stream offset of the first chunk not yet indexed */
+static uint64_t scan_pos;
+static uint64_t scan_offset;
+
+static void replay_chunk_reserve_comp(size_t size)
+{
+    if (size > comp_alloc) {
+        comp_alloc = size;
+        comp = g_realloc(comp, comp_alloc);
+    }
+}
+
+static bool replay_chunk_flush(void)
+{
+    ReplayChunkHeader hdr;
+    size_t n;
+
+    if (!chunk_pos) {
+        return true;
+    }
+
+    replay_chunk_reserve_comp(ZSTD_compressBound(chunk_pos));
+    n = ZSTD_compress(comp, comp_alloc, chunk, chunk_pos, REPLAY_ZSTD_LEVEL);
+    if (ZSTD_isError(n)) {
+        return false;
+    }
+
+    hdr.raw_size = cpu_to_be32(chunk_pos);
+    hdr.comp_size = cpu_to_be32(n);
+    hdr.icount = cpu_to_be64(chunk_icount);
+    if (fwrite(&hdr, sizeof(hdr), 1, replay_file) != 1 ||
+        fwrite(comp, 1, n, replay_file) != n) {
+        return false;
+    }
+
+    chunk_offset += chunk_pos;
+    chunk_pos = 0;
+    chunk_icount = replay_state.current_icount;
+    return true;
+}
+
+/* Returns the i-th chunk, walking chunk headers as needed */
+static ReplayChunkIndex *replay_chunk_index(unsigned i)
+{
+    while (chunk_index->len <= i) {
+        ReplayChunkHeader hdr;
+        ReplayChunkIndex e;
+
+        if (fseeko(replay_file, scan_pos, SEEK_SET) ||
+            fread(&hdr, sizeof(hdr), 1, replay_file) != 1) {
+            return NULL;
+        }
+        e.file_pos = scan_pos;
+        e.offset = scan_offset;
+        e.raw_size = be32_to_cpu(hdr.raw_size);
+        e.comp_size = be32_to_cpu(hdr.comp_size);
+        e.icount = be64_to_cpu(hdr.icount);
+        if (e.raw_size > REPLAY_CHUNK_SIZE) {
+            log_error = true;
+            return NULL;
+        }
+        g_array_append_val(chunk_index, e);
+
+        scan_pos += sizeof(hdr) + e.comp_size;
+        scan_offset += e.raw_size;
+    }
+    return &g_array_index(chunk_index, ReplayChunkIndex, i);
+}
+
+static bool replay_chunk_load(unsigned i)
+{
+    ReplayChunkIndex *e = replay_chunk_index(i);
+    size_t n;
+
+    if (!e) {
+        log_eof = true;
+        return false;
+    }
+
+    replay_chunk_reserve_comp(e->comp_size);
+    if (fseeko(replay_file, e->file_pos + sizeof(ReplayChunkHeader),
+               SEEK_SET) ||
+        fread(comp, 1, e->comp_size, replay_file) != e->comp_size) {
+        log_eof = true;
+        return false;
+    }
+    n = ZSTD_decompress(chunk, REPLAY_CHUNK_SIZE, comp, e->comp_size);
+    if (ZSTD_isError(n) || n != e->raw_size) {
+        log_error = true;
+        return false;
+    }
+
+    chunk_len = n;
+    chunk_pos = 0;
+    chunk_offset = e->offset;
+    chunk_icount = e->icount;
+    chunk_next = i + 1;
+    return true;
+}
+
+static void replay_chunk_start(void)
+{
+    chunk = g_malloc(REPLAY_CHUNK_SIZE);
+    chunk_len = chunk_pos = 0;
+    chunk_offset = 0;
+    chunk_icount = replay_state.current_icount;
+    chunk_index = g_array_new(FALSE, FALSE, sizeof(ReplayChunkIndex));
+    chunk_next = 0;
+    scan_pos = ftello(replay_file);
+    scan_offset = 0;
+}
+
+static bool replay_chunk_write(const uint8_t *buf, size_t size)
+{
+    while (size) {
+        size_t n = MIN(size, REPLAY_CHUNK_SIZE - chunk_pos);
+
+        memcpy(chunk + chunk_pos, buf, n);
+        chunk_pos += n;
+        buf += n;
+        size -= n;
+        if (chunk_pos == REPLAY_CHUNK_SIZE && !replay_chunk_flush()) {
+            log_error = true;
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool replay_chunk_read(uint8_t *buf, size_t size)
+{
+    while (size) {
+        size_t n;
+
+        if (chunk_pos == chunk_len && !replay_chunk_load(chunk_next)) {
+            return false;
+        }
+        n = MIN(size, chunk_len - chunk_pos);
+        memcpy(buf, chunk + chunk_pos, n);
+        chunk_pos += n;
+        buf += n;
+        size -= n;
+    }
+    return true;
+}
+
+static void replay_chunk_seek(uint64_t offset)
+{
+    ReplayChunkIndex *e;
+    unsigned lo = 0, hi = chunk_index->len;
+
+    g_assert(replay_mode == REPLAY_MODE_PLAY);
+    log_eof = false;
+
+    /* Binary search the chunks indexed so far... */
+    while (lo < hi) {
+        unsigned mid = lo + (hi - lo) / 2;
+
+        e = &g_array_index(chunk_index, ReplayChunkIndex, mid);
+        if (e->offset + e->raw_size <= offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    /* ... then walk the headers of the following ones if needed */
+    while ((e = replay_chunk_index(lo)) &&
+           e->offset + e->raw_size <= offset) {
+        lo++;
+    }
+    if (!e) {
+        log_eof = true;
+        return;
+    }
+
+    /* Only decompress if the target is not in the current chunk */
+    if (!chunk_len || lo + 1 != chunk_next) {
+        if (!replay_chunk_load(lo)) {
+            return;
+        }
+    }
+    chunk_pos = offset - chunk_offset;
+}
+#else
+static void replay_chunk_start(void)
+{
+    g_assert_not_reached();
+}
+
+static bool replay_chunk_flush(void)
+{
+    g_assert_not_reached();
+}
+
+static bool replay_chunk_write(const uint8_t *buf, size_t size)
+{
+    g_assert_not_reached();
+}
+
+static bool replay_chunk_read(uint8_t *buf, size_t size)
+{
+    g_assert_not_reached();
+}
+
+static void replay_chunk_seek(uint64_t offset)
+{
+    g_assert_not_reached();
+}
+#endif
+
+void replay_log_start(bool compressed)
+{
+    log_compressed = compressed;
+    log_eof = log_error = false;
+    if (compressed) {
+        replay_chunk_start();
+    }
+}
+
+bool replay_log_finish(void)
+{
+    bool ok = true;
+
+    if (!log_compressed) {
+        return true;
+    }
+    if (replay_mode == REPLAY_MODE_RECORD) {
+        ok = replay_chunk_flush();
+    }
+    g_free(chunk);
+    chunk = NULL;
+    g_free(comp);
+    comp = NULL;
+    comp_alloc = 0;
+    g_array_free(chunk_index, TRUE);
+    chunk_index = NULL;
+    log_compressed = false;
+    return ok;
+}
+
+bool replay_log_putc(uint8_t byte)
+{
+    if (!log_compressed) {
+        return putc(byte, replay_file) != EOF;
+    }
+    return replay_chunk_write(&byte, 1);
+}
+
+bool replay_log_write(const void *buf, size_t size)
+{
+    if (!log_compressed) {
+        return fwrite(buf, 1, size, replay_file) == size;
+    }
+    return replay_chunk_write(buf, size);
+}
+
+int replay_log_getc(void)
+{
+    uint8_t byte;
+
+    if (!log_compressed) {
+        return getc(replay_file);
+    }
+    if (chunk_pos < chunk_len) {
+        return chunk[chunk_pos++];
+    }
+    return replay_chunk_read(&byte, 1) ? byte : EOF;
+}
+
+bool replay_log_read(void *buf, size_t size)
+{
+    if (!log_compressed) {
+        return fread(buf, 1, size, replay_file) == size;
+    }
+    return replay_chunk_read(buf, size);
+}
+
+uint64_t replay_log_tell(void)
+{
+    if (!log_compressed) {
+        return ftell(replay_file);
+    }
+    return chunk_offset + chunk_pos;
+}
+
+void replay_log_seek(uint64_t offset)
+{
+    if (!log_compressed) {
+        fseek(replay_file, offset, SEEK_SET);
+        return;
+    }
+    replay_chunk_seek(offset);
+}
+
+bool replay_log_eof(void)
+{
+    return log_compressed ? log_eof : feof(replay_file);
+}
+
+bool replay_log_error(void)
+{
+    return log_compressed ? log_error : ferror(replay_file);
+}
@@ -25,12 +25,15 @@
 #define REPLAY_VERSION              0xe0200c
 /* Size of replay log header */
 #define HEADER_SIZE                 (sizeof(uint32_t) + sizeof(uint64_t))
+/* Flags in the second header field */
+#define REPLAY_FLAG_ZSTD            1
 
 ReplayMode replay_mode = REPLAY_MODE_NONE;
 char *replay_snapshot;
 
 /* Name of replay file  */
 static char *replay_filename;
+static uint64_t replay_flags;
 ReplayState replay_state;
 static GSList *replay_blockers;
 
@@ -338,7 +341,7 @@ G_NORETURN void replay_sync_error(const char *error)
     abort();
 }
 
-static void replay_enable(const char *fname, int mode)
+static void replay_enable(const char *fname, int mode, bool compress)
 {
     const char *fmode = NULL;
     assert(!replay_file);
@@ -375,15 +378,29 @@ static void replay_enable(const char *fname, int mode)
 
     /* skip file header for RECORD and check it for PLAY */
     if (replay_mode == REPLAY_MODE_RECORD) {
+        replay_flags = compress ? REPLAY_FLAG_ZSTD : 0;
         fseek(replay_file, HEADER_SIZE, SEEK_SET);
+        replay_log_start(compress);
     } else if (replay_mode == REPLAY_MODE_PLAY) {
         unsigned int version = replay_get_dword();
         if (version != REPLAY_VERSION) {
             fprintf(stderr, "Replay: invalid input log file version\n");
             exit(1);
         }
+        replay_flags = replay_get_qword();
+        if (replay_flags & ~REPLAY_FLAG_ZSTD) {
+            fprintf(stderr, "Replay: unsupported input log file flags\n");
+            exit(1);
+        }
+#ifndef CONFIG_ZSTD
+        if (replay_flags & REPLAY_FLAG_ZSTD) {
+            fprintf(stderr, "Replay: compressed log needs zstd support\n");
+            exit(1);
+        }
+#endif
         /* go to the beginning */
         fseek(replay_file, HEADER_SIZE, SEEK_SET);
+        replay_log_start(replay_flags & REPLAY_FLAG_ZSTD);
         replay_fetch_data_kind();
     }
 
@@ -396,6 +413,7 @@ void replay_configure(QemuOpts *opts)
 {
     const char *fname;
     const char *rr;
+    bool compress;
     ReplayMode mode = REPLAY_MODE_NONE;
     Location loc;
 
@@ -425,9 +443,17 @@ void replay_configure(QemuOpts *opts)
         exit(1);
     }
 
+    compress = qemu_opt_get_bool(opts, "rrcompress", false);
+#ifndef CONFIG_ZSTD
+    if (compress) {
+        error_report("rrcompress=on requires QEMU to be built with zstd");
+        exit(1);
+    }
+#endif
+
     replay_snapshot = g_strdup(qemu_opt_get(opts, "rrsnapshot"));
     replay_vmstate_register();
-    replay_enable(fname, mode);
+    replay_enable(fname, mode, compress);
 
 out:
     loc_pop(&loc);
@@ -471,10 +497,17 @@ void replay_finish(void)
             replay_shutdown_request(SHUTDOWN_CAUSE_HOST_SIGNAL);
             /* write end event */
             replay_put_event(EVENT_END);
+        }
 
+        if (!replay_log_finish()) {
+            error_report("replay write error");
+        }
+
+        if (replay_mode == REPLAY_MODE_RECORD) {
             /* write header */
             fseek(replay_file, 0, SEEK_SET);
             replay_put_dword(REPLAY_VERSION);
+            replay_put_qword(replay_flags);
         }
 
         fclose(replay_file);
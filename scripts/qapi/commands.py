@@ -50,7 +50,8 @@ def gen_call(name: str,
              arg_type: Optional[QAPISchemaObjectType],
              boxed: bool,
              ret_type: Optional[QAPISchemaType],
-             gen_tracing: bool) -> str:
+             gen_tracing: bool,
+             stream_output: bool) -> str:
     ret = ''
 
     argstr = ''
@@ -106,10 +107,22 @@ def gen_call(name: str,
 ''')
 
     if ret_type:
-        ret += gen_marshal_output(ret_type)
+        ret += gen_marshal_output(ret_type, stream_output)
 
     if gen_tracing:
-        if ret_type:
+        if ret_type and stream_output:
+            # *ret is null when the reply was streamed
+            ret += mcgen('''
+
+    if (trace_event_get_state_backends(TRACE_QMP_EXIT_%(upper)s)) {
+        g_autoptr(GString) ret_json =
+            *ret ? qobject_to_json(*ret) : g_string_new("<streamed>");
+
+        trace_qmp_exit_%(name)s(ret_json->str, true);
+    }
+''',
+                         upper=upper, name=name)
+        elif ret_type:
             ret += mcgen('''
 
     if (trace_event_get_state_backends(TRACE_QMP_EXIT_%(upper)s)) {
@@ -129,10 +142,11 @@ def gen_call(name: str,
     return ret
 
 
-def gen_marshal_output(ret_type: QAPISchemaType) -> str:
+def gen_marshal_output(ret_type: QAPISchemaType,
+                       stream_output: bool) -> str:
     return mcgen('''
 
-    ov = qobject_output_visitor_new_qmp(ret);
+    ov = %(new_visitor)s(ret);
     if (visit_type_%(c_name)s(ov, "unused", &retval, errp)) {
         visit_complete(ov, ret);
     }
@@ -141,7 +155,9 @@ def gen_marshal_output(ret_type: QAPISchemaType) -> str:
     visit_type_%(c_name)s(ov, "unused", &retval, NULL);
     visit_free(ov);
 ''',
-                 c_name=ret_type.c_name())
+                 c_name=ret_type.c_name(),
+                 new_visitor=('qmp_output_visitor_new_stream' if stream_output
+                              else 'qobject_output_visitor_new_qmp'))
 
 
 def build_marshal_proto(name: str,
@@ -174,7 +190,8 @@ def gen_marshal(name: str,
                 boxed: bool,
                 ret_type: Optional[QAPISchemaType],
                 gen_tracing: bool,
-                coroutine: bool) -> str:
+                coroutine: bool,
+                stream_output: bool) -> str:
     have_args = boxed or (arg_type and not arg_type.is_empty())
     if have_args:
         assert arg_type is not None
@@ -230,7 +247,8 @@ def gen_marshal(name: str,
     }
 ''')
 
-    ret += gen_call(name, arg_type, boxed, ret_type, gen_tracing)
+    ret += gen_call(name, arg_type, boxed, ret_type, gen_tracing,
+                    stream_output)
 
     ret += mcgen('''
 
@@ -265,7 +283,8 @@ def gen_register_command(name: str,
                          success_response: bool,
                          allow_oob: bool,
                          allow_preconfig: bool,
-                         coroutine: bool) -> str:
+                         coroutine: bool,
+                         stream_output: bool) -> str:
     options = []
 
     if not success_response:
@@ -276,6 +295,8 @@ def gen_register_command(name: str,
         options += ['QCO_ALLOW_PRECONFIG']
     if coroutine:
         options += ['QCO_COROUTINE']
+    if stream_output:
+        options += ['QCO_STREAM_OUTPUT']
 
     ret = mcgen('''
     qmp_register_command(cmds, "%(name)s",
@@ -366,7 +387,8 @@ def visit_command(self,
                       boxed: bool,
                       allow_oob: bool,
                       allow_preconfig: bool,
-                      coroutine: bool) -> None:
+                      coroutine: bool,
+                      stream_output: bool) -> None:
         if not gen:
             return
         with ifcontext(ifcond, self._genh, self._genc):
@@ -374,14 +396,15 @@ def visit_command(self,
                                             ret_type, coroutine))
             self._genh.add(gen_marshal_decl(name, coroutine))
             self._genc.add(gen_marshal(name, arg_type, boxed, ret_type,
-                                       self._gen_tracing, coroutine))
+                                       self._gen_tracing, coroutine,
+                                       stream_output))
             if self._gen_tracing:
                 self._gen_trace_events.add(gen_trace(name))
         with self._temp_module('./init'):
             with ifcontext(ifcond, self._genh, self._genc):
                 self._genc.add(gen_register_command(
                     name, features, success_response, allow_oob,
-                    allow_preconfig, coroutine))
+                    allow_preconfig, coroutine, stream_output))
 
 
 def gen_commands(schema: QAPISchema,
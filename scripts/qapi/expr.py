@@ -232,7 +232,8 @@ def check_flags(expr: QAPIExpression) -> None:
         if key in expr and expr[key] is not False:
             raise QAPISemError(
                 expr.info, "flag '%s' may only use false value" % key)
-    for key in ('boxed', 'allow-oob', 'allow-preconfig', 'coroutine'):
+    for key in ('boxed', 'allow-oob', 'allow-preconfig', 'coroutine',
+                'stream-output'):
         if key in expr and expr[key] is not True:
             raise QAPISemError(
                 expr.info, "flag '%s' may only use true value" % key)
@@ -243,6 +244,14 @@ def check_flags(expr: QAPIExpression) -> None:
         # a use case for it.
         raise QAPISemError(
             expr.info, "flags 'allow-oob' and 'coroutine' are incompatible")
+    if 'allow-oob' in expr and 'stream-output' in expr:
+        # Streaming relies on only one command running at a time.
+        raise QAPISemError(
+            expr.info,
+            "flags 'allow-oob' and 'stream-output' are incompatible")
+    if 'stream-output' in expr and 'returns' not in expr:
+        raise QAPISemError(
+            expr.info, "flag 'stream-output' requires 'returns'")
 
 
 def check_if(expr: Dict[str, object],
@@ -659,7 +668,7 @@ def check_exprs(exprs: List[QAPIExpression]) -> List[QAPIExpression]:
                        ['command'],
                        ['data', 'returns', 'boxed', 'if', 'features',
                         'gen', 'success-response', 'allow-oob',
-                        'allow-preconfig', 'coroutine'])
+                        'allow-preconfig', 'coroutine', 'stream-output'])
             normalize_members(expr.get('data'))
             check_command(expr)
         elif meta == 'event':
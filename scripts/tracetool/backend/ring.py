@@ -0,0 +1,87 @@
+# SPDX-License-Identifier: GPL-2.0-or-later
+
+"""
+Per-thread in-memory ring buffer backend.
+"""
+
+__license__    = "GPL version 2 or (at your option) any later version"
+
+__maintainer__ = "Stefan Hajnoczi"
+__email__      = "stefanha@redhat.com"
+
+
+from tracetool import out
+from tracetool.backend.simple import is_string
+
+
+PUBLIC = True
+CHECK_TRACE_EVENT_GET_STATE = True
+
+
+def generate_h_begin(events, group):
+    for event in events:
+        out('void _ring_%(api)s(%(args)s);',
+            api=event.api(),
+            args=event.args)
+    out('')
+
+
+def generate_h(event, group):
+    out('        _ring_%(api)s(%(args)s);',
+        api=event.api(),
+        args=", ".join(event.args.names()))
+
+
+def generate_h_backend_dstate(event, group):
+    out('    trace_event_get_state_dynamic_by_id(%(event_id)s) || \\',
+        event_id="TRACE_" + event.name.upper())
+
+
+def generate_c_begin(events, group):
+    out('#include "qemu/osdep.h"',
+        '#include "trace/control.h"',
+        '#include "trace/ring.h"',
+        '')
+
+
+def generate_c(event, group):
+    out('void _ring_%(api)s(%(args)s)',
+        '{',
+        api=event.api(),
+        args=event.args)
+
+    values = []
+    strings = 0
+    for i, (type_, name) in enumerate(event.args):
+        # strings are not copied to the ring
+        if is_string(type_):
+            values.append('0')
+            strings |= 1 << i
+        # pointer var (not string)
+        elif type_.endswith('*'):
+            values.append('(uintptr_t)%s' % name)
+        # primitive data type
+        else:
+            values.append('(uint64_t)%s' % name)
+
+    if values:
+        out('    const uint64_t ring_args[] = { %(values)s };',
+            '',
+            '    trace_ring_record(%(event_obj)s.id, ring_args, %(nargs)d, %(strings)#x);',
+            values=", ".join(values),
+            event_obj=event.api(event.QEMU_EVENT),
+            nargs=len(values),
+            strings=strings)
+    else:
+        out('    trace_ring_record(%(event_obj)s.id, NULL, 0, 0);',
+            event_obj=event.api(event.QEMU_EVENT))
+
+    out('}',
+        '')
+
+def generate_rs(event, group):
+    out('        extern "C" { fn _ring_%(api)s(%(rust_args)s); }',
+        '        unsafe { _ring_%(api)s(%(args)s); }',
+        api=event.api(),
+        rust_args=event.args.rust_decl_extern(),
+        args=event.args.rust_call_extern())
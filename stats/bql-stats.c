@@ -0,0 +1,126 @@
+/*
+ * BQL hold time statistics for query-stats
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.
+ */
+
+#include "qemu/osdep.h"
+#include "system/cpus.h"
+#include "system/stats.h"
+
+/* Number of call sites reported by query-stats */
+#define BQL_TOP_SITES 8
+
+static StatsList *bql_stats_add(StatsList *stats_list, strList *names,
+                                const char *name, uint64_t value)
+{
+    Stats *stats;
+
+    if (!apply_str_list_filter(name, names)) {
+        return stats_list;
+    }
+
+    stats = g_new0(Stats, 1);
+    stats->name = g_strdup(name);
+    stats->value = g_new0(StatsValue, 1);
+    stats->value->type = QTYPE_QNUM;
+    stats->value->u.scalar = value;
+    QAPI_LIST_PREPEND(stats_list, stats);
+    return stats_list;
+}
+
+static StatsList *bql_stats_add_hist(StatsList *stats_list, strList *names,
+                                     const char *name, uint64_t *hist,
+                                     unsigned n)
+{
+    uint64List *list = NULL;
+    Stats *stats;
+
+    if (!apply_str_list_filter(name, names)) {
+        return stats_list;
+    }
+
+    while (n--) {
+        QAPI_LIST_PREPEND(list, hist[n]);
+    }
+    stats = g_new0(Stats, 1);
+    stats->name = g_strdup(name);
+    stats->value = g_new0(StatsValue, 1);
+    stats->value->type = QTYPE_QLIST;
+    stats->value->u.list = list;
+    QAPI_LIST_PREPEND(stats_list, stats);
+    return stats_list;
+}
+
+static void bql_stats_cb(StatsResultList **result, StatsTarget target,
+                         strList *names, strList *targets, Error **errp)
+{
+    BQLSiteStats sites[BQL_TOP_SITES];
+    StatsList *stats_list = NULL;
+    BQLStats bql;
+    unsigned i, n;
+
+    if (target != STATS_TARGET_VM) {
+        return;
+    }
+
+    n = bql_get_stats(&bql, sites, ARRAY_SIZE(sites));
+    for (i = n; i-- > 0; ) {
+        g_autofree char *name = g_strdup_printf("hold-time:%s:%d",
+                                                sites[i].file,
+                                                sites[i].line);
+
+        stats_list = bql_stats_add(stats_list, names, name,
+                                   sites[i].hold_ns);
+    }
+    stats_list = bql_stats_add_hist(stats_list, names, "hold-time-histogram",
+                                    bql.hold_us_hist,
+                                    ARRAY_SIZE(bql.hold_us_hist));
+    stats_list = bql_stats_add(stats_list, names, "hold-time-max",
+                               bql.max_hold_ns);
+    stats_list = bql_stats_add(stats_list, names, "hold-time",
+                               bql.hold_ns);
+    stats_list = bql_stats_add(stats_list, names, "acquisitions",
+                               bql.acquisitions);
+    if (stats_list) {
+        add_stats_entry(result, STATS_PROVIDER_BQL, NULL, stats_list);
+    }
+}
+
+static StatsSchemaValueList *bql_schemas_add(StatsSchemaValueList *list,
+                                             const char *name,
+                                             StatsType type,
+                                             int16_t exponent)
+{
+    StatsSchemaValue *value = g_new0(StatsSchemaValue, 1);
+
+    value->name = g_strdup(name);
+    value->type = type;
+    if (exponent) {
+        value->has_unit = true;
+        value->unit = STATS_UNIT_SECONDS;
+        value->has_base = true;
+        value->base = 10;
+        value->exponent = exponent;
+    }
+    QAPI_LIST_PREPEND(list, value);
+    return list;
+}
+
+static void bql_schemas_cb(StatsSchemaList **result, Error **errp)
+{
+    StatsSchemaValueList *list = NULL;
+
+    list = bql_schemas_add(list, "hold-time-histogram",
+                           STATS_TYPE_LOG2_HISTOGRAM, -6);
+    list = bql_schemas_add(list, "hold-time-max", STATS_TYPE_PEAK, -9);
+    list = bql_schemas_add(list, "hold-time", STATS_TYPE_CUMULATIVE, -9);
+    list = bql_schemas_add(list, "acquisitions", STATS_TYPE_CUMULATIVE, 0);
+    add_stats_schema(result, STATS_PROVIDER_BQL, STATS_TARGET_VM, list);
+}
+
+void bql_stats_init(void)
+{
+    add_stats_callbacks(STATS_PROVIDER_BQL, bql_stats_cb, bql_schemas_cb);
+}
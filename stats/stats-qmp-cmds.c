@@ -15,24 +15,63 @@ typedef struct StatsCallbacks {
     StatsProvider provider;
     StatRetrieveFunc *stats_cb;
     SchemaRetrieveFunc *schemas_cb;
+    /* stats_cb can run without the BQL */
+    bool unlocked;
     QTAILQ_ENTRY(StatsCallbacks) next;
 } StatsCallbacks;
 
 static QTAILQ_HEAD(, StatsCallbacks) stats_callbacks =
     QTAILQ_HEAD_INITIALIZER(stats_callbacks);
 
-void add_stats_callbacks(StatsProvider provider,
-                         StatRetrieveFunc *stats_fn,
-                         SchemaRetrieveFunc *schemas_fn)
+static void do_add_stats_callbacks(StatsProvider provider,
+                                   StatRetrieveFunc *stats_fn,
+                                   SchemaRetrieveFunc *schemas_fn,
+                                   bool unlocked)
 {
     StatsCallbacks *entry = g_new(StatsCallbacks, 1);
     entry->provider = provider;
     entry->stats_cb = stats_fn;
     entry->schemas_cb = schemas_fn;
+    entry->unlocked = unlocked;
 
     QTAILQ_INSERT_TAIL(&stats_callbacks, entry, next);
 }
 
+void add_stats_callbacks(StatsProvider provider,
+                         StatRetrieveFunc *stats_fn,
+                         SchemaRetrieveFunc *schemas_fn)
+{
+    do_add_stats_callbacks(provider, stats_fn, schemas_fn, false);
+}
+
+void add_stats_callbacks_unlocked(StatsProvider provider,
+                                  StatRetrieveFunc *stats_fn,
+                                  SchemaRetrieveFunc *schemas_fn)
+{
+    do_add_stats_callbacks(provider, stats_fn, schemas_fn, true);
+}
+
+bool stats_filter_needs_bql(StatsFilter *filter)
+{
+    StatsCallbacks *entry;
+    StatsRequestList *request;
+
+    QTAILQ_FOREACH(entry, &stats_callbacks, next) {
+        if (entry->unlocked) {
+            continue;
+        }
+        if (!filter->has_providers) {
+            return true;
+        }
+        for (request = filter->providers; request; request = request->next) {
+            if (request->value->provider == entry->provider) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
 static bool invoke_stats_cb(StatsCallbacks *entry,
                             StatsResultList **stats_results,
                             StatsFilter *filter, StatsRequest *request,
@@ -65,6 +104,7 @@ static bool invoke_stats_cb(StatsCallbacks *entry,
         }
         break;
     case STATS_TARGET_CRYPTODEV:
+    case STATS_TARGET_RAMBLOCK:
         break;
     default:
         abort();
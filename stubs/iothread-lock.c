@@ -40,6 +40,6 @@ bool mutex_is_bql(QemuMutex *mutex)
     return false;
 }
 
-void bql_update_status(bool locked)
+void bql_update_status(bool locked, const char *file, int line)
 {
 }
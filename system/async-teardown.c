@@ -106,3 +106,8 @@ void init_async_teardown(void)
     clone(async_teardown_fn, new_stack_for_clone(), CLONE_VM, NULL);
     sigprocmask(SIG_SETMASK, &old_signals, NULL);
 }
+
+bool async_teardown_enabled(void)
+{
+    return the_ppid != 0;
+}
@@ -32,10 +32,13 @@
 #include "qapi/qmp/qerror.h"
 #include "exec/gdbstub.h"
 #include "accel/accel-cpu-ops.h"
+#include "accel/accel-cpu.h"
 #include "system/hw_accel.h"
 #include "exec/cpu-common.h"
 #include "qemu/thread.h"
 #include "qemu/main-loop.h"
+#include "qemu/host-utils.h"
+#include "qemu/timer.h"
 #include "qemu/plugin.h"
 #include "system/cpus.h"
 #include "qemu/guest-random.h"
@@ -529,10 +532,110 @@ bool mutex_is_bql(QemuMutex *mutex)
     return mutex == &bql;
 }
 
-void bql_update_status(bool locked)
+/*
+ * BQL hold time accounting.  Everything is protected by the BQL itself:
+ * the hold is started right after the BQL is taken and accounted right
+ * before it is released, so the only cost is reading the clock twice.
+ */
+#define BQL_SITES 256
+
+typedef struct BQLHold {
+    int64_t start_ns;
+    const char *file;
+    int line;
+    BQLStats stats;
+    /* Open-addressing hash table of call sites */
+    BQLSiteStats sites[BQL_SITES];
+} BQLHold;
+
+static BQLHold bql_hold;
+
+static BQLSiteStats *bql_site_lookup(const char *file, int line)
+{
+    unsigned h = ((uintptr_t)file >> 3) * 31 + line;
+    unsigned i;
+
+    if (!file) {
+        return NULL;
+    }
+    for (i = 0; i < BQL_SITES; i++) {
+        BQLSiteStats *site = &bql_hold.sites[(h + i) % BQL_SITES];
+
+        if (!site->file) {
+            site->file = file;
+            site->line = line;
+            return site;
+        }
+        if (site->file == file && site->line == line) {
+            return site;
+        }
+    }
+    return NULL;
+}
+
+static void bql_hold_end(void)
+{
+    uint64_t hold_ns = get_clock() - bql_hold.start_ns;
+    uint64_t hold_us = hold_ns / SCALE_US;
+    BQLStats *stats = &bql_hold.stats;
+    BQLSiteStats *site;
+    unsigned bucket = 0;
+
+    if (hold_us) {
+        bucket = MIN(64 - clz64(hold_us), BQL_HOLD_HIST_BUCKETS - 1);
+    }
+    stats->hold_us_hist[bucket]++;
+    stats->acquisitions++;
+    stats->hold_ns += hold_ns;
+    stats->max_hold_ns = MAX(stats->max_hold_ns, hold_ns);
+
+    /* Sites that do not fit the table are only counted in the totals */
+    site = bql_site_lookup(bql_hold.file, bql_hold.line);
+    if (site) {
+        site->acquisitions++;
+        site->hold_ns += hold_ns;
+        site->max_hold_ns = MAX(site->max_hold_ns, hold_ns);
+    }
+}
+
+static int bql_site_compare(const void *a, const void *b)
+{
+    const BQLSiteStats *sa = a, *sb = b;
+
+    return sa->hold_ns > sb->hold_ns ? -1 : sa->hold_ns < sb->hold_ns;
+}
+
+unsigned bql_get_stats(BQLStats *stats, BQLSiteStats *sites,
+                       unsigned nr_sites)
+{
+    g_autofree BQLSiteStats *sorted = g_new(BQLSiteStats, BQL_SITES);
+    unsigned i, n = 0;
+
+    g_assert(bql_locked());
+    *stats = bql_hold.stats;
+
+    for (i = 0; i < BQL_SITES; i++) {
+        if (bql_hold.sites[i].file) {
+            sorted[n++] = bql_hold.sites[i];
+        }
+    }
+    qsort(sorted, n, sizeof(*sorted), bql_site_compare);
+    n = MIN(n, nr_sites);
+    memcpy(sites, sorted, n * sizeof(*sites));
+    return n;
+}
+
+void bql_update_status(bool locked, const char *file, int line)
 {
     /* This function should only be used when an update happened.. */
     assert(bql_locked() != locked);
+    if (locked) {
+        bql_hold.start_ns = get_clock();
+        bql_hold.file = file;
+        bql_hold.line = line;
+    } else {
+        bql_hold_end();
+    }
     set_bql_locked(locked);
 }
 
@@ -726,11 +829,30 @@ void qemu_init_vcpu(CPUState *cpu)
     g_assert(cpus_accel != NULL && cpus_accel->create_vcpu_thread != NULL);
     cpus_accel->create_vcpu_thread(cpu);
 
+    /* Cold-plugged vCPUs are waited for by qemu_wait_vcpus_created() */
+    if (!phase_check(PHASE_MACHINE_READY) && cpu->cc->accel_cpu &&
+        cpu->cc->accel_cpu->parallel_vcpu_init) {
+        return;
+    }
+
     while (!cpu->created) {
         qemu_cond_wait(&qemu_cpu_cond, &bql);
     }
 }
 
+void qemu_wait_vcpus_created(void)
+{
+    int64_t start = get_clock();
+    CPUState *cpu;
+
+    CPU_FOREACH(cpu) {
+        while (!cpu->created) {
+            qemu_cond_wait(&qemu_cpu_cond, &bql);
+        }
+    }
+    trace_qemu_wait_vcpus_created((get_clock() - start) / SCALE_US);
+}
+
 void cpu_stop_current(void)
 {
     if (current_cpu) {
@@ -802,6 +924,7 @@ void vm_start(void)
 {
     if (!vm_prepare_start(false)) {
         resume_all_vcpus();
+        phase_log_startup_time();
     }
 }
 
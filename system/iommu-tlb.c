@@ -0,0 +1,71 @@
+/*
+ * Translation caches for emulated IOMMUs
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "system/iommu-tlb.h"
+
+void iommu_range_tlb_init(IOMMURangeTLB *tlb, unsigned max_entries)
+{
+    memset(&tlb->root, 0, sizeof(tlb->root));
+    tlb->nb_entries = 0;
+    tlb->max_entries = max_entries;
+}
+
+void iommu_range_tlb_reset(IOMMURangeTLB *tlb)
+{
+    iommu_range_tlb_remove(tlb, 0, HWADDR_MAX, NULL, NULL);
+}
+
+IOMMURangeTLBEntry *iommu_range_tlb_lookup(IOMMURangeTLB *tlb, uint64_t tag,
+                                           hwaddr addr)
+{
+    IntervalTreeNode *node;
+
+    /* Only the requesters that use the same IOVA share this walk */
+    for (node = interval_tree_iter_first(&tlb->root, addr, addr); node;
+         node = interval_tree_iter_next(node, addr, addr)) {
+        IOMMURangeTLBEntry *entry = container_of(node, IOMMURangeTLBEntry,
+                                                 node);
+
+        if (entry->tag == tag) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+void iommu_range_tlb_insert(IOMMURangeTLB *tlb, IOMMURangeTLBEntry *entry,
+                            uint64_t tag, hwaddr iova, hwaddr addr_mask)
+{
+    if (tlb->nb_entries >= tlb->max_entries) {
+        iommu_range_tlb_reset(tlb);
+    }
+
+    entry->tag = tag;
+    entry->node.start = iova & ~addr_mask;
+    entry->node.last = iova | addr_mask;
+    interval_tree_insert(&entry->node, &tlb->root);
+    tlb->nb_entries++;
+}
+
+void iommu_range_tlb_remove(IOMMURangeTLB *tlb, hwaddr start, hwaddr last,
+                            IOMMURangeTLBMatch *match, void *opaque)
+{
+    IntervalTreeNode *node, *next;
+
+    for (node = interval_tree_iter_first(&tlb->root, start, last); node;
+         node = next) {
+        IOMMURangeTLBEntry *entry = container_of(node, IOMMURangeTLBEntry,
+                                                 node);
+
+        next = interval_tree_iter_next(node, start, last);
+        if (!match || match(entry, opaque)) {
+            interval_tree_remove(node, &tlb->root);
+            g_free(entry);
+            tlb->nb_entries--;
+        }
+    }
+}
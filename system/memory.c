@@ -42,6 +42,10 @@
 
 static unsigned memory_region_transaction_depth;
 static bool memory_region_update_pending;
+/* Rerender every FlatView, not just those whose regions have changed */
+static bool memory_region_update_all;
+/* Identifies the current transaction in MemoryRegion.changed_gen */
+static unsigned memory_region_transaction_gen = 1;
 static bool ioeventfd_update_pending;
 unsigned int global_dirty_tracking;
 
@@ -1056,29 +1060,94 @@ static void flatviews_init(void)
     }
 }
 
+/*
+ * Whether anything that render_memory_region() looks at has changed in
+ * the current transaction, in @mr or in the regions it maps.
+ * memory_region_mark_changed() marks all the containers of a changed
+ * region, so only aliases need to be followed outside the subtree.
+ */
+static bool memory_region_subtree_changed(MemoryRegion *mr)
+{
+    MemoryRegion *child;
+
+    if (mr->changed_gen == memory_region_transaction_gen) {
+        return true;
+    }
+    if (!mr->enabled) {
+        return false;
+    }
+    if (mr->alias) {
+        return memory_region_subtree_changed(mr->alias);
+    }
+    QTAILQ_FOREACH(child, &mr->subregions, subregions_link) {
+        if (memory_region_subtree_changed(child)) {
+            return true;
+        }
+    }
+    return false;
+}
+
 static void flatviews_reset(void)
 {
+    GHashTable *old_views = flat_views;
     AddressSpace *as;
 
-    if (flat_views) {
-        g_hash_table_unref(flat_views);
-        flat_views = NULL;
-    }
+    flat_views = NULL;
     flatviews_init();
 
-    /* Render unique FVs */
+    /*
+     * Render unique FVs, reusing those whose regions were not touched by
+     * the transaction.  address_space_set_flatview() then leaves the
+     * address spaces that use them alone.
+     */
     QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
         MemoryRegion *physmr = memory_region_get_flatview_root(as->root);
+        FlatView *view;
 
         if (g_hash_table_lookup(flat_views, physmr)) {
             continue;
         }
 
+        view = old_views ? g_hash_table_lookup(old_views, physmr) : NULL;
+        if (view && !memory_region_update_all &&
+            !memory_region_subtree_changed(physmr)) {
+            flatview_ref(view);
+            g_hash_table_replace(flat_views, physmr, view);
+            continue;
+        }
+
         generate_memory_topology(physmr);
     }
+
+    if (old_views) {
+        g_hash_table_unref(old_views);
+    }
 }
 
-static void address_space_set_flatview(AddressSpace *as)
+/*
+ * An address space keeps its FlatView, so there is nothing to add or
+ * delete.  Listeners that rebuild their state between begin and commit
+ * still need to see every range.
+ */
+static void address_space_replay_nop(AddressSpace *as, FlatView *view)
+{
+    MemoryListener *listener;
+    FlatRange *fr;
+
+    QTAILQ_FOREACH(listener, &as->listeners, link_as) {
+        if (!listener->region_nop) {
+            continue;
+        }
+        FOR_EACH_FLAT_RANGE(fr, view) {
+            MemoryRegionSection mrs = section_from_flat_range(fr, view);
+
+            listener->region_nop(listener, &mrs);
+        }
+    }
+}
+
+/* Returns whether the FlatView of @as changed */
+static bool address_space_set_flatview(AddressSpace *as)
 {
     FlatView *old_view = address_space_to_flatview(as);
     MemoryRegion *physmr = memory_region_get_flatview_root(as->root);
@@ -1087,7 +1156,7 @@ static void address_space_set_flatview(AddressSpace *as)
     assert(new_view);
 
     if (old_view == new_view) {
-        return;
+        return false;
     }
 
     if (old_view) {
@@ -1121,6 +1190,7 @@ static void address_space_set_flatview(AddressSpace *as)
     if (old_view) {
         flatview_unref(old_view);
     }
+    return true;
 }
 
 static void address_space_update_topology(AddressSpace *as)
@@ -1134,6 +1204,18 @@ static void address_space_update_topology(AddressSpace *as)
     address_space_set_flatview(as);
 }
 
+/*
+ * Record that @mr changed in a way that affects the FlatViews it is part
+ * of, and schedule them to be rendered again on commit.
+ */
+static void memory_region_mark_changed(MemoryRegion *mr)
+{
+    memory_region_update_pending = true;
+    for (; mr; mr = mr->container) {
+        mr->changed_gen = memory_region_transaction_gen;
+    }
+}
+
 void memory_region_transaction_begin(void)
 {
     qemu_flush_coalesced_mmio_buffer();
@@ -1155,11 +1237,19 @@ void memory_region_transaction_commit(void)
             MEMORY_LISTENER_CALL_GLOBAL(begin, Forward);
 
             QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
-                address_space_set_flatview(as);
-                address_space_update_ioeventfds(as);
+                if (address_space_set_flatview(as)) {
+                    address_space_update_ioeventfds(as);
+                    continue;
+                }
+                address_space_replay_nop(as, address_space_to_flatview(as));
+                if (ioeventfd_update_pending) {
+                    address_space_update_ioeventfds(as);
+                }
             }
             memory_region_update_pending = false;
+            memory_region_update_all = false;
             ioeventfd_update_pending = false;
+            memory_region_transaction_gen++;
             MEMORY_LISTENER_CALL_GLOBAL(commit, Forward);
         } else if (ioeventfd_update_pending) {
             QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
@@ -2264,7 +2354,9 @@ void memory_region_set_log(MemoryRegion *mr, bool log, unsigned client)
 
     memory_region_transaction_begin();
     mr->dirty_log_mask = (mr->dirty_log_mask & ~mask) | (log * mask);
-    memory_region_update_pending |= mr->enabled;
+    if (mr->enabled) {
+        memory_region_mark_changed(mr);
+    }
     memory_region_transaction_commit();
 }
 
@@ -2394,7 +2486,9 @@ void memory_region_set_readonly(MemoryRegion *mr, bool readonly)
     if (mr->readonly != readonly) {
         memory_region_transaction_begin();
         mr->readonly = readonly;
-        memory_region_update_pending |= mr->enabled;
+        if (mr->enabled) {
+            memory_region_mark_changed(mr);
+        }
         memory_region_transaction_commit();
     }
 }
@@ -2404,7 +2498,9 @@ void memory_region_set_nonvolatile(MemoryRegion *mr, bool nonvolatile)
     if (mr->nonvolatile != nonvolatile) {
         memory_region_transaction_begin();
         mr->nonvolatile = nonvolatile;
-        memory_region_update_pending |= mr->enabled;
+        if (mr->enabled) {
+            memory_region_mark_changed(mr);
+        }
         memory_region_transaction_commit();
     }
 }
@@ -2414,7 +2510,9 @@ void memory_region_rom_device_set_romd(MemoryRegion *mr, bool romd_mode)
     if (mr->romd_mode != romd_mode) {
         memory_region_transaction_begin();
         mr->romd_mode = romd_mode;
-        memory_region_update_pending |= mr->enabled;
+        if (mr->enabled) {
+            memory_region_mark_changed(mr);
+        }
         memory_region_transaction_commit();
     }
 }
@@ -2670,7 +2768,9 @@ static void memory_region_update_container_subregions(MemoryRegion *subregion)
     }
     QTAILQ_INSERT_TAIL(&mr->subregions, subregion, subregions_link);
 done:
-    memory_region_update_pending |= mr->enabled && subregion->enabled;
+    if (mr->enabled && subregion->enabled) {
+        memory_region_mark_changed(mr);
+    }
     memory_region_transaction_commit();
 }
 
@@ -2724,7 +2824,9 @@ void memory_region_del_subregion(MemoryRegion *mr,
         memory_region_unref(subregion);
     }
 
-    memory_region_update_pending |= mr->enabled && subregion->enabled;
+    if (mr->enabled && subregion->enabled) {
+        memory_region_mark_changed(mr);
+    }
     memory_region_transaction_commit();
 }
 
@@ -2735,7 +2837,7 @@ void memory_region_set_enabled(MemoryRegion *mr, bool enabled)
     }
     memory_region_transaction_begin();
     mr->enabled = enabled;
-    memory_region_update_pending = true;
+    memory_region_mark_changed(mr);
     memory_region_transaction_commit();
 }
 
@@ -2751,7 +2853,7 @@ void memory_region_set_size(MemoryRegion *mr, uint64_t size)
     }
     memory_region_transaction_begin();
     mr->size = s;
-    memory_region_update_pending = true;
+    memory_region_mark_changed(mr);
     memory_region_transaction_commit();
 }
 
@@ -2787,7 +2889,9 @@ void memory_region_set_alias_offset(MemoryRegion *mr, hwaddr offset)
 
     memory_region_transaction_begin();
     mr->alias_offset = offset;
-    memory_region_update_pending |= mr->enabled;
+    if (mr->enabled) {
+        memory_region_mark_changed(mr);
+    }
     memory_region_transaction_commit();
 }
 
@@ -2799,7 +2903,9 @@ void memory_region_set_unmergeable(MemoryRegion *mr, bool unmergeable)
 
     memory_region_transaction_begin();
     mr->unmergeable = unmergeable;
-    memory_region_update_pending |= mr->enabled;
+    if (mr->enabled) {
+        memory_region_mark_changed(mr);
+    }
     memory_region_transaction_commit();
 }
 
@@ -2999,6 +3105,7 @@ bool memory_global_dirty_log_start(unsigned int flags, Error **errp)
 
         memory_region_transaction_begin();
         memory_region_update_pending = true;
+        memory_region_update_all = true;
         memory_region_transaction_commit();
     }
     return true;
@@ -3015,6 +3122,7 @@ static void memory_global_dirty_log_do_stop(unsigned int flags)
     if (!global_dirty_tracking) {
         memory_region_transaction_begin();
         memory_region_update_pending = true;
+        memory_region_update_all = true;
         memory_region_transaction_commit();
         MEMORY_LISTENER_CALL_GLOBAL(log_global_stop, Reverse);
     }
@@ -3723,6 +3831,47 @@ void mtree_info(bool flatview, bool dispatch_tree, bool owner, bool disabled)
     }
 }
 
+static gint mmio_bql_compare(gconstpointer a, gconstpointer b)
+{
+    const MemoryRegion *mra = a, *mrb = b;
+
+    return mra->bql_wait_ns > mrb->bql_wait_ns ? -1 :
+           mra->bql_wait_ns < mrb->bql_wait_ns;
+}
+
+void mmio_bql_info(void)
+{
+    g_autoptr(GHashTable) seen = g_hash_table_new(NULL, NULL);
+    g_autoptr(GList) regions = NULL;
+    AddressSpace *as;
+    FlatRange *fr;
+    GList *l;
+
+    QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
+        FlatView *view = address_space_get_flatview(as);
+
+        FOR_EACH_FLAT_RANGE(fr, view) {
+            if (fr->mr->bql_accesses &&
+                g_hash_table_add(seen, fr->mr)) {
+                regions = g_list_prepend(regions, fr->mr);
+            }
+        }
+        flatview_unref(view);
+    }
+
+    regions = g_list_sort(regions, mmio_bql_compare);
+    qemu_printf("%-40s %12s %12s %10s\n", "region", "accesses", "wait (us)",
+                "avg (ns)");
+    for (l = regions; l; l = l->next) {
+        MemoryRegion *mr = l->data;
+
+        qemu_printf("%-40s %12" PRIu64 " %12" PRIu64 " %10" PRIu64 "\n",
+                    memory_region_name(mr), mr->bql_accesses,
+                    mr->bql_wait_ns / 1000,
+                    mr->bql_wait_ns / mr->bql_accesses);
+    }
+}
+
 bool memory_region_init_ram(MemoryRegion *mr,
                             Object *owner,
                             const char *name,
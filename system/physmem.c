@@ -22,6 +22,7 @@
 #include "qapi/error.h"
 
 #include "qemu/cutils.h"
+#include "qemu/units.h"
 #include "qemu/cacheflush.h"
 #include "qemu/hbitmap.h"
 #include "qemu/madvise.h"
@@ -139,7 +140,8 @@ typedef struct PhysPageMap {
 } PhysPageMap;
 
 struct AddressSpaceDispatch {
-    MemoryRegionSection *mru_section;
+    /* Unique for the lifetime of QEMU, identifies @d in SectionCache */
+    uint64_t gen;
     /* This is a multi-level map on the physical address space.
      * The bottom level has pointers to MemoryRegionSections.
      */
@@ -342,19 +344,52 @@ static MemoryRegionSection *phys_page_find(AddressSpaceDispatch *d, hwaddr addr)
     }
 }
 
+/*
+ * Most recently used sections of each thread, so that a vCPU or a device
+ * that keeps accessing a few MMIO regions skips the walk of the phys map.
+ * The cache is per thread to avoid bouncing a shared cache line between
+ * vCPUs.  Entries are tagged with the generation of their dispatch, which
+ * is never reused, so that entries of a freed dispatch are never matched.
+ */
+#define SECTION_CACHE_SIZE 4
+
+typedef struct SectionCache {
+    struct {
+        uint64_t gen;
+        MemoryRegionSection *section;
+    } entries[SECTION_CACHE_SIZE];
+    unsigned next;
+} SectionCache;
+
+static __thread SectionCache section_cache;
+static uint64_t dispatch_gen;
+
 /* Called from RCU critical section */
 static MemoryRegionSection *address_space_lookup_region(AddressSpaceDispatch *d,
                                                         hwaddr addr,
                                                         bool resolve_subpage)
 {
-    MemoryRegionSection *section = qatomic_read(&d->mru_section);
+    SectionCache *cache = &section_cache;
+    MemoryRegionSection *section;
     subpage_t *subpage;
+    int i;
+
+    for (i = 0; i < SECTION_CACHE_SIZE; i++) {
+        section = cache->entries[i].section;
+        if (cache->entries[i].gen == d->gen &&
+            section_covers_addr(section, addr)) {
+            goto found;
+        }
+    }
 
-    if (!section || section == &d->map.sections[PHYS_SECTION_UNASSIGNED] ||
-        !section_covers_addr(section, addr)) {
-        section = phys_page_find(d, addr);
-        qatomic_set(&d->mru_section, section);
+    section = phys_page_find(d, addr);
+    if (section != &d->map.sections[PHYS_SECTION_UNASSIGNED]) {
+        i = cache->next++ % SECTION_CACHE_SIZE;
+        cache->entries[i].gen = d->gen;
+        cache->entries[i].section = section;
     }
+
+found:
     if (resolve_subpage && section->mr->subpage) {
         subpage = container_of(section->mr, subpage_t, iomem);
         section = &d->map.sections[subpage->sub_section[SUBPAGE_IDX(addr)]];
@@ -1325,14 +1360,19 @@ uint64_t physical_memory_set_dirty_lebitmap(unsigned long *bitmap,
                     total_dirty_pages += nbits;
                 }
                 num_dirty += nbits;
+                /* Set each run of contiguous dirty pages at once */
                 do {
+                    unsigned long run;
+
                     j = ctzl(c);
-                    c &= ~(1ul << j);
+                    run = MIN(ctzl(~(c >> j)), HOST_LONG_BITS - j);
+                    c &= run == HOST_LONG_BITS ? 0 : ~(((1ul << run) - 1) << j);
                     page_number = (i * HOST_LONG_BITS + j) * hpratio;
                     addr = page_number * TARGET_PAGE_SIZE;
                     ram_addr = start + addr;
                     physical_memory_set_dirty_range(ram_addr,
-                                       TARGET_PAGE_SIZE * hpratio, clients);
+                                       TARGET_PAGE_SIZE * hpratio * run,
+                                       clients);
                 } while (c != 0);
             }
         }
@@ -2653,6 +2693,94 @@ void qemu_ram_free(RAMBlock *block)
     qemu_mutex_unlock_ramlist();
 }
 
+/*
+ * Guest RAM released by each work item of qemu_ram_release_all(), and the
+ * maximum number of threads doing it.
+ */
+#define RAM_RELEASE_CHUNK       (1 * GiB)
+#define RAM_RELEASE_MAX_THREADS 16
+
+typedef struct RAMReleaseChunk {
+    void *host;
+    size_t len;
+} RAMReleaseChunk;
+
+typedef struct RAMReleaseWork {
+    RAMReleaseChunk *chunks;
+    unsigned nr_chunks;
+    unsigned next;
+} RAMReleaseWork;
+
+static void *ram_release_thread(void *opaque)
+{
+    RAMReleaseWork *work = opaque;
+    unsigned i;
+
+    while ((i = qatomic_fetch_inc(&work->next)) < work->nr_chunks) {
+        /* Errors, e.g. for mlock()ed memory, leave the work to exit() */
+        qemu_madvise(work->chunks[i].host, work->chunks[i].len,
+                     QEMU_MADV_DONTNEED);
+    }
+    return NULL;
+}
+
+void qemu_ram_release_all(void)
+{
+    RAMReleaseWork work = { 0 };
+    QemuThread *threads;
+    unsigned nr_threads, i;
+    RAMBlock *block;
+
+    if (xen_enabled()) {
+        return;
+    }
+
+    RCU_READ_LOCK_GUARD();
+    RAMBLOCK_FOREACH(block) {
+        if (!block->host || memory_region_is_ram_device(block->mr)) {
+            continue;
+        }
+        work.nr_chunks += DIV_ROUND_UP(block->used_length, RAM_RELEASE_CHUNK);
+    }
+
+    nr_threads = MIN(work.nr_chunks, RAM_RELEASE_MAX_THREADS);
+    nr_threads = MIN(nr_threads, g_get_num_processors());
+    if (nr_threads <= 1) {
+        /* Not worth it, a single thread is no faster than exit() itself */
+        return;
+    }
+
+    work.chunks = g_new(RAMReleaseChunk, work.nr_chunks);
+    i = 0;
+    RAMBLOCK_FOREACH(block) {
+        ram_addr_t offset;
+
+        if (!block->host || memory_region_is_ram_device(block->mr)) {
+            continue;
+        }
+        for (offset = 0; offset < block->used_length;
+             offset += RAM_RELEASE_CHUNK) {
+            work.chunks[i].host = block->host + offset;
+            work.chunks[i].len = MIN(RAM_RELEASE_CHUNK,
+                                     block->used_length - offset);
+            i++;
+        }
+    }
+    assert(i == work.nr_chunks);
+
+    trace_qemu_ram_release_all(work.nr_chunks, nr_threads);
+    threads = g_new(QemuThread, nr_threads);
+    for (i = 0; i < nr_threads; i++) {
+        qemu_thread_create(&threads[i], "ram-release", ram_release_thread,
+                           &work, QEMU_THREAD_JOINABLE);
+    }
+    for (i = 0; i < nr_threads; i++) {
+        qemu_thread_join(&threads[i]);
+    }
+    g_free(threads);
+    g_free(work.chunks);
+}
+
 #ifndef _WIN32
 /* Simply remap the given VM memory location from start to start+length */
 static int qemu_ram_remap_mmap(RAMBlock *block, uint64_t start, size_t length)
@@ -2671,6 +2799,33 @@ static int qemu_ram_remap_mmap(RAMBlock *block, uint64_t start, size_t length)
     return area != host_startaddr ? -errno : 0;
 }
 
+int qemu_ram_map_file(RAMBlock *block, uint64_t offset, size_t length,
+                      int fd, off_t file_offset)
+{
+    void *host_startaddr = block->host + offset;
+    int flags, prot;
+    void *area;
+
+    assert(block->fd < 0 && !qemu_ram_is_shared(block));
+    assert(QEMU_PTR_IS_ALIGNED(host_startaddr, qemu_real_host_page_size()));
+    assert(QEMU_IS_ALIGNED(length, qemu_real_host_page_size()));
+    assert(offset + length <= block->max_length);
+
+    flags = MAP_FIXED | MAP_PRIVATE;
+    flags |= block->flags & RAM_NORESERVE ? MAP_NORESERVE : 0;
+    prot = PROT_READ;
+    prot |= block->flags & RAM_READONLY ? 0 : PROT_WRITE;
+    area = mmap(host_startaddr, length, prot, flags, fd, file_offset);
+    if (area != host_startaddr) {
+        return -errno;
+    }
+
+    block->file_mapped = true;
+    memory_try_enable_merging(host_startaddr, length);
+    qemu_ram_setup_dump(host_startaddr, length);
+    return 0;
+}
+
 /*
  * qemu_ram_remap - remap a single RAM page
  *
@@ -3039,6 +3194,8 @@ AddressSpaceDispatch *address_space_dispatch_new(FlatView *fv)
     AddressSpaceDispatch *d = g_new0(AddressSpaceDispatch, 1);
     uint16_t n;
 
+    /* Called with the BQL held */
+    d->gen = ++dispatch_gen;
     n = dummy_section(&d->map, fv, &io_mem_unassigned);
     assert(n == PHYS_SECTION_UNASSIGNED);
 
@@ -3216,7 +3373,11 @@ bool prepare_mmio_access(MemoryRegion *mr)
     bool release_lock = false;
 
     if (!bql_locked() && !mr->lockless_io) {
+        int64_t start = get_clock();
+
         bql_lock();
+        mr->bql_accesses++;
+        mr->bql_wait_ns += get_clock() - start;
         release_lock = true;
     }
     if (mr->flush_coalesced_mmio) {
@@ -4195,7 +4356,10 @@ int ram_block_discard_range(RAMBlock *rb, uint64_t offset, size_t length)
              * fallocate'd away).
              */
 #if defined(CONFIG_MADVISE)
-            if (qemu_ram_is_shared(rb) && rb->fd < 0) {
+            if (rb->file_mapped) {
+                /* DONTNEED would bring back the contents of the file */
+                ret = qemu_ram_remap_mmap(rb, offset, length);
+            } else if (qemu_ram_is_shared(rb) && rb->fd < 0) {
                 ret = madvise(host_startaddr, length, QEMU_MADV_REMOVE);
             } else {
                 ret = madvise(host_startaddr, length, QEMU_MADV_DONTNEED);
@@ -4288,14 +4452,13 @@ void mtree_print_dispatch(AddressSpaceDispatch *d, MemoryRegion *root)
                                 " [ROM]", " [watch]" };
 
         qemu_printf("      #%d @" HWADDR_FMT_plx ".." HWADDR_FMT_plx
-                    " %s%s%s%s%s",
+                    " %s%s%s%s",
             i,
             s->offset_within_address_space,
             s->offset_within_address_space + MR_SIZE(s->size),
             s->mr->name ? s->mr->name : "(noname)",
             i < ARRAY_SIZE(names) ? names[i] : "",
             s->mr == root ? " [ROOT]" : "",
-            s == d->mru_section ? " [MRU]" : "",
             s->mr->is_iommu ? " [iommu]" : "");
 
         if (s->mr->alias) {
@@ -4341,7 +4504,10 @@ static unsigned int ram_block_coordinated_discard_required_cnt;
 static unsigned int ram_block_discard_disabled_cnt;
 /* Disable only uncoordinated discards. */
 static unsigned int ram_block_uncoordinated_discard_disabled_cnt;
+/* Uncoordinated discards between ram_block_discard_begin() and _end(). */
+static unsigned int ram_block_discard_inflight_cnt;
 static QemuMutex ram_block_discard_disable_mutex;
+static QemuCond ram_block_discard_inflight_cond;
 
 static void ram_block_discard_disable_mutex_lock(void)
 {
@@ -4349,6 +4515,7 @@ static void ram_block_discard_disable_mutex_lock(void)
 
     if (g_once_init_enter(&initialized)) {
         qemu_mutex_init(&ram_block_discard_disable_mutex);
+        qemu_cond_init(&ram_block_discard_inflight_cond);
         g_once_init_leave(&initialized, 1);
     }
     qemu_mutex_lock(&ram_block_discard_disable_mutex);
@@ -4359,6 +4526,39 @@ static void ram_block_discard_disable_mutex_unlock(void)
     qemu_mutex_unlock(&ram_block_discard_disable_mutex);
 }
 
+/* Called with ram_block_discard_disable_mutex held. */
+static void ram_block_discard_wait_inflight(void)
+{
+    while (ram_block_discard_inflight_cnt) {
+        qemu_cond_wait(&ram_block_discard_inflight_cond,
+                       &ram_block_discard_disable_mutex);
+    }
+}
+
+bool ram_block_discard_begin(void)
+{
+    bool ret = false;
+
+    ram_block_discard_disable_mutex_lock();
+    if (!ram_block_discard_disabled_cnt &&
+        !ram_block_uncoordinated_discard_disabled_cnt) {
+        ram_block_discard_inflight_cnt++;
+        ret = true;
+    }
+    ram_block_discard_disable_mutex_unlock();
+    return ret;
+}
+
+void ram_block_discard_end(void)
+{
+    ram_block_discard_disable_mutex_lock();
+    assert(ram_block_discard_inflight_cnt);
+    if (!--ram_block_discard_inflight_cnt) {
+        qemu_cond_broadcast(&ram_block_discard_inflight_cond);
+    }
+    ram_block_discard_disable_mutex_unlock();
+}
+
 int ram_block_discard_disable(bool state)
 {
     int ret = 0;
@@ -4371,6 +4571,7 @@ int ram_block_discard_disable(bool state)
         ret = -EBUSY;
     } else {
         ram_block_discard_disabled_cnt++;
+        ram_block_discard_wait_inflight();
     }
     ram_block_discard_disable_mutex_unlock();
     return ret;
@@ -4387,6 +4588,7 @@ int ram_block_uncoordinated_discard_disable(bool state)
         ret = -EBUSY;
     } else {
         ram_block_uncoordinated_discard_disabled_cnt++;
+        ram_block_discard_wait_inflight();
     }
     ram_block_discard_disable_mutex_unlock();
     return ret;
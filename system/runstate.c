@@ -42,6 +42,7 @@
 #include "qapi/qapi-commands-run-state.h"
 #include "qapi/qapi-events-run-state.h"
 #include "qemu/accel.h"
+#include "qemu/async-teardown.h"
 #include "qemu/error-report.h"
 #include "qemu/job.h"
 #include "qemu/log.h"
@@ -53,10 +54,12 @@
 #include "qom/object_interfaces.h"
 #include "system/cpus.h"
 #include "system/qtest.h"
+#include "system/ramblock.h"
 #include "system/replay.h"
 #include "system/reset.h"
 #include "system/runstate.h"
 #include "system/runstate-action.h"
+#include "system/stats.h"
 #include "system/system.h"
 #include "system/tpm.h"
 #include "trace.h"
@@ -943,6 +946,8 @@ void qemu_init_subsystems(void)
     precopy_infrastructure_init();
     postcopy_infrastructure_init();
     monitor_init_globals();
+    rcu_stats_init();
+    bql_stats_init();
 
     if (qcrypto_init(&err) < 0) {
         error_reportf_err(err, "cannot initialize crypto: ");
@@ -996,8 +1001,19 @@ void qemu_cleanup(int status)
     tpm_cleanup();
     net_cleanup();
     audio_cleanup();
+    /* Subscriptions can have timers in the monitor I/O thread */
+    monitor_stats_cleanup();
     monitor_cleanup();
     qemu_chr_cleanup();
     user_creatable_cleanup();
     /* TODO: unref root container, check all devices are ok */
+
+    /*
+     * Management has already seen the monitors go away.  Releasing guest
+     * RAM in parallel here is faster than leaving it all to exit(), unless
+     * the cleanup process of async teardown takes care of it anyway.
+     */
+    if (!async_teardown_enabled()) {
+        qemu_ram_release_all();
+    }
 }
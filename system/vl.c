@@ -457,6 +457,9 @@ static QemuOptsList qemu_icount_opts = {
         }, {
             .name = "rrsnapshot",
             .type = QEMU_OPT_STRING,
+        }, {
+            .name = "rrcompress",
+            .type = QEMU_OPT_BOOL,
         },
         { /* end of list */ }
     },
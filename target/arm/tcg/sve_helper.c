@@ -167,6 +167,30 @@ LOGICAL_PPPP(sve_nand_pppp, DO_NAND)
 #undef DO_SEL
 #undef LOGICAL_PPPP
 
+/*
+ * Return true if every element of size 1 << ESZ within the first
+ * OPR_SZ bytes of the vector is active in the predicate VG.
+ * Compilers routinely govern unpredicated arithmetic with PTRUE, so
+ * the expanders below use this to skip the per-element predicate
+ * test, which leaves a loop the compiler can vectorize.
+ */
+static inline bool sve_pred_all_active(void *vg, intptr_t opr_sz, int esz)
+{
+    uint64_t *g = vg, mask = pred_esz_masks[esz];
+    intptr_t i;
+
+    for (i = 0; i < opr_sz / 64; i++) {
+        if ((g[i] & mask) != mask) {
+            return false;
+        }
+    }
+    if (opr_sz & 63) {
+        mask &= MAKE_64BIT_MASK(0, opr_sz & 63);
+        return (g[i] & mask) == mask;
+    }
+    return true;
+}
+
 /* Fully general three-operand expander, controlled by a predicate.
  * This is complicated by the host-endian storage of the register file.
  */
@@ -179,6 +203,14 @@ LOGICAL_PPPP(sve_nand_pppp, DO_NAND)
 void HELPER(NAME)(void *vd, void *vn, void *vm, void *vg, uint32_t desc) \
 {                                                                       \
     intptr_t i, opr_sz = simd_oprsz(desc);                              \
+    if (sve_pred_all_active(vg, opr_sz, ctz32(sizeof(TYPE)))) {         \
+        for (i = 0; i < opr_sz; i += sizeof(TYPE)) {                    \
+            TYPE nn = *(TYPE *)(vn + H(i));                             \
+            TYPE mm = *(TYPE *)(vm + H(i));                             \
+            *(TYPE *)(vd + H(i)) = OP(nn, mm);                          \
+        }                                                               \
+        return;                                                         \
+    }                                                                   \
     for (i = 0; i < opr_sz; ) {                                         \
         uint16_t pg = *(uint16_t *)(vg + H1_2(i >> 3));                 \
         do {                                                            \
@@ -199,6 +231,13 @@ void HELPER(NAME)(void *vd, void *vn, void *vm, void *vg, uint32_t desc) \
     intptr_t i, opr_sz = simd_oprsz(desc) / 8;                  \
     TYPE *d = vd, *n = vn, *m = vm;                             \
     uint8_t *pg = vg;                                           \
+    if (sve_pred_all_active(vg, opr_sz * 8, MO_64)) {           \
+        for (i = 0; i < opr_sz; i += 1) {                       \
+            TYPE nn = n[i], mm = m[i];                          \
+            d[i] = OP(nn, mm);                                  \
+        }                                                       \
+        return;                                                 \
+    }                                                           \
     for (i = 0; i < opr_sz; i += 1) {                           \
         if (pg[H1(i)] & 1) {                                    \
             TYPE nn = n[i], mm = m[i];                          \
@@ -817,6 +856,13 @@ DO_ZPZW(sve_lsl_zpzw_s, uint32_t, uint64_t, H1_4, DO_LSL)
 void HELPER(NAME)(void *vd, void *vn, void *vg, uint32_t desc)  \
 {                                                               \
     intptr_t i, opr_sz = simd_oprsz(desc);                      \
+    if (sve_pred_all_active(vg, opr_sz, ctz32(sizeof(TYPE)))) { \
+        for (i = 0; i < opr_sz; i += sizeof(TYPE)) {            \
+            TYPE nn = *(TYPE *)(vn + H(i));                     \
+            *(TYPE *)(vd + H(i)) = OP(nn);                      \
+        }                                                       \
+        return;                                                 \
+    }                                                           \
     for (i = 0; i < opr_sz; ) {                                 \
         uint16_t pg = *(uint16_t *)(vg + H1_2(i >> 3));         \
         do {                                                    \
@@ -836,6 +882,13 @@ void HELPER(NAME)(void *vd, void *vn, void *vg, uint32_t desc)  \
     intptr_t i, opr_sz = simd_oprsz(desc) / 8;                  \
     TYPE *d = vd, *n = vn;                                      \
     uint8_t *pg = vg;                                           \
+    if (sve_pred_all_active(vg, opr_sz * 8, MO_64)) {           \
+        for (i = 0; i < opr_sz; i += 1) {                       \
+            TYPE nn = n[i];                                     \
+            d[i] = OP(nn);                                      \
+        }                                                       \
+        return;                                                 \
+    }                                                           \
     for (i = 0; i < opr_sz; i += 1) {                           \
         if (pg[H1(i)] & 1) {                                    \
             TYPE nn = n[i];                                     \
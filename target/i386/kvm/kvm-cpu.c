@@ -240,6 +240,7 @@ static void kvm_cpu_accel_class_init(ObjectClass *oc, const void *data)
 
     acc->cpu_target_realize = kvm_cpu_realizefn;
     acc->cpu_instance_init = kvm_cpu_instance_init;
+    acc->parallel_vcpu_init = true;
 }
 static const TypeInfo kvm_cpu_accel_type_info = {
     .name = ACCEL_CPU_NAME("kvm"),
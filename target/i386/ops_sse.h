@@ -1575,16 +1575,6 @@ void glue(helper_palignr, SUFFIX)(CPUX86State *env, Reg *d, Reg *v, Reg *s,
 
 #if SHIFT >= 1
 
-#define SSE_HELPER_V(name, elem, num, F)                                \
-    void glue(name, SUFFIX)(CPUX86State *env, Reg *d, Reg *v, Reg *s,   \
-                            Reg *m)                                     \
-    {                                                                   \
-        int i;                                                          \
-        for (i = 0; i < num; i++) {                                     \
-            d->elem(i) = F(v->elem(i), s->elem(i), m->elem(i));         \
-        }                                                               \
-    }
-
 #define SSE_HELPER_I(name, elem, num, F)                                \
     void glue(name, SUFFIX)(CPUX86State *env, Reg *d, Reg *v, Reg *s,   \
                             uint32_t imm)                               \
@@ -1597,12 +1587,6 @@ void glue(helper_palignr, SUFFIX)(CPUX86State *env, Reg *d, Reg *v, Reg *s,
     }
 
 /* SSE4.1 op helpers */
-#define FBLENDVB(v, s, m) ((m & 0x80) ? s : v)
-#define FBLENDVPS(v, s, m) ((m & 0x80000000) ? s : v)
-#define FBLENDVPD(v, s, m) ((m & 0x8000000000000000LL) ? s : v)
-SSE_HELPER_V(helper_pblendvb, B, 8 << SHIFT, FBLENDVB)
-SSE_HELPER_V(helper_blendvps, L, 2 << SHIFT, FBLENDVPS)
-SSE_HELPER_V(helper_blendvpd, Q, 1 << SHIFT, FBLENDVPD)
 
 void glue(helper_ptest, SUFFIX)(CPUX86State *env, Reg *d, Reg *s)
 {
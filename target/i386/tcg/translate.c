@@ -169,6 +169,12 @@ typedef struct DisasContext {
  */
 #define DISAS_EOB_RECHECK_TF   DISAS_TARGET_4
 
+/*
+ * EIP has already been updated by a near indirect jump, call or return.
+ * Like DISAS_JUMP, but CS and the hflags are known not to have changed.
+ */
+#define DISAS_JUMP_NEAR        DISAS_TARGET_5
+
 /* The environment in which user-only runs is constrained. */
 #ifdef CONFIG_USER_ONLY
 #define PE(S)     true
@@ -1996,6 +2002,27 @@ static void gen_bnd_jmp(DisasContext *s)
     }
 }
 
+/*
+ * Look up the TB at EIP for DISAS_JUMP_NEAR.  Only RF differs from the
+ * flags of this TB, and gen_eob() has just cleared it.
+ */
+static void gen_lookup_and_goto_ptr_near(DisasContext *s)
+{
+    TCGv_i64 pc = tcg_temp_new_i64();
+
+    if (CODE64(s)) {
+        tcg_gen_extu_tl_i64(pc, cpu_eip);
+    } else {
+        TCGv t = tcg_temp_new();
+
+        tcg_gen_addi_tl(t, cpu_eip, s->cs_base);
+        tcg_gen_ext32u_tl(t, t);
+        tcg_gen_extu_tl_i64(pc, t);
+    }
+    translator_lookup_and_goto_ptr_cached(&s->base, pc, s->cs_base,
+                                          s->flags & ~HF_RF_MASK);
+}
+
 /*
  * Generate an end of block, including common tasks such as generating
  * single step traps, resetting the RF flag, and handling the interrupt
@@ -2029,6 +2056,8 @@ gen_eob(DisasContext *s, int mode)
                /* give irqs a chance to happen */
                !inhibit_reset) {
         tcg_gen_lookup_and_goto_ptr();
+    } else if (mode == DISAS_JUMP_NEAR && !inhibit_reset) {
+        gen_lookup_and_goto_ptr_near(s);
     } else {
         tcg_gen_exit_tb(NULL, 0);
     }
@@ -3621,6 +3650,7 @@ static void i386_tr_tb_stop(DisasContextBase *dcbase, CPUState *cpu)
     case DISAS_EOB_ONLY:
     case DISAS_EOB_RECHECK_TF:
     case DISAS_JUMP:
+    case DISAS_JUMP_NEAR:
         gen_eob(dc, dc->base.is_jmp);
         break;
     default:
@@ -2559,6 +2559,24 @@ static void fold_setcond_tst_pow2(OptContext *ctx, TCGOp *op, bool neg)
     }
 }
 
+static bool fold_set_label(OptContext *ctx, TCGOp *op)
+{
+    TCGLabel *label = arg_label(op->args[0]);
+
+    /*
+     * Once every branch to the label has been folded away, the label is
+     * only reached by falling through: the extended basic block, and with
+     * it the known constants and copies, continues across it.
+     * reachable_code_pass will remove the label itself.
+     */
+    if (QSIMPLEQ_EMPTY(&label->branches)) {
+        finish_bb(ctx);
+    } else {
+        finish_ebb(ctx);
+    }
+    return true;
+}
+
 static bool fold_setcond(OptContext *ctx, TCGOp *op)
 {
     int i = do_constant_folding_cond1(ctx, op, op->args[0], &op->args[1],
@@ -3335,6 +3353,8 @@ void tcg_optimize(TCGContext *s)
             done = fold_xor(&ctx, op);
             break;
         case INDEX_op_set_label:
+            done = fold_set_label(&ctx, op);
+            break;
         case INDEX_op_br:
         case INDEX_op_exit_tb:
         case INDEX_op_goto_tb:
@@ -29,6 +29,7 @@
 #include "qemu/memalign.h"
 #include "qemu/cacheinfo.h"
 #include "qemu/qtree.h"
+#include "qemu/bitmap.h"
 #include "qapi/error.h"
 #include "tcg/tcg.h"
 #include "exec/translation-block.h"
@@ -72,6 +73,10 @@ struct tcg_region_state {
     /* fields protected by the lock */
     size_t current; /* current region index */
     size_t agg_size_full; /* aggregate size of full regions */
+    uint64_t gen; /* allocation generation counter */
+    uint64_t *alloc_gen; /* generation at which each region was handed out */
+    unsigned long *reclaimed; /* regions emptied by tcg_region_reclaim */
+    size_t n_reclaimed;
 };
 
 static struct tcg_region_state region;
@@ -191,10 +196,23 @@ static void tcg_region_trees_init(void)
     }
 }
 
-static struct tcg_region_tree *tc_ptr_to_region_tree(const void *p)
+/* @p must point into the rw view of code_gen_buffer */
+static size_t tc_ptr_to_region_idx(const void *p)
 {
-    size_t region_idx;
+    ptrdiff_t offset;
 
+    if (p < region.start_aligned) {
+        return 0;
+    }
+    offset = p - region.start_aligned;
+    if (offset > region.stride * (region.n - 1)) {
+        return region.n - 1;
+    }
+    return offset / region.stride;
+}
+
+static struct tcg_region_tree *tc_ptr_to_region_tree(const void *p)
+{
     /*
      * Like tcg_splitwx_to_rw, with no assert.  The pc may come from
      * a signal handler over which the caller has no control.
@@ -205,19 +223,7 @@ static struct tcg_region_tree *tc_ptr_to_region_tree(const void *p)
             return NULL;
         }
     }
-
-    if (p < region.start_aligned) {
-        region_idx = 0;
-    } else {
-        ptrdiff_t offset = p - region.start_aligned;
-
-        if (offset > region.stride * (region.n - 1)) {
-            region_idx = region.n - 1;
-        } else {
-            region_idx = offset / region.stride;
-        }
-    }
-    return region_trees + region_idx * tree_size;
+    return region_trees + tc_ptr_to_region_idx(p) * tree_size;
 }
 
 void tcg_tb_insert(TranslationBlock *tb)
@@ -359,11 +365,19 @@ static void tcg_region_assign(TCGContext *s, size_t curr_region)
 
 static bool tcg_region_alloc__locked(TCGContext *s)
 {
-    if (region.current == region.n) {
+    size_t curr_region;
+
+    if (region.current < region.n) {
+        curr_region = region.current++;
+    } else if (region.n_reclaimed) {
+        curr_region = find_first_bit(region.reclaimed, region.n);
+        clear_bit(curr_region, region.reclaimed);
+        region.n_reclaimed--;
+    } else {
         return true;
     }
-    tcg_region_assign(s, region.current);
-    region.current++;
+    region.alloc_gen[curr_region] = region.gen++;
+    tcg_region_assign(s, curr_region);
     return false;
 }
 
@@ -412,6 +426,8 @@ void tcg_region_reset_all(void)
     qemu_mutex_lock(&region.lock);
     region.current = 0;
     region.agg_size_full = 0;
+    bitmap_zero(region.reclaimed, region.n);
+    region.n_reclaimed = 0;
 
     for (i = 0; i < n_ctxs; i++) {
         TCGContext *s = qatomic_read(&tcg_ctxs[i]);
@@ -422,6 +438,100 @@ void tcg_region_reset_all(void)
     tcg_region_tree_reset_all();
 }
 
+static int region_gen_cmp(const void *ap, const void *bp)
+{
+    uint64_t a = region.alloc_gen[*(const size_t *)ap];
+    uint64_t b = region.alloc_gen[*(const size_t *)bp];
+
+    return a < b ? -1 : a > b;
+}
+
+static gboolean tcg_region_tree_collect(gpointer key, gpointer value,
+                                        gpointer data)
+{
+    g_ptr_array_add(data, value);
+    return false;
+}
+
+/*
+ * Recycle the oldest full regions instead of the whole buffer.
+ *
+ * Regions are handed out in order and, once full, are never written to
+ * again; the generation at which a region was handed out is therefore a
+ * good proxy for how cold its translations are.  Up to a quarter of the
+ * regions not currently owned by a TCGContext are reclaimed, oldest first.
+ * @evict is called on every TB of a reclaimed region; it must unlink the
+ * TB from everything that can still reach it (hash table, page lists,
+ * jump caches and chained jumps) since its memory is about to be reused.
+ *
+ * Returns the number of regions reclaimed.  Zero means that nothing could
+ * be reclaimed and that the caller must fall back to a full flush.
+ *
+ * Call from a safe-work context.
+ */
+size_t tcg_region_reclaim(void (*evict)(TranslationBlock *tb))
+{
+    unsigned int n_ctxs = qatomic_read(&tcg_cur_ctxs);
+    g_autofree unsigned long *owned = NULL;
+    g_autofree size_t *victims = NULL;
+    size_t n_victims = 0;
+    size_t i;
+
+    if (region.n < 2) {
+        return 0;
+    }
+
+    owned = bitmap_new(region.n);
+    victims = g_new(size_t, region.n);
+
+    qemu_mutex_lock(&region.lock);
+    for (i = 0; i < n_ctxs; i++) {
+        const TCGContext *s = qatomic_read(&tcg_ctxs[i]);
+
+        set_bit(tc_ptr_to_region_idx(s->code_gen_buffer), owned);
+    }
+    for (i = 0; i < region.current; i++) {
+        if (!test_bit(i, owned) && !test_bit(i, region.reclaimed)) {
+            victims[n_victims++] = i;
+        }
+    }
+    qemu_mutex_unlock(&region.lock);
+
+    if (n_victims == 0) {
+        return 0;
+    }
+    qsort(victims, n_victims, sizeof(*victims), region_gen_cmp);
+    n_victims = MIN(n_victims, MAX(region.n / 4, 1));
+
+    for (i = 0; i < n_victims; i++) {
+        struct tcg_region_tree *rt = region_trees + victims[i] * tree_size;
+        g_autoptr(GPtrArray) tbs = g_ptr_array_new();
+        void *start, *end;
+
+        qemu_mutex_lock(&rt->lock);
+        q_tree_foreach(rt->tree, tcg_region_tree_collect, tbs);
+        qemu_mutex_unlock(&rt->lock);
+
+        for (guint j = 0; j < tbs->len; j++) {
+            evict(g_ptr_array_index(tbs, j));
+        }
+
+        qemu_mutex_lock(&rt->lock);
+        /* Increment the refcount first so that destroy acts as a reset */
+        q_tree_ref(rt->tree);
+        q_tree_destroy(rt->tree);
+        qemu_mutex_unlock(&rt->lock);
+
+        tcg_region_bounds(victims[i], &start, &end);
+        qemu_mutex_lock(&region.lock);
+        set_bit(victims[i], region.reclaimed);
+        region.n_reclaimed++;
+        region.agg_size_full -= (end - start) - TCG_HIGHWATER;
+        qemu_mutex_unlock(&region.lock);
+    }
+    return n_victims;
+}
+
 static size_t tcg_n_regions(size_t tb_size, unsigned max_threads)
 {
 #ifdef CONFIG_USER_ONLY
@@ -805,6 +915,8 @@ void tcg_region_init(size_t tb_size, int splitwx, unsigned max_threads)
 
     /* init the region struct */
     qemu_mutex_init(&region.lock);
+    region.alloc_gen = g_new0(uint64_t, region.n);
+    region.reclaimed = bitmap_new(region.n);
 
     /*
      * Set guard pages in the rw buffer, as that's the one into which
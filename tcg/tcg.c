@@ -4797,6 +4797,7 @@ static TCGReg tcg_reg_alloc(TCGContext *s, TCGRegSet required_regs,
     }
 
     /* We must spill something.  */
+    s->gen_tb->prof.spills++;
     for (j = f; j < 2; j++) {
         TCGRegSet set = reg_ct[j];
 
@@ -5923,6 +5924,7 @@ static void tcg_reg_alloc_op(TCGContext *s, const TCGOp *op)
     case INDEX_op_goto_ptr:
         tcg_debug_assert(!const_args[0]);
         tcg_out_goto_ptr(s, new_args[0]);
+        s->gen_tb->prof.goto_ptr++;
         break;
 
     default:
@@ -6920,6 +6922,9 @@ int tcg_gen_code(TCGContext *s, TranslationBlock *tb, uint64_t pc_start)
     tb->jmp_insn_offset[0] = TB_JMP_OFFSET_INVALID;
     tb->jmp_insn_offset[1] = TB_JMP_OFFSET_INVALID;
 
+    /* Code quality metrics start afresh if we restart after overflow. */
+    memset(&tb->prof, 0, sizeof(tb->prof));
+
     tcg_reg_alloc_start(s);
 
     /*
@@ -6992,9 +6997,11 @@ int tcg_gen_code(TCGContext *s, TranslationBlock *tb, uint64_t pc_start)
         case INDEX_op_call:
             assert_carry_dead(s);
             tcg_reg_alloc_call(s, op);
+            tb->prof.calls++;
             break;
         case INDEX_op_exit_tb:
             tcg_out_exit_tb(s, op->args[0]);
+            tb->prof.exit_tb++;
             break;
         case INDEX_op_goto_tb:
             tcg_out_goto_tb(s, op->args[0]);
@@ -325,6 +325,9 @@ static void tci_qemu_st(CPUArchState *env, uint64_t taddr, uint64_t val,
     }
 }
 
+/* Each case is also a label, for the dispatch table of tcg_qemu_tb_exec */
+#define CASE(op)  case INDEX_op_##op: op_##op
+
 /* Interpret pseudo code in tb. */
 /*
  * Disable CFI checks.
@@ -340,6 +343,104 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
                    / sizeof(uint64_t)];
     bool carry = false;
 
+    /*
+     * Threaded dispatch: jump straight to the handler of each opcode.
+     * Since the indirect jump is duplicated at the end of every handler,
+     * the host branch predictor can learn which op tends to follow which,
+     * and there is no range check on the opcode.  The switch below only
+     * provides the case bodies and the meaning of "break".
+     */
+    static const void * const dispatch[256] = {
+        [0 ... 255] = &&op_bad,
+        [INDEX_op_call] = &&op_call,
+        [INDEX_op_br] = &&op_br,
+#if TCG_TARGET_REG_BITS == 32
+        [INDEX_op_setcond2_i32] = &&op_setcond2_i32,
+#elif TCG_TARGET_REG_BITS == 64
+        [INDEX_op_setcond] = &&op_setcond,
+        [INDEX_op_movcond] = &&op_movcond,
+#endif
+        [INDEX_op_mov] = &&op_mov,
+        [INDEX_op_tci_movi] = &&op_tci_movi,
+        [INDEX_op_tci_movl] = &&op_tci_movl,
+        [INDEX_op_tci_setcarry] = &&op_tci_setcarry,
+        [INDEX_op_ld8u] = &&op_ld8u,
+        [INDEX_op_ld8s] = &&op_ld8s,
+        [INDEX_op_ld16u] = &&op_ld16u,
+        [INDEX_op_ld16s] = &&op_ld16s,
+        [INDEX_op_ld] = &&op_ld,
+        [INDEX_op_st8] = &&op_st8,
+        [INDEX_op_st16] = &&op_st16,
+        [INDEX_op_st] = &&op_st,
+        [INDEX_op_add] = &&op_add,
+        [INDEX_op_sub] = &&op_sub,
+        [INDEX_op_mul] = &&op_mul,
+        [INDEX_op_and] = &&op_and,
+        [INDEX_op_or] = &&op_or,
+        [INDEX_op_xor] = &&op_xor,
+        [INDEX_op_andc] = &&op_andc,
+        [INDEX_op_orc] = &&op_orc,
+        [INDEX_op_eqv] = &&op_eqv,
+        [INDEX_op_nand] = &&op_nand,
+        [INDEX_op_nor] = &&op_nor,
+        [INDEX_op_neg] = &&op_neg,
+        [INDEX_op_not] = &&op_not,
+        [INDEX_op_ctpop] = &&op_ctpop,
+        [INDEX_op_addco] = &&op_addco,
+        [INDEX_op_addci] = &&op_addci,
+        [INDEX_op_addcio] = &&op_addcio,
+        [INDEX_op_subbo] = &&op_subbo,
+        [INDEX_op_subbi] = &&op_subbi,
+        [INDEX_op_subbio] = &&op_subbio,
+        [INDEX_op_muls2] = &&op_muls2,
+        [INDEX_op_mulu2] = &&op_mulu2,
+        [INDEX_op_tci_divs32] = &&op_tci_divs32,
+        [INDEX_op_tci_divu32] = &&op_tci_divu32,
+        [INDEX_op_tci_rems32] = &&op_tci_rems32,
+        [INDEX_op_tci_remu32] = &&op_tci_remu32,
+        [INDEX_op_tci_clz32] = &&op_tci_clz32,
+        [INDEX_op_tci_ctz32] = &&op_tci_ctz32,
+        [INDEX_op_tci_setcond32] = &&op_tci_setcond32,
+        [INDEX_op_tci_movcond32] = &&op_tci_movcond32,
+        [INDEX_op_shl] = &&op_shl,
+        [INDEX_op_shr] = &&op_shr,
+        [INDEX_op_sar] = &&op_sar,
+        [INDEX_op_tci_rotl32] = &&op_tci_rotl32,
+        [INDEX_op_tci_rotr32] = &&op_tci_rotr32,
+        [INDEX_op_deposit] = &&op_deposit,
+        [INDEX_op_extract] = &&op_extract,
+        [INDEX_op_sextract] = &&op_sextract,
+        [INDEX_op_brcond] = &&op_brcond,
+        [INDEX_op_bswap16] = &&op_bswap16,
+        [INDEX_op_bswap32] = &&op_bswap32,
+#if TCG_TARGET_REG_BITS == 64
+        [INDEX_op_ld32u] = &&op_ld32u,
+        [INDEX_op_ld32s] = &&op_ld32s,
+        [INDEX_op_st32] = &&op_st32,
+        [INDEX_op_divs] = &&op_divs,
+        [INDEX_op_divu] = &&op_divu,
+        [INDEX_op_rems] = &&op_rems,
+        [INDEX_op_remu] = &&op_remu,
+        [INDEX_op_clz] = &&op_clz,
+        [INDEX_op_ctz] = &&op_ctz,
+        [INDEX_op_rotl] = &&op_rotl,
+        [INDEX_op_rotr] = &&op_rotr,
+        [INDEX_op_ext_i32_i64] = &&op_ext_i32_i64,
+        [INDEX_op_extu_i32_i64] = &&op_extu_i32_i64,
+        [INDEX_op_bswap64] = &&op_bswap64,
+#endif /* TCG_TARGET_REG_BITS == 64 */
+        [INDEX_op_exit_tb] = &&op_exit_tb,
+        [INDEX_op_goto_tb] = &&op_goto_tb,
+        [INDEX_op_goto_ptr] = &&op_goto_ptr,
+        [INDEX_op_qemu_ld] = &&op_qemu_ld,
+        [INDEX_op_tci_qemu_ld_rrr] = &&op_tci_qemu_ld_rrr,
+        [INDEX_op_qemu_st] = &&op_qemu_st,
+        [INDEX_op_tci_qemu_st_rrr] = &&op_tci_qemu_st_rrr,
+        [INDEX_op_qemu_ld2] = &&op_qemu_ld2,
+        [INDEX_op_qemu_st2] = &&op_qemu_st2,
+        [INDEX_op_mb] = &&op_mb,
+    };
+
     regs[TCG_AREG0] = (tcg_target_ulong)env;
     regs[TCG_REG_CALL_STACK] = (uintptr_t)stack;
     tci_assert(tb_ptr);
@@ -360,8 +461,9 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
         insn = *tb_ptr++;
         opc = extract32(insn, 0, 8);
 
+        goto *dispatch[opc];
         switch (opc) {
-        case INDEX_op_call:
+        CASE(call):
             {
                 void *call_slots[MAX_CALL_IARGS];
                 ffi_cif *cif;
@@ -414,82 +516,82 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
             }
             break;
 
-        case INDEX_op_br:
+        CASE(br):
             tci_args_l(insn, tb_ptr, &ptr);
             tb_ptr = ptr;
             continue;
 #if TCG_TARGET_REG_BITS == 32
-        case INDEX_op_setcond2_i32:
+        CASE(setcond2_i32):
             tci_args_rrrrrc(insn, &r0, &r1, &r2, &r3, &r4, &condition);
             regs[r0] = tci_compare64(tci_uint64(regs[r2], regs[r1]),
                                      tci_uint64(regs[r4], regs[r3]),
                                      condition);
             break;
 #elif TCG_TARGET_REG_BITS == 64
-        case INDEX_op_setcond:
+        CASE(setcond):
             tci_args_rrrc(insn, &r0, &r1, &r2, &condition);
             regs[r0] = tci_compare64(regs[r1], regs[r2], condition);
             break;
-        case INDEX_op_movcond:
+        CASE(movcond):
             tci_args_rrrrrc(insn, &r0, &r1, &r2, &r3, &r4, &condition);
             tmp32 = tci_compare64(regs[r1], regs[r2], condition);
             regs[r0] = regs[tmp32 ? r3 : r4];
             break;
 #endif
-        case INDEX_op_mov:
+        CASE(mov):
             tci_args_rr(insn, &r0, &r1);
             regs[r0] = regs[r1];
             break;
-        case INDEX_op_tci_movi:
+        CASE(tci_movi):
             tci_args_ri(insn, &r0, &t1);
             regs[r0] = t1;
             break;
-        case INDEX_op_tci_movl:
+        CASE(tci_movl):
             tci_args_rl(insn, tb_ptr, &r0, &ptr);
             regs[r0] = *(tcg_target_ulong *)ptr;
             break;
-        case INDEX_op_tci_setcarry:
+        CASE(tci_setcarry):
             carry = true;
             break;
 
             /* Load/store operations (32 bit). */
 
-        case INDEX_op_ld8u:
+        CASE(ld8u):
             tci_args_rrs(insn, &r0, &r1, &ofs);
             ptr = (void *)(regs[r1] + ofs);
             regs[r0] = *(uint8_t *)ptr;
             break;
-        case INDEX_op_ld8s:
+        CASE(ld8s):
             tci_args_rrs(insn, &r0, &r1, &ofs);
             ptr = (void *)(regs[r1] + ofs);
             regs[r0] = *(int8_t *)ptr;
             break;
-        case INDEX_op_ld16u:
+        CASE(ld16u):
             tci_args_rrs(insn, &r0, &r1, &ofs);
             ptr = (void *)(regs[r1] + ofs);
             regs[r0] = *(uint16_t *)ptr;
             break;
-        case INDEX_op_ld16s:
+        CASE(ld16s):
             tci_args_rrs(insn, &r0, &r1, &ofs);
             ptr = (void *)(regs[r1] + ofs);
             regs[r0] = *(int16_t *)ptr;
             break;
-        case INDEX_op_ld:
+        CASE(ld):
             tci_args_rrs(insn, &r0, &r1, &ofs);
             ptr = (void *)(regs[r1] + ofs);
             regs[r0] = *(tcg_target_ulong *)ptr;
             break;
-        case INDEX_op_st8:
+        CASE(st8):
             tci_args_rrs(insn, &r0, &r1, &ofs);
             ptr = (void *)(regs[r1] + ofs);
             *(uint8_t *)ptr = regs[r0];
             break;
-        case INDEX_op_st16:
+        CASE(st16):
             tci_args_rrs(insn, &r0, &r1, &ofs);
             ptr = (void *)(regs[r1] + ofs);
             *(uint16_t *)ptr = regs[r0];
             break;
-        case INDEX_op_st:
+        CASE(st):
             tci_args_rrs(insn, &r0, &r1, &ofs);
             ptr = (void *)(regs[r1] + ofs);
             *(tcg_target_ulong *)ptr = regs[r0];
@@ -497,73 +599,73 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
 
             /* Arithmetic operations (mixed 32/64 bit). */
 
-        case INDEX_op_add:
+        CASE(add):
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = regs[r1] + regs[r2];
             break;
-        case INDEX_op_sub:
+        CASE(sub):
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = regs[r1] - regs[r2];
             break;
-        case INDEX_op_mul:
+        CASE(mul):
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = regs[r1] * regs[r2];
             break;
-        case INDEX_op_and:
+        CASE(and):
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = regs[r1] & regs[r2];
             break;
-        case INDEX_op_or:
+        CASE(or):
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = regs[r1] | regs[r2];
             break;
-        case INDEX_op_xor:
+        CASE(xor):
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = regs[r1] ^ regs[r2];
             break;
-        case INDEX_op_andc:
+        CASE(andc):
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = regs[r1] & ~regs[r2];
             break;
-        case INDEX_op_orc:
+        CASE(orc):
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = regs[r1] | ~regs[r2];
             break;
-        case INDEX_op_eqv:
+        CASE(eqv):
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = ~(regs[r1] ^ regs[r2]);
             break;
-        case INDEX_op_nand:
+        CASE(nand):
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = ~(regs[r1] & regs[r2]);
             break;
-        case INDEX_op_nor:
+        CASE(nor):
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = ~(regs[r1] | regs[r2]);
             break;
-        case INDEX_op_neg:
+        CASE(neg):
             tci_args_rr(insn, &r0, &r1);
             regs[r0] = -regs[r1];
             break;
-        case INDEX_op_not:
+        CASE(not):
             tci_args_rr(insn, &r0, &r1);
             regs[r0] = ~regs[r1];
             break;
-        case INDEX_op_ctpop:
+        CASE(ctpop):
             tci_args_rr(insn, &r0, &r1);
             regs[r0] = ctpop_tr(regs[r1]);
             break;
-        case INDEX_op_addco:
+        CASE(addco):
             tci_args_rrr(insn, &r0, &r1, &r2);
             t1 = regs[r1] + regs[r2];
             carry = t1 < regs[r1];
             regs[r0] = t1;
             break;
-        case INDEX_op_addci:
+        CASE(addci):
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = regs[r1] + regs[r2] + carry;
             break;
-        case INDEX_op_addcio:
+        CASE(addcio):
             tci_args_rrr(insn, &r0, &r1, &r2);
             if (carry) {
                 t1 = regs[r1] + regs[r2] + 1;
@@ -574,16 +676,16 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
             }
             regs[r0] = t1;
             break;
-        case INDEX_op_subbo:
+        CASE(subbo):
             tci_args_rrr(insn, &r0, &r1, &r2);
             carry = regs[r1] < regs[r2];
             regs[r0] = regs[r1] - regs[r2];
             break;
-        case INDEX_op_subbi:
+        CASE(subbi):
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = regs[r1] - regs[r2] - carry;
             break;
-        case INDEX_op_subbio:
+        CASE(subbio):
             tci_args_rrr(insn, &r0, &r1, &r2);
             if (carry) {
                 carry = regs[r1] <= regs[r2];
@@ -593,7 +695,7 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
                 regs[r0] = regs[r1] - regs[r2];
             }
             break;
-        case INDEX_op_muls2:
+        CASE(muls2):
             tci_args_rrrr(insn, &r0, &r1, &r2, &r3);
 #if TCG_TARGET_REG_BITS == 32
             tmp64 = (int64_t)(int32_t)regs[r2] * (int32_t)regs[r3];
@@ -602,7 +704,7 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
             muls64(&regs[r0], &regs[r1], regs[r2], regs[r3]);
 #endif
             break;
-        case INDEX_op_mulu2:
+        CASE(mulu2):
             tci_args_rrrr(insn, &r0, &r1, &r2, &r3);
 #if TCG_TARGET_REG_BITS == 32
             tmp64 = (uint64_t)(uint32_t)regs[r2] * (uint32_t)regs[r3];
@@ -614,37 +716,37 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
 
             /* Arithmetic operations (32 bit). */
 
-        case INDEX_op_tci_divs32:
+        CASE(tci_divs32):
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = (int32_t)regs[r1] / (int32_t)regs[r2];
             break;
-        case INDEX_op_tci_divu32:
+        CASE(tci_divu32):
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = (uint32_t)regs[r1] / (uint32_t)regs[r2];
             break;
-        case INDEX_op_tci_rems32:
+        CASE(tci_rems32):
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = (int32_t)regs[r1] % (int32_t)regs[r2];
             break;
-        case INDEX_op_tci_remu32:
+        CASE(tci_remu32):
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = (uint32_t)regs[r1] % (uint32_t)regs[r2];
             break;
-        case INDEX_op_tci_clz32:
+        CASE(tci_clz32):
             tci_args_rrr(insn, &r0, &r1, &r2);
             tmp32 = regs[r1];
             regs[r0] = tmp32 ? clz32(tmp32) : regs[r2];
             break;
-        case INDEX_op_tci_ctz32:
+        CASE(tci_ctz32):
             tci_args_rrr(insn, &r0, &r1, &r2);
             tmp32 = regs[r1];
             regs[r0] = tmp32 ? ctz32(tmp32) : regs[r2];
             break;
-        case INDEX_op_tci_setcond32:
+        CASE(tci_setcond32):
             tci_args_rrrc(insn, &r0, &r1, &r2, &condition);
             regs[r0] = tci_compare32(regs[r1], regs[r2], condition);
             break;
-        case INDEX_op_tci_movcond32:
+        CASE(tci_movcond32):
             tci_args_rrrrrc(insn, &r0, &r1, &r2, &r3, &r4, &condition);
             tmp32 = tci_compare32(regs[r1], regs[r2], condition);
             regs[r0] = regs[tmp32 ? r3 : r4];
@@ -652,67 +754,67 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
 
             /* Shift/rotate operations. */
 
-        case INDEX_op_shl:
+        CASE(shl):
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = regs[r1] << (regs[r2] % TCG_TARGET_REG_BITS);
             break;
-        case INDEX_op_shr:
+        CASE(shr):
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = regs[r1] >> (regs[r2] % TCG_TARGET_REG_BITS);
             break;
-        case INDEX_op_sar:
+        CASE(sar):
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = ((tcg_target_long)regs[r1]
                         >> (regs[r2] % TCG_TARGET_REG_BITS));
             break;
-        case INDEX_op_tci_rotl32:
+        CASE(tci_rotl32):
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = rol32(regs[r1], regs[r2] & 31);
             break;
-        case INDEX_op_tci_rotr32:
+        CASE(tci_rotr32):
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = ror32(regs[r1], regs[r2] & 31);
             break;
-        case INDEX_op_deposit:
+        CASE(deposit):
             tci_args_rrrbb(insn, &r0, &r1, &r2, &pos, &len);
             regs[r0] = deposit_tr(regs[r1], pos, len, regs[r2]);
             break;
-        case INDEX_op_extract:
+        CASE(extract):
             tci_args_rrbb(insn, &r0, &r1, &pos, &len);
             regs[r0] = extract_tr(regs[r1], pos, len);
             break;
-        case INDEX_op_sextract:
+        CASE(sextract):
             tci_args_rrbb(insn, &r0, &r1, &pos, &len);
             regs[r0] = sextract_tr(regs[r1], pos, len);
             break;
-        case INDEX_op_brcond:
+        CASE(brcond):
             tci_args_rl(insn, tb_ptr, &r0, &ptr);
             if (regs[r0]) {
                 tb_ptr = ptr;
             }
             break;
-        case INDEX_op_bswap16:
+        CASE(bswap16):
             tci_args_rr(insn, &r0, &r1);
             regs[r0] = bswap16(regs[r1]);
             break;
-        case INDEX_op_bswap32:
+        CASE(bswap32):
             tci_args_rr(insn, &r0, &r1);
             regs[r0] = bswap32(regs[r1]);
             break;
 #if TCG_TARGET_REG_BITS == 64
             /* Load/store operations (64 bit). */
 
-        case INDEX_op_ld32u:
+        CASE(ld32u):
             tci_args_rrs(insn, &r0, &r1, &ofs);
             ptr = (void *)(regs[r1] + ofs);
             regs[r0] = *(uint32_t *)ptr;
             break;
-        case INDEX_op_ld32s:
+        CASE(ld32s):
             tci_args_rrs(insn, &r0, &r1, &ofs);
             ptr = (void *)(regs[r1] + ofs);
             regs[r0] = *(int32_t *)ptr;
             break;
-        case INDEX_op_st32:
+        CASE(st32):
             tci_args_rrs(insn, &r0, &r1, &ofs);
             ptr = (void *)(regs[r1] + ofs);
             *(uint32_t *)ptr = regs[r0];
@@ -720,50 +822,50 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
 
             /* Arithmetic operations (64 bit). */
 
-        case INDEX_op_divs:
+        CASE(divs):
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = (int64_t)regs[r1] / (int64_t)regs[r2];
             break;
-        case INDEX_op_divu:
+        CASE(divu):
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = (uint64_t)regs[r1] / (uint64_t)regs[r2];
             break;
-        case INDEX_op_rems:
+        CASE(rems):
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = (int64_t)regs[r1] % (int64_t)regs[r2];
             break;
-        case INDEX_op_remu:
+        CASE(remu):
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = (uint64_t)regs[r1] % (uint64_t)regs[r2];
             break;
-        case INDEX_op_clz:
+        CASE(clz):
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = regs[r1] ? clz64(regs[r1]) : regs[r2];
             break;
-        case INDEX_op_ctz:
+        CASE(ctz):
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = regs[r1] ? ctz64(regs[r1]) : regs[r2];
             break;
 
             /* Shift/rotate operations (64 bit). */
 
-        case INDEX_op_rotl:
+        CASE(rotl):
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = rol64(regs[r1], regs[r2] & 63);
             break;
-        case INDEX_op_rotr:
+        CASE(rotr):
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = ror64(regs[r1], regs[r2] & 63);
             break;
-        case INDEX_op_ext_i32_i64:
+        CASE(ext_i32_i64):
             tci_args_rr(insn, &r0, &r1);
             regs[r0] = (int32_t)regs[r1];
             break;
-        case INDEX_op_extu_i32_i64:
+        CASE(extu_i32_i64):
             tci_args_rr(insn, &r0, &r1);
             regs[r0] = (uint32_t)regs[r1];
             break;
-        case INDEX_op_bswap64:
+        CASE(bswap64):
             tci_args_rr(insn, &r0, &r1);
             regs[r0] = bswap64(regs[r1]);
             break;
@@ -771,16 +873,16 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
 
             /* QEMU specific operations. */
 
-        case INDEX_op_exit_tb:
+        CASE(exit_tb):
             tci_args_l(insn, tb_ptr, &ptr);
             return (uintptr_t)ptr;
 
-        case INDEX_op_goto_tb:
+        CASE(goto_tb):
             tci_args_l(insn, tb_ptr, &ptr);
             tb_ptr = *(void **)ptr;
             break;
 
-        case INDEX_op_goto_ptr:
+        CASE(goto_ptr):
             tci_args_r(insn, &r0);
             ptr = (void *)regs[r0];
             if (!ptr) {
@@ -789,31 +891,31 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
             tb_ptr = ptr;
             break;
 
-        case INDEX_op_qemu_ld:
+        CASE(qemu_ld):
             tci_args_rrm(insn, &r0, &r1, &oi);
             taddr = regs[r1];
             regs[r0] = tci_qemu_ld(env, taddr, oi, tb_ptr);
             break;
-        case INDEX_op_tci_qemu_ld_rrr:
+        CASE(tci_qemu_ld_rrr):
             tci_args_rrr(insn, &r0, &r1, &r2);
             taddr = regs[r1];
             oi = regs[r2];
             regs[r0] = tci_qemu_ld(env, taddr, oi, tb_ptr);
             break;
 
-        case INDEX_op_qemu_st:
+        CASE(qemu_st):
             tci_args_rrm(insn, &r0, &r1, &oi);
             taddr = regs[r1];
             tci_qemu_st(env, taddr, regs[r0], oi, tb_ptr);
             break;
-        case INDEX_op_tci_qemu_st_rrr:
+        CASE(tci_qemu_st_rrr):
             tci_args_rrr(insn, &r0, &r1, &r2);
             taddr = regs[r1];
             oi = regs[r2];
             tci_qemu_st(env, taddr, regs[r0], oi, tb_ptr);
             break;
 
-        case INDEX_op_qemu_ld2:
+        CASE(qemu_ld2):
             tcg_debug_assert(TCG_TARGET_REG_BITS == 32);
             tci_args_rrrr(insn, &r0, &r1, &r2, &r3);
             taddr = regs[r2];
@@ -822,7 +924,7 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
             tci_write_reg64(regs, r1, r0, tmp64);
             break;
 
-        case INDEX_op_qemu_st2:
+        CASE(qemu_st2):
             tcg_debug_assert(TCG_TARGET_REG_BITS == 32);
             tci_args_rrrr(insn, &r0, &r1, &r2, &r3);
             tmp64 = tci_uint64(regs[r1], regs[r0]);
@@ -831,11 +933,12 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
             tci_qemu_st(env, taddr, tmp64, oi, tb_ptr);
             break;
 
-        case INDEX_op_mb:
+        CASE(mb):
             /* Ensure ordering for all kinds */
             smp_mb();
             break;
         default:
+        op_bad:
             g_assert_not_reached();
         }
     }
@@ -0,0 +1,364 @@
+/*
+ * Block layer scaling benchmark
+ *
+ * Submits requests through a BlockBackend from a number of IOThreads, each
+ * with a fixed number of requests in flight, and reports the throughput
+ * and the CPU time that the IOThreads spent per request.  With the null
+ * drivers nearly all of that time is spent in the block layer itself.
+ *
+ * Every combination of the given IOThread counts and queue depths is run
+ * once for each number of raw format layers from 0 to -l, so that the cost
+ * of a single layer shows as the difference between consecutive lines.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/cutils.h"
+#include "qemu/main-loop.h"
+#include "qemu/timer.h"
+#include "block/block.h"
+#include "block/qdict.h"
+#include "system/block-backend.h"
+#include "qapi/error.h"
+#include "qobject/qdict.h"
+#include "iothread.h"
+
+typedef struct BenchThread {
+    IOThread *iothread;
+    BlockBackend *blk;
+    /* Only accessed from the IOThread while the workload runs */
+    uint64_t ops;
+    unsigned int running;
+    bool started;
+    int64_t cpu_start;
+    int64_t cpu_end;
+} QEMU_ALIGNED(64) BenchThread;
+
+typedef struct BenchWorker {
+    BenchThread *thread;
+    uint64_t offset;
+    void *buf;
+    QEMUIOVector qiov;
+} BenchWorker;
+
+static unsigned int duration = 1;
+static GArray *thread_counts;
+static GArray *queue_depths;
+static unsigned int max_layers;
+static uint64_t request_size = 4096;
+static uint64_t device_size = 1 * GiB;
+static const char *driver = "null-co";
+static const char *filename;
+static bool nocache;
+static bool per_thread_node;
+static bool write_requests;
+
+static bool bench_stop;
+static unsigned int bench_workers;
+static unsigned int bench_running;
+static QemuEvent bench_done;
+
+static const char commands_string[] =
+    " -d = duration, in seconds\n"
+    " -n = comma-separated list of IOThread counts\n"
+    " -q = comma-separated list of queue depths per IOThread\n"
+    " -l = maximum number of raw format layers on top of the driver\n"
+    " -s = one node per IOThread instead of a shared one\n"
+    "\n"
+    " -D = driver: null-co (default), null-aio or file\n"
+    " -f = file name for the file driver\n"
+    " -N = bypass the host page cache (file driver)\n"
+    " -S = device size for the null drivers\n"
+    " -b = request size\n"
+    " -w = write instead of read";
+
+static void usage_complete(int argc, char *argv[])
+{
+    fprintf(stderr, "Usage: %s [options]\n", argv[0]);
+    fprintf(stderr, "options:\n%s\n", commands_string);
+    exit(-1);
+}
+
+static int64_t thread_cpu_ns(void)
+{
+#ifdef CLOCK_THREAD_CPUTIME_ID
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0) {
+        return ts.tv_sec * NANOSECONDS_PER_SECOND + ts.tv_nsec;
+    }
+#endif
+    return 0;
+}
+
+static void coroutine_fn bench_co(void *opaque)
+{
+    BenchWorker *w = opaque;
+    BenchThread *t = w->thread;
+    uint64_t stride = request_size * bench_workers;
+    int ret;
+
+    if (!t->started) {
+        t->started = true;
+        t->cpu_start = thread_cpu_ns();
+    }
+
+    while (!qatomic_read(&bench_stop)) {
+        if (write_requests) {
+            ret = blk_co_pwritev(t->blk, w->offset, request_size, &w->qiov, 0);
+        } else {
+            ret = blk_co_preadv(t->blk, w->offset, request_size, &w->qiov, 0);
+        }
+        if (ret < 0) {
+            fprintf(stderr, "I/O error at offset %" PRIu64 ": %s\n",
+                    w->offset, strerror(-ret));
+            exit(1);
+        }
+        t->ops++;
+
+        w->offset += stride;
+        if (w->offset + request_size > device_size) {
+            w->offset %= stride;
+        }
+    }
+
+    if (--t->running == 0) {
+        t->cpu_end = thread_cpu_ns();
+        if (qatomic_fetch_dec(&bench_running) == 1) {
+            qemu_event_set(&bench_done);
+        }
+    }
+}
+
+static BlockBackend *bench_open(unsigned int layers)
+{
+    QDict *opts = qdict_new();
+    BlockBackend *blk;
+    int flags = write_requests ? BDRV_O_RDWR : 0;
+    unsigned int i;
+
+    qdict_put_str(opts, "driver", driver);
+    if (filename) {
+        qdict_put_str(opts, "filename", filename);
+    } else {
+        qdict_put_int(opts, "size", device_size);
+        qdict_put_bool(opts, "read-zeroes", false);
+    }
+    for (i = 0; i < layers; i++) {
+        QDict *raw = qdict_new();
+
+        qdict_put_str(raw, "driver", "raw");
+        qdict_put(raw, "file", opts);
+        opts = raw;
+    }
+    qdict_flatten(opts);
+    if (nocache) {
+        flags |= BDRV_O_NOCACHE;
+    }
+
+    blk = blk_new_open(NULL, NULL, opts, flags, &error_fatal);
+    if (filename) {
+        device_size = QEMU_ALIGN_DOWN(blk_getlength(blk), request_size);
+    }
+    return blk;
+}
+
+static void bench_run(unsigned int n_threads, unsigned int qd,
+                      unsigned int layers)
+{
+    BenchThread *threads = g_new0(BenchThread, n_threads);
+    BenchWorker *workers = g_new0(BenchWorker, n_threads * qd);
+    BlockBackend *shared = NULL;
+    uint64_t ops = 0;
+    int64_t cpu = 0;
+    int64_t start, elapsed;
+    unsigned int i;
+
+    if (!per_thread_node) {
+        shared = bench_open(layers);
+    }
+    for (i = 0; i < n_threads; i++) {
+        threads[i].iothread = iothread_new();
+        if (shared) {
+            blk_ref(shared);
+            threads[i].blk = shared;
+        } else {
+            threads[i].blk = bench_open(layers);
+        }
+        threads[i].running = qd;
+    }
+    if (device_size < request_size * n_threads * qd) {
+        fprintf(stderr, "Device too small for %u requests of %" PRIu64
+                " bytes\n", n_threads * qd, request_size);
+        exit(1);
+    }
+    for (i = 0; i < n_threads * qd; i++) {
+        BenchWorker *w = &workers[i];
+
+        w->thread = &threads[i / qd];
+        w->offset = i * request_size;
+        w->buf = blk_blockalign(w->thread->blk, request_size);
+        memset(w->buf, 0, request_size);
+        qemu_iovec_init_buf(&w->qiov, w->buf, request_size);
+    }
+
+    bench_workers = n_threads * qd;
+    qatomic_set(&bench_stop, false);
+    qatomic_set(&bench_running, n_threads);
+    qemu_event_reset(&bench_done);
+
+    start = get_clock();
+    for (i = 0; i < n_threads * qd; i++) {
+        BenchWorker *w = &workers[i];
+        Coroutine *co = qemu_coroutine_create(bench_co, w);
+
+        aio_co_schedule(iothread_get_aio_context(w->thread->iothread), co);
+    }
+    g_usleep(duration * G_USEC_PER_SEC);
+    qatomic_set(&bench_stop, true);
+    qemu_event_wait(&bench_done);
+    elapsed = get_clock() - start;
+
+    for (i = 0; i < n_threads; i++) {
+        ops += threads[i].ops;
+        cpu += threads[i].cpu_end - threads[i].cpu_start;
+        iothread_join(threads[i].iothread);
+        blk_unref(threads[i].blk);
+    }
+    for (i = 0; i < n_threads * qd; i++) {
+        qemu_vfree(workers[i].buf);
+    }
+    if (shared) {
+        blk_unref(shared);
+    }
+
+    printf("%7u %5u %6u %12.0f %11.0f\n", n_threads, qd, layers,
+           (double)ops * NANOSECONDS_PER_SECOND / elapsed,
+           ops ? (double)cpu / ops : 0);
+
+    g_free(workers);
+    g_free(threads);
+}
+
+static GArray *parse_list(const char *arg, char opt)
+{
+    g_auto(GStrv) items = g_strsplit(arg, ",", -1);
+    GArray *list = g_array_new(false, false, sizeof(unsigned int));
+    char **p;
+
+    for (p = items; *p; p++) {
+        unsigned int val;
+
+        if (qemu_strtoui(*p, NULL, 10, &val) < 0 || !val) {
+            fprintf(stderr, "Invalid value '%s' for -%c\n", *p, opt);
+            exit(1);
+        }
+        g_array_append_val(list, val);
+    }
+    return list;
+}
+
+static uint64_t parse_size(const char *arg, char opt)
+{
+    uint64_t val;
+
+    if (qemu_strtosz(arg, NULL, &val) < 0 || !val) {
+        fprintf(stderr, "Invalid size '%s' for -%c\n", arg, opt);
+        exit(1);
+    }
+    return val;
+}
+
+static void parse_args(int argc, char *argv[])
+{
+    int c;
+
+    for (;;) {
+        c = getopt(argc, argv, "b:d:D:f:hl:n:Nq:sS:w");
+        if (c < 0) {
+            break;
+        }
+        switch (c) {
+        case 'b':
+            request_size = parse_size(optarg, c);
+            break;
+        case 'd':
+            duration = atoi(optarg);
+            break;
+        case 'D':
+            driver = optarg;
+            break;
+        case 'f':
+            filename = optarg;
+            break;
+        case 'h':
+            usage_complete(argc, argv);
+            exit(0);
+        case 'l':
+            max_layers = atoi(optarg);
+            break;
+        case 'n':
+            thread_counts = parse_list(optarg, c);
+            break;
+        case 'N':
+            nocache = true;
+            break;
+        case 'q':
+            queue_depths = parse_list(optarg, c);
+            break;
+        case 's':
+            per_thread_node = true;
+            break;
+        case 'S':
+            device_size = parse_size(optarg, c);
+            break;
+        case 'w':
+            write_requests = true;
+            break;
+        default:
+            usage_complete(argc, argv);
+        }
+    }
+
+    if (!strcmp(driver, "file") != !!filename) {
+        fprintf(stderr, "A file name is needed with the file driver only\n");
+        exit(1);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int one = 1;
+    unsigned int i, j, layers;
+
+    parse_args(argc, argv);
+    if (!thread_counts) {
+        thread_counts = g_array_new(false, false, sizeof(unsigned int));
+        g_array_append_val(thread_counts, one);
+    }
+    if (!queue_depths) {
+        queue_depths = g_array_new(false, false, sizeof(unsigned int));
+        g_array_append_val(queue_depths, one);
+    }
+
+    bdrv_init();
+    qemu_init_main_loop(&error_fatal);
+    qemu_event_init(&bench_done, false);
+
+    printf("threads    qd layers         IOPS  cpu-ns/req\n");
+    for (i = 0; i < thread_counts->len; i++) {
+        for (j = 0; j < queue_depths->len; j++) {
+            for (layers = 0; layers <= max_layers; layers++) {
+                bench_run(g_array_index(thread_counts, unsigned int, i),
+                          g_array_index(queue_depths, unsigned int, j),
+                          layers);
+            }
+        }
+    }
+
+    qemu_event_destroy(&bench_done);
+    g_array_free(thread_counts, true);
+    g_array_free(queue_depths, true);
+    return 0;
+}
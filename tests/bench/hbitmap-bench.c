@@ -0,0 +1,92 @@
+/*
+ * QEMU HBitmap scanning and merging speed benchmark
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#include "qemu/osdep.h"
+#include "qemu/hbitmap.h"
+#include "qemu/units.h"
+
+/* 1 TiB disk with 8 KiB granularity */
+#define BITS (128 * MiB)
+
+/* Dirty runs of @run bits every @stride bits */
+static HBitmap *alloc_pattern(uint64_t offset, uint64_t run, uint64_t stride)
+{
+    HBitmap *hb = hbitmap_alloc(BITS, 0);
+    uint64_t i;
+
+    for (i = offset; i + run <= BITS; i += stride) {
+        hbitmap_set(hb, i, run);
+    }
+    return hb;
+}
+
+static void test(const void *opaque)
+{
+    HBitmap *a = alloc_pattern(0, 4096, 64 * KiB);
+    HBitmap *b = alloc_pattern(1000, 100, 3000);
+    HBitmap *r = hbitmap_alloc(BITS, 0);
+    /* Long dirty runs, as in the first backup of a mostly written disk */
+    HBitmap *runs = alloc_pattern(0, 16 * MiB - 1, 16 * MiB);
+    uint64_t merged = 0, dirty = 0;
+    int accel_index = 0;
+
+    do {
+        double total = 0.0;
+        uint64_t n;
+
+        if (accel_index != 0) {
+            g_test_message("%s", "");  /* gnu_printf Werror for simple "" */
+        }
+
+        g_test_timer_start();
+        do {
+            hbitmap_merge(a, b, r);
+            total += BITS / 8;
+        } while (g_test_timer_elapsed() < 0.5);
+
+        if (accel_index == 0) {
+            merged = hbitmap_count(r);
+        } else {
+            g_assert_cmpint(hbitmap_count(r), ==, merged);
+        }
+        g_test_message("hbitmap_merge #%d: %8.0f MB/sec",
+                       accel_index, total / MiB / g_test_timer_last());
+
+        total = 0.0;
+        g_test_timer_start();
+        do {
+            int64_t start = 0, dirty_start, dirty_count;
+
+            n = 0;
+            while (hbitmap_next_dirty_area(runs, start, BITS, INT64_MAX,
+                                           &dirty_start, &dirty_count)) {
+                n += dirty_count;
+                start = dirty_start + dirty_count;
+            }
+            total += BITS / 8;
+        } while (g_test_timer_elapsed() < 0.5);
+
+        if (accel_index == 0) {
+            dirty = n;
+        } else {
+            g_assert_cmpint(n, ==, dirty);
+        }
+        g_test_message("hbitmap_next_dirty_area #%d: %8.0f MB/sec",
+                       accel_index, total / MiB / g_test_timer_last());
+        accel_index++;
+    } while (test_hbitmap_next_accel());
+
+    hbitmap_free(a);
+    hbitmap_free(b);
+    hbitmap_free(r);
+    hbitmap_free(runs);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_data_func("/hbitmap/speed", NULL, test);
+    return g_test_run();
+}
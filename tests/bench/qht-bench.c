@@ -9,9 +9,18 @@
 #include "qemu/atomic.h"
 #include "qemu/qht.h"
 #include "qemu/rcu.h"
+#include "qemu/timer.h"
 #include "qemu/xxhash.h"
 #include "qemu/memalign.h"
 
+/*
+ * Latency histogram: values below 8 ns get a bucket each; above that, each
+ * power of two is split into 8 buckets, i.e. the error is below 12.5%.
+ */
+#define LAT_SUB_BITS 3
+#define LAT_SUB_BUCKETS (1 << LAT_SUB_BITS)
+#define LAT_BUCKETS ((64 - LAT_SUB_BITS + 1) * LAT_SUB_BUCKETS)
+
 struct thread_stats {
     size_t rd;
     size_t not_rd;
@@ -21,6 +30,8 @@ struct thread_stats {
     size_t not_rm;
     size_t rz;
     size_t not_rz;
+    size_t rd_lat[LAT_BUCKETS];
+    size_t up_lat[LAT_BUCKETS];
 };
 
 struct thread_info {
@@ -60,7 +71,9 @@ static unsigned long resize_delay = 1000;
 static double resize_rate; /* 0.0 to 1.0 */
 static unsigned int n_rz_threads = 1;
 static QemuThread *rz_threads;
+static bool resize_reset;
 static bool precompute_hash;
+static bool measure_latency;
 
 static double update_rate; /* 0.0 to 1.0 */
 static uint64_t update_threshold;
@@ -93,7 +106,11 @@ static const char commands_string[] =
     " -R = enable auto-resize\n"
     " -S = resize rate (0.0 to 100.0)\n"
     " -D = delay (in us) between potential resizes\n"
-    " -N = number of resize threads";
+    " -N = number of resize threads\n"
+    " -F = resize threads reset the table to the initial size hint, so that\n"
+    "      it grows again through auto-resize\n"
+    "\n"
+    " -L = report the latency distribution of lookups and updates";
 
 static void usage_complete(int argc, char *argv[])
 {
@@ -135,6 +152,38 @@ static uint64_t xorshift64star(uint64_t x)
     return x * UINT64_C(2685821657736338717);
 }
 
+static unsigned int lat_bucket(uint64_t ns)
+{
+    int msb;
+
+    if (ns < LAT_SUB_BUCKETS) {
+        return ns;
+    }
+    msb = 63 - clz64(ns);
+    return ((msb - LAT_SUB_BITS + 1) << LAT_SUB_BITS) +
+           ((ns >> (msb - LAT_SUB_BITS)) & (LAT_SUB_BUCKETS - 1));
+}
+
+/* lowest latency that falls in bucket @idx */
+static uint64_t lat_bucket_min(unsigned int idx)
+{
+    int msb;
+
+    if (idx < LAT_SUB_BUCKETS) {
+        return idx;
+    }
+    msb = (idx >> LAT_SUB_BITS) + LAT_SUB_BITS - 1;
+    return (uint64_t)(LAT_SUB_BUCKETS + (idx & (LAT_SUB_BUCKETS - 1))) <<
+           (msb - LAT_SUB_BITS);
+}
+
+static inline void lat_record(size_t *hist, int64_t start)
+{
+    if (measure_latency) {
+        hist[lat_bucket(get_clock() - start)]++;
+    }
+}
+
 static void do_rz(struct thread_info *info)
 {
     struct thread_stats *stats = &info->stats;
@@ -144,7 +193,11 @@ static void do_rz(struct thread_info *info)
         size_t size = info->resize_down ? resize_min : resize_max;
         bool resized;
 
-        resized = qht_resize(&ht, size);
+        if (resize_reset) {
+            resized = qht_reset_size(&ht, qht_n_elems);
+        } else {
+            resized = qht_resize(&ht, size);
+        }
         info->resize_down = !info->resize_down;
 
         if (resized) {
@@ -160,6 +213,7 @@ static void do_rw(struct thread_info *info)
 {
     struct thread_stats *stats = &info->stats;
     uint64_t r = info->seed - 1;
+    int64_t start = measure_latency ? get_clock() : 0;
     uint32_t hash;
     long *p;
 
@@ -174,6 +228,7 @@ static void do_rw(struct thread_info *info)
         } else {
             stats->not_rd++;
         }
+        lat_record(stats->rd_lat, start);
     } else {
         p = &keys[r & (update_range - 1)];
         hash = hfunc(*p);
@@ -201,6 +256,7 @@ static void do_rw(struct thread_info *info)
             }
         }
         info->write_op = !info->write_op;
+        lat_record(stats->up_lat, start);
     }
 }
 
@@ -278,10 +334,15 @@ static void pr_params(void)
            qht_mode & QHT_MODE_AUTO_RESIZE ? "on" : "off");
     if (resize_rate) {
         printf(" resize_rate:       %f%%\n", resize_rate * 100.0);
-        printf(" resize range:      %zu-%zu\n", resize_min, resize_max);
+        if (resize_reset) {
+            printf(" resize:            reset to %zu\n", qht_n_elems);
+        } else {
+            printf(" resize range:      %zu-%zu\n", resize_min, resize_max);
+        }
         printf(" # resize threads   %u\n", n_rz_threads);
     }
     printf(" update rate:       %f%%\n", update_rate * 100.0);
+    printf(" latency:           %s\n", measure_latency ? "on" : "off");
     printf(" offset:            %ld\n", populate_offset);
     printf(" initial key range: %zu\n", init_range);
     printf(" lookup range:      %lu\n", lookup_range);
@@ -368,11 +429,16 @@ static void htable_init(void)
 
 static void add_stats(struct thread_stats *s, struct thread_info *info, int n)
 {
-    int i;
+    int i, j;
 
     for (i = 0; i < n; i++) {
         struct thread_stats *stats = &info[i].stats;
 
+        for (j = 0; j < LAT_BUCKETS; j++) {
+            s->rd_lat[j] += stats->rd_lat[j];
+            s->up_lat[j] += stats->up_lat[j];
+        }
+
         s->rd += stats->rd;
         s->not_rd += stats->not_rd;
 
@@ -387,6 +453,36 @@ static void add_stats(struct thread_stats *s, struct thread_info *info, int n)
     }
 }
 
+static void pr_latency(const char *name, const size_t *hist)
+{
+    static const double percentiles[] = { 50.0, 99.0, 99.9, 99.99 };
+    size_t total = 0;
+    size_t sum = 0;
+    int max = -1;
+    int i, j;
+
+    for (i = 0; i < LAT_BUCKETS; i++) {
+        total += hist[i];
+        if (hist[i]) {
+            max = i;
+        }
+    }
+    if (!total) {
+        return;
+    }
+
+    printf(" %s latency (ns):", name);
+    for (i = 0, j = 0; j < ARRAY_SIZE(percentiles); i++) {
+        sum += hist[i];
+        while (j < ARRAY_SIZE(percentiles) &&
+               sum >= total * percentiles[j] / 100.0) {
+            printf(" p%g %" PRIu64 ",", percentiles[j], lat_bucket_min(i));
+            j++;
+        }
+    }
+    printf(" max %" PRIu64 "\n", lat_bucket_min(max));
+}
+
 static void pr_stats(void)
 {
     struct thread_stats s = {};
@@ -418,6 +514,11 @@ static void pr_stats(void)
     tx = (s.rd + s.not_rd + s.in + s.not_in + s.rm + s.not_rm) / 1e6 / duration;
     printf(" Throughput:        %.2f MT/s\n", tx);
     printf(" Throughput/thread: %.2f MT/s/thread\n", tx / n_rw_threads);
+
+    if (measure_latency) {
+        pr_latency("Lookup", s.rd_lat);
+        pr_latency("Update", s.up_lat);
+    }
 }
 
 static void run_test(void)
@@ -445,7 +546,7 @@ static void parse_args(int argc, char *argv[])
     int c;
 
     for (;;) {
-        c = getopt(argc, argv, "d:D:g:k:K:l:hn:N:o:pr:Rs:S:u:");
+        c = getopt(argc, argv, "d:D:Fg:k:K:l:Lhn:N:o:pr:Rs:S:u:");
         if (c < 0) {
             break;
         }
@@ -456,6 +557,9 @@ static void parse_args(int argc, char *argv[])
         case 'D':
             resize_delay = atol(optarg);
             break;
+        case 'F':
+            resize_reset = true;
+            break;
         case 'g':
             init_range = pow2ceil(atol(optarg));
             lookup_range = pow2ceil(atol(optarg));
@@ -475,6 +579,9 @@ static void parse_args(int argc, char *argv[])
         case 'l':
             lookup_range = pow2ceil(atol(optarg));
             break;
+        case 'L':
+            measure_latency = true;
+            break;
         case 'n':
             n_rw_threads = atoi(optarg);
             break;
@@ -0,0 +1,70 @@
+/*
+ * QEMU timer list speed benchmark
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/timer.h"
+
+static void timer_cb(void *opaque)
+{
+    unsigned *fired = opaque;
+
+    (*fired)++;
+}
+
+/* Re-arm random timers among @n pending ones, like per-request timeouts do */
+static void test_mod(const void *opaque)
+{
+    size_t n = (uintptr_t)opaque;
+    QEMUTimerListGroup tlg;
+    QEMUTimer *timers = g_new(QEMUTimer, n);
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    GRand *rand = g_rand_new_with_seed(1);
+    unsigned fired = 0;
+    double ops = 0;
+
+    timerlistgroup_init(&tlg, NULL, NULL);
+    for (size_t i = 0; i < n; i++) {
+        timer_init_full(&timers[i], &tlg, QEMU_CLOCK_REALTIME, SCALE_NS, 0,
+                        timer_cb, &fired);
+        timer_mod_ns(&timers[i], now + NANOSECONDS_PER_SECOND * 3600 +
+                     g_rand_int_range(rand, 0, 1000000));
+    }
+
+    g_test_timer_start();
+    do {
+        for (int i = 0; i < 1000; i++) {
+            QEMUTimer *ts = &timers[g_rand_int_range(rand, 0, n)];
+
+            timer_mod_ns(ts, now + NANOSECONDS_PER_SECOND * 3600 +
+                         g_rand_int_range(rand, 0, 1000000));
+        }
+        ops += 1000;
+    } while (g_test_timer_elapsed() < 0.5);
+
+    g_test_message("timer_mod_ns, %6zu timers: %8.2f Mops/sec", n,
+                   ops / g_test_timer_last() / 1e6);
+
+    for (size_t i = 0; i < n; i++) {
+        timer_del(&timers[i]);
+    }
+    g_assert_cmpuint(fired, ==, 0);
+    timerlistgroup_deinit(&tlg);
+    g_rand_free(rand);
+    g_free(timers);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    qemu_init_clocks(NULL);
+    for (size_t n = 10; n <= 100000; n *= 10) {
+        g_autofree char *path = g_strdup_printf("/timer/mod/%zu", n);
+
+        g_test_add_data_func(path, (void *)(uintptr_t)n, test_mod);
+    }
+    return g_test_run();
+}
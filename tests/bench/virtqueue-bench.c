@@ -0,0 +1,402 @@
+/*
+ * Virtqueue benchmark
+ *
+ * Measures the device side of split and packed virtqueues without booting
+ * a guest.  The benchmark plays the driver through qtest: it places
+ * batches of descriptor chains in the transmit queue of a virtio-net
+ * device that has no peer, so the device pops each chain, drops the packet
+ * and fills, flushes and notifies right away.  The time from the kick to
+ * the last used element is reported per element, for every combination of
+ * the given chain lengths and batch sizes.
+ *
+ * The time of the qtest round trips needed to kick the queue and to see
+ * the used elements is measured at startup and subtracted, so the numbers
+ * are approximate for small batches.
+ *
+ * Run it with QTEST_QEMU_BINARY pointing to an x86 system emulator.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "qemu/cutils.h"
+#include "qemu/timer.h"
+#include "libqtest.h"
+#include "libqos/malloc-pc.h"
+#include "libqos/pci-pc.h"
+#include "libqos/virtio-pci.h"
+#include "standard-headers/linux/virtio_config.h"
+#include "standard-headers/linux/virtio_ring.h"
+
+/* Bytes sent per chain, split evenly among its descriptors */
+#define BENCH_PACKET_SIZE   128
+#define BENCH_MAX_CHAIN     16
+#define BENCH_WARMUP_ROUNDS 16
+#define BENCH_TIMEOUT_NS    (10 * NANOSECONDS_PER_SECOND)
+#define BENCH_RTT_SAMPLES   1000
+
+/* The transmit queue of the first queue pair */
+#define BENCH_QUEUE_INDEX   1
+
+typedef struct BenchQueue {
+    QTestState *qts;
+    QGuestAllocator alloc;
+    QPCIBus *pcibus;
+    QVirtioPCIDevice *dev;
+    QVirtQueue *vq;
+    bool packed;
+    uint64_t buf;
+    /* Split: avail index.  Packed: ring position of the next descriptor */
+    uint16_t avail_idx;
+    bool avail_wrap;
+    /* Duration of a qtest round trip */
+    int64_t rtt;
+} BenchQueue;
+
+static GArray *chain_lengths;
+static GArray *batch_sizes;
+static unsigned int rounds = 1000;
+static bool run_split = true;
+static bool run_packed = true;
+
+static const char commands_string[] =
+    " -c = comma-separated list of chain lengths (at most 16)\n"
+    " -b = comma-separated list of batch sizes\n"
+    " -r = number of measured rounds per combination\n"
+    " -l = ring layout: split or packed (default: both)";
+
+static void usage_complete(int argc, char *argv[])
+{
+    fprintf(stderr, "Usage: %s [options]\n", argv[0]);
+    fprintf(stderr, "options:\n%s\n", commands_string);
+    exit(-1);
+}
+
+static void bench_kick(BenchQueue *q)
+{
+    QVirtioDevice *vdev = &q->dev->vdev;
+
+    vdev->bus->virtqueue_kick(vdev, q->vq);
+}
+
+static void bench_check_timeout(int64_t start)
+{
+    if (get_clock() - start > BENCH_TIMEOUT_NS) {
+        fprintf(stderr, "Timed out waiting for used elements\n");
+        exit(1);
+    }
+}
+
+static void split_write_table(BenchQueue *q, unsigned int chain,
+                              unsigned int batch)
+{
+    g_autofree struct vring_desc *desc = g_new(struct vring_desc,
+                                               chain * batch);
+    unsigned int seg = BENCH_PACKET_SIZE / chain;
+    unsigned int i;
+
+    for (i = 0; i < chain * batch; i++) {
+        unsigned int k = i % chain;
+
+        desc[i].addr = cpu_to_le64(q->buf + k * seg);
+        desc[i].len = cpu_to_le32(seg);
+        desc[i].flags = cpu_to_le16(k < chain - 1 ? VRING_DESC_F_NEXT : 0);
+        desc[i].next = cpu_to_le16(i + 1);
+    }
+    qtest_memwrite(q->qts, q->vq->desc, desc, chain * batch * sizeof(*desc));
+}
+
+static int64_t split_round(BenchQueue *q, unsigned int chain,
+                           unsigned int batch)
+{
+    g_autofree uint16_t *ring = g_new(uint16_t, batch);
+    uint32_t size = q->vq->size;
+    uint16_t pos = q->avail_idx % size;
+    unsigned int first = MIN(batch, size - pos);
+    unsigned int j;
+    int64_t start;
+
+    for (j = 0; j < batch; j++) {
+        ring[j] = cpu_to_le16(j * chain);
+    }
+    qtest_memwrite(q->qts, q->vq->avail + 4 + pos * 2, ring, first * 2);
+    if (first < batch) {
+        qtest_memwrite(q->qts, q->vq->avail + 4, ring + first,
+                       (batch - first) * 2);
+    }
+    q->avail_idx += batch;
+    qtest_writew(q->qts, q->vq->avail + 2, q->avail_idx);
+
+    start = get_clock();
+    bench_kick(q);
+    while (qtest_readw(q->qts, q->vq->used + 2) != q->avail_idx) {
+        bench_check_timeout(start);
+    }
+    return get_clock() - start - 2 * q->rtt;
+}
+
+static bool packed_is_used(BenchQueue *q, uint16_t pos, bool wrap)
+{
+    uint16_t flags = qtest_readw(q->qts, q->vq->desc + pos * 16 + 14);
+    bool avail = flags & (1 << VRING_PACKED_DESC_F_AVAIL);
+    bool used = flags & (1 << VRING_PACKED_DESC_F_USED);
+
+    return avail == wrap && used == wrap;
+}
+
+static int64_t packed_round(BenchQueue *q, unsigned int chain,
+                            unsigned int batch)
+{
+    unsigned int n = chain * batch;
+    g_autofree struct vring_packed_desc *desc =
+        g_new(struct vring_packed_desc, n);
+    unsigned int seg = BENCH_PACKET_SIZE / chain;
+    uint32_t size = q->vq->size;
+    uint16_t pos = q->avail_idx;
+    bool wrap = q->avail_wrap;
+    uint16_t head_pos[2];
+    bool head_wrap[2];
+    unsigned int i, first;
+    int64_t start;
+
+    for (i = 0; i < n; i++) {
+        unsigned int j = i / chain;
+        unsigned int k = i % chain;
+        uint16_t flags = wrap ? 1 << VRING_PACKED_DESC_F_AVAIL
+                              : 1 << VRING_PACKED_DESC_F_USED;
+
+        if (k < chain - 1) {
+            flags |= VRING_DESC_F_NEXT;
+        }
+        desc[i].addr = cpu_to_le64(q->buf + k * seg);
+        desc[i].len = cpu_to_le32(seg);
+        desc[i].id = cpu_to_le16(j);
+        desc[i].flags = cpu_to_le16(flags);
+
+        /* The used elements are written where the chains start */
+        if (k == 0 && j == 0) {
+            head_pos[0] = pos;
+            head_wrap[0] = wrap;
+        }
+        if (k == 0 && j == batch - 1) {
+            head_pos[1] = pos;
+            head_wrap[1] = wrap;
+        }
+        if (++pos == size) {
+            pos = 0;
+            wrap = !wrap;
+        }
+    }
+
+    first = MIN(n, size - q->avail_idx);
+    qtest_memwrite(q->qts, q->vq->desc + q->avail_idx * sizeof(*desc),
+                   desc, first * sizeof(*desc));
+    if (first < n) {
+        qtest_memwrite(q->qts, q->vq->desc, desc + first,
+                       (n - first) * sizeof(*desc));
+    }
+    q->avail_idx = pos;
+    q->avail_wrap = wrap;
+
+    /*
+     * The device writes the flags of the first element of a flush last, so
+     * once both the first and the last chain are used, all of them are.
+     */
+    start = get_clock();
+    bench_kick(q);
+    for (i = 0; i < 2; i++) {
+        while (!packed_is_used(q, head_pos[i], head_wrap[i])) {
+            bench_check_timeout(start);
+        }
+    }
+    return get_clock() - start - 3 * q->rtt;
+}
+
+static int64_t bench_round(BenchQueue *q, unsigned int chain,
+                           unsigned int batch)
+{
+    return q->packed ? packed_round(q, chain, batch)
+                     : split_round(q, chain, batch);
+}
+
+static BenchQueue *bench_start(bool packed)
+{
+    BenchQueue *q = g_new0(BenchQueue, 1);
+    QVirtioDevice *vdev;
+    QPCIAddress addr = { .devfn = QPCI_DEVFN(4, 0) };
+    uint64_t features;
+    int64_t start;
+    int i;
+
+    q->packed = packed;
+    q->qts = qtest_initf("-M pc -nodefaults "
+                         "-device virtio-net-pci,addr=04.0,"
+                         "disable-legacy=on,packed=%s",
+                         packed ? "on" : "off");
+    pc_alloc_init(&q->alloc, q->qts, 0);
+    q->pcibus = qpci_new_pc(q->qts, &q->alloc);
+    q->dev = virtio_pci_new(q->pcibus, &addr);
+    g_assert_nonnull(q->dev);
+    qvirtio_pci_device_enable(q->dev);
+
+    vdev = &q->dev->vdev;
+    qvirtio_start_device(vdev);
+    features = qvirtio_get_features(vdev) &
+               ((1ull << VIRTIO_F_VERSION_1) |
+                (1ull << VIRTIO_F_RING_PACKED));
+    g_assert(!!(features & (1ull << VIRTIO_F_RING_PACKED)) == packed);
+    qvirtio_set_features(vdev, features);
+
+    q->vq = vdev->bus->virtqueue_setup(vdev, &q->alloc, BENCH_QUEUE_INDEX);
+    if (packed) {
+        /* The split layout left by the setup is not a valid packed ring */
+        qtest_memset(q->qts, q->vq->desc, 0,
+                     qvring_size(q->vq->size, VIRTIO_PCI_VRING_ALIGN));
+        q->avail_wrap = true;
+    }
+    q->buf = guest_alloc(&q->alloc, BENCH_PACKET_SIZE);
+    qtest_memset(q->qts, q->buf, 0, BENCH_PACKET_SIZE);
+
+    qvirtio_set_driver_ok(vdev);
+
+    start = get_clock();
+    for (i = 0; i < BENCH_RTT_SAMPLES; i++) {
+        qtest_readw(q->qts, q->vq->desc);
+    }
+    q->rtt = (get_clock() - start) / BENCH_RTT_SAMPLES;
+    return q;
+}
+
+static void bench_stop(BenchQueue *q)
+{
+    QVirtioDevice *vdev = &q->dev->vdev;
+
+    vdev->bus->virtqueue_cleanup(q->vq, &q->alloc);
+    qos_object_destroy(&q->dev->obj);
+    qpci_free_pc(q->pcibus);
+    alloc_destroy(&q->alloc);
+    qtest_quit(q->qts);
+    g_free(q);
+}
+
+static void bench_run(bool packed)
+{
+    BenchQueue *q = bench_start(packed);
+    unsigned int i, j, r;
+
+    for (i = 0; i < chain_lengths->len; i++) {
+        unsigned int chain = g_array_index(chain_lengths, unsigned int, i);
+
+        for (j = 0; j < batch_sizes->len; j++) {
+            unsigned int batch = g_array_index(batch_sizes, unsigned int, j);
+            int64_t ns = 0;
+
+            if (chain * batch > q->vq->size) {
+                printf("%-6s %5u %5u %12s\n", packed ? "packed" : "split",
+                       chain, batch, "too large");
+                continue;
+            }
+            if (!packed) {
+                split_write_table(q, chain, batch);
+            }
+            for (r = 0; r < BENCH_WARMUP_ROUNDS; r++) {
+                bench_round(q, chain, batch);
+            }
+            for (r = 0; r < rounds; r++) {
+                ns += MAX(bench_round(q, chain, batch), 0);
+            }
+            printf("%-6s %5u %5u %12.1f\n", packed ? "packed" : "split",
+                   chain, batch, (double)ns / rounds / batch);
+        }
+    }
+
+    bench_stop(q);
+}
+
+static GArray *parse_list(const char *arg, char opt, unsigned int max)
+{
+    g_auto(GStrv) items = g_strsplit(arg, ",", -1);
+    GArray *list = g_array_new(false, false, sizeof(unsigned int));
+    char **p;
+
+    for (p = items; *p; p++) {
+        unsigned int val;
+
+        if (qemu_strtoui(*p, NULL, 10, &val) < 0 || !val || val > max) {
+            fprintf(stderr, "Invalid value '%s' for -%c\n", *p, opt);
+            exit(1);
+        }
+        g_array_append_val(list, val);
+    }
+    return list;
+}
+
+static void parse_args(int argc, char *argv[])
+{
+    int c;
+
+    for (;;) {
+        c = getopt(argc, argv, "b:c:hl:r:");
+        if (c < 0) {
+            break;
+        }
+        switch (c) {
+        case 'b':
+            batch_sizes = parse_list(optarg, c, UINT16_MAX);
+            break;
+        case 'c':
+            chain_lengths = parse_list(optarg, c, BENCH_MAX_CHAIN);
+            break;
+        case 'h':
+            usage_complete(argc, argv);
+            exit(0);
+        case 'l':
+            run_split = !strcmp(optarg, "split");
+            run_packed = !strcmp(optarg, "packed");
+            if (!run_split && !run_packed) {
+                usage_complete(argc, argv);
+            }
+            break;
+        case 'r':
+            rounds = atoi(optarg);
+            break;
+        default:
+            usage_complete(argc, argv);
+        }
+    }
+    if (!chain_lengths) {
+        chain_lengths = parse_list("1,2,4", 'c', BENCH_MAX_CHAIN);
+    }
+    if (!batch_sizes) {
+        batch_sizes = parse_list("1,8,32,64", 'b', UINT16_MAX);
+    }
+    if (!rounds) {
+        usage_complete(argc, argv);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    const char *arch;
+
+    parse_args(argc, argv);
+
+    arch = qtest_get_arch();
+    if (strcmp(arch, "x86_64") && strcmp(arch, "i386")) {
+        fprintf(stderr, "An x86 QEMU binary is needed, not %s\n", arch);
+        return 1;
+    }
+
+    printf("layout chain batch  ns/element\n");
+    if (run_split) {
+        bench_run(false);
+    }
+    if (run_packed) {
+        bench_run(true);
+    }
+
+    g_array_free(chain_lengths, true);
+    g_array_free(batch_sizes, true);
+    return 0;
+}
@@ -0,0 +1,98 @@
+/*
+ * QEMU XBZRLE encode/decode speed benchmark
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/units.h"
+#include "../migration/xbzrle.h"
+
+#define XBZRLE_PAGE_SIZE 4096
+
+/*
+ * Dirty @percent of the page, in runs of @run bytes spread evenly over
+ * it, as a guest writing to a few fields of its data structures would.
+ */
+static void make_page(uint8_t *old_buf, uint8_t *new_buf, int percent, int run)
+{
+    int runs = XBZRLE_PAGE_SIZE * percent / 100 / run;
+    int i, j;
+
+    for (i = 0; i < XBZRLE_PAGE_SIZE; i++) {
+        old_buf[i] = new_buf[i] = i * 7;
+    }
+    for (i = 0; i < runs; i++) {
+        int start = i * (XBZRLE_PAGE_SIZE / runs);
+
+        for (j = start; j < start + run; j++) {
+            new_buf[j] = ~old_buf[j];
+        }
+    }
+}
+
+static void test(const void *opaque)
+{
+    static const int percents[] = { 0, 1, 10, 50 };
+    uint8_t *old_buf = g_malloc(XBZRLE_PAGE_SIZE);
+    uint8_t *new_buf = g_malloc(XBZRLE_PAGE_SIZE);
+    uint8_t *dec_buf = g_malloc(XBZRLE_PAGE_SIZE);
+    uint8_t *compressed = g_malloc(XBZRLE_PAGE_SIZE);
+    int accel_index = 0;
+
+    do {
+        if (accel_index != 0) {
+            g_test_message("%s", "");  /* gnu_printf Werror for simple "" */
+        }
+        for (int k = 0; k < ARRAY_SIZE(percents); k++) {
+            double total = 0.0;
+            int dlen;
+
+            make_page(old_buf, new_buf, percents[k], 8);
+
+            g_test_timer_start();
+            do {
+                dlen = xbzrle_encode_buffer(old_buf, new_buf, XBZRLE_PAGE_SIZE,
+                                            compressed, XBZRLE_PAGE_SIZE);
+                total += XBZRLE_PAGE_SIZE;
+            } while (g_test_timer_elapsed() < 0.5);
+
+            total /= MiB;
+            g_test_message("xbzrle encode #%d: %2d%% dirty %8.0f MB/sec",
+                           accel_index, percents[k],
+                           total / g_test_timer_last());
+
+            /* decode does not depend on the accel, only measure it once */
+            if (accel_index != 0 || dlen <= 0) {
+                continue;
+            }
+            total = 0.0;
+            g_test_timer_start();
+            do {
+                memcpy(dec_buf, old_buf, XBZRLE_PAGE_SIZE);
+                xbzrle_decode_buffer(compressed, dlen, dec_buf,
+                                     XBZRLE_PAGE_SIZE);
+                total += XBZRLE_PAGE_SIZE;
+            } while (g_test_timer_elapsed() < 0.5);
+            g_assert(memcmp(dec_buf, new_buf, XBZRLE_PAGE_SIZE) == 0);
+
+            total /= MiB;
+            g_test_message("xbzrle decode: %2d%% dirty %8.0f MB/sec",
+                           percents[k], total / g_test_timer_last());
+        }
+        accel_index++;
+    } while (test_xbzrle_encode_next_accel());
+
+    g_free(old_buf);
+    g_free(new_buf);
+    g_free(dec_buf);
+    g_free(compressed);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_data_func("/migration/xbzrle/speed", NULL, test);
+    return g_test_run();
+}
@@ -0,0 +1,22 @@
+#!/usr/bin/env python3
+#
+# Migration performance regression suite invocation
+#
+# Runs a fixed matrix of guest sizes, dirty rates and migration features,
+# and compares the results with those of a baseline build:
+#
+#   guestperf-regression.py --binary OLD-QEMU --output base
+#   guestperf-regression.py --binary NEW-QEMU --output new --baseline base
+#
+# The second command exits with status 1 if a metric of any case got worse
+# by more than its threshold.
+#
+# SPDX-License-Identifier: LGPL-2.1-or-later
+#
+
+import sys
+
+from guestperf.shell import RegressionShell
+
+shell = RegressionShell()
+sys.exit(shell.run(sys.argv[1:]))
@@ -237,6 +237,10 @@ def _migrate(self, hardware, scenario, src,
 
         if defer_migrate:
             resp = dst.cmd("migrate-incoming", uri=connect_uri)
+
+        # Bracket the migration with samples, for the CPU time it costs
+        src_qemu_time.append(self._cpu_timing(src_pid))
+        src_vcpu_time.extend(self._vcpu_timing(src_pid, src_threads))
         resp = src.cmd("migrate", uri=connect_uri)
 
         post_copy = False
@@ -261,6 +265,8 @@ def _migrate(self, hardware, scenario, src,
                 progress_history.append(progress)
 
             if progress._status in ("completed", "failed", "cancelled"):
+                src_qemu_time.append(self._cpu_timing(src_pid))
+                src_vcpu_time.extend(self._vcpu_timing(src_pid, src_threads))
                 if progress._status == "completed" and paused:
                     dst.cmd("cont")
                 if progress_history[-1] != progress:
@@ -357,6 +363,8 @@ def _get_common_args(self, hardware, tunnelled=False):
             args.append("quiet")
 
         args.append("ramsize=%s" % hardware._mem)
+        if hardware._dirty_rate:
+            args.append("dirtyrate=%s" % hardware._dirty_rate)
 
         cmdline = " ".join(args)
         if tunnelled:
@@ -24,7 +24,7 @@ def __init__(self, cpus=1, mem=1,
                  dst_cpu_bind=None, dst_mem_bind=None,
                  prealloc_pages = False,
                  huge_pages=False, locked_pages=False,
-                 dirty_ring_size=0):
+                 dirty_ring_size=0, dirty_rate=0):
         self._cpus = cpus
         self._mem = mem # GiB
         self._src_mem_bind = src_mem_bind # List of NUMA nodes
@@ -35,6 +35,7 @@ def __init__(self, cpus=1, mem=1,
         self._huge_pages = huge_pages
         self._locked_pages = locked_pages
         self._dirty_ring_size = dirty_ring_size
+        self._dirty_rate = dirty_rate # MiB per second, 0 for unlimited
 
 
     def serialize(self):
@@ -49,6 +50,7 @@ def serialize(self):
             "huge_pages": self._huge_pages,
             "locked_pages": self._locked_pages,
             "dirty_ring_size": self._dirty_ring_size,
+            "dirty_rate": self._dirty_rate,
         }
 
     @classmethod
@@ -63,4 +65,5 @@ def deserialize(cls, data):
             data["prealloc_pages"],
             data["huge_pages"],
             data["locked_pages"],
-            data["dirty_ring_size"])
+            data["dirty_ring_size"],
+            data.get("dirty_rate", 0))
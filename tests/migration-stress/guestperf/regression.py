@@ -0,0 +1,202 @@
+#
+# Migration test performance regression matrix
+#
+# SPDX-License-Identifier: LGPL-2.1-or-later
+#
+
+import copy
+import glob
+import json
+import os.path
+import statistics
+
+from guestperf.report import Report
+from guestperf.scenario import Scenario
+
+
+class RegressionCase(object):
+
+    def __init__(self, name, mem, dirty_rate, scenario):
+        self._name = name
+        self._mem = mem # GiB
+        self._dirty_rate = dirty_rate # MiB per second
+        self._scenario = scenario
+
+    def get_hardware(self, hardware):
+        hardware = copy.copy(hardware)
+        hardware._mem = self._mem
+        hardware._dirty_rate = self._dirty_rate
+        return hardware
+
+
+def _build_cases():
+    modes = [
+        ("precopy", {}),
+        ("postcopy", dict(post_copy=True, post_copy_iters=1)),
+        ("multifd-2", dict(multifd=True, multifd_channels=2)),
+        ("multifd-8", dict(multifd=True, multifd_channels=8)),
+        ("multifd-4-zlib", dict(multifd=True, multifd_channels=4,
+                                multifd_compression="zlib")),
+        ("multifd-4-zstd", dict(multifd=True, multifd_channels=4,
+                                multifd_compression="zstd")),
+        ("xbzrle", dict(compression_xbzrle=True)),
+    ]
+
+    cases = []
+    for mem in (1, 4):
+        for dirty_rate in (128, 1024):
+            for mode, params in modes:
+                name = "mem-%dg-dirty-%dm-%s" % (mem, dirty_rate, mode)
+                cases.append(RegressionCase(name, mem, dirty_rate,
+                                            Scenario(name, **params)))
+    return cases
+
+
+# Fixed matrix whose results are compared across builds; keep the names
+# stable, as they are used to match results with the baseline
+REGRESSION_CASES = _build_cases()
+
+
+# Metrics and the relative increase, in percent, that is flagged as a
+# regression by default.  For all of them lower is better.
+METRICS = [
+    ("total_time_ms", 10),
+    ("downtime_ms", 25),
+    ("transferred_bytes", 5),
+    ("src_cpu_ms_per_gib", 10),
+]
+
+
+def _cpu_at(records, when, after):
+    """Cumulative CPU time of each thread at the sample nearest to @when,
+    taken at or after it if @after, else at or before it"""
+    values = {}
+    for record in sorted(records, key=lambda r: r._timestamp,
+                         reverse=after):
+        if after and record._timestamp < when:
+            break
+        if not after and record._timestamp > when:
+            break
+        values[record._tid] = record._value
+    return values
+
+
+def _cpu_delta(records, start, end):
+    before = _cpu_at(records, start, False)
+    later = _cpu_at(records, end, True)
+    return sum(later[tid] - before[tid] for tid in later if tid in before)
+
+
+def report_metrics(report):
+    """Returns the metrics of a report, or None if the migration failed"""
+    if not report._result._success or not report._progress_history:
+        return None
+
+    progress = report._progress_history[-1]
+    end = progress._now
+    start = end - progress._duration / 1000.0
+
+    # The vCPUs keep running the workload during the migration, leave
+    # them out to get the cost of migrating
+    cpu_ms = (_cpu_delta(report._qemu_timings._records, start, end) -
+              _cpu_delta(report._vcpu_timings._records, start, end))
+    gib = progress._ram._transferred_bytes / (1024.0 * 1024 * 1024)
+
+    return {
+        "total_time_ms": progress._duration,
+        "downtime_ms": progress._downtime,
+        "transferred_bytes": progress._ram._transferred_bytes,
+        "src_cpu_ms_per_gib": cpu_ms / gib if gib else 0,
+    }
+
+
+def report_filename(dirname, case, run):
+    return os.path.join(dirname, "%s.%d.json" % (case._name, run))
+
+
+def load_metrics(dirname, case):
+    """Returns the median of each metric over the runs of @case found in
+    @dirname, None if any run failed, or {} if there are no runs"""
+    pattern = os.path.join(glob.escape(dirname),
+                           glob.escape(case._name) + ".*.json")
+    runs = []
+    for filename in sorted(glob.glob(pattern)):
+        metrics = report_metrics(Report.from_json_file(filename))
+        if metrics is None:
+            return None
+        runs.append(metrics)
+
+    if not runs:
+        return {}
+    return {name: statistics.median(run[name] for run in runs)
+            for name, _ in METRICS}
+
+
+class Regression(object):
+
+    def __init__(self, case, metric, baseline, current, threshold):
+        self._case = case
+        self._metric = metric
+        self._baseline = baseline
+        self._current = current
+        self._threshold = threshold
+
+    def __str__(self):
+        if self._current is None:
+            return "%s: migration failed" % self._case._name
+        return "%s: %s %.0f -> %.0f (threshold +%d%%)" % (
+            self._case._name, self._metric,
+            self._baseline, self._current, self._threshold)
+
+
+def compare(cases, baseline_dir, current_dir, thresholds, out):
+    """Prints the metrics of @current_dir next to those of @baseline_dir,
+    if any, to @out, and returns the list of regressions"""
+    regressions = []
+
+    print("%-40s %-20s %14s %14s %8s" % ("case", "metric", "baseline",
+                                          "current", "change"), file=out)
+    for case in cases:
+        baseline = {}
+        if baseline_dir is not None:
+            baseline = load_metrics(baseline_dir, case)
+        current = load_metrics(current_dir, case)
+        if current == {}:
+            continue
+        if current is None:
+            if baseline is not None:
+                regressions.append(Regression(case, None, None, None, 0))
+            print("%-40s failed" % case._name, file=out)
+            continue
+
+        for name, _ in METRICS:
+            threshold = thresholds[name]
+            if not baseline:
+                print("%-40s %-20s %14s %14.0f" % (case._name, name, "-",
+                                                   current[name]), file=out)
+                continue
+
+            flag = ""
+            change = 0.0
+            if baseline[name]:
+                change = 100.0 * (current[name] - baseline[name]) / \
+                    baseline[name]
+            if change > threshold:
+                flag = " REGRESSION"
+                regressions.append(Regression(case, name, baseline[name],
+                                              current[name], threshold))
+            print("%-40s %-20s %14.0f %14.0f %+7.1f%%%s" % (
+                case._name, name, baseline[name], current[name],
+                change, flag), file=out)
+
+    return regressions
+
+
+def save_metrics(cases, dirname):
+    metrics = {}
+    for case in cases:
+        case_metrics = load_metrics(dirname, case)
+        if case_metrics != {}:
+            metrics[case._name] = case_metrics
+    with open(os.path.join(dirname, "metrics.json"), "w") as fh:
+        print(json.dumps(metrics, indent=4), file=fh)
@@ -32,6 +32,8 @@
 from guestperf.comparison import COMPARISONS
 from guestperf.plot import Plot
 from guestperf.report import Report
+from guestperf.regression import (REGRESSION_CASES, METRICS, compare,
+                                  report_filename, save_metrics)
 
 
 class BaseShell(object):
@@ -63,6 +65,8 @@ def __init__(self):
         parser.add_argument("--locked-pages", dest="locked_pages", default=False)
         parser.add_argument("--dirty-ring-size", dest="dirty_ring_size",
                             default=0, type=int)
+        parser.add_argument("--dirty-rate", dest="dirty_rate",
+                            default=0, type=int)
 
         self._parser = parser
 
@@ -94,7 +98,8 @@ def split_map(value):
                         huge_pages=args.huge_pages,
                         prealloc_pages=args.prealloc_pages,
 
-                        dirty_ring_size=args.dirty_ring_size)
+                        dirty_ring_size=args.dirty_ring_size,
+                        dirty_rate=args.dirty_rate)
 
 
 class Shell(BaseShell):
@@ -248,6 +253,77 @@ def run(self, argv):
                 raise
 
 
+class RegressionShell(BaseShell):
+
+    def __init__(self):
+        super(RegressionShell, self).__init__()
+
+        parser = self._parser
+
+        parser.add_argument("--filter", dest="filter", default="*")
+        parser.add_argument("--output", dest="output", default=os.getcwd())
+        parser.add_argument("--repeat", dest="repeat", default=1, type=int)
+        parser.add_argument("--baseline", dest="baseline", default=None)
+        parser.add_argument("--compare-only", dest="compare_only",
+                            default=False, action="store_true")
+        parser.add_argument("--threshold", dest="thresholds", default=[],
+                            action="append", metavar="METRIC=PERCENT")
+
+    def get_thresholds(self, args):
+        thresholds = dict(METRICS)
+        for value in args.thresholds:
+            name, _, percent = value.partition("=")
+            if name not in thresholds or not percent.isdigit():
+                raise Exception("invalid threshold '%s', expected one of "
+                                "%s followed by =PERCENT" %
+                                (value, ", ".join(thresholds.keys())))
+            thresholds[name] = int(percent)
+        return thresholds
+
+    def run(self, argv):
+        args = self._parser.parse_args(argv)
+        logging.basicConfig(level=(logging.DEBUG if args.debug else
+                                   logging.INFO if args.verbose else
+                                   logging.WARN))
+
+        engine = self.get_engine(args)
+        hardware = self.get_hardware(args)
+
+        cases = [case for case in REGRESSION_CASES
+                 if fnmatch.fnmatch(case._name, args.filter)]
+
+        try:
+            thresholds = self.get_thresholds(args)
+            if not os.path.exists(args.output):
+                os.makedirs(args.output)
+
+            for case in [] if args.compare_only else cases:
+                for run in range(args.repeat):
+                    if args.verbose:
+                        print("Running %s (%d/%d)" % (case._name, run + 1,
+                                                      args.repeat))
+                    report = engine.run(case.get_hardware(hardware),
+                                        case._scenario)
+                    with open(report_filename(args.output, case, run),
+                              "w") as fh:
+                        print(report.to_json(), file=fh)
+
+            save_metrics(cases, args.output)
+            regressions = compare(cases, args.baseline, args.output,
+                                  thresholds, sys.stdout)
+        except Exception as e:
+            print("Error: %s" % str(e), file=sys.stderr)
+            if args.debug:
+                raise
+            return 1
+
+        if args.baseline is None:
+            return 0
+        for regression in regressions:
+            print("Regression: %s" % regression, file=sys.stderr)
+        return 1 if regressions else 0
+
+
 class PlotShell(object):
 
     def __init__(self):
@@ -29,6 +29,9 @@ const char *argv0;
 
 #define RAM_PAGE_SIZE 4096
 
+/* Maximum MB dirtied per second by each thread, 0 for no limit */
+static unsigned long long dirtyrateMB;
+
 #ifndef CONFIG_GETTID
 static int gettid(void)
 {
@@ -166,6 +169,7 @@ static void stressone(unsigned long long ramsizeMB)
     char *dataptr;
     size_t nMB = 0;
     unsigned long long before, after;
+    unsigned long long throttle_start, throttledMB = 0;
 
     /* We don't care about initial state, but we do want
      * to fault it all into RAM, otherwise the first iter
@@ -179,6 +183,7 @@ static void stressone(unsigned long long ramsizeMB)
     }
 
     before = now();
+    throttle_start = before;
 
     while (1) {
 
@@ -193,6 +198,17 @@ static void stressone(unsigned long long ramsizeMB)
                 }
             }
 
+            if (dirtyrateMB) {
+                unsigned long long due, cur;
+
+                throttledMB++;
+                due = throttle_start + throttledMB * 1000 / dirtyrateMB;
+                cur = now();
+                if (due > cur) {
+                    g_usleep((due - cur) * 1000);
+                }
+            }
+
             if (nMB == 1024) {
                 after = now();
                 fprintf(stderr, "%s (%05d): INFO: %06llums copied 1 GB in %05llums\n",
@@ -214,10 +230,13 @@ static void *stressthread(void *arg)
     return NULL;
 }
 
-static void stress(unsigned long long ramsizeGB, int ncpus)
+static void stress(unsigned long long ramsizeGB,
+                   unsigned long long dirtyrate, int ncpus)
 {
     size_t i;
     unsigned long long ramsizeMB = ramsizeGB * 1024 / ncpus;
+
+    dirtyrateMB = dirtyrate ? MAX(dirtyrate / ncpus, 1) : 0;
     ncpus--;
 
     for (i = 0; i < ncpus; i++) {
@@ -263,13 +282,15 @@ static int mount_all(void)
 int main(int argc, char **argv)
 {
     unsigned long long ramsizeGB = 1;
+    unsigned long long dirtyrate = 0;
     char *end;
     int ch;
     int opt_ind = 0;
-    const char *sopt = "hr:c:";
+    const char *sopt = "hr:d:c:";
     struct option lopt[] = {
         { "help", no_argument, NULL, 'h' },
         { "ramsize", required_argument, NULL, 'r' },
+        { "dirtyrate", required_argument, NULL, 'd' },
         { "cpus", required_argument, NULL, 'c' },
         { NULL, 0, NULL, 0 }
     };
@@ -290,6 +311,17 @@ int main(int argc, char **argv)
             }
             break;
 
+        case 'd':
+            errno = 0;
+            dirtyrate = g_ascii_strtoull(optarg, &end, 10);
+            if (errno != 0 || *end) {
+                fprintf(stderr,
+                        "%s (%05d): ERROR: Cannot parse dirty rate %s\n",
+                        argv0, gettid(), optarg);
+                exit_failure();
+            }
+            break;
+
         case 'c':
             errno = 0;
             ncpus = strtoll(optarg, &end, 10);
@@ -302,7 +334,8 @@ int main(int argc, char **argv)
 
         case '?':
         case 'h':
-            fprintf(stderr, "%s: [--help][--ramsize GB][--cpus N]\n", argv0);
+            fprintf(stderr, "%s: [--help][--ramsize GB][--dirtyrate MB/s]"
+                    "[--cpus N]\n", argv0);
             exit_failure();
         }
     }
@@ -314,6 +347,11 @@ int main(int argc, char **argv)
         ret = get_command_arg_ull("ramsize", &ramsizeGB);
         if (ret < 0)
             exit_failure();
+
+        ret = get_command_arg_ull("dirtyrate", &dirtyrate);
+        if (ret < 0) {
+            exit_failure();
+        }
     }
 
     if (ncpus == 0)
@@ -321,8 +359,12 @@ int main(int argc, char **argv)
 
     fprintf(stdout, "%s (%05d): INFO: RAM %llu GiB across %d CPUs\n",
             argv0, gettid(), ramsizeGB, ncpus);
+    if (dirtyrate) {
+        fprintf(stdout, "%s (%05d): INFO: dirtying at most %llu MB/s\n",
+                argv0, gettid(), dirtyrate);
+    }
 
-    stress(ramsizeGB, ncpus);
+    stress(ramsizeGB, dirtyrate, ncpus);
 
     exit_failure();
 }
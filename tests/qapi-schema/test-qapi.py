@@ -70,13 +70,14 @@ def visit_alternate_type(self, name, info, ifcond, features,
 
     def visit_command(self, name, info, ifcond, features,
                       arg_type, ret_type, gen, success_response, boxed,
-                      allow_oob, allow_preconfig, coroutine):
+                      allow_oob, allow_preconfig, coroutine, stream_output):
         print('command %s %s -> %s'
               % (name, arg_type and arg_type.name,
                  ret_type and ret_type.name))
-        print('    gen=%s success_response=%s boxed=%s oob=%s preconfig=%s%s'
+        print('    gen=%s success_response=%s boxed=%s oob=%s preconfig=%s%s%s'
               % (gen, success_response, boxed, allow_oob, allow_preconfig,
-                 " coroutine=True" if coroutine else ""))
+                 " coroutine=True" if coroutine else "",
+                 " stream_output=True" if stream_output else ""))
         self._print_if(ifcond)
         self._print_features(features)
 
@@ -164,6 +164,32 @@ static void test_multifd_tcp_zlib(char *name, MigrateCommon *args)
     test_precopy_common(args);
 }
 
+static void *
+migrate_hook_start_precopy_tcp_multifd_xbzrle(QTestState *from,
+                                              QTestState *to)
+{
+    migrate_set_parameter_int(from, "xbzrle-cache-size", 33554432);
+
+    return migrate_hook_start_precopy_tcp_multifd_common(from, to, "xbzrle");
+}
+
+static void test_multifd_tcp_xbzrle(char *name, MigrateCommon *args)
+{
+    args->listen_uri = "defer";
+    args->start_hook = migrate_hook_start_precopy_tcp_multifd_xbzrle;
+    args->iterations = 2;
+    /*
+     * Deltas are only sent for pages modified again after they were
+     * sent once, i.e. from the 2nd round on.
+     */
+    args->live = true;
+
+    args->start.caps[MIGRATION_CAPABILITY_MULTIFD] = true;
+    args->start.caps[MIGRATION_CAPABILITY_X_MULTIFD_PARTITIONED_SCAN] = true;
+
+    test_precopy_common(args);
+}
+
 static void migration_test_add_compression_smoke(MigrationTestEnv *env)
 {
     migration_test_add("/migration/multifd/tcp/plain/zlib",
@@ -204,6 +230,9 @@ void migration_test_add_compression(MigrationTestEnv *env)
                        test_multifd_tcp_uadk);
 #endif
 
+    migration_test_add("/migration/multifd/tcp/plain/xbzrle",
+                       test_multifd_tcp_xbzrle);
+
     if (g_test_slow()) {
         migration_test_add("/migration/precopy/unix/xbzrle",
                            test_precopy_unix_xbzrle);
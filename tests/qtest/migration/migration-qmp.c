@@ -366,6 +366,21 @@ void read_blocktime(QTestState *who)
     qobject_unref(rsp_return);
 }
 
+void read_downtime_profile(QTestState *from, QTestState *to)
+{
+    QDict *rsp_return;
+
+    rsp_return = migrate_query_not_failed(from);
+    g_assert(qdict_haskey(rsp_return, "device-save-times"));
+    g_assert(qdict_haskey(rsp_return, "downtime-checkpoints"));
+    qobject_unref(rsp_return);
+
+    rsp_return = migrate_query_not_failed(to);
+    g_assert(qdict_haskey(rsp_return, "device-load-times"));
+    g_assert(qdict_haskey(rsp_return, "downtime-checkpoints"));
+    qobject_unref(rsp_return);
+}
+
 /*
  * Wait for two changes in the migration pass count, but bail if we stop.
  */
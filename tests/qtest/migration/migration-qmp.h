@@ -31,6 +31,7 @@ gchar *migrate_query_status(QTestState *who);
 int64_t read_migrate_property_int(QTestState *who, const char *property);
 uint64_t get_migration_pass(QTestState *who);
 void read_blocktime(QTestState *who);
+void read_downtime_profile(QTestState *from, QTestState *to);
 void wait_for_migration_pass(QTestState *who, QTestMigrationState *src_state);
 void migrate_set_parameter_str(QTestState *who, const char *parameter,
                                const char *value);
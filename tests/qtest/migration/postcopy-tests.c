@@ -13,6 +13,7 @@
 #include "qemu/osdep.h"
 #include "libqtest.h"
 #include "migration/framework.h"
+#include "migration/migration-qmp.h"
 #include "migration/migration-util.h"
 #include "qobject/qlist.h"
 #include "qemu/module.h"
@@ -39,6 +40,39 @@ static void test_postcopy_preempt(char *name, MigrateCommon *args)
     test_postcopy_common(args);
 }
 
+static void *migrate_hook_start_postcopy_preempt_channels(QTestState *from,
+                                                          QTestState *to)
+{
+    migrate_set_parameter_int(from, "x-postcopy-preempt-channels", 4);
+    migrate_set_parameter_int(to, "x-postcopy-preempt-channels", 4);
+
+    return NULL;
+}
+
+static void test_postcopy_preempt_channels(char *name, MigrateCommon *args)
+{
+    args->start_hook = migrate_hook_start_postcopy_preempt_channels;
+    args->start.caps[MIGRATION_CAPABILITY_POSTCOPY_PREEMPT] = true;
+
+    test_postcopy_common(args);
+}
+
+static void test_postcopy_preempt_channels_recovery(char *name,
+                                                    MigrateCommon *args)
+{
+    args->start_hook = migrate_hook_start_postcopy_preempt_channels;
+    args->start.caps[MIGRATION_CAPABILITY_POSTCOPY_PREEMPT] = true;
+
+    test_postcopy_recovery_common(args);
+}
+
+static void test_postcopy_prefetch(char *name, MigrateCommon *args)
+{
+    args->start.caps[MIGRATION_CAPABILITY_X_POSTCOPY_PREFETCH] = true;
+
+    test_postcopy_common(args);
+}
+
 static void test_postcopy_recovery(char *name, MigrateCommon *args)
 {
     test_postcopy_recovery_common(args);
@@ -113,6 +147,12 @@ void migration_test_add_postcopy(MigrationTestEnv *env)
             "/migration/postcopy/recovery/double-failures/reconnect",
             test_postcopy_recovery_fail_reconnect);
 
+        migration_test_add("/migration/postcopy/preempt/channels/plain",
+                           test_postcopy_preempt_channels);
+        migration_test_add("/migration/postcopy/preempt/channels/recovery",
+                           test_postcopy_preempt_channels_recovery);
+        migration_test_add("/migration/postcopy/prefetch",
+                           test_postcopy_prefetch);
         migration_test_add("/migration/multifd+postcopy/plain",
                            test_multifd_postcopy);
         migration_test_add("/migration/multifd+postcopy/preempt/plain",
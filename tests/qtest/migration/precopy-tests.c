@@ -50,6 +50,25 @@ static void test_precopy_unix_plain(char *name, MigrateCommon *args)
     test_precopy_common(args);
 }
 
+static void migrate_hook_end_downtime_profile(QTestState *from,
+                                              QTestState *to,
+                                              void *opaque)
+{
+    read_downtime_profile(from, to);
+}
+
+static void test_precopy_unix_downtime_profile(char *name,
+                                               MigrateCommon *args)
+{
+    g_autofree char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
+
+    args->listen_uri = uri;
+    args->connect_uri = uri;
+    args->end_hook = migrate_hook_end_downtime_profile;
+
+    test_precopy_common(args);
+}
+
 static void test_precopy_unix_suspend_live(char *name, MigrateCommon *args)
 {
     g_autofree char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
@@ -207,6 +226,50 @@ static void test_precopy_tcp_plain(char *name, MigrateCommon *args)
     test_precopy_common(args);
 }
 
+static void test_precopy_tcp_defer_hot_pages(char *name, MigrateCommon *args)
+{
+    args->listen_uri = "tcp:127.0.0.1:0";
+    /* The guest must keep dirtying memory for pages to be found hot */
+    args->live = true;
+
+    args->start.caps[MIGRATION_CAPABILITY_X_DEFER_HOT_PAGES] = true;
+
+    test_precopy_common(args);
+}
+
+#ifndef _WIN32
+static void *migrate_hook_start_bandwidth_pool(QTestState *from,
+                                               QTestState *to)
+{
+    migrate_set_parameter_str(from, "x-bandwidth-pool", "bwpool");
+
+    return NULL;
+}
+
+static void migrate_hook_end_bandwidth_pool(QTestState *from,
+                                            QTestState *to,
+                                            void *opaque)
+{
+    g_autofree char *path = g_strdup_printf("%s/bwpool", tmpfs);
+
+    unlink(path);
+}
+
+static void test_precopy_tcp_bandwidth_pool(char *name, MigrateCommon *args)
+{
+    g_autofree char *opts = g_strdup_printf(
+        "-object x-migration-bandwidth-pool,id=bwpool,"
+        "mem-path=%s/bwpool,max-bandwidth=1G", tmpfs);
+
+    args->listen_uri = "tcp:127.0.0.1:0";
+    args->start.opts_source = opts;
+    args->start_hook = migrate_hook_start_bandwidth_pool;
+    args->end_hook = migrate_hook_end_bandwidth_pool;
+
+    test_precopy_common(args);
+}
+#endif
+
 static void test_precopy_tcp_switchover_ack(char *name, MigrateCommon *args)
 {
     args->listen_uri = "tcp:127.0.0.1:0";
@@ -520,6 +583,23 @@ static void test_multifd_tcp_no_zero_page(char *name, MigrateCommon *args)
     test_precopy_common(args);
 }
 
+static void test_multifd_tcp_partitioned_scan(char *name,
+                                              MigrateCommon *args)
+{
+    args->listen_uri = "defer";
+    args->start_hook = migrate_hook_start_precopy_tcp_multifd;
+    /*
+     * The dirty bitmap is scanned from the multifd threads, and the
+     * guest keeps dirtying memory meanwhile.
+     */
+    args->live = true;
+
+    args->start.caps[MIGRATION_CAPABILITY_MULTIFD] = true;
+    args->start.caps[MIGRATION_CAPABILITY_X_MULTIFD_PARTITIONED_SCAN] = true;
+
+    test_precopy_common(args);
+}
+
 static void test_multifd_tcp_channels_none(char *name, MigrateCommon *args)
 {
     args->listen_uri = "defer";
@@ -1220,6 +1300,8 @@ static void migration_test_add_precopy_smoke(MigrationTestEnv *env)
 
     migration_test_add("/migration/precopy/unix/plain",
                        test_precopy_unix_plain);
+    migration_test_add("/migration/precopy/unix/downtime-profile",
+                       test_precopy_unix_downtime_profile);
 
     migration_test_add("/migration/precopy/tcp/plain", test_precopy_tcp_plain);
     migration_test_add("/migration/multifd/tcp/uri/plain/none",
@@ -1251,8 +1333,12 @@ void migration_test_add_precopy(MigrationTestEnv *env)
 
     migration_test_add("/migration/precopy/tcp/plain/switchover-ack",
                        test_precopy_tcp_switchover_ack);
+    migration_test_add("/migration/precopy/tcp/plain/defer-hot-pages",
+                       test_precopy_tcp_defer_hot_pages);
 
 #ifndef _WIN32
+    migration_test_add("/migration/precopy/tcp/plain/bandwidth-pool",
+                       test_precopy_tcp_bandwidth_pool);
     migration_test_add("/migration/precopy/fd/tcp",
                        test_precopy_fd_socket);
     migration_test_add("/migration/precopy/fd/file",
@@ -1277,6 +1363,8 @@ void migration_test_add_precopy(MigrationTestEnv *env)
                        test_multifd_tcp_zero_page_legacy);
     migration_test_add("/migration/multifd/tcp/plain/zero-page/none",
                        test_multifd_tcp_no_zero_page);
+    migration_test_add("/migration/multifd/tcp/plain/partitioned-scan",
+                       test_multifd_tcp_partitioned_scan);
     if (g_str_equal(env->arch, "x86_64")
         && env->has_kvm && env->has_dirty_ring) {
 
@@ -1748,6 +1748,50 @@ static void char_file_test(void)
     char_file_test_internal(NULL, NULL);
 }
 
+static void char_file_write_buffer_test(void)
+{
+    g_autofree char *tmp_path = g_dir_make_tmp("qemu-test-char.XXXXXX",
+                                               NULL);
+    g_autofree char *out = g_build_filename(tmp_path, "out", NULL);
+    g_autofree char *contents = NULL;
+    ChardevFile file = {
+        .out = out,
+        .has_write_buffer = true,
+        .write_buffer = 16,
+        .has_write_buffer_interval = true,
+        .write_buffer_interval = 60000,
+    };
+    ChardevBackend backend = { .type = CHARDEV_BACKEND_KIND_FILE,
+                               .u.file.data = &file };
+    const char *text = "hello!\nthis does not fit into the buffer\n";
+    Chardev *chr;
+    gsize length;
+    int i, ret;
+
+    chr = qemu_chardev_new("label-file-wbuf", TYPE_CHARDEV_FILE, &backend,
+                           NULL, &error_abort);
+    g_assert_nonnull(chr->wbuf);
+
+    /* One byte at a time, like a serial port */
+    for (i = 0; i < 7; i++) {
+        ret = qemu_chr_write(chr, (uint8_t *)text + i, 1, false);
+        g_assert_cmpint(ret, ==, 1);
+    }
+    ret = qemu_chr_write_all(chr, (uint8_t *)text + 7, strlen(text) - 7);
+    g_assert_cmpint(ret, ==, strlen(text) - 7);
+
+    /* Everything is written out when the chardev goes away */
+    object_unparent(OBJECT(chr));
+
+    ret = g_file_get_contents(out, &contents, &length, NULL);
+    g_assert(ret == TRUE);
+    g_assert_cmpint(length, ==, strlen(text));
+    g_assert(strncmp(contents, text, length) == 0);
+
+    g_unlink(out);
+    g_rmdir(tmp_path);
+}
+
 static void char_null_test(void)
 {
     Error *err = NULL;
@@ -1914,6 +1958,7 @@ int main(int argc, char **argv)
     g_test_add_func("/char/pipe", char_pipe_test);
 #endif
     g_test_add_func("/char/file", char_file_test);
+    g_test_add_func("/char/file-write-buffer", char_file_write_buffer_test);
 #ifndef _WIN32
     g_test_add_func("/char/file-fifo", char_file_fifo_test);
 #endif
@@ -810,6 +810,57 @@ static void test_cipher_short_plaintext(void)
     qcrypto_cipher_free(cipher);
 }
 
+static void test_cipher_sectors(const void *opaque)
+{
+    QCryptoCipherMode mode = GPOINTER_TO_INT(opaque);
+    QCryptoCipher *cipher;
+    uint8_t key[32];
+    uint8_t ivs[8 * 16];
+    uint8_t plaintext[8 * 512];
+    uint8_t expected[8 * 512];
+    uint8_t ciphertext[8 * 512];
+    size_t i;
+
+    for (i = 0; i < sizeof(key); i++) {
+        key[i] = i;
+    }
+    for (i = 0; i < sizeof(ivs); i++) {
+        ivs[i] = i * 7;
+    }
+    for (i = 0; i < sizeof(plaintext); i++) {
+        plaintext[i] = i * 13;
+    }
+
+    /* XTS takes two keys */
+    cipher = qcrypto_cipher_new(
+        QCRYPTO_CIPHER_ALGO_AES_128, mode,
+        key, mode == QCRYPTO_CIPHER_MODE_XTS ? 32 : 16, &error_abort);
+    g_assert(cipher != NULL);
+
+    /* The result must match a setiv + encrypt for each sector */
+    for (i = 0; i < 8; i++) {
+        g_assert(qcrypto_cipher_setiv(cipher, ivs + i * 16, 16,
+                                      &error_abort) == 0);
+        g_assert(qcrypto_cipher_encrypt(cipher, plaintext + i * 512,
+                                        expected + i * 512, 512,
+                                        &error_abort) == 0);
+    }
+
+    g_assert(qcrypto_cipher_encrypt_sectors(cipher, ivs, 16, 512,
+                                            plaintext, ciphertext,
+                                            sizeof(plaintext),
+                                            &error_abort) == 0);
+    g_assert(memcmp(ciphertext, expected, sizeof(expected)) == 0);
+
+    g_assert(qcrypto_cipher_decrypt_sectors(cipher, ivs, 16, 512,
+                                            ciphertext, ciphertext,
+                                            sizeof(ciphertext),
+                                            &error_abort) == 0);
+    g_assert(memcmp(ciphertext, plaintext, sizeof(plaintext)) == 0);
+
+    qcrypto_cipher_free(cipher);
+}
+
 int main(int argc, char **argv)
 {
     size_t i;
@@ -839,5 +890,18 @@ int main(int argc, char **argv)
         g_printerr("# skip unsupported aes-256:cbc\n");
     }
 
+    if (qcrypto_cipher_supports(QCRYPTO_CIPHER_ALGO_AES_128,
+                                QCRYPTO_CIPHER_MODE_XTS)) {
+        g_test_add_data_func("/crypto/cipher/sectors/aes-xts-128",
+                             GINT_TO_POINTER(QCRYPTO_CIPHER_MODE_XTS),
+                             test_cipher_sectors);
+    }
+    if (qcrypto_cipher_supports(QCRYPTO_CIPHER_ALGO_AES_128,
+                                QCRYPTO_CIPHER_MODE_CBC)) {
+        g_test_add_data_func("/crypto/cipher/sectors/aes-cbc-128",
+                             GINT_TO_POINTER(QCRYPTO_CIPHER_MODE_CBC),
+                             test_cipher_sectors);
+    }
+
     return g_test_run();
 }
@@ -46,6 +46,7 @@
 #ifdef CONFIG_CRYPTO_SM3
 #define OUTPUT_SM3 "d4a97db105b477b84c4f20ec9c31a6c814e2705a0b83a5a89748d75f0ef456a1"
 #endif
+#define OUTPUT_XXH64 "b6935fb0fc6e6263"
 
 #define OUTPUT_MD5_B64 "Yo0gY3FWMDWrjvYvSSveyQ=="
 #define OUTPUT_SHA1_B64 "sudPJnWKOkIeUJzuBFJEt4dTzAI="
@@ -61,6 +62,7 @@
 #ifdef CONFIG_CRYPTO_SM3
 #define OUTPUT_SM3_B64 "1Kl9sQW0d7hMTyDsnDGmyBTicFoLg6Wol0jXXw70VqE="
 #endif
+#define OUTPUT_XXH64_B64 "tpNfsPxuYmM="
 
 static const char *expected_outputs[] = {
     [QCRYPTO_HASH_ALGO_MD5] = OUTPUT_MD5,
@@ -73,6 +75,7 @@ static const char *expected_outputs[] = {
 #ifdef CONFIG_CRYPTO_SM3
     [QCRYPTO_HASH_ALGO_SM3] = OUTPUT_SM3,
 #endif
+    [QCRYPTO_HASH_ALGO_XXH64] = OUTPUT_XXH64,
 };
 static const char *expected_outputs_b64[] = {
     [QCRYPTO_HASH_ALGO_MD5] = OUTPUT_MD5_B64,
@@ -85,6 +88,7 @@ static const char *expected_outputs_b64[] = {
 #ifdef CONFIG_CRYPTO_SM3
     [QCRYPTO_HASH_ALGO_SM3] = OUTPUT_SM3_B64,
 #endif
+    [QCRYPTO_HASH_ALGO_XXH64] = OUTPUT_XXH64_B64,
 };
 static const int expected_lens[] = {
     [QCRYPTO_HASH_ALGO_MD5] = 16,
@@ -97,6 +101,7 @@ static const int expected_lens[] = {
 #ifdef CONFIG_CRYPTO_SM3
     [QCRYPTO_HASH_ALGO_SM3] = 32,
 #endif
+    [QCRYPTO_HASH_ALGO_XXH64] = 8,
 };
 
 static const char hex[] = "0123456789abcdef";
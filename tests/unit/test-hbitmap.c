@@ -145,10 +145,14 @@ static void hbitmap_test_teardown(TestHBitmapData *data,
 /* Set a range in the HBitmap and in the shadow "simple" bitmap.
  * The two bitmaps are then tested against each other.
  */
-static void hbitmap_test_set(TestHBitmapData *data,
-                             uint64_t first, uint64_t count)
+static void hbitmap_test_set_bits(TestHBitmapData *data, bool atomic,
+                                  uint64_t first, uint64_t count)
 {
-    hbitmap_set(data->hb, first, count);
+    if (atomic) {
+        hbitmap_set_atomic(data->hb, first, count);
+    } else {
+        hbitmap_set(data->hb, first, count);
+    }
     while (count-- != 0) {
         size_t pos = first >> LOG_BITS_PER_LONG;
         int bit = first & (BITS_PER_LONG - 1);
@@ -162,6 +166,12 @@ static void hbitmap_test_set(TestHBitmapData *data,
     }
 }
 
+static void hbitmap_test_set(TestHBitmapData *data,
+                             uint64_t first, uint64_t count)
+{
+    hbitmap_test_set_bits(data, false, first, count);
+}
+
 /* Reset a range in the HBitmap and in the shadow "simple" bitmap.
  */
 static void hbitmap_test_reset(TestHBitmapData *data,
@@ -350,6 +360,21 @@ static void test_hbitmap_set_overlap(TestHBitmapData *data,
     hbitmap_test_set(data, L3 - 1, L2);
 }
 
+static void test_hbitmap_set_atomic(TestHBitmapData *data,
+                                    const void *unused)
+{
+    hbitmap_test_init(data, L3 * 2, 0);
+    hbitmap_test_set_bits(data, true, L1 - 1, L1 + 2);
+    hbitmap_test_set(data, L1 * 2 - 1, L1 * 2 + 2);
+    hbitmap_test_set_bits(data, true, 0, L1 * 3);
+    hbitmap_test_set_bits(data, true, L1 * 8 - 1, L2);
+    hbitmap_test_reset(data, L1 * 8, L1);
+    hbitmap_test_set_bits(data, true, L2 - L1 - 1, L1 * 8 + 2);
+    hbitmap_test_set_bits(data, true, L3 - 1, L2);
+    hbitmap_test_reset(data, 0, L3 * 2);
+    hbitmap_test_set_bits(data, true, L2, 1);
+}
+
 static void test_hbitmap_reset_empty(TestHBitmapData *data,
                                      const void *unused)
 {
@@ -1058,6 +1083,7 @@ int main(int argc, char **argv)
     hbitmap_test_add("/hbitmap/set/general", test_hbitmap_set);
     hbitmap_test_add("/hbitmap/set/twice", test_hbitmap_set_twice);
     hbitmap_test_add("/hbitmap/set/overlap", test_hbitmap_set_overlap);
+    hbitmap_test_add("/hbitmap/set/atomic", test_hbitmap_set_atomic);
     hbitmap_test_add("/hbitmap/reset/empty", test_hbitmap_reset_empty);
     hbitmap_test_add("/hbitmap/reset/general", test_hbitmap_reset);
     hbitmap_test_add("/hbitmap/reset/all", test_hbitmap_reset_all);
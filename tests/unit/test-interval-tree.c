@@ -193,6 +193,63 @@ static void test_find_many_range(void)
     }
 }
 
+static IntervalGapTreeNode gap_nodes[20];
+static IntervalGapTreeRoot gap_root;
+
+static void test_gap_find_free(void)
+{
+    uint64_t start;
+    int i;
+
+    /* An empty tree is all free */
+    g_assert(interval_gap_tree_find_free(&gap_root, 0, UINT64_MAX, UINT64_MAX,
+                                         &start));
+    g_assert_cmpuint(start, ==, 0);
+
+    /* Nodes of 10 locations with holes of i + 1 locations before them */
+    for (i = 0; i < ARRAY_SIZE(gap_nodes); ++i) {
+        gap_nodes[i].start = i ? gap_nodes[i - 1].last + i + 2 : 1;
+        gap_nodes[i].last = gap_nodes[i].start + 9;
+    }
+    /* Insert in a scrambled order */
+    for (i = 0; i < ARRAY_SIZE(gap_nodes); ++i) {
+        interval_gap_tree_insert(&gap_nodes[(i * 7) % ARRAY_SIZE(gap_nodes)],
+                                 &gap_root);
+    }
+
+    /* The lowest hole that fits is chosen */
+    for (i = 0; i < ARRAY_SIZE(gap_nodes); ++i) {
+        g_assert(interval_gap_tree_find_free(&gap_root, 0, UINT64_MAX, i,
+                                             &start));
+        g_assert_cmpuint(start, ==, gap_nodes[i].start - i - 1);
+    }
+
+    /* Holes are clamped to the requested range */
+    g_assert(interval_gap_tree_find_free(&gap_root, gap_nodes[5].start,
+                                         UINT64_MAX, 0, &start));
+    g_assert_cmpuint(start, ==, gap_nodes[6].start - 7);
+    g_assert(!interval_gap_tree_find_free(&gap_root, 0, gap_nodes[3].start,
+                                          5, &start));
+
+    /* Nothing fits between the nodes, only after the last one */
+    g_assert(interval_gap_tree_find_free(&gap_root, 0, UINT64_MAX, 100,
+                                         &start));
+    g_assert_cmpuint(start, ==, gap_nodes[ARRAY_SIZE(gap_nodes) - 1].last + 1);
+
+    /* Removing a node merges its hole with the next one */
+    interval_gap_tree_remove(&gap_nodes[10], &gap_root);
+    g_assert(interval_gap_tree_find_free(&gap_root, 0, UINT64_MAX, 25,
+                                         &start));
+    g_assert_cmpuint(start, ==, gap_nodes[9].last + 1);
+
+    for (i = 0; i < ARRAY_SIZE(gap_nodes); ++i) {
+        if (i != 10) {
+            interval_gap_tree_remove(&gap_nodes[i], &gap_root);
+        }
+    }
+    g_assert(gap_root.rb_node == NULL);
+}
+
 int main(int argc, char **argv)
 {
     g_test_init(&argc, &argv, NULL);
@@ -204,6 +261,7 @@ int main(int argc, char **argv)
     g_test_add_func("/interval-tree/find-one-range-many",
                     test_find_one_range_many);
     g_test_add_func("/interval-tree/find-many-range", test_find_many_range);
+    g_test_add_func("/interval-tree/gap-find-free", test_gap_find_free);
 
     return g_test_run();
 }
@@ -734,6 +734,40 @@ static void test_accounting(void)
                                 (64.0 / 13)));
 }
 
+static void test_account_batch(void)
+{
+    uint64_t size, units;
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+
+    throttle_config_init(&cfg);
+    cfg.buckets[THROTTLE_BPS_TOTAL].avg = 1000;
+    cfg.buckets[THROTTLE_OPS_WRITE].avg = 200;
+
+    throttle_init(&ts);
+    throttle_config(&ts, QEMU_CLOCK_VIRTUAL, &cfg);
+
+    /* 10 ms of I/O; writes are the only ones limited in operations */
+    throttle_get_allowance(&ts, THROTTLE_READ, 10 * SCALE_MS, &size, &units);
+    g_assert_cmpint(size, ==, 10);
+    g_assert_cmpint(units, ==, 0);
+    throttle_get_allowance(&ts, THROTTLE_WRITE, 10 * SCALE_MS, &size, &units);
+    g_assert_cmpint(size, ==, 10);
+    g_assert_cmpint(units, ==, 2);
+
+    /* the bps bucket holds 100 bytes before throttling */
+    g_assert(throttle_account_batch(&ts, now, THROTTLE_WRITE, 60, 2));
+    g_assert(double_cmp(ts.cfg.buckets[THROTTLE_BPS_TOTAL].level, 60));
+    g_assert(double_cmp(ts.cfg.buckets[THROTTLE_OPS_WRITE].level, 2));
+
+    /* a batch that would throttle is not accounted at all */
+    g_assert(!throttle_account_batch(&ts, now, THROTTLE_READ, 50, 1));
+    g_assert(double_cmp(ts.cfg.buckets[THROTTLE_BPS_TOTAL].level, 60));
+    g_assert(double_cmp(ts.cfg.buckets[THROTTLE_OPS_READ].level, 0));
+
+    g_assert(throttle_account_batch(&ts, now, THROTTLE_READ, 40, 1));
+    g_assert(double_cmp(ts.cfg.buckets[THROTTLE_BPS_TOTAL].level, 100));
+}
+
 static void test_groups(void)
 {
     ThrottleConfig cfg1, cfg2;
@@ -829,6 +863,7 @@ int main(int argc, char **argv)
                     test_iops_size_is_missing_limit);
     g_test_add_func("/throttle/config_functions",   test_config_functions);
     g_test_add_func("/throttle/accounting",         test_accounting);
+    g_test_add_func("/throttle/account_batch",      test_account_batch);
     g_test_add_func("/throttle/groups",             test_groups);
     return g_test_run();
 }
@@ -0,0 +1,111 @@
+/*
+ * Timed histogram computation tests
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "system/cpu-timers.h"
+#include "qemu/timed-histogram.h"
+
+/* This is the clock for QEMU_CLOCK_VIRTUAL */
+static int64_t my_clock_value;
+
+int64_t cpu_get_clock(void)
+{
+    return my_clock_value;
+}
+
+static void test_exact(void)
+{
+    TimedHistogram th;
+    int i;
+
+    timed_histogram_init(&th, QEMU_CLOCK_VIRTUAL, NANOSECONDS_PER_SECOND);
+
+    g_assert_cmpuint(timed_histogram_percentile(&th, 500), ==, 0);
+    g_assert_cmpuint(timed_histogram_percentile(&th, 999), ==, 0);
+
+    /* Small values are counted exactly */
+    for (i = 0; i < 10; i++) {
+        timed_histogram_account(&th, i);
+    }
+    g_assert_cmpuint(timed_histogram_percentile(&th, 0), ==, 0);
+    g_assert_cmpuint(timed_histogram_percentile(&th, 500), ==, 4);
+    g_assert_cmpuint(timed_histogram_percentile(&th, 900), ==, 8);
+    g_assert_cmpuint(timed_histogram_percentile(&th, 1000), ==, 9);
+}
+
+static void test_error_bound(void)
+{
+    TimedHistogram th;
+    uint64_t value, result;
+
+    timed_histogram_init(&th, QEMU_CLOCK_VIRTUAL, NANOSECONDS_PER_SECOND);
+
+    for (value = 17; value < (1ULL << 38); value = value * 3 + 1) {
+        timed_histogram_init(&th, QEMU_CLOCK_VIRTUAL, NANOSECONDS_PER_SECOND);
+        timed_histogram_account(&th, value);
+        result = timed_histogram_percentile(&th, 500);
+        g_assert_cmpuint(result, >=, value);
+        g_assert_cmpuint(result - value, <=, value / 16);
+    }
+
+    /* Huge values end up in the last bucket */
+    timed_histogram_account(&th, UINT64_MAX);
+    g_assert_cmpuint(timed_histogram_percentile(&th, 1000), ==,
+                     (1ULL << 40) - 1);
+}
+
+static void test_tail(void)
+{
+    TimedHistogram th;
+    int i;
+
+    timed_histogram_init(&th, QEMU_CLOCK_VIRTUAL, NANOSECONDS_PER_SECOND);
+
+    /* 99% fast requests and 1% slow ones */
+    for (i = 0; i < 990; i++) {
+        timed_histogram_account(&th, 10);
+    }
+    for (i = 0; i < 10; i++) {
+        timed_histogram_account(&th, 10000);
+    }
+    g_assert_cmpuint(timed_histogram_percentile(&th, 500), ==, 10);
+    g_assert_cmpuint(timed_histogram_percentile(&th, 990), ==, 10);
+    g_assert_cmpuint(timed_histogram_percentile(&th, 999), >=, 10000);
+}
+
+static void test_expiration(void)
+{
+    TimedHistogram th;
+    int i;
+
+    timed_histogram_init(&th, QEMU_CLOCK_VIRTUAL, NANOSECONDS_PER_SECOND);
+
+    for (i = 0; i < 100; i++) {
+        timed_histogram_account(&th, 5);
+        g_assert_cmpuint(timed_histogram_percentile(&th, 500), ==, 5);
+        my_clock_value += NANOSECONDS_PER_SECOND / 10;
+    }
+
+    my_clock_value += NANOSECONDS_PER_SECOND * 100;
+    g_assert_cmpuint(timed_histogram_percentile(&th, 500), ==, 0);
+
+    for (i = 0; i < 100; i++) {
+        timed_histogram_account(&th, 7);
+        g_assert_cmpuint(timed_histogram_percentile(&th, 500), ==, 7);
+        my_clock_value += NANOSECONDS_PER_SECOND / 10;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/timed-histogram/exact", test_exact);
+    g_test_add_func("/timed-histogram/error-bound", test_error_bound);
+    g_test_add_func("/timed-histogram/tail", test_tail);
+    g_test_add_func("/timed-histogram/expiration", test_expiration);
+    return g_test_run();
+}
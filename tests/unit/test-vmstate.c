@@ -1537,6 +1537,58 @@ static void test_tmp_struct(void)
     g_assert_cmpint(obj.f, ==, 8); /* From the child->parent */
 }
 
+static int post_load_async_sync_hook(void *opaque, int version_id)
+{
+    TestStruct *obj = opaque;
+
+    obj->b = 1;
+    return 0;
+}
+
+static bool post_load_async_hook(void *opaque, int version_id, Error **errp)
+{
+    TestStruct *obj = opaque;
+
+    /* Runs after post_load */
+    obj->b *= 2;
+    return true;
+}
+
+static const VMStateDescription vmstate_post_load_async = {
+    .name = "test/post_load_async",
+    .version_id = 1,
+    .post_load = post_load_async_sync_hook,
+    .post_load_async = post_load_async_hook,
+    .fields = (const VMStateField[]) {
+        VMSTATE_UINT32(a, TestStruct),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+/* Outside of an incoming migration the hook is called right away */
+static void test_post_load_async(void)
+{
+    TestStruct obj, obj_clone;
+
+    uint8_t const wire_post_load_async[] = {
+        /* u32 a */ 0x00, 0x00, 0x00, 0x03,
+        QEMU_VM_EOF, /* just to ensure we won't get EOF reported prematurely */
+    };
+
+    memset(&obj, 0, sizeof(obj));
+    obj.a = 3;
+    save_vmstate(&vmstate_post_load_async, &obj);
+
+    compare_vmstate(wire_post_load_async, sizeof(wire_post_load_async));
+
+    memset(&obj, 0, sizeof(obj));
+    SUCCESS(load_vmstate_one(&vmstate_post_load_async, &obj, 1,
+                             wire_post_load_async,
+                             sizeof(wire_post_load_async)));
+    g_assert_cmpint(obj.a, ==, 3);
+    g_assert_cmpint(obj.b, ==, 2);
+}
+
 int main(int argc, char **argv)
 {
     g_autofree char *temp_file = g_strdup_printf("%s/vmst.test.XXXXXX",
@@ -1577,6 +1629,7 @@ int main(int argc, char **argv)
     g_test_add_func("/vmstate/qlist/save/saveqlist", test_save_qlist);
     g_test_add_func("/vmstate/qlist/load/loadqlist", test_load_qlist);
     g_test_add_func("/vmstate/tmp_struct", test_tmp_struct);
+    g_test_add_func("/vmstate/post_load_async", test_post_load_async);
     g_test_run();
 
     close(temp_fd);
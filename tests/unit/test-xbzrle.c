@@ -173,6 +173,77 @@ static void test_encode_decode(void)
     }
 }
 
+#define ACCEL_PAGES 256
+
+static void fill_accel_page(GRand *rand, uint8_t *old_buf, uint8_t *new_buf)
+{
+    int runs = g_rand_int_range(rand, 0, 64);
+    int i, j;
+
+    for (i = 0; i < XBZRLE_PAGE_SIZE; i++) {
+        old_buf[i] = new_buf[i] = g_rand_int(rand);
+    }
+    for (i = 0; i < runs; i++) {
+        int start = g_rand_int_range(rand, 0, XBZRLE_PAGE_SIZE);
+        int len = g_rand_int_range(rand, 1, 300);
+
+        for (j = start; j < MIN(start + len, XBZRLE_PAGE_SIZE); j++) {
+            new_buf[j] = ~old_buf[j];
+        }
+    }
+}
+
+/*
+ * Check that all the accelerated versions of the encoder produce the
+ * same output as the most optimized one, which must decode back to the
+ * new page.  Lowers the accel to the generic version, so run it last.
+ */
+static void test_encode_accel(void)
+{
+    uint8_t *old_buf = g_malloc(XBZRLE_PAGE_SIZE);
+    uint8_t *new_buf = g_malloc(XBZRLE_PAGE_SIZE);
+    uint8_t *compressed = g_malloc(XBZRLE_PAGE_SIZE);
+    uint8_t *expected = g_malloc(ACCEL_PAGES * XBZRLE_PAGE_SIZE);
+    int expected_len[ACCEL_PAGES];
+    bool first = true;
+    int i, dlen;
+
+    do {
+        GRand *rand = g_rand_new_with_seed(0x585a524c);
+
+        for (i = 0; i < ACCEL_PAGES; i++) {
+            uint8_t *exp = expected + i * XBZRLE_PAGE_SIZE;
+
+            fill_accel_page(rand, old_buf, new_buf);
+            /* exercise the overflow path too */
+            dlen = (i % 8) ? XBZRLE_PAGE_SIZE : 64;
+            dlen = xbzrle_encode_buffer(old_buf, new_buf, XBZRLE_PAGE_SIZE,
+                                        compressed, dlen);
+            if (first) {
+                expected_len[i] = dlen;
+                if (dlen > 0) {
+                    memcpy(exp, compressed, dlen);
+                    g_assert(xbzrle_decode_buffer(compressed, dlen, old_buf,
+                                                  XBZRLE_PAGE_SIZE) >= 0);
+                    g_assert(memcmp(old_buf, new_buf, XBZRLE_PAGE_SIZE) == 0);
+                }
+            } else {
+                g_assert_cmpint(dlen, ==, expected_len[i]);
+                if (dlen > 0) {
+                    g_assert(memcmp(exp, compressed, dlen) == 0);
+                }
+            }
+        }
+        g_rand_free(rand);
+        first = false;
+    } while (test_xbzrle_encode_next_accel());
+
+    g_free(old_buf);
+    g_free(new_buf);
+    g_free(compressed);
+    g_free(expected);
+}
+
 int main(int argc, char **argv)
 {
     g_test_init(&argc, &argv, NULL);
@@ -185,6 +256,7 @@ int main(int argc, char **argv)
     g_test_add_func("/xbzrle/encode_decode_overflow",
                     test_encode_decode_overflow);
     g_test_add_func("/xbzrle/encode_decode", test_encode_decode);
+    g_test_add_func("/xbzrle/encode_accel", test_encode_accel);
 
     return g_test_run();
 }
@@ -17,6 +17,9 @@
 #ifdef CONFIG_TRACE_FTRACE
 #include "trace/ftrace.h"
 #endif
+#ifdef CONFIG_TRACE_RING
+#include "trace/ring.h"
+#endif
 #ifdef CONFIG_TRACE_LOG
 #include "qemu/log.h"
 #endif
@@ -277,6 +280,13 @@ bool trace_init_backends(void)
     }
 #endif
 
+#ifdef CONFIG_TRACE_RING
+    if (!trace_ring_init()) {
+        fprintf(stderr, "failed to initialize ring tracing backend.\n");
+        return false;
+    }
+#endif
+
 #ifdef CONFIG_TRACE_SYSLOG
     openlog(NULL, LOG_PID, LOG_DAEMON);
 #endif
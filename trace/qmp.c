@@ -11,6 +11,9 @@
 #include "qapi/error.h"
 #include "qapi/qapi-commands-trace.h"
 #include "control.h"
+#ifdef CONFIG_TRACE_RING
+#include "trace/ring.h"
+#endif
 
 
 static bool check_events(bool ignore_unavailable, bool is_pattern,
@@ -106,3 +109,10 @@ void qmp_trace_event_set_state(const char *name, bool enable,
         trace_event_set_state_dynamic(ev, enable);
     }
 }
+
+#ifdef CONFIG_TRACE_RING
+void qmp_trace_ring_dump(const char *file, Error **errp)
+{
+    trace_ring_dump(file, errp);
+}
+#endif
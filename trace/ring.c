@@ -0,0 +1,292 @@
+/*
+ * Ring buffer ("flight recorder") trace backend
+ *
+ * Every thread records events into a ring of its own, so recording takes
+ * no locks and never contends with other threads.  When the ring is full
+ * the oldest records are overwritten.  Nothing is written out until
+ * trace_ring_dump() is called, which makes the backend cheap enough to
+ * leave enabled and collect the most recent events after something went
+ * wrong.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "qemu/notify.h"
+#include "qemu/thread.h"
+#include "qemu/timer.h"
+#include "trace/control.h"
+#include "trace/ring.h"
+
+/* Number of records in the ring of each thread */
+#define TRACE_RING_RECORDS 1024
+
+/* The output matches trace/simple.c, so simpletrace.py can parse it */
+#define HEADER_EVENT_ID (~(uint64_t)0)
+#define HEADER_MAGIC 0xf2b177cb0aa429b4ULL
+#define HEADER_VERSION 4
+
+#define TRACE_RECORD_TYPE_MAPPING 0
+#define TRACE_RECORD_TYPE_EVENT   1
+
+typedef struct TraceRingRecord {
+    /* Index of the record plus one once complete, 0 while being written */
+    unsigned long seq;
+    int64_t ticks;
+    uint32_t event;
+    uint32_t tid;
+    uint16_t nargs;
+    uint16_t strings;
+    uint64_t args[TRACE_RING_MAX_ARGS];
+} TraceRingRecord;
+
+typedef struct TraceRing {
+    /* Number of records written so far, only modified by the owner */
+    unsigned long head;
+    /* Protected by ring_lock */
+    bool in_use;
+    uint32_t tid;
+    struct TraceRing *next;
+    TraceRingRecord records[TRACE_RING_RECORDS];
+} TraceRing;
+
+/*
+ * Rings are never freed.  When a thread exits its ring is handed to the
+ * next thread that starts tracing, so that the records of the exited
+ * thread remain available until they are overwritten.
+ */
+static GMutex ring_lock;
+static TraceRing *rings;
+
+static __thread TraceRing *ring;
+static __thread bool ring_exited;
+static __thread Notifier ring_exit_notifier;
+
+/* Reference point to convert host ticks to nanoseconds */
+static int64_t calib_ticks;
+static int64_t calib_ns;
+
+static void trace_ring_thread_exit(Notifier *n, void *unused)
+{
+    g_mutex_lock(&ring_lock);
+    ring->in_use = false;
+    g_mutex_unlock(&ring_lock);
+
+    ring = NULL;
+    ring_exited = true;
+}
+
+static TraceRing *trace_ring_get(void)
+{
+    TraceRing *r;
+
+    g_mutex_lock(&ring_lock);
+    for (r = rings; r; r = r->next) {
+        if (!r->in_use) {
+            break;
+        }
+    }
+    if (!r) {
+        /* don't use g_malloc, can deadlock when traced */
+        r = calloc(1, sizeof(*r));
+        if (!r) {
+            g_mutex_unlock(&ring_lock);
+            return NULL;
+        }
+        r->next = rings;
+        rings = r;
+    }
+    r->in_use = true;
+    r->tid = qemu_get_thread_id();
+    g_mutex_unlock(&ring_lock);
+
+    ring_exit_notifier.notify = trace_ring_thread_exit;
+    qemu_thread_atexit_add(&ring_exit_notifier);
+    return r;
+}
+
+void trace_ring_record(uint32_t event, const uint64_t *args,
+                       unsigned nargs, unsigned strings)
+{
+    TraceRing *r = ring;
+    TraceRingRecord *rec;
+    unsigned long head;
+
+    if (unlikely(!r)) {
+        /* Events traced by thread-exit notifiers running after ours */
+        if (ring_exited) {
+            return;
+        }
+        r = ring = trace_ring_get();
+        if (!r) {
+            return;
+        }
+    }
+
+    head = r->head;
+    rec = &r->records[head % TRACE_RING_RECORDS];
+    qatomic_set(&rec->seq, 0);
+    smp_wmb();
+    rec->ticks = cpu_get_host_ticks();
+    rec->event = event;
+    rec->tid = r->tid;
+    rec->nargs = nargs;
+    rec->strings = strings;
+    memcpy(rec->args, args, nargs * sizeof(uint64_t));
+    smp_wmb();
+    qatomic_set(&rec->seq, head + 1);
+    qatomic_set(&r->head, head + 1);
+}
+
+/* Copy the records of @r that are not being overwritten to @out */
+static void trace_ring_collect(TraceRing *r, GArray *out)
+{
+    unsigned long head = qatomic_read(&r->head);
+    unsigned long i = 0;
+
+    if (head > TRACE_RING_RECORDS) {
+        i = head - TRACE_RING_RECORDS;
+    }
+    for (; i != head; i++) {
+        TraceRingRecord *src = &r->records[i % TRACE_RING_RECORDS];
+        TraceRingRecord rec;
+
+        if (qatomic_read(&src->seq) != i + 1) {
+            continue;
+        }
+        smp_rmb();
+        rec = *src;
+        smp_rmb();
+        if (qatomic_read(&src->seq) != i + 1) {
+            continue;
+        }
+        g_array_append_val(out, rec);
+    }
+}
+
+static gint trace_ring_compare(gconstpointer a, gconstpointer b)
+{
+    const TraceRingRecord *ra = a, *rb = b;
+
+    return ra->ticks < rb->ticks ? -1 : ra->ticks > rb->ticks;
+}
+
+static bool trace_ring_write_record(FILE *fp, const TraceRingRecord *rec,
+                                    double ns_per_tick)
+{
+    uint64_t type = TRACE_RECORD_TYPE_EVENT;
+    uint64_t event = rec->event;
+    uint64_t timestamp_ns = calib_ns + (rec->ticks - calib_ticks) * ns_per_tick;
+    uint32_t length = 24;
+    uint32_t empty = 0;
+    unsigned i;
+
+    for (i = 0; i < rec->nargs; i++) {
+        length += rec->strings & (1 << i) ? sizeof(empty) : sizeof(uint64_t);
+    }
+
+    if (fwrite(&type, sizeof(type), 1, fp) != 1 ||
+        fwrite(&event, sizeof(event), 1, fp) != 1 ||
+        fwrite(&timestamp_ns, sizeof(timestamp_ns), 1, fp) != 1 ||
+        fwrite(&length, sizeof(length), 1, fp) != 1 ||
+        fwrite(&rec->tid, sizeof(rec->tid), 1, fp) != 1) {
+        return false;
+    }
+    for (i = 0; i < rec->nargs; i++) {
+        if (rec->strings & (1 << i)) {
+            if (fwrite(&empty, sizeof(empty), 1, fp) != 1) {
+                return false;
+            }
+        } else if (fwrite(&rec->args[i], sizeof(uint64_t), 1, fp) != 1) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool trace_ring_write(FILE *fp, GArray *records)
+{
+    static const uint64_t header[] = {
+        HEADER_EVENT_ID, HEADER_MAGIC, HEADER_VERSION
+    };
+    uint64_t type = TRACE_RECORD_TYPE_MAPPING;
+    int64_t ticks = cpu_get_host_ticks() - calib_ticks;
+    double ns_per_tick = 1;
+    TraceEventIter iter;
+    TraceEvent *ev;
+    unsigned i;
+
+    if (ticks > 0) {
+        ns_per_tick = (double)(get_clock() - calib_ns) / ticks;
+    }
+
+    if (fwrite(header, sizeof(header), 1, fp) != 1) {
+        return false;
+    }
+
+    trace_event_iter_init_all(&iter);
+    while ((ev = trace_event_iter_next(&iter)) != NULL) {
+        uint64_t id = trace_event_get_id(ev);
+        const char *name = trace_event_get_name(ev);
+        uint32_t len = strlen(name);
+
+        if (fwrite(&type, sizeof(type), 1, fp) != 1 ||
+            fwrite(&id, sizeof(id), 1, fp) != 1 ||
+            fwrite(&len, sizeof(len), 1, fp) != 1 ||
+            fwrite(name, len, 1, fp) != 1) {
+            return false;
+        }
+    }
+
+    for (i = 0; i < records->len; i++) {
+        if (!trace_ring_write_record(fp, &g_array_index(records,
+                                                        TraceRingRecord, i),
+                                     ns_per_tick)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool trace_ring_dump(const char *file, Error **errp)
+{
+    g_autoptr(GArray) records = g_array_new(false, false,
+                                            sizeof(TraceRingRecord));
+    TraceRing *r;
+    FILE *fp;
+    bool ok;
+
+    /* Tracing must not allocate a ring while ring_lock is held below */
+    if (!ring && !ring_exited) {
+        ring = trace_ring_get();
+    }
+
+    g_mutex_lock(&ring_lock);
+    for (r = rings; r; r = r->next) {
+        trace_ring_collect(r, records);
+    }
+    g_mutex_unlock(&ring_lock);
+
+    g_array_sort(records, trace_ring_compare);
+
+    fp = fopen(file, "wb");
+    if (!fp) {
+        error_setg_errno(errp, errno, "failed to open '%s'", file);
+        return false;
+    }
+    ok = trace_ring_write(fp, records);
+    if (fclose(fp) != 0 || !ok) {
+        error_setg_errno(errp, errno, "failed to write '%s'", file);
+        return false;
+    }
+    return true;
+}
+
+bool trace_ring_init(void)
+{
+    calib_ticks = cpu_get_host_ticks();
+    calib_ns = get_clock();
+    return true;
+}
@@ -0,0 +1,40 @@
+/*
+ * Ring buffer ("flight recorder") trace backend
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef TRACE_RING_H
+#define TRACE_RING_H
+
+/* Maximum number of arguments of a trace event, see tracetool */
+#define TRACE_RING_MAX_ARGS 10
+
+bool trace_ring_init(void);
+
+/**
+ * trace_ring_record:
+ * @event: event ID
+ * @args: argument values
+ * @nargs: number of elements in @args
+ * @strings: bitmask of the arguments that are strings
+ *
+ * Append a record to the calling thread's ring, overwriting the oldest
+ * record if it is full.  String arguments are not copied, their slot in
+ * @args is ignored and they are dumped as empty strings.
+ */
+void trace_ring_record(uint32_t event, const uint64_t *args,
+                       unsigned nargs, unsigned strings);
+
+/**
+ * trace_ring_dump:
+ * @file: path of the output file
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Write the contents of all rings to @file in the simpletrace format.
+ * Recording continues while the dump is in progress.
+ */
+bool trace_ring_dump(const char *file, Error **errp);
+
+#endif /* TRACE_RING_H */
@@ -58,10 +58,16 @@ typedef QemuConsoleClass QemuGraphicConsoleClass;
 
 OBJECT_DEFINE_TYPE(QemuGraphicConsole, qemu_graphic_console, QEMU_GRAPHIC_CONSOLE, QEMU_CONSOLE)
 
+/* Refreshes without display changes before the refresh rate decays */
+#define GUI_REFRESH_IDLE_COUNT 16
+
 struct DisplayState {
     QEMUTimer *gui_timer;
     uint64_t last_update;
     uint64_t update_interval;
+    /* Interval requested by the listeners, before backing off */
+    uint64_t base_interval;
+    unsigned idle_refreshes;
     bool refreshing;
 
     QLIST_HEAD(, DisplayChangeListener) listeners;
@@ -86,6 +92,8 @@ static void gui_update(void *opaque)
     DisplayState *ds = opaque;
     DisplayChangeListener *dcl;
 
+    /* Reset by gui_activity() if the refresh changes anything */
+    ds->idle_refreshes++;
     ds->refreshing = true;
     dpy_refresh(ds);
     ds->refreshing = false;
@@ -97,6 +105,15 @@ static void gui_update(void *opaque)
             interval = dcl_interval;
         }
     }
+    ds->base_interval = interval;
+
+    /* Double the interval for each idle refresh beyond the threshold */
+    if (ds->idle_refreshes > GUI_REFRESH_IDLE_COUNT &&
+        interval < GUI_REFRESH_INTERVAL_BACKOFF) {
+        unsigned shift = MIN(ds->idle_refreshes - GUI_REFRESH_IDLE_COUNT, 8);
+
+        interval = MIN(interval << shift, GUI_REFRESH_INTERVAL_BACKOFF);
+    }
     if (ds->update_interval != interval) {
         ds->update_interval = interval;
         trace_console_refresh(interval);
@@ -105,6 +122,27 @@ static void gui_update(void *opaque)
     timer_mod(ds->gui_timer, ds->last_update + interval);
 }
 
+/* The display changed, go back to the refresh rate of the listeners */
+static void gui_activity(DisplayState *ds)
+{
+    ds->idle_refreshes = 0;
+    if (!ds->refreshing && ds->gui_timer &&
+        ds->update_interval > ds->base_interval) {
+        timer_mod(ds->gui_timer, ds->last_update + ds->base_interval);
+    }
+}
+
+/*
+ * Called on user input, which is likely to change the display soon
+ * even if it has been idle for a while.
+ */
+void dpy_refresh_wakeup(void)
+{
+    if (display_state) {
+        gui_activity(display_state);
+    }
+}
+
 static void gui_setup_refresh(DisplayState *ds)
 {
     DisplayChangeListener *dcl;
@@ -789,6 +827,7 @@ void dpy_gfx_update(QemuConsole *con, int x, int y, int w, int h)
     if (!qemu_console_is_visible(con)) {
         return;
     }
+    gui_activity(s);
     dpy_gfx_update_texture(con, con->surface, x, y, w, h);
     QLIST_FOREACH(dcl, &s->listeners, next) {
         if (con != dcl->con) {
@@ -833,6 +872,7 @@ void dpy_gfx_replace_surface(QemuConsole *con,
 
     assert(old_surface != new_surface);
 
+    gui_activity(s);
     con->scanout.kind = SCANOUT_SURFACE;
     con->surface = new_surface;
     dpy_gfx_create_texture(con, new_surface);
@@ -948,6 +988,7 @@ void dpy_mouse_set(QemuConsole *c, int x, int y, bool on)
     if (!qemu_console_is_visible(c)) {
         return;
     }
+    gui_activity(s);
     QLIST_FOREACH(dcl, &s->listeners, next) {
         if (c != dcl->con) {
             continue;
@@ -969,6 +1010,7 @@ void dpy_cursor_define(QemuConsole *c, QEMUCursor *cursor)
     if (!qemu_console_is_visible(c)) {
         return;
     }
+    gui_activity(s);
     QLIST_FOREACH(dcl, &s->listeners, next) {
         if (c != dcl->con) {
             continue;
@@ -1122,6 +1164,7 @@ void dpy_gl_update(QemuConsole *con,
 
     assert(con->gl);
 
+    gui_activity(s);
     graphic_hw_gl_block(con, true);
     QLIST_FOREACH(dcl, &s->listeners, next) {
         if (con != dcl->con) {
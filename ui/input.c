@@ -369,6 +369,7 @@ void qemu_input_event_sync(void)
         return;
     }
 
+    dpy_refresh_wakeup();
     replay_input_sync_event();
 }
 
@@ -0,0 +1,244 @@
+/*
+ * QEMU VNC display driver: Open H.264 encoding
+ *
+ * The frames are encoded by a GStreamer pipeline, which uses a hardware
+ * encoder (VA-API, NVENC) when one is available.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/error-report.h"
+#include "qemu/timer.h"
+#include "vnc.h"
+#include "trace.h"
+
+#include <gst/gst.h>
+#include <gst/app/gstappsrc.h>
+#include <gst/app/gstappsink.h>
+
+/* Flags of an Open H.264 rectangle */
+#define VNC_H264_FLAG_RESET_CONTEXT      1
+
+/* How long to wait for the encoder to produce a frame */
+#define VNC_H264_PULL_TIMEOUT            (100 * GST_MSECOND)
+
+#if HOST_BIG_ENDIAN
+#define VNC_H264_SOURCE_FORMAT "xRGB"
+#else
+#define VNC_H264_SOURCE_FORMAT "BGRx"
+#endif
+
+/*
+ * Encoders in order of preference.  All of them are configured not to
+ * delay frames, so that the output for a frame can be sent as part of the
+ * same framebuffer update.
+ */
+static const struct {
+    const char *name;
+    const char *props;
+} vnc_h264_encoders[] = {
+    { "vah264lpenc", "b-frames=0" },
+    { "vah264enc", "b-frames=0" },
+    { "vaapih264enc", "max-bframes=0" },
+    { "nvh264enc", "zerolatency=true bframes=0" },
+    { "x264enc", "tune=zerolatency speed-preset=ultrafast" },
+    { "openh264enc", "usage-type=screen complexity=low" },
+};
+
+struct VncH264 {
+    GstElement *pipeline;
+    GstElement *source;
+    GstElement *sink;
+    int width;
+    int height;
+    int64_t start;
+    /* The client must reset its decoder before the next frame */
+    bool reset;
+};
+
+/* Index in vnc_h264_encoders, -1 if H.264 is not available, -2 until probed */
+static int vnc_h264_encoder = -2;
+
+bool vnc_h264_available(void)
+{
+    g_autoptr(GError) err = NULL;
+    int i;
+
+    if (vnc_h264_encoder != -2) {
+        return vnc_h264_encoder >= 0;
+    }
+
+    vnc_h264_encoder = -1;
+    if (!gst_init_check(NULL, NULL, &err)) {
+        warn_report("vnc: H.264 disabled, cannot initialize GStreamer: %s",
+                    err->message);
+        return false;
+    }
+    for (i = 0; i < ARRAY_SIZE(vnc_h264_encoders); i++) {
+        GstElementFactory *f =
+            gst_element_factory_find(vnc_h264_encoders[i].name);
+
+        if (f) {
+            gst_object_unref(f);
+            vnc_h264_encoder = i;
+            trace_vnc_h264_encoder(vnc_h264_encoders[i].name);
+            return true;
+        }
+    }
+    return false;
+}
+
+static void vnc_h264_free(VncH264 *h264)
+{
+    if (h264->pipeline) {
+        gst_element_set_state(h264->pipeline, GST_STATE_NULL);
+        gst_object_unref(h264->source);
+        gst_object_unref(h264->sink);
+        gst_object_unref(h264->pipeline);
+    }
+    g_free(h264);
+}
+
+static VncH264 *vnc_h264_new(int width, int height)
+{
+    g_autoptr(GError) err = NULL;
+    g_autofree char *desc = NULL;
+    VncH264 *h264 = g_new0(VncH264, 1);
+
+    desc = g_strdup_printf(
+        "appsrc name=src format=time is-live=true "
+        "caps=video/x-raw,format=%s,width=%d,height=%d,framerate=0/1 "
+        "! videoconvert ! %s %s "
+        "! video/x-h264,stream-format=byte-stream,alignment=au "
+        "! appsink name=sink sync=false",
+        VNC_H264_SOURCE_FORMAT, width, height,
+        vnc_h264_encoders[vnc_h264_encoder].name,
+        vnc_h264_encoders[vnc_h264_encoder].props);
+
+    h264->pipeline = gst_parse_launch(desc, &err);
+    if (!h264->pipeline) {
+        error_report("vnc: cannot create H.264 pipeline: %s", err->message);
+        g_free(h264);
+        return NULL;
+    }
+    h264->source = gst_bin_get_by_name(GST_BIN(h264->pipeline), "src");
+    h264->sink = gst_bin_get_by_name(GST_BIN(h264->pipeline), "sink");
+    h264->width = width;
+    h264->height = height;
+    h264->start = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    h264->reset = true;
+
+    if (gst_element_set_state(h264->pipeline, GST_STATE_PLAYING) ==
+        GST_STATE_CHANGE_FAILURE) {
+        error_report("vnc: cannot start H.264 pipeline");
+        vnc_h264_free(h264);
+        return NULL;
+    }
+    return h264;
+}
+
+static bool vnc_h264_push(VncH264 *h264, VncDisplay *vd,
+                          int x, int y, int w, int h)
+{
+    size_t line = w * VNC_SERVER_FB_BYTES;
+    GstBuffer *buf = gst_buffer_new_allocate(NULL, line * h, NULL);
+    GstMapInfo map;
+    uint8_t *src = vnc_server_fb_ptr(vd, x, y);
+    int i;
+
+    gst_buffer_map(buf, &map, GST_MAP_WRITE);
+    for (i = 0; i < h; i++) {
+        memcpy(map.data + i * line, src, line);
+        src += vnc_server_fb_stride(vd);
+    }
+    gst_buffer_unmap(buf, &map);
+
+    GST_BUFFER_PTS(buf) = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - h264->start;
+    return gst_app_src_push_buffer(GST_APP_SRC(h264->source), buf) ==
+           GST_FLOW_OK;
+}
+
+/* Append all the encoded data that is ready to @out */
+static void vnc_h264_pull(VncH264 *h264, Buffer *out)
+{
+    GstClockTime timeout = VNC_H264_PULL_TIMEOUT;
+    GstSample *sample;
+
+    while ((sample = gst_app_sink_try_pull_sample(GST_APP_SINK(h264->sink),
+                                                  timeout))) {
+        GstBuffer *buf = gst_sample_get_buffer(sample);
+        GstMapInfo map;
+
+        if (buf && gst_buffer_map(buf, &map, GST_MAP_READ)) {
+            buffer_reserve(out, map.size);
+            buffer_append(out, map.data, map.size);
+            gst_buffer_unmap(buf, &map);
+        }
+        gst_sample_unref(sample);
+        /* Only wait for the first frame, then take what is left */
+        timeout = 0;
+    }
+}
+
+int vnc_h264_send_framebuffer_update(VncState *vs, VncWorker *worker,
+                                     int x, int y, int w, int h)
+{
+    VncH264 *h264;
+    uint32_t flags;
+    Buffer out;
+
+    /* 4:2:0 chroma subsampling needs even dimensions */
+    if ((w | h) & 1) {
+        vnc_framebuffer_update(vs, x, y, w, h, VNC_ENCODING_RAW);
+        return vnc_raw_send_framebuffer_update(vs, x, y, w, h);
+    }
+
+    /*
+     * A new stream starts with an IDR frame.  Restart the encoder when the
+     * size changes and when the client asked for a full update.
+     */
+    if (worker->h264 &&
+        (worker->h264->width != w || worker->h264->height != h ||
+         vs->job_update == VNC_STATE_UPDATE_FORCE)) {
+        vnc_h264_free(worker->h264);
+        worker->h264 = NULL;
+    }
+    if (!worker->h264) {
+        worker->h264 = vnc_h264_new(w, h);
+        if (!worker->h264) {
+            return 0;
+        }
+    }
+    h264 = worker->h264;
+
+    if (!vnc_h264_push(h264, vs->vd, x, y, w, h)) {
+        return 0;
+    }
+
+    buffer_init(&out, "vnc-h264");
+    vnc_h264_pull(h264, &out);
+    if (!out.offset) {
+        buffer_free(&out);
+        return 0;
+    }
+
+    flags = h264->reset ? VNC_H264_FLAG_RESET_CONTEXT : 0;
+    h264->reset = false;
+
+    trace_vnc_h264_frame(vs, w, h, out.offset, flags);
+    vnc_framebuffer_update(vs, x, y, w, h, VNC_ENCODING_H264);
+    vnc_write_u32(vs, out.offset);
+    vnc_write_u32(vs, flags);
+    vnc_write(vs, out.buffer, out.offset);
+    buffer_free(&out);
+    return 1;
+}
+
+void vnc_h264_clear(VncWorker *worker)
+{
+    if (worker->h264) {
+        vnc_h264_free(worker->h264);
+        worker->h264 = NULL;
+    }
+}
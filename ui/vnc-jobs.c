@@ -44,28 +44,32 @@
  * - VncState::output lock: used to make sure the output buffer is not corrupted
  *                          if two threads try to write on it at the same time
  *
- * While the VNC worker thread is working, the VncDisplay global lock is held
- * to avoid screen corruption (this does not block vnc_refresh() because it
- * uses trylock()) but the output lock is not held because the thread works on
- * its own output buffer.
+ * While a VNC worker thread is working, the VncDisplay global lock is held
+ * shared to avoid screen corruption (this does not block vnc_refresh() because
+ * it uses trylock()) but the output lock is not held because the thread works
+ * on its own output buffer.
  * When the encoding job is done, the worker thread will hold the output lock
  * and copy its output buffer in vs->output.
+ *
+ * Several worker threads take jobs from the queue, so that different clients
+ * are encoded in parallel.  The jobs of one client are encoded one at a time
+ * and in order, because the encoders keep per-client state such as the zlib
+ * streams in VncWorker.
  */
 
+#define VNC_WORKER_THREADS_MAX 4
+
 struct VncJobQueue {
     QemuCond cond;
     QemuMutex mutex;
-    QemuThread thread;
+    int nr_threads;
     bool exit;
     QTAILQ_HEAD(, VncJob) jobs;
 };
 
 typedef struct VncJobQueue VncJobQueue;
 
-/*
- * We use a single global queue, but most of the functions are
- * already reentrant, so we can easily add more than one encoding thread
- */
+/* We use a single global queue, shared by all encoding threads */
 static VncJobQueue *queue;
 
 static void vnc_lock_queue(VncJobQueue *queue)
@@ -190,6 +194,7 @@ static void vnc_async_encoding_start(VncState *orig, VncState *local)
     local->hextile = orig->hextile;
     local->client_width = orig->client_width;
     local->client_height = orig->client_height;
+    local->job_update = orig->job_update;
 }
 
 static void vnc_async_encoding_end(VncState *orig, VncState *local)
@@ -226,26 +231,47 @@ static bool vnc_worker_clamp_rect(VncState *vs, VncJob *job, VncRect *rect)
     return false;
 }
 
+/* Returns the first job whose client has no earlier job in the queue */
+static VncJob *vnc_job_next_locked(VncJobQueue *queue)
+{
+    VncJob *job, *prev;
+
+    QTAILQ_FOREACH(job, &queue->jobs, next) {
+        if (job->running) {
+            continue;
+        }
+        for (prev = QTAILQ_PREV(job, next); prev;
+             prev = QTAILQ_PREV(prev, next)) {
+            if (prev->vs == job->vs) {
+                break;
+            }
+        }
+        if (!prev) {
+            return job;
+        }
+    }
+    return NULL;
+}
+
 static int vnc_worker_thread_loop(VncJobQueue *queue)
 {
     VncConnection *vc;
-    VncJob *job;
+    VncJob *job = NULL;
     VncRectEntry *entry, *tmp;
     VncState vs = {};
     int n_rectangles;
     int saved_offset;
 
     vnc_lock_queue(queue);
-    while (QTAILQ_EMPTY(&queue->jobs) && !queue->exit) {
+    while (!queue->exit && !(job = vnc_job_next_locked(queue))) {
         qemu_cond_wait(&queue->cond, &queue->mutex);
     }
-    /* Here job can only be NULL if queue->exit is true */
-    job = QTAILQ_FIRST(&queue->jobs);
-    vnc_unlock_queue(queue);
-
     if (queue->exit) {
+        vnc_unlock_queue(queue);
         return -1;
     }
+    job->running = true;
+    vnc_unlock_queue(queue);
 
     assert(job->vs->magic == VNC_MAGIC);
     vc = container_of(job->vs, VncConnection, vs);
@@ -276,12 +302,12 @@ static int vnc_worker_thread_loop(VncJobQueue *queue)
     saved_offset = vs.output.offset;
     vnc_write_u16(&vs, 0);
 
-    vnc_lock_display(job->vs->vd);
+    vnc_lock_display_shared(job->vs->vd);
     QLIST_FOREACH_SAFE(entry, &job->rectangles, next, tmp) {
         int n;
 
         if (job->vs->ioc == NULL) {
-            vnc_unlock_display(job->vs->vd);
+            vnc_unlock_display_shared(job->vs->vd);
             /* Copy persistent encoding data */
             vnc_async_encoding_end(job->vs, &vs);
             goto disconnected;
@@ -299,7 +325,7 @@ static int vnc_worker_thread_loop(VncJobQueue *queue)
         g_free(entry);
     }
     trace_vnc_job_nrects(&vs, job, n_rectangles);
-    vnc_unlock_display(job->vs->vd);
+    vnc_unlock_display_shared(job->vs->vd);
 
     /* Put n_rectangles at the beginning of the message */
     vs.output.buffer[saved_offset] = (n_rectangles >> 8) & 0xFF;
@@ -350,11 +376,16 @@ static void vnc_queue_clear(VncJobQueue *q)
 static void *vnc_worker_thread(void *arg)
 {
     VncJobQueue *queue = arg;
-
-    qemu_thread_get_self(&queue->thread);
+    bool last;
 
     while (!vnc_worker_thread_loop(queue)) ;
-    vnc_queue_clear(queue);
+
+    vnc_lock_queue(queue);
+    last = --queue->nr_threads == 0;
+    vnc_unlock_queue(queue);
+    if (last) {
+        vnc_queue_clear(queue);
+    }
     return NULL;
 }
 
@@ -366,12 +397,18 @@ static bool vnc_worker_thread_running(void)
 void vnc_start_worker_thread(void)
 {
     VncJobQueue *q;
+    int i;
 
     if (vnc_worker_thread_running())
         return;
 
     q = vnc_queue_init();
-    qemu_thread_create(&q->thread, "vnc_worker", vnc_worker_thread, q,
-                       QEMU_THREAD_DETACHED);
+    q->nr_threads = MIN(VNC_WORKER_THREADS_MAX, g_get_num_processors());
+    for (i = 0; i < q->nr_threads; i++) {
+        QemuThread thread;
+
+        qemu_thread_create(&thread, "vnc_worker", vnc_worker_thread, q,
+                           QEMU_THREAD_DETACHED);
+    }
     queue = q; /* Set global queue */
 }
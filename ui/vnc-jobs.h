@@ -39,22 +39,42 @@ void vnc_jobs_join(VncState *vs);
 void vnc_jobs_consume_buffer(VncState *vs);
 void vnc_start_worker_thread(void);
 
-/* Locks */
+/*
+ * Locks
+ *
+ * The display lock can be taken shared by any number of worker threads that
+ * only read the server surface, or exclusively with vnc_trylock_display(),
+ * which fails while the lock is held in either mode.
+ */
 static inline int vnc_trylock_display(VncDisplay *vd)
 {
-    return qemu_mutex_trylock(&vd->mutex);
+    if (qemu_mutex_trylock(&vd->mutex)) {
+        return -1;
+    }
+    if (qatomic_read(&vd->encoders)) {
+        qemu_mutex_unlock(&vd->mutex);
+        return -1;
+    }
+    return 0;
 }
 
-static inline void vnc_lock_display(VncDisplay *vd)
+static inline void vnc_unlock_display(VncDisplay *vd)
 {
-    qemu_mutex_lock(&vd->mutex);
+    qemu_mutex_unlock(&vd->mutex);
 }
 
-static inline void vnc_unlock_display(VncDisplay *vd)
+static inline void vnc_lock_display_shared(VncDisplay *vd)
 {
+    qemu_mutex_lock(&vd->mutex);
+    qatomic_inc(&vd->encoders);
     qemu_mutex_unlock(&vd->mutex);
 }
 
+static inline void vnc_unlock_display_shared(VncDisplay *vd)
+{
+    qatomic_dec(&vd->encoders);
+}
+
 static inline void vnc_lock_output(VncState *vs)
 {
     qemu_mutex_lock(&vs->output_mutex);
@@ -975,6 +975,11 @@ int vnc_send_framebuffer_update(VncState *vs, VncWorker *worker,
         case VNC_ENCODING_ZYWRLE:
             n = vnc_zywrle_send_framebuffer_update(vs, worker, x, y, w, h);
             break;
+#ifdef CONFIG_VNC_H264
+        case VNC_ENCODING_H264:
+            n = vnc_h264_send_framebuffer_update(vs, worker, x, y, w, h);
+            break;
+#endif
         default:
             vnc_framebuffer_update(vs, x, y, w, h, VNC_ENCODING_RAW);
             n = vnc_raw_send_framebuffer_update(vs, x, y, w, h);
@@ -1177,6 +1182,17 @@ static int vnc_update_client(VncState *vs, int has_dirty)
     height = pixman_image_get_height(vd->server);
     width = pixman_image_get_width(vd->server);
 
+    if (vs->vnc_encoding == VNC_ENCODING_H264) {
+        /*
+         * H.264 frames always cover the whole framebuffer, so send a
+         * single rectangle.  The loop below then finds nothing to do.
+         */
+        for (y = 0; y < height; y++) {
+            bitmap_zero(vs->dirty[y], VNC_DIRTY_BITS);
+        }
+        n += vnc_job_add_rect(job, 0, 0, width, height);
+    }
+
     y = 0;
     for (;;) {
         int x, h;
@@ -1328,6 +1344,9 @@ void vnc_disconnect_finish(VncState *vs)
     vnc_zlib_clear(&vc->worker);
     vnc_tight_clear(&vc->worker);
     vnc_zrle_clear(&vc->worker);
+#ifdef CONFIG_VNC_H264
+    vnc_h264_clear(&vc->worker);
+#endif
 
 #ifdef CONFIG_VNC_SASL
     vnc_sasl_client_cleanup(vs);
@@ -2067,9 +2086,24 @@ static void ext_key_event(VncState *vs, int down,
     }
 }
 
+/* Whether vnc_refresh() has anything to do for the clients of @vd */
+static bool vnc_has_update_request(VncDisplay *vd)
+{
+    VncState *vs;
+
+    QTAILQ_FOREACH(vs, &vd->clients, next) {
+        if (vs->update != VNC_STATE_UPDATE_NONE || vs->disconnecting) {
+            return true;
+        }
+    }
+    return false;
+}
+
 static void framebuffer_update_request(VncState *vs, int incremental,
                                        int x, int y, int w, int h)
 {
+    bool wakeup = !vnc_has_update_request(vs->vd);
+
     if (incremental) {
         if (vs->update != VNC_STATE_UPDATE_FORCE) {
             vs->update = VNC_STATE_UPDATE_INCREMENTAL;
@@ -2081,6 +2115,11 @@ static void framebuffer_update_request(VncState *vs, int incremental,
             vnc_desktop_resize_ext(vs, 0);
         }
     }
+
+    /* The refresh timer may have backed off while nobody was asking */
+    if (wakeup) {
+        update_displaychangelistener(&vs->vd->dcl, VNC_REFRESH_INTERVAL_BASE);
+    }
 }
 
 static void send_ext_key_event_ack(VncState *vs)
@@ -2178,6 +2217,14 @@ static void set_encodings(VncState *vs, int32_t *encodings, size_t n_encodings)
             vnc_set_feature(vs, VNC_FEATURE_ZYWRLE);
             vs->vnc_encoding = enc;
             break;
+#ifdef CONFIG_VNC_H264
+        case VNC_ENCODING_H264:
+            if (vs->vd->lossy && vnc_h264_available()) {
+                vnc_set_feature(vs, VNC_FEATURE_H264);
+                vs->vnc_encoding = enc;
+            }
+            break;
+#endif
         case VNC_ENCODING_DESKTOPRESIZE:
             vnc_set_feature(vs, VNC_FEATURE_RESIZE);
             break;
@@ -3161,8 +3208,9 @@ static int vnc_refresh_server_surface(VncDisplay *vd)
     int has_dirty = 0;
     pixman_image_t *tmpbuf = NULL;
     unsigned long offset;
-    int x;
+    int x, x_first, x_end, nr_bits;
     uint8_t *guest_ptr, *server_ptr;
+    DECLARE_BITMAP(changed, VNC_DIRTY_BITS);
 
     struct timeval tv = { 0, 0 };
 
@@ -3200,45 +3248,73 @@ static int vnc_refresh_server_surface(VncDisplay *vd)
                    * DIV_ROUND_UP(guest_bpp, 8);
     }
     line_bytes = MIN(server_stride, guest_ll);
+    nr_bits = DIV_ROUND_UP(width, VNC_DIRTY_PIXELS_PER_BIT);
 
     for (;;) {
-        y = offset / VNC_DIRTY_BPL(&vd->guest);
-        x = offset % VNC_DIRTY_BPL(&vd->guest);
+        unsigned long *guest_dirty;
 
-        server_ptr = server_row0 + y * server_stride + x * cmp_bytes;
+        y = offset / VNC_DIRTY_BPL(&vd->guest);
+        x_first = offset % VNC_DIRTY_BPL(&vd->guest);
+        guest_dirty = vd->guest.dirty[y];
+        if (x_first >= nr_bits) {
+            /* only bits beyond the visible width, nothing to compare */
+            goto next_row;
+        }
+        x_end = find_last_bit(guest_dirty, nr_bits) + 1;
 
+        /*
+         * Only convert the span between the first and the last dirty
+         * tile; guest_ptr then points at tile x_first.
+         */
         if (vd->guest.format != VNC_SERVER_FB_FORMAT) {
-            qemu_pixman_linebuf_fill(tmpbuf, vd->guest.fb, width, 0, y);
+            int px = x_first * VNC_DIRTY_PIXELS_PER_BIT;
+
+            qemu_pixman_linebuf_fill(tmpbuf, vd->guest.fb,
+                                     MIN(width - px, (x_end - x_first) *
+                                         VNC_DIRTY_PIXELS_PER_BIT),
+                                     px, y);
             guest_ptr = (uint8_t *)pixman_image_get_data(tmpbuf);
         } else {
-            guest_ptr = guest_row0 + y * guest_stride;
+            guest_ptr = guest_row0 + y * guest_stride + x_first * cmp_bytes;
         }
-        guest_ptr += x * cmp_bytes;
+        server_ptr = server_row0 + y * server_stride + x_first * cmp_bytes;
 
-        for (; x < DIV_ROUND_UP(width, VNC_DIRTY_PIXELS_PER_BIT);
-             x++, guest_ptr += cmp_bytes, server_ptr += cmp_bytes) {
+        /*
+         * Visit only the dirty tiles and collect the ones whose contents
+         * really changed, so that the client dirty maps can be updated a
+         * word at a time instead of one set_bit() per tile and client.
+         */
+        bitmap_zero(changed, x_end);
+        for (x = x_first; x < x_end;
+             x = find_next_bit(guest_dirty, x_end, x + 1)) {
             int _cmp_bytes = cmp_bytes;
-            if (!test_and_clear_bit(x, vd->guest.dirty[y])) {
-                continue;
-            }
+            uint8_t *g = guest_ptr + (x - x_first) * cmp_bytes;
+            uint8_t *s = server_ptr + (x - x_first) * cmp_bytes;
+
             if ((x + 1) * cmp_bytes > line_bytes) {
                 _cmp_bytes = line_bytes - x * cmp_bytes;
             }
             assert(_cmp_bytes >= 0);
-            if (memcmp(server_ptr, guest_ptr, _cmp_bytes) == 0) {
+            if (memcmp(s, g, _cmp_bytes) == 0) {
                 continue;
             }
-            memcpy(server_ptr, guest_ptr, _cmp_bytes);
+            memcpy(s, g, _cmp_bytes);
             if (!vd->non_adaptive) {
                 vnc_rect_updated(vd, x * VNC_DIRTY_PIXELS_PER_BIT,
                                  y, &tv);
             }
+            set_bit(x, changed);
+            has_dirty++;
+        }
+        bitmap_clear(guest_dirty, x_first, x_end - x_first);
+
+        if (find_next_bit(changed, x_end, x_first) < x_end) {
             QTAILQ_FOREACH(vs, &vd->clients, next) {
-                set_bit(x, vs->dirty[y]);
+                bitmap_or(vs->dirty[y], vs->dirty[y], changed, x_end);
             }
-            has_dirty++;
         }
 
+next_row:
         y++;
         offset = find_next_bit((unsigned long *) &vd->guest.dirty,
                                height * VNC_DIRTY_BPL(&vd->guest),
@@ -3263,6 +3339,18 @@ static void vnc_refresh(DisplayChangeListener *dcl)
         return;
     }
 
+    /*
+     * Nothing can be sent until a client asks for an update, so leave the
+     * guest framebuffer alone and let its dirty tracking accumulate.
+     */
+    if (!vnc_has_update_request(vd)) {
+        vd->dcl.update_interval += VNC_REFRESH_INTERVAL_INC;
+        if (vd->dcl.update_interval > VNC_REFRESH_INTERVAL_MAX) {
+            vd->dcl.update_interval = VNC_REFRESH_INTERVAL_MAX;
+        }
+        return;
+    }
+
     graphic_hw_update(vd->dcl.con);
 
     if (vnc_trylock_display(vd)) {
@@ -158,6 +158,7 @@ struct VncDisplay
     int ledstate;
     QKbdState *kbd;
     QemuMutex mutex;
+    int encoders;       /* worker threads reading the surface, see vnc-jobs.h */
 
     int cursor_msize;
     uint8_t *cursor_mask;
@@ -233,6 +234,8 @@ typedef struct VncZywrle {
     int buf[VNC_ZRLE_TILE_WIDTH * VNC_ZRLE_TILE_HEIGHT];
 } VncZywrle;
 
+typedef struct VncH264 VncH264;
+
 struct VncRect
 {
     int x;
@@ -250,6 +253,7 @@ struct VncRectEntry
 struct VncJob
 {
     VncState *vs;
+    bool running;       /* protected by the jobs queue lock */
 
     QLIST_HEAD(, VncRectEntry) rectangles;
     QTAILQ_ENTRY(VncJob) next;
@@ -357,6 +361,9 @@ typedef struct VncWorker {
     VncTight tight;
     VncZlib zlib;
     VncZrle zrle;
+#ifdef CONFIG_VNC_H264
+    VncH264 *h264;
+#endif
 } VncWorker;
 
 typedef struct VncConnection {
@@ -414,6 +421,7 @@ enum {
 #define VNC_ENCODING_TRLE                 0x0000000f
 #define VNC_ENCODING_ZRLE                 0x00000010
 #define VNC_ENCODING_ZYWRLE               0x00000011
+#define VNC_ENCODING_H264                 0x00000032 /* Open H.264 */
 #define VNC_ENCODING_COMPRESSLEVEL0       0xFFFFFF00 /* -256 */
 #define VNC_ENCODING_QUALITYLEVEL0        0xFFFFFFE0 /* -32  */
 #define VNC_ENCODING_XCURSOR              0xFFFFFF10 /* -240 */
@@ -474,6 +482,7 @@ enum VncFeatures {
     VNC_FEATURE_XVP,
     VNC_FEATURE_CLIPBOARD_EXT,
     VNC_FEATURE_AUDIO,
+    VNC_FEATURE_H264,
 };
 
 
@@ -640,6 +649,13 @@ int vnc_zywrle_send_framebuffer_update(VncState *vs, VncWorker *worker,
                                        int x, int y, int w, int h);
 void vnc_zrle_clear(VncWorker *worker);
 
+#ifdef CONFIG_VNC_H264
+bool vnc_h264_available(void);
+int vnc_h264_send_framebuffer_update(VncState *vs, VncWorker *worker,
+                                     int x, int y, int w, int h);
+void vnc_h264_clear(VncWorker *worker);
+#endif
+
 /* vnc-clipboard.c */
 void vnc_server_cut_text_caps(VncState *vs);
 void vnc_client_cut_text(VncState *vs, size_t len, uint8_t *text);
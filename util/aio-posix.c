@@ -93,13 +93,14 @@ static bool aio_remove_fd_handler(AioContext *ctx, AioHandler *node)
     return true;
 }
 
-void aio_set_fd_handler(AioContext *ctx,
-                        int fd,
-                        IOHandler *io_read,
-                        IOHandler *io_write,
-                        AioPollFn *io_poll,
-                        IOHandler *io_poll_ready,
-                        void *opaque)
+static void aio_set_fd_handler_common(AioContext *ctx,
+                                      int fd,
+                                      IOHandler *io_read,
+                                      IOHandler *io_write,
+                                      AioPollFn *io_poll,
+                                      IOHandler *io_poll_ready,
+                                      void *opaque,
+                                      bool drains_fd)
 {
     AioHandler *node;
     AioHandler *new_node = NULL;
@@ -139,6 +140,7 @@ void aio_set_fd_handler(AioContext *ctx,
         new_node->io_poll = io_poll;
         new_node->io_poll_ready = io_poll_ready;
         new_node->opaque = opaque;
+        new_node->drains_fd = drains_fd;
 
         if (is_new) {
             new_node->pfd.fd = fd;
@@ -173,6 +175,18 @@ void aio_set_fd_handler(AioContext *ctx,
     }
 }
 
+void aio_set_fd_handler(AioContext *ctx,
+                        int fd,
+                        IOHandler *io_read,
+                        IOHandler *io_write,
+                        AioPollFn *io_poll,
+                        IOHandler *io_poll_ready,
+                        void *opaque)
+{
+    aio_set_fd_handler_common(ctx, fd, io_read, io_write, io_poll,
+                              io_poll_ready, opaque, false);
+}
+
 static void aio_set_fd_poll(AioContext *ctx, int fd,
                             IOHandler *io_poll_begin,
                             IOHandler *io_poll_end)
@@ -193,9 +207,10 @@ void aio_set_event_notifier(AioContext *ctx,
                             AioPollFn *io_poll,
                             EventNotifierHandler *io_poll_ready)
 {
-    aio_set_fd_handler(ctx, event_notifier_get_fd(notifier),
-                       (IOHandler *)io_read, NULL, io_poll,
-                       (IOHandler *)io_poll_ready, notifier);
+    /* Handlers drain the notifier with event_notifier_test_and_clear() */
+    aio_set_fd_handler_common(ctx, event_notifier_get_fd(notifier),
+                              (IOHandler *)io_read, NULL, io_poll,
+                              (IOHandler *)io_poll_ready, notifier, true);
 }
 
 void aio_set_event_notifier_poll(AioContext *ctx,
@@ -557,11 +572,43 @@ static bool run_poll_handlers(AioContext *ctx, AioHandlerList *ready_list,
  *
  * Returns: true if progress was made, false otherwise
  */
+struct AioPollGroup {
+    char *name;
+    unsigned int refcnt;
+
+    /* The member that is busy polling, or NULL.  Accessed with atomics. */
+    AioContext *poller;
+
+    QLIST_ENTRY(AioPollGroup) next;
+};
+
+/* Protected by the BQL */
+static QLIST_HEAD(, AioPollGroup) poll_groups =
+    QLIST_HEAD_INITIALIZER(poll_groups);
+
+/* Returns true if @ctx may busy poll now; pair with poll_group_leave() */
+static bool poll_group_enter(AioContext *ctx)
+{
+    AioPollGroup *group = ctx->poll_group;
+
+    return !group || qatomic_cmpxchg(&group->poller, NULL, ctx) == NULL;
+}
+
+static void poll_group_leave(AioContext *ctx)
+{
+    AioPollGroup *group = ctx->poll_group;
+
+    if (group) {
+        qatomic_set(&group->poller, NULL);
+    }
+}
+
 static bool try_poll_mode(AioContext *ctx, AioHandlerList *ready_list,
                           int64_t *timeout)
 {
     AioHandler *node;
     int64_t max_ns;
+    bool progress;
 
     if (QLIST_EMPTY_RCU(&ctx->poll_aio_handlers)) {
         return false;
@@ -573,16 +620,16 @@ static bool try_poll_mode(AioContext *ctx, AioHandlerList *ready_list,
     }
     max_ns = qemu_soonest_timeout(*timeout, max_ns);
 
-    if (max_ns && !ctx->fdmon_ops->need_wait(ctx)) {
+    if (max_ns && !ctx->fdmon_ops->need_wait(ctx) && poll_group_enter(ctx)) {
         /*
          * Enable poll mode. It pairs with the poll_set_started() in
          * aio_poll() which disables poll mode.
          */
         poll_set_started(ctx, ready_list, true);
 
-        if (run_poll_handlers(ctx, ready_list, max_ns, timeout)) {
-            return true;
-        }
+        progress = run_poll_handlers(ctx, ready_list, max_ns, timeout);
+        poll_group_leave(ctx);
+        return progress;
     }
     return false;
 }
@@ -773,6 +820,7 @@ void aio_context_destroy(AioContext *ctx)
     qemu_lockcnt_unlock(&ctx->list_lock);
 
     aio_free_deleted_handlers(ctx);
+    aio_context_set_poll_group(ctx, NULL);
 }
 
 void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
@@ -796,6 +844,37 @@ void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
     aio_notify(ctx);
 }
 
+void aio_context_set_poll_group(AioContext *ctx, const char *name)
+{
+    AioPollGroup *group = ctx->poll_group;
+
+    if (group) {
+        ctx->poll_group = NULL;
+        if (--group->refcnt == 0) {
+            QLIST_REMOVE(group, next);
+            g_free(group->name);
+            g_free(group);
+        }
+    }
+
+    if (!name) {
+        return;
+    }
+
+    QLIST_FOREACH(group, &poll_groups, next) {
+        if (!strcmp(group->name, name)) {
+            break;
+        }
+    }
+    if (!group) {
+        group = g_new0(AioPollGroup, 1);
+        group->name = g_strdup(name);
+        QLIST_INSERT_HEAD(&poll_groups, group, next);
+    }
+    group->refcnt++;
+    ctx->poll_group = group;
+}
+
 void aio_context_set_aio_params(AioContext *ctx, int64_t max_batch)
 {
     /*
@@ -807,6 +886,16 @@ void aio_context_set_aio_params(AioContext *ctx, int64_t max_batch)
     aio_notify(ctx);
 }
 
+bool aio_context_set_io_uring_sqpoll(AioContext *ctx, int cpu, Error **errp)
+{
+#ifdef CONFIG_LINUX_IO_URING
+    return fdmon_io_uring_set_sqpoll(ctx, cpu, errp);
+#else
+    error_setg(errp, "io_uring is not supported in this build");
+    return false;
+#endif
+}
+
 #ifdef CONFIG_LINUX_IO_URING
 void aio_add_sqe(void (*prep_sqe)(struct io_uring_sqe *sqe, void *opaque),
                  void *opaque, CqeHandler *cqe_handler)
@@ -37,9 +37,11 @@ struct AioHandler {
     QSLIST_ENTRY(AioHandler) node_submitted;
     unsigned flags; /* see fdmon-io_uring.c */
     CqeHandler internal_cqe_handler; /* used for POLL_ADD/POLL_REMOVE */
+    bool poll_multishot; /* is the POLL_ADD multishot? */
 #endif
     int64_t poll_idle_timeout; /* when to stop userspace polling */
     bool poll_ready; /* has polling detected an event? */
+    bool drains_fd; /* io_read() always drains pfd.fd, edge triggering is ok */
     AioPolledEvent poll;
 };
 
@@ -75,6 +77,7 @@ static inline void fdmon_epoll_disable(AioContext *ctx)
 
 #ifdef CONFIG_LINUX_IO_URING
 bool fdmon_io_uring_setup(AioContext *ctx, Error **errp);
+bool fdmon_io_uring_set_sqpoll(AioContext *ctx, int cpu, Error **errp);
 void fdmon_io_uring_destroy(AioContext *ctx);
 #endif /* !CONFIG_LINUX_IO_URING */
 
@@ -436,6 +436,16 @@ void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
     }
 }
 
+void aio_context_set_poll_group(AioContext *ctx, const char *name)
+{
+}
+
 void aio_context_set_aio_params(AioContext *ctx, int64_t max_batch)
 {
 }
+
+bool aio_context_set_io_uring_sqpoll(AioContext *ctx, int cpu, Error **errp)
+{
+    error_setg(errp, "io_uring is not implemented on Windows");
+    return false;
+}
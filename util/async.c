@@ -32,6 +32,8 @@
 #include "qemu/mem-reentrancy.h"
 #include "qemu/atomic.h"
 #include "qemu/lockcnt.h"
+#include "qemu/lockable.h"
+#include "qemu/memalign.h"
 #include "qemu/rcu_queue.h"
 #include "block/raw-aio.h"
 #include "qemu/coroutine_int.h"
@@ -93,9 +95,16 @@ static void aio_bh_enqueue(QEMUBH *bh, unsigned new_flags)
          *    could be freed.
          */
         QSLIST_INSERT_HEAD_ATOMIC(&ctx->bh_list, bh, next);
+
+        /*
+         * If the bottom half was already pending, whoever set BH_PENDING
+         * has notified or is about to notify @ctx, and aio_bh_poll() will
+         * see our writes once it clears BH_PENDING.  This coalesces the
+         * wakeups of e.g. a burst of aio_co_schedule() calls into one.
+         */
+        aio_notify(ctx);
     }
 
-    aio_notify(ctx);
     if (unlikely(icount_enabled())) {
         /*
          * Workaround for record/replay.
@@ -366,6 +375,19 @@ aio_ctx_dispatch(GSource     *source,
     return true;
 }
 
+static void aio_buf_pool_cleanup(AioBufPool *pool)
+{
+    int i;
+
+    for (i = 0; i < AIO_BUF_POOL_CLASSES; i++) {
+        while (pool->nb_bufs[i]) {
+            qemu_vfree(pool->bufs[i][--pool->nb_bufs[i]]);
+        }
+    }
+    pool->cached = 0;
+    qemu_mutex_destroy(&pool->lock);
+}
+
 static void
 aio_ctx_finalize(GSource *source)
 {
@@ -416,6 +438,7 @@ aio_ctx_finalize(GSource *source)
     event_notifier_cleanup(&ctx->notifier);
     qemu_rec_mutex_destroy(&ctx->lock);
     timerlistgroup_deinit(&ctx->tlg);
+    aio_buf_pool_cleanup(&ctx->buf_pool);
     unregister_aiocontext(ctx);
     aio_context_destroy(ctx);
     /* aio_context_destroy() still needs the lock */
@@ -443,6 +466,76 @@ ThreadPoolAio *aio_get_thread_pool(AioContext *ctx)
     return ctx->thread_pool;
 }
 
+/* Returns the size class for @size, or -1 if it is too large to be kept */
+static int aio_buf_pool_class(size_t size)
+{
+    int shift = size > 1 ? 64 - clz64(size - 1) : 0;
+
+    shift = MAX(shift, AIO_BUF_POOL_MIN_SHIFT);
+    if (shift >= AIO_BUF_POOL_MIN_SHIFT + AIO_BUF_POOL_CLASSES) {
+        return -1;
+    }
+    return shift - AIO_BUF_POOL_MIN_SHIFT;
+}
+
+void *aio_buf_pool_try_alloc(AioContext *ctx, size_t alignment, size_t size)
+{
+    int idx = aio_buf_pool_class(size);
+    size_t class_size;
+    void *ptr = NULL;
+
+    if (idx < 0) {
+        return qemu_try_memalign(alignment, size);
+    }
+    class_size = (size_t)1 << (idx + AIO_BUF_POOL_MIN_SHIFT);
+
+    /* Kept buffers are aligned to the host page size */
+    if (ctx && alignment <= qemu_real_host_page_size()) {
+        WITH_QEMU_LOCK_GUARD(&ctx->buf_pool.lock) {
+            AioBufPool *pool = &ctx->buf_pool;
+
+            if (pool->nb_bufs[idx]) {
+                ptr = pool->bufs[idx][--pool->nb_bufs[idx]];
+                pool->cached -= class_size;
+            }
+        }
+        if (ptr) {
+            return ptr;
+        }
+    }
+
+    /* Any buffer of this size may be kept when it is freed */
+    alignment = MAX(alignment, qemu_real_host_page_size());
+    return qemu_try_memalign(alignment, class_size);
+}
+
+void aio_buf_pool_free(AioContext *ctx, void *ptr, size_t size)
+{
+    int idx = aio_buf_pool_class(size);
+    size_t class_size;
+
+    if (!ptr) {
+        return;
+    }
+    if (!ctx || idx < 0) {
+        qemu_vfree(ptr);
+        return;
+    }
+    class_size = (size_t)1 << (idx + AIO_BUF_POOL_MIN_SHIFT);
+
+    WITH_QEMU_LOCK_GUARD(&ctx->buf_pool.lock) {
+        AioBufPool *pool = &ctx->buf_pool;
+
+        if (pool->nb_bufs[idx] < AIO_BUF_POOL_DEPTH &&
+            pool->cached + class_size <= AIO_BUF_POOL_MAX_CACHED) {
+            pool->bufs[idx][pool->nb_bufs[idx]++] = ptr;
+            pool->cached += class_size;
+            return;
+        }
+    }
+    qemu_vfree(ptr);
+}
+
 #ifdef CONFIG_LINUX_AIO
 LinuxAioState *aio_setup_linux_aio(AioContext *ctx, Error **errp)
 {
@@ -478,6 +571,7 @@ void aio_notify(AioContext *ctx)
     smp_mb();
     if (qatomic_read(&ctx->notify_me)) {
         event_notifier_set(&ctx->notifier);
+        stat64_inc(&ctx->wakeups);
     }
 }
 
@@ -604,6 +698,7 @@ AioContext *aio_context_new(Error **errp)
     ctx->thread_pool = NULL;
     qemu_rec_mutex_init(&ctx->lock);
     timerlistgroup_init(&ctx->tlg, aio_timerlist_notify, ctx);
+    qemu_mutex_init(&ctx->buf_pool.lock);
 
     ctx->poll_max_ns = 0;
     ctx->poll_grow = 0;
@@ -25,7 +25,10 @@
  *
  * File descriptor monitoring is implemented using the following operations:
  *
- * 1. IORING_OP_POLL_ADD - adds a file descriptor to be monitored.
+ * 1. IORING_OP_POLL_ADD - adds a file descriptor to be monitored.  It is
+ *    one-shot and re-armed after each completion, except for handlers whose
+ *    io_read() drains the file descriptor (EventNotifiers).  Those use
+ *    multishot poll, which stays armed until removed, if the kernel has it.
  * 2. IORING_OP_POLL_REMOVE - removes a file descriptor being monitored.  When
  *    the poll mask changes for a file descriptor it is first removed and then
  *    re-added with the new poll mask, so this operation is also used as part
@@ -47,7 +50,9 @@
 #include <poll.h>
 #include "qapi/error.h"
 #include "qemu/defer-call.h"
+#include "qemu/lockable.h"
 #include "qemu/rcu_queue.h"
+#include "qemu/units.h"
 #include "aio-posix.h"
 #include "trace.h"
 
@@ -98,6 +103,11 @@ static struct io_uring_sqe *get_sqe(AioContext *ctx)
 
     assert(ret > 1);
     sqe = io_uring_get_sqe(ring);
+    while (!sqe && (ring->flags & IORING_SETUP_SQPOLL)) {
+        /* The kernel poller thread has not picked up the sqes yet */
+        io_uring_sqring_wait(ring);
+        sqe = io_uring_get_sqe(ring);
+    }
     assert(sqe);
     return sqe;
 }
@@ -191,12 +201,26 @@ static void fdmon_special_cqe_handler(CqeHandler *cqe_handler)
      */
 }
 
+#ifdef HAVE_IO_URING_PREP_POLL_MULTISHOT
+/* Set when the kernel rejects IORING_POLL_ADD_MULTI */
+static bool poll_multishot_unsupported;
+#endif
+
 static void add_poll_add_sqe(AioContext *ctx, AioHandler *node)
 {
     struct io_uring_sqe *sqe = get_sqe(ctx);
     int events = poll_events_from_pfd(node->pfd.events);
 
-    io_uring_prep_poll_add(sqe, node->pfd.fd, events);
+#ifdef HAVE_IO_URING_PREP_POLL_MULTISHOT
+    node->poll_multishot = node->drains_fd &&
+                           !qatomic_read(&poll_multishot_unsupported);
+    if (node->poll_multishot) {
+        io_uring_prep_poll_multishot(sqe, node->pfd.fd, events);
+    } else
+#endif
+    {
+        io_uring_prep_poll_add(sqe, node->pfd.fd, events);
+    }
     node->internal_cqe_handler.cb = fdmon_special_cqe_handler;
     io_uring_sqe_set_data(sqe, &node->internal_cqe_handler);
 }
@@ -251,6 +275,17 @@ static bool process_cqe_aio_handler(AioContext *ctx,
 {
     unsigned flags;
 
+#ifdef HAVE_IO_URING_PREP_POLL_MULTISHOT
+    if (cqe->flags & IORING_CQE_F_MORE) {
+        /* Multishot poll is still armed, this is not its last cqe */
+        if (qatomic_read(&node->flags) & FDMON_IO_URING_REMOVE) {
+            return false;
+        }
+        aio_add_ready_handler(ready_list, node, pfd_events_from_poll(cqe->res));
+        return true;
+    }
+#endif
+
     /*
      * Deletion can only happen when IORING_OP_POLL_ADD completes.  If we race
      * with enqueue() here then we can safely clear the FDMON_IO_URING_REMOVE
@@ -267,9 +302,21 @@ static bool process_cqe_aio_handler(AioContext *ctx,
         return false;
     }
 
+#ifdef HAVE_IO_URING_PREP_POLL_MULTISHOT
+    if (cqe->res == -EINVAL && node->poll_multishot) {
+        /* Kernel older than 5.13, fall back to one-shot poll */
+        qatomic_set(&poll_multishot_unsupported, true);
+        add_poll_add_sqe(ctx, node);
+        return false;
+    }
+#endif
+
     aio_add_ready_handler(ready_list, node, pfd_events_from_poll(cqe->res));
 
-    /* IORING_OP_POLL_ADD is one-shot so we must re-arm it */
+    /*
+     * IORING_OP_POLL_ADD is one-shot, and multishot poll may also terminate
+     * (e.g. on cq ring overflow), so we must re-arm it
+     */
     add_poll_add_sqe(ctx, node);
     return true;
 }
@@ -441,6 +488,364 @@ static bool fdmon_io_uring_need_wait(AioContext *ctx)
     return false;
 }
 
+/*
+ * Fixed buffers and files
+ *
+ * Buffers and files can be registered with the rings so that requests refer
+ * to them by index, which saves the kernel from pinning the pages and looking
+ * up the file for every request.  Each buffer or file has the same index in
+ * all rings, so the indices can be looked up without knowing the ring.  The
+ * table is only modified with fixed_lock held and is published with RCU, so
+ * lookups from any AioContext thread are lock-free.
+ */
+enum {
+    FDMON_IO_URING_FIXED_BUFS   = 1024,
+    FDMON_IO_URING_FIXED_FILES  = 64,
+};
+
+/* The kernel rejects registered buffers that are larger than this */
+#define FDMON_IO_URING_MAX_FIXED_BUF (1 * GiB)
+
+typedef struct {
+    struct rcu_head rcu;
+    struct iovec bufs[FDMON_IO_URING_FIXED_BUFS]; /* iov_base NULL if unused */
+    unsigned buf_refcnt[FDMON_IO_URING_FIXED_BUFS];
+    int sorted_bufs[FDMON_IO_URING_FIXED_BUFS];   /* used indices by address */
+    int nb_sorted_bufs;
+    int files[FDMON_IO_URING_FIXED_FILES];        /* -1 if unused */
+    unsigned file_refcnt[FDMON_IO_URING_FIXED_FILES];
+} FixedTable;
+
+static QemuMutex fixed_lock;
+static FixedTable *fixed_table;     /* RCU, modified with fixed_lock held */
+static GPtrArray *fixed_rings;      /* AioContexts with registered tables */
+static bool fixed_disabled;         /* registration failed, don't use table */
+
+static void __attribute__((__constructor__)) fixed_init(void)
+{
+    int i;
+
+    qemu_mutex_init(&fixed_lock);
+    fixed_rings = g_ptr_array_new();
+    fixed_table = g_new0(FixedTable, 1);
+    for (i = 0; i < FDMON_IO_URING_FIXED_FILES; i++) {
+        fixed_table->files[i] = -1;
+    }
+}
+
+/* Called with fixed_lock held */
+static void fixed_disable(const char *what, int ret)
+{
+    trace_fdmon_io_uring_fixed_disabled(what, ret);
+    qatomic_set(&fixed_disabled, true);
+}
+
+/* Called with fixed_lock held */
+static void fixed_table_publish(FixedTable *t)
+{
+    FixedTable *old = fixed_table;
+
+    qatomic_rcu_set(&fixed_table, t);
+    g_free_rcu(old, rcu);
+}
+
+#ifdef HAVE_IO_URING_REGISTER_BUFFERS_SPARSE
+static int fixed_ring_update(AioContext *ctx, bool file, int index,
+                             const struct iovec *iov, int fd)
+{
+    struct io_uring *ring = &ctx->fdmon_io_uring;
+    __u64 tag = 0;
+    int ret;
+
+    if (file) {
+        ret = io_uring_register_files_update(ring, index, &fd, 1);
+    } else {
+        ret = io_uring_register_buffers_update_tag(ring, index, iov, &tag, 1);
+    }
+    return ret < 0 ? ret : 0;
+}
+#else
+static int fixed_ring_update(AioContext *ctx, bool file, int index,
+                             const struct iovec *iov, int fd)
+{
+    return -ENOTSUP;
+}
+#endif
+
+/*
+ * Sets the buffer (if @file is false) or file at @index in all rings.  If this
+ * fails for one of the rings, the entry is cleared in all rings again.
+ *
+ * Called with fixed_lock held.
+ */
+static bool fixed_update(bool file, int index, const struct iovec *iov, int fd)
+{
+    static const struct iovec empty_iov;
+    unsigned i, j;
+    int ret;
+
+    for (i = 0; i < fixed_rings->len; i++) {
+        ret = fixed_ring_update(g_ptr_array_index(fixed_rings, i), file,
+                                index, iov, fd);
+        if (ret < 0) {
+            trace_fdmon_io_uring_fixed_update_failed(file, index, ret);
+            for (j = 0; j < i; j++) {
+                fixed_ring_update(g_ptr_array_index(fixed_rings, j), file,
+                                  index, &empty_iov, -1);
+            }
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Called with fixed_lock held */
+static void fixed_ring_add(AioContext *ctx)
+{
+#ifdef HAVE_IO_URING_REGISTER_BUFFERS_SPARSE
+    struct io_uring *ring = &ctx->fdmon_io_uring;
+    FixedTable *t = fixed_table;
+    int i, ret;
+
+    if (fixed_disabled) {
+        return;
+    }
+
+    ret = io_uring_register_buffers_sparse(ring, FDMON_IO_URING_FIXED_BUFS);
+    if (ret < 0) {
+        fixed_disable("buffers", ret);
+        return;
+    }
+    ret = io_uring_register_files_sparse(ring, FDMON_IO_URING_FIXED_FILES);
+    if (ret < 0) {
+        fixed_disable("files", ret);
+        return;
+    }
+
+    /* Catch up with the entries registered before this ring was created */
+    for (i = 0; i < FDMON_IO_URING_FIXED_BUFS; i++) {
+        if (t->bufs[i].iov_base) {
+            ret = fixed_ring_update(ctx, false, i, &t->bufs[i], -1);
+            if (ret < 0) {
+                fixed_disable("buffers", ret);
+                return;
+            }
+        }
+    }
+    for (i = 0; i < FDMON_IO_URING_FIXED_FILES; i++) {
+        if (t->files[i] != -1) {
+            ret = fixed_ring_update(ctx, true, i, NULL, t->files[i]);
+            if (ret < 0) {
+                fixed_disable("files", ret);
+                return;
+            }
+        }
+    }
+
+    g_ptr_array_add(fixed_rings, ctx);
+#else
+    fixed_disable("buffers", -ENOTSUP);
+#endif
+}
+
+/* Registers one chunk of a buffer.  Called with fixed_lock held. */
+static void fixed_register_buf_chunk(FixedTable *t, void *host, size_t size)
+{
+    struct iovec iov = { .iov_base = host, .iov_len = size };
+    int i, free_index = -1;
+
+    for (i = 0; i < FDMON_IO_URING_FIXED_BUFS; i++) {
+        if (t->bufs[i].iov_base == host && t->bufs[i].iov_len == size) {
+            t->buf_refcnt[i]++;
+            return;
+        }
+        if (!t->bufs[i].iov_base && free_index < 0) {
+            free_index = i;
+        }
+    }
+
+    if (free_index < 0 || !fixed_update(false, free_index, &iov, -1)) {
+        return;
+    }
+
+    t->bufs[free_index] = iov;
+    t->buf_refcnt[free_index] = 1;
+
+    for (i = t->nb_sorted_bufs; i > 0; i--) {
+        if (t->bufs[t->sorted_bufs[i - 1]].iov_base < host) {
+            break;
+        }
+        t->sorted_bufs[i] = t->sorted_bufs[i - 1];
+    }
+    t->sorted_bufs[i] = free_index;
+    t->nb_sorted_bufs++;
+}
+
+/* Called with fixed_lock held */
+static void fixed_unregister_buf_chunk(FixedTable *t, void *host, size_t size)
+{
+    static const struct iovec empty_iov;
+    int i, j;
+
+    for (i = 0; i < FDMON_IO_URING_FIXED_BUFS; i++) {
+        if (t->bufs[i].iov_base == host && t->bufs[i].iov_len == size) {
+            break;
+        }
+    }
+    if (i == FDMON_IO_URING_FIXED_BUFS || --t->buf_refcnt[i] > 0) {
+        return;
+    }
+
+    fixed_update(false, i, &empty_iov, -1);
+    t->bufs[i] = empty_iov;
+
+    j = 0;
+    while (t->sorted_bufs[j] != i) {
+        j++;
+    }
+    t->nb_sorted_bufs--;
+    memmove(&t->sorted_bufs[j], &t->sorted_bufs[j + 1],
+            (t->nb_sorted_bufs - j) * sizeof(t->sorted_bufs[0]));
+}
+
+void aio_register_fixed_buf(void *host, size_t size)
+{
+    FixedTable *t;
+    size_t done;
+
+    QEMU_LOCK_GUARD(&fixed_lock);
+    if (fixed_disabled) {
+        return;
+    }
+
+    t = g_memdup2(fixed_table, sizeof(*t));
+    for (done = 0; done < size; done += FDMON_IO_URING_MAX_FIXED_BUF) {
+        fixed_register_buf_chunk(t, host + done,
+                                 MIN(size - done, FDMON_IO_URING_MAX_FIXED_BUF));
+    }
+    fixed_table_publish(t);
+}
+
+void aio_unregister_fixed_buf(void *host, size_t size)
+{
+    FixedTable *t;
+    size_t done;
+
+    QEMU_LOCK_GUARD(&fixed_lock);
+    t = g_memdup2(fixed_table, sizeof(*t));
+    for (done = 0; done < size; done += FDMON_IO_URING_MAX_FIXED_BUF) {
+        fixed_unregister_buf_chunk(t, host + done,
+                                   MIN(size - done,
+                                       FDMON_IO_URING_MAX_FIXED_BUF));
+    }
+    fixed_table_publish(t);
+}
+
+void aio_register_fixed_file(int fd)
+{
+    FixedTable *t;
+    int i, free_index = -1;
+
+    QEMU_LOCK_GUARD(&fixed_lock);
+    if (fixed_disabled) {
+        return;
+    }
+
+    t = g_memdup2(fixed_table, sizeof(*t));
+    for (i = 0; i < FDMON_IO_URING_FIXED_FILES; i++) {
+        if (t->files[i] == fd) {
+            t->file_refcnt[i]++;
+            goto out;
+        }
+        if (t->files[i] == -1 && free_index < 0) {
+            free_index = i;
+        }
+    }
+
+    if (free_index >= 0 && fixed_update(true, free_index, NULL, fd)) {
+        t->files[free_index] = fd;
+        t->file_refcnt[free_index] = 1;
+    }
+
+out:
+    fixed_table_publish(t);
+}
+
+void aio_unregister_fixed_file(int fd)
+{
+    FixedTable *t;
+    int i;
+
+    QEMU_LOCK_GUARD(&fixed_lock);
+    t = g_memdup2(fixed_table, sizeof(*t));
+    for (i = 0; i < FDMON_IO_URING_FIXED_FILES; i++) {
+        if (t->files[i] == fd) {
+            if (--t->file_refcnt[i] == 0) {
+                fixed_update(true, i, NULL, -1);
+                t->files[i] = -1;
+            }
+            break;
+        }
+    }
+    fixed_table_publish(t);
+}
+
+int aio_get_fixed_buf_index(const void *addr, size_t len)
+{
+    FixedTable *t;
+    int lo, hi;
+
+    if (qatomic_read(&fixed_disabled)) {
+        return -1;
+    }
+
+    RCU_READ_LOCK_GUARD();
+    t = qatomic_rcu_read(&fixed_table);
+
+    /* Find the last buffer that starts at or before @addr */
+    lo = 0;
+    hi = t->nb_sorted_bufs;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+
+        if (t->bufs[t->sorted_bufs[mid]].iov_base <= addr) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (lo > 0) {
+        int index = t->sorted_bufs[lo - 1];
+        const struct iovec *iov = &t->bufs[index];
+
+        if (len <= iov->iov_len &&
+            addr - iov->iov_base <= iov->iov_len - len) {
+            return index;
+        }
+    }
+    return -1;
+}
+
+int aio_get_fixed_file_index(int fd)
+{
+    FixedTable *t;
+    int i;
+
+    if (qatomic_read(&fixed_disabled)) {
+        return -1;
+    }
+
+    RCU_READ_LOCK_GUARD();
+    t = qatomic_rcu_read(&fixed_table);
+    for (i = 0; i < FDMON_IO_URING_FIXED_FILES; i++) {
+        if (t->files[i] == fd) {
+            return i;
+        }
+    }
+    return -1;
+}
+
 static const FDMonOps fdmon_io_uring_ops = {
     .update = fdmon_io_uring_update,
     .wait = fdmon_io_uring_wait,
@@ -464,6 +869,10 @@ bool fdmon_io_uring_setup(AioContext *ctx, Error **errp)
         return false;
     }
 
+    WITH_QEMU_LOCK_GUARD(&fixed_lock) {
+        fixed_ring_add(ctx);
+    }
+
     QSLIST_INIT(&ctx->submit_list);
     QSIMPLEQ_INIT(&ctx->cqe_handler_ready_list);
     ctx->fdmon_ops = &fdmon_io_uring_ops;
@@ -472,6 +881,47 @@ bool fdmon_io_uring_setup(AioContext *ctx, Error **errp)
     return true;
 }
 
+bool fdmon_io_uring_set_sqpoll(AioContext *ctx, int cpu, Error **errp)
+{
+    struct io_uring_params params = {
+        .flags = IORING_SETUP_SQPOLL,
+    };
+    struct io_uring ring;
+    int ret;
+
+    if (ctx->fdmon_ops != &fdmon_io_uring_ops) {
+        error_setg(errp, "io_uring is not available");
+        return false;
+    }
+
+    /* Nothing may have been submitted to the old ring yet */
+    assert(!io_uring_sq_ready(&ctx->fdmon_io_uring));
+
+    if (cpu >= 0) {
+        params.flags |= IORING_SETUP_SQ_AFF;
+        params.sq_thread_cpu = cpu;
+    }
+
+    ret = io_uring_queue_init_params(FDMON_IO_URING_ENTRIES, &ring, &params);
+    if (ret != 0) {
+        error_setg_errno(errp, -ret, "Failed to initialize io_uring with "
+                         "submission queue polling");
+        return false;
+    }
+
+    WITH_QEMU_LOCK_GUARD(&fixed_lock) {
+        g_ptr_array_remove(fixed_rings, ctx);
+        io_uring_queue_exit(&ctx->fdmon_io_uring);
+        ctx->fdmon_io_uring = ring;
+        fixed_ring_add(ctx);
+    }
+
+    g_source_remove_unix_fd(&ctx->source, ctx->io_uring_fd_tag);
+    ctx->io_uring_fd_tag = g_source_add_unix_fd(&ctx->source,
+            ctx->fdmon_io_uring.ring_fd, G_IO_IN);
+    return true;
+}
+
 void fdmon_io_uring_destroy(AioContext *ctx)
 {
     AioHandler *node;
@@ -480,6 +930,10 @@ void fdmon_io_uring_destroy(AioContext *ctx)
         return;
     }
 
+    WITH_QEMU_LOCK_GUARD(&fixed_lock) {
+        g_ptr_array_remove(fixed_rings, ctx);
+    }
+
     io_uring_queue_exit(&ctx->fdmon_io_uring);
 
     /* Move handlers due to be removed onto the deleted list */
@@ -12,8 +12,10 @@
 #include "qemu/osdep.h"
 #include "qemu/hbitmap.h"
 #include "qemu/host-utils.h"
+#include "qemu/stats64.h"
 #include "trace.h"
 #include "crypto/hash.h"
+#include "host/cpuinfo.h"
 
 /* HBitmaps provides an array of bits.  The bits are stored as usual in an
  * array of unsigned longs, but HBitmap is also optimized to provide fast
@@ -64,6 +66,9 @@ struct HBitmap {
     /* Number of set bits in the bottom level.  */
     uint64_t count;
 
+    /* Bits set by hbitmap_set_atomic(), to be added to count.  */
+    Stat64 count_delta;
+
     /* A scaling factor.  Given a granularity of G, each bit in the bitmap will
      * will actually represent a group of 2^G elements.  Each operation on a
      * range of bits first rounds the bits to determine which group they land
@@ -101,6 +106,61 @@ struct HBitmap {
     uint64_t sizes[HBITMAP_LEVELS];
 };
 
+/* Return the index of the first word in [pos, end) of @p that is not
+ * @skip, or @end if there is none.  @skip must be 0 or ~0UL.
+ */
+static size_t hb_find_word_int(const unsigned long *p, size_t pos, size_t end,
+                               unsigned long skip)
+{
+    while (pos < end && p[pos] == skip) {
+        pos++;
+    }
+    return pos;
+}
+
+/* Store a[i] | b[i] into dst[i] for @n words, and return the number of bits
+ * set in the result.  @dst may be the same array as @a or @b.
+ */
+static uint64_t hb_or_words_int(unsigned long *dst, const unsigned long *a,
+                                const unsigned long *b, size_t n)
+{
+    uint64_t count = 0;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        dst[i] = a[i] | b[i];
+        count += ctpopl(dst[i]);
+    }
+    return count;
+}
+
+typedef struct HBitmapAccel {
+    size_t (*find_word)(const unsigned long *p, size_t pos, size_t end,
+                        unsigned long skip);
+    uint64_t (*or_words)(unsigned long *dst, const unsigned long *a,
+                         const unsigned long *b, size_t n);
+} HBitmapAccel;
+
+#include "host/hbitmap.c.inc"
+
+static const HBitmapAccel *hb_accel;
+static unsigned accel_index;
+
+bool test_hbitmap_next_accel(void)
+{
+    if (accel_index != 0) {
+        hb_accel = &accel_table[--accel_index];
+        return true;
+    }
+    return false;
+}
+
+static void __attribute__((constructor)) init_accel(void)
+{
+    accel_index = best_accel();
+    hb_accel = &accel_table[accel_index];
+}
+
 /* Advance hbi to the next nonzero word and return it.  hbi->pos
  * is updated.  Returns zero if we reach the end of the bitmap.
  */
@@ -245,10 +305,7 @@ int64_t hbitmap_next_zero(const HBitmap *hb, int64_t start, int64_t count)
     assert((start >> hb->granularity) < hb->size);
 
     if (cur == (unsigned long)-1) {
-        do {
-            pos++;
-        } while (pos < sz && last_lev[pos] == (unsigned long)-1);
-
+        pos = hb_accel->find_word(last_lev, pos + 1, sz, ~0UL);
         if (pos >= sz) {
             return -1;
         }
@@ -336,7 +393,7 @@ bool hbitmap_status(const HBitmap *hb, int64_t start, int64_t count,
 
 bool hbitmap_empty(const HBitmap *hb)
 {
-    return hb->count == 0;
+    return hb->count + stat64_get(&hb->count_delta) == 0;
 }
 
 int hbitmap_granularity(const HBitmap *hb)
@@ -346,7 +403,7 @@ int hbitmap_granularity(const HBitmap *hb)
 
 uint64_t hbitmap_count(const HBitmap *hb)
 {
-    return hb->count << hb->granularity;
+    return (hb->count + stat64_get(&hb->count_delta)) << hb->granularity;
 }
 
 /**
@@ -486,6 +543,66 @@ void hbitmap_set(HBitmap *hb, uint64_t start, uint64_t count)
     }
 }
 
+/* Same as hb_set_between, but concurrent calls are allowed.  Words that
+ * already have all the bits are only read, and the upper level is only
+ * updated when a word stops being zero.  Returns the number of bits that
+ * were changed.
+ */
+static uint64_t hb_set_between_atomic(HBitmap *hb, int level, uint64_t start,
+                                      uint64_t last)
+{
+    size_t pos = start >> BITS_PER_LEVEL;
+    size_t lastpos = last >> BITS_PER_LEVEL;
+    uint64_t changed = 0;
+    size_t i;
+
+    for (i = pos; i <= lastpos; i++) {
+        unsigned long *elem = &hb->levels[level][i];
+        unsigned long mask = ~0UL;
+        unsigned long old;
+
+        if (i == lastpos) {
+            mask = (2UL << (last & (BITS_PER_LONG - 1))) - 1;
+        }
+        if (i == pos) {
+            mask &= ~0UL << (start & (BITS_PER_LONG - 1));
+        }
+
+        if ((qatomic_read(elem) & mask) == mask) {
+            continue;
+        }
+        old = qatomic_fetch_or(elem, mask);
+        changed += ctpopl(mask & ~old);
+        if (level > 0 && !old) {
+            hb_set_between_atomic(hb, level - 1, i, i);
+        }
+    }
+    return changed;
+}
+
+void hbitmap_set_atomic(HBitmap *hb, uint64_t start, uint64_t count)
+{
+    /* Compute range in the last layer.  */
+    uint64_t first, changed;
+    uint64_t last = start + count - 1;
+
+    if (count == 0) {
+        return;
+    }
+
+    first = start >> hb->granularity;
+    last >>= hb->granularity;
+    assert(last < hb->size);
+
+    changed = hb_set_between_atomic(hb, HBITMAP_LEVELS - 1, first, last);
+    if (changed) {
+        stat64_add(&hb->count_delta, changed);
+        if (hb->meta) {
+            hbitmap_set_atomic(hb->meta, start, count);
+        }
+    }
+}
+
 /* Resetting works the other way round: propagate up if the new
  * value is zero.
  */
@@ -594,6 +711,7 @@ void hbitmap_reset_all(HBitmap *hb)
 
     hb->levels[0][0] = 1UL << (BITS_PER_LONG - 1);
     hb->count = 0;
+    stat64_set(&hb->count_delta, 0);
 }
 
 bool hbitmap_is_serializable(const HBitmap *hb)
@@ -779,6 +897,7 @@ void hbitmap_deserialize_finish(HBitmap *bitmap)
 
     bitmap->levels[0][0] |= 1UL << (BITS_PER_LONG - 1);
     bitmap->count = hb_count_between(bitmap, 0, bitmap->size - 1);
+    stat64_set(&bitmap->count_delta, 0);
 }
 
 void hbitmap_free(HBitmap *hb)
@@ -901,7 +1020,6 @@ static void hbitmap_sparse_merge(HBitmap *dst, const HBitmap *src)
 void hbitmap_merge(const HBitmap *a, const HBitmap *b, HBitmap *result)
 {
     int i;
-    uint64_t j;
 
     assert(a->orig_size == result->orig_size);
     assert(b->orig_size == result->orig_size);
@@ -932,16 +1050,18 @@ void hbitmap_merge(const HBitmap *a, const HBitmap *b, HBitmap *result)
     /* This merge is O(size), as BITS_PER_LONG and HBITMAP_LEVELS are constant.
      * It may be possible to improve running times for sparsely populated maps
      * by using hbitmap_iter_next, but this is suboptimal for dense maps.
+     * The dirty count is recomputed while merging the last level; no bits
+     * are set past the end of the bitmap there.
      */
     assert(a->size == b->size);
-    for (i = HBITMAP_LEVELS - 1; i >= 0; i--) {
-        for (j = 0; j < a->sizes[i]; j++) {
-            result->levels[i][j] = a->levels[i][j] | b->levels[i][j];
-        }
+    i = HBITMAP_LEVELS - 1;
+    result->count = hb_accel->or_words(result->levels[i], a->levels[i],
+                                       b->levels[i], a->sizes[i]);
+    while (i-- > 0) {
+        hb_accel->or_words(result->levels[i], a->levels[i], b->levels[i],
+                           a->sizes[i]);
     }
-
-    /* Recompute the dirty count */
-    result->count = hb_count_between(result, 0, result->size - 1);
+    stat64_set(&result->count_delta, 0);
 }
 
 char *hbitmap_sha256(const HBitmap *bitmap, Error **errp)
@@ -175,6 +175,32 @@ static RBNode *rb_next(RBNode *node)
     return parent;
 }
 
+static RBNode *rb_prev(RBNode *node)
+{
+    RBNode *parent;
+
+    /*
+     * If we have a left-hand child, go down and then right as far as we can.
+     */
+    if (node->rb_left) {
+        node = node->rb_left;
+        while (node->rb_right) {
+            node = node->rb_right;
+        }
+        return node;
+    }
+
+    /*
+     * No left-hand children. Go up till we find an ancestor which
+     * is a right-hand child of its parent.
+     */
+    while ((parent = rb_parent(node)) && node == parent->rb_left) {
+        node = parent;
+    }
+
+    return parent;
+}
+
 static inline void rb_change_child(RBNode *old, RBNode *new,
                                    RBNode *parent, RBRoot *root)
 {
@@ -870,6 +896,221 @@ IntervalTreeNode *interval_tree_iter_next(IntervalTreeNode *node,
     }
 }
 
+/*
+ * Gap trees.
+ *
+ * Derived from the vm_area_struct rb_subtree_gap augmentation that Linux
+ * used in mm/mmap.c to find unmapped areas, before maple trees.
+ *
+ * Each node records the number of free locations between the previous
+ * node and itself, and the largest such gap in its subtree.  A search for
+ * a free range can then skip every subtree without a large enough gap.
+ */
+
+#define rb_to_gtree(N)  container_of(N, IntervalGapTreeNode, rb)
+
+static bool interval_gap_tree_compute_max(IntervalGapTreeNode *node, bool exit)
+{
+    IntervalGapTreeNode *child;
+    uint64_t max = node->gap;
+
+    if (node->rb.rb_left) {
+        child = rb_to_gtree(node->rb.rb_left);
+        if (child->subtree_gap > max) {
+            max = child->subtree_gap;
+        }
+    }
+    if (node->rb.rb_right) {
+        child = rb_to_gtree(node->rb.rb_right);
+        if (child->subtree_gap > max) {
+            max = child->subtree_gap;
+        }
+    }
+    if (exit && node->subtree_gap == max) {
+        return true;
+    }
+    node->subtree_gap = max;
+    return false;
+}
+
+static void interval_gap_tree_propagate(RBNode *rb, RBNode *stop)
+{
+    while (rb != stop) {
+        IntervalGapTreeNode *node = rb_to_gtree(rb);
+        if (interval_gap_tree_compute_max(node, true)) {
+            break;
+        }
+        rb = rb_parent(&node->rb);
+    }
+}
+
+static void interval_gap_tree_copy(RBNode *rb_old, RBNode *rb_new)
+{
+    IntervalGapTreeNode *old = rb_to_gtree(rb_old);
+    IntervalGapTreeNode *new = rb_to_gtree(rb_new);
+
+    new->subtree_gap = old->subtree_gap;
+}
+
+static void interval_gap_tree_rotate(RBNode *rb_old, RBNode *rb_new)
+{
+    IntervalGapTreeNode *old = rb_to_gtree(rb_old);
+    IntervalGapTreeNode *new = rb_to_gtree(rb_new);
+
+    new->subtree_gap = old->subtree_gap;
+    interval_gap_tree_compute_max(old, false);
+}
+
+static const RBAugmentCallbacks interval_gap_tree_augment = {
+    .propagate = interval_gap_tree_propagate,
+    .copy = interval_gap_tree_copy,
+    .rotate = interval_gap_tree_rotate,
+};
+
+/* Update the gap of @node after its previous node changed */
+static void interval_gap_tree_update_gap(IntervalGapTreeNode *node,
+                                         IntervalGapTreeNode *prev)
+{
+    node->gap = node->start - (prev ? prev->last + 1 : 0);
+    interval_gap_tree_propagate(&node->rb, NULL);
+}
+
+void interval_gap_tree_insert(IntervalGapTreeNode *node,
+                              IntervalGapTreeRoot *root)
+{
+    RBNode **link = &root->rb_node, *rb_link_parent = NULL;
+    IntervalGapTreeNode *parent, *prev = NULL, *next = NULL;
+
+    while (*link) {
+        rb_link_parent = *link;
+        parent = rb_to_gtree(rb_link_parent);
+
+        if (node->start < parent->start) {
+            next = parent;
+            link = &parent->rb.rb_left;
+        } else {
+            prev = parent;
+            link = &parent->rb.rb_right;
+        }
+    }
+
+    node->gap = node->start - (prev ? prev->last + 1 : 0);
+    node->subtree_gap = node->gap;
+    for (RBNode *rb = rb_link_parent; rb; rb = rb_parent(rb)) {
+        parent = rb_to_gtree(rb);
+        if (parent->subtree_gap < node->gap) {
+            parent->subtree_gap = node->gap;
+        }
+    }
+
+    rb_link_node(&node->rb, rb_link_parent, link);
+    rb_insert_augmented(&node->rb, root, &interval_gap_tree_augment);
+
+    /* The new node splits the gap of the next one */
+    if (next) {
+        interval_gap_tree_update_gap(next, node);
+    }
+}
+
+void interval_gap_tree_remove(IntervalGapTreeNode *node,
+                              IntervalGapTreeRoot *root)
+{
+    RBNode *rb_prev_node = rb_prev(&node->rb);
+    RBNode *rb_next_node = rb_next(&node->rb);
+
+    rb_erase_augmented(&node->rb, root, &interval_gap_tree_augment);
+
+    /* The next node inherits the gap of the removed one */
+    if (rb_next_node) {
+        interval_gap_tree_update_gap(rb_to_gtree(rb_next_node),
+                                     rb_prev_node ? rb_to_gtree(rb_prev_node)
+                                                  : NULL);
+    }
+}
+
+/* Check the gap before @node, clamped to [begin, end] */
+static bool interval_gap_tree_fits(const IntervalGapTreeNode *node,
+                                   uint64_t begin, uint64_t end, uint64_t size,
+                                   uint64_t *start)
+{
+    uint64_t hole_start, hole_last;
+
+    if (node->gap <= size) {
+        return false;
+    }
+
+    hole_start = MAX(node->start - node->gap, begin);
+    hole_last = MIN(node->start - 1, end);
+    if (hole_start > hole_last || hole_last - hole_start < size) {
+        return false;
+    }
+
+    *start = hole_start;
+    return true;
+}
+
+static bool interval_gap_tree_subtree_find(const IntervalGapTreeNode *node,
+                                           uint64_t begin, uint64_t end,
+                                           uint64_t size, uint64_t *start)
+{
+    while (node && node->subtree_gap > size) {
+        /*
+         * Every gap of the left subtree ends before node->start, so it is
+         * only worth visiting if node->start is above begin.
+         */
+        if (node->rb.rb_left && node->start > begin &&
+            interval_gap_tree_subtree_find(rb_to_gtree(node->rb.rb_left),
+                                           begin, end, size, start)) {
+            return true;
+        }
+        if (interval_gap_tree_fits(node, begin, end, size, start)) {
+            return true;
+        }
+        /* Every gap of the right subtree starts after node->last */
+        if (node->last >= end || !node->rb.rb_right) {
+            return false;
+        }
+        node = rb_to_gtree(node->rb.rb_right);
+    }
+    return false;
+}
+
+bool interval_gap_tree_find_free(const IntervalGapTreeRoot *root,
+                                 uint64_t begin, uint64_t end, uint64_t size,
+                                 uint64_t *start)
+{
+    RBNode *rb = root->rb_node;
+    uint64_t hole_start;
+
+    if (begin > end) {
+        return false;
+    }
+
+    if (rb) {
+        if (interval_gap_tree_subtree_find(rb_to_gtree(rb), begin, end, size,
+                                           start)) {
+            return true;
+        }
+
+        /* Check the space after the last node */
+        while (rb->rb_right) {
+            rb = rb->rb_right;
+        }
+        if (rb_to_gtree(rb)->last >= end) {
+            return false;
+        }
+        hole_start = MAX(rb_to_gtree(rb)->last + 1, begin);
+    } else {
+        hole_start = begin;
+    }
+
+    if (end - hole_start < size) {
+        return false;
+    }
+    *start = hole_start;
+    return true;
+}
+
 /* Occasionally useful for calling from within the debugger. */
 #if 0
 static void debug_interval_tree_int(IntervalTreeNode *node,
@@ -11,50 +11,27 @@
 
 #include "qemu/osdep.h"
 #include "qemu/iova-tree.h"
+#include "qemu/interval-tree.h"
 
 struct IOVATree {
     GTree *tree;
-};
-
-/* Args to pass to iova_tree_alloc foreach function. */
-struct IOVATreeAllocArgs {
-    /* Size of the desired allocation */
-    size_t new_size;
-
-    /* The minimum address allowed in the allocation */
-    hwaddr iova_begin;
-
-    /* Map at the left of the hole, can be NULL if "this" is first one */
-    const DMAMap *prev;
-
-    /* Map at the right of the hole, can be NULL if "prev" is the last one */
-    const DMAMap *this;
-
-    /* If found, we fill in the IOVA here */
-    hwaddr iova_result;
 
-    /* Whether have we found a valid IOVA */
-    bool iova_found;
+    /* Free IOVA ranges, only tracked by trees keyed by IOVA */
+    IntervalGapTreeRoot gaps;
+    bool track_gaps;
 };
 
+/* A tree element.  The GTree frees it through the map key. */
+typedef struct IOVATreeEntry {
+    DMAMap map;
+    IntervalGapTreeNode node;
+} IOVATreeEntry;
+
 typedef struct IOVATreeFindIOVAArgs {
     const DMAMap *needle;
     const DMAMap *result;
 } IOVATreeFindIOVAArgs;
 
-/**
- * Iterate args to the next hole
- *
- * @args: The alloc arguments
- * @next: The next mapping in the tree. Can be NULL to signal the last one
- */
-static void iova_tree_alloc_args_iterate(struct IOVATreeAllocArgs *args,
-                                         const DMAMap *next)
-{
-    args->prev = args->this;
-    args->this = next;
-}
-
 static int iova_tree_compare(gconstpointer a, gconstpointer b, gpointer data)
 {
     const DMAMap *m1 = a, *m2 = b;
@@ -77,6 +54,7 @@ IOVATree *iova_tree_new(void)
 
     /* We don't have values actually, no need to free */
     iova_tree->tree = g_tree_new_full(iova_tree_compare, NULL, g_free, NULL);
+    iova_tree->track_gaps = true;
 
     return iova_tree;
 }
@@ -115,16 +93,23 @@ const DMAMap *iova_tree_find_iova(const IOVATree *tree, const DMAMap *map)
     return args.result;
 }
 
-static inline void iova_tree_insert_internal(GTree *gtree, DMAMap *range)
+static void iova_tree_insert_internal(IOVATree *tree, const DMAMap *map)
 {
+    IOVATreeEntry *entry = g_new0(IOVATreeEntry, 1);
+
+    memcpy(&entry->map, map, sizeof(entry->map));
+    if (tree->track_gaps) {
+        entry->node.start = map->iova;
+        entry->node.last = map->iova + map->size;
+        interval_gap_tree_insert(&entry->node, &tree->gaps);
+    }
+
     /* Key and value are sharing the same range data */
-    g_tree_insert(gtree, range, range);
+    g_tree_insert(tree->tree, &entry->map, &entry->map);
 }
 
 int iova_tree_insert(IOVATree *tree, const DMAMap *map)
 {
-    DMAMap *new;
-
     if (map->iova + map->size < map->iova || map->perm == IOMMU_NONE) {
         return IOVA_ERR_INVALID;
     }
@@ -134,10 +119,7 @@ int iova_tree_insert(IOVATree *tree, const DMAMap *map)
         return IOVA_ERR_OVERLAP;
     }
 
-    new = g_new0(DMAMap, 1);
-    memcpy(new, map, sizeof(*new));
-    iova_tree_insert_internal(tree->tree, new);
-
+    iova_tree_insert_internal(tree, map);
     return IOVA_OK;
 }
 
@@ -146,109 +128,32 @@ void iova_tree_remove(IOVATree *tree, DMAMap map)
     const DMAMap *overlap;
 
     while ((overlap = iova_tree_find(tree, &map))) {
-        g_tree_remove(tree->tree, overlap);
-    }
-}
+        if (tree->track_gaps) {
+            IOVATreeEntry *entry = container_of(overlap, IOVATreeEntry, map);
 
-/**
- * Try to find an unallocated IOVA range between prev and this elements.
- *
- * @args: Arguments to allocation
- *
- * Cases:
- *
- * (1) !prev, !this: No entries allocated, always succeed
- *
- * (2) !prev, this: We're iterating at the 1st element.
- *
- * (3) prev, !this: We're iterating at the last element.
- *
- * (4) prev, this: this is the most common case, we'll try to find a hole
- * between "prev" and "this" mapping.
- *
- * Note that this function assumes the last valid iova is HWADDR_MAX, but it
- * searches linearly so it's easy to discard the result if it's not the case.
- */
-static void iova_tree_alloc_map_in_hole(struct IOVATreeAllocArgs *args)
-{
-    const DMAMap *prev = args->prev, *this = args->this;
-    uint64_t hole_start, hole_last;
-
-    if (this && this->iova + this->size < args->iova_begin) {
-        return;
-    }
-
-    hole_start = MAX(prev ? prev->iova + prev->size + 1 : 0, args->iova_begin);
-    hole_last = this ? this->iova : HWADDR_MAX;
-
-    if (hole_last - hole_start > args->new_size) {
-        args->iova_result = hole_start;
-        args->iova_found = true;
+            interval_gap_tree_remove(&entry->node, &tree->gaps);
+        }
+        g_tree_remove(tree->tree, overlap);
     }
 }
 
-/**
- * Foreach dma node in the tree, compare if there is a hole with its previous
- * node (or minimum iova address allowed) and the node.
- *
- * @key: Node iterating
- * @value: Node iterating
- * @pargs: Struct to communicate with the outside world
- *
- * Return: false to keep iterating, true if needs break.
- */
-static gboolean iova_tree_alloc_traverse(gpointer key, gpointer value,
-                                         gpointer pargs)
-{
-    struct IOVATreeAllocArgs *args = pargs;
-    DMAMap *node = value;
-
-    assert(key == value);
-
-    iova_tree_alloc_args_iterate(args, node);
-    iova_tree_alloc_map_in_hole(args);
-    return args->iova_found;
-}
-
 int iova_tree_alloc_map(IOVATree *tree, DMAMap *map, hwaddr iova_begin,
                         hwaddr iova_last)
 {
-    struct IOVATreeAllocArgs args = {
-        .new_size = map->size,
-        .iova_begin = iova_begin,
-    };
+    uint64_t iova;
 
+    assert(tree->track_gaps);
     if (unlikely(iova_last < iova_begin)) {
         return IOVA_ERR_INVALID;
     }
 
-    /*
-     * Find a valid hole for the mapping
-     *
-     * Assuming low iova_begin, so no need to do a binary search to
-     * locate the first node.
-     *
-     * TODO: Replace all this with g_tree_node_first/next/last when available
-     * (from glib since 2.68). To do it with g_tree_foreach complicates the
-     * code a lot.
-     *
-     */
-    g_tree_foreach(tree->tree, iova_tree_alloc_traverse, &args);
-    if (!args.iova_found) {
-        /*
-         * Either tree is empty or the last hole is still not checked.
-         * g_tree_foreach does not compare (last, iova_last] range, so we check
-         * it here.
-         */
-        iova_tree_alloc_args_iterate(&args, NULL);
-        iova_tree_alloc_map_in_hole(&args);
-    }
-
-    if (!args.iova_found || args.iova_result + map->size > iova_last) {
+    /* Find the lowest hole that fits the mapping */
+    if (!interval_gap_tree_find_free(&tree->gaps, iova_begin, iova_last,
+                                     map->size, &iova)) {
         return IOVA_ERR_NOMEM;
     }
 
-    map->iova = args.iova_result;
+    map->iova = iova;
     return iova_tree_insert(tree, map);
 }
 
@@ -285,8 +190,6 @@ IOVATree *gpa_tree_new(void)
 
 int gpa_tree_insert(IOVATree *tree, const DMAMap *map)
 {
-    DMAMap *new;
-
     if (map->translated_addr + map->size < map->translated_addr ||
         map->perm == IOMMU_NONE) {
         return IOVA_ERR_INVALID;
@@ -297,9 +200,6 @@ int gpa_tree_insert(IOVATree *tree, const DMAMap *map)
         return IOVA_ERR_OVERLAP;
     }
 
-    new = g_new0(DMAMap, 1);
-    memcpy(new, map, sizeof(*new));
-    iova_tree_insert_internal(tree->tree, new);
-
+    iova_tree_insert_internal(tree, map);
     return IOVA_OK;
 }
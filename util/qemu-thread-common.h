@@ -41,7 +41,7 @@ static inline void qemu_mutex_post_lock(QemuMutex *mutex,
 #endif
     trace_qemu_mutex_locked(mutex, file, line);
     if (mutex_is_bql(mutex)) {
-        bql_update_status(true);
+        bql_update_status(true, file, line);
     }
 }
 
@@ -54,7 +54,7 @@ static inline void qemu_mutex_pre_unlock(QemuMutex *mutex,
 #endif
     trace_qemu_mutex_unlock(mutex, file, line);
     if (mutex_is_bql(mutex)) {
-        bql_update_status(false);
+        bql_update_status(false, file, line);
     }
 }
 
@@ -67,7 +67,19 @@ static QEMUClock qemu_clocks[QEMU_CLOCK_MAX];
 struct QEMUTimerList {
     QEMUClock *clock;
     QemuMutex active_timers_lock;
+
+    /*
+     * Binary min-heap of the pending timers, ordered by expire_time and
+     * then by seq so that timers expiring at the same time run in the order
+     * they were armed.  active_timers mirrors heap[0] and is also read
+     * without the lock, to check quickly whether any timer is pending.
+     */
+    QEMUTimer **heap;
+    unsigned heap_len;
+    unsigned heap_size;
+    uint64_t seq;
     QEMUTimer *active_timers;
+
     QLIST_ENTRY(QEMUTimerList) list;
     QEMUTimerListNotifyCB *notify_cb;
     void *notify_opaque;
@@ -118,6 +130,7 @@ void timerlist_free(QEMUTimerList *timer_list)
         QLIST_REMOVE(timer_list, list);
     }
     qemu_mutex_destroy(&timer_list->active_timers_lock);
+    g_free(timer_list->heap);
     g_free(timer_list);
 }
 
@@ -268,8 +281,16 @@ int64_t qemu_clock_deadline_ns_all(QEMUClockType type, int attr_mask)
         qemu_mutex_lock(&timer_list->active_timers_lock);
         ts = timer_list->active_timers;
         /* Skip all external timers */
-        while (ts && (ts->attributes & ~attr_mask)) {
-            ts = ts->next;
+        if (ts && (ts->attributes & ~attr_mask)) {
+            ts = NULL;
+            for (unsigned i = 1; i < timer_list->heap_len; i++) {
+                QEMUTimer *t = timer_list->heap[i];
+
+                if (!(t->attributes & ~attr_mask) &&
+                    (!ts || t->expire_time < ts->expire_time)) {
+                    ts = t;
+                }
+            }
         }
         if (!ts) {
             qemu_mutex_unlock(&timer_list->active_timers_lock);
@@ -369,43 +390,102 @@ void timer_deinit(QEMUTimer *ts)
     ts->timer_list = NULL;
 }
 
-static void timer_del_locked(QEMUTimerList *timer_list, QEMUTimer *ts)
+static bool timer_before(const QEMUTimer *a, const QEMUTimer *b)
 {
-    QEMUTimer **pt, *t;
+    return a->expire_time < b->expire_time ||
+           (a->expire_time == b->expire_time && a->seq < b->seq);
+}
 
-    ts->expire_time = -1;
-    pt = &timer_list->active_timers;
-    for(;;) {
-        t = *pt;
-        if (!t)
-            break;
-        if (t == ts) {
-            qatomic_set(pt, t->next);
+static void timer_heap_set(QEMUTimerList *timer_list, unsigned i,
+                           QEMUTimer *ts)
+{
+    timer_list->heap[i] = ts;
+    ts->heap_index = i;
+}
+
+static void timer_heap_sift_up(QEMUTimerList *timer_list, unsigned i)
+{
+    QEMUTimer *ts = timer_list->heap[i];
+
+    while (i > 0) {
+        unsigned parent = (i - 1) / 2;
+
+        if (!timer_before(ts, timer_list->heap[parent])) {
             break;
         }
-        pt = &t->next;
+        timer_heap_set(timer_list, i, timer_list->heap[parent]);
+        i = parent;
     }
+    timer_heap_set(timer_list, i, ts);
 }
 
-static bool timer_mod_ns_locked(QEMUTimerList *timer_list,
-                                QEMUTimer *ts, int64_t expire_time)
+static void timer_heap_sift_down(QEMUTimerList *timer_list, unsigned i)
 {
-    QEMUTimer **pt, *t;
+    QEMUTimer *ts = timer_list->heap[i];
 
-    /* add the timer in the sorted list */
-    pt = &timer_list->active_timers;
     for (;;) {
-        t = *pt;
-        if (!timer_expired_ns(t, expire_time)) {
+        unsigned child = 2 * i + 1;
+
+        if (child >= timer_list->heap_len) {
+            break;
+        }
+        if (child + 1 < timer_list->heap_len &&
+            timer_before(timer_list->heap[child + 1],
+                         timer_list->heap[child])) {
+            child++;
+        }
+        if (!timer_before(timer_list->heap[child], ts)) {
             break;
         }
-        pt = &t->next;
+        timer_heap_set(timer_list, i, timer_list->heap[child]);
+        i = child;
     }
+    timer_heap_set(timer_list, i, ts);
+}
+
+/* Remove a pending timer from the heap */
+static void timer_heap_remove(QEMUTimerList *timer_list, QEMUTimer *ts)
+{
+    unsigned i = ts->heap_index;
+    QEMUTimer *last = timer_list->heap[--timer_list->heap_len];
+
+    assert(timer_list->heap[i] == ts);
+    if (last != ts) {
+        timer_heap_set(timer_list, i, last);
+        if (i > 0 && timer_before(last, timer_list->heap[(i - 1) / 2])) {
+            timer_heap_sift_up(timer_list, i);
+        } else {
+            timer_heap_sift_down(timer_list, i);
+        }
+    }
+    qatomic_set(&timer_list->active_timers,
+                timer_list->heap_len ? timer_list->heap[0] : NULL);
+}
+
+static void timer_del_locked(QEMUTimerList *timer_list, QEMUTimer *ts)
+{
+    if (timer_pending(ts)) {
+        timer_heap_remove(timer_list, ts);
+        ts->expire_time = -1;
+    }
+}
+
+static bool timer_mod_ns_locked(QEMUTimerList *timer_list,
+                                QEMUTimer *ts, int64_t expire_time)
+{
+    if (timer_list->heap_len == timer_list->heap_size) {
+        timer_list->heap_size = MAX(timer_list->heap_size * 2, 16);
+        timer_list->heap = g_renew(QEMUTimer *, timer_list->heap,
+                                   timer_list->heap_size);
+    }
+
     ts->expire_time = MAX(expire_time, 0);
-    ts->next = *pt;
-    qatomic_set(pt, ts);
+    ts->seq = timer_list->seq++;
+    timer_list->heap[timer_list->heap_len] = ts;
+    timer_heap_sift_up(timer_list, timer_list->heap_len++);
+    qatomic_set(&timer_list->active_timers, timer_list->heap[0]);
 
-    return pt == &timer_list->active_timers;
+    return timer_list->heap[0] == ts;
 }
 
 static void timerlist_rearm(QEMUTimerList *timer_list)
@@ -552,8 +632,7 @@ bool timerlist_run_timers(QEMUTimerList *timer_list)
         }
 
         /* remove timer from the list before calling the callback */
-        timer_list->active_timers = ts->next;
-        ts->next = NULL;
+        timer_heap_remove(timer_list, ts);
         ts->expire_time = -1;
         cb = ts->cb;
         opaque = ts->opaque;
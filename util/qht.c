@@ -22,8 +22,8 @@
  * - Writes (i.e. insertions/removals) can be concurrent with writes to
  *   different buckets; writes to the same bucket are serialized through a lock.
  * - Optional auto-resizing: the hash table resizes up if the load surpasses
- *   a certain threshold. Resizing is done concurrently with readers; writes
- *   are serialized with the resize operation.
+ *   a certain threshold. Resizing is done concurrently with readers and
+ *   writers; entries are migrated to the resized map incrementally.
  *
  * The key structure is the bucket, which is cacheline-sized. Buckets
  * contain a few hash values and pointers; the u32 hash values are stored in
@@ -43,10 +43,23 @@
  * just-removed entry. This makes lookups slightly faster, since the moment an
  * invalid entry is found, the (failed) lookup is over.
  *
- * Resizing is done by taking all bucket spinlocks (so that no other writers can
- * race with us) and then copying all entries into a new hash map. Then, the
- * ht->map pointer is set, and the old map is freed once no RCU readers can see
- * it anymore.
+ * Explicit resizes (and resets) are done by taking all bucket spinlocks (so
+ * that no other writers can race with us) and then copying all entries into a
+ * new hash map. Then, the ht->map pointer is set, and the old map is freed once
+ * no RCU readers can see it anymore.
+ *
+ * Automatic resizes double the number of head buckets without stopping
+ * writers: the new map is installed right away and keeps a pointer to the old
+ * one. Each head bucket of the old map is then migrated on its own, under its
+ * lock and the locks of the two new head buckets its entries are split into.
+ * A bucket is migrated when a writer first accesses one of its hashes, and
+ * insertions also migrate a few buckets in order, so that the resize completes
+ * even if part of the table is never written. Until an old bucket is migrated,
+ * its entries are only in the old map, and the two new buckets are empty;
+ * lookups that fail in the new map therefore retry in the old bucket, unless
+ * it is marked as migrated. Once all buckets are migrated, the old map is
+ * freed after an RCU grace period. Iterators and explicit resizes complete a
+ * pending migration before they start.
  *
  * Writers check for concurrent resizes by comparing ht->map before and after
  * acquiring their bucket lock. If they don't match, a resize has occurred
@@ -68,6 +81,7 @@
 #include "qemu/osdep.h"
 #include "qemu/qht.h"
 #include "qemu/atomic.h"
+#include "qemu/bitmap.h"
 #include "qemu/rcu.h"
 #include "qemu/memalign.h"
 
@@ -176,6 +190,11 @@ struct qht_tsan_lock {
  * @n_added_buckets: number of added (i.e. "non-head") buckets
  * @n_added_buckets_threshold: threshold to trigger an upward resize once the
  *                             number of added buckets surpasses it.
+ * @old: map whose entries are being migrated to this one, or NULL.
+ * @migrated: bitmap of the head buckets that have been migrated to the next
+ *            map. Only allocated once an incremental resize starts.
+ * @n_migrated: number of bits set in @migrated.
+ * @migrate_next: next head bucket to be migrated in order by insertions.
  * @tsan_bucket_locks: Array of striped locks to be used only under TSAN.
  *
  * Buckets are tracked in what we call a "map", i.e. this structure.
@@ -186,6 +205,10 @@ struct qht_map {
     size_t n_buckets;
     size_t n_added_buckets;
     size_t n_added_buckets_threshold;
+    struct qht_map *old;
+    unsigned long *migrated;
+    size_t n_migrated;
+    size_t migrate_next;
 #ifdef CONFIG_TSAN
     struct qht_tsan_lock tsan_bucket_locks[QHT_TSAN_BUCKET_LOCKS];
 #endif
@@ -194,9 +217,20 @@ struct qht_map {
 /* trigger a resize when n_added_buckets > n_buckets / div */
 #define QHT_NR_ADDED_BUCKETS_THRESHOLD_DIV 8
 
+/*
+ * Number of old head buckets migrated in order by each insertion during an
+ * incremental resize. Since the next resize can only start after this one
+ * completes, this must be large enough for the migration to finish well
+ * before the new map reaches its own threshold.
+ */
+#define QHT_MIGRATE_STEP 8
+
 static void qht_do_resize_reset(struct qht *ht, struct qht_map *new,
                                 bool reset);
 static void qht_grow_maybe(struct qht *ht);
+static void qht_map_migrate_hash(struct qht *ht, struct qht_map *map,
+                                 uint32_t hash);
+static void qht_migrate_finish__locked(struct qht *ht);
 
 #ifdef QHT_DEBUG
 
@@ -295,6 +329,21 @@ static inline void qht_bucket_unlock(struct qht_map *map,
     qht_bucket_lock_do(map, b, qemu_spin_unlock);
 }
 
+/* do @a and @b, both from @map, share a lock? */
+static inline bool qht_bucket_lock_is_shared(struct qht_map *map,
+                                             struct qht_bucket *a,
+                                             struct qht_bucket *b)
+{
+#ifdef CONFIG_TSAN
+    unsigned long a_idx = a - map->buckets;
+    unsigned long b_idx = b - map->buckets;
+
+    return ((a_idx ^ b_idx) & (QHT_TSAN_BUCKET_LOCKS - 1)) == 0;
+#else
+    return a == b;
+#endif
+}
+
 static inline void qht_head_init(struct qht_map *map, struct qht_bucket *b)
 {
     memset(b, 0, sizeof(*b));
@@ -342,7 +391,8 @@ static inline bool qht_map_is_stale__locked(const struct qht *ht,
 }
 
 /*
- * Grab all bucket locks, and set @pmap after making sure the map isn't stale.
+ * Grab all bucket locks, and set @pmap after making sure the map isn't stale
+ * and holds all entries, i.e. no migration to it is pending.
  *
  * Pairs with qht_map_unlock_buckets(), hence the pass-by-reference.
  *
@@ -355,14 +405,20 @@ void qht_map_lock_buckets__no_stale(struct qht *ht, struct qht_map **pmap)
 
     map = qatomic_rcu_read(&ht->map);
     qht_map_lock_buckets(map);
-    if (likely(!qht_map_is_stale__locked(ht, map))) {
+    if (likely(!qht_map_is_stale__locked(ht, map) &&
+               !qatomic_read(&map->old))) {
         *pmap = map;
         return;
     }
     qht_map_unlock_buckets(map);
 
-    /* we raced with a resize; acquire ht->lock to see the updated ht->map */
+    /*
+     * We raced with a resize, or one is in progress; acquire ht->lock to see
+     * the updated ht->map and complete the migration. A new resize cannot
+     * migrate any entry out of the map while we hold all of its locks.
+     */
     qht_lock(ht);
+    qht_migrate_finish__locked(ht);
     map = ht->map;
     qht_map_lock_buckets(map);
     qht_unlock(ht);
@@ -370,7 +426,8 @@ void qht_map_lock_buckets__no_stale(struct qht *ht, struct qht_map **pmap)
 }
 
 /*
- * Get a head bucket and lock it, making sure its parent map is not stale.
+ * Get a head bucket and lock it, making sure its parent map is not stale and
+ * that the bucket's entries have been migrated to it.
  * @pmap is filled with a pointer to the bucket's parent map.
  *
  * Unlock with qht_bucket_unlock.
@@ -385,6 +442,7 @@ struct qht_bucket *qht_bucket_lock__no_stale(struct qht *ht, uint32_t hash,
     struct qht_map *map;
 
     map = qatomic_rcu_read(&ht->map);
+    qht_map_migrate_hash(ht, map, hash);
     b = qht_map_to_bucket(map, hash);
 
     qht_bucket_lock(map, b);
@@ -397,6 +455,7 @@ struct qht_bucket *qht_bucket_lock__no_stale(struct qht *ht, uint32_t hash,
     /* we raced with a resize; acquire ht->lock to see the updated ht->map */
     qht_lock(ht);
     map = ht->map;
+    qht_map_migrate_hash(ht, map, hash);
     b = qht_map_to_bucket(map, hash);
     qht_bucket_lock(map, b);
     qht_unlock(ht);
@@ -433,6 +492,7 @@ static void qht_map_destroy(struct qht_map *map)
         qht_chain_destroy(map, &map->buckets[i]);
     }
     qemu_vfree(map->buckets);
+    g_free(map->migrated);
     g_free(map);
 }
 
@@ -447,6 +507,10 @@ static struct qht_map *qht_map_create(size_t n_buckets)
     map->n_added_buckets = 0;
     map->n_added_buckets_threshold = n_buckets /
         QHT_NR_ADDED_BUCKETS_THRESHOLD_DIV;
+    map->old = NULL;
+    map->migrated = NULL;
+    map->n_migrated = 0;
+    map->migrate_next = 0;
 
     /* let tiny hash tables to at least add one non-head bucket */
     if (unlikely(map->n_added_buckets_threshold == 0)) {
@@ -478,6 +542,9 @@ void qht_init(struct qht *ht, qht_cmp_func_t cmp, size_t n_elems,
 /* call only when there are no readers/writers left */
 void qht_destroy(struct qht *ht)
 {
+    if (ht->map->old) {
+        qht_map_destroy(ht->map->old);
+    }
     qht_map_destroy(ht->map);
     memset(ht, 0, sizeof(*ht));
 }
@@ -592,6 +659,46 @@ void *qht_lookup__slowpath(const struct qht_bucket *b, qht_lookup_func_t func,
     return ret;
 }
 
+static inline bool qht_map_bucket_migrated(const struct qht_map *map,
+                                           size_t idx)
+{
+    return qatomic_read(&map->migrated[BIT_WORD(idx)]) & BIT_MASK(idx);
+}
+
+/*
+ * Look up an entry that was not found in @map's bucket, which may still be in
+ * the old map during an incremental resize.
+ */
+static __attribute__((noinline))
+void *qht_lookup__migrating(const struct qht_map *map, qht_lookup_func_t func,
+                            const void *userp, uint32_t hash)
+{
+    const struct qht_map *old = qatomic_rcu_read(&map->old);
+    const struct qht_bucket *b;
+    unsigned int version;
+    bool migrated = true;
+    void *ret = NULL;
+
+    if (old) {
+        size_t idx = hash & (old->n_buckets - 1);
+
+        b = &old->buckets[idx];
+        do {
+            version = seqlock_read_begin(&b->sequence);
+            migrated = qht_map_bucket_migrated(old, idx);
+            if (!migrated) {
+                ret = qht_do_lookup(b, func, userp, hash);
+            }
+        } while (seqlock_read_retry(&b->sequence, version));
+    }
+    if (!migrated) {
+        return ret;
+    }
+    /* the bucket was migrated after we looked at @map; look again */
+    b = qht_map_to_bucket(map, hash);
+    return qht_lookup__slowpath(b, func, userp, hash);
+}
+
 void *qht_lookup_custom(const struct qht *ht, const void *userp, uint32_t hash,
                         qht_lookup_func_t func)
 {
@@ -605,14 +712,17 @@ void *qht_lookup_custom(const struct qht *ht, const void *userp, uint32_t hash,
 
     version = seqlock_read_begin(&b->sequence);
     ret = qht_do_lookup(b, func, userp, hash);
-    if (likely(!seqlock_read_retry(&b->sequence, version))) {
+    if (unlikely(seqlock_read_retry(&b->sequence, version))) {
+        /*
+         * Removing the do/while from the fastpath gives a 4% perf. increase
+         * when running a 100%-lookup microbenchmark.
+         */
+        ret = qht_lookup__slowpath(b, func, userp, hash);
+    }
+    if (likely(ret || !qatomic_read(&map->old))) {
         return ret;
     }
-    /*
-     * Removing the do/while from the fastpath gives a 4% perf. increase when
-     * running a 100%-lookup microbenchmark.
-     */
-    return qht_lookup__slowpath(b, func, userp, hash);
+    return qht_lookup__migrating(map, func, userp, hash);
 }
 
 void *qht_lookup(const struct qht *ht, const void *userp, uint32_t hash)
@@ -670,6 +780,128 @@ static void *qht_insert__locked(const struct qht *ht, struct qht_map *map,
     return NULL;
 }
 
+/*
+ * Migrate the entries of head bucket @idx of @map->old to @map, unless that
+ * has already been done.
+ */
+static void qht_bucket_migrate(struct qht *ht, struct qht_map *map,
+                               struct qht_map *old, size_t idx)
+{
+    struct qht_bucket *head = &old->buckets[idx];
+    struct qht_bucket *lo = &map->buckets[idx];
+    struct qht_bucket *hi = &map->buckets[idx + old->n_buckets];
+    struct qht_bucket *b;
+    int i;
+
+    qht_bucket_lock(old, head);
+    if (qht_map_bucket_migrated(old, idx)) {
+        qht_bucket_unlock(old, head);
+        return;
+    }
+    qht_bucket_lock(map, lo);
+    if (!qht_bucket_lock_is_shared(map, lo, hi)) {
+        qht_bucket_lock(map, hi);
+    }
+
+    b = head;
+    do {
+        for (i = 0; i < QHT_BUCKET_ENTRIES; i++) {
+            if (b->pointers[i] == NULL) {
+                goto done;
+            }
+            qht_insert__locked(ht, map, qht_map_to_bucket(map, b->hashes[i]),
+                               b->pointers[i], b->hashes[i], NULL);
+        }
+        b = b->next;
+    } while (b);
+ done:
+    qht_bucket_debug__locked(lo);
+    qht_bucket_debug__locked(hi);
+
+    /*
+     * The entries are left in place, so that concurrent lookups that read
+     * the bucket before the seqlock is bumped still find them.
+     */
+    seqlock_write_begin(&head->sequence);
+    set_bit_atomic(idx, old->migrated);
+    seqlock_write_end(&head->sequence);
+    qatomic_inc(&old->n_migrated);
+
+    if (!qht_bucket_lock_is_shared(map, lo, hi)) {
+        qht_bucket_unlock(map, hi);
+    }
+    qht_bucket_unlock(map, lo);
+    qht_bucket_unlock(old, head);
+}
+
+/* make sure that the entries with @hash are in @map */
+static void qht_map_migrate_hash(struct qht *ht, struct qht_map *map,
+                                 uint32_t hash)
+{
+    struct qht_map *old = qatomic_rcu_read(&map->old);
+    size_t idx;
+
+    if (likely(old == NULL)) {
+        return;
+    }
+    idx = hash & (old->n_buckets - 1);
+    if (!qht_map_bucket_migrated(old, idx)) {
+        qht_bucket_migrate(ht, map, old, idx);
+    }
+}
+
+/* free @map->old if all of its buckets have been migrated */
+static void qht_map_drop_old__locked(struct qht_map *map)
+{
+    struct qht_map *old = map->old;
+
+    if (old && qatomic_read(&old->n_migrated) == old->n_buckets) {
+        qatomic_set(&map->old, NULL);
+        call_rcu(old, qht_map_destroy, rcu);
+    }
+}
+
+/* complete the pending migration to ht->map, if any */
+static void qht_migrate_finish__locked(struct qht *ht)
+{
+    struct qht_map *map = ht->map;
+    size_t i;
+
+    if (map->old == NULL) {
+        return;
+    }
+    for (i = 0; i < map->old->n_buckets; i++) {
+        if (!qht_map_bucket_migrated(map->old, i)) {
+            qht_bucket_migrate(ht, map, map->old, i);
+        }
+    }
+    qht_map_drop_old__locked(map);
+}
+
+/* migrate the next few buckets in order to @map, which is being resized */
+static __attribute__((noinline))
+void qht_migrate_step(struct qht *ht, struct qht_map *map)
+{
+    struct qht_map *old = qatomic_rcu_read(&map->old);
+    size_t start, end, i;
+
+    if (old == NULL) {
+        return;
+    }
+    start = qatomic_fetch_add(&old->migrate_next, QHT_MIGRATE_STEP);
+    end = MIN(start + QHT_MIGRATE_STEP, old->n_buckets);
+    for (i = start; i < end; i++) {
+        if (!qht_map_bucket_migrated(old, i)) {
+            qht_bucket_migrate(ht, map, old, i);
+        }
+    }
+    if (qatomic_read(&old->n_migrated) == old->n_buckets) {
+        qht_lock(ht);
+        qht_map_drop_old__locked(map);
+        qht_unlock(ht);
+    }
+}
+
 static __attribute__((noinline)) void qht_grow_maybe(struct qht *ht)
 {
     struct qht_map *map;
@@ -682,11 +914,17 @@ static __attribute__((noinline)) void qht_grow_maybe(struct qht *ht)
         return;
     }
     map = ht->map;
-    /* another thread might have just performed the resize we were after */
-    if (qht_map_needs_resize(map)) {
+    /*
+     * Another thread might have just performed the resize we were after.
+     * If a migration is still pending, the next insertion will try again.
+     */
+    if (qht_map_needs_resize(map) && map->old == NULL) {
         struct qht_map *new = qht_map_create(map->n_buckets * 2);
 
-        qht_do_resize(ht, new);
+        /* the entries are migrated as the buckets are accessed */
+        map->migrated = bitmap_new(map->n_buckets);
+        new->old = map;
+        qatomic_rcu_set(&ht->map, new);
     }
     qht_unlock(ht);
 }
@@ -706,6 +944,9 @@ bool qht_insert(struct qht *ht, void *p, uint32_t hash, void **existing)
     qht_bucket_debug__locked(b);
     qht_bucket_unlock(map, b);
 
+    if (unlikely(qatomic_read(&map->old))) {
+        qht_migrate_step(ht, map);
+    }
     if (unlikely(needs_resize) && ht->mode & QHT_MODE_AUTO_RESIZE) {
         qht_grow_maybe(ht);
     }
@@ -871,8 +1112,7 @@ do_qht_iter(struct qht *ht, const struct qht_iter *iter, void *userp)
 {
     struct qht_map *map;
 
-    map = qatomic_rcu_read(&ht->map);
-    qht_map_lock_buckets(map);
+    qht_map_lock_buckets__no_stale(ht, &map);
     qht_map_iter__all_locked(map, iter, userp);
     qht_map_unlock_buckets(map);
 }
@@ -926,6 +1166,7 @@ static void qht_do_resize_reset(struct qht *ht, struct qht_map *new, bool reset)
     };
     struct qht_map_copy_data data;
 
+    qht_migrate_finish__locked(ht);
     old = ht->map;
     qht_map_lock_buckets(old);
 
@@ -967,10 +1208,48 @@ bool qht_resize(struct qht *ht, size_t n_elems)
     return ret;
 }
 
+static void qht_chain_statistics(const struct qht_bucket *head,
+                                 struct qht_stats *stats)
+{
+    const struct qht_bucket *b;
+    unsigned int version;
+    size_t buckets;
+    size_t entries;
+    int j;
+
+    do {
+        version = seqlock_read_begin(&head->sequence);
+        buckets = 0;
+        entries = 0;
+        b = head;
+        do {
+            for (j = 0; j < QHT_BUCKET_ENTRIES; j++) {
+                if (qatomic_read(&b->pointers[j]) == NULL) {
+                    break;
+                }
+                entries++;
+            }
+            buckets++;
+            b = qatomic_rcu_read(&b->next);
+        } while (b);
+    } while (seqlock_read_retry(&head->sequence, version));
+
+    if (entries) {
+        qdist_inc(&stats->chain, buckets);
+        qdist_inc(&stats->occupancy,
+                  (double)entries / QHT_BUCKET_ENTRIES / buckets);
+        stats->used_head_buckets++;
+        stats->entries += entries;
+    } else {
+        qdist_inc(&stats->occupancy, 0);
+    }
+}
+
 /* pass @stats to qht_statistics_destroy() when done */
 void qht_statistics_init(const struct qht *ht, struct qht_stats *stats)
 {
     const struct qht_map *map;
+    const struct qht_map *old;
     int i;
 
     map = qatomic_rcu_read(&ht->map);
@@ -987,38 +1266,20 @@ void qht_statistics_init(const struct qht *ht, struct qht_stats *stats)
     stats->head_buckets = map->n_buckets;
 
     for (i = 0; i < map->n_buckets; i++) {
-        const struct qht_bucket *head = &map->buckets[i];
-        const struct qht_bucket *b;
-        unsigned int version;
-        size_t buckets;
-        size_t entries;
-        int j;
+        qht_chain_statistics(&map->buckets[i], stats);
+    }
 
-        do {
-            version = seqlock_read_begin(&head->sequence);
-            buckets = 0;
-            entries = 0;
-            b = head;
-            do {
-                for (j = 0; j < QHT_BUCKET_ENTRIES; j++) {
-                    if (qatomic_read(&b->pointers[j]) == NULL) {
-                        break;
-                    }
-                    entries++;
-                }
-                buckets++;
-                b = qatomic_rcu_read(&b->next);
-            } while (b);
-        } while (seqlock_read_retry(&head->sequence, version));
-
-        if (entries) {
-            qdist_inc(&stats->chain, buckets);
-            qdist_inc(&stats->occupancy,
-                      (double)entries / QHT_BUCKET_ENTRIES / buckets);
-            stats->used_head_buckets++;
-            stats->entries += entries;
-        } else {
-            qdist_inc(&stats->occupancy, 0);
+    /*
+     * The entries of buckets pending migration are only in the old map.
+     * Count their chains too; concurrent migrations can make the result
+     * slightly off, as with concurrent writers.
+     */
+    old = qatomic_rcu_read(&map->old);
+    if (old) {
+        for (i = 0; i < old->n_buckets; i++) {
+            if (!qht_map_bucket_migrated(old, i)) {
+                qht_chain_statistics(&old->buckets[i], stats);
+            }
         }
     }
 }
@@ -32,6 +32,7 @@
 #include "qemu/thread.h"
 #include "qemu/main-loop.h"
 #include "qemu/lockable.h"
+#include "qemu/stats64.h"
 #if defined(CONFIG_MALLOC_TRIM)
 #include <malloc.h>
 #endif
@@ -54,6 +55,12 @@ static int rcu_call_count;
 static QemuMutex rcu_registry_lock;
 static QemuMutex rcu_sync_lock;
 
+/* See rcu_get_stats() */
+static Stat64 rcu_stat_grace_periods;
+static Stat64 rcu_stat_forced_grace_periods;
+static Stat64 rcu_stat_callbacks;
+static Stat64 rcu_stat_callbacks_done;
+
 /*
  * Check whether a quiescent state was crossed between the beginning of
  * update_counter_and_wait and now.
@@ -98,6 +105,7 @@ static void wait_for_readers(void)
             (qatomic_read(&rcu_call_count) >= RCU_CALL_MIN_SIZE ||
              sleeps >= 5 || qatomic_read(&in_drain_call_rcu))) {
             forced = true;
+            stat64_inc(&rcu_stat_forced_grace_periods);
 
             QLIST_FOREACH(index, &registry, node) {
                 notifier_list_notify(&index->force_rcu, NULL);
@@ -200,6 +208,7 @@ void synchronize_rcu(void)
         }
 
         wait_for_readers();
+        stat64_inc(&rcu_stat_grace_periods);
     }
 }
 
@@ -322,6 +331,7 @@ static void *call_rcu_thread(void *opaque)
 
             n--;
             node->func(node);
+            stat64_inc(&rcu_stat_callbacks_done);
         }
         bql_unlock();
     }
@@ -332,10 +342,22 @@ void call_rcu1(struct rcu_head *node, void (*func)(struct rcu_head *node))
 {
     node->func = func;
     enqueue(node);
+    stat64_inc(&rcu_stat_callbacks);
     qatomic_inc(&rcu_call_count);
     qemu_event_set(&rcu_call_ready_event);
 }
 
+void rcu_get_stats(RCUStats *stats)
+{
+    /* Read done before total, so that pending cannot go negative */
+    uint64_t done = stat64_get(&rcu_stat_callbacks_done);
+
+    stats->grace_periods = stat64_get(&rcu_stat_grace_periods);
+    stats->forced_grace_periods = stat64_get(&rcu_stat_forced_grace_periods);
+    stats->callbacks = stat64_get(&rcu_stat_callbacks);
+    stats->callbacks_pending = stats->callbacks - done;
+}
+
 
 struct rcu_drain {
     struct rcu_head rcu;
@@ -165,6 +165,26 @@ static void thread_context_get_cpu_affinity(Object *obj, Visitor *v,
     qapi_free_uint16List(host_cpus);
 }
 
+#ifdef CONFIG_NUMA
+/* Add the CPUs of host node @node to @bitmap. */
+static void thread_context_add_node_cpus(unsigned long *bitmap, int nbits,
+                                         int node, struct bitmask *tmp_cpus)
+{
+    int i;
+
+    numa_bitmask_clearall(tmp_cpus);
+    if (numa_node_to_cpus(node, tmp_cpus)) {
+        /* We ignore any errors, such as impossible nodes. */
+        return;
+    }
+    for (i = 0; i < nbits; i++) {
+        if (numa_bitmask_isbitset(tmp_cpus, i)) {
+            set_bit(i, bitmap);
+        }
+    }
+}
+#endif
+
 static void thread_context_set_node_affinity(Object *obj, Visitor *v,
                                              const char *name, void *opaque,
                                              Error **errp)
@@ -175,7 +195,7 @@ static void thread_context_set_node_affinity(Object *obj, Visitor *v,
     uint16List *l, *host_nodes = NULL;
     unsigned long *bitmap = NULL;
     struct bitmask *tmp_cpus;
-    int ret, i;
+    int ret;
 
     if (tc->init_cpu_bitmap) {
         error_setg(errp, "Mixing CPU and node affinity not supported");
@@ -194,17 +214,7 @@ static void thread_context_set_node_affinity(Object *obj, Visitor *v,
     bitmap = bitmap_new(nbits);
     tmp_cpus = numa_allocate_cpumask();
     for (l = host_nodes; l; l = l->next) {
-        numa_bitmask_clearall(tmp_cpus);
-        ret = numa_node_to_cpus(l->value, tmp_cpus);
-        if (ret) {
-            /* We ignore any errors, such as impossible nodes. */
-            continue;
-        }
-        for (i = 0; i < nbits; i++) {
-            if (numa_bitmask_isbitset(tmp_cpus, i)) {
-                set_bit(i, bitmap);
-            }
-        }
+        thread_context_add_node_cpus(bitmap, nbits, l->value, tmp_cpus);
     }
     numa_free_cpumask(tmp_cpus);
 
@@ -248,11 +258,12 @@ static void thread_context_get_thread_id(Object *obj, Visitor *v,
 static void thread_context_instance_complete(UserCreatable *uc, Error **errp)
 {
     ThreadContext *tc = THREAD_CONTEXT(uc);
+    const char *id = object_get_canonical_path_component(OBJECT(uc));
     char *thread_name;
     int ret;
 
-    thread_name = g_strdup_printf("TC %s",
-                               object_get_canonical_path_component(OBJECT(uc)));
+    /* Contexts created by thread_context_new_node_affinity() have no id */
+    thread_name = g_strdup_printf("TC %s", id ? id : "internal");
     qemu_thread_create(&tc->thread, thread_name, thread_context_run, tc,
                        QEMU_THREAD_JOINABLE);
     g_free(thread_name);
@@ -354,3 +365,40 @@ void thread_context_create_thread(ThreadContext *tc, QemuThread *thread,
     }
     qemu_mutex_unlock(&tc->mutex);
 }
+
+ThreadContext *thread_context_new_node_affinity(const unsigned long *host_nodes,
+                                                unsigned long nnodes,
+                                                Error **errp)
+{
+#ifdef CONFIG_NUMA
+    const int nbits = numa_num_possible_cpus();
+    unsigned long *bitmap = bitmap_new(nbits);
+    struct bitmask *tmp_cpus = numa_allocate_cpumask();
+    ThreadContext *tc;
+    unsigned long node;
+
+    for (node = find_first_bit(host_nodes, nnodes); node < nnodes;
+         node = find_next_bit(host_nodes, nnodes, node + 1)) {
+        thread_context_add_node_cpus(bitmap, nbits, node, tmp_cpus);
+    }
+    numa_free_cpumask(tmp_cpus);
+
+    if (bitmap_empty(bitmap, nbits)) {
+        g_free(bitmap);
+        error_setg(errp, "The nodes select no CPUs");
+        return NULL;
+    }
+
+    tc = THREAD_CONTEXT(object_new(TYPE_THREAD_CONTEXT));
+    tc->init_cpu_bitmap = bitmap;
+    tc->init_cpu_nbits = nbits;
+    if (!user_creatable_complete(USER_CREATABLE(tc), errp)) {
+        object_unref(OBJECT(tc));
+        return NULL;
+    }
+    return tc;
+#else
+    error_setg(errp, "NUMA node affinity is not supported by this QEMU");
+    return NULL;
+#endif
+}
@@ -54,6 +54,15 @@ struct ThreadPoolElementAio {
     /* Access to this list is protected by lock.  */
     QTAILQ_ENTRY(ThreadPoolElementAio) reqs;
 
+    /*
+     * Pushed atomically to pool->done_list by whoever moves the state
+     * to THREAD_DONE, then moved to pool->completed by the mother thread.
+     */
+    union {
+        QSLIST_ENTRY(ThreadPoolElementAio) done;
+        QSIMPLEQ_ENTRY(ThreadPoolElementAio) completed;
+    };
+
     /* This list is only written by the thread pool's mother thread.  */
     QLIST_ENTRY(ThreadPoolElementAio) all;
 };
@@ -68,6 +77,10 @@ struct ThreadPoolAio {
 
     /* The following variables are only accessed from one AioContext. */
     QLIST_HEAD(, ThreadPoolElementAio) head;
+    QSIMPLEQ_HEAD(, ThreadPoolElementAio) completed;
+
+    /* Requests in THREAD_DONE state not yet seen by completion_bh.  */
+    QSLIST_HEAD(, ThreadPoolElementAio) done_list;
 
     /* The following variables are protected by lock.  */
     QTAILQ_HEAD(, ThreadPoolElementAio) request_list;
@@ -79,6 +92,13 @@ struct ThreadPoolAio {
     int max_threads;
 };
 
+/* Hand a request in THREAD_DONE state over to the completion bottom half */
+static void thread_pool_done(ThreadPoolAio *pool, ThreadPoolElementAio *req)
+{
+    QSLIST_INSERT_HEAD_ATOMIC(&pool->done_list, req, done);
+    qemu_bh_schedule(pool->completion_bh);
+}
+
 static void *worker_thread(void *opaque)
 {
     ThreadPoolAio *pool = opaque;
@@ -119,7 +139,7 @@ static void *worker_thread(void *opaque)
         /* _release to write ret before state.  */
         qatomic_store_release(&req->state, THREAD_DONE);
 
-        qemu_bh_schedule(pool->completion_bh);
+        thread_pool_done(pool, req);
         qemu_mutex_lock(&pool->lock);
     }
 
@@ -175,19 +195,38 @@ static void spawn_thread(ThreadPoolAio *pool)
     }
 }
 
+/*
+ * Move the whole batch of requests completed so far to pool->completed,
+ * in completion order.
+ */
+static void thread_pool_take_done(ThreadPoolAio *pool)
+{
+    QSLIST_HEAD(, ThreadPoolElementAio) list;
+    QSIMPLEQ_HEAD(, ThreadPoolElementAio) batch =
+        QSIMPLEQ_HEAD_INITIALIZER(batch);
+    ThreadPoolElementAio *elem;
+
+    QSLIST_MOVE_ATOMIC(&list, &pool->done_list);
+    while ((elem = QSLIST_FIRST(&list))) {
+        QSLIST_REMOVE_HEAD(&list, done);
+        QSIMPLEQ_INSERT_HEAD(&batch, elem, completed);
+    }
+    QSIMPLEQ_CONCAT(&pool->completed, &batch);
+}
+
 static void thread_pool_completion_bh(void *opaque)
 {
     ThreadPoolAio *pool = opaque;
-    ThreadPoolElementAio *elem, *next;
+    ThreadPoolElementAio *elem;
 
     defer_call_begin(); /* cb() may use defer_call() to coalesce work */
 
-restart:
-    QLIST_FOREACH_SAFE(elem, &pool->head, all, next) {
+    thread_pool_take_done(pool);
+    while ((elem = QSIMPLEQ_FIRST(&pool->completed))) {
+        QSIMPLEQ_REMOVE_HEAD(&pool->completed, completed);
+
         /* _acquire to read state before ret.  */
-        if (qatomic_load_acquire(&elem->state) != THREAD_DONE) {
-            continue;
-        }
+        assert(qatomic_load_acquire(&elem->state) == THREAD_DONE);
 
         trace_thread_pool_complete_aio(pool, elem, elem->common.opaque,
                                        elem->ret);
@@ -196,21 +235,22 @@ restart:
         if (elem->common.cb) {
             /* Schedule ourselves in case elem->common.cb() calls aio_poll() to
              * wait for another request that completed at the same time.
+             * A nested invocation picks up the rest of pool->completed.
              */
             qemu_bh_schedule(pool->completion_bh);
 
             elem->common.cb(elem->common.opaque, elem->ret);
 
             /* We can safely cancel the completion_bh here regardless of someone
-             * else having scheduled it meanwhile because we reenter the
-             * completion function anyway (goto restart).
+             * else having scheduled it meanwhile because we look at
+             * pool->done_list again below.
              */
             qemu_bh_cancel(pool->completion_bh);
+        }
+        qemu_aio_unref(elem);
 
-            qemu_aio_unref(elem);
-            goto restart;
-        } else {
-            qemu_aio_unref(elem);
+        if (QSIMPLEQ_EMPTY(&pool->completed)) {
+            thread_pool_take_done(pool);
         }
     }
 
@@ -227,10 +267,10 @@ static void thread_pool_cancel(BlockAIOCB *acb)
     QEMU_LOCK_GUARD(&pool->lock);
     if (qatomic_read(&elem->state) == THREAD_QUEUED) {
         QTAILQ_REMOVE(&pool->request_list, elem, reqs);
-        qemu_bh_schedule(pool->completion_bh);
 
         qatomic_set(&elem->ret, -ECANCELED);
         qatomic_store_release(&elem->state, THREAD_DONE);
+        thread_pool_done(pool, elem);
     }
 
 }
@@ -334,6 +374,8 @@ static void thread_pool_init_one(ThreadPoolAio *pool, AioContext *ctx)
     pool->new_thread_bh = aio_bh_new(ctx, spawn_thread_bh_fn, pool);
 
     QLIST_INIT(&pool->head);
+    QSIMPLEQ_INIT(&pool->completed);
+    QSLIST_INIT(&pool->done_list);
     QTAILQ_INIT(&pool->request_list);
 
     thread_pool_update_params(pool, ctx);
@@ -467,19 +467,41 @@ bool throttle_schedule_timer(ThrottleState *ts,
  * @direction: throttle direction
  * @size:     the size of the operation
  */
+static const BucketType bucket_types_size[THROTTLE_MAX][2] = {
+    { THROTTLE_BPS_TOTAL, THROTTLE_BPS_READ },
+    { THROTTLE_BPS_TOTAL, THROTTLE_BPS_WRITE }
+};
+static const BucketType bucket_types_units[THROTTLE_MAX][2] = {
+    { THROTTLE_OPS_TOTAL, THROTTLE_OPS_READ },
+    { THROTTLE_OPS_TOTAL, THROTTLE_OPS_WRITE }
+};
+
+static void throttle_do_account(ThrottleState *ts, ThrottleDirection direction,
+                                double size, double units)
+{
+    unsigned i;
+
+    for (i = 0; i < ARRAY_SIZE(bucket_types_size[THROTTLE_READ]); i++) {
+        LeakyBucket *bkt;
+
+        bkt = &ts->cfg.buckets[bucket_types_size[direction][i]];
+        bkt->level = MAX(bkt->level + size, 0);
+        if (bkt->burst_length > 1) {
+            bkt->burst_level = MAX(bkt->burst_level + size, 0);
+        }
+
+        bkt = &ts->cfg.buckets[bucket_types_units[direction][i]];
+        bkt->level = MAX(bkt->level + units, 0);
+        if (bkt->burst_length > 1) {
+            bkt->burst_level = MAX(bkt->burst_level + units, 0);
+        }
+    }
+}
+
 void throttle_account(ThrottleState *ts, ThrottleDirection direction,
                       uint64_t size)
 {
-    static const BucketType bucket_types_size[THROTTLE_MAX][2] = {
-        { THROTTLE_BPS_TOTAL, THROTTLE_BPS_READ },
-        { THROTTLE_BPS_TOTAL, THROTTLE_BPS_WRITE }
-    };
-    static const BucketType bucket_types_units[THROTTLE_MAX][2] = {
-        { THROTTLE_OPS_TOTAL, THROTTLE_OPS_READ },
-        { THROTTLE_OPS_TOTAL, THROTTLE_OPS_WRITE }
-    };
     double units = 1.0;
-    unsigned i;
 
     assert(direction < THROTTLE_MAX);
     /* if cfg.op_size is defined and smaller than size we compute unit count */
@@ -487,23 +509,66 @@ void throttle_account(ThrottleState *ts, ThrottleDirection direction,
         units = (double) size / ts->cfg.op_size;
     }
 
+    throttle_do_account(ts, direction, size, units);
+}
+
+/* compute how much I/O the limits allow in a given time
+ *
+ * @direction: throttle direction
+ * @ns:        the length of time
+ * @size:      the number of bytes, or 0 if they are not limited
+ * @units:     the number of operations, or 0 if they are not limited
+ */
+void throttle_get_allowance(ThrottleState *ts, ThrottleDirection direction,
+                            int64_t ns, uint64_t *size, uint64_t *units)
+{
+    unsigned i;
+
+    assert(direction < THROTTLE_MAX);
+    *size = *units = 0;
     for (i = 0; i < ARRAY_SIZE(bucket_types_size[THROTTLE_READ]); i++) {
         LeakyBucket *bkt;
+        uint64_t n;
 
         bkt = &ts->cfg.buckets[bucket_types_size[direction][i]];
-        bkt->level += size;
-        if (bkt->burst_length > 1) {
-            bkt->burst_level += size;
+        if (bkt->avg) {
+            n = MAX((double)bkt->avg * ns / NANOSECONDS_PER_SECOND, 1);
+            *size = *size ? MIN(*size, n) : n;
         }
 
         bkt = &ts->cfg.buckets[bucket_types_units[direction][i]];
-        bkt->level += units;
-        if (bkt->burst_length > 1) {
-            bkt->burst_level += units;
+        if (bkt->avg) {
+            n = MAX((double)bkt->avg * ns / NANOSECONDS_PER_SECOND, 1);
+            *units = *units ? MIN(*units, n) : n;
         }
     }
 }
 
+/* do the accounting for a batch of operations ahead of time, unless the
+ * batch would have to wait
+ *
+ * @now:       the current time in the clock of @ts
+ * @direction: throttle direction
+ * @size:      the number of bytes of the batch
+ * @units:     the number of operations of the batch
+ * @ret:       true if the batch has been accounted, false if it would
+ *             be throttled, in which case nothing is accounted
+ */
+bool throttle_account_batch(ThrottleState *ts, int64_t now,
+                            ThrottleDirection direction,
+                            uint64_t size, uint64_t units)
+{
+    assert(direction < THROTTLE_MAX);
+    throttle_do_leak(ts, now);
+    throttle_do_account(ts, direction, size, units);
+
+    if (throttle_compute_wait_for(ts, direction)) {
+        throttle_do_account(ts, direction, -(double)size, -(double)units);
+        return false;
+    }
+    return true;
+}
+
 /* return a ThrottleConfig based on the options in a ThrottleLimits
  *
  * @arg:    the ThrottleLimits object to read from
@@ -0,0 +1,198 @@
+/*
+ * QEMU timed latency histogram
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/host-utils.h"
+
+#include "qemu/timed-histogram.h"
+
+/* This module computes percentiles of a set of values within a time
+ * window.
+ *
+ * Values are counted in a log-linear histogram with a fixed number of
+ * buckets, so accounting is O(1) and the relative error of a percentile is
+ * bounded no matter how the values are distributed.
+ *
+ * The windows work like in timed-average.c: two windows with the same
+ * period are offsetted by period / 2, values are accounted in both and
+ * percentiles are always returned from the oldest one.
+ */
+
+#define SUB_BUCKETS (1 << TIMED_HISTOGRAM_SUB_BITS)
+
+/* Return the index of the bucket that counts @value */
+static unsigned bucket_index(uint64_t value)
+{
+    unsigned msb;
+
+    if (value < SUB_BUCKETS) {
+        return value;
+    }
+
+    msb = 63 - clz64(value);
+    if (msb >= TIMED_HISTOGRAM_MAX_BITS) {
+        return TIMED_HISTOGRAM_BUCKETS - 1;
+    }
+    return ((msb - TIMED_HISTOGRAM_SUB_BITS + 1) << TIMED_HISTOGRAM_SUB_BITS) +
+           ((value >> (msb - TIMED_HISTOGRAM_SUB_BITS)) & (SUB_BUCKETS - 1));
+}
+
+/* Return the largest value that is counted in bucket @index */
+static uint64_t bucket_max(unsigned index)
+{
+    unsigned shift;
+    uint64_t base;
+
+    if (index < SUB_BUCKETS) {
+        return index;
+    }
+
+    shift = (index >> TIMED_HISTOGRAM_SUB_BITS) - 1;
+    base = (uint64_t)(SUB_BUCKETS + (index & (SUB_BUCKETS - 1))) << shift;
+    return base + (1ULL << shift) - 1;
+}
+
+/* Update the expiration of a time window
+ *
+ * @w:      the window used
+ * @now:    the current time in nanoseconds
+ * @period: the expiration period in nanoseconds
+ */
+static void update_expiration(TimedHistogramWindow *w, int64_t now,
+                              int64_t period)
+{
+    /* time elapsed since the last theoretical expiration */
+    int64_t elapsed = (now - w->expiration) % period;
+    /* time remaining until the next expiration */
+    int64_t remaining = period - elapsed;
+    /* compute expiration */
+    w->expiration = now + remaining;
+}
+
+/* Reset a window
+ *
+ * @w: the window to reset
+ */
+static void window_reset(TimedHistogramWindow *w)
+{
+    memset(w->buckets, 0, sizeof(w->buckets));
+    w->count = 0;
+}
+
+/* Initialize a TimedHistogram structure
+ *
+ * @th:         the TimedHistogram structure
+ * @clock_type: the type of clock to use
+ * @period:     the time window period in nanoseconds
+ */
+void timed_histogram_init(TimedHistogram *th, QEMUClockType clock_type,
+                          uint64_t period)
+{
+    int64_t now = qemu_clock_get_ns(clock_type);
+
+    /* Same adjustment as in timed_average_init() */
+    th->period = (uint64_t) period * 4 / 3;
+    th->clock_type = clock_type;
+    th->current = 0;
+
+    window_reset(&th->windows[0]);
+    window_reset(&th->windows[1]);
+
+    /* Both windows are offsetted by half a period */
+    th->windows[0].expiration = now + th->period / 2;
+    th->windows[1].expiration = now + th->period;
+}
+
+/* Check if the time windows have expired, resetting them if that's the case
+ *
+ * @th: the TimedHistogram structure
+ */
+static void check_expirations(TimedHistogram *th)
+{
+    int64_t now = qemu_clock_get_ns(th->clock_type);
+    int i;
+
+    assert(th->period != 0);
+
+    for (i = 0; i < 2; i++) {
+        TimedHistogramWindow *w = &th->windows[i];
+        if (w->expiration <= now) {
+            window_reset(w);
+            update_expiration(w, now, th->period);
+        }
+    }
+
+    /* Make th->current point to the oldest window */
+    if (th->windows[0].expiration < th->windows[1].expiration) {
+        th->current = 0;
+    } else {
+        th->current = 1;
+    }
+}
+
+/* Account a value
+ *
+ * @th:    the TimedHistogram structure
+ * @value: the value to account
+ */
+void timed_histogram_account(TimedHistogram *th, uint64_t value)
+{
+    unsigned index = bucket_index(value);
+    int i;
+
+    check_expirations(th);
+
+    for (i = 0; i < 2; i++) {
+        th->windows[i].buckets[index]++;
+        th->windows[i].count++;
+    }
+}
+
+/* Get a percentile
+ *
+ * @th:       the TimedHistogram structure
+ * @permille: the percentile in tenths of a percent, e.g. 999 for p99.9
+ * @ret:      the smallest bucket upper bound that at least @permille / 1000
+ *            of the accounted values are less than or equal to, or 0 if no
+ *            values have been accounted
+ */
+uint64_t timed_histogram_percentile(TimedHistogram *th, unsigned permille)
+{
+    TimedHistogramWindow *w;
+    uint64_t rank, sum = 0;
+    unsigned i;
+
+    assert(permille <= 1000);
+
+    check_expirations(th);
+    w = &th->windows[th->current];
+    if (!w->count) {
+        return 0;
+    }
+
+    /* The rank of the value we're looking for, counting from 1 */
+    rank = MAX(DIV_ROUND_UP(w->count * permille, 1000), 1);
+    for (i = 0; i < TIMED_HISTOGRAM_BUCKETS; i++) {
+        sum += w->buckets[i];
+        if (sum >= rank) {
+            return bucket_max(i);
+        }
+    }
+    g_assert_not_reached();
+}
@@ -190,40 +190,49 @@ void qemu_vfio_pci_unmap_bar(QEMUVFIOState *s, int index, void *bar,
     }
 }
 
-/**
- * Initialize device IRQ with @irq_type and register an event notifier.
- */
-int qemu_vfio_pci_init_irq(QEMUVFIOState *s, EventNotifier *e,
-                           int irq_type, Error **errp)
+static int qemu_vfio_pci_get_irq_info(QEMUVFIOState *s, int irq_type,
+                                      struct vfio_irq_info *irq_info,
+                                      Error **errp)
 {
-    int r;
-    struct vfio_irq_set *irq_set;
-    size_t irq_set_size;
-    struct vfio_irq_info irq_info = { .argsz = sizeof(irq_info) };
-
-    irq_info.index = irq_type;
-    if (ioctl(s->device, VFIO_DEVICE_GET_IRQ_INFO, &irq_info)) {
+    *irq_info = (struct vfio_irq_info) {
+        .argsz = sizeof(*irq_info),
+        .index = irq_type,
+    };
+    if (ioctl(s->device, VFIO_DEVICE_GET_IRQ_INFO, irq_info)) {
         error_setg_errno(errp, errno, "Failed to get device interrupt info");
         return -errno;
     }
-    if (!(irq_info.flags & VFIO_IRQ_INFO_EVENTFD)) {
+    if (!(irq_info->flags & VFIO_IRQ_INFO_EVENTFD)) {
         error_setg(errp, "Device interrupt doesn't support eventfd");
         return -EINVAL;
     }
+    return 0;
+}
+
+/*
+ * Point vectors [@start, @start + @count) of @irq_type at @fds.  A negative
+ * fd leaves the corresponding vector without a trigger.
+ */
+static int qemu_vfio_pci_set_irqs(QEMUVFIOState *s, int irq_type,
+                                  unsigned start, unsigned count,
+                                  const int *fds, Error **errp)
+{
+    int r;
+    struct vfio_irq_set *irq_set;
+    size_t irq_set_size;
 
-    irq_set_size = sizeof(*irq_set) + sizeof(int);
+    irq_set_size = sizeof(*irq_set) + count * sizeof(int);
     irq_set = g_malloc0(irq_set_size);
 
-    /* Get to a known IRQ state */
     *irq_set = (struct vfio_irq_set) {
         .argsz = irq_set_size,
         .flags = VFIO_IRQ_SET_DATA_EVENTFD | VFIO_IRQ_SET_ACTION_TRIGGER,
-        .index = irq_info.index,
-        .start = 0,
-        .count = 1,
+        .index = irq_type,
+        .start = start,
+        .count = count,
     };
 
-    *(int *)&irq_set->data = event_notifier_get_fd(e);
+    memcpy(&irq_set->data, fds, count * sizeof(int));
     r = ioctl(s->device, VFIO_DEVICE_SET_IRQS, irq_set);
     g_free(irq_set);
     if (r) {
@@ -233,6 +242,76 @@ int qemu_vfio_pci_init_irq(QEMUVFIOState *s, EventNotifier *e,
     return 0;
 }
 
+/**
+ * Return the number of vectors the device offers for @irq_type.
+ */
+int qemu_vfio_pci_get_irq_count(QEMUVFIOState *s, int irq_type, Error **errp)
+{
+    struct vfio_irq_info irq_info;
+    int r;
+
+    r = qemu_vfio_pci_get_irq_info(s, irq_type, &irq_info, errp);
+    if (r) {
+        return r;
+    }
+    return MIN(irq_info.count, INT_MAX);
+}
+
+/**
+ * Initialize @nvectors device IRQ vectors with @irq_type and register an
+ * event notifier for vector 0.  The other vectors are enabled without a
+ * trigger; use qemu_vfio_pci_set_irq_vector() to attach notifiers to them.
+ */
+int qemu_vfio_pci_init_irq_vectors(QEMUVFIOState *s, EventNotifier *e,
+                                   int irq_type, unsigned nvectors,
+                                   Error **errp)
+{
+    g_autofree int *fds = NULL;
+    struct vfio_irq_info irq_info;
+    int r;
+
+    r = qemu_vfio_pci_get_irq_info(s, irq_type, &irq_info, errp);
+    if (r) {
+        return r;
+    }
+    if (!nvectors || nvectors > irq_info.count) {
+        error_setg(errp, "Device supports %u interrupt vectors, %u requested",
+                   irq_info.count, nvectors);
+        return -EINVAL;
+    }
+
+    fds = g_new(int, nvectors);
+    fds[0] = event_notifier_get_fd(e);
+    for (unsigned i = 1; i < nvectors; i++) {
+        fds[i] = -1;
+    }
+
+    /* Get to a known IRQ state */
+    return qemu_vfio_pci_set_irqs(s, irq_type, 0, nvectors, fds, errp);
+}
+
+/**
+ * Initialize device IRQ with @irq_type and register an event notifier.
+ */
+int qemu_vfio_pci_init_irq(QEMUVFIOState *s, EventNotifier *e,
+                           int irq_type, Error **errp)
+{
+    return qemu_vfio_pci_init_irq_vectors(s, e, irq_type, 1, errp);
+}
+
+/**
+ * Register @e for an IRQ vector previously enabled with
+ * qemu_vfio_pci_init_irq_vectors(), or detach the vector's notifier if @e is
+ * NULL.
+ */
+int qemu_vfio_pci_set_irq_vector(QEMUVFIOState *s, EventNotifier *e,
+                                 int irq_type, unsigned vector, Error **errp)
+{
+    int fd = e ? event_notifier_get_fd(e) : -1;
+
+    return qemu_vfio_pci_set_irqs(s, irq_type, vector, 1, &fd, errp);
+}
+
 static int qemu_vfio_pci_read_config(QEMUVFIOState *s, void *buf,
                                      int size, int ofs)
 {
@@ -0,0 +1,151 @@
+/*
+ * xxHash64 - Fast non-cryptographic hash
+ *
+ * The input is processed in stripes of 32 bytes by four independent
+ * accumulators, which lets the CPU overlap the multiplications and keeps
+ * the hash close to memory bandwidth.
+ *
+ * The algorithm is by Yann Collet, see https://github.com/Cyan4973/xxHash
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bitops.h"
+#include "qemu/bswap.h"
+#include "qemu/xxh64.h"
+
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+
+static inline uint64_t xxh64_round(uint64_t acc, uint64_t input)
+{
+    acc += input * PRIME64_2;
+    acc = rol64(acc, 31);
+    return acc * PRIME64_1;
+}
+
+static inline uint64_t xxh64_merge_round(uint64_t acc, uint64_t val)
+{
+    acc ^= xxh64_round(0, val);
+    return acc * PRIME64_1 + PRIME64_4;
+}
+
+/* Consume as many whole stripes of @p as possible, return the bytes used */
+static size_t xxh64_stripes(uint64_t *v, const uint8_t *p, size_t len)
+{
+    uint64_t v1 = v[0], v2 = v[1], v3 = v[2], v4 = v[3];
+    size_t done = 0;
+
+    for (; len - done >= 32; done += 32) {
+        v1 = xxh64_round(v1, ldq_le_p(p + done));
+        v2 = xxh64_round(v2, ldq_le_p(p + done + 8));
+        v3 = xxh64_round(v3, ldq_le_p(p + done + 16));
+        v4 = xxh64_round(v4, ldq_le_p(p + done + 24));
+    }
+    v[0] = v1;
+    v[1] = v2;
+    v[2] = v3;
+    v[3] = v4;
+    return done;
+}
+
+void qemu_xxh64_init(QemuXXH64State *state, uint64_t seed)
+{
+    memset(state, 0, sizeof(*state));
+    state->seed = seed;
+    state->v[0] = seed + PRIME64_1 + PRIME64_2;
+    state->v[1] = seed + PRIME64_2;
+    state->v[2] = seed;
+    state->v[3] = seed - PRIME64_1;
+}
+
+void qemu_xxh64_update(QemuXXH64State *state, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+    size_t n;
+
+    state->total_len += len;
+
+    if (state->buf_len) {
+        n = MIN(len, sizeof(state->buf) - state->buf_len);
+        memcpy(state->buf + state->buf_len, p, n);
+        state->buf_len += n;
+        p += n;
+        len -= n;
+        if (state->buf_len < sizeof(state->buf)) {
+            return;
+        }
+        xxh64_stripes(state->v, state->buf, sizeof(state->buf));
+        state->buf_len = 0;
+    }
+
+    n = xxh64_stripes(state->v, p, len);
+    memcpy(state->buf, p + n, len - n);
+    state->buf_len = len - n;
+}
+
+uint64_t qemu_xxh64_digest(const QemuXXH64State *state)
+{
+    const uint8_t *p = state->buf;
+    size_t len = state->buf_len;
+    uint64_t h;
+
+    if (state->total_len >= 32) {
+        h = rol64(state->v[0], 1) + rol64(state->v[1], 7) +
+            rol64(state->v[2], 12) + rol64(state->v[3], 18);
+        h = xxh64_merge_round(h, state->v[0]);
+        h = xxh64_merge_round(h, state->v[1]);
+        h = xxh64_merge_round(h, state->v[2]);
+        h = xxh64_merge_round(h, state->v[3]);
+    } else {
+        h = state->seed + PRIME64_5;
+    }
+    h += state->total_len;
+
+    for (; len >= 8; p += 8, len -= 8) {
+        h ^= xxh64_round(0, ldq_le_p(p));
+        h = rol64(h, 27) * PRIME64_1 + PRIME64_4;
+    }
+    if (len >= 4) {
+        h ^= (uint64_t)(uint32_t)ldl_le_p(p) * PRIME64_1;
+        h = rol64(h, 23) * PRIME64_2 + PRIME64_3;
+        p += 4;
+        len -= 4;
+    }
+    for (; len; p++, len--) {
+        h ^= *p * PRIME64_5;
+        h = rol64(h, 11) * PRIME64_1;
+    }
+
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+uint64_t qemu_xxh64(uint64_t seed, const void *data, size_t len)
+{
+    QemuXXH64State state;
+
+    qemu_xxh64_init(&state, seed);
+    qemu_xxh64_update(&state, data, len);
+    return qemu_xxh64_digest(&state);
+}
+
+uint64_t iov_xxh64(uint64_t seed, const struct iovec *iov, size_t iov_cnt)
+{
+    QemuXXH64State state;
+
+    qemu_xxh64_init(&state, seed);
+    while (iov_cnt--) {
+        qemu_xxh64_update(&state, iov->iov_base, iov->iov_len);
+        iov++;
+    }
+    return qemu_xxh64_digest(&state);
+}